@@ -62,6 +62,12 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #define AST_NAME_STRLEN 256
 #define NUM_SPYGROUPS 128
 
+/*! \brief How long a spy that found nothing trusts the target feed before looking again anyway, in ms */
+#define SPY_RESCAN_INTERVAL 1000
+
+/*! \brief Buckets of the spy target container */
+#define SPY_TARGET_BUCKETS 563
+
 /*** DOCUMENTATION
 	<application name="ChanSpy" language="en_US">
 		<synopsis>
@@ -581,7 +587,7 @@ static void publish_chanspy_message(struct ast_channel *spyer,
 	if (!message) {
 		return;
 	}
-	stasis_publish(ast_channel_topic(spyer), message);
+	stasis_publish(ast_channel_topic_for_publish(spyer), message);
 }
 
 static int attach_barge(struct ast_autochan *spyee_autochan,
@@ -837,7 +843,256 @@ static int channel_spy(struct ast_channel *chan, struct ast_autochan *spyee_auto
 	return running;
 }
 
-static struct ast_autochan *next_channel(struct ast_channel_iterator *iter,
+/*!
+ * \brief Snapshots of the channels spies may pick, by unique ID
+ *
+ * Kept up to date from the channel cache, so that spies looking for a
+ * channel by extension, or for any channel, go through snapshots instead of
+ * walking and locking every channel of the system on each pass.
+ */
+static struct ao2_container *spy_targets;
+static struct stasis_subscription *spy_targets_sub;
+
+/*! \brief Bumped whenever a channel appears or changes name, extension or bridge */
+static int spy_targets_version;
+
+AO2_STRING_FIELD_HASH_FN(ast_channel_snapshot, uniqueid)
+AO2_STRING_FIELD_CMP_FN(ast_channel_snapshot, uniqueid)
+
+static void spy_targets_update(struct ast_channel_snapshot *old_snapshot,
+	struct ast_channel_snapshot *new_snapshot)
+{
+	ao2_lock(spy_targets);
+	if (old_snapshot) {
+		ao2_find(spy_targets, old_snapshot->uniqueid,
+			OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE | OBJ_NOLOCK);
+	}
+	if (new_snapshot) {
+		ao2_link_flags(spy_targets, new_snapshot, OBJ_NOLOCK);
+	}
+	ao2_unlock(spy_targets);
+
+	if (new_snapshot && (!old_snapshot
+		|| strcmp(old_snapshot->name, new_snapshot->name)
+		|| strcmp(old_snapshot->context, new_snapshot->context)
+		|| strcmp(old_snapshot->exten, new_snapshot->exten)
+		|| strcmp(old_snapshot->bridgeid, new_snapshot->bridgeid))) {
+		ast_atomic_fetchadd_int(&spy_targets_version, +1);
+	}
+}
+
+static void spy_targets_cb(void *data, struct stasis_subscription *sub,
+	struct stasis_message *message)
+{
+	struct stasis_cache_update *update;
+
+	if (stasis_message_type(message) != stasis_cache_update_type()) {
+		return;
+	}
+	update = stasis_message_data(message);
+	if (update->type != ast_channel_snapshot_type()) {
+		return;
+	}
+
+	spy_targets_update(update->old_snapshot ? stasis_message_data(update->old_snapshot) : NULL,
+		update->new_snapshot ? stasis_message_data(update->new_snapshot) : NULL);
+}
+
+/*! \brief Add the channels already up when the module loads */
+static void spy_targets_fill(void)
+{
+	struct ao2_container *cached;
+	struct ao2_iterator iter;
+	struct stasis_message *message;
+
+	cached = stasis_cache_dump(ast_channel_cache(), ast_channel_snapshot_type());
+	if (!cached) {
+		return;
+	}
+
+	iter = ao2_iterator_init(cached, 0);
+	for (; (message = ao2_iterator_next(&iter)); ao2_ref(message, -1)) {
+		struct ast_channel_snapshot *snapshot = stasis_message_data(message);
+
+		/* The subscription may have seen a newer snapshot already */
+		ao2_lock(spy_targets);
+		if (!ao2_find(spy_targets, snapshot->uniqueid, OBJ_SEARCH_KEY | OBJ_NODATA | OBJ_NOLOCK)) {
+			ao2_link_flags(spy_targets, snapshot, OBJ_NOLOCK);
+		}
+		ao2_unlock(spy_targets);
+	}
+	ao2_iterator_destroy(&iter);
+	ao2_ref(cached, -1);
+}
+
+/*! \brief What a spy looks for in the spy targets */
+struct spy_target_filter {
+	/*! Extension and context to match, or NULL for any */
+	const char *exten;
+	const char *context;
+	/*! Only bridged channels */
+	int bridged;
+};
+
+static int spy_target_match_cb(void *obj, void *arg, int flags)
+{
+	struct ast_channel_snapshot *snapshot = obj;
+	struct spy_target_filter *filter = arg;
+
+	if (filter->bridged && ast_strlen_zero(snapshot->bridgeid)) {
+		return 0;
+	}
+	/*
+	 * A channel in a macro matches on the extension the macro was called
+	 * from, which only the channel knows.  next_channel() checks.
+	 */
+	if (filter->exten && strncasecmp(snapshot->context, "macro-", 6)
+		&& (strcasecmp(snapshot->context, filter->context)
+			|| strcasecmp(snapshot->exten, filter->exten))) {
+		return 0;
+	}
+	return CMP_MATCH;
+}
+
+/*! \brief The channels a spy goes through in one pass */
+struct spy_iterator {
+	/*! Channels whose name matches, when spying by name */
+	struct ast_channel_iterator *by_name;
+	/*! Matching spy targets otherwise, NULL for an empty pass */
+	struct ao2_iterator *targets;
+	/*! Extension and context the channels must be at, or NULL for any */
+	const char *exten;
+	const char *context;
+};
+
+static struct spy_iterator *spy_iterator_destroy(struct spy_iterator *iter)
+{
+	if (iter->by_name) {
+		ast_channel_iterator_destroy(iter->by_name);
+	}
+	if (iter->targets) {
+		ao2_iterator_destroy(iter->targets);
+	}
+	ast_free(iter);
+
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Start a pass over the channels whose name matches
+ */
+static struct spy_iterator *spy_iterator_by_name(const char *name, size_t name_len)
+{
+	struct spy_iterator *iter = ast_calloc(1, sizeof(*iter));
+
+	if (!iter) {
+		return NULL;
+	}
+	iter->by_name = ast_channel_iterator_by_name_new(name, name_len);
+	if (!iter->by_name) {
+		return spy_iterator_destroy(iter);
+	}
+	return iter;
+}
+
+/*!
+ * \internal
+ * \brief Start a pass over the spy targets at an extension, or all of them
+ *
+ * \param exten Extension to match, or NULL for any channel
+ * \param context Context of the extension
+ * \param bridged Only bridged channels
+ * \param found_any Whether the last pass spied on a channel
+ * \param version Version of the spy targets the last full pass saw, updated
+ * \param last_scan When the last full pass started, updated
+ *
+ * A spy that found nothing to spy on has nothing new to find until a
+ * channel appears or changes, so the pass is left empty then.  It still
+ * looks again every SPY_RESCAN_INTERVAL, for changes the channel cache does
+ * not show such as SPYGROUP being set or another spy leaving a channel.
+ */
+static struct spy_iterator *spy_iterator_targets(const char *exten, const char *context,
+	int bridged, int found_any, int *version, struct timeval *last_scan)
+{
+	struct spy_iterator *iter = ast_calloc(1, sizeof(*iter));
+	struct spy_target_filter filter = {
+		.exten = exten,
+		.context = context,
+		.bridged = bridged,
+	};
+	struct timeval now = ast_tvnow();
+	int current = spy_targets_version;
+
+	if (!iter) {
+		return NULL;
+	}
+	iter->exten = exten;
+	iter->context = context;
+
+	if (!found_any && current == *version && ast_tvdiff_ms(now, *last_scan) < SPY_RESCAN_INTERVAL) {
+		return iter;
+	}
+	*version = current;
+	*last_scan = now;
+
+	iter->targets = ao2_callback(spy_targets, OBJ_MULTIPLE, spy_target_match_cb, &filter);
+	if (!iter->targets) {
+		return spy_iterator_destroy(iter);
+	}
+	return iter;
+}
+
+/*! \brief Whether a channel is at an extension, as ast_channel_iterator_by_exten_new() finds them */
+static int spy_exten_match(struct ast_channel *chan, const char *exten, const char *context)
+{
+	int match;
+
+	ast_channel_lock(chan);
+	match = (!strcasecmp(ast_channel_context(chan), context)
+			|| !strcasecmp(ast_channel_macrocontext(chan), context))
+		&& (!strcasecmp(ast_channel_exten(chan), exten)
+			|| !strcasecmp(ast_channel_macroexten(chan), exten));
+	ast_channel_unlock(chan);
+
+	return match;
+}
+
+/*!
+ * \internal
+ * \brief Get the next channel of a pass
+ */
+static struct ast_channel *spy_iterator_next(struct spy_iterator *iter)
+{
+	struct ast_channel_snapshot *snapshot;
+	struct ast_channel *next;
+
+	if (iter->by_name) {
+		return ast_channel_iterator_next(iter->by_name);
+	}
+	if (!iter->targets) {
+		return NULL;
+	}
+
+	for (; (snapshot = ao2_iterator_next(iter->targets)); ao2_ref(snapshot, -1)) {
+		next = ast_channel_get_by_name(snapshot->uniqueid);
+		if (!next) {
+			/* Gone, and its removal from the cache may not have been seen yet */
+			ao2_unlink(spy_targets, snapshot);
+			continue;
+		}
+		if (iter->exten && !spy_exten_match(next, iter->exten, iter->context)) {
+			ast_channel_unref(next);
+			continue;
+		}
+		ao2_ref(snapshot, -1);
+		return next;
+	}
+
+	return NULL;
+}
+
+static struct ast_autochan *next_channel(struct spy_iterator *iter,
 	struct ast_channel *chan)
 {
 	struct ast_channel *next;
@@ -848,7 +1103,7 @@ static struct ast_autochan *next_channel(struct ast_channel_iterator *iter,
 		return NULL;
 	}
 
-	for (; (next = ast_channel_iterator_next(iter)); ast_channel_unref(next)) {
+	for (; (next = spy_iterator_next(iter)); ast_channel_unref(next)) {
 		if (!strncmp(ast_channel_name(next), "DAHDI/pseudo", pseudo_len)
 			|| next == chan) {
 			continue;
@@ -882,7 +1137,9 @@ static int common_exec(struct ast_channel *chan, struct ast_flags *flags,
 	int waitms;
 	int res;
 	int num_spyed_upon = 1;
-	struct ast_channel_iterator *iter = NULL;
+	struct spy_iterator *iter = NULL;
+	int targets_version = 0;
+	struct timeval last_scan = { 0, };
 
 	if (ast_test_flag(flags, OPTION_EXIT)) {
 		const char *c;
@@ -937,15 +1194,15 @@ static int common_exec(struct ast_channel *chan, struct ast_flags *flags,
 					res = -1;
 					goto exit;
 				}
-				iter = ast_channel_iterator_by_name_new(ast_channel_name(unique_chan), 0);
+				iter = spy_iterator_by_name(ast_channel_name(unique_chan), 0);
 				ast_channel_unref(unique_chan);
 			} else {
-				iter = ast_channel_iterator_by_name_new(spec, strlen(spec));
+				iter = spy_iterator_by_name(spec, strlen(spec));
 			}
-		} else if (!ast_strlen_zero(exten)) {
-			iter = ast_channel_iterator_by_exten_new(exten, context);
 		} else {
-			iter = ast_channel_iterator_all_new();
+			iter = spy_iterator_targets(S_OR(exten, NULL), context,
+				ast_test_flag(flags, OPTION_BRIDGED), num_spyed_upon,
+				&targets_version, &last_scan);
 		}
 
 		if (!iter) {
@@ -955,7 +1212,7 @@ static int common_exec(struct ast_channel *chan, struct ast_flags *flags,
 
 		res = ast_waitfordigit(chan, waitms);
 		if (res < 0) {
-			iter = ast_channel_iterator_destroy(iter);
+			iter = spy_iterator_destroy(iter);
 			ast_channel_clear_flag(chan, AST_FLAG_SPYING);
 			break;
 		}
@@ -964,7 +1221,7 @@ static int common_exec(struct ast_channel *chan, struct ast_flags *flags,
 			tmp[0] = res;
 			tmp[1] = '\0';
 			if (!ast_goto_if_exists(chan, exitcontext, tmp, 1)) {
-				iter = ast_channel_iterator_destroy(iter);
+				iter = spy_iterator_destroy(iter);
 				goto exit;
 			} else {
 				ast_debug(2, "Exit by single digit did not work in chanspy. Extension %s does not exist in context %s\n", tmp, exitcontext);
@@ -1132,12 +1389,12 @@ static int common_exec(struct ast_channel *chan, struct ast_flags *flags,
 
 			if (res == -1) {
 				ast_autochan_destroy(autochan);
-				iter = ast_channel_iterator_destroy(iter);
+				iter = spy_iterator_destroy(iter);
 				goto exit;
 			} else if (res == -2) {
 				res = 0;
 				ast_autochan_destroy(autochan);
-				iter = ast_channel_iterator_destroy(iter);
+				iter = spy_iterator_destroy(iter);
 				goto exit;
 			} else if (res > 1 && spec && !ast_test_flag(flags, OPTION_UNIQUEID)) {
 				struct ast_channel *next;
@@ -1160,12 +1417,12 @@ static int common_exec(struct ast_channel *chan, struct ast_flags *flags,
 				}
 			} else if (res == 0 && ast_test_flag(flags, OPTION_EXITONHANGUP)) {
 				ast_autochan_destroy(autochan);
-				iter = ast_channel_iterator_destroy(iter);
+				iter = spy_iterator_destroy(iter);
 				goto exit;
 			}
 		}
 
-		iter = ast_channel_iterator_destroy(iter);
+		iter = spy_iterator_destroy(iter);
 
 		if (res == -1 || ast_check_hangup(chan))
 			break;
@@ -1469,6 +1726,10 @@ static int unload_module(void)
 	res |= ast_unregister_application(app_ext);
 	res |= ast_unregister_application(app_dahdiscan);
 
+	spy_targets_sub = stasis_unsubscribe_and_join(spy_targets_sub);
+	ao2_cleanup(spy_targets);
+	spy_targets = NULL;
+
 	return res;
 }
 
@@ -1476,6 +1737,19 @@ static int load_module(void)
 {
 	int res = 0;
 
+	spy_targets = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, SPY_TARGET_BUCKETS,
+		ast_channel_snapshot_hash_fn, NULL, ast_channel_snapshot_cmp_fn);
+	if (!spy_targets) {
+		return AST_MODULE_LOAD_DECLINE;
+	}
+	spy_targets_sub = stasis_subscribe(ast_channel_topic_all_cached(), spy_targets_cb, NULL);
+	if (!spy_targets_sub) {
+		ao2_ref(spy_targets, -1);
+		spy_targets = NULL;
+		return AST_MODULE_LOAD_DECLINE;
+	}
+	spy_targets_fill();
+
 	res |= ast_register_application_xml(app_chan, chanspy_exec);
 	res |= ast_register_application_xml(app_ext, extenspy_exec);
 	res |= ast_register_application_xml(app_dahdiscan, dahdiscan_exec);
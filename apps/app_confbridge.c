@@ -72,6 +72,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/json.h"
 #include "asterisk/format_cache.h"
 #include "asterisk/taskprocessor.h"
+#include "asterisk/vector.h"
 
 /*** DOCUMENTATION
 	<application name="ConfBridge" language="en_US">
@@ -508,7 +509,7 @@ static void send_conf_stasis(struct confbridge_conference *conference, struct as
 	}
 
 	if (channel_topic) {
-		stasis_publish(ast_channel_topic(chan), msg);
+		stasis_publish(ast_channel_topic_for_publish(chan), msg);
 	} else {
 		stasis_publish(ast_bridge_topic(conference->bridge), msg);
 	}
@@ -903,7 +904,7 @@ static void handle_video_on_join(struct confbridge_conference *conference, struc
 
 		ao2_lock(conference);
 		/* see if anyone is already the video src */
-		AST_LIST_TRAVERSE(&conference->active_list, user, list) {
+		AST_DLLIST_TRAVERSE(&conference->active_list, user, list) {
 			if (user->chan == chan) {
 				continue;
 			}
@@ -948,7 +949,7 @@ static void handle_video_on_exit(struct confbridge_conference *conference, struc
 
 	/* Make the next available marked user the video src.  */
 	ao2_lock(conference);
-	AST_LIST_TRAVERSE(&conference->active_list, user, list) {
+	AST_DLLIST_TRAVERSE(&conference->active_list, user, list) {
 		if (user->chan == chan) {
 			continue;
 		}
@@ -1310,7 +1311,7 @@ void conf_handle_first_join(struct confbridge_conference *conference)
 void conf_handle_second_active(struct confbridge_conference *conference)
 {
 	/* If we are the second participant we may need to stop music on hold on the first */
-	struct confbridge_user *first_user = AST_LIST_FIRST(&conference->active_list);
+	struct confbridge_user *first_user = AST_DLLIST_FIRST(&conference->active_list);
 
 	if (ast_test_flag(&first_user->u_profile, USER_OPT_MUSICONHOLD)) {
 		conf_moh_stop(first_user);
@@ -1715,6 +1716,12 @@ static int play_sound_helper(struct confbridge_conference *conference, const cha
 	}
 
 	playback_task_data_init(&ptd, conference, filename, say_number);
+
+	/* Sounds queued after this one may not be played before it */
+	ao2_lock(conference);
+	conference->queued_playback = NULL;
+	ao2_unlock(conference);
+
 	if (ast_taskprocessor_push(conference->playback_queue, playback_task, &ptd)) {
 		if (!ast_strlen_zero(filename)) {
 			ast_log(LOG_WARNING, "Unable to play file '%s' to conference %s\n",
@@ -1747,7 +1754,8 @@ int play_sound_file(struct confbridge_conference *conference, const char *filena
 struct async_playback_task_data {
 	struct confbridge_conference *conference;
 	int say_number;
-	struct ast_channel *initiator;
+	/*! Channels that queued the playback, which starts once they are ready */
+	AST_VECTOR(, struct ast_channel *) initiators;
 	char filename[0];
 };
 
@@ -1845,6 +1853,20 @@ static int setup_async_playback_datastore(struct ast_channel *initiator)
 	return 0;
 }
 
+/*!
+ * \brief Make an async playback wait for one more channel to be ready
+ *
+ * \note The datastore of the initiator must have been set up.
+ */
+static void async_playback_task_data_add_initiator(struct async_playback_task_data *aptd,
+	struct ast_channel *initiator)
+{
+	/* If this fails the sound may be clipped for the initiator, as above */
+	if (!AST_VECTOR_APPEND(&aptd->initiators, initiator)) {
+		ast_channel_ref(initiator);
+	}
+}
+
 static struct async_playback_task_data *async_playback_task_data_alloc(
 	struct confbridge_conference *conference, const char *filename, int say_number,
 	struct ast_channel *initiator)
@@ -1856,6 +1878,11 @@ static struct async_playback_task_data *async_playback_task_data_alloc(
 		return NULL;
 	}
 
+	if (AST_VECTOR_INIT(&aptd->initiators, initiator ? 1 : 0)) {
+		ast_free(aptd);
+		return NULL;
+	}
+
 	/* Safe */
 	strcpy(aptd->filename, filename);
 	aptd->say_number = say_number;
@@ -1876,16 +1903,15 @@ static struct async_playback_task_data *async_playback_task_data_alloc(
 	 */
 	aptd->conference = conference;
 
-	aptd->initiator = initiator;
 	if (initiator) {
-		ast_channel_ref(initiator);
-		ast_channel_lock(aptd->initiator);
+		ast_channel_lock(initiator);
 		/* We don't really care if this fails. If the datastore fails to get set up
 		 * we'll still play the announcement. It's possible that the sound will be
 		 * clipped for the initiator, but that's not the end of the world.
 		 */
-		setup_async_playback_datastore(aptd->initiator);
-		ast_channel_unlock(aptd->initiator);
+		setup_async_playback_datastore(initiator);
+		ast_channel_unlock(initiator);
+		async_playback_task_data_add_initiator(aptd, initiator);
 	}
 
 	return aptd;
@@ -1893,7 +1919,8 @@ static struct async_playback_task_data *async_playback_task_data_alloc(
 
 static void async_playback_task_data_destroy(struct async_playback_task_data *aptd)
 {
-	ast_channel_cleanup(aptd->initiator);
+	AST_VECTOR_CALLBACK_VOID(&aptd->initiators, ast_channel_unref);
+	AST_VECTOR_FREE(&aptd->initiators);
 	ast_free(aptd);
 }
 
@@ -1940,10 +1967,18 @@ static void wait_for_initiator(struct ast_channel *initiator)
 static int async_playback_task(void *data)
 {
 	struct async_playback_task_data *aptd = data;
+	int i;
+
+	/* Once started the playback can no longer be shared with a new request */
+	ao2_lock(aptd->conference);
+	if (aptd->conference->queued_playback == aptd) {
+		aptd->conference->queued_playback = NULL;
+	}
+	ao2_unlock(aptd->conference);
 
-	/* Wait for the initiator to get back in the bridge or be hung up */
-	if (aptd->initiator) {
-		wait_for_initiator(aptd->initiator);
+	/* Wait for the initiators to get back in the bridge or be hung up */
+	for (i = 0; i < AST_VECTOR_SIZE(&aptd->initiators); i++) {
+		wait_for_initiator(AST_VECTOR_GET(&aptd->initiators, i));
 	}
 
 	playback_common(aptd->conference, aptd->filename, aptd->say_number);
@@ -1956,6 +1991,7 @@ static int async_play_sound_helper(struct confbridge_conference *conference,
 	const char *filename, int say_number, struct ast_channel *initiator)
 {
 	struct async_playback_task_data *aptd;
+	struct async_playback_task_data *queued;
 
 	/* Do not waste resources trying to play files that do not exist */
 	if (ast_strlen_zero(filename)) {
@@ -1971,7 +2007,28 @@ static int async_play_sound_helper(struct confbridge_conference *conference,
 		return -1;
 	}
 
+	ao2_lock(conference);
+
+	/*
+	 * When many users join or leave at once they each queue the same sound.
+	 * If it is the last playback queued and has not started yet it plays
+	 * once for all of them instead.
+	 */
+	queued = conference->queued_playback;
+	if (queued && say_number < 0 && queued->say_number < 0
+		&& !strcmp(queued->filename, aptd->filename)) {
+		if (initiator) {
+			async_playback_task_data_add_initiator(queued, initiator);
+		}
+		ao2_unlock(conference);
+		ast_debug(3, "Sound '%s' is already queued for conference '%s'\n",
+			filename, conference->name);
+		async_playback_task_data_destroy(aptd);
+		return 0;
+	}
+
 	if (ast_taskprocessor_push(conference->playback_queue, async_playback_task, aptd)) {
+		ao2_unlock(conference);
 		if (!ast_strlen_zero(filename)) {
 			ast_log(LOG_WARNING, "Unable to play file '%s' to conference '%s'\n",
 				filename, conference->name);
@@ -1982,6 +2039,9 @@ static int async_play_sound_helper(struct confbridge_conference *conference,
 		async_playback_task_data_destroy(aptd);
 		return -1;
 	}
+	conference->queued_playback = aptd;
+
+	ao2_unlock(conference);
 
 	return 0;
 }
@@ -2533,7 +2593,7 @@ static int action_toggle_mute_participants(struct confbridge_conference *confere
 	mute = !conference->muted;
 	conference->muted = mute;
 
-	AST_LIST_TRAVERSE(&conference->active_list, cur_user, list) {
+	AST_DLLIST_TRAVERSE(&conference->active_list, cur_user, list) {
 		if (!ast_test_flag(&cur_user->u_profile, USER_OPT_ADMIN)) {
 			/* Set user level to bridge level mute request. */
 			cur_user->muted = mute;
@@ -2665,7 +2725,7 @@ static int action_kick_last(struct confbridge_conference *conference,
 	}
 
 	ao2_lock(conference);
-	if (((last_user = AST_LIST_LAST(&conference->active_list)) == user)
+	if (((last_user = AST_DLLIST_LAST(&conference->active_list)) == user)
 		|| (ast_test_flag(&last_user->u_profile, USER_OPT_ADMIN))) {
 		ao2_unlock(conference);
 		play_file(bridge_channel, NULL,
@@ -2859,7 +2919,7 @@ static int kick_conference_participant(struct confbridge_conference *conference,
 
 	SCOPED_AO2LOCK(bridge_lock, conference);
 
-	AST_LIST_TRAVERSE(&conference->active_list, user, list) {
+	AST_DLLIST_TRAVERSE(&conference->active_list, user, list) {
 		if (user->kicked) {
 			continue;
 		}
@@ -2875,7 +2935,7 @@ static int kick_conference_participant(struct confbridge_conference *conference,
 			}
 		}
 	}
-	AST_LIST_TRAVERSE(&conference->waiting_list, user, list) {
+	AST_DLLIST_TRAVERSE(&conference->waiting_list, user, list) {
 		if (user->kicked) {
 			continue;
 		}
@@ -2940,13 +3000,13 @@ static char *complete_confbridge_participant(const char *conference_name, const
 
 	{
 		SCOPED_AO2LOCK(bridge_lock, conference);
-		AST_LIST_TRAVERSE(&conference->active_list, user, list) {
+		AST_DLLIST_TRAVERSE(&conference->active_list, user, list) {
 			if (!strncasecmp(ast_channel_name(user->chan), word, wordlen) && ++which > state) {
 				res = ast_strdup(ast_channel_name(user->chan));
 				return res;
 			}
 		}
-		AST_LIST_TRAVERSE(&conference->waiting_list, user, list) {
+		AST_DLLIST_TRAVERSE(&conference->waiting_list, user, list) {
 			if (!strncasecmp(ast_channel_name(user->chan), word, wordlen) && ++which > state) {
 				res = ast_strdup(ast_channel_name(user->chan));
 				return res;
@@ -3098,10 +3158,10 @@ static char *handle_cli_confbridge_list(struct ast_cli_entry *e, int cmd, struct
 		ast_cli(a->fd, "Channel                        Flags  User Profile     Bridge Profile   Menu             CallerID\n");
 		ast_cli(a->fd, "============================== ====== ================ ================ ================ ================\n");
 		ao2_lock(conference);
-		AST_LIST_TRAVERSE(&conference->active_list, user, list) {
+		AST_DLLIST_TRAVERSE(&conference->active_list, user, list) {
 			handle_cli_confbridge_list_item(a, user, 0);
 		}
-		AST_LIST_TRAVERSE(&conference->waiting_list, user, list) {
+		AST_DLLIST_TRAVERSE(&conference->waiting_list, user, list) {
 			handle_cli_confbridge_list_item(a, user, 1);
 		}
 		ao2_unlock(conference);
@@ -3159,7 +3219,7 @@ static int generic_mute_unmute_helper(int mute, const char *conference_name,
 
 	{
 		SCOPED_AO2LOCK(bridge_lock, conference);
-		AST_LIST_TRAVERSE(&conference->active_list, user, list) {
+		AST_DLLIST_TRAVERSE(&conference->active_list, user, list) {
 			int match = !strncasecmp(chan_name, ast_channel_name(user->chan),
 				strlen(chan_name));
 			if (match || all
@@ -3172,7 +3232,7 @@ static int generic_mute_unmute_helper(int mute, const char *conference_name,
 			}
 		}
 
-		AST_LIST_TRAVERSE(&conference->waiting_list, user, list) {
+		AST_DLLIST_TRAVERSE(&conference->waiting_list, user, list) {
 			int match = !strncasecmp(chan_name, ast_channel_name(user->chan),
 				strlen(chan_name));
 			if (match || all
@@ -3436,9 +3496,18 @@ static struct ast_custom_function confbridge_info_function = {
 	.read = func_confbridge_info,
 };
 
-static void action_confbridgelist_item(struct mansession *s, const char *id_text, struct confbridge_conference *conference, struct confbridge_user *user, int waiting)
+/*! \brief What ConfbridgeList reports of a user, taken under the conference lock */
+struct confbridge_list_item {
+	struct ast_channel *chan;
+	unsigned int flags;
+	unsigned int waiting:1;
+	unsigned int muted:1;
+};
+
+static void action_confbridgelist_item(struct mansession *s, const char *id_text, struct confbridge_conference *conference, struct confbridge_list_item *item, struct ast_str **buf)
 {
-	astman_append(s,
+	ast_channel_lock(item->chan);
+	ast_str_set(buf, 0,
 		"Event: ConfbridgeList\r\n"
 		"%s"
 		"Conference: %s\r\n"
@@ -3455,16 +3524,28 @@ static void action_confbridgelist_item(struct mansession *s, const char *id_text
 		"\r\n",
 		id_text,
 		conference->name,
-		S_COR(ast_channel_caller(user->chan)->id.number.valid, ast_channel_caller(user->chan)->id.number.str, "<unknown>"),
-		S_COR(ast_channel_caller(user->chan)->id.name.valid, ast_channel_caller(user->chan)->id.name.str, "<no name>"),
-		ast_channel_name(user->chan),
-		ast_test_flag(&user->u_profile, USER_OPT_ADMIN) ? "Yes" : "No",
-		ast_test_flag(&user->u_profile, USER_OPT_MARKEDUSER) ? "Yes" : "No",
-		ast_test_flag(&user->u_profile, USER_OPT_WAITMARKED) ? "Yes" : "No",
-		ast_test_flag(&user->u_profile, USER_OPT_ENDMARKED) ? "Yes" : "No",
-		waiting ? "Yes" : "No",
-		user->muted ? "Yes" : "No",
-		ast_channel_get_up_time(user->chan));
+		S_COR(ast_channel_caller(item->chan)->id.number.valid, ast_channel_caller(item->chan)->id.number.str, "<unknown>"),
+		S_COR(ast_channel_caller(item->chan)->id.name.valid, ast_channel_caller(item->chan)->id.name.str, "<no name>"),
+		ast_channel_name(item->chan),
+		(item->flags & USER_OPT_ADMIN) ? "Yes" : "No",
+		(item->flags & USER_OPT_MARKEDUSER) ? "Yes" : "No",
+		(item->flags & USER_OPT_WAITMARKED) ? "Yes" : "No",
+		(item->flags & USER_OPT_ENDMARKED) ? "Yes" : "No",
+		item->waiting ? "Yes" : "No",
+		item->muted ? "Yes" : "No",
+		ast_channel_get_up_time(item->chan));
+	ast_channel_unlock(item->chan);
+
+	/* Writing to the manager session may block, so no lock is held */
+	astman_append(s, "%s", ast_str_buffer(*buf));
+}
+
+static void confbridge_list_item_set(struct confbridge_list_item *item, struct confbridge_user *user, int waiting)
+{
+	item->chan = ast_channel_ref(user->chan);
+	item->flags = user->u_profile.flags;
+	item->waiting = waiting;
+	item->muted = user->muted;
 }
 
 static int action_confbridgelist(struct mansession *s, const struct message *m)
@@ -3473,8 +3554,11 @@ static int action_confbridgelist(struct mansession *s, const struct message *m)
 	const char *conference_name = astman_get_header(m, "Conference");
 	struct confbridge_user *user;
 	struct confbridge_conference *conference;
+	struct confbridge_list_item *items;
+	struct ast_str *buf;
 	char id_text[80];
 	int total = 0;
+	int i;
 
 	id_text[0] = '\0';
 	if (!ast_strlen_zero(actionid)) {
@@ -3494,18 +3578,37 @@ static int action_confbridgelist(struct mansession *s, const struct message *m)
 		return 0;
 	}
 
-	astman_send_listack(s, m, "Confbridge user list will follow", "start");
-
+	/*
+	 * Only what is needed of each user is copied under the conference lock,
+	 * so users can join and leave while the list is written out.
+	 */
 	ao2_lock(conference);
-	AST_LIST_TRAVERSE(&conference->active_list, user, list) {
-		total++;
-		action_confbridgelist_item(s, id_text, conference, user, 0);
+	items = ast_malloc(sizeof(*items) * (conference->activeusers + conference->waitingusers + 1));
+	if (!items) {
+		ao2_unlock(conference);
+		ao2_ref(conference, -1);
+		astman_send_error(s, m, "Internal error while listing the conference.");
+		return 0;
+	}
+	AST_DLLIST_TRAVERSE(&conference->active_list, user, list) {
+		confbridge_list_item_set(&items[total++], user, 0);
 	}
-	AST_LIST_TRAVERSE(&conference->waiting_list, user, list) {
-		total++;
-		action_confbridgelist_item(s, id_text, conference, user, 1);
+	AST_DLLIST_TRAVERSE(&conference->waiting_list, user, list) {
+		confbridge_list_item_set(&items[total++], user, 1);
 	}
 	ao2_unlock(conference);
+
+	astman_send_listack(s, m, "Confbridge user list will follow", "start");
+
+	buf = ast_str_create(512);
+	for (i = 0; i < total; i++) {
+		if (buf) {
+			action_confbridgelist_item(s, id_text, conference, &items[i], &buf);
+		}
+		ast_channel_unref(items[i].chan);
+	}
+	ast_free(buf);
+	ast_free(items);
 	ao2_ref(conference, -1);
 
 	astman_send_list_complete_start(s, m, "ConfbridgeListComplete", total);
@@ -3777,7 +3880,7 @@ static int action_confbridgesetsinglevideosrc(struct mansession *s, const struct
 
 	/* find channel and set as video src. */
 	ao2_lock(conference);
-	AST_LIST_TRAVERSE(&conference->active_list, user, list) {
+	AST_DLLIST_TRAVERSE(&conference->active_list, user, list) {
 		if (!strncmp(channel, ast_channel_name(user->chan), strlen(channel))) {
 			ast_bridge_set_single_src_video_mode(conference->bridge, user->chan);
 			break;
@@ -3825,24 +3928,15 @@ static int func_confbridge_info(struct ast_channel *chan, const char *cmd, char
 	/* get the correct count for the type requested */
 	ao2_lock(conference);
 	if (!strcasecmp(args.type, "parties")) {
-		AST_LIST_TRAVERSE(&conference->active_list, user, list) {
-			count++;
-		}
-		AST_LIST_TRAVERSE(&conference->waiting_list, user, list) {
-			count++;
-		}
+		count = conference->activeusers + conference->waitingusers;
 	} else if (!strcasecmp(args.type, "admins")) {
-		AST_LIST_TRAVERSE(&conference->active_list, user, list) {
+		AST_DLLIST_TRAVERSE(&conference->active_list, user, list) {
 			if (ast_test_flag(&user->u_profile, USER_OPT_ADMIN)) {
 				count++;
 			}
 		}
 	} else if (!strcasecmp(args.type, "marked")) {
-		AST_LIST_TRAVERSE(&conference->active_list, user, list) {
-			if (ast_test_flag(&user->u_profile, USER_OPT_MARKEDUSER)) {
-				count++;
-			}
-		}
+		count = conference->markedusers;
 	} else if (!strcasecmp(args.type, "locked")) {
 		count = conference->locked;
 	} else if (!strcasecmp(args.type, "muted")) {
@@ -3858,39 +3952,39 @@ static int func_confbridge_info(struct ast_channel *chan, const char *cmd, char
 
 void conf_add_user_active(struct confbridge_conference *conference, struct confbridge_user *user)
 {
-	AST_LIST_INSERT_TAIL(&conference->active_list, user, list);
+	AST_DLLIST_INSERT_TAIL(&conference->active_list, user, list);
 	conference->activeusers++;
 }
 
 void conf_add_user_marked(struct confbridge_conference *conference, struct confbridge_user *user)
 {
-	AST_LIST_INSERT_TAIL(&conference->active_list, user, list);
+	AST_DLLIST_INSERT_TAIL(&conference->active_list, user, list);
 	conference->activeusers++;
 	conference->markedusers++;
 }
 
 void conf_add_user_waiting(struct confbridge_conference *conference, struct confbridge_user *user)
 {
-	AST_LIST_INSERT_TAIL(&conference->waiting_list, user, list);
+	AST_DLLIST_INSERT_TAIL(&conference->waiting_list, user, list);
 	conference->waitingusers++;
 }
 
 void conf_remove_user_active(struct confbridge_conference *conference, struct confbridge_user *user)
 {
-	AST_LIST_REMOVE(&conference->active_list, user, list);
+	AST_DLLIST_REMOVE(&conference->active_list, user, list);
 	conference->activeusers--;
 }
 
 void conf_remove_user_marked(struct confbridge_conference *conference, struct confbridge_user *user)
 {
-	AST_LIST_REMOVE(&conference->active_list, user, list);
+	AST_DLLIST_REMOVE(&conference->active_list, user, list);
 	conference->activeusers--;
 	conference->markedusers--;
 }
 
 void conf_mute_only_active(struct confbridge_conference *conference)
 {
-	struct confbridge_user *only_user = AST_LIST_FIRST(&conference->active_list);
+	struct confbridge_user *only_user = AST_DLLIST_FIRST(&conference->active_list);
 
 	/* Turn on MOH if the single participant is set up for it */
 	if (ast_test_flag(&only_user->u_profile, USER_OPT_MUSICONHOLD)) {
@@ -3901,7 +3995,7 @@ void conf_mute_only_active(struct confbridge_conference *conference)
 
 void conf_remove_user_waiting(struct confbridge_conference *conference, struct confbridge_user *user)
 {
-	AST_LIST_REMOVE(&conference->waiting_list, user, list);
+	AST_DLLIST_REMOVE(&conference->waiting_list, user, list);
 	conference->waitingusers--;
 }
 
@@ -68,6 +68,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/bridge_after.h"
 #include "asterisk/features_config.h"
 #include "asterisk/max_forwards.h"
+#include "asterisk/threadpool.h"
 
 /*** DOCUMENTATION
 	<application name="Dial" language="en_US">
@@ -805,6 +806,12 @@ struct chanlist {
 	/*! TRUE if an AST_CONTROL_CONNECTED_LINE update was saved to the connected element. */
 	unsigned int pending_connected_update:1;
 	struct ast_aoc_decoded *aoc_s_rate_list;
+	/*! Fan-out the channel is being requested or called by */
+	struct dial_fanout *fanout;
+	/*! Cause of a failed request of the channel */
+	int cause;
+	/*! Result of calling the channel */
+	int call_res;
 	/*! The interface, tech, and number strings are stuffed here. */
 	char stuff[0];
 };
@@ -839,7 +846,108 @@ static void hanguptree(struct dial_head *out_chans, struct ast_channel *exceptio
 	}
 }
 
-#define AST_MAX_WATCHERS 256
+/*! \brief Threads requesting and calling the destinations of a Dial */
+static struct ast_threadpool *dial_pool;
+
+/*!
+ * \brief Requests or calls to all destinations of a Dial
+ *
+ * Each destination is handed to the dial pool and the dialing channel waits
+ * for all of them, so the time taken is that of the slowest destination
+ * rather than the sum of them.
+ */
+struct dial_fanout {
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	/*! Destinations not done yet */
+	int pending;
+	/*! Channel the destinations are requested for */
+	struct ast_channel *requestor;
+	/*! Formats the destinations are requested with */
+	struct ast_format_cap *cap;
+};
+
+static void dial_fanout_done(struct dial_fanout *fanout)
+{
+	ast_mutex_lock(&fanout->lock);
+	if (!--fanout->pending) {
+		ast_cond_signal(&fanout->cond);
+	}
+	ast_mutex_unlock(&fanout->lock);
+}
+
+static int dial_request_task(void *data)
+{
+	struct chanlist *tmp = data;
+	struct dial_fanout *fanout = tmp->fanout;
+
+	tmp->chan = ast_request(tmp->tech, fanout->cap, NULL, fanout->requestor, tmp->number, &tmp->cause);
+	dial_fanout_done(fanout);
+	return 0;
+}
+
+static int dial_call_task(void *data)
+{
+	struct chanlist *tmp = data;
+	struct dial_fanout *fanout = tmp->fanout;
+
+	/* Place the call, but don't wait on the answer */
+	tmp->call_res = ast_call(tmp->chan, tmp->number, 0);
+	dial_fanout_done(fanout);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Run a task for every destination and wait for all of them
+ *
+ * A single destination, or one the pool could not take, is done by the
+ * dialing thread itself.
+ */
+static void dial_fanout_run(struct ast_channel *chan, struct dial_head *out_chans, int (*task)(void *data))
+{
+	struct dial_fanout fanout = {
+		.requestor = chan,
+	};
+	struct chanlist *first = AST_LIST_FIRST(out_chans);
+	struct chanlist *tmp;
+	int parallel = first && AST_LIST_NEXT(first, node) && dial_pool;
+
+	if (!first) {
+		return;
+	}
+
+	ast_channel_lock(chan);
+	fanout.cap = ao2_bump(ast_channel_nativeformats(chan));
+	ast_channel_unlock(chan);
+
+	ast_mutex_init(&fanout.lock);
+	ast_cond_init(&fanout.cond, NULL);
+
+	AST_LIST_TRAVERSE(out_chans, tmp, node) {
+		tmp->fanout = &fanout;
+		ast_mutex_lock(&fanout.lock);
+		++fanout.pending;
+		ast_mutex_unlock(&fanout.lock);
+		if (!parallel || ast_threadpool_push(dial_pool, task, tmp)) {
+			task(tmp);
+		}
+	}
+
+	ast_mutex_lock(&fanout.lock);
+	while (fanout.pending) {
+		ast_cond_wait(&fanout.cond, &fanout.lock);
+	}
+	ast_mutex_unlock(&fanout.lock);
+
+	AST_LIST_TRAVERSE(out_chans, tmp, node) {
+		tmp->fanout = NULL;
+	}
+
+	ast_mutex_destroy(&fanout.lock);
+	ast_cond_destroy(&fanout.cond);
+	ao2_cleanup(fanout.cap);
+}
 
 /*
  * argument to handle_cause() and other functions.
@@ -1200,6 +1308,9 @@ static struct ast_channel *wait_for_answer(struct ast_channel *in,
 	int cc_frame_received = 0;
 	int num_ringing = 0;
 	struct timeval start = ast_tvnow();
+	struct chanlist *watched;
+	RAII_VAR(struct ast_channel **, watchers, NULL, ast_free);
+	int max_watchers = 1;
 
 	if (single) {
 		/* Turn off hold music, etc */
@@ -1227,6 +1338,18 @@ static struct ast_channel *wait_for_answer(struct ast_channel *in,
 
 	is_cc_recall = ast_cc_is_recall(in, &cc_recall_core_id, NULL);
 
+	/* Forwarding replaces the channel of a destination, never adds one */
+	AST_LIST_TRAVERSE(out_chans, watched, node) {
+		++max_watchers;
+	}
+	watchers = ast_malloc(max_watchers * sizeof(*watchers));
+	if (!watchers) {
+		*to = -1;
+		strcpy(pa->status, "CONGESTION");
+		publish_dial_end_event(in, out_chans, NULL, pa->status);
+		return NULL;
+	}
+
 #ifdef HAVE_EPOLL
 	AST_LIST_TRAVERSE(out_chans, epollo, node) {
 		ast_poll_channel_add(in, epollo->chan);
@@ -1238,7 +1361,6 @@ static struct ast_channel *wait_for_answer(struct ast_channel *in,
 		int pos = 0; /* how many channels do we handle */
 		int numlines = prestart;
 		struct ast_channel *winner;
-		struct ast_channel *watchers[AST_MAX_WATCHERS];
 
 		watchers[pos++] = in;
 		AST_LIST_TRAVERSE(out_chans, o, node) {
@@ -2454,13 +2576,11 @@ static int dial_exec_full(struct ast_channel *chan, const char *data, struct ast
 	/* loop through the list of dial destinations */
 	rest = args.peers;
 	while ((cur = strsep(&rest, "&")) ) {
-		struct ast_channel *tc; /* channel for this destination */
 		/* Get a technology/resource pair */
 		char *number = cur;
 		char *tech = strsep(&number, "/");
 		size_t tech_len;
 		size_t number_len;
-		struct ast_format_cap *nativeformats;
 
 		num_dialed++;
 		if (ast_strlen_zero(number)) {
@@ -2501,8 +2621,6 @@ static int dial_exec_full(struct ast_channel *chan, const char *data, struct ast
 			ast_set2_flag64(tmp, args.url, DIAL_NOFORWARDHTML);
 		}
 
-		/* Request the peer */
-
 		ast_channel_lock(chan);
 		/*
 		 * Seed the chanlist's connected line information with previously
@@ -2511,21 +2629,24 @@ static int dial_exec_full(struct ast_channel *chan, const char *data, struct ast
 		 * through the CONNECTED_LINE dialplan function.
 		 */
 		ast_party_connected_line_copy(&tmp->connected, ast_channel_connected(chan));
-
-		nativeformats = ao2_bump(ast_channel_nativeformats(chan));
-
 		ast_channel_unlock(chan);
 
-		tc = ast_request(tmp->tech, nativeformats, NULL, chan, tmp->number, &cause);
+		AST_LIST_INSERT_TAIL(&out_chans, tmp, node);
+	}
+
+	/* Request the peers */
+	dial_fanout_run(chan, &out_chans, dial_request_task);
 
-		ao2_cleanup(nativeformats);
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&out_chans, tmp, node) {
+		struct ast_channel *tc = tmp->chan; /* channel for this destination */
 
 		if (!tc) {
 			/* If we can't, just go on to the next call */
+			cause = tmp->cause;
 			ast_log(LOG_WARNING, "Unable to create channel of type '%s' (cause %d - %s)\n",
 				tmp->tech, cause, ast_cause2str(cause));
 			handle_cause(cause, &num);
-			if (!rest) {
+			if (!AST_LIST_NEXT(tmp, node)) {
 				/* we are on the last destination */
 				ast_channel_hangupcause_set(chan, cause);
 			}
@@ -2534,6 +2655,7 @@ static int dial_exec_full(struct ast_channel *chan, const char *data, struct ast
 					ast_cc_extension_monitor_add_dialstring(chan, tmp->interface, "");
 				}
 			}
+			AST_LIST_REMOVE_CURRENT(node);
 			chanlist_free(tmp);
 			continue;
 		}
@@ -2549,7 +2671,8 @@ static int dial_exec_full(struct ast_channel *chan, const char *data, struct ast
 		pbx_builtin_setvar_helper(tc, "DIALEDPEERNUMBER", tmp->number);
 
 		/* Setup outgoing SDP to match incoming one */
-		if (!AST_LIST_FIRST(&out_chans) && !rest && CAN_EARLY_BRIDGE(peerflags, chan, tc)) {
+		if (AST_LIST_FIRST(&out_chans) == tmp && !AST_LIST_NEXT(tmp, node)
+			&& CAN_EARLY_BRIDGE(peerflags, chan, tc)) {
 			/* We are on the only destination. */
 			ast_rtp_instance_early_bridge_make_compatible(tc, chan);
 		}
@@ -2654,11 +2777,8 @@ static int dial_exec_full(struct ast_channel *chan, const char *data, struct ast
 
 		ast_channel_unlock(tc);
 		ast_channel_unlock(chan);
-
-		/* Put channel in the list of outgoing thingies. */
-		tmp->chan = tc;
-		AST_LIST_INSERT_TAIL(&out_chans, tmp, node);
 	}
+	AST_LIST_TRAVERSE_SAFE_END;
 
 	/*
 	 * PREDIAL: Run gosub on all of the callee channels
@@ -2690,8 +2810,10 @@ static int dial_exec_full(struct ast_channel *chan, const char *data, struct ast
 	}
 
 	/* Start all outgoing calls */
+	dial_fanout_run(chan, &out_chans, dial_call_task);
+
 	AST_LIST_TRAVERSE_SAFE_BEGIN(&out_chans, tmp, node) {
-		res = ast_call(tmp->chan, tmp->number, 0); /* Place the call, but don't wait on the answer */
+		res = tmp->call_res;
 		ast_channel_lock(chan);
 
 		/* check the results of ast_call */
@@ -3376,13 +3498,26 @@ static int unload_module(void)
 	res = ast_unregister_application(app);
 	res |= ast_unregister_application(rapp);
 
+	ast_threadpool_shutdown(dial_pool);
+	dial_pool = NULL;
+
 	return res;
 }
 
 static int load_module(void)
 {
+	struct ast_threadpool_options options = {
+		.version = AST_THREADPOOL_OPTIONS_VERSION,
+		.idle_timeout = 60,
+		.auto_increment = 4,
+		.initial_size = 0,
+		.max_size = 32,
+	};
 	int res;
 
+	/* Without the pool the destinations are requested and called one at a time */
+	dial_pool = ast_threadpool_create("app_dial", NULL, &options);
+
 	res = ast_register_application_xml(app, dial_exec);
 	res |= ast_register_application_xml(rapp, retrydial_exec);
 
@@ -126,6 +126,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 					<option name="P">
 						<para>Play a beep on the channel that stops the recording.</para>
 					</option>
+					<option name="S">
+						<para>Sync the recording files to storage when the recording ends.</para>
+					</option>
 					<option name="m">
 						<argument name="mailbox" required="true" />
 						<para>Create a copy of the recording as a voicemail in the indicated <emphasis>mailbox</emphasis>(es)
@@ -333,7 +336,8 @@ enum mixmonitor_flags {
 	MUXFLAG_VMRECIPIENTS = (1 << 10),
 	MUXFLAG_BEEP = (1 << 11),
 	MUXFLAG_BEEP_START = (1 << 12),
-	MUXFLAG_BEEP_STOP = (1 << 13)
+	MUXFLAG_BEEP_STOP = (1 << 13),
+	MUXFLAG_SYNC = (1 << 14)
 };
 
 enum mixmonitor_args {
@@ -354,6 +358,7 @@ AST_APP_OPTIONS(mixmonitor_opts, {
 	AST_APP_OPTION_ARG('B', MUXFLAG_BEEP, OPT_ARG_BEEP_INTERVAL),
 	AST_APP_OPTION('p', MUXFLAG_BEEP_START),
 	AST_APP_OPTION('P', MUXFLAG_BEEP_STOP),
+	AST_APP_OPTION('S', MUXFLAG_SYNC),
 	AST_APP_OPTION_ARG('v', MUXFLAG_READVOLUME, OPT_ARG_READVOLUME),
 	AST_APP_OPTION_ARG('V', MUXFLAG_WRITEVOLUME, OPT_ARG_WRITEVOLUME),
 	AST_APP_OPTION_ARG('W', MUXFLAG_VOLUME, OPT_ARG_VOLUME),
@@ -611,7 +616,10 @@ static void mixmonitor_save_prep(struct mixmonitor *mixmonitor, char *filename,
 				*ext = "raw";
 			}
 
-			if (!(*fs = ast_writefile(filename, *ext, NULL, *oflags, 0, 0666))) {
+			/* Writes are made by the file writer threads, so that slow
+			 * storage does not hold up reading the audiohook */
+			if (!(*fs = ast_writefile_async(filename, *ext, NULL, *oflags, 0666,
+				ast_test_flag(mixmonitor, MUXFLAG_SYNC) ? AST_WRITEFILE_SYNC : 0))) {
 				ast_log(LOG_ERROR, "Cannot open %s.%s\n", filename, *ext);
 				*errflag = 1;
 			} else {
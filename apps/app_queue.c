@@ -1554,6 +1554,14 @@ struct penalty_rule {
 #define ANNOUNCEPOSITION_MORE_THAN 3 /*!< We say "Currently there are more than <limit>" */
 #define ANNOUNCEPOSITION_LIMIT 4 /*!< We not announce position more than <limit> */
 
+/*!
+ * \brief Number of member selection time histogram buckets
+ *
+ * Bucket n counts the selections that took less than 2^n microseconds and
+ * the last bucket counts all the slower ones.
+ */
+#define QUEUE_SELECTION_BUCKETS 20
+
 struct call_queue {
 	AST_DECLARE_STRING_FIELDS(
 		/*! Queue name */
@@ -1648,7 +1656,11 @@ struct call_queue {
 	int memberdelay;                    /*!< Seconds to delay connecting member to caller */
 	int autofill;                       /*!< Ignore the head call status and ring an available agent */
 
+	unsigned int selections;            /*!< Number of times members were chosen for a caller */
+	unsigned int selection_usecs[QUEUE_SELECTION_BUCKETS]; /*!< Member selection time histogram */
+
 	struct ao2_container *members;             /*!< Head of the list of members */
+	struct queue_member_snapshot *member_snapshot; /*!< Members to ring, protected by the members container lock */
 	struct queue_ent *head;             /*!< Head of the list of callers */
 	AST_LIST_ENTRY(call_queue) list;    /*!< Next call queue */
 	AST_LIST_HEAD_NOLOCK(, penalty_rule) rules; /*!< The list of penalty rules to invoke */
@@ -2131,7 +2143,7 @@ static void queue_publish_multi_channel_blob(struct ast_channel *caller, struct
 		return;
 	}
 
-	queue_publish_multi_channel_snapshot_blob(ast_channel_topic(caller), caller_snapshot,
+	queue_publish_multi_channel_snapshot_blob(ast_channel_topic_for_publish(caller), caller_snapshot,
 			agent_snapshot, type, blob);
 }
 
@@ -2691,7 +2703,8 @@ static void init_queue(struct call_queue *q)
 			/* linear strategy depends on order, so we have to place all members in a single bucket */
 			q->members = ao2_container_alloc(1, member_hash_fn, member_cmp_fn);
 		} else {
-			q->members = ao2_container_alloc(37, member_hash_fn, member_cmp_fn);
+			q->members = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX,
+				AO2_CONTAINER_ALLOC_OPT_AUTO_RESIZE, 37, member_hash_fn, NULL, member_cmp_fn);
 		}
 	}
 	q->found = 1;
@@ -2743,6 +2756,8 @@ static void clear_queue(struct call_queue *q)
 	q->callsabandoned = 0;
 	q->callscompletedinsl = 0;
 	q->talktime = 0;
+	q->selections = 0;
+	memset(q->selection_usecs, 0, sizeof(q->selection_usecs));
 
 	if (q->members) {
 		struct member *mem;
@@ -3199,6 +3214,81 @@ static void queue_set_param(struct call_queue *q, const char *param, const char
 #define QUEUE_UNPAUSED_DEVSTATE AST_DEVICE_NOT_INUSE
 #define QUEUE_UNKNOWN_PAUSED_DEVSTATE AST_DEVICE_NOT_INUSE
 
+/*!
+ * \brief The members of a queue at one point in time.
+ *
+ * The snapshot never changes once built so callers can walk it to start
+ * their call attempts without holding the queue lock.  It is thrown away
+ * whenever a member is added to or removed from the queue.  Member fields
+ * such as the penalty and status are read from the members themselves so
+ * they are always current.
+ */
+struct queue_member_snapshot {
+	/*! Number of members */
+	size_t count;
+	/*! The members, each holding a reference */
+	struct member *members[0];
+};
+
+static void queue_member_snapshot_destroy(void *obj)
+{
+	struct queue_member_snapshot *snapshot = obj;
+	size_t i;
+
+	for (i = 0; i < snapshot->count; ++i) {
+		ao2_ref(snapshot->members[i], -1);
+	}
+}
+
+/*! \internal
+ * \brief Get the member snapshot of a queue, building it if needed.
+ * \param queue The queue to get the snapshot of
+ * \return The snapshot with a reference for the caller
+ * \retval NULL on allocation failure
+ */
+static struct queue_member_snapshot *queue_member_snapshot_get(struct call_queue *queue)
+{
+	struct queue_member_snapshot *snapshot;
+	struct ao2_iterator mem_iter;
+	struct member *mem;
+	size_t max;
+
+	ao2_lock(queue->members);
+	snapshot = queue->member_snapshot;
+	if (!snapshot) {
+		max = ao2_container_count(queue->members);
+		snapshot = ao2_alloc_options(sizeof(*snapshot) + max * sizeof(snapshot->members[0]),
+			queue_member_snapshot_destroy, AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!snapshot) {
+			ao2_unlock(queue->members);
+			return NULL;
+		}
+		mem_iter = ao2_iterator_init(queue->members, 0);
+		while (snapshot->count < max && (mem = ao2_iterator_next(&mem_iter))) {
+			/* Place the reference for mem into the snapshot. */
+			snapshot->members[snapshot->count++] = mem;
+		}
+		ao2_iterator_destroy(&mem_iter);
+		queue->member_snapshot = snapshot;
+	}
+	ao2_ref(snapshot, +1);
+	ao2_unlock(queue->members);
+
+	return snapshot;
+}
+
+/*! \internal
+ * \brief Throw away the member snapshot of a queue after its members change.
+ * \param queue The queue whose members changed
+ */
+static void queue_member_snapshot_invalidate(struct call_queue *queue)
+{
+	ao2_lock(queue->members);
+	ao2_cleanup(queue->member_snapshot);
+	queue->member_snapshot = NULL;
+	ao2_unlock(queue->members);
+}
+
 /*! \internal
  * \brief If adding a single new member to a queue, use this function instead of ao2_linking.
  *        This adds round robin queue position data for a fresh member as well as links it.
@@ -3210,6 +3300,7 @@ static void member_add_to_queue(struct call_queue *queue, struct member *mem)
 	ao2_lock(queue->members);
 	mem->queuepos = ao2_container_count(queue->members);
 	ao2_link(queue->members, mem);
+	queue_member_snapshot_invalidate(queue);
 	ast_devstate_changed(mem->paused ? QUEUE_PAUSED_DEVSTATE : QUEUE_UNPAUSED_DEVSTATE,
 		AST_DEVSTATE_CACHABLE, "Queue:%s_pause_%s", queue->name, mem->interface);
 	ao2_unlock(queue->members);
@@ -3228,6 +3319,7 @@ static void member_remove_from_queue(struct call_queue *queue, struct member *me
 	ast_devstate_changed(QUEUE_UNKNOWN_PAUSED_DEVSTATE, AST_DEVSTATE_CACHABLE, "Queue:%s_pause_%s", queue->name, mem->interface);
 	queue_member_follower_removal(queue, mem);
 	ao2_unlink(queue->members, mem);
+	queue_member_snapshot_invalidate(queue);
 	ao2_unlock(queue->members);
 }
 
@@ -3350,6 +3442,7 @@ static void destroy_queue(void *obj)
 	int i;
 
 	free_members(q, 1);
+	ao2_cleanup(q->member_snapshot);
 	ast_string_field_free_memory(q);
 	for (i = 0; i < MAX_PERIODIC_ANNOUNCEMENTS; i++) {
 		if (q->sound_periodicannounce[i]) {
@@ -4429,20 +4522,72 @@ static int ring_entry(struct queue_ent *qe, struct callattempt *tmp, int *busies
 	return 1;
 }
 
-/*! \brief find the entry with the best metric, or NULL */
+/*!
+ * \brief Order call attempts by metric, best first
+ *
+ * The sort is stable so attempts with the same metric keep the order they
+ * were added in.
+ *
+ * \param outgoing The list of call attempts
+ * \return The head of the sorted list
+ */
+static struct callattempt *sort_callattempts(struct callattempt *outgoing)
+{
+	struct callattempt *left;
+	struct callattempt *right;
+	struct callattempt *slow;
+	struct callattempt *fast;
+	struct callattempt *head = NULL;
+	struct callattempt **tail = &head;
+
+	if (!outgoing || !outgoing->q_next) {
+		return outgoing;
+	}
+
+	/* Split the list in half */
+	slow = outgoing;
+	for (fast = outgoing->q_next; fast && fast->q_next; fast = fast->q_next->q_next) {
+		slow = slow->q_next;
+	}
+	right = slow->q_next;
+	slow->q_next = NULL;
+
+	left = sort_callattempts(outgoing);
+	right = sort_callattempts(right);
+
+	while (left && right) {
+		if (left->metric <= right->metric) {
+			*tail = left;
+			left = left->q_next;
+		} else {
+			*tail = right;
+			right = right->q_next;
+		}
+		tail = &(*tail)->q_next;
+	}
+	*tail = left ? left : right;
+
+	return head;
+}
+
+/*!
+ * \brief find the entry with the best metric, or NULL
+ *
+ * \note The list is sorted by metric so the first entry still to be
+ * tried is the best.
+ */
 static struct callattempt *find_best(struct callattempt *outgoing)
 {
-	struct callattempt *best = NULL, *cur;
+	struct callattempt *cur;
 
 	for (cur = outgoing; cur; cur = cur->q_next) {
 		if (cur->stillgoing &&					/* Not already done */
-			!cur->chan &&					/* Isn't already going */
-			(!best || cur->metric < best->metric)) {		/* We haven't found one yet, or it's better */
-			best = cur;
+			!cur->chan) {					/* Isn't already going */
+			return cur;
 		}
 	}
 
-	return best;
+	return NULL;
 }
 
 /*!
@@ -4468,8 +4613,8 @@ static int ring_one(struct queue_ent *qe, struct callattempt *outgoing, int *bus
 		if (qe->parent->strategy == QUEUE_STRATEGY_RINGALL) {
 			struct callattempt *cur;
 			/* Ring everyone who shares this best metric (for ringall) */
-			for (cur = outgoing; cur; cur = cur->q_next) {
-				if (cur->stillgoing && !cur->chan && cur->metric <= best->metric) {
+			for (cur = best; cur && cur->metric <= best->metric; cur = cur->q_next) {
+				if (cur->stillgoing && !cur->chan) {
 					ast_debug(1, "(Parallel) Trying '%s' with metric %d\n", cur->interface, cur->metric);
 					ret |= ring_entry(qe, cur, busies);
 				}
@@ -5496,7 +5641,7 @@ static int update_queue(struct call_queue *q, struct member *member, int callcom
 			ao2_lock(qtmp);
 			if ((mem = ao2_find(qtmp->members, member, OBJ_POINTER))) {
 				time(&mem->lastcall);
-				mem->calls++;
+				ast_atomic_fetchadd_int(&mem->calls, +1);
 				mem->callcompletedinsl = 0;
 				mem->starttime = 0;
 				mem->lastqueue = q;
@@ -5507,13 +5652,12 @@ static int update_queue(struct call_queue *q, struct member *member, int callcom
 		}
 		ao2_iterator_destroy(&queue_iter);
 	} else {
-		ao2_lock(q);
+		/* Only this member changes so the queue need not be locked. */
 		time(&member->lastcall);
 		member->callcompletedinsl = 0;
-		member->calls++;
+		ast_atomic_fetchadd_int(&member->calls, +1);
 		member->starttime = 0;
 		member->lastqueue = q;
-		ao2_unlock(q);
 	}
 	/* Member might never experience any direct status change (local
 	 * channel with forwarding in particular). If that's the case,
@@ -5538,18 +5682,79 @@ static int update_queue(struct call_queue *q, struct member *member, int callcom
 	return 0;
 }
 
+/*!
+ * \brief Record how long it took to choose the members to ring for a caller
+ *
+ * \note The queue must be locked.
+ */
+static void queue_record_selection(struct call_queue *q, int64_t usecs)
+{
+	int bucket = 0;
+
+	while (bucket < QUEUE_SELECTION_BUCKETS - 1 && usecs >= (1LL << bucket)) {
+		++bucket;
+	}
+	++q->selection_usecs[bucket];
+	++q->selections;
+}
+
+/*!
+ * \brief Estimate a member selection time percentile from the histogram
+ *
+ * \note The queue must be locked.
+ *
+ * \return The upper bound, in microseconds, of the bucket holding the percentile
+ * \retval -1 if the percentile falls in the last, unbounded, bucket
+ */
+static long queue_selection_percentile(const struct call_queue *q, unsigned int percent)
+{
+	unsigned long long wanted = ((unsigned long long) q->selections * percent + 99) / 100;
+	unsigned long long seen = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < QUEUE_SELECTION_BUCKETS - 1; ++bucket) {
+		seen += q->selection_usecs[bucket];
+		if (seen >= wanted) {
+			return 1L << bucket;
+		}
+	}
+
+	return -1;
+}
+
+/*!
+ * \brief Format a member selection time percentile for queue show
+ */
+static const char *queue_selection_percentile_str(const struct call_queue *q, unsigned int percent,
+	char *buf, size_t size)
+{
+	long usecs = queue_selection_percentile(q, percent);
+
+	if (usecs < 0) {
+		snprintf(buf, size, ">=%ldus", 1L << (QUEUE_SELECTION_BUCKETS - 1));
+	} else {
+		snprintf(buf, size, "<%ldus", usecs);
+	}
+
+	return buf;
+}
+
 /*! \brief Calculate the metric of each member in the outgoing callattempts
  *
  * A numeric metric is given to each member depending on the ring strategy used
  * by the queue. Members with lower metrics will be called before members with
  * higher metrics
+ *
+ * \note This is called without the queue locked, so the queue values it needs
+ * are passed in and the round robin wrap is handed back through \a wrapped.
+ *
  * \retval -1 if penalties are exceeded
  * \retval 0 otherwise
  */
-static int calc_metric(struct call_queue *q, struct member *mem, int pos, struct queue_ent *qe, struct callattempt *tmp)
+static int calc_metric(struct call_queue *q, struct member *mem, int pos, struct queue_ent *qe, struct callattempt *tmp,
+	int membercount, int rrpos, int *wrapped)
 {
 	/* disregarding penalty on too few members? */
-	int membercount = ao2_container_count(q->members);
 	unsigned char usepenalty = (membercount <= q->penaltymemberslimit) ? 0 : 1;
 
 	if (usepenalty) {
@@ -5582,12 +5787,12 @@ static int calc_metric(struct call_queue *q, struct member *mem, int pos, struct
 	case QUEUE_STRATEGY_RRORDERED:
 	case QUEUE_STRATEGY_RRMEMORY:
 		pos = mem->queuepos;
-		if (pos < q->rrpos) {
+		if (pos < rrpos) {
 			tmp->metric = 1000 + pos;
 		} else {
-			if (pos > q->rrpos) {
+			if (pos > rrpos) {
 				/* Indicate there is another priority */
-				q->wrapped = 1;
+				*wrapped = 1;
 			}
 			tmp->metric = pos;
 		}
@@ -6502,7 +6707,12 @@ static int try_calling(struct queue_ent *qe, struct ast_flags opts, char **opt_a
 	char tmpid[256];
 	int forwardsallowed = 1;
 	int block_connected_line = 0;
-	struct ao2_iterator memi;
+	struct queue_member_snapshot *members = NULL;
+	size_t i;
+	int rrpos;
+	int wrapped = 0;
+	struct timeval selection_start;
+	int64_t selection_usecs;
 	struct queue_end_bridge *queue_end_bridge = NULL;
 	int callcompletedinsl;
 	time_t starttime;
@@ -6590,13 +6800,22 @@ static int try_calling(struct queue_ent *qe, struct ast_flags opts, char **opt_a
 		announce = announceoverride;
 	}
 
-	memi = ao2_iterator_init(qe->parent->members, 0);
-	while ((cur = ao2_iterator_next(&memi))) {
+	/* Walk the member snapshot with the queue unlocked so other callers of
+	 * this queue are not held up while our call attempts are set up. */
+	selection_start = ast_tvnow();
+	members = queue_member_snapshot_get(qe->parent);
+	if (!members) {
+		ao2_unlock(qe->parent);
+		goto out;
+	}
+	rrpos = qe->parent->rrpos;
+	ao2_unlock(qe->parent);
+
+	for (i = 0; i < members->count; ++i) {
 		struct callattempt *tmp = ast_calloc(1, sizeof(*tmp));
+
+		cur = members->members[i];
 		if (!tmp) {
-			ao2_ref(cur, -1);
-			ao2_iterator_destroy(&memi);
-			ao2_unlock(qe->parent);
 			goto out;
 		}
 
@@ -6612,13 +6831,14 @@ static int try_calling(struct queue_ent *qe, struct ast_flags opts, char **opt_a
 
 		tmp->block_connected_update = block_connected_line;
 		tmp->stillgoing = 1;
+		ao2_ref(cur, +1);
 		tmp->member = cur;/* Place the reference for cur into callattempt. */
 		tmp->lastcall = cur->lastcall;
 		tmp->lastqueue = cur->lastqueue;
 		ast_copy_string(tmp->interface, cur->interface, sizeof(tmp->interface));
 		/* Special case: If we ring everyone, go ahead and ring them, otherwise
 		   just calculate their metric for the appropriate strategy */
-		if (!calc_metric(qe->parent, cur, x++, qe, tmp)) {
+		if (!calc_metric(qe->parent, cur, x++, qe, tmp, members->count, rrpos, &wrapped)) {
 			/* Put them in the list of outgoing thingies...  We're ready now.
 			   XXX If we're forcibly removed, these outgoing calls won't get
 			   hung up XXX */
@@ -6631,7 +6851,16 @@ static int try_calling(struct queue_ent *qe, struct ast_flags opts, char **opt_a
 			callattempt_free(tmp);
 		}
 	}
-	ao2_iterator_destroy(&memi);
+	ao2_ref(members, -1);
+	members = NULL;
+	outgoing = sort_callattempts(outgoing);
+	selection_usecs = ast_tvdiff_us(ast_tvnow(), selection_start);
+
+	ao2_lock(qe->parent);
+	if (wrapped) {
+		qe->parent->wrapped = 1;
+	}
+	queue_record_selection(qe->parent, selection_usecs);
 
 	if (qe->parent->timeoutpriority == TIMEOUT_PRIORITY_APP) {
 		/* Application arguments have higher timeout priority (behaviour for <=1.6) */
@@ -6977,6 +7206,7 @@ static int try_calling(struct queue_ent *qe, struct ast_flags opts, char **opt_a
 		ao2_ref(member, -1);
 	}
 out:
+	ao2_cleanup(members);
 	hangupcalls(qe, outgoing, NULL, qe->cancel_answered_elsewhere);
 
 	return res;
@@ -8891,6 +9121,7 @@ static void reload_single_member(const char *memberdata, struct call_queue *q)
 			newm->queuepos = cur->queuepos;
 			ao2_link(q->members, newm);
 			ao2_unlink(q->members, cur);
+			queue_member_snapshot_invalidate(q);
 			ao2_unlock(q->members);
 		} else {
 			/* Otherwise we need to add using the function that will apply a round robin queue position manually. */
@@ -9032,6 +9263,7 @@ static void reload_single_queue(struct ast_config *cfg, struct ast_flags *mask,
 		ao2_lock(q->members);
 		ao2_callback(q->members, OBJ_NODATA | OBJ_MULTIPLE, queue_delme_members_decrement_followers, q);
 		ao2_callback(q->members, OBJ_NODATA | OBJ_MULTIPLE | OBJ_UNLINK, kill_dead_members, q);
+		queue_member_snapshot_invalidate(q);
 		ao2_unlock(q->members);
 	}
 
@@ -9179,13 +9411,24 @@ static int reload_handler(int reload, struct ast_flags *mask, const char *queuen
 	return res;
 }
 
-/*! \brief direct ouput to manager or cli with proper terminator */
-static void do_print(struct mansession *s, int fd, const char *str)
+/*! \brief add output for manager or cli with proper terminator */
+static void do_print(struct mansession *s, struct ast_str **output, const char *str)
+{
+	ast_str_append(output, 0, "%s%s", str, s ? "\r\n" : "\n");
+}
+
+/*!
+ * \brief direct output added by do_print() to manager or cli
+ *
+ * \note Writing may block on a slow console, so no lock may be held.
+ */
+static void do_print_flush(struct mansession *s, int fd, struct ast_str **output)
 {
 	if (s) {
-		astman_append(s, "%s\r\n", str);
+		astman_append(s, "%s", ast_str_buffer(*output));
+		ast_str_reset(*output);
 	} else {
-		ast_cli(fd, "%s\n", str);
+		ast_cli_flush(fd, output);
 	}
 }
 
@@ -9199,6 +9442,7 @@ static char *__queues_show(struct mansession *s, int fd, int argc, const char *
 {
 	struct call_queue *q;
 	struct ast_str *out = ast_str_alloca(512);
+	RAII_VAR(struct ast_str *, output, ast_str_create(1024), ast_free);
 	int found = 0;
 	time_t now = time(NULL);
 	struct ao2_iterator queue_iter;
@@ -9208,6 +9452,10 @@ static char *__queues_show(struct mansession *s, int fd, int argc, const char *
 		return CLI_SHOWUSAGE;
 	}
 
+	if (!output) {
+		return CLI_FAILURE;
+	}
+
 	if (argc == 3)	{ /* specific queue */
 		if ((q = find_load_queue_rt_friendly(argv[2]))) {
 			queue_t_unref(q, "Done with temporary pointer");
@@ -9229,13 +9477,20 @@ static char *__queues_show(struct mansession *s, int fd, int argc, const char *
 		}
 	}
 
-	ao2_lock(queues);
-	queue_iter = ao2_iterator_init(queues, AO2_ITERATOR_DONTLOCK);
+	/*
+	 * Neither the container nor a queue is locked while output is written,
+	 * so a slow console does not hold up calls.
+	 */
+	queue_iter = ao2_iterator_init(queues, 0);
 	while ((q = ao2_t_iterator_next(&queue_iter, "Iterate through queues"))) {
 		float sl;
 		struct call_queue *realtime_queue = NULL;
 
-		ao2_lock(q);
+		if (argc == 3 && strcasecmp(q->name, argv[2])) {
+			queue_t_unref(q, "Done with iterator");
+			continue;
+		}
+
 		/* This check is to make sure we don't print information for realtime
 		 * queues which have been deleted from realtime but which have not yet
 		 * been deleted from the in-core container. Only do this if we're not
@@ -9244,18 +9499,13 @@ static char *__queues_show(struct mansession *s, int fd, int argc, const char *
 		if (argc < 3 && q->realtime) {
 			realtime_queue = find_load_queue_rt_friendly(q->name);
 			if (!realtime_queue) {
-				ao2_unlock(q);
 				queue_t_unref(q, "Done with iterator");
 				continue;
 			}
 			queue_t_unref(realtime_queue, "Queue is already in memory");
 		}
 
-		if (argc == 3 && strcasecmp(q->name, argv[2])) {
-			ao2_unlock(q);
-			queue_t_unref(q, "Done with iterator");
-			continue;
-		}
+		ao2_lock(q);
 		found = 1;
 
 		ast_str_set(&out, 0, "%s has %d calls (max ", q->name, q->count);
@@ -9271,13 +9521,25 @@ static char *__queues_show(struct mansession *s, int fd, int argc, const char *
 		ast_str_append(&out, 0, ") in '%s' strategy (%ds holdtime, %ds talktime), W:%d, C:%d, A:%d, SL:%2.1f%% within %ds",
 			int2strat(q->strategy), q->holdtime, q->talktime, q->weight,
 			q->callscompleted, q->callsabandoned,sl,q->servicelevel);
-		do_print(s, fd, ast_str_buffer(out));
+		do_print(s, &output, ast_str_buffer(out));
+		if (q->selections) {
+			char p50[16];
+			char p90[16];
+			char p99[16];
+
+			ast_str_set(&out, 0, "   Member selection: %u times, 50%% %s, 90%% %s, 99%% %s",
+				q->selections,
+				queue_selection_percentile_str(q, 50, p50, sizeof(p50)),
+				queue_selection_percentile_str(q, 90, p90, sizeof(p90)),
+				queue_selection_percentile_str(q, 99, p99, sizeof(p99)));
+			do_print(s, &output, ast_str_buffer(out));
+		}
 		if (!ao2_container_count(q->members)) {
-			do_print(s, fd, "   No Members");
+			do_print(s, &output, "   No Members");
 		} else {
 			struct member *mem;
 
-			do_print(s, fd, "   Members: ");
+			do_print(s, &output, "   Members: ");
 			mem_iter = ao2_iterator_init(q->members, 0);
 			while ((mem = ao2_iterator_next(&mem_iter))) {
 				ast_str_set(&out, 0, "      %s", mem->membername);
@@ -9310,38 +9572,39 @@ static char *__queues_show(struct mansession *s, int fd, int argc, const char *
 				} else {
 					ast_str_append(&out, 0, " has taken no calls yet");
 				}
-				do_print(s, fd, ast_str_buffer(out));
+				do_print(s, &output, ast_str_buffer(out));
 				ao2_ref(mem, -1);
 			}
 			ao2_iterator_destroy(&mem_iter);
 		}
 		if (!q->head) {
-			do_print(s, fd, "   No Callers");
+			do_print(s, &output, "   No Callers");
 		} else {
 			struct queue_ent *qe;
 			int pos = 1;
 
-			do_print(s, fd, "   Callers: ");
+			do_print(s, &output, "   Callers: ");
 			for (qe = q->head; qe; qe = qe->next) {
 				ast_str_set(&out, 0, "      %d. %s (wait: %ld:%2.2ld, prio: %d)",
 					pos++, ast_channel_name(qe->chan), (long) (now - qe->start) / 60,
 					(long) (now - qe->start) % 60, qe->prio);
-				do_print(s, fd, ast_str_buffer(out));
+				do_print(s, &output, ast_str_buffer(out));
 			}
 		}
-		do_print(s, fd, "");	/* blank line between entries */
+		do_print(s, &output, "");	/* blank line between entries */
 		ao2_unlock(q);
 		queue_t_unref(q, "Done with iterator"); /* Unref the iterator's reference */
+		do_print_flush(s, fd, &output);
 	}
 	ao2_iterator_destroy(&queue_iter);
-	ao2_unlock(queues);
 	if (!found) {
 		if (argc == 3) {
 			ast_str_set(&out, 0, "No such queue: %s.", argv[2]);
 		} else {
 			ast_str_set(&out, 0, "No queues.");
 		}
-		do_print(s, fd, ast_str_buffer(out));
+		do_print(s, &output, ast_str_buffer(out));
+		do_print_flush(s, fd, &output);
 	}
 	return CLI_SUCCESS;
 }
@@ -5976,12 +5976,144 @@ static int messagecount(const char *mailbox_id, const char *folder)
 	return __has_voicemail(context, mailbox, folder, 0) + (folder && strcmp(folder, "INBOX") ? 0 : __has_voicemail(context, mailbox, "Urgent", 0));
 }
 
-static int __has_voicemail(const char *context, const char *mailbox, const char *folder, int shortcircuit)
+/*!
+ * \brief Message count of a folder, as of its modification time
+ *
+ * Adding, renaming or removing a message file updates the modification time
+ * of its folder, whether Asterisk or something else did it.  So a count stays
+ * valid as long as the folder's modification time is unchanged, and checking
+ * that takes a stat() instead of reading the whole directory.
+ */
+struct folder_count {
+	/*! Modification time of the folder when it was counted */
+	time_t mtime;
+	/*! When the folder was counted */
+	time_t counted;
+	/*! Number of messages */
+	int messages;
+	/*! Whether the folder holds any message file at all */
+	int any;
+	/*! Path of the folder */
+	char path[0];
+};
+
+/*! \brief Folder counts by path */
+static struct ao2_container *folder_counts;
+
+#define FOLDER_COUNT_BUCKETS 1021
+
+static int folder_count_hash_fn(const void *obj, const int flags)
+{
+	const char *key;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_KEY:
+		key = obj;
+		break;
+	case OBJ_SEARCH_OBJECT:
+		key = ((const struct folder_count *) obj)->path;
+		break;
+	default:
+		ast_assert(0);
+		return 0;
+	}
+	return ast_str_hash(key);
+}
+
+static int folder_count_cmp_fn(void *obj, void *arg, int flags)
+{
+	const struct folder_count *left = obj;
+	const char *right_key = arg;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+		right_key = ((const struct folder_count *) arg)->path;
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		return strcmp(left->path, right_key) ? 0 : CMP_MATCH;
+	default:
+		return 0;
+	}
+}
+
+/*!
+ * \internal
+ * \brief Count the messages of a folder, reading it only if it changed
+ *
+ * \param path The folder
+ * \param[out] any Whether the folder holds any message file at all
+ *
+ * \return Number of messages
+ */
+static int count_folder(const char *path, int *any)
 {
+	struct folder_count *count;
+	struct stat st;
 	DIR *dir;
 	struct dirent *de;
+	int messages = 0;
+	time_t counted;
+
+	*any = 0;
+	if (stat(path, &st)) {
+		return 0;
+	}
+
+	count = folder_counts ? ao2_find(folder_counts, path, OBJ_SEARCH_KEY) : NULL;
+	if (count) {
+		/*
+		 * The modification time only has a one second resolution, so a
+		 * change made in the second the folder was counted could go
+		 * unnoticed.  Counts from such a second are not trusted.
+		 */
+		if (count->mtime == st.st_mtime && count->mtime < count->counted) {
+			messages = count->messages;
+			*any = count->any;
+			ao2_ref(count, -1);
+			return messages;
+		}
+		ao2_ref(count, -1);
+	}
+
+	counted = time(NULL);
+	if (!(dir = opendir(path))) {
+		return 0;
+	}
+	while ((de = readdir(dir))) {
+		if (!strncasecmp(de->d_name, "msg", 3)) {
+			*any = 1;
+			if (!strncasecmp(de->d_name + 8, "txt", 3)) {
+				messages++;
+			}
+		}
+	}
+	closedir(dir);
+
+	if (!folder_counts) {
+		return messages;
+	}
+	count = ao2_alloc_options(sizeof(*count) + strlen(path) + 1, NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (count) {
+		count->mtime = st.st_mtime;
+		count->counted = counted;
+		count->messages = messages;
+		count->any = *any;
+		strcpy(count->path, path); /* Safe */
+		ao2_lock(folder_counts);
+		ao2_find(folder_counts, path, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA | OBJ_NOLOCK);
+		ao2_link_flags(folder_counts, count, OBJ_NOLOCK);
+		ao2_unlock(folder_counts);
+		ao2_ref(count, -1);
+	}
+
+	return messages;
+}
+
+static int __has_voicemail(const char *context, const char *mailbox, const char *folder, int shortcircuit)
+{
 	char fn[256];
-	int ret = 0;
+	int messages;
+	int any;
 
 	/* If no mailbox, return immediately */
 	if (ast_strlen_zero(mailbox))
@@ -5994,23 +6126,9 @@ static int __has_voicemail(const char *context, const char *mailbox, const char
 
 	snprintf(fn, sizeof(fn), "%s%s/%s/%s", VM_SPOOL_DIR, context, mailbox, folder);
 
-	if (!(dir = opendir(fn)))
-		return 0;
-
-	while ((de = readdir(dir))) {
-		if (!strncasecmp(de->d_name, "msg", 3)) {
-			if (shortcircuit) {
-				ret = 1;
-				break;
-			} else if (!strncasecmp(de->d_name + 8, "txt", 3)) {
-				ret++;
-			}
-		}
-	}
-
-	closedir(dir);
+	messages = count_folder(fn, &any);
 
-	return ret;
+	return shortcircuit ? any : messages;
 }
 
 /** 
@@ -14939,6 +15057,10 @@ static int unload_module(void)
 
 	if (poll_thread != AST_PTHREADT_NULL)
 		stop_poll_thread();
+#if !(defined(IMAP_STORAGE) || defined(ODBC_STORAGE))
+	ao2_cleanup(folder_counts);
+	folder_counts = NULL;
+#endif
 
 	mwi_subscription_tps = ast_taskprocessor_unreference(mwi_subscription_tps);
 	ast_unload_realtime("voicemail");
@@ -14975,6 +15097,15 @@ static int load_module(void)
 	if (!(inprocess_container = ao2_container_alloc(573, inprocess_hash_fn, inprocess_cmp_fn))) {
 		return AST_MODULE_LOAD_DECLINE;
 	}
+#if !(defined(IMAP_STORAGE) || defined(ODBC_STORAGE))
+	folder_counts = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX,
+		AO2_CONTAINER_ALLOC_OPT_AUTO_RESIZE, FOLDER_COUNT_BUCKETS,
+		folder_count_hash_fn, NULL, folder_count_cmp_fn);
+	if (!folder_counts) {
+		ao2_ref(inprocess_container, -1);
+		return AST_MODULE_LOAD_DECLINE;
+	}
+#endif
 
 	/* compute the location of the voicemail spool directory */
 	snprintf(VM_SPOOL_DIR, sizeof(VM_SPOOL_DIR), "%s/voicemail/", ast_config_AST_SPOOL_DIR);
@@ -86,14 +86,14 @@ static void leave_marked(struct confbridge_user *user)
 	conf_remove_user_marked(user->conference, user);
 
 	if (user->conference->markedusers == 0) {
-		AST_LIST_TRAVERSE_SAFE_BEGIN(&user->conference->active_list, user_iter, list) {
+		AST_DLLIST_TRAVERSE_SAFE_BEGIN(&user->conference->active_list, user_iter, list) {
 			/* Kick ENDMARKED cbu_iters */
 			if (ast_test_flag(&user_iter->u_profile, USER_OPT_ENDMARKED) && !user_iter->kicked) {
 				if (ast_test_flag(&user_iter->u_profile, USER_OPT_WAITMARKED)
 					&& !ast_test_flag(&user_iter->u_profile, USER_OPT_MARKEDUSER)) {
-					AST_LIST_REMOVE_CURRENT(list);
+					AST_DLLIST_REMOVE_CURRENT(list);
 					user_iter->conference->activeusers--;
-					AST_LIST_INSERT_TAIL(&user_iter->conference->waiting_list, user_iter, list);
+					AST_DLLIST_INSERT_TAIL(&user_iter->conference->waiting_list, user_iter, list);
 					user_iter->conference->waitingusers++;
 				}
 				user_iter->kicked = 1;
@@ -103,9 +103,9 @@ static void leave_marked(struct confbridge_user *user)
 				&& !ast_test_flag(&user_iter->u_profile, USER_OPT_MARKEDUSER)) {
 				need_prompt = 1;
 
-				AST_LIST_REMOVE_CURRENT(list);
+				AST_DLLIST_REMOVE_CURRENT(list);
 				user_iter->conference->activeusers--;
-				AST_LIST_INSERT_TAIL(&user_iter->conference->waiting_list, user_iter, list);
+				AST_DLLIST_INSERT_TAIL(&user_iter->conference->waiting_list, user_iter, list);
 				user_iter->conference->waitingusers++;
 			} else {
 				/* User is neither wait_marked nor end_marked; however, they
@@ -114,7 +114,7 @@ static void leave_marked(struct confbridge_user *user)
 				need_prompt = 1;
 			}
 		}
-		AST_LIST_TRAVERSE_SAFE_END;
+		AST_DLLIST_TRAVERSE_SAFE_END;
 	}
 
 	switch (user->conference->activeusers) {
@@ -165,7 +165,7 @@ static void leave_marked(struct confbridge_user *user)
 				NULL);
 		}
 
-		AST_LIST_TRAVERSE(&user->conference->waiting_list, user_iter, list) {
+		AST_DLLIST_TRAVERSE(&user->conference->waiting_list, user_iter, list) {
 			if (user_iter->kicked) {
 				continue;
 			}
@@ -196,10 +196,10 @@ static void transition_to_marked(struct confbridge_user *user)
 	int waitmarked_moved = 0;
 
 	/* Move all waiting users to active, stopping MOH and unmuting if necessary */
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&user->conference->waiting_list, user_iter, list) {
-		AST_LIST_REMOVE_CURRENT(list);
+	AST_DLLIST_TRAVERSE_SAFE_BEGIN(&user->conference->waiting_list, user_iter, list) {
+		AST_DLLIST_REMOVE_CURRENT(list);
 		user->conference->waitingusers--;
-		AST_LIST_INSERT_TAIL(&user->conference->active_list, user_iter, list);
+		AST_DLLIST_INSERT_TAIL(&user->conference->active_list, user_iter, list);
 		user->conference->activeusers++;
 		if (user_iter->playing_moh) {
 			conf_moh_stop(user_iter);
@@ -207,7 +207,7 @@ static void transition_to_marked(struct confbridge_user *user)
 		conf_update_user_mute(user_iter);
 		waitmarked_moved++;
 	}
-	AST_LIST_TRAVERSE_SAFE_END;
+	AST_DLLIST_TRAVERSE_SAFE_END;
 
 	/* Play the audio file stating that the conference is beginning */
 	if (user->conference->markedusers == 1
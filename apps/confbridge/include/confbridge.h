@@ -25,6 +25,7 @@
 #include "asterisk/app.h"
 #include "asterisk/logger.h"
 #include "asterisk/linkedlists.h"
+#include "asterisk/dlinkedlists.h"
 #include "asterisk/channel.h"
 #include "asterisk/bridge.h"
 #include "asterisk/bridge_features.h"
@@ -210,6 +211,8 @@ struct bridge_profile {
 	char regcontext[AST_MAX_CONTEXT];
 };
 
+struct async_playback_task_data;
+
 /*! \brief The structure that represents a conference bridge */
 struct confbridge_conference {
 	char name[MAX_CONF_NAME];                                         /*!< Name of the conference bridge */
@@ -225,9 +228,10 @@ struct confbridge_conference {
 	struct ast_channel *record_chan;                                  /*!< Channel used for recording the conference */
 	struct ast_str *record_filename;                                  /*!< Recording filename. */
 	struct ast_str *orig_rec_file;                                    /*!< Previous b_profile.rec_file. */
-	AST_LIST_HEAD_NOLOCK(, confbridge_user) active_list;              /*!< List of users participating in the conference bridge */
-	AST_LIST_HEAD_NOLOCK(, confbridge_user) waiting_list;             /*!< List of users waiting to join the conference bridge */
+	AST_DLLIST_HEAD_NOLOCK(, confbridge_user) active_list;            /*!< List of users participating in the conference bridge */
+	AST_DLLIST_HEAD_NOLOCK(, confbridge_user) waiting_list;           /*!< List of users waiting to join the conference bridge */
 	struct ast_taskprocessor *playback_queue;                         /*!< Queue for playing back bridge announcements and managing the announcer channel */
+	struct async_playback_task_data *queued_playback;                 /*!< Last announcement queued to playback_queue that has not started */
 };
 
 extern struct ao2_container *conference_bridges;
@@ -252,7 +256,7 @@ struct confbridge_user {
 	unsigned int kicked:1;                       /*!< User has been kicked from the conference */
 	unsigned int playing_moh:1;                  /*!< MOH is currently being played to the user */
 	AST_LIST_HEAD_NOLOCK(, post_join_action) post_join_list; /*!< List of sounds to play after joining */;
-	AST_LIST_ENTRY(confbridge_user) list;        /*!< Linked list information */
+	AST_DLLIST_ENTRY(confbridge_user) list;      /*!< Linked list information */
 };
 
 /*! \brief load confbridge.conf file */
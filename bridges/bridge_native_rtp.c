@@ -85,6 +85,13 @@ struct native_rtp_bridge_channel_data {
 	struct ast_rtp_glue *remote_cb;
 	/*! \brief Channel's cached RTP glue information */
 	struct rtp_glue_data glue;
+	/*!
+	 * \brief Slot of the channel's file descriptors holding the audio RTP
+	 * socket while the RTP engine reads it, -1 if none
+	 */
+	int hidden_fd_slot;
+	/*! \brief Audio RTP socket that was in hidden_fd_slot */
+	int hidden_fd;
 };
 
 static void rtp_glue_data_init(struct rtp_glue_data *glue)
@@ -133,10 +140,92 @@ static struct native_rtp_bridge_channel_data *native_rtp_bridge_channel_data_all
 	data = ast_calloc(1, sizeof(*data));
 	if (data) {
 		rtp_glue_data_init(&data->glue);
+		data->hidden_fd_slot = -1;
 	}
 	return data;
 }
 
+/*!
+ * \internal
+ * \brief Stop a channel polling its audio RTP socket if the RTP engine reads it while locally bridged
+ *
+ * \note The channel must be locked.
+ */
+static void native_rtp_bridge_hide_fd(struct ast_channel *chan, struct native_rtp_bridge_channel_data *data)
+{
+	int fd;
+	int slot;
+
+	if (data->hidden_fd_slot != -1
+		|| !ast_rtp_instance_local_bridge_reads(data->glue.audio.instance)) {
+		return;
+	}
+
+	fd = ast_rtp_instance_fd(data->glue.audio.instance, 0);
+	if (fd < 0) {
+		return;
+	}
+
+	for (slot = 0; slot < AST_MAX_FDS; ++slot) {
+		if (ast_channel_fd(chan, slot) == fd) {
+			ast_debug(2, "Channel '%s' no longer polls RTP socket %d while locally bridged\n",
+				ast_channel_name(chan), fd);
+			data->hidden_fd_slot = slot;
+			data->hidden_fd = fd;
+			ast_channel_set_fd(chan, slot, -1);
+			return;
+		}
+	}
+}
+
+/*!
+ * \internal
+ * \brief Have a channel poll its audio RTP socket again
+ *
+ * \note The channel must be locked.
+ */
+static void native_rtp_bridge_restore_fd(struct ast_channel *chan, struct native_rtp_bridge_channel_data *data)
+{
+	if (data->hidden_fd_slot == -1) {
+		return;
+	}
+
+	/* Unless the channel driver set up its file descriptors again meanwhile */
+	if (ast_channel_fd(chan, data->hidden_fd_slot) == -1) {
+		ast_channel_set_fd(chan, data->hidden_fd_slot, data->hidden_fd);
+	}
+	data->hidden_fd_slot = -1;
+}
+
+/*!
+ * \internal
+ * \brief Check if the DTMF hooks of a channel can still see its digits when natively bridged
+ *
+ * Locally bridged RFC2833 digits can be given to the core while the audio
+ * is relayed.  Other DTMF modes, or remote bridging, would hide them.
+ */
+static int native_rtp_bridge_dtmf_tappable(enum ast_rtp_glue_result native_type, struct rtp_glue_data *glue)
+{
+	return native_type == AST_RTP_GLUE_RESULT_LOCAL
+		&& ast_rtp_instance_dtmf_mode_get(glue->audio.instance) == AST_RTP_DTMF_MODE_RFC2833;
+}
+
+/*!
+ * \internal
+ * \brief Have the RTP engine give a locally bridged channel's DTMF to the core if it has DTMF hooks
+ *
+ * \note The channel must be locked.
+ */
+static void native_rtp_bridge_tap_dtmf(struct ast_bridge_channel *bridge_channel, struct rtp_glue_data *glue)
+{
+	if (ao2_container_count(bridge_channel->features->dtmf_hooks)
+		&& native_rtp_bridge_dtmf_tappable(AST_RTP_GLUE_RESULT_LOCAL, glue)) {
+		ast_debug(2, "Channel '%s' DTMF goes through the core for its DTMF hooks while locally bridged\n",
+			ast_channel_name(bridge_channel->chan));
+		ast_rtp_instance_set_prop(glue->audio.instance, AST_RTP_PROPERTY_LOCAL_BRIDGE_DTMF, 1);
+	}
+}
+
 /*!
  * \internal
  * \brief Helper function which gets all RTP information (glue and instances) relating to the given channels
@@ -325,6 +414,10 @@ static void native_rtp_bridge_start(struct ast_bridge *bridge, struct ast_channe
 		}
 		ast_rtp_instance_set_bridged(glue0->audio.instance, glue1->audio.instance);
 		ast_rtp_instance_set_bridged(glue1->audio.instance, glue0->audio.instance);
+		native_rtp_bridge_tap_dtmf(bc0, glue0);
+		native_rtp_bridge_tap_dtmf(bc1, glue1);
+		native_rtp_bridge_hide_fd(bc0->chan, data0);
+		native_rtp_bridge_hide_fd(bc1->chan, data1);
 		ast_verb(4, "Locally RTP bridged '%s' and '%s' in stack\n",
 			ast_channel_name(bc0->chan), ast_channel_name(bc1->chan));
 		break;
@@ -478,6 +571,10 @@ static void native_rtp_bridge_stop(struct ast_bridge *bridge, struct ast_channel
 		}
 		ast_rtp_instance_set_bridged(glue0->audio.instance, NULL);
 		ast_rtp_instance_set_bridged(glue1->audio.instance, NULL);
+		ast_rtp_instance_set_prop(glue0->audio.instance, AST_RTP_PROPERTY_LOCAL_BRIDGE_DTMF, 0);
+		ast_rtp_instance_set_prop(glue1->audio.instance, AST_RTP_PROPERTY_LOCAL_BRIDGE_DTMF, 0);
+		native_rtp_bridge_restore_fd(bc0->chan, data0);
+		native_rtp_bridge_restore_fd(bc1->chan, data1);
 		break;
 	case AST_RTP_GLUE_RESULT_REMOTE:
 		if (target) {
@@ -646,14 +743,16 @@ static int native_rtp_bridge_compatible_check(struct ast_bridge *bridge, struct
 	}
 
 	if (ao2_container_count(bc0->features->dtmf_hooks)
-		&& ast_rtp_instance_dtmf_mode_get(glue0->audio.instance)) {
+		&& ast_rtp_instance_dtmf_mode_get(glue0->audio.instance)
+		&& !native_rtp_bridge_dtmf_tappable(native_type, glue0)) {
 		ast_debug(1, "Bridge '%s' can not use native RTP bridge as channel '%s' has DTMF hooks\n",
 			bridge->uniqueid, ast_channel_name(bc0->chan));
 		return 0;
 	}
 
 	if (ao2_container_count(bc1->features->dtmf_hooks)
-		&& ast_rtp_instance_dtmf_mode_get(glue1->audio.instance)) {
+		&& ast_rtp_instance_dtmf_mode_get(glue1->audio.instance)
+		&& !native_rtp_bridge_dtmf_tappable(native_type, glue1)) {
 		ast_debug(1, "Bridge '%s' can not use native RTP bridge as channel '%s' has DTMF hooks\n",
 			bridge->uniqueid, ast_channel_name(bc1->chan));
 		return 0;
@@ -54,6 +54,11 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/astobj2.h"
 #include "asterisk/timing.h"
 #include "asterisk/translate.h"
+#include "asterisk/slinmix.h"
+#include "asterisk/cli.h"
+#include "asterisk/config.h"
+#include "asterisk/latency.h"
+#include "asterisk/affinity.h"
 
 #define MAX_DATALEN 8096
 
@@ -79,6 +84,15 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #define DEFAULT_ENERGY_HISTORY_LEN 150
 
+/*! \brief Tick interval of the mixing pool workers in ms, all mixing intervals must be a multiple of it. */
+#define SOFTMIX_POOL_TICK_INTERVAL 10
+
+/*! Shortest time in ms between video update requests passed on to a video source */
+#define SOFTMIX_VIDEO_UPDATE_INTERVAL 500
+
+/*! \brief Configuration file for the module */
+#define SOFTMIX_CONFIG "bridge_softmix.conf"
+
 struct video_follow_talker_data {
 	/*! audio energy history */
 	int energy_history[DEFAULT_ENERGY_HISTORY_LEN];
@@ -112,14 +126,39 @@ struct softmix_channel {
 	unsigned int talking:1;
 	/*! TRUE if the channel provided audio for this mixing interval */
 	unsigned int have_audio:1;
+	/*! TRUE if the channel's audio is part of the mix of this mixing interval */
+	unsigned int mixed:1;
+	/*! Smoothed energy of the channel's audio, used to find the loudest talkers */
+	int energy;
 	/*! Buffer containing final mixed audio from all sources */
 	short final_buf[MAX_DATALEN];
 	/*! Buffer containing only the audio from the channel */
 	short our_buf[MAX_DATALEN];
 	/*! Data pertaining to talker mode for video conferencing */
 	struct video_follow_talker_data video_talker;
+	/*! When a video update request was last passed on to this channel */
+	struct timeval last_video_update;
 };
 
+/*! \brief Mixing latency statistics of a bridge shown by 'bridge show' */
+struct softmix_latency {
+	/*! Number of mixing iterations performed */
+	unsigned int iterations;
+	/*! How long the last mixing iteration took in us */
+	unsigned int last_us;
+	/*! Longest mixing iteration in us */
+	unsigned int max_us;
+	/*! Longest delay between the timer firing and mixing starting in us */
+	unsigned int max_delay_us;
+	/*! Total time spent mixing in us */
+	uint64_t total_us;
+	/*! Total delay between the timer firing and mixing starting in us */
+	uint64_t total_delay_us;
+};
+
+struct softmix_mixing_state;
+struct softmix_pool_worker;
+
 struct softmix_bridge_data {
 	struct ast_timer *timer;
 	/*!
@@ -138,10 +177,51 @@ struct softmix_bridge_data {
 	pthread_t thread;
 	unsigned int internal_rate;
 	unsigned int internal_mixing_interval;
+	/*! Pool worker mixing this bridge, NULL if the bridge has its own mixing thread */
+	struct softmix_pool_worker *worker;
+	/*! Mixing state kept between ticks when mixed by a pool worker */
+	struct softmix_mixing_state *state;
+	/*! Mixing latency statistics */
+	struct softmix_latency latency;
+	/*! Linked list information for the pool worker */
+	AST_LIST_ENTRY(softmix_bridge_data) pool_entry;
 	/*! TRUE if the mixing thread should stop */
 	unsigned int stop:1;
 };
 
+/*! \brief A mixing thread shared by many bridges */
+struct softmix_pool_worker {
+	/*! Lock protecting the bridges list, held while mixing */
+	ast_mutex_t lock;
+	/*! Lock protecting the pending list */
+	ast_mutex_t pending_lock;
+	/*! Timing source driving all of the worker's bridges */
+	struct ast_timer *timer;
+	/*! Bridges mixed by this worker */
+	AST_LIST_HEAD_NOLOCK(, softmix_bridge_data) bridges;
+	/*! Bridges assigned to this worker that it has not picked up yet */
+	AST_LIST_HEAD_NOLOCK(, softmix_bridge_data) pending;
+	/*! Thread doing the mixing */
+	pthread_t thread;
+	/*! Number of bridges plus the number of channels in them */
+	int load;
+	/*! Number of timer ticks processed */
+	unsigned int ticks;
+	/*! Index of the worker in the pool */
+	unsigned int id;
+	/*! TRUE if the worker should stop */
+	unsigned int stop:1;
+};
+
+/*! \brief The mixing pool, empty if every bridge has its own mixing thread */
+static struct {
+	struct softmix_pool_worker *workers;
+	unsigned int num_workers;
+} pool;
+
+/*! \brief Most talkers mixed into a bridge, 0 to mix every channel */
+static unsigned int max_talkers;
+
 struct softmix_stats {
 	/*! Each index represents a sample rate used above the internal rate. */
 	unsigned int sample_rates[16];
@@ -161,22 +241,42 @@ struct softmix_mixing_array {
 	unsigned int max_num_entries;
 	unsigned int used_entries;
 	int16_t **buffers;
+	/*! Channel each of the buffers came from */
+	struct softmix_channel **channels;
+};
+
+struct softmix_translate_helper_entry;
+
+struct softmix_translate_helper {
+	struct ast_format *slin_src; /*!< the source format expected for all the translators */
+	AST_LIST_HEAD_NOLOCK(, softmix_translate_helper_entry) entries;
+};
+
+/*! \brief Mixing state carried between the mixing iterations of a bridge */
+struct softmix_mixing_state {
+	struct softmix_stats stats;
+	struct softmix_mixing_array mixing_array;
+	struct softmix_translate_helper trans_helper;
+	/*! Counts down, gather stats at zero and reset. */
+	unsigned int stat_iteration_counter;
+	/*! Set when the internal sample rate has changed */
+	int update_all_rates;
+	/*! Buffer the mixed audio is accumulated in */
+	int16_t buf[MAX_DATALEN];
 };
 
 struct softmix_translate_helper_entry {
 	int num_times_requested; /*!< Once this entry is no longer requested, free the trans_pvt
 	                              and re-init if it was usable. */
+	int num_listeners; /*!< Channels given the plain mix in this format during this run */
+	int last_num_listeners; /*!< Channels given the plain mix in this format during the last run */
 	struct ast_format *dst_format; /*!< The destination format for this helper */
 	struct ast_trans_pvt *trans_pvt; /*!< the translator for this slot. */
 	struct ast_frame *out_frame; /*!< The output frame from the last translation */
+	struct ast_frame *shared_frame; /*!< Mix of the last run shared by every channel using this format */
 	AST_LIST_ENTRY(softmix_translate_helper_entry) entry;
 };
 
-struct softmix_translate_helper {
-	struct ast_format *slin_src; /*!< the source format expected for all the translators */
-	AST_LIST_HEAD_NOLOCK(, softmix_translate_helper_entry) entries;
-};
-
 static struct softmix_translate_helper_entry *softmix_translate_helper_entry_alloc(struct ast_format *dst)
 {
 	struct softmix_translate_helper_entry *entry;
@@ -187,6 +287,7 @@ static struct softmix_translate_helper_entry *softmix_translate_helper_entry_all
 	/* initialize this to one so that the first time through the cleanup code after
 	   allocation it won't be removed from the entry list */
 	entry->num_times_requested = 1;
+	entry->num_listeners = 1;
 	return entry;
 }
 
@@ -200,6 +301,9 @@ static void *softmix_translate_helper_free_entry(struct softmix_translate_helper
 	if (entry->out_frame) {
 		ast_frfree(entry->out_frame);
 	}
+	if (entry->shared_frame) {
+		ast_frfree(entry->shared_frame);
+	}
 	ast_free(entry);
 	return NULL;
 }
@@ -262,20 +366,29 @@ static int16_t *softmix_process_read_audio(struct softmix_channel *sc, unsigned
  * \details This function will remove the channel's talking from its own audio if present and
  * possibly even do the channel's write translation for it depending on how many other
  * channels use the same write format.
+ *
+ * \param trans_helper Translation helper of the mixing run
+ * \param raw_write_fmt Raw write format of the channel
+ * \param sc Softmix channel to write to
+ * \param mix Mixed audio of all of the mixed channels
+ *
+ * \note sc->write_frame must already describe the mix.
+ *
+ * \return The frame to queue to the channel. Channels using the same format that do not
+ * have their own audio removed share the same frame.
  */
-static void softmix_process_write_audio(struct softmix_translate_helper *trans_helper,
+static struct ast_frame *softmix_process_write_audio(struct softmix_translate_helper *trans_helper,
 	struct ast_format *raw_write_fmt,
-	struct softmix_channel *sc)
+	struct softmix_channel *sc,
+	const int16_t *mix)
 {
 	struct softmix_translate_helper_entry *entry = NULL;
-	int i;
 
 	/* If we provided audio that was not determined to be silence,
 	 * then take it out while in slinear format. */
-	if (sc->have_audio && sc->talking) {
-		for (i = 0; i < sc->write_frame.samples; i++) {
-			ast_slinear_saturated_subtract(&sc->final_buf[i], &sc->our_buf[i]);
-		}
+	if (sc->mixed && sc->talking) {
+		memcpy(sc->final_buf, mix, sc->write_frame.datalen);
+		ast_slinear_saturated_subtract_buf(sc->final_buf, sc->our_buf, sc->write_frame.samples);
 		/* check to see if any entries exist for the format. if not we'll want
 		   to remove it during cleanup */
 		AST_LIST_TRAVERSE(&trans_helper->entries, entry, entry) {
@@ -286,7 +399,7 @@ static void softmix_process_write_audio(struct softmix_translate_helper *trans_h
 		}
 		/* do not do any special write translate optimization if we had to make
 		 * a special mix for them to remove their own audio. */
-		return;
+		return &sc->write_frame;
 	}
 
 	/* Attempt to optimize channels using the same translation path/codec. Build a list of entries
@@ -297,14 +410,40 @@ static void softmix_process_write_audio(struct softmix_translate_helper *trans_h
 	AST_LIST_TRAVERSE(&trans_helper->entries, entry, entry) {
 		if (ast_format_cmp(entry->dst_format, raw_write_fmt) == AST_FORMAT_CMP_EQUAL) {
 			entry->num_times_requested++;
+			entry->num_listeners++;
 		} else {
 			continue;
 		}
-		if (!entry->trans_pvt && (entry->num_times_requested > 1)) {
+		if (entry->shared_frame) {
+			/* Already translated for an earlier channel, reference it */
+			return entry->shared_frame;
+		}
+		/*
+		 * Talkers hear their own mix, so only the channels hearing the plain
+		 * mix count.  Going by the last run as well lets the first of them
+		 * in this run set up the shared frame.
+		 */
+		if (entry->num_listeners < 2 && entry->last_num_listeners < 2) {
+			break;
+		}
+		if (ast_format_cmp(entry->dst_format, trans_helper->slin_src) == AST_FORMAT_CMP_EQUAL) {
+			/* No translation needed, share the mix itself */
+			memcpy(sc->final_buf, mix, sc->write_frame.datalen);
+			entry->shared_frame = ast_frame_share(&sc->write_frame);
+			return entry->shared_frame ?: &sc->write_frame;
+		}
+		if (!entry->trans_pvt) {
 			entry->trans_pvt = ast_translator_build_path(entry->dst_format, trans_helper->slin_src);
 		}
 		if (entry->trans_pvt && !entry->out_frame) {
+			memcpy(sc->final_buf, mix, sc->write_frame.datalen);
 			entry->out_frame = ast_translate(entry->trans_pvt, &sc->write_frame, 0);
+			if (entry->out_frame && entry->out_frame->frametype == AST_FRAME_VOICE) {
+				entry->shared_frame = ast_frame_share(entry->out_frame);
+			}
+			if (entry->shared_frame) {
+				return entry->shared_frame;
+			}
 		}
 		if (entry->out_frame && entry->out_frame->frametype == AST_FRAME_VOICE
 				&& entry->out_frame->datalen < MAX_DATALEN) {
@@ -312,6 +451,7 @@ static void softmix_process_write_audio(struct softmix_translate_helper *trans_h
 			memcpy(sc->final_buf, entry->out_frame->data.ptr, entry->out_frame->datalen);
 			sc->write_frame.datalen = entry->out_frame->datalen;
 			sc->write_frame.samples = entry->out_frame->samples;
+			return &sc->write_frame;
 		}
 		break;
 	}
@@ -320,6 +460,9 @@ static void softmix_process_write_audio(struct softmix_translate_helper *trans_h
 	if (!entry && (entry = softmix_translate_helper_entry_alloc(raw_write_fmt))) {
 		AST_LIST_INSERT_HEAD(&trans_helper->entries, entry, entry);
 	}
+
+	memcpy(sc->final_buf, mix, sc->write_frame.datalen);
+	return &sc->write_frame;
 }
 
 static void softmix_translate_helper_cleanup(struct softmix_translate_helper *trans_helper)
@@ -338,10 +481,14 @@ static void softmix_translate_helper_cleanup(struct softmix_translate_helper *tr
 			ast_frfree(entry->out_frame);
 			entry->out_frame = NULL;
 		}
+		if (entry->shared_frame) {
+			ast_frfree(entry->shared_frame);
+			entry->shared_frame = NULL;
+		}
 
-		/* nothing is optimized for a single path reference, so there is
+		/* nothing is optimized for a single listener, so there is
 		   no reason to continue to hold onto the codec */
-		if (entry->num_times_requested == 1 && entry->trans_pvt) {
+		if (entry->num_listeners < 2 && entry->trans_pvt) {
 			ast_translator_free_path(entry->trans_pvt);
 			entry->trans_pvt = NULL;
 		}
@@ -350,6 +497,8 @@ static void softmix_translate_helper_cleanup(struct softmix_translate_helper *tr
 		   of references to a given entry is recalculated, so reset the number of
 		   times requested */
 		entry->num_times_requested = 0;
+		entry->last_num_listeners = entry->num_listeners;
+		entry->num_listeners = 0;
 	}
 	AST_LIST_TRAVERSE_SAFE_END;
 }
@@ -471,6 +620,10 @@ static int softmix_bridge_join(struct ast_bridge *bridge, struct ast_bridge_chan
 			: DEFAULT_SOFTMIX_INTERVAL,
 		bridge_channel, 0);
 
+	if (softmix_data->worker) {
+		ast_atomic_fetchadd_int(&softmix_data->worker->load, 1);
+	}
+
 	softmix_poke_thread(softmix_data);
 	return 0;
 }
@@ -479,12 +632,17 @@ static int softmix_bridge_join(struct ast_bridge *bridge, struct ast_bridge_chan
 static void softmix_bridge_leave(struct ast_bridge *bridge, struct ast_bridge_channel *bridge_channel)
 {
 	struct softmix_channel *sc = bridge_channel->tech_pvt;
+	struct softmix_bridge_data *softmix_data = bridge->tech_pvt;
 
 	if (!sc) {
 		return;
 	}
 	bridge_channel->tech_pvt = NULL;
 
+	if (softmix_data && softmix_data->worker) {
+		ast_atomic_fetchadd_int(&softmix_data->worker->load, -1);
+	}
+
 	/* Drop mutex lock */
 	ast_mutex_destroy(&sc->lock);
 
@@ -614,6 +772,9 @@ static void softmix_bridge_write_voice(struct ast_bridge *bridge, struct ast_bri
 		ast_dsp_silence_with_energy(sc->dsp, frame, &totalsilence, &cur_energy);
 	}
 
+	/* Smooth the energy so the loudest talkers do not change with every frame */
+	sc->energy = (sc->energy * 3 + cur_energy) / 4;
+
 	if (bridge->softmix.video_mode.mode == AST_BRIDGE_VIDEO_MODE_TALKER_SRC) {
 		int cur_slot = sc->video_talker.energy_history_cur_slot;
 
@@ -660,6 +821,49 @@ static void softmix_bridge_write_voice(struct ast_bridge *bridge, struct ast_bri
 	}
 }
 
+/*!
+ * \internal
+ * \brief Pass a video update request on to the video sources of the bridge.
+ *
+ * \details Only the channels whose video is being distributed can act on a
+ * request for a full frame, so only they are sent one.  When many viewers
+ * ask at once, for instance after a source switch or packet loss on a shared
+ * path, the requests are folded into one per source every
+ * SOFTMIX_VIDEO_UPDATE_INTERVAL ms.
+ *
+ * \param bridge Which bridge is getting the frame
+ * \param bridge_channel Which channel is asking for the update, may be NULL.
+ * \param frame The video update request.
+ *
+ * \return Nothing
+ */
+static void softmix_pass_video_update(struct ast_bridge *bridge, struct ast_bridge_channel *bridge_channel, struct ast_frame *frame)
+{
+	struct ast_bridge_channel *cur;
+	struct timeval now = ast_tvnow();
+
+	AST_LIST_TRAVERSE(&bridge->channels, cur, entry) {
+		struct softmix_channel *sc = cur->tech_pvt;
+		int pass;
+
+		if (cur == bridge_channel || cur->suspended || !sc
+			|| !ast_bridge_is_video_src(bridge, cur->chan)) {
+			continue;
+		}
+
+		ast_mutex_lock(&sc->lock);
+		pass = ast_tvdiff_ms(now, sc->last_video_update) >= SOFTMIX_VIDEO_UPDATE_INTERVAL;
+		if (pass) {
+			sc->last_video_update = now;
+		}
+		ast_mutex_unlock(&sc->lock);
+
+		if (pass) {
+			ast_bridge_channel_queue_frame(cur, frame);
+		}
+	}
+}
+
 /*!
  * \internal
  * \brief Determine what to do with a control frame.
@@ -681,7 +885,11 @@ static int softmix_bridge_write_control(struct ast_bridge *bridge, struct ast_br
 
 	switch (frame->subclass.integer) {
 	case AST_CONTROL_VIDUPDATE:
-		ast_bridge_queue_everyone_else(bridge, NULL, frame);
+		if (bridge->softmix.video_mode.mode == AST_BRIDGE_VIDEO_MODE_NONE) {
+			ast_bridge_queue_everyone_else(bridge, NULL, frame);
+		} else {
+			softmix_pass_video_update(bridge, bridge_channel, frame);
+		}
 		break;
 	default:
 		break;
@@ -875,7 +1083,8 @@ static int softmix_mixing_array_init(struct softmix_mixing_array *mixing_array,
 {
 	memset(mixing_array, 0, sizeof(*mixing_array));
 	mixing_array->max_num_entries = starting_num_entries;
-	if (!(mixing_array->buffers = ast_calloc(mixing_array->max_num_entries, sizeof(int16_t *)))) {
+	if (!(mixing_array->buffers = ast_calloc(mixing_array->max_num_entries, sizeof(int16_t *)))
+		|| !(mixing_array->channels = ast_calloc(mixing_array->max_num_entries, sizeof(struct softmix_channel *)))) {
 		ast_log(LOG_NOTICE, "Failed to allocate softmix mixing structure.\n");
 		return -1;
 	}
@@ -885,172 +1094,329 @@ static int softmix_mixing_array_init(struct softmix_mixing_array *mixing_array,
 static void softmix_mixing_array_destroy(struct softmix_mixing_array *mixing_array)
 {
 	ast_free(mixing_array->buffers);
+	ast_free(mixing_array->channels);
 }
 
 static int softmix_mixing_array_grow(struct softmix_mixing_array *mixing_array, unsigned int num_entries)
 {
 	int16_t **tmp;
+	struct softmix_channel **tmp_channels;
 	/* give it some room to grow since memory is cheap but allocations can be expensive */
-	mixing_array->max_num_entries = num_entries;
-	if (!(tmp = ast_realloc(mixing_array->buffers, (mixing_array->max_num_entries * sizeof(int16_t *))))) {
+	if (!(tmp = ast_realloc(mixing_array->buffers, (num_entries * sizeof(int16_t *))))) {
 		ast_log(LOG_NOTICE, "Failed to re-allocate softmix mixing structure.\n");
 		return -1;
 	}
 	mixing_array->buffers = tmp;
+	if (!(tmp_channels = ast_realloc(mixing_array->channels, (num_entries * sizeof(struct softmix_channel *))))) {
+		ast_log(LOG_NOTICE, "Failed to re-allocate softmix mixing structure.\n");
+		return -1;
+	}
+	mixing_array->channels = tmp_channels;
+	mixing_array->max_num_entries = num_entries;
 	return 0;
 }
 
 /*!
- * \brief Mixing loop.
+ * \internal
+ * \brief Limit the mixing array to the loudest talkers.
+ *
+ * \details Only talking channels are kept, and of those only the max_talkers with the
+ * highest energy. Everyone still hears the mix, but the mix is made of far fewer
+ * channels in large bridges where most participants are silent or listening.
+ *
+ * \param mixing_array Channels that provided audio, in the order they were read
+ */
+static void softmix_mixing_array_limit_talkers(struct softmix_mixing_array *mixing_array)
+{
+	unsigned int idx;
+	unsigned int used = 0;
+
+	for (idx = 0; idx < mixing_array->used_entries; ++idx) {
+		struct softmix_channel *sc = mixing_array->channels[idx];
+		int16_t *buffer = mixing_array->buffers[idx];
+		unsigned int pos;
+
+		if (!sc->talking) {
+			continue;
+		}
+
+		/* Keep the kept entries sorted loudest first, dropping the quietest */
+		for (pos = used; pos > 0 && mixing_array->channels[pos - 1]->energy < sc->energy; --pos) {
+			if (pos < max_talkers) {
+				mixing_array->channels[pos] = mixing_array->channels[pos - 1];
+				mixing_array->buffers[pos] = mixing_array->buffers[pos - 1];
+			}
+		}
+		if (pos < max_talkers) {
+			mixing_array->channels[pos] = sc;
+			mixing_array->buffers[pos] = buffer;
+			if (used < max_talkers) {
+				++used;
+			}
+		}
+	}
+	mixing_array->used_entries = used;
+}
+
+static void softmix_mixing_state_free(struct softmix_mixing_state *state)
+{
+	if (!state) {
+		return;
+	}
+	softmix_translate_helper_destroy(&state->trans_helper);
+	softmix_mixing_array_destroy(&state->mixing_array);
+	ast_free(state);
+}
+
+static struct softmix_mixing_state *softmix_mixing_state_alloc(struct ast_bridge *bridge)
+{
+	struct softmix_bridge_data *softmix_data = bridge->tech_pvt;
+	struct softmix_mixing_state *state;
+
+	state = ast_calloc(1, sizeof(*state));
+	if (!state) {
+		return NULL;
+	}
+	softmix_translate_helper_init(&state->trans_helper, softmix_data->internal_rate);
+
+	/* Give the mixing array room to grow, memory is cheap but allocations are expensive. */
+	if (softmix_mixing_array_init(&state->mixing_array, bridge->num_channels + 10)) {
+		softmix_mixing_state_free(state);
+		return NULL;
+	}
+	return state;
+}
+
+/*!
+ * \internal
+ * \brief Update the bridge's mixing latency statistics.
+ *
+ * \param softmix_data Bridge mixing data.
+ * \param tick When the timing source woke up the mixer.
+ * \param start When mixing of the bridge started.
+ *
+ * \note On entry, bridge is already locked.
+ */
+static void softmix_latency_update(struct softmix_bridge_data *softmix_data,
+	struct timeval tick, struct timeval start)
+{
+	struct softmix_latency *latency = &softmix_data->latency;
+	struct timeval end = ast_tvnow();
+	unsigned int mix_us = ast_tvdiff_us(end, start);
+	unsigned int delay_us = ast_tvdiff_us(start, tick);
+
+	++latency->iterations;
+	latency->last_us = mix_us;
+	latency->total_us += mix_us;
+	latency->max_us = MAX(latency->max_us, mix_us);
+	latency->total_delay_us += delay_us;
+	latency->max_delay_us = MAX(latency->max_delay_us, delay_us);
+
+	AST_LATENCY_END(AST_LATENCY_SOFTMIX_MIX, start);
+}
+
+/*!
+ * \internal
+ * \brief Perform a single mixing iteration of a bridge.
+ *
+ * \param bridge Which bridge to mix.
+ * \param state Mixing state carried between iterations.
+ *
+ * \note On entry, bridge is already locked.
  *
  * \retval 0 on success
  * \retval -1 on failure
  */
-static int softmix_mixing_loop(struct ast_bridge *bridge)
+static int softmix_mixing_iteration(struct ast_bridge *bridge, struct softmix_mixing_state *state)
 {
-	struct softmix_stats stats = { { 0 }, };
-	struct softmix_mixing_array mixing_array;
 	struct softmix_bridge_data *softmix_data = bridge->tech_pvt;
-	struct ast_timer *timer;
-	struct softmix_translate_helper trans_helper;
-	int16_t buf[MAX_DATALEN];
-	unsigned int stat_iteration_counter = 0; /* counts down, gather stats at zero and reset. */
-	int timingfd;
-	int update_all_rates = 0; /* set this when the internal sample rate has changed */
+	struct softmix_mixing_array *mixing_array = &state->mixing_array;
+	struct ast_bridge_channel *bridge_channel;
+	struct ast_format *cur_slin = ast_format_cache_get_slin_by_rate(softmix_data->internal_rate);
+	unsigned int softmix_samples = SOFTMIX_SAMPLES(softmix_data->internal_rate, softmix_data->internal_mixing_interval);
+	unsigned int softmix_datalen = SOFTMIX_DATALEN(softmix_data->internal_rate, softmix_data->internal_mixing_interval);
+	struct ast_frame *write_frame;
 	unsigned int idx;
-	unsigned int x;
-	int res = -1;
 
-	timer = softmix_data->timer;
-	timingfd = ast_timer_fd(timer);
-	softmix_translate_helper_init(&trans_helper, softmix_data->internal_rate);
-	ast_timer_set_rate(timer, (1000 / softmix_data->internal_mixing_interval));
+	if (softmix_datalen > MAX_DATALEN) {
+		/* This should NEVER happen, but if it does we need to know about it. Almost
+		 * all the memcpys used during this process depend on this assumption.  Rather
+		 * than checking this over and over again through out the code, this single
+		 * verification is done on each iteration. */
+		ast_log(LOG_WARNING,
+			"Bridge %s: Conference mixing error, requested mixing length greater than mixing buffer.\n",
+			bridge->uniqueid);
+		return -1;
+	}
 
-	/* Give the mixing array room to grow, memory is cheap but allocations are expensive. */
-	if (softmix_mixing_array_init(&mixing_array, bridge->num_channels + 10)) {
-		goto softmix_cleanup;
+	/* Grow the mixing array buffer as participants are added. */
+	if (mixing_array->max_num_entries < bridge->num_channels
+		&& softmix_mixing_array_grow(mixing_array, bridge->num_channels + 5)) {
+		return -1;
 	}
 
-	/*
-	 * XXX Softmix needs to use channel roles to determine who gets
-	 * what audio mixed.
-	 */
-	while (!softmix_data->stop && bridge->num_active) {
-		struct ast_bridge_channel *bridge_channel;
-		int timeout = -1;
-		struct ast_format *cur_slin = ast_format_cache_get_slin_by_rate(softmix_data->internal_rate);
-		unsigned int softmix_samples = SOFTMIX_SAMPLES(softmix_data->internal_rate, softmix_data->internal_mixing_interval);
-		unsigned int softmix_datalen = SOFTMIX_DATALEN(softmix_data->internal_rate, softmix_data->internal_mixing_interval);
-
-		if (softmix_datalen > MAX_DATALEN) {
-			/* This should NEVER happen, but if it does we need to know about it. Almost
-			 * all the memcpys used during this process depend on this assumption.  Rather
-			 * than checking this over and over again through out the code, this single
-			 * verification is done on each iteration. */
-			ast_log(LOG_WARNING,
-				"Bridge %s: Conference mixing error, requested mixing length greater than mixing buffer.\n",
-				bridge->uniqueid);
-			goto softmix_cleanup;
+	/* init the number of buffers stored in the mixing array to 0.
+	 * As buffers are added for mixing, this number is incremented. */
+	mixing_array->used_entries = 0;
+
+	/* These variables help determine if a rate change is required */
+	if (!state->stat_iteration_counter) {
+		memset(&state->stats, 0, sizeof(state->stats));
+		state->stats.locked_rate = bridge->softmix.internal_sample_rate;
+	}
+
+	/* If the sample rate has changed, update the translator helper */
+	if (state->update_all_rates) {
+		softmix_translate_helper_change_rate(&state->trans_helper, softmix_data->internal_rate);
+	}
+
+	/* Go through pulling audio from each factory that has it available */
+	AST_LIST_TRAVERSE(&bridge->channels, bridge_channel, entry) {
+		struct softmix_channel *sc = bridge_channel->tech_pvt;
+
+		if (!sc) {
+			/* This channel failed to join successfully. */
+			continue;
 		}
+		sc->mixed = 0;
 
-		/* Grow the mixing array buffer as participants are added. */
-		if (mixing_array.max_num_entries < bridge->num_channels
-			&& softmix_mixing_array_grow(&mixing_array, bridge->num_channels + 5)) {
-			goto softmix_cleanup;
+		/* Update the sample rate to match the bridge's native sample rate if necessary. */
+		if (state->update_all_rates) {
+			set_softmix_bridge_data(softmix_data->internal_rate, softmix_data->internal_mixing_interval, bridge_channel, 1);
 		}
 
-		/* init the number of buffers stored in the mixing array to 0.
-		 * As buffers are added for mixing, this number is incremented. */
-		mixing_array.used_entries = 0;
+		/* If stat_iteration_counter is 0, then collect statistics during this mixing interation */
+		if (!state->stat_iteration_counter) {
+			gather_softmix_stats(&state->stats, softmix_data, bridge_channel);
+		}
 
-		/* These variables help determine if a rate change is required */
-		if (!stat_iteration_counter) {
-			memset(&stats, 0, sizeof(stats));
-			stats.locked_rate = bridge->softmix.internal_sample_rate;
+		/* if the channel is suspended, don't check for audio, but still gather stats */
+		if (bridge_channel->suspended) {
+			continue;
 		}
 
-		/* If the sample rate has changed, update the translator helper */
-		if (update_all_rates) {
-			softmix_translate_helper_change_rate(&trans_helper, softmix_data->internal_rate);
+		/* Try to get audio from the factory if available */
+		ast_mutex_lock(&sc->lock);
+		if ((mixing_array->buffers[mixing_array->used_entries] = softmix_process_read_audio(sc, softmix_samples))) {
+			mixing_array->channels[mixing_array->used_entries] = sc;
+			mixing_array->used_entries++;
 		}
+		ast_mutex_unlock(&sc->lock);
+	}
 
-		/* Go through pulling audio from each factory that has it available */
-		AST_LIST_TRAVERSE(&bridge->channels, bridge_channel, entry) {
-			struct softmix_channel *sc = bridge_channel->tech_pvt;
+	if (max_talkers && mixing_array->used_entries > max_talkers) {
+		softmix_mixing_array_limit_talkers(mixing_array);
+	}
 
-			if (!sc) {
-				/* This channel failed to join successfully. */
-				continue;
-			}
+	/* mix it like crazy */
+	memset(state->buf, 0, softmix_datalen);
+	for (idx = 0; idx < mixing_array->used_entries; ++idx) {
+		ast_slinear_saturated_add_buf(state->buf, mixing_array->buffers[idx], softmix_samples);
+		mixing_array->channels[idx]->mixed = 1;
+	}
 
-			/* Update the sample rate to match the bridge's native sample rate if necessary. */
-			if (update_all_rates) {
-				set_softmix_bridge_data(softmix_data->internal_rate, softmix_data->internal_mixing_interval, bridge_channel, 1);
-			}
+	/* Next step go through removing the channel's own audio and creating a good frame... */
+	AST_LIST_TRAVERSE(&bridge->channels, bridge_channel, entry) {
+		struct softmix_channel *sc = bridge_channel->tech_pvt;
 
-			/* If stat_iteration_counter is 0, then collect statistics during this mixing interation */
-			if (!stat_iteration_counter) {
-				gather_softmix_stats(&stats, softmix_data, bridge_channel);
-			}
+		if (!sc || bridge_channel->suspended) {
+			/* This channel failed to join successfully or is suspended. */
+			continue;
+		}
 
-			/* if the channel is suspended, don't check for audio, but still gather stats */
-			if (bridge_channel->suspended) {
-				continue;
-			}
+		ast_mutex_lock(&sc->lock);
 
-			/* Try to get audio from the factory if available */
-			ast_mutex_lock(&sc->lock);
-			if ((mixing_array.buffers[mixing_array.used_entries] = softmix_process_read_audio(sc, softmix_samples))) {
-				mixing_array.used_entries++;
-			}
-			ast_mutex_unlock(&sc->lock);
-		}
+		/* Make SLINEAR write frame from local buffer */
+		ao2_t_replace(sc->write_frame.subclass.format, cur_slin,
+			"Replace softmix channel slin format");
+		sc->write_frame.datalen = softmix_datalen;
+		sc->write_frame.samples = softmix_samples;
+		/* Nobody else was heard, so whoever sends it on may send comfort noise */
+		ast_set2_flag(&sc->write_frame, !mixing_array->used_entries
+			|| (sc->mixed && sc->talking && mixing_array->used_entries == 1), AST_FRFLAG_SILENCE);
 
-		/* mix it like crazy */
-		memset(buf, 0, softmix_datalen);
-		for (idx = 0; idx < mixing_array.used_entries; ++idx) {
-			for (x = 0; x < softmix_samples; ++x) {
-				ast_slinear_saturated_add(buf + x, mixing_array.buffers[idx] + x);
-			}
-		}
+		/* process the softmix channel's new write audio */
+		write_frame = softmix_process_write_audio(&state->trans_helper,
+			ast_channel_rawwriteformat(bridge_channel->chan), sc, state->buf);
 
-		/* Next step go through removing the channel's own audio and creating a good frame... */
-		AST_LIST_TRAVERSE(&bridge->channels, bridge_channel, entry) {
-			struct softmix_channel *sc = bridge_channel->tech_pvt;
+		ast_mutex_unlock(&sc->lock);
 
-			if (!sc || bridge_channel->suspended) {
-				/* This channel failed to join successfully or is suspended. */
-				continue;
-			}
+		/* A frame is now ready for the channel. */
+		ast_bridge_channel_queue_frame(bridge_channel, write_frame);
+	}
 
-			ast_mutex_lock(&sc->lock);
+	state->update_all_rates = 0;
+	if (!state->stat_iteration_counter) {
+		state->update_all_rates = analyse_softmix_stats(&state->stats, softmix_data);
+		state->stat_iteration_counter = SOFTMIX_STAT_INTERVAL;
+	}
+	state->stat_iteration_counter--;
 
-			/* Make SLINEAR write frame from local buffer */
-			ao2_t_replace(sc->write_frame.subclass.format, cur_slin,
-				"Replace softmix channel slin format");
-			sc->write_frame.datalen = softmix_datalen;
-			sc->write_frame.samples = softmix_samples;
-			memcpy(sc->final_buf, buf, softmix_datalen);
+	return 0;
+}
 
-			/* process the softmix channel's new write audio */
-			softmix_process_write_audio(&trans_helper, ast_channel_rawwriteformat(bridge_channel->chan), sc);
+/*!
+ * \internal
+ * \brief Detect a mixing interval change requested by the bridge.
+ *
+ * \note On entry, bridge is already locked.
+ *
+ * \retval 0 if the interval did not change
+ * \retval 1 if the interval changed
+ */
+static int softmix_mixing_interval_update(struct ast_bridge *bridge, struct softmix_mixing_state *state)
+{
+	struct softmix_bridge_data *softmix_data = bridge->tech_pvt;
 
-			ast_mutex_unlock(&sc->lock);
+	if (bridge->softmix.internal_mixing_interval
+		&& (bridge->softmix.internal_mixing_interval != softmix_data->internal_mixing_interval)) {
+		softmix_data->internal_mixing_interval = bridge->softmix.internal_mixing_interval;
+		state->update_all_rates = 1; /* if the interval changes, the rates must be adjusted as well just to be notified new interval.*/
+		return 1;
+	}
+	return 0;
+}
 
-			/* A frame is now ready for the channel. */
-			ast_bridge_channel_queue_frame(bridge_channel, &sc->write_frame);
-		}
+/*!
+ * \brief Mixing loop.
+ *
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+static int softmix_mixing_loop(struct ast_bridge *bridge)
+{
+	struct softmix_bridge_data *softmix_data = bridge->tech_pvt;
+	struct softmix_mixing_state *state;
+	struct ast_timer *timer;
+	struct timeval tick = ast_tvnow();
+	int timingfd;
+	int res = -1;
+
+	timer = softmix_data->timer;
+	timingfd = ast_timer_fd(timer);
+	ast_timer_set_rate(timer, (1000 / softmix_data->internal_mixing_interval));
+
+	state = softmix_mixing_state_alloc(bridge);
+	if (!state) {
+		return -1;
+	}
 
-		update_all_rates = 0;
-		if (!stat_iteration_counter) {
-			update_all_rates = analyse_softmix_stats(&stats, softmix_data);
-			stat_iteration_counter = SOFTMIX_STAT_INTERVAL;
+	/*
+	 * XXX Softmix needs to use channel roles to determine who gets
+	 * what audio mixed.
+	 */
+	while (!softmix_data->stop && bridge->num_active) {
+		int timeout = -1;
+		struct timeval start = ast_tvnow();
+
+		if (softmix_mixing_iteration(bridge, state)) {
+			goto softmix_cleanup;
 		}
-		stat_iteration_counter--;
+		softmix_latency_update(softmix_data, tick, start);
 
 		ast_bridge_unlock(bridge);
 		/* cleanup any translation frame data from the previous mixing iteration. */
-		softmix_translate_helper_cleanup(&trans_helper);
+		softmix_translate_helper_cleanup(&state->trans_helper);
 		/* Wait for the timing source to tell us to wake up and get things done */
 		ast_waitfor_n_fd(&timingfd, 1, &timeout, NULL);
 		if (ast_timer_ack(timer, 1) < 0) {
@@ -1059,22 +1425,19 @@ static int softmix_mixing_loop(struct ast_bridge *bridge)
 			ast_bridge_lock(bridge);
 			goto softmix_cleanup;
 		}
+		tick = ast_tvnow();
 		ast_bridge_lock(bridge);
 
 		/* make sure to detect mixing interval changes if they occur. */
-		if (bridge->softmix.internal_mixing_interval
-			&& (bridge->softmix.internal_mixing_interval != softmix_data->internal_mixing_interval)) {
-			softmix_data->internal_mixing_interval = bridge->softmix.internal_mixing_interval;
+		if (softmix_mixing_interval_update(bridge, state)) {
 			ast_timer_set_rate(timer, (1000 / softmix_data->internal_mixing_interval));
-			update_all_rates = 1; /* if the interval changes, the rates must be adjusted as well just to be notified new interval.*/
 		}
 	}
 
 	res = 0;
 
 softmix_cleanup:
-	softmix_translate_helper_destroy(&trans_helper);
-	softmix_mixing_array_destroy(&mixing_array);
+	softmix_mixing_state_free(state);
 	return res;
 }
 
@@ -1092,6 +1455,7 @@ static void *softmix_mixing_thread(void *data)
 	struct softmix_bridge_data *softmix_data = data;
 	struct ast_bridge *bridge = softmix_data->bridge;
 
+	ast_thread_class_set(AST_THREAD_CLASS_MIXING);
 	ast_bridge_lock(bridge);
 	if (bridge->callid) {
 		ast_callid_threadassoc_add(bridge->callid);
@@ -1130,6 +1494,230 @@ static void *softmix_mixing_thread(void *data)
 	return NULL;
 }
 
+/*!
+ * \internal
+ * \brief Mix a bridge assigned to a pool worker for this tick.
+ *
+ * \param worker The pool worker mixing the bridge.
+ * \param softmix_data Bridge mixing data.
+ * \param tick When the worker's timing source woke up.
+ *
+ * \note On entry, the worker is locked.
+ */
+static void softmix_pool_mix_bridge(struct softmix_pool_worker *worker,
+	struct softmix_bridge_data *softmix_data, struct timeval tick)
+{
+	struct ast_bridge *bridge = softmix_data->bridge;
+	unsigned int ticks_per_mix;
+	struct timeval start;
+
+	ticks_per_mix = MAX(1, softmix_data->internal_mixing_interval / SOFTMIX_POOL_TICK_INTERVAL);
+	if (softmix_data->stop || (worker->ticks % ticks_per_mix)) {
+		return;
+	}
+
+	ast_bridge_lock(bridge);
+	if (softmix_data->stop || bridge->tech_pvt != softmix_data || !bridge->num_active) {
+		/* Nobody to mix for, start from scratch once somebody shows up. */
+		softmix_mixing_state_free(softmix_data->state);
+		softmix_data->state = NULL;
+		ast_bridge_unlock(bridge);
+		return;
+	}
+
+	if (!softmix_data->state) {
+		softmix_data->state = softmix_mixing_state_alloc(bridge);
+		if (!softmix_data->state) {
+			ast_bridge_unlock(bridge);
+			return;
+		}
+	}
+
+	start = ast_tvnow();
+	if (!softmix_mixing_iteration(bridge, softmix_data->state)) {
+		softmix_latency_update(softmix_data, tick, start);
+	}
+	softmix_translate_helper_cleanup(&softmix_data->state->trans_helper);
+	softmix_mixing_interval_update(bridge, softmix_data->state);
+	ast_bridge_unlock(bridge);
+}
+
+/*!
+ * \internal
+ * \brief Pool worker thread mixing all of its assigned bridges.
+ * \since 13.18.0
+ */
+static void *softmix_pool_worker_thread(void *data)
+{
+	struct softmix_pool_worker *worker = data;
+	int timingfd = ast_timer_fd(worker->timer);
+
+	ast_thread_class_set(AST_THREAD_CLASS_MIXING);
+	ast_debug(1, "Starting softmix pool worker %u\n", worker->id);
+
+	while (!worker->stop) {
+		struct softmix_bridge_data *softmix_data;
+		struct timeval tick;
+		int timeout = 1000;
+
+		if (ast_waitfor_n_fd(&timingfd, 1, &timeout, NULL) < 0) {
+			continue;
+		}
+		if (ast_timer_ack(worker->timer, 1) < 0) {
+			ast_log(LOG_ERROR, "Softmix pool worker %u failed to acknowledge timer.\n",
+				worker->id);
+			sleep(1);
+			continue;
+		}
+		tick = ast_tvnow();
+
+		ast_mutex_lock(&worker->lock);
+		++worker->ticks;
+
+		/* Pick up any bridges created since the last tick. */
+		ast_mutex_lock(&worker->pending_lock);
+		AST_LIST_APPEND_LIST(&worker->bridges, &worker->pending, pool_entry);
+		ast_mutex_unlock(&worker->pending_lock);
+
+		AST_LIST_TRAVERSE(&worker->bridges, softmix_data, pool_entry) {
+			softmix_pool_mix_bridge(worker, softmix_data, tick);
+		}
+		ast_mutex_unlock(&worker->lock);
+	}
+
+	ast_debug(1, "Stopping softmix pool worker %u\n", worker->id);
+
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Pick the least loaded pool worker.
+ * \since 13.18.0
+ *
+ * \retval NULL if the pool is not in use.
+ */
+static struct softmix_pool_worker *softmix_pool_least_loaded(void)
+{
+	struct softmix_pool_worker *best = NULL;
+	int i;
+
+	for (i = 0; i < pool.num_workers; ++i) {
+		if (!best || pool.workers[i].load < best->load) {
+			best = &pool.workers[i];
+		}
+	}
+	return best;
+}
+
+/*!
+ * \internal
+ * \brief Add a bridge to a pool worker.
+ * \since 13.18.0
+ *
+ * \note On entry, the bridge may be locked.  The worker holds its own
+ * lock while it locks the bridges it mixes so new bridges are handed over
+ * through the pending list instead.
+ */
+static void softmix_pool_add(struct softmix_pool_worker *worker, struct softmix_bridge_data *softmix_data)
+{
+	softmix_data->worker = worker;
+	/* The bridge itself counts as a unit of load so empty bridges are spread out too. */
+	ast_atomic_fetchadd_int(&worker->load, 1);
+
+	ast_mutex_lock(&worker->pending_lock);
+	AST_LIST_INSERT_TAIL(&worker->pending, softmix_data, pool_entry);
+	ast_mutex_unlock(&worker->pending_lock);
+}
+
+/*!
+ * \internal
+ * \brief Remove a bridge from its pool worker.
+ * \since 13.18.0
+ *
+ * \note On entry, the bridge must NOT be locked.  Once this returns the
+ * worker will no longer touch the bridge.
+ */
+static void softmix_pool_remove(struct softmix_bridge_data *softmix_data)
+{
+	struct softmix_pool_worker *worker = softmix_data->worker;
+
+	ast_mutex_lock(&worker->lock);
+	ast_mutex_lock(&worker->pending_lock);
+	if (!AST_LIST_REMOVE(&worker->pending, softmix_data, pool_entry)) {
+		AST_LIST_REMOVE(&worker->bridges, softmix_data, pool_entry);
+	}
+	ast_mutex_unlock(&worker->pending_lock);
+	ast_mutex_unlock(&worker->lock);
+
+	ast_atomic_fetchadd_int(&worker->load, -1);
+	softmix_mixing_state_free(softmix_data->state);
+	softmix_data->state = NULL;
+	softmix_data->worker = NULL;
+}
+
+static void softmix_pool_destroy(void)
+{
+	int i;
+
+	for (i = 0; i < pool.num_workers; ++i) {
+		struct softmix_pool_worker *worker = &pool.workers[i];
+
+		worker->stop = 1;
+		if (worker->thread != AST_PTHREADT_NULL) {
+			pthread_join(worker->thread, NULL);
+		}
+		if (worker->timer) {
+			ast_timer_close(worker->timer);
+		}
+		ast_mutex_destroy(&worker->pending_lock);
+		ast_mutex_destroy(&worker->lock);
+	}
+	ast_free(pool.workers);
+	pool.workers = NULL;
+	pool.num_workers = 0;
+}
+
+static int softmix_pool_create(unsigned int num_workers)
+{
+	int i;
+
+	pool.workers = ast_calloc(num_workers, sizeof(*pool.workers));
+	if (!pool.workers) {
+		return -1;
+	}
+
+	for (i = 0; i < num_workers; ++i) {
+		struct softmix_pool_worker *worker = &pool.workers[i];
+
+		worker->id = i;
+		worker->thread = AST_PTHREADT_NULL;
+		ast_mutex_init(&worker->lock);
+		ast_mutex_init(&worker->pending_lock);
+		AST_LIST_HEAD_INIT_NOLOCK(&worker->bridges);
+		AST_LIST_HEAD_INIT_NOLOCK(&worker->pending);
+		/* Count the worker as soon as its lock exists so it gets cleaned up. */
+		pool.num_workers = i + 1;
+
+		worker->timer = ast_timer_open();
+		if (!worker->timer) {
+			ast_log(LOG_ERROR, "Failed to open timer for softmix pool worker\n");
+			softmix_pool_destroy();
+			return -1;
+		}
+		ast_timer_set_rate(worker->timer, 1000 / SOFTMIX_POOL_TICK_INTERVAL);
+
+		if (ast_pthread_create(&worker->thread, NULL, softmix_pool_worker_thread, worker)) {
+			worker->thread = AST_PTHREADT_NULL;
+			softmix_pool_destroy();
+			return -1;
+		}
+	}
+
+	ast_verb(2, "Softmix bridges will be mixed by a pool of %u threads\n", num_workers);
+	return 0;
+}
+
 static void softmix_bridge_data_destroy(struct softmix_bridge_data *softmix_data)
 {
 	if (softmix_data->timer) {
@@ -1145,6 +1733,7 @@ static void softmix_bridge_data_destroy(struct softmix_bridge_data *softmix_data
 static int softmix_bridge_create(struct ast_bridge *bridge)
 {
 	struct softmix_bridge_data *softmix_data;
+	struct softmix_pool_worker *worker;
 
 	softmix_data = ast_calloc(1, sizeof(*softmix_data));
 	if (!softmix_data) {
@@ -1153,17 +1742,27 @@ static int softmix_bridge_create(struct ast_bridge *bridge)
 	softmix_data->bridge = bridge;
 	ast_mutex_init(&softmix_data->lock);
 	ast_cond_init(&softmix_data->cond, NULL);
+	softmix_data->thread = AST_PTHREADT_NULL;
+	/* start at minimum rate, let it grow from there */
+	softmix_data->internal_rate = SOFTMIX_MIN_SAMPLE_RATE;
+	softmix_data->internal_mixing_interval = DEFAULT_SOFTMIX_INTERVAL;
+
+	bridge->tech_pvt = softmix_data;
+
+	worker = softmix_pool_least_loaded();
+	if (worker) {
+		/* The pool worker's timer drives the mixing. */
+		softmix_pool_add(worker, softmix_data);
+		return 0;
+	}
+
 	softmix_data->timer = ast_timer_open();
 	if (!softmix_data->timer) {
 		ast_log(AST_LOG_WARNING, "Failed to open timer for softmix bridge\n");
 		softmix_bridge_data_destroy(softmix_data);
+		bridge->tech_pvt = NULL;
 		return -1;
 	}
-	/* start at minimum rate, let it grow from there */
-	softmix_data->internal_rate = SOFTMIX_MIN_SAMPLE_RATE;
-	softmix_data->internal_mixing_interval = DEFAULT_SOFTMIX_INTERVAL;
-
-	bridge->tech_pvt = softmix_data;
 
 	/* Start the mixing thread. */
 	if (ast_pthread_create(&softmix_data->thread, NULL, softmix_mixing_thread,
@@ -1218,7 +1817,9 @@ static void softmix_bridge_destroy(struct ast_bridge *bridge)
 	thread = softmix_data->thread;
 	softmix_data->thread = AST_PTHREADT_NULL;
 	ast_mutex_unlock(&softmix_data->lock);
-	if (thread != AST_PTHREADT_NULL) {
+	if (softmix_data->worker) {
+		softmix_pool_remove(softmix_data);
+	} else if (thread != AST_PTHREADT_NULL) {
 		ast_debug(1, "Bridge %s: Waiting for mixing thread to die.\n", bridge->uniqueid);
 		pthread_join(thread, NULL);
 	}
@@ -1227,6 +1828,37 @@ static void softmix_bridge_destroy(struct ast_bridge *bridge)
 	bridge->tech_pvt = NULL;
 }
 
+/*! \brief Function called to show technology specific details of a bridge */
+static void softmix_bridge_show(struct ast_bridge *bridge, int fd)
+{
+	struct softmix_bridge_data *softmix_data = bridge->tech_pvt;
+	struct softmix_latency *latency;
+
+	if (!softmix_data) {
+		return;
+	}
+	latency = &softmix_data->latency;
+
+	if (softmix_data->worker) {
+		ast_cli(fd, "Mixing-Mode: pool worker %u\n", softmix_data->worker->id);
+	} else {
+		ast_cli(fd, "Mixing-Mode: thread\n");
+	}
+	ast_cli(fd, "Mixing-Rate: %u\n", softmix_data->internal_rate);
+	ast_cli(fd, "Mixing-Interval: %u ms\n", softmix_data->internal_mixing_interval);
+	if (max_talkers) {
+		ast_cli(fd, "Mixing-Talkers: loudest %u\n", max_talkers);
+	}
+	ast_cli(fd, "Mixing-Iterations: %u\n", latency->iterations);
+	ast_cli(fd, "Mixing-Time: last %u us, avg %u us, max %u us\n",
+		latency->last_us,
+		latency->iterations ? (unsigned int) (latency->total_us / latency->iterations) : 0,
+		latency->max_us);
+	ast_cli(fd, "Mixing-Delay: avg %u us, max %u us\n",
+		latency->iterations ? (unsigned int) (latency->total_delay_us / latency->iterations) : 0,
+		latency->max_delay_us);
+}
+
 static struct ast_bridge_technology softmix_bridge = {
 	.name = "softmix",
 	.capabilities = AST_BRIDGE_CAPABILITY_MULTIMIX,
@@ -1238,16 +1870,65 @@ static struct ast_bridge_technology softmix_bridge = {
 	.leave = softmix_bridge_leave,
 	.unsuspend = softmix_bridge_unsuspend,
 	.write = softmix_bridge_write,
+	.show = softmix_bridge_show,
 };
 
+/*!
+ * \internal
+ * \brief Load the number of pool workers from the configuration file.
+ * \since 13.18.0
+ *
+ * \return Number of pool workers, 0 for a thread per bridge.
+ */
+static unsigned int softmix_load_config(void)
+{
+	struct ast_flags config_flags = { 0 };
+	struct ast_config *cfg;
+	const char *value;
+	int num_workers = 0;
+
+	cfg = ast_config_load(SOFTMIX_CONFIG, config_flags);
+	if (!cfg || cfg == CONFIG_STATUS_FILEINVALID) {
+		return 0;
+	}
+
+	value = ast_variable_retrieve(cfg, "general", "max_talkers");
+	if (!ast_strlen_zero(value) && sscanf(value, "%30u", &max_talkers) != 1) {
+		ast_log(LOG_WARNING, "Invalid max_talkers '%s' in %s, mixing every channel\n",
+			value, SOFTMIX_CONFIG);
+		max_talkers = 0;
+	}
+
+	value = ast_variable_retrieve(cfg, "general", "mixing_threads");
+	if (!ast_strlen_zero(value)) {
+		if (!strcasecmp(value, "auto")) {
+			num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+		} else if (sscanf(value, "%30d", &num_workers) != 1 || num_workers < 0) {
+			ast_log(LOG_WARNING, "Invalid mixing_threads '%s' in %s, using a thread per bridge\n",
+				value, SOFTMIX_CONFIG);
+			num_workers = 0;
+		}
+	}
+	ast_config_destroy(cfg);
+
+	return MAX(num_workers, 0);
+}
+
 static int unload_module(void)
 {
 	ast_bridge_technology_unregister(&softmix_bridge);
+	softmix_pool_destroy();
 	return 0;
 }
 
 static int load_module(void)
 {
+	unsigned int num_workers = softmix_load_config();
+
+	if (num_workers && softmix_pool_create(num_workers)) {
+		ast_log(LOG_WARNING, "Failed to create softmix mixing pool, using a thread per bridge\n");
+	}
+
 	if (ast_bridge_technology_register(&softmix_bridge)) {
 		unload_module();
 		return AST_MODULE_LOAD_DECLINE;
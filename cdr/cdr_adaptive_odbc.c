@@ -83,12 +83,26 @@ struct tables {
 	char *table;
 	char *schema;
 	unsigned int usegmtime:1;
+	/*! Maximum number of rows a batch of CDRs inserts in one statement */
+	unsigned int maxbatchrows;
 	AST_LIST_HEAD_NOLOCK(odbc_columns, columns) columns;
 	AST_RWLIST_ENTRY(tables) list;
 };
 
 static AST_RWLIST_HEAD_STATIC(odbc_tables, tables);
 
+/*! \brief A CDR insert queued to run on a res_odbc worker */
+struct cdr_insert {
+	char *connection;
+	char *table;
+	/*! Number of rows the statement inserts */
+	unsigned int rows;
+	char sql[0];
+};
+
+/*! Number of inserts queued but not yet run */
+static int pending_inserts;
+
 static int load_config(void)
 {
 	struct ast_config *cfg;
@@ -102,6 +116,7 @@ static int load_config(void)
 	char table[40];
 	char schema[40];
 	int lenconnection, lentable, lenschema, usegmtime = 0;
+	unsigned int maxbatchrows;
 	SQLLEN sqlptr;
 	int res = 0;
 	SQLHSTMT stmt = NULL;
@@ -129,6 +144,13 @@ static int load_config(void)
 			usegmtime = ast_true(tmp);
 		}
 
+		maxbatchrows = 1;
+		if (!ast_strlen_zero(tmp = ast_variable_retrieve(cfg, catg, "maxbatchrows"))
+			&& (sscanf(tmp, "%30u", &maxbatchrows) != 1 || maxbatchrows < 1)) {
+			ast_log(LOG_WARNING, "maxbatchrows in '%s' must be a positive integer\n", catg);
+			maxbatchrows = 1;
+		}
+
 		/* When loading, we want to be sure we can connect. */
 		obj = ast_odbc_request_obj(connection, 1);
 		if (!obj) {
@@ -175,6 +197,7 @@ static int load_config(void)
 		}
 
 		tableptr->usegmtime = usegmtime;
+		tableptr->maxbatchrows = maxbatchrows;
 		tableptr->connection = (char *)tableptr + sizeof(*tableptr);
 		tableptr->table = (char *)tableptr + sizeof(*tableptr) + lenconnection + 1;
 		tableptr->schema = (char *)tableptr + sizeof(*tableptr) + lenconnection + 1 + lentable + 1;
@@ -345,15 +368,68 @@ static SQLHSTMT generic_prepare(struct odbc_obj *obj, void *data)
 	return stmt;
 }
 
+static SQLHSTMT insert_prepare(struct odbc_obj *obj, void *data)
+{
+	struct cdr_insert *insert = data;
+
+	return generic_prepare(obj, insert->sql);
+}
+
+static void insert_result(struct odbc_obj *obj, SQLHSTMT stmt, void *data)
+{
+	struct cdr_insert *insert = data;
+	SQLLEN rows = 0;
+
+	if (stmt) {
+		SQLRowCount(stmt, &rows);
+	}
+	if (rows == 0) {
+		ast_log(LOG_WARNING, "cdr_adaptive_odbc: Insert failed on '%s:%s'.  CDR failed: %s\n", insert->connection, insert->table, insert->sql);
+	} else if (rows < insert->rows) {
+		ast_log(LOG_WARNING, "cdr_adaptive_odbc: Insert of %u rows on '%s:%s' only inserted %ld.  CDRs failed: %s\n",
+			insert->rows, insert->connection, insert->table, (long) rows, insert->sql);
+	}
+
+	ast_free(insert);
+	ast_atomic_fetchadd_int(&pending_inserts, -1);
+}
+
+/*!
+ * \internal
+ * \brief Queue an insert so this thread does not wait for the database
+ */
+static void queue_insert(struct tables *tableptr, const char *sql, unsigned int rows)
+{
+	struct cdr_insert *insert;
+	size_t sql_len = strlen(sql) + 1;
+	size_t connection_len = strlen(tableptr->connection) + 1;
+
+	insert = ast_malloc(sizeof(*insert) + sql_len + connection_len + strlen(tableptr->table) + 1);
+	if (!insert) {
+		ast_log(LOG_WARNING, "cdr_adaptive_odbc: Insert failed on '%s:%s'.  CDR failed: %s\n", tableptr->connection, tableptr->table, sql);
+		return;
+	}
+	strcpy(insert->sql, sql); /* SAFE */
+	insert->connection = insert->sql + sql_len;
+	strcpy(insert->connection, tableptr->connection); /* SAFE */
+	insert->table = insert->connection + connection_len;
+	strcpy(insert->table, tableptr->table); /* SAFE */
+	insert->rows = rows;
+
+	ast_atomic_fetchadd_int(&pending_inserts, +1);
+	if (ast_odbc_async_execute(tableptr->connection, insert_prepare, insert_result, insert)) {
+		ast_log(LOG_WARNING, "cdr_adaptive_odbc: Insert failed on '%s:%s'.  CDR failed: %s\n", tableptr->connection, tableptr->table, sql);
+		ast_atomic_fetchadd_int(&pending_inserts, -1);
+		ast_free(insert);
+	}
+}
+
 #define LENGTHEN_BUF1(size)														\
 			do {																\
 				/* Lengthen buffer, if necessary */								\
-				if (ast_str_strlen(sql) + size + 1 > ast_str_size(sql)) {		\
-					if (ast_str_make_space(&sql, ((ast_str_size(sql) + size + 1) / 512 + 1) * 512) != 0) { \
+				if (ast_str_strlen(*cols) + size + 1 > ast_str_size(*cols)) {		\
+					if (ast_str_make_space(cols, ((ast_str_size(*cols) + size + 1) / 512 + 1) * 512) != 0) { \
 						ast_log(LOG_ERROR, "Unable to allocate sufficient memory.  Insert CDR '%s:%s' failed.\n", tableptr->connection, tableptr->table); \
-						ast_free(sql);											\
-						ast_free(sql2);											\
-						AST_RWLIST_UNLOCK(&odbc_tables);						\
 						return -1;												\
 					}															\
 				}																\
@@ -361,394 +437,415 @@ static SQLHSTMT generic_prepare(struct odbc_obj *obj, void *data)
 
 #define LENGTHEN_BUF2(size)														\
 			do {																\
-				if (ast_str_strlen(sql2) + size + 1 > ast_str_size(sql2)) {		\
-					if (ast_str_make_space(&sql2, ((ast_str_size(sql2) + size + 3) / 512 + 1) * 512) != 0) { \
+				if (ast_str_strlen(*vals) + size + 1 > ast_str_size(*vals)) {		\
+					if (ast_str_make_space(vals, ((ast_str_size(*vals) + size + 3) / 512 + 1) * 512) != 0) { \
 						ast_log(LOG_ERROR, "Unable to allocate sufficient memory.  Insert CDR '%s:%s' failed.\n", tableptr->connection, tableptr->table); \
-						ast_free(sql);											\
-						ast_free(sql2);											\
-						AST_RWLIST_UNLOCK(&odbc_tables);						\
 						return -1;												\
 					}															\
 				}																\
 			} while (0)
 
-static int odbc_log(struct ast_cdr *cdr)
+/*!
+ * \internal
+ * \brief Render the columns and values a CDR inserts into a table
+ *
+ * \param tableptr The table
+ * \param obj A database handle, used to escape values
+ * \param cdr The CDR
+ * \param cols Set to the comma separated column names
+ * \param vals Set to the comma separated values
+ *
+ * \retval 0 on success
+ * \retval 1 if a filter cancelled the CDR for this table
+ * \retval -1 on error
+ */
+static int build_row(struct tables *tableptr, struct odbc_obj *obj, struct ast_cdr *cdr,
+	struct ast_str **cols, struct ast_str **vals)
 {
-	struct tables *tableptr;
 	struct columns *entry;
-	struct odbc_obj *obj;
-	struct ast_str *sql = ast_str_create(maxsize), *sql2 = ast_str_create(maxsize2);
 	char *tmp;
 	char colbuf[1024], *colptr;
-	SQLHSTMT stmt = NULL;
-	SQLLEN rows = 0;
-
-	if (!sql || !sql2) {
-		if (sql)
-			ast_free(sql);
-		if (sql2)
-			ast_free(sql2);
-		return -1;
-	}
-
-	if (AST_RWLIST_RDLOCK(&odbc_tables)) {
-		ast_log(LOG_ERROR, "Unable to lock table list.  Insert CDR(s) failed.\n");
-		ast_free(sql);
-		ast_free(sql2);
-		return -1;
-	}
-
-	AST_LIST_TRAVERSE(&odbc_tables, tableptr, list) {
-		int first = 1;
-		if (ast_strlen_zero(tableptr->schema)) {
-			ast_str_set(&sql, 0, "INSERT INTO %s (", tableptr->table);
-		} else {
-			ast_str_set(&sql, 0, "INSERT INTO %s.%s (", tableptr->schema, tableptr->table);
+	int first = 1;
+
+	ast_str_reset(*cols);
+	ast_str_reset(*vals);
+
+	AST_LIST_TRAVERSE(&(tableptr->columns), entry, list) {
+		int datefield = 0;
+		if (strcasecmp(entry->cdrname, "start") == 0) {
+			datefield = 1;
+		} else if (strcasecmp(entry->cdrname, "answer") == 0) {
+			datefield = 2;
+		} else if (strcasecmp(entry->cdrname, "end") == 0) {
+			datefield = 3;
 		}
-		ast_str_set(&sql2, 0, " VALUES (");
 
-		/* No need to check the connection now; we'll handle any failure in prepare_and_execute */
-		if (!(obj = ast_odbc_request_obj(tableptr->connection, 0))) {
-			ast_log(LOG_WARNING, "cdr_adaptive_odbc: Unable to retrieve database handle for '%s:%s'.  CDR failed: %s\n", tableptr->connection, tableptr->table, ast_str_buffer(sql));
-			continue;
+		/* Check if we have a similarly named variable */
+		if (entry->staticvalue) {
+			colptr = ast_strdupa(entry->staticvalue);
+		} else if (datefield && tableptr->usegmtime) {
+			struct timeval date_tv = (datefield == 1) ? cdr->start : (datefield == 2) ? cdr->answer : cdr->end;
+			struct ast_tm tm = { 0, };
+			ast_localtime(&date_tv, &tm, "UTC");
+			ast_strftime(colbuf, sizeof(colbuf), "%Y-%m-%d %H:%M:%S", &tm);
+			colptr = colbuf;
+		} else {
+			ast_cdr_format_var(cdr, entry->cdrname, &colptr, colbuf, sizeof(colbuf), datefield ? 0 : 1);
 		}
 
-		AST_LIST_TRAVERSE(&(tableptr->columns), entry, list) {
-			int datefield = 0;
-			if (strcasecmp(entry->cdrname, "start") == 0) {
-				datefield = 1;
-			} else if (strcasecmp(entry->cdrname, "answer") == 0) {
-				datefield = 2;
-			} else if (strcasecmp(entry->cdrname, "end") == 0) {
-				datefield = 3;
-			}
-
-			/* Check if we have a similarly named variable */
-			if (entry->staticvalue) {
-				colptr = ast_strdupa(entry->staticvalue);
-			} else if (datefield && tableptr->usegmtime) {
-				struct timeval date_tv = (datefield == 1) ? cdr->start : (datefield == 2) ? cdr->answer : cdr->end;
-				struct ast_tm tm = { 0, };
-				ast_localtime(&date_tv, &tm, "UTC");
-				ast_strftime(colbuf, sizeof(colbuf), "%Y-%m-%d %H:%M:%S", &tm);
-				colptr = colbuf;
-			} else {
-				ast_cdr_format_var(cdr, entry->cdrname, &colptr, colbuf, sizeof(colbuf), datefield ? 0 : 1);
+		if (colptr) {
+			/* Check first if the column filters this entry.  Note that this
+			 * is very specifically NOT ast_strlen_zero(), because the filter
+			 * could legitimately specify that the field is blank, which is
+			 * different from the field being unspecified (NULL). */
+			if ((entry->filtervalue && !entry->negatefiltervalue && strcasecmp(colptr, entry->filtervalue) != 0) ||
+				(entry->filtervalue && entry->negatefiltervalue && strcasecmp(colptr, entry->filtervalue) == 0)) {
+				ast_verb(4, "CDR column '%s' with value '%s' does not match filter of"
+					" %s'%s'.  Cancelling this CDR.\n",
+					entry->cdrname, colptr, entry->negatefiltervalue ? "!" : "", entry->filtervalue);
+				return 1;
 			}
 
-			if (colptr) {
-				/* Check first if the column filters this entry.  Note that this
-				 * is very specifically NOT ast_strlen_zero(), because the filter
-				 * could legitimately specify that the field is blank, which is
-				 * different from the field being unspecified (NULL). */
-				if ((entry->filtervalue && !entry->negatefiltervalue && strcasecmp(colptr, entry->filtervalue) != 0) ||
-					(entry->filtervalue && entry->negatefiltervalue && strcasecmp(colptr, entry->filtervalue) == 0)) {
-					ast_verb(4, "CDR column '%s' with value '%s' does not match filter of"
-						" %s'%s'.  Cancelling this CDR.\n",
-						entry->cdrname, colptr, entry->negatefiltervalue ? "!" : "", entry->filtervalue);
-					goto early_release;
-				}
-
-				/* Only a filter? */
-				if (ast_strlen_zero(entry->name))
-					continue;
+			/* Only a filter? */
+			if (ast_strlen_zero(entry->name))
+				continue;
 
-				LENGTHEN_BUF1(strlen(entry->name));
+			LENGTHEN_BUF1(strlen(entry->name));
 
-				switch (entry->type) {
-				case SQL_CHAR:
-				case SQL_VARCHAR:
-				case SQL_LONGVARCHAR:
+			switch (entry->type) {
+			case SQL_CHAR:
+			case SQL_VARCHAR:
+			case SQL_LONGVARCHAR:
 #ifdef HAVE_ODBC_WCHAR
-				case SQL_WCHAR:
-				case SQL_WVARCHAR:
-				case SQL_WLONGVARCHAR:
+			case SQL_WCHAR:
+			case SQL_WVARCHAR:
+			case SQL_WLONGVARCHAR:
 #endif
-				case SQL_BINARY:
-				case SQL_VARBINARY:
-				case SQL_LONGVARBINARY:
-				case SQL_GUID:
-					/* For these two field names, get the rendered form, instead of the raw
-					 * form (but only when we're dealing with a character-based field).
-					 */
-					if (strcasecmp(entry->name, "disposition") == 0) {
-						ast_cdr_format_var(cdr, entry->name, &colptr, colbuf, sizeof(colbuf), 0);
-					} else if (strcasecmp(entry->name, "amaflags") == 0) {
-						ast_cdr_format_var(cdr, entry->name, &colptr, colbuf, sizeof(colbuf), 0);
-					}
+			case SQL_BINARY:
+			case SQL_VARBINARY:
+			case SQL_LONGVARBINARY:
+			case SQL_GUID:
+				/* For these two field names, get the rendered form, instead of the raw
+				 * form (but only when we're dealing with a character-based field).
+				 */
+				if (strcasecmp(entry->name, "disposition") == 0) {
+					ast_cdr_format_var(cdr, entry->name, &colptr, colbuf, sizeof(colbuf), 0);
+				} else if (strcasecmp(entry->name, "amaflags") == 0) {
+					ast_cdr_format_var(cdr, entry->name, &colptr, colbuf, sizeof(colbuf), 0);
+				}
 
-					/* Truncate too-long fields */
-					if (entry->type != SQL_GUID) {
-						if (strlen(colptr) > entry->octetlen) {
-							colptr[entry->octetlen] = '\0';
-						}
+				/* Truncate too-long fields */
+				if (entry->type != SQL_GUID) {
+					if (strlen(colptr) > entry->octetlen) {
+						colptr[entry->octetlen] = '\0';
 					}
+				}
 
-					ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-					LENGTHEN_BUF2(strlen(colptr));
+				ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+				LENGTHEN_BUF2(strlen(colptr));
 
-					/* Encode value, with escaping */
-					ast_str_append(&sql2, 0, "%s'", first ? "" : ",");
-					for (tmp = colptr; *tmp; tmp++) {
-						if (*tmp == '\'') {
-							ast_str_append(&sql2, 0, "''");
-						} else if (*tmp == '\\' && ast_odbc_backslash_is_escape(obj)) {
-							ast_str_append(&sql2, 0, "\\\\");
-						} else {
-							ast_str_append(&sql2, 0, "%c", *tmp);
-						}
-					}
-					ast_str_append(&sql2, 0, "'");
-					break;
-				case SQL_TYPE_DATE:
-					if (ast_strlen_zero(colptr)) {
-						continue;
+				/* Encode value, with escaping */
+				ast_str_append(vals, 0, "%s'", first ? "" : ",");
+				for (tmp = colptr; *tmp; tmp++) {
+					if (*tmp == '\'') {
+						ast_str_append(vals, 0, "''");
+					} else if (*tmp == '\\' && ast_odbc_backslash_is_escape(obj)) {
+						ast_str_append(vals, 0, "\\\\");
 					} else {
-						int year = 0, month = 0, day = 0;
-						if (sscanf(colptr, "%4d-%2d-%2d", &year, &month, &day) != 3 || year <= 0 ||
-							month <= 0 || month > 12 || day < 0 || day > 31 ||
-							((month == 4 || month == 6 || month == 9 || month == 11) && day == 31) ||
-							(month == 2 && year % 400 == 0 && day > 29) ||
-							(month == 2 && year % 100 == 0 && day > 28) ||
-							(month == 2 && year % 4 == 0 && day > 29) ||
-							(month == 2 && year % 4 != 0 && day > 28)) {
-							ast_log(LOG_WARNING, "CDR variable %s is not a valid date ('%s').\n", entry->name, colptr);
-							continue;
-						}
-
-						if (year > 0 && year < 100) {
-							year += 2000;
-						}
-
-						ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-						LENGTHEN_BUF2(17);
-						ast_str_append(&sql2, 0, "%s{ d '%04d-%02d-%02d' }", first ? "" : ",", year, month, day);
+						ast_str_append(vals, 0, "%c", *tmp);
 					}
-					break;
-				case SQL_TYPE_TIME:
-					if (ast_strlen_zero(colptr)) {
+				}
+				ast_str_append(vals, 0, "'");
+				break;
+			case SQL_TYPE_DATE:
+				if (ast_strlen_zero(colptr)) {
+					continue;
+				} else {
+					int year = 0, month = 0, day = 0;
+					if (sscanf(colptr, "%4d-%2d-%2d", &year, &month, &day) != 3 || year <= 0 ||
+						month <= 0 || month > 12 || day < 0 || day > 31 ||
+						((month == 4 || month == 6 || month == 9 || month == 11) && day == 31) ||
+						(month == 2 && year % 400 == 0 && day > 29) ||
+						(month == 2 && year % 100 == 0 && day > 28) ||
+						(month == 2 && year % 4 == 0 && day > 29) ||
+						(month == 2 && year % 4 != 0 && day > 28)) {
+						ast_log(LOG_WARNING, "CDR variable %s is not a valid date ('%s').\n", entry->name, colptr);
 						continue;
-					} else {
-						int hour = 0, minute = 0, second = 0;
-						int count = sscanf(colptr, "%2d:%2d:%2d", &hour, &minute, &second);
-
-						if ((count != 2 && count != 3) || hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 59) {
-							ast_log(LOG_WARNING, "CDR variable %s is not a valid time ('%s').\n", entry->name, colptr);
-							continue;
-						}
+					}
 
-						ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-						LENGTHEN_BUF2(15);
-						ast_str_append(&sql2, 0, "%s{ t '%02d:%02d:%02d' }", first ? "" : ",", hour, minute, second);
+					if (year > 0 && year < 100) {
+						year += 2000;
 					}
-					break;
-				case SQL_TYPE_TIMESTAMP:
-				case SQL_TIMESTAMP:
-					if (ast_strlen_zero(colptr)) {
-						continue;
-					} else {
-						int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
-						int count = sscanf(colptr, "%4d-%2d-%2d %2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second);
-
-						if ((count != 3 && count != 5 && count != 6) || year <= 0 ||
-							month <= 0 || month > 12 || day < 0 || day > 31 ||
-							((month == 4 || month == 6 || month == 9 || month == 11) && day == 31) ||
-							(month == 2 && year % 400 == 0 && day > 29) ||
-							(month == 2 && year % 100 == 0 && day > 28) ||
-							(month == 2 && year % 4 == 0 && day > 29) ||
-							(month == 2 && year % 4 != 0 && day > 28) ||
-							hour > 23 || minute > 59 || second > 59 || hour < 0 || minute < 0 || second < 0) {
-							ast_log(LOG_WARNING, "CDR variable %s is not a valid timestamp ('%s').\n", entry->name, colptr);
-							continue;
-						}
 
-						if (year > 0 && year < 100) {
-							year += 2000;
-						}
+					ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+					LENGTHEN_BUF2(17);
+					ast_str_append(vals, 0, "%s{ d '%04d-%02d-%02d' }", first ? "" : ",", year, month, day);
+				}
+				break;
+			case SQL_TYPE_TIME:
+				if (ast_strlen_zero(colptr)) {
+					continue;
+				} else {
+					int hour = 0, minute = 0, second = 0;
+					int count = sscanf(colptr, "%2d:%2d:%2d", &hour, &minute, &second);
 
-						ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-						LENGTHEN_BUF2(26);
-						ast_str_append(&sql2, 0, "%s{ ts '%04d-%02d-%02d %02d:%02d:%02d' }", first ? "" : ",", year, month, day, hour, minute, second);
-					}
-					break;
-				case SQL_INTEGER:
-					if (ast_strlen_zero(colptr)) {
+					if ((count != 2 && count != 3) || hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 59) {
+						ast_log(LOG_WARNING, "CDR variable %s is not a valid time ('%s').\n", entry->name, colptr);
 						continue;
-					} else {
-						int integer = 0;
-						if (sscanf(colptr, "%30d", &integer) != 1) {
-							ast_log(LOG_WARNING, "CDR variable %s is not an integer.\n", entry->name);
-							continue;
-						}
-
-						ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-						LENGTHEN_BUF2(12);
-						ast_str_append(&sql2, 0, "%s%d", first ? "" : ",", integer);
 					}
-					break;
-				case SQL_BIGINT:
-					if (ast_strlen_zero(colptr)) {
-						continue;
-					} else {
-						long long integer = 0;
-						if (sscanf(colptr, "%30lld", &integer) != 1) {
-							ast_log(LOG_WARNING, "CDR variable %s is not an integer.\n", entry->name);
-							continue;
-						}
 
-						ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-						LENGTHEN_BUF2(24);
-						ast_str_append(&sql2, 0, "%s%lld", first ? "" : ",", integer);
-					}
-					break;
-				case SQL_SMALLINT:
-					if (ast_strlen_zero(colptr)) {
+					ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+					LENGTHEN_BUF2(15);
+					ast_str_append(vals, 0, "%s{ t '%02d:%02d:%02d' }", first ? "" : ",", hour, minute, second);
+				}
+				break;
+			case SQL_TYPE_TIMESTAMP:
+			case SQL_TIMESTAMP:
+				if (ast_strlen_zero(colptr)) {
+					continue;
+				} else {
+					int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+					int count = sscanf(colptr, "%4d-%2d-%2d %2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second);
+
+					if ((count != 3 && count != 5 && count != 6) || year <= 0 ||
+						month <= 0 || month > 12 || day < 0 || day > 31 ||
+						((month == 4 || month == 6 || month == 9 || month == 11) && day == 31) ||
+						(month == 2 && year % 400 == 0 && day > 29) ||
+						(month == 2 && year % 100 == 0 && day > 28) ||
+						(month == 2 && year % 4 == 0 && day > 29) ||
+						(month == 2 && year % 4 != 0 && day > 28) ||
+						hour > 23 || minute > 59 || second > 59 || hour < 0 || minute < 0 || second < 0) {
+						ast_log(LOG_WARNING, "CDR variable %s is not a valid timestamp ('%s').\n", entry->name, colptr);
 						continue;
-					} else {
-						short integer = 0;
-						if (sscanf(colptr, "%30hd", &integer) != 1) {
-							ast_log(LOG_WARNING, "CDR variable %s is not an integer.\n", entry->name);
-							continue;
-						}
+					}
 
-						ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-						LENGTHEN_BUF2(6);
-						ast_str_append(&sql2, 0, "%s%d", first ? "" : ",", integer);
+					if (year > 0 && year < 100) {
+						year += 2000;
 					}
-					break;
-				case SQL_TINYINT:
-					if (ast_strlen_zero(colptr)) {
+
+					ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+					LENGTHEN_BUF2(26);
+					ast_str_append(vals, 0, "%s{ ts '%04d-%02d-%02d %02d:%02d:%02d' }", first ? "" : ",", year, month, day, hour, minute, second);
+				}
+				break;
+			case SQL_INTEGER:
+				if (ast_strlen_zero(colptr)) {
+					continue;
+				} else {
+					int integer = 0;
+					if (sscanf(colptr, "%30d", &integer) != 1) {
+						ast_log(LOG_WARNING, "CDR variable %s is not an integer.\n", entry->name);
 						continue;
-					} else {
-						signed char integer = 0;
-						if (sscanf(colptr, "%30hhd", &integer) != 1) {
-							ast_log(LOG_WARNING, "CDR variable %s is not an integer.\n", entry->name);
-							continue;
-						}
+					}
 
-						ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-						LENGTHEN_BUF2(4);
-						ast_str_append(&sql2, 0, "%s%d", first ? "" : ",", integer);
+					ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+					LENGTHEN_BUF2(12);
+					ast_str_append(vals, 0, "%s%d", first ? "" : ",", integer);
+				}
+				break;
+			case SQL_BIGINT:
+				if (ast_strlen_zero(colptr)) {
+					continue;
+				} else {
+					long long integer = 0;
+					if (sscanf(colptr, "%30lld", &integer) != 1) {
+						ast_log(LOG_WARNING, "CDR variable %s is not an integer.\n", entry->name);
+						continue;
 					}
-					break;
-				case SQL_BIT:
-					if (ast_strlen_zero(colptr)) {
+
+					ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+					LENGTHEN_BUF2(24);
+					ast_str_append(vals, 0, "%s%lld", first ? "" : ",", integer);
+				}
+				break;
+			case SQL_SMALLINT:
+				if (ast_strlen_zero(colptr)) {
+					continue;
+				} else {
+					short integer = 0;
+					if (sscanf(colptr, "%30hd", &integer) != 1) {
+						ast_log(LOG_WARNING, "CDR variable %s is not an integer.\n", entry->name);
 						continue;
-					} else {
-						signed char integer = 0;
-						if (sscanf(colptr, "%30hhd", &integer) != 1) {
-							ast_log(LOG_WARNING, "CDR variable %s is not an integer.\n", entry->name);
-							continue;
-						}
-						if (integer != 0)
-							integer = 1;
+					}
 
-						ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-						LENGTHEN_BUF2(2);
-						ast_str_append(&sql2, 0, "%s%d", first ? "" : ",", integer);
+					ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+					LENGTHEN_BUF2(6);
+					ast_str_append(vals, 0, "%s%d", first ? "" : ",", integer);
+				}
+				break;
+			case SQL_TINYINT:
+				if (ast_strlen_zero(colptr)) {
+					continue;
+				} else {
+					signed char integer = 0;
+					if (sscanf(colptr, "%30hhd", &integer) != 1) {
+						ast_log(LOG_WARNING, "CDR variable %s is not an integer.\n", entry->name);
+						continue;
 					}
-					break;
-				case SQL_NUMERIC:
-				case SQL_DECIMAL:
-					if (ast_strlen_zero(colptr)) {
+
+					ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+					LENGTHEN_BUF2(4);
+					ast_str_append(vals, 0, "%s%d", first ? "" : ",", integer);
+				}
+				break;
+			case SQL_BIT:
+				if (ast_strlen_zero(colptr)) {
+					continue;
+				} else {
+					signed char integer = 0;
+					if (sscanf(colptr, "%30hhd", &integer) != 1) {
+						ast_log(LOG_WARNING, "CDR variable %s is not an integer.\n", entry->name);
 						continue;
-					} else {
-						double number = 0.0;
-
-						if (!strcasecmp(entry->cdrname, "billsec")) {
-							if (!ast_tvzero(cdr->answer)) {
-								snprintf(colbuf, sizeof(colbuf), "%lf",
-											(double) (ast_tvdiff_us(cdr->end, cdr->answer) / 1000000.0));
-							} else {
-								ast_copy_string(colbuf, "0", sizeof(colbuf));
-							}
-						} else if (!strcasecmp(entry->cdrname, "duration")) {
-							snprintf(colbuf, sizeof(colbuf), "%lf",
-										(double) (ast_tvdiff_us(cdr->end, cdr->start) / 1000000.0));
+					}
+					if (integer != 0)
+						integer = 1;
 
-							if (!ast_strlen_zero(colbuf)) {
-								colptr = colbuf;
-							}
-						}
+					ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+					LENGTHEN_BUF2(2);
+					ast_str_append(vals, 0, "%s%d", first ? "" : ",", integer);
+				}
+				break;
+			case SQL_NUMERIC:
+			case SQL_DECIMAL:
+				if (ast_strlen_zero(colptr)) {
+					continue;
+				} else {
+					double number = 0.0;
 
-						if (sscanf(colptr, "%30lf", &number) != 1) {
-							ast_log(LOG_WARNING, "CDR variable %s is not an numeric type.\n", entry->name);
-							continue;
+					if (!strcasecmp(entry->cdrname, "billsec")) {
+						if (!ast_tvzero(cdr->answer)) {
+							snprintf(colbuf, sizeof(colbuf), "%lf",
+										(double) (ast_tvdiff_us(cdr->end, cdr->answer) / 1000000.0));
+						} else {
+							ast_copy_string(colbuf, "0", sizeof(colbuf));
 						}
+					} else if (!strcasecmp(entry->cdrname, "duration")) {
+						snprintf(colbuf, sizeof(colbuf), "%lf",
+									(double) (ast_tvdiff_us(cdr->end, cdr->start) / 1000000.0));
 
-						ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-						LENGTHEN_BUF2(entry->decimals);
-						ast_str_append(&sql2, 0, "%s%*.*lf", first ? "" : ",", entry->decimals, entry->radix, number);
+						if (!ast_strlen_zero(colbuf)) {
+							colptr = colbuf;
+						}
 					}
-					break;
-				case SQL_FLOAT:
-				case SQL_REAL:
-				case SQL_DOUBLE:
-					if (ast_strlen_zero(colptr)) {
+
+					if (sscanf(colptr, "%30lf", &number) != 1) {
+						ast_log(LOG_WARNING, "CDR variable %s is not an numeric type.\n", entry->name);
 						continue;
-					} else {
-						double number = 0.0;
-
-						if (!strcasecmp(entry->cdrname, "billsec")) {
-							if (!ast_tvzero(cdr->answer)) {
-								snprintf(colbuf, sizeof(colbuf), "%lf",
-											(double) (ast_tvdiff_us(cdr->end, cdr->answer) / 1000000.0));
-							} else {
-								ast_copy_string(colbuf, "0", sizeof(colbuf));
-							}
-						} else if (!strcasecmp(entry->cdrname, "duration")) {
-							snprintf(colbuf, sizeof(colbuf), "%lf",
-										(double) (ast_tvdiff_us(cdr->end, cdr->start) / 1000000.0));
+					}
+
+					ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+					LENGTHEN_BUF2(entry->decimals);
+					ast_str_append(vals, 0, "%s%*.*lf", first ? "" : ",", entry->decimals, entry->radix, number);
+				}
+				break;
+			case SQL_FLOAT:
+			case SQL_REAL:
+			case SQL_DOUBLE:
+				if (ast_strlen_zero(colptr)) {
+					continue;
+				} else {
+					double number = 0.0;
 
-							if (!ast_strlen_zero(colbuf)) {
-								colptr = colbuf;
-							}
+					if (!strcasecmp(entry->cdrname, "billsec")) {
+						if (!ast_tvzero(cdr->answer)) {
+							snprintf(colbuf, sizeof(colbuf), "%lf",
+										(double) (ast_tvdiff_us(cdr->end, cdr->answer) / 1000000.0));
+						} else {
+							ast_copy_string(colbuf, "0", sizeof(colbuf));
 						}
+					} else if (!strcasecmp(entry->cdrname, "duration")) {
+						snprintf(colbuf, sizeof(colbuf), "%lf",
+									(double) (ast_tvdiff_us(cdr->end, cdr->start) / 1000000.0));
 
-						if (sscanf(colptr, "%30lf", &number) != 1) {
-							ast_log(LOG_WARNING, "CDR variable %s is not an numeric type.\n", entry->name);
-							continue;
+						if (!ast_strlen_zero(colbuf)) {
+							colptr = colbuf;
 						}
+					}
 
-						ast_str_append(&sql, 0, "%s%s", first ? "" : ",", entry->name);
-						LENGTHEN_BUF2(entry->decimals);
-						ast_str_append(&sql2, 0, "%s%lf", first ? "" : ",", number);
+					if (sscanf(colptr, "%30lf", &number) != 1) {
+						ast_log(LOG_WARNING, "CDR variable %s is not an numeric type.\n", entry->name);
+						continue;
 					}
-					break;
-				default:
-					ast_log(LOG_WARNING, "Column type %d (field '%s:%s:%s') is unsupported at this time.\n", entry->type, tableptr->connection, tableptr->table, entry->name);
-					continue;
+
+					ast_str_append(cols, 0, "%s%s", first ? "" : ",", entry->name);
+					LENGTHEN_BUF2(entry->decimals);
+					ast_str_append(vals, 0, "%s%lf", first ? "" : ",", number);
 				}
-				first = 0;
-			} else if (entry->filtervalue
-				&& ((!entry->negatefiltervalue && entry->filtervalue[0] != '\0')
-					|| (entry->negatefiltervalue && entry->filtervalue[0] == '\0'))) {
-				ast_log(AST_LOG_WARNING, "CDR column '%s' was not set and does not match filter of"
-					" %s'%s'.  Cancelling this CDR.\n",
-					entry->cdrname, entry->negatefiltervalue ? "!" : "",
-					entry->filtervalue);
-				goto early_release;
+				break;
+			default:
+				ast_log(LOG_WARNING, "Column type %d (field '%s:%s:%s') is unsupported at this time.\n", entry->type, tableptr->connection, tableptr->table, entry->name);
+				continue;
 			}
+			first = 0;
+		} else if (entry->filtervalue
+			&& ((!entry->negatefiltervalue && entry->filtervalue[0] != '\0')
+				|| (entry->negatefiltervalue && entry->filtervalue[0] == '\0'))) {
+			ast_log(AST_LOG_WARNING, "CDR column '%s' was not set and does not match filter of"
+				" %s'%s'.  Cancelling this CDR.\n",
+				entry->cdrname, entry->negatefiltervalue ? "!" : "",
+				entry->filtervalue);
+			return 1;
 		}
+	}
 
-		/* Concatenate the two constructed buffers */
-		LENGTHEN_BUF1(ast_str_strlen(sql2));
-		ast_str_append(&sql, 0, ")");
-		ast_str_append(&sql2, 0, ")");
-		ast_str_append(&sql, 0, "%s", ast_str_buffer(sql2));
+	return 0;
+}
 
-		ast_debug(3, "Executing [%s]\n", ast_str_buffer(sql));
+/*!
+ * \internal
+ * \brief Start an insert statement into a table with its first row
+ */
+static void start_insert(struct ast_str **sql, struct tables *tableptr, struct ast_str *cols, struct ast_str *vals)
+{
+	if (ast_strlen_zero(tableptr->schema)) {
+		ast_str_set(sql, 0, "INSERT INTO %s (%s) VALUES (%s)", tableptr->table,
+			ast_str_buffer(cols), ast_str_buffer(vals));
+	} else {
+		ast_str_set(sql, 0, "INSERT INTO %s.%s (%s) VALUES (%s)", tableptr->schema, tableptr->table,
+			ast_str_buffer(cols), ast_str_buffer(vals));
+	}
+}
 
-		stmt = ast_odbc_prepare_and_execute(obj, generic_prepare, ast_str_buffer(sql));
-		if (stmt) {
-			SQLRowCount(stmt, &rows);
-			SQLFreeHandle(SQL_HANDLE_STMT, stmt);
-		}
-		if (rows == 0) {
-			ast_log(LOG_WARNING, "cdr_adaptive_odbc: Insert failed on '%s:%s'.  CDR failed: %s\n", tableptr->connection, tableptr->table, ast_str_buffer(sql));
+static int odbc_log(struct ast_cdr *cdr)
+{
+	struct tables *tableptr;
+	struct odbc_obj *obj;
+	struct ast_str *sql = ast_str_create(maxsize), *cols = ast_str_create(maxsize2), *vals = ast_str_create(maxsize2);
+	int res;
+
+	if (!sql || !cols || !vals) {
+		ast_free(sql);
+		ast_free(cols);
+		ast_free(vals);
+		return -1;
+	}
+
+	if (AST_RWLIST_RDLOCK(&odbc_tables)) {
+		ast_log(LOG_ERROR, "Unable to lock table list.  Insert CDR(s) failed.\n");
+		ast_free(sql);
+		ast_free(cols);
+		ast_free(vals);
+		return -1;
+	}
+
+	AST_LIST_TRAVERSE(&odbc_tables, tableptr, list) {
+		/* No need to check the connection now; we'll handle any failure in prepare_and_execute */
+		if (!(obj = ast_odbc_request_obj(tableptr->connection, 0))) {
+			ast_log(LOG_WARNING, "cdr_adaptive_odbc: Unable to retrieve database handle for '%s:%s'.  CDR failed.\n", tableptr->connection, tableptr->table);
+			continue;
 		}
-early_release:
+
+		res = build_row(tableptr, obj, cdr, &cols, &vals);
+
+		/* The handle was only needed to build the statement */
 		ast_odbc_release_obj(obj);
+		if (res) {
+			continue;
+		}
+
+		start_insert(&sql, tableptr, cols, vals);
+		ast_debug(3, "Executing [%s]\n", ast_str_buffer(sql));
+		queue_insert(tableptr, ast_str_buffer(sql), 1);
 	}
 	AST_RWLIST_UNLOCK(&odbc_tables);
 
@@ -756,12 +853,95 @@ early_release:
 	if (ast_str_strlen(sql) > maxsize) {
 		maxsize = ast_str_strlen(sql);
 	}
-	if (ast_str_strlen(sql2) > maxsize2) {
-		maxsize2 = ast_str_strlen(sql2);
+	if (ast_str_strlen(vals) > maxsize2) {
+		maxsize2 = ast_str_strlen(vals);
+	}
+
+	ast_free(sql);
+	ast_free(cols);
+	ast_free(vals);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Insert a batch of CDRs
+ *
+ * Consecutive CDRs that insert the same columns into a table are inserted
+ * with a single statement of up to the table's 'maxbatchrows' rows.
+ */
+static int odbc_log_batch(struct ast_cdr **cdrs, size_t count)
+{
+	struct tables *tableptr;
+	struct odbc_obj *obj;
+	struct ast_str *sql = ast_str_create(maxsize), *cols = ast_str_create(maxsize2), *vals = ast_str_create(maxsize2);
+	struct ast_str *batch_cols = ast_str_create(maxsize2);
+	unsigned int rows;
+	size_t idx;
+
+	if (!sql || !cols || !vals || !batch_cols) {
+		ast_free(sql);
+		ast_free(cols);
+		ast_free(vals);
+		ast_free(batch_cols);
+		return -1;
+	}
+
+	if (AST_RWLIST_RDLOCK(&odbc_tables)) {
+		ast_log(LOG_ERROR, "Unable to lock table list.  Insert CDR(s) failed.\n");
+		ast_free(sql);
+		ast_free(cols);
+		ast_free(vals);
+		ast_free(batch_cols);
+		return -1;
+	}
+
+	AST_LIST_TRAVERSE(&odbc_tables, tableptr, list) {
+		if (!(obj = ast_odbc_request_obj(tableptr->connection, 0))) {
+			ast_log(LOG_WARNING, "cdr_adaptive_odbc: Unable to retrieve database handle for '%s:%s'.  %zu CDRs failed.\n", tableptr->connection, tableptr->table, count);
+			continue;
+		}
+
+		rows = 0;
+		for (idx = 0; idx < count; idx++) {
+			if (build_row(tableptr, obj, cdrs[idx], &cols, &vals)) {
+				continue;
+			}
+
+			if (rows && (rows >= tableptr->maxbatchrows
+				|| strcmp(ast_str_buffer(cols), ast_str_buffer(batch_cols)))) {
+				ast_debug(3, "Executing [%s]\n", ast_str_buffer(sql));
+				queue_insert(tableptr, ast_str_buffer(sql), rows);
+				rows = 0;
+			}
+
+			if (!rows) {
+				ast_str_set(&batch_cols, 0, "%s", ast_str_buffer(cols));
+				start_insert(&sql, tableptr, cols, vals);
+			} else {
+				ast_str_append(&sql, 0, ",(%s)", ast_str_buffer(vals));
+			}
+			rows++;
+		}
+
+		/* The handle was only needed to build the statements */
+		ast_odbc_release_obj(obj);
+
+		if (rows) {
+			ast_debug(3, "Executing [%s]\n", ast_str_buffer(sql));
+			queue_insert(tableptr, ast_str_buffer(sql), rows);
+		}
+	}
+	AST_RWLIST_UNLOCK(&odbc_tables);
+
+	if (ast_str_strlen(vals) > maxsize2) {
+		maxsize2 = ast_str_strlen(vals);
 	}
 
 	ast_free(sql);
-	ast_free(sql2);
+	ast_free(cols);
+	ast_free(vals);
+	ast_free(batch_cols);
 	return 0;
 }
 
@@ -771,8 +951,13 @@ static int unload_module(void)
 		return -1;
 	}
 
+	/* Queued inserts call back into this module */
+	while (ast_atomic_fetchadd_int(&pending_inserts, 0)) {
+		usleep(10000);
+	}
+
 	if (AST_RWLIST_WRLOCK(&odbc_tables)) {
-		ast_cdr_register(name, ast_module_info->description, odbc_log);
+		ast_cdr_register_batch(name, ast_module_info->description, odbc_log, odbc_log_batch);
 		ast_log(LOG_ERROR, "Unable to lock column list.  Unload failed.\n");
 		return -1;
 	}
@@ -791,7 +976,7 @@ static int load_module(void)
 
 	load_config();
 	AST_RWLIST_UNLOCK(&odbc_tables);
-	ast_cdr_register(name, ast_module_info->description, odbc_log);
+	ast_cdr_register_batch(name, ast_module_info->description, odbc_log, odbc_log_batch);
 	return 0;
 }
 
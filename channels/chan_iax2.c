@@ -613,7 +613,17 @@ struct iax2_trunk_peer {
 	AST_LIST_ENTRY(iax2_trunk_peer) list;
 };
 
-static AST_LIST_HEAD_STATIC(tpeers, iax2_trunk_peer);
+/*! \brief Number of lists the trunk peers are spread over */
+#define TRUNK_PEER_SHARDS 32
+
+/*!
+ * \brief Trunk peers, hashed by address
+ *
+ * Queueing a frame only takes the lock of the trunk peer's own list, and
+ * the trunk timer sends one list at a time, so calls on different trunks
+ * do not wait on each other or on the timer.
+ */
+static AST_LIST_HEAD(tpeer_list, iax2_trunk_peer) tpeers[TRUNK_PEER_SHARDS];
 
 enum iax_reg_state {
 	REG_STATE_UNREGISTERED = 0,
@@ -909,18 +919,21 @@ enum callno_type {
 #define CALLNO_ENTRY_GET_CALLNO(a)    ((a) & 0x7FFF)
 
 struct call_number_pool {
+	/*! Protects available and numbers */
+	ast_mutex_t *lock;
 	size_t capacity;
 	size_t available;
 	callno_entry numbers[IAX_MAX_CALLS / 2 + 1];
 };
 
 AST_MUTEX_DEFINE_STATIC(callno_pool_lock);
+AST_MUTEX_DEFINE_STATIC(callno_pool_trunk_lock);
 
 /*! table of available call numbers */
-static struct call_number_pool callno_pool;
+static struct call_number_pool callno_pool = { .lock = &callno_pool_lock };
 
 /*! table of available trunk call numbers */
-static struct call_number_pool callno_pool_trunk;
+static struct call_number_pool callno_pool_trunk = { .lock = &callno_pool_trunk_lock };
 
 /*!
  * \brief a list of frames that may need to be retransmitted
@@ -974,7 +987,8 @@ static uint16_t global_maxcallno;
 /*! Total num of call numbers allowed to be allocated without calltoken validation */
 static uint16_t global_maxcallno_nonval;
 
-static uint16_t total_nonval_callno_used = 0;
+/*! \note Only changed with atomic operations */
+static int total_nonval_callno_used = 0;
 
 /*! peer connection private, keeps track of all the call numbers
  *  consumed by a single ip address */
@@ -2926,6 +2940,7 @@ static int get_unused_callno(enum callno_type type, int validated, callno_entry
 	struct call_number_pool *pool = NULL;
 	callno_entry swap;
 	size_t choice;
+	long int rand;
 
 	switch (type) {
 	case CALLNO_TYPE_NORMAL:
@@ -2942,26 +2957,35 @@ static int get_unused_callno(enum callno_type type, int validated, callno_entry
 	/* If we fail, make sure this has a defined value */
 	*entry = 0;
 
-	/* We lock here primarily to ensure thread safety of the
-	 * total_nonval_callno_used check and increment */
-	ast_mutex_lock(&callno_pool_lock);
+	/* Only a certain number of non-validated call numbers should be allocated.
+	 * If there ever is an attack, this separates the calltoken validating users
+	 * from the non-calltoken validating users.  The number is claimed before
+	 * checking so that racing allocations cannot both take the last one. */
+	if (!validated) {
+		int used = ast_atomic_fetchadd_int(&total_nonval_callno_used, 1);
+
+		if (used >= global_maxcallno_nonval) {
+			ast_atomic_fetchadd_int(&total_nonval_callno_used, -1);
+			ast_log(LOG_WARNING,
+				"NON-CallToken callnumber limit is reached. Current: %d Max: %d\n",
+				used,
+				global_maxcallno_nonval);
+			return 1;
+		}
+	}
+
+	/* Reading /dev/urandom is a system call, so do it before taking the lock */
+	rand = ast_random();
+
+	ast_mutex_lock(pool->lock);
 
 	/* Bail out if we don't have any available call numbers */
 	if (!pool->available) {
+		ast_mutex_unlock(pool->lock);
+		if (!validated) {
+			ast_atomic_fetchadd_int(&total_nonval_callno_used, -1);
+		}
 		ast_log(LOG_WARNING, "Out of call numbers\n");
-		ast_mutex_unlock(&callno_pool_lock);
-		return 1;
-	}
-
-	/* Only a certain number of non-validated call numbers should be allocated.
-	 * If there ever is an attack, this separates the calltoken validating users
-	 * from the non-calltoken validating users. */
-	if (!validated && total_nonval_callno_used >= global_maxcallno_nonval) {
-		ast_log(LOG_WARNING,
-			"NON-CallToken callnumber limit is reached. Current: %d Max: %d\n",
-			total_nonval_callno_used,
-			global_maxcallno_nonval);
-		ast_mutex_unlock(&callno_pool_lock);
 		return 1;
 	}
 
@@ -2979,7 +3003,7 @@ static int get_unused_callno(enum callno_type type, int validated, callno_entry
 	 * When numbers are returned to the pool, we put them just past x and bump x
 	 * by 1 so that this number is now available for re-use. */
 
-	choice = ast_random() % pool->available;
+	choice = rand % pool->available;
 
 	*entry = pool->numbers[choice];
 	swap = pool->numbers[pool->available - 1];
@@ -2987,14 +3011,12 @@ static int get_unused_callno(enum callno_type type, int validated, callno_entry
 	pool->numbers[choice] = swap;
 	pool->available--;
 
+	ast_mutex_unlock(pool->lock);
+
 	if (validated) {
 		CALLNO_ENTRY_SET_VALIDATED(*entry);
-	} else {
-		total_nonval_callno_used++;
 	}
 
-	ast_mutex_unlock(&callno_pool_lock);
-
 	return 0;
 }
 
@@ -3003,14 +3025,9 @@ static int replace_callno(const void *obj)
 	callno_entry entry = PTR_TO_CALLNO_ENTRY(obj);
 	struct call_number_pool *pool;
 
-	/* We lock here primarily to ensure thread safety of the
-	 * total_nonval_callno_used check and decrement */
-	ast_mutex_lock(&callno_pool_lock);
-
 	if (!CALLNO_ENTRY_IS_VALIDATED(entry)) {
-		if (total_nonval_callno_used) {
-			total_nonval_callno_used--;
-		} else {
+		if (ast_atomic_fetchadd_int(&total_nonval_callno_used, -1) <= 0) {
+			ast_atomic_fetchadd_int(&total_nonval_callno_used, 1);
 			ast_log(LOG_ERROR,
 				"Attempted to decrement total non calltoken validated "
 				"callnumbers below zero.  Callno is: %d\n",
@@ -3024,15 +3041,17 @@ static int replace_callno(const void *obj)
 		pool = &callno_pool_trunk;
 	}
 
-	ast_assert(pool->capacity > pool->available);
-
 	/* This clears the validated flag */
 	entry = CALLNO_ENTRY_GET_CALLNO(entry);
 
+	ast_mutex_lock(pool->lock);
+
+	ast_assert(pool->capacity > pool->available);
+
 	pool->numbers[pool->available] = entry;
 	pool->available++;
 
-	ast_mutex_unlock(&callno_pool_lock);
+	ast_mutex_unlock(pool->lock);
 
 	return 0;
 }
@@ -6253,14 +6272,27 @@ static unsigned int calc_rxstamp(struct chan_iax2_pvt *p, unsigned int offset)
 	return ms;
 }
 
+/*! \brief Find the list a trunk peer address hashes to */
+static struct tpeer_list *tpeer_shard(const struct ast_sockaddr *addr)
+{
+	unsigned int hash = ast_sockaddr_hash(addr) + ast_sockaddr_port(addr);
+
+	/* IPv4 addresses hash in network byte order so fold in every byte */
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+
+	return &tpeers[hash % TRUNK_PEER_SHARDS];
+}
+
 static struct iax2_trunk_peer *find_tpeer(struct ast_sockaddr *addr, int fd)
 {
+	struct tpeer_list *shard = tpeer_shard(addr);
 	struct iax2_trunk_peer *tpeer = NULL;
 
 	/* Finds and locks trunk peer */
-	AST_LIST_LOCK(&tpeers);
+	AST_LIST_LOCK(shard);
 
-	AST_LIST_TRAVERSE(&tpeers, tpeer, list) {
+	AST_LIST_TRAVERSE(shard, tpeer, list) {
 		if (!ast_sockaddr_cmp(&tpeer->addr, addr)) {
 			ast_mutex_lock(&tpeer->lock);
 			break;
@@ -6280,11 +6312,11 @@ static struct iax2_trunk_peer *find_tpeer(struct ast_sockaddr *addr, int fd)
 			setsockopt(tpeer->sockfd, SOL_SOCKET, SO_NO_CHECK, &nochecksums, sizeof(nochecksums));
 #endif
 			ast_debug(1, "Created trunk peer for '%s'\n", ast_sockaddr_stringify(&tpeer->addr));
-			AST_LIST_INSERT_TAIL(&tpeers, tpeer, list);
+			AST_LIST_INSERT_TAIL(shard, tpeer, list);
 		}
 	}
 
-	AST_LIST_UNLOCK(&tpeers);
+	AST_LIST_UNLOCK(shard);
 
 	return tpeer;
 }
@@ -9459,38 +9491,30 @@ static inline int iax2_trunk_expired(struct iax2_trunk_peer *tpeer, struct timev
 	return 0;
 }
 
-static int timing_read(int *id, int fd, short events, void *cbdata)
+/*!
+ * \brief Send the trunk data queued on the trunk peers of one list
+ *
+ * \return The number of call chunks sent.
+ */
+static int send_trunk_shard(struct tpeer_list *shard, struct timeval *now, int *processed)
 {
-	int res, processed = 0, totalcalls = 0;
+	int res, totalcalls = 0;
 	struct iax2_trunk_peer *tpeer = NULL, *drop = NULL;
-	struct timeval now = ast_tvnow();
 
-	if (iaxtrunkdebug) {
-		ast_verbose("Beginning trunk processing. Trunk queue ceiling is %d bytes per host\n", trunkmaxsize);
-	}
-
-	if (timer) {
-		if (ast_timer_ack(timer, 1) < 0) {
-			ast_log(LOG_ERROR, "Timer failed acknowledge\n");
-			return 0;
-		}
-	}
-
-	/* For each peer that supports trunking... */
-	AST_LIST_LOCK(&tpeers);
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&tpeers, tpeer, list) {
-		processed++;
+	AST_LIST_LOCK(shard);
+	AST_LIST_TRAVERSE_SAFE_BEGIN(shard, tpeer, list) {
+		(*processed)++;
 		res = 0;
 		ast_mutex_lock(&tpeer->lock);
 		/* We can drop a single tpeer per pass.  That makes all this logic
 		   substantially easier */
-		if (!drop && iax2_trunk_expired(tpeer, &now)) {
+		if (!drop && iax2_trunk_expired(tpeer, now)) {
 			/* Take it out of the list, but don't free it yet, because it
 			   could be in use */
 			AST_LIST_REMOVE_CURRENT(list);
 			drop = tpeer;
 		} else {
-			res = send_trunk(tpeer, &now);
+			res = send_trunk(tpeer, now);
 			trunk_timed++;
 			if (iaxtrunkdebug) {
 				ast_verbose(" - Trunk peer (%s) has %d call chunk%s in transit, %u bytes backloged and has hit a high water mark of %u bytes\n",
@@ -9506,12 +9530,12 @@ static int timing_read(int *id, int fd, short events, void *cbdata)
 		ast_mutex_unlock(&tpeer->lock);
 	}
 	AST_LIST_TRAVERSE_SAFE_END;
-	AST_LIST_UNLOCK(&tpeers);
+	AST_LIST_UNLOCK(shard);
 
 	if (drop) {
 		ast_mutex_lock(&drop->lock);
 		/*  Once we have this lock, we're sure nobody else is using it or could use it once we release it,
-			because by the time they could get tpeerlock, we've already grabbed it */
+			because by the time they could get the list lock, we've already grabbed it */
 		ast_debug(1, "Dropping unused iax2 trunk peer '%s'\n", ast_sockaddr_stringify(&drop->addr));
 		if (drop->trunkdata) {
 			ast_free(drop->trunkdata);
@@ -9522,6 +9546,30 @@ static int timing_read(int *id, int fd, short events, void *cbdata)
 		ast_free(drop);
 	}
 
+	return totalcalls;
+}
+
+static int timing_read(int *id, int fd, short events, void *cbdata)
+{
+	int x, processed = 0, totalcalls = 0;
+	struct timeval now = ast_tvnow();
+
+	if (iaxtrunkdebug) {
+		ast_verbose("Beginning trunk processing. Trunk queue ceiling is %d bytes per host\n", trunkmaxsize);
+	}
+
+	if (timer) {
+		if (ast_timer_ack(timer, 1) < 0) {
+			ast_log(LOG_ERROR, "Timer failed acknowledge\n");
+			return 0;
+		}
+	}
+
+	/* For each peer that supports trunking... */
+	for (x = 0; x < TRUNK_PEER_SHARDS; x++) {
+		totalcalls += send_trunk_shard(&tpeers[x], &now, &processed);
+	}
+
 	if (iaxtrunkdebug) {
 		ast_verbose("Ending trunk processing with %d peers and %d call chunks processed\n", processed, totalcalls);
 	}
@@ -14762,6 +14810,17 @@ static int __unload_module(void)
 		ast_mutex_destroy(&iaxsl[x]);
 	}
 
+	for (x = 0; x < TRUNK_PEER_SHARDS; x++) {
+		struct iax2_trunk_peer *tpeer;
+
+		while ((tpeer = AST_LIST_REMOVE_HEAD(&tpeers[x], list))) {
+			ast_mutex_destroy(&tpeer->lock);
+			ast_free(tpeer->trunkdata);
+			ast_free(tpeer);
+		}
+		AST_LIST_HEAD_DESTROY(&tpeers[x]);
+	}
+
 	ao2_ref(peers, -1);
 	ao2_ref(users, -1);
 	ao2_ref(iax_peercallno_pvts, -1);
@@ -14849,9 +14908,11 @@ static int load_objects(void)
 		goto container_fail;
 	} else if (!(users = ao2_container_alloc(MAX_USER_BUCKETS, user_hash_cb, user_cmp_cb))) {
 		goto container_fail;
-	} else if (!(iax_peercallno_pvts = ao2_container_alloc(IAX_MAX_CALLS, pvt_hash_cb, pvt_cmp_cb))) {
+	} else if (!(iax_peercallno_pvts = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0,
+		IAX_MAX_CALLS, pvt_hash_cb, NULL, pvt_cmp_cb))) {
 		goto container_fail;
-	} else if (!(iax_transfercallno_pvts = ao2_container_alloc(IAX_MAX_CALLS, transfercallno_pvt_hash_cb, transfercallno_pvt_cmp_cb))) {
+	} else if (!(iax_transfercallno_pvts = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0,
+		IAX_MAX_CALLS, transfercallno_pvt_hash_cb, NULL, transfercallno_pvt_cmp_cb))) {
 		goto container_fail;
 	} else if (!(peercnts = ao2_container_alloc(MAX_PEER_BUCKETS, peercnt_hash_cb, peercnt_cmp_cb))) {
 		goto container_fail;
@@ -15110,6 +15171,10 @@ static int load_module(void)
 		ast_mutex_init(&iaxsl[x]);
 	}
 
+	for (x = 0; x < TRUNK_PEER_SHARDS; x++) {
+		AST_LIST_HEAD_INIT(&tpeers[x]);
+	}
+
 	if (!(sched = ast_sched_context_create())) {
 		ast_log(LOG_ERROR, "Failed to create scheduler thread\n");
 		ao2_ref(iax2_tech.capabilities, -1);
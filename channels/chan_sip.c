@@ -285,6 +285,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/features_config.h"
 #include "asterisk/http_websocket.h"
 #include "asterisk/format_cache.h"
+#include "asterisk/taskprocessor.h"
 
 /*** DOCUMENTATION
 	<application name="SIPDtmfMode" language="en_US">
@@ -621,6 +622,7 @@ static int mwi_expiry = DEFAULT_MWI_EXPIRY;
 static int unauth_sessions = 0;
 static int authlimit = DEFAULT_AUTHLIMIT;
 static int authtimeout = DEFAULT_AUTHTIMEOUT;
+static int udp_workers_count = DEFAULT_UDP_WORKERS; /*!< Configured number of UDP workers */
 
 /*! \brief Global jitterbuffer configuration - by default, jb is disabled
  *  \note Values shown here match the defaults shown in sip.conf.sample */
@@ -839,6 +841,27 @@ static char used_context[AST_MAX_CONTEXT];        /*!< name of automatically cre
 
 AST_MUTEX_DEFINE_STATIC(netlock);
 
+/*! \brief Number of locks serializing the handling of messages by Call-ID */
+#define REQUEST_LOCKS 64
+
+/*!
+ * \brief Locks serializing the handling of received messages
+ *
+ * Messages are handled under the lock chosen by their Call-ID, so messages
+ * for the same dialog are handled one at a time while messages for other
+ * dialogs are handled at the same time by other threads.
+ */
+static ast_mutex_t request_locks[REQUEST_LOCKS];
+
+/*!
+ * \brief Taskprocessors handling UDP messages, chosen by Call-ID
+ *
+ * \note Only the monitor thread pushes to these, and they are only changed by
+ * the monitor thread or while it is not running.
+ */
+static struct ast_taskprocessor *udp_workers[SIP_MAX_UDP_WORKERS];
+static int udp_workers_running;
+
 /*! \brief Protect the monitoring thread, so only one process can kill or start it, and not
    when it's doing something critical. */
 AST_MUTEX_DEFINE_STATIC(monlock);
@@ -1135,6 +1158,8 @@ static int sip_queryoption(struct ast_channel *chan, int option, void *data, int
 static const char *sip_get_callid(struct ast_channel *chan);
 
 static int handle_request_do(struct sip_request *req, struct ast_sockaddr *addr);
+static int parse_incoming(struct sip_request *req, struct ast_sockaddr *addr);
+static int handle_parsed_request(struct sip_request *req, struct ast_sockaddr *addr);
 static int sip_standard_port(enum ast_transport type, int port);
 static int sip_prepare_socket(struct sip_pvt *p);
 static int get_address_family_filter(unsigned int transport);
@@ -8473,6 +8498,77 @@ static const char *find_full_alias(const char *name, const char *_default)
 	return _default;
 }
 
+/*!
+ * \brief Hash a header name into a bucket of the header index
+ *
+ * Case is ignored and compact forms hash the same as their full names, so
+ * every spelling __get_header() accepts for a name is in the same bucket.
+ */
+static unsigned int header_name_bucket(const char *name, size_t len)
+{
+	unsigned int hash = 0;
+
+	if (len == 1) {
+		char shortname[2] = { name[0], '\0' };
+		const char *fullname = find_full_alias(shortname, NULL);
+
+		if (fullname) {
+			name = fullname;
+			len = strlen(fullname);
+		}
+	}
+
+	while (len--) {
+		hash = hash * 33 + tolower(*name++);
+	}
+
+	return hash & (SIP_HEADER_BUCKETS - 1);
+}
+
+/*! \brief Index the headers of a parsed SIP message by name */
+static void index_headers(struct sip_request *req)
+{
+	unsigned char tail[SIP_HEADER_BUCKETS] = { 0, };
+	int x;
+
+	memset(req->header_bucket, 0, sizeof(req->header_bucket));
+	for (x = 0; x < req->headers; x++) {
+		const char *header = REQ_OFFSET_TO_STR(req, header[x]);
+		unsigned int bucket = header_name_bucket(header, strcspn(header, ": \t"));
+
+		/* Headers are chained in order, so matches are found in their order in the message */
+		req->header_next[x] = 0;
+		if (tail[bucket]) {
+			req->header_next[tail[bucket] - 1] = x + 1;
+		} else {
+			req->header_bucket[bucket] = x + 1;
+		}
+		tail[bucket] = x + 1;
+	}
+	req->header_indexed = 1;
+}
+
+/*! \brief Get the value of a header line if it has the given name, or NULL */
+static const char *header_value(const char *header, const char *name, int len, const char *sname, int slen)
+{
+	int match = !strncasecmp(header, name, len);
+	int smatch = slen ? !strncasecmp(header, sname, slen) : 0;
+
+	if (match || smatch) {
+		/* skip name */
+		const char *r = header + (match ? len : slen );
+		/* HCOLON has optional SP/HTAB; skip past those */
+		while (*r == ' ' || *r == '\t') {
+			++r;
+		}
+		if (*r == ':') {
+			return ast_skip_blanks(r+1);
+		}
+	}
+
+	return NULL;
+}
+
 static const char *__get_header(const struct sip_request *req, const char *name, int *start)
 {
 	/*
@@ -8484,24 +8580,29 @@ static const char *__get_header(const struct sip_request *req, const char *name,
 	 */
 	const char *sname = find_alias(name, NULL);
 	int x, len = strlen(name), slen = (sname ? 1 : 0);
-	for (x = *start; x < req->headers; x++) {
-		const char *header = REQ_OFFSET_TO_STR(req, header[x]);
-		int smatch = 0, match = !strncasecmp(header, name, len);
-		if (slen) {
-			smatch = !strncasecmp(header, sname, slen);
-		}
-		if (match || smatch) {
-			/* skip name */
-			const char *r = header + (match ? len : slen );
-			/* HCOLON has optional SP/HTAB; skip past those */
-			while (*r == ' ' || *r == '\t') {
-				++r;
+	const char *value;
+
+	if (req->header_indexed) {
+		for (x = req->header_bucket[header_name_bucket(name, len)]; x; x = req->header_next[x - 1]) {
+			if (x - 1 < *start) {
+				continue;
 			}
-			if (*r == ':') {
-				*start = x+1;
-				return ast_skip_blanks(r+1);
+			value = header_value(REQ_OFFSET_TO_STR(req, header[x - 1]), name, len, sname, slen);
+			if (value) {
+				*start = x;
+				return value;
 			}
 		}
+
+		return "";
+	}
+
+	for (x = *start; x < req->headers; x++) {
+		value = header_value(REQ_OFFSET_TO_STR(req, header[x]), name, len, sname, slen);
+		if (value) {
+			*start = x+1;
+			return value;
+		}
 	}
 
 	/* Don't return NULL, so sip_get_header is always a valid pointer */
@@ -9956,6 +10057,8 @@ static int parse_request(struct sip_request *req)
 		ast_log(LOG_WARNING, "Too many lines, skipping <%s>\n", c);
 	}
 
+	index_headers(req);
+
 	/* Split up the first line parts */
 	return determine_firstline_parts(req);
 }
@@ -11750,6 +11853,7 @@ static int add_header(struct sip_request *req, const char *var, const char *valu
 	req->header[req->headers] = ast_str_strlen(req->data);
 
 	req->headers++;
+	req->header_indexed = 0;
 
 	return 0;
 }
@@ -28964,6 +29068,81 @@ static int handle_incoming(struct sip_pvt *p, struct sip_request *req, struct as
 \return 1 on error, 0 on success
 \note Successful messages is connected to SIP call and forwarded to handle_incoming()
 */
+/*! \brief A UDP message handed to a worker */
+struct udp_message {
+	struct sip_request req;
+	struct ast_sockaddr addr;
+};
+
+static int udp_message_handle(void *data)
+{
+	struct udp_message *msg = data;
+
+	handle_parsed_request(&msg->req, &msg->addr);
+	deinit_req(&msg->req);
+	ast_free(msg);
+
+	return 0;
+}
+
+/*!
+ * \brief Parse a UDP message and hand it to the worker for its Call-ID
+ *
+ * All messages for a dialog go to the same worker, so they are handled in
+ * the order they were read.
+ *
+ * \note The request's data is taken over, or freed if the message is dropped.
+ */
+static void udp_message_dispatch(struct sip_request *req, struct ast_sockaddr *addr)
+{
+	struct udp_message *msg;
+	const char *callid;
+
+	if (parse_incoming(req, addr) || !(msg = ast_malloc(sizeof(*msg)))) {
+		deinit_req(req);
+		return;
+	}
+
+	/* The header offsets are relative to the data, so the request can be moved */
+	msg->req = *req;
+	ast_sockaddr_copy(&msg->addr, addr);
+
+	callid = sip_get_header(&msg->req, "Call-ID");
+	if (ast_taskprocessor_push(udp_workers[ast_str_hash(callid) % udp_workers_running],
+			udp_message_handle, msg)) {
+		deinit_req(&msg->req);
+		ast_free(msg);
+	}
+}
+
+/*!
+ * \brief Change the number of UDP workers
+ *
+ * \note Called from the monitor thread, or while it is not running.
+ */
+static void udp_workers_set(int count)
+{
+	char name[AST_TASKPROCESSOR_MAX_NAME + 1];
+	int i;
+
+	for (i = udp_workers_running; i < count; ++i) {
+		snprintf(name, sizeof(name), "chan_sip/udp-%d", i);
+		if (!(udp_workers[i] = ast_taskprocessor_get(name, TPS_REF_DEFAULT))) {
+			ast_log(LOG_WARNING, "Unable to create UDP worker, %d will be used\n", i);
+			count = i;
+			break;
+		}
+	}
+	for (i = count; i < udp_workers_running; ++i) {
+		/* Let the worker handle the messages it was given before it goes */
+		while (ast_taskprocessor_size(udp_workers[i])) {
+			usleep(1000);
+		}
+		udp_workers[i] = ast_taskprocessor_unreference(udp_workers[i]);
+	}
+	udp_workers_running = count;
+}
+
 static int sipsock_read(int *id, int fd, short events, void *ignore)
 {
 	struct sip_request req;
@@ -28999,23 +29178,25 @@ static int sipsock_read(int *id, int fd, short events, void *ignore)
 	req.socket.tcptls_session	= NULL;
 	req.socket.port = htons(ast_sockaddr_port(&bindaddr));
 
+	if (udp_workers_running) {
+		udp_message_dispatch(&req, &addr);
+		return 1;
+	}
+
 	handle_request_do(&req, &addr);
 	deinit_req(&req);
 
 	return 1;
 }
 
-/*! \brief Handle incoming SIP message - request or response
-
- 	This is used for all transports (udp, tcp and tcp/tls)
-*/
-static int handle_request_do(struct sip_request *req, struct ast_sockaddr *addr)
+/*!
+ * \brief Parse an incoming SIP message
+ *
+ * \retval 0 the message is to be handled
+ * \retval -1 the message is to be dropped
+ */
+static int parse_incoming(struct sip_request *req, struct ast_sockaddr *addr)
 {
-	struct sip_pvt *p;
-	struct ast_channel *owner_chan_ref = NULL;
-	int recount = 0;
-	int nounlock = 0;
-
 	if (sip_debug_test_addr(addr))	/* Set the debug flag early on packet level */
 		req->debug = 1;
 	if (sip_cfg.pedanticsipchecking)
@@ -29027,7 +29208,7 @@ static int handle_request_do(struct sip_request *req, struct ast_sockaddr *addr)
 
 	if (parse_request(req) == -1) { /* Bad packet, can't parse */
 		ast_str_reset(req->data); /* nulling this out is NOT a good idea here. */
-		return 1;
+		return -1;
 	}
 	req->method = find_sip_method(REQ_OFFSET_TO_STR(req, rlpart1));
 
@@ -29036,15 +29217,34 @@ static int handle_request_do(struct sip_request *req, struct ast_sockaddr *addr)
 
 	if (req->headers < 2) {	/* Must have at least two headers */
 		ast_str_reset(req->data); /* nulling this out is NOT a good idea here. */
-		return 1;
+		return -1;
 	}
-	ast_mutex_lock(&netlock);
+
+	return 0;
+}
+
+/*! \brief Get the lock serializing the handling of a parsed message */
+static ast_mutex_t *request_lock(const struct sip_request *req)
+{
+	return &request_locks[ast_str_hash(sip_get_header(req, "Call-ID")) % REQUEST_LOCKS];
+}
+
+/*! \brief Handle a parsed SIP message - request or response */
+static int handle_parsed_request(struct sip_request *req, struct ast_sockaddr *addr)
+{
+	struct sip_pvt *p;
+	struct ast_channel *owner_chan_ref = NULL;
+	int recount = 0;
+	int nounlock = 0;
+	ast_mutex_t *lock = request_lock(req);
+
+	ast_mutex_lock(lock);
 
 	/* Find the active SIP dialog or create a new one */
 	p = find_call(req, addr, req->method);	/* returns p with a reference only. _NOT_ locked*/
 	if (p == NULL) {
 		ast_debug(1, "Invalid SIP message - rejected , no callid, len %zu\n", ast_str_strlen(req->data));
-		ast_mutex_unlock(&netlock);
+		ast_mutex_unlock(lock);
 		return 1;
 	}
 
@@ -29084,7 +29284,7 @@ static int handle_request_do(struct sip_request *req, struct ast_sockaddr *addr)
 		ast_channel_unref(owner_chan_ref);
 	}
 	sip_pvt_unlock(p);
-	ast_mutex_unlock(&netlock);
+	ast_mutex_unlock(lock);
 
 	if (p->logger_callid) {
 		ast_callid_threadassoc_remove();
@@ -29094,6 +29294,19 @@ static int handle_request_do(struct sip_request *req, struct ast_sockaddr *addr)
 	return 1;
 }
 
+/*! \brief Handle incoming SIP message - request or response
+
+ 	This is used for all transports (udp, tcp and tcp/tls)
+*/
+static int handle_request_do(struct sip_request *req, struct ast_sockaddr *addr)
+{
+	if (parse_incoming(req, addr)) {
+		return 1;
+	}
+
+	return handle_parsed_request(req, addr);
+}
+
 /*! \brief Returns the port to use for this socket
  *
  * \param type The type of transport used
@@ -32287,6 +32500,7 @@ static int reload_config(enum channelreloadreason reason)
 	global_refer_addheaders = TRUE;
 	authlimit = DEFAULT_AUTHLIMIT;
 	authtimeout = DEFAULT_AUTHTIMEOUT;
+	udp_workers_count = DEFAULT_UDP_WORKERS;
 	global_store_sip_cause = DEFAULT_STORE_SIP_CAUSE;
 	min_expiry = DEFAULT_MIN_EXPIRY;
 	max_expiry = DEFAULT_MAX_EXPIRY;
@@ -32595,6 +32809,12 @@ static int reload_config(enum channelreloadreason reason)
 				ast_log(LOG_WARNING, "Invalid %s '%s' at line %d of %s\n",
 					v->name, v->value, v->lineno, config);
 			}
+		} else if (!strcasecmp(v->name, "udpworkers")) {
+			if (ast_parse_arg(v->value, PARSE_INT32|PARSE_DEFAULT|PARSE_IN_RANGE,
+					  &udp_workers_count, DEFAULT_UDP_WORKERS, 0, SIP_MAX_UDP_WORKERS)) {
+				ast_log(LOG_WARNING, "Invalid %s '%s' at line %d of %s\n",
+					v->name, v->value, v->lineno, config);
+			}
 		} else if (!strcasecmp(v->name, "sipdebug")) {
 			if (ast_true(v->value))
 				sipdebug |= sip_debug_config;
@@ -32991,6 +33211,8 @@ static int reload_config(enum channelreloadreason reason)
 	}
 	ast_mutex_unlock(&netlock);
 
+	udp_workers_set(udp_workers_count);
+
 	/* Start TCP server */
 	if (sip_cfg.tcp_enabled) {
 		if (ast_sockaddr_isnull(&sip_tcp_desc.local_address)) {
@@ -35038,6 +35260,91 @@ AST_TEST_DEFINE(get_in_brackets_const_test)
 	return AST_TEST_PASS;
 }
 
+AST_TEST_DEFINE(test_sip_header_index)
+{
+	static const char *names[] = {
+		"Via", "v", "VIA", "From", "f", "To", "t", "Call-ID", "i", "CSeq", "Contact",
+		"m", "Content-Length", "l", "Subject", "X-Custom", "x-custom", "X", "Topic",
+		"INVITE", "Allow-Events", "u", "Event", "Max-Forwards",
+	};
+	struct sip_request req = { 0, };
+	const char *indexed;
+	const char *scanned;
+	int indexed_start;
+	int scanned_start;
+	int i;
+	enum ast_test_result_state res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "sip_header_index";
+		info->category = "/channels/chan_sip/";
+		info->summary = "SIP header index test";
+		info->description =
+			"Checks that looking up headers through the index built when a\n"
+			"message is parsed finds the same headers, in the same order, as\n"
+			"scanning the headers, including compact and differently cased names.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!(req.data = ast_str_create(SIP_MIN_PACKET))) {
+		return AST_TEST_FAIL;
+	}
+	ast_str_set(&req.data, 0,
+		"INVITE sip:bob@example.org SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 127.0.0.1:5061;branch=z9hG4bK-1\r\n"
+		"v: SIP/2.0/UDP 127.0.0.2:5060;branch=z9hG4bK-2\r\n"
+		"f: sipp <sip:127.0.0.1:5061>;tag=12345\r\n"
+		"To : <sip:bob@example.org:5060>\r\n"
+		"Topic: not the To header\r\n"
+		"i: 12345\r\n"
+		"CSeq: 1 INVITE\r\n"
+		"Contact: <sip:127.0.0.1:5061>\r\n"
+		"m: <sip:127.0.0.1:5062>\r\n"
+		"x-CUSTOM:custom\r\n"
+		"X: single letter\r\n"
+		"u: presence\r\n"
+		"Max-Forwards: 70\r\n"
+		"l: 0\r\n"
+		"\r\n");
+	parse_request(&req);
+
+	if (!req.header_indexed) {
+		ast_test_status_update(test, "Parsed message was not indexed\n");
+		res = AST_TEST_FAIL;
+	}
+
+	for (i = 0; i < ARRAY_LEN(names); ++i) {
+		indexed_start = scanned_start = 0;
+		do {
+			req.header_indexed = 1;
+			indexed = __get_header(&req, names[i], &indexed_start);
+			req.header_indexed = 0;
+			scanned = __get_header(&req, names[i], &scanned_start);
+			if (strcmp(indexed, scanned) || indexed_start != scanned_start) {
+				ast_test_status_update(test, "Header '%s' found '%s' at %d, expected '%s' at %d\n",
+					names[i], indexed, indexed_start, scanned, scanned_start);
+				res = AST_TEST_FAIL;
+				break;
+			}
+		} while (!ast_strlen_zero(indexed));
+	}
+	req.header_indexed = 1;
+
+	if (strcmp(sip_get_header(&req, "call-id"), "12345")
+		|| strcmp(sip_get_header(&req, "to"), "<sip:bob@example.org:5060>")
+		|| strcmp(sip_get_header(&req, "X-Custom"), "custom")
+		|| !ast_strlen_zero(sip_get_header(&req, "Record-Route"))) {
+		ast_test_status_update(test, "Unexpected header values\n");
+		res = AST_TEST_FAIL;
+	}
+
+	ast_free(req.data);
+	return res;
+}
+
 #endif
 
 #define DATA_EXPORT_SIP_PEER(MEMBER)				\
@@ -35225,8 +35532,14 @@ static int unload_module(void);
 static int load_module(void)
 {
 	struct sip_peer *bogus_peer;
+	int i;
 
 	ast_verbose("SIP channel loading...\n");
+
+	for (i = 0; i < ARRAY_LEN(request_locks); ++i) {
+		ast_mutex_init(&request_locks[i]);
+	}
+
 	log_level = ast_logger_register_level("SIP_HISTORY");
 	if (log_level < 0) {
 		ast_log(LOG_WARNING, "Unable to register history log level\n");
@@ -35251,7 +35564,9 @@ static int load_module(void)
 	/* if the number of objects gets above MAX_XXX_BUCKETS, things will slow down */
 	peers = ao2_t_container_alloc(HASH_PEER_SIZE, peer_hash_cb, peer_cmp_cb, "allocate peers");
 	peers_by_ip = ao2_t_container_alloc(HASH_PEER_SIZE, peer_iphash_cb, peer_ipcmp_cb, "allocate peers_by_ip");
-	dialogs = ao2_t_container_alloc(HASH_DIALOG_SIZE, dialog_hash_cb, dialog_cmp_cb, "allocate dialogs");
+	/* Dialogs are looked up far more often than added, often from several threads */
+	dialogs = ao2_t_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0, HASH_DIALOG_SIZE,
+		dialog_hash_cb, NULL, dialog_cmp_cb, "allocate dialogs");
 	dialogs_needdestroy = ao2_t_container_alloc(1, NULL, NULL, "allocate dialogs_needdestroy");
 	dialogs_rtpcheck = ao2_t_container_alloc(HASH_DIALOG_SIZE, dialog_hash_cb, dialog_cmp_cb, "allocate dialogs for rtpchecks");
 	threadt = ao2_t_container_alloc(HASH_DIALOG_SIZE, threadt_hash_cb, threadt_cmp_cb, "allocate threadt table");
@@ -35328,6 +35643,7 @@ static int load_module(void)
 	AST_TEST_REGISTER(test_sip_mwi_subscribe_parse);
 	AST_TEST_REGISTER(test_tcp_message_fragmentation);
 	AST_TEST_REGISTER(get_in_brackets_const_test);
+	AST_TEST_REGISTER(test_sip_header_index);
 #endif
 
 	/* Register AstData providers */
@@ -35429,6 +35745,7 @@ static int unload_module(void)
 	struct sip_threadinfo *th;
 	struct ao2_iterator i;
 	struct timeval start;
+	int x;
 
 	ast_sched_dump(sched);
 
@@ -35463,6 +35780,7 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(test_sip_mwi_subscribe_parse);
 	AST_TEST_UNREGISTER(test_tcp_message_fragmentation);
 	AST_TEST_UNREGISTER(get_in_brackets_const_test);
+	AST_TEST_UNREGISTER(test_sip_header_index);
 #endif
 	/* Unregister all the AstData providers */
 	ast_data_unregister(NULL);
@@ -35522,6 +35840,9 @@ static int unload_module(void)
 		ast_mutex_unlock(&monlock);
 	}
 
+	/* Nothing reads UDP messages now, so let the workers finish */
+	udp_workers_set(0);
+
 	/* Clear containers */
 	unlink_all_peers_from_tables();
 	cleanup_all_regs();
@@ -35633,6 +35954,10 @@ static int unload_module(void)
 		ast_logger_unregister_level("SIP_HISTORY");
 	}
 
+	for (x = 0; x < ARRAY_LEN(request_locks); ++x) {
+		ast_mutex_destroy(&request_locks[x]);
+	}
+
 	return 0;
 }
 
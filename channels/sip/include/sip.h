@@ -68,6 +68,8 @@
 
 #define DEFAULT_AUTHLIMIT            100
 #define DEFAULT_AUTHTIMEOUT          30
+#define DEFAULT_UDP_WORKERS          0       /*!< Threads handling UDP messages by Call-ID, 0 to handle them on the monitor thread */
+#define SIP_MAX_UDP_WORKERS          64
 
 /* guard limit must be larger than guard secs */
 /* guard min must be < 1000, and should be >= 250 */
@@ -103,6 +105,7 @@
 
 #define SIP_MAX_HEADERS           64     /*!< Max amount of SIP headers to read */
 #define SIP_MAX_LINES             256    /*!< Max amount of lines in SIP attachment (like SDP) */
+#define SIP_HEADER_BUCKETS        32     /*!< Buckets in the header index of a parsed SIP message, a power of two */
 #define SIP_MAX_PACKET_SIZE       20480  /*!< Max SIP packet size */
 #define SIP_MIN_PACKET            4096   /*!< Initialize size of memory to allocate for packets */
 #define MAX_HISTORY_ENTRIES		  50	 /*!< Max entires in the history list for a sip_pvt */
@@ -824,7 +827,10 @@ struct sip_request {
 	char has_to_tag;        /*!< non-zero if packet has To: tag */
 	char ignore;            /*!< if non-zero This is a re-transmit, ignore it */
 	char authenticated;     /*!< non-zero if this request was authenticated */
+	char header_indexed;    /*!< non-zero if header_bucket and header_next index the headers */
 	ptrdiff_t header[SIP_MAX_HEADERS]; /*!< Array of offsets into the request string of each SIP header*/
+	unsigned char header_bucket[SIP_HEADER_BUCKETS]; /*!< First header (index + 1) with a name hashing to each bucket, 0 if none */
+	unsigned char header_next[SIP_MAX_HEADERS];      /*!< Next header (index + 1) in the same bucket, 0 if none */
 	ptrdiff_t line[SIP_MAX_LINES];     /*!< Array of offsets into the request string of each SDP line*/
 	struct ast_str *data;
 	struct ast_str *content;
@@ -749,6 +749,8 @@ static int register_translator(uint32_t dst_dahdi_fmt, uint32_t src_dahdi_fmt)
 	zt->t.newpvt = dahdi_new;
 	zt->t.sample = fakesrc_sample;
 	zt->t.native_plc = 0;
+	/* The hardware does the work, so always prefer it to software. */
+	zt->t.fixed_comp_cost = 1;
 
 	zt->t.desc_size = sizeof(struct codec_dahdi_pvt);
 	if ((res = ast_register_translator(&zt->t))) {
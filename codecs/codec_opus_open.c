@@ -0,0 +1,553 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ *
+ * \brief Translate between signed linear and Opus
+ *
+ * \ingroup codecs
+ *
+ * The Opus library - http://opus-codec.org
+ *
+ * Signed linear audio of each rate the Opus encoder and decoder work at is
+ * translated directly, without resampling to 48 kHz first.  Encoder and
+ * decoder states are kept in pools for the next translation paths, and the
+ * complexity of the encoders can follow the CPU time Asterisk uses.
+ */
+
+/*** MODULEINFO
+	<depend>opus</depend>
+	<support_level>extended</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <sys/resource.h>
+#include <opus/opus.h>
+
+#include "asterisk/module.h"
+#include "asterisk/translate.h"
+#include "asterisk/format.h"
+#include "asterisk/format_cache.h"
+#include "asterisk/config.h"
+#include "asterisk/lock.h"
+#include "asterisk/opus.h"
+#include "asterisk/slin.h"
+#include "asterisk/utils.h"
+
+/*! \brief Rate of the Opus RTP clock, whatever the rate of the audio */
+#define OPUS_RATE 48000
+
+/*! \brief Samples of 120 ms at 48 kHz, the longest an Opus packet holds */
+#define OPUS_MAX_SAMPLES 5760
+
+#define BUFFER_SAMPLES (OPUS_MAX_SAMPLES * 2)
+
+/*! \brief Largest packet the encoder is allowed to produce */
+#define OPUS_MAX_PACKET 1275
+
+/*! \brief Most idle encoders or decoders kept per translator */
+#define OPUS_POOL_SIZE 16
+
+/*! \brief Expected packet loss, in percent, when forward error correction is used */
+#define OPUS_FEC_LOSS 10
+
+/*! \brief Process CPU use, in percent of all processors, above which encoders get simpler */
+#define AUTOCOMPLEXITY_HIGH 80
+/*! \brief Process CPU use, in percent of all processors, below which encoders get better */
+#define AUTOCOMPLEXITY_LOW 60
+
+#define DEFAULT_COMPLEXITY 10
+
+/*! \brief Idle encoders or decoders of a translator, ready for the next pvt */
+struct opus_pool {
+	int count;
+	void *states[OPUS_POOL_SIZE];
+};
+
+struct opus_coder_pvt {
+	OpusEncoder *encoder;
+	OpusDecoder *decoder;
+	/*! Samples of 20 ms at the rate of the signed linear audio */
+	int framesize;
+	/*! Samples of the last packet decoded, for concealing a lost one */
+	int last_samples;
+	/*! Complexity the encoder was last set to */
+	int complexity;
+	/*! The encoder uses discontinuous transmission */
+	unsigned int dtx:1;
+	/*! The last packet encoded was not sent because of discontinuous transmission */
+	unsigned int silent:1;
+	int16_t buf[BUFFER_SAMPLES];
+};
+
+static unsigned int rates[] = { 8000, 12000, 16000, 24000, 48000 };
+
+/*! \brief Encoders, at the index of their rate, followed by the decoders */
+static struct ast_translator translators[ARRAY_LEN(rates) * 2];
+/*! \brief Pool of each of the translators, at the same index */
+static struct opus_pool pools[ARRAY_LEN(rates) * 2];
+AST_MUTEX_DEFINE_STATIC(pools_lock);
+
+/* codec variables */
+static int complexity = DEFAULT_COMPLEXITY;
+static int autocomplexity;
+static int fec;
+static int dtx;
+
+/*! \brief Complexity encoders are set to, lowered and raised by autocomplexity */
+static volatile int current_complexity = DEFAULT_COMPLEXITY;
+
+/*! \brief When and at what CPU use the complexity was last adjusted */
+static struct {
+	ast_mutex_t lock;
+	struct timeval when;
+	struct timeval cpu;
+} autocomplexity_state;
+
+static long processors = 1;
+
+static struct timeval rusage_cpu(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return ast_tvadd(usage.ru_utime, usage.ru_stime);
+}
+
+/*!
+ * \internal
+ * \brief Adjust the complexity of encoders to the CPU use, once a second
+ *
+ * Called by encoders for every packet.  Only the encoder getting here first
+ * after a second does the work; the others go on at the current complexity.
+ */
+static void autocomplexity_update(void)
+{
+	struct timeval now;
+	struct timeval cpu;
+	int64_t elapsed;
+	int usage;
+
+	if (!autocomplexity || ast_mutex_trylock(&autocomplexity_state.lock)) {
+		return;
+	}
+
+	now = ast_tvnow();
+	elapsed = ast_tvdiff_us(now, autocomplexity_state.when);
+	if (elapsed < 1000000) {
+		ast_mutex_unlock(&autocomplexity_state.lock);
+		return;
+	}
+
+	cpu = rusage_cpu();
+	usage = ast_tvdiff_us(cpu, autocomplexity_state.cpu) * 100 / (elapsed * processors);
+	autocomplexity_state.when = now;
+	autocomplexity_state.cpu = cpu;
+
+	if (usage > AUTOCOMPLEXITY_HIGH && current_complexity > 0) {
+		current_complexity--;
+		ast_debug(1, "CPU use at %d%%, lowering Opus complexity to %d\n", usage, current_complexity);
+	} else if (usage < AUTOCOMPLEXITY_LOW && current_complexity < complexity) {
+		current_complexity++;
+		ast_debug(1, "CPU use at %d%%, raising Opus complexity to %d\n", usage, current_complexity);
+	}
+
+	ast_mutex_unlock(&autocomplexity_state.lock);
+}
+
+/*! \internal \brief Get an attribute of the negotiated format, or a default */
+static int opus_attribute(struct ast_format *format, const char *name, int fallback)
+{
+	const int *value;
+
+	if (!format) {
+		return fallback;
+	}
+
+	value = ast_format_attribute_get(format, name);
+
+	return value ? *value : fallback;
+}
+
+static void *opus_pool_get(struct ast_trans_pvt *pvt)
+{
+	struct opus_pool *pool = &pools[pvt->t - translators];
+	void *state = NULL;
+
+	ast_mutex_lock(&pools_lock);
+	if (pool->count) {
+		state = pool->states[--pool->count];
+	}
+	ast_mutex_unlock(&pools_lock);
+
+	return state;
+}
+
+/*! \retval 0 if the state went back to the pool, -1 if the caller has to destroy it */
+static int opus_pool_put(struct ast_trans_pvt *pvt, void *state)
+{
+	struct opus_pool *pool = &pools[pvt->t - translators];
+	int res = -1;
+
+	ast_mutex_lock(&pools_lock);
+	if (pool->count < OPUS_POOL_SIZE) {
+		pool->states[pool->count++] = state;
+		res = 0;
+	}
+	ast_mutex_unlock(&pools_lock);
+
+	return res;
+}
+
+static int lintoopus_new(struct ast_trans_pvt *pvt)
+{
+	struct opus_coder_pvt *tmp = pvt->pvt;
+	unsigned int rate = pvt->t->src_codec.sample_rate;
+	int use_fec;
+	int bitrate;
+	int err;
+
+	if ((tmp->encoder = opus_pool_get(pvt))) {
+		opus_encoder_ctl(tmp->encoder, OPUS_RESET_STATE);
+	} else if (!(tmp->encoder = opus_encoder_create(rate, 1, OPUS_APPLICATION_VOIP, &err))) {
+		ast_log(LOG_ERROR, "Unable to create Opus encoder: %s\n", opus_strerror(err));
+		return -1;
+	}
+
+	tmp->framesize = rate / 50;
+	tmp->complexity = current_complexity;
+	tmp->dtx = opus_attribute(pvt->explicit_dst, CODEC_OPUS_ATTR_DTX, dtx) ? 1 : 0;
+	use_fec = opus_attribute(pvt->explicit_dst, CODEC_OPUS_ATTR_FEC, fec);
+	bitrate = opus_attribute(pvt->explicit_dst, CODEC_OPUS_ATTR_MAX_AVERAGE_BITRATE,
+		CODEC_OPUS_DEFAULT_BITRATE);
+
+	opus_encoder_ctl(tmp->encoder, OPUS_SET_COMPLEXITY(tmp->complexity));
+	opus_encoder_ctl(tmp->encoder, OPUS_SET_BITRATE(bitrate > 0 ? bitrate : OPUS_AUTO));
+	opus_encoder_ctl(tmp->encoder, OPUS_SET_VBR(!opus_attribute(pvt->explicit_dst, CODEC_OPUS_ATTR_CBR, 0)));
+	opus_encoder_ctl(tmp->encoder, OPUS_SET_DTX(tmp->dtx));
+	opus_encoder_ctl(tmp->encoder, OPUS_SET_INBAND_FEC(use_fec ? 1 : 0));
+	opus_encoder_ctl(tmp->encoder, OPUS_SET_PACKET_LOSS_PERC(use_fec ? OPUS_FEC_LOSS : 0));
+
+	return 0;
+}
+
+static int opustolin_new(struct ast_trans_pvt *pvt)
+{
+	struct opus_coder_pvt *tmp = pvt->pvt;
+	unsigned int rate = pvt->t->dst_codec.sample_rate;
+	int err;
+
+	if ((tmp->decoder = opus_pool_get(pvt))) {
+		opus_decoder_ctl(tmp->decoder, OPUS_RESET_STATE);
+	} else if (!(tmp->decoder = opus_decoder_create(rate, 1, &err))) {
+		ast_log(LOG_ERROR, "Unable to create Opus decoder: %s\n", opus_strerror(err));
+		return -1;
+	}
+
+	tmp->framesize = rate / 50;
+	tmp->last_samples = tmp->framesize;
+
+	ast_assert(pvt->f.subclass.format == NULL);
+	pvt->f.subclass.format = ao2_bump(ast_format_cache_get_slin_by_rate(rate));
+
+	return 0;
+}
+
+/*! \brief decode and store in outbuf */
+static int opustolin_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
+{
+	struct opus_coder_pvt *tmp = pvt->pvt;
+	int space = BUFFER_SAMPLES - pvt->samples;
+	int samples;
+
+	if (!f->datalen) {
+		/* Native PLC, conceal as much as the last packet held */
+		samples = opus_decode(tmp->decoder, NULL, 0, pvt->outbuf.i16 + pvt->samples,
+			MIN(tmp->last_samples, space), 0);
+	} else {
+		samples = opus_decode(tmp->decoder, f->data.ptr, f->datalen,
+			pvt->outbuf.i16 + pvt->samples, space, 0);
+	}
+
+	if (samples < 0) {
+		ast_log(LOG_WARNING, "Unable to decode Opus packet: %s\n", opus_strerror(samples));
+		return -1;
+	}
+
+	if (f->datalen) {
+		tmp->last_samples = samples;
+	}
+	pvt->samples += samples;
+	pvt->datalen += samples * 2;
+
+	return 0;
+}
+
+/*! \brief store input frame in work buffer */
+static int lintoopus_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
+{
+	struct opus_coder_pvt *tmp = pvt->pvt;
+
+	memcpy(tmp->buf + pvt->samples, f->data.ptr, f->datalen);
+	pvt->samples += f->samples;
+
+	return 0;
+}
+
+static int is_digital_silence(const int16_t *samples, int count)
+{
+	int x;
+
+	for (x = 0; x < count; x++) {
+		if (samples[x]) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*! \brief encode the work buffer into 20 ms packets */
+static struct ast_frame *lintoopus_frameout(struct ast_trans_pvt *pvt)
+{
+	struct opus_coder_pvt *tmp = pvt->pvt;
+	struct ast_frame *result = NULL;
+	struct ast_frame *last = NULL;
+	int samples = 0; /* input samples */
+	int out_samples = tmp->framesize * (OPUS_RATE / pvt->t->src_codec.sample_rate);
+
+	autocomplexity_update();
+	if (tmp->complexity != current_complexity) {
+		tmp->complexity = current_complexity;
+		opus_encoder_ctl(tmp->encoder, OPUS_SET_COMPLEXITY(tmp->complexity));
+	}
+
+	while (pvt->samples >= tmp->framesize) {
+		struct ast_frame *current;
+		int datalen;
+
+		if (tmp->silent && is_digital_silence(tmp->buf + samples, tmp->framesize)) {
+			/* Nothing would be sent for it anyway */
+			datalen = 0;
+		} else {
+			datalen = opus_encode(tmp->encoder, tmp->buf + samples, tmp->framesize,
+				pvt->outbuf.uc, OPUS_MAX_PACKET);
+		}
+		samples += tmp->framesize;
+		pvt->samples -= tmp->framesize;
+
+		if (datalen < 0) {
+			ast_log(LOG_WARNING, "Unable to encode Opus packet: %s\n", opus_strerror(datalen));
+			continue;
+		}
+
+		/* Packets of 2 bytes or less need not be sent when using DTX */
+		tmp->silent = tmp->dtx && datalen <= 2;
+		if (tmp->silent) {
+			continue;
+		}
+
+		current = ast_trans_frameout(pvt, datalen, out_samples);
+		if (!current) {
+			continue;
+		} else if (last) {
+			AST_LIST_NEXT(last, frame_list) = current;
+		} else {
+			result = current;
+		}
+		last = current;
+	}
+
+	/* Move the data at the end of the buffer to the front */
+	if (samples) {
+		memmove(tmp->buf, tmp->buf + samples, pvt->samples * 2);
+	}
+
+	return result;
+}
+
+static void lintoopus_destroy(struct ast_trans_pvt *pvt)
+{
+	struct opus_coder_pvt *tmp = pvt->pvt;
+
+	if (tmp->encoder && opus_pool_put(pvt, tmp->encoder)) {
+		opus_encoder_destroy(tmp->encoder);
+	}
+}
+
+static void opustolin_destroy(struct ast_trans_pvt *pvt)
+{
+	struct opus_coder_pvt *tmp = pvt->pvt;
+
+	if (tmp->decoder && opus_pool_put(pvt, tmp->decoder)) {
+		opus_decoder_destroy(tmp->decoder);
+	}
+}
+
+static void parse_config(int reload)
+{
+	struct ast_flags config_flags = { reload ? CONFIG_FLAG_FILEUNCHANGED : 0 };
+	struct ast_config *cfg = ast_config_load("codecs.conf", config_flags);
+	struct ast_variable *var;
+	int res;
+
+	if (cfg == CONFIG_STATUS_FILEUNCHANGED || cfg == CONFIG_STATUS_FILEINVALID) {
+		return;
+	}
+
+	complexity = DEFAULT_COMPLEXITY;
+	autocomplexity = 0;
+	fec = 0;
+	dtx = 0;
+
+	if (cfg != CONFIG_STATUS_FILEMISSING) {
+		for (var = ast_variable_browse(cfg, "opus"); var; var = var->next) {
+			if (!strcasecmp(var->name, "complexity")) {
+				if (sscanf(var->value, "%30d", &res) != 1 || res < 0 || res > 10) {
+					ast_log(LOG_ERROR, "Opus complexity must be 0-10, using %d\n", DEFAULT_COMPLEXITY);
+				} else {
+					complexity = res;
+				}
+			} else if (!strcasecmp(var->name, "autocomplexity")) {
+				autocomplexity = ast_true(var->value);
+			} else if (!strcasecmp(var->name, "fec")) {
+				fec = ast_true(var->value);
+			} else if (!strcasecmp(var->name, "dtx")) {
+				dtx = ast_true(var->value);
+			}
+		}
+		ast_config_destroy(cfg);
+	}
+
+	current_complexity = complexity;
+	ast_verb(3, "CODEC OPUS: Complexity %d%s, FEC [%s], DTX [%s]\n", complexity,
+		autocomplexity ? " or less depending on CPU use" : "",
+		fec ? "on" : "off", dtx ? "on" : "off");
+}
+
+static int reload(void)
+{
+	parse_config(1);
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+static int unload_module(void)
+{
+	int res = 0;
+	int idx;
+
+	for (idx = 0; idx < ARRAY_LEN(translators); idx++) {
+		res |= ast_unregister_translator(&translators[idx]);
+	}
+
+	for (idx = 0; idx < ARRAY_LEN(pools); idx++) {
+		while (pools[idx].count) {
+			void *state = pools[idx].states[--pools[idx].count];
+
+			if (idx < ARRAY_LEN(rates)) {
+				opus_encoder_destroy(state);
+			} else {
+				opus_decoder_destroy(state);
+			}
+		}
+	}
+
+	ast_mutex_destroy(&autocomplexity_state.lock);
+
+	return res;
+}
+
+static int load_module(void)
+{
+	int res = 0;
+	int idx;
+
+	parse_config(0);
+
+	processors = sysconf(_SC_NPROCESSORS_ONLN);
+	if (processors < 1) {
+		processors = 1;
+	}
+	ast_mutex_init(&autocomplexity_state.lock);
+	autocomplexity_state.when = ast_tvnow();
+	autocomplexity_state.cpu = rusage_cpu();
+
+	for (idx = 0; idx < ARRAY_LEN(rates); idx++) {
+		struct ast_translator *encoder = &translators[idx];
+		struct ast_translator *decoder = &translators[idx + ARRAY_LEN(rates)];
+
+		snprintf(encoder->name, sizeof(encoder->name), "slin %ukhz -> opus", rates[idx] / 1000);
+		encoder->src_codec.name = "slin";
+		encoder->src_codec.type = AST_MEDIA_TYPE_AUDIO;
+		encoder->src_codec.sample_rate = rates[idx];
+		encoder->dst_codec.name = "opus";
+		encoder->dst_codec.type = AST_MEDIA_TYPE_AUDIO;
+		encoder->dst_codec.sample_rate = OPUS_RATE;
+		encoder->format = "opus";
+		encoder->newpvt = lintoopus_new;
+		encoder->framein = lintoopus_framein;
+		encoder->frameout = lintoopus_frameout;
+		encoder->destroy = lintoopus_destroy;
+		encoder->desc_size = sizeof(struct opus_coder_pvt);
+		encoder->buffer_samples = BUFFER_SAMPLES;
+		encoder->buf_size = OPUS_MAX_PACKET;
+		if (rates[idx] == 8000) {
+			encoder->sample = slin8_sample;
+		} else if (rates[idx] == 16000) {
+			encoder->sample = slin16_sample;
+		}
+
+		snprintf(decoder->name, sizeof(decoder->name), "opus -> slin %ukhz", rates[idx] / 1000);
+		decoder->src_codec.name = "opus";
+		decoder->src_codec.type = AST_MEDIA_TYPE_AUDIO;
+		decoder->src_codec.sample_rate = OPUS_RATE;
+		decoder->dst_codec.name = "slin";
+		decoder->dst_codec.type = AST_MEDIA_TYPE_AUDIO;
+		decoder->dst_codec.sample_rate = rates[idx];
+		decoder->newpvt = opustolin_new;
+		decoder->framein = opustolin_framein;
+		decoder->destroy = opustolin_destroy;
+		decoder->desc_size = sizeof(struct opus_coder_pvt);
+		decoder->buffer_samples = BUFFER_SAMPLES;
+		decoder->buf_size = BUFFER_SAMPLES * 2;
+		decoder->native_plc = 1;
+	}
+
+	for (idx = 0; idx < ARRAY_LEN(translators); idx++) {
+		res |= ast_register_translator(&translators[idx]);
+	}
+
+	/* in case ast_register_translator() failed, we call unload_module() and
+	ast_unregister_translator won't fail.*/
+	if (res) {
+		unload_module();
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO(ASTERISK_GPL_KEY, AST_MODFLAG_DEFAULT, "Opus Coder/Decoder",
+	.support_level = AST_MODULE_SUPPORT_EXTENDED,
+	.load = load_module,
+	.unload = unload_module,
+	.reload = reload,
+);
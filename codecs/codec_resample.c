@@ -37,11 +37,29 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/module.h"
 #include "asterisk/translate.h"
 #include "asterisk/slin.h"
+#include "asterisk/config.h"
+#include "asterisk/lock.h"
 
 #define OUTBUF_SAMPLES   11520
 
+/*! \brief Default speex resampler quality, 0 to 10 */
+#define DEFAULT_QUALITY 5
+
+/*! \brief Most idle resamplers kept per translator */
+#define RESAMPLER_POOL_SIZE 8
+
+/*! \brief Idle resamplers of a translator, ready for the next pvt */
+struct resampler_pool {
+	int count;
+	SpeexResamplerState *states[RESAMPLER_POOL_SIZE];
+};
+
 static struct ast_translator *translators;
+/*! \brief Pool of each of the translators, at the same index */
+static struct resampler_pool *pools;
+AST_MUTEX_DEFINE_STATIC(pools_lock);
 static int trans_size;
+static int quality = DEFAULT_QUALITY;
 static struct ast_codec codec_list[] = {
 	{
 		.name = "slin",
@@ -92,11 +110,24 @@ static struct ast_codec codec_list[] = {
 
 static int resamp_new(struct ast_trans_pvt *pvt)
 {
+	struct resampler_pool *pool = &pools[pvt->t - translators];
+	SpeexResamplerState *resamp_pvt = NULL;
 	int err;
 
-	if (!(pvt->pvt = speex_resampler_init(1, pvt->t->src_codec.sample_rate, pvt->t->dst_codec.sample_rate, 5, &err))) {
+	ast_mutex_lock(&pools_lock);
+	if (pool->count) {
+		resamp_pvt = pool->states[--pool->count];
+	}
+	ast_mutex_unlock(&pools_lock);
+
+	if (resamp_pvt) {
+		/* The filter is only rebuilt if the quality has since been changed */
+		speex_resampler_set_quality(resamp_pvt, quality);
+		speex_resampler_reset_mem(resamp_pvt);
+	} else if (!(resamp_pvt = speex_resampler_init(1, pvt->t->src_codec.sample_rate, pvt->t->dst_codec.sample_rate, quality, &err))) {
 		return -1;
 	}
+	pvt->pvt = resamp_pvt;
 
 	ast_assert(pvt->f.subclass.format == NULL);
 	pvt->f.subclass.format = ao2_bump(ast_format_cache_get_slin_by_rate(pvt->t->dst_codec.sample_rate));
@@ -106,9 +137,19 @@ static int resamp_new(struct ast_trans_pvt *pvt)
 
 static void resamp_destroy(struct ast_trans_pvt *pvt)
 {
+	struct resampler_pool *pool = &pools[pvt->t - translators];
 	SpeexResamplerState *resamp_pvt = pvt->pvt;
 
-	speex_resampler_destroy(resamp_pvt);
+	ast_mutex_lock(&pools_lock);
+	if (pool->count < RESAMPLER_POOL_SIZE) {
+		pool->states[pool->count++] = resamp_pvt;
+		resamp_pvt = NULL;
+	}
+	ast_mutex_unlock(&pools_lock);
+
+	if (resamp_pvt) {
+		speex_resampler_destroy(resamp_pvt);
+	}
 }
 
 static int resamp_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
@@ -135,6 +176,39 @@ static int resamp_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 	return 0;
 }
 
+static void parse_config(int reload)
+{
+	struct ast_flags config_flags = { reload ? CONFIG_FLAG_FILEUNCHANGED : 0 };
+	struct ast_config *cfg = ast_config_load("codecs.conf", config_flags);
+	struct ast_variable *var;
+	int res = DEFAULT_QUALITY;
+
+	if (cfg == CONFIG_STATUS_FILEUNCHANGED || cfg == CONFIG_STATUS_FILEINVALID) {
+		return;
+	}
+
+	if (cfg != CONFIG_STATUS_FILEMISSING) {
+		for (var = ast_variable_browse(cfg, "resample"); var; var = var->next) {
+			if (!strcasecmp(var->name, "quality")) {
+				if (sscanf(var->value, "%30d", &res) != 1 || res < 0 || res > 10) {
+					ast_log(LOG_ERROR, "Resampler quality must be 0-10, using %d\n", DEFAULT_QUALITY);
+					res = DEFAULT_QUALITY;
+				}
+			}
+		}
+		ast_config_destroy(cfg);
+	}
+
+	quality = res;
+	ast_verb(3, "CODEC RESAMPLE: Setting Quality to %d\n", quality);
+}
+
+static int reload(void)
+{
+	parse_config(1);
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
 static int unload_module(void)
 {
 	int res = 0;
@@ -145,6 +219,16 @@ static int unload_module(void)
 	}
 	ast_free(translators);
 
+	if (pools) {
+		for (idx = 0; idx < trans_size; idx++) {
+			while (pools[idx].count) {
+				speex_resampler_destroy(pools[idx].states[--pools[idx].count]);
+			}
+		}
+		ast_free(pools);
+		pools = NULL;
+	}
+
 	return res;
 }
 
@@ -153,10 +237,16 @@ static int load_module(void)
 	int res = 0;
 	int x, y, idx = 0;
 
+	parse_config(0);
+
 	trans_size = ARRAY_LEN(codec_list) * (ARRAY_LEN(codec_list) - 1);
 	if (!(translators = ast_calloc(1, sizeof(struct ast_translator) * trans_size))) {
 		return AST_MODULE_LOAD_DECLINE;
 	}
+	if (!(pools = ast_calloc(trans_size, sizeof(*pools)))) {
+		ast_free(translators);
+		return AST_MODULE_LOAD_DECLINE;
+	}
 
 	for (x = 0; x < ARRAY_LEN(codec_list); x++) {
 		for (y = 0; y < ARRAY_LEN(codec_list); y++) {
@@ -188,4 +278,9 @@ static int load_module(void)
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
-AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "SLIN Resampling Codec");
+AST_MODULE_INFO(ASTERISK_GPL_KEY, AST_MODFLAG_DEFAULT, "SLIN Resampling Codec",
+	.support_level = AST_MODULE_SUPPORT_CORE,
+	.load = load_module,
+	.unload = unload_module,
+	.reload = reload,
+);
@@ -65,8 +65,12 @@ typedef struct
     /*! 6 for 48000kbps, 7 for 56000kbps, or 8 for 64000kbps. */
     int bits_per_sample;
 
-    /*! Signal history for the QMF */
-    int x[24];
+    /*! Signal history for the QMF, the even and the odd samples apart.  Each
+        sample is stored twice, 12 apart, so the last 12 of each start at
+        x[][ptr] without moving the history along. */
+    int x[2][24];
+    /*! Where the oldest samples of the QMF history are */
+    int ptr;
 
     struct
     {
@@ -103,8 +107,12 @@ typedef struct
     /*! 6 for 48000kbps, 7 for 56000kbps, or 8 for 64000kbps. */
     int bits_per_sample;
 
-    /*! Signal history for the QMF */
-    int x[24];
+    /*! Signal history for the QMF, the even and the odd samples apart.  Each
+        sample is stored twice, 12 apart, so the last 12 of each start at
+        x[][ptr] without moving the history along. */
+    int x[2][24];
+    /*! Where the oldest samples of the QMF history are */
+    int ptr;
 
     struct
     {
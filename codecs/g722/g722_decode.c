@@ -239,6 +239,10 @@ int g722_decode(g722_decode_state_t *s, int16_t amp[], const uint8_t g722_data[]
     {
            3,  -11,   12,   32, -210,  951, 3876, -805,  362, -156,   53,  -11,
     };
+    static const int qmf_coeffs_rev[12] =
+    {
+         -11,   53, -156,  362, -805, 3876,  951, -210,   32,   12,  -11,    3,
+    };
 
     int dlowt;
     int rlow;
@@ -375,17 +379,19 @@ int g722_decode(g722_decode_state_t *s, int16_t amp[], const uint8_t g722_data[]
             else
             {
                 /* Apply the receive QMF */
-                for (i = 0;  i < 22;  i++)
-                    s->x[i] = s->x[i + 2];
-                s->x[22] = rlow + rhigh;
-                s->x[23] = rlow - rhigh;
+                s->x[0][s->ptr] =
+                s->x[0][s->ptr + 12] = rlow + rhigh;
+                s->x[1][s->ptr] =
+                s->x[1][s->ptr + 12] = rlow - rhigh;
+                if (++s->ptr >= 12)
+                    s->ptr = 0;
 
                 xout1 = 0;
                 xout2 = 0;
                 for (i = 0;  i < 12;  i++)
                 {
-                    xout2 += s->x[2*i]*qmf_coeffs[i];
-                    xout1 += s->x[2*i + 1]*qmf_coeffs[11 - i];
+                    xout2 += s->x[0][s->ptr + i]*qmf_coeffs[i];
+                    xout1 += s->x[1][s->ptr + i]*qmf_coeffs_rev[i];
                 }
                 amp[outlen++] = (int16_t) (xout1 >> 11);
                 amp[outlen++] = (int16_t) (xout2 >> 11);
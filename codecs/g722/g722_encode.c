@@ -236,6 +236,10 @@ int g722_encode(g722_encode_state_t *s, uint8_t g722_data[], const int16_t amp[]
     {
            3,  -11,   12,   32, -210,  951, 3876, -805,  362, -156,   53,  -11,
     };
+    static const int qmf_coeffs_rev[12] =
+    {
+         -11,   53, -156,  362, -805, 3876,  951, -210,   32,   12,  -11,    3,
+    };
     static const int ihn[3] = {0, 1, 0};
     static const int ihp[3] = {0, 3, 2};
     static const int wh[3] = {0, -214, 798};
@@ -284,19 +288,21 @@ int g722_encode(g722_encode_state_t *s, uint8_t g722_data[], const int16_t amp[]
             else
             {
                 /* Apply the transmit QMF */
-                /* Shuffle the buffer down */
-                for (i = 0;  i < 22;  i++)
-                    s->x[i] = s->x[i + 2];
-                s->x[22] = amp[j++];
-                s->x[23] = amp[j++];
-    
+                /* Add the new samples to the history */
+                s->x[0][s->ptr] =
+                s->x[0][s->ptr + 12] = amp[j++];
+                s->x[1][s->ptr] =
+                s->x[1][s->ptr + 12] = amp[j++];
+                if (++s->ptr >= 12)
+                    s->ptr = 0;
+
                 /* Discard every other QMF output */
                 sumeven = 0;
                 sumodd = 0;
                 for (i = 0;  i < 12;  i++)
                 {
-                    sumodd += s->x[2*i]*qmf_coeffs[i];
-                    sumeven += s->x[2*i + 1]*qmf_coeffs[11 - i];
+                    sumodd += s->x[0][s->ptr + i]*qmf_coeffs[i];
+                    sumeven += s->x[1][s->ptr + i]*qmf_coeffs_rev[i];
                 }
                 xlow = (sumeven + sumodd) >> 14;
                 xhigh = (sumeven - sumodd) >> 14;
@@ -308,11 +314,22 @@ int g722_encode(g722_encode_state_t *s, uint8_t g722_data[], const int16_t amp[]
         /* Block 1L, QUANTL */
         wd = (el >= 0)  ?  el  :  -(el + 1);
 
-        for (i = 1;  i < 30;  i++)
+        /* Find the first decision level above wd.  The levels only grow, so
+           halve the range until it is found. */
         {
-            wd1 = (q6[i]*s->band[0].det) >> 12;
-            if (wd < wd1)
-                break;
+            int lo = 1;
+            int hi = 30;
+
+            while (lo < hi)
+            {
+                i = (lo + hi) >> 1;
+                wd1 = (q6[i]*s->band[0].det) >> 12;
+                if (wd < wd1)
+                    hi = i;
+                else
+                    lo = i + 1;
+            }
+            i = lo;
         }
         ilow = (el < 0)  ?  iln[i]  :  ilp[i];
 
@@ -0,0 +1,22 @@
+"""add udp_sockets to transport
+
+Revision ID: 3a094a18e75b
+Revises: 164abbd708c
+Create Date: 2017-08-14 10:21:46.183047
+
+"""
+
+# revision identifiers, used by Alembic.
+revision = '3a094a18e75b'
+down_revision = '164abbd708c'
+
+from alembic import op
+import sqlalchemy as sa
+
+
+def upgrade():
+    op.add_column('ps_transports', sa.Column('udp_sockets', sa.Integer))
+
+
+def downgrade():
+    op.drop_column('ps_transports', 'udp_sockets')
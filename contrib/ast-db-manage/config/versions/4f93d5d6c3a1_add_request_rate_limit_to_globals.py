@@ -0,0 +1,22 @@
+"""add request_rate_limit to globals
+
+Revision ID: 4f93d5d6c3a1
+Revises: 3a094a18e75b
+Create Date: 2017-08-21 09:47:12.308441
+
+"""
+
+# revision identifiers, used by Alembic.
+revision = '4f93d5d6c3a1'
+down_revision = '3a094a18e75b'
+
+from alembic import op
+import sqlalchemy as sa
+
+
+def upgrade():
+    op.add_column('ps_globals', sa.Column('request_rate_limit', sa.Integer))
+
+
+def downgrade():
+    op.drop_column('ps_globals', 'request_rate_limit')
@@ -47,6 +47,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/bridge_basic.h"
 #include "asterisk/bridge_after.h"
 #include "asterisk/max_forwards.h"
+#include "asterisk/channel_cpu.h"
 
 /*** DOCUMENTATION
 	<function name="CHANNELS" language="en_US">
@@ -236,6 +237,12 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 						<para>R/O Call identifier log tag associated with the channel
 						e.g., <literal>[C-00000000]</literal>.</para>
 					</enum>
+					<enum name="cpu_usec">
+						<para>R/O Microseconds of CPU time spent reading and writing
+						frames and running dialplan applications for the channel.  Only
+						counted when Asterisk is built with CHANNEL_CPU_STATS enabled in
+						menuselect, otherwise always 0.</para>
+					</enum>
 				</enumlist>
 				<xi:include xpointer="xpointer(/docs/info[@name='CHANNEL'])" />
 			</parameter>
@@ -461,6 +468,8 @@ static int func_channel_read(struct ast_channel *chan, const char *function,
 			ast_callid_unref(callid);
 		}
 		ast_channel_unlock(chan);
+	} else if (!strcasecmp(data, "cpu_usec")) {
+		snprintf(buf, len, "%" PRIu64, ast_channel_cpu_usec(chan));
 	} else if (!ast_channel_tech(chan) || !ast_channel_tech(chan)->func_channel_read || ast_channel_tech(chan)->func_channel_read(chan, function, data, buf, len)) {
 		ast_log(LOG_WARNING, "Unknown or unavailable item requested: '%s'\n", data);
 		ret = -1;
@@ -569,6 +569,50 @@ static void curl_instance_cleanup(void *data)
 AST_THREADSTORAGE_CUSTOM(curl_instance, curl_instance_init, curl_instance_cleanup);
 AST_THREADSTORAGE(thread_escapebuf);
 
+/*!
+ * \brief DNS cache, TLS sessions and connections shared by the handles of all threads
+ *
+ * The handles are per thread, and channel threads do not last longer than
+ * their call, so without it every call would resolve and connect again.
+ */
+static CURLSH *curl_share;
+static ast_mutex_t curl_share_locks[CURL_LOCK_DATA_LAST];
+
+static void curl_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	ast_mutex_lock(&curl_share_locks[data]);
+}
+
+static void curl_share_unlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+	ast_mutex_unlock(&curl_share_locks[data]);
+}
+
+static void curl_share_create(void)
+{
+	curl_share = curl_share_init();
+	if (!curl_share) {
+		ast_log(LOG_WARNING, "Unable to create a curl share, CURL() connections will not be reused across calls\n");
+		return;
+	}
+	curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, curl_share_lock);
+	curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, curl_share_unlock);
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	/* Sharing connections is new in libcurl 7.57.0 */
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+static void curl_share_destroy(void)
+{
+	if (curl_share) {
+		curl_share_cleanup(curl_share);
+		curl_share = NULL;
+	}
+}
+
 /*!
  * \brief Check for potential HTTP injection risk.
  *
@@ -670,6 +714,9 @@ static int acf_curl_helper(struct ast_channel *chan, const char *cmd, char *info
 
 	curl_easy_setopt(*curl, CURLOPT_URL, args.url);
 	curl_easy_setopt(*curl, CURLOPT_FILE, (void *) &str);
+	if (curl_share) {
+		curl_easy_setopt(*curl, CURLOPT_SHARE, curl_share);
+	}
 
 	if (args.postdata) {
 		curl_easy_setopt(*curl, CURLOPT_POST, 1);
@@ -690,6 +737,11 @@ static int acf_curl_helper(struct ast_channel *chan, const char *cmd, char *info
 	 * CURLOPT_ERRORBUFFER" (62bcf005f4678a93158358265ba905bace33b834). */
 	curl_easy_setopt(*curl, CURLOPT_ERRORBUFFER, (char*)NULL);
 
+	/* Only attached while used so the share can go away on unload */
+	if (curl_share) {
+		curl_easy_setopt(*curl, CURLOPT_SHARE, (CURLSH *) NULL);
+	}
+
 	if (store) {
 		AST_LIST_UNLOCK(list);
 	}
@@ -847,18 +899,25 @@ AST_TEST_DEFINE(vulnerable_url)
 static int unload_module(void)
 {
 	int res;
+	int i;
 
 	res = ast_custom_function_unregister(&acf_curl);
 	res |= ast_custom_function_unregister(&acf_curlopt);
 
 	AST_TEST_UNREGISTER(vulnerable_url);
 
+	curl_share_destroy();
+	for (i = 0; i < ARRAY_LEN(curl_share_locks); i++) {
+		ast_mutex_destroy(&curl_share_locks[i]);
+	}
+
 	return res;
 }
 
 static int load_module(void)
 {
 	int res;
+	int i;
 
 	if (!ast_module_check("res_curl.so")) {
 		if (ast_load_resource("res_curl.so") != AST_MODULE_LOAD_SUCCESS) {
@@ -867,6 +926,11 @@ static int load_module(void)
 		}
 	}
 
+	for (i = 0; i < ARRAY_LEN(curl_share_locks); i++) {
+		ast_mutex_init(&curl_share_locks[i]);
+	}
+	curl_share_create();
+
 	res = ast_custom_function_register(&acf_curl);
 	res |= ast_custom_function_register(&acf_curlopt);
 
@@ -45,7 +45,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 /*** DOCUMENTATION
 	<function name="JITTERBUFFER" language="en_US">
 		<synopsis>
-			Add a Jitterbuffer to the Read side of the channel. This dejitters the audio stream before it reaches the Asterisk core. This is a write only function.
+			Add a Jitterbuffer to the Read side of the channel. This dejitters the audio stream before it reaches the Asterisk core.
 		</synopsis>
 		<syntax>
 			<parameter name="jitterbuffer type" required="true">
@@ -56,6 +56,11 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 					<option name="adaptive">
 						<para>Set an adaptive jitterbuffer on the channel.</para>
 					</option>
+					<option name="stretch">
+						<para>Set an adaptive jitterbuffer on the channel that changes its
+						delay by time-stretching signed linear and G.711 audio, rather than
+						by dropping and interpolating frames.</para>
+					</option>
 					<option name="disabled">
 						<para>Remove a previously set jitterbuffer from the channel.</para>
 					</option>
@@ -75,9 +80,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 			<para><replaceable>resync_threshold</replaceable>: The length in milliseconds over
 			which a timestamp difference will result in resyncing the jitterbuffer.
 			Defaults to 1000ms.</para>
-			<para>target_extra: This option only affects the adaptive jitterbuffer. It represents
-			the amount time in milliseconds by which the new jitter buffer will pad its size.
-			Defaults to 40ms.</para>
+			<para>target_extra: This option only affects the adaptive and stretch jitterbuffers.
+			It represents the amount time in milliseconds by which the new jitter buffer will pad
+			its size. Defaults to 40ms.</para>
 			<example title="Fixed with defaults" language="text">
 			exten => 1,1,Set(JITTERBUFFER(fixed)=default)
 			</example>
@@ -97,6 +102,21 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 			exten => 1,1,Set(JITTERBUFFER(fixed)=default)
 			exten => 1,n,Set(JITTERBUFFER(disabled)=)
 			</example>
+			<example title="Stretch with 200ms max size, 10ms target extra" language="text">
+			exten => 1,1,Set(JITTERBUFFER(stretch)=200,,10)
+			</example>
+			<para>When read, the function returns a statistic of the adaptive or stretch
+			jitterbuffer on the channel instead. The argument is then one of
+			<literal>current</literal> (the current delay in milliseconds),
+			<literal>target</literal> (the delay aimed for), <literal>jitter</literal>,
+			<literal>frames_in</literal>, <literal>frames_late</literal>,
+			<literal>frames_lost</literal>, <literal>frames_dropped</literal>,
+			<literal>accelerated</literal>, <literal>expanded</literal> and
+			<literal>interpolated</literal> (milliseconds of audio removed by
+			time-stretching or dropping, added by time-stretching, and interpolated).</para>
+			<example title="Log the delay of the jitterbuffer" language="text">
+			exten => 1,n,Verbose(1,Jitterbuffer delay ${JITTERBUFFER(current)}ms)
+			</example>
 			<note><para>If a channel specifies a jitterbuffer due to channel driver configuration and
 			the JITTERBUFFER function has set a jitterbuffer for that channel, the jitterbuffer set by
 			the JITTERBUFFER function will take priority and the jitterbuffer set by the channel
@@ -121,6 +141,7 @@ static int jb_helper(struct ast_channel *chan, const char *cmd, char *data, cons
 	if (!ast_strlen_zero(data)) {
 		if (strcasecmp(data, "fixed") &&
 				strcasecmp(data, "adaptive") &&
+				strcasecmp(data, "stretch") &&
 				strcasecmp(data, "disabled")) {
 			ast_log(LOG_WARNING, "Unknown Jitterbuffer type %s. Failed to create jitterbuffer.\n", data);
 			return -1;
@@ -164,8 +185,51 @@ static int jb_helper(struct ast_channel *chan, const char *cmd, char *data, cons
 }
 
 
+static int jb_read(struct ast_channel *chan, const char *cmd, char *data, char *buf, size_t len)
+{
+	struct ast_jb_stats stats;
+
+	if (!chan) {
+		ast_log(LOG_WARNING, "No channel was provided to %s function.\n", cmd);
+		return -1;
+	}
+
+	if (ast_jb_get_stats(chan, &stats)) {
+		ast_log(LOG_WARNING, "Channel %s has no jitterbuffer that keeps statistics\n", ast_channel_name(chan));
+		return -1;
+	}
+
+	if (!strcasecmp(data, "current")) {
+		snprintf(buf, len, "%ld", stats.current);
+	} else if (!strcasecmp(data, "target")) {
+		snprintf(buf, len, "%ld", stats.target);
+	} else if (!strcasecmp(data, "jitter")) {
+		snprintf(buf, len, "%ld", stats.jitter);
+	} else if (!strcasecmp(data, "frames_in")) {
+		snprintf(buf, len, "%u", stats.frames_in);
+	} else if (!strcasecmp(data, "frames_late")) {
+		snprintf(buf, len, "%u", stats.frames_late);
+	} else if (!strcasecmp(data, "frames_lost")) {
+		snprintf(buf, len, "%u", stats.frames_lost);
+	} else if (!strcasecmp(data, "frames_dropped")) {
+		snprintf(buf, len, "%u", stats.frames_dropped);
+	} else if (!strcasecmp(data, "accelerated")) {
+		snprintf(buf, len, "%ld", stats.accelerated);
+	} else if (!strcasecmp(data, "expanded")) {
+		snprintf(buf, len, "%ld", stats.expanded);
+	} else if (!strcasecmp(data, "interpolated")) {
+		snprintf(buf, len, "%ld", stats.interpolated);
+	} else {
+		ast_log(LOG_WARNING, "Unknown jitterbuffer statistic '%s'\n", data);
+		return -1;
+	}
+
+	return 0;
+}
+
 static struct ast_custom_function jb_function = {
 	.name = "JITTERBUFFER",
+	.read = jb_read,
 	.write = jb_helper,
 };
 
@@ -217,7 +217,7 @@ static int talk_detect_audiohook_cb(struct ast_audiohook *audiohook, struct ast_
 		                td_params->talking ? ast_channel_talking_start() : ast_channel_talking_stop(),
 		                blob);
 		if (message) {
-			stasis_publish(ast_channel_topic(chan), message);
+			stasis_publish(ast_channel_topic_for_publish(chan), message);
 			ao2_ref(message, -1);
 		}
 
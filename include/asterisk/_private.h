@@ -34,6 +34,7 @@ int ast_channels_init(void);		/*!< Provided by channel.c */
 void ast_builtins_init(void);		/*!< Provided by cli.c */
 int ast_cli_perms_init(int reload);	/*!< Provided by cli.c */
 int dnsmgr_init(void);			/*!< Provided by dnsmgr.c */
+int ast_dns_cache_init(void);		/*!< Provided by dns.c */
 void dnsmgr_start_refresh(void);	/*!< Provided by dnsmgr.c */
 int dnsmgr_reload(void);		/*!< Provided by dnsmgr.c */
 void threadstorage_init(void);		/*!< Provided by threadstorage.c */
@@ -56,9 +57,16 @@ int ast_cel_engine_reload(void);	/*!< Provided by cel.c */
 int ast_ssl_init(void);                 /*!< Provided by ssl.c */
 int ast_pj_init(void);                 /*!< Provided by libasteriskpj.c */
 int ast_test_init(void);            /*!< Provided by test.c */
+int ast_bench_init(void);           /*!< Provided by bench.c */
+int ast_lock_contention_init(void); /*!< Provided by lock.c */
 int ast_msg_init(void);             /*!< Provided by message.c */
 void ast_msg_shutdown(void);        /*!< Provided by message.c */
 int aco_init(void);             /*!< Provided by config_options.c */
+int ast_slinmix_init(void);		/*!< Provided by slinmix.c */
+int ast_g711_init(void);		/*!< Provided by g711.c */
+int ast_frame_init(void);		/*!< Provided by frame.c */
+int ast_latency_init(void);		/*!< Provided by latency.c */
+int ast_affinity_init(void);		/*!< Provided by affinity.c */
 
 /*!
  * \brief Initialize the bridging system.
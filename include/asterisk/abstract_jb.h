@@ -50,6 +50,7 @@ enum {
 enum ast_jb_type {
 	AST_JB_FIXED,
 	AST_JB_ADAPTIVE,
+	AST_JB_STRETCH,
 };
 
 /*! Abstract return codes */
@@ -80,6 +81,34 @@ struct ast_jb_conf
 };
 
 
+/*!
+ * \brief Jitterbuffer statistics.
+ * \since 13.18.0
+ */
+struct ast_jb_stats
+{
+	/*! \brief Delay of the audio being played out beyond the quickest transit, in ms. */
+	long current;
+	/*! \brief Delay being aimed for, in ms. */
+	long target;
+	/*! \brief Jitter seen on the incoming frames, in ms. */
+	long jitter;
+	/*! \brief Number of frames put into the jitterbuffer. */
+	unsigned int frames_in;
+	/*! \brief Number of frames that arrived after they should have been played out. */
+	unsigned int frames_late;
+	/*! \brief Number of frames that never arrived. */
+	unsigned int frames_lost;
+	/*! \brief Number of frames dropped because of overflow or to reduce the delay. */
+	unsigned int frames_dropped;
+	/*! \brief Audio removed by time-stretching or dropping frames, in ms. */
+	long accelerated;
+	/*! \brief Audio added by time-stretching, in ms. */
+	long expanded;
+	/*! \brief Audio interpolated because nothing was available, in ms. */
+	long interpolated;
+};
+
 /* Jitterbuffer configuration property names */
 #define AST_JB_CONF_PREFIX "jb"
 #define AST_JB_CONF_ENABLE "enable"
@@ -111,6 +140,8 @@ typedef void (*jb_force_resynch_impl)(void *jb);
 typedef void (*jb_empty_and_reset_impl)(void *jb);
 /*! \brief Check if late */
 typedef int (*jb_is_late_impl)(void *jb, long ts);
+/*! \brief Get statistics */
+typedef void (*jb_stats_impl)(void *jb, struct ast_jb_stats *stats);
 
 
 /*!
@@ -130,6 +161,8 @@ struct ast_jb_impl
 	jb_force_resynch_impl force_resync;
 	jb_empty_and_reset_impl empty_and_reset;
 	jb_is_late_impl is_late;
+	/*! \brief Optional, NULL if the implementation keeps no statistics */
+	jb_stats_impl stats;
 };
 
 /*!
@@ -303,6 +336,18 @@ void ast_jb_conf_default(struct ast_jb_conf *conf);
  */
 void ast_jb_create_framehook(struct ast_channel *chan, struct ast_jb_conf *jb_conf, int prefer_existing);
 
+/*!
+ * \since 13.18.0
+ * \brief Get the statistics of the jitterbuffer framehook on a channel
+ *
+ * \param chan Which channel to get the statistics of
+ * \param[out] stats The statistics
+ *
+ * \retval 0 success
+ * \retval -1 if the channel has no jitterbuffer, or its implementation keeps no statistics
+ */
+int ast_jb_get_stats(struct ast_channel *chan, struct ast_jb_stats *stats);
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
@@ -56,6 +56,9 @@ struct ast_ha {
 	struct ast_ha *next;
 };
 
+/*! \brief A list of host access rules compiled for fast lookups */
+struct ast_ha_index;
+
 #define ACL_NAME_LENGTH 80
 
 /*!
@@ -66,6 +69,7 @@ struct ast_ha {
  */
 struct ast_acl {
 	struct ast_ha *acl;             /*!< Rules contained by the ACL */
+	struct ast_ha_index *index;     /*!< Prefix tree of the rules, built when the ACL is first applied */
 	int is_realtime;                /*!< If raised, this named ACL was retrieved from realtime storage */
 	int is_invalid;                 /*!< If raised, this is an invalid ACL which will automatically reject everything. */
 	char name[ACL_NAME_LENGTH];     /*!< If this was retrieved from the named ACL subsystem, this is the name of the ACL. */
@@ -194,6 +198,43 @@ int ast_acl_list_is_empty(struct ast_acl_list *acl_list);
  */
 enum ast_acl_sense ast_apply_ha(const struct ast_ha *ha, const struct ast_sockaddr *addr);
 
+/*!
+ * \brief Compile a list of host access rules into prefix trees
+ *
+ * \details
+ * The rules are copied into a prefix tree per address family so applying
+ * them takes time proportional to the address length rather than to the
+ * number of rules.  The result of ast_ha_index_apply() is always the same
+ * as ast_apply_ha() on the list, including that the last rule matched
+ * wins.
+ *
+ * \param ha The head of the list of host access rules
+ * \retval NULL on allocation failure
+ * \return The index, to be freed with ast_ha_index_free()
+ *
+ * \since 13.18.0
+ */
+struct ast_ha_index *ast_ha_index_build(const struct ast_ha *ha);
+
+/*!
+ * \brief Apply a compiled list of host access rules to a given IP address
+ *
+ * \param index The index built by ast_ha_index_build()
+ * \param addr An ast_sockaddr whose address is considered when matching rules
+ * \retval AST_SENSE_ALLOW The IP address passes our ACL
+ * \retval AST_SENSE_DENY The IP address fails our ACL
+ *
+ * \since 13.18.0
+ */
+enum ast_acl_sense ast_ha_index_apply(const struct ast_ha_index *index, const struct ast_sockaddr *addr);
+
+/*!
+ * \brief Free a compiled list of host access rules
+ *
+ * \since 13.18.0
+ */
+void ast_ha_index_free(struct ast_ha_index *index);
+
 /*!
  * \brief Apply a set of rules to a given IP address
  *
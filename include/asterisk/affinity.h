@@ -0,0 +1,76 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Thread placement by class
+ *
+ * The [affinity] section of asterisk.conf gives each class of thread a set
+ * of CPUs, either as a list of CPU numbers and ranges or as the CPUs of a
+ * NUMA node.  A thread joins its class when it starts, and is then pinned
+ * to those CPUs.  Memory is placed on the node of the thread that first
+ * touches it, so the buffers a pinned thread allocates for its own work
+ * stay on its node.
+ *
+ * \code
+ * [affinity]
+ * sip = 0-7
+ * mixing = node1
+ * \endcode
+ */
+
+#ifndef _ASTERISK_AFFINITY_H
+#define _ASTERISK_AFFINITY_H
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/*! \brief Classes of thread that can be placed */
+enum ast_thread_class {
+	/*! Threads of the res_pjsip threadpool */
+	AST_THREAD_CLASS_SIP,
+	/*! Threads mixing softmix bridges */
+	AST_THREAD_CLASS_MIXING,
+	/*! Threads running a channel, which read and write its media */
+	AST_THREAD_CLASS_CHANNEL,
+	/*! Threads of the stasis message bus threadpool */
+	AST_THREAD_CLASS_STASIS,
+	AST_THREAD_CLASS_MAX,
+};
+
+/*!
+ * \brief Place the calling thread in a class
+ * \since 13.18.0
+ *
+ * Pins the thread to the CPUs configured for the class.  Nothing is done
+ * if the class has no CPUs configured.
+ *
+ * \param thread_class The class of the thread
+ */
+void ast_thread_class_set(enum ast_thread_class thread_class);
+
+/*!
+ * \brief Get the name of a thread class, as used in asterisk.conf
+ * \since 13.18.0
+ */
+const char *ast_thread_class_name(enum ast_thread_class thread_class);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _ASTERISK_AFFINITY_H */
@@ -36,6 +36,7 @@ typedef struct agi_state {
 	int audio;	        /*!< FD for audio output */
 	int ctrl;		/*!< FD for input control */
 	unsigned int fast:1;    /*!< flag for fast agi or not */
+	unsigned int released:1; /*!< FastAGI server released the connection to be reused */
 	struct ast_speech *speech; /*!< Speech structure for speech recognition */
 } AGI;
 
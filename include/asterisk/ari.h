@@ -91,6 +91,8 @@ struct stasis_rest_handlers {
 struct ast_ari_response {
 	/*! Response message */
 	struct ast_json *message;
+	/*! Encoded response body, sent instead of \a message when set */
+	struct ast_str *body;
 	/*! \r\n seperated response headers */
 	struct ast_str *headers;
 	/*! HTTP response code.
@@ -122,10 +124,11 @@ int ast_ari_remove_handler(struct stasis_rest_handlers *handler);
  * \internal
  * \brief Stasis RESTful invocation handler.
  *
- * Only call from res_ari and test_ari. Only public to allow
- * for unit testing.
+ * Only call from res_ari, res_ari_bulk and test_ari. Only public to allow
+ * for unit testing and bulk requests.
  *
- * \param ser TCP/TLS connection.
+ * \param ser TCP/TLS connection. \c NULL when invoked for an operation of a
+ *            bulk request; WebSocket upgrades are refused then.
  * \param uri HTTP URI, relative to the API path.
  * \param method HTTP method.
  * \param get_params HTTP \c GET parameters.
@@ -189,6 +192,24 @@ struct ast_json *ast_ari_websocket_session_read(
 int ast_ari_websocket_session_write(struct ast_ari_websocket_session *session,
 	struct ast_json *message);
 
+/*!
+ * \brief Queue a message to be sent to an ARI WebSocket.
+ *
+ * The message is serialized before this returns, so it may be changed or
+ * freed afterwards. It is written to the WebSocket by a serializer of the
+ * session, together with any other messages queued in the meantime, so the
+ * caller does not wait on the network.
+ *
+ * \param session Session to write to.
+ * \param message Message to send.
+ * \return 0 on success.
+ * \return Non-zero on error.
+ *
+ * \since 13.18.0
+ */
+int ast_ari_websocket_session_queue(struct ast_ari_websocket_session *session,
+	struct ast_json *message);
+
 /*!
  * \brief Get the Session ID for an ARI WebSocket.
  *
@@ -240,6 +261,19 @@ __attribute__((format(printf, 4, 5)));
 void ast_ari_response_ok(struct ast_ari_response *response,
 			     struct ast_json *message);
 
+/*!
+ * \brief Fill in an \c OK (200) \a ast_ari_response with an encoded JSON body.
+ *
+ * For large responses encoded with an \ref ast_json_writer, using
+ * ast_ari_json_format(). In developer mode, the body is decoded again so
+ * responses can still be validated.
+ *
+ * \param response Response to fill in.
+ * \param body Encoded JSON response. This reference is stolen.
+ */
+void ast_ari_response_ok_encoded(struct ast_ari_response *response,
+	struct ast_str *body);
+
 /*!
  * \brief Fill in a <tt>No Content</tt> (204) \a ast_ari_response.
  */
@@ -419,6 +419,15 @@ enum ao2_alloc_opts {
 	AO2_ALLOC_OPT_LOCK_NOLOCK = (2 << 0),
 	/*! The ao2 object locking option field mask. */
 	AO2_ALLOC_OPT_LOCK_MASK = (3 << 0),
+	/*!
+	 * \brief The last reference to the ao2 object is released on a hot path.
+	 * \since 13.18.0
+	 *
+	 * The destructor is run and the object freed by a reaper thread
+	 * instead of by the thread that released the last reference.  The
+	 * destructor must not depend on running before the release returns.
+	 */
+	AO2_ALLOC_OPT_DEFER_DESTROY = (1 << 2),
 };
 
 /*!
@@ -1142,6 +1151,42 @@ enum ao2_container_opts {
 	 * ao2_sort_fn.
 	 */
 	AO2_CONTAINER_ALLOC_OPT_DUPS_REPLACE = (3 << 1),
+	/*!
+	 * \brief Find single objects without locking the container.
+	 * \since 13.18.0
+	 *
+	 * \details An ao2_find() by OBJ_SEARCH_OBJECT or OBJ_SEARCH_KEY
+	 * without OBJ_MULTIPLE, OBJ_UNLINK, or OBJ_NODATA looks the object
+	 * up in an index of the container that readers walk without taking
+	 * the container lock.  Linking and unlinking objects keep the index
+	 * up to date under the container write lock, and index entries are
+	 * only released once no reader can still be looking at them.
+	 *
+	 * \note Only hash and list containers have the index.  Other
+	 * containers ignore the option.
+	 *
+	 * \note The search order flags do not apply to these finds.  If the
+	 * container has several objects matching, which one is found is
+	 * not defined.
+	 */
+	AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND = (1 << 3),
+	/*!
+	 * \brief Grow the number of hash buckets with the number of objects.
+	 * \since 13.18.0
+	 *
+	 * \details Once the container holds more than two objects per
+	 * bucket the buckets are doubled.  The objects are moved into the
+	 * new buckets a few buckets at a time by the following links, so no
+	 * link or find ever rehashes the whole container.
+	 *
+	 * \note Only hash containers with a hash function grow.  Other
+	 * containers ignore the option.
+	 *
+	 * \note Objects are visited in bucket order as before.  A bucket
+	 * with an object held by an ongoing traversal or iterator is not
+	 * moved until they move on.
+	 */
+	AO2_CONTAINER_ALLOC_OPT_AUTO_RESIZE = (1 << 4),
 };
 
 /*!
@@ -0,0 +1,196 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ * \brief Benchmark Framework API
+ *
+ * For an overview on how to use the benchmark API, see \ref AstBenchAPI
+ */
+
+#ifndef _AST_BENCH_H_
+#define _AST_BENCH_H_
+
+/*!
+
+\page AstBenchAPI Asterisk Benchmark API
+
+\section BenchAPIUsage How to Use the Benchmark API
+
+   Benchmarks are defined and registered like unit tests, and are only
+   available when Asterisk is built with TEST_FRAMEWORK.
+
+\code
+   AST_BENCH_DEFINE(sample_bench)
+   {
+      switch (cmd) {
+      case BENCH_INIT:
+          info->name = "sample";
+          info->category = "/main/sample/";
+          info->summary = "sample benchmark";
+          info->description = "Measures how long doing something a thousand times takes";
+          info->ops = 1000;
+          return 0;
+      case BENCH_SETUP:
+          \\ allocate what every iteration uses
+          return 0;
+      case BENCH_RUN:
+          \\ do something info->ops times
+          return 0;
+      case BENCH_CLEANUP:
+          \\ free what BENCH_SETUP allocated
+          return 0;
+      }
+      return -1;
+   }
+
+   AST_BENCH_REGISTER(sample_bench);
+\endcode
+
+   BENCH_SETUP is called once, followed by info->warmup untimed and
+   info->iterations timed BENCH_RUN calls, and BENCH_CLEANUP even if one of
+   them failed.  Only one benchmark runs at a time, so benchmarks may keep
+   their state in static variables.
+
+   CLI Examples:
+\code
+   'bench show registered all'       lists every registered benchmark.
+   'bench execute all'               runs every registered benchmark.
+   'bench show results'              shows the results of the last run.
+   'bench generate results json'     writes the results of the last run as JSON.
+\endcode
+
+   Running them without a console is done with
+   asterisk -rx "bench execute all" followed by
+   asterisk -rx "bench generate results json /path/to/file.json".
+*/
+
+enum ast_bench_command {
+	/*! Fill in the info */
+	BENCH_INIT,
+	/*! Prepare for the iterations */
+	BENCH_SETUP,
+	/*! Run one iteration */
+	BENCH_RUN,
+	/*! Free what BENCH_SETUP allocated */
+	BENCH_CLEANUP,
+};
+
+/*!
+ * \brief An Asterisk benchmark.
+ *
+ * This is an opaque type.
+ */
+struct ast_bench;
+
+/*!
+ * \brief What BENCH_INIT fills in
+ */
+struct ast_bench_info {
+	/*! \brief Name of the benchmark, unique to category */
+	const char *name;
+	/*!
+	 * \brief Benchmark category
+	 *
+	 * Like test categories, with a leading and trailing forward slash ('/').
+	 */
+	const char *category;
+	/*! \brief Short summary of the benchmark */
+	const char *summary;
+	/*! \brief More detailed description of the benchmark */
+	const char *description;
+	/*! \brief Number of timed iterations, 100 if not set */
+	unsigned int iterations;
+	/*! \brief Number of untimed iterations run first, a tenth of iterations if not set */
+	unsigned int warmup;
+	/*! \brief Number of operations an iteration does, for the rate, 1 if not set */
+	unsigned int ops;
+};
+
+/*!
+ * \brief Benchmark callback function
+ *
+ * \param info The benchmark info object
+ * \param cmd What to do
+ * \param bench The benchmark being run
+ *
+ * \retval 0 success
+ * \retval -1 failure, which stops the benchmark
+ */
+typedef int (ast_bench_cb_t)(struct ast_bench_info *info, enum ast_bench_command cmd,
+	struct ast_bench *bench);
+
+#ifdef TEST_FRAMEWORK
+
+#define AST_BENCH_DEFINE(hdr) static int hdr(struct ast_bench_info *info, enum ast_bench_command cmd, struct ast_bench *bench)
+#define AST_BENCH_REGISTER(cb) ast_bench_register(cb)
+#define AST_BENCH_UNREGISTER(cb) ast_bench_unregister(cb)
+
+/*!
+ * \brief Register a benchmark
+ *
+ * \param cb Benchmark callback function
+ *
+ * \retval 0 success
+ * \retval -1 failure
+ */
+int ast_bench_register(ast_bench_cb_t *cb);
+
+/*!
+ * \brief Unregister a benchmark
+ *
+ * \param cb Benchmark callback function
+ *
+ * \retval 0 success
+ * \retval -1 failure
+ */
+int ast_bench_unregister(ast_bench_cb_t *cb);
+
+/*!
+ * \brief Set how long the current iteration took
+ *
+ * \param bench The benchmark being run
+ * \param usec Duration in microseconds
+ *
+ * For benchmarks measuring something other than the time BENCH_RUN takes,
+ * such as how long a message takes to be delivered.  Replaces the time
+ * measured by the framework for the iteration.
+ */
+void ast_bench_set_time(struct ast_bench *bench, int64_t usec);
+
+/*!
+ * \brief Report something about a benchmark being run
+ *
+ * \param bench The benchmark being run
+ * \param fmt printf style format string
+ *
+ * Shown on the CLI the benchmark was run from, if any, and kept with the
+ * results.
+ */
+void ast_bench_status_update(struct ast_bench *bench, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+#else
+
+#define AST_BENCH_DEFINE(hdr) static int attribute_unused hdr(struct ast_bench_info *info, enum ast_bench_command cmd, struct ast_bench *bench)
+#define AST_BENCH_REGISTER(cb)
+#define AST_BENCH_UNREGISTER(cb)
+#define ast_bench_set_time(bench, usec)
+#define ast_bench_status_update(bench, fmt, ...)
+
+#endif
+
+#endif /* _AST_BENCH_H_ */
@@ -312,6 +312,8 @@ struct ast_bridge {
 	unsigned int dissolved:1;
 	/*! TRUE if the bridge construction was completed. */
 	unsigned int construction_completed:1;
+	/*! TRUE if the bridge manager is to update the peer variables and publish the bridge state. */
+	unsigned int reconfigured_deferred:1;
 
 	AST_DECLARE_STRING_FIELDS(
 		/*! Immutable name of the creator for the bridge */
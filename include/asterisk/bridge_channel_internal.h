@@ -68,6 +68,8 @@ enum bridge_channel_action_type {
 	BRIDGE_CHANNEL_ACTION_DEFERRED_TECH_DESTROY = 1000,
 	/*! Bridge deferred dissolving. */
 	BRIDGE_CHANNEL_ACTION_DEFERRED_DISSOLVING,
+	/*! Bridge deferred peer variable update and state publication. */
+	BRIDGE_CHANNEL_ACTION_DEFERRED_RECONFIGURED,
 };
 
 /*!
@@ -172,6 +172,16 @@ struct ast_bridge_technology {
 	struct ast_module *mod;
 	/*! Linked list information */
 	AST_RWLIST_ENTRY(ast_bridge_technology) entry;
+	/*!
+	 * \brief Output technology specific information about a bridge for the 'bridge show' CLI command.
+	 * \since 13.18.0
+	 *
+	 * \param bridge Which bridge to show information about.
+	 * \param fd File descriptor to send the output to.
+	 *
+	 * \note On entry, bridge is already locked.
+	 */
+	void (*show)(struct ast_bridge *bridge, int fd);
 };
 
 /*!
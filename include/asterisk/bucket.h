@@ -342,6 +342,20 @@ int ast_bucket_file_delete(struct ast_bucket_file *file);
  */
 struct ast_bucket_file *ast_bucket_file_retrieve(const char *uri);
 
+/*!
+ * \brief Retrieve whether or not the backing datastore views the bucket file as stale
+ * \since 13.18.0
+ *
+ * \param file Bucket file
+ *
+ * This refers to whether or not the file contents held locally, such as a
+ * downloaded copy, no longer reflect the contents at the URI.
+ *
+ * \retval 0 if not stale
+ * \retval 1 if stale
+ */
+int ast_bucket_file_is_stale(struct ast_bucket_file *file);
+
 /*!
  * \brief Add an observer for bucket file creation and deletion operations
  *
@@ -224,6 +224,7 @@ enum ast_cdr_settings {
 	CDR_END_BEFORE_H_EXTEN = 1 << 4,    /*< End the CDR before the 'h' extension runs */
 	CDR_INITIATED_SECONDS = 1 << 5,     /*< Include microseconds into the billing time */
 	CDR_DEBUG = 1 << 6,                 /*< Enables extra debug statements */
+	CDR_SPOOL = 1 << 7,                 /*< Write CDRs to a local spool before posting them */
 };
 
 /*! \brief CDR Batch Mode settings */
@@ -457,6 +458,18 @@ int ast_cdr_serialize_variables(const char *channel_name, struct ast_str **buf,
  */
 typedef int (*ast_cdrbe)(struct ast_cdr *cdr);
 
+/*!
+ * \brief CDR backend callback for a batch of records
+ * \since 13.18.0
+ *
+ * \param cdrs The records, in the order they were completed
+ * \param count The number of records
+ *
+ * \warning As with \ref ast_cdrbe, the channels of the records must not be
+ * accessed.  The records are freed once the callback returns.
+ */
+typedef int (*ast_cdrbe_batch)(struct ast_cdr **cdrs, size_t count);
+
 /*! \brief Return TRUE if CDR subsystem is enabled */
 int ast_cdr_is_enabled(void);
 
@@ -509,6 +522,24 @@ void ast_cdr_free(struct ast_cdr *cdr);
  */
 int ast_cdr_register(const char *name, const char *desc, ast_cdrbe be);
 
+/*!
+ * \brief Register a CDR handling engine that can post a batch of records at once
+ * \since 13.18.0
+ *
+ * \param name name associated with the particular CDR handler
+ * \param desc description of the CDR handler
+ * \param be function pointer to a CDR handler for single records, may be NULL
+ * \param batch_be function pointer to a CDR handler for batches of records
+ *
+ * When CDRs are posted in batch mode, batch_be is given every record of the
+ * batch in one call.  Records posted on their own are given to be, or to
+ * batch_be as a batch of one if be is NULL.
+ *
+ * \retval 0 on success.
+ * \retval -1 on error
+ */
+int ast_cdr_register_batch(const char *name, const char *desc, ast_cdrbe be, ast_cdrbe_batch batch_be);
+
 /*!
  * \brief Unregister a CDR handling engine
  * \param name name of CDR handler to unregister
@@ -761,8 +761,6 @@ struct ast_channel_tech {
 /*! Kill the channel channel driver technology descriptor. */
 extern const struct ast_channel_tech ast_kill_tech;
 
-struct ast_epoll_data;
-
 /*!
  * The high bit of the frame count is used as a debug marker, so
  * increments of the counters must be done with care.
@@ -2347,13 +2345,29 @@ void ast_channel_set_caller(struct ast_channel *chan, const struct ast_party_cal
  */
 void ast_channel_set_caller_event(struct ast_channel *chan, const struct ast_party_caller *caller, const struct ast_set_party_caller *update);
 
-/*! Set the file descriptor on the channel */
+/*!
+ * \brief Set the file descriptor on the channel
+ *
+ * \note Where epoll or kqueue is available the descriptor is also registered
+ * with the channel's event queue, so channel fds must always be changed
+ * through this function.  Set the fd again after replacing a closed one
+ * even if the new descriptor has the same number.
+ */
 void ast_channel_set_fd(struct ast_channel *chan, int which, int fd);
 
-/*! Add a channel to an optimized waitfor */
+/*!
+ * \brief Add a channel to an optimized waitfor
+ *
+ * \note This does nothing.  Every channel keeps its own event queue, which
+ * ast_waitfor_nandfds() uses whatever other channels it is waiting on.
+ */
 void ast_poll_channel_add(struct ast_channel *chan0, struct ast_channel *chan1);
 
-/*! Delete a channel from an optimized waitfor */
+/*!
+ * \brief Delete a channel from an optimized waitfor
+ *
+ * \note This does nothing.  See ast_poll_channel_add().
+ */
 void ast_poll_channel_del(struct ast_channel *chan0, struct ast_channel *chan1);
 
 /*! Start a tone going */
@@ -4056,6 +4070,8 @@ enum ama_flags ast_channel_amaflags(const struct ast_channel *chan);
 void ast_channel_amaflags_set(struct ast_channel *chan, enum ama_flags value);
 int ast_channel_epfd(const struct ast_channel *chan);
 void ast_channel_epfd_set(struct ast_channel *chan, int value);
+int ast_channel_internal_epfd_incomplete(const struct ast_channel *chan);
+void ast_channel_internal_epfd_incomplete_set(struct ast_channel *chan, int value);
 int ast_channel_fdno(const struct ast_channel *chan);
 void ast_channel_fdno_set(struct ast_channel *chan, int value);
 int ast_channel_hangupcause(const struct ast_channel *chan);
@@ -4242,12 +4258,6 @@ void ast_channel_internal_fd_set(struct ast_channel *chan, int which, int value)
 int ast_channel_fd(const struct ast_channel *chan, int which);
 int ast_channel_fd_isset(const struct ast_channel *chan, int which);
 
-/* epoll data internal accessors */
-#ifdef HAVE_EPOLL
-struct ast_epoll_data *ast_channel_internal_epfd_data(const struct ast_channel *chan, int which);
-void ast_channel_internal_epfd_data_set(struct ast_channel *chan, int which , struct ast_epoll_data *value);
-#endif
-
 pthread_t ast_channel_blocker(const struct ast_channel *chan);
 void ast_channel_blocker_set(struct ast_channel *chan, pthread_t value);
 
@@ -4263,6 +4273,31 @@ void ast_channel_internal_bridge_set(struct ast_channel *chan, struct ast_bridge
 struct ast_bridge_channel *ast_channel_internal_bridge_channel(const struct ast_channel *chan);
 void ast_channel_internal_bridge_channel_set(struct ast_channel *chan, struct ast_bridge_channel *value);
 
+struct ast_channel_snapshot;
+
+/*!
+ * \since 13.18.0
+ * \brief Get the last snapshot that was created of a channel
+ *
+ * \pre chan is locked
+ *
+ * \note The returned snapshot does not have its reference count bumped.
+ *
+ * \retval NULL if no snapshot has been created yet
+ */
+struct ast_channel_snapshot *ast_channel_internal_snapshot(const struct ast_channel *chan);
+
+/*!
+ * \since 13.18.0
+ * \brief Remember the last snapshot that was created of a channel
+ *
+ * \pre chan is locked
+ *
+ * \note The channel takes its own reference to the snapshot and releases
+ * the previous one.
+ */
+void ast_channel_internal_snapshot_set(struct ast_channel *chan, struct ast_channel_snapshot *snapshot);
+
 struct ast_channel *ast_channel_internal_bridged_channel(const struct ast_channel *chan);
 void ast_channel_internal_bridged_channel_set(struct ast_channel *chan, struct ast_channel *value);
 
@@ -4402,6 +4437,10 @@ struct varshead *ast_channel_get_vars(struct ast_channel *chan);
  *
  * If the given \a chan is \c NULL, ast_channel_topic_all() is returned.
  *
+ * A channel's topic is created the first time it is asked for. Code that
+ * only publishes to the channel should use ast_channel_topic_for_publish()
+ * instead, so channels nobody subscribes to do without one.
+ *
  * \param chan Channel, or \c NULL.
  *
  * \retval Topic for channel's events.
@@ -4409,6 +4448,22 @@ struct varshead *ast_channel_get_vars(struct ast_channel *chan);
  */
 struct stasis_topic *ast_channel_topic(struct ast_channel *chan);
 
+/*!
+ * \since 13.18.0
+ * \brief A topic to publish the events for a particular channel to.
+ *
+ * This is the channel's own topic if something has asked for it with
+ * ast_channel_topic(). Otherwise it is a topic shared by all such channels,
+ * which is forwarded and cached the same way, so subscribers of
+ * ast_channel_topic_all() see no difference.
+ *
+ * \param chan Channel, or \c NULL.
+ *
+ * \retval Topic to publish the channel's events to.
+ * \retval ast_channel_topic_all() if \a chan is \c NULL.
+ */
+struct stasis_topic *ast_channel_topic_for_publish(struct ast_channel *chan);
+
 /*!
  * \since 12
  * \brief A topic which publishes the events for a particular channel.
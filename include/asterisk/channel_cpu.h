@@ -0,0 +1,119 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Per channel CPU accounting
+ *
+ * The CPU time a thread spends working for a channel, as measured by the
+ * thread's CPU clock, is added to the channel.  Work for a channel done
+ * while working for another is only counted for the innermost channel, so
+ * writing a frame to the peer of a channel being read from is counted for
+ * the peer.
+ *
+ * Accounting is only built when CHANNEL_CPU_STATS is enabled in the
+ * Compiler Flags section of menuselect.  Otherwise the macros below do
+ * nothing and no CPU time is counted.
+ *
+ * \code
+ * AST_CHANNEL_CPU_DECLARE(cpu);
+ *
+ * AST_CHANNEL_CPU_START(cpu, chan);
+ * ...
+ * AST_CHANNEL_CPU_END(cpu);
+ * \endcode
+ */
+
+#ifndef _ASTERISK_CHANNEL_CPU_H
+#define _ASTERISK_CHANNEL_CPU_H
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+struct ast_channel;
+
+/*!
+ * \brief Get the CPU time counted for a channel
+ * \since 13.18.0
+ *
+ * \param chan The channel
+ *
+ * \return microseconds of CPU time
+ */
+uint64_t ast_channel_cpu_usec(struct ast_channel *chan);
+
+/*!
+ * \brief Get the CPU time counted for all channels since startup
+ * \since 13.18.0
+ *
+ * \return microseconds of CPU time, of the channels hung up and the
+ *         channels still up
+ */
+uint64_t ast_channel_cpu_usec_total(void);
+
+#ifdef CHANNEL_CPU_STATS
+
+/*!
+ * \brief Start counting the CPU time of the calling thread for a channel
+ * \since 13.18.0
+ *
+ * \param chan The channel, which the caller must hold a reference to until
+ *        ast_channel_cpu_end()
+ *
+ * \return the channel the thread counted for before, to pass to
+ *         ast_channel_cpu_end()
+ */
+struct ast_channel *ast_channel_cpu_start(struct ast_channel *chan);
+
+/*!
+ * \brief Stop counting the CPU time of the calling thread for a channel
+ * \since 13.18.0
+ *
+ * \param prev What ast_channel_cpu_start() returned
+ */
+void ast_channel_cpu_end(struct ast_channel *prev);
+
+/*!
+ * \brief Stop counting the CPU time of a channel being hung up
+ * \since 13.18.0
+ *
+ * Sets the \c cpu_usec variable on the CDRs of the channel and adds its
+ * CPU time to the total of the channels hung up.
+ *
+ * \param chan The channel
+ */
+void ast_channel_cpu_hangup(struct ast_channel *chan);
+
+#define AST_CHANNEL_CPU_DECLARE(name) struct ast_channel *name
+#define AST_CHANNEL_CPU_START(name, chan) ((name) = ast_channel_cpu_start(chan))
+#define AST_CHANNEL_CPU_END(name) ast_channel_cpu_end(name)
+#define AST_CHANNEL_CPU_HANGUP(chan) ast_channel_cpu_hangup(chan)
+
+#else
+
+#define AST_CHANNEL_CPU_DECLARE(name) attribute_unused struct ast_channel *name
+#define AST_CHANNEL_CPU_START(name, chan)
+#define AST_CHANNEL_CPU_END(name)
+#define AST_CHANNEL_CPU_HANGUP(chan)
+
+#endif /* CHANNEL_CPU_STATS */
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _ASTERISK_CHANNEL_CPU_H */
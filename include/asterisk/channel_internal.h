@@ -23,7 +23,9 @@ struct ast_channel *__ast_channel_internal_alloc(void (*destructor)(void *obj),
 void ast_channel_internal_finalize(struct ast_channel *chan);
 int ast_channel_internal_is_finalized(struct ast_channel *chan);
 void ast_channel_internal_cleanup(struct ast_channel *chan);
-int ast_channel_internal_setup_topics(struct ast_channel *chan);
 
 void ast_channel_internal_errno_set(enum ast_channel_error error);
 enum ast_channel_error ast_channel_internal_errno(void);
+
+void ast_channel_internal_cpu_nsec_add(struct ast_channel *chan, uint64_t nsec);
+uint64_t ast_channel_internal_cpu_nsec(struct ast_channel *chan);
@@ -28,6 +28,8 @@
 struct ast_var_t {
 	AST_LIST_ENTRY(ast_var_t) entries;
 	char *value;
+	/*! Hash of the name without its initial underscores */
+	unsigned int hash;
 	char name[0];
 };
 
@@ -46,6 +48,16 @@ const char *ast_var_name(const struct ast_var_t *var);
 const char *ast_var_full_name(const struct ast_var_t *var);
 const char *ast_var_value(const struct ast_var_t *var);
 char *ast_var_find(const struct varshead *head, const char *name);
+
+/*!
+ * \brief Find a variable by its name without the initial underscores
+ * \since 13.18.0
+ *
+ * \note Only variables whose name hashes the same have their names compared.
+ *
+ * \return The first variable in the list with the name, or NULL
+ */
+struct ast_var_t *ast_var_list_find(const struct varshead *head, const char *name);
 struct varshead *ast_var_list_clone(struct varshead *head);
 
 #define AST_VAR_LIST_TRAVERSE(head, var) AST_LIST_TRAVERSE(head, var, entries)
@@ -33,6 +33,39 @@ extern "C" {
 void ast_cli(int fd, const char *fmt, ...)
 	__attribute__((format(printf, 2, 3)));
 
+/*!
+ * \brief Add output to a buffer, writing it to a CLI once a chunk is ready
+ * \since 13.18.0
+ *
+ * \param fd File descriptor of the CLI
+ * \param buf Buffer of the output not written yet, allocated if NULL
+ * \param fmt printf style format string
+ *
+ * Commands with a lot of output use this rather than ast_cli() to write it
+ * in chunks of AST_CLI_CHUNK_LEN instead of a line at a time.  Output is
+ * written by this function, so it must not be called with locks held;
+ * ast_str_append() the output built under locks to the buffer instead.
+ * Whatever is left has to be written by ast_cli_flush().
+ */
+void ast_cli_buffered(int fd, struct ast_str **buf, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+/*!
+ * \brief Write the output in a buffer to a CLI, in chunks, and empty it
+ * \since 13.18.0
+ *
+ * \param fd File descriptor of the CLI
+ * \param buf Buffer of the output, may point to NULL
+ *
+ * Each chunk of AST_CLI_CHUNK_LEN is given as long to be written as a
+ * single ast_cli() is, so a slow remote console receives all of a large
+ * output rather than the part written in that time.
+ */
+void ast_cli_flush(int fd, struct ast_str **buf);
+
+/*! \brief Size of the chunks ast_cli_buffered() and ast_cli_flush() write */
+#define AST_CLI_CHUNK_LEN 16384
+
 /* dont check permissions while passing this option as a 'uid'
  * to the cli_has_permissions() function. */
 #define CLI_NO_PERMS		-1
@@ -269,6 +269,34 @@ struct ast_filestream *ast_readfile(const char *filename, const char *type, cons
  */
 struct ast_filestream *ast_writefile(const char *filename, const char *type, const char *comment, int flags, int check, mode_t mode);
 
+/*! \brief Flags for ast_writefile_async() */
+enum ast_writefile_flags {
+	/*! Sync the file to storage when the stream is closed */
+	AST_WRITEFILE_SYNC = (1 << 0),
+};
+
+/*!
+ * \brief Starts writing a file, with the writes made by a writer thread
+ * \since 13.18.0
+ *
+ * \param filename the name of the file to write to
+ * \param type format of file you wish to write out to
+ * \param comment comment to go with
+ * \param flags output file flags
+ * \param mode Open mode
+ * \param async_flags AST_WRITEFILE_* flags
+ *
+ * Like ast_writefile(), but the data written to the stream is handed to a
+ * shared pool of writer threads, so that writing frames does not wait for
+ * storage unless a lot of data is waiting to be written. Closing the stream
+ * waits for the data to be written. Files opened for reading as well as
+ * writing, and systems without fopencookie(), are written synchronously.
+ *
+ * \retval a struct ast_filestream on success.
+ * \retval NULL on failure.
+ */
+struct ast_filestream *ast_writefile_async(const char *filename, const char *type, const char *comment, int flags, mode_t mode, unsigned int async_flags);
+
 /*! 
  * \brief Writes a frame to a stream 
  * \param fs filestream to write to
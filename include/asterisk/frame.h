@@ -135,6 +135,12 @@ enum {
 	AST_FRFLAG_HAS_TIMING_INFO = (1 << 0),
 	/*! This frame has been requeued */
 	AST_FRFLAG_REQUEUED = (1 << 1),
+	/*!
+	 * This voice frame holds nothing but silence.  Kept through translation,
+	 * so whoever sends it on may send something cheaper instead, such as RTP
+	 * comfort noise.
+	 */
+	AST_FRFLAG_SILENCE = (1 << 2),
 };
 
 struct ast_frame_subclass {
@@ -219,6 +225,10 @@ extern struct ast_frame ast_null_frame;
 #define AST_MALLOCD_DATA	(1 << 1)
 /*! Need the source be free'd? (haha!) */
 #define AST_MALLOCD_SRC		(1 << 2)
+/*! The header came from a frame pool, always set along with AST_MALLOCD_HDR */
+#define AST_MALLOCD_POOL	(1 << 3)
+/*! The data and src belong to a payload shared with other frames, see ast_frame_share() */
+#define AST_MALLOCD_SHARED	(1 << 4)
 
 /* MODEM subclasses */
 /*! T.38 Fax-over-IP */
@@ -556,6 +566,68 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr);
  */
 struct ast_frame *ast_frdup(const struct ast_frame *fr);
 
+/*!
+ * \brief Create a frame that shares its payload with other frames
+ * \since 13.18.0
+ *
+ * \param fr Frame to share
+ *
+ * If \a fr already shares its payload the new frame references the same
+ * payload and no data is copied.  Otherwise the data and src of \a fr are
+ * copied once into a new reference counted payload which later calls can
+ * share.  This makes handing the same frame to many consumers cheap.
+ *
+ * Every shared frame has its own header, so fields such as ts, seqno and
+ * delivery can be changed freely.  The data, the AST_FRIENDLY_OFFSET area in
+ * front of it and src are read only until ast_frame_unshare() is called.
+ *
+ * \return A malloc'd frame to be freed with ast_frfree(), or NULL on error
+ */
+struct ast_frame *ast_frame_share(const struct ast_frame *fr);
+
+/*!
+ * \brief Give a frame its own copy of a shared payload
+ * \since 13.18.0
+ *
+ * \param fr Frame that is about to be modified
+ *
+ * Anything that changes the data of a frame in place, or writes into the
+ * space in front of it, must call this first.  Frames that do not share a
+ * payload are left untouched.  A frame that is unshared has its header, data
+ * and src malloc'd just like one returned by ast_frisolate().
+ *
+ * \retval 0 on success
+ * \retval -1 on error, the frame still shares its payload
+ */
+int ast_frame_unshare(struct ast_frame *fr);
+
+/*!
+ * \brief Get the energy measured for a frame with a shared payload
+ * \since 13.18.0
+ *
+ * \param fr Frame to look at
+ * \param[out] energy Average absolute sample value of the frame
+ *
+ * The data of a shared payload cannot change, so a measurement made by one
+ * consumer of the frame, such as a silence detector, can be reused by every
+ * other frame sharing the payload.
+ *
+ * \retval 0 if the energy was measured before
+ * \retval -1 if it was not, or the frame does not share its payload
+ */
+int ast_frame_get_energy(const struct ast_frame *fr, int *energy);
+
+/*!
+ * \brief Record the energy measured for a frame with a shared payload
+ * \since 13.18.0
+ *
+ * \param fr Frame that was measured
+ * \param energy Average absolute sample value of the frame
+ *
+ * Nothing is recorded for frames that do not share their payload.
+ */
+void ast_frame_set_energy(struct ast_frame *fr, int energy);
+
 void ast_swapcopy_samples(void *dst, const void *src, int samples);
 
 /* Helpers for byteswapping native samples to/from
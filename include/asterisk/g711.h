@@ -0,0 +1,101 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief G.711 buffer conversion
+ *
+ * These are the buffer-at-a-time equivalents of AST_LIN2MU(), AST_MULAW(),
+ * AST_LIN2A() and AST_ALAW().  The results are guaranteed to be identical
+ * to applying the per-sample macros in a loop, but on platforms that
+ * support it the work is done using SIMD instructions selected at runtime.
+ */
+
+#ifndef _ASTERISK_G711_H
+#define _ASTERISK_G711_H
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/*!
+ * \brief Convert signed linear samples to mu-law
+ * \since 13.18.0
+ *
+ * \param dst Buffer receiving one mu-law byte per sample
+ * \param src Signed linear samples
+ * \param samples Number of samples to convert
+ */
+void ast_lin2mu_buf(unsigned char *dst, const int16_t *src, size_t samples);
+
+/*!
+ * \brief Convert mu-law samples to signed linear
+ * \since 13.18.0
+ *
+ * \param dst Buffer receiving the signed linear samples
+ * \param src mu-law bytes
+ * \param samples Number of samples to convert
+ */
+void ast_mulaw_buf(int16_t *dst, const unsigned char *src, size_t samples);
+
+/*!
+ * \brief Convert signed linear samples to A-law
+ * \since 13.18.0
+ *
+ * \param dst Buffer receiving one A-law byte per sample
+ * \param src Signed linear samples
+ * \param samples Number of samples to convert
+ */
+void ast_lin2a_buf(unsigned char *dst, const int16_t *src, size_t samples);
+
+/*!
+ * \brief Convert A-law samples to signed linear
+ * \since 13.18.0
+ *
+ * \param dst Buffer receiving the signed linear samples
+ * \param src A-law bytes
+ * \param samples Number of samples to convert
+ */
+void ast_alaw_buf(int16_t *dst, const unsigned char *src, size_t samples);
+
+/*!
+ * \brief Get the name of the G.711 conversion backend in use
+ * \since 13.18.0
+ *
+ * \return "scalar", "sse2" or "avx2"
+ */
+const char *ast_g711_backend(void);
+
+/*!
+ * \brief Select a specific G.711 conversion backend
+ * \since 13.18.0
+ *
+ * \param name Name of the backend as returned by ast_g711_backend(),
+ * or NULL to select the best one the CPU supports.
+ *
+ * \note This exists so that unit tests can compare every backend against
+ * the per-sample macros.  It is not safe to call while audio is being
+ * converted.
+ *
+ * \retval 0 on success
+ * \retval -1 if the backend is unknown or not supported by this CPU
+ */
+int ast_g711_set_backend(const char *name);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _ASTERISK_G711_H */
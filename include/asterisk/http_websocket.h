@@ -272,6 +272,25 @@ AST_OPTIONAL_API(int, ast_websocket_read_string,
  */
 AST_OPTIONAL_API(int, ast_websocket_write, (struct ast_websocket *session, enum ast_websocket_opcode opcode, char *payload, uint64_t payload_size), { errno = ENOSYS; return -1;});
 
+/*!
+ * \brief Construct and transmit several WebSocket frames at once
+ *
+ * The frames are written with a single flush of the session, rather than
+ * one flush per frame as with ast_websocket_write().
+ *
+ * \param session Pointer to the WebSocket session
+ * \param opcode WebSocket operation code to place in every frame
+ * \param payloads Payloads of the frames
+ * \param payload_sizes Lengths of the payloads
+ * \param count Number of frames
+ *
+ * \retval 0 if successfully written
+ * \retval -1 if error occurred
+ *
+ * \since 13.18.0
+ */
+AST_OPTIONAL_API(int, ast_websocket_write_batch, (struct ast_websocket *session, enum ast_websocket_opcode opcode, char * const *payloads, const uint64_t *payload_sizes, size_t count), { errno = ENOSYS; return -1;});
+
 /*!
  * \brief Construct and transmit a WebSocket frame containing string data.
  *
@@ -832,6 +832,203 @@ int ast_json_dump_file_format(struct ast_json *root, FILE *output, enum ast_json
  */
 int ast_json_dump_new_file_format(struct ast_json *root, const char *path, enum ast_json_encoding_format format);
 
+/*!
+ * \brief Streaming JSON encoder.
+ * \since 13.18.0
+ *
+ * Appends the encoding of a JSON value to an \ref ast_str as it is
+ * described, without building an \ref ast_json tree first. This is meant for
+ * objects that are encoded far more often than they are manipulated, such as
+ * channel and bridge snapshots.
+ *
+ * Errors are sticky; once a call fails, all further calls fail and the
+ * contents of the \ref ast_str are undefined. Only the result of
+ * ast_json_writer_finish() needs to be checked.
+ *
+ * \code
+ * struct ast_json_writer writer;
+ *
+ * ast_json_writer_init(&writer, &buf, AST_JSON_COMPACT);
+ * ast_json_writer_object_start(&writer);
+ * ast_json_writer_key(&writer, "name");
+ * ast_json_writer_string(&writer, "SIP/alice-00000001");
+ * ast_json_writer_object_end(&writer);
+ * if (ast_json_writer_finish(&writer)) {
+ *	... error ...
+ * }
+ * \endcode
+ */
+struct ast_json_writer {
+	/*! String the encoding is appended to */
+	struct ast_str **buf;
+	/*! Encoding format */
+	enum ast_json_encoding_format format;
+	/*! Number of open objects and arrays */
+	unsigned int depth;
+	/*! Bit per nesting level, set once that level has a member */
+	uint64_t has_members;
+	/*! Bit per nesting level, set if that level is an object */
+	uint64_t in_object;
+	/*! Set after a key, when the next value belongs to it */
+	unsigned int after_key:1;
+	/*! Set once any call has failed */
+	unsigned int error:1;
+};
+
+/*! \brief Maximum nesting depth of an \ref ast_json_writer */
+#define AST_JSON_WRITER_MAX_DEPTH 64
+
+/*!
+ * \brief Initialize a streaming JSON encoder.
+ * \since 13.18.0
+ *
+ * \param writer Encoder to initialize.
+ * \param buf String to append to. It is grown as needed.
+ * \param format Encoding format type.
+ */
+void ast_json_writer_init(struct ast_json_writer *writer, struct ast_str **buf,
+	enum ast_json_encoding_format format);
+
+/*!
+ * \brief Check that a streaming JSON encoding completed successfully.
+ * \since 13.18.0
+ *
+ * \param writer Encoder.
+ * \return 0 if every call succeeded and all objects and arrays are closed.
+ * \return -1 on error.
+ */
+int ast_json_writer_finish(struct ast_json_writer *writer);
+
+/*!
+ * \brief Open a JSON object.
+ * \since 13.18.0
+ * \param writer Encoder.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_object_start(struct ast_json_writer *writer);
+
+/*!
+ * \brief Close the innermost JSON object.
+ * \since 13.18.0
+ * \param writer Encoder.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_object_end(struct ast_json_writer *writer);
+
+/*!
+ * \brief Open a JSON array.
+ * \since 13.18.0
+ * \param writer Encoder.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_array_start(struct ast_json_writer *writer);
+
+/*!
+ * \brief Close the innermost JSON array.
+ * \since 13.18.0
+ * \param writer Encoder.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_array_end(struct ast_json_writer *writer);
+
+/*!
+ * \brief Write the key of the next member of the innermost object.
+ * \since 13.18.0
+ * \param writer Encoder.
+ * \param key Key; must be valid UTF-8.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_key(struct ast_json_writer *writer, const char *key);
+
+/*!
+ * \brief Write a JSON string.
+ * \since 13.18.0
+ *
+ * As with ast_json_string_create(), invalid UTF-8 is an error.
+ *
+ * \param writer Encoder.
+ * \param value String to write, or \c NULL to write a JSON null.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_string(struct ast_json_writer *writer, const char *value);
+
+/*!
+ * \brief Write a JSON integer.
+ * \since 13.18.0
+ * \param writer Encoder.
+ * \param value Value to write.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_integer(struct ast_json_writer *writer, intmax_t value);
+
+/*!
+ * \brief Write a JSON null.
+ * \since 13.18.0
+ * \param writer Encoder.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_null(struct ast_json_writer *writer);
+
+/*!
+ * \brief Write an existing JSON value.
+ * \since 13.18.0
+ *
+ * For the rare parts of a streamed value that are only available as
+ * \ref ast_json.
+ *
+ * \param writer Encoder.
+ * \param value Value to write, or \c NULL to write a JSON null.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_value(struct ast_json_writer *writer, struct ast_json *value);
+
+/*!
+ * \brief Write a timeval, formatted as ast_json_timeval() does.
+ * \since 13.18.0
+ * \param writer Encoder.
+ * \param tv \c timeval to encode.
+ * \param zone Text string of a standard system zoneinfo file. If NULL, the
+ *             system localtime will be used.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_timeval(struct ast_json_writer *writer, const struct timeval tv,
+	const char *zone);
+
+/*!
+ * \brief Write a name/number pair, as ast_json_name_number() builds it.
+ * \since 13.18.0
+ * \param writer Encoder.
+ * \param name Name
+ * \param number Number
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_name_number(struct ast_json_writer *writer, const char *name,
+	const char *number);
+
+/*!
+ * \brief Write a context/exten/priority, as ast_json_dialplan_cep() builds it.
+ * \since 13.18.0
+ * \param writer Encoder.
+ * \param context Dialplan context.
+ * \param exten Extension.
+ * \param priority Dialplan priority.
+ * \return 0 on success.
+ * \return -1 on error.
+ */
+int ast_json_writer_dialplan_cep(struct ast_json_writer *writer, const char *context,
+	const char *exten, int priority);
+
 #define AST_JSON_ERROR_TEXT_LENGTH    160
 #define AST_JSON_ERROR_SOURCE_LENGTH   80
 
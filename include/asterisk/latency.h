@@ -0,0 +1,120 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Hot path latency histograms
+ *
+ * Each thread counts the time spent in a stage of frame and task handling
+ * into its own log-linear histogram, so recording takes no locks.  The
+ * histograms of all threads are summed when they are shown with
+ * "core show latency" or the CoreShowLatency AMI action.
+ *
+ * Recording is only built when LATENCY_STATS is enabled in the Compiler
+ * Flags section of menuselect.  Otherwise the macros below do nothing.
+ *
+ * \code
+ * AST_LATENCY_DECLARE(start);
+ *
+ * AST_LATENCY_START(start);
+ * ...
+ * AST_LATENCY_END(AST_LATENCY_TRANSLATE, start);
+ * \endcode
+ */
+
+#ifndef _ASTERISK_LATENCY_H
+#define _ASTERISK_LATENCY_H
+
+#include "asterisk/time.h"
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/*! \brief The stages latency is recorded for */
+enum ast_latency_stage {
+	/*! Reading a frame from a channel */
+	AST_LATENCY_CHANNEL_READ,
+	/*! Writing a frame to a channel */
+	AST_LATENCY_CHANNEL_WRITE,
+	/*! Passing a frame through a translation path */
+	AST_LATENCY_TRANSLATE,
+	/*! Handing a frame read from a bridged channel to the bridge */
+	AST_LATENCY_BRIDGE_FRAME,
+	/*! Mixing one interval of a softmix bridge */
+	AST_LATENCY_SOFTMIX_MIX,
+	/*! Time a task waits in a taskprocessor queue */
+	AST_LATENCY_TASKPROCESSOR_WAIT,
+	AST_LATENCY_STAGE_MAX,
+};
+
+#ifdef LATENCY_STATS
+
+/*! \brief Latency recorded for a stage */
+struct ast_latency_summary {
+	/*! Number of times recorded */
+	uint64_t count;
+	/*! Total of the recorded times */
+	uint64_t total_us;
+	unsigned int mean_us;
+	/*! Percentiles are the largest time of the histogram bucket they fall in */
+	unsigned int p50_us;
+	unsigned int p99_us;
+	unsigned int p999_us;
+	unsigned int max_us;
+};
+
+/*!
+ * \brief Get the latency recorded for every stage
+ * \since 13.18.0
+ *
+ * \param summaries Filled in with the latency since startup or the last reset,
+ * indexed by stage
+ */
+void ast_latency_get_summaries(struct ast_latency_summary summaries[AST_LATENCY_STAGE_MAX]);
+
+/*!
+ * \brief Get the name of a stage
+ * \since 13.18.0
+ */
+const char *ast_latency_stage_name(enum ast_latency_stage stage);
+
+/*!
+ * \brief Record the time spent in a stage
+ * \since 13.18.0
+ *
+ * \param stage The stage
+ * \param start When the stage started
+ */
+void ast_latency_record(enum ast_latency_stage stage, struct timeval start);
+
+#define AST_LATENCY_DECLARE(name) struct timeval name
+#define AST_LATENCY_START(name) ((name) = ast_tvnow())
+#define AST_LATENCY_END(stage, name) ast_latency_record((stage), (name))
+
+#else
+
+#define AST_LATENCY_DECLARE(name) attribute_unused struct timeval name
+#define AST_LATENCY_START(name)
+#define AST_LATENCY_END(stage, name)
+
+#endif /* LATENCY_STATS */
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _ASTERISK_LATENCY_H */
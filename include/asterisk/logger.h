@@ -295,6 +295,25 @@ void ast_console_toggle_loglevel(int fd, int level, int state);
  */
 unsigned int ast_debug_get_by_module(const char *module);
 
+/*!
+ * \brief Get the debug level for the call of the calling thread
+ * \since 13.18.0
+ *
+ * \return the debug level set on the callid bound to the calling thread,
+ *         or 0 if the thread has no callid
+ */
+unsigned int ast_debug_get_by_callid(void);
+
+/*!
+ * \brief Get the debug level for a channel name
+ * \since 13.18.0
+ *
+ * \param name the name of the channel
+ *
+ * \return the debug level set for the longest prefix of the name
+ */
+unsigned int ast_debug_get_by_channel(const char *name);
+
 /*!
  * \brief Get the verbose level for a module
  * \param module the name of module
@@ -431,6 +450,34 @@ void ast_callid_threadstorage_auto_clean(struct ast_callid *callid, int callid_c
  */
 void ast_callid_strnprint(char *buffer, size_t buffer_size, struct ast_callid *callid);
 
+/*!
+ * \brief Set the debug level of the messages logged for a call
+ * \since 13.18.0
+ *
+ * \param callid The callid of the call
+ * \param level The debug level, or 0 to stop debugging the call
+ *
+ * Debug messages logged by threads bound to the callid are logged as
+ * though the core debug level was at least \c level.
+ */
+void ast_callid_debug_set(struct ast_callid *callid, unsigned int level);
+
+/*!
+ * \brief Get the debug level of the messages logged for a call
+ * \since 13.18.0
+ *
+ * \param callid The callid of the call
+ *
+ * \return the debug level set with ast_callid_debug_set()
+ */
+unsigned int ast_callid_debug_get(struct ast_callid *callid);
+
+/*!
+ * \brief Stop debugging all calls
+ * \since 13.18.0
+ */
+void ast_callid_debug_clear_all(void);
+
 /*!
  * \brief Send a log message to a dynamically registered log level
  * \param level The log level to send the message to
@@ -447,7 +494,8 @@ void ast_callid_strnprint(char *buffer, size_t buffer_size, struct ast_callid *c
 
 #define DEBUG_ATLEAST(level) \
 	(option_debug >= (level) \
-		|| (ast_opt_dbg_module && (int)ast_debug_get_by_module(AST_MODULE) >= (level)))
+		|| (ast_opt_dbg_module && (int)ast_debug_get_by_module(AST_MODULE) >= (level)) \
+		|| (ast_opt_dbg_callid && (int)ast_debug_get_by_callid() >= (level)))
 
 /*!
  * \brief Log a DEBUG message
@@ -0,0 +1,86 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ * \brief On disk format of binary log channels
+ *
+ * A binary log file starts with a \ref ast_logger_binary_header, followed by
+ * any number of records. Each record is an \ref ast_logger_binary_record
+ * followed by the file, function, level name and message strings, in that
+ * order and without terminators. All fields are in the byte order of the
+ * host that wrote the file.
+ *
+ * This header is shared with utils/astlogdecode.c and must not depend on
+ * anything else in the tree.
+ */
+
+#ifndef _ASTERISK_LOGGER_BINARY_H
+#define _ASTERISK_LOGGER_BINARY_H
+
+#include <stdint.h>
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/*! \brief Magic at the start of every binary log file */
+#define AST_LOGGER_BINARY_MAGIC "AstBLog\0"
+
+/*! \brief Version of the record layout below */
+#define AST_LOGGER_BINARY_VERSION 1
+
+/*! \brief Magic at the start of every record, used to detect corruption */
+#define AST_LOGGER_BINARY_RECORD_MAGIC 0x524c4241 /* "ABLR" */
+
+struct ast_logger_binary_header {
+	/*! \brief AST_LOGGER_BINARY_MAGIC */
+	char magic[8];
+	/*! \brief AST_LOGGER_BINARY_VERSION */
+	uint32_t version;
+	/*! \brief sizeof(struct ast_logger_binary_record) when written */
+	uint32_t record_size;
+};
+
+struct ast_logger_binary_record {
+	/*! \brief AST_LOGGER_BINARY_RECORD_MAGIC */
+	uint32_t magic;
+	/*! \brief Length of the record, including this header and the strings */
+	uint32_t len;
+	/*! \brief When the message was logged */
+	int64_t tv_sec;
+	uint32_t tv_usec;
+	/*! \brief Numerical log level */
+	int32_t level;
+	/*! \brief Thread that logged the message */
+	int32_t lwp;
+	/*! \brief Call identifier, 0 if there is none */
+	uint32_t callid;
+	/*! \brief Source line */
+	int32_t line;
+	/*! \brief Lengths of the strings following the record */
+	uint32_t message_len;
+	uint16_t file_len;
+	uint16_t function_len;
+	uint16_t level_name_len;
+	uint16_t reserved;
+};
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _ASTERISK_LOGGER_BINARY_H */
@@ -20,6 +20,7 @@
 #define _ASTERISK_MANAGER_H
 
 #include "asterisk/network.h"
+#include "asterisk/netsock2.h"
 #include "asterisk/lock.h"
 #include "asterisk/datastore.h"
 #include "asterisk/xmldoc.h"
@@ -139,6 +140,29 @@ void ast_manager_unregister_hook(struct manager_custom_hook *hook);
 */
 int ast_hook_send_action(struct manager_custom_hook *hook, const char *msg);
 
+/*!
+ * \brief Start an AMI session on a socket provided by another transport
+ * \since 13.18.0
+ *
+ * The session is processed exactly like a TCP AMI connection, in its own
+ * thread, by reading actions from and writing responses and events to
+ * \a fd as AMI protocol text.  This lets modules carry AMI over other
+ * transports, typically by bridging one end of a socketpair() to their own
+ * connection.
+ *
+ * \param fd Connected stream socket.  The session takes ownership of it,
+ * and it is closed when the session ends or if the session cannot be
+ * started.
+ * \param local Local address of the connection, may be NULL
+ * \param remote Address of the client, used for the user ACLs
+ * \param transport Transport reported in security events
+ *
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+int ast_manager_session_start(int fd, const struct ast_sockaddr *local,
+	const struct ast_sockaddr *remote, enum ast_transport transport);
+
 struct mansession;
 
 struct message {
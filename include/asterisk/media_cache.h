@@ -0,0 +1,104 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief An in-memory media cache
+ *
+ * The media cache keeps local copies of media referenced by URI, such as
+ * http://example.com/prompts/welcome.wav, so that they can be played back
+ * like any other sound file.  The copies are retrieved through the bucket
+ * API, which means a bucket scheme for the URI must be registered.  The
+ * least recently used copies are removed once the cache holds too many.
+ *
+ * Bucket schemes may set the following metadata on the files they retrieve:
+ *  - \c ext The file extension of the media, when the URI does not end with one
+ *  - \c __actual_expires When the copy has to be revalidated, in seconds since the epoch
+ */
+
+#ifndef _ASTERISK_MEDIA_CACHE_H
+#define _ASTERISK_MEDIA_CACHE_H
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/*!
+ * \brief Check if an item exists in the cache
+ * \since 13.18.0
+ *
+ * \param uri The unique URI for the media
+ *
+ * \retval 0 uri does not exist in cache
+ * \retval 1 uri does exist in cache
+ */
+int ast_media_cache_exists(const char *uri);
+
+/*!
+ * \brief Retrieve an item from the cache
+ * \since 13.18.0
+ *
+ * \param uri The unique URI for the media
+ * \param file_path Buffer to hold the path of the local copy, including its extension
+ * \param len Length of the buffer pointed to by \c file_path
+ *
+ * If the item is not in the cache it is retrieved, blocking the caller.
+ * If the item is in the cache but has expired the local copy is provided
+ * right away and revalidated in the background; a stale copy is replaced
+ * once the new one has been retrieved.
+ *
+ * \retval 0 The item was retrieved successfully
+ * \retval -1 The item could not be retrieved
+ */
+int ast_media_cache_retrieve(const char *uri, char *file_path, size_t len);
+
+/*!
+ * \brief Retrieve an item into the cache in the background
+ * \since 13.18.0
+ *
+ * \param uri The unique URI for the media
+ *
+ * Does nothing if the item is already in the cache.
+ *
+ * \retval 0 The retrieval was queued, or the item is already in the cache
+ * \retval -1 The retrieval could not be queued
+ */
+int ast_media_cache_prefetch(const char *uri);
+
+/*!
+ * \brief Remove an item from the cache
+ * \since 13.18.0
+ *
+ * \param uri The unique URI for the media
+ *
+ * \retval 0 success
+ * \retval -1 the item was not in the cache
+ */
+int ast_media_cache_delete(const char *uri);
+
+/*!
+ * \brief Initialize the media cache
+ * \since 13.18.0
+ *
+ * \retval 0 success
+ * \retval -1 failure
+ */
+int ast_media_cache_init(void);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _ASTERISK_MEDIA_CACHE_H */
@@ -101,6 +101,46 @@ struct ao2_container *ast_media_get_media(struct ast_media_index *index);
  */
 int ast_media_index_update(struct ast_media_index *index,
 	const char *variant);
+
+/*!
+ * \brief Reuse the directory listings of another media index
+ * \since 13.18.0
+ *
+ * \param index Media index to be updated
+ * \param previous Media index whose listings may be reused, or NULL for none
+ *
+ * Updating the index then only reads the directories modified since the
+ * previous index read them, rather than reading every directory and
+ * stat()ing every file.
+ */
+void ast_media_index_reuse(struct ast_media_index *index, struct ast_media_index *previous);
+
+/*!
+ * \brief Save the directory listings of a media index to a file
+ * \since 13.18.0
+ *
+ * \param index Media index which has been updated
+ * \param filename File to save the listings to
+ *
+ * \retval non-zero on error
+ * \return zero on success
+ */
+int ast_media_index_save(struct ast_media_index *index, const char *filename);
+
+/*!
+ * \brief Load directory listings saved by ast_media_index_save() for reuse
+ * \since 13.18.0
+ *
+ * \param index Media index to be updated
+ * \param filename File the listings were saved to
+ *
+ * Like ast_media_index_reuse(), but with the listings of an index saved,
+ * for instance, before Asterisk was last stopped.
+ *
+ * \retval non-zero on error, such as the file not existing
+ * \return zero on success
+ */
+int ast_media_index_load(struct ast_media_index *index, const char *filename);
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
@@ -197,6 +197,22 @@ int ast_update_module_list_condition(int (*modentry)(const char *module, const c
                                                      void *data, const char *condition),
                                      const char *like, void *data, const char *condition);
 
+/*!
+ * \brief Ask for the time the modules took to load.
+ * \param modentry A callback called with the name of each module and the time,
+ *        in microseconds, its load function took
+ * \param data Data passed into the callback
+ *
+ * Modules are listed in the order they were loaded, which is the order the
+ * callback is called in. Modules that have not run their load function are
+ * skipped.
+ *
+ * \return the number of modules listed
+ * \since 13.18.0
+ */
+int ast_module_list_load_times(int (*modentry)(const char *module, int64_t usec, void *data),
+                               void *data);
+
 /*!
  * \brief Check if module with the name given is loaded
  * \param name Module name, like "chan_sip.so"
@@ -76,6 +76,8 @@ enum ast_option_flags {
 	AST_OPT_FLAG_DONT_WARN = (1 << 18),
 	/*! End CDRs before the 'h' extension */
 	AST_OPT_FLAG_END_CDR_BEFORE_H_EXTEN = (1 << 19),
+	/*! There is a per-call debug setting */
+	AST_OPT_FLAG_DEBUG_CALLID = (1 << 20),
 	/*! Always fork, even if verbose or debug settings are non-zero */
 	AST_OPT_FLAG_ALWAYS_FORK = (1 << 21),
 	/*! Disable log/verbose output to remote consoles */
@@ -125,6 +127,7 @@ enum ast_option_flags {
 #define ast_opt_always_fork		ast_test_flag(&ast_options, AST_OPT_FLAG_ALWAYS_FORK)
 #define ast_opt_mute			ast_test_flag(&ast_options, AST_OPT_FLAG_MUTE)
 #define ast_opt_dbg_module		ast_test_flag(&ast_options, AST_OPT_FLAG_DEBUG_MODULE)
+#define ast_opt_dbg_callid		ast_test_flag(&ast_options, AST_OPT_FLAG_DEBUG_CALLID)
 #define ast_opt_verb_module		ast_test_flag(&ast_options, AST_OPT_FLAG_VERBOSE_MODULE)
 #define ast_opt_light_background	ast_test_flag(&ast_options, AST_OPT_FLAG_LIGHT_BACKGROUND)
 #define ast_opt_force_black_background	ast_test_flag(&ast_options, AST_OPT_FLAG_FORCE_BLACK_BACKGROUND)
@@ -198,6 +201,12 @@ extern int ast_language_is_prefix;
 
 extern unsigned int ast_option_rtpptdynamic;
 
+extern int ast_option_lockfree_taskprocessors;	/*!< Use lock-free queues for serialized taskprocessors */
+
+extern int ast_option_astdb_wal;	/*!< Use the SQLite WAL journal mode for the astdb */
+
+extern int ast_option_sound_file_cache;	/*!< Share memory mappings of sound files between streams */
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
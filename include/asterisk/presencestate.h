@@ -66,6 +66,9 @@ enum ast_presence_state ast_presence_state_val(const char *val);
  * \param subtype The output paramenter to store the subtype string in. Must be freed if returned
  * \param message The output paramenter to store the message string in. Must be freed if returned
  *
+ * \note The provider is only asked if the presentity has not reported a
+ * change of state, and is not asked again once it has answered.
+ *
  * \retval presence state value on success,
  * \retval -1 on failure.
  */
@@ -96,8 +99,8 @@ enum ast_presence_state ast_presence_state_nocache(const char *presence_provider
  * \param fmt Presence entity whose state has changed
  *
  * The new state of the entity will be sent off to any subscribers
- * of the presence state. It will also be stored in the internal event
- * cache.
+ * of the presence state, unless it is the same as the state stored for it.
+ * It will also be stored in the internal event cache.
  *
  * \retval 0 Success
  * \retval -1 Failure
@@ -117,8 +120,8 @@ int ast_presence_state_changed(enum ast_presence_state state,
  * \param presence_provider Presence entity whose state has changed
  *
  * The new state of the entity will be sent off to any subscribers
- * of the presence state. It will also be stored in the internal event
- * cache.
+ * of the presence state, unless it is the same as the state stored for it.
+ * It will also be stored in the internal event cache.
  *
  * \retval 0 Success
  * \retval -1 Failure
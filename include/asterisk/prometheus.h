@@ -0,0 +1,154 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef _ASTERISK_PROMETHEUS_H
+#define _ASTERISK_PROMETHEUS_H
+
+/*! \file
+ *
+ * \brief Metrics served to Prometheus by res_prometheus.
+ *
+ * A module keeps its metrics in its own ast_prometheus_metric structures and
+ * updates them with atomic operations, so updating a metric takes no lock and
+ * does not call into res_prometheus.  Registering a metric makes
+ * res_prometheus read it whenever its HTTP URI is scraped.
+ *
+ * \code
+ * static struct ast_prometheus_metric requests =
+ *     AST_PROMETHEUS_METRIC_INIT(AST_PROMETHEUS_COUNTER, "asterisk_example_requests_total",
+ *         "Requests handled", NULL);
+ *
+ * ast_prometheus_metric_register(&requests);
+ * ast_prometheus_metric_add(&requests, 1);
+ * ast_prometheus_metric_unregister(&requests);
+ * \endcode
+ *
+ * \since 13.18.0
+ */
+
+#include "asterisk/optional_api.h"
+#include "asterisk/linkedlists.h"
+
+/*! \brief Kinds of metric */
+enum ast_prometheus_metric_type {
+	/*! A value that only goes up */
+	AST_PROMETHEUS_COUNTER,
+	/*! A value that can go up and down */
+	AST_PROMETHEUS_GAUGE,
+	/*! Observations counted into buckets */
+	AST_PROMETHEUS_HISTOGRAM,
+};
+
+/*! \brief A metric */
+struct ast_prometheus_metric {
+	/*! Name of the metric.  Metrics with the same name must have the same type. */
+	const char *name;
+	/*! Description of the metric */
+	const char *help;
+	/*! Labels that tell metrics with the same name apart, e.g. method="INVITE", or NULL */
+	const char *labels;
+	enum ast_prometheus_metric_type type;
+	/*!
+	 * If set, called for the value of a counter or gauge whenever metrics
+	 * are read, instead of using value.
+	 */
+	int64_t (*get_value)(void);
+	/*! The value of a counter or gauge, or the sum of a histogram's observations */
+	int64_t value;
+	/*! Upper bounds of a histogram's buckets, in ascending order */
+	const int64_t *bounds;
+	/*! Observations counted in each bucket, with one more for those above every bound */
+	int64_t *buckets;
+	/*! Number of bounds */
+	unsigned int num_bounds;
+	AST_RWLIST_ENTRY(ast_prometheus_metric) entry;
+};
+
+/*! \brief Initializer for a counter or gauge */
+#define AST_PROMETHEUS_METRIC_INIT(metric_type, metric_name, metric_help, metric_labels) \
+	{ .type = (metric_type), .name = (metric_name), .help = (metric_help), .labels = (metric_labels), }
+
+/*!
+ * \brief Initializer for a histogram
+ *
+ * \param metric_bounds A static array of bucket upper bounds
+ * \param metric_buckets A static array with one more element than metric_bounds
+ */
+#define AST_PROMETHEUS_HISTOGRAM_INIT(metric_name, metric_help, metric_labels, metric_bounds, metric_buckets) \
+	{ .type = AST_PROMETHEUS_HISTOGRAM, .name = (metric_name), .help = (metric_help), \
+	  .labels = (metric_labels), .bounds = (metric_bounds), .buckets = (metric_buckets), \
+	  .num_bounds = ARRAY_LEN(metric_bounds), }
+
+/*!
+ * \brief Add to a counter or gauge
+ *
+ * \note Without atomic builtins concurrent updates may be lost.
+ */
+static force_inline void ast_prometheus_metric_add(struct ast_prometheus_metric *metric, int64_t amount)
+{
+#ifdef HAVE_GCC_ATOMICS
+	__sync_fetch_and_add(&metric->value, amount);
+#else
+	metric->value += amount;
+#endif
+}
+
+/*! \brief Set a gauge */
+static force_inline void ast_prometheus_metric_set(struct ast_prometheus_metric *metric, int64_t value)
+{
+#ifdef HAVE_GCC_ATOMICS
+	__sync_lock_test_and_set(&metric->value, value);
+#else
+	metric->value = value;
+#endif
+}
+
+/*! \brief Count an observation into a histogram */
+static force_inline void ast_prometheus_histogram_observe(struct ast_prometheus_metric *metric, int64_t value)
+{
+	unsigned int bucket = 0;
+
+	while (bucket < metric->num_bounds && value > metric->bounds[bucket]) {
+		++bucket;
+	}
+	ast_prometheus_metric_add(metric, value);
+#ifdef HAVE_GCC_ATOMICS
+	__sync_fetch_and_add(&metric->buckets[bucket], 1);
+#else
+	++metric->buckets[bucket];
+#endif
+}
+
+/*!
+ * \brief Register a metric to be served
+ *
+ * \param metric The metric.  It must stay valid until it is unregistered.
+ *
+ * \retval 0 on success
+ * \retval -1 on failure, or if res_prometheus is not loaded
+ */
+AST_OPTIONAL_API(int, ast_prometheus_metric_register,
+	(struct ast_prometheus_metric *metric), { return -1; });
+
+/*!
+ * \brief Stop serving a metric
+ *
+ * \param metric The metric
+ */
+AST_OPTIONAL_API(void, ast_prometheus_metric_unregister,
+	(struct ast_prometheus_metric *metric), {});
+
+#endif /* _ASTERISK_PROMETHEUS_H */
@@ -42,6 +42,8 @@ enum {
 	RES_ODBC_CONNECTED = (1 << 2),
 };
 
+struct odbc_cached_stmt;
+
 /*! \brief ODBC container */
 struct odbc_obj {
 	SQLHDBC  con;                   /*!< ODBC Connection Handle */
@@ -52,6 +54,10 @@ struct odbc_obj {
 	int lineno;
 #endif
 	AST_LIST_ENTRY(odbc_obj) list;
+	/*! Statements prepared on this connection, most recently used first */
+	AST_LIST_HEAD_NOLOCK(, odbc_cached_stmt) stmts;
+	/*! Number of statements in the prepared statement cache */
+	unsigned int stmt_count;
 };
 
 /*!\brief These structures are used for adaptive capabilities */
@@ -160,6 +166,77 @@ SQLHSTMT ast_odbc_direct_execute(struct odbc_obj *obj, SQLHSTMT (*exec_cb)(struc
  */
 SQLHSTMT ast_odbc_prepare_and_execute(struct odbc_obj *obj, SQLHSTMT (*prepare_cb)(struct odbc_obj *obj, void *data), void *data);
 
+/*!
+ * \brief Returns a prepared statement handle from the connection's statement cache.
+ * \since 13.18.0
+ *
+ * \param obj The ODBC object
+ * \param sql The statement to prepare
+ *
+ * If the statement has already been prepared on this connection the same
+ * handle is returned, otherwise it is prepared and remembered, up to the
+ * class's 'statement_cache' limit.  Parameters may be bound to the handle
+ * before it is executed.  The handle is owned by the connection and must be
+ * given back with ast_odbc_release_stmt() instead of being freed.
+ *
+ * This is intended to be called from the prepare_cb of
+ * ast_odbc_prepare_and_execute() and ast_odbc_async_execute().
+ *
+ * \retval a prepared statement handle
+ * \retval NULL on error
+ */
+SQLHSTMT ast_odbc_prepare_cached(struct odbc_obj *obj, const char *sql);
+
+/*!
+ * \brief Releases a statement handle.
+ * \since 13.18.0
+ *
+ * \param obj The ODBC object the statement was executed on
+ * \param stmt The statement handle
+ *
+ * Statements from ast_odbc_prepare_cached() have their cursor closed and
+ * their parameters reset so they may be executed again.  Any other statement
+ * handle is freed.
+ */
+void ast_odbc_release_stmt(struct odbc_obj *obj, SQLHSTMT stmt);
+
+/*!
+ * \brief Callback with the result of an asynchronous statement
+ *
+ * \param obj The ODBC object the statement was executed on, or NULL if no
+ *        connection to the database could be made
+ * \param stmt The executed statement handle, or NULL if it failed.  It is
+ *        released once the callback returns and must not be freed by it.
+ * \param data The data given to ast_odbc_async_execute()
+ */
+typedef void (*ast_odbc_async_cb)(struct odbc_obj *obj, SQLHSTMT stmt, void *data);
+
+/*!
+ * \brief Prepares and executes a statement on a worker thread.
+ * \since 13.18.0
+ *
+ * \param name The name of the res_odbc.conf section describing the database
+ * \param prepare_cb A function callback, which, when called, should return a
+ *        statement handle prepared, with any necessary parameters bound.
+ * \param result_cb Called with the executed statement.  May be NULL.
+ * \param data A parameter passed to both callbacks
+ *
+ * The statement is queued on the class and run by one of its asynchronous
+ * workers, which are limited by the class's 'async_workers' option.  A worker
+ * keeps its connection for as long as there are statements queued on the
+ * class, running them one after the other.  Statements queued on a class are
+ * therefore not guaranteed to run in order when it has more than one worker.
+ *
+ * Both callbacks are invoked on the worker.  On success result_cb is always
+ * invoked exactly once and is where any resources in data should be freed.
+ *
+ * \retval 0 if the statement was queued
+ * \retval -1 if the class does not exist or on allocation failure, in
+ *         which case neither callback is invoked
+ */
+int ast_odbc_async_execute(const char *name, SQLHSTMT (*prepare_cb)(struct odbc_obj *obj, void *data),
+	ast_odbc_async_cb result_cb, void *data);
+
 /*!
  * \brief Find or create an entry describing the table specified.
  * \param database Name of an ODBC class on which to query the table
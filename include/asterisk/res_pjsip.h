@@ -112,6 +112,16 @@ struct ast_sip_transport_state {
 	 * \since 13.8.0
 	 */
 	struct ast_sockaddr external_address;
+	/*!
+	 * UDP transports sharing the bind address with \ref transport
+	 * \since 13.18.0
+	 */
+	struct pjsip_transport **udp_transports;
+	/*!
+	 * Number of transports in \ref udp_transports
+	 * \since 13.18.0
+	 */
+	unsigned int udp_transport_count;
 };
 
 /*
@@ -196,6 +206,11 @@ struct ast_sip_transport {
 	int allow_reload;
 	/*! Automatically send requests out the same transport requests have come in on */
 	int symmetric_transport;
+	/*!
+	 * Number of UDP sockets sharing the bind address
+	 * \since 13.18.0
+	 */
+	unsigned int udp_sockets;
 };
 
 #define SIP_SORCERY_DOMAIN_ALIAS_TYPE "domain_alias"
@@ -402,6 +417,8 @@ struct ast_sip_auth {
 	unsigned int nonce_lifetime;
 	/*! Used to determine what to use when authenticating */
 	enum ast_sip_auth_type type;
+	/*! Precomputed MD5 of user:realm:pass for userpass auths with a realm */
+	char ha1[33];
 };
 
 AST_VECTOR(ast_sip_auth_vector, const char *);
@@ -1502,10 +1519,16 @@ struct ast_sip_endpoint *ast_sip_dialog_get_endpoint(pjsip_dialog *dlg);
  * \param serializer The serializer to which the task belongs. Can be NULL
  * \param sip_task The task to execute
  * \param task_data The parameter to pass to the task when it executes
+ * \param callsite Name the task's statistics are kept under, which must stay valid
  * \retval 0 Success
  * \retval -1 Failure
+ *
+ * \note ast_sip_push_task() names the task after its function.
  */
-int ast_sip_push_task(struct ast_taskprocessor *serializer, int (*sip_task)(void *), void *task_data);
+int __ast_sip_push_task(struct ast_taskprocessor *serializer, int (*sip_task)(void *), void *task_data,
+	const char *callsite);
+#define ast_sip_push_task(serializer, sip_task, task_data) \
+	__ast_sip_push_task((serializer), (sip_task), (task_data), #sip_task)
 
 /*!
  * \brief Push a task to SIP servants and wait for it to complete
@@ -1524,10 +1547,16 @@ int ast_sip_push_task(struct ast_taskprocessor *serializer, int (*sip_task)(void
  * \param serializer The SIP serializer to which the task belongs. May be NULL.
  * \param sip_task The task to execute
  * \param task_data The parameter to pass to the task when it executes
+ * \param callsite Name the task's statistics are kept under, which must stay valid
  * \retval 0 Success
  * \retval -1 Failure
+ *
+ * \note ast_sip_push_task_synchronous() names the task after its function.
  */
-int ast_sip_push_task_synchronous(struct ast_taskprocessor *serializer, int (*sip_task)(void *), void *task_data);
+int __ast_sip_push_task_synchronous(struct ast_taskprocessor *serializer, int (*sip_task)(void *), void *task_data,
+	const char *callsite);
+#define ast_sip_push_task_synchronous(serializer, sip_task, task_data) \
+	__ast_sip_push_task_synchronous((serializer), (sip_task), (task_data), #sip_task)
 
 /*!
  * \brief Determine if the current thread is a SIP servant thread
@@ -2856,6 +2885,15 @@ void ast_sip_modify_id_header(pj_pool_t *pool, pjsip_fromto_hdr *id_hdr,
 void ast_sip_get_unidentified_request_thresholds(unsigned int *count, unsigned int *period,
 	unsigned int *prune_interval);
 
+/*!
+ * \brief Retrieve the out-of-dialog request rate limit
+ * \since 13.18.0
+ *
+ * \return The number of out-of-dialog requests per second accepted from a
+ * single source IP address, 0 if requests are not limited
+ */
+unsigned int ast_sip_get_request_rate_limit(void);
+
 /*!
  * \brief Get the transport name from an endpoint or request uri
  * \since 13.15.0
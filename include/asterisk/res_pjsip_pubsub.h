@@ -219,6 +219,13 @@ enum ast_sip_subscription_notify_reason {
 /*! Type used for conveying mailbox state */
 #define AST_SIP_MESSAGE_ACCUMULATOR "ast_sip_message_accumulator"
 
+/*!
+ * \brief Placeholder for the version in a shared body
+ *
+ * \see ast_sip_pubsub_body_generator::body_version
+ */
+#define AST_SIP_BODY_VERSION_PLACEHOLDER "\x1eversion\x1e"
+
 /*!
  * \brief Data used to create bodies for NOTIFY/PUBLISH requests.
  */
@@ -593,6 +600,21 @@ struct ast_sip_pubsub_body_generator {
 	 */
 	void (*destroy_body)(void *body);
 	AST_LIST_ENTRY(ast_sip_pubsub_body_generator) list;
+	/*!
+	 * \brief Get the version to place into the next body for a subscription
+	 *
+	 * Optional. Bodies generated from \ref AST_SIP_EXTEN_STATE_DATA are
+	 * shared between subscriptions to the same resource in the same state.
+	 * Body generators that number their bodies write
+	 * \ref AST_SIP_BODY_VERSION_PLACEHOLDER in place of the version, and this
+	 * is called to fill it in for each subscription the body is sent to.
+	 *
+	 * \param sub The subscription the body is sent to
+	 * \param[out] version The version to place into the body
+	 * \retval 0 Success
+	 * \retval non-zero Failure
+	 */
+	int (*body_version)(struct ast_sip_subscription *sub, unsigned int *version);
 };
 
 /*!
@@ -114,6 +114,8 @@ enum ast_rtp_property {
 	AST_RTP_PROPERTY_STUN,
 	/*! Enable RTCP support */
 	AST_RTP_PROPERTY_RTCP,
+	/*! Give RFC2833 DTMF received while locally bridged to the core instead of relaying it */
+	AST_RTP_PROPERTY_LOCAL_BRIDGE_DTMF,
 
 	/*!
 	 * \brief Maximum number of RTP properties supported
@@ -573,6 +575,8 @@ struct ast_rtp_engine {
 	struct ast_frame *(*read)(struct ast_rtp_instance *instance, int rtcp);
 	/*! Callback to locally bridge two RTP instances */
 	int (*local_bridge)(struct ast_rtp_instance *instance0, struct ast_rtp_instance *instance1);
+	/*! Callback to find out if the engine reads the packets of a locally bridged instance itself */
+	int (*local_bridge_reads)(struct ast_rtp_instance *instance);
 	/*! Callback to set the read format */
 	int (*set_read_format)(struct ast_rtp_instance *instance, struct ast_format *format);
 	/*! Callback to set the write format */
@@ -1805,6 +1809,20 @@ struct ast_rtp_instance *ast_rtp_instance_get_bridged(struct ast_rtp_instance *i
  */
 void ast_rtp_instance_set_bridged(struct ast_rtp_instance *instance, struct ast_rtp_instance *bridged);
 
+/*!
+ * \brief Find out if the RTP engine reads the packets of a locally bridged instance itself
+ * \since 13.18.0
+ *
+ * \param instance The RTP instance, locally bridged through the local_bridge callback
+ *
+ * \retval 1 The engine reads and relays the packets received on the RTP file
+ *         descriptor, and queues any frames for the core on the channel.
+ *         The channel does not need to poll ast_rtp_instance_fd(instance, 0)
+ *         until the local bridge is stopped.
+ * \retval 0 The channel must keep reading the instance.
+ */
+int ast_rtp_instance_local_bridge_reads(struct ast_rtp_instance *instance);
+
 /*!
  * \brief Make two channels compatible for early bridging
  *
@@ -2349,6 +2367,120 @@ time_t ast_rtp_instance_get_last_rx(const struct ast_rtp_instance *rtp);
  */
 void ast_rtp_instance_set_last_rx(struct ast_rtp_instance *rtp, time_t time);
 
+/*!
+ * \brief One direction of RTP relayed between two locally bridged instances
+ * \since 13.18.0
+ *
+ * Each relayed packet has its payload type mapped, its SSRC replaced and
+ * the offsets added to its sequence number and timestamp, then it is sent
+ * to the destination.  Anything else received on the socket, including
+ * packets from other addresses and with other payload types, must be left
+ * for the RTP engine to read.
+ */
+struct ast_rtp_relay {
+	/*! Socket the packets are received on */
+	int in_fd;
+	/*! Socket the packets are sent from */
+	int out_fd;
+	/*! Address the packets are received from */
+	struct ast_sockaddr source;
+	/*! Address the packets are sent to */
+	struct ast_sockaddr destination;
+	/*! SSRC of the packets as received */
+	unsigned int in_ssrc;
+	/*! SSRC written into the packets */
+	unsigned int out_ssrc;
+	/*! Added to the sequence number of each packet */
+	unsigned short seqno_offset;
+	/*! Added to the timestamp of each packet */
+	unsigned int timestamp_offset;
+	/*! Payload type sent for each received payload type, -1 if it is not relayed */
+	int payload_map[AST_RTP_MAX_PT];
+};
+
+/*!
+ * \brief A relay engine, which moves packets between sockets without the
+ * RTP engine reading them, for example in the kernel
+ * \since 13.18.0
+ */
+struct ast_rtp_relay_engine {
+	/*! Name of the relay engine */
+	const char *name;
+	/*! Module this relay engine came from */
+	struct ast_module *mod;
+	/*!
+	 * \brief Start relaying packets
+	 *
+	 * \return Private data of the relay, or NULL if this engine can not
+	 * relay these packets
+	 */
+	void *(*start)(const struct ast_rtp_relay *relay);
+	/*!
+	 * \brief Stop relaying packets
+	 *
+	 * \param pvt Private data returned by start
+	 * \param[out] packets Number of packets relayed
+	 * \param[out] octets Number of payload octets relayed
+	 */
+	void (*stop)(void *pvt, unsigned int *packets, unsigned int *octets);
+	/*! Linked list information */
+	AST_RWLIST_ENTRY(ast_rtp_relay_engine) entry;
+};
+
+/*! \brief A relay that has been handed to a relay engine */
+struct ast_rtp_relay_offload;
+
+#define ast_rtp_relay_engine_register(engine) ast_rtp_relay_engine_register2(engine, ast_module_info->self)
+
+/*!
+ * \brief Register a relay engine
+ * \since 13.18.0
+ *
+ * \param engine The relay engine to register
+ * \param module Module that the relay engine is part of
+ *
+ * \retval 0 success
+ * \retval -1 failure
+ */
+int ast_rtp_relay_engine_register2(struct ast_rtp_relay_engine *engine, struct ast_module *module);
+
+/*!
+ * \brief Unregister a relay engine
+ * \since 13.18.0
+ *
+ * \note Relays already started keep a reference to the module that the
+ * relay engine is part of until they are stopped.
+ *
+ * \retval 0 success
+ * \retval -1 failure
+ */
+int ast_rtp_relay_engine_unregister(struct ast_rtp_relay_engine *engine);
+
+/*!
+ * \brief Hand a relay to the first relay engine that accepts it
+ * \since 13.18.0
+ *
+ * \note This is for use by RTP engines.
+ *
+ * \return The started relay, an ao2 object, or NULL if no relay engine
+ * accepted it
+ */
+struct ast_rtp_relay_offload *ast_rtp_relay_offload_start(const struct ast_rtp_relay *relay);
+
+/*!
+ * \brief Stop a relay
+ * \since 13.18.0
+ *
+ * Once this returns, packets arrive on the relay's socket again.  Stopping
+ * a relay that has already stopped does nothing.
+ *
+ * \param offload The relay
+ * \param[out] packets If not NULL, the number of packets relayed
+ * \param[out] octets If not NULL, the number of payload octets relayed
+ */
+void ast_rtp_relay_offload_stop(struct ast_rtp_relay_offload *offload,
+	unsigned int *packets, unsigned int *octets);
+
 /*! \addtogroup StasisTopicsAndMessages
  * @{
  */
@@ -152,6 +152,33 @@ extern "C" {
  */
 struct ast_sched_context *ast_sched_context_create(void);
 
+/*!
+ * \brief How a scheduler context keeps its scheduled entries
+ * \since 13.18.0
+ */
+enum ast_sched_type {
+	/*! Binary heap, O(log n) add and delete.  The default. */
+	AST_SCHED_TYPE_HEAP = 0,
+	/*!
+	 * Hierarchical timing wheel with millisecond ticks, O(1) add and
+	 * delete.  Suited to contexts holding very many entries that are
+	 * constantly rescheduled, such as retransmission timers.
+	 */
+	AST_SCHED_TYPE_WHEEL,
+};
+
+/*!
+ * \brief Create a scheduler context using a specific queue type
+ * \since 13.18.0
+ *
+ * \param type How the context keeps its scheduled entries
+ *
+ * \note The type has no effect on the rest of the scheduler API.
+ *
+ * \return Returns a malloc'd sched_context structure, NULL on failure
+ */
+struct ast_sched_context *ast_sched_context_create_type(enum ast_sched_type type);
+
 /*!
  * \brief destroys a schedule context
  *
@@ -0,0 +1,114 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Signed linear buffer mixing primitives
+ *
+ * These are the buffer-at-a-time equivalents of
+ * ast_slinear_saturated_add(), ast_slinear_saturated_subtract(),
+ * ast_slinear_saturated_multiply() and ast_slinear_saturated_divide().
+ * The results are guaranteed to be bit for bit identical to applying the
+ * per-sample helpers in a loop, but on platforms that support it the work
+ * is done using SIMD instructions selected at runtime.
+ */
+
+#ifndef _ASTERISK_SLINMIX_H
+#define _ASTERISK_SLINMIX_H
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/*!
+ * \brief Saturating add of one signed linear buffer into another
+ * \since 13.18.0
+ *
+ * \param dst Buffer to accumulate into
+ * \param src Buffer to add to dst
+ * \param samples Number of samples in each buffer
+ */
+void ast_slinear_saturated_add_buf(int16_t *dst, const int16_t *src, size_t samples);
+
+/*!
+ * \brief Saturating subtract of one signed linear buffer from another
+ * \since 13.18.0
+ *
+ * \param dst Buffer to subtract from
+ * \param src Buffer to subtract out of dst
+ * \param samples Number of samples in each buffer
+ */
+void ast_slinear_saturated_subtract_buf(int16_t *dst, const int16_t *src, size_t samples);
+
+/*!
+ * \brief Saturating multiply of a signed linear buffer by a constant
+ * \since 13.18.0
+ *
+ * \param buf Buffer to multiply in place
+ * \param value Value to multiply each sample by
+ * \param samples Number of samples in the buffer
+ */
+void ast_slinear_saturated_multiply_buf(int16_t *buf, int16_t value, size_t samples);
+
+/*!
+ * \brief Divide a signed linear buffer by a constant
+ * \since 13.18.0
+ *
+ * \param buf Buffer to divide in place
+ * \param value Value to divide each sample by (must not be 0)
+ * \param samples Number of samples in the buffer
+ */
+void ast_slinear_saturated_divide_buf(int16_t *buf, int16_t value, size_t samples);
+
+/*!
+ * \brief Apply a frame style volume adjustment to a signed linear buffer
+ * \since 13.18.0
+ *
+ * \param buf Buffer to adjust in place
+ * \param adjustment Positive values multiply, negative values divide
+ * by the absolute value, and 0 leaves the buffer untouched.
+ * \param samples Number of samples in the buffer
+ */
+void ast_slinear_adjust_volume_buf(int16_t *buf, int adjustment, size_t samples);
+
+/*!
+ * \brief Get the name of the mixing backend in use
+ * \since 13.18.0
+ *
+ * \return "scalar", "sse2", "avx2" or "neon"
+ */
+const char *ast_slinmix_backend(void);
+
+/*!
+ * \brief Select a specific mixing backend
+ * \since 13.18.0
+ *
+ * \param name Name of the backend as returned by ast_slinmix_backend(),
+ * or NULL to select the best one the CPU supports.
+ *
+ * \note This exists so that unit tests can compare every backend against
+ * the scalar implementation.  It is not safe to call while audio is
+ * being mixed.
+ *
+ * \retval 0 on success
+ * \retval -1 if the backend is unknown or not supported by this CPU
+ */
+int ast_slinmix_set_backend(const char *name);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _ASTERISK_SLINMIX_H */
@@ -312,6 +312,28 @@ struct ast_sorcery_wizard {
 
 	/*! \brief Callback for closing a wizard */
 	void (*close)(void *data);
+
+	/*!
+	 * \brief Optional callback for a caching wizard to tell if it knows an object does not exist
+	 * \since 13.18.0
+	 *
+	 * \retval non-zero if no wizard needs to be asked for the object
+	 */
+	int (*is_missing_id)(const struct ast_sorcery *sorcery, void *data, const char *type, const char *id);
+
+	/*!
+	 * \brief Optional callback telling a caching wizard that no wizard has an object
+	 * \since 13.18.0
+	 */
+	void (*missing_id)(const struct ast_sorcery *sorcery, void *data, const char *type, const char *id);
+
+	/*!
+	 * \brief Optional callback for determining if an object is stale
+	 * \since 13.18.0
+	 *
+	 * \retval non-zero if the object is stale
+	 */
+	int (*is_stale)(const struct ast_sorcery *sorcery, void *data, void *object);
 };
 
 /*! \brief Interface for a sorcery object type observer */
@@ -845,6 +867,76 @@ int __ast_sorcery_object_field_register(struct ast_sorcery *sorcery, const char
 #define ast_sorcery_object_field_register_custom_alias(sorcery, type, name, default_val, config_handler, sorcery_handler, multiple_handler, flags, ...) \
     __ast_sorcery_object_field_register(sorcery, type, name, default_val, OPT_CUSTOM_T, config_handler, sorcery_handler, multiple_handler, flags, 1, 1, VA_NARGS(__VA_ARGS__), __VA_ARGS__);
 
+/*!
+ * \brief Index the objects of a type by a field
+ * \since 13.18.0
+ *
+ * Wizards that keep their objects in memory keep an index of them by the
+ * value of the field, so retrieving by fields that include an exact value
+ * for it does not have to look at every object.
+ *
+ * \param sorcery Pointer to a sorcery structure
+ * \param type Type of object
+ * \param name Name of a registered field
+ *
+ * \note This must be called before the objects of the type are loaded.
+ *
+ * \retval 0 success
+ * \retval -1 failure
+ */
+int ast_sorcery_object_field_index(struct ast_sorcery *sorcery, const char *type, const char *name);
+
+/*! \brief Opaque index of objects by their indexed fields, kept by a wizard */
+struct ast_sorcery_index;
+
+/*!
+ * \brief Allocate an index for the objects of a type
+ * \since 13.18.0
+ *
+ * \param sorcery Pointer to a sorcery structure
+ * \param type Type of object
+ *
+ * \retval non-NULL an ao2 index
+ * \retval NULL if no field of the type is indexed, or on failure
+ */
+struct ast_sorcery_index *ast_sorcery_index_alloc(const struct ast_sorcery *sorcery, const char *type);
+
+/*!
+ * \brief Add an object to an index
+ * \since 13.18.0
+ *
+ * \param index The index
+ * \param obj The ao2 object to index, which need not be the sorcery object itself
+ * \param objectset The objectset of the sorcery object
+ *
+ * \retval 0 success
+ * \retval -1 failure
+ */
+int ast_sorcery_index_link(struct ast_sorcery_index *index, void *obj, const struct ast_variable *objectset);
+
+/*!
+ * \brief Remove an object from an index
+ * \since 13.18.0
+ *
+ * \param index The index
+ * \param obj The indexed ao2 object
+ * \param objectset The objectset of the sorcery object when it was indexed
+ */
+void ast_sorcery_index_unlink(struct ast_sorcery_index *index, void *obj, const struct ast_variable *objectset);
+
+/*!
+ * \brief Find the objects in an index that may match fields
+ * \since 13.18.0
+ *
+ * \param index The index
+ * \param fields Fields being retrieved by
+ *
+ * \retval non-NULL a container of the indexed objects with the value of an
+ * indexed field in the fields.  They still have to be compared with all the fields.
+ * \retval NULL if the index can not narrow the search, every object has to be compared
+ */
+struct ao2_container *ast_sorcery_index_find(struct ast_sorcery_index *index, const struct ast_variable *fields);
+
 /*!
  * \brief Register a field within an object with custom handlers without documentation
  *
@@ -1217,6 +1309,25 @@ void *ast_sorcery_retrieve_by_fields(const struct ast_sorcery *sorcery, const ch
  */
 struct ao2_container *ast_sorcery_retrieve_by_regex(const struct ast_sorcery *sorcery, const char *type, const char *regex);
 
+/*!
+ * \brief Warm the caches of an object type with the objects matching fields
+ * \since 13.18.0
+ *
+ * \param sorcery Pointer to a sorcery structure
+ * \param type Type of object to prefetch
+ * \param fields Optional object fields and values to match against, NULL for all objects
+ *
+ * The objects are retrieved from the backend in a single multiple object
+ * retrieval and created in every caching wizard, so later retrievals by id
+ * of the objects are answered by the caches instead of one backend query each.
+ * A caching wizard that keeps the full backend itself is left to populate
+ * itself.
+ *
+ * \retval -1 if the type has no caching wizard or the objects could not be retrieved
+ * \retval The number of objects retrieved
+ */
+int ast_sorcery_prefetch(const struct ast_sorcery *sorcery, const char *type, const struct ast_variable *fields);
+
 /*!
  * \brief Update an object
  *
@@ -1239,6 +1350,20 @@ int ast_sorcery_update(const struct ast_sorcery *sorcery, void *object);
  */
 int ast_sorcery_delete(const struct ast_sorcery *sorcery, void *object);
 
+/*!
+ * \brief Determine if a sorcery object is stale with respect to its backing datastore
+ * \since 13.18.0
+ *
+ * \param sorcery Pointer to a sorcery structure
+ * \param object Pointer to a sorcery object
+ *
+ * Wizards without an is_stale callback never consider an object stale.
+ *
+ * \retval 0 the object is not stale
+ * \retval 1 the object is stale
+ */
+int ast_sorcery_is_stale(const struct ast_sorcery *sorcery, void *object);
+
 /*!
  * \brief Decrease the reference count of a sorcery structure
  *
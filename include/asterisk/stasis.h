@@ -320,6 +320,18 @@ enum stasis_message_type_result stasis_message_type_create(const char *name,
  */
 const char *stasis_message_type_name(const struct stasis_message_type *type);
 
+/*!
+ * \brief Gets the unique identifier of a given message type
+ * \since 13.18.0
+ *
+ * Identifiers are small integers handed out in the order the message
+ * types are created, and are used to index subscription message filters.
+ *
+ * \param type The type to get.
+ * \return Identifier of the type.
+ */
+int stasis_message_type_id(const struct stasis_message_type *type);
+
 /*!
  * \brief Check whether a message type is declined
  *
@@ -614,6 +626,66 @@ struct stasis_subscription *stasis_unsubscribe(
 int stasis_subscription_set_congestion_limits(struct stasis_subscription *subscription,
 	long low_water, long high_water);
 
+/*!
+ * \brief Stasis subscription message filters
+ * \since 13.18.0
+ */
+enum stasis_subscription_message_filter {
+	/*! No filter is in place, all messages are delivered */
+	STASIS_SUBSCRIPTION_FILTER_NONE = 0,
+	/*! No filter is in place or can be set, all messages are delivered */
+	STASIS_SUBSCRIPTION_FILTER_FORCED_NONE,
+	/*! Only messages of accepted message types are delivered */
+	STASIS_SUBSCRIPTION_FILTER_SELECTIVE,
+};
+
+/*!
+ * \brief Add a message type that a subscription will accept.
+ * \since 13.18.0
+ *
+ * Messages of types the subscription has not accepted are dropped by the
+ * topic before they are queued to the subscription, once the filter has
+ * been set to \ref STASIS_SUBSCRIPTION_FILTER_SELECTIVE.  Subscription
+ * change messages, including the final message, are always delivered.
+ *
+ * \param subscription Subscription to add the message type to.
+ * \param type The message type we wish to accept.
+ *
+ * \retval 0 on success
+ * \retval -1 failure
+ */
+int stasis_subscription_accept_message_type(struct stasis_subscription *subscription,
+	const struct stasis_message_type *type);
+
+/*!
+ * \brief Indicate that a message type is no longer accepted by a subscription.
+ * \since 13.18.0
+ *
+ * \param subscription Subscription to remove the message type from.
+ * \param type The message type we no longer wish to accept.
+ *
+ * \retval 0 on success
+ * \retval -1 failure
+ */
+int stasis_subscription_decline_message_type(struct stasis_subscription *subscription,
+	const struct stasis_message_type *type);
+
+/*!
+ * \brief Set the message type filtering level on a subscription.
+ * \since 13.18.0
+ *
+ * \param subscription Subscription to set the filter on.
+ * \param filter What filter to use.
+ *
+ * \note Once the filter is \ref STASIS_SUBSCRIPTION_FILTER_FORCED_NONE it
+ * cannot be changed.
+ *
+ * \retval 0 on success
+ * \retval -1 failure
+ */
+int stasis_subscription_set_filter(struct stasis_subscription *subscription,
+	enum stasis_subscription_message_filter filter);
+
 /*!
  * \brief Block until the last message is processed on a subscription.
  *
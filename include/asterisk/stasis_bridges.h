@@ -264,6 +264,23 @@ void ast_bridge_publish_leave(struct ast_bridge *bridge, struct ast_channel *cha
 struct ast_json *ast_bridge_snapshot_to_json(const struct ast_bridge_snapshot *snapshot,
 	const struct stasis_message_sanitizer *sanitize);
 
+/*!
+ * \brief Encode a \ref ast_bridge_snapshot as JSON, without building a JSON tree.
+ * \since 13.18.0
+ *
+ * Writes the same object ast_bridge_snapshot_to_json() builds. If the
+ * snapshot is \c NULL, a JSON null is written.
+ *
+ * \param snapshot The bridge snapshot to encode
+ * \param sanitize The message sanitizer to use on the snapshot
+ * \param writer Streaming JSON encoder to write to
+ *
+ * \retval 0 on success
+ * \retval -1 on error
+ */
+int ast_bridge_snapshot_write_json(const struct ast_bridge_snapshot *snapshot,
+	const struct stasis_message_sanitizer *sanitize, struct ast_json_writer *writer);
+
 /*!
  * \brief Pair showing a bridge snapshot and a specific channel snapshot belonging to the bridge
  */
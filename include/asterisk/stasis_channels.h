@@ -34,33 +34,37 @@
  *
  * While not enforced programmatically, this object is shared across multiple
  * threads, and should be treated as an immutable object.
+ *
+ * The strings are grouped into segments that are only copied from the
+ * channel when one of their values has changed since the last snapshot
+ * of the channel.  Unchanged segments are shared with the previous
+ * snapshot, so two snapshots of the same channel may point at the same
+ * string.
  */
 struct ast_channel_snapshot {
-	AST_DECLARE_STRING_FIELDS(
-		AST_STRING_FIELD(name);             /*!< ASCII unique channel name */
-		AST_STRING_FIELD(uniqueid);         /*!< Unique Channel Identifier */
-		AST_STRING_FIELD(linkedid);         /*!< Linked Channel Identifier -- gets propagated by linkage */
-		AST_STRING_FIELD(appl);             /*!< Current application */
-		AST_STRING_FIELD(data);             /*!< Data passed to current application */
-		AST_STRING_FIELD(context);          /*!< Dialplan: Current extension context */
-		AST_STRING_FIELD(exten);            /*!< Dialplan: Current extension number */
-		AST_STRING_FIELD(accountcode);      /*!< Account code for billing */
-		AST_STRING_FIELD(peeraccount);      /*!< Peer account code for billing */
-		AST_STRING_FIELD(userfield);        /*!< Userfield for CEL billing */
-		AST_STRING_FIELD(hangupsource);     /*!< Who is responsible for hanging up this channel */
-		AST_STRING_FIELD(caller_name);      /*!< Caller ID Name */
-		AST_STRING_FIELD(caller_number);    /*!< Caller ID Number */
-		AST_STRING_FIELD(caller_dnid);      /*!< Dialed ID Number */
-		AST_STRING_FIELD(caller_ani);       /*!< Caller ID ANI Number */
-		AST_STRING_FIELD(caller_rdnis);     /*!< Caller ID RDNIS Number */
-		AST_STRING_FIELD(caller_subaddr);   /*!< Caller subaddress */
-		AST_STRING_FIELD(dialed_subaddr);   /*!< Dialed subaddress */
-		AST_STRING_FIELD(connected_name);   /*!< Connected Line Name */
-		AST_STRING_FIELD(connected_number); /*!< Connected Line Number */
-		AST_STRING_FIELD(language);         /*!< The default spoken language for the channel */
-		AST_STRING_FIELD(bridgeid);         /*!< Unique Bridge Identifier */
-		AST_STRING_FIELD(type);             /*!< Type of channel technology */
-	);
+	const char *name;                       /*!< ASCII unique channel name */
+	const char *uniqueid;                   /*!< Unique Channel Identifier */
+	const char *linkedid;                   /*!< Linked Channel Identifier -- gets propagated by linkage */
+	const char *appl;                       /*!< Current application */
+	const char *data;                       /*!< Data passed to current application */
+	const char *context;                    /*!< Dialplan: Current extension context */
+	const char *exten;                      /*!< Dialplan: Current extension number */
+	const char *accountcode;                /*!< Account code for billing */
+	const char *peeraccount;                /*!< Peer account code for billing */
+	const char *userfield;                  /*!< Userfield for CEL billing */
+	const char *hangupsource;               /*!< Who is responsible for hanging up this channel */
+	const char *caller_name;                /*!< Caller ID Name */
+	const char *caller_number;              /*!< Caller ID Number */
+	const char *caller_dnid;                /*!< Dialed ID Number */
+	const char *caller_ani;                 /*!< Caller ID ANI Number */
+	const char *caller_rdnis;               /*!< Caller ID RDNIS Number */
+	const char *caller_subaddr;             /*!< Caller subaddress */
+	const char *dialed_subaddr;             /*!< Dialed subaddress */
+	const char *connected_name;             /*!< Connected Line Name */
+	const char *connected_number;           /*!< Connected Line Number */
+	const char *language;                   /*!< The default spoken language for the channel */
+	const char *bridgeid;                   /*!< Unique Bridge Identifier */
+	const char *type;                       /*!< Type of channel technology */
 
 	struct timeval creationtime;            /*!< The time of channel creation */
 	enum ast_channel_state state;           /*!< State of line */
@@ -95,6 +99,17 @@ struct ast_multi_channel_blob;
 
 struct stasis_cp_all *ast_channel_cache_all(void);
 
+/*!
+ * \since 13.18.0
+ * \brief Topics shared by the channels that have no topic of their own yet.
+ *
+ * They are forwarded to ast_channel_topic_all() and cache into
+ * ast_channel_cache() just like the topics of a single channel.
+ *
+ * \see ast_channel_topic_for_publish()
+ */
+struct stasis_cp_single *ast_channel_topics_shared(void);
+
 /*!
  * \since 12
  * \brief A topic which publishes the events for all channels.
@@ -581,6 +596,23 @@ void ast_publish_channel_state(struct ast_channel *chan);
 struct ast_json *ast_channel_snapshot_to_json(const struct ast_channel_snapshot *snapshot,
 	const struct stasis_message_sanitizer *sanitize);
 
+/*!
+ * \brief Encode a \ref ast_channel_snapshot as JSON, without building a JSON tree.
+ * \since 13.18.0
+ *
+ * Writes the same object ast_channel_snapshot_to_json() builds. If the
+ * snapshot is \c NULL or rejected by \a sanitize, a JSON null is written.
+ *
+ * \param snapshot The snapshot to encode
+ * \param sanitize The message sanitizer to use on the snapshot
+ * \param writer Streaming JSON encoder to write to
+ *
+ * \retval 0 on success
+ * \retval -1 on error
+ */
+int ast_channel_snapshot_write_json(const struct ast_channel_snapshot *snapshot,
+	const struct stasis_message_sanitizer *sanitize, struct ast_json_writer *writer);
+
 /*!
  * \brief Compares the context, exten and priority of two snapshots.
  * \since 12
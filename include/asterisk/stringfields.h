@@ -226,8 +226,9 @@ AST_VECTOR(ast_string_field_vector, const char **);
   \since 13.9.0
 */
 struct ast_string_field_header {
-	struct ast_string_field_pool *embedded_pool;	/*!< pointer to the embedded pool, if any */
+	struct ast_string_field_pool *embedded_pool;	/*!< pointer to the first pool, allocated along with the header */
 	struct ast_string_field_vector string_fields;	/*!< field vector for compare and copy */
+	int in_structure;				/*!< nonzero if the header is part of the structure's allocation */
 };
 
 /*!
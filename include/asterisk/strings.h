@@ -606,6 +606,25 @@ struct ast_str {
  */
 int ast_regex_string_to_regex_pattern(const char *regex_string, struct ast_str **regex_pattern);
 
+/*!
+ * \brief Get the literal prefix of every string an extended regex matches
+ *
+ * Only a regex anchored with '^' has a prefix, made of the literal
+ * characters up to the first token that is not one.  A literal followed by
+ * a '?', '*' or '{' quantifier is not part of the prefix, and a regex with
+ * an alternation has no prefix.  The prefix lets the strings that cannot
+ * match be skipped, or a sorted container be searched for the range of
+ * strings that can, before the regex is executed on them.
+ *
+ * \param regex Extended regular expression
+ * \param prefix Buffer of at least strlen(regex) + 1 characters filled
+ *        with the prefix, empty if there is none
+ *
+ * etval 0 on success
+ * etval -1 if the regex is invalid because it ends with a backslash
+ */
+int ast_regex_literal_prefix(const char *regex, char *prefix);
+
 /*!
  * \brief Create a malloc'ed dynamic length string
  *
@@ -926,6 +945,46 @@ struct ast_str *__ast_str_thread_get(struct ast_threadstorage *ts,
 #define ast_str_thread_get(ts, init_len) __ast_str_thread_get(ts, init_len, __FILE__, __PRETTY_FUNCTION__, __LINE__)
 #endif /* defined(DEBUG_THREADLOCALS) */
 
+/*!
+ * \brief Get a scratch dynamic string of the calling thread
+ *
+ * \param init_len Space the string should have to start with
+ *
+ * Each thread has a few dynamic strings kept between uses, handed out
+ * empty, the one closest in size to init_len first.  They spare code
+ * building a string only for the duration of a call the cost of allocating
+ * and freeing it.  Once all are in use an ordinary string is returned.
+ *
+ * The string must be given back with ast_str_scratch_release() instead of
+ * being freed, and must not be passed to another thread.  Strings still
+ * handed out when a taskprocessor task returns are taken back then.
+ *
+ * \return The string, NULL on allocation failure
+ */
+struct ast_str *ast_str_scratch_get(size_t init_len);
+
+/*!
+ * \brief Give back a string from ast_str_scratch_get()
+ *
+ * \param buf The string, may be NULL.  Usable as a RAII_VAR destructor.
+ */
+void ast_str_scratch_release(struct ast_str *buf);
+
+/*!
+ * \brief Note which scratch strings the calling thread has handed out
+ *
+ * \return Mark to pass to ast_str_scratch_reclaim()
+ */
+unsigned int ast_str_scratch_mark(void);
+
+/*!
+ * \brief Take back the scratch strings handed out since a mark
+ *
+ * Used when a unit of work, such as a taskprocessor task, is done.  Any of
+ * those strings still held must no longer be used.
+ */
+void ast_str_scratch_reclaim(unsigned int mark);
+
 /*!
  * \brief Error codes from __ast_str_helper()
  * The undelying processing to manipulate dynamic string is done
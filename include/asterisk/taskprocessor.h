@@ -151,6 +151,22 @@ void *ast_taskprocessor_listener_get_user_data(const struct ast_taskprocessor_li
  */
 struct ast_taskprocessor_listener *ast_taskprocessor_listener_alloc(const struct ast_taskprocessor_listener_callbacks *callbacks, void *user_data);
 
+/*!
+ * \brief Indicate that a listener never executes more than one task at a time
+ * \since 13.18.0
+ *
+ * A taskprocessor whose listener only ever has one thread at a time calling
+ * ast_taskprocessor_execute() may use a lock-free multi-producer single-consumer
+ * queue instead of locking the taskprocessor for every push and pop.  The
+ * lock-free queue is used when this has been called and the
+ * lockfree_taskprocessors option is enabled in asterisk.conf.
+ *
+ * \param listener The taskprocessor listener
+ *
+ * \note This must be called before the listener is used to create a taskprocessor.
+ */
+void ast_taskprocessor_listener_set_serialized(struct ast_taskprocessor_listener *listener);
+
 /*!
  * \brief Get a reference to a taskprocessor with the specified name and create the taskprocessor if necessary
  *
@@ -209,11 +225,17 @@ void *ast_taskprocessor_unreference(struct ast_taskprocessor *tps);
  * \param tps The taskprocessor structure
  * \param task_exe The task handling function to push into the taskprocessor queue
  * \param datap The data to be used by the task handling function
+ * \param callsite Name the task's statistics are kept under, which must stay valid
  * \retval 0 success
  * \retval -1 failure
  * \since 1.6.1
+ *
+ * \note ast_taskprocessor_push() names the task after its handling function.
  */
-int ast_taskprocessor_push(struct ast_taskprocessor *tps, int (*task_exe)(void *datap), void *datap);
+int __ast_taskprocessor_push(struct ast_taskprocessor *tps, int (*task_exe)(void *datap), void *datap,
+	const char *callsite);
+#define ast_taskprocessor_push(tps, task_exe, datap) \
+	__ast_taskprocessor_push((tps), (task_exe), (datap), #task_exe)
 
 /*! \brief Local data parameter */
 struct ast_taskprocessor_local {
@@ -234,12 +256,17 @@ struct ast_taskprocessor_local {
  * \param tps The taskprocessor structure
  * \param task_exe The task handling function to push into the taskprocessor queue
  * \param datap The data to be used by the task handling function
+ * \param callsite Name the task's statistics are kept under, which must stay valid
  * \retval 0 success
  * \retval -1 failure
  * \since 12.0.0
+ *
+ * \note ast_taskprocessor_push_local() names the task after its handling function.
  */
-int ast_taskprocessor_push_local(struct ast_taskprocessor *tps,
-	int (*task_exe)(struct ast_taskprocessor_local *local), void *datap);
+int __ast_taskprocessor_push_local(struct ast_taskprocessor *tps,
+	int (*task_exe)(struct ast_taskprocessor_local *local), void *datap, const char *callsite);
+#define ast_taskprocessor_push_local(tps, task_exe, datap) \
+	__ast_taskprocessor_push_local((tps), (task_exe), (datap), #task_exe)
 
 /*!
  * \brief Indicate the taskprocessor is suspended.
@@ -284,6 +311,27 @@ int ast_taskprocessor_is_suspended(struct ast_taskprocessor *tps);
  */
 int ast_taskprocessor_execute(struct ast_taskprocessor *tps);
 
+/*!
+ * \brief Pop a batch of tasks off the taskprocessor and execute them.
+ * \since 13.18.0
+ *
+ * This behaves like calling ast_taskprocessor_execute() repeatedly but the
+ * tasks are removed from the queue with a single lock and the statistics and
+ * listener emptied callback are only updated once for the whole batch.
+ *
+ * \param tps The taskprocessor from which to execute.
+ * \param max_tasks Maximum number of tasks to execute, 0 for no limit.
+ * \param max_usec Stop executing once this many microseconds have passed,
+ * 0 for no limit.  At least one task is always executed if one is queued.
+ *
+ * \note Tasks removed from the queue but not executed because of the time
+ * limit are put back at the front of the queue.
+ *
+ * \retval 0 There is no further work to be done.
+ * \retval 1 Tasks still remain in the taskprocessor queue.
+ */
+int ast_taskprocessor_execute_batch(struct ast_taskprocessor *tps, unsigned int max_tasks, unsigned int max_usec);
+
 /*!
  * \brief Am I the given taskprocessor's current task.
  * \since 12.7.0
@@ -330,6 +378,75 @@ const char *ast_taskprocessor_name(struct ast_taskprocessor *tps);
  */
 long ast_taskprocessor_size(struct ast_taskprocessor *tps);
 
+/*!
+ * \brief Count the taskprocessors and the tasks queued on them
+ * \since 13.18.0
+ *
+ * \param[out] count Number of taskprocessors
+ * \param[out] queued Number of tasks queued on all taskprocessors
+ * \param[out] max_queued Number of tasks queued on the taskprocessor with the most
+ */
+void ast_taskprocessor_totals(unsigned long *count, unsigned long *queued, long *max_queued);
+
+/*!
+ * \brief Number of buckets in the task time histograms
+ *
+ * Bucket 0 counts tasks taking less than a microsecond and bucket n those
+ * taking less than 2^n microseconds, but at least 2^(n-1).  The last bucket
+ * also counts everything longer.
+ */
+#define AST_TASKPROCESSOR_TIME_BUCKETS 24
+
+/*! \brief How long tasks waited to start and took to execute */
+struct ast_taskprocessor_times {
+	/*! Number of tasks */
+	uint64_t count;
+	/*! Total microseconds from being pushed until starting to execute */
+	uint64_t wait_us;
+	/*! Total microseconds spent executing */
+	uint64_t exec_us;
+	/*! Longest a task took to execute */
+	uint64_t max_exec_us;
+	/*! Tasks counted by how long they waited */
+	uint64_t wait_buckets[AST_TASKPROCESSOR_TIME_BUCKETS];
+	/*! Tasks counted by how long they took to execute */
+	uint64_t exec_buckets[AST_TASKPROCESSOR_TIME_BUCKETS];
+};
+
+/*!
+ * \brief Sum how long the tasks of all taskprocessors waited and executed for
+ * \since 13.18.0
+ *
+ * \param[out] times The totals since each taskprocessor was created
+ */
+void ast_taskprocessor_times_totals(struct ast_taskprocessor_times *times);
+
+/*! \brief How long the tasks pushed from a callsite took */
+struct ast_taskprocessor_callsite_times {
+	/*! The name given when the tasks were pushed */
+	const char *callsite;
+	/*! Number of tasks executed */
+	uint64_t count;
+	/*! Total microseconds from being pushed until starting to execute */
+	uint64_t wait_us;
+	/*! Total microseconds spent executing */
+	uint64_t exec_us;
+	/*! Longest a task took to execute */
+	uint64_t max_exec_us;
+};
+
+/*!
+ * \brief Get how long the tasks of each callsite took since startup
+ * \since 13.18.0
+ *
+ * \param[out] times Filled in with a callsite each, the one with the most
+ * execution time first
+ * \param max Number of elements in \a times
+ *
+ * \return The number of elements filled in
+ */
+int ast_taskprocessor_callsite_times_get(struct ast_taskprocessor_callsite_times *times, int max);
+
 /*!
  * \brief Get the current taskprocessor high water alert count.
  * \since 13.10.0
@@ -137,6 +137,8 @@ struct ast_tls_config {
  * on the stream without using an auxiliary thread.
  */
 
+struct ast_threadpool;
+
 /*! \brief
  * arguments for the accepting thread
  */
@@ -155,6 +157,14 @@ struct ast_tcptls_session_args {
 	void *(*worker_fn)(void *); /*!< the function in charge of doing the actual work */
 	const char *name;
 	struct ast_tls_config *old_tls_cfg; /*!< copy of the SSL configuration to determine whether changes have been made */
+	/*!
+	 * \brief Threads to handle accepted connections on, if any.
+	 *
+	 * When set, each accepted connection is handled by a task on the pool
+	 * instead of a new thread, so threads are reused between short-lived
+	 * connections. The task holds its thread until worker_fn returns.
+	 */
+	struct ast_threadpool *worker_pool;
 };
 
 struct ast_tcptls_stream;
@@ -301,6 +311,27 @@ void ast_ssl_teardown(struct ast_tls_config *cfg);
  */
 int ast_tls_read_conf(struct ast_tls_config *tls_cfg, struct ast_tcptls_session_args *tls_desc, const char *varname, const char *value);
 
+/*!
+ * \brief TLS handshakes done since startup
+ */
+struct ast_tcptls_handshake_stats {
+	/*! Handshakes that succeeded */
+	uint64_t completed;
+	/*! Of the completed handshakes, those that resumed a session */
+	uint64_t resumed;
+	/*! Handshakes that failed */
+	uint64_t failed;
+	/*! Time the completed handshakes took, in microseconds */
+	uint64_t total_us;
+};
+
+/*!
+ * \brief Get the TLS handshakes done since startup
+ *
+ * \param[out] stats Filled in with the handshakes of every server and client
+ */
+void ast_tcptls_handshake_stats_get(struct ast_tcptls_handshake_stats *stats);
+
 HOOK_T ast_tcptls_server_read(struct ast_tcptls_session_instance *ser, void *buf, size_t count);
 HOOK_T ast_tcptls_server_write(struct ast_tcptls_session_instance *ser, const void *buf, size_t count);
 
@@ -68,7 +68,7 @@ struct ast_threadpool_listener_callbacks {
 };
 
 struct ast_threadpool_options {
-#define AST_THREADPOOL_OPTIONS_VERSION 1
+#define AST_THREADPOOL_OPTIONS_VERSION 2
 	/*! Version of threadpool options in use */
 	int version;
 	/*!
@@ -122,6 +122,17 @@ struct ast_threadpool_options {
 	 * a thread completes
 	 */
 	void (*thread_end)(void);
+	/*!
+	 * \brief Schedule serializers on per thread run queues
+	 * \since 13.18.0
+	 *
+	 * Each serializer of the pool is given a home run queue, and the
+	 * threads of the queue run it whenever it has tasks.  Threads that
+	 * run out of work steal whole serializers from the other queues
+	 * rather than waiting on the pool.  Tasks pushed to the pool itself
+	 * are executed as usual.
+	 */
+	int work_stealing;
 };
 
 /*!
@@ -183,10 +194,16 @@ void ast_threadpool_set_size(struct ast_threadpool *threadpool, unsigned int siz
  * \param pool The threadpool to add the task to
  * \param task The task to add
  * \param data The parameter for the task
+ * \param callsite Name the task's statistics are kept under, which must stay valid
  * \retval 0 success
  * \retval -1 failure
+ *
+ * \note ast_threadpool_push() names the task after its function.
  */
-int ast_threadpool_push(struct ast_threadpool *pool, int (*task)(void *data), void *data);
+int __ast_threadpool_push(struct ast_threadpool *pool, int (*task)(void *data), void *data,
+	const char *callsite);
+#define ast_threadpool_push(pool, task, data) \
+	__ast_threadpool_push((pool), (task), (data), #task)
 
 /*!
  * \brief Shut down a threadpool and destroy it
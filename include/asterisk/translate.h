@@ -179,6 +179,10 @@ struct ast_translator {
 
 	int desc_size;                         /*!< size of private descriptor in pvt->pvt, if any */
 	int native_plc;                        /*!< true if the translator can do native plc */
+	int fixed_comp_cost;                   /*!< If not 0, used as the computational cost instead of
+	                                        *   timing sample translations.  For translators handing the
+	                                        *   work to hardware or a remote service, whose cost is not
+	                                        *   the CPU time they use. */
 
 	struct ast_module *module;             /*!< opaque reference to the parent module */
 
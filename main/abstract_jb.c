@@ -47,6 +47,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/abstract_jb.h"
 #include "fixedjitterbuf.h"
 #include "jitterbuf.h"
+#include "stretchjitterbuf.h"
 
 /*! Internal jb flags */
 enum {
@@ -79,6 +80,19 @@ static int jb_remove_adaptive(void *jb, struct ast_frame **fout);
 static void jb_force_resynch_adaptive(void *jb);
 static void jb_empty_and_reset_adaptive(void *jb);
 static int jb_is_late_adaptive(void *jb, long ts);
+static void jb_stats_adaptive(void *jb, struct ast_jb_stats *stats);
+/* stretch */
+static void *jb_create_stretch(struct ast_jb_conf *general_config);
+static void jb_destroy_stretch(void *jb);
+static int jb_put_first_stretch(void *jb, struct ast_frame *fin, long now);
+static int jb_put_stretch(void *jb, struct ast_frame *fin, long now);
+static int jb_get_stretch(void *jb, struct ast_frame **fout, long now, long interpl);
+static long jb_next_stretch(void *jb);
+static int jb_remove_stretch(void *jb, struct ast_frame **fout);
+static void jb_force_resynch_stretch(void *jb);
+static void jb_empty_and_reset_stretch(void *jb);
+static int jb_is_late_stretch(void *jb, long ts);
+static void jb_stats_stretch(void *jb, struct ast_jb_stats *stats);
 
 /* Available jb implementations */
 static const struct ast_jb_impl avail_impl[] = {
@@ -109,6 +123,22 @@ static const struct ast_jb_impl avail_impl[] = {
 		.force_resync = jb_force_resynch_adaptive,
 		.empty_and_reset = jb_empty_and_reset_adaptive,
 		.is_late = jb_is_late_adaptive,
+		.stats = jb_stats_adaptive,
+	},
+	{
+		.name = "stretch",
+		.type = AST_JB_STRETCH,
+		.create = jb_create_stretch,
+		.destroy = jb_destroy_stretch,
+		.put_first = jb_put_first_stretch,
+		.put = jb_put_stretch,
+		.get = jb_get_stretch,
+		.next = jb_next_stretch,
+		.remove = jb_remove_stretch,
+		.force_resync = jb_force_resynch_stretch,
+		.empty_and_reset = jb_empty_and_reset_stretch,
+		.is_late = jb_is_late_stretch,
+		.stats = jb_stats_stretch,
 	}
 };
 
@@ -119,6 +149,8 @@ static const int fixed_to_abstract_code[] =
 	{AST_JB_IMPL_OK, AST_JB_IMPL_DROP, AST_JB_IMPL_INTERP, AST_JB_IMPL_NOFRAME};
 static const int adaptive_to_abstract_code[] =
 	{AST_JB_IMPL_OK, AST_JB_IMPL_NOFRAME, AST_JB_IMPL_NOFRAME, AST_JB_IMPL_INTERP, AST_JB_IMPL_DROP, AST_JB_IMPL_OK};
+static const int stretch_to_abstract_code[] =
+	{AST_JB_IMPL_OK, AST_JB_IMPL_DROP, AST_JB_IMPL_INTERP, AST_JB_IMPL_NOFRAME};
 
 /* JB_GET actions (used only for the frames log) */
 static const char * const jb_get_actions[] = {"Delivered", "Dropped", "Interpolated", "No"};
@@ -826,6 +858,98 @@ static int jb_is_late_adaptive(void *jb, long ts)
 	return jb_is_late(jb, ts);
 }
 
+static void jb_stats_adaptive(void *jb, struct ast_jb_stats *stats)
+{
+	jb_info info;
+
+	memset(stats, 0, sizeof(*stats));
+	if (jb_getinfo(jb, &info) != JB_OK) {
+		return;
+	}
+
+	stats->current = info.current;
+	stats->target = info.target;
+	stats->jitter = info.jitter;
+	stats->frames_in = info.frames_in;
+	stats->frames_late = info.frames_late;
+	stats->frames_lost = info.frames_lost;
+	stats->frames_dropped = info.frames_dropped;
+}
+
+/* stretch */
+
+static void *jb_create_stretch(struct ast_jb_conf *general_config)
+{
+	struct stretch_jb_conf conf;
+
+	conf.max_size = general_config->max_size;
+	conf.resync_threshold = general_config->resync_threshold;
+	conf.target_extra = general_config->target_extra;
+
+	return stretch_jb_new(&conf);
+}
+
+static void jb_destroy_stretch(void *jb)
+{
+	jb_empty_and_reset_stretch(jb);
+	stretch_jb_destroy(jb);
+}
+
+static int jb_put_first_stretch(void *jb, struct ast_frame *fin, long now)
+{
+	return jb_put_stretch(jb, fin, now);
+}
+
+static int jb_put_stretch(void *jb, struct ast_frame *fin, long now)
+{
+	return stretch_to_abstract_code[stretch_jb_put(jb, fin, now)];
+}
+
+static int jb_get_stretch(void *jb, struct ast_frame **fout, long now, long interpl)
+{
+	struct ast_frame *frame = &ast_null_frame;
+	int res;
+
+	res = stretch_jb_get(jb, &frame, now, interpl);
+	*fout = frame;
+
+	return stretch_to_abstract_code[res];
+}
+
+static long jb_next_stretch(void *jb)
+{
+	return stretch_jb_next(jb);
+}
+
+static int jb_remove_stretch(void *jb, struct ast_frame **fout)
+{
+	return stretch_to_abstract_code[stretch_jb_remove(jb, fout)];
+}
+
+static void jb_force_resynch_stretch(void *jb)
+{
+	stretch_jb_set_force_resynch(jb);
+}
+
+static void jb_empty_and_reset_stretch(void *jb)
+{
+	struct ast_frame *f;
+
+	while (stretch_jb_remove(jb, &f) == STRETCH_JB_OK) {
+		ast_frfree(f);
+	}
+}
+
+static int jb_is_late_stretch(void *jb, long ts)
+{
+	return stretch_jb_is_late(jb, ts);
+}
+
+static void jb_stats_stretch(void *jb, struct ast_jb_stats *stats)
+{
+	stretch_jb_get_stats(jb, stats);
+}
+
 #define DEFAULT_TIMER_INTERVAL 20
 #define DEFAULT_SIZE  200
 #define DEFAULT_TARGET_EXTRA  40
@@ -842,6 +966,16 @@ struct jb_framedata {
 	int timer_fd;
 	int first;
 	void *jb_obj;
+	/* Statistics, shared with the datastore, NULL if the impl keeps none */
+	struct ast_jb_stats *stats;
+};
+
+/*! \brief Data of the jitterbuffer datastore */
+struct jb_datastore_data {
+	/*! Id of the framehook */
+	int id;
+	/*! Statistics kept up to date by the framehook, if any */
+	struct ast_jb_stats *stats;
 };
 
 static void jb_framedata_destroy(struct jb_framedata *framedata)
@@ -859,6 +993,7 @@ static void jb_framedata_destroy(struct jb_framedata *framedata)
 		framedata->jb_obj = NULL;
 	}
 	ao2_cleanup(framedata->last_format);
+	ao2_cleanup(framedata->stats);
 	ast_free(framedata);
 }
 
@@ -871,7 +1006,10 @@ void ast_jb_conf_default(struct ast_jb_conf *conf)
 }
 
 static void datastore_destroy_cb(void *data) {
-	ast_free(data);
+	struct jb_datastore_data *jb_data = data;
+
+	ao2_cleanup(jb_data->stats);
+	ast_free(jb_data);
 	ast_debug(1, "JITTERBUFFER datastore destroyed\n");
 }
 
@@ -1035,6 +1173,11 @@ static struct ast_frame *hook_event_cb(struct ast_channel *chan, struct ast_fram
 		}
 	}
 
+	/* The channel is locked so the datastore can not be reading them right now */
+	if (framedata->stats && framedata->jb_obj) {
+		framedata->jb_impl->stats(framedata->jb_obj, framedata->stats);
+	}
+
 	return frame;
 }
 
@@ -1052,6 +1195,8 @@ static int jb_framedata_init(struct jb_framedata *framedata, struct ast_jb_conf
 			jb_impl_type = AST_JB_FIXED;
 		} else if (!strcasecmp(jb_conf->impl, "adaptive")) {
 			jb_impl_type = AST_JB_ADAPTIVE;
+		} else if (!strcasecmp(jb_conf->impl, "stretch")) {
+			jb_impl_type = AST_JB_STRETCH;
 		} else {
 			ast_log(LOG_WARNING, "Unknown Jitterbuffer type %s. Failed to create jitterbuffer.\n", jb_conf->impl);
 			return -1;
@@ -1071,6 +1216,14 @@ static int jb_framedata_init(struct jb_framedata *framedata, struct ast_jb_conf
 	ast_timer_set_rate(framedata->timer, 1000 / framedata->timer_interval);
 	framedata->start_tv = ast_tvnow();
 
+	if (framedata->jb_impl->stats) {
+		framedata->stats = ao2_alloc_options(sizeof(*framedata->stats), NULL,
+			AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!framedata->stats) {
+			return -1;
+		}
+	}
+
 	framedata->jb_obj = framedata->jb_impl->create(&framedata->jb_conf);
 	return 0;
 }
@@ -1089,11 +1242,11 @@ void ast_jb_create_framehook(struct ast_channel *chan, struct ast_jb_conf *jb_co
 
 	/* If disabled, strip any existing jitterbuffer and don't replace it. */
 	if (!strcasecmp(jb_conf->impl, "disabled")) {
-		int *id;
+		struct jb_datastore_data *jb_data;
 		ast_channel_lock(chan);
 		if ((datastore = ast_channel_datastore_find(chan, &jb_datastore, NULL))) {
-			id = datastore->data;
-			ast_framehook_detach(chan, *id);
+			jb_data = datastore->data;
+			ast_framehook_detach(chan, jb_data->id);
 			ast_channel_datastore_remove(chan, datastore);
 			ast_datastore_free(datastore);
 		}
@@ -1115,7 +1268,7 @@ void ast_jb_create_framehook(struct ast_channel *chan, struct ast_jb_conf *jb_co
 	ast_channel_lock(chan);
 	i = ast_framehook_attach(chan, &interface);
 	if (i >= 0) {
-		int *id;
+		struct jb_datastore_data *jb_data;
 		if ((datastore = ast_channel_datastore_find(chan, &jb_datastore, NULL))) {
 			/* There is already a jitterbuffer on the channel. */
 			if (prefer_existing) {
@@ -1125,8 +1278,8 @@ void ast_jb_create_framehook(struct ast_channel *chan, struct ast_jb_conf *jb_co
 				return;
 			}
 			/* We prefer the new jitterbuffer, so strip the old one. */
-			id = datastore->data;
-			ast_framehook_detach(chan, *id);
+			jb_data = datastore->data;
+			ast_framehook_detach(chan, jb_data->id);
 			ast_channel_datastore_remove(chan, datastore);
 			ast_datastore_free(datastore);
 		}
@@ -1137,15 +1290,16 @@ void ast_jb_create_framehook(struct ast_channel *chan, struct ast_jb_conf *jb_co
 			return;
 		}
 
-		if (!(id = ast_calloc(1, sizeof(int)))) {
+		if (!(jb_data = ast_calloc(1, sizeof(*jb_data)))) {
 			ast_datastore_free(datastore);
 			ast_framehook_detach(chan, i);
 			ast_channel_unlock(chan);
 			return;
 		}
 
-		*id = i; /* Store off the id. The channel is still locked so it is safe to access this ptr. */
-		datastore->data = id;
+		jb_data->id = i; /* Store off the id. The channel is still locked so it is safe to access this ptr. */
+		jb_data->stats = ao2_bump(framedata->stats);
+		datastore->data = jb_data;
 		ast_channel_datastore_add(chan, datastore);
 
 		ast_channel_set_fd(chan, AST_JITTERBUFFER_FD, framedata->timer_fd);
@@ -1155,3 +1309,22 @@ void ast_jb_create_framehook(struct ast_channel *chan, struct ast_jb_conf *jb_co
 	}
 	ast_channel_unlock(chan);
 }
+
+int ast_jb_get_stats(struct ast_channel *chan, struct ast_jb_stats *stats)
+{
+	struct ast_datastore *datastore;
+	struct jb_datastore_data *jb_data;
+	int res = -1;
+
+	ast_channel_lock(chan);
+	if ((datastore = ast_channel_datastore_find(chan, &jb_datastore, NULL))) {
+		jb_data = datastore->data;
+		if (jb_data->stats) {
+			*stats = *jb_data->stats;
+			res = 0;
+		}
+	}
+	ast_channel_unlock(chan);
+
+	return res;
+}
@@ -242,6 +242,7 @@ struct ast_acl_list *ast_free_acl_list(struct ast_acl_list *acl_list)
 	AST_LIST_LOCK(acl_list);
 	while ((current = AST_LIST_REMOVE_HEAD(acl_list, list))) {
 		ast_free_ha(current->acl);
+		ast_ha_index_free(current->index);
 		ast_free(current);
 	}
 	AST_LIST_UNLOCK(acl_list);
@@ -460,6 +461,8 @@ void ast_append_acl(const char *sense, const char *stuff, struct ast_acl_list **
 
 		/* With the proper ACL set for modification, we can just pass this off to the ast_ha append function. */
 		acl->acl = ast_append_ha(sense, stuff, acl->acl, error);
+		ast_ha_index_free(acl->index);
+		acl->index = NULL;
 
 		AST_LIST_UNLOCK(working_list);
 		return;
@@ -690,6 +693,367 @@ void ast_ha_join_cidr(const struct ast_ha *ha, struct ast_str **buf)
 	}
 }
 
+/*!
+ * \internal
+ * \brief Check whether an address matches a single host access rule
+ */
+static int ha_rule_matches(const struct ast_ha *rule, const struct ast_sockaddr *addr)
+{
+	struct ast_sockaddr result;
+	struct ast_sockaddr mapped_addr;
+	const struct ast_sockaddr *addr_to_use;
+#if 0	/* debugging code */
+	char iabuf[INET_ADDRSTRLEN];
+	char iabuf2[INET_ADDRSTRLEN];
+	/* DEBUG */
+	ast_copy_string(iabuf, ast_inet_ntoa(sin->sin_addr), sizeof(iabuf));
+	ast_copy_string(iabuf2, ast_inet_ntoa(ha->netaddr), sizeof(iabuf2));
+	ast_debug(1, "##### Testing %s with %s\n", iabuf, iabuf2);
+#endif
+	if (ast_sockaddr_is_ipv4(&rule->addr)) {
+		if (ast_sockaddr_is_ipv6(addr)) {
+			if (ast_sockaddr_is_ipv4_mapped(addr)) {
+				/* IPv4 ACLs apply to IPv4-mapped addresses */
+				if (!ast_sockaddr_ipv4_mapped(addr, &mapped_addr)) {
+					ast_log(LOG_ERROR, "%s provided to ast_sockaddr_ipv4_mapped could not be converted. That shouldn't be possible.\n",
+						ast_sockaddr_stringify(addr));
+					return 0;
+				}
+				addr_to_use = &mapped_addr;
+			} else {
+				/* An IPv4 ACL does not apply to an IPv6 address */
+				return 0;
+			}
+		} else {
+			/* Address is IPv4 and ACL is IPv4. No biggie */
+			addr_to_use = addr;
+		}
+	} else {
+		if (ast_sockaddr_is_ipv6(addr) && !ast_sockaddr_is_ipv4_mapped(addr)) {
+			addr_to_use = addr;
+		} else {
+			/* Address is IPv4 or IPv4 mapped but ACL is IPv6. Skip */
+			return 0;
+		}
+	}
+
+	/* For each rule, if this address and the netmask = the net address
+	   apply the current rule */
+	if (ast_sockaddr_apply_netmask(addr_to_use, &rule->netmask, &result)) {
+		/* Unlikely to happen since we know the address to be IPv4 or IPv6 */
+		return 0;
+	}
+	return !ast_sockaddr_cmp_addr(&result, &rule->addr);
+}
+
+enum ast_acl_sense ast_apply_ha(const struct ast_ha *ha, const struct ast_sockaddr *addr)
+{
+	/* Start optimistic */
+	enum ast_acl_sense res = AST_SENSE_ALLOW;
+	const struct ast_ha *current_ha;
+
+	for (current_ha = ha; current_ha; current_ha = current_ha->next) {
+		if (ha_rule_matches(current_ha, addr)) {
+			res = current_ha->sense;
+		}
+	}
+	return res;
+}
+
+/*! \brief Lists with fewer rules than this are applied without an index */
+#define HA_INDEX_MIN_RULES 8
+
+/*!
+ * \brief A node of a host access rule prefix tree
+ *
+ * Nodes only exist where a rule ends or where the tree branches, so a
+ * lookup visits at most one node per rule on the path rather than one per
+ * address bit.
+ */
+struct ha_index_node {
+	/*! The prefix leading to this node, bits past \ref len are zero */
+	unsigned char prefix[16];
+	/*! Length of the prefix in bits */
+	int len;
+	/*! Position in the list of the last rule with this prefix, -1 if none */
+	int order;
+	/*! Sense of that rule */
+	enum ast_acl_sense sense;
+	/*! The nodes below this one, by the bit following the prefix */
+	struct ha_index_node *child[2];
+};
+
+/*! \brief A host access rule whose netmask is not a prefix */
+struct ha_index_rule {
+	/*! Position in the list */
+	int order;
+	/*! Copy of the rule */
+	struct ast_ha ha;
+};
+
+struct ast_ha_index {
+	/*! Prefix tree of the IPv4 rules */
+	struct ha_index_node *ipv4;
+	/*! Prefix tree of the IPv6 rules */
+	struct ha_index_node *ipv6;
+	/*! Number of rules in \ref others */
+	int others_count;
+	/*! Rules that do not fit the prefix trees, checked one by one */
+	struct ha_index_rule *others;
+};
+
+static int ha_index_worthwhile(const struct ast_ha *ha)
+{
+	int count = 0;
+
+	for (; ha && count < HA_INDEX_MIN_RULES; ha = ha->next) {
+		++count;
+	}
+	return count >= HA_INDEX_MIN_RULES;
+}
+
+static int ha_index_bit(const unsigned char *bytes, int bit)
+{
+	return (bytes[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+/*! \brief Count how many leading bits, up to \a len, two prefixes share */
+static int ha_index_common_bits(const unsigned char *a, const unsigned char *b, int len)
+{
+	int bits = 0;
+	unsigned char diff;
+
+	while (bits + 8 <= len && a[bits / 8] == b[bits / 8]) {
+		bits += 8;
+	}
+	if (bits >= len) {
+		return len;
+	}
+	diff = a[bits / 8] ^ b[bits / 8];
+	while (bits < len && !(diff & (0x80 >> (bits % 8)))) {
+		++bits;
+	}
+	return bits;
+}
+
+/*!
+ * \brief Get the raw bytes of an IPv4 or IPv6 address
+ *
+ * \return The length of the address in bits
+ * \retval 0 if the address is neither
+ */
+static int ha_index_addr_bytes(const struct ast_sockaddr *addr, unsigned char *bytes)
+{
+	if (ast_sockaddr_is_ipv4(addr)) {
+		uint32_t ipv4 = htonl(ast_sockaddr_ipv4(addr));
+
+		memcpy(bytes, &ipv4, sizeof(ipv4));
+		return 32;
+	}
+	if (ast_sockaddr_is_ipv6(addr)) {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) &addr->ss;
+
+		memcpy(bytes, sin6->sin6_addr.s6_addr, sizeof(sin6->sin6_addr.s6_addr));
+		return 128;
+	}
+	return 0;
+}
+
+/*!
+ * \brief Get the prefix length of a netmask
+ *
+ * \retval -1 if the netmask is not a prefix
+ */
+static int ha_index_prefix_len(const unsigned char *mask, int bits)
+{
+	int len = 0;
+	int i;
+
+	while (len < bits && ha_index_bit(mask, len)) {
+		++len;
+	}
+	for (i = len; i < bits; ++i) {
+		if (ha_index_bit(mask, i)) {
+			return -1;
+		}
+	}
+	return len;
+}
+
+static struct ha_index_node *ha_index_node_alloc(const unsigned char *prefix, int len)
+{
+	struct ha_index_node *node = ast_calloc(1, sizeof(*node));
+	int i;
+
+	if (!node) {
+		return NULL;
+	}
+	memcpy(node->prefix, prefix, (len + 7) / 8);
+	if (len % 8) {
+		node->prefix[len / 8] &= 0xff << (8 - len % 8);
+	}
+	for (i = (len + 7) / 8; i < sizeof(node->prefix); ++i) {
+		node->prefix[i] = 0;
+	}
+	node->len = len;
+	node->order = -1;
+	return node;
+}
+
+static void ha_index_node_free(struct ha_index_node *node)
+{
+	if (!node) {
+		return;
+	}
+	ha_index_node_free(node->child[0]);
+	ha_index_node_free(node->child[1]);
+	ast_free(node);
+}
+
+/*! \brief Add a rule to a prefix tree */
+static int ha_index_node_add(struct ha_index_node **root, const unsigned char *prefix, int len,
+	int order, enum ast_acl_sense sense)
+{
+	struct ha_index_node **pos = root;
+	struct ha_index_node *node;
+	struct ha_index_node *split;
+	int common;
+
+	while ((node = *pos)) {
+		common = ha_index_common_bits(node->prefix, prefix, MIN(node->len, len));
+		if (common == node->len) {
+			if (node->len == len) {
+				/* Rules are added in order so this one comes later */
+				node->order = order;
+				node->sense = sense;
+				return 0;
+			}
+			pos = &node->child[ha_index_bit(prefix, node->len)];
+			continue;
+		}
+
+		/* The new rule branches off, or ends, part way along this node */
+		split = ha_index_node_alloc(prefix, common);
+		if (!split) {
+			return -1;
+		}
+		split->child[ha_index_bit(node->prefix, common)] = node;
+		*pos = split;
+		if (common == len) {
+			split->order = order;
+			split->sense = sense;
+			return 0;
+		}
+		pos = &split->child[ha_index_bit(prefix, common)];
+		break;
+	}
+
+	node = ha_index_node_alloc(prefix, len);
+	if (!node) {
+		return -1;
+	}
+	node->order = order;
+	node->sense = sense;
+	*pos = node;
+	return 0;
+}
+
+struct ast_ha_index *ast_ha_index_build(const struct ast_ha *ha)
+{
+	struct ast_ha_index *index;
+	const struct ast_ha *rule;
+	int order = 0;
+
+	if (!(index = ast_calloc(1, sizeof(*index)))) {
+		return NULL;
+	}
+
+	for (rule = ha; rule; rule = rule->next, ++order) {
+		unsigned char addr[16];
+		unsigned char mask[16];
+		int bits = ha_index_addr_bytes(&rule->addr, addr);
+		int len = -1;
+
+		if (bits && ha_index_addr_bytes(&rule->netmask, mask) == bits) {
+			len = ha_index_prefix_len(mask, bits);
+		}
+
+		if (len >= 0) {
+			if (ha_index_node_add(bits == 32 ? &index->ipv4 : &index->ipv6, addr, len,
+				order, rule->sense)) {
+				ast_ha_index_free(index);
+				return NULL;
+			}
+		} else {
+			struct ha_index_rule *others;
+
+			others = ast_realloc(index->others, (index->others_count + 1) * sizeof(*others));
+			if (!others) {
+				ast_ha_index_free(index);
+				return NULL;
+			}
+			index->others = others;
+			others[index->others_count].order = order;
+			ast_copy_ha(rule, &others[index->others_count].ha);
+			others[index->others_count].ha.next = NULL;
+			++index->others_count;
+		}
+	}
+
+	return index;
+}
+
+enum ast_acl_sense ast_ha_index_apply(const struct ast_ha_index *index, const struct ast_sockaddr *addr)
+{
+	struct ast_sockaddr mapped_addr;
+	const struct ha_index_node *node;
+	unsigned char bytes[16];
+	int bits;
+	int order = -1;
+	enum ast_acl_sense res = AST_SENSE_ALLOW;
+	int i;
+
+	/* IPv4 rules apply to IPv4-mapped addresses and IPv6 rules do not */
+	if (ast_sockaddr_is_ipv4_mapped(addr) && ast_sockaddr_ipv4_mapped(addr, &mapped_addr)) {
+		bits = ha_index_addr_bytes(&mapped_addr, bytes);
+	} else {
+		bits = ha_index_addr_bytes(addr, bytes);
+	}
+
+	node = bits == 32 ? index->ipv4 : bits == 128 ? index->ipv6 : NULL;
+	while (node && node->len <= bits
+		&& ha_index_common_bits(node->prefix, bytes, node->len) == node->len) {
+		if (node->order > order) {
+			order = node->order;
+			res = node->sense;
+		}
+		if (node->len == bits) {
+			break;
+		}
+		node = node->child[ha_index_bit(bytes, node->len)];
+	}
+
+	for (i = 0; i < index->others_count; ++i) {
+		if (index->others[i].order > order && ha_rule_matches(&index->others[i].ha, addr)) {
+			order = index->others[i].order;
+			res = index->others[i].ha.sense;
+		}
+	}
+
+	return res;
+}
+
+void ast_ha_index_free(struct ast_ha_index *index)
+{
+	if (!index) {
+		return;
+	}
+	ha_index_node_free(index->ipv4);
+	ha_index_node_free(index->ipv6);
+	ast_free(index->others);
+	ast_free(index);
+}
+
 enum ast_acl_sense ast_apply_acl(struct ast_acl_list *acl_list, const struct ast_sockaddr *addr, const char *purpose)
 {
 	struct ast_acl *acl;
@@ -710,8 +1074,12 @@ enum ast_acl_sense ast_apply_acl(struct ast_acl_list *acl_list, const struct ast
 			return AST_SENSE_DENY;
 		}
 
+		if (!acl->index && acl->acl && ha_index_worthwhile(acl->acl)) {
+			acl->index = ast_ha_index_build(acl->acl);
+		}
+
 		if (acl->acl) {
-			if (ast_apply_ha(acl->acl, addr) == AST_SENSE_DENY) {
+			if ((acl->index ? ast_ha_index_apply(acl->index, addr) : ast_apply_ha(acl->acl, addr)) == AST_SENSE_DENY) {
 				ast_log(LOG_NOTICE, "%sRejecting '%s' due to a failure to pass ACL '%s'\n", purpose ? purpose : "", ast_sockaddr_stringify_addr(addr),
 						ast_strlen_zero(acl->name) ? "(BASELINE)" : acl->name);
 				AST_LIST_UNLOCK(acl_list);
@@ -725,64 +1093,6 @@ enum ast_acl_sense ast_apply_acl(struct ast_acl_list *acl_list, const struct ast
 	return AST_SENSE_ALLOW;
 }
 
-enum ast_acl_sense ast_apply_ha(const struct ast_ha *ha, const struct ast_sockaddr *addr)
-{
-	/* Start optimistic */
-	enum ast_acl_sense res = AST_SENSE_ALLOW;
-	const struct ast_ha *current_ha;
-
-	for (current_ha = ha; current_ha; current_ha = current_ha->next) {
-		struct ast_sockaddr result;
-		struct ast_sockaddr mapped_addr;
-		const struct ast_sockaddr *addr_to_use;
-#if 0	/* debugging code */
-		char iabuf[INET_ADDRSTRLEN];
-		char iabuf2[INET_ADDRSTRLEN];
-		/* DEBUG */
-		ast_copy_string(iabuf, ast_inet_ntoa(sin->sin_addr), sizeof(iabuf));
-		ast_copy_string(iabuf2, ast_inet_ntoa(ha->netaddr), sizeof(iabuf2));
-		ast_debug(1, "##### Testing %s with %s\n", iabuf, iabuf2);
-#endif
-		if (ast_sockaddr_is_ipv4(&current_ha->addr)) {
-			if (ast_sockaddr_is_ipv6(addr)) {
-				if (ast_sockaddr_is_ipv4_mapped(addr)) {
-					/* IPv4 ACLs apply to IPv4-mapped addresses */
-					if (!ast_sockaddr_ipv4_mapped(addr, &mapped_addr)) {
-						ast_log(LOG_ERROR, "%s provided to ast_sockaddr_ipv4_mapped could not be converted. That shouldn't be possible.\n",
-							ast_sockaddr_stringify(addr));
-						continue;
-					}
-					addr_to_use = &mapped_addr;
-				} else {
-					/* An IPv4 ACL does not apply to an IPv6 address */
-					continue;
-				}
-			} else {
-				/* Address is IPv4 and ACL is IPv4. No biggie */
-				addr_to_use = addr;
-			}
-		} else {
-			if (ast_sockaddr_is_ipv6(addr) && !ast_sockaddr_is_ipv4_mapped(addr)) {
-				addr_to_use = addr;
-			} else {
-				/* Address is IPv4 or IPv4 mapped but ACL is IPv6. Skip */
-				continue;
-			}
-		}
-
-		/* For each rule, if this address and the netmask = the net address
-		   apply the current rule */
-		if (ast_sockaddr_apply_netmask(addr_to_use, &current_ha->netmask, &result)) {
-			/* Unlikely to happen since we know the address to be IPv4 or IPv6 */
-			continue;
-		}
-		if (!ast_sockaddr_cmp_addr(&result, &current_ha->addr)) {
-			res = current_ha->sense;
-		}
-	}
-	return res;
-}
-
 static int resolve_first(struct ast_sockaddr *addr, const char *name, int flag,
 			 int family)
 {
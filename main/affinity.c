@@ -0,0 +1,272 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Thread placement by class
+ */
+
+/*** MODULEINFO
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/_private.h"
+#include "asterisk/affinity.h"
+#include "asterisk/cli.h"
+#include "asterisk/config.h"
+#include "asterisk/paths.h"
+#include "asterisk/strings.h"
+#include "asterisk/utils.h"
+
+static const char *thread_class_names[AST_THREAD_CLASS_MAX] = {
+	[AST_THREAD_CLASS_SIP] = "sip",
+	[AST_THREAD_CLASS_MIXING] = "mixing",
+	[AST_THREAD_CLASS_CHANNEL] = "channel",
+	[AST_THREAD_CLASS_STASIS] = "stasis",
+};
+
+/*! Most characters of a CPU list read from a NUMA node */
+#define NODE_CPU_LIST_LEN 1024
+
+#ifdef __linux__
+struct thread_class_affinity {
+	/*! The CPUs threads of the class are pinned to */
+	cpu_set_t cpus;
+	/*! Number of CPUs in cpus, 0 if threads of the class are not pinned */
+	int count;
+	/*! The CPUs as configured */
+	char config[80];
+};
+
+/*! Only written while Asterisk starts, before any thread joins a class */
+static struct thread_class_affinity affinities[AST_THREAD_CLASS_MAX];
+
+static int cpu_list_parse(const char *list, cpu_set_t *cpus, int allow_nodes);
+
+/*!
+ * \brief Add the CPUs of a NUMA node to a set
+ *
+ * \param node The node, as "node<number>"
+ * \param cpus The set to add to
+ *
+ * \retval 0 success
+ * \retval -1 the node does not exist
+ */
+static int node_cpus_add(const char *node, cpu_set_t *cpus)
+{
+	char path[PATH_MAX];
+	char list[NODE_CPU_LIST_LEN];
+	unsigned int id;
+	FILE *file;
+	int res = -1;
+
+	if (sscanf(node, "node%30u", &id) != 1) {
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", id);
+	file = fopen(path, "r");
+	if (!file) {
+		ast_log(LOG_WARNING, "NUMA node %u does not exist\n", id);
+		return -1;
+	}
+	if (fgets(list, sizeof(list), file)) {
+		res = cpu_list_parse(ast_strip(list), cpus, 0);
+	}
+	fclose(file);
+
+	return res;
+}
+
+/*!
+ * \brief Add the CPUs of a list such as "0-3,8,node1" to a set
+ *
+ * \param list The comma separated CPUs, ranges of CPUs and NUMA nodes
+ * \param cpus The set to add to
+ * \param allow_nodes Nonzero if the list may name NUMA nodes
+ *
+ * \retval 0 success
+ * \retval -1 the list is invalid
+ */
+static int cpu_list_parse(const char *list, cpu_set_t *cpus, int allow_nodes)
+{
+	char *buf = ast_strdupa(list);
+	char *item;
+
+	while ((item = strsep(&buf, ","))) {
+		unsigned int first;
+		unsigned int last;
+
+		item = ast_strip(item);
+		if (ast_strlen_zero(item)) {
+			continue;
+		}
+		if (allow_nodes && !strncasecmp(item, "node", 4)) {
+			if (node_cpus_add(item, cpus)) {
+				return -1;
+			}
+			continue;
+		}
+
+		switch (sscanf(item, "%30u-%30u", &first, &last)) {
+		case 1:
+			last = first;
+			break;
+		case 2:
+			break;
+		default:
+			return -1;
+		}
+		if (last < first || last >= CPU_SETSIZE) {
+			return -1;
+		}
+		for (; first <= last; ++first) {
+			CPU_SET(first, cpus);
+		}
+	}
+
+	return 0;
+}
+#endif /* __linux__ */
+
+const char *ast_thread_class_name(enum ast_thread_class thread_class)
+{
+	return thread_class < AST_THREAD_CLASS_MAX ? thread_class_names[thread_class] : "unknown";
+}
+
+void ast_thread_class_set(enum ast_thread_class thread_class)
+{
+#ifdef __linux__
+	struct thread_class_affinity *affinity;
+
+	if (thread_class >= AST_THREAD_CLASS_MAX) {
+		return;
+	}
+
+	affinity = &affinities[thread_class];
+	if (!affinity->count) {
+		return;
+	}
+	if (pthread_setaffinity_np(pthread_self(), sizeof(affinity->cpus), &affinity->cpus)) {
+		ast_log(LOG_WARNING, "Could not pin %s thread to CPUs %s\n",
+			thread_class_names[thread_class], affinity->config);
+	}
+#endif
+}
+
+/*! \brief Read the [affinity] section of asterisk.conf */
+static void affinity_load(void)
+{
+	struct ast_flags config_flags = { 0 };
+	struct ast_config *cfg;
+	struct ast_variable *var;
+
+	cfg = ast_config_load2(ast_config_AST_CONFIG_FILE, "" /* core, can't reload */, config_flags);
+	if (!cfg || cfg == CONFIG_STATUS_FILEINVALID) {
+		return;
+	}
+
+	for (var = ast_variable_browse(cfg, "affinity"); var; var = var->next) {
+#ifdef __linux__
+		cpu_set_t cpus;
+		int i;
+
+		for (i = 0; i < AST_THREAD_CLASS_MAX; ++i) {
+			if (!strcasecmp(var->name, thread_class_names[i])) {
+				break;
+			}
+		}
+		if (i == AST_THREAD_CLASS_MAX) {
+			ast_log(LOG_WARNING, "Unknown thread class '%s' in the [affinity] section of %s\n",
+				var->name, ast_config_AST_CONFIG_FILE);
+			continue;
+		}
+
+		CPU_ZERO(&cpus);
+		if (cpu_list_parse(var->value, &cpus, 1) || !CPU_COUNT(&cpus)) {
+			ast_log(LOG_WARNING, "Invalid CPUs '%s' for %s threads in %s\n",
+				var->value, var->name, ast_config_AST_CONFIG_FILE);
+			continue;
+		}
+
+		affinities[i].cpus = cpus;
+		affinities[i].count = CPU_COUNT(&cpus);
+		ast_copy_string(affinities[i].config, var->value, sizeof(affinities[i].config));
+#else
+		ast_log(LOG_WARNING, "Thread affinity is not supported on this platform\n");
+		break;
+#endif
+	}
+
+	ast_config_destroy(cfg);
+}
+
+static char *handle_show_affinity(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	int i;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show affinity";
+		e->usage =
+			"Usage: core show affinity\n"
+			"       Shows the CPUs each class of thread is pinned to, as set in\n"
+			"       the [affinity] section of asterisk.conf.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, "%-10s %6s %s\n", "Class", "Count", "CPUs");
+	for (i = 0; i < AST_THREAD_CLASS_MAX; ++i) {
+#ifdef __linux__
+		if (affinities[i].count) {
+			ast_cli(a->fd, "%-10s %6d %s\n", thread_class_names[i],
+				affinities[i].count, affinities[i].config);
+			continue;
+		}
+#endif
+		ast_cli(a->fd, "%-10s %6s %s\n", thread_class_names[i], "-", "(any)");
+	}
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_affinity[] = {
+	AST_CLI_DEFINE(handle_show_affinity, "Show the CPUs each class of thread is pinned to"),
+};
+
+static void affinity_shutdown(void)
+{
+	ast_cli_unregister_multiple(cli_affinity, ARRAY_LEN(cli_affinity));
+}
+
+int ast_affinity_init(void)
+{
+	affinity_load();
+
+	ast_register_cleanup(affinity_shutdown);
+	ast_cli_register_multiple(cli_affinity, ARRAY_LEN(cli_affinity));
+	return 0;
+}
@@ -348,12 +348,43 @@ struct expr_node
 
 typedef void *yyscan_t;
 
+enum expr_opcode {
+	EXPR_OP_PUSH, EXPR_OP_FUNC, EXPR_OP_OR, EXPR_OP_AND, EXPR_OP_EQ, EXPR_OP_GT,
+	EXPR_OP_LT, EXPR_OP_GE, EXPR_OP_LE, EXPR_OP_NE, EXPR_OP_PLUS, EXPR_OP_MINUS,
+	EXPR_OP_NEGATE, EXPR_OP_COMPL, EXPR_OP_TIMES, EXPR_OP_DIV, EXPR_OP_REM,
+	EXPR_OP_COLON, EXPR_OP_EQTILDE, EXPR_OP_COND, EXPR_OP_TILDETILDE
+} ;
+
+/*! One step of a compiled expression, run on a stack of values */
+struct expr_insn
+{
+	enum expr_opcode op;
+	/*! How many values the step takes off the stack */
+	int argc;
+	/*! The value pushed, or the name of the function called */
+	struct val *val;
+};
+
+/*! An expression parsed once, to be run any number of times */
+struct expr_program
+{
+	struct expr_insn *insns;
+	int count;
+	int size;
+	/*! Values on the stack after the last step, and the most there ever are */
+	int depth;
+	int max_depth;
+	/*! Set if a step could not be added */
+	int failed;
+};
+
 struct parse_io
 {
 	char *string;
 	struct val *val;
 	yyscan_t scanner;
 	struct ast_channel *chan;
+	struct expr_program *program;
 };
  
 static int		chk_div __P((FP___TYPE, FP___TYPE));
@@ -389,6 +420,12 @@ static int		to_number __P((struct val *));
 static void		to_string __P((struct val *));
 static struct expr_node *alloc_expr_node(enum node_type);
 static void destroy_arglist(struct expr_node *arglist);
+static struct val *emit_value(struct parse_io *io, struct val *vp);
+static struct val *emit_op(struct parse_io *io, enum expr_opcode op, int argc);
+static struct val *emit_func(struct parse_io *io, struct val *funcname, struct expr_node *arglist);
+struct expr_program *ast_expr_program_alloc(void);
+void ast_expr_program_free(struct expr_program *program);
+struct val *ast_expr_program_run(struct expr_program *program, struct ast_channel *chan);
 
 /* uh, if I want to predeclare yylex with a YYLTYPE, I have to predeclare the yyltype... sigh */
 typedef struct yyltype
@@ -416,7 +453,7 @@ int		ast_yyerror(const char *,YYLTYPE *, struct parse_io *);
 
 
 /* Line 189 of yacc.c  */
-#line 419 "ast_expr2.c"
+#line 456 "ast_expr2.c"
 
 /* Enabling traces.  */
 #ifndef YYDEBUG
@@ -476,7 +513,7 @@ typedef union YYSTYPE
 {
 
 /* Line 214 of yacc.c  */
-#line 345 "ast_expr2.y"
+#line 382 "ast_expr2.y"
 
 	struct val *val;
 	struct expr_node *arglist;
@@ -484,7 +521,7 @@ typedef union YYSTYPE
 
 
 /* Line 214 of yacc.c  */
-#line 487 "ast_expr2.c"
+#line 524 "ast_expr2.c"
 } YYSTYPE;
 # define YYSTYPE_IS_TRIVIAL 1
 # define yystype YYSTYPE /* obsolescent; will be withdrawn */
@@ -508,13 +545,13 @@ typedef struct YYLTYPE
 /* Copy the second part of user declarations.  */
 
 /* Line 264 of yacc.c  */
-#line 350 "ast_expr2.y"
+#line 387 "ast_expr2.y"
 
 extern int		ast_yylex __P((YYSTYPE *, YYLTYPE *, yyscan_t));
 
 
 /* Line 264 of yacc.c  */
-#line 517 "ast_expr2.c"
+#line 554 "ast_expr2.c"
 
 #ifdef short
 # undef short
@@ -1472,209 +1509,200 @@ yydestruct (yymsg, yytype, yyvaluep, yylocationp)
       case 4: /* "TOK_COLONCOLON" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1479 "ast_expr2.c"
+#line 1516 "ast_expr2.c"
 	break;
       case 5: /* "TOK_COND" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1488 "ast_expr2.c"
+#line 1525 "ast_expr2.c"
 	break;
       case 6: /* "TOK_OR" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1497 "ast_expr2.c"
+#line 1534 "ast_expr2.c"
 	break;
       case 7: /* "TOK_AND" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1506 "ast_expr2.c"
+#line 1543 "ast_expr2.c"
 	break;
       case 8: /* "TOK_NE" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1515 "ast_expr2.c"
+#line 1552 "ast_expr2.c"
 	break;
       case 9: /* "TOK_LE" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1524 "ast_expr2.c"
+#line 1561 "ast_expr2.c"
 	break;
       case 10: /* "TOK_GE" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1533 "ast_expr2.c"
+#line 1570 "ast_expr2.c"
 	break;
       case 11: /* "TOK_LT" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1542 "ast_expr2.c"
+#line 1579 "ast_expr2.c"
 	break;
       case 12: /* "TOK_GT" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1551 "ast_expr2.c"
+#line 1588 "ast_expr2.c"
 	break;
       case 13: /* "TOK_EQ" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1560 "ast_expr2.c"
+#line 1597 "ast_expr2.c"
 	break;
       case 14: /* "TOK_MINUS" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1569 "ast_expr2.c"
+#line 1606 "ast_expr2.c"
 	break;
       case 15: /* "TOK_PLUS" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1578 "ast_expr2.c"
+#line 1615 "ast_expr2.c"
 	break;
       case 16: /* "TOK_MOD" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1587 "ast_expr2.c"
+#line 1624 "ast_expr2.c"
 	break;
       case 17: /* "TOK_DIV" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1596 "ast_expr2.c"
+#line 1633 "ast_expr2.c"
 	break;
       case 18: /* "TOK_MULT" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1605 "ast_expr2.c"
+#line 1642 "ast_expr2.c"
 	break;
       case 19: /* "TOK_COMPL" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1614 "ast_expr2.c"
+#line 1651 "ast_expr2.c"
 	break;
       case 20: /* "TOK_TILDETILDE" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1623 "ast_expr2.c"
+#line 1660 "ast_expr2.c"
 	break;
       case 21: /* "TOK_EQTILDE" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1632 "ast_expr2.c"
+#line 1669 "ast_expr2.c"
 	break;
       case 22: /* "TOK_COLON" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1641 "ast_expr2.c"
+#line 1678 "ast_expr2.c"
 	break;
       case 23: /* "TOK_LP" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1650 "ast_expr2.c"
+#line 1687 "ast_expr2.c"
 	break;
       case 24: /* "TOK_RP" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1659 "ast_expr2.c"
+#line 1696 "ast_expr2.c"
 	break;
       case 25: /* "TOKEN" */
 
 /* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
-	{  free_value((yyvaluep->val)); };
-
-/* Line 1000 of yacc.c  */
-#line 1668 "ast_expr2.c"
-	break;
-      case 29: /* "expr" */
-
-/* Line 1000 of yacc.c  */
-#line 368 "ast_expr2.y"
+#line 405 "ast_expr2.y"
 	{  free_value((yyvaluep->val)); };
 
 /* Line 1000 of yacc.c  */
-#line 1677 "ast_expr2.c"
+#line 1705 "ast_expr2.c"
 	break;
 
       default:
@@ -2005,38 +2033,34 @@ yyreduce:
         case 2:
 
 /* Line 1455 of yacc.c  */
-#line 374 "ast_expr2.y"
-    { ((struct parse_io *)parseio)->val = (struct val *)calloc(sizeof(struct val),1);
-              ((struct parse_io *)parseio)->val->type = (yyvsp[(1) - (1)].val)->type;
-              if( (yyvsp[(1) - (1)].val)->type == AST_EXPR_number )
-				  ((struct parse_io *)parseio)->val->u.i = (yyvsp[(1) - (1)].val)->u.i;
-              else
-				  ((struct parse_io *)parseio)->val->u.s = (yyvsp[(1) - (1)].val)->u.s; 
-			  free((yyvsp[(1) - (1)].val));
+#line 411 "ast_expr2.y"
+    { /* the program leaves the value of the expression on the stack */
+              if (((struct parse_io *)parseio)->program->failed)
+				  YYABORT;
 			;}
     break;
 
   case 3:
 
 /* Line 1455 of yacc.c  */
-#line 382 "ast_expr2.y"
-    {/* nothing */ ((struct parse_io *)parseio)->val = (struct val *)calloc(sizeof(struct val),1);
-              ((struct parse_io *)parseio)->val->type = AST_EXPR_string;
-			  ((struct parse_io *)parseio)->val->u.s = strdup(""); 
+#line 415 "ast_expr2.y"
+    {/* nothing */ emit_value((struct parse_io *)parseio, make_str(""));
+              if (((struct parse_io *)parseio)->program->failed)
+				  YYABORT;
 			;}
     break;
 
   case 4:
 
 /* Line 1455 of yacc.c  */
-#line 389 "ast_expr2.y"
+#line 422 "ast_expr2.y"
     { (yyval.arglist) = alloc_expr_node(AST_EXPR_NODE_VAL); (yyval.arglist)->val = (yyvsp[(1) - (1)].val);;}
     break;
 
   case 5:
 
 /* Line 1455 of yacc.c  */
-#line 390 "ast_expr2.y"
+#line 423 "ast_expr2.y"
     {struct expr_node *x = alloc_expr_node(AST_EXPR_NODE_VAL);
                                  struct expr_node *t;
 								 DESTROY((yyvsp[(2) - (3)].val));
@@ -2048,38 +2072,36 @@ yyreduce:
   case 6:
 
 /* Line 1455 of yacc.c  */
-#line 396 "ast_expr2.y"
+#line 429 "ast_expr2.y"
     {struct expr_node *x = alloc_expr_node(AST_EXPR_NODE_VAL);
                                  struct expr_node *t;  /* NULL args should OK */
 								 DESTROY((yyvsp[(2) - (2)].val));
                                  for (t=(yyvsp[(1) - (2)].arglist);t->right;t=t->right)
 						         	  ;
-                                 (yyval.arglist) = (yyvsp[(1) - (2)].arglist); t->right = x; x->val = make_str("");;}
+                                 (yyval.arglist) = (yyvsp[(1) - (2)].arglist); t->right = x; emit_value((struct parse_io *)parseio, make_str(""));;}
     break;
 
   case 7:
 
 /* Line 1455 of yacc.c  */
-#line 405 "ast_expr2.y"
-    { (yyval.val) = op_func((yyvsp[(1) - (4)].val),(yyvsp[(3) - (4)].arglist), ((struct parse_io *)parseio)->chan);
+#line 438 "ast_expr2.y"
+    { (yyval.val) = emit_func((struct parse_io *)parseio, (yyvsp[(1) - (4)].val), (yyvsp[(3) - (4)].arglist));
 		                            DESTROY((yyvsp[(2) - (4)].val));
 									DESTROY((yyvsp[(4) - (4)].val));
-									DESTROY((yyvsp[(1) - (4)].val));
-									destroy_arglist((yyvsp[(3) - (4)].arglist));
                                   ;}
     break;
 
   case 8:
 
 /* Line 1455 of yacc.c  */
-#line 411 "ast_expr2.y"
-    {(yyval.val) = (yyvsp[(1) - (1)].val);;}
+#line 442 "ast_expr2.y"
+    {(yyval.val) = emit_value((struct parse_io *)parseio, (yyvsp[(1) - (1)].val));;}
     break;
 
   case 9:
 
 /* Line 1455 of yacc.c  */
-#line 412 "ast_expr2.y"
+#line 443 "ast_expr2.y"
     { (yyval.val) = (yyvsp[(2) - (3)].val);
 	                       (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 						   (yyloc).first_line=0; (yyloc).last_line=0;
@@ -2089,8 +2111,8 @@ yyreduce:
   case 10:
 
 /* Line 1455 of yacc.c  */
-#line 416 "ast_expr2.y"
-    { (yyval.val) = op_or ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val));
+#line 447 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_OR, 2);
 						DESTROY((yyvsp[(2) - (3)].val));	
                          (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 						 (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2099,8 +2121,8 @@ yyreduce:
   case 11:
 
 /* Line 1455 of yacc.c  */
-#line 420 "ast_expr2.y"
-    { (yyval.val) = op_and ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 451 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_AND, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                      (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
                           (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2109,8 +2131,8 @@ yyreduce:
   case 12:
 
 /* Line 1455 of yacc.c  */
-#line 424 "ast_expr2.y"
-    { (yyval.val) = op_eq ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val));
+#line 455 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_EQ, 2);
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                     (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column;
 						 (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2119,8 +2141,8 @@ yyreduce:
   case 13:
 
 /* Line 1455 of yacc.c  */
-#line 428 "ast_expr2.y"
-    { (yyval.val) = op_gt ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val));
+#line 459 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_GT, 2);
 						DESTROY((yyvsp[(2) - (3)].val));	
                          (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column;
 						 (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2129,8 +2151,8 @@ yyreduce:
   case 14:
 
 /* Line 1455 of yacc.c  */
-#line 432 "ast_expr2.y"
-    { (yyval.val) = op_lt ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 463 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_LT, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                     (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 						 (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2139,8 +2161,8 @@ yyreduce:
   case 15:
 
 /* Line 1455 of yacc.c  */
-#line 436 "ast_expr2.y"
-    { (yyval.val) = op_ge ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 467 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_GE, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                      (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 						  (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2149,8 +2171,8 @@ yyreduce:
   case 16:
 
 /* Line 1455 of yacc.c  */
-#line 440 "ast_expr2.y"
-    { (yyval.val) = op_le ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 471 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_LE, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                      (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 						  (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2159,8 +2181,8 @@ yyreduce:
   case 17:
 
 /* Line 1455 of yacc.c  */
-#line 444 "ast_expr2.y"
-    { (yyval.val) = op_ne ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 475 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_NE, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                      (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 						  (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2169,8 +2191,8 @@ yyreduce:
   case 18:
 
 /* Line 1455 of yacc.c  */
-#line 448 "ast_expr2.y"
-    { (yyval.val) = op_plus ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 479 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_PLUS, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                       (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 						   (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2179,8 +2201,8 @@ yyreduce:
   case 19:
 
 /* Line 1455 of yacc.c  */
-#line 452 "ast_expr2.y"
-    { (yyval.val) = op_minus ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 483 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_MINUS, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                        (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 							(yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2189,8 +2211,8 @@ yyreduce:
   case 20:
 
 /* Line 1455 of yacc.c  */
-#line 456 "ast_expr2.y"
-    { (yyval.val) = op_negate ((yyvsp[(2) - (2)].val)); 
+#line 487 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_NEGATE, 1); 
 						DESTROY((yyvsp[(1) - (2)].val));	
 	                        (yyloc).first_column = (yylsp[(1) - (2)]).first_column; (yyloc).last_column = (yylsp[(2) - (2)]).last_column; 
 							(yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2199,8 +2221,8 @@ yyreduce:
   case 21:
 
 /* Line 1455 of yacc.c  */
-#line 460 "ast_expr2.y"
-    { (yyval.val) = op_compl ((yyvsp[(2) - (2)].val)); 
+#line 491 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_COMPL, 1); 
 						DESTROY((yyvsp[(1) - (2)].val));	
 	                        (yyloc).first_column = (yylsp[(1) - (2)]).first_column; (yyloc).last_column = (yylsp[(2) - (2)]).last_column; 
 							(yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2209,8 +2231,8 @@ yyreduce:
   case 22:
 
 /* Line 1455 of yacc.c  */
-#line 464 "ast_expr2.y"
-    { (yyval.val) = op_times ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 495 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_TIMES, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                       (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 						   (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2219,8 +2241,8 @@ yyreduce:
   case 23:
 
 /* Line 1455 of yacc.c  */
-#line 468 "ast_expr2.y"
-    { (yyval.val) = op_div ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 499 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_DIV, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                      (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 						  (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2229,8 +2251,8 @@ yyreduce:
   case 24:
 
 /* Line 1455 of yacc.c  */
-#line 472 "ast_expr2.y"
-    { (yyval.val) = op_rem ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 503 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_REM, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                      (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 						  (yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2239,8 +2261,8 @@ yyreduce:
   case 25:
 
 /* Line 1455 of yacc.c  */
-#line 476 "ast_expr2.y"
-    { (yyval.val) = op_colon ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 507 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_COLON, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                        (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 							(yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2249,8 +2271,8 @@ yyreduce:
   case 26:
 
 /* Line 1455 of yacc.c  */
-#line 480 "ast_expr2.y"
-    { (yyval.val) = op_eqtilde ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 511 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_EQTILDE, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                        (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 							(yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2259,8 +2281,8 @@ yyreduce:
   case 27:
 
 /* Line 1455 of yacc.c  */
-#line 484 "ast_expr2.y"
-    { (yyval.val) = op_cond ((yyvsp[(1) - (5)].val), (yyvsp[(3) - (5)].val), (yyvsp[(5) - (5)].val)); 
+#line 515 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_COND, 3); 
 						DESTROY((yyvsp[(2) - (5)].val));	
 						DESTROY((yyvsp[(4) - (5)].val));	
 	                        (yyloc).first_column = (yylsp[(1) - (5)]).first_column; (yyloc).last_column = (yylsp[(3) - (5)]).last_column; 
@@ -2270,8 +2292,8 @@ yyreduce:
   case 28:
 
 /* Line 1455 of yacc.c  */
-#line 489 "ast_expr2.y"
-    { (yyval.val) = op_tildetilde ((yyvsp[(1) - (3)].val), (yyvsp[(3) - (3)].val)); 
+#line 520 "ast_expr2.y"
+    { (yyval.val) = emit_op((struct parse_io *)parseio, EXPR_OP_TILDETILDE, 2); 
 						DESTROY((yyvsp[(2) - (3)].val));	
 	                        (yyloc).first_column = (yylsp[(1) - (3)]).first_column; (yyloc).last_column = (yylsp[(3) - (3)]).last_column; 
 							(yyloc).first_line=0; (yyloc).last_line=0;;}
@@ -2280,7 +2302,7 @@ yyreduce:
 
 
 /* Line 1455 of yacc.c  */
-#line 2283 "ast_expr2.c"
+#line 2305 "ast_expr2.c"
       default: break;
     }
   YY_SYMBOL_PRINT ("-> $$ =", yyr1[yyn], &yyval, &yyloc);
@@ -2499,7 +2521,7 @@ yyreturn:
 
 
 /* Line 1675 of yacc.c  */
-#line 495 "ast_expr2.y"
+#line 526 "ast_expr2.y"
 
 
 static struct expr_node *alloc_expr_node(enum node_type nt)
@@ -2748,6 +2770,209 @@ static void destroy_arglist(struct expr_node *arglist)
 	}
 }
 
+/* The parser does not work the expression out as it goes, but adds a step
+   to the program for each value and operator as it reduces them.  The
+   program is then run, as many times as needed, to get the value. */
+
+static int emit(struct parse_io *io, enum expr_opcode op, int argc, struct val *vp)
+{
+	struct expr_program *program = io->program;
+	struct expr_insn *insn;
+
+	if (program->failed) {
+		return -1;
+	}
+	if (program->count == program->size) {
+		int size = program->size ? program->size * 2 : 8;
+		struct expr_insn *insns = realloc(program->insns, size * sizeof(*insns));
+
+		if (!insns) {
+			ast_log(LOG_WARNING, "realloc() failed\n");
+			program->failed = 1;
+			return -1;
+		}
+		program->insns = insns;
+		program->size = size;
+	}
+	insn = &program->insns[program->count++];
+	insn->op = op;
+	insn->argc = argc;
+	insn->val = vp;
+
+	program->depth += 1 - argc;
+	if (program->depth > program->max_depth) {
+		program->max_depth = program->depth;
+	}
+	return 0;
+}
+
+static struct val *emit_value(struct parse_io *io, struct val *vp)
+{
+	if (!vp) {
+		io->program->failed = 1;
+	} else if (emit(io, EXPR_OP_PUSH, 0, vp)) {
+		free_value(vp);
+	}
+	return NULL;
+}
+
+static struct val *emit_op(struct parse_io *io, enum expr_opcode op, int argc)
+{
+	emit(io, op, argc, NULL);
+	return NULL;
+}
+
+static struct val *emit_func(struct parse_io *io, struct val *funcname, struct expr_node *arglist)
+{
+	struct expr_node *t;
+	int argc = 0;
+
+	/* the values of the arguments are already on the stack */
+	for (t = arglist; t; t = t->right) {
+		argc++;
+	}
+	destroy_arglist(arglist);
+
+	if (emit(io, EXPR_OP_FUNC, argc, funcname)) {
+		free_value(funcname);
+	}
+	return NULL;
+}
+
+struct expr_program *ast_expr_program_alloc(void)
+{
+	return calloc(1, sizeof(struct expr_program));
+}
+
+void ast_expr_program_free(struct expr_program *program)
+{
+	int i;
+
+	if (!program) {
+		return;
+	}
+	for (i = 0; i < program->count; i++) {
+		free_value(program->insns[i].val);
+	}
+	free(program->insns);
+	free(program);
+}
+
+static struct val *copy_value(struct val *vp)
+{
+	struct val *copy = malloc(sizeof(*copy));
+
+	if (!copy) {
+		ast_log(LOG_WARNING, "malloc() failed\n");
+		return NULL;
+	}
+	copy->type = vp->type;
+	if (vp->type == AST_EXPR_number) {
+		copy->u.i = vp->u.i;
+	} else if (!(copy->u.s = strdup(vp->u.s))) {
+		ast_log(LOG_WARNING, "malloc() failed\n");
+		free(copy);
+		return NULL;
+	}
+	return copy;
+}
+
+struct val *ast_expr_program_run(struct expr_program *program, struct ast_channel *chan)
+{
+	struct val *small_stack[16];
+	struct val **stack = small_stack;
+	struct val *result = NULL;
+	struct expr_node *arglist, *x;
+	int sp = 0;
+	int i, j;
+
+	if (program->max_depth > (int) (sizeof(small_stack) / sizeof(small_stack[0]))
+		&& !(stack = malloc(program->max_depth * sizeof(*stack)))) {
+		ast_log(LOG_WARNING, "malloc() failed\n");
+		return NULL;
+	}
+
+	for (i = 0; i < program->count; i++) {
+		struct expr_insn *insn = &program->insns[i];
+
+		switch (insn->op) {
+		case EXPR_OP_PUSH:
+			if (!(stack[sp] = copy_value(insn->val))) {
+				goto cleanup;
+			}
+			sp++;
+			continue;
+		case EXPR_OP_FUNC:
+			arglist = NULL;
+			for (j = 0; j < insn->argc; j++) {
+				if (!(x = alloc_expr_node(AST_EXPR_NODE_VAL))) {
+					destroy_arglist(arglist);
+					goto cleanup;
+				}
+				/* the last argument is on the top of the stack */
+				x->val = stack[--sp];
+				x->right = arglist;
+				arglist = x;
+			}
+			stack[sp] = op_func(insn->val, arglist, chan);
+			destroy_arglist(arglist);
+			break;
+		case EXPR_OP_NEGATE:
+			sp--;
+			stack[sp] = op_negate(stack[sp]);
+			break;
+		case EXPR_OP_COMPL:
+			sp--;
+			stack[sp] = op_compl(stack[sp]);
+			break;
+		case EXPR_OP_COND:
+			sp -= 3;
+			stack[sp] = op_cond(stack[sp], stack[sp + 1], stack[sp + 2]);
+			break;
+		default:
+			sp -= 2;
+			switch (insn->op) {
+			case EXPR_OP_OR: stack[sp] = op_or(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_AND: stack[sp] = op_and(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_EQ: stack[sp] = op_eq(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_GT: stack[sp] = op_gt(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_LT: stack[sp] = op_lt(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_GE: stack[sp] = op_ge(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_LE: stack[sp] = op_le(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_NE: stack[sp] = op_ne(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_PLUS: stack[sp] = op_plus(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_MINUS: stack[sp] = op_minus(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_TIMES: stack[sp] = op_times(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_DIV: stack[sp] = op_div(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_REM: stack[sp] = op_rem(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_COLON: stack[sp] = op_colon(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_EQTILDE: stack[sp] = op_eqtilde(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_TILDETILDE: stack[sp] = op_tildetilde(stack[sp], stack[sp + 1]); break;
+			default: stack[sp] = NULL; break;
+			}
+			break;
+		}
+		/* the operators free the values they are given */
+		if (!stack[sp]) {
+			goto cleanup;
+		}
+		sp++;
+	}
+
+	if (sp) {
+		result = stack[--sp];
+	}
+
+cleanup:
+	while (sp) {
+		free_value(stack[--sp]);
+	}
+	if (stack != small_stack) {
+		free(stack);
+	}
+	return result;
+}
+
 #if !defined(STANDALONE) && !defined(STANDALONE2)
 static char *compose_func_args(struct expr_node *arglist)
 {
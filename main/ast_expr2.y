@@ -269,12 +269,43 @@ struct expr_node
 
 typedef void *yyscan_t;
 
+enum expr_opcode {
+	EXPR_OP_PUSH, EXPR_OP_FUNC, EXPR_OP_OR, EXPR_OP_AND, EXPR_OP_EQ, EXPR_OP_GT,
+	EXPR_OP_LT, EXPR_OP_GE, EXPR_OP_LE, EXPR_OP_NE, EXPR_OP_PLUS, EXPR_OP_MINUS,
+	EXPR_OP_NEGATE, EXPR_OP_COMPL, EXPR_OP_TIMES, EXPR_OP_DIV, EXPR_OP_REM,
+	EXPR_OP_COLON, EXPR_OP_EQTILDE, EXPR_OP_COND, EXPR_OP_TILDETILDE
+} ;
+
+/*! One step of a compiled expression, run on a stack of values */
+struct expr_insn
+{
+	enum expr_opcode op;
+	/*! How many values the step takes off the stack */
+	int argc;
+	/*! The value pushed, or the name of the function called */
+	struct val *val;
+};
+
+/*! An expression parsed once, to be run any number of times */
+struct expr_program
+{
+	struct expr_insn *insns;
+	int count;
+	int size;
+	/*! Values on the stack after the last step, and the most there ever are */
+	int depth;
+	int max_depth;
+	/*! Set if a step could not be added */
+	int failed;
+};
+
 struct parse_io
 {
 	char *string;
 	struct val *val;
 	yyscan_t scanner;
 	struct ast_channel *chan;
+	struct expr_program *program;
 };
  
 static int		chk_div __P((FP___TYPE, FP___TYPE));
@@ -310,6 +341,12 @@ static int		to_number __P((struct val *));
 static void		to_string __P((struct val *));
 static struct expr_node *alloc_expr_node(enum node_type);
 static void destroy_arglist(struct expr_node *arglist);
+static struct val *emit_value(struct parse_io *io, struct val *vp);
+static struct val *emit_op(struct parse_io *io, enum expr_opcode op, int argc);
+static struct val *emit_func(struct parse_io *io, struct val *funcname, struct expr_node *arglist);
+struct expr_program *ast_expr_program_alloc(void);
+void ast_expr_program_free(struct expr_program *program);
+struct val *ast_expr_program_run(struct expr_program *program, struct ast_channel *chan);
 
 /* uh, if I want to predeclare yylex with a YYLTYPE, I have to predeclare the yyltype... sigh */
 typedef struct yyltype
@@ -366,23 +403,19 @@ extern int		ast_yylex __P((YYSTYPE *, YYLTYPE *, yyscan_t));
 %type <arglist> arglist
 %type <val> start expr
 
-%destructor {  free_value($$); }  expr TOKEN TOK_COND TOK_COLONCOLON TOK_OR TOK_AND TOK_EQ 
+%destructor {  free_value($$); }  TOKEN TOK_COND TOK_COLONCOLON TOK_OR TOK_AND TOK_EQ 
                                  TOK_GT TOK_LT TOK_GE TOK_LE TOK_NE TOK_PLUS TOK_MINUS TOK_MULT TOK_DIV TOK_MOD TOK_COMPL TOK_COLON TOK_EQTILDE 
                                  TOK_RP TOK_LP TOK_TILDETILDE
 
 %%
 
-start: expr { ((struct parse_io *)parseio)->val = (struct val *)calloc(sizeof(struct val),1);
-              ((struct parse_io *)parseio)->val->type = $1->type;
-              if( $1->type == AST_EXPR_number )
-				  ((struct parse_io *)parseio)->val->u.i = $1->u.i;
-              else
-				  ((struct parse_io *)parseio)->val->u.s = $1->u.s; 
-			  free($1);
+start: expr { /* the program leaves the value of the expression on the stack */
+              if (((struct parse_io *)parseio)->program->failed)
+				  YYABORT;
 			}
-	| {/* nothing */ ((struct parse_io *)parseio)->val = (struct val *)calloc(sizeof(struct val),1);
-              ((struct parse_io *)parseio)->val->type = AST_EXPR_string;
-			  ((struct parse_io *)parseio)->val->u.s = strdup(""); 
+	| {/* nothing */ emit_value((struct parse_io *)parseio, make_str(""));
+              if (((struct parse_io *)parseio)->program->failed)
+				  YYABORT;
 			}
 
 	;
@@ -399,95 +432,93 @@ arglist: expr { $$ = alloc_expr_node(AST_EXPR_NODE_VAL); $$->val = $1;}
 								 DESTROY($2);
                                  for (t=$1;t->right;t=t->right)
 						         	  ;
-                                 $$ = $1; t->right = x; x->val = make_str("");}
+                                 $$ = $1; t->right = x; emit_value((struct parse_io *)parseio, make_str(""));}
        ;
 
 expr: 
-      TOKEN TOK_LP arglist TOK_RP { $$ = op_func($1,$3, ((struct parse_io *)parseio)->chan);
+      TOKEN TOK_LP arglist TOK_RP { $$ = emit_func((struct parse_io *)parseio, $1, $3);
 		                            DESTROY($2);
 									DESTROY($4);
-									DESTROY($1);
-									destroy_arglist($3);
                                   }
-    | TOKEN {$$ = $1;}
+    | TOKEN {$$ = emit_value((struct parse_io *)parseio, $1);}
 	| TOK_LP expr TOK_RP { $$ = $2;
 	                       @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 						   @$.first_line=0; @$.last_line=0;
 							DESTROY($1); DESTROY($3); }
-	| expr TOK_OR expr { $$ = op_or ($1, $3);
+	| expr TOK_OR expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_OR, 2);
 						DESTROY($2);	
                          @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 						 @$.first_line=0; @$.last_line=0;}
-	| expr TOK_AND expr { $$ = op_and ($1, $3); 
+	| expr TOK_AND expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_AND, 2); 
 						DESTROY($2);	
 	                      @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
                           @$.first_line=0; @$.last_line=0;}
-	| expr TOK_EQ expr { $$ = op_eq ($1, $3);
+	| expr TOK_EQ expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_EQ, 2);
 						DESTROY($2);	
 	                     @$.first_column = @1.first_column; @$.last_column = @3.last_column;
 						 @$.first_line=0; @$.last_line=0;}
-	| expr TOK_GT expr { $$ = op_gt ($1, $3);
+	| expr TOK_GT expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_GT, 2);
 						DESTROY($2);	
                          @$.first_column = @1.first_column; @$.last_column = @3.last_column;
 						 @$.first_line=0; @$.last_line=0;}
-	| expr TOK_LT expr { $$ = op_lt ($1, $3); 
+	| expr TOK_LT expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_LT, 2); 
 						DESTROY($2);	
 	                     @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 						 @$.first_line=0; @$.last_line=0;}
-	| expr TOK_GE expr  { $$ = op_ge ($1, $3); 
+	| expr TOK_GE expr  { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_GE, 2); 
 						DESTROY($2);	
 	                      @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 						  @$.first_line=0; @$.last_line=0;}
-	| expr TOK_LE expr  { $$ = op_le ($1, $3); 
+	| expr TOK_LE expr  { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_LE, 2); 
 						DESTROY($2);	
 	                      @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 						  @$.first_line=0; @$.last_line=0;}
-	| expr TOK_NE expr  { $$ = op_ne ($1, $3); 
+	| expr TOK_NE expr  { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_NE, 2); 
 						DESTROY($2);	
 	                      @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 						  @$.first_line=0; @$.last_line=0;}
-	| expr TOK_PLUS expr { $$ = op_plus ($1, $3); 
+	| expr TOK_PLUS expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_PLUS, 2); 
 						DESTROY($2);	
 	                       @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 						   @$.first_line=0; @$.last_line=0;}
-	| expr TOK_MINUS expr { $$ = op_minus ($1, $3); 
+	| expr TOK_MINUS expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_MINUS, 2); 
 						DESTROY($2);	
 	                        @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 							@$.first_line=0; @$.last_line=0;}
-	| TOK_MINUS expr %prec TOK_COMPL { $$ = op_negate ($2); 
+	| TOK_MINUS expr %prec TOK_COMPL { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_NEGATE, 1); 
 						DESTROY($1);	
 	                        @$.first_column = @1.first_column; @$.last_column = @2.last_column; 
 							@$.first_line=0; @$.last_line=0;}
-	| TOK_COMPL expr   { $$ = op_compl ($2); 
+	| TOK_COMPL expr   { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_COMPL, 1); 
 						DESTROY($1);	
 	                        @$.first_column = @1.first_column; @$.last_column = @2.last_column; 
 							@$.first_line=0; @$.last_line=0;}
-	| expr TOK_MULT expr { $$ = op_times ($1, $3); 
+	| expr TOK_MULT expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_TIMES, 2); 
 						DESTROY($2);	
 	                       @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 						   @$.first_line=0; @$.last_line=0;}
-	| expr TOK_DIV expr { $$ = op_div ($1, $3); 
+	| expr TOK_DIV expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_DIV, 2); 
 						DESTROY($2);	
 	                      @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 						  @$.first_line=0; @$.last_line=0;}
-	| expr TOK_MOD expr { $$ = op_rem ($1, $3); 
+	| expr TOK_MOD expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_REM, 2); 
 						DESTROY($2);	
 	                      @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 						  @$.first_line=0; @$.last_line=0;}
-	| expr TOK_COLON expr { $$ = op_colon ($1, $3); 
+	| expr TOK_COLON expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_COLON, 2); 
 						DESTROY($2);	
 	                        @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 							@$.first_line=0; @$.last_line=0;}
-	| expr TOK_EQTILDE expr { $$ = op_eqtilde ($1, $3); 
+	| expr TOK_EQTILDE expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_EQTILDE, 2); 
 						DESTROY($2);	
 	                        @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 							@$.first_line=0; @$.last_line=0;}
-	| expr TOK_COND expr TOK_COLONCOLON expr  { $$ = op_cond ($1, $3, $5); 
+	| expr TOK_COND expr TOK_COLONCOLON expr  { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_COND, 3); 
 						DESTROY($2);	
 						DESTROY($4);	
 	                        @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 							@$.first_line=0; @$.last_line=0;}
-	| expr TOK_TILDETILDE expr { $$ = op_tildetilde ($1, $3); 
+	| expr TOK_TILDETILDE expr { $$ = emit_op((struct parse_io *)parseio, EXPR_OP_TILDETILDE, 2); 
 						DESTROY($2);	
 	                        @$.first_column = @1.first_column; @$.last_column = @3.last_column; 
 							@$.first_line=0; @$.last_line=0;}
@@ -741,6 +772,209 @@ static void destroy_arglist(struct expr_node *arglist)
 	}
 }
 
+/* The parser does not work the expression out as it goes, but adds a step
+   to the program for each value and operator as it reduces them.  The
+   program is then run, as many times as needed, to get the value. */
+
+static int emit(struct parse_io *io, enum expr_opcode op, int argc, struct val *vp)
+{
+	struct expr_program *program = io->program;
+	struct expr_insn *insn;
+
+	if (program->failed) {
+		return -1;
+	}
+	if (program->count == program->size) {
+		int size = program->size ? program->size * 2 : 8;
+		struct expr_insn *insns = realloc(program->insns, size * sizeof(*insns));
+
+		if (!insns) {
+			ast_log(LOG_WARNING, "realloc() failed\n");
+			program->failed = 1;
+			return -1;
+		}
+		program->insns = insns;
+		program->size = size;
+	}
+	insn = &program->insns[program->count++];
+	insn->op = op;
+	insn->argc = argc;
+	insn->val = vp;
+
+	program->depth += 1 - argc;
+	if (program->depth > program->max_depth) {
+		program->max_depth = program->depth;
+	}
+	return 0;
+}
+
+static struct val *emit_value(struct parse_io *io, struct val *vp)
+{
+	if (!vp) {
+		io->program->failed = 1;
+	} else if (emit(io, EXPR_OP_PUSH, 0, vp)) {
+		free_value(vp);
+	}
+	return NULL;
+}
+
+static struct val *emit_op(struct parse_io *io, enum expr_opcode op, int argc)
+{
+	emit(io, op, argc, NULL);
+	return NULL;
+}
+
+static struct val *emit_func(struct parse_io *io, struct val *funcname, struct expr_node *arglist)
+{
+	struct expr_node *t;
+	int argc = 0;
+
+	/* the values of the arguments are already on the stack */
+	for (t = arglist; t; t = t->right) {
+		argc++;
+	}
+	destroy_arglist(arglist);
+
+	if (emit(io, EXPR_OP_FUNC, argc, funcname)) {
+		free_value(funcname);
+	}
+	return NULL;
+}
+
+struct expr_program *ast_expr_program_alloc(void)
+{
+	return calloc(1, sizeof(struct expr_program));
+}
+
+void ast_expr_program_free(struct expr_program *program)
+{
+	int i;
+
+	if (!program) {
+		return;
+	}
+	for (i = 0; i < program->count; i++) {
+		free_value(program->insns[i].val);
+	}
+	free(program->insns);
+	free(program);
+}
+
+static struct val *copy_value(struct val *vp)
+{
+	struct val *copy = malloc(sizeof(*copy));
+
+	if (!copy) {
+		ast_log(LOG_WARNING, "malloc() failed\n");
+		return NULL;
+	}
+	copy->type = vp->type;
+	if (vp->type == AST_EXPR_number) {
+		copy->u.i = vp->u.i;
+	} else if (!(copy->u.s = strdup(vp->u.s))) {
+		ast_log(LOG_WARNING, "malloc() failed\n");
+		free(copy);
+		return NULL;
+	}
+	return copy;
+}
+
+struct val *ast_expr_program_run(struct expr_program *program, struct ast_channel *chan)
+{
+	struct val *small_stack[16];
+	struct val **stack = small_stack;
+	struct val *result = NULL;
+	struct expr_node *arglist, *x;
+	int sp = 0;
+	int i, j;
+
+	if (program->max_depth > (int) (sizeof(small_stack) / sizeof(small_stack[0]))
+		&& !(stack = malloc(program->max_depth * sizeof(*stack)))) {
+		ast_log(LOG_WARNING, "malloc() failed\n");
+		return NULL;
+	}
+
+	for (i = 0; i < program->count; i++) {
+		struct expr_insn *insn = &program->insns[i];
+
+		switch (insn->op) {
+		case EXPR_OP_PUSH:
+			if (!(stack[sp] = copy_value(insn->val))) {
+				goto cleanup;
+			}
+			sp++;
+			continue;
+		case EXPR_OP_FUNC:
+			arglist = NULL;
+			for (j = 0; j < insn->argc; j++) {
+				if (!(x = alloc_expr_node(AST_EXPR_NODE_VAL))) {
+					destroy_arglist(arglist);
+					goto cleanup;
+				}
+				/* the last argument is on the top of the stack */
+				x->val = stack[--sp];
+				x->right = arglist;
+				arglist = x;
+			}
+			stack[sp] = op_func(insn->val, arglist, chan);
+			destroy_arglist(arglist);
+			break;
+		case EXPR_OP_NEGATE:
+			sp--;
+			stack[sp] = op_negate(stack[sp]);
+			break;
+		case EXPR_OP_COMPL:
+			sp--;
+			stack[sp] = op_compl(stack[sp]);
+			break;
+		case EXPR_OP_COND:
+			sp -= 3;
+			stack[sp] = op_cond(stack[sp], stack[sp + 1], stack[sp + 2]);
+			break;
+		default:
+			sp -= 2;
+			switch (insn->op) {
+			case EXPR_OP_OR: stack[sp] = op_or(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_AND: stack[sp] = op_and(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_EQ: stack[sp] = op_eq(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_GT: stack[sp] = op_gt(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_LT: stack[sp] = op_lt(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_GE: stack[sp] = op_ge(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_LE: stack[sp] = op_le(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_NE: stack[sp] = op_ne(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_PLUS: stack[sp] = op_plus(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_MINUS: stack[sp] = op_minus(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_TIMES: stack[sp] = op_times(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_DIV: stack[sp] = op_div(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_REM: stack[sp] = op_rem(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_COLON: stack[sp] = op_colon(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_EQTILDE: stack[sp] = op_eqtilde(stack[sp], stack[sp + 1]); break;
+			case EXPR_OP_TILDETILDE: stack[sp] = op_tildetilde(stack[sp], stack[sp + 1]); break;
+			default: stack[sp] = NULL; break;
+			}
+			break;
+		}
+		/* the operators free the values they are given */
+		if (!stack[sp]) {
+			goto cleanup;
+		}
+		sp++;
+	}
+
+	if (sp) {
+		result = stack[--sp];
+	}
+
+cleanup:
+	while (sp) {
+		free_value(stack[--sp]);
+	}
+	if (stack != small_stack) {
+		free(stack);
+	}
+	return result;
+}
+
 #if !defined(STANDALONE) && !defined(STANDALONE2)
 static char *compose_func_args(struct expr_node *arglist)
 {
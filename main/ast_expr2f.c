@@ -557,6 +557,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #ifndef STANDALONE
 #include "asterisk/strings.h"
 #include "asterisk/channel.h"
+#include "asterisk/threadstorage.h"
 #endif
 
 /* Conditionally redefine the macro from flex 2.5.35, in case someone uses flex <2.5.35 to regenerate this file. */
@@ -596,12 +597,15 @@ struct val {
 	yylval_param->val->u.s = strdup(yytext);	\
 	} while (0)
 
+struct expr_program;
+
 struct parse_io
 {
 	char *string;
 	struct val *val;
 	yyscan_t scanner;
 	struct ast_channel *chan;
+	struct expr_program *program;
 };
  
 void ast_yyset_column(int column_no, yyscan_t yyscanner);
@@ -609,7 +613,7 @@ int ast_yyget_column(yyscan_t yyscanner);
 static int curlycount = 0;
 static char *expr2_token_subst(const char *mess);
 
-#line 611 "ast_expr2f.c"
+#line 615 "ast_expr2f.c"
 
 #define INITIAL 0
 #define var 1
@@ -857,10 +861,10 @@ YY_DECL
 	register int yy_act;
     struct yyguts_t * yyg = (struct yyguts_t*)yyscanner;
 
-#line 130 "ast_expr2.fl"
+#line 134 "ast_expr2.fl"
 
 
-#line 862 "ast_expr2f.c"
+#line 866 "ast_expr2f.c"
 
     yylval = yylval_param;
 
@@ -951,132 +955,132 @@ do_action:	/* This label is used only to access EOF actions. */
 
 case 1:
 YY_RULE_SETUP
-#line 132 "ast_expr2.fl"
+#line 136 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_OR;}
 	YY_BREAK
 case 2:
 YY_RULE_SETUP
-#line 133 "ast_expr2.fl"
+#line 137 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_AND;}
 	YY_BREAK
 case 3:
 YY_RULE_SETUP
-#line 134 "ast_expr2.fl"
+#line 138 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_EQ;}
 	YY_BREAK
 case 4:
 YY_RULE_SETUP
-#line 135 "ast_expr2.fl"
+#line 139 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_OR;}
 	YY_BREAK
 case 5:
 YY_RULE_SETUP
-#line 136 "ast_expr2.fl"
+#line 140 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_AND;}
 	YY_BREAK
 case 6:
 YY_RULE_SETUP
-#line 137 "ast_expr2.fl"
+#line 141 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_EQ;}
 	YY_BREAK
 case 7:
 YY_RULE_SETUP
-#line 138 "ast_expr2.fl"
+#line 142 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_EQTILDE;}
 	YY_BREAK
 case 8:
 YY_RULE_SETUP
-#line 139 "ast_expr2.fl"
+#line 143 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_TILDETILDE;}
 	YY_BREAK
 case 9:
 YY_RULE_SETUP
-#line 140 "ast_expr2.fl"
+#line 144 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_GT;}
 	YY_BREAK
 case 10:
 YY_RULE_SETUP
-#line 141 "ast_expr2.fl"
+#line 145 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_LT;}
 	YY_BREAK
 case 11:
 YY_RULE_SETUP
-#line 142 "ast_expr2.fl"
+#line 146 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_GE;}
 	YY_BREAK
 case 12:
 YY_RULE_SETUP
-#line 143 "ast_expr2.fl"
+#line 147 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_LE;}
 	YY_BREAK
 case 13:
 YY_RULE_SETUP
-#line 144 "ast_expr2.fl"
+#line 148 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_NE;}
 	YY_BREAK
 case 14:
 YY_RULE_SETUP
-#line 145 "ast_expr2.fl"
+#line 149 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_PLUS;}
 	YY_BREAK
 case 15:
 YY_RULE_SETUP
-#line 146 "ast_expr2.fl"
+#line 150 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_COMMA;}
 	YY_BREAK
 case 16:
 YY_RULE_SETUP
-#line 147 "ast_expr2.fl"
+#line 151 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_MINUS;}
 	YY_BREAK
 case 17:
 YY_RULE_SETUP
-#line 148 "ast_expr2.fl"
+#line 152 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_MULT;}
 	YY_BREAK
 case 18:
 YY_RULE_SETUP
-#line 149 "ast_expr2.fl"
+#line 153 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_DIV;}
 	YY_BREAK
 case 19:
 YY_RULE_SETUP
-#line 150 "ast_expr2.fl"
+#line 154 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_MOD;}
 	YY_BREAK
 case 20:
 YY_RULE_SETUP
-#line 151 "ast_expr2.fl"
+#line 155 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_COND;}
 	YY_BREAK
 case 21:
 YY_RULE_SETUP
-#line 152 "ast_expr2.fl"
+#line 156 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_COMPL;}
 	YY_BREAK
 case 22:
 YY_RULE_SETUP
-#line 153 "ast_expr2.fl"
+#line 157 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_COLON;}
 	YY_BREAK
 case 23:
 YY_RULE_SETUP
-#line 154 "ast_expr2.fl"
+#line 158 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_COLONCOLON;}
 	YY_BREAK
 case 24:
 YY_RULE_SETUP
-#line 155 "ast_expr2.fl"
+#line 159 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_LP;}
 	YY_BREAK
 case 25:
 YY_RULE_SETUP
-#line 156 "ast_expr2.fl"
+#line 160 "ast_expr2.fl"
 { SET_COLUMNS; SET_STRING; return TOK_RP;}
 	YY_BREAK
 case 26:
 YY_RULE_SETUP
-#line 157 "ast_expr2.fl"
+#line 161 "ast_expr2.fl"
 {
 		/* gather the contents of ${} expressions, with trailing stuff,
 		 * into a single TOKEN.
@@ -1089,24 +1093,24 @@ YY_RULE_SETUP
 	YY_BREAK
 case 27:
 YY_RULE_SETUP
-#line 167 "ast_expr2.fl"
+#line 171 "ast_expr2.fl"
 {}
 	YY_BREAK
 case 28:
 /* rule 28 can match eol */
 YY_RULE_SETUP
-#line 168 "ast_expr2.fl"
+#line 172 "ast_expr2.fl"
 {SET_COLUMNS; SET_STRING; return TOKEN;}
 	YY_BREAK
 case 29:
 /* rule 29 can match eol */
 YY_RULE_SETUP
-#line 170 "ast_expr2.fl"
+#line 174 "ast_expr2.fl"
 {/* what to do with eol */}
 	YY_BREAK
 case 30:
 YY_RULE_SETUP
-#line 171 "ast_expr2.fl"
+#line 175 "ast_expr2.fl"
 {
 		SET_COLUMNS;
 		/* the original behavior of the expression parser was
@@ -1119,7 +1123,7 @@ YY_RULE_SETUP
 case 31:
 /* rule 31 can match eol */
 YY_RULE_SETUP
-#line 180 "ast_expr2.fl"
+#line 184 "ast_expr2.fl"
 {
 		SET_COLUMNS;
 		SET_STRING;
@@ -1129,7 +1133,7 @@ YY_RULE_SETUP
 case 32:
 /* rule 32 can match eol */
 YY_RULE_SETUP
-#line 186 "ast_expr2.fl"
+#line 190 "ast_expr2.fl"
 {
 		curlycount = 0;
 		BEGIN(var);
@@ -1139,7 +1143,7 @@ YY_RULE_SETUP
 case 33:
 /* rule 33 can match eol */
 YY_RULE_SETUP
-#line 192 "ast_expr2.fl"
+#line 196 "ast_expr2.fl"
 {
 		curlycount--;
 		if (curlycount < 0) {
@@ -1153,7 +1157,7 @@ YY_RULE_SETUP
 case 34:
 /* rule 34 can match eol */
 YY_RULE_SETUP
-#line 202 "ast_expr2.fl"
+#line 206 "ast_expr2.fl"
 {
 		curlycount++;
 		yymore();
@@ -1161,7 +1165,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 35:
 YY_RULE_SETUP
-#line 208 "ast_expr2.fl"
+#line 212 "ast_expr2.fl"
 {
 		BEGIN(0);
 		SET_COLUMNS;
@@ -1171,7 +1175,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 36:
 YY_RULE_SETUP
-#line 215 "ast_expr2.fl"
+#line 219 "ast_expr2.fl"
 {
 		curlycount = 0;
 		BEGIN(var);
@@ -1181,7 +1185,7 @@ YY_RULE_SETUP
 case 37:
 /* rule 37 can match eol */
 YY_RULE_SETUP
-#line 221 "ast_expr2.fl"
+#line 225 "ast_expr2.fl"
 {
 		char c = yytext[yyleng-1];
 		BEGIN(0);
@@ -1192,7 +1196,7 @@ YY_RULE_SETUP
 	}
 	YY_BREAK
 case YY_STATE_EOF(trail):
-#line 230 "ast_expr2.fl"
+#line 234 "ast_expr2.fl"
 {
 		BEGIN(0);
 		SET_COLUMNS;
@@ -1203,10 +1207,10 @@ case YY_STATE_EOF(trail):
 	YY_BREAK
 case 38:
 YY_RULE_SETUP
-#line 238 "ast_expr2.fl"
+#line 242 "ast_expr2.fl"
 ECHO;
 	YY_BREAK
-#line 1208 "ast_expr2f.c"
+#line 1212 "ast_expr2f.c"
 case YY_STATE_EOF(INITIAL):
 case YY_STATE_EOF(var):
 	yyterminate();
@@ -2382,7 +2386,7 @@ void *ast_yyrealloc  (void * ptr, yy_size_t  size , yyscan_t yyscanner)
 
 #define YYTABLES_NAME "yytables"
 
-#line 238 "ast_expr2.fl"
+#line 242 "ast_expr2.fl"
 
 
 
@@ -2394,6 +2398,9 @@ void *ast_yyrealloc  (void * ptr, yy_size_t  size , yyscan_t yyscanner)
 
 int ast_yyparse(void *); /* need to/should define this prototype for the call to yyparse */
 int ast_yyerror(const char *, YYLTYPE *, struct parse_io *); /* likewise */
+struct expr_program *ast_expr_program_alloc(void);
+void ast_expr_program_free(struct expr_program *program);
+struct val *ast_expr_program_run(struct expr_program *program, struct ast_channel *chan);
 
 void ast_yyfree(void *ptr, yyscan_t yyscanner)
 {
@@ -2403,43 +2410,159 @@ void ast_yyfree(void *ptr, yyscan_t yyscanner)
 	free( (char *) ptr );
 }
 
-int ast_expr(char *expr, char *buf, int length, struct ast_channel *chan)
+/*! \brief Parse an expression into a program that works out its value */
+static struct expr_program *expr_compile(char *expr)
 {
-	struct parse_io io = { .string = expr, .chan = chan };
-	int return_value = 0;
+	struct parse_io io = { .string = expr };
+
+	if (!(io.program = ast_expr_program_alloc())) {
+		return NULL;
+	}
 
 	ast_yylex_init(&io.scanner);
 
 	ast_yy_scan_string(expr, io.scanner);
 
-	ast_yyparse ((void *) &io);
+	if (ast_yyparse ((void *) &io)) {
+		ast_expr_program_free(io.program);
+		io.program = NULL;
+	}
 
 	ast_yylex_destroy(io.scanner);
 
-	if (!io.val) {
+	return io.program;
+}
+
+#ifndef STANDALONE
+/*! Number of expressions each thread keeps compiled */
+#define EXPR_CACHE_SIZE 16
+
+struct expr_cache_entry {
+	unsigned int hash;
+	char *string;
+	struct expr_program *program;
+};
+
+/*! \brief The expressions a thread compiled last */
+struct expr_cache {
+	struct expr_cache_entry entries[EXPR_CACHE_SIZE];
+	/*! The entry replaced next */
+	int next;
+};
+
+static void expr_cache_destroy(void *data)
+{
+	struct expr_cache *cache = data;
+	int i;
+
+	for (i = 0; i < EXPR_CACHE_SIZE; i++) {
+		free(cache->entries[i].string);
+		ast_expr_program_free(cache->entries[i].program);
+	}
+	ast_free(cache);
+}
+
+AST_THREADSTORAGE_CUSTOM(expr_cache_buf, NULL, expr_cache_destroy);
+
+static void expr_cache_put(struct expr_cache *cache, int i, unsigned int hash, char *string, struct expr_program *program)
+{
+	struct expr_cache_entry *entry;
+
+	if (i < 0 || cache->entries[i].program) {
+		i = cache->next;
+		cache->next = (i + 1) % EXPR_CACHE_SIZE;
+	}
+	entry = &cache->entries[i];
+	free(entry->string);
+	ast_expr_program_free(entry->program);
+	entry->hash = hash;
+	entry->string = string;
+	entry->program = program;
+}
+#endif
+
+/*!
+ * \brief Work out the value of an expression
+ *
+ * \note The last few expressions each thread parsed are kept compiled, so
+ * that evaluating the same expression again only has to run its program.
+ */
+static struct val *expr_evaluate(char *expr, struct ast_channel *chan)
+{
+	struct expr_program *program = NULL;
+	struct val *val;
+#ifndef STANDALONE
+	struct expr_cache *cache = ast_threadstorage_get(&expr_cache_buf, sizeof(*cache));
+	unsigned int hash = ast_str_hash(expr);
+	char *string = NULL;
+	int i = -1;
+
+	if (cache) {
+		for (i = 0; i < EXPR_CACHE_SIZE; i++) {
+			struct expr_cache_entry *entry = &cache->entries[i];
+
+			if (entry->program && entry->hash == hash && !strcmp(entry->string, expr)) {
+				/* Take it out while it runs, in case a function it calls
+				 * evaluates expressions of its own. */
+				string = entry->string;
+				program = entry->program;
+				entry->string = NULL;
+				entry->program = NULL;
+				break;
+			}
+		}
+		if (!program) {
+			i = -1;
+		}
+	}
+#endif
+
+	if (!program && !(program = expr_compile(expr))) {
+		return NULL;
+	}
+
+	val = ast_expr_program_run(program, chan);
+
+#ifndef STANDALONE
+	if (cache && (string || (string = strdup(expr)))) {
+		expr_cache_put(cache, i, hash, string, program);
+		return val;
+	}
+#endif
+	ast_expr_program_free(program);
+
+	return val;
+}
+
+int ast_expr(char *expr, char *buf, int length, struct ast_channel *chan)
+{
+	struct val *val = expr_evaluate(expr, chan);
+	int return_value = 0;
+
+	if (!val) {
 		if (length > 1) {
 			strcpy(buf, "0");
 			return_value = 1;
 		}
 	} else {
-		if (io.val->type == AST_EXPR_number) {
+		if (val->type == AST_EXPR_number) {
 			int res_length;
 
-			res_length = snprintf(buf, length, FP___PRINTF, io.val->u.i);
+			res_length = snprintf(buf, length, FP___PRINTF, val->u.i);
 			return_value = (res_length <= length) ? res_length : length;
 		} else {
-			if (io.val->u.s)
+			if (val->u.s)
 #if defined(STANDALONE) || defined(LOW_MEMORY) || defined(STANDALONE)
-				strncpy(buf, io.val->u.s, length - 1);
+				strncpy(buf, val->u.s, length - 1);
 #else /* !STANDALONE && !LOW_MEMORY */
-				ast_copy_string(buf, io.val->u.s, length);
+				ast_copy_string(buf, val->u.s, length);
 #endif /* STANDALONE || LOW_MEMORY */
 			else
 				buf[0] = 0;
 			return_value = strlen(buf);
-			free(io.val->u.s);
+			free(val->u.s);
 		}
-		free(io.val);
+		free(val);
 	}
 	return return_value;
 }
@@ -2447,29 +2570,23 @@ int ast_expr(char *expr, char *buf, int length, struct ast_channel *chan)
 #ifndef STANDALONE
 int ast_str_expr(struct ast_str **str, ssize_t maxlen, struct ast_channel *chan, char *expr)
 {
-	struct parse_io io = { .string = expr, .chan = chan };
-
-	ast_yylex_init(&io.scanner);
-	ast_yy_scan_string(expr, io.scanner);
-	ast_yyparse ((void *) &io);
-	ast_yylex_destroy(io.scanner);
+	struct val *val = expr_evaluate(expr, chan);
 
-	if (!io.val) {
+	if (!val) {
 		ast_str_set(str, maxlen, "0");
 	} else {
-		if (io.val->type == AST_EXPR_number) {
-			ast_str_set(str, maxlen, FP___PRINTF, io.val->u.i);
-		} else if (io.val->u.s) {
-			ast_str_set(str, maxlen, "%s", io.val->u.s);
-			free(io.val->u.s);
+		if (val->type == AST_EXPR_number) {
+			ast_str_set(str, maxlen, FP___PRINTF, val->u.i);
+		} else if (val->u.s) {
+			ast_str_set(str, maxlen, "%s", val->u.s);
+			free(val->u.s);
 		}
-		free(io.val);
+		free(val);
 	}
 	return ast_str_strlen(*str);
 }
 #endif
 
-
 char extra_error_message[4095];
 int extra_error_message_supplied = 0;
 void  ast_expr_register_extra_error_info(char *message);
@@ -240,6 +240,7 @@ int daemon(int, int);  /* defined in libresolv of all places */
 #include "asterisk/uuid.h"
 #include "asterisk/sorcery.h"
 #include "asterisk/bucket.h"
+#include "asterisk/media_cache.h"
 #include "asterisk/stasis.h"
 #include "asterisk/json.h"
 #include "asterisk/stasis_endpoints.h"
@@ -329,6 +330,9 @@ int ast_pjproject_max_log_level = -1;/* Default to -1 to know if we have read th
 int ast_option_pjproject_log_level;
 double ast_option_maxload;			/*!< Max load avg on system */
 int ast_option_maxcalls;			/*!< Max number of active calls */
+int ast_option_lockfree_taskprocessors;	/*!< Use lock-free queues for serialized taskprocessors */
+int ast_option_astdb_wal;			/*!< Use the SQLite WAL journal mode for the astdb */
+int ast_option_sound_file_cache;		/*!< Share memory mappings of sound files between streams */
 int ast_option_maxfiles;			/*!< Max number of open file handles (files, sockets) */
 unsigned int option_dtmfminduration;		/*!< Minimum duration of DTMF. */
 #if defined(HAVE_SYSINFO)
@@ -346,9 +350,12 @@ char record_cache_dir[AST_CACHE_DIR_LEN] = DEFAULT_TMP_DIR;
 static int ast_socket = -1;		/*!< UNIX Socket for allowing remote control */
 static int ast_consock = -1;		/*!< UNIX Socket for controlling another asterisk */
 pid_t ast_mainpid;
+/*! \brief Most output queued for a remote console before further output is dropped */
+#define CONSOLE_QUEUE_MAX (256 * 1024)
+
 struct console {
 	int fd;				/*!< File descriptor */
-	int p[2];			/*!< Pipe */
+	int p[2];			/*!< Pipe waking up the handler for queued output */
 	pthread_t t;			/*!< Thread of handler */
 	int mute;			/*!< Is the console muted for logs */
 	int uid;			/*!< Remote user ID. */
@@ -356,6 +363,14 @@ struct console {
 	int levels[NUMLOGLEVELS];	/*!< Which log levels are enabled for the console */
 	/*! Verbosity level of this console. */
 	int option_verbose;
+	/*! Protects the queued output and the pipe */
+	ast_mutex_t lock;
+	/*! Output queued for the handler to write */
+	struct ast_str *queued;
+	/*! Messages dropped since the handler last took the queued output */
+	unsigned int dropped;
+	/*! Set while the handler has been woken up to take the queued output */
+	unsigned int wakeup:1;
 };
 
 struct ast_atexit {
@@ -1384,6 +1399,33 @@ void ast_console_toggle_mute(int fd, int silent)
 	ast_cli(fd, "Couldn't find remote console.\n");
 }
 
+/*!
+ * \brief queue the string for the handler of a network console client to write
+ *
+ * Whoever logs never waits for a slow console.  Once CONSOLE_QUEUE_MAX is
+ * queued further messages are dropped, and counted, rather than partly
+ * written like writing to the pipe would.
+ */
+static void console_queue(struct console *con, const char *string)
+{
+	size_t len = strlen(string);
+
+	ast_mutex_lock(&con->lock);
+	if (con->fd < 0 || !con->queued) {
+		ast_mutex_unlock(&con->lock);
+		return;
+	}
+
+	if (ast_str_strlen(con->queued) + len > CONSOLE_QUEUE_MAX
+		|| ast_str_append(&con->queued, 0, "%s", string) == AST_DYNSTR_BUILD_FAILED) {
+		con->dropped++;
+	} else if (!con->wakeup) {
+		con->wakeup = 1;
+		fdprint(con->p[1], "!");
+	}
+	ast_mutex_unlock(&con->lock);
+}
+
 /*!
  * \brief log the string to all attached network console clients
  */
@@ -1397,7 +1439,7 @@ static void ast_network_puts_mutable(const char *string, int level)
 			|| consoles[x].levels[level]) {
 			continue;
 		}
-		fdprint(consoles[x].p[1], string);
+		console_queue(&consoles[x], string);
 	}
 }
 
@@ -1426,7 +1468,7 @@ static void ast_network_puts(const char *string)
 		if (consoles[x].fd < 0) {
 			continue;
 		}
-		fdprint(consoles[x].p[1], string);
+		console_queue(&consoles[x], string);
 	}
 }
 
@@ -1458,7 +1500,7 @@ static void network_verboser(const char *string)
 			|| consoles[x].option_verbose < verb_level) {
 			continue;
 		}
-		fdprint(consoles[x].p[1], string);
+		console_queue(&consoles[x], string);
 	}
 }
 
@@ -1524,6 +1566,53 @@ static int read_credentials(int fd, char *buffer, size_t size, struct console *c
 }
 
 /* This is the thread running the remote console on the main process. */
+/*!
+ * \brief write the output queued for a network console client
+ *
+ * \retval -1 the client went away
+ */
+static int netconsole_write_queued(struct console *con, struct ast_str **sending)
+{
+	struct ast_str *swap;
+	unsigned int dropped;
+	char notice[80];
+	char *pos;
+	size_t left;
+	ssize_t res;
+
+	ast_mutex_lock(&con->lock);
+	swap = con->queued;
+	con->queued = *sending;
+	*sending = swap;
+	dropped = con->dropped;
+	con->dropped = 0;
+	con->wakeup = 0;
+	ast_mutex_unlock(&con->lock);
+
+	if (dropped) {
+		snprintf(notice, sizeof(notice), "*** %u message%s dropped, console is too slow ***\n",
+			dropped, ESS(dropped));
+		ast_str_append(sending, 0, "%s", notice);
+	}
+
+	pos = ast_str_buffer(*sending);
+	left = ast_str_strlen(*sending);
+	while (left) {
+		res = write(con->fd, pos, left);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res < 1) {
+			return -1;
+		}
+		pos += res;
+		left -= res;
+	}
+	ast_str_reset(*sending);
+
+	return 0;
+}
+
 static void *netconsole(void *vconsole)
 {
 	struct console *con = vconsole;
@@ -1534,6 +1623,7 @@ static void *netconsole(void *vconsole)
 	char *start_read = inbuf;
 	int res;
 	struct pollfd fds[2];
+	struct ast_str *sending = ast_str_create(4096);
 
 	if (gethostname(hostname, sizeof(hostname)-1))
 		ast_copy_string(hostname, "<Unknown>", sizeof(hostname));
@@ -1592,24 +1682,31 @@ static void *netconsole(void *vconsole)
 			start_read = end_buf - start_read + inbuf;
 		}
 		if (fds[1].revents) {
-			res = read_credentials(con->p[0], outbuf, sizeof(outbuf), con);
+			res = read(con->p[0], outbuf, sizeof(outbuf));
 			if (res < 1) {
 				ast_log(LOG_ERROR, "read returned %d\n", res);
 				break;
 			}
-			res = write(con->fd, outbuf, res);
-			if (res < 1)
+			if (!sending || netconsole_write_queued(con, &sending)) {
 				break;
+			}
 		}
 	}
 	ast_verb_console_unregister();
 	if (!ast_opt_hide_connect) {
 		ast_verb(3, "Remote UNIX connection disconnected\n");
 	}
+	ast_mutex_lock(&con->lock);
 	close(con->fd);
 	close(con->p[0]);
 	close(con->p[1]);
 	con->fd = -1;
+	ast_free(con->queued);
+	con->queued = NULL;
+	con->dropped = 0;
+	con->wakeup = 0;
+	ast_mutex_unlock(&con->lock);
+	ast_free(sending);
 
 	return NULL;
 }
@@ -1667,9 +1764,16 @@ static void *listener(void *unused)
 					consoles[x].gid = -2;
 					/* Server default of remote console verbosity level is OFF. */
 					consoles[x].option_verbose = 0;
+					ast_mutex_lock(&consoles[x].lock);
+					consoles[x].queued = ast_str_create(4096);
 					consoles[x].fd = s;
+					ast_mutex_unlock(&consoles[x].lock);
 					if (ast_pthread_create_detached_background(&consoles[x].t, NULL, netconsole, &consoles[x])) {
+						ast_mutex_lock(&consoles[x].lock);
 						consoles[x].fd = -1;
+						ast_free(consoles[x].queued);
+						consoles[x].queued = NULL;
+						ast_mutex_unlock(&consoles[x].lock);
 						ast_log(LOG_ERROR, "Unable to spawn thread to handle connection: %s\n", strerror(errno));
 						close(consoles[x].p[0]);
 						close(consoles[x].p[1]);
@@ -1699,8 +1803,10 @@ static int ast_makesocket(void)
 	uid_t uid = -1;
 	gid_t gid = -1;
 
-	for (x = 0; x < AST_MAX_CONNECTS; x++)
+	for (x = 0; x < AST_MAX_CONNECTS; x++) {
 		consoles[x].fd = -1;
+		ast_mutex_init(&consoles[x].lock);
+	}
 	unlink(ast_config_AST_SOCKET);
 	ast_socket = socket(PF_LOCAL, SOCK_STREAM, 0);
 	if (ast_socket < 0) {
@@ -3882,6 +3988,12 @@ static void ast_readconfig(void)
 			}
 		} else if (!strcasecmp(v->name, "live_dangerously")) {
 			live_dangerously = ast_true(v->value);
+		} else if (!strcasecmp(v->name, "lockfree_taskprocessors")) {
+			ast_option_lockfree_taskprocessors = ast_true(v->value);
+		} else if (!strcasecmp(v->name, "astdb_wal")) {
+			ast_option_astdb_wal = ast_true(v->value);
+		} else if (!strcasecmp(v->name, "sound_file_cache")) {
+			ast_option_sound_file_cache = ast_true(v->value);
 		}
 	}
 	if (!ast_opt_remote) {
@@ -4564,6 +4676,7 @@ static void asterisk_daemon(int isroot, const char *runuser, const char *rungrou
 
 	check_init(astobj2_init(), "AO2");
 	check_init(ast_named_locks_init(), "Named Locks");
+	check_init(ast_dns_cache_init(), "DNS Cache");
 
 	if (ast_opt_console) {
 		if (el_hist == NULL || el == NULL)
@@ -4594,11 +4707,17 @@ static void asterisk_daemon(int isroot, const char *runuser, const char *rungrou
 	ast_builtins_init();
 
 	check_init(ast_utils_init(), "Utilities");
+	check_init(ast_lock_contention_init(), "Lock Contention Profiler");
+	check_init(ast_affinity_init(), "Thread Affinity");
+	check_init(ast_slinmix_init(), "Signed Linear Mixing");
+	check_init(ast_g711_init(), "G.711 Conversion");
+	check_init(ast_frame_init(), "Frame Pool");
 	check_init(ast_tps_init(), "Task Processor Core");
 	check_init(ast_fd_init(), "File Descriptor Debugging");
 	check_init(ast_pbx_init(), "ast_pbx_init");
 #ifdef TEST_FRAMEWORK
 	check_init(ast_test_init(), "Test Framework");
+	check_init(ast_bench_init(), "Benchmark Framework");
 #endif
 	check_init(ast_translate_init(), "Translator Core");
 
@@ -4611,6 +4730,7 @@ static void asterisk_daemon(int isroot, const char *runuser, const char *rungrou
 	check_init(ast_codec_builtin_init(), "Built-in Codecs");
 	check_init(aco_init(), "Configuration Option Framework");
 	check_init(ast_bucket_init(), "Bucket API");
+	check_init(ast_media_cache_init(), "Media Cache");
 	check_init(stasis_init(), "Stasis");
 	check_init(ast_stasis_system_init(), "Stasis system-level information");
 	check_init(ast_endpoint_stasis_init(), "Stasis Endpoint");
@@ -4686,6 +4806,7 @@ static void asterisk_daemon(int isroot, const char *runuser, const char *rungrou
 	check_init(ast_local_init(), "Local Proxy Channel Driver");
 	check_init(ast_cel_engine_init(), "CEL Engine");
 	check_init(init_manager(), "Asterisk Manager Interface");
+	check_init(ast_latency_init(), "Latency Statistics");
 	check_init(ast_enum_init(), "ENUM Support");
 	check_init(ast_cc_init(), "Call Completion Supplementary Services");
 	check_init(ast_sounds_index_init(), "Sounds Indexer");
@@ -35,6 +35,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "astobj2_container_private.h"
 #include "asterisk/cli.h"
 #include "asterisk/paths.h"
+#include "asterisk/utils.h"
+#include "asterisk/vector.h"
 
 /* Use ast_log_safe in place of ast_log. */
 #define ast_log ast_log_safe
@@ -117,13 +119,13 @@ static struct astobj2 *INTERNAL_OBJ(void *user_data)
 {
 	struct astobj2 *p;
 
-	if (!user_data) {
+	if (__builtin_expect(!user_data, 0)) {
 		__ast_assert_failed(0, "user_data is NULL", __FILE__, __LINE__, __PRETTY_FUNCTION__);
 		return NULL;
 	}
 
 	p = (struct astobj2 *) ((char *) user_data - sizeof(*p));
-	if (AO2_MAGIC != p->priv_data.magic) {
+	if (__builtin_expect(AO2_MAGIC != p->priv_data.magic, 0)) {
 		char bad_magic[100];
 
 		snprintf(bad_magic, sizeof(bad_magic), "bad magic number 0x%x for object %p",
@@ -394,20 +396,131 @@ void *ao2_object_get_lockaddr(void *user_data)
 	return NULL;
 }
 
-static int internal_ao2_ref(void *user_data, int delta, const char *file, int line, const char *func)
+/*!
+ * \internal
+ * \brief Run the destructor of an object and free it.
+ *
+ * \param user_data The object whose last reference is gone.
+ */
+static void ao2_destroy(void *user_data)
 {
-	struct astobj2 *obj = INTERNAL_OBJ(user_data);
+	struct astobj2 *obj = (struct astobj2 *) ((char *) user_data - sizeof(*obj));
 	struct astobj2_lock *obj_mutex;
 	struct astobj2_rwlock *obj_rwlock;
+
+	if (obj->priv_data.destructor_fn != NULL) {
+		obj->priv_data.destructor_fn(user_data);
+	}
+
+#ifdef AO2_DEBUG
+	ast_atomic_fetchadd_int(&ao2.total_mem, - obj->priv_data.data_size);
+	ast_atomic_fetchadd_int(&ao2.total_objects, -1);
+#endif
+
+	/* In case someone uses an object after it's been freed */
+	obj->priv_data.magic = 0;
+
+	switch (obj->priv_data.options & AO2_ALLOC_OPT_LOCK_MASK) {
+	case AO2_ALLOC_OPT_LOCK_MUTEX:
+		obj_mutex = INTERNAL_OBJ_MUTEX(user_data);
+		ast_mutex_destroy(&obj_mutex->mutex.lock);
+
+		ast_free(obj_mutex);
+		break;
+	case AO2_ALLOC_OPT_LOCK_RWLOCK:
+		obj_rwlock = INTERNAL_OBJ_RWLOCK(user_data);
+		ast_rwlock_destroy(&obj_rwlock->rwlock.lock);
+
+		ast_free(obj_rwlock);
+		break;
+	case AO2_ALLOC_OPT_LOCK_NOLOCK:
+		ast_free(obj);
+		break;
+	default:
+		ast_log(LOG_ERROR, "Invalid lock option on ao2 object %p\n", user_data);
+		break;
+	}
+}
+
+/*! \brief Lock and condition of the deferred destruction queue */
+AST_MUTEX_DEFINE_STATIC(reaper_lock);
+static ast_cond_t reaper_cond;
+/*! \brief Objects waiting for the reaper thread to destroy them */
+AST_VECTOR(ao2_doomed_objs, void *);
+static struct ao2_doomed_objs reaper_queue;
+static pthread_t reaper_thread = AST_PTHREADT_NULL;
+/*! \brief Set once the reaper thread has been stopped for shutdown */
+static int reaper_stopped;
+
+static void *reaper_run(void *data)
+{
+	ast_mutex_lock(&reaper_lock);
+	for (;;) {
+		struct ao2_doomed_objs doomed;
+		size_t idx;
+
+		while (!AST_VECTOR_SIZE(&reaper_queue) && !reaper_stopped) {
+			ast_cond_wait(&reaper_cond, &reaper_lock);
+		}
+		if (!AST_VECTOR_SIZE(&reaper_queue)) {
+			break;
+		}
+
+		/* Take the whole queue so destructors run without the lock held. */
+		doomed = reaper_queue;
+		memset(&reaper_queue, 0, sizeof(reaper_queue));
+		ast_mutex_unlock(&reaper_lock);
+
+		for (idx = 0; idx < doomed.current; ++idx) {
+			ao2_destroy(doomed.elems[idx]);
+		}
+		AST_VECTOR_FREE(&doomed);
+
+		ast_mutex_lock(&reaper_lock);
+	}
+	ast_mutex_unlock(&reaper_lock);
+
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Hand an object whose last reference is gone to the reaper thread.
+ *
+ * \retval 0 the reaper thread will destroy the object.
+ * \retval -1 the caller must destroy the object itself.
+ */
+static int ao2_defer_destroy(void *user_data)
+{
+	int res = -1;
+
+	ast_mutex_lock(&reaper_lock);
+	if (!reaper_stopped) {
+		if (reaper_thread == AST_PTHREADT_NULL
+			&& ast_pthread_create_background(&reaper_thread, NULL, reaper_run, NULL)) {
+			reaper_thread = AST_PTHREADT_NULL;
+		} else if (!AST_VECTOR_APPEND(&reaper_queue, user_data)) {
+			ast_cond_signal(&reaper_cond);
+			res = 0;
+		}
+	}
+	ast_mutex_unlock(&reaper_lock);
+
+	return res;
+}
+
+static int internal_ao2_ref(void *user_data, int delta, const char *file, int line, const char *func)
+{
+	struct astobj2 *obj = INTERNAL_OBJ(user_data);
 	int current_value;
 	int ret;
 
-	if (obj == NULL) {
+	if (__builtin_expect(obj == NULL, 0)) {
 		return -1;
 	}
 
 	/* if delta is 0, just return the refcount */
-	if (delta == 0) {
+	if (__builtin_expect(delta == 0, 0)) {
 		return obj->priv_data.ref_counter;
 	}
 
@@ -419,11 +532,12 @@ static int internal_ao2_ref(void *user_data, int delta, const char *file, int li
 	ast_atomic_fetchadd_int(&ao2.total_refs, delta);
 #endif
 
-	if (0 < current_value) {
+	if (__builtin_expect(0 < current_value, 1)) {
 		/* The object still lives. */
 #define EXCESSIVE_REF_COUNT		100000
 
-		if (EXCESSIVE_REF_COUNT <= current_value && ret < EXCESSIVE_REF_COUNT) {
+		if (__builtin_expect(EXCESSIVE_REF_COUNT <= current_value, 0)
+			&& ret < EXCESSIVE_REF_COUNT) {
 			char excessive_ref_buf[100];
 
 			/* We just reached or went over the excessive ref count trigger */
@@ -447,39 +561,11 @@ static int internal_ao2_ref(void *user_data, int delta, const char *file, int li
 	}
 
 	/* last reference, destroy the object */
-	if (obj->priv_data.destructor_fn != NULL) {
-		obj->priv_data.destructor_fn(user_data);
-	}
-
-#ifdef AO2_DEBUG
-	ast_atomic_fetchadd_int(&ao2.total_mem, - obj->priv_data.data_size);
-	ast_atomic_fetchadd_int(&ao2.total_objects, -1);
-#endif
-
-	/* In case someone uses an object after it's been freed */
-	obj->priv_data.magic = 0;
-
-	switch (obj->priv_data.options & AO2_ALLOC_OPT_LOCK_MASK) {
-	case AO2_ALLOC_OPT_LOCK_MUTEX:
-		obj_mutex = INTERNAL_OBJ_MUTEX(user_data);
-		ast_mutex_destroy(&obj_mutex->mutex.lock);
-
-		ast_free(obj_mutex);
-		break;
-	case AO2_ALLOC_OPT_LOCK_RWLOCK:
-		obj_rwlock = INTERNAL_OBJ_RWLOCK(user_data);
-		ast_rwlock_destroy(&obj_rwlock->rwlock.lock);
-
-		ast_free(obj_rwlock);
-		break;
-	case AO2_ALLOC_OPT_LOCK_NOLOCK:
-		ast_free(obj);
-		break;
-	default:
-		ast_log(__LOG_ERROR, file, line, func,
-			"Invalid lock option on ao2 object %p\n", user_data);
-		break;
+	if ((obj->priv_data.options & AO2_ALLOC_OPT_DEFER_DESTROY)
+		&& !ao2_defer_destroy(user_data)) {
+		return ret;
 	}
+	ao2_destroy(user_data);
 
 	return ret;
 }
@@ -866,6 +952,18 @@ static struct ast_cli_entry cli_astobj2[] = {
 
 static void astobj2_cleanup(void)
 {
+	pthread_t thread;
+
+	/* Objects released from now on are destroyed by whoever releases them. */
+	ast_mutex_lock(&reaper_lock);
+	reaper_stopped = 1;
+	thread = reaper_thread;
+	ast_cond_signal(&reaper_cond);
+	ast_mutex_unlock(&reaper_lock);
+	if (thread != AST_PTHREADT_NULL) {
+		pthread_join(thread, NULL);
+	}
+
 #if defined(AO2_DEBUG)
 	ast_cli_unregister_multiple(cli_astobj2, ARRAY_LEN(cli_astobj2));
 #endif
@@ -892,6 +990,8 @@ int astobj2_init(void)
 		return -1;
 	}
 
+	ast_cond_init(&reaper_cond, NULL);
+
 #if defined(AO2_DEBUG)
 	ast_cli_register_multiple(cli_astobj2, ARRAY_LEN(cli_astobj2));
 #endif	/* defined(AO2_DEBUG) */
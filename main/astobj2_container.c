@@ -47,6 +47,10 @@ int __container_unlink_node_debug(struct ao2_container_node *node, uint32_t flag
 		return 0;
 	}
 
+	if (container && node->obj && container->v_table->obj_removed) {
+		container->v_table->obj_removed(container, node);
+	}
+
 	if ((flags & AO2_UNLINK_NODE_UNLINK_OBJECT)
 		&& !(flags & AO2_UNLINK_NODE_NOUNREF_OBJECT)) {
 		if (tag) {
@@ -471,6 +475,32 @@ void *__ao2_callback_data(struct ao2_container *c, enum search_flags flags,
 /*!
  * the find function just invokes the default callback with some reasonable flags.
  */
+/*!
+ * \internal
+ * \brief Determine if a find can skip locking the container.
+ *
+ * \param c Container to search.
+ * \param flags search_flags of the find.
+ *
+ * \retval non-zero if the lock free index of the container can be used.
+ */
+static int find_is_lockfree(struct ao2_container *c, enum search_flags flags)
+{
+	if (!(c->options & AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND)
+		|| !c->v_table || !c->v_table->find_lockfree
+		|| (flags & (OBJ_MULTIPLE | OBJ_UNLINK | OBJ_NODATA))) {
+		return 0;
+	}
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+	case OBJ_SEARCH_KEY:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 void *__ao2_find_debug(struct ao2_container *c, const void *arg, enum search_flags flags,
 	const char *tag, const char *file, int line, const char *func)
 {
@@ -481,6 +511,9 @@ void *__ao2_find_debug(struct ao2_container *c, const void *arg, enum search_fla
 		ast_assert(0);
 		return NULL;
 	}
+	if (find_is_lockfree(c, flags)) {
+		return c->v_table->find_lockfree(c, flags, arged, tag, file, line, func);
+	}
 	return __ao2_callback_debug(c, flags, c->cmp_fn, arged, tag, file, line, func);
 }
 
@@ -493,6 +526,9 @@ void *__ao2_find(struct ao2_container *c, const void *arg, enum search_flags fla
 		ast_assert(0);
 		return NULL;
 	}
+	if (find_is_lockfree(c, flags)) {
+		return c->v_table->find_lockfree(c, flags, arged, NULL, NULL, 0, NULL);
+	}
 	return __ao2_callback(c, flags, c->cmp_fn, arged);
 }
 
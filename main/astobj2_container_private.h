@@ -168,6 +168,34 @@ typedef struct ao2_container_node *(*ao2_container_find_next_fn)(struct ao2_cont
  */
 typedef void (*ao2_container_find_cleanup_fn)(void *v_state);
 
+/*!
+ * \brief Find an object without locking the container.
+ *
+ * \param self Container to operate upon.
+ * \param flags search_flags of the find.  (OBJ_SEARCH_OBJECT or OBJ_SEARCH_KEY)
+ * \param arg Comparison callback arg parameter.
+ * \param tag used for debugging.
+ * \param file Debug file name invoked from
+ * \param line Debug line invoked from
+ * \param func Debug function name invoked from
+ *
+ * \retval obj-ptr of found object (Reffed).
+ * \retval NULL when no object found.
+ */
+typedef void *(*ao2_container_find_lockfree_fn)(struct ao2_container *self, enum search_flags flags, void *arg, const char *tag, const char *file, int line, const char *func);
+
+/*!
+ * \brief The object of a container node is leaving the container.
+ *
+ * \param self Container to operate upon.
+ * \param node Container node still holding the object.
+ *
+ * \note The container is already write locked.
+ *
+ * \return Nothing
+ */
+typedef void (*ao2_container_node_obj_removed_fn)(struct ao2_container *self, struct ao2_container_node *node);
+
 /*!
  * \brief Find the next non-empty iteration node in the container.
  *
@@ -264,6 +292,10 @@ struct ao2_container_methods {
 	ao2_container_find_cleanup_fn traverse_cleanup;
 	/*! Find the next iteration element in the container. */
 	ao2_iterator_next_fn iterator_next;
+	/*! Find an object without locking the container. (Optional) */
+	ao2_container_find_lockfree_fn find_lockfree;
+	/*! The object of a node is leaving the container. (Optional) */
+	ao2_container_node_obj_removed_fn obj_removed;
 #if defined(AO2_DEBUG)
 	/*! Increment the container linked object statistic. */
 	ao2_link_node_stat_fn link_stat;
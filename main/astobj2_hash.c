@@ -32,6 +32,22 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/dlinkedlists.h"
 #include "asterisk/utils.h"
 
+/*!
+ * \brief Entry of the lock free find index of a bucket.
+ *
+ * \details Readers walk the entries without any lock so an entry
+ * holds its own reference to the object, and an unlinked entry is
+ * only released once no reader can still be looking at it.
+ */
+struct hash_lockfree_entry {
+	/*! Object of the entry.  (Holds a reference.) */
+	void *obj;
+	/*! Next entry in the bucket index. */
+	struct hash_lockfree_entry *next;
+	/*! Next entry waiting to be released. */
+	struct hash_lockfree_entry *retired;
+};
+
 /*!
  * A structure to create a linked list of entries,
  * used within a bucket.
@@ -46,11 +62,21 @@ struct hash_bucket_node {
 	AST_DLLIST_ENTRY(hash_bucket_node) links;
 	/*! Hash bucket holding the node. */
 	int my_bucket;
+	/*! Level of the bucket table holding the node. */
+	unsigned int my_level;
+	/*! Hash value of the node object. */
+	int my_hash;
+	/*! Lock free find index entry of the node object if any. */
+	struct hash_lockfree_entry *lockfree;
 };
 
 struct hash_bucket {
 	/*! List of objects held in the bucket. */
 	AST_DLLIST_HEAD_NOLOCK(, hash_bucket_node) list;
+	/*! Lock free find index of the bucket objects. */
+	struct hash_lockfree_entry *lockfree;
+	/*! TRUE once a resize moved the bucket objects into the next table. */
+	int migrated;
 #if defined(AO2_DEBUG)
 	/*! Number of elements currently in the bucket. */
 	int elements;
@@ -59,6 +85,27 @@ struct hash_bucket {
 #endif	/* defined(AO2_DEBUG) */
 };
 
+/*!
+ * \brief A table of hash buckets.
+ *
+ * \details Resizing a container doubles its bucket table.  Bucket b
+ * of a table is split into buckets 2b and 2b + 1 of the next one, so
+ * traversing the buckets in index order visits the objects in the
+ * same order whatever the table size.
+ */
+struct hash_table {
+	/*! Number of hash buckets in this table. */
+	int n_buckets;
+	/*! Number of times the container bucket count was doubled for this table. */
+	unsigned int level;
+	/*! Table whose buckets are being moved into this one, or NULL. */
+	struct hash_table *from;
+	/*! Next table waiting to be released. */
+	struct hash_table *retired;
+	/*! Hash bucket array of n_buckets.  Variable size. */
+	struct hash_bucket buckets[0];
+};
+
 /*!
  * A hash container in addition to values common to all
  * container types, stores the hash callback function, the
@@ -71,10 +118,28 @@ struct ao2_container_hash {
 	 */
 	struct ao2_container common;
 	ao2_hash_fn *hash_fn;
-	/*! Number of hash buckets in this container. */
+	/*! Lock free find epoch.  Retired index entries wait for it to move on. */
+	unsigned int lockfree_epoch;
+	/*! Lock free finds in progress in each epoch. */
+	int lockfree_readers[2];
+	/*! Index entries unlinked during the current epoch. */
+	struct hash_lockfree_entry *lockfree_retired_new;
+	/*! Index entries unlinked during the previous epoch. */
+	struct hash_lockfree_entry *lockfree_retired_old;
+	/*! Bucket tables replaced during the current epoch. */
+	struct hash_table *lockfree_tables_new;
+	/*! Bucket tables replaced during the previous epoch. */
+	struct hash_table *lockfree_tables_old;
+	/*! Number of hash buckets the container was created with. */
 	int n_buckets;
-	/*! Hash bucket array of n_buckets.  Variable size. */
-	struct hash_bucket buckets[0];
+	/*! Current bucket table.  The table the container was created with follows the container. */
+	struct hash_table *table;
+	/*! Next bucket of table->from to move. */
+	int resize_cursor;
+	/*! Buckets of table->from left to move. */
+	int resize_left;
+	/*! TRUE if the bucket table grows with the number of objects. */
+	unsigned int resizable:1;
 };
 
 /*! Traversal state to restart a hash container traversal. */
@@ -87,6 +152,8 @@ struct hash_traversal_state {
 	int bucket_start;
 	/*! Stopping hash bucket */
 	int bucket_last;
+	/*! Bucket table level of the search boundaries */
+	unsigned int level;
 	/*! Saved search flags to control traversing the container. */
 	enum search_flags flags;
 	/*! TRUE if it is a descending search */
@@ -147,6 +214,488 @@ static struct ao2_container *hash_ao2_alloc_empty_clone_debug(struct ao2_contain
 		tag, file, line, func, ref_debug);
 }
 
+/*!
+ * \internal
+ * \brief Get the bucket index of a hash value in a bucket table.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param table Bucket table of the container.
+ * \param hash Hash value.
+ *
+ * \details The hash value modulo the number of buckets the container
+ * was created with picks the bucket of the first table.  Each doubling
+ * of the table then appends the next bit of the quotient so a bucket
+ * is split in place by the next table.
+ *
+ * \return Bucket index in the table.
+ */
+static int hash_table_index(struct ao2_container_hash *self, const struct hash_table *table, int hash)
+{
+	unsigned int value = hash < 0 ? -(unsigned int) hash : hash;
+	unsigned int index = value % self->n_buckets;
+	unsigned int quot = value / self->n_buckets;
+	unsigned int level;
+
+	for (level = table->level; level; --level) {
+		index = (index << 1) | (quot & 1);
+		quot >>= 1;
+	}
+	return index;
+}
+
+/*!
+ * \internal
+ * \brief Get the bucket at a position of the current bucket table.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param pos Bucket position.
+ *
+ * \details While a resize is moving buckets into the current table, a
+ * bucket not moved yet takes the place of both buckets it splits into.
+ *
+ * \retval NULL if the position is covered by the bucket before it.
+ */
+static struct hash_bucket *hash_bucket_at(struct ao2_container_hash *self, int pos)
+{
+	struct hash_table *table = self->table;
+
+	if (table->from && !table->from->buckets[pos >> 1].migrated) {
+		return (pos & 1) ? NULL : &table->from->buckets[pos >> 1];
+	}
+	return &table->buckets[pos];
+}
+
+static struct hash_bucket_node *hash_bucket_first(struct ao2_container_hash *self, int pos)
+{
+	struct hash_bucket *bucket = hash_bucket_at(self, pos);
+
+	return bucket ? AST_DLLIST_FIRST(&bucket->list) : NULL;
+}
+
+static struct hash_bucket_node *hash_bucket_last(struct ao2_container_hash *self, int pos)
+{
+	struct hash_bucket *bucket = hash_bucket_at(self, pos);
+
+	return bucket ? AST_DLLIST_LAST(&bucket->list) : NULL;
+}
+
+/*!
+ * \internal
+ * \brief Get the position of the bucket a hash value belongs in.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param hash Hash value.
+ *
+ * \return Bucket position in the current bucket table.
+ */
+static int hash_pos(struct ao2_container_hash *self, int hash)
+{
+	struct hash_table *table = self->table;
+	int pos = hash_table_index(self, table, hash);
+
+	if (table->from && !table->from->buckets[pos >> 1].migrated) {
+		/* The bucket has not been split yet. */
+		pos &= ~1;
+	}
+	return pos;
+}
+
+/*!
+ * \internal
+ * \brief Get the bucket holding a node.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param node Container node.
+ *
+ * \return Bucket the node is in.
+ */
+static struct hash_bucket *hash_node_bucket(struct ao2_container_hash *self, struct hash_bucket_node *node)
+{
+	struct hash_table *table = self->table;
+
+	if (node->my_level != table->level) {
+		/* A resize has not moved the node yet. */
+		table = table->from;
+	}
+	return &table->buckets[node->my_bucket];
+}
+
+/*!
+ * \internal
+ * \brief Get the position of the bucket holding a node.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param node Container node.
+ *
+ * \return Bucket position in the current bucket table.
+ */
+static int hash_node_pos(struct ao2_container_hash *self, struct hash_bucket_node *node)
+{
+	return node->my_bucket << (self->table->level - node->my_level);
+}
+
+#define lockfree_load(link) __atomic_load_n(&(link), __ATOMIC_ACQUIRE)
+#define lockfree_store(link, entry) __atomic_store_n(&(link), (entry), __ATOMIC_RELEASE)
+
+/*!
+ * \internal
+ * \brief Enter a lock free find.
+ * \since 13.18.0
+ *
+ * \param self Container to search.
+ *
+ * \details Readers just announce themselves in a counter for the
+ * current epoch.  Writers only release the index entries they
+ * unlinked once the epoch has moved on and no reader is left in the
+ * previous one.
+ *
+ * \return Token to pass to hash_lockfree_read_end().
+ */
+static int hash_lockfree_read_begin(struct ao2_container_hash *self)
+{
+	unsigned int epoch;
+
+	for (;;) {
+		epoch = __atomic_load_n(&self->lockfree_epoch, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&self->lockfree_readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&self->lockfree_epoch, __ATOMIC_SEQ_CST) == epoch) {
+			return epoch & 1;
+		}
+		/* A writer moved to the next epoch before we were counted. */
+		__atomic_sub_fetch(&self->lockfree_readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Leave a lock free find.
+ * \since 13.18.0
+ *
+ * \param self Container searched.
+ * \param token What hash_lockfree_read_begin() returned.
+ *
+ * \return Nothing
+ */
+static void hash_lockfree_read_end(struct ao2_container_hash *self, int token)
+{
+	__atomic_sub_fetch(&self->lockfree_readers[token], 1, __ATOMIC_SEQ_CST);
+}
+
+static void hash_lockfree_release(struct hash_lockfree_entry *entry)
+{
+	struct hash_lockfree_entry *next;
+
+	while (entry) {
+		next = entry->retired;
+		ao2_t_ref(entry->obj, -1, "Release lock free index entry");
+		ast_free(entry);
+		entry = next;
+	}
+}
+
+/*!
+ * \internal
+ * \brief Free a bucket table unless it was allocated with the container.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param table Bucket table no longer used.
+ *
+ * \return Nothing
+ */
+static void hash_table_free(struct ao2_container_hash *self, struct hash_table *table)
+{
+	if ((void *) table != (void *) (self + 1)) {
+		ast_free(table);
+	}
+}
+
+static void hash_lockfree_release_tables(struct ao2_container_hash *self, struct hash_table *table)
+{
+	struct hash_table *next;
+
+	while (table) {
+		next = table->retired;
+		hash_table_free(self, table);
+		table = next;
+	}
+}
+
+/*!
+ * \internal
+ * \brief Release a bucket table with the index entries left in it.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param table Bucket table no longer used.
+ *
+ * \details Readers may still be looking at the table so it is only
+ * released with the index entries unlinked during the current epoch.
+ *
+ * \note The container is already write locked.
+ *
+ * \return Nothing
+ */
+static void hash_lockfree_retire_table(struct ao2_container_hash *self, struct hash_table *table)
+{
+	struct hash_lockfree_entry *entry;
+	int idx;
+
+	for (idx = 0; idx < table->n_buckets; ++idx) {
+		for (entry = table->buckets[idx].lockfree; entry; entry = entry->next) {
+			entry->retired = self->lockfree_retired_new;
+			self->lockfree_retired_new = entry;
+		}
+	}
+	table->retired = self->lockfree_tables_new;
+	self->lockfree_tables_new = table;
+}
+
+/*!
+ * \internal
+ * \brief Release retired index entries no reader can still be looking at.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ *
+ * \details This never waits for readers.  If readers from the previous
+ * epoch are still around the retired entries are simply kept until a
+ * later write.
+ *
+ * \note The container is already write locked.
+ *
+ * \return Nothing
+ */
+static void hash_lockfree_reclaim(struct ao2_container_hash *self)
+{
+	unsigned int epoch = self->lockfree_epoch;
+
+	if (__atomic_load_n(&self->lockfree_readers[(epoch + 1) & 1], __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	/* Everyone who could have seen these has left. */
+	hash_lockfree_release(self->lockfree_retired_old);
+	self->lockfree_retired_old = NULL;
+	hash_lockfree_release_tables(self, self->lockfree_tables_old);
+	self->lockfree_tables_old = NULL;
+
+	if (self->lockfree_retired_new || self->lockfree_tables_new) {
+		self->lockfree_retired_old = self->lockfree_retired_new;
+		self->lockfree_retired_new = NULL;
+		self->lockfree_tables_old = self->lockfree_tables_new;
+		self->lockfree_tables_new = NULL;
+		__atomic_store_n(&self->lockfree_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Put an object into the lock free find index of a bucket.
+ * \since 13.18.0
+ *
+ * \param bucket Bucket to operate upon.
+ * \param entry Unused index entry.
+ * \param obj Object of the entry.
+ *
+ * \note The container is already write locked.
+ *
+ * \return Nothing
+ */
+static void hash_lockfree_publish(struct hash_bucket *bucket, struct hash_lockfree_entry *entry, void *obj)
+{
+	entry->obj = ao2_t_bump(obj, "Lock free index entry");
+	entry->next = bucket->lockfree;
+	entry->retired = NULL;
+	lockfree_store(bucket->lockfree, entry);
+}
+
+/*!
+ * \internal
+ * \brief Put an object into the lock free find index of a bucket.
+ * \since 13.18.0
+ *
+ * \param bucket Bucket to operate upon.
+ * \param obj Object of the entry.
+ *
+ * \note The container is already write locked.
+ *
+ * \retval entry-ptr of the new index entry.
+ * \retval NULL on error.
+ */
+static struct hash_lockfree_entry *hash_lockfree_add(struct hash_bucket *bucket, void *obj)
+{
+	struct hash_lockfree_entry *entry;
+
+	entry = ast_malloc(sizeof(*entry));
+	if (entry) {
+		hash_lockfree_publish(bucket, entry, obj);
+	}
+	return entry;
+}
+
+/*!
+ * \internal
+ * \brief Take an entry out of the lock free find index of a bucket.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param bucket Bucket holding the entry.
+ * \param entry Index entry to take out.
+ *
+ * \note The container is already write locked.
+ *
+ * \return Nothing
+ */
+static void hash_lockfree_remove(struct ao2_container_hash *self, struct hash_bucket *bucket,
+	struct hash_lockfree_entry *entry)
+{
+	struct hash_lockfree_entry **link;
+
+	for (link = &bucket->lockfree; *link != entry; link = &(*link)->next) {
+	}
+	/* Readers already on the entry still find the rest of the bucket through it. */
+	lockfree_store(*link, entry->next);
+
+	entry->retired = self->lockfree_retired_new;
+	self->lockfree_retired_new = entry;
+	hash_lockfree_reclaim(self);
+}
+
+/*!
+ * \internal
+ * \brief The object of a hash container node is leaving the container.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param node Container node still holding the object.
+ *
+ * \note The container is already write locked.
+ *
+ * \return Nothing
+ */
+static void hash_ao2_obj_removed(struct ao2_container_hash *self, struct hash_bucket_node *node)
+{
+	if (node->lockfree) {
+		hash_lockfree_remove(self, hash_node_bucket(self, node), node->lockfree);
+		node->lockfree = NULL;
+	}
+}
+
+/*!
+ * \internal
+ * \brief Replace the object of a node in the lock free find index.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param bucket Bucket holding the node.
+ * \param node Node getting a new object.
+ * \param obj The new object of the node.
+ *
+ * \note The container is already write locked.
+ *
+ * \retval 0 on success.
+ * \retval -1 on error.  The index is left as it was.
+ */
+static int hash_lockfree_replace(struct ao2_container_hash *self, struct hash_bucket *bucket,
+	struct hash_bucket_node *node, void *obj)
+{
+	struct hash_lockfree_entry *entry;
+
+	entry = hash_lockfree_add(bucket, obj);
+	if (!entry) {
+		return -1;
+	}
+	if (node->lockfree) {
+		hash_lockfree_remove(self, bucket, node->lockfree);
+	}
+	node->lockfree = entry;
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Find an object in a hash container without locking it.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param flags search_flags of the find.  (OBJ_SEARCH_OBJECT or OBJ_SEARCH_KEY)
+ * \param arg Comparison callback arg parameter.
+ * \param tag used for debugging.
+ * \param file Debug file name invoked from
+ * \param line Debug line invoked from
+ * \param func Debug function name invoked from
+ *
+ * \retval obj-ptr of found object (Reffed).
+ * \retval NULL when no object found.
+ */
+static void *hash_ao2_find_lockfree(struct ao2_container_hash *self, enum search_flags flags,
+	void *arg, const char *tag, const char *file, int line, const char *func)
+{
+	ao2_sort_fn *sort_fn = self->common.sort_fn;
+	ao2_callback_fn *cmp_fn = self->common.cmp_fn;
+	struct hash_lockfree_entry *entry;
+	struct hash_table *table;
+	struct hash_table *from;
+	struct hash_bucket *bucket = NULL;
+	void *ret = NULL;
+	int hash;
+	int token;
+	int match;
+
+	hash = self->hash_fn(arg, flags & OBJ_SEARCH_MASK);
+
+	token = hash_lockfree_read_begin(self);
+
+	/*
+	 * A resize leaves the index of the buckets it moved in place until
+	 * the previous table is released, so whichever table we look at
+	 * has every object linked before we started.
+	 */
+	table = lockfree_load(self->table);
+	from = lockfree_load(table->from);
+	if (from) {
+		bucket = &from->buckets[hash_table_index(self, from, hash)];
+		if (lockfree_load(bucket->migrated)) {
+			bucket = NULL;
+		}
+	}
+	if (!bucket) {
+		bucket = &table->buckets[hash_table_index(self, table, hash)];
+	}
+
+	for (entry = lockfree_load(bucket->lockfree);
+		entry;
+		entry = lockfree_load(entry->next)) {
+		/* The index is not kept sorted so the sort_fn only filters. */
+		if (sort_fn && sort_fn(entry->obj, arg, flags & OBJ_SEARCH_MASK)) {
+			continue;
+		}
+
+		match = cmp_fn ? cmp_fn(entry->obj, arg, flags) : CMP_MATCH;
+		if (match & CMP_MATCH) {
+			ret = entry->obj;
+			if (tag) {
+				__ao2_ref_debug(ret, 1, tag, file, line, func);
+			} else {
+				ao2_t_ref(ret, 1, "Lock free find found object");
+			}
+			break;
+		}
+		if (match & CMP_STOP) {
+			break;
+		}
+	}
+	hash_lockfree_read_end(self, token);
+
+	return ret;
+}
+
 /*!
  * \internal
  * \brief Destroy a hash container list node.
@@ -198,7 +747,7 @@ static void hash_ao2_node_destructor(void *v_doomed)
 			ast_log(LOG_ERROR, "Container integrity failed before node deletion.\n");
 		}
 #endif	/* defined(AO2_DEBUG) */
-		bucket = &my_container->buckets[doomed->my_bucket];
+		bucket = hash_node_bucket(my_container, doomed);
 		AST_DLLIST_REMOVE(&bucket->list, doomed, links);
 		AO2_DEVMODE_STAT(--my_container->common.nodes);
 	}
@@ -212,6 +761,188 @@ static void hash_ao2_node_destructor(void *v_doomed)
 	}
 }
 
+/*! Grow the bucket table when there are more objects than this per bucket. */
+#define HASH_RESIZE_LOAD 2
+/*! Buckets moved into the new bucket table by each link during a resize. */
+#define HASH_RESIZE_STEP 2
+/*! Buckets looked at by each link during a resize. */
+#define HASH_RESIZE_LOOK (HASH_RESIZE_STEP * 8)
+/*! Do not grow bucket tables past this many buckets. */
+#define HASH_RESIZE_MAX_BUCKETS (1 << 20)
+
+/*!
+ * \internal
+ * \brief Start moving the container into a bucket table twice as large.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ *
+ * \note The container is already write locked.
+ *
+ * \return Nothing
+ */
+static void hash_resize_start(struct ao2_container_hash *self)
+{
+	struct hash_table *from = self->table;
+	struct hash_table *table;
+
+	table = ast_calloc(1, sizeof(*table) + 2 * from->n_buckets * sizeof(table->buckets[0]));
+	if (!table) {
+		return;
+	}
+	table->n_buckets = 2 * from->n_buckets;
+	table->level = from->level + 1;
+	table->from = from;
+
+	self->resize_cursor = 0;
+	self->resize_left = from->n_buckets;
+	lockfree_store(self->table, table);
+}
+
+/*!
+ * \internal
+ * \brief Finish a resize once every bucket was moved.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ *
+ * \note The container is already write locked.
+ *
+ * \return Nothing
+ */
+static void hash_resize_finish(struct ao2_container_hash *self)
+{
+	struct hash_table *from = self->table->from;
+
+	lockfree_store(self->table->from, NULL);
+	if (self->common.options & AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND) {
+		/* Readers may still be looking at the previous table. */
+		hash_lockfree_retire_table(self, from);
+		hash_lockfree_reclaim(self);
+	} else {
+		hash_table_free(self, from);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Move a bucket of the previous table into the current one.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ * \param old Bucket of the previous table.
+ *
+ * \details A bucket with a node held by a traversal or an iterator is
+ * left for later so they continue where they were.  Its objects keep
+ * their order in the two buckets they are split into.
+ *
+ * \note The container is already write locked.
+ *
+ * \retval 0 on success.
+ * \retval -1 if the bucket cannot be moved now.
+ */
+static int hash_resize_move(struct ao2_container_hash *self, struct hash_bucket *old)
+{
+	struct hash_table *table = self->table;
+	struct hash_lockfree_entry *spare = NULL;
+	struct hash_lockfree_entry *entry;
+	struct hash_bucket_node *node;
+	struct hash_bucket *bucket;
+	int lockfree = self->common.options & AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND;
+
+	AST_DLLIST_TRAVERSE(&old->list, node, links) {
+		if (!node->common.obj || 1 < __ao2_ref(node, 0)) {
+			return -1;
+		}
+		if (lockfree) {
+			/* Allocate the new index entries first so a failure changes nothing. */
+			entry = ast_malloc(sizeof(*entry));
+			if (!entry) {
+				while ((entry = spare)) {
+					spare = entry->retired;
+					ast_free(entry);
+				}
+				return -1;
+			}
+			entry->retired = spare;
+			spare = entry;
+		}
+	}
+
+	while ((node = AST_DLLIST_REMOVE_HEAD(&old->list, links))) {
+		node->my_bucket = hash_table_index(self, table, node->my_hash);
+		node->my_level = table->level;
+		bucket = &table->buckets[node->my_bucket];
+		AST_DLLIST_INSERT_TAIL(&bucket->list, node, links);
+#if defined(AO2_DEBUG)
+		--old->elements;
+		++bucket->elements;
+		if (bucket->max_elements < bucket->elements) {
+			bucket->max_elements = bucket->elements;
+		}
+#endif	/* defined(AO2_DEBUG) */
+
+		if (lockfree) {
+			/* The old entry stays in the previous table for readers still there. */
+			entry = spare;
+			spare = entry->retired;
+			hash_lockfree_publish(bucket, entry, node->common.obj);
+			node->lockfree = entry;
+		}
+	}
+
+	lockfree_store(old->migrated, 1);
+	--self->resize_left;
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Do a little of the work of resizing the container.
+ * \since 13.18.0
+ *
+ * \param self Container to operate upon.
+ *
+ * \details Each link moves a few buckets into the new bucket table
+ * so no operation ever has to rehash the whole container.  Finds keep
+ * looking in whichever table holds the bucket of their key.
+ *
+ * \note The container is already write locked.
+ *
+ * \return Nothing
+ */
+static void hash_resize_step(struct ao2_container_hash *self)
+{
+	struct hash_table *from = self->table->from;
+	int moved = 0;
+	int looked;
+
+	if (!from) {
+		if (ao2_container_count(&self->common) <= self->table->n_buckets * HASH_RESIZE_LOAD
+			|| HASH_RESIZE_MAX_BUCKETS < 2 * self->table->n_buckets) {
+			return;
+		}
+		hash_resize_start(self);
+		from = self->table->from;
+		if (!from) {
+			return;
+		}
+	}
+
+	for (looked = 0; looked < HASH_RESIZE_LOOK && moved < HASH_RESIZE_STEP; ++looked) {
+		struct hash_bucket *old = &from->buckets[self->resize_cursor];
+
+		self->resize_cursor = (self->resize_cursor + 1) % from->n_buckets;
+		if (!old->migrated && !hash_resize_move(self, old)) {
+			++moved;
+			if (!self->resize_left) {
+				hash_resize_finish(self);
+				break;
+			}
+		}
+	}
+}
+
 /*!
  * \internal
  * \brief Create a new container node.
@@ -230,6 +961,8 @@ static void hash_ao2_node_destructor(void *v_doomed)
 static struct hash_bucket_node *hash_ao2_new_node(struct ao2_container_hash *self, void *obj_new, const char *tag, const char *file, int line, const char *func)
 {
 	struct hash_bucket_node *node;
+	struct hash_table *table;
+	int hash;
 	int i;
 
 	node = __ao2_alloc(sizeof(*node), hash_ao2_node_destructor, AO2_ALLOC_OPT_LOCK_NOLOCK);
@@ -237,7 +970,18 @@ static struct hash_bucket_node *hash_ao2_new_node(struct ao2_container_hash *sel
 		return NULL;
 	}
 
-	i = abs(self->hash_fn(obj_new, OBJ_SEARCH_OBJECT) % self->n_buckets);
+	if (self->resizable) {
+		hash_resize_step(self);
+	}
+
+	hash = self->hash_fn(obj_new, OBJ_SEARCH_OBJECT);
+	table = self->table;
+	if (table->from
+		&& !table->from->buckets[hash_table_index(self, table->from, hash)].migrated) {
+		/* A resize has not moved the bucket yet. */
+		table = table->from;
+	}
+	i = hash_table_index(self, table, hash);
 
 	if (tag) {
 		__ao2_ref_debug(obj_new, +1, tag, file, line, func);
@@ -247,13 +991,15 @@ static struct hash_bucket_node *hash_ao2_new_node(struct ao2_container_hash *sel
 	node->common.obj = obj_new;
 	node->common.my_container = (struct ao2_container *) self;
 	node->my_bucket = i;
+	node->my_level = table->level;
+	node->my_hash = hash;
 
 	return node;
 }
 
 /*!
  * \internal
- * \brief Insert a node into this container.
+ * \brief Insert a node into its hash bucket.
  * \since 12.0.0
  *
  * \param self Container to operate upon.
@@ -261,7 +1007,7 @@ static struct hash_bucket_node *hash_ao2_new_node(struct ao2_container_hash *sel
  *
  * \return enum ao2_container_insert value.
  */
-static enum ao2_container_insert hash_ao2_insert_node(struct ao2_container_hash *self,
+static enum ao2_container_insert hash_ao2_bucket_insert(struct ao2_container_hash *self,
 	struct hash_bucket_node *node)
 {
 	int cmp;
@@ -270,7 +1016,7 @@ static enum ao2_container_insert hash_ao2_insert_node(struct ao2_container_hash
 	ao2_sort_fn *sort_fn;
 	uint32_t options;
 
-	bucket = &self->buckets[node->my_bucket];
+	bucket = hash_node_bucket(self, node);
 	sort_fn = self->common.sort_fn;
 	options = self->common.options;
 
@@ -299,6 +1045,10 @@ static enum ao2_container_insert hash_ao2_insert_node(struct ao2_container_hash
 					}
 					break;
 				case AO2_CONTAINER_ALLOC_OPT_DUPS_REPLACE:
+					if (options & AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND
+						&& hash_lockfree_replace(self, bucket, cur, node->common.obj)) {
+						return AO2_CONTAINER_INSERT_NODE_REJECTED;
+					}
 					SWAP(cur->common.obj, node->common.obj);
 					__ao2_ref(node, -1);
 					return AO2_CONTAINER_INSERT_NODE_OBJ_REPLACED;
@@ -332,6 +1082,10 @@ static enum ao2_container_insert hash_ao2_insert_node(struct ao2_container_hash
 					}
 					break;
 				case AO2_CONTAINER_ALLOC_OPT_DUPS_REPLACE:
+					if (options & AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND
+						&& hash_lockfree_replace(self, bucket, cur, node->common.obj)) {
+						return AO2_CONTAINER_INSERT_NODE_REJECTED;
+					}
 					SWAP(cur->common.obj, node->common.obj);
 					__ao2_ref(node, -1);
 					return AO2_CONTAINER_INSERT_NODE_OBJ_REPLACED;
@@ -344,6 +1098,36 @@ static enum ao2_container_insert hash_ao2_insert_node(struct ao2_container_hash
 	return AO2_CONTAINER_INSERT_NODE_INSERTED;
 }
 
+/*!
+ * \internal
+ * \brief Insert a node into this container.
+ * \since 12.0.0
+ *
+ * \param self Container to operate upon.
+ * \param node Container node to insert into the container.
+ *
+ * \return enum ao2_container_insert value.
+ */
+static enum ao2_container_insert hash_ao2_insert_node(struct ao2_container_hash *self,
+	struct hash_bucket_node *node)
+{
+	enum ao2_container_insert res;
+
+	res = hash_ao2_bucket_insert(self, node);
+	if (res == AO2_CONTAINER_INSERT_NODE_INSERTED
+		&& (self->common.options & AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND)) {
+		struct hash_bucket *bucket = hash_node_bucket(self, node);
+
+		node->lockfree = hash_lockfree_add(bucket, node->common.obj);
+		if (!node->lockfree) {
+			/* Lock free finds would not find the object. */
+			AST_DLLIST_REMOVE(&bucket->list, node, links);
+			res = AO2_CONTAINER_INSERT_NODE_REJECTED;
+		}
+	}
+	return res;
+}
+
 /*!
  * \internal
  * \brief Find the first hash container node in a traversal.
@@ -387,8 +1171,7 @@ static struct hash_bucket_node *hash_ao2_find_first(struct ao2_container_hash *s
 	case OBJ_SEARCH_OBJECT:
 	case OBJ_SEARCH_KEY:
 		/* we know hash can handle this case */
-		bucket_cur = abs(self->hash_fn(arg, flags & OBJ_SEARCH_MASK)
-				% self->n_buckets);
+		bucket_cur = hash_pos(self, self->hash_fn(arg, flags & OBJ_SEARCH_MASK));
 		state->sort_fn = self->common.sort_fn;
 		break;
 	case OBJ_SEARCH_PARTIAL_KEY:
@@ -403,6 +1186,7 @@ static struct hash_bucket_node *hash_ao2_find_first(struct ao2_container_hash *s
 		break;
 	}
 
+	state->level = self->table->level;
 	if (state->descending) {
 		/*
 		 * Determine the search boundaries of a descending traversal.
@@ -410,7 +1194,7 @@ static struct hash_bucket_node *hash_ao2_find_first(struct ao2_container_hash *s
 		 * bucket_cur downto state->bucket_last
 		 */
 		if (bucket_cur < 0) {
-			bucket_cur = self->n_buckets - 1;
+			bucket_cur = self->table->n_buckets - 1;
 			state->bucket_last = 0;
 		} else {
 			state->bucket_last = bucket_cur;
@@ -420,7 +1204,7 @@ static struct hash_bucket_node *hash_ao2_find_first(struct ao2_container_hash *s
 		/* For each bucket */
 		for (; state->bucket_last <= bucket_cur; --bucket_cur) {
 			/* For each node in the bucket. */
-			for (node = AST_DLLIST_LAST(&self->buckets[bucket_cur].list);
+			for (node = hash_bucket_last(self, bucket_cur);
 				node;
 				node = AST_DLLIST_PREV(node, links)) {
 				if (!node->common.obj) {
@@ -453,7 +1237,7 @@ static struct hash_bucket_node *hash_ao2_find_first(struct ao2_container_hash *s
 		 */
 		if (bucket_cur < 0) {
 			bucket_cur = 0;
-			state->bucket_last = self->n_buckets;
+			state->bucket_last = self->table->n_buckets;
 		} else {
 			state->bucket_last = bucket_cur + 1;
 		}
@@ -462,7 +1246,7 @@ static struct hash_bucket_node *hash_ao2_find_first(struct ao2_container_hash *s
 		/* For each bucket */
 		for (; bucket_cur < state->bucket_last; ++bucket_cur) {
 			/* For each node in the bucket. */
-			for (node = AST_DLLIST_FIRST(&self->buckets[bucket_cur].list);
+			for (node = hash_bucket_first(self, bucket_cur);
 				node;
 				node = AST_DLLIST_NEXT(node, links)) {
 				if (!node->common.obj) {
@@ -515,7 +1299,15 @@ static struct hash_bucket_node *hash_ao2_find_next(struct ao2_container_hash *se
 
 	arg = state->arg;
 	flags = state->flags;
-	bucket_cur = prev->my_bucket;
+	if (state->level != self->table->level) {
+		/* The container was resized by a callback of the traversal. */
+		unsigned int shift = self->table->level - state->level;
+
+		state->bucket_start <<= shift;
+		state->bucket_last <<= shift;
+		state->level = self->table->level;
+	}
+	bucket_cur = hash_node_pos(self, prev);
 	node = prev;
 
 	/*
@@ -531,7 +1323,7 @@ static struct hash_bucket_node *hash_ao2_find_next(struct ao2_container_hash *se
 		/* For each bucket */
 		for (; state->bucket_last <= bucket_cur; --bucket_cur) {
 			/* For each node in the bucket. */
-			for (node = AST_DLLIST_LAST(&self->buckets[bucket_cur].list);
+			for (node = hash_bucket_last(self, bucket_cur);
 				node;
 				node = AST_DLLIST_PREV(node, links)) {
 				if (!node->common.obj) {
@@ -575,7 +1367,7 @@ hash_descending_resume:;
 		/* For each bucket */
 		for (; bucket_cur < state->bucket_last; ++bucket_cur) {
 			/* For each node in the bucket. */
-			for (node = AST_DLLIST_FIRST(&self->buckets[bucket_cur].list);
+			for (node = hash_bucket_first(self, bucket_cur);
 				node;
 				node = AST_DLLIST_NEXT(node, links)) {
 				if (!node->common.obj) {
@@ -641,7 +1433,7 @@ static struct hash_bucket_node *hash_ao2_iterator_next(struct ao2_container_hash
 
 	if (flags & AO2_ITERATOR_DESCENDING) {
 		if (node) {
-			cur_bucket = node->my_bucket;
+			cur_bucket = hash_node_pos(self, node);
 
 			/* Find next non-empty node. */
 			for (;;) {
@@ -656,12 +1448,12 @@ static struct hash_bucket_node *hash_ao2_iterator_next(struct ao2_container_hash
 			}
 		} else {
 			/* Find first non-empty node. */
-			cur_bucket = self->n_buckets;
+			cur_bucket = self->table->n_buckets;
 		}
 
 		/* Find a non-empty node in the remaining buckets */
 		while (0 <= --cur_bucket) {
-			node = AST_DLLIST_LAST(&self->buckets[cur_bucket].list);
+			node = hash_bucket_last(self, cur_bucket);
 			while (node) {
 				if (node->common.obj) {
 					/* Found a non-empty node. */
@@ -672,7 +1464,7 @@ static struct hash_bucket_node *hash_ao2_iterator_next(struct ao2_container_hash
 		}
 	} else {
 		if (node) {
-			cur_bucket = node->my_bucket;
+			cur_bucket = hash_node_pos(self, node);
 
 			/* Find next non-empty node. */
 			for (;;) {
@@ -691,8 +1483,8 @@ static struct hash_bucket_node *hash_ao2_iterator_next(struct ao2_container_hash
 		}
 
 		/* Find a non-empty node in the remaining buckets */
-		while (++cur_bucket < self->n_buckets) {
-			node = AST_DLLIST_FIRST(&self->buckets[cur_bucket].list);
+		while (++cur_bucket < self->table->n_buckets) {
+			node = hash_bucket_first(self, cur_bucket);
 			while (node) {
 				if (node->common.obj) {
 					/* Found a non-empty node. */
@@ -722,11 +1514,11 @@ static void hash_ao2_link_node_stat(struct ao2_container *hash, struct ao2_conta
 {
 	struct ao2_container_hash *self = (struct ao2_container_hash *) hash;
 	struct hash_bucket_node *node = (struct hash_bucket_node *) hash_node;
-	int i = node->my_bucket;
+	struct hash_bucket *bucket = hash_node_bucket(self, node);
 
-	++self->buckets[i].elements;
-	if (self->buckets[i].max_elements < self->buckets[i].elements) {
-		self->buckets[i].max_elements = self->buckets[i].elements;
+	++bucket->elements;
+	if (bucket->max_elements < bucket->elements) {
+		bucket->max_elements = bucket->elements;
 	}
 }
 #endif	/* defined(AO2_DEBUG) */
@@ -747,7 +1539,7 @@ static void hash_ao2_unlink_node_stat(struct ao2_container *hash, struct ao2_con
 	struct ao2_container_hash *self = (struct ao2_container_hash *) hash;
 	struct hash_bucket_node *node = (struct hash_bucket_node *) hash_node;
 
-	--self->buckets[node->my_bucket].elements;
+	--hash_node_bucket(self, node)->elements;
 }
 #endif	/* defined(AO2_DEBUG) */
 
@@ -763,16 +1555,28 @@ static void hash_ao2_unlink_node_stat(struct ao2_container *hash, struct ao2_con
  */
 static void hash_ao2_destroy(struct ao2_container_hash *self)
 {
+	struct hash_table *from = self->table->from;
 	int idx;
 
 	/* Check that the container no longer has any nodes */
-	for (idx = self->n_buckets; idx--;) {
-		if (!AST_DLLIST_EMPTY(&self->buckets[idx].list)) {
+	for (idx = self->table->n_buckets; idx--;) {
+		if (hash_bucket_first(self, idx)) {
 			ast_log(LOG_ERROR, "Node ref leak.  Hash container still has nodes!\n");
 			ast_assert(0);
 			break;
 		}
 	}
+
+	if (from) {
+		hash_lockfree_retire_table(self, from);
+	}
+	hash_lockfree_retire_table(self, self->table);
+
+	/* Nobody can be finding anything in a container being destroyed. */
+	hash_lockfree_release(self->lockfree_retired_old);
+	hash_lockfree_release(self->lockfree_retired_new);
+	hash_lockfree_release_tables(self, self->lockfree_tables_old);
+	hash_lockfree_release_tables(self, self->lockfree_tables_new);
 }
 
 #if defined(AO2_DEBUG)
@@ -797,11 +1601,11 @@ static void hash_ao2_dump(struct ao2_container_hash *self, void *where, ao2_prnt
 	int suppressed_buckets = 0;
 	struct hash_bucket_node *node;
 
-	prnt(where, "Number of buckets: %d\n\n", self->n_buckets);
+	prnt(where, "Number of buckets: %d\n\n", self->table->n_buckets);
 
 	prnt(where, FORMAT, "Bucket", "Node", "Prev", "Next", "Obj", "Key");
-	for (bucket = 0; bucket < self->n_buckets; ++bucket) {
-		node = AST_DLLIST_FIRST(&self->buckets[bucket].list);
+	for (bucket = 0; bucket < self->table->n_buckets; ++bucket) {
+		node = hash_bucket_first(self, bucket);
 		if (node) {
 			suppressed_buckets = 0;
 			do {
@@ -850,15 +1654,16 @@ static void hash_ao2_stats(struct ao2_container_hash *self, void *where, ao2_prn
 
 	int bucket;
 	int suppressed_buckets = 0;
+	struct hash_bucket *cur;
 
-	prnt(where, "Number of buckets: %d\n\n", self->n_buckets);
+	prnt(where, "Number of buckets: %d\n\n", self->table->n_buckets);
 
 	prnt(where, FORMAT, "Bucket", "Objects", "Max");
-	for (bucket = 0; bucket < self->n_buckets; ++bucket) {
-		if (self->buckets[bucket].max_elements) {
+	for (bucket = 0; bucket < self->table->n_buckets; ++bucket) {
+		cur = hash_bucket_at(self, bucket);
+		if (cur && cur->max_elements) {
 			suppressed_buckets = 0;
-			prnt(where, FORMAT2, bucket, self->buckets[bucket].elements,
-				self->buckets[bucket].max_elements);
+			prnt(where, FORMAT2, bucket, cur->elements, cur->max_elements);
 		} else if (!suppressed_buckets) {
 			suppressed_buckets = 1;
 			prnt(where, "...\n");
@@ -894,14 +1699,20 @@ static int hash_ao2_integrity(struct ao2_container_hash *self)
 	struct hash_bucket_node *node;
 	struct hash_bucket_node *prev;
 	struct hash_bucket_node *next;
+	struct hash_bucket *cur;
 
 	count_total_obj = 0;
 	count_total_node = 0;
 
 	/* For each bucket in the container. */
-	for (bucket = 0; bucket < self->n_buckets; ++bucket) {
-		if (!AST_DLLIST_FIRST(&self->buckets[bucket].list)
-			&& !AST_DLLIST_LAST(&self->buckets[bucket].list)) {
+	for (bucket = 0; bucket < self->table->n_buckets; ++bucket) {
+		cur = hash_bucket_at(self, bucket);
+		if (!cur) {
+			/* The position is covered by a bucket not moved by a resize yet. */
+			continue;
+		}
+		if (!AST_DLLIST_FIRST(&cur->list)
+			&& !AST_DLLIST_LAST(&cur->list)) {
 			/* The bucket list is empty. */
 			continue;
 		}
@@ -910,7 +1721,7 @@ static int hash_ao2_integrity(struct ao2_container_hash *self)
 		obj_last = NULL;
 
 		/* Check bucket list links and nodes. */
-		node = AST_DLLIST_LAST(&self->buckets[bucket].list);
+		node = AST_DLLIST_LAST(&cur->list);
 		if (!node) {
 			ast_log(LOG_ERROR, "Bucket %d list tail is NULL when it should not be!\n",
 				bucket);
@@ -921,7 +1732,7 @@ static int hash_ao2_integrity(struct ao2_container_hash *self)
 				bucket);
 			return -1;
 		}
-		node = AST_DLLIST_FIRST(&self->buckets[bucket].list);
+		node = AST_DLLIST_FIRST(&cur->list);
 		if (!node) {
 			ast_log(LOG_ERROR, "Bucket %d list head is NULL when it should not be!\n",
 				bucket);
@@ -946,7 +1757,7 @@ static int hash_ao2_integrity(struct ao2_container_hash *self)
 						bucket);
 					return -1;
 				}
-			} else if (node != AST_DLLIST_FIRST(&self->buckets[bucket].list)) {
+			} else if (node != AST_DLLIST_FIRST(&cur->list)) {
 				ast_log(LOG_ERROR, "Bucket %d backward list chain is broken!\n",
 					bucket);
 				return -1;
@@ -965,15 +1776,15 @@ static int hash_ao2_integrity(struct ao2_container_hash *self)
 						bucket);
 					return -1;
 				}
-			} else if (node != AST_DLLIST_LAST(&self->buckets[bucket].list)) {
+			} else if (node != AST_DLLIST_LAST(&cur->list)) {
 				ast_log(LOG_ERROR, "Bucket %d forward list chain is broken!\n",
 					bucket);
 				return -1;
 			}
 
-			if (bucket != node->my_bucket) {
+			if (cur != hash_node_bucket(self, node)) {
 				ast_log(LOG_ERROR, "Bucket %d node claims to be in bucket %d!\n",
-					bucket, node->my_bucket);
+					bucket, hash_node_pos(self, node));
 				return -1;
 			}
 
@@ -985,8 +1796,7 @@ static int hash_ao2_integrity(struct ao2_container_hash *self)
 			++count_obj;
 
 			/* Check container hash key for expected bucket. */
-			bucket_exp = abs(self->hash_fn(node->common.obj, OBJ_SEARCH_OBJECT)
-					% self->n_buckets);
+			bucket_exp = hash_pos(self, self->hash_fn(node->common.obj, OBJ_SEARCH_OBJECT));
 			if (bucket != bucket_exp) {
 				ast_log(LOG_ERROR, "Bucket %d node hashes to bucket %d!\n",
 					bucket, bucket_exp);
@@ -1006,9 +1816,9 @@ static int hash_ao2_integrity(struct ao2_container_hash *self)
 		}
 
 		/* Check bucket obj count statistic. */
-		if (count_obj != self->buckets[bucket].elements) {
+		if (count_obj != cur->elements) {
 			ast_log(LOG_ERROR, "Bucket %d object count of %d does not match stat of %d!\n",
-				bucket, count_obj, self->buckets[bucket].elements);
+				bucket, count_obj, cur->elements);
 			return -1;
 		}
 
@@ -1045,6 +1855,8 @@ static const struct ao2_container_methods v_table_hash = {
 	.traverse_first = (ao2_container_find_first_fn) hash_ao2_find_first,
 	.traverse_next = (ao2_container_find_next_fn) hash_ao2_find_next,
 	.iterator_next = (ao2_iterator_next_fn) hash_ao2_iterator_next,
+	.find_lockfree = (ao2_container_find_lockfree_fn) hash_ao2_find_lockfree,
+	.obj_removed = (ao2_container_node_obj_removed_fn) hash_ao2_obj_removed,
 	.destroy = (ao2_container_destroy_fn) hash_ao2_destroy,
 #if defined(AO2_DEBUG)
 	.link_stat = hash_ao2_link_node_stat,
@@ -1095,6 +1907,9 @@ static struct ao2_container *hash_ao2_container_init(
 	self->common.options = options;
 	self->hash_fn = hash_fn ? hash_fn : hash_zero;
 	self->n_buckets = n_buckets;
+	self->table = (struct hash_table *) (self + 1);
+	self->table->n_buckets = n_buckets;
+	self->resizable = hash_fn && (options & AO2_CONTAINER_ALLOC_OPT_AUTO_RESIZE);
 
 #ifdef AO2_DEBUG
 	ast_atomic_fetchadd_int(&ao2.total_containers, 1);
@@ -1112,7 +1927,8 @@ struct ao2_container *__ao2_container_alloc_hash(unsigned int ao2_options,
 	struct ao2_container_hash *self;
 
 	num_buckets = hash_fn ? n_buckets : 1;
-	container_size = sizeof(struct ao2_container_hash) + num_buckets * sizeof(struct hash_bucket);
+	container_size = sizeof(struct ao2_container_hash) + sizeof(struct hash_table)
+		+ num_buckets * sizeof(struct hash_bucket);
 
 	self = ao2_t_alloc_options(container_size, container_destruct, ao2_options,
 		"New hash container");
@@ -1130,7 +1946,8 @@ struct ao2_container *__ao2_container_alloc_hash_debug(unsigned int ao2_options,
 	struct ao2_container_hash *self;
 
 	num_buckets = hash_fn ? n_buckets : 1;
-	container_size = sizeof(struct ao2_container_hash) + num_buckets * sizeof(struct hash_bucket);
+	container_size = sizeof(struct ao2_container_hash) + sizeof(struct hash_table)
+		+ num_buckets * sizeof(struct hash_bucket);
 
 	self = __ao2_alloc_debug(container_size,
 		ref_debug ? container_destruct_debug : container_destruct, ao2_options,
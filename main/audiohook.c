@@ -42,6 +42,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/frame.h"
 #include "asterisk/translate.h"
 #include "asterisk/format_cache.h"
+#include "asterisk/slinmix.h"
 
 #define AST_AUDIOHOOK_SYNC_TOLERANCE 100 /*!< Tolerance in milliseconds for audiohooks synchronization */
 #define AST_AUDIOHOOK_SMALL_QUEUE_TOLERANCE 100 /*!< When small queue is enabled, this is the maximum amount of audio that can remain queued at a time. */
@@ -53,6 +54,13 @@ struct ast_audiohook_translate {
 	struct ast_format *format;
 };
 
+/*! \brief Translation path between two signed linear rates */
+struct ast_audiohook_resample {
+	struct ast_trans_pvt *trans_pvt;
+	struct ast_format *src_format;
+	struct ast_format *dst_format;
+};
+
 struct ast_audiohook_list {
 	/* If all the audiohooks in this list are capable
 	 * of processing slinear at any sample rate, this
@@ -63,6 +71,8 @@ struct ast_audiohook_list {
 
 	struct ast_audiohook_translate in_translate[2];
 	struct ast_audiohook_translate out_translate[2];
+	/*! Resampling from the list rate to the rate of the spies */
+	struct ast_audiohook_resample spy_resample[2];
 	AST_LIST_HEAD_NOLOCK(, ast_audiohook) spy_list;
 	AST_LIST_HEAD_NOLOCK(, ast_audiohook) whisper_list;
 	AST_LIST_HEAD_NOLOCK(, ast_audiohook) manipulate_list;
@@ -249,10 +259,8 @@ static struct ast_frame *audiohook_read_frame_single(struct ast_audiohook *audio
 
 static struct ast_frame *audiohook_read_frame_both(struct ast_audiohook *audiohook, size_t samples, struct ast_frame **read_reference, struct ast_frame **write_reference)
 {
-	int count;
 	int usable_read;
 	int usable_write;
-	short adjust_value;
 	short buf1[samples];
 	short buf2[samples];
 	short *read_buf = NULL;
@@ -295,14 +303,7 @@ static struct ast_frame *audiohook_read_frame_both(struct ast_audiohook *audioho
 				memset(buf1, 0, sizeof(buf1));
 			} else if (audiohook->options.read_volume) {
 				/* Adjust read volume if need be */
-				adjust_value = abs(audiohook->options.read_volume);
-				for (count = 0; count < samples; count++) {
-					if (audiohook->options.read_volume > 0) {
-						ast_slinear_saturated_multiply(&buf1[count], &adjust_value);
-					} else if (audiohook->options.read_volume < 0) {
-						ast_slinear_saturated_divide(&buf1[count], &adjust_value);
-					}
-				}
+				ast_slinear_adjust_volume_buf(buf1, audiohook->options.read_volume, samples);
 			}
 		}
 	} else {
@@ -319,14 +320,7 @@ static struct ast_frame *audiohook_read_frame_both(struct ast_audiohook *audioho
 				memset(buf2, 0, sizeof(buf2));
 			} else if (audiohook->options.write_volume) {
 				/* Adjust write volume if need be */
-				adjust_value = abs(audiohook->options.write_volume);
-				for (count = 0; count < samples; count++) {
-					if (audiohook->options.write_volume > 0) {
-						ast_slinear_saturated_multiply(&buf2[count], &adjust_value);
-					} else if (audiohook->options.write_volume < 0) {
-						ast_slinear_saturated_divide(&buf2[count], &adjust_value);
-					}
-				}
+				ast_slinear_adjust_volume_buf(buf2, audiohook->options.write_volume, samples);
 			}
 		}
 	} else {
@@ -349,9 +343,7 @@ static struct ast_frame *audiohook_read_frame_both(struct ast_audiohook *audioho
 	if (read_buf) {
 		frame.data.ptr = read_buf;
 		if (write_buf) {
-			for (count = 0; count < samples; count++) {
-				ast_slinear_saturated_add(read_buf++, write_buf++);
-			}
+			ast_slinear_saturated_add_buf(read_buf, write_buf, samples);
 		}
 	} else if (write_buf) {
 		frame.data.ptr = write_buf;
@@ -603,6 +595,11 @@ void ast_audiohook_detach_list(struct ast_audiohook_list *audiohook_list)
 			ast_translator_free_path(audiohook_list->out_translate[i].trans_pvt);
 			ao2_cleanup(audiohook_list->in_translate[i].format);
 		}
+		if (audiohook_list->spy_resample[i].trans_pvt) {
+			ast_translator_free_path(audiohook_list->spy_resample[i].trans_pvt);
+		}
+		ao2_cleanup(audiohook_list->spy_resample[i].src_format);
+		ao2_cleanup(audiohook_list->spy_resample[i].dst_format);
 	}
 
 	/* Free ourselves */
@@ -876,6 +873,73 @@ static struct ast_frame *audiohook_list_translate_to_native(struct ast_audiohook
 	return outframe;
 }
 
+/*! \brief A frame resampled once per pass for the spies of an audiohook_list */
+struct audiohook_spy_frame {
+	/*! Rate the frame was resampled to, 0 if not yet done, -1 if it failed */
+	int rate;
+	/*! The resampled frame, owned by the translator */
+	struct ast_frame *frame;
+};
+
+/*!
+ * \brief Get the signed linear frame at the rate a spy wants.
+ *
+ * \details
+ * Spies on a channel nearly always run at the same rate. Rather than have the
+ * factories of each spy resample the frame on their own, it is resampled once
+ * for the first rate differing from the frame's and shared by every spy at that
+ * rate. Spies at any other rate are given the frame as is.
+ *
+ * \param audiohook_list audiohook_list data object
+ * \param direction Direction the frame came from
+ * \param slin_frame Signed linear frame at the audiohook_list's rate
+ * \param rate Rate of the spy
+ * \param spy_frame Resampled frame of this pass
+ *
+ * \return The frame to feed to the spy, NULL if there is none this time
+ */
+static struct ast_frame *audiohook_list_spy_frame(struct ast_audiohook_list *audiohook_list,
+	enum ast_audiohook_direction direction, struct ast_frame *slin_frame, int rate,
+	struct audiohook_spy_frame *spy_frame)
+{
+	struct ast_audiohook_resample *spy_resample = (direction == AST_AUDIOHOOK_DIRECTION_READ ?
+		&audiohook_list->spy_resample[0] : &audiohook_list->spy_resample[1]);
+	struct ast_format *slin;
+
+	if (ast_format_get_sample_rate(slin_frame->subclass.format) == rate) {
+		return slin_frame;
+	}
+
+	if (spy_frame->rate) {
+		return spy_frame->rate == rate ? spy_frame->frame : slin_frame;
+	}
+	spy_frame->rate = rate;
+
+	slin = ast_format_cache_get_slin_by_rate(rate);
+	if (!spy_resample->trans_pvt
+		|| ast_format_cmp(slin_frame->subclass.format, spy_resample->src_format) != AST_FORMAT_CMP_EQUAL
+		|| ast_format_cmp(slin, spy_resample->dst_format) != AST_FORMAT_CMP_EQUAL) {
+		struct ast_trans_pvt *new_trans;
+
+		new_trans = ast_translator_build_path(slin, slin_frame->subclass.format);
+		if (!new_trans) {
+			spy_frame->rate = -1;
+			return slin_frame;
+		}
+
+		if (spy_resample->trans_pvt) {
+			ast_translator_free_path(spy_resample->trans_pvt);
+		}
+		spy_resample->trans_pvt = new_trans;
+
+		ao2_replace(spy_resample->src_format, slin_frame->subclass.format);
+		ao2_replace(spy_resample->dst_format, slin);
+	}
+
+	spy_frame->frame = ast_translate(spy_resample->trans_pvt, slin_frame, 0);
+	return spy_frame->frame;
+}
+
 /*!
  *\brief Set the audiohook's internal sample rate to the audiohook_list's rate,
  *       but only when native slin compatibility is turned on.
@@ -937,6 +1001,8 @@ static struct ast_frame *audio_audiohook_write_list(struct ast_channel *chan, st
 	int middle_frame_manipulated = 0;
 	int removed = 0;
 	int internal_sample_rate;
+	struct audiohook_spy_frame spy_frame = { 0, };
+	struct ast_frame *spy_write_frame;
 
 	/* ---Part_1. translate start_frame to SLINEAR if necessary. */
 	if (!(middle_frame = audiohook_list_translate_to_slin(audiohook_list, direction, start_frame))) {
@@ -981,15 +1047,18 @@ static struct ast_frame *audio_audiohook_write_list(struct ast_channel *chan, st
 			continue;
 		}
 		audiohook_list_set_hook_rate(audiohook_list, audiohook, &internal_sample_rate);
-		ast_audiohook_write_frame(audiohook, direction, middle_frame);
+		spy_write_frame = audiohook_list_spy_frame(audiohook_list, direction, middle_frame,
+			audiohook->hook_internal_samp_rate, &spy_frame);
+		if (spy_write_frame) {
+			ast_audiohook_write_frame(audiohook, direction, spy_write_frame);
+		}
 		ast_audiohook_unlock(audiohook);
 	}
 	AST_LIST_TRAVERSE_SAFE_END;
 
 	/* If this frame is being written out to the channel then we need to use whisper sources */
-	if (!AST_LIST_EMPTY(&audiohook_list->whisper_list)) {
-		int i = 0;
-		short read_buf[samples], combine_buf[samples], *data1 = NULL, *data2 = NULL;
+	if (!AST_LIST_EMPTY(&audiohook_list->whisper_list) && !ast_frame_unshare(middle_frame)) {
+		short read_buf[samples], combine_buf[samples];
 		memset(&combine_buf, 0, sizeof(combine_buf));
 		AST_LIST_TRAVERSE_SAFE_BEGIN(&audiohook_list->whisper_list, audiohook, list) {
 			struct ast_slinfactory *factory = (direction == AST_AUDIOHOOK_DIRECTION_READ ? &audiohook->read_factory : &audiohook->write_factory);
@@ -1007,22 +1076,18 @@ static struct ast_frame *audio_audiohook_write_list(struct ast_channel *chan, st
 			audiohook_list_set_hook_rate(audiohook_list, audiohook, &internal_sample_rate);
 			if (ast_slinfactory_available(factory) >= samples && ast_slinfactory_read(factory, read_buf, samples)) {
 				/* Take audio from this whisper source and combine it into our main buffer */
-				for (i = 0, data1 = combine_buf, data2 = read_buf; i < samples; i++, data1++, data2++) {
-					ast_slinear_saturated_add(data1, data2);
-				}
+				ast_slinear_saturated_add_buf(combine_buf, read_buf, samples);
 			}
 			ast_audiohook_unlock(audiohook);
 		}
 		AST_LIST_TRAVERSE_SAFE_END;
 		/* We take all of the combined whisper sources and combine them into the audio being written out */
-		for (i = 0, data1 = middle_frame->data.ptr, data2 = combine_buf; i < samples; i++, data1++, data2++) {
-			ast_slinear_saturated_add(data1, data2);
-		}
+		ast_slinear_saturated_add_buf(middle_frame->data.ptr, combine_buf, samples);
 		middle_frame_manipulated = 1;
 	}
 
 	/* Pass off frame to manipulate audiohooks */
-	if (!AST_LIST_EMPTY(&audiohook_list->manipulate_list)) {
+	if (!AST_LIST_EMPTY(&audiohook_list->manipulate_list) && !ast_frame_unshare(middle_frame)) {
 		AST_LIST_TRAVERSE_SAFE_BEGIN(&audiohook_list->manipulate_list, audiohook, list) {
 			ast_audiohook_lock(audiohook);
 			if (audiohook->status != AST_AUDIOHOOK_STATUS_RUNNING) {
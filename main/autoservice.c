@@ -51,8 +51,12 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/lock.h"
 #include "asterisk/utils.h"
 
+/*! \brief Most channels a single autoservice thread watches */
 #define MAX_AUTOMONS 1500
 
+/*! \brief Number of autoservice threads channels are spread across */
+#define AUTOSERVICE_WORKERS 8
+
 struct asent {
 	struct ast_channel *chan;
 	/*! This gets incremented each time autoservice gets started on the same
@@ -68,16 +72,30 @@ struct asent {
 	AST_LIST_ENTRY(asent) list;
 };
 
-static AST_LIST_HEAD_STATIC(aslist, asent);
-static ast_cond_t as_cond;
+/*!
+ * \brief An autoservice thread and the channels it services
+ *
+ * Each channel put into autoservice is serviced by the thread with the
+ * fewest channels, so no single thread has to wait on every channel.
+ */
+struct as_worker {
+	/*! Channels serviced by this thread, also locking the rest */
+	AST_LIST_HEAD(, asent) list;
+	ast_cond_t cond;
+	pthread_t thread;
+	/*! Incremented each time the thread is about to rebuild its channel array */
+	int chan_list_state;
+	/*! Number of entries in the list */
+	unsigned int channels;
+};
+
+static struct as_worker as_workers[AUTOSERVICE_WORKERS];
 
-static pthread_t asthread = AST_PTHREADT_NULL;
 static volatile int asexit = 0;
 
-static int as_chan_list_state;
-
-static void *autoservice_run(void *ign)
+static void *autoservice_run(void *data)
 {
+	struct as_worker *worker = data;
 	struct ast_callid *callid = NULL;
 	struct ast_frame hangup_frame = {
 		.frametype = AST_FRAME_CONTROL,
@@ -92,18 +110,19 @@ static void *autoservice_run(void *ign)
 		int i, x = 0, ms = 50;
 		struct ast_frame *f = NULL;
 		struct ast_frame *defer_frame = NULL;
+		struct ast_frame *dup_f;
 
-		AST_LIST_LOCK(&aslist);
+		AST_LIST_LOCK(&worker->list);
 
 		/* At this point, we know that no channels that have been removed are going
 		 * to get used again. */
-		as_chan_list_state++;
+		worker->chan_list_state++;
 
-		if (AST_LIST_EMPTY(&aslist)) {
-			ast_cond_wait(&as_cond, &aslist.lock);
+		if (AST_LIST_EMPTY(&worker->list)) {
+			ast_cond_wait(&worker->cond, &worker->list.lock);
 		}
 
-		AST_LIST_TRAVERSE(&aslist, as, list) {
+		AST_LIST_TRAVERSE(&worker->list, as, list) {
 			if (!ast_check_hangup(as->chan)) {
 				if (x < MAX_AUTOMONS) {
 					ents[x] = as;
@@ -114,7 +133,7 @@ static void *autoservice_run(void *ign)
 			}
 		}
 
-		AST_LIST_UNLOCK(&aslist);
+		AST_LIST_UNLOCK(&worker->list);
 
 		if (!x) {
 			/* If we don't sleep, this becomes a busy loop, which causes
@@ -155,57 +174,102 @@ static void *autoservice_run(void *ign)
 		}
 
 		for (i = 0; i < x; i++) {
-			struct ast_frame *dup_f;
-
-			if (mons[i] != chan) {
-				continue;
+			if (mons[i] == chan) {
+				break;
 			}
-
-			if (!f) { /* defer_frame == &hangup_frame */
-				if ((dup_f = ast_frdup(defer_frame))) {
-					AST_LIST_INSERT_HEAD(&ents[i]->deferred_frames, dup_f, frame_list);
-				}
-			} else {
-				if ((dup_f = ast_frisolate(defer_frame))) {
-					AST_LIST_INSERT_HEAD(&ents[i]->deferred_frames, dup_f, frame_list);
-				}
-				if (dup_f != defer_frame) {
-					ast_frfree(defer_frame);
-				}
-			}
-
-			break;
 		}
+
 		/* The ast_waitfor_n() call will only read frames from
 		 * the channels' file descriptors. If ast_waitfor_n()
 		 * returns non-NULL, then one of the channels in the
-		 * mons array must have triggered the return. It's
-		 * therefore impossible that we got here while (i >= x).
-		 * If we did, we'd need to ast_frfree(f) if (f). */
+		 * mons array must have triggered the return, so the
+		 * entry is always found.  Frames of types ignored by
+		 * the entry would be discarded when autoservice stops,
+		 * so they are not copied and kept around. */
+		if (i == x || ((1 << defer_frame->frametype) & ents[i]->ignore_frame_types)) {
+			if (f) {
+				ast_frfree(f);
+			}
+			continue;
+		}
+
+		if (!f) { /* defer_frame == &hangup_frame */
+			if ((dup_f = ast_frdup(defer_frame))) {
+				AST_LIST_INSERT_HEAD(&ents[i]->deferred_frames, dup_f, frame_list);
+			}
+		} else {
+			if ((dup_f = ast_frisolate(defer_frame))) {
+				AST_LIST_INSERT_HEAD(&ents[i]->deferred_frames, dup_f, frame_list);
+			}
+			if (dup_f != defer_frame) {
+				ast_frfree(defer_frame);
+			}
+		}
 	}
 
 	ast_callid_threadassoc_change(NULL);
-	asthread = AST_PTHREADT_NULL;
+	worker->thread = AST_PTHREADT_NULL;
 
 	return NULL;
 }
 
-int ast_autoservice_start(struct ast_channel *chan)
+/*!
+ * \internal
+ * \brief Find the autoservice entry of a channel
+ *
+ * \param chan The channel
+ * \param found Set to the entry of the channel
+ *
+ * \return The worker servicing the channel, locked, or NULL if the channel is
+ * not in autoservice.
+ */
+static struct as_worker *autoservice_find(struct ast_channel *chan, struct asent **found)
 {
-	int res = 0;
 	struct asent *as;
+	int i;
+
+	for (i = 0; i < AUTOSERVICE_WORKERS; i++) {
+		struct as_worker *worker = &as_workers[i];
 
-	AST_LIST_LOCK(&aslist);
-	AST_LIST_TRAVERSE(&aslist, as, list) {
-		if (as->chan == chan) {
-			as->use_count++;
-			break;
+		AST_LIST_LOCK(&worker->list);
+		AST_LIST_TRAVERSE(&worker->list, as, list) {
+			if (as->chan == chan) {
+				*found = as;
+				return worker;
+			}
 		}
+		AST_LIST_UNLOCK(&worker->list);
 	}
-	AST_LIST_UNLOCK(&aslist);
 
-	if (as) {
+	return NULL;
+}
+
+/*! \internal \brief Pick the worker servicing the fewest channels */
+static struct as_worker *autoservice_pick_worker(void)
+{
+	struct as_worker *worker = &as_workers[0];
+	int i;
+
+	for (i = 1; i < AUTOSERVICE_WORKERS; i++) {
+		if (as_workers[i].channels < worker->channels) {
+			worker = &as_workers[i];
+		}
+	}
+
+	return worker;
+}
+
+int ast_autoservice_start(struct ast_channel *chan)
+{
+	int res = 0;
+	struct asent *as;
+	struct as_worker *worker;
+
+	worker = autoservice_find(chan, &as);
+	if (worker) {
 		/* Entry exists, autoservice is already handling this channel */
+		as->use_count++;
+		AST_LIST_UNLOCK(&worker->list);
 		return 0;
 	}
 
@@ -222,29 +286,32 @@ int ast_autoservice_start(struct ast_channel *chan)
 		ast_set_flag(ast_channel_flags(chan), AST_FLAG_END_DTMF_ONLY);
 	ast_channel_unlock(chan);
 
-	AST_LIST_LOCK(&aslist);
+	worker = autoservice_pick_worker();
+	AST_LIST_LOCK(&worker->list);
 
-	if (AST_LIST_EMPTY(&aslist) && asthread != AST_PTHREADT_NULL) {
-		ast_cond_signal(&as_cond);
+	if (AST_LIST_EMPTY(&worker->list) && worker->thread != AST_PTHREADT_NULL) {
+		ast_cond_signal(&worker->cond);
 	}
 
-	AST_LIST_INSERT_HEAD(&aslist, as, list);
+	AST_LIST_INSERT_HEAD(&worker->list, as, list);
+	worker->channels++;
 
-	if (asthread == AST_PTHREADT_NULL) { /* need start the thread */
-		if (ast_pthread_create_background(&asthread, NULL, autoservice_run, NULL)) {
+	if (worker->thread == AST_PTHREADT_NULL) { /* need start the thread */
+		if (ast_pthread_create_background(&worker->thread, NULL, autoservice_run, worker)) {
 			ast_log(LOG_WARNING, "Unable to create autoservice thread :(\n");
 			/* There will only be a single member in the list at this point,
 			   the one we just added. */
-			AST_LIST_REMOVE(&aslist, as, list);
+			AST_LIST_REMOVE(&worker->list, as, list);
+			worker->channels--;
 			free(as);
-			asthread = AST_PTHREADT_NULL;
+			worker->thread = AST_PTHREADT_NULL;
 			res = -1;
 		} else {
-			pthread_kill(asthread, SIGURG);
+			pthread_kill(worker->thread, SIGURG);
 		}
 	}
 
-	AST_LIST_UNLOCK(&aslist);
+	AST_LIST_UNLOCK(&worker->list);
 
 	return res;
 }
@@ -253,43 +320,42 @@ int ast_autoservice_stop(struct ast_channel *chan)
 {
 	int res = -1;
 	struct asent *as, *removed = NULL;
+	struct as_worker *worker;
 	struct ast_frame *f;
 	int chan_list_state;
 
-	AST_LIST_LOCK(&aslist);
+	worker = autoservice_find(chan, &as);
+	if (!worker) {
+		return 0;
+	}
 
 	/* Save the autoservice channel list state.  We _must_ verify that the channel
 	 * list has been rebuilt before we return.  Because, after we return, the channel
 	 * could get destroyed and we don't want our poor autoservice thread to step on
 	 * it after its gone! */
-	chan_list_state = as_chan_list_state;
+	chan_list_state = worker->chan_list_state;
 
-	/* Find the entry, but do not free it because it still can be in the
+	/* Remove the entry, but do not free it because it still can be in the
 	   autoservice thread array */
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&aslist, as, list) {
-		if (as->chan == chan) {
-			as->use_count--;
-			if (as->use_count < 1) {
-				AST_LIST_REMOVE_CURRENT(list);
-				removed = as;
-			}
-			break;
-		}
+	as->use_count--;
+	if (as->use_count < 1) {
+		AST_LIST_REMOVE(&worker->list, as, list);
+		worker->channels--;
+		removed = as;
 	}
-	AST_LIST_TRAVERSE_SAFE_END;
 
-	if (removed && asthread != AST_PTHREADT_NULL) {
-		pthread_kill(asthread, SIGURG);
+	if (removed && worker->thread != AST_PTHREADT_NULL) {
+		pthread_kill(worker->thread, SIGURG);
 	}
 
-	AST_LIST_UNLOCK(&aslist);
+	AST_LIST_UNLOCK(&worker->list);
 
 	if (!removed) {
 		return 0;
 	}
 
 	/* Wait while autoservice thread rebuilds its list. */
-	while (chan_list_state == as_chan_list_state) {
+	while (chan_list_state == worker->chan_list_state) {
 		usleep(1000);
 	}
 
@@ -331,33 +397,42 @@ void ast_autoservice_chan_hangup_peer(struct ast_channel *chan, struct ast_chann
 int ast_autoservice_ignore(struct ast_channel *chan, enum ast_frame_type ftype)
 {
 	struct asent *as;
-	int res = -1;
+	struct as_worker *worker;
 
-	AST_LIST_LOCK(&aslist);
-	AST_LIST_TRAVERSE(&aslist, as, list) {
-		if (as->chan == chan) {
-			res = 0;
-			as->ignore_frame_types |= (1 << ftype);
-			break;
-		}
+	worker = autoservice_find(chan, &as);
+	if (!worker) {
+		return -1;
 	}
-	AST_LIST_UNLOCK(&aslist);
-	return res;
+
+	as->ignore_frame_types |= (1 << ftype);
+	AST_LIST_UNLOCK(&worker->list);
+	return 0;
 }
 
 static void autoservice_shutdown(void)
 {
-	pthread_t th = asthread;
+	int i;
+
 	asexit = 1;
-	if (th != AST_PTHREADT_NULL) {
-		ast_cond_signal(&as_cond);
-		pthread_kill(th, SIGURG);
-		pthread_join(th, NULL);
+	for (i = 0; i < AUTOSERVICE_WORKERS; i++) {
+		pthread_t th = as_workers[i].thread;
+
+		if (th != AST_PTHREADT_NULL) {
+			ast_cond_signal(&as_workers[i].cond);
+			pthread_kill(th, SIGURG);
+			pthread_join(th, NULL);
+		}
 	}
 }
 
 void ast_autoservice_init(void)
 {
+	int i;
+
+	for (i = 0; i < AUTOSERVICE_WORKERS; i++) {
+		AST_LIST_HEAD_INIT(&as_workers[i].list);
+		ast_cond_init(&as_workers[i].cond, NULL);
+		as_workers[i].thread = AST_PTHREADT_NULL;
+	}
 	ast_register_cleanup(autoservice_shutdown);
-	ast_cond_init(&as_cond, NULL);
 }
@@ -0,0 +1,632 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Benchmark Framework
+ *
+ * Runs registered benchmarks the way main/test.c runs unit tests, and keeps
+ * the distribution of their iteration times.
+ */
+
+/*** MODULEINFO
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/_private.h"
+
+#ifdef TEST_FRAMEWORK
+#include "asterisk/bench.h"
+#include "asterisk/logger.h"
+#include "asterisk/linkedlists.h"
+#include "asterisk/utils.h"
+#include "asterisk/cli.h"
+#include "asterisk/term.h"
+#include "asterisk/ast_version.h"
+#include "asterisk/paths.h"
+#include "asterisk/time.h"
+#include "asterisk/json.h"
+
+#define DEFAULT_ITERATIONS 100
+
+enum bench_state {
+	BENCH_NOT_RUN,
+	BENCH_DONE,
+	BENCH_FAILED,
+};
+
+/*! This array corresponds to the values defined in the bench_state enum */
+static const char * const bench_state2str[] = {
+	[BENCH_NOT_RUN] = "NOT RUN",
+	[BENCH_DONE]    = "DONE",
+	[BENCH_FAILED]  = "FAIL",
+};
+
+/*! holds all the information pertaining to a single defined benchmark */
+struct ast_bench {
+	struct ast_bench_info info;        /*!< holds benchmark callback information */
+	ast_bench_cb_t *cb;                /*!< benchmark callback function */
+	/*! \brief Status output from the last run */
+	struct ast_str *status_str;
+	/*! \brief CLI arguments, if being run from the CLI */
+	struct ast_cli_args *cli;
+	/*! \brief Time set by the benchmark for the current iteration, -1 if none */
+	int64_t iteration_usec;
+	enum bench_state state;            /*!< state of the last run */
+	/*! \brief Results of the last run, in microseconds per iteration */
+	unsigned int samples;
+	int64_t min;
+	int64_t p50;
+	int64_t p90;
+	int64_t p99;
+	int64_t max;
+	double mean;
+	/*! \brief Operations per second over the timed iterations */
+	double ops_per_sec;
+	/*! \brief When the last run ended */
+	struct timeval when;
+	AST_LIST_ENTRY(ast_bench) entry;
+};
+
+/*! List of registered benchmarks */
+static AST_LIST_HEAD_STATIC(benches, ast_bench);
+
+void ast_bench_set_time(struct ast_bench *bench, int64_t usec)
+{
+	bench->iteration_usec = MAX(usec, 0);
+}
+
+void ast_bench_status_update(struct ast_bench *bench, const char *fmt, ...)
+{
+	struct ast_str *buf;
+	va_list ap;
+
+	if (!(buf = ast_str_create(128))) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	ast_str_set_va(&buf, 0, fmt, ap);
+	va_end(ap);
+
+	if (bench->cli) {
+		ast_cli(bench->cli->fd, "%s", ast_str_buffer(buf));
+	}
+	ast_str_append(&bench->status_str, 0, "%s", ast_str_buffer(buf));
+
+	ast_free(buf);
+}
+
+static struct ast_bench *bench_free(struct ast_bench *bench)
+{
+	if (!bench) {
+		return NULL;
+	}
+
+	ast_free(bench->status_str);
+	ast_free(bench);
+
+	return NULL;
+}
+
+static struct ast_bench *bench_alloc(ast_bench_cb_t *cb)
+{
+	struct ast_bench *bench;
+
+	bench = ast_calloc(1, sizeof(*bench));
+	if (!bench) {
+		return NULL;
+	}
+
+	bench->cb = cb;
+	bench->cb(&bench->info, BENCH_INIT, bench);
+
+	if (ast_strlen_zero(bench->info.name) || ast_strlen_zero(bench->info.category)
+		|| ast_strlen_zero(bench->info.summary) || ast_strlen_zero(bench->info.description)) {
+		ast_log(LOG_ERROR, "Benchmark %s%s is missing a name, category, summary or description, registration refused.\n",
+			S_OR(bench->info.category, ""), S_OR(bench->info.name, ""));
+		return bench_free(bench);
+	}
+
+	if (!bench->info.iterations) {
+		bench->info.iterations = DEFAULT_ITERATIONS;
+	}
+	if (!bench->info.warmup) {
+		bench->info.warmup = bench->info.iterations / 10;
+	}
+	if (!bench->info.ops) {
+		bench->info.ops = 1;
+	}
+
+	if (!(bench->status_str = ast_str_create(128))) {
+		return bench_free(bench);
+	}
+
+	return bench;
+}
+
+int ast_bench_register(ast_bench_cb_t *cb)
+{
+	struct ast_bench *bench;
+
+	if (!cb || !(bench = bench_alloc(cb))) {
+		return -1;
+	}
+
+	AST_LIST_LOCK(&benches);
+	AST_LIST_INSERT_SORTALPHA(&benches, bench, entry, info.category);
+	AST_LIST_UNLOCK(&benches);
+
+	return 0;
+}
+
+int ast_bench_unregister(ast_bench_cb_t *cb)
+{
+	struct ast_bench *cur;
+
+	AST_LIST_LOCK(&benches);
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&benches, cur, entry) {
+		if (cur->cb == cb) {
+			AST_LIST_REMOVE_CURRENT(entry);
+			break;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+	AST_LIST_UNLOCK(&benches);
+
+	if (!cur) {
+		return -1;
+	}
+	bench_free(cur);
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Determine if category cat1 resides in cat2
+ */
+static int bench_cat_match(const char *cat1, const char *cat2)
+{
+	return !strncmp(cat1, cat2, strlen(cat2));
+}
+
+static int bench_sample_cmp(const void *left, const void *right)
+{
+	const int64_t *a = left;
+	const int64_t *b = right;
+
+	return *a < *b ? -1 : *a > *b;
+}
+
+/*!
+ * \internal
+ * \brief Run a single benchmark, keeping its results in it
+ */
+static void bench_execute(struct ast_bench *bench)
+{
+	int64_t *samples;
+	int64_t total = 0;
+	unsigned int i;
+	int res;
+
+	ast_str_reset(bench->status_str);
+	bench->samples = 0;
+	bench->state = BENCH_FAILED;
+
+	samples = ast_malloc(bench->info.iterations * sizeof(*samples));
+	if (!samples) {
+		return;
+	}
+
+	res = bench->cb(&bench->info, BENCH_SETUP, bench);
+	for (i = 0; !res && i < bench->info.warmup; i++) {
+		res = bench->cb(&bench->info, BENCH_RUN, bench);
+	}
+	for (i = 0; !res && i < bench->info.iterations; i++) {
+		struct timeval start;
+
+		bench->iteration_usec = -1;
+		start = ast_tvnow();
+		res = bench->cb(&bench->info, BENCH_RUN, bench);
+		samples[i] = bench->iteration_usec >= 0
+			? bench->iteration_usec : ast_tvdiff_us(ast_tvnow(), start);
+		total += samples[i];
+	}
+	if (bench->cb(&bench->info, BENCH_CLEANUP, bench)) {
+		res = -1;
+	}
+	bench->when = ast_tvnow();
+
+	if (!res) {
+		qsort(samples, bench->info.iterations, sizeof(*samples), bench_sample_cmp);
+		bench->samples = bench->info.iterations;
+		bench->min = samples[0];
+		bench->p50 = samples[(bench->samples - 1) * 50 / 100];
+		bench->p90 = samples[(bench->samples - 1) * 90 / 100];
+		bench->p99 = samples[(bench->samples - 1) * 99 / 100];
+		bench->max = samples[bench->samples - 1];
+		bench->mean = (double) total / bench->samples;
+		bench->ops_per_sec = total
+			? (double) bench->info.ops * bench->samples * 1000000.0 / total : 0.0;
+		bench->state = BENCH_DONE;
+	}
+
+	ast_free(samples);
+}
+
+static int bench_execute_multiple(const char *name, const char *category, struct ast_cli_args *cli)
+{
+	char result_buf[32];
+	struct ast_bench *bench;
+	int count = 0;
+
+	AST_LIST_LOCK(&benches);
+	AST_LIST_TRAVERSE(&benches, bench, entry) {
+		if ((category && !bench_cat_match(bench->info.category, category))
+			|| (name && strcmp(bench->info.name, name))) {
+			continue;
+		}
+
+		if (cli) {
+			ast_cli(cli->fd, "START  %s - %s\n", bench->info.category, bench->info.name);
+		}
+
+		bench->cli = cli;
+		bench_execute(bench);
+		bench->cli = NULL;
+		count++;
+
+		if (!cli) {
+			continue;
+		}
+		term_color(result_buf, bench_state2str[bench->state],
+			bench->state == BENCH_FAILED ? COLOR_RED : COLOR_GREEN, 0, sizeof(result_buf));
+		if (bench->state == BENCH_DONE) {
+			ast_cli(cli->fd, "END    %s - %s Result: %s p50: %" PRId64 "us p99: %" PRId64 "us Rate: %.0f/s\n",
+				bench->info.category, bench->info.name, result_buf,
+				bench->p50, bench->p99, bench->ops_per_sec);
+		} else {
+			ast_cli(cli->fd, "END    %s - %s Result: %s\n",
+				bench->info.category, bench->info.name, result_buf);
+		}
+	}
+	AST_LIST_UNLOCK(&benches);
+
+	return count;
+}
+
+static struct ast_json *bench_to_json(struct ast_bench *bench)
+{
+	struct ast_json *json;
+
+	json = ast_json_pack("{s: s, s: s, s: s, s: o, s: i, s: i}",
+		"category", bench->info.category,
+		"name", bench->info.name,
+		"result", bench_state2str[bench->state],
+		"timestamp", ast_json_timeval(bench->when, NULL),
+		"iterations", bench->samples,
+		"ops_per_iteration", bench->info.ops);
+	if (!json || bench->state != BENCH_DONE) {
+		return json;
+	}
+
+	if (ast_json_object_set(json, "usec", ast_json_pack("{s: o, s: o, s: o, s: o, s: o, s: o}",
+			"min", ast_json_integer_create(bench->min),
+			"mean", ast_json_real_create(bench->mean),
+			"p50", ast_json_integer_create(bench->p50),
+			"p90", ast_json_integer_create(bench->p90),
+			"p99", ast_json_integer_create(bench->p99),
+			"max", ast_json_integer_create(bench->max)))
+		|| ast_json_object_set(json, "ops_per_sec", ast_json_real_create(bench->ops_per_sec))) {
+		ast_json_unref(json);
+		return NULL;
+	}
+
+	return json;
+}
+
+/*!
+ * \internal
+ * \brief Write the results of every benchmark run to a JSON file
+ */
+static int bench_generate_json(const char *path)
+{
+	struct ast_json *results;
+	struct ast_json *benchmarks;
+	struct ast_bench *bench;
+	int res;
+
+	results = ast_json_pack("{s: s, s: o, s: []}",
+		"asterisk_version", ast_get_version(),
+		"timestamp", ast_json_timeval(ast_tvnow(), NULL),
+		"benchmarks");
+	if (!results) {
+		return -1;
+	}
+	benchmarks = ast_json_object_get(results, "benchmarks");
+
+	AST_LIST_LOCK(&benches);
+	AST_LIST_TRAVERSE(&benches, bench, entry) {
+		if (bench->state == BENCH_NOT_RUN) {
+			continue;
+		}
+		if (ast_json_array_append(benchmarks, bench_to_json(bench))) {
+			AST_LIST_UNLOCK(&benches);
+			ast_json_unref(results);
+			return -1;
+		}
+	}
+	AST_LIST_UNLOCK(&benches);
+
+	res = ast_json_dump_new_file_format(results, path, AST_JSON_PRETTY);
+	ast_json_unref(results);
+
+	return res;
+}
+
+static char *complete_bench_category(const char *word, int state)
+{
+	int which = 0;
+	int wordlen = strlen(word);
+	char *ret = NULL;
+	struct ast_bench *bench;
+
+	AST_LIST_LOCK(&benches);
+	AST_LIST_TRAVERSE(&benches, bench, entry) {
+		if (!strncasecmp(word, bench->info.category, wordlen) && ++which > state) {
+			ret = ast_strdup(bench->info.category);
+			break;
+		}
+	}
+	AST_LIST_UNLOCK(&benches);
+	return ret;
+}
+
+static char *complete_bench_name(const char *word, int state, const char *category)
+{
+	int which = 0;
+	int wordlen = strlen(word);
+	char *ret = NULL;
+	struct ast_bench *bench;
+
+	AST_LIST_LOCK(&benches);
+	AST_LIST_TRAVERSE(&benches, bench, entry) {
+		if (bench_cat_match(bench->info.category, category)
+			&& !strncasecmp(word, bench->info.name, wordlen) && ++which > state) {
+			ret = ast_strdup(bench->info.name);
+			break;
+		}
+	}
+	AST_LIST_UNLOCK(&benches);
+	return ret;
+}
+
+/* CLI commands */
+static char *bench_cli_show_registered(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-25.25s %-30.30s %-40.40s %10s\n"
+	static const char * const option1[] = { "all", "category", NULL };
+	struct ast_bench *bench;
+	char iterations[16];
+	int count = 0;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "bench show registered";
+		e->usage =
+			"Usage: 'bench show registered' can be used in two ways.\n"
+			"       1. 'bench show registered all' shows all registered benchmarks\n"
+			"       2. 'bench show registered category [bench category]' shows all\n"
+			"          benchmarks in the given category.\n";
+		return NULL;
+	case CLI_GENERATE:
+		if (a->pos == 3) {
+			return ast_cli_complete(a->word, option1, a->n);
+		}
+		if (a->pos == 4) {
+			return complete_bench_category(a->word, a->n);
+		}
+		return NULL;
+	}
+
+	if ((a->argc == 4 && strcmp(a->argv[3], "all"))
+		|| (a->argc == 5 && strcmp(a->argv[3], "category"))
+		|| a->argc < 4 || a->argc > 5) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, FORMAT, "Category", "Name", "Summary", "Iterations");
+	ast_cli(a->fd, FORMAT, "--------", "----", "-------", "----------");
+	AST_LIST_LOCK(&benches);
+	AST_LIST_TRAVERSE(&benches, bench, entry) {
+		if (a->argc == 5 && !bench_cat_match(bench->info.category, a->argv[4])) {
+			continue;
+		}
+		snprintf(iterations, sizeof(iterations), "%u", bench->info.iterations);
+		ast_cli(a->fd, FORMAT, bench->info.category, bench->info.name,
+			bench->info.summary, iterations);
+		count++;
+	}
+	AST_LIST_UNLOCK(&benches);
+	ast_cli(a->fd, "\n%d Registered Benchmarks Matched\n", count);
+
+	return CLI_SUCCESS;
+#undef FORMAT
+}
+
+static char *bench_cli_execute(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	static const char * const option1[] = { "all", "category", NULL };
+	static const char * const option2[] = { "name", NULL };
+	int count;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "bench execute";
+		e->usage =
+			"Usage: bench execute can be used in three ways.\n"
+			"       1. 'bench execute all' runs all registered benchmarks\n"
+			"       2. 'bench execute category [bench category]' runs all benchmarks\n"
+			"          in the given category.\n"
+			"       3. 'bench execute category [bench category] name [bench name]'\n"
+			"          runs the benchmark of the given category and name.\n";
+		return NULL;
+	case CLI_GENERATE:
+		if (a->pos == 2) {
+			return ast_cli_complete(a->word, option1, a->n);
+		}
+		if (a->pos == 3) {
+			return complete_bench_category(a->word, a->n);
+		}
+		if (a->pos == 4) {
+			return ast_cli_complete(a->word, option2, a->n);
+		}
+		if (a->pos == 5) {
+			return complete_bench_name(a->word, a->n, a->argv[3]);
+		}
+		return NULL;
+	}
+
+	if (a->argc == 3 && !strcmp(a->argv[2], "all")) {
+		count = bench_execute_multiple(NULL, NULL, a);
+	} else if (a->argc == 4 && !strcmp(a->argv[2], "category")) {
+		count = bench_execute_multiple(NULL, a->argv[3], a);
+	} else if (a->argc == 6 && !strcmp(a->argv[2], "category") && !strcmp(a->argv[4], "name")) {
+		count = bench_execute_multiple(a->argv[5], a->argv[3], a);
+	} else {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (!count) {
+		ast_cli(a->fd, "--- No Benchmarks Found! ---\n");
+	}
+	ast_cli(a->fd, "\n%d Benchmark(s) Executed\n", count);
+
+	return CLI_SUCCESS;
+}
+
+static char *bench_cli_show_results(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT_HDR "%-25.25s %-25.25s %7s %9s %9s %9s %9s %9s %12s\n"
+#define FORMAT_RES "%-25.25s %-25.25s %7u %9" PRId64 " %9" PRId64 " %9" PRId64 " %9" PRId64 " %9" PRId64 " %12.0f\n"
+	struct ast_bench *bench;
+	int count = 0;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "bench show results";
+		e->usage =
+			"Usage: bench show results\n"
+			"       Shows the iteration times, in microseconds, and the rate of\n"
+			"       operations of the benchmarks run.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, FORMAT_HDR, "Category", "Name", "Iters", "Min", "p50", "p90", "p99", "Max", "Ops/s");
+	AST_LIST_LOCK(&benches);
+	AST_LIST_TRAVERSE(&benches, bench, entry) {
+		if (bench->state == BENCH_NOT_RUN) {
+			continue;
+		}
+		count++;
+		if (bench->state == BENCH_FAILED) {
+			ast_cli(a->fd, "%-25.25s %-25.25s FAILED\n", bench->info.category, bench->info.name);
+			continue;
+		}
+		ast_cli(a->fd, FORMAT_RES, bench->info.category, bench->info.name, bench->samples,
+			bench->min, bench->p50, bench->p90, bench->p99, bench->max, bench->ops_per_sec);
+	}
+	AST_LIST_UNLOCK(&benches);
+	ast_cli(a->fd, "\n%d Benchmark(s) Run\n", count);
+
+	return CLI_SUCCESS;
+#undef FORMAT_HDR
+#undef FORMAT_RES
+}
+
+static char *bench_cli_generate_results(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	static const char * const option[] = { "json", NULL };
+	char path[PATH_MAX];
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "bench generate results";
+		e->usage =
+			"Usage: bench generate results json [path]\n"
+			"       Writes the results of the benchmarks run as JSON, by default\n"
+			"       to a file in the log directory.\n";
+		return NULL;
+	case CLI_GENERATE:
+		if (a->pos == 3) {
+			return ast_cli_complete(a->word, option, a->n);
+		}
+		return NULL;
+	}
+
+	if (a->argc < 4 || a->argc > 5 || strcmp(a->argv[3], "json")) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (a->argc == 5) {
+		ast_copy_string(path, a->argv[4], sizeof(path));
+	} else {
+		snprintf(path, sizeof(path), "%s/asterisk_bench_results-%ld.json",
+			ast_config_AST_LOG_DIR, (long) ast_tvnow().tv_sec);
+	}
+
+	if (bench_generate_json(path)) {
+		ast_cli(a->fd, "Results Could Not Be Generated: %s\n", path);
+	} else {
+		ast_cli(a->fd, "Results Generated Successfully: %s\n", path);
+	}
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry bench_cli[] = {
+	AST_CLI_DEFINE(bench_cli_show_registered,  "show registered benchmarks"),
+	AST_CLI_DEFINE(bench_cli_execute,          "execute registered benchmarks"),
+	AST_CLI_DEFINE(bench_cli_show_results,     "show last benchmark results"),
+	AST_CLI_DEFINE(bench_cli_generate_results, "generate benchmark results to file"),
+};
+
+static void bench_cleanup(void)
+{
+	ast_cli_unregister_multiple(bench_cli, ARRAY_LEN(bench_cli));
+}
+#endif /* TEST_FRAMEWORK */
+
+int ast_bench_init(void)
+{
+#ifdef TEST_FRAMEWORK
+	ast_register_cleanup(bench_cleanup);
+	ast_cli_register_multiple(bench_cli, ARRAY_LEN(bench_cli));
+#endif
+
+	return 0;
+}
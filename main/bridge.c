@@ -120,12 +120,29 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/core_local.h"
 #include "asterisk/core_unreal.h"
 #include "asterisk/causes.h"
+#include "asterisk/affinity.h"
 
 /*! All bridges container. */
 static struct ao2_container *bridges;
 
 static AST_RWLIST_HEAD_STATIC(bridge_technologies, ast_bridge_technology);
 
+/*! Every combination of the bridge capabilities */
+#define BRIDGE_CAPABILITY_COMBINATIONS (AST_BRIDGE_CAPABILITY_MULTIMIX << 1)
+
+/*!
+ * \brief Registered bridge technologies with any of each combination of capabilities
+ *
+ * Ordered by preference, highest first, then by registration.  Rebuilt when
+ * a technology is registered or unregistered, and protected by the
+ * bridge_technologies lock.
+ */
+static AST_VECTOR(bridge_technology_vector, struct ast_bridge_technology *)
+	technologies_by_capabilities[BRIDGE_CAPABILITY_COMBINATIONS];
+
+/*! TRUE if technologies_by_capabilities could be built */
+static int technologies_by_capabilities_valid;
+
 static unsigned int optimization_id;
 
 /* Initial starting point for the bridge array of channels */
@@ -141,6 +158,7 @@ static unsigned int optimization_id;
 #define ATTENDEDTRANSFER "ATTENDEDTRANSFER"
 
 static void cleanup_video_mode(struct ast_bridge *bridge);
+static void bridge_reconfigured_deferred(struct ast_bridge *bridge);
 
 /*! Default DTMF keys for built in features */
 static char builtin_features_dtmf[AST_BRIDGE_BUILTIN_END][MAXIMUM_DTMF_FEATURE_STRING];
@@ -208,6 +226,38 @@ static void bridge_manager_service_req(struct ast_bridge *bridge)
 	ao2_unlock(bridge_manager);
 }
 
+static int bridge_technology_preference_cmp(struct ast_bridge_technology *left,
+	struct ast_bridge_technology *right)
+{
+	return (int) right->preference - (int) left->preference;
+}
+
+/*!
+ * \internal
+ * \brief Rebuild the registered bridge technologies by capabilities.
+ *
+ * \note Must be called with the bridge_technologies list write locked.
+ */
+static void bridge_technologies_by_capabilities_build(void)
+{
+	struct ast_bridge_technology *current;
+	uint32_t capabilities;
+
+	technologies_by_capabilities_valid = 1;
+	for (capabilities = 0; capabilities < BRIDGE_CAPABILITY_COMBINATIONS; ++capabilities) {
+		AST_VECTOR_RESET(&technologies_by_capabilities[capabilities], AST_VECTOR_ELEM_CLEANUP_NOOP);
+		AST_RWLIST_TRAVERSE(&bridge_technologies, current, entry) {
+			if (!(current->capabilities & capabilities)) {
+				continue;
+			}
+			if (AST_VECTOR_ADD_SORTED(&technologies_by_capabilities[capabilities], current,
+				bridge_technology_preference_cmp)) {
+				technologies_by_capabilities_valid = 0;
+			}
+		}
+	}
+}
+
 int __ast_bridge_technology_register(struct ast_bridge_technology *technology, struct ast_module *module)
 {
 	struct ast_bridge_technology *current;
@@ -238,6 +288,7 @@ int __ast_bridge_technology_register(struct ast_bridge_technology *technology, s
 
 	/* Insert our new bridge technology into the list and print out a pretty message */
 	AST_RWLIST_INSERT_TAIL(&bridge_technologies, technology, entry);
+	bridge_technologies_by_capabilities_build();
 
 	AST_RWLIST_UNLOCK(&bridge_technologies);
 
@@ -261,6 +312,9 @@ int ast_bridge_technology_unregister(struct ast_bridge_technology *technology)
 		}
 	}
 	AST_RWLIST_TRAVERSE_SAFE_END;
+	if (current) {
+		bridge_technologies_by_capabilities_build();
+	}
 
 	AST_RWLIST_UNLOCK(&bridge_technologies);
 
@@ -484,8 +538,28 @@ static struct ast_bridge_technology *find_best_technology(uint32_t capabilities,
 {
 	struct ast_bridge_technology *current;
 	struct ast_bridge_technology *best = NULL;
+	size_t idx;
 
 	AST_RWLIST_RDLOCK(&bridge_technologies);
+	if (technologies_by_capabilities_valid && capabilities < BRIDGE_CAPABILITY_COMBINATIONS) {
+		/* The first usable technology by preference is the best. */
+		for (idx = 0; !best && idx < AST_VECTOR_SIZE(&technologies_by_capabilities[capabilities]); ++idx) {
+			current = AST_VECTOR_GET(&technologies_by_capabilities[capabilities], idx);
+			if (current->suspended) {
+				ast_debug(1, "Bridge technology %s is suspended. Skipping.\n",
+					current->name);
+				continue;
+			}
+			if (current->compatible && !current->compatible(bridge)) {
+				ast_debug(1, "Bridge technology %s is not compatible with properties of existing bridge.\n",
+					current->name);
+				continue;
+			}
+			best = current;
+		}
+		goto found;
+	}
+
 	AST_RWLIST_TRAVERSE(&bridge_technologies, current, entry) {
 		if (current->suspended) {
 			ast_debug(1, "Bridge technology %s is suspended. Skipping.\n",
@@ -510,6 +584,7 @@ static struct ast_bridge_technology *find_best_technology(uint32_t capabilities,
 		best = current;
 	}
 
+found:
 	if (best) {
 		/* Increment it's module reference count if present so it does not get unloaded while in use */
 		ast_module_ref(best->mod);
@@ -585,6 +660,9 @@ static void bridge_action_bridge(struct ast_bridge *bridge, struct ast_frame *ac
 		bridge->v_table->dissolving(bridge);
 		ast_bridge_lock(bridge);
 		break;
+	case BRIDGE_CHANNEL_ACTION_DEFERRED_RECONFIGURED:
+		bridge_reconfigured_deferred(bridge);
+		break;
 	default:
 		/* Unexpected deferred action type.  Should never happen. */
 		ast_assert(0);
@@ -1374,7 +1452,14 @@ static void set_bridge_peer_vars_multiparty(struct ast_bridge *bridge)
 		++idx;
 
 		ast_channel_lock(bridge_channel->chan);
-		ast_bridge_vars_set(bridge_channel->chan, buf, NULL);
+		/*
+		 * Past the first names the list no longer changes as channels
+		 * join, so only set it where it did to avoid a channel snapshot.
+		 */
+		if (strcmp(S_OR(pbx_builtin_getvar_helper(bridge_channel->chan, "BRIDGEPEER"), ""), buf)
+			|| pbx_builtin_getvar_helper(bridge_channel->chan, "BRIDGEPVTCALLID")) {
+			ast_bridge_vars_set(bridge_channel->chan, buf, NULL);
+		}
 		ast_channel_unlock(bridge_channel->chan);
 	}
 }
@@ -1429,6 +1514,62 @@ static void set_bridge_peer_vars(struct ast_bridge *bridge)
 	}
 }
 
+/*!
+ * \internal
+ * \brief Update the peer variables and publish the state of a bridge for the bridge manager.
+ *
+ * \param bridge What to operate on.
+ *
+ * \note On entry, the bridge is already locked.
+ *
+ * \return Nothing
+ */
+static void bridge_reconfigured_deferred(struct ast_bridge *bridge)
+{
+	bridge->reconfigured_deferred = 0;
+	if (bridge->dissolved || bridge->num_channels <= 2) {
+		/* Two party bridges are updated by bridge_reconfigured() itself. */
+		return;
+	}
+	set_bridge_peer_vars(bridge);
+	ast_bridge_publish_state(bridge);
+}
+
+/*!
+ * \internal
+ * \brief Have the bridge manager update the peer variables and publish the state of a bridge.
+ *
+ * \param bridge What to operate on.
+ *
+ * \details
+ * Every channel joining or leaving a multiparty bridge changes the
+ * BRIDGEPEER variable of every other channel and the bridge snapshot,
+ * so doing it for each one costs O(n) each time.  When channels join or
+ * leave faster than the bridge manager gets to the bridge, it is done
+ * once for all of them.
+ *
+ * \note On entry, the bridge is already locked.
+ *
+ * \return Nothing
+ */
+static void bridge_reconfigured_defer(struct ast_bridge *bridge)
+{
+	struct ast_frame action = {
+		.frametype = AST_FRAME_BRIDGE_ACTION,
+		.subclass.integer = BRIDGE_CHANNEL_ACTION_DEFERRED_RECONFIGURED,
+	};
+
+	if (bridge->reconfigured_deferred) {
+		return;
+	}
+	if (ast_bridge_queue_action(bridge, &action)) {
+		/* Do it now then. */
+		bridge_reconfigured_deferred(bridge);
+		return;
+	}
+	bridge->reconfigured_deferred = 1;
+}
+
 void bridge_reconfigured(struct ast_bridge *bridge, unsigned int colp_update)
 {
 	if (!bridge->reconfigured) {
@@ -1447,6 +1588,11 @@ void bridge_reconfigured(struct ast_bridge *bridge, unsigned int colp_update)
 		return;
 	}
 	check_bridge_play_sounds(bridge);
+	if (2 < bridge->num_channels) {
+		/* Connected line updates only concern two party bridges. */
+		bridge_reconfigured_defer(bridge);
+		return;
+	}
 	set_bridge_peer_vars(bridge);
 	ast_bridge_publish_state(bridge);
 
@@ -1743,6 +1889,7 @@ static void *bridge_channel_depart_thread(void *data)
 {
 	struct ast_bridge_channel *bridge_channel = data;
 
+	ast_thread_class_set(AST_THREAD_CLASS_CHANNEL);
 	if (bridge_channel->callid) {
 		ast_callid_threadassoc_add(bridge_channel->callid);
 	}
@@ -1773,6 +1920,7 @@ static void *bridge_channel_ind_thread(void *data)
 	struct ast_bridge_channel *bridge_channel = data;
 	struct ast_channel *chan;
 
+	ast_thread_class_set(AST_THREAD_CLASS_CHANNEL);
 	if (bridge_channel->callid) {
 		ast_callid_threadassoc_add(bridge_channel->callid);
 	}
@@ -5089,6 +5237,7 @@ static char *handle_bridge_show_specific(struct ast_cli_entry *e, int cmd, struc
 {
 	RAII_VAR(struct stasis_message *, msg, NULL, ao2_cleanup);
 	struct ast_bridge_snapshot *snapshot;
+	struct ast_bridge *bridge;
 
 	switch (cmd) {
 	case CLI_INIT:
@@ -5121,6 +5270,16 @@ static char *handle_bridge_show_specific(struct ast_cli_entry *e, int cmd, struc
 	ast_cli(a->fd, "Num-Channels: %u\n", snapshot->num_channels);
 	ao2_callback(snapshot->channels, OBJ_NODATA, bridge_show_specific_print_channel, a);
 
+	bridge = ast_bridge_find_by_id(snapshot->uniqueid);
+	if (bridge) {
+		ast_bridge_lock(bridge);
+		if (bridge->technology && bridge->technology->show) {
+			bridge->technology->show(bridge, a->fd);
+		}
+		ast_bridge_unlock(bridge);
+		ao2_ref(bridge, -1);
+	}
+
 	return CLI_SUCCESS;
 }
 
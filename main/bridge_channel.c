@@ -57,6 +57,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/causes.h"
 #include "asterisk/test.h"
 #include "asterisk/sem.h"
+#include "asterisk/latency.h"
 
 /*!
  * \brief Used to queue an action frame onto a bridge channel and write an action frame into a bridge.
@@ -986,7 +987,7 @@ int ast_bridge_channel_queue_frame(struct ast_bridge_channel *bridge_channel, st
 		return 0;
 	}
 
-	dup = ast_frdup(fr);
+	dup = (fr->mallocd & AST_MALLOCD_SHARED) ? ast_frame_share(fr) : ast_frdup(fr);
 	if (!dup) {
 		return -1;
 	}
@@ -1011,6 +1012,7 @@ int ast_bridge_channel_queue_frame(struct ast_bridge_channel *bridge_channel, st
 int ast_bridge_queue_everyone_else(struct ast_bridge *bridge, struct ast_bridge_channel *bridge_channel, struct ast_frame *frame)
 {
 	struct ast_bridge_channel *cur;
+	struct ast_frame *shared = NULL;
 	int not_written = -1;
 
 	if (frame->frametype == AST_FRAME_NULL) {
@@ -1018,14 +1020,28 @@ int ast_bridge_queue_everyone_else(struct ast_bridge *bridge, struct ast_bridge_
 		return 0;
 	}
 
+	/*
+	 * When media goes to more than one channel copy the payload once
+	 * and let every recipient reference it instead of duplicating it.
+	 */
+	if ((frame->frametype == AST_FRAME_VOICE || frame->frametype == AST_FRAME_VIDEO)
+		&& frame->datalen
+		&& bridge->num_channels - (bridge_channel ? 1 : 0) > 1) {
+		shared = ast_frame_share(frame);
+	}
+
 	AST_LIST_TRAVERSE(&bridge->channels, cur, entry) {
 		if (cur == bridge_channel) {
 			continue;
 		}
-		if (!ast_bridge_channel_queue_frame(cur, frame)) {
+		if (!ast_bridge_channel_queue_frame(cur, shared ?: frame)) {
 			not_written = 0;
 		}
 	}
+
+	if (shared) {
+		ast_frfree(shared);
+	}
 	return not_written;
 }
 
@@ -2405,6 +2421,7 @@ static struct ast_frame *bridge_handle_dtmf(struct ast_bridge_channel *bridge_ch
 static void bridge_handle_trip(struct ast_bridge_channel *bridge_channel)
 {
 	struct ast_frame *frame;
+	AST_LATENCY_DECLARE(start);
 
 	if (bridge_channel->features->mute) {
 		frame = ast_read_noaudio(bridge_channel->chan);
@@ -2416,6 +2433,7 @@ static void bridge_handle_trip(struct ast_bridge_channel *bridge_channel)
 		ast_bridge_channel_kick(bridge_channel, 0);
 		return;
 	}
+	AST_LATENCY_START(start);
 	switch (frame->frametype) {
 	case AST_FRAME_CONTROL:
 		switch (frame->subclass.integer) {
@@ -2445,6 +2463,7 @@ static void bridge_handle_trip(struct ast_bridge_channel *bridge_channel)
 	/* Simply write the frame out to the bridge technology. */
 	bridge_channel_write_frame(bridge_channel, frame);
 	bridge_frame_free(frame);
+	AST_LATENCY_END(AST_LATENCY_BRIDGE_FRAME, start);
 }
 
 /*!
@@ -240,6 +240,18 @@ static int bucket_file_wizard_delete(const struct ast_sorcery *sorcery, void *da
 	return file->scheme_impl->file->delete(sorcery, data, object);
 }
 
+/*! \brief Callback function for determining if a bucket file is stale */
+static int bucket_file_wizard_is_stale(const struct ast_sorcery *sorcery, void *data, void *object)
+{
+	struct ast_bucket_file *file = object;
+
+	if (!file->scheme_impl->file->is_stale) {
+		return 0;
+	}
+
+	return file->scheme_impl->file->is_stale(sorcery, data, object);
+}
+
 /*! \brief Intermediary file wizard */
 static struct ast_sorcery_wizard bucket_file_wizard = {
 	.name = "bucket_file",
@@ -247,6 +259,7 @@ static struct ast_sorcery_wizard bucket_file_wizard = {
 	.retrieve_id = bucket_file_wizard_retrieve,
 	.update = bucket_file_wizard_update,
 	.delete = bucket_file_wizard_delete,
+	.is_stale = bucket_file_wizard_is_stale,
 };
 
 int __ast_bucket_scheme_register(const char *name, struct ast_sorcery_wizard *bucket,
@@ -778,6 +791,11 @@ int ast_bucket_file_delete(struct ast_bucket_file *file)
 	return ast_sorcery_delete(bucket_sorcery, file);
 }
 
+int ast_bucket_file_is_stale(struct ast_bucket_file *file)
+{
+	return ast_sorcery_is_stale(bucket_sorcery, file);
+}
+
 struct ast_json *ast_bucket_file_json(const struct ast_bucket_file *file)
 {
 	RAII_VAR(struct ast_json *, json, NULL, ast_json_unref);
@@ -325,8 +325,13 @@ struct cc_control_payload {
  */
 AST_LIST_HEAD(cc_monitor_tree, ast_cc_monitor);
 
-static const int CC_CORE_INSTANCES_BUCKETS = 17;
+static const int CC_CORE_INSTANCES_BUCKETS = 257;
 static struct ao2_container *cc_core_instances;
+/*!
+ * The same core instances hashed by the device name of their agent,
+ * so finding those of a caller does not visit every core instance.
+ */
+static struct ao2_container *cc_core_instances_by_agent;
 
 struct cc_core_instance {
 	/*!
@@ -430,6 +435,29 @@ static int cc_core_instance_cmp_fn(void *obj, void *arg, int flags)
 	return core_instance1->core_id == core_instance2->core_id ? CMP_MATCH | CMP_STOP : 0;
 }
 
+static int cc_core_instance_agent_hash_fn(const void *obj, const int flags)
+{
+	const struct cc_core_instance *core_instance = obj;
+	const char *name = obj;
+
+	if ((flags & OBJ_SEARCH_MASK) != OBJ_SEARCH_KEY) {
+		name = core_instance->agent->device_name;
+	}
+	return ast_str_hash(name);
+}
+
+static int cc_core_instance_agent_cmp_fn(void *obj, void *arg, int flags)
+{
+	struct cc_core_instance *core_instance1 = obj;
+	struct cc_core_instance *core_instance2 = arg;
+	const char *name = arg;
+
+	if ((flags & OBJ_SEARCH_MASK) != OBJ_SEARCH_KEY) {
+		name = core_instance2->agent->device_name;
+	}
+	return !strcmp(core_instance1->agent->device_name, name) ? CMP_MATCH : 0;
+}
+
 static struct cc_core_instance *find_cc_core_instance(const int core_id)
 {
 	struct cc_core_instance finder = {.core_id = core_id,};
@@ -606,7 +634,7 @@ static enum ast_device_state ccss_device_state(const char *device_name)
 	enum ast_device_state cc_current_state;
 
 	match_flags = MATCH_NO_REQUEST;
-	core_instance = ao2_t_callback_data(cc_core_instances, 0, match_agent,
+	core_instance = ao2_t_callback_data(cc_core_instances_by_agent, OBJ_SEARCH_KEY, match_agent,
 		(char *) device_name, &match_flags,
 		"Find Core Instance for ccss_device_state reqeust.");
 	if (!core_instance) {
@@ -2505,7 +2533,7 @@ static long count_agents(const char * const caller, const int core_id_exception)
 {
 	struct count_agents_cb_data data = {.core_id_exception = core_id_exception,};
 
-	ao2_t_callback_data(cc_core_instances, OBJ_NODATA, count_agents_cb, (char *)caller, &data, "Counting agents");
+	ao2_t_callback_data(cc_core_instances_by_agent, OBJ_NODATA | OBJ_SEARCH_KEY, count_agents_cb, (char *)caller, &data, "Counting agents");
 	ast_log_dynamic_level(cc_logger_level, "Counted %d agents\n", data.count);
 	return data.count;
 }
@@ -2514,14 +2542,20 @@ static void kill_duplicate_offers(char *caller)
 {
 	unsigned long match_flags = MATCH_NO_REQUEST;
 	struct ao2_iterator *dups_iter;
+	struct cc_core_instance *core_instance;
 
 	/*
 	 * Must remove the ref that was in cc_core_instances outside of
 	 * the container lock to prevent deadlock.
 	 */
-	dups_iter = ao2_t_callback_data(cc_core_instances, OBJ_MULTIPLE | OBJ_UNLINK,
+	dups_iter = ao2_t_callback_data(cc_core_instances_by_agent, OBJ_MULTIPLE | OBJ_UNLINK | OBJ_SEARCH_KEY,
 		match_agent, caller, &match_flags, "Killing duplicate offers");
 	if (dups_iter) {
+		/* The iterator holds a ref to each, so unlinking them does not destroy them. */
+		while ((core_instance = ao2_t_iterator_next(dups_iter, "Next duplicate offer"))) {
+			ao2_t_unlink(cc_core_instances, core_instance, "Unlink duplicate offer");
+			cc_unref(core_instance, "Done with duplicate offer");
+		}
 		/* Now actually unref any duplicate offers by simply destroying the iterator. */
 		ao2_iterator_destroy(dups_iter);
 	}
@@ -2982,6 +3016,7 @@ static struct cc_core_instance *cc_core_init_instance(struct ast_channel *caller
 	core_instance->monitors = cc_ref(called_tree, "Core instance getting ref to monitor tree");
 
 	ao2_t_link(cc_core_instances, core_instance, "Link core instance into container");
+	ao2_t_link(cc_core_instances_by_agent, core_instance, "Link core instance into agent container");
 
 	return core_instance;
 }
@@ -3255,6 +3290,7 @@ static int cc_complete(struct cc_core_instance *core_instance, struct cc_state_c
 	 */
 	cc_publish_recallcomplete(core_instance->core_id, core_instance->agent->device_name);
 	ao2_t_unlink(cc_core_instances, core_instance, "Unlink core instance since CC recall has completed");
+	ao2_t_unlink(cc_core_instances_by_agent, core_instance, "Unlink core instance since CC recall has completed");
 	return 0;
 }
 
@@ -3262,6 +3298,7 @@ static int cc_failed(struct cc_core_instance *core_instance, struct cc_state_cha
 {
 	cc_publish_failure(core_instance->core_id, core_instance->agent->device_name, args->debug);
 	ao2_t_unlink(cc_core_instances, core_instance, "Unlink core instance since CC failed");
+	ao2_t_unlink(cc_core_instances_by_agent, core_instance, "Unlink core instance since CC failed");
 	return 0;
 }
 
@@ -4259,7 +4296,7 @@ static int ccreq_exec(struct ast_channel *chan, const char *data)
 	ast_channel_get_device_name(chan, device_name, sizeof(device_name));
 
 	match_flags = MATCH_NO_REQUEST;
-	if (!(core_instance = ao2_t_callback_data(cc_core_instances, 0, match_agent, device_name, &match_flags, "Find core instance for CallCompletionRequest"))) {
+	if (!(core_instance = ao2_t_callback_data(cc_core_instances_by_agent, OBJ_SEARCH_KEY, match_agent, device_name, &match_flags, "Find core instance for CallCompletionRequest"))) {
 		ast_log_dynamic_level(cc_logger_level, "Couldn't find a core instance for caller %s\n", device_name);
 		pbx_builtin_setvar_helper(chan, "CC_REQUEST_RESULT", "FAIL");
 		pbx_builtin_setvar_helper(chan, "CC_REQUEST_REASON", "NO_CORE_INSTANCE");
@@ -4310,7 +4347,7 @@ static int cccancel_exec(struct ast_channel *chan, const char *data)
 	ast_channel_get_device_name(chan, device_name, sizeof(device_name));
 
 	match_flags = MATCH_REQUEST;
-	if (!(core_instance = ao2_t_callback_data(cc_core_instances, 0, match_agent, device_name, &match_flags, "Find core instance for CallCompletionCancel"))) {
+	if (!(core_instance = ao2_t_callback_data(cc_core_instances_by_agent, OBJ_SEARCH_KEY, match_agent, device_name, &match_flags, "Find core instance for CallCompletionCancel"))) {
 		ast_log_dynamic_level(cc_logger_level, "Cannot find CC transaction to cancel for caller %s\n", device_name);
 		pbx_builtin_setvar_helper(chan, "CC_CANCEL_RESULT", "FAIL");
 		pbx_builtin_setvar_helper(chan, "CC_CANCEL_REASON", "NO_CORE_INSTANCE");
@@ -4634,6 +4671,10 @@ static void cc_shutdown(void)
 		cc_core_taskprocessor = ast_taskprocessor_unreference(cc_core_taskprocessor);
 	}
 	/* Note that core instances must be destroyed prior to the generic_monitors */
+	if (cc_core_instances_by_agent) {
+		ao2_t_ref(cc_core_instances_by_agent, -1, "Unref cc_core_instances_by_agent container in cc_shutdown");
+		cc_core_instances_by_agent = NULL;
+	}
 	if (cc_core_instances) {
 		ao2_t_ref(cc_core_instances, -1, "Unref cc_core_instances container in cc_shutdown");
 		cc_core_instances = NULL;
@@ -4653,6 +4694,11 @@ int ast_cc_init(void)
 					"Create core instance container"))) {
 		return -1;
 	}
+	if (!(cc_core_instances_by_agent = ao2_t_container_alloc(CC_CORE_INSTANCES_BUCKETS,
+					cc_core_instance_agent_hash_fn, cc_core_instance_agent_cmp_fn,
+					"Create core instance by agent container"))) {
+		return -1;
+	}
 	if (!(generic_monitors = ao2_t_container_alloc(CC_CORE_INSTANCES_BUCKETS,
 					generic_monitor_hash_fn, generic_monitor_cmp_fn,
 					"Create generic monitor container"))) {
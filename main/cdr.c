@@ -49,6 +49,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #include <signal.h>
 #include <inttypes.h>
+#include <fcntl.h>
 
 #include "asterisk/lock.h"
 #include "asterisk/channel.h"
@@ -72,6 +73,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/stasis_message_router.h"
 #include "asterisk/astobj2.h"
 #include "asterisk/taskprocessor.h"
+#include "asterisk/vector.h"
+#include "asterisk/paths.h"
 
 /*** DOCUMENTATION
 	<configInfo name="cdr" language="en_US">
@@ -183,6 +186,19 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 					submission of CDR data during asterisk shutdown, set this to <literal>yes</literal>.</para>
 					</description>
 				</configOption>
+				<configOption name="spool">
+					<synopsis>Write CDRs to a local spool before giving them to the backends</synopsis>
+					<description><para>When enabled, every CDR is first appended to a binary
+					spool file in the <literal>cdr</literal> directory of the Asterisk spool
+					directory. A background thread gives the spooled records to each backend
+					in batches, and records how far each backend has got. A backend that fails
+					is retried a few seconds later from the first record it did not accept.
+					Records it has not accepted stay in the spool across restarts. This
+					replaces the <literal>batch</literal> setting while it is enabled.</para>
+					<para>Records may be given to a backend again if Asterisk stops after
+					the backend accepts them but before its position is saved.</para>
+					</description>
+				</configOption>
 			</configObject>
 		</configFile>
 	</configInfo>
@@ -209,6 +225,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #define MAX_BATCH_TIME 86400
 #define DEFAULT_BATCH_SCHEDULER_ONLY "0"
 #define DEFAULT_BATCH_SAFE_SHUTDOWN "1"
+#define DEFAULT_SPOOL "0"
 
 #define CDR_DEBUG(mod_cfg, fmt, ...) \
 	do { \
@@ -220,6 +237,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 static void cdr_detach(struct ast_cdr *cdr);
 static void cdr_submit_batch(int shutdown);
 static int cdr_toggle_runtime_options(void);
+static off_t cdr_spool_checkpoint_take(const char *name);
+static void cdr_spool_checkpoint_keep(const char *name, off_t pos);
 
 /*! \brief The configuration settings for this module */
 struct module_config {
@@ -291,8 +310,11 @@ struct cdr_beitem {
 	char name[20];
 	char desc[80];
 	ast_cdrbe be;
+	ast_cdrbe_batch batch_be;
 	AST_RWLIST_ENTRY(cdr_beitem) list;
 	int suspended:1;
+	off_t spool_pos;              /*!< Offset of the first spooled record not yet given to this backend */
+	struct timeval spool_retry;   /*!< When to next try this backend after it failed a spooled record */
 };
 
 /*! \brief List of registered backends */
@@ -330,6 +352,9 @@ static ast_cond_t cdr_pending_cond;
 /*! \brief A container of the active CDRs indexed by Party A channel id */
 static struct ao2_container *active_cdrs_by_channel;
 
+/*! \brief A container of links to the active CDRs indexed by Party B channel name */
+static struct ao2_container *active_cdrs_by_party_b;
+
 /*! \brief Message router for stasis messages regarding channel state */
 static struct stasis_message_router *stasis_router;
 
@@ -696,6 +721,13 @@ struct cdr_object {
 	struct cdr_object *next;                /*!< The next CDR object in the chain */
 	struct cdr_object *last;                /*!< The last CDR object in the chain */
 	int is_root;                            /*!< True if this is the first CDR in the chain */
+	AST_VECTOR(, char *) party_b_names;     /*!< Party B names linked to this chain. Only used on the root */
+};
+
+/*! \brief A link from a Party B channel name to the root of a CDR chain */
+struct cdr_party_b_link {
+	struct cdr_object *cdr;                 /*!< The root CDR that has the Party B */
+	char name[0];                           /*!< The Party B channel name */
 };
 
 /*!
@@ -833,6 +865,160 @@ static int cdr_object_channel_cmp_fn(void *obj, void *arg, int flags)
     return cmp ? 0 : CMP_MATCH;
 }
 
+/*! \internal
+ * \brief Hash function for containers of Party B links indexing by channel name */
+static int cdr_party_b_link_hash_fn(const void *obj, const int flags)
+{
+	const struct cdr_party_b_link *link;
+	const char *key;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_KEY:
+		key = obj;
+		break;
+	case OBJ_SEARCH_OBJECT:
+		link = obj;
+		key = link->name;
+		break;
+	default:
+		ast_assert(0);
+		return 0;
+	}
+	return ast_str_case_hash(key);
+}
+
+/*! \internal
+ * \brief Comparison function for containers of Party B links indexing by channel name
+ */
+static int cdr_party_b_link_cmp_fn(void *obj, void *arg, int flags)
+{
+	struct cdr_party_b_link *left = obj;
+	struct cdr_party_b_link *right = arg;
+	const char *right_key = arg;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+		right_key = right->name;
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		break;
+	default:
+		ast_assert(0);
+		return 0;
+	}
+	return strcasecmp(left->name, right_key) ? 0 : CMP_MATCH;
+}
+
+static void cdr_party_b_link_dtor(void *obj)
+{
+	struct cdr_party_b_link *link = obj;
+
+	ao2_cleanup(link->cdr);
+}
+
+/*!
+ * \internal
+ * \brief Link every Party B in a chain that isn't linked yet to the chain's root
+ *
+ * \note The root \ref cdr_object must be locked. Links are only removed when
+ * the chain is unlinked, so a link may outlive its Party B. Anything using
+ * \ref active_cdrs_by_party_b must still check the Party B name.
+ */
+static void cdr_object_link_party_b(struct cdr_object *cdr)
+{
+	struct cdr_object *it_cdr;
+	struct cdr_party_b_link *link;
+	const char *name;
+	char *linked_name;
+	int i;
+
+	ast_assert(cdr->is_root);
+
+	for (it_cdr = cdr; it_cdr; it_cdr = it_cdr->next) {
+		if (!it_cdr->party_b.snapshot) {
+			continue;
+		}
+		name = it_cdr->party_b.snapshot->name;
+
+		for (i = 0; i < AST_VECTOR_SIZE(&cdr->party_b_names); i++) {
+			if (!strcasecmp(AST_VECTOR_GET(&cdr->party_b_names, i), name)) {
+				break;
+			}
+		}
+		if (i < AST_VECTOR_SIZE(&cdr->party_b_names)) {
+			continue;
+		}
+
+		link = ao2_alloc_options(sizeof(*link) + strlen(name) + 1,
+			cdr_party_b_link_dtor, AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!link) {
+			continue;
+		}
+		strcpy(link->name, name); /* Safe */
+
+		linked_name = ast_strdup(name);
+		if (!linked_name || AST_VECTOR_APPEND(&cdr->party_b_names, linked_name)) {
+			ast_free(linked_name);
+			ao2_ref(link, -1);
+			continue;
+		}
+		link->cdr = ao2_bump(cdr);
+		ao2_link(active_cdrs_by_party_b, link);
+		ao2_ref(link, -1);
+	}
+}
+
+static int cdr_party_b_link_match_cb(void *obj, void *arg, void *data, int flags)
+{
+	struct cdr_party_b_link *link = obj;
+
+	return (link->cdr == data && !strcasecmp(link->name, arg)) ? CMP_MATCH : 0;
+}
+
+/*!
+ * \internal
+ * \brief Remove all of the Party B links to a chain's root
+ *
+ * \note The root \ref cdr_object must be locked
+ */
+static void cdr_object_unlink_party_b(struct cdr_object *cdr)
+{
+	int i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&cdr->party_b_names); i++) {
+		ao2_callback_data(active_cdrs_by_party_b,
+			OBJ_SEARCH_KEY | OBJ_MULTIPLE | OBJ_UNLINK | OBJ_NODATA,
+			cdr_party_b_link_match_cb, AST_VECTOR_GET(&cdr->party_b_names, i), cdr);
+	}
+	AST_VECTOR_RESET(&cdr->party_b_names, ast_free_ptr);
+}
+
+/*!
+ * \internal
+ * \brief Run a callback on every active CDR chain with a given Party B
+ *
+ * \details Rather than walking all active CDRs, only the chains linked to
+ * \c name in \ref active_cdrs_by_party_b are visited. Each root is locked
+ * while the callback runs.
+ */
+static void cdr_object_party_b_callback(const char *name, ao2_callback_fn *cb, void *arg)
+{
+	struct ao2_iterator *it_links;
+	struct cdr_party_b_link *link;
+
+	it_links = ao2_find(active_cdrs_by_party_b, name, OBJ_SEARCH_KEY | OBJ_MULTIPLE);
+	if (!it_links) {
+		return;
+	}
+	while ((link = ao2_iterator_next(it_links))) {
+		ao2_lock(link->cdr);
+		cb(link->cdr, arg, 0);
+		ao2_unlock(link->cdr);
+		ao2_ref(link, -1);
+	}
+	ao2_iterator_destroy(it_links);
+}
+
 /*!
  * \brief \ref cdr_object Destructor
  */
@@ -841,6 +1027,8 @@ static void cdr_object_dtor(void *obj)
 	struct cdr_object *cdr = obj;
 	struct ast_var_t *it_var;
 
+	AST_VECTOR_CALLBACK_VOID(&cdr->party_b_names, ast_free_ptr);
+	AST_VECTOR_FREE(&cdr->party_b_names);
 	ao2_cleanup(cdr->party_a.snapshot);
 	ao2_cleanup(cdr->party_b.snapshot);
 	while ((it_var = AST_LIST_REMOVE_HEAD(&cdr->party_a.variables, entries))) {
@@ -2012,6 +2200,7 @@ static void handle_dial_message(void *data, struct stasis_subscription *sub, str
 				caller,
 				peer);
 	}
+	cdr_object_link_party_b(cdr);
 	ao2_unlock(cdr);
 }
 
@@ -2145,6 +2334,7 @@ static void handle_channel_cache_message(void *data, struct stasis_subscription
 				cdr_object_finalize(it_cdr);
 			}
 			cdr_object_dispatch(cdr);
+			cdr_object_unlink_party_b(cdr);
 			ao2_unlink(active_cdrs_by_channel, cdr);
 		}
 		ao2_unlock(cdr);
@@ -2152,10 +2342,10 @@ static void handle_channel_cache_message(void *data, struct stasis_subscription
 
 	/* Handle Party B */
 	if (new_snapshot) {
-		ao2_callback(active_cdrs_by_channel, OBJ_NODATA, cdr_object_update_party_b,
+		cdr_object_party_b_callback(new_snapshot->name, cdr_object_update_party_b,
 			new_snapshot);
 	} else {
-		ao2_callback(active_cdrs_by_channel, OBJ_NODATA, cdr_object_finalize_party_b,
+		cdr_object_party_b_callback(old_snapshot->name, cdr_object_finalize_party_b,
 			old_snapshot);
 	}
 
@@ -2270,7 +2460,7 @@ static void handle_bridge_leave_message(void *data, struct stasis_subscription *
 
 	if (strcmp(bridge->subclass, "parking")) {
 		/* Party B */
-		ao2_callback(active_cdrs_by_channel, OBJ_NODATA,
+		cdr_object_party_b_callback(channel->name,
 				cdr_object_party_b_left_bridge_cb,
 				&leave_data);
 	}
@@ -2389,6 +2579,10 @@ static void handle_bridge_pairings(struct cdr_object *cdr, struct ast_bridge_sna
 
 		bridge_candidate_process(cdr, cand_cdr);
 
+		ao2_lock(cand_cdr);
+		cdr_object_link_party_b(cand_cdr);
+		ao2_unlock(cand_cdr);
+
 		ao2_ref(channel_id, -1);
 	}
 	ao2_iterator_destroy(&it_channels);
@@ -2507,6 +2701,7 @@ static void handle_standard_bridge_enter_message(struct cdr_object *cdr,
 			handle_standard_bridge_enter_message(cdr, bridge, channel);
 		}
 	}
+	cdr_object_link_party_b(cdr);
 	ao2_unlock(cdr);
 }
 
@@ -2697,13 +2892,23 @@ int ast_cdr_backend_unsuspend(const char *name)
 }
 
 int ast_cdr_register(const char *name, const char *desc, ast_cdrbe be)
+{
+	if (!be) {
+		ast_log(LOG_WARNING, "CDR engine '%s' lacks backend\n", name);
+		return -1;
+	}
+
+	return ast_cdr_register_batch(name, desc, be, NULL);
+}
+
+int ast_cdr_register_batch(const char *name, const char *desc, ast_cdrbe be, ast_cdrbe_batch batch_be)
 {
 	struct cdr_beitem *i = NULL;
 
 	if (!name)
 		return -1;
 
-	if (!be) {
+	if (!be && !batch_be) {
 		ast_log(LOG_WARNING, "CDR engine '%s' lacks backend\n", name);
 		return -1;
 	}
@@ -2721,8 +2926,10 @@ int ast_cdr_register(const char *name, const char *desc, ast_cdrbe be)
 		return -1;
 
 	i->be = be;
+	i->batch_be = batch_be;
 	ast_copy_string(i->name, name, sizeof(i->name));
 	ast_copy_string(i->desc, desc, sizeof(i->desc));
+	i->spool_pos = cdr_spool_checkpoint_take(name);
 
 	AST_RWLIST_INSERT_HEAD(&be_list, i, list);
 	AST_RWLIST_UNLOCK(&be_list);
@@ -2757,6 +2964,7 @@ int ast_cdr_unregister(const char *name)
 	}
 
 	AST_RWLIST_REMOVE(&be_list, match, list);
+	cdr_spool_checkpoint_keep(match->name, match->spool_pos);
 	AST_RWLIST_UNLOCK(&be_list);
 
 	ast_verb(2, "Unregistered '%s' CDR backend\n", name);
@@ -3260,39 +3468,100 @@ void ast_cdr_setuserfield(const char *channel_name, const char *userfield)
 	}
 
 	/* Handle Party B */
-	ao2_callback(active_cdrs_by_channel, OBJ_NODATA,
+	cdr_object_party_b_callback(channel_name,
 			cdr_object_update_party_b_userfield_cb,
 			&party_b_info);
 
 }
 
+/*!
+ * \internal
+ * \brief Determine if a public CDR should be given to the backends
+ */
+static int cdr_is_postable(struct module_config *mod_cfg, struct ast_cdr *cdr)
+{
+	/* For people, who don't want to see unanswered single-channel events */
+	if (!ast_test_flag(&mod_cfg->general->settings, CDR_UNANSWERED) &&
+			cdr->disposition < AST_CDR_ANSWERED &&
+			(ast_strlen_zero(cdr->channel) || ast_strlen_zero(cdr->dstchannel))) {
+		ast_debug(1, "Skipping CDR  for %s since we weren't answered\n", cdr->channel);
+		return 0;
+	}
+
+	if (ast_test_flag(cdr, AST_CDR_FLAG_DISABLE)) {
+		return 0;
+	}
+
+	return 1;
+}
+
 static void post_cdr(struct ast_cdr *cdr)
 {
 	RAII_VAR(struct module_config *, mod_cfg, ao2_global_obj_ref(module_configs), ao2_cleanup);
 	struct cdr_beitem *i;
 
 	for (; cdr ; cdr = cdr->next) {
-		/* For people, who don't want to see unanswered single-channel events */
-		if (!ast_test_flag(&mod_cfg->general->settings, CDR_UNANSWERED) &&
-				cdr->disposition < AST_CDR_ANSWERED &&
-				(ast_strlen_zero(cdr->channel) || ast_strlen_zero(cdr->dstchannel))) {
-			ast_debug(1, "Skipping CDR  for %s since we weren't answered\n", cdr->channel);
-			continue;
-		}
-
-		if (ast_test_flag(cdr, AST_CDR_FLAG_DISABLE)) {
+		if (!cdr_is_postable(mod_cfg, cdr)) {
 			continue;
 		}
 		AST_RWLIST_RDLOCK(&be_list);
 		AST_RWLIST_TRAVERSE(&be_list, i, list) {
-			if (!i->suspended) {
+			if (i->suspended) {
+				continue;
+			}
+			if (i->be) {
 				i->be(cdr);
+			} else {
+				i->batch_be(&cdr, 1);
 			}
 		}
 		AST_RWLIST_UNLOCK(&be_list);
 	}
 }
 
+/*!
+ * \internal
+ * \brief Give a batch of public CDRs to the backends
+ *
+ * Backends that registered a batch handler are given all of the records in
+ * one call, the others are given them one at a time.
+ *
+ * \param cdrs The records, which are not chained together
+ * \param count The number of records
+ */
+static void post_cdr_batch(struct ast_cdr **cdrs, size_t count)
+{
+	RAII_VAR(struct module_config *, mod_cfg, ao2_global_obj_ref(module_configs), ao2_cleanup);
+	struct cdr_beitem *i;
+	size_t idx;
+	size_t posted = 0;
+
+	/* Drop the records nobody wants to see, keeping the order of the others */
+	for (idx = 0; idx < count; idx++) {
+		if (cdr_is_postable(mod_cfg, cdrs[idx])) {
+			cdrs[posted++] = cdrs[idx];
+		}
+	}
+	if (!posted) {
+		return;
+	}
+
+	AST_RWLIST_RDLOCK(&be_list);
+	AST_RWLIST_TRAVERSE(&be_list, i, list) {
+		if (i->suspended) {
+			continue;
+		}
+		if (i->batch_be) {
+			i->batch_be(cdrs, posted);
+			continue;
+		}
+		for (idx = 0; idx < posted; idx++) {
+			i->be(cdrs[idx]);
+		}
+	}
+	AST_RWLIST_UNLOCK(&be_list);
+}
+
 int ast_cdr_set_property(const char *channel_name, enum ast_cdr_options option)
 {
 	RAII_VAR(struct cdr_object *, cdr, cdr_object_get_by_name(channel_name), ao2_cleanup);
@@ -3488,10 +3757,37 @@ static void *do_batch_backend_process(void *data)
 {
 	struct cdr_batch_item *processeditem;
 	struct cdr_batch_item *batchitem = data;
+	struct ast_cdr **cdrs;
+	struct ast_cdr *cdr;
+	size_t count = 0;
+	int posted = 0;
 
-	/* Push each CDR into storage mechanism(s) and free all the memory */
+	/* Each item may hold a chain of records */
+	for (processeditem = batchitem; processeditem; processeditem = processeditem->next) {
+		for (cdr = processeditem->cdr; cdr; cdr = cdr->next) {
+			count++;
+		}
+	}
+
+	/* Push the whole batch into storage mechanism(s) at once if we can */
+	cdrs = ast_malloc(count * sizeof(*cdrs));
+	if (cdrs) {
+		count = 0;
+		for (processeditem = batchitem; processeditem; processeditem = processeditem->next) {
+			for (cdr = processeditem->cdr; cdr; cdr = cdr->next) {
+				cdrs[count++] = cdr;
+			}
+		}
+		post_cdr_batch(cdrs, count);
+		ast_free(cdrs);
+		posted = 1;
+	}
+
+	/* Otherwise push each CDR on its own, and free all the memory */
 	while (batchitem) {
-		post_cdr(batchitem->cdr);
+		if (!posted) {
+			post_cdr(batchitem->cdr);
+		}
 		ast_cdr_free(batchitem->cdr);
 		processeditem = batchitem;
 		batchitem = batchitem->next;
@@ -3563,6 +3859,618 @@ static void submit_unscheduled_batch(void)
 	ast_mutex_unlock(&cdr_pending_lock);
 }
 
+/*! \brief Magic number at the start of every record in the CDR spool */
+#define CDR_SPOOL_MAGIC 0x43445231
+/*! \brief The most spooled CDRs given to a backend at once */
+#define CDR_SPOOL_SHIP_MAX 256
+/*! \brief Seconds to wait before giving spooled CDRs to a backend that failed */
+#define CDR_SPOOL_RETRY 5
+
+/*! \brief Header before every record in the CDR spool */
+struct cdr_spool_header {
+	uint32_t magic;                 /*!< \ref CDR_SPOOL_MAGIC */
+	uint32_t len;                   /*!< Length of the record that follows */
+};
+
+/*! \brief How far a backend that isn't registered had got through the spool */
+struct cdr_spool_checkpoint {
+	AST_LIST_ENTRY(cdr_spool_checkpoint) list;
+	off_t pos;
+	char name[20];
+};
+
+/*! \brief Lock protecting the spool file and the checkpoints */
+AST_MUTEX_DEFINE_STATIC(cdr_spool_lock);
+/*! \brief Lock held while spooled CDRs are given to the backends */
+AST_MUTEX_DEFINE_STATIC(cdr_spool_ship_lock);
+static ast_cond_t cdr_spool_cond;
+static pthread_t cdr_spool_thread = AST_PTHREADT_NULL;
+static int cdr_spool_stopping;
+/*! \brief The spool file, or -1 when CDRs are not being spooled */
+static int cdr_spool_fd = -1;
+/*! \brief The length of the complete records in the spool file */
+static off_t cdr_spool_end;
+/*! \brief Checkpoints of backends that are not registered */
+static AST_LIST_HEAD_NOLOCK_STATIC(cdr_spool_checkpoints, cdr_spool_checkpoint);
+/*! \brief Set once the checkpoints of backends that never loaded have been dropped */
+static int cdr_spool_loaded;
+
+static void cdr_spool_path(char *buf, size_t size, const char *suffix)
+{
+	snprintf(buf, size, "%s/cdr/spool%s", ast_config_AST_SPOOL_DIR, suffix);
+}
+
+static off_t cdr_spool_checkpoint_take(const char *name)
+{
+	struct cdr_spool_checkpoint *checkpoint;
+	off_t pos = 0;
+
+	ast_mutex_lock(&cdr_spool_lock);
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&cdr_spool_checkpoints, checkpoint, list) {
+		if (!strcasecmp(checkpoint->name, name)) {
+			AST_LIST_REMOVE_CURRENT(list);
+			pos = checkpoint->pos;
+			ast_free(checkpoint);
+			break;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+	ast_mutex_unlock(&cdr_spool_lock);
+
+	return pos;
+}
+
+static void cdr_spool_checkpoint_keep(const char *name, off_t pos)
+{
+	struct cdr_spool_checkpoint *checkpoint;
+
+	ast_mutex_lock(&cdr_spool_lock);
+	if (cdr_spool_fd >= 0 && (checkpoint = ast_calloc(1, sizeof(*checkpoint)))) {
+		ast_copy_string(checkpoint->name, name, sizeof(checkpoint->name));
+		checkpoint->pos = pos;
+		AST_LIST_INSERT_TAIL(&cdr_spool_checkpoints, checkpoint, list);
+	}
+	ast_mutex_unlock(&cdr_spool_lock);
+}
+
+/*!
+ * \internal
+ * \brief Save how far every backend has got through the spool
+ *
+ * \note The backend list must be locked
+ */
+static void cdr_spool_checkpoint_save(void)
+{
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	struct cdr_beitem *i;
+	struct cdr_spool_checkpoint *checkpoint;
+	FILE *f;
+
+	cdr_spool_path(path, sizeof(path), ".pos");
+	cdr_spool_path(tmp_path, sizeof(tmp_path), ".pos.tmp");
+
+	f = fopen(tmp_path, "w");
+	if (!f) {
+		ast_log(LOG_WARNING, "Unable to save CDR spool positions to '%s': %s\n",
+			tmp_path, strerror(errno));
+		return;
+	}
+
+	AST_RWLIST_TRAVERSE(&be_list, i, list) {
+		fprintf(f, "%jd %s\n", (intmax_t) i->spool_pos, i->name);
+	}
+	ast_mutex_lock(&cdr_spool_lock);
+	AST_LIST_TRAVERSE(&cdr_spool_checkpoints, checkpoint, list) {
+		fprintf(f, "%jd %s\n", (intmax_t) checkpoint->pos, checkpoint->name);
+	}
+	ast_mutex_unlock(&cdr_spool_lock);
+
+	if (fclose(f) || rename(tmp_path, path)) {
+		ast_log(LOG_WARNING, "Unable to save CDR spool positions to '%s': %s\n",
+			path, strerror(errno));
+		unlink(tmp_path);
+	}
+}
+
+/*! \note Don't call without cdr_spool_lock */
+static void cdr_spool_checkpoint_load(void)
+{
+	char path[PATH_MAX];
+	char line[80];
+	char name[20];
+	intmax_t pos;
+	struct cdr_spool_checkpoint *checkpoint;
+	FILE *f;
+
+	cdr_spool_path(path, sizeof(path), ".pos");
+	f = fopen(path, "r");
+	if (!f) {
+		return;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%jd %19[^\n]", &pos, name) != 2 || pos < 0) {
+			continue;
+		}
+		checkpoint = ast_calloc(1, sizeof(*checkpoint));
+		if (!checkpoint) {
+			break;
+		}
+		ast_copy_string(checkpoint->name, name, sizeof(checkpoint->name));
+		checkpoint->pos = MIN(pos, cdr_spool_end);
+		AST_LIST_INSERT_TAIL(&cdr_spool_checkpoints, checkpoint, list);
+	}
+	fclose(f);
+}
+
+/*! \note Don't call without cdr_spool_lock */
+static int cdr_spool_open(void)
+{
+	char path[PATH_MAX];
+	struct cdr_spool_header header;
+	off_t size;
+	off_t pos = 0;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/cdr", ast_config_AST_SPOOL_DIR);
+	ast_mkdir(path, AST_DIR_MODE);
+
+	cdr_spool_path(path, sizeof(path), "");
+	fd = open(path, O_RDWR | O_CREAT | O_APPEND, AST_FILE_MODE);
+	if (fd < 0) {
+		ast_log(LOG_ERROR, "Unable to open CDR spool '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	/* If we stopped part way through writing a record, drop what we wrote of it */
+	size = lseek(fd, 0, SEEK_END);
+	while (pos + (off_t) sizeof(header) <= size) {
+		if (pread(fd, &header, sizeof(header), pos) != sizeof(header)
+			|| header.magic != CDR_SPOOL_MAGIC
+			|| pos + (off_t) sizeof(header) + header.len > size) {
+			break;
+		}
+		pos += sizeof(header) + header.len;
+	}
+	if (pos != size) {
+		ast_log(LOG_WARNING, "Discarding %jd bytes of incomplete records from CDR spool '%s'\n",
+			(intmax_t) (size - pos), path);
+		if (ftruncate(fd, pos)) {
+			ast_log(LOG_ERROR, "Unable to truncate CDR spool '%s': %s\n", path, strerror(errno));
+			close(fd);
+			return -1;
+		}
+	}
+
+	cdr_spool_fd = fd;
+	cdr_spool_end = pos;
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Append a chain of public CDRs to the spool
+ *
+ * \details Each record is the \ref ast_cdr itself followed by the name and
+ * value of each of its variables, all NULL terminated. The records are only
+ * meant to be read back by the Asterisk that wrote them.
+ *
+ * \retval 0 The CDRs are in the spool
+ * \retval -1 The CDRs were not spooled and the caller must post them
+ */
+static int cdr_spool_append(struct ast_cdr *cdr)
+{
+	struct cdr_spool_header header = { .magic = CDR_SPOOL_MAGIC, };
+	struct ast_cdr *it_cdr;
+	struct ast_cdr copy;
+	struct ast_var_t *var;
+	size_t total = 0;
+	size_t len;
+	ssize_t res;
+	char *buf;
+	char *pos;
+
+	for (it_cdr = cdr; it_cdr; it_cdr = it_cdr->next) {
+		total += sizeof(header) + sizeof(*it_cdr);
+		AST_LIST_TRAVERSE(&it_cdr->varshead, var, entries) {
+			total += strlen(ast_var_name(var)) + strlen(ast_var_value(var)) + 2;
+		}
+	}
+
+	buf = ast_malloc(total);
+	if (!buf) {
+		return -1;
+	}
+
+	pos = buf;
+	for (it_cdr = cdr; it_cdr; it_cdr = it_cdr->next) {
+		char *record = pos + sizeof(header);
+
+		copy = *it_cdr;
+		memset(&copy.varshead, 0, sizeof(copy.varshead));
+		copy.next = NULL;
+		memcpy(record, &copy, sizeof(copy));
+		pos = record + sizeof(copy);
+		AST_LIST_TRAVERSE(&it_cdr->varshead, var, entries) {
+			len = strlen(ast_var_name(var)) + 1;
+			memcpy(pos, ast_var_name(var), len);
+			pos += len;
+			len = strlen(ast_var_value(var)) + 1;
+			memcpy(pos, ast_var_value(var), len);
+			pos += len;
+		}
+		header.len = pos - record;
+		memcpy(record - sizeof(header), &header, sizeof(header));
+	}
+
+	ast_mutex_lock(&cdr_spool_lock);
+	if (cdr_spool_fd < 0) {
+		ast_mutex_unlock(&cdr_spool_lock);
+		ast_free(buf);
+		return -1;
+	}
+	res = write(cdr_spool_fd, buf, total);
+	if (res != (ssize_t) total) {
+		ast_log(LOG_ERROR, "Unable to write CDR to the spool: %s\n",
+			res < 0 ? strerror(errno) : "short write");
+		if (res > 0 && ftruncate(cdr_spool_fd, cdr_spool_end)) {
+			ast_log(LOG_ERROR, "Unable to remove partial CDR from the spool: %s\n", strerror(errno));
+		}
+		ast_mutex_unlock(&cdr_spool_lock);
+		ast_free(buf);
+		return -1;
+	}
+	cdr_spool_end += total;
+	ast_cond_signal(&cdr_spool_cond);
+	ast_mutex_unlock(&cdr_spool_lock);
+
+	ast_free(buf);
+	return 0;
+}
+
+/*! \brief Rebuild a public CDR from a spooled record */
+static struct ast_cdr *cdr_spool_decode(const char *record, size_t len)
+{
+	const char *end = record + len;
+	const char *name;
+	const char *value;
+	struct ast_var_t *newvariable;
+	struct ast_cdr *cdr;
+
+	if (len < sizeof(*cdr)) {
+		return NULL;
+	}
+
+	cdr = ast_cdr_alloc();
+	if (!cdr) {
+		return NULL;
+	}
+	memcpy(cdr, record, sizeof(*cdr));
+	AST_LIST_HEAD_INIT_NOLOCK(&cdr->varshead);
+	cdr->next = NULL;
+
+	for (name = record + sizeof(*cdr); name < end; name = value + strlen(value) + 1) {
+		value = name + strnlen(name, end - name) + 1;
+		if (value >= end || !memchr(value, '\0', end - value)) {
+			break;
+		}
+		newvariable = ast_var_assign(name, value);
+		if (newvariable) {
+			AST_LIST_INSERT_TAIL(&cdr->varshead, newvariable, entries);
+		}
+	}
+
+	return cdr;
+}
+
+/*!
+ * \internal
+ * \brief Give a backend the next spooled CDRs that it hasn't accepted
+ *
+ * \note The backend list must be locked
+ *
+ * \retval 0 The backend accepted them
+ * \retval -1 The backend failed them
+ */
+static int cdr_spool_ship_backend(struct module_config *mod_cfg, struct cdr_beitem *i, off_t end)
+{
+	struct cdr_spool_header header;
+	struct ast_cdr *cdrs[CDR_SPOOL_SHIP_MAX];
+	off_t starts[CDR_SPOOL_SHIP_MAX];
+	off_t pos = i->spool_pos;
+	size_t count = 0;
+	size_t idx;
+	char *record;
+	int failed = -1;
+
+	while (pos < end && count < ARRAY_LEN(cdrs)) {
+		struct ast_cdr *cdr = NULL;
+		off_t start = pos;
+
+		if (pread(cdr_spool_fd, &header, sizeof(header), pos) == sizeof(header)
+			&& header.magic == CDR_SPOOL_MAGIC
+			&& pos + (off_t) sizeof(header) + header.len <= end
+			&& (record = ast_malloc(header.len))) {
+			if (pread(cdr_spool_fd, record, header.len, pos + sizeof(header)) == header.len) {
+				cdr = cdr_spool_decode(record, header.len);
+			}
+			ast_free(record);
+		}
+		if (!cdr) {
+			ast_log(LOG_ERROR, "Unable to read CDR spool at offset %jd; skipping the rest of it for backend '%s'\n",
+				(intmax_t) pos, i->name);
+			pos = end;
+			break;
+		}
+		pos += sizeof(header) + header.len;
+
+		if (!cdr_is_postable(mod_cfg, cdr)) {
+			ast_cdr_free(cdr);
+			continue;
+		}
+		starts[count] = start;
+		cdrs[count++] = cdr;
+	}
+
+	if (count && i->batch_be) {
+		if (i->batch_be(cdrs, count)) {
+			failed = 0;
+		}
+	} else {
+		for (idx = 0; idx < count; idx++) {
+			if (i->be(cdrs[idx])) {
+				failed = idx;
+				break;
+			}
+		}
+	}
+
+	i->spool_pos = failed < 0 ? pos : starts[failed];
+
+	for (idx = 0; idx < count; idx++) {
+		ast_cdr_free(cdrs[idx]);
+	}
+
+	return failed < 0 ? 0 : -1;
+}
+
+/*!
+ * \internal
+ * \brief Empty the spool once every backend has been given all of it
+ */
+static void cdr_spool_truncate(off_t end)
+{
+	struct cdr_beitem *i;
+	struct cdr_spool_checkpoint *checkpoint;
+	int truncate = 1;
+
+	AST_RWLIST_WRLOCK(&be_list);
+	ast_mutex_lock(&cdr_spool_lock);
+
+	/* Something may have been spooled, or a backend registered, since we looked.
+	 * A backend that is being reloaded still needs what it hasn't been given.
+	 */
+	if (cdr_spool_end != end) {
+		truncate = 0;
+	}
+	AST_RWLIST_TRAVERSE(&be_list, i, list) {
+		if (i->spool_pos != end) {
+			truncate = 0;
+		}
+	}
+	AST_LIST_TRAVERSE(&cdr_spool_checkpoints, checkpoint, list) {
+		if (checkpoint->pos != end) {
+			truncate = 0;
+		}
+	}
+
+	if (truncate && ftruncate(cdr_spool_fd, 0)) {
+		ast_log(LOG_ERROR, "Unable to truncate the CDR spool: %s\n", strerror(errno));
+		truncate = 0;
+	}
+
+	if (truncate) {
+		cdr_spool_end = 0;
+		AST_RWLIST_TRAVERSE(&be_list, i, list) {
+			i->spool_pos = 0;
+		}
+		AST_LIST_TRAVERSE(&cdr_spool_checkpoints, checkpoint, list) {
+			checkpoint->pos = 0;
+		}
+	}
+	ast_mutex_unlock(&cdr_spool_lock);
+
+	if (truncate) {
+		cdr_spool_checkpoint_save();
+	}
+	AST_RWLIST_UNLOCK(&be_list);
+}
+
+/*!
+ * \internal
+ * \brief Give the spooled CDRs to the backends
+ *
+ * \retval 1 There are more spooled CDRs that can be given right away
+ * \retval 0 Otherwise
+ */
+static int cdr_spool_ship(void)
+{
+	RAII_VAR(struct module_config *, mod_cfg, ao2_global_obj_ref(module_configs), ao2_cleanup);
+	struct timeval now = ast_tvnow();
+	struct cdr_beitem *i;
+	off_t end;
+	off_t pos;
+	int caught_up = 1;
+	int moved = 0;
+	int more = 0;
+
+	/* Keep everything until the backends have had a chance to load */
+	if (!mod_cfg || !ast_fully_booted) {
+		return 0;
+	}
+
+	SCOPED_MUTEX(ship_lock, &cdr_spool_ship_lock);
+
+	ast_mutex_lock(&cdr_spool_lock);
+	if (!cdr_spool_loaded) {
+		struct cdr_spool_checkpoint *checkpoint;
+
+		/* Backends that didn't load with everything else aren't configured any more */
+		while ((checkpoint = AST_LIST_REMOVE_HEAD(&cdr_spool_checkpoints, list))) {
+			if (checkpoint->pos < cdr_spool_end) {
+				ast_log(LOG_NOTICE, "Discarding spooled CDRs for CDR backend '%s', which is not loaded\n",
+					checkpoint->name);
+			}
+			ast_free(checkpoint);
+		}
+		cdr_spool_loaded = 1;
+	}
+	end = cdr_spool_fd < 0 ? 0 : cdr_spool_end;
+	ast_mutex_unlock(&cdr_spool_lock);
+	if (!end) {
+		return 0;
+	}
+
+	AST_RWLIST_RDLOCK(&be_list);
+	AST_RWLIST_TRAVERSE(&be_list, i, list) {
+		pos = i->spool_pos;
+		if (i->suspended) {
+			/* Suspended backends aren't given CDRs, spooled or not */
+			i->spool_pos = end;
+		} else if (pos < end && ast_tvcmp(now, i->spool_retry) >= 0) {
+			if (cdr_spool_ship_backend(mod_cfg, i, end)) {
+				i->spool_retry = ast_tvadd(now, ast_samp2tv(CDR_SPOOL_RETRY, 1));
+				ast_log(LOG_WARNING, "CDR backend '%s' failed spooled CDRs; retrying in %d seconds\n",
+					i->name, CDR_SPOOL_RETRY);
+			} else if (i->spool_pos < end) {
+				more = 1;
+			}
+		}
+		if (i->spool_pos != pos) {
+			moved = 1;
+		}
+		if (i->spool_pos < end) {
+			caught_up = 0;
+		}
+	}
+	if (moved) {
+		cdr_spool_checkpoint_save();
+	}
+	AST_RWLIST_UNLOCK(&be_list);
+
+	if (caught_up) {
+		cdr_spool_truncate(end);
+	}
+
+	return more;
+}
+
+static void *do_cdr_spool(void *data)
+{
+	struct timeval wait;
+	struct timespec timeout;
+	int more = 0;
+
+	ast_mutex_lock(&cdr_spool_lock);
+	while (!cdr_spool_stopping) {
+		if (!more) {
+			/* Wake up at least once a second to retry failed backends */
+			wait = ast_tvadd(ast_tvnow(), ast_samp2tv(1, 1));
+			timeout.tv_sec = wait.tv_sec;
+			timeout.tv_nsec = wait.tv_usec * 1000;
+			ast_cond_timedwait(&cdr_spool_cond, &cdr_spool_lock, &timeout);
+			if (cdr_spool_stopping) {
+				break;
+			}
+		}
+		ast_mutex_unlock(&cdr_spool_lock);
+		more = cdr_spool_ship();
+		ast_mutex_lock(&cdr_spool_lock);
+	}
+	ast_mutex_unlock(&cdr_spool_lock);
+
+	return NULL;
+}
+
+static int cdr_spool_start(void)
+{
+	struct cdr_beitem *i;
+	int res;
+
+	if (cdr_spool_thread != AST_PTHREADT_NULL) {
+		return 0;
+	}
+
+	AST_RWLIST_WRLOCK(&be_list);
+	ast_mutex_lock(&cdr_spool_lock);
+	res = cdr_spool_open();
+	if (!res) {
+		cdr_spool_checkpoint_load();
+		cdr_spool_loaded = 0;
+	}
+	ast_mutex_unlock(&cdr_spool_lock);
+	if (!res) {
+		AST_RWLIST_TRAVERSE(&be_list, i, list) {
+			i->spool_pos = cdr_spool_checkpoint_take(i->name);
+		}
+	}
+	AST_RWLIST_UNLOCK(&be_list);
+	if (res) {
+		return -1;
+	}
+
+	cdr_spool_stopping = 0;
+	ast_cond_init(&cdr_spool_cond, NULL);
+	if (ast_pthread_create_background(&cdr_spool_thread, NULL, do_cdr_spool, NULL)) {
+		ast_log(LOG_ERROR, "Unable to start CDR spool thread.\n");
+		cdr_spool_thread = AST_PTHREADT_NULL;
+		ast_cond_destroy(&cdr_spool_cond);
+		ast_mutex_lock(&cdr_spool_lock);
+		close(cdr_spool_fd);
+		cdr_spool_fd = -1;
+		ast_mutex_unlock(&cdr_spool_lock);
+		return -1;
+	}
+
+	ast_log(LOG_NOTICE, "CDR spooling enabled, with %jd bytes already spooled.\n",
+		(intmax_t) cdr_spool_end);
+	return 0;
+}
+
+static void cdr_spool_stop(void)
+{
+	struct cdr_spool_checkpoint *checkpoint;
+
+	if (cdr_spool_thread == AST_PTHREADT_NULL) {
+		return;
+	}
+
+	ast_mutex_lock(&cdr_spool_lock);
+	cdr_spool_stopping = 1;
+	ast_cond_signal(&cdr_spool_cond);
+	ast_mutex_unlock(&cdr_spool_lock);
+	pthread_join(cdr_spool_thread, NULL);
+	cdr_spool_thread = AST_PTHREADT_NULL;
+	ast_cond_destroy(&cdr_spool_cond);
+
+	/* Anything left in the spool is given to the backends when it is next enabled */
+	ast_mutex_lock(&cdr_spool_ship_lock);
+	AST_RWLIST_RDLOCK(&be_list);
+	cdr_spool_checkpoint_save();
+	AST_RWLIST_UNLOCK(&be_list);
+	ast_mutex_lock(&cdr_spool_lock);
+	close(cdr_spool_fd);
+	cdr_spool_fd = -1;
+	cdr_spool_end = 0;
+	while ((checkpoint = AST_LIST_REMOVE_HEAD(&cdr_spool_checkpoints, list))) {
+		ast_free(checkpoint);
+	}
+	ast_mutex_unlock(&cdr_spool_lock);
+	ast_mutex_unlock(&cdr_spool_ship_lock);
+}
+
 static void cdr_detach(struct ast_cdr *cdr)
 {
 	struct cdr_batch_item *newtail;
@@ -3581,6 +4489,12 @@ static void cdr_detach(struct ast_cdr *cdr)
 		return;
 	}
 
+	/* Spooled CDRs are given to the backends by the spool thread */
+	if (ast_test_flag(&mod_cfg->general->settings, CDR_SPOOL) && !cdr_spool_append(cdr)) {
+		ast_cdr_free(cdr);
+		return;
+	}
+
 	/* post stuff immediately if we are not in batch mode, this is legacy behaviour */
 	if (!ast_test_flag(&mod_cfg->general->settings, CDR_BATCHMODE)) {
 		post_cdr(cdr);
@@ -3886,6 +4800,7 @@ static char *handle_cli_status(struct ast_cli_entry *e, int cmd, struct ast_cli_
 	ast_cli(a->fd, "----------------------------------\n");
 	ast_cli(a->fd, "  Logging:                    %s\n", ast_test_flag(&mod_cfg->general->settings, CDR_ENABLED) ? "Enabled" : "Disabled");
 	ast_cli(a->fd, "  Mode:                       %s\n", ast_test_flag(&mod_cfg->general->settings, CDR_BATCHMODE) ? "Batch" : "Simple");
+	ast_cli(a->fd, "  Spool:                      %s\n", ast_test_flag(&mod_cfg->general->settings, CDR_SPOOL) ? "Enabled" : "Disabled");
 	if (ast_test_flag(&mod_cfg->general->settings, CDR_ENABLED)) {
 		ast_cli(a->fd, "  Log unanswered calls:       %s\n", ast_test_flag(&mod_cfg->general->settings, CDR_UNANSWERED) ? "Yes" : "No");
 		ast_cli(a->fd, "  Log congestion:             %s\n\n", ast_test_flag(&mod_cfg->general->settings, CDR_CONGESTION) ? "Yes" : "No");
@@ -3911,6 +4826,10 @@ static char *handle_cli_status(struct ast_cli_entry *e, int cmd, struct ast_cli_
 		} else {
 			AST_RWLIST_TRAVERSE(&be_list, beitem, list) {
 				ast_cli(a->fd, "    %s%s\n", beitem->name, beitem->suspended ? " (suspended) " : "");
+				if (cdr_spool_fd >= 0 && beitem->spool_pos < cdr_spool_end) {
+					ast_cli(a->fd, "      %jd bytes of spooled CDRs waiting\n",
+						(intmax_t) (cdr_spool_end - beitem->spool_pos));
+				}
 			}
 		}
 		AST_RWLIST_UNLOCK(&be_list);
@@ -3976,6 +4895,7 @@ static int cdr_object_dispatch_all_cb(void *obj, void *arg, int flags)
 		cdr_object_transition_state(it_cdr, &finalized_state_fn_table);
 	}
 	cdr_object_dispatch(cdr);
+	cdr_object_unlink_party_b(cdr);
 	ao2_unlock(cdr);
 
 	return 0;
@@ -4064,6 +4984,7 @@ static int process_config(int reload)
 		aco_option_register(&cfg_info, "safeshutdown", ACO_EXACT, general_options, DEFAULT_BATCH_SAFE_SHUTDOWN, OPT_BOOLFLAG_T, 1, FLDSET(struct ast_cdr_config, batch_settings.settings), BATCH_MODE_SAFE_SHUTDOWN);
 		aco_option_register(&cfg_info, "size", ACO_EXACT, general_options, DEFAULT_BATCH_SIZE, OPT_UINT_T, PARSE_IN_RANGE, FLDSET(struct ast_cdr_config, batch_settings.size), 0, MAX_BATCH_SIZE);
 		aco_option_register(&cfg_info, "time", ACO_EXACT, general_options, DEFAULT_BATCH_TIME, OPT_UINT_T, PARSE_IN_RANGE, FLDSET(struct ast_cdr_config, batch_settings.time), 0, MAX_BATCH_TIME);
+		aco_option_register(&cfg_info, "spool", ACO_EXACT, general_options, DEFAULT_SPOOL, OPT_BOOLFLAG_T, 1, FLDSET(struct ast_cdr_config, settings), CDR_SPOOL);
 	}
 
 	if (aco_process_config(&cfg_info, reload)) {
@@ -4102,6 +5023,7 @@ static void cdr_engine_shutdown(void)
 	ao2_callback(active_cdrs_by_channel, OBJ_NODATA, cdr_object_dispatch_all_cb,
 		NULL);
 	finalize_batch_mode();
+	cdr_spool_stop();
 	ast_cli_unregister_multiple(cli_commands, ARRAY_LEN(cli_commands));
 	ast_sched_context_destroy(sched);
 	sched = NULL;
@@ -4114,6 +5036,8 @@ static void cdr_engine_shutdown(void)
 	ao2_container_unregister("cdrs_by_channel");
 	ao2_ref(active_cdrs_by_channel, -1);
 	active_cdrs_by_channel = NULL;
+	ao2_cleanup(active_cdrs_by_party_b);
+	active_cdrs_by_party_b = NULL;
 }
 
 static void cdr_enable_batch_mode(struct ast_cdr_config *config)
@@ -4179,7 +5103,13 @@ static int cdr_toggle_runtime_options(void)
 		} else {
 			ast_log(LOG_NOTICE, "CDR simple logging enabled.\n");
 		}
+		if (ast_test_flag(&mod_cfg->general->settings, CDR_SPOOL)) {
+			cdr_spool_start();
+		} else {
+			cdr_spool_stop();
+		}
 	} else {
+		cdr_spool_stop();
 		destroy_subscriptions();
 		ast_log(LOG_NOTICE, "CDR logging disabled.\n");
 	}
@@ -4223,6 +5153,12 @@ int ast_cdr_engine_init(void)
 	}
 	ao2_container_register("cdrs_by_channel", active_cdrs_by_channel, cdr_container_print_fn);
 
+	active_cdrs_by_party_b = ao2_container_alloc(NUM_CDR_BUCKETS,
+		cdr_party_b_link_hash_fn, cdr_party_b_link_cmp_fn);
+	if (!active_cdrs_by_party_b) {
+		return -1;
+	}
+
 	sched = ast_sched_context_create();
 	if (!sched) {
 		ast_log(LOG_ERROR, "Unable to create schedule context.\n");
@@ -4267,6 +5203,10 @@ void ast_cdr_engine_term(void)
 	if (ast_test_flag(&mod_cfg->general->settings, CDR_BATCHMODE)) {
 		cdr_submit_batch(ast_test_flag(&mod_cfg->general->batch_settings.settings, BATCH_MODE_SAFE_SHUTDOWN));
 	}
+
+	/* Give the backends what they can take now; the rest waits for the next start */
+	while (cdr_spool_ship()) {
+	}
 }
 
 int ast_cdr_engine_reload(void)
@@ -142,6 +142,9 @@ static AO2_GLOBAL_OBJ_STATIC(cel_backends);
 /*! The number of buckets into which backend names will be hashed */
 #define BACKEND_BUCKETS 13
 
+/*! The maximum number of events that may be waiting for a backend */
+#define BACKEND_QUEUE_MAX 10000
+
 /*! Container for dial end multichannel blobs for holding on to dial statuses */
 static AO2_GLOBAL_OBJ_STATIC(cel_dialstatus_store);
 
@@ -312,8 +315,20 @@ static const char * const cel_event_types[CEL_MAX_EVENT_IDS] = {
 	[AST_CEL_LOCAL_OPTIMIZE]   = "LOCAL_OPTIMIZE",
 };
 
+/*! \brief An event waiting to be given to a backend */
+struct cel_queued_event {
+	AST_LIST_ENTRY(cel_queued_event) list;
+	unsigned char event[0];      /*!< A copy of the \ref ast_event */
+};
+
 struct cel_backend {
 	ast_cel_backend_cb callback; /*!< Callback for this backend */
+	struct ast_taskprocessor *serializer; /*!< Serializer events are given to the backend on */
+	AST_LIST_HEAD_NOLOCK(, cel_queued_event) queue; /*!< Events waiting for the backend */
+	unsigned int queued;         /*!< Number of events in the queue */
+	unsigned int dropped;        /*!< Number of events dropped because the queue was full */
+	unsigned int overflowing:1;  /*!< Set while events are being dropped */
+	unsigned int unregistered:1; /*!< Set once the backend no longer accepts events */
 	char name[0];                /*!< Name of this backend */
 };
 
@@ -507,7 +522,10 @@ static char *handle_cli_status(struct ast_cli_entry *e, int cmd, struct ast_cli_
 
 		iter = ao2_iterator_init(backends, 0);
 		for (; (backend = ao2_iterator_next(&iter)); ao2_ref(backend, -1)) {
-			ast_cli(a->fd, "CEL Event Subscriber: %s\n", backend->name);
+			ao2_lock(backend);
+			ast_cli(a->fd, "CEL Event Subscriber: %s (queued: %u, dropped: %u)\n",
+				backend->name, backend->queued, backend->dropped);
+			ao2_unlock(backend);
 		}
 		ao2_iterator_destroy(&iter);
 	}
@@ -651,11 +669,97 @@ struct ast_event *ast_cel_create_event(struct ast_channel_snapshot *snapshot,
 		AST_EVENT_IE_END);
 }
 
+/*!
+ * \internal
+ * \brief Give all of the events queued for a backend to it
+ *
+ * \note Runs on the backend's serializer, so events reach a backend one at a
+ * time and in the order they were generated.
+ */
+static int cel_backend_drain(void *data)
+{
+	struct cel_backend *backend = data;
+	AST_LIST_HEAD_NOLOCK(, cel_queued_event) events;
+	struct cel_queued_event *queued;
+
+	AST_LIST_HEAD_INIT_NOLOCK(&events);
+
+	ao2_lock(backend);
+	AST_LIST_APPEND_LIST(&events, &backend->queue, list);
+	backend->queued = 0;
+	ao2_unlock(backend);
+
+	while ((queued = AST_LIST_REMOVE_HEAD(&events, list))) {
+		backend->callback((struct ast_event *) queued->event);
+		ast_free(queued);
+	}
+
+	ao2_ref(backend, -1);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Queue a copy of an event for a backend
+ *
+ * \details The stasis router thread that generates events never waits on a
+ * backend. A drain task is pushed to the backend's serializer when its queue
+ * goes from empty to not empty, so a slow backend is given every event that
+ * built up while it was busy in one go. Once \ref BACKEND_QUEUE_MAX events are
+ * waiting, new events for that backend are dropped and counted.
+ */
 static int cel_backend_send_cb(void *obj, void *arg, int flags)
 {
 	struct cel_backend *backend = obj;
+	struct ast_event *event = arg;
+	struct cel_queued_event *queued;
+	size_t event_len = ast_event_get_size(event);
+
+	ao2_lock(backend);
+	if (backend->unregistered) {
+		ao2_unlock(backend);
+		return 0;
+	}
+
+	if (backend->queued >= BACKEND_QUEUE_MAX) {
+		++backend->dropped;
+		if (!backend->overflowing) {
+			backend->overflowing = 1;
+			ast_log(LOG_WARNING, "CEL backend '%s' has %u events waiting; dropping events until it catches up\n",
+				backend->name, backend->queued);
+		}
+		ao2_unlock(backend);
+		return 0;
+	}
+
+	if (backend->overflowing) {
+		backend->overflowing = 0;
+		ast_log(LOG_NOTICE, "CEL backend '%s' caught up; %u events dropped in total\n",
+			backend->name, backend->dropped);
+	}
+
+	queued = ast_malloc(sizeof(*queued) + event_len);
+	if (!queued) {
+		++backend->dropped;
+		ao2_unlock(backend);
+		return 0;
+	}
+	memcpy(queued->event, event, event_len);
+
+	if (AST_LIST_EMPTY(&backend->queue)) {
+		ao2_ref(backend, +1);
+		if (ast_taskprocessor_push(backend->serializer, cel_backend_drain, backend)) {
+			ao2_ref(backend, -1);
+			++backend->dropped;
+			ao2_unlock(backend);
+			ast_free(queued);
+			return 0;
+		}
+	}
+	AST_LIST_INSERT_TAIL(&backend->queue, queued, list);
+	++backend->queued;
+	ao2_unlock(backend);
 
-	backend->callback(arg);
 	return 0;
 }
 
@@ -1879,36 +1983,109 @@ void ast_cel_set_config(struct ast_cel_general_config *config)
 	}
 }
 
+struct cel_backend_flush_data {
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	int done;
+};
+
+static int cel_backend_flush_task(void *data)
+{
+	struct cel_backend_flush_data *flush = data;
+
+	ast_mutex_lock(&flush->lock);
+	flush->done = 1;
+	ast_cond_signal(&flush->cond);
+	ast_mutex_unlock(&flush->lock);
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Wait until a backend has been given every event queued for it
+ */
+static void cel_backend_flush(struct cel_backend *backend)
+{
+	struct cel_backend_flush_data flush = { .done = 0, };
+
+	ast_mutex_init(&flush.lock);
+	ast_cond_init(&flush.cond, NULL);
+
+	ast_mutex_lock(&flush.lock);
+	if (ast_taskprocessor_push(backend->serializer, cel_backend_flush_task, &flush)) {
+		ast_log(LOG_WARNING, "Unable to wait for CEL backend '%s' to finish its queued events\n",
+			backend->name);
+	} else {
+		while (!flush.done) {
+			ast_cond_wait(&flush.cond, &flush.lock);
+		}
+	}
+	ast_mutex_unlock(&flush.lock);
+
+	ast_mutex_destroy(&flush.lock);
+	ast_cond_destroy(&flush.cond);
+}
+
 int ast_cel_backend_unregister(const char *name)
 {
 	struct ao2_container *backends = ao2_global_obj_ref(cel_backends);
+	struct cel_backend *backend;
 
 	if (backends) {
-		ao2_find(backends, name, OBJ_SEARCH_KEY | OBJ_NODATA | OBJ_UNLINK);
+		backend = ao2_find(backends, name, OBJ_SEARCH_KEY | OBJ_UNLINK);
 		ao2_ref(backends, -1);
+		if (backend) {
+			/* The backend's module may be unloaded once we return, so it
+			 * must not be called after this.
+			 */
+			ao2_lock(backend);
+			backend->unregistered = 1;
+			ao2_unlock(backend);
+			cel_backend_flush(backend);
+			ao2_ref(backend, -1);
+		}
 	}
 
 	return 0;
 }
 
+static void cel_backend_dtor(void *obj)
+{
+	struct cel_backend *backend = obj;
+	struct cel_queued_event *queued;
+
+	while ((queued = AST_LIST_REMOVE_HEAD(&backend->queue, list))) {
+		ast_free(queued);
+	}
+	ast_taskprocessor_unreference(backend->serializer);
+}
+
 int ast_cel_backend_register(const char *name, ast_cel_backend_cb backend_callback)
 {
 	RAII_VAR(struct ao2_container *, backends, ao2_global_obj_ref(cel_backends), ao2_cleanup);
 	struct cel_backend *backend;
+	char tps_name[AST_TASKPROCESSOR_MAX_NAME + 1];
 
 	if (!backends || ast_strlen_zero(name) || !backend_callback) {
 		return -1;
 	}
 
-	/* The backend object is immutable so it doesn't need a lock of its own. */
-	backend = ao2_alloc_options(sizeof(*backend) + 1 + strlen(name), NULL,
-		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	/* The backend's lock protects its event queue. */
+	backend = ao2_alloc(sizeof(*backend) + 1 + strlen(name), cel_backend_dtor);
 	if (!backend) {
 		return -1;
 	}
 	strcpy(backend->name, name);/* Safe */
 	backend->callback = backend_callback;
 
+	ast_taskprocessor_build_name(tps_name, sizeof(tps_name), "cel/%s", name);
+	backend->serializer = ast_taskprocessor_get(tps_name, TPS_REF_DEFAULT);
+	if (!backend->serializer) {
+		ao2_ref(backend, -1);
+		return -1;
+	}
+
 	ao2_link(backends, backend);
 	ao2_ref(backend, -1);
 	return 0;
@@ -75,12 +75,18 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/test.h"
 #include "asterisk/stasis_channels.h"
 #include "asterisk/max_forwards.h"
+#include "asterisk/latency.h"
+#include "asterisk/channel_cpu.h"
+#include "asterisk/taskprocessor.h"
+#include "asterisk/vector.h"
 
 /*** DOCUMENTATION
  ***/
 
-#ifdef HAVE_EPOLL
+#if defined(HAVE_EPOLL)
 #include <sys/epoll.h>
+#elif defined(HAVE_KQUEUE)
+#include <sys/event.h>
 #endif
 
 #if defined(KEEP_TILL_CHANNEL_PARTY_NUMBER_INFO_NEEDED)
@@ -89,11 +95,6 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #endif	/* defined(HAVE_PRI) */
 #endif	/* defined(KEEP_TILL_CHANNEL_PARTY_NUMBER_INFO_NEEDED) */
 
-struct ast_epoll_data {
-	struct ast_channel *chan;
-	int which;
-};
-
 /* uncomment if you have problems with 'monitoring' synchronized files */
 #if 0
 #define MONITOR_CONSTANT_DELAY
@@ -127,13 +128,154 @@ struct chanlist {
 static AST_RWLIST_HEAD_STATIC(backends, chanlist);
 
 #ifdef LOW_MEMORY
+#define NUM_CHANNEL_SHARDS 1
 #define NUM_CHANNEL_BUCKETS 61
 #else
-#define NUM_CHANNEL_BUCKETS 1567
+#define NUM_CHANNEL_SHARDS 16
+#define NUM_CHANNEL_BUCKETS 101
 #endif
 
-/*! \brief All active channels on the system */
-static struct ao2_container *channels;
+/*!
+ * \brief All active channels on the system
+ *
+ * Channels are spread over several independently locked containers by the
+ * hash of their name so that creating, destroying and looking up channels
+ * does not serialize on a single lock.  A channel's name may only change
+ * while the containers of both its old and new names are locked.
+ */
+static struct ao2_container *channels[NUM_CHANNEL_SHARDS];
+
+/*!
+ * \brief All active channels on the system ordered by name
+ *
+ * Used for channel name prefix lookups.  This lock is always taken after
+ * the locks of the channels containers and never while holding a channel
+ * lock.
+ */
+static struct ao2_container *channels_by_name;
+
+/*!
+ * \brief All active channels on the system ordered by unique ID
+ *
+ * Used for exact and prefix unique ID lookups.  Same locking rules as
+ * channels_by_name.  A channel's unique ID only changes in a masquerade,
+ * while it is unlinked.
+ */
+static struct ao2_container *channels_by_uniqueid;
+
+/*!
+ * \brief Serialize the linking of channels with assigned unique IDs
+ *
+ * Picked by hash of the assigned ID, so only channels assigned the same
+ * ID, or IDs with the same hash, wait on each other.
+ */
+static ast_mutex_t channel_id_locks[NUM_CHANNEL_SHARDS];
+
+/*! \brief Lock the channel ID locks of assigned unique IDs, lowest index first */
+static void channel_id_lock(const struct ast_assigned_ids *assignedids, unsigned int *lock1, unsigned int *lock2)
+{
+	*lock1 = (unsigned int) ast_str_hash(S_OR(assignedids->uniqueid, "")) % NUM_CHANNEL_SHARDS;
+	*lock2 = (unsigned int) ast_str_hash(S_OR(assignedids->uniqueid2, "")) % NUM_CHANNEL_SHARDS;
+	if (*lock2 < *lock1) {
+		unsigned int swap = *lock1;
+
+		*lock1 = *lock2;
+		*lock2 = swap;
+	}
+
+	ast_mutex_lock(&channel_id_locks[*lock1]);
+	if (*lock2 != *lock1) {
+		ast_mutex_lock(&channel_id_locks[*lock2]);
+	}
+}
+
+static void channel_id_unlock(unsigned int lock1, unsigned int lock2)
+{
+	if (lock2 != lock1) {
+		ast_mutex_unlock(&channel_id_locks[lock2]);
+	}
+	ast_mutex_unlock(&channel_id_locks[lock1]);
+}
+
+/*! \brief Channels hung up whose last reference the reaper drops */
+static AST_VECTOR(reaper_channels, struct ast_channel *) reaper_channels;
+
+/*! \brief Protects reaper_channels and reaper_tps */
+AST_MUTEX_DEFINE_STATIC(reaper_lock);
+
+/*! \brief Taskprocessor destroying the channels hung up */
+static struct ast_taskprocessor *reaper_tps;
+
+/*! \brief Get the index of the channels container for a channel name */
+static unsigned int channel_shard(const char *name)
+{
+	if (ast_strlen_zero(name)) {
+		return 0;
+	}
+	return (unsigned int) ast_str_case_hash(name) % NUM_CHANNEL_SHARDS;
+}
+
+static void channels_lock_all(void)
+{
+	int i;
+
+	for (i = 0; i < NUM_CHANNEL_SHARDS; ++i) {
+		ao2_lock(channels[i]);
+	}
+}
+
+static void channels_unlock_all(void)
+{
+	int i;
+
+	for (i = NUM_CHANNEL_SHARDS - 1; i >= 0; --i) {
+		ao2_unlock(channels[i]);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Link a channel into the channels containers
+ *
+ * \pre The channels container for the channel's name is locked.
+ */
+static void channel_link_locked(struct ast_channel *chan)
+{
+	ao2_link_flags(channels[channel_shard(ast_channel_name(chan))], chan, OBJ_NOLOCK);
+	ao2_link(channels_by_name, chan);
+	ao2_link(channels_by_uniqueid, chan);
+}
+
+/*!
+ * \internal
+ * \brief Unlink a channel from the channels containers
+ *
+ * \pre The channels container for the channel's name is locked.
+ */
+static void channel_unlink_locked(struct ast_channel *chan)
+{
+	ao2_unlink_flags(channels[channel_shard(ast_channel_name(chan))], chan, OBJ_NOLOCK);
+	ao2_unlink(channels_by_name, chan);
+	ao2_unlink(channels_by_uniqueid, chan);
+}
+
+/*! \brief Unlink a channel from the channels containers, safe even if already unlinked */
+static void channel_unlink(struct ast_channel *chan)
+{
+	unsigned int shard;
+
+	for (;;) {
+		shard = channel_shard(ast_channel_name(chan));
+		ao2_lock(channels[shard]);
+		/* The name may have changed before we got the lock. */
+		if (shard == channel_shard(ast_channel_name(chan))) {
+			break;
+		}
+		ao2_unlock(channels[shard]);
+	}
+	channel_unlink_locked(chan);
+	ao2_unlock(channels[shard]);
+}
 
 /*! \brief map AST_CAUSE's to readable string representations
  *
@@ -503,13 +645,26 @@ static int ast_channel_softhangup_cb(void *obj, void *arg, int flags)
 
 void ast_softhangup_all(void)
 {
-	ao2_callback(channels, OBJ_NODATA | OBJ_MULTIPLE, ast_channel_softhangup_cb, NULL);
+	int i;
+
+	for (i = 0; i < NUM_CHANNEL_SHARDS; ++i) {
+		ao2_callback(channels[i], OBJ_NODATA | OBJ_MULTIPLE, ast_channel_softhangup_cb, NULL);
+	}
 }
 
 /*! \brief returns number of active/allocated channels */
 int ast_active_channels(void)
 {
-	return channels ? ao2_container_count(channels) : 0;
+	int count = 0;
+	int i;
+
+	if (!channels_by_name) {
+		return 0;
+	}
+	for (i = 0; i < NUM_CHANNEL_SHARDS; ++i) {
+		count += ao2_container_count(channels[i]);
+	}
+	return count;
 }
 
 int ast_undestroyed_channels(void)
@@ -685,7 +840,7 @@ static void publish_cache_clear(struct ast_channel *chan)
 	}
 
 	message = stasis_cache_clear_create(clear_msg);
-	stasis_publish(ast_channel_topic(chan), message);
+	stasis_publish(ast_channel_topic_for_publish(chan), message);
 }
 
 /*! \brief Gives the string form of a given channel state.
@@ -767,18 +922,17 @@ static const struct ast_channel_tech null_tech = {
 
 static void ast_channel_destructor(void *obj);
 static void ast_dummy_channel_destructor(void *obj);
-static int ast_channel_by_uniqueid_cb(void *obj, void *arg, void *data, int flags);
+static void *channel_by_uniqueid(const char *uniqueid, size_t id_len, int flags);
 
 static int does_id_conflict(const char *uniqueid)
 {
 	struct ast_channel *conflict;
-	int length = 0;
 
 	if (ast_strlen_zero(uniqueid)) {
 		return 0;
 	}
 
-	conflict = ast_channel_callback(ast_channel_by_uniqueid_cb, (char *) uniqueid, &length, OBJ_NOLOCK);
+	conflict = channel_by_uniqueid(uniqueid, 0, 0);
 	if (conflict) {
 		ast_log(LOG_ERROR, "Channel Unique ID '%s' already in use by channel %s(%p)\n",
 			uniqueid, ast_channel_name(conflict), conflict);
@@ -789,6 +943,124 @@ static int does_id_conflict(const char *uniqueid)
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Create the event queue that keeps a channel's fds registered.
+ *
+ * \retval -1 if there is no event queue, in which case the channel's fds
+ * are polled each time they are waited on.
+ */
+static int channel_evq_create(void)
+{
+#if defined(HAVE_EPOLL)
+	return epoll_create1(EPOLL_CLOEXEC);
+#elif defined(HAVE_KQUEUE)
+	return kqueue();
+#else
+	return -1;
+#endif
+}
+
+/*!
+ * \internal
+ * \brief Register an fd with a channel's event queue.
+ *
+ * \param evq Event queue of the channel
+ * \param fd Descriptor to add, or update if it is already queued
+ * \param which Index of the descriptor on the channel
+ *
+ * \retval 0 on success
+ * \retval -1 on failure, with errno set
+ */
+static int channel_evq_add(int evq, int fd, int which)
+{
+#if defined(HAVE_EPOLL)
+	struct epoll_event ev = { 0, };
+
+	ev.events = EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP;
+	ev.data.u32 = which;
+	if (!epoll_ctl(evq, EPOLL_CTL_ADD, fd, &ev)) {
+		return 0;
+	}
+	if (errno == EEXIST) {
+		return epoll_ctl(evq, EPOLL_CTL_MOD, fd, &ev);
+	}
+	return -1;
+#elif defined(HAVE_KQUEUE)
+	struct kevent kev;
+
+	EV_SET(&kev, fd, EVFILT_READ, EV_ADD, 0, 0, (void *) (intptr_t) which);
+	return kevent(evq, &kev, 1, NULL, 0, NULL) ? -1 : 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*!
+ * \internal
+ * \brief Remove an fd from a channel's event queue.
+ *
+ * \note Closing a descriptor removes it from the queue, so failures are
+ * expected and ignored.
+ */
+static void channel_evq_del(int evq, int fd)
+{
+#if defined(HAVE_EPOLL)
+	struct epoll_event ev = { 0, };
+
+	epoll_ctl(evq, EPOLL_CTL_DEL, fd, &ev);
+#elif defined(HAVE_KQUEUE)
+	struct kevent kev;
+
+	EV_SET(&kev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	kevent(evq, &kev, 1, NULL, 0, NULL);
+#endif
+}
+
+/*!
+ * \internal
+ * \brief Wait for one of the fds in a channel's event queue.
+ *
+ * \param evq Event queue of the channel
+ * \param ms Milliseconds to wait, or -1 to wait forever
+ * \param[out] which Index of the fd that is ready
+ * \param[out] exception Set if there is priority data on the fd
+ *
+ * \retval 1 if an fd is ready
+ * \retval 0 on timeout
+ * \retval -1 on failure, with errno set
+ */
+static int channel_evq_wait(int evq, int ms, int *which, int *exception)
+{
+#if defined(HAVE_EPOLL)
+	struct epoll_event ev;
+	int res;
+
+	res = epoll_wait(evq, &ev, 1, ms);
+	if (res > 0) {
+		*which = ev.data.u32;
+		*exception = (ev.events & EPOLLPRI) ? 1 : 0;
+	}
+	return res;
+#elif defined(HAVE_KQUEUE)
+	struct kevent kev;
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+	int res;
+
+	res = kevent(evq, NULL, 0, &kev, 1, ms < 0 ? NULL : &ts);
+	if (res > 0) {
+		*which = (int) (intptr_t) kev.udata;
+		/* kqueue does not single out priority data */
+		*exception = 0;
+	}
+	return res;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 /*! \brief Create a new channel structure */
 static struct ast_channel * attribute_malloc __attribute__((format(printf, 15, 0)))
 __ast_channel_alloc_ap(int needqueue, int state, const char *cid_num, const char *cid_name,
@@ -804,6 +1076,9 @@ __ast_channel_alloc_ap(int needqueue, int state, const char *cid_num, const char
 	struct ast_sched_context *schedctx;
 	struct ast_timer *timer;
 	struct timeval now;
+	unsigned int shard;
+	unsigned int id_lock1 = 0;
+	unsigned int id_lock2 = 0;
 	const struct ast_channel_tech *channel_tech;
 
 	/* If shutting down, don't allocate any new channels */
@@ -845,9 +1120,7 @@ __ast_channel_alloc_ap(int needqueue, int state, const char *cid_num, const char
 	ast_channel_internal_alertpipe_clear(tmp);
 	ast_channel_internal_fd_clear_all(tmp);
 
-#ifdef HAVE_EPOLL
-	ast_channel_epfd_set(tmp, epoll_create(25));
-#endif
+	ast_channel_epfd_set(tmp, channel_evq_create());
 
 	if (!(schedctx = ast_sched_context_create())) {
 		ast_log(LOG_WARNING, "Channel allocation failed: Unable to create schedule context\n");
@@ -910,8 +1183,6 @@ __ast_channel_alloc_ap(int needqueue, int state, const char *cid_num, const char
 	now = ast_tvnow();
 	ast_channel_creationtime_set(tmp, &now);
 
-	ast_channel_internal_setup_topics(tmp);
-
 	if (!ast_strlen_zero(name_fmt)) {
 		char *slash, *slash2;
 		/* Almost every channel is calling this function, and setting the name via the ast_string_field_build() call.
@@ -975,22 +1246,29 @@ __ast_channel_alloc_ap(int needqueue, int state, const char *cid_num, const char
 	 */
 	ast_channel_lock(tmp);
 
-	ao2_lock(channels);
-
-	if (assignedids && (does_id_conflict(assignedids->uniqueid) || does_id_conflict(assignedids->uniqueid2))) {
-		ast_channel_internal_errno_set(AST_CHANNEL_ERROR_ID_EXISTS);
-		ao2_unlock(channels);
-		ast_channel_unlock(tmp);
-		/* See earlier channel creation abort comment above. */
-		return ast_channel_unref(tmp);
+	if (assignedids) {
+		/* Hold off other channels assigned the same IDs until this channel is linked. */
+		channel_id_lock(assignedids, &id_lock1, &id_lock2);
+		if (does_id_conflict(assignedids->uniqueid) || does_id_conflict(assignedids->uniqueid2)) {
+			ast_channel_internal_errno_set(AST_CHANNEL_ERROR_ID_EXISTS);
+			channel_id_unlock(id_lock1, id_lock2);
+			ast_channel_unlock(tmp);
+			/* See earlier channel creation abort comment above. */
+			return ast_channel_unref(tmp);
+		}
 	}
 
 	/* Finalize and link into the channels container. */
 	ast_channel_internal_finalize(tmp);
 	ast_atomic_fetchadd_int(&chancount, +1);
-	ao2_link_flags(channels, tmp, OBJ_NOLOCK);
+	shard = channel_shard(ast_channel_name(tmp));
+	ao2_lock(channels[shard]);
+	channel_link_locked(tmp);
+	ao2_unlock(channels[shard]);
 
-	ao2_unlock(channels);
+	if (assignedids) {
+		channel_id_unlock(id_lock1, id_lock2);
+	}
 
 	if (endpoint) {
 		ast_endpoint_add_channel(endpoint, tmp);
@@ -1053,14 +1331,10 @@ struct ast_channel *ast_dummy_channel_alloc(void)
 	ast_channel_timingfd_set(tmp, -1);
 	ast_channel_internal_alertpipe_clear(tmp);
 	ast_channel_internal_fd_clear_all(tmp);
-#ifdef HAVE_EPOLL
 	ast_channel_epfd_set(tmp, -1);
-#endif
 
 	ast_channel_hold_state_set(tmp, AST_CONTROL_UNHOLD);
 
-	ast_channel_internal_setup_topics(tmp);
-
 	headp = ast_channel_varshead(tmp);
 	AST_LIST_HEAD_INIT_NOLOCK(headp);
 
@@ -1318,7 +1592,52 @@ void ast_channel_undefer_dtmf(struct ast_channel *chan)
 struct ast_channel *ast_channel_callback(ao2_callback_data_fn *cb_fn, void *arg,
 		void *data, int ao2_flags)
 {
-	return ao2_callback_data(channels, ao2_flags, cb_fn, arg, data);
+	struct ao2_container *matches;
+	struct ao2_iterator *iter;
+	struct ast_channel *chan;
+	int i;
+
+	if (ao2_flags & OBJ_KEY) {
+		/* Only one container can hold the named channel. */
+		return ao2_callback_data(channels[channel_shard(arg)], ao2_flags, cb_fn, arg, data);
+	}
+
+	if (!(ao2_flags & OBJ_MULTIPLE) || (ao2_flags & OBJ_NODATA)) {
+		for (i = 0; i < NUM_CHANNEL_SHARDS; ++i) {
+			chan = ao2_callback_data(channels[i], ao2_flags, cb_fn, arg, data);
+			if (chan) {
+				return chan;
+			}
+		}
+		return NULL;
+	}
+
+	/* Gather the matches of every container behind one iterator. */
+	matches = ao2_container_alloc_list(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, NULL, NULL);
+	if (!matches) {
+		return NULL;
+	}
+	for (i = 0; i < NUM_CHANNEL_SHARDS; ++i) {
+		struct ao2_iterator *found;
+
+		found = ao2_callback_data(channels[i], ao2_flags, cb_fn, arg, data);
+		if (!found) {
+			continue;
+		}
+		while ((chan = ao2_iterator_next(found))) {
+			ao2_link(matches, chan);
+			ast_channel_unref(chan);
+		}
+		ao2_iterator_destroy(found);
+	}
+
+	iter = ast_malloc(sizeof(*iter));
+	if (iter) {
+		*iter = ao2_iterator_init(matches, AO2_ITERATOR_UNLINK | AO2_ITERATOR_MALLOCD);
+	}
+	ao2_ref(matches, -1);
+
+	return (struct ast_channel *) iter;
 }
 
 static int ast_channel_by_name_cb(void *obj, void *arg, void *data, int flags)
@@ -1388,6 +1707,64 @@ static int ast_channel_by_uniqueid_cb(void *obj, void *arg, void *data, int flag
 	return ret;
 }
 
+/*!
+ * \internal
+ * \brief Search the name index for channels whose name starts with a prefix
+ *
+ * \param name The prefix
+ * \param name_len Length of the prefix
+ * \param flags ao2 search flags
+ *
+ * \return What ao2_callback_data() returns for the flags.
+ */
+static void *channel_by_name_prefix(const char *name, size_t name_len, int flags)
+{
+	char *prefix;
+
+	if (ast_strlen_zero(name)) {
+		/* Let the callback complain */
+		return ast_channel_callback(ast_channel_by_name_cb, (char *) name, &name_len, flags);
+	}
+
+	/* Prefix matches are all adjacent in the name index */
+	prefix = ast_alloca(name_len + 1);
+	ast_copy_string(prefix, name, name_len + 1);
+
+	return ao2_callback_data(channels_by_name, flags | OBJ_SEARCH_PARTIAL_KEY,
+		ast_channel_by_name_cb, prefix, &name_len);
+}
+
+/*!
+ * \internal
+ * \brief Search the unique ID index for channels
+ *
+ * \param uniqueid The unique ID, or a prefix of it
+ * \param id_len Length of the prefix, 0 for the whole unique ID
+ * \param flags ao2 search flags
+ *
+ * \return What ao2_callback_data() returns for the flags.
+ */
+static void *channel_by_uniqueid(const char *uniqueid, size_t id_len, int flags)
+{
+	char *prefix;
+
+	if (ast_strlen_zero(uniqueid)) {
+		/* Let the callback complain */
+		return ast_channel_callback(ast_channel_by_uniqueid_cb, (char *) uniqueid, &id_len, flags);
+	}
+
+	if (!id_len) {
+		return ao2_callback_data(channels_by_uniqueid, flags | OBJ_SEARCH_KEY,
+			ast_channel_by_uniqueid_cb, (char *) uniqueid, &id_len);
+	}
+
+	prefix = ast_alloca(id_len + 1);
+	ast_copy_string(prefix, uniqueid, id_len + 1);
+
+	return ao2_callback_data(channels_by_uniqueid, flags | OBJ_SEARCH_PARTIAL_KEY,
+		ast_channel_by_uniqueid_cb, prefix, &id_len);
+}
+
 struct ast_channel_iterator {
 	/* storage for non-dynamically allocated iterator */
 	struct ao2_iterator simple_iterator;
@@ -1395,6 +1772,8 @@ struct ast_channel_iterator {
 	 * allocated iterator)
 	 */
 	struct ao2_iterator *active_iterator;
+	/* channels container being iterated by an all channels iterator, or -1 */
+	int shard;
 };
 
 struct ast_channel_iterator *ast_channel_iterator_destroy(struct ast_channel_iterator *i)
@@ -1414,6 +1793,7 @@ struct ast_channel_iterator *ast_channel_iterator_by_exten_new(const char *exten
 	if (!(i = ast_calloc(1, sizeof(*i)))) {
 		return NULL;
 	}
+	i->shard = -1;
 
 	i->active_iterator = (void *) ast_channel_callback(ast_channel_by_exten_cb,
 		l_context, l_exten, OBJ_MULTIPLE);
@@ -1433,10 +1813,15 @@ struct ast_channel_iterator *ast_channel_iterator_by_name_new(const char *name,
 	if (!(i = ast_calloc(1, sizeof(*i)))) {
 		return NULL;
 	}
+	i->shard = -1;
 
-	i->active_iterator = (void *) ast_channel_callback(ast_channel_by_name_cb,
-		l_name, &name_len,
-		OBJ_MULTIPLE | (name_len == 0 /* match the whole word, so optimize */ ? OBJ_KEY : 0));
+	if (name_len == 0) {
+		/* match the whole word, so optimize */
+		i->active_iterator = (void *) ast_channel_callback(ast_channel_by_name_cb,
+			l_name, &name_len, OBJ_MULTIPLE | OBJ_KEY);
+	} else {
+		i->active_iterator = channel_by_name_prefix(name, name_len, OBJ_MULTIPLE);
+	}
 	if (!i->active_iterator) {
 		ast_free(i);
 		return NULL;
@@ -1453,7 +1838,8 @@ struct ast_channel_iterator *ast_channel_iterator_all_new(void)
 		return NULL;
 	}
 
-	i->simple_iterator = ao2_iterator_init(channels, 0);
+	i->shard = 0;
+	i->simple_iterator = ao2_iterator_init(channels[0], 0);
 	i->active_iterator = &i->simple_iterator;
 
 	return i;
@@ -1461,7 +1847,16 @@ struct ast_channel_iterator *ast_channel_iterator_all_new(void)
 
 struct ast_channel *ast_channel_iterator_next(struct ast_channel_iterator *i)
 {
-	return ao2_iterator_next(i->active_iterator);
+	struct ast_channel *chan;
+
+	while (!(chan = ao2_iterator_next(i->active_iterator))
+		&& 0 <= i->shard && i->shard < NUM_CHANNEL_SHARDS - 1) {
+		/* Move on to the next channels container */
+		ao2_iterator_destroy(&i->simple_iterator);
+		i->simple_iterator = ao2_iterator_init(channels[++i->shard], 0);
+	}
+
+	return chan;
 }
 
 /* Legacy function, not currently used for lookups, but we need a cmp_fn */
@@ -1476,8 +1871,12 @@ struct ast_channel *ast_channel_get_by_name_prefix(const char *name, size_t name
 	struct ast_channel *chan;
 	char *l_name = (char *) name;
 
-	chan = ast_channel_callback(ast_channel_by_name_cb, l_name, &name_len,
-		(name_len == 0) /* optimize if it is a complete name match */ ? OBJ_KEY : 0);
+	if (name_len == 0) {
+		/* optimize if it is a complete name match */
+		chan = ast_channel_callback(ast_channel_by_name_cb, l_name, &name_len, OBJ_KEY);
+	} else {
+		chan = channel_by_name_prefix(name, name_len, 0);
+	}
 	if (chan) {
 		return chan;
 	}
@@ -1488,7 +1887,7 @@ struct ast_channel *ast_channel_get_by_name_prefix(const char *name, size_t name
 	}
 
 	/* Now try a search for uniqueid. */
-	return ast_channel_callback(ast_channel_by_uniqueid_cb, l_name, &name_len, 0);
+	return channel_by_uniqueid(l_name, name_len, 0);
 }
 
 struct ast_channel *ast_channel_get_by_name(const char *name)
@@ -1612,7 +2011,7 @@ int ast_safe_sleep(struct ast_channel *chan, int ms)
 struct ast_channel *ast_channel_release(struct ast_channel *chan)
 {
 	/* Safe, even if already unlinked. */
-	ao2_unlink(channels, chan);
+	channel_unlink(chan);
 	return ast_channel_unref(chan);
 }
 
@@ -2220,9 +2619,6 @@ void ast_party_redirecting_free(struct ast_party_redirecting *doomed)
 static void ast_channel_destructor(void *obj)
 {
 	struct ast_channel *chan = obj;
-#ifdef HAVE_EPOLL
-	int i;
-#endif
 	struct ast_var_t *vardata;
 	struct ast_frame *f;
 	struct varshead *headp;
@@ -2322,14 +2718,10 @@ static void ast_channel_destructor(void *obj)
 		ast_timer_close(ast_channel_timer(chan));
 		ast_channel_timer_set(chan, NULL);
 	}
-#ifdef HAVE_EPOLL
-	for (i = 0; i < AST_MAX_FDS; i++) {
-		if (ast_channel_internal_epfd_data(chan, i)) {
-			ast_free(ast_channel_internal_epfd_data(chan, i));
-		}
+	if (ast_channel_epfd(chan) > -1) {
+		close(ast_channel_epfd(chan));
+		ast_channel_epfd_set(chan, -1);
 	}
-	close(ast_channel_epfd(chan));
-#endif
 	while ((f = AST_LIST_REMOVE_HEAD(ast_channel_readq(chan), frame_list)))
 		ast_frfree(f);
 
@@ -2483,80 +2875,53 @@ struct ast_datastore *ast_channel_datastore_find(struct ast_channel *chan, const
 /*! Set the file descriptor on the channel */
 void ast_channel_set_fd(struct ast_channel *chan, int which, int fd)
 {
-#ifdef HAVE_EPOLL
-	struct epoll_event ev;
-	struct ast_epoll_data *aed = NULL;
+	int evq = ast_channel_epfd(chan);
+	int old = ast_channel_fd(chan, which);
+	int x;
 
-	if (ast_channel_fd_isset(chan, which)) {
-		epoll_ctl(ast_channel_epfd(chan), EPOLL_CTL_DEL, ast_channel_fd(chan, which), &ev);
-		aed = ast_channel_internal_epfd_data(chan, which);
-	}
+	ast_channel_internal_fd_set(chan, which, fd);
 
-	/* If this new fd is valid, add it to the epoll */
-	if (fd > -1) {
-		if (!aed && (!(aed = ast_calloc(1, sizeof(*aed)))))
-			return;
+	if (evq < 0) {
+		return;
+	}
 
-		ast_channel_internal_epfd_data_set(chan, which, aed);
-		aed->chan = chan;
-		aed->which = which;
+	/* Leave the old descriptor queued if it is still in use at another index */
+	if (old > -1 && old != fd) {
+		for (x = 0; x < AST_MAX_FDS; x++) {
+			if (ast_channel_fd(chan, x) == old) {
+				break;
+			}
+		}
+		if (x == AST_MAX_FDS) {
+			channel_evq_del(evq, old);
+		}
+	}
 
-		ev.events = EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP;
-		ev.data.ptr = aed;
-		epoll_ctl(ast_channel_epfd(chan), EPOLL_CTL_ADD, fd, &ev);
-	} else if (aed) {
-		/* We don't have to keep around this epoll data structure now */
-		ast_free(aed);
-		ast_channel_epfd_data_set(chan, which, NULL);
+	/*
+	 * Always (re)register the new descriptor. One with the same number
+	 * as the old one may still be a different file.
+	 */
+	if (fd > -1 && channel_evq_add(evq, fd, which)
+		&& !ast_channel_internal_epfd_incomplete(chan)) {
+		/*
+		 * The queue is kept open since another thread may be waiting on
+		 * it, but from now on the channel's fds are polled instead.
+		 */
+		ast_debug(3, "Channel '%s' fd %d cannot be queued (%s), waiting with poll instead\n",
+			ast_channel_name(chan), fd, strerror(errno));
+		ast_channel_internal_epfd_incomplete_set(chan, 1);
 	}
-#endif
-	ast_channel_internal_fd_set(chan, which, fd);
-	return;
 }
 
 /*! Add a channel to an optimized waitfor */
 void ast_poll_channel_add(struct ast_channel *chan0, struct ast_channel *chan1)
 {
-#ifdef HAVE_EPOLL
-	struct epoll_event ev;
-	int i = 0;
-
-	if (ast_channel_epfd(chan0) == -1)
-		return;
-
-	/* Iterate through the file descriptors on chan1, adding them to chan0 */
-	for (i = 0; i < AST_MAX_FDS; i++) {
-		if (!ast_channel_fd_isset(chan1, i)) {
-			continue;
-		}
-		ev.events = EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP;
-		ev.data.ptr = ast_channel_internal_epfd_data(chan1, i);
-		epoll_ctl(ast_channel_epfd(chan0), EPOLL_CTL_ADD, ast_channel_fd(chan1, i), &ev);
-	}
-
-#endif
-	return;
+	/* Each channel's fds are registered with its own event queue already */
 }
 
 /*! Delete a channel from an optimized waitfor */
 void ast_poll_channel_del(struct ast_channel *chan0, struct ast_channel *chan1)
 {
-#ifdef HAVE_EPOLL
-	struct epoll_event ev;
-	int i = 0;
-
-	if (ast_channel_epfd(chan0) == -1)
-		return;
-
-	for (i = 0; i < AST_MAX_FDS; i++) {
-		if (!ast_channel_fd_isset(chan1, i)) {
-			continue;
-		}
-		epoll_ctl(ast_channel_epfd(chan0), EPOLL_CTL_DEL, ast_channel_fd(chan1, i), &ev);
-	}
-
-#endif
-	return;
 }
 
 void ast_channel_clear_softhangup(struct ast_channel *chan, int flag)
@@ -2670,6 +3035,61 @@ static void destroy_hooks(struct ast_channel *chan)
 }
 
 /*! \brief Hangup a channel */
+/*!
+ * \internal
+ * \brief Drop the references to the channels queued for the reaper
+ */
+static int channel_reaper_task(void *data)
+{
+	struct reaper_channels batch;
+
+	ast_mutex_lock(&reaper_lock);
+	batch = reaper_channels;
+	AST_VECTOR_INIT(&reaper_channels, 0);
+	ast_mutex_unlock(&reaper_lock);
+
+	AST_VECTOR_CALLBACK_VOID(&batch, ast_channel_unref);
+	AST_VECTOR_FREE(&batch);
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Drop the reference to a channel hung up, destroying it in the reaper
+ *
+ * Destroying a channel publishes its final snapshot and frees its
+ * datastores, translators and CDR.  When the last reference is the one
+ * being dropped the channel is queued, so the thread hanging it up is not
+ * held up.  The reaper destroys everything queued by the time it runs in
+ * one go.
+ */
+static void channel_reap(struct ast_channel *chan)
+{
+	int queued = 0;
+
+	if (ao2_ref(chan, 0) > 1) {
+		/* Somebody else destroys it */
+		ast_channel_unref(chan);
+		return;
+	}
+
+	ast_mutex_lock(&reaper_lock);
+	if (reaper_tps && !AST_VECTOR_APPEND(&reaper_channels, chan)) {
+		queued = 1;
+		if (AST_VECTOR_SIZE(&reaper_channels) == 1
+			&& ast_taskprocessor_push(reaper_tps, channel_reaper_task, NULL)) {
+			AST_VECTOR_REMOVE_UNORDERED(&reaper_channels, 0);
+			queued = 0;
+		}
+	}
+	ast_mutex_unlock(&reaper_lock);
+
+	if (!queued) {
+		ast_channel_unref(chan);
+	}
+}
+
 void ast_hangup(struct ast_channel *chan)
 {
 	/* Be NULL safe for RAII_VAR() usage. */
@@ -2703,7 +3123,8 @@ void ast_hangup(struct ast_channel *chan)
 	 * longer be needed.
 	 */
 	ast_pbx_hangup_handler_run(chan);
-	ao2_unlink(channels, chan);
+	AST_CHANNEL_CPU_HANGUP(chan);
+	channel_unlink(chan);
 	ast_channel_lock(chan);
 
 	destroy_hooks(chan);
@@ -2747,7 +3168,7 @@ void ast_hangup(struct ast_channel *chan)
 
 	ast_cc_offer(chan);
 
-	ast_channel_unref(chan);
+	channel_reap(chan);
 }
 
 /*!
@@ -3063,14 +3484,23 @@ int ast_waitfor_n_fd(int *fds, int n, int *ms, int *exception)
 	return winner;
 }
 
+/*!
+ * \internal
+ * \brief Get the event queue to wait on for a channel
+ *
+ * \retval -1 if the channel's fds must be polled individually
+ */
+static int channel_waitfor_evq(struct ast_channel *chan)
+{
+	if (ast_channel_internal_epfd_incomplete(chan)) {
+		return -1;
+	}
+	return ast_channel_epfd(chan);
+}
+
 /*! \brief Wait for x amount of time on a file descriptor to have input.  */
-#ifdef HAVE_EPOLL
-static struct ast_channel *ast_waitfor_nandfds_classic(struct ast_channel **c, int n, int *fds, int nfds,
-					int *exception, int *outfd, int *ms)
-#else
 struct ast_channel *ast_waitfor_nandfds(struct ast_channel **c, int n, int *fds, int nfds,
 					int *exception, int *outfd, int *ms)
-#endif
 {
 	struct timeval start = { 0 , 0 };
 	struct pollfd *pfds = NULL;
@@ -3081,9 +3511,12 @@ struct ast_channel *ast_waitfor_nandfds(struct ast_channel **c, int n, int *fds,
 	struct timeval now = { 0, 0 };
 	struct timeval whentohangup = { 0, 0 }, diff;
 	struct ast_channel *winner = NULL;
+	/* Event queue of the only channel when no other fds are waited on */
+	int single_evq = -1;
+	int which = 0, priority = 0;
 	struct fdmap {
 		int chan;
-		int fdno;
+		int fdno;	/*!< -1 if this is the channel's event queue */
 	} *fdmap = NULL;
 
 	if (outfd) {
@@ -3093,7 +3526,13 @@ struct ast_channel *ast_waitfor_nandfds(struct ast_channel **c, int n, int *fds,
 		*exception = 0;
 	}
 
-	if ((sz = n * AST_MAX_FDS + nfds)) {
+	if (n == 1 && !nfds) {
+		single_evq = channel_waitfor_evq(c[0]);
+	}
+
+	if (single_evq > -1) {
+		sz = 0;
+	} else if ((sz = n * AST_MAX_FDS + nfds)) {
 		pfds = ast_alloca(sizeof(*pfds) * sz);
 		fdmap = ast_alloca(sizeof(*fdmap) * sz);
 	} else {
@@ -3135,15 +3574,26 @@ struct ast_channel *ast_waitfor_nandfds(struct ast_channel **c, int n, int *fds,
 	 * Build the pollfd array, putting the channels' fds first,
 	 * followed by individual fds. Order is important because
 	 * individual fd's must have priority over channel fds.
+	 * A channel with an event queue needs only the queue polled.
 	 */
 	max = 0;
 	for (x = 0; x < n; x++) {
-		for (y = 0; y < AST_MAX_FDS; y++) {
-			fdmap[max].fdno = y;  /* fd y is linked to this pfds */
-			fdmap[max].chan = x;  /* channel x is linked to this pfds */
-			max += ast_add_fd(&pfds[max], ast_channel_fd(c[x], y));
-		}
+		int evq;
+
 		ast_channel_lock(c[x]);
+		if (single_evq > -1) {
+			/* Waiting directly on the event queue */
+		} else if ((evq = channel_waitfor_evq(c[x])) > -1) {
+			fdmap[max].fdno = -1;
+			fdmap[max].chan = x;
+			max += ast_add_fd(&pfds[max], evq);
+		} else {
+			for (y = 0; y < AST_MAX_FDS; y++) {
+				fdmap[max].fdno = y;  /* fd y is linked to this pfds */
+				fdmap[max].chan = x;  /* channel x is linked to this pfds */
+				max += ast_add_fd(&pfds[max], ast_channel_fd(c[x], y));
+			}
+		}
 		CHECK_BLOCKING(c[x]);
 		ast_channel_unlock(c[x]);
 	}
@@ -3163,11 +3613,17 @@ struct ast_channel *ast_waitfor_nandfds(struct ast_channel **c, int n, int *fds,
 			if (kbrms > 600000) {
 				kbrms = 600000;
 			}
-			res = ast_poll(pfds, max, kbrms);
+			if (single_evq > -1) {
+				res = channel_evq_wait(single_evq, kbrms, &which, &priority);
+			} else {
+				res = ast_poll(pfds, max, kbrms);
+			}
 			if (!res) {
 				rms -= kbrms;
 			}
 		} while (!res && (rms > 0));
+	} else if (single_evq > -1) {
+		res = channel_evq_wait(single_evq, rms, &which, &priority);
 	} else {
 		res = ast_poll(pfds, max, rms);
 	}
@@ -3198,6 +3654,17 @@ struct ast_channel *ast_waitfor_nandfds(struct ast_channel **c, int n, int *fds,
 		*ms = 0;	/* XXX use 0 since we may not have an exact timeout. */
 		return winner;
 	}
+	if (single_evq > -1) {
+		winner = c[0];
+		ast_channel_lock(winner);
+		if (priority) {
+			ast_set_flag(ast_channel_flags(winner), AST_FLAG_EXCEPTION);
+		} else {
+			ast_clear_flag(ast_channel_flags(winner), AST_FLAG_EXCEPTION);
+		}
+		ast_channel_fdno_set(winner, which);
+		ast_channel_unlock(winner);
+	}
 	/*
 	 * Then check if any channel or fd has a pending event.
 	 * Remember to check channels first and fds last, as they
@@ -3209,6 +3676,15 @@ struct ast_channel *ast_waitfor_nandfds(struct ast_channel **c, int n, int *fds,
 			continue;
 		}
 		if (fdmap[x].chan >= 0) {	/* this is a channel */
+			if (fdmap[x].fdno < 0) {
+				/* Find out which of the channel's fds is ready */
+				if (channel_evq_wait(pfds[x].fd, 0, &which, &priority) <= 0) {
+					continue;
+				}
+				res = priority ? POLLPRI : POLLIN;
+			} else {
+				which = fdmap[x].fdno;
+			}
 			winner = c[fdmap[x].chan];	/* override previous winners */
 			ast_channel_lock(winner);
 			if (res & POLLPRI) {
@@ -3216,7 +3692,7 @@ struct ast_channel *ast_waitfor_nandfds(struct ast_channel **c, int n, int *fds,
 			} else {
 				ast_clear_flag(ast_channel_flags(winner), AST_FLAG_EXCEPTION);
 			}
-			ast_channel_fdno_set(winner, fdmap[x].fdno);
+			ast_channel_fdno_set(winner, which);
 			ast_channel_unlock(winner);
 		} else {			/* this is an fd */
 			if (outfd) {
@@ -3237,205 +3713,6 @@ struct ast_channel *ast_waitfor_nandfds(struct ast_channel **c, int n, int *fds,
 	return winner;
 }
 
-#ifdef HAVE_EPOLL
-static struct ast_channel *ast_waitfor_nandfds_simple(struct ast_channel *chan, int *ms)
-{
-	struct timeval start = { 0 , 0 };
-	int res = 0;
-	struct epoll_event ev[1];
-	long diff, rms = *ms;
-	struct ast_channel *winner = NULL;
-	struct ast_epoll_data *aed = NULL;
-
-	ast_channel_lock(chan);
-	/* Figure out their timeout */
-	if (!ast_tvzero(*ast_channel_whentohangup(chan))) {
-		if ((diff = ast_tvdiff_ms(*ast_channel_whentohangup(chan), ast_tvnow())) < 0) {
-			/* They should already be hungup! */
-			ast_channel_softhangup_internal_flag_add(chan, AST_SOFTHANGUP_TIMEOUT);
-			ast_channel_unlock(chan);
-			return NULL;
-		}
-		/* If this value is smaller then the current one... make it priority */
-		if (rms > diff) {
-			rms = diff;
-		}
-	}
-
-	ast_channel_unlock(chan);
-
-	/* Time to make this channel block... */
-	CHECK_BLOCKING(chan);
-
-	if (*ms > 0) {
-		start = ast_tvnow();
-	}
-
-	/* We don't have to add any file descriptors... they are already added, we just have to wait! */
-	res = epoll_wait(ast_channel_epfd(chan), ev, 1, rms);
-
-	/* Stop blocking */
-	ast_clear_flag(ast_channel_flags(chan), AST_FLAG_BLOCKING);
-
-	/* Simulate a timeout if we were interrupted */
-	if (res < 0) {
-		if (errno != EINTR) {
-			*ms = -1;
-		}
-		return NULL;
-	}
-
-	/* If this channel has a timeout see if it expired */
-	if (!ast_tvzero(*ast_channel_whentohangup(chan))) {
-		if (ast_tvdiff_ms(ast_tvnow(), *ast_channel_whentohangup(chan)) >= 0) {
-			ast_channel_softhangup_internal_flag_add(chan, AST_SOFTHANGUP_TIMEOUT);
-			winner = chan;
-		}
-	}
-
-	/* No fd ready, reset timeout and be done for now */
-	if (!res) {
-		*ms = 0;
-		return winner;
-	}
-
-	/* See what events are pending */
-	aed = ev[0].data.ptr;
-	ast_channel_fdno_set(chan, aed->which);
-	if (ev[0].events & EPOLLPRI) {
-		ast_set_flag(ast_channel_flags(chan), AST_FLAG_EXCEPTION);
-	} else {
-		ast_clear_flag(ast_channel_flags(chan), AST_FLAG_EXCEPTION);
-	}
-
-	if (*ms > 0) {
-		*ms -= ast_tvdiff_ms(ast_tvnow(), start);
-		if (*ms < 0) {
-			*ms = 0;
-		}
-	}
-
-	return chan;
-}
-
-static struct ast_channel *ast_waitfor_nandfds_complex(struct ast_channel **c, int n, int *ms)
-{
-	struct timeval start = { 0 , 0 };
-	int res = 0, i;
-	struct epoll_event ev[25] = { { 0, } };
-	struct timeval now = { 0, 0 };
-	long whentohangup = 0, diff = 0, rms = *ms;
-	struct ast_channel *winner = NULL;
-
-	for (i = 0; i < n; i++) {
-		ast_channel_lock(c[i]);
-		if (!ast_tvzero(*ast_channel_whentohangup(c[i]))) {
-			if (whentohangup == 0) {
-				now = ast_tvnow();
-			}
-			if ((diff = ast_tvdiff_ms(*ast_channel_whentohangup(c[i]), now)) < 0) {
-				ast_channel_softhangup_internal_flag_add(c[i], AST_SOFTHANGUP_TIMEOUT);
-				ast_channel_unlock(c[i]);
-				return c[i];
-			}
-			if (!whentohangup || whentohangup > diff) {
-				whentohangup = diff;
-			}
-		}
-		ast_channel_unlock(c[i]);
-		CHECK_BLOCKING(c[i]);
-	}
-
-	rms = *ms;
-	if (whentohangup) {
-		rms = whentohangup;
-		if (*ms >= 0 && *ms < rms) {
-			rms = *ms;
-		}
-	}
-
-	if (*ms > 0) {
-		start = ast_tvnow();
-	}
-
-	res = epoll_wait(ast_channel_epfd(c[0]), ev, 25, rms);
-
-	for (i = 0; i < n; i++) {
-		ast_clear_flag(ast_channel_flags(c[i]), AST_FLAG_BLOCKING);
-	}
-
-	if (res < 0) {
-		if (errno != EINTR) {
-			*ms = -1;
-		}
-		return NULL;
-	}
-
-	if (whentohangup) {
-		now = ast_tvnow();
-		for (i = 0; i < n; i++) {
-			if (!ast_tvzero(*ast_channel_whentohangup(c[i])) && ast_tvdiff_ms(now, *ast_channel_whentohangup(c[i])) >= 0) {
-				ast_channel_softhangup_internal_flag_add(c[i], AST_SOFTHANGUP_TIMEOUT);
-				if (!winner) {
-					winner = c[i];
-				}
-			}
-		}
-	}
-
-	if (!res) {
-		*ms = 0;
-		return winner;
-	}
-
-	for (i = 0; i < res; i++) {
-		struct ast_epoll_data *aed = ev[i].data.ptr;
-
-		if (!ev[i].events || !aed) {
-			continue;
-		}
-
-		winner = aed->chan;
-		if (ev[i].events & EPOLLPRI) {
-			ast_set_flag(ast_channel_flags(winner), AST_FLAG_EXCEPTION);
-		} else {
-			ast_clear_flag(ast_channel_flags(winner), AST_FLAG_EXCEPTION);
-		}
-		ast_channel_fdno_set(winner, aed->which);
-	}
-
-	if (*ms > 0) {
-		*ms -= ast_tvdiff_ms(ast_tvnow(), start);
-		if (*ms < 0) {
-			*ms = 0;
-		}
-	}
-
-	return winner;
-}
-
-struct ast_channel *ast_waitfor_nandfds(struct ast_channel **c, int n, int *fds, int nfds,
-					int *exception, int *outfd, int *ms)
-{
-	/* Clear all provided values in one place. */
-	if (outfd) {
-		*outfd = -99999;
-	}
-	if (exception) {
-		*exception = 0;
-	}
-
-	/* If no epoll file descriptor is available resort to classic nandfds */
-	if (!n || nfds || ast_channel_epfd(c[0]) == -1) {
-		return ast_waitfor_nandfds_classic(c, n, fds, nfds, exception, outfd, ms);
-	} else if (!nfds && n == 1) {
-		return ast_waitfor_nandfds_simple(c[0], ms);
-	} else {
-		return ast_waitfor_nandfds_complex(c, n, ms);
-	}
-}
-#endif
-
 struct ast_channel *ast_waitfor_n(struct ast_channel **c, int n, int *ms)
 {
 	return ast_waitfor_nandfds(c, n, NULL, 0, NULL, NULL, ms);
@@ -4395,12 +4672,30 @@ done:
 
 struct ast_frame *ast_read(struct ast_channel *chan)
 {
-	return __ast_read(chan, 0);
+	struct ast_frame *f;
+	AST_LATENCY_DECLARE(start);
+	AST_CHANNEL_CPU_DECLARE(cpu);
+
+	AST_LATENCY_START(start);
+	AST_CHANNEL_CPU_START(cpu, chan);
+	f = __ast_read(chan, 0);
+	AST_CHANNEL_CPU_END(cpu);
+	AST_LATENCY_END(AST_LATENCY_CHANNEL_READ, start);
+	return f;
 }
 
 struct ast_frame *ast_read_noaudio(struct ast_channel *chan)
 {
-	return __ast_read(chan, 1);
+	struct ast_frame *f;
+	AST_LATENCY_DECLARE(start);
+	AST_CHANNEL_CPU_DECLARE(cpu);
+
+	AST_LATENCY_START(start);
+	AST_CHANNEL_CPU_START(cpu, chan);
+	f = __ast_read(chan, 1);
+	AST_CHANNEL_CPU_END(cpu);
+	AST_LATENCY_END(AST_LATENCY_CHANNEL_READ, start);
+	return f;
 }
 
 int ast_indicate(struct ast_channel *chan, int condition)
@@ -5091,7 +5386,7 @@ static void adjust_frame_for_plc(struct ast_channel *chan, struct ast_frame *fra
 		frame->data.ptr = plc->samples_buf + AST_FRIENDLY_OFFSET;
 		frame->datalen = num_new_samples * 2;
 		frame->offset = AST_FRIENDLY_OFFSET * 2;
-	} else {
+	} else if (!ast_frame_unshare(frame)) {
 		plc_rx(&plc->plc_state, frame->data.ptr, frame->samples);
 	}
 }
@@ -5128,12 +5423,18 @@ int ast_write(struct ast_channel *chan, struct ast_frame *fr)
 	struct ast_frame *f = NULL;
 	int count = 0;
 	int hooked = 0;
+	AST_LATENCY_DECLARE(start);
+	AST_CHANNEL_CPU_DECLARE(cpu);
+
+	AST_LATENCY_START(start);
+	AST_CHANNEL_CPU_START(cpu, chan);
 
 	/*Deadlock avoidance*/
 	while(ast_channel_trylock(chan)) {
 		/*cannot goto done since the channel is not locked*/
 		if(count++ > 10) {
 			ast_debug(1, "Deadlock avoided for write to channel '%s'\n", ast_channel_name(chan));
+			AST_CHANNEL_CPU_END(cpu);
 			return 0;
 		}
 		usleep(1);
@@ -5455,6 +5756,8 @@ done:
 		ast_channel_audiohooks_set(chan, NULL);
 	}
 	ast_channel_unlock(chan);
+	AST_CHANNEL_CPU_END(cpu);
+	AST_LATENCY_END(AST_LATENCY_CHANNEL_WRITE, start);
 	return res;
 }
 
@@ -6635,14 +6938,42 @@ static void __ast_change_name_nolink(struct ast_channel *chan, const char *newna
 
 void ast_change_name(struct ast_channel *chan, const char *newname)
 {
-	/* We must re-link, as the hash value will change here. */
-	ao2_lock(channels);
+	unsigned int old_shard;
+	unsigned int new_shard = channel_shard(newname);
+
+	/*
+	 * We must re-link, as the hash value will change here.  The name
+	 * cannot change while its container is locked, so lock both
+	 * containers in order and then check we picked the right old one.
+	 */
+	for (;;) {
+		old_shard = channel_shard(ast_channel_name(chan));
+		ao2_lock(channels[MIN(old_shard, new_shard)]);
+		if (old_shard != new_shard) {
+			ao2_lock(channels[MAX(old_shard, new_shard)]);
+		}
+		if (old_shard == channel_shard(ast_channel_name(chan))) {
+			break;
+		}
+		if (old_shard != new_shard) {
+			ao2_unlock(channels[MAX(old_shard, new_shard)]);
+		}
+		ao2_unlock(channels[MIN(old_shard, new_shard)]);
+	}
+
+	/* The name index lock must not be taken while holding the channel lock. */
+	ao2_unlink(channels_by_name, chan);
 	ast_channel_lock(chan);
-	ao2_unlink(channels, chan);
+	ao2_unlink_flags(channels[old_shard], chan, OBJ_NOLOCK);
 	__ast_change_name_nolink(chan, newname);
-	ao2_link(channels, chan);
+	ao2_link_flags(channels[new_shard], chan, OBJ_NOLOCK);
 	ast_channel_unlock(chan);
-	ao2_unlock(channels);
+	ao2_link(channels_by_name, chan);
+
+	if (old_shard != new_shard) {
+		ao2_unlock(channels[MAX(old_shard, new_shard)]);
+	}
+	ao2_unlock(channels[MIN(old_shard, new_shard)]);
 }
 
 void ast_channel_inherit_variables(const struct ast_channel *parent, struct ast_channel *child)
@@ -6770,7 +7101,7 @@ static void channel_do_masquerade(struct ast_channel *original, struct ast_chann
 	ast_indicate_data(clonechan, AST_CONTROL_MASQUERADE_NOTIFY, &x, sizeof(x));
 
 	/*
-	 * The container lock is necessary for proper locking order
+	 * The container locks are necessary for proper locking order
 	 * because the channels must be unlinked to change their
 	 * names.
 	 *
@@ -6781,15 +7112,15 @@ static void channel_do_masquerade(struct ast_channel *original, struct ast_chann
 	 * has restabilized the channels to hold off ast_hangup() and until
 	 * AST_FLAG_ZOMBIE can be set on the clonechan.
 	 */
-	ao2_lock(channels);
+	channels_lock_all();
 
 	/* Bump the refs to ensure that they won't dissapear on us. */
 	ast_channel_ref(original);
 	ast_channel_ref(clonechan);
 
 	/* unlink from channels container as name (which is the hash value) will change */
-	ao2_unlink(channels, original);
-	ao2_unlink(channels, clonechan);
+	channel_unlink_locked(original);
+	channel_unlink_locked(clonechan);
 
 	moh_is_playing = ast_test_flag(ast_channel_flags(original), AST_FLAG_MOH);
 	if (moh_is_playing) {
@@ -7179,9 +7510,9 @@ static void channel_do_masquerade(struct ast_channel *original, struct ast_chann
 	ast_channel_unlock(original);
 	ast_channel_unlock(clonechan);
 
-	ao2_link(channels, clonechan);
-	ao2_link(channels, original);
-	ao2_unlock(channels);
+	channel_link_locked(clonechan);
+	channel_link_locked(original);
+	channels_unlock_all();
 
 	/* Release our held safety references. */
 	ast_channel_unref(original);
@@ -7656,6 +7987,42 @@ static int ast_channel_hash_cb(const void *obj, const int flags)
 	return ast_str_case_hash(name);
 }
 
+static int ast_channel_name_sort_cb(const void *obj_left, const void *obj_right, int flags)
+{
+	const struct ast_channel *left = obj_left;
+	const char *right_key = obj_right;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+		right_key = ast_channel_name(obj_right);
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		return strcasecmp(ast_channel_name(left), right_key);
+	case OBJ_SEARCH_PARTIAL_KEY:
+		return strncasecmp(ast_channel_name(left), right_key, strlen(right_key));
+	default:
+		return 0;
+	}
+}
+
+static int ast_channel_uniqueid_sort_cb(const void *obj_left, const void *obj_right, int flags)
+{
+	const struct ast_channel *left = obj_left;
+	const char *right_key = obj_right;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+		right_key = ast_channel_uniqueid(obj_right);
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		return strcasecmp(ast_channel_uniqueid(left), right_key);
+	case OBJ_SEARCH_PARTIAL_KEY:
+		return strncasecmp(ast_channel_uniqueid(left), right_key, strlen(right_key));
+	default:
+		return 0;
+	}
+}
+
 int ast_plc_reload(void)
 {
 	struct ast_variable *var;
@@ -7945,31 +8312,73 @@ struct varshead *ast_channel_get_manager_vars(struct ast_channel *chan)
 	return ret;
 }
 
+static void channels_containers_destroy(void)
+{
+	int i;
+
+	ao2_cleanup(channels_by_uniqueid);
+	channels_by_uniqueid = NULL;
+	ao2_cleanup(channels_by_name);
+	channels_by_name = NULL;
+	for (i = 0; i < NUM_CHANNEL_SHARDS; ++i) {
+		ao2_cleanup(channels[i]);
+		channels[i] = NULL;
+	}
+}
+
 static void channels_shutdown(void)
 {
+	struct ast_taskprocessor *tps;
+
+	ast_mutex_lock(&reaper_lock);
+	tps = reaper_tps;
+	reaper_tps = NULL;
+	ast_mutex_unlock(&reaper_lock);
+	ast_taskprocessor_unreference(tps);
+	channel_reaper_task(NULL);
+
 	free_channelvars();
 
 	ast_data_unregister(NULL);
 	ast_cli_unregister_multiple(cli_channel, ARRAY_LEN(cli_channel));
-	if (channels) {
+	if (channels_by_name) {
 		ao2_container_unregister("channels");
-		ao2_ref(channels, -1);
-		channels = NULL;
 	}
+	channels_containers_destroy();
 	ast_channel_unregister(&surrogate_tech);
 }
 
 int ast_channels_init(void)
 {
-	channels = ao2_container_alloc(NUM_CHANNEL_BUCKETS,
-			ast_channel_hash_cb, ast_channel_cmp_cb);
-	if (!channels) {
+	int i;
+
+	for (i = 0; i < NUM_CHANNEL_SHARDS; ++i) {
+		ast_mutex_init(&channel_id_locks[i]);
+		channels[i] = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX,
+			AO2_CONTAINER_ALLOC_OPT_AUTO_RESIZE, NUM_CHANNEL_BUCKETS,
+			ast_channel_hash_cb, NULL, ast_channel_cmp_cb);
+		if (!channels[i]) {
+			channels_containers_destroy();
+			return -1;
+		}
+	}
+	channels_by_name = ao2_container_alloc_rbtree(AO2_ALLOC_OPT_LOCK_MUTEX,
+		AO2_CONTAINER_ALLOC_OPT_DUPS_ALLOW, ast_channel_name_sort_cb, NULL);
+	channels_by_uniqueid = ao2_container_alloc_rbtree(AO2_ALLOC_OPT_LOCK_MUTEX,
+		AO2_CONTAINER_ALLOC_OPT_DUPS_ALLOW, ast_channel_uniqueid_sort_cb, NULL);
+	if (!channels_by_name || !channels_by_uniqueid) {
+		channels_containers_destroy();
 		return -1;
 	}
-	ao2_container_register("channels", channels, prnt_channel_key);
+	ao2_container_register("channels", channels_by_name, prnt_channel_key);
 
 	ast_channel_register(&surrogate_tech);
 
+	reaper_tps = ast_taskprocessor_get("channel_reaper", TPS_REF_DEFAULT);
+	if (!reaper_tps) {
+		ast_log(LOG_WARNING, "Unable to create the channel reaper, channels are destroyed by the threads hanging them up\n");
+	}
+
 	ast_stasis_channels_init();
 
 	ast_cli_register_multiple(cli_channel, ARRAY_LEN(cli_channel));
@@ -8098,6 +8507,7 @@ static int silence_generator_generate(struct ast_channel *chan, void *data, int
 		.datalen = sizeof(buf),
 	};
 	frame.subclass.format = ast_format_slin;
+	ast_set_flag(&frame, AST_FRFLAG_SILENCE);
 
 	memset(buf, 0, sizeof(buf));
 
@@ -10593,7 +11003,7 @@ int ast_channel_get_cc_agent_type(struct ast_channel *chan, char *agent_type, si
 
 void ast_channel_unlink(struct ast_channel *chan)
 {
-	ao2_unlink(channels, chan);
+	channel_unlink(chan);
 }
 
 struct ast_bridge *ast_channel_get_bridge(const struct ast_channel *chan)
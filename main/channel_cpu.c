@@ -0,0 +1,164 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Per channel CPU accounting
+ */
+
+/*** MODULEINFO
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/channel.h"
+#include "asterisk/channel_cpu.h"
+#include "asterisk/channel_internal.h"
+
+#ifdef CHANNEL_CPU_STATS
+
+#include <time.h>
+
+#include "asterisk/cdr.h"
+#include "asterisk/threadstorage.h"
+
+/*! \brief The channel a thread is counting CPU time for */
+struct channel_cpu_thread {
+	/*! The channel, or NULL if the thread works for none */
+	struct ast_channel *chan;
+	/*! The CPU clock of the thread when it last started or switched channels */
+	uint64_t since;
+};
+
+AST_THREADSTORAGE(channel_cpu_threads);
+
+/*! \brief CPU time of the channels hung up, in nanoseconds */
+static uint64_t hungup_nsec;
+
+/*! \brief Read the CPU clock of the calling thread, in nanoseconds */
+static uint64_t thread_cpu_nsec(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) {
+		return 0;
+	}
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*!
+ * \internal
+ * \brief Count the CPU time of the thread since it last switched, and switch channels
+ */
+static void channel_cpu_switch(struct channel_cpu_thread *thread, struct ast_channel *chan)
+{
+	uint64_t now = thread_cpu_nsec();
+
+	if (thread->chan && now > thread->since) {
+		ast_channel_internal_cpu_nsec_add(thread->chan, now - thread->since);
+	}
+	thread->chan = chan;
+	thread->since = now;
+}
+
+struct ast_channel *ast_channel_cpu_start(struct ast_channel *chan)
+{
+	struct channel_cpu_thread *thread;
+	struct ast_channel *prev;
+
+	thread = ast_threadstorage_get(&channel_cpu_threads, sizeof(*thread));
+	if (!thread) {
+		return NULL;
+	}
+
+	prev = thread->chan;
+	if (prev != chan) {
+		channel_cpu_switch(thread, chan);
+	}
+
+	return prev;
+}
+
+void ast_channel_cpu_end(struct ast_channel *prev)
+{
+	struct channel_cpu_thread *thread;
+
+	thread = ast_threadstorage_get(&channel_cpu_threads, sizeof(*thread));
+	if (!thread || thread->chan == prev) {
+		return;
+	}
+
+	channel_cpu_switch(thread, prev);
+}
+
+void ast_channel_cpu_hangup(struct ast_channel *chan)
+{
+	struct channel_cpu_thread *thread;
+	char value[32];
+	uint64_t nsec;
+
+	/* Count the thread's time so far, in case it is working for the channel */
+	thread = ast_threadstorage_get(&channel_cpu_threads, sizeof(*thread));
+	if (thread && thread->chan == chan) {
+		channel_cpu_switch(thread, chan);
+	}
+
+	nsec = ast_channel_internal_cpu_nsec(chan);
+	__atomic_add_fetch(&hungup_nsec, nsec, __ATOMIC_RELAXED);
+
+	snprintf(value, sizeof(value), "%" PRIu64, nsec / 1000);
+	ast_cdr_setvar(ast_channel_name(chan), "cpu_usec", value);
+}
+
+uint64_t ast_channel_cpu_usec(struct ast_channel *chan)
+{
+	return ast_channel_internal_cpu_nsec(chan) / 1000;
+}
+
+uint64_t ast_channel_cpu_usec_total(void)
+{
+	struct ast_channel_iterator *iter;
+	struct ast_channel *chan;
+	uint64_t nsec = __atomic_load_n(&hungup_nsec, __ATOMIC_RELAXED);
+
+	iter = ast_channel_iterator_all_new();
+	for (; iter && (chan = ast_channel_iterator_next(iter)); ast_channel_unref(chan)) {
+		nsec += ast_channel_internal_cpu_nsec(chan);
+	}
+	if (iter) {
+		ast_channel_iterator_destroy(iter);
+	}
+
+	return nsec / 1000;
+}
+
+#else
+
+uint64_t ast_channel_cpu_usec(struct ast_channel *chan)
+{
+	return 0;
+}
+
+uint64_t ast_channel_cpu_usec_total(void)
+{
+	return 0;
+}
+
+#endif /* CHANNEL_CPU_STATS */
@@ -50,6 +50,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/stasis_endpoints.h"
 #include "asterisk/stringfields.h"
 #include "asterisk/test.h"
+#include "asterisk/threadstorage.h"
 
 /*!
  * \brief Channel UniqueId structure
@@ -98,9 +99,6 @@ struct ast_channel {
 							 *   in the CHANNEL dialplan function */
 	struct ast_channel_monitor *monitor;		/*!< Channel monitoring */
 	struct ast_callid *callid;			/*!< Bound call identifier pointer */
-#ifdef HAVE_EPOLL
-	struct ast_epoll_data *epfd_data[AST_MAX_FDS];
-#endif
 	struct ao2_container *dialed_causes;		/*!< Contains tech-specific and Asterisk cause data from dialed channels */
 
 	AST_DECLARE_STRING_FIELDS(
@@ -199,9 +197,8 @@ struct ast_channel {
 	struct ast_format *rawreadformat;         /*!< Raw read format (before translation) */
 	struct ast_format *rawwriteformat;        /*!< Raw write format (after translation) */
 	unsigned int emulate_dtmf_duration;		/*!< Number of ms left to emulate DTMF for */
-#ifdef HAVE_EPOLL
-	int epfd;
-#endif
+	int epfd;					/*!< Event queue (epoll or kqueue) of the channel's fds, or -1 */
+	unsigned int epfd_incomplete:1;			/*!< Some of the channel's fds could not be queued */
 	int visible_indication;                         /*!< Indication currently playing on the channel */
 	int hold_state;							/*!< Current Hold/Unhold state */
 
@@ -209,6 +206,7 @@ struct ast_channel {
 
 	struct ast_bridge *bridge;                      /*!< Bridge this channel is participating in */
 	struct ast_bridge_channel *bridge_channel;/*!< The bridge_channel this channel is linked with. */
+	struct ast_channel_snapshot *snapshot;		/*!< The last snapshot created of this channel */
 	struct ast_timer *timer;			/*!< timer object that provided timingfd */
 
 	char context[AST_MAX_CONTEXT];			/*!< Dialplan: Current extension context */
@@ -224,11 +222,32 @@ struct ast_channel {
 	struct stasis_cp_single *topics;		/*!< Topic for all channel's events */
 	struct stasis_forward *endpoint_forward;	/*!< Subscription for event forwarding to endpoint's topic */
 	struct stasis_forward *endpoint_cache_forward; /*!< Subscription for cache updates to endpoint's topic */
+	uint64_t cpu_nsec;				/*!< CPU time counted for this channel, see channel_cpu.h */
 };
 
-/*! \brief The monotonically increasing integer counter for channel uniqueids */
+/*!
+ * \brief The monotonically increasing integer counter for channel uniqueids
+ *
+ * \note Values are taken in blocks per thread, so channels created within
+ * the same second by different threads are not numbered in creation order.
+ */
 static int uniqueint;
 
+/*! \brief Most uniqueid counter values a thread takes from the counter at once */
+#define UNIQUEINT_BLOCK_MAX 64
+
+/*! \brief Uniqueid counter values taken by a thread but not yet used */
+struct uniqueint_block {
+	/*! The next value to use */
+	int next;
+	/*! How many values are left */
+	int left;
+	/*! How many values to take next */
+	int size;
+};
+
+AST_THREADSTORAGE(uniqueint_blocks);
+
 /* AST_DATA definitions, which will probably have to be re-thought since the channel will be opaque */
 
 #if 0	/* XXX AstData: ast_callerid no longer exists. (Equivalent code not readily apparent.) */
@@ -598,7 +617,6 @@ void ast_channel_amaflags_set(struct ast_channel *chan, enum ama_flags value)
 	ast_channel_publish_snapshot(chan);
 }
 
-#ifdef HAVE_EPOLL
 int ast_channel_epfd(const struct ast_channel *chan)
 {
 	return chan->epfd;
@@ -607,7 +625,14 @@ void ast_channel_epfd_set(struct ast_channel *chan, int value)
 {
 	chan->epfd = value;
 }
-#endif
+int ast_channel_internal_epfd_incomplete(const struct ast_channel *chan)
+{
+	return chan->epfd_incomplete;
+}
+void ast_channel_internal_epfd_incomplete_set(struct ast_channel *chan, int value)
+{
+	chan->epfd_incomplete = value ? 1 : 0;
+}
 int ast_channel_fdno(const struct ast_channel *chan)
 {
 	return chan->fdno;
@@ -939,6 +964,14 @@ void ast_channel_callid_set(struct ast_channel *chan, struct ast_callid *callid)
 
 	chan->callid = ast_callid_ref(callid);
 
+	if (!ast_callid_debug_get(callid)) {
+		unsigned int level = ast_debug_get_by_channel(ast_channel_name(chan));
+
+		if (level) {
+			ast_callid_debug_set(callid, level);
+		}
+	}
+
 	ast_test_suite_event_notify("CallIDChange",
 		"State: CallIDChange\r\n"
 		"Channel: %s\r\n"
@@ -1311,17 +1344,6 @@ int ast_channel_fd_isset(const struct ast_channel *chan, int which)
 	return ast_channel_fd(chan, which) > -1;
 }
 
-#ifdef HAVE_EPOLL
-struct ast_epoll_data *ast_channel_internal_epfd_data(const struct ast_channel *chan, int which)
-{
-	return chan->epfd_data[which];
-}
-void ast_channel_internal_epfd_data_set(struct ast_channel *chan, int which , struct ast_epoll_data *value)
-{
-	chan->epfd_data[which] = value;
-}
-#endif
-
 pthread_t ast_channel_blocker(const struct ast_channel *chan)
 {
 	return chan->blocker;
@@ -1359,6 +1381,15 @@ void ast_channel_internal_bridge_channel_set(struct ast_channel *chan, struct as
 	chan->bridge_channel = value;
 }
 
+struct ast_channel_snapshot *ast_channel_internal_snapshot(const struct ast_channel *chan)
+{
+	return chan->snapshot;
+}
+void ast_channel_internal_snapshot_set(struct ast_channel *chan, struct ast_channel_snapshot *snapshot)
+{
+	ao2_replace(chan->snapshot, snapshot);
+}
+
 struct ast_flags *ast_channel_flags(struct ast_channel *chan)
 {
 	return &chan->flags;
@@ -1430,6 +1461,34 @@ static int pvt_cause_cmp_fn(void *obj, void *vstr, int flags)
 
 #define DIALED_CAUSES_BUCKETS 37
 
+/*!
+ * \internal
+ * \brief Get the next uniqueid counter value for the calling thread
+ *
+ * Threads take values from the shared counter in blocks, so that threads
+ * creating many channels do not all update it.  Blocks start with a single
+ * value and double each time a thread runs out, so short lived threads
+ * leave few values unused.
+ */
+static int uniqueint_next(void)
+{
+	struct uniqueint_block *block;
+
+	block = ast_threadstorage_get(&uniqueint_blocks, sizeof(*block));
+	if (!block) {
+		return ast_atomic_fetchadd_int(&uniqueint, 1);
+	}
+
+	if (!block->left) {
+		block->size = block->size ? MIN(block->size * 2, UNIQUEINT_BLOCK_MAX) : 1;
+		block->next = ast_atomic_fetchadd_int(&uniqueint, block->size);
+		block->left = block->size;
+	}
+	block->left--;
+
+	return block->next++;
+}
+
 struct ast_channel *__ast_channel_internal_alloc(void (*destructor)(void *obj), const struct ast_assigned_ids *assignedids, const struct ast_channel *requestor, const char *file, int line, const char *function)
 {
 	struct ast_channel *tmp;
@@ -1448,6 +1507,9 @@ struct ast_channel *__ast_channel_internal_alloc(void (*destructor)(void *obj),
 		return NULL;
 	}
 
+	/* The destructor must not close a descriptor it was never given */
+	tmp->epfd = -1;
+
 	if ((ast_string_field_init(tmp, 128))) {
 		return ast_channel_unref(tmp);
 	}
@@ -1458,7 +1520,7 @@ struct ast_channel *__ast_channel_internal_alloc(void (*destructor)(void *obj),
 
 	/* set the creation time in the uniqueid */
 	tmp->uniqueid.creation_time = time(NULL);
-	tmp->uniqueid.creation_unique = ast_atomic_fetchadd_int(&uniqueint, 1);
+	tmp->uniqueid.creation_unique = uniqueint_next();
 
 	/* use provided id or default to historical {system-}time.# format */
 	if (assignedids && !ast_strlen_zero(assignedids->uniqueid)) {
@@ -1540,6 +1602,17 @@ void ast_channel_internal_set_fake_ids(struct ast_channel *chan, const char *uni
 	ast_copy_string(chan->linkedid.unique_id, linkedid, sizeof(chan->linkedid.unique_id));
 }
 
+void ast_channel_internal_cpu_nsec_add(struct ast_channel *chan, uint64_t nsec)
+{
+	/* Threads working for the same channel may add at the same time */
+	__atomic_add_fetch(&chan->cpu_nsec, nsec, __ATOMIC_RELAXED);
+}
+
+uint64_t ast_channel_internal_cpu_nsec(struct ast_channel *chan)
+{
+	return __atomic_load_n(&chan->cpu_nsec, __ATOMIC_RELAXED);
+}
+
 void ast_channel_internal_cleanup(struct ast_channel *chan)
 {
 	if (chan->dialed_causes) {
@@ -1550,6 +1623,9 @@ void ast_channel_internal_cleanup(struct ast_channel *chan)
 
 	ast_string_field_free_memory(chan);
 
+	ao2_cleanup(chan->snapshot);
+	chan->snapshot = NULL;
+
 	chan->endpoint_forward = stasis_forward_cancel(chan->endpoint_forward);
 	chan->endpoint_cache_forward = stasis_forward_cancel(chan->endpoint_cache_forward);
 
@@ -1567,13 +1643,41 @@ int ast_channel_internal_is_finalized(struct ast_channel *chan)
 	return chan->finalized;
 }
 
+/*! \brief Serializes creating the topics of a channel */
+AST_MUTEX_DEFINE_STATIC(channel_topics_lock);
+
+/*!
+ * \internal
+ * \brief Get the topics of a channel, creating them if it has none yet.
+ */
+static struct stasis_cp_single *channel_topics(struct ast_channel *chan)
+{
+	const char *topic_name;
+
+	if (chan->topics) {
+		return chan->topics;
+	}
+
+	ast_mutex_lock(&channel_topics_lock);
+	if (!chan->topics) {
+		topic_name = chan->uniqueid.unique_id;
+		if (ast_strlen_zero(topic_name)) {
+			topic_name = "<dummy-channel>";
+		}
+		chan->topics = stasis_cp_single_create(ast_channel_cache_all(), topic_name);
+	}
+	ast_mutex_unlock(&channel_topics_lock);
+
+	return chan->topics;
+}
+
 struct stasis_topic *ast_channel_topic(struct ast_channel *chan)
 {
 	if (!chan) {
 		return ast_channel_topic_all();
 	}
 
-	return stasis_cp_single_topic(chan->topics);
+	return stasis_cp_single_topic(channel_topics(chan));
 }
 
 struct stasis_topic *ast_channel_topic_cached(struct ast_channel *chan)
@@ -1582,7 +1686,19 @@ struct stasis_topic *ast_channel_topic_cached(struct ast_channel *chan)
 		return ast_channel_topic_all_cached();
 	}
 
-	return stasis_cp_single_topic_cached(chan->topics);
+	return stasis_cp_single_topic_cached(channel_topics(chan));
+}
+
+struct stasis_topic *ast_channel_topic_for_publish(struct ast_channel *chan)
+{
+	struct stasis_cp_single *topics;
+
+	if (!chan) {
+		return ast_channel_topic_all();
+	}
+
+	topics = chan->topics;
+	return stasis_cp_single_topic(topics ? topics : ast_channel_topics_shared());
 }
 
 int ast_channel_forward_endpoint(struct ast_channel *chan,
@@ -1608,24 +1724,6 @@ int ast_channel_forward_endpoint(struct ast_channel *chan,
 	return 0;
 }
 
-int ast_channel_internal_setup_topics(struct ast_channel *chan)
-{
-	const char *topic_name = chan->uniqueid.unique_id;
-	ast_assert(chan->topics == NULL);
-
-	if (ast_strlen_zero(topic_name)) {
-		topic_name = "<dummy-channel>";
-	}
-
-	chan->topics = stasis_cp_single_create(
-		ast_channel_cache_all(), topic_name);
-	if (!chan->topics) {
-		return -1;
-	}
-
-	return 0;
-}
-
 AST_THREADSTORAGE(channel_errno);
 
 void ast_channel_internal_errno_set(enum ast_channel_error error)
@@ -56,6 +56,7 @@ struct ast_var_t *ast_var_assign(const char *name, const char *value)
 	ast_copy_string(var->name, name, name_len);
 	var->value = var->name + name_len;
 	ast_copy_string(var->value, value, value_len);
+	var->hash = ast_str_hash(ast_var_name(var));
 
 	return var;
 }
@@ -102,6 +103,19 @@ char *ast_var_find(const struct varshead *head, const char *name)
 	return NULL;
 }
 
+struct ast_var_t *ast_var_list_find(const struct varshead *head, const char *name)
+{
+	struct ast_var_t *var;
+	unsigned int hash = ast_str_hash(name);
+
+	AST_LIST_TRAVERSE(head, var, entries) {
+		if (var->hash == hash && !strcmp(name, ast_var_name(var))) {
+			return var;
+		}
+	}
+	return NULL;
+}
+
 struct varshead *ast_var_list_create(void)
 {
 	struct varshead *head;
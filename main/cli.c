@@ -108,6 +108,9 @@ AST_RWLIST_HEAD(module_level_list, module_level);
 /*! list of module names and their debug levels */
 static struct module_level_list debug_modules = AST_RWLIST_HEAD_INIT_VALUE;
 
+/*! list of channel name prefixes and the debug levels of their calls */
+static struct module_level_list debug_channels = AST_RWLIST_HEAD_INIT_VALUE;
+
 AST_THREADSTORAGE(ast_cli_buf);
 
 AST_RWLOCK_DEFINE_STATIC(shutdown_commands_lock);
@@ -134,6 +137,48 @@ void ast_cli(int fd, const char *fmt, ...)
 	}
 }
 
+void ast_cli_buffered(int fd, struct ast_str **buf, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!*buf && !(*buf = ast_str_create(AST_CLI_CHUNK_LEN))) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	ast_str_append_va(buf, 0, fmt, ap);
+	va_end(ap);
+
+	if (ast_str_strlen(*buf) >= AST_CLI_CHUNK_LEN) {
+		ast_cli_flush(fd, buf);
+	}
+}
+
+void ast_cli_flush(int fd, struct ast_str **buf)
+{
+	char *pos;
+	size_t left;
+	size_t len;
+
+	if (!*buf) {
+		return;
+	}
+
+	pos = ast_str_buffer(*buf);
+	left = ast_str_strlen(*buf);
+	while (left) {
+		len = MIN(left, AST_CLI_CHUNK_LEN);
+		if (ast_carefulwrite(fd, pos, len, 100)) {
+			/* The CLI went away or is not reading */
+			break;
+		}
+		pos += len;
+		left -= len;
+	}
+
+	ast_str_reset(*buf);
+}
+
 unsigned int ast_debug_get_by_module(const char *module)
 {
 	struct module_level *ml;
@@ -151,6 +196,26 @@ unsigned int ast_debug_get_by_module(const char *module)
 	return res;
 }
 
+unsigned int ast_debug_get_by_channel(const char *name)
+{
+	struct module_level *ml;
+	unsigned int res = 0;
+	size_t matched = 0;
+
+	AST_RWLIST_RDLOCK(&debug_channels);
+	AST_LIST_TRAVERSE(&debug_channels, ml, entry) {
+		size_t len = strlen(ml->module);
+
+		if (len > matched && !strncasecmp(ml->module, name, len)) {
+			res = ml->level;
+			matched = len;
+		}
+	}
+	AST_RWLIST_UNLOCK(&debug_channels);
+
+	return res;
+}
+
 unsigned int ast_verbose_get_by_module(const char *module)
 {
 	return 0;
@@ -438,6 +503,125 @@ static void status_debug_verbose(struct ast_cli_args *a, const char *what, int o
 	}
 }
 
+/*!
+ * \internal
+ * \brief Set the debug level of the calls of the channels matching a name or callid
+ *
+ * \param name Channel name prefix to match, or NULL
+ * \param callid_str Callid to match, as C-xxxxxxxx, or NULL
+ *
+ * \return the number of channels matched
+ */
+static int debug_set_channel_calls(const char *name, const char *callid_str,
+	unsigned int level, int atleast)
+{
+	struct ast_channel_iterator *iter;
+	struct ast_channel *chan;
+	struct ast_callid *callid;
+	char buf[AST_CALLID_BUFFER_LENGTH];
+	int count = 0;
+
+	iter = ast_channel_iterator_all_new();
+	if (!iter) {
+		return 0;
+	}
+
+	for (; (chan = ast_channel_iterator_next(iter)); ast_channel_unref(chan)) {
+		ast_channel_lock(chan);
+		if (name && strncasecmp(ast_channel_name(chan), name, strlen(name))) {
+			ast_channel_unlock(chan);
+			continue;
+		}
+		callid = ast_channel_callid(chan);
+		ast_channel_unlock(chan);
+		if (!callid) {
+			continue;
+		}
+
+		if (callid_str) {
+			/* Skip the leading '[' of the printed callid */
+			ast_callid_strnprint(buf, sizeof(buf), callid);
+			if (strcasecmp(buf + 1, callid_str)) {
+				ast_callid_unref(callid);
+				continue;
+			}
+		}
+
+		if (!atleast || level > ast_callid_debug_get(callid)) {
+			ast_callid_debug_set(callid, level);
+		}
+		ast_callid_unref(callid);
+		count++;
+	}
+	ast_channel_iterator_destroy(iter);
+
+	return count;
+}
+
+/*!
+ * \internal
+ * \brief Handle 'core set debug <level> {callid|channel} <id>'
+ */
+static char *handle_debug_call(struct ast_cli_args *a, const char *type, const char *id,
+	int newlevel, int atleast)
+{
+	struct module_level *ml;
+	char *callid_str;
+	int count;
+
+	if (newlevel < 0) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (!strcasecmp(type, "callid")) {
+		callid_str = ast_strip(ast_strdupa(id));
+		if (*callid_str == '[') {
+			callid_str++;
+			callid_str[strcspn(callid_str, "]")] = '\0';
+		}
+		count = debug_set_channel_calls(NULL, callid_str, newlevel, atleast);
+		if (!count) {
+			ast_cli(a->fd, "No channel has call '%s'.\n", callid_str);
+			return CLI_FAILURE;
+		}
+		ast_cli(a->fd, "Call debug has been set to %d for '%s'.\n", newlevel, callid_str);
+		return CLI_SUCCESS;
+	}
+
+	if (strcasecmp(type, "channel")) {
+		return CLI_SHOWUSAGE;
+	}
+
+	AST_RWLIST_WRLOCK(&debug_channels);
+	ml = find_module_level(id, &debug_channels);
+	if (!newlevel) {
+		if (ml) {
+			AST_RWLIST_REMOVE(&debug_channels, ml, entry);
+			ast_free(ml);
+		}
+	} else if (ml) {
+		if (!atleast || newlevel > ml->level) {
+			ml->level = newlevel;
+		}
+	} else {
+		ml = ast_calloc(1, sizeof(*ml) + strlen(id) + 1);
+		if (!ml) {
+			AST_RWLIST_UNLOCK(&debug_channels);
+			return CLI_FAILURE;
+		}
+		ml->level = newlevel;
+		strcpy(ml->module, id);
+		AST_RWLIST_INSERT_TAIL(&debug_channels, ml, entry);
+	}
+	AST_RWLIST_UNLOCK(&debug_channels);
+
+	count = debug_set_channel_calls(id, NULL, newlevel, atleast);
+	ast_cli(a->fd, "Call debug has been set to %d for channels starting with '%s' (%d current call%s).\n",
+		newlevel, id, count, ESS(count));
+
+	return CLI_SUCCESS;
+}
+
 static char *handle_debug(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	int oldval;
@@ -451,10 +635,17 @@ static char *handle_debug(struct ast_cli_entry *e, int cmd, struct ast_cli_args
 		e->command = "core set debug";
 		e->usage =
 			"Usage: core set debug [atleast] <level> [module]\n"
+			"       core set debug [atleast] <level> callid <C-xxxxxxxx>\n"
+			"       core set debug [atleast] <level> channel <name>\n"
 			"       core set debug off\n"
 			"\n"
 			"       Sets level of debug messages to be displayed or\n"
 			"       sets a module name to display debug messages from.\n"
+			"       With callid, debug messages are displayed only for\n"
+			"       the call with that identifier, as shown in the logs.\n"
+			"       With channel, they are displayed only for the calls of\n"
+			"       channels whose name starts with <name>, such as\n"
+			"       PJSIP/alice, including calls that start later.\n"
 			"       0 or off means no messages should be displayed.\n"
 			"       Equivalent to -d[d[...]] on startup\n";
 		return NULL;
@@ -502,13 +693,19 @@ static char *handle_debug(struct ast_cli_entry *e, int cmd, struct ast_cli_args
 		if (!strcasecmp(a->argv[e->args], "atleast")) {
 			atleast = 1;
 		}
-		if (a->argc != e->args + atleast + 1 && a->argc != e->args + atleast + 2) {
+		if (a->argc < e->args + atleast + 1 || a->argc > e->args + atleast + 3) {
 			return CLI_SHOWUSAGE;
 		}
 		if (sscanf(a->argv[e->args + atleast], "%30d", &newlevel) != 1) {
 			return CLI_SHOWUSAGE;
 		}
 
+		if (a->argc == e->args + atleast + 3) {
+			/* We have specified a call to debug. */
+			return handle_debug_call(a, a->argv[e->args + atleast + 1],
+				a->argv[e->args + atleast + 2], newlevel, atleast);
+		}
+
 		if (a->argc == e->args + atleast + 2) {
 			/* We have specified a module name. */
 			char *mod = ast_strdupa(a->argv[e->args + atleast + 1]);
@@ -578,6 +775,13 @@ static char *handle_debug(struct ast_cli_entry *e, int cmd, struct ast_cli_args
 		}
 		ast_clear_flag(&ast_options, AST_OPT_FLAG_DEBUG_MODULE);
 		AST_RWLIST_UNLOCK(&debug_modules);
+
+		AST_RWLIST_WRLOCK(&debug_channels);
+		while ((ml = AST_RWLIST_REMOVE_HEAD(&debug_channels, entry))) {
+			ast_free(ml);
+		}
+		AST_RWLIST_UNLOCK(&debug_channels);
+		ast_callid_debug_clear_all();
 	}
 	oldval = option_debug;
 	if (!atleast || newlevel > option_debug) {
@@ -876,6 +1080,85 @@ static char * handle_showuptime(struct ast_cli_entry *e, int cmd, struct ast_cli
 	return CLI_SUCCESS;
 }
 
+/*! \brief Time a module took to load, for 'core show startup timing' */
+struct module_load_time {
+	int64_t usec;
+	char module[0];
+};
+
+AST_VECTOR(module_load_times, struct module_load_time *);
+
+static int load_time_modentry(const char *module, int64_t usec, void *data)
+{
+	struct module_load_times *times = data;
+	struct module_load_time *time;
+
+	time = ast_malloc(sizeof(*time) + strlen(module) + 1);
+	if (!time) {
+		return 0;
+	}
+	time->usec = usec;
+	strcpy(time->module, module); /* Safe */
+	if (AST_VECTOR_APPEND(times, time)) {
+		ast_free(time);
+		return 0;
+	}
+	return 1;
+}
+
+static int load_time_cmp(const void *a, const void *b)
+{
+	const struct module_load_time *left = *(struct module_load_time * const *) a;
+	const struct module_load_time *right = *(struct module_load_time * const *) b;
+
+	return left->usec < right->usec ? 1 : left->usec > right->usec ? -1 : 0;
+}
+
+static char *handle_show_startup_timing(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct module_load_times times;
+	int64_t total = 0;
+	int i;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show startup timing";
+		e->usage =
+			"Usage: core show startup timing\n"
+			"       Shows how long the load function of each module took,\n"
+			"       slowest first.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (AST_VECTOR_INIT(&times, 256)) {
+		return CLI_FAILURE;
+	}
+	ast_module_list_load_times(load_time_modentry, &times);
+	if (AST_VECTOR_SIZE(&times)) {
+		qsort(times.elems, AST_VECTOR_SIZE(&times), sizeof(*times.elems), load_time_cmp);
+	}
+
+	ast_cli(a->fd, "%-40s %12s\n", "Module", "Load (ms)");
+	for (i = 0; i < AST_VECTOR_SIZE(&times); ++i) {
+		struct module_load_time *time = AST_VECTOR_GET(&times, i);
+
+		ast_cli(a->fd, "%-40s %12.3f\n", time->module, time->usec / 1000.0);
+		total += time->usec;
+	}
+	ast_cli(a->fd, "%d modules took %.3f ms to load\n", (int) AST_VECTOR_SIZE(&times), total / 1000.0);
+
+	AST_VECTOR_RESET(&times, ast_free);
+	AST_VECTOR_FREE(&times);
+	return CLI_SUCCESS;
+}
+
 static char *handle_modlist(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	const char *like;
@@ -980,6 +1263,7 @@ static char *handle_chanlist(struct ast_cli_entry *e, int cmd, struct ast_cli_ar
 #define VERBOSE_FORMAT_STRING2 "%-20.20s %-20.20s %-16.16s %-4.4s %-7.7s %-12.12s %-25.25s %-15.15s %8.8s %-11.11s %-11.11s %-20.20s\n"
 
 	RAII_VAR(struct ao2_container *, channels, NULL, ao2_cleanup);
+	RAII_VAR(struct ast_str *, out, NULL, ast_free);
 	struct ao2_iterator it_chans;
 	struct stasis_message *msg;
 	int numchans = 0, concise = 0, verbose = 0, count = 0;
@@ -1046,7 +1330,7 @@ static char *handle_chanlist(struct ast_cli_entry *e, int cmd, struct ast_cli_ar
 				}
 			}
 			if (concise) {
-				ast_cli(a->fd, CONCISE_FORMAT_STRING, cs->name, cs->context, cs->exten, cs->priority, ast_state2str(cs->state),
+				ast_cli_buffered(a->fd, &out, CONCISE_FORMAT_STRING, cs->name, cs->context, cs->exten, cs->priority, ast_state2str(cs->state),
 					S_OR(cs->appl, "(None)"),
 					cs->data,
 					cs->caller_number,
@@ -1057,7 +1341,7 @@ static char *handle_chanlist(struct ast_cli_entry *e, int cmd, struct ast_cli_ar
 					cs->bridgeid,
 					cs->uniqueid);
 			} else if (verbose) {
-				ast_cli(a->fd, VERBOSE_FORMAT_STRING, cs->name, cs->context, cs->exten, cs->priority, ast_state2str(cs->state),
+				ast_cli_buffered(a->fd, &out, VERBOSE_FORMAT_STRING, cs->name, cs->context, cs->exten, cs->priority, ast_state2str(cs->state),
 					S_OR(cs->appl, "(None)"),
 					S_OR(cs->data, "(Empty)"),
 					cs->caller_number,
@@ -1075,11 +1359,12 @@ static char *handle_chanlist(struct ast_cli_entry *e, int cmd, struct ast_cli_ar
 				if (!ast_strlen_zero(cs->appl)) {
 					snprintf(appdata, sizeof(appdata), "%s(%s)", cs->appl, S_OR(cs->data, ""));
 				}
-				ast_cli(a->fd, FORMAT_STRING, cs->name, locbuf, ast_state2str(cs->state), appdata);
+				ast_cli_buffered(a->fd, &out, FORMAT_STRING, cs->name, locbuf, ast_state2str(cs->state), appdata);
 			}
 		}
 	}
 	ao2_iterator_destroy(&it_chans);
+	ast_cli_flush(a->fd, &out);
 
 	if (!concise) {
 		numchans = ast_active_channels();
@@ -1854,6 +2139,8 @@ static struct ast_cli_entry cli_cli[] = {
 
 	AST_CLI_DEFINE(handle_showuptime, "Show uptime information"),
 
+	AST_CLI_DEFINE(handle_show_startup_timing, "Show how long modules took to load"),
+
 	AST_CLI_DEFINE(handle_softhangup, "Request a hangup on a given channel"),
 
 	AST_CLI_DEFINE(handle_cli_reload_permissions, "Reload CLI permissions config"),
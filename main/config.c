@@ -96,6 +96,8 @@ struct cache_file_mtime {
 	AST_LIST_ENTRY(cache_file_mtime) list;
 	AST_LIST_HEAD_NOLOCK(includes, cache_file_include) includes;
 	unsigned int has_exec:1;
+	/*! The file did not exist.  Only used by the parse cache. */
+	unsigned int missing:1;
 	/*! stat() file size */
 	unsigned long stat_size;
 	/*! stat() file modtime nanoseconds */
@@ -1719,6 +1721,328 @@ static void config_cache_attribute(const char *configfile, enum config_cache_att
 	AST_LIST_UNLOCK(&cfmtime_head);
 }
 
+/*!
+ * \brief A parsed configuration file, reused by later loads of the same file
+ *
+ * Modules often load the same file, such as pjsip.conf being loaded once for
+ * every sorcery object type, and every load used to parse it again.  The
+ * result of a parse is kept along with the modification time of every file
+ * read for it, and is copied instead of parsed as long as none of those
+ * files changed.
+ */
+struct config_parse_cache {
+	/*! The parsed configuration, only ever copied */
+	struct ast_config *cfg;
+	/*! Every file read for the parse, with the files each included */
+	AST_LIST_HEAD_NOLOCK(, cache_file_mtime) files;
+	/*! Something was read that cannot be checked for changes */
+	unsigned int uncacheable:1;
+	/*! Load flags that change the result */
+	unsigned int flags;
+	/*! Full path of the file */
+	char filename[0];
+};
+
+struct config_parse_cache_key {
+	const char *filename;
+	unsigned int flags;
+};
+
+/*! \brief Load flags that change the result of a parse */
+#define CONFIG_PARSE_CACHE_FLAGS CONFIG_FLAG_NOREALTIME
+
+#define CONFIG_PARSE_CACHE_BUCKETS 53
+
+/*! \brief Cached parses, by filename */
+static struct ao2_container *parse_cache;
+
+/*! \brief The parse cache entry being recorded by the current thread */
+AST_THREADSTORAGE(parse_recording);
+
+static int config_parse_cache_hash(const void *obj, const int flags)
+{
+	const struct config_parse_cache *cached = obj;
+	const struct config_parse_cache_key *key = obj;
+
+	return ast_str_hash((flags & OBJ_SEARCH_MASK) == OBJ_SEARCH_KEY ? key->filename : cached->filename);
+}
+
+static int config_parse_cache_cmp(void *obj, void *arg, int flags)
+{
+	const struct config_parse_cache *left = obj;
+	const struct config_parse_cache *right = arg;
+	const struct config_parse_cache_key *key = arg;
+
+	if ((flags & OBJ_SEARCH_MASK) == OBJ_SEARCH_KEY) {
+		return left->flags == key->flags && !strcmp(left->filename, key->filename) ? CMP_MATCH : 0;
+	}
+	return left->flags == right->flags && !strcmp(left->filename, right->filename) ? CMP_MATCH : 0;
+}
+
+static void config_parse_cache_destroy(void *obj)
+{
+	struct config_parse_cache *cached = obj;
+	struct cache_file_mtime *file;
+
+	while ((file = AST_LIST_REMOVE_HEAD(&cached->files, list))) {
+		config_cache_destroy_entry(file);
+	}
+	ast_config_destroy(cached->cfg);
+}
+
+/*!
+ * \internal
+ * \brief Get the parse cache entry the current thread is recording, if any
+ */
+static struct config_parse_cache *config_parse_recording(void)
+{
+	struct config_parse_cache **recording;
+
+	recording = ast_threadstorage_get(&parse_recording, sizeof(*recording));
+	return recording && *recording && !(*recording)->uncacheable ? *recording : NULL;
+}
+
+/*!
+ * \internal
+ * \brief Prevent the parse being recorded from being reused
+ */
+static void config_parse_uncacheable(void)
+{
+	struct config_parse_cache *recording = config_parse_recording();
+
+	if (recording) {
+		recording->uncacheable = 1;
+	}
+}
+
+static struct cache_file_mtime *config_parse_find_file(struct config_parse_cache *cached, const char *fn)
+{
+	struct cache_file_mtime *file;
+
+	AST_LIST_TRAVERSE(&cached->files, file, list) {
+		if (!strcmp(file->filename, fn)) {
+			break;
+		}
+	}
+	return file;
+}
+
+/*!
+ * \internal
+ * \brief Record a file read for the parse being recorded
+ *
+ * \param fn Full path of the file
+ * \param statbuf stat() of the file, NULL if it does not exist
+ */
+static void config_parse_record_file(const char *fn, struct stat *statbuf)
+{
+	struct config_parse_cache *recording = config_parse_recording();
+	struct cache_file_mtime *file;
+
+	if (!recording || config_parse_find_file(recording, fn)) {
+		return;
+	}
+
+	file = cfmtime_new(fn, "");
+	if (!file) {
+		recording->uncacheable = 1;
+		return;
+	}
+	if (statbuf) {
+		cfmstat_save(file, statbuf);
+	} else {
+		file->missing = 1;
+	}
+	AST_LIST_INSERT_TAIL(&recording->files, file, list);
+}
+
+/*!
+ * \internal
+ * \brief Record a file included by a file read for the parse being recorded
+ */
+static void config_parse_record_include(const char *configfile, const char *include)
+{
+	struct config_parse_cache *recording = config_parse_recording();
+	struct cache_file_mtime *file;
+	struct cache_file_include *cfinclude;
+
+	if (!recording) {
+		return;
+	}
+
+	file = config_parse_find_file(recording, configfile);
+	cfinclude = ast_calloc(1, sizeof(*cfinclude) + strlen(include) + 1);
+	if (!file || !cfinclude) {
+		ast_free(cfinclude);
+		recording->uncacheable = 1;
+		return;
+	}
+	strcpy(cfinclude->include, include); /* Safe */
+	AST_LIST_INSERT_TAIL(&file->includes, cfinclude, list);
+}
+
+/*!
+ * \internal
+ * \brief Determine if none of the files read for a cached parse changed
+ */
+static int config_parse_cache_valid(struct config_parse_cache *cached)
+{
+	struct cache_file_mtime *file;
+	struct stat statbuf;
+
+	AST_LIST_TRAVERSE(&cached->files, file, list) {
+		if (stat(file->filename, &statbuf)) {
+			if (!file->missing) {
+				return 0;
+			}
+		} else if (file->missing || !S_ISREG(statbuf.st_mode) || cfmstat_cmp(file, &statbuf)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*!
+ * \internal
+ * \brief Update what is known of the files of a cached parse for who_asked
+ *
+ * This leaves the file modification cache as a parse of the files would
+ * have, so CONFIG_FLAG_FILEUNCHANGED keeps working for who_asked.
+ */
+static void config_parse_cache_apply(struct config_parse_cache *cached, const char *who_asked)
+{
+	struct cache_file_mtime *file;
+	struct cache_file_mtime *cfmtime;
+	struct cache_file_include *include;
+	struct cache_file_include *cfinclude;
+
+	AST_LIST_TRAVERSE(&cached->files, file, list) {
+		if (file->missing) {
+			config_cache_remove(file->filename, who_asked);
+			continue;
+		}
+
+		AST_LIST_LOCK(&cfmtime_head);
+		AST_LIST_TRAVERSE(&cfmtime_head, cfmtime, list) {
+			if (!strcmp(cfmtime->filename, file->filename) && !strcmp(cfmtime->who_asked, who_asked)) {
+				break;
+			}
+		}
+		if (!cfmtime) {
+			cfmtime = cfmtime_new(file->filename, who_asked);
+			if (!cfmtime) {
+				AST_LIST_UNLOCK(&cfmtime_head);
+				continue;
+			}
+			AST_LIST_INSERT_SORTALPHA(&cfmtime_head, cfmtime, list, filename);
+		}
+
+		cfmtime->has_exec = 0;
+		config_cache_flush_includes(cfmtime);
+		cfmtime->stat_size = file->stat_size;
+		cfmtime->stat_mtime_nsec = file->stat_mtime_nsec;
+		cfmtime->stat_mtime = file->stat_mtime;
+		AST_LIST_TRAVERSE(&file->includes, include, list) {
+			cfinclude = ast_calloc(1, sizeof(*cfinclude) + strlen(include->include) + 1);
+			if (!cfinclude) {
+				break;
+			}
+			strcpy(cfinclude->include, include->include); /* Safe */
+			AST_LIST_INSERT_TAIL(&cfmtime->includes, cfinclude, list);
+		}
+		AST_LIST_UNLOCK(&cfmtime_head);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Copy everything a parse without comments produces
+ *
+ * Unlike ast_config_copy() this keeps templates, their instances and the
+ * list of includes.
+ */
+static struct ast_config *config_parse_copy(const struct ast_config *old)
+{
+	struct ast_config *new_config = ast_config_new();
+	struct ast_config_include **next_incl;
+	const struct ast_config_include *incl;
+	const struct ast_category *cat_iter;
+
+	if (!new_config) {
+		return NULL;
+	}
+	new_config->max_include_level = old->max_include_level;
+
+	for (cat_iter = old->root; cat_iter; cat_iter = cat_iter->next) {
+		struct ast_category_template_instance *x;
+		const struct ast_variable *var;
+		struct ast_category *new_cat;
+
+		new_cat = new_category(cat_iter->name, cat_iter->file, cat_iter->lineno, cat_iter->ignored);
+		if (!new_cat) {
+			goto fail;
+		}
+		ast_category_append(new_config, new_cat);
+		new_cat->include_level = cat_iter->include_level;
+
+		AST_LIST_TRAVERSE(&cat_iter->template_instances, x, next) {
+			struct ast_category_template_instance *new_x;
+			struct ast_category *base;
+
+			/* The parse used the first category of that name too */
+			for (base = new_config->root; base != new_cat; base = base->next) {
+				if (!strcmp(base->name, x->name)) {
+					break;
+				}
+			}
+			new_x = ast_calloc(1, sizeof(*new_x));
+			if (!new_x) {
+				goto fail;
+			}
+			strcpy(new_x->name, x->name); /* Safe */
+			new_x->inst = base;
+			AST_LIST_INSERT_TAIL(&new_cat->template_instances, new_x, next);
+		}
+
+		for (var = cat_iter->root; var; var = var->next) {
+			struct ast_variable *cloned = variable_clone(var);
+
+			if (!cloned) {
+				goto fail;
+			}
+			cloned->inherited = var->inherited;
+			ast_variable_append(new_cat, cloned);
+		}
+	}
+
+	next_incl = &new_config->includes;
+	for (incl = old->includes; incl; incl = incl->next) {
+		struct ast_config_include *new_incl = ast_calloc(1, sizeof(*new_incl));
+
+		if (!new_incl) {
+			goto fail;
+		}
+		*next_incl = new_incl;
+		next_incl = &new_incl->next;
+		new_incl->include_location_file = ast_strdup(incl->include_location_file);
+		new_incl->include_location_lineno = incl->include_location_lineno;
+		new_incl->exec = incl->exec;
+		new_incl->exec_file = ast_strdup(incl->exec_file);
+		new_incl->included_file = ast_strdup(incl->included_file);
+		new_incl->inclusion_count = incl->inclusion_count;
+		if (!new_incl->include_location_file || !new_incl->included_file
+			|| (incl->exec_file && !new_incl->exec_file)) {
+			goto fail;
+		}
+	}
+
+	return new_config;
+
+fail:
+	ast_config_destroy(new_config);
+	return NULL;
+}
+
 /*! \brief parse one line in the configuration.
  * \verbatim
  * We can have a category header	[foo](...)
@@ -1911,6 +2235,7 @@ static int process_text_line(struct ast_config *cfg, struct ast_category **cat,
 			struct timeval now = ast_tvnow();
 			if (!ast_test_flag(&flags, CONFIG_FLAG_NOCACHE))
 				config_cache_attribute(configfile, ATTRIBUTE_EXEC, NULL, who_asked);
+			config_parse_uncacheable();
 			snprintf(exec_file, sizeof(exec_file), "/var/tmp/exec.%d%d.%ld", (int)now.tv_sec, (int)now.tv_usec, (long)pthread_self());
 			snprintf(cmd, sizeof(cmd), "%s > %s 2>&1", cur, exec_file);
 			ast_safe_system(cmd);
@@ -1918,6 +2243,7 @@ static int process_text_line(struct ast_config *cfg, struct ast_category **cat,
 		} else {
 			if (!ast_test_flag(&flags, CONFIG_FLAG_NOCACHE))
 				config_cache_attribute(configfile, ATTRIBUTE_INCLUDE, cur, who_asked);
+			config_parse_record_include(configfile, cur);
 			exec_file[0] = '\0';
 		}
 		/* A #include */
@@ -2021,7 +2347,7 @@ set_new_variable:
 	return 0;
 }
 
-static struct ast_config *config_text_file_load(const char *database, const char *table, const char *filename, struct ast_config *cfg, struct ast_flags flags, const char *suggested_include_file, const char *who_asked)
+static struct ast_config *config_text_file_parse(const char *database, const char *table, const char *filename, struct ast_config *cfg, struct ast_flags flags, const char *suggested_include_file, const char *who_asked)
 {
 	char fn[256];
 #if defined(LOW_MEMORY)
@@ -2069,6 +2395,11 @@ static struct ast_config *config_text_file_load(const char *database, const char
 			return NULL;
 		}
 	}
+	if (cfg && strpbrk(fn, "*?[")) {
+		/* Files matching the pattern later on would go unnoticed */
+		config_parse_uncacheable();
+	}
+
 #ifdef AST_INCLUDE_GLOB
 	globbuf.gl_offs = 0;	/* initialize it to silence gcc */
 	glob_ret = glob(fn, MY_GLOB_FLAGS, NULL, &globbuf);
@@ -2108,6 +2439,9 @@ static struct ast_config *config_text_file_load(const char *database, const char
 					if (!ast_test_flag(&flags, CONFIG_FLAG_NOCACHE)) {
 						config_cache_remove(fn, who_asked);
 					}
+					if (cfg) {
+						config_parse_record_file(fn, NULL);
+					}
 					continue;
 				}
 
@@ -2116,6 +2450,9 @@ static struct ast_config *config_text_file_load(const char *database, const char
 					if (!ast_test_flag(&flags, CONFIG_FLAG_NOCACHE)) {
 						config_cache_remove(fn, who_asked);
 					}
+					if (cfg) {
+						config_parse_uncacheable();
+					}
 					continue;
 				}
 
@@ -2146,7 +2483,7 @@ static struct ast_config *config_text_file_load(const char *database, const char
 
 					/* File is unchanged, what about the (cached) includes (if any)? */
 					AST_LIST_TRAVERSE(&cfmtime->includes, cfinclude, list) {
-						if (!config_text_file_load(NULL, NULL, cfinclude->include,
+						if (!config_text_file_parse(NULL, NULL, cfinclude->include,
 							NULL, flags, "", who_asked)) {
 							/* One change is enough to short-circuit and reload the whole shebang */
 							unchanged = 0;
@@ -2185,8 +2522,10 @@ static struct ast_config *config_text_file_load(const char *database, const char
 				if (!(f = fopen(fn, "r"))) {
 					ast_debug(1, "No file to parse: %s\n", fn);
 					ast_verb(2, "Parsing '%s': Not found (%s)\n", fn, strerror(errno));
+					config_parse_uncacheable();
 					continue;
 				}
+				config_parse_record_file(fn, &statbuf);
 				count++;
 				/* If we get to this point, then we're loading regardless */
 				ast_clear_flag(&flags, CONFIG_FLAG_FILEUNCHANGED);
@@ -2353,6 +2692,98 @@ static struct ast_config *config_text_file_load(const char *database, const char
 }
 
 
+/*!
+ * \internal
+ * \brief Load a text configuration file, reusing an earlier parse if possible
+ *
+ * Only the loads of a whole file into an empty configuration, without
+ * comments, are cached.
+ */
+static struct ast_config *config_text_file_load(const char *database, const char *table, const char *filename, struct ast_config *cfg, struct ast_flags flags, const char *suggested_include_file, const char *who_asked)
+{
+	struct config_parse_cache_key key;
+	struct config_parse_cache **recording;
+	struct config_parse_cache *previous;
+	struct config_parse_cache *cached;
+	struct ast_config *result;
+	char fn[256];
+
+	if (!parse_cache || !cfg || cfg->include_level != 1 || cfg->root || cfg->includes
+		|| !ast_strlen_zero(suggested_include_file)
+		|| ast_test_flag(&flags, CONFIG_FLAG_WITHCOMMENTS | CONFIG_FLAG_NOCACHE)
+		|| (cfg_hooks && ao2_container_count(cfg_hooks))) {
+		return config_text_file_parse(database, table, filename, cfg, flags, suggested_include_file, who_asked);
+	}
+
+	if (ast_test_flag(&flags, CONFIG_FLAG_FILEUNCHANGED)) {
+		result = config_text_file_parse(database, table, filename, NULL, flags, suggested_include_file, who_asked);
+		if (result == CONFIG_STATUS_FILEUNCHANGED) {
+			return result;
+		}
+		ast_clear_flag(&flags, CONFIG_FLAG_FILEUNCHANGED);
+	}
+
+	if (filename[0] == '/') {
+		ast_copy_string(fn, filename, sizeof(fn));
+	} else {
+		snprintf(fn, sizeof(fn), "%s/%s", ast_config_AST_CONFIG_DIR, filename);
+	}
+	key.filename = fn;
+	key.flags = flags.flags & CONFIG_PARSE_CACHE_FLAGS;
+
+	cached = ao2_find(parse_cache, &key, OBJ_SEARCH_KEY);
+	if (cached) {
+		struct ast_config *copy = NULL;
+
+		if (config_parse_cache_valid(cached)) {
+			copy = config_parse_copy(cached->cfg);
+		} else {
+			ao2_unlink(parse_cache, cached);
+		}
+		if (copy) {
+			cfg->root = copy->root;
+			cfg->last = copy->last;
+			cfg->current = copy->last;
+			cfg->includes = copy->includes;
+			copy->root = copy->last = copy->current = NULL;
+			copy->includes = NULL;
+			ast_config_destroy(copy);
+
+			config_parse_cache_apply(cached, who_asked);
+			ao2_ref(cached, -1);
+			ast_debug(1, "Parsing %s: Unchanged since last parsed\n", fn);
+			return cfg;
+		}
+		ao2_ref(cached, -1);
+	}
+
+	recording = ast_threadstorage_get(&parse_recording, sizeof(*recording));
+	cached = ao2_alloc_options(sizeof(*cached) + strlen(fn) + 1, config_parse_cache_destroy,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!recording || !cached) {
+		ao2_cleanup(cached);
+		return config_text_file_parse(database, table, filename, cfg, flags, suggested_include_file, who_asked);
+	}
+	strcpy(cached->filename, fn); /* Safe */
+	cached->flags = key.flags;
+
+	/* A config hook run by the parse may load another file */
+	previous = *recording;
+	*recording = cached;
+	result = config_text_file_parse(database, table, filename, cfg, flags, suggested_include_file, who_asked);
+	*recording = previous;
+
+	if (result == cfg && !cached->uncacheable && (cached->cfg = config_parse_copy(cfg))) {
+		ao2_wrlock(parse_cache);
+		ao2_find(parse_cache, &key, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA | OBJ_NOLOCK);
+		ao2_link_flags(parse_cache, cached, OBJ_NOLOCK);
+		ao2_unlock(parse_cache);
+	}
+	ao2_ref(cached, -1);
+
+	return result;
+}
+
 /* NOTE: categories and variables each have a file and lineno attribute. On a save operation, these are used to determine
    which file and line number to write out to. Thus, an entire hierarchy of config files (via #include statements) can be
    recreated. BUT, care must be taken to make sure that every cat and var has the proper file name stored, or you may
@@ -2836,6 +3267,268 @@ int ast_config_text_file_save2(const char *configfile, const struct ast_config *
 	return 0;
 }
 
+/*! Buckets for cached realtime lookups. Keep it prime! */
+#define REALTIME_CACHE_BUCKETS 563
+
+/*! \brief A family whose realtime lookups are cached, from the [cache] section of extconfig.conf */
+struct realtime_cache_family {
+	AST_LIST_ENTRY(realtime_cache_family) list;
+	/*! How long a lookup is cached, in seconds */
+	int ttl;
+	char name[0];
+};
+
+/*!
+ * \brief A cached realtime lookup
+ *
+ * Lookups that found nothing are cached as well.  While the lookup is
+ * being done it is pending, and identical lookups wait for its result
+ * rather than asking the realtime engine again.
+ */
+struct realtime_cache_entry {
+	/*! When the result is no longer good */
+	struct timeval expires;
+	/*! How long the result is good for, in seconds */
+	int ttl;
+	/*! Set while the lookup is being done */
+	unsigned int pending:1;
+	/*! Set if the family was written to while the lookup was being done */
+	unsigned int invalidated:1;
+	/*! Result of a single entry lookup */
+	struct ast_variable *vars;
+	/*! Result of a multiple entry lookup */
+	struct ast_config *cfg;
+	/*! Family, whether multiple entries were looked up, and the fields */
+	char key[0];
+};
+
+/*! \brief Separates the parts of the key of a cached lookup */
+#define REALTIME_CACHE_SEP "\x1f"
+
+/*! \brief Protects the realtime cache, its entries and the cached families */
+AST_MUTEX_DEFINE_STATIC(realtime_cache_lock);
+
+/*! \brief Signalled when a pending lookup is done */
+static ast_cond_t realtime_cache_cond;
+
+/*! \brief Cached realtime lookups, see struct realtime_cache_entry */
+static struct ao2_container *realtime_cache;
+
+static AST_LIST_HEAD_NOLOCK_STATIC(realtime_cache_families, realtime_cache_family);
+
+/*! \brief When expired lookups were last removed from the cache */
+static struct timeval realtime_cache_pruned;
+
+AO2_STRING_FIELD_HASH_FN(realtime_cache_entry, key)
+AO2_STRING_FIELD_CMP_FN(realtime_cache_entry, key)
+
+static void realtime_cache_entry_destroy(void *obj)
+{
+	struct realtime_cache_entry *entry = obj;
+
+	ast_variables_destroy(entry->vars);
+	if (entry->cfg) {
+		ast_config_destroy(entry->cfg);
+	}
+}
+
+/*! \brief Match the lookups of the family given as arg, and mark them invalidated */
+static int realtime_cache_family_match(void *obj, void *arg, int flags)
+{
+	struct realtime_cache_entry *entry = obj;
+	const char *family = arg;
+	size_t len = strlen(family);
+
+	if (strncmp(entry->key, family, len) || strncmp(entry->key + len, REALTIME_CACHE_SEP, 1)) {
+		return 0;
+	}
+
+	entry->invalidated = 1;
+	return CMP_MATCH;
+}
+
+/*! \brief Match the lookups that are done and expired */
+static int realtime_cache_expired_match(void *obj, void *arg, int flags)
+{
+	struct realtime_cache_entry *entry = obj;
+	struct timeval *now = arg;
+
+	return !entry->pending && ast_tvcmp(*now, entry->expires) >= 0 ? CMP_MATCH : 0;
+}
+
+/*!
+ * \internal
+ * \brief Drop the cached lookups of a family that was written to
+ *
+ * \param family The family, or NULL for every family
+ */
+static void realtime_cache_invalidate(const char *family)
+{
+	ast_mutex_lock(&realtime_cache_lock);
+	if (realtime_cache) {
+		ao2_callback(realtime_cache, OBJ_NOLOCK | OBJ_UNLINK | OBJ_MULTIPLE | OBJ_NODATA,
+			family ? realtime_cache_family_match : NULL, (char *) family);
+	}
+	ast_mutex_unlock(&realtime_cache_lock);
+}
+
+/*! \pre realtime_cache_lock is locked */
+static int realtime_cache_ttl(const char *family)
+{
+	struct realtime_cache_family *cached;
+
+	AST_LIST_TRAVERSE(&realtime_cache_families, cached, list) {
+		if (!strcmp(cached->name, family)) {
+			return cached->ttl;
+		}
+	}
+
+	return 0;
+}
+
+/*! \brief Cache the lookups of a family for ttl seconds */
+static int realtime_cache_family_add(const char *family, int ttl)
+{
+	struct realtime_cache_family *cached;
+
+	if (!(cached = ast_calloc(1, sizeof(*cached) + strlen(family) + 1))) {
+		return -1;
+	}
+	strcpy(cached->name, family);
+	cached->ttl = ttl;
+
+	ast_mutex_lock(&realtime_cache_lock);
+	AST_LIST_INSERT_TAIL(&realtime_cache_families, cached, list);
+	ast_mutex_unlock(&realtime_cache_lock);
+
+	ast_verb(2, "Caching realtime lookups of %s for %d seconds\n", family, ttl);
+
+	return 0;
+}
+
+/*! \brief Stop caching the lookups of every family, and drop those cached */
+static void realtime_cache_families_clear(void)
+{
+	struct realtime_cache_family *cached;
+
+	ast_mutex_lock(&realtime_cache_lock);
+	while ((cached = AST_LIST_REMOVE_HEAD(&realtime_cache_families, list))) {
+		ast_free(cached);
+	}
+	ast_mutex_unlock(&realtime_cache_lock);
+
+	realtime_cache_invalidate(NULL);
+}
+
+/*!
+ * \internal
+ * \brief Find a realtime lookup in the cache, or start it
+ *
+ * \param family The family looked up
+ * \param multi Whether multiple entries are looked up
+ * \param fields The fields looked up
+ * \param[out] hit Set if the lookup was found in the cache
+ *
+ * \retval NULL if lookups of the family are not cached.
+ * \return The cached lookup if hit is set.  Otherwise a pending lookup,
+ * which the caller must do and finish with realtime_cache_end().
+ */
+static struct realtime_cache_entry *realtime_cache_begin(const char *family, int multi,
+	const struct ast_variable *fields, int *hit)
+{
+	struct realtime_cache_entry *entry;
+	struct ast_str *key;
+	struct timeval now;
+	int ttl;
+
+	*hit = 0;
+
+	ast_mutex_lock(&realtime_cache_lock);
+	ttl = realtime_cache ? realtime_cache_ttl(family) : 0;
+	ast_mutex_unlock(&realtime_cache_lock);
+	if (ttl <= 0 || !(key = ast_str_create(128))) {
+		return NULL;
+	}
+
+	ast_str_set(&key, 0, "%s" REALTIME_CACHE_SEP "%s", family, multi ? "multi" : "single");
+	for (; fields; fields = fields->next) {
+		ast_str_append(&key, 0, REALTIME_CACHE_SEP "%s" REALTIME_CACHE_SEP "%s",
+			fields->name, fields->value);
+	}
+
+	ast_mutex_lock(&realtime_cache_lock);
+	for (;;) {
+		entry = ao2_find(realtime_cache, ast_str_buffer(key), OBJ_SEARCH_KEY | OBJ_NOLOCK);
+		if (!entry) {
+			break;
+		}
+		if (entry->pending) {
+			/* Someone else is asking the engine already, wait for the answer */
+			ast_cond_wait(&realtime_cache_cond, &realtime_cache_lock);
+			ao2_ref(entry, -1);
+			continue;
+		}
+		if (ast_tvcmp(ast_tvnow(), entry->expires) < 0) {
+			ast_mutex_unlock(&realtime_cache_lock);
+			ast_free(key);
+			*hit = 1;
+			return entry;
+		}
+		ao2_unlink_flags(realtime_cache, entry, OBJ_NOLOCK);
+		ao2_ref(entry, -1);
+		break;
+	}
+
+	now = ast_tvnow();
+	if (ast_tvdiff_ms(now, realtime_cache_pruned) >= 1000) {
+		ao2_callback(realtime_cache, OBJ_NOLOCK | OBJ_UNLINK | OBJ_MULTIPLE | OBJ_NODATA,
+			realtime_cache_expired_match, &now);
+		realtime_cache_pruned = now;
+	}
+
+	entry = ao2_alloc_options(sizeof(*entry) + ast_str_strlen(key) + 1,
+		realtime_cache_entry_destroy, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (entry) {
+		strcpy(entry->key, ast_str_buffer(key));
+		entry->ttl = ttl;
+		entry->pending = 1;
+		ao2_link_flags(realtime_cache, entry, OBJ_NOLOCK);
+	}
+	ast_mutex_unlock(&realtime_cache_lock);
+	ast_free(key);
+
+	return entry;
+}
+
+/*!
+ * \internal
+ * \brief Keep the result of a pending lookup, and wake those waiting for it
+ *
+ * \param entry The pending lookup, whose reference is dropped
+ * \param vars Result of a single entry lookup, copied
+ * \param cfg Result of a multiple entry lookup, copied
+ */
+static void realtime_cache_end(struct realtime_cache_entry *entry,
+	struct ast_variable *vars, struct ast_config *cfg)
+{
+	ast_mutex_lock(&realtime_cache_lock);
+	if (!entry->invalidated) {
+		entry->vars = vars ? ast_variables_dup(vars) : NULL;
+		entry->cfg = cfg ? ast_config_copy(cfg) : NULL;
+		if ((vars && !entry->vars) || (cfg && !entry->cfg)) {
+			/* Not to be taken for a lookup that found nothing */
+			ao2_unlink_flags(realtime_cache, entry, OBJ_NOLOCK);
+		} else {
+			entry->expires = ast_tvadd(ast_tvnow(), ast_tv(entry->ttl, 0));
+		}
+	}
+	entry->pending = 0;
+	ast_cond_broadcast(&realtime_cache_cond);
+	ast_mutex_unlock(&realtime_cache_lock);
+
+	ao2_ref(entry, -1);
+}
+
 static void clear_config_maps(void)
 {
 	struct ast_config_map *map;
@@ -2897,6 +3590,7 @@ int read_config_maps(void)
 	int pri;
 
 	clear_config_maps();
+	realtime_cache_families_clear();
 
 	configtmp = ast_config_new();
 	if (!configtmp) {
@@ -2964,6 +3658,19 @@ int read_config_maps(void)
 			ast_realtime_append_mapping(v->name, driver, database, table, pri);
 	}
 
+	for (v = ast_variable_browse(config, "cache"); v; v = v->next) {
+		int ttl;
+
+		if (sscanf(v->value, "%30d", &ttl) != 1 || ttl < 0) {
+			ast_log(LOG_WARNING, "Invalid cache time '%s' for realtime family '%s' at line %d of %s\n",
+				v->value, v->name, v->lineno, extconfig_conf);
+			continue;
+		}
+		if (ttl) {
+			realtime_cache_family_add(v->name, ttl);
+		}
+	}
+
 	ast_config_destroy(config);
 	return 0;
 }
@@ -3120,6 +3827,11 @@ struct ast_config *ast_config_internal_load(const char *filename, struct ast_con
 		}
 	}
 
+	if (loader != &text_file_engine) {
+		/* Realtime data has no modification time to check */
+		config_parse_uncacheable();
+	}
+
 	result = loader->load_func(db, table, filename, cfg, flags, suggested_include_file, who_asked);
 
 	if (result && result != CONFIG_STATUS_FILEINVALID && result != CONFIG_STATUS_FILEUNCHANGED) {
@@ -3244,7 +3956,7 @@ static int realtime_arguments_to_fields2(va_list ap, int skip, struct ast_variab
 	return 0;
 }
 
-struct ast_variable *ast_load_realtime_all_fields(const char *family, const struct ast_variable *fields)
+static struct ast_variable *realtime_engine_load_all_fields(const char *family, const struct ast_variable *fields)
 {
 	struct ast_config_engine *eng;
 	char db[256];
@@ -3265,6 +3977,29 @@ struct ast_variable *ast_load_realtime_all_fields(const char *family, const stru
 	return res;
 }
 
+struct ast_variable *ast_load_realtime_all_fields(const char *family, const struct ast_variable *fields)
+{
+	struct realtime_cache_entry *entry;
+	struct ast_variable *res;
+	int hit;
+
+	entry = realtime_cache_begin(family, 0, fields, &hit);
+	if (!entry) {
+		return realtime_engine_load_all_fields(family, fields);
+	}
+
+	if (hit) {
+		res = entry->vars ? ast_variables_dup(entry->vars) : NULL;
+		ao2_ref(entry, -1);
+		return res;
+	}
+
+	res = realtime_engine_load_all_fields(family, fields);
+	realtime_cache_end(entry, res, NULL);
+
+	return res;
+}
+
 struct ast_variable *ast_load_realtime_all(const char *family, ...)
 {
 	RAII_VAR(struct ast_variable *, fields, NULL, ast_variables_destroy);
@@ -3401,10 +4136,13 @@ int ast_unload_realtime(const char *family)
 			break;
 		}
 	}
+
+	realtime_cache_invalidate(family);
+
 	return res;
 }
 
-struct ast_config *ast_load_realtime_multientry_fields(const char *family, const struct ast_variable *fields)
+static struct ast_config *realtime_engine_load_multientry_fields(const char *family, const struct ast_variable *fields)
 {
 	struct ast_config_engine *eng;
 	char db[256];
@@ -3430,6 +4168,29 @@ struct ast_config *ast_load_realtime_multientry_fields(const char *family, const
 	return res;
 }
 
+struct ast_config *ast_load_realtime_multientry_fields(const char *family, const struct ast_variable *fields)
+{
+	struct realtime_cache_entry *entry;
+	struct ast_config *res;
+	int hit;
+
+	entry = realtime_cache_begin(family, 1, fields, &hit);
+	if (!entry) {
+		return realtime_engine_load_multientry_fields(family, fields);
+	}
+
+	if (hit) {
+		res = entry->cfg ? ast_config_copy(entry->cfg) : NULL;
+		ao2_ref(entry, -1);
+		return res;
+	}
+
+	res = realtime_engine_load_multientry_fields(family, fields);
+	realtime_cache_end(entry, NULL, res);
+
+	return res;
+}
+
 struct ast_config *ast_load_realtime_multientry(const char *family, ...)
 {
 	RAII_VAR(struct ast_variable *, fields, NULL, ast_variables_destroy);
@@ -3464,6 +4225,9 @@ int ast_update_realtime_fields(const char *family, const char *keyfield, const c
 		}
 	}
 
+	/* Cached lookups of the family may no longer be what the engine would answer */
+	realtime_cache_invalidate(family);
+
 	return res;
 }
 
@@ -3500,6 +4264,8 @@ int ast_update2_realtime_fields(const char *family, const struct ast_variable *l
 		}
 	}
 
+	realtime_cache_invalidate(family);
+
 	return res;
 }
 
@@ -3545,6 +4311,8 @@ int ast_store_realtime_fields(const char *family, const struct ast_variable *fie
 		}
 	}
 
+	realtime_cache_invalidate(family);
+
 	return res;
 }
 
@@ -3581,6 +4349,8 @@ int ast_destroy_realtime_fields(const char *family, const char *keyfield, const
 		}
 	}
 
+	realtime_cache_invalidate(family);
+
 	return res;
 }
 
@@ -3989,13 +4759,28 @@ static void config_shutdown(void)
 	ast_cli_unregister_multiple(cli_config, ARRAY_LEN(cli_config));
 
 	clear_config_maps();
+	realtime_cache_families_clear();
+
+	ast_mutex_lock(&realtime_cache_lock);
+	ao2_cleanup(realtime_cache);
+	realtime_cache = NULL;
+	ast_mutex_unlock(&realtime_cache_lock);
 
 	ao2_cleanup(cfg_hooks);
 	cfg_hooks = NULL;
+
+	ao2_cleanup(parse_cache);
+	parse_cache = NULL;
 }
 
 int register_config_cli(void)
 {
+	ast_cond_init(&realtime_cache_cond, NULL);
+	realtime_cache = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0,
+		REALTIME_CACHE_BUCKETS, realtime_cache_entry_hash_fn, NULL, realtime_cache_entry_cmp_fn);
+
+	parse_cache = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0,
+		CONFIG_PARSE_CACHE_BUCKETS, config_parse_cache_hash, NULL, config_parse_cache_cmp);
 	ast_cli_register_multiple(cli_config, ARRAY_LEN(cli_config));
 	ast_register_cleanup(config_shutdown);
 	return 0;
@@ -135,6 +135,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 static const char tdesc[] = "Local Proxy Channel Driver";
 
+/*! \brief Number of buckets in the locals container */
+#define LOCALS_BUCKETS 563
+
+/*! \brief Local channel pvts, hashed on exten@context */
 static struct ao2_container *locals;
 
 static struct ast_channel *local_request(const char *type, struct ast_format_cap *cap, const struct ast_assigned_ids *assignedids, const struct ast_channel *requestor, const char *data, int *cause);
@@ -235,6 +239,24 @@ struct local_pvt {
 	char exten[AST_MAX_EXTENSION];
 };
 
+/*!
+ * \internal
+ * \brief Find the pvt of a Local channel in the locals container.
+ *
+ * \param chan Channel the pvt was taken from, which may not be a Local channel
+ * \param p The channel's tech pvt
+ *
+ * \return p with a ref if chan is a Local channel that has not been hung up, else NULL
+ */
+static struct local_pvt *local_find(struct ast_channel *chan, struct local_pvt *p)
+{
+	/* The pvt of another channel driver cannot be hashed as a local_pvt */
+	if (!p || ast_channel_tech(chan) != &local_tech) {
+		return NULL;
+	}
+	return ao2_find(locals, p, OBJ_SEARCH_OBJECT);
+}
+
 void ast_local_lock_all2(struct ast_channel *chan, void **tech_pvt,
 	struct ast_channel **base_chan, struct ast_channel **base_owner)
 {
@@ -300,7 +322,7 @@ struct ast_channel *ast_local_get_peer(struct ast_channel *ast)
 		return NULL;
 	}
 
-	found = p ? ao2_find(locals, p, 0) : NULL;
+	found = local_find(ast, p);
 	if (!found) {
 		/* ast is either not a local channel or it has alredy been hungup */
 		return NULL;
@@ -327,16 +349,18 @@ static int local_devicestate(const char *data)
 	int is_inuse = 0;
 	int res = AST_DEVICE_INVALID;
 	char *exten = ast_strdupa(data);
+	char *name;
 	char *context;
 	char *opts;
 	struct local_pvt *lp;
-	struct ao2_iterator it;
+	struct ao2_iterator *it;
 
 	/* Strip options if they exist */
 	opts = strchr(exten, '/');
 	if (opts) {
 		*opts = '\0';
 	}
+	name = ast_strdupa(exten);
 
 	context = strchr(exten, '@');
 	if (!context) {
@@ -346,16 +370,14 @@ static int local_devicestate(const char *data)
 	}
 	*context++ = '\0';
 
-	it = ao2_iterator_init(locals, 0);
-	for (; (lp = ao2_iterator_next(&it)); ao2_ref(lp, -1)) {
+	/* Only the Local channels to exten@context are visited */
+	it = ao2_find(locals, name, OBJ_SEARCH_KEY | OBJ_MULTIPLE);
+	for (; it && (lp = ao2_iterator_next(it)); ao2_ref(lp, -1)) {
 		ao2_lock(lp);
-		if (!strcmp(exten, lp->exten)
-			&& !strcmp(context, lp->context)) {
-			res = AST_DEVICE_NOT_INUSE;
-			if (lp->base.owner
-				&& ast_test_flag(&lp->base, AST_UNREAL_CARETAKER_THREAD)) {
-				is_inuse = 1;
-			}
+		res = AST_DEVICE_NOT_INUSE;
+		if (lp->base.owner
+			&& ast_test_flag(&lp->base, AST_UNREAL_CARETAKER_THREAD)) {
+			is_inuse = 1;
 		}
 		ao2_unlock(lp);
 		if (is_inuse) {
@@ -364,7 +386,9 @@ static int local_devicestate(const char *data)
 			break;
 		}
 	}
-	ao2_iterator_destroy(&it);
+	if (it) {
+		ao2_iterator_destroy(it);
+	}
 
 	if (res == AST_DEVICE_INVALID) {
 		ast_debug(3, "Checking if extension %s@%s exists (devicestate)\n", exten, context);
@@ -443,7 +467,7 @@ static void local_optimization_started_cb(struct ast_unreal_pvt *base, struct as
 		return;
 	}
 
-	stasis_publish(ast_channel_topic(p->base.owner), msg);
+	stasis_publish(ast_channel_topic_for_publish(p->base.owner), msg);
 }
 
 /*! \brief Callback for \ref ast_unreal_pvt_callbacks \ref optimization_finished_cb */
@@ -474,7 +498,7 @@ static void local_optimization_finished_cb(struct ast_unreal_pvt *base, int succ
 		return;
 	}
 
-	stasis_publish(ast_channel_topic(p->base.owner), msg);
+	stasis_publish(ast_channel_topic_for_publish(p->base.owner), msg);
 }
 
 static struct ast_manager_event_blob *local_message_to_ami(struct stasis_message *message)
@@ -601,7 +625,7 @@ static void publish_local_bridge_message(struct local_pvt *p)
 		goto end;
 	}
 
-	stasis_publish(ast_channel_topic(owner), msg);
+	stasis_publish(ast_channel_topic_for_publish(owner), msg);
 
 end:
 	ast_channel_unlock(owner);
@@ -627,9 +651,9 @@ int ast_local_setup_bridge(struct ast_channel *ast, struct ast_bridge *bridge, s
 
 	ast_channel_lock(ast);
 	p = ast_channel_tech_pvt(ast);
+	found = local_find(ast, p);
 	ast_channel_unlock(ast);
 
-	found = p ? ao2_find(locals, p, 0) : NULL;
 	if (found) {
 		ao2_lock(found);
 		if (found->type == LOCAL_CALL_ACTION_DIALPLAN
@@ -668,9 +692,9 @@ int ast_local_setup_masquerade(struct ast_channel *ast, struct ast_channel *masq
 
 	ast_channel_lock(ast);
 	p = ast_channel_tech_pvt(ast);
+	found = local_find(ast, p);
 	ast_channel_unlock(ast);
 
-	found = p ? ao2_find(locals, p, 0) : NULL;
 	if (found) {
 		ao2_lock(found);
 		if (found->type == LOCAL_CALL_ACTION_DIALPLAN
@@ -1024,10 +1048,12 @@ static int manager_optimize_away(struct mansession *s, const struct message *m)
 		return 0;
 	}
 
+	ast_channel_lock(chan);
 	p = ast_channel_tech_pvt(chan);
+	found = local_find(chan, p);
+	ast_channel_unlock(chan);
 	ast_channel_unref(chan);
 
-	found = p ? ao2_find(locals, p, 0) : NULL;
 	if (found) {
 		ao2_lock(found);
 		ast_clear_flag(&found->base, AST_UNREAL_NO_OPTIMIZATION);
@@ -1042,9 +1068,37 @@ static int manager_optimize_away(struct mansession *s, const struct message *m)
 }
 
 
+static int locals_hash_cb(const void *obj, const int flags)
+{
+	const struct local_pvt *p;
+	const char *key;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_KEY:
+		key = obj;
+		break;
+	case OBJ_SEARCH_OBJECT:
+		p = obj;
+		key = p->base.name;
+		break;
+	default:
+		/* Hash can only work on something with a full key. */
+		ast_assert(0);
+		return 0;
+	}
+	return ast_str_hash(key);
+}
+
 static int locals_cmp_cb(void *obj, void *arg, int flags)
 {
-	return (obj == arg) ? CMP_MATCH : 0;
+	struct local_pvt *p = obj;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_KEY:
+		return strcmp(p->base.name, arg) ? 0 : CMP_MATCH;
+	default:
+		return (obj == arg) ? CMP_MATCH : 0;
+	}
 }
 
 /*!
@@ -1092,7 +1146,8 @@ int ast_local_init(void)
 	}
 	ast_format_cap_append_by_type(local_tech.capabilities, AST_MEDIA_TYPE_UNKNOWN);
 
-	locals = ao2_container_alloc_list(AO2_ALLOC_OPT_LOCK_MUTEX, 0, NULL, locals_cmp_cb);
+	locals = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, LOCALS_BUCKETS,
+		locals_hash_cb, NULL, locals_cmp_cb);
 	if (!locals) {
 		ao2_cleanup(local_tech.capabilities);
 		local_tech.capabilities = NULL;
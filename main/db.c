@@ -107,28 +107,219 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
  ***/
 
 #define MAX_DB_FIELD 256
+/*! \brief Lock for the SQLite database handle and its statements */
 AST_MUTEX_DEFINE_STATIC(dblock);
+/*!
+ * \brief Lock for changes to the key cache and for the dirty key set
+ *
+ * \note If both locks are needed, dblock must be locked first.
+ */
+AST_MUTEX_DEFINE_STATIC(cachelock);
 static ast_cond_t dbcond;
 static sqlite3 *astdb;
 static pthread_t syncthread;
 static int doexit;
 static int dosync;
 
+/*!
+ * \brief Every key in the database, sorted by key
+ *
+ * Reads are answered from here. Writes change it and mark the key dirty,
+ * and the sync thread writes dirty keys back to SQLite in one transaction.
+ */
+static struct ao2_container *db_cache;
+/*! \brief Keys changed in db_cache that are not yet written back */
+static struct ao2_container *db_dirty;
+
+/*! \brief Number of buckets in the dirty key set */
+#define DB_DIRTY_BUCKETS 127
+
 static void db_sync(void);
+static int db_cache_load(void);
 
 #define DEFINE_SQL_STATEMENT(stmt,sql) static sqlite3_stmt *stmt; \
 	const char stmt##_sql[] = sql;
 
 DEFINE_SQL_STATEMENT(put_stmt, "INSERT OR REPLACE INTO astdb (key, value) VALUES (?, ?)")
-DEFINE_SQL_STATEMENT(get_stmt, "SELECT value FROM astdb WHERE key=?")
 DEFINE_SQL_STATEMENT(del_stmt, "DELETE FROM astdb WHERE key=?")
-DEFINE_SQL_STATEMENT(deltree_stmt, "DELETE FROM astdb WHERE key || '/' LIKE ? || '/' || '%'")
-DEFINE_SQL_STATEMENT(deltree_all_stmt, "DELETE FROM astdb")
-DEFINE_SQL_STATEMENT(gettree_stmt, "SELECT key, value FROM astdb WHERE key || '/' LIKE ? || '/' || '%' ORDER BY key")
 DEFINE_SQL_STATEMENT(gettree_all_stmt, "SELECT key, value FROM astdb ORDER BY key")
-DEFINE_SQL_STATEMENT(showkey_stmt, "SELECT key, value FROM astdb WHERE key LIKE '%' || '/' || ? ORDER BY key")
 DEFINE_SQL_STATEMENT(create_astdb_stmt, "CREATE TABLE IF NOT EXISTS astdb(key VARCHAR(256), value VARCHAR(256), PRIMARY KEY(key))")
 
+/*! \brief A key and its value in the cache */
+struct db_entry {
+	/*! The value, which is stored after the key */
+	char *value;
+	char key[0];
+};
+
+/*! \brief A key that has changed since the last write back */
+struct db_dirty_key {
+	/*! The entry to write when the key is written back, NULL to delete the key */
+	struct db_entry *entry;
+	char key[0];
+};
+
+static struct db_entry *db_entry_alloc(const char *key, const char *value)
+{
+	size_t key_len = strlen(key) + 1;
+	struct db_entry *entry;
+
+	entry = ao2_alloc_options(sizeof(*entry) + key_len + strlen(value) + 1, NULL,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!entry) {
+		return NULL;
+	}
+	strcpy(entry->key, key); /* Safe */
+	entry->value = entry->key + key_len;
+	strcpy(entry->value, value); /* Safe */
+
+	return entry;
+}
+
+/*!
+ * \internal
+ * \brief Sort cache entries by key
+ *
+ * Keys are ordered without regard to case first, so that a partial key
+ * search finds every key matching a tree prefix the way SQLite's LIKE did.
+ * Keys differing only in case are then ordered byte by byte, so they remain
+ * distinct keys.
+ */
+static int db_entry_sort(const void *obj_left, const void *obj_right, int flags)
+{
+	const struct db_entry *left = obj_left;
+	const char *right_key = obj_right;
+	int cmp;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+		right_key = ((const struct db_entry *) obj_right)->key;
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		cmp = strcasecmp(left->key, right_key);
+		if (!cmp) {
+			cmp = strcmp(left->key, right_key);
+		}
+		break;
+	case OBJ_SEARCH_PARTIAL_KEY:
+		cmp = strncasecmp(left->key, right_key, strlen(right_key));
+		break;
+	default:
+		ast_assert(0);
+		cmp = 0;
+		break;
+	}
+
+	return cmp;
+}
+
+static void db_dirty_key_destructor(void *obj)
+{
+	struct db_dirty_key *dirty = obj;
+
+	ao2_cleanup(dirty->entry);
+}
+
+static int db_dirty_key_hash(const void *obj, const int flags)
+{
+	const char *key = obj;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+		key = ((const struct db_dirty_key *) obj)->key;
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		break;
+	default:
+		ast_assert(0);
+		return 0;
+	}
+
+	return ast_str_hash(key);
+}
+
+static int db_dirty_key_cmp(void *obj, void *arg, int flags)
+{
+	const struct db_dirty_key *left = obj;
+	const char *right_key = arg;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+		right_key = ((const struct db_dirty_key *) arg)->key;
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		break;
+	default:
+		ast_assert(0);
+		return 0;
+	}
+
+	return strcmp(left->key, right_key) ? 0 : CMP_MATCH;
+}
+
+static struct ao2_container *db_dirty_alloc(void)
+{
+	return ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, DB_DIRTY_BUCKETS,
+		db_dirty_key_hash, NULL, db_dirty_key_cmp);
+}
+
+/*!
+ * \internal
+ * \brief Note that a key has changed and wake up the sync thread
+ *
+ * \note cachelock must be held when calling this function.
+ */
+static void db_mark_dirty(const char *key)
+{
+	struct db_dirty_key *dirty;
+
+	if ((dirty = ao2_find(db_dirty, key, OBJ_SEARCH_KEY))) {
+		ao2_ref(dirty, -1);
+	} else if ((dirty = ao2_alloc_options(sizeof(*dirty) + strlen(key) + 1,
+		db_dirty_key_destructor, AO2_ALLOC_OPT_LOCK_NOLOCK))) {
+		strcpy(dirty->key, key); /* Safe */
+		ao2_link(db_dirty, dirty);
+		ao2_ref(dirty, -1);
+	} else {
+		ast_log(LOG_ERROR, "Unable to note change to astdb key '%s', it may not be saved\n", key);
+	}
+	db_sync();
+}
+
+/*!
+ * \internal
+ * \brief Match the keys of a tree, as selected by a partial key search on its prefix
+ *
+ * A key is in the tree of a prefix if it is the prefix, or it continues the
+ * prefix with a '/'.
+ */
+static int db_tree_match(void *obj, void *arg, int flags)
+{
+	struct db_entry *entry = obj;
+	const char *prefix = arg;
+	char next = entry->key[strlen(prefix)];
+
+	return (next == '\0' || next == '/') ? CMP_MATCH : 0;
+}
+
+/*!
+ * \internal
+ * \brief Find the cache entries of a tree, in key order
+ *
+ * \param prefix The tree, or an empty string for the whole database
+ * \param flags Extra search flags, such as OBJ_UNLINK
+ *
+ * \return An iterator of the entries, or NULL on failure
+ */
+static struct ao2_iterator *db_cache_tree(const char *prefix, int flags)
+{
+	if (ast_strlen_zero(prefix)) {
+		return ao2_callback(db_cache, flags | OBJ_MULTIPLE, NULL, NULL);
+	}
+	return ao2_callback(db_cache, flags | OBJ_MULTIPLE | OBJ_SEARCH_PARTIAL_KEY,
+		db_tree_match, (void *) prefix);
+}
+
 static int init_stmt(sqlite3_stmt **stmt, const char *sql, size_t len)
 {
 	ast_mutex_lock(&dblock);
@@ -163,13 +354,8 @@ static int clean_stmt(sqlite3_stmt **stmt, const char *sql)
  */
 static void clean_statements(void)
 {
-	clean_stmt(&get_stmt, get_stmt_sql);
 	clean_stmt(&del_stmt, del_stmt_sql);
-	clean_stmt(&deltree_stmt, deltree_stmt_sql);
-	clean_stmt(&deltree_all_stmt, deltree_all_stmt_sql);
-	clean_stmt(&gettree_stmt, gettree_stmt_sql);
 	clean_stmt(&gettree_all_stmt, gettree_all_stmt_sql);
-	clean_stmt(&showkey_stmt, showkey_stmt_sql);
 	clean_stmt(&put_stmt, put_stmt_sql);
 	clean_stmt(&create_astdb_stmt, create_astdb_stmt_sql);
 }
@@ -178,13 +364,8 @@ static int init_statements(void)
 {
 	/* Don't initialize create_astdb_statment here as the astdb table needs to exist
 	 * brefore these statments can be initialized */
-	return init_stmt(&get_stmt, get_stmt_sql, sizeof(get_stmt_sql))
-	|| init_stmt(&del_stmt, del_stmt_sql, sizeof(del_stmt_sql))
-	|| init_stmt(&deltree_stmt, deltree_stmt_sql, sizeof(deltree_stmt_sql))
-	|| init_stmt(&deltree_all_stmt, deltree_all_stmt_sql, sizeof(deltree_all_stmt_sql))
-	|| init_stmt(&gettree_stmt, gettree_stmt_sql, sizeof(gettree_stmt_sql))
+	return init_stmt(&del_stmt, del_stmt_sql, sizeof(del_stmt_sql))
 	|| init_stmt(&gettree_all_stmt, gettree_all_stmt_sql, sizeof(gettree_all_stmt_sql))
-	|| init_stmt(&showkey_stmt, showkey_stmt_sql, sizeof(showkey_stmt_sql))
 	|| init_stmt(&put_stmt, put_stmt_sql, sizeof(put_stmt_sql));
 }
 
@@ -214,7 +395,6 @@ static int db_create_astdb(void)
 		res = -1;
 	}
 	sqlite3_reset(create_astdb_stmt);
-	db_sync();
 	ast_mutex_unlock(&dblock);
 
 	return res;
@@ -258,6 +438,16 @@ static int db_open(void)
 		return -1;
 	}
 
+	if (ast_option_astdb_wal) {
+		/* Write backs then do not block readers of the database file */
+		char *errmsg = NULL;
+
+		if (sqlite3_exec(astdb, "PRAGMA journal_mode=WAL", NULL, NULL, &errmsg) != SQLITE_OK) {
+			ast_log(LOG_WARNING, "Unable to use WAL journal mode for the Asterisk database: %s\n", errmsg);
+			sqlite3_free(errmsg);
+		}
+	}
+
 	ast_mutex_unlock(&dblock);
 
 	return 0;
@@ -265,6 +455,8 @@ static int db_open(void)
 
 static int db_init(void)
 {
+	int res;
+
 	if (astdb) {
 		return 0;
 	}
@@ -273,7 +465,20 @@ static int db_init(void)
 		return -1;
 	}
 
-	return 0;
+	db_cache = ao2_container_alloc_rbtree(AO2_ALLOC_OPT_LOCK_RWLOCK,
+		AO2_CONTAINER_ALLOC_OPT_DUPS_REPLACE, db_entry_sort, NULL);
+	db_dirty = db_dirty_alloc();
+	if (!db_cache || !db_dirty) {
+		return -1;
+	}
+
+	ast_mutex_lock(&dblock);
+	ast_mutex_lock(&cachelock);
+	res = db_cache_load();
+	ast_mutex_unlock(&cachelock);
+	ast_mutex_unlock(&dblock);
+
+	return res;
 }
 
 /* We purposely don't lock around the sqlite3 call because the transaction
@@ -308,36 +513,168 @@ static int ast_db_rollback_transaction(void)
 	return db_execute_sql("ROLLBACK", NULL, NULL);
 }
 
+/*!
+ * \internal
+ * \brief Fill the cache with every key in SQLite
+ *
+ * \note dblock and cachelock must be held when calling this function.
+ */
+static int db_cache_load(void)
+{
+	int res = 0;
+
+	ao2_callback(db_cache, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, NULL, NULL);
+
+	while (sqlite3_step(gettree_all_stmt) == SQLITE_ROW) {
+		const char *key_s, *value_s;
+		struct db_entry *entry;
+
+		if (!(key_s = (const char *) sqlite3_column_text(gettree_all_stmt, 0))) {
+			continue;
+		}
+		if (!(value_s = (const char *) sqlite3_column_text(gettree_all_stmt, 1))) {
+			continue;
+		}
+		if (!(entry = db_entry_alloc(key_s, value_s))) {
+			res = -1;
+			break;
+		}
+		ao2_link(db_cache, entry);
+		ao2_ref(entry, -1);
+	}
+	sqlite3_reset(gettree_all_stmt);
+
+	return res;
+}
+
+/*!
+ * \internal
+ * \brief Take the keys that need to be written back
+ *
+ * Each returned key holds the entry that is current for it, or no entry if
+ * the key has been deleted.
+ *
+ * \note cachelock must be held when calling this function.
+ *
+ * \return The keys, or NULL if there are none
+ */
+static struct ao2_container *db_take_dirty(void)
+{
+	struct ao2_container *dirty;
+	struct ao2_container *fresh;
+	struct ao2_iterator iter;
+	struct db_dirty_key *key;
+
+	if (!ao2_container_count(db_dirty) || !(fresh = db_dirty_alloc())) {
+		return NULL;
+	}
+	dirty = db_dirty;
+	db_dirty = fresh;
+
+	iter = ao2_iterator_init(dirty, 0);
+	for (; (key = ao2_iterator_next(&iter)); ao2_ref(key, -1)) {
+		key->entry = ao2_find(db_cache, key->key, OBJ_SEARCH_KEY);
+	}
+	ao2_iterator_destroy(&iter);
+
+	return dirty;
+}
+
+/*!
+ * \internal
+ * \brief Mark keys that failed to be written back dirty again
+ *
+ * \note cachelock must be held when calling this function.
+ */
+static void db_requeue_dirty(struct ao2_container *dirty)
+{
+	struct ao2_iterator iter;
+	struct db_dirty_key *key;
+
+	ast_log(LOG_WARNING, "Couldn't write %d astdb changes, will retry\n",
+		ao2_container_count(dirty));
+
+	iter = ao2_iterator_init(dirty, 0);
+	for (; (key = ao2_iterator_next(&iter)); ao2_ref(key, -1)) {
+		db_mark_dirty(key->key);
+	}
+	ao2_iterator_destroy(&iter);
+}
+
+/*!
+ * \internal
+ * \brief Write changed keys back to SQLite in one transaction
+ *
+ * \note dblock must be held when calling this function.
+ *
+ * \retval 0 on success
+ * \retval -1 if the transaction failed, and the keys need db_requeue_dirty()
+ */
+static int db_write_back(struct ao2_container *dirty)
+{
+	struct ao2_iterator iter;
+	struct db_dirty_key *key;
+	int res = 0;
+
+	if (ast_db_begin_transaction()) {
+		res = -1;
+	}
+
+	iter = ao2_iterator_init(dirty, 0);
+	for (; !res && (key = ao2_iterator_next(&iter)); ao2_ref(key, -1)) {
+		sqlite3_stmt *stmt = key->entry ? put_stmt : del_stmt;
+
+		if (sqlite3_bind_text(stmt, 1, key->key, -1, SQLITE_STATIC) != SQLITE_OK) {
+			ast_log(LOG_WARNING, "Couldn't bind key to stmt: %s\n", sqlite3_errmsg(astdb));
+			res = -1;
+		} else if (key->entry
+			&& sqlite3_bind_text(stmt, 2, key->entry->value, -1, SQLITE_STATIC) != SQLITE_OK) {
+			ast_log(LOG_WARNING, "Couldn't bind value to stmt: %s\n", sqlite3_errmsg(astdb));
+			res = -1;
+		} else if (sqlite3_step(stmt) != SQLITE_DONE) {
+			ast_log(LOG_WARNING, "Couldn't execute statment: %s\n", sqlite3_errmsg(astdb));
+			res = -1;
+		}
+		sqlite3_reset(stmt);
+	}
+	ao2_iterator_destroy(&iter);
+
+	if (!res && ast_db_commit_transaction()) {
+		res = -1;
+	}
+
+	if (res) {
+		ast_db_rollback_transaction();
+	}
+
+	return res;
+}
+
 int ast_db_put(const char *family, const char *key, const char *value)
 {
 	char fullkey[MAX_DB_FIELD];
-	size_t fullkey_len;
-	int res = 0;
+	struct db_entry *entry;
 
 	if (strlen(family) + strlen(key) + 2 > sizeof(fullkey) - 1) {
 		ast_log(LOG_WARNING, "Family and key length must be less than %zu bytes\n", sizeof(fullkey) - 3);
 		return -1;
 	}
 
-	fullkey_len = snprintf(fullkey, sizeof(fullkey), "/%s/%s", family, key);
+	snprintf(fullkey, sizeof(fullkey), "/%s/%s", family, key);
 
-	ast_mutex_lock(&dblock);
-	if (sqlite3_bind_text(put_stmt, 1, fullkey, fullkey_len, SQLITE_STATIC) != SQLITE_OK) {
-		ast_log(LOG_WARNING, "Couldn't bind key to stmt: %s\n", sqlite3_errmsg(astdb));
-		res = -1;
-	} else if (sqlite3_bind_text(put_stmt, 2, value, -1, SQLITE_STATIC) != SQLITE_OK) {
-		ast_log(LOG_WARNING, "Couldn't bind value to stmt: %s\n", sqlite3_errmsg(astdb));
-		res = -1;
-	} else if (sqlite3_step(put_stmt) != SQLITE_DONE) {
-		ast_log(LOG_WARNING, "Couldn't execute statment: %s\n", sqlite3_errmsg(astdb));
-		res = -1;
+	if (!(entry = db_entry_alloc(fullkey, value))) {
+		return -1;
 	}
 
-	sqlite3_reset(put_stmt);
-	db_sync();
-	ast_mutex_unlock(&dblock);
+	ast_mutex_lock(&cachelock);
+	/* The container replaces any entry for the same key */
+	ao2_link(db_cache, entry);
+	db_mark_dirty(fullkey);
+	ast_mutex_unlock(&cachelock);
 
-	return res;
+	ao2_ref(entry, -1);
+
+	return 0;
 }
 
 /*!
@@ -356,41 +693,29 @@ int ast_db_put(const char *family, const char *key, const char *value)
  */
 static int db_get_common(const char *family, const char *key, char **buffer, int bufferlen)
 {
-	const unsigned char *result;
 	char fullkey[MAX_DB_FIELD];
-	size_t fullkey_len;
-	int res = 0;
+	struct db_entry *entry;
 
 	if (strlen(family) + strlen(key) + 2 > sizeof(fullkey) - 1) {
 		ast_log(LOG_WARNING, "Family and key length must be less than %zu bytes\n", sizeof(fullkey) - 3);
 		return -1;
 	}
 
-	fullkey_len = snprintf(fullkey, sizeof(fullkey), "/%s/%s", family, key);
+	snprintf(fullkey, sizeof(fullkey), "/%s/%s", family, key);
 
-	ast_mutex_lock(&dblock);
-	if (sqlite3_bind_text(get_stmt, 1, fullkey, fullkey_len, SQLITE_STATIC) != SQLITE_OK) {
-		ast_log(LOG_WARNING, "Couldn't bind key to stmt: %s\n", sqlite3_errmsg(astdb));
-		res = -1;
-	} else if (sqlite3_step(get_stmt) != SQLITE_ROW) {
+	if (!(entry = ao2_find(db_cache, fullkey, OBJ_SEARCH_KEY))) {
 		ast_debug(1, "Unable to find key '%s' in family '%s'\n", key, family);
-		res = -1;
-	} else if (!(result = sqlite3_column_text(get_stmt, 0))) {
-		ast_log(LOG_WARNING, "Couldn't get value\n");
-		res = -1;
-	} else {
-		const char *value = (const char *) result;
+		return -1;
+	}
 
-		if (bufferlen == -1) {
-			*buffer = ast_strdup(value);
-		} else {
-			ast_copy_string(*buffer, value, bufferlen);
-		}
+	if (bufferlen == -1) {
+		*buffer = ast_strdup(entry->value);
+	} else {
+		ast_copy_string(*buffer, entry->value, bufferlen);
 	}
-	sqlite3_reset(get_stmt);
-	ast_mutex_unlock(&dblock);
+	ao2_ref(entry, -1);
 
-	return res;
+	return 0;
 }
 
 int ast_db_get(const char *family, const char *key, char *value, int valuelen)
@@ -413,7 +738,7 @@ int ast_db_get_allocated(const char *family, const char *key, char **out)
 int ast_db_del(const char *family, const char *key)
 {
 	char fullkey[MAX_DB_FIELD];
-	size_t fullkey_len;
+	struct db_entry *entry;
 	int res = 0;
 
 	if (strlen(family) + strlen(key) + 2 > sizeof(fullkey) - 1) {
@@ -421,27 +746,26 @@ int ast_db_del(const char *family, const char *key)
 		return -1;
 	}
 
-	fullkey_len = snprintf(fullkey, sizeof(fullkey), "/%s/%s", family, key);
+	snprintf(fullkey, sizeof(fullkey), "/%s/%s", family, key);
 
-	ast_mutex_lock(&dblock);
-	if (sqlite3_bind_text(del_stmt, 1, fullkey, fullkey_len, SQLITE_STATIC) != SQLITE_OK) {
-		ast_log(LOG_WARNING, "Couldn't bind key to stmt: %s\n", sqlite3_errmsg(astdb));
-		res = -1;
-	} else if (sqlite3_step(del_stmt) != SQLITE_DONE) {
+	ast_mutex_lock(&cachelock);
+	if ((entry = ao2_find(db_cache, fullkey, OBJ_SEARCH_KEY | OBJ_UNLINK))) {
+		db_mark_dirty(fullkey);
+		ao2_ref(entry, -1);
+	} else {
 		ast_debug(1, "Unable to find key '%s' in family '%s'\n", key, family);
 		res = -1;
 	}
-	sqlite3_reset(del_stmt);
-	db_sync();
-	ast_mutex_unlock(&dblock);
+	ast_mutex_unlock(&cachelock);
 
 	return res;
 }
 
 int ast_db_deltree(const char *family, const char *keytree)
 {
-	sqlite3_stmt *stmt = deltree_stmt;
 	char prefix[MAX_DB_FIELD];
+	struct ao2_iterator *iter;
+	struct db_entry *entry;
 	int res = 0;
 
 	if (!ast_strlen_zero(family)) {
@@ -454,21 +778,19 @@ int ast_db_deltree(const char *family, const char *keytree)
 		}
 	} else {
 		prefix[0] = '\0';
-		stmt = deltree_all_stmt;
 	}
 
-	ast_mutex_lock(&dblock);
-	if (!ast_strlen_zero(prefix) && (sqlite3_bind_text(stmt, 1, prefix, -1, SQLITE_STATIC) != SQLITE_OK)) {
-		ast_log(LOG_WARNING, "Could bind %s to stmt: %s\n", prefix, sqlite3_errmsg(astdb));
-		res = -1;
-	} else if (sqlite3_step(stmt) != SQLITE_DONE) {
-		ast_log(LOG_WARNING, "Couldn't execute stmt: %s\n", sqlite3_errmsg(astdb));
-		res = -1;
+	ast_mutex_lock(&cachelock);
+	if (!(iter = db_cache_tree(prefix, OBJ_UNLINK))) {
+		ast_mutex_unlock(&cachelock);
+		return -1;
 	}
-	res = sqlite3_changes(astdb);
-	sqlite3_reset(stmt);
-	db_sync();
-	ast_mutex_unlock(&dblock);
+	for (; (entry = ao2_iterator_next(iter)); ao2_ref(entry, -1)) {
+		db_mark_dirty(entry->key);
+		++res;
+	}
+	ast_mutex_unlock(&cachelock);
+	ao2_iterator_destroy(iter);
 
 	return res;
 }
@@ -476,7 +798,8 @@ int ast_db_deltree(const char *family, const char *keytree)
 struct ast_db_entry *ast_db_gettree(const char *family, const char *keytree)
 {
 	char prefix[MAX_DB_FIELD];
-	sqlite3_stmt *stmt = gettree_stmt;
+	struct ao2_iterator *iter;
+	struct db_entry *entry;
 	struct ast_db_entry *cur, *last = NULL, *ret = NULL;
 
 	if (!ast_strlen_zero(family)) {
@@ -489,32 +812,21 @@ struct ast_db_entry *ast_db_gettree(const char *family, const char *keytree)
 		}
 	} else {
 		prefix[0] = '\0';
-		stmt = gettree_all_stmt;
 	}
 
-	ast_mutex_lock(&dblock);
-	if (!ast_strlen_zero(prefix) && (sqlite3_bind_text(stmt, 1, prefix, -1, SQLITE_STATIC) != SQLITE_OK)) {
-		ast_log(LOG_WARNING, "Could bind %s to stmt: %s\n", prefix, sqlite3_errmsg(astdb));
-		sqlite3_reset(stmt);
-		ast_mutex_unlock(&dblock);
+	if (!(iter = db_cache_tree(prefix, 0))) {
 		return NULL;
 	}
 
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		const char *key_s, *value_s;
-		if (!(key_s = (const char *) sqlite3_column_text(stmt, 0))) {
-			break;
-		}
-		if (!(value_s = (const char *) sqlite3_column_text(stmt, 1))) {
-			break;
-		}
-		if (!(cur = ast_malloc(sizeof(*cur) + strlen(key_s) + strlen(value_s) + 2))) {
+	for (; (entry = ao2_iterator_next(iter)); ao2_ref(entry, -1)) {
+		if (!(cur = ast_malloc(sizeof(*cur) + strlen(entry->key) + strlen(entry->value) + 2))) {
+			ao2_ref(entry, -1);
 			break;
 		}
 		cur->next = NULL;
-		cur->key = cur->data + strlen(value_s) + 1;
-		strcpy(cur->data, value_s);
-		strcpy(cur->key, key_s);
+		cur->key = cur->data + strlen(entry->value) + 1;
+		strcpy(cur->data, entry->value);
+		strcpy(cur->key, entry->key);
 		if (last) {
 			last->next = cur;
 		} else {
@@ -522,8 +834,7 @@ struct ast_db_entry *ast_db_gettree(const char *family, const char *keytree)
 		}
 		last = cur;
 	}
-	sqlite3_reset(stmt);
-	ast_mutex_unlock(&dblock);
+	ao2_iterator_destroy(iter);
 
 	return ret;
 }
@@ -659,7 +970,8 @@ static char *handle_cli_database_show(struct ast_cli_entry *e, int cmd, struct a
 {
 	char prefix[MAX_DB_FIELD];
 	int counter = 0;
-	sqlite3_stmt *stmt = gettree_stmt;
+	struct ao2_iterator *iter;
+	struct db_entry *entry;
 
 	switch (cmd) {
 	case CLI_INIT:
@@ -684,44 +996,41 @@ static char *handle_cli_database_show(struct ast_cli_entry *e, int cmd, struct a
 	} else if (a->argc == 2) {
 		/* Neither */
 		prefix[0] = '\0';
-		stmt = gettree_all_stmt;
-
 	} else {
 		return CLI_SHOWUSAGE;
 	}
 
-	ast_mutex_lock(&dblock);
-	if (!ast_strlen_zero(prefix) && (sqlite3_bind_text(stmt, 1, prefix, -1, SQLITE_STATIC) != SQLITE_OK)) {
-		ast_log(LOG_WARNING, "Could bind %s to stmt: %s\n", prefix, sqlite3_errmsg(astdb));
-		sqlite3_reset(stmt);
-		ast_mutex_unlock(&dblock);
+	if (!(iter = db_cache_tree(prefix, 0))) {
 		return NULL;
 	}
 
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		const char *key_s, *value_s;
-		if (!(key_s = (const char *) sqlite3_column_text(stmt, 0))) {
-			ast_log(LOG_WARNING, "Skipping invalid key!\n");
-			continue;
-		}
-		if (!(value_s = (const char *) sqlite3_column_text(stmt, 1))) {
-			ast_log(LOG_WARNING, "Skipping invalid value!\n");
-			continue;
-		}
+	for (; (entry = ao2_iterator_next(iter)); ao2_ref(entry, -1)) {
 		++counter;
-		ast_cli(a->fd, "%-50s: %-25s\n", key_s, value_s);
+		ast_cli(a->fd, "%-50s: %-25s\n", entry->key, entry->value);
 	}
-
-	sqlite3_reset(stmt);
-	ast_mutex_unlock(&dblock);
+	ao2_iterator_destroy(iter);
 
 	ast_cli(a->fd, "%d results found.\n", counter);
 	return CLI_SUCCESS;
 }
 
+/*! \brief Match keys whose last component is the argument, ignoring case */
+static int db_last_key_match(void *obj, void *arg, int flags)
+{
+	struct db_entry *entry = obj;
+	const char *last = arg;
+	size_t key_len = strlen(entry->key);
+	size_t last_len = strlen(last);
+
+	return (key_len > last_len && entry->key[key_len - last_len - 1] == '/'
+		&& !strcasecmp(entry->key + key_len - last_len, last)) ? CMP_MATCH : 0;
+}
+
 static char *handle_cli_database_showkey(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	int counter = 0;
+	struct ao2_iterator *iter;
+	struct db_entry *entry;
 
 	switch (cmd) {
 	case CLI_INIT:
@@ -738,27 +1047,15 @@ static char *handle_cli_database_showkey(struct ast_cli_entry *e, int cmd, struc
 		return CLI_SHOWUSAGE;
 	}
 
-	ast_mutex_lock(&dblock);
-	if (!ast_strlen_zero(a->argv[2]) && (sqlite3_bind_text(showkey_stmt, 1, a->argv[2], -1, SQLITE_STATIC) != SQLITE_OK)) {
-		ast_log(LOG_WARNING, "Could bind %s to stmt: %s\n", a->argv[2], sqlite3_errmsg(astdb));
-		sqlite3_reset(showkey_stmt);
-		ast_mutex_unlock(&dblock);
+	if (!(iter = ao2_callback(db_cache, OBJ_MULTIPLE, db_last_key_match, (void *) a->argv[2]))) {
 		return NULL;
 	}
 
-	while (sqlite3_step(showkey_stmt) == SQLITE_ROW) {
-		const char *key_s, *value_s;
-		if (!(key_s = (const char *) sqlite3_column_text(showkey_stmt, 0))) {
-			break;
-		}
-		if (!(value_s = (const char *) sqlite3_column_text(showkey_stmt, 1))) {
-			break;
-		}
+	for (; (entry = ao2_iterator_next(iter)); ao2_ref(entry, -1)) {
 		++counter;
-		ast_cli(a->fd, "%-50s: %-25s\n", key_s, value_s);
+		ast_cli(a->fd, "%-50s: %-25s\n", entry->key, entry->value);
 	}
-	sqlite3_reset(showkey_stmt);
-	ast_mutex_unlock(&dblock);
+	ao2_iterator_destroy(iter);
 
 	ast_cli(a->fd, "%d results found.\n", counter);
 	return CLI_SUCCESS;
@@ -779,6 +1076,7 @@ static int display_results(void *arg, int columns, char **values, char **colname
 
 static char *handle_cli_database_query(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
+	struct ao2_container *dirty;
 
 	switch (cmd) {
 	case CLI_INIT:
@@ -795,9 +1093,22 @@ static char *handle_cli_database_query(struct ast_cli_entry *e, int cmd, struct
 		return CLI_SHOWUSAGE;
 	}
 
+	/*
+	 * The query runs against what is on disk, so pending changes are
+	 * written first. It may also change the database, so the cache is
+	 * reloaded afterwards.
+	 */
 	ast_mutex_lock(&dblock);
+	ast_mutex_lock(&cachelock);
+	if ((dirty = db_take_dirty())) {
+		if (db_write_back(dirty)) {
+			db_requeue_dirty(dirty);
+		}
+		ao2_ref(dirty, -1);
+	}
 	db_execute_sql(a->argv[2], display_results, a);
-	db_sync(); /* Go ahead and sync the db in case they write */
+	db_cache_load();
+	ast_mutex_unlock(&cachelock);
 	ast_mutex_unlock(&dblock);
 
 	return CLI_SUCCESS;
@@ -937,7 +1248,7 @@ static int manager_dbdeltree(struct mansession *s, const struct message *m)
  * \internal
  * \brief Signal the astdb sync thread to do its thing.
  *
- * \note dblock is assumed to be held when calling this function.
+ * \note cachelock is assumed to be held when calling this function.
  */
 static void db_sync(void)
 {
@@ -949,36 +1260,49 @@ static void db_sync(void)
  * \internal
  * \brief astdb sync thread
  *
- * This thread is in charge of syncing astdb to disk after a change.
+ * This thread is in charge of writing changed keys back to disk.
  * By pushing it off to this thread to take care of, this I/O bound operation
  * will not block other threads from performing other critical processing.
  * If changes happen rapidly, this thread will also ensure that the sync
- * operations are rate limited.
+ * operations are rate limited, writing all keys changed in the meantime
+ * in a single transaction.
  */
 static void *db_sync_thread(void *data)
 {
-	ast_mutex_lock(&dblock);
-	ast_db_begin_transaction();
+	struct ao2_container *dirty;
+	int exiting;
+
 	for (;;) {
-		/* If dosync is set, db_sync() was called during sleep(1), 
-		 * and the pending transaction should be committed. 
+		/* If dosync is set, db_sync() was called during sleep(1),
+		 * and the changed keys should be written back.
 		 * Otherwise, block until db_sync() is called.
 		 */
+		ast_mutex_lock(&cachelock);
 		while (!dosync) {
-			ast_cond_wait(&dbcond, &dblock);
+			ast_cond_wait(&dbcond, &cachelock);
 		}
 		dosync = 0;
-		if (ast_db_commit_transaction()) {
-			ast_db_rollback_transaction();
+		exiting = doexit;
+		ast_mutex_unlock(&cachelock);
+
+		ast_mutex_lock(&dblock);
+		ast_mutex_lock(&cachelock);
+		dirty = db_take_dirty();
+		ast_mutex_unlock(&cachelock);
+		if (dirty) {
+			if (db_write_back(dirty)) {
+				ast_mutex_lock(&cachelock);
+				db_requeue_dirty(dirty);
+				ast_mutex_unlock(&cachelock);
+			}
+			ao2_ref(dirty, -1);
 		}
-		if (doexit) {
-			ast_mutex_unlock(&dblock);
+		ast_mutex_unlock(&dblock);
+
+		if (exiting) {
 			break;
 		}
-		ast_db_begin_transaction();
-		ast_mutex_unlock(&dblock);
 		sleep(1);
-		ast_mutex_lock(&dblock);
 	}
 
 	return NULL;
@@ -996,12 +1320,12 @@ static void astdb_atexit(void)
 	ast_manager_unregister("DBDel");
 	ast_manager_unregister("DBDelTree");
 
-	/* Set doexit to 1 to kill thread. db_sync must be called with
-	 * mutex held. */
-	ast_mutex_lock(&dblock);
+	/* Set doexit to 1 to kill thread, after it writes back any
+	 * changed keys. db_sync must be called with cachelock held. */
+	ast_mutex_lock(&cachelock);
 	doexit = 1;
 	db_sync();
-	ast_mutex_unlock(&dblock);
+	ast_mutex_unlock(&cachelock);
 
 	pthread_join(syncthread, NULL);
 	ast_mutex_lock(&dblock);
@@ -156,6 +156,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/astobj2.h"
 #include "asterisk/stasis.h"
 #include "asterisk/devicestate.h"
+#include "asterisk/cli.h"
 
 #define DEVSTATE_TOPIC_BUCKETS 57
 
@@ -332,8 +333,166 @@ static enum ast_device_state devstate_cached(const char *device)
 	return state;
 }
 
+#ifdef LOW_MEMORY
+#define DEVSTATE_QUERY_BUCKETS 17
+#else
+#define DEVSTATE_QUERY_BUCKETS 563
+#endif
+
+/*! \brief How often the devices of a provider were answered from the query table */
+struct devstate_query_stats {
+	/*! Queries answered from the table */
+	int hits;
+	/*! Queries the provider had to answer */
+	int misses;
+	/*! Answers dropped because the device changed */
+	int invalidations;
+	/*! Channel technology or provider label */
+	char name[0];
+};
+
+/*!
+ * \brief The last answer a provider gave for a device that is not in the cache
+ *
+ * \note Providers must report a change of state with ast_devstate_changed(),
+ * which drops the answer kept here, so it can be given again until then.
+ */
+struct devstate_query {
+	struct devstate_query_stats *stats;
+	/*! Bumped each time the device changes */
+	unsigned int generation;
+	/*! Set if state holds an answer that is still good */
+	int valid;
+	/*! Set once the device has reported a state that must not be cached */
+	int uncachable;
+	enum ast_device_state state;
+	/*! When the answer was given */
+	struct timeval updated;
+	char device[0];
+};
+
+/*! \brief Provider answers for devices, see struct devstate_query */
+static struct ao2_container *devstate_queries;
+
+/*! \brief Per provider query statistics, see struct devstate_query_stats */
+static struct ao2_container *devstate_query_stats;
+
+AO2_STRING_FIELD_HASH_FN(devstate_query, device)
+AO2_STRING_FIELD_CMP_FN(devstate_query, device)
+
+/*! \note Provider labels are not case sensitive */
+static int devstate_query_stats_hash_fn(const void *obj, const int flags)
+{
+	const struct devstate_query_stats *stats = obj;
+
+	return ast_str_case_hash((flags & OBJ_SEARCH_MASK) == OBJ_SEARCH_KEY ? obj : stats->name);
+}
+
+static int devstate_query_stats_cmp_fn(void *obj, void *arg, int flags)
+{
+	const struct devstate_query_stats *left = obj;
+	const struct devstate_query_stats *right = arg;
+
+	return strcasecmp(left->name, (flags & OBJ_SEARCH_MASK) == OBJ_SEARCH_KEY ? arg : right->name)
+		? 0 : CMP_MATCH;
+}
+
+static void devstate_query_destroy(void *obj)
+{
+	struct devstate_query *query = obj;
+
+	ao2_cleanup(query->stats);
+}
+
+/*! \brief Find the statistics of the provider of a device, creating them if needed */
+static struct devstate_query_stats *devstate_query_stats_get(const char *device)
+{
+	struct devstate_query_stats *stats;
+	size_t len = strcspn(device, "/:");
+	char *name = ast_alloca(len + 1);
+
+	ast_copy_string(name, device, len + 1);
+
+	ao2_lock(devstate_query_stats);
+	stats = ao2_find(devstate_query_stats, name, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!stats) {
+		stats = ao2_alloc_options(sizeof(*stats) + len + 1, NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (stats) {
+			strcpy(stats->name, name);
+			ao2_link_flags(devstate_query_stats, stats, OBJ_NOLOCK);
+		}
+	}
+	ao2_unlock(devstate_query_stats);
+
+	return stats;
+}
+
+/*! \brief Find the query table entry of a device, creating it if needed */
+static struct devstate_query *devstate_query_get(const char *device, int create)
+{
+	struct devstate_query *query;
+
+	if (!devstate_queries) {
+		return NULL;
+	}
+
+	query = ao2_find(devstate_queries, device, OBJ_SEARCH_KEY);
+	if (query || !create) {
+		return query;
+	}
+
+	ao2_lock(devstate_queries);
+	query = ao2_find(devstate_queries, device, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!query) {
+		query = ao2_alloc(sizeof(*query) + strlen(device) + 1, devstate_query_destroy);
+		if (query) {
+			strcpy(query->device, device);
+			query->stats = devstate_query_stats_get(device);
+			if (query->stats) {
+				ao2_link_flags(devstate_queries, query, OBJ_NOLOCK);
+			} else {
+				ao2_ref(query, -1);
+				query = NULL;
+			}
+		}
+	}
+	ao2_unlock(devstate_queries);
+
+	return query;
+}
+
+/*!
+ * \internal
+ * \brief Drop the answer kept for a device that has changed
+ *
+ * \param device The device that changed
+ * \param cachable Whether the new state of the device may be cached
+ */
+static void devstate_query_invalidate(const char *device, enum ast_devstate_cache cachable)
+{
+	struct devstate_query *query;
+
+	/* Devices that must not be cached get an entry so they are never kept */
+	query = devstate_query_get(device, cachable == AST_DEVSTATE_NOT_CACHABLE);
+	if (!query) {
+		return;
+	}
+
+	ao2_lock(query);
+	++query->generation;
+	if (query->valid) {
+		query->valid = 0;
+		ast_atomic_fetchadd_int(&query->stats->invalidations, +1);
+	}
+	if (cachable == AST_DEVSTATE_NOT_CACHABLE) {
+		query->uncachable = 1;
+	}
+	ao2_unlock(query);
+	ao2_ref(query, -1);
+}
+
 /*! \brief Check device state through channel specific function or generic function */
-static enum ast_device_state _ast_device_state(const char *device, int check_cache)
+static enum ast_device_state provider_device_state(const char *device)
 {
 	char *number;
 	const struct ast_channel_tech *chan_tech;
@@ -341,14 +500,6 @@ static enum ast_device_state _ast_device_state(const char *device, int check_cac
 	/*! \brief Channel driver that provides device state */
 	char *tech;
 
-	/* If the last known state is cached, just return that */
-	if (check_cache) {
-		res = devstate_cached(device);
-		if (res != AST_DEVICE_UNKNOWN) {
-			return res;
-		}
-	}
-
 	number = ast_strdupa(device);
 	tech = strsep(&number, "/");
 	if (!number) {
@@ -387,6 +538,66 @@ static enum ast_device_state _ast_device_state(const char *device, int check_cac
 	return res;
 }
 
+/*! \brief Check device state, from the cache, the query table or the provider */
+static enum ast_device_state _ast_device_state(const char *device, int check_cache)
+{
+	struct devstate_query *query;
+	unsigned int generation;
+	int unknown;
+	enum ast_device_state res;
+
+	if (!check_cache) {
+		return provider_device_state(device);
+	}
+
+	/* If the last known state is cached, just return that */
+	res = devstate_cached(device);
+	if (res != AST_DEVICE_UNKNOWN) {
+		return res;
+	}
+
+	query = devstate_query_get(device, 1);
+	if (!query) {
+		return provider_device_state(device);
+	}
+
+	ao2_lock(query);
+	if (query->valid) {
+		res = query->state;
+		ao2_unlock(query);
+		ast_atomic_fetchadd_int(&query->stats->hits, +1);
+		ao2_ref(query, -1);
+		return res;
+	}
+	generation = query->generation;
+	ao2_unlock(query);
+
+	ast_atomic_fetchadd_int(&query->stats->misses, +1);
+	res = provider_device_state(device);
+
+	/*
+	 * Keep the answer, unless the device changed while the provider
+	 * was asked, or none of the providers know the device.
+	 */
+	ao2_lock(query);
+	if (query->generation == generation && !query->uncachable
+		&& res != AST_DEVICE_UNKNOWN && res != AST_DEVICE_INVALID) {
+		query->state = res;
+		query->valid = 1;
+		query->updated = ast_tvnow();
+	}
+	unknown = res == AST_DEVICE_INVALID && !query->valid && !query->uncachable;
+	ao2_unlock(query);
+
+	if (unknown) {
+		/* Do not keep entries for every made up device name asked about */
+		ao2_unlink(devstate_queries, query);
+	}
+	ao2_ref(query, -1);
+
+	return res;
+}
+
 enum ast_device_state ast_device_state(const char *device)
 {
 	/* This function is called from elsewhere in the code to find out the
@@ -422,6 +633,20 @@ int ast_devstate_prov_add(const char *label, ast_devstate_prov_cb_type callback)
 	return 0;
 }
 
+static int devstate_query_invalidate_provider(void *obj, void *arg, int flags)
+{
+	struct devstate_query *query = obj;
+	const char *label = arg;
+
+	if (!strcasecmp(query->stats->name, label)) {
+		ao2_lock(query);
+		++query->generation;
+		query->valid = 0;
+		ao2_unlock(query);
+	}
+	return 0;
+}
+
 /*! \brief Remove device state provider */
 int ast_devstate_prov_del(const char *label)
 {
@@ -440,6 +665,11 @@ int ast_devstate_prov_del(const char *label)
 	AST_RWLIST_TRAVERSE_SAFE_END;
 	AST_RWLIST_UNLOCK(&devstate_provs);
 
+	if (!res && devstate_queries) {
+		/* The answers the provider gave no longer hold */
+		ao2_callback(devstate_queries, OBJ_NODATA, devstate_query_invalidate_provider, (void *) label);
+	}
+
 	return res;
 }
 
@@ -480,6 +710,9 @@ int ast_devstate_changed_literal(enum ast_device_state state, enum ast_devstate_
 {
 	struct state_change *change;
 
+	/* Whatever the state is now, the answer kept for the device is old */
+	devstate_query_invalidate(device, cachable);
+
 	/*
 	 * If we know the state change (how nice of the caller of this function!)
 	 * then we can just generate a device state event.
@@ -722,6 +955,8 @@ int ast_device_state_clear_cache(const char *device)
 		return -1;
 	}
 
+	devstate_query_invalidate(device, AST_DEVSTATE_CACHABLE);
+
 	msg = stasis_cache_clear_create(cached_msg);
 	if (msg) {
 		stasis_publish(ast_device_state_topic(device), msg);
@@ -747,6 +982,11 @@ int ast_publish_device_state_full(
 		return -1;
 	}
 
+	if (eid) {
+		/* Aggregates are only states republished, not changes */
+		devstate_query_invalidate(device, cachable);
+	}
+
 	device_state = device_state_alloc(device, state, cachable, eid);
 	if (!device_state) {
 		return -1;
@@ -887,8 +1127,87 @@ static struct stasis_message *device_state_aggregate_calc(struct stasis_cache_en
 	return aggregate_snapshot;
 }
 
+struct devstate_query_totals {
+	const char *name;
+	int devices;
+	int kept;
+	/*! Age of the oldest answer kept, in seconds */
+	int oldest;
+	struct timeval now;
+};
+
+static int devstate_query_total(void *obj, void *arg, int flags)
+{
+	struct devstate_query *query = obj;
+	struct devstate_query_totals *totals = arg;
+	int age;
+
+	if (strcasecmp(query->stats->name, totals->name)) {
+		return 0;
+	}
+
+	++totals->devices;
+	ao2_lock(query);
+	if (query->valid) {
+		++totals->kept;
+		age = ast_tvdiff_ms(totals->now, query->updated) / 1000;
+		if (age > totals->oldest) {
+			totals->oldest = age;
+		}
+	}
+	ao2_unlock(query);
+	return 0;
+}
+
+static char *handle_devstate_show_queries(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-20s %8s %8s %10s %10s %12s %10s\n"
+#define FORMAT2 "%-20s %8d %8d %10d %10d %12d %10d\n"
+	struct ao2_iterator iter;
+	struct devstate_query_stats *stats;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "devstate show queries";
+		e->usage =
+			"Usage: devstate show queries\n"
+			"       For each channel technology and device state provider, show\n"
+			"       how many device state queries were answered with the state\n"
+			"       it last gave, how many it had to answer, and how old the\n"
+			"       oldest state kept is, in seconds.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, FORMAT, "Provider", "Devices", "Kept", "Hits", "Misses", "Invalidated", "Oldest");
+	iter = ao2_iterator_init(devstate_query_stats, 0);
+	for (; (stats = ao2_iterator_next(&iter)); ao2_ref(stats, -1)) {
+		struct devstate_query_totals totals = { .name = stats->name, .now = ast_tvnow(), };
+
+		ao2_callback(devstate_queries, OBJ_NODATA, devstate_query_total, &totals);
+		ast_cli(a->fd, FORMAT2, stats->name, totals.devices, totals.kept,
+			stats->hits, stats->misses, stats->invalidations, totals.oldest);
+	}
+	ao2_iterator_destroy(&iter);
+
+	return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+static struct ast_cli_entry devstate_cli[] = {
+	AST_CLI_DEFINE(handle_devstate_show_queries, "Show how device state queries were answered"),
+};
+
 static void devstate_cleanup(void)
 {
+	ast_cli_unregister_multiple(devstate_cli, ARRAY_LEN(devstate_cli));
+
 	devstate_message_sub = stasis_unsubscribe_and_join(devstate_message_sub);
 	device_state_topic_cached = stasis_caching_unsubscribe_and_join(device_state_topic_cached);
 
@@ -901,6 +1220,11 @@ static void devstate_cleanup(void)
 	ao2_cleanup(device_state_topic_all);
 	device_state_topic_all = NULL;
 
+	ao2_cleanup(devstate_queries);
+	devstate_queries = NULL;
+	ao2_cleanup(devstate_query_stats);
+	devstate_query_stats = NULL;
+
 	STASIS_MESSAGE_TYPE_CLEANUP(ast_device_state_message_type);
 }
 
@@ -911,6 +1235,14 @@ int devstate_init(void)
 	if (STASIS_MESSAGE_TYPE_INIT(ast_device_state_message_type) != 0) {
 		return -1;
 	}
+	devstate_query_stats = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, 17,
+		devstate_query_stats_hash_fn, NULL, devstate_query_stats_cmp_fn);
+	devstate_queries = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0,
+		DEVSTATE_QUERY_BUCKETS, devstate_query_hash_fn, NULL, devstate_query_cmp_fn);
+	if (!devstate_query_stats || !devstate_queries) {
+		devstate_cleanup();
+		return -1;
+	}
 	device_state_topic_all = stasis_topic_create("ast_device_state_topic");
 	if (!device_state_topic_all) {
 		devstate_cleanup();
@@ -942,6 +1274,8 @@ int devstate_init(void)
 		return -1;
 	}
 
+	ast_cli_register_multiple(devstate_cli, ARRAY_LEN(devstate_cli));
+
 	return 0;
 }
 
@@ -41,12 +41,26 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <arpa/nameser.h>	/* res_* functions */
 #include <resolv.h>
 
+#include "asterisk/_private.h"
+#include "asterisk/astobj2.h"
 #include "asterisk/channel.h"
 #include "asterisk/dns.h"
 #include "asterisk/endian.h"
 
 #define MAX_SIZE 4096
 
+/*! \brief Number of buckets for cached DNS answers */
+#define DNS_CACHE_BUCKETS 127
+
+/*! \brief Number of DNS answers cached before the cache is emptied */
+#define DNS_CACHE_MAX 1024
+
+/*! \brief Longest time, in seconds, a DNS answer is cached regardless of its TTL */
+#define DNS_CACHE_MAX_TTL 3600
+
+/*! \brief Time, in seconds, a name or record found not to exist is cached */
+#define DNS_CACHE_NEGATIVE_TTL 30
+
 #ifdef __PDP_ENDIAN
 #if __BYTE_ORDER == __PDP_ENDIAN
 #define DETERMINED_BYTE_ORDER __LITTLE_ENDIAN
@@ -185,9 +199,13 @@ static int skip_name(unsigned char *s, int len)
 	return x;
 }
 
-/*! \brief Parse DNS lookup result, call callback */
+/*!
+ * \brief Parse DNS lookup result, call callback
+ *
+ * \param ttl Lowered to the smallest TTL of the records in the answer section
+ */
 static int dns_parse_answer(void *context,
-	int class, int type, unsigned char *answer, int len,
+	int class, int type, unsigned char *answer, int len, unsigned int *ttl,
 	int (*callback)(void *context, unsigned char *answer, int len, unsigned char *fullanswer))
 {
 	unsigned char *fullanswer = answer;
@@ -229,6 +247,10 @@ static int dns_parse_answer(void *context,
 			return -1;
 		}
 
+		if (ntohl(ans->ttl) < *ttl) {
+			*ttl = ntohl(ans->ttl);
+		}
+
 		if (ntohs(ans->class) == class && ntohs(ans->rtype) == type) {
 			if (callback) {
 				if ((res = callback(context, answer, ntohs(ans->size), fullanswer)) < 0) {
@@ -248,39 +270,121 @@ static int dns_parse_answer(void *context,
 AST_MUTEX_DEFINE_STATIC(res_lock);
 #endif
 
-/*! \brief Lookup record in DNS
-\note Asterisk DNS is synchronus at this time. This means that if your DNS does
-not work properly, Asterisk might not start properly or a channel may lock.
-*/
-int ast_search_dns(void *context,
-	   const char *dname, int class, int type,
-	   int (*callback)(void *context, unsigned char *answer, int len, unsigned char *fullanswer))
+/*! \brief A DNS answer, or the failure of a lookup, cached until it expires */
+struct dns_cache_entry {
+	/*! When the entry stops being used */
+	struct timeval expires;
+	/*! Length of the answer, 0 if the lookup failed */
+	int len;
+	/*! The answer, as returned by the resolver */
+	unsigned char *answer;
+	/*! class/type/name the entry is cached under, in lower case */
+	char key[0];
+};
+
+/*! \brief Cached DNS answers */
+static struct ao2_container *dns_cache;
+
+AO2_STRING_FIELD_HASH_FN(dns_cache_entry, key);
+AO2_STRING_FIELD_CMP_FN(dns_cache_entry, key);
+
+/*!
+ * \internal
+ * \brief Copy an unexpired cached answer
+ *
+ * \retval -1 if nothing is cached
+ * \retval 0 if the lookup is cached as failed
+ * \return length of the answer copied to \a answer otherwise
+ */
+static int dns_cache_get(const char *key, unsigned char *answer)
+{
+	struct dns_cache_entry *entry;
+	int len = -1;
+
+	if (!dns_cache) {
+		return -1;
+	}
+
+	entry = ao2_find(dns_cache, key, OBJ_SEARCH_KEY);
+	if (!entry) {
+		return -1;
+	}
+
+	if (ast_tvcmp(entry->expires, ast_tvnow()) > 0) {
+		memcpy(answer, entry->answer, entry->len);
+		len = entry->len;
+	} else {
+		ao2_unlink(dns_cache, entry);
+	}
+	ao2_ref(entry, -1);
+
+	return len;
+}
+
+/*!
+ * \internal
+ * \brief Cache an answer, or a failed lookup if \a len is 0, for \a ttl seconds
+ */
+static void dns_cache_put(const char *key, const unsigned char *answer, int len, unsigned int ttl)
+{
+	struct dns_cache_entry *entry;
+	size_t key_len = strlen(key) + 1;
+
+	if (!dns_cache || !ttl) {
+		return;
+	}
+
+	entry = ao2_alloc_options(sizeof(*entry) + key_len + len, NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!entry) {
+		return;
+	}
+	memcpy(entry->key, key, key_len);
+	entry->answer = (unsigned char *) entry->key + key_len;
+	memcpy(entry->answer, answer, len);
+	entry->len = len;
+	entry->expires = ast_tvadd(ast_tvnow(), ast_samp2tv(MIN(ttl, DNS_CACHE_MAX_TTL), 1));
+
+	ao2_wrlock(dns_cache);
+	if (ao2_container_count(dns_cache) >= DNS_CACHE_MAX) {
+		ao2_callback(dns_cache, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE | OBJ_NOLOCK, NULL, NULL);
+	} else {
+		ao2_find(dns_cache, key, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA | OBJ_NOLOCK);
+	}
+	ao2_link_flags(dns_cache, entry, OBJ_NOLOCK);
+	ao2_unlock(dns_cache);
+
+	ao2_ref(entry, -1);
+}
+
+/*!
+ * \internal
+ * \brief Ask the system resolver for records
+ *
+ * \param negative Set if the name or the records do not exist
+ *
+ * \return length of the answer, or -1 on failure
+ */
+static int dns_search(const char *dname, int class, int type,
+	unsigned char *answer, int size, int *negative)
 {
 #ifdef HAVE_RES_NINIT
 	struct __res_state dnsstate;
 #endif
-	unsigned char answer[MAX_SIZE];
-	int res, ret = -1;
+	int res;
+	int herr;
 
 #ifdef HAVE_RES_NINIT
 	memset(&dnsstate, 0, sizeof(dnsstate));
 	res_ninit(&dnsstate);
-	res = res_nsearch(&dnsstate, dname, class, type, answer, sizeof(answer));
+	res = res_nsearch(&dnsstate, dname, class, type, answer, size);
+	herr = dnsstate.res_h_errno;
 #else
 	ast_mutex_lock(&res_lock);
 	res_init();
-	res = res_search(dname, class, type, answer, sizeof(answer));
+	res = res_search(dname, class, type, answer, size);
+	herr = h_errno;
 #endif
-	if (res > 0) {
-		if ((res = dns_parse_answer(context, class, type, answer, res, callback)) < 0) {
-			ast_log(LOG_WARNING, "DNS Parse error for %s\n", dname);
-			ret = -1;
-		} else if (res == 0) {
-			ast_debug(1, "No matches found in DNS for %s\n", dname);
-			ret = 0;
-		} else
-			ret = 1;
-	}
+	*negative = res < 0 && (herr == HOST_NOT_FOUND || herr == NO_DATA);
 #ifdef HAVE_RES_NINIT
 #ifdef HAVE_RES_NDESTROY
 	res_ndestroy(&dnsstate);
@@ -294,9 +398,80 @@ int ast_search_dns(void *context,
 	ast_mutex_unlock(&res_lock);
 #endif
 
+	return res;
+}
+
+/*! \brief Lookup record in DNS
+\note Asterisk DNS is synchronus at this time. This means that if your DNS does
+not work properly, Asterisk might not start properly or a channel may lock.
+Answers are cached for their TTL, and names or records found not to exist for
+DNS_CACHE_NEGATIVE_TTL seconds, so only the first lookup of a name waits.
+*/
+int ast_search_dns(void *context,
+	   const char *dname, int class, int type,
+	   int (*callback)(void *context, unsigned char *answer, int len, unsigned char *fullanswer))
+{
+	unsigned char answer[MAX_SIZE];
+	unsigned int ttl = DNS_CACHE_MAX_TTL;
+	char *key;
+	char *pos;
+	int cached;
+	int negative = 0;
+	int len;
+	int res, ret = -1;
+
+	key = ast_alloca(strlen(dname) + 32);
+	sprintf(key, "%d/%d/%s", class, type, dname); /* Safe */
+	for (pos = key; *pos; ++pos) {
+		*pos = tolower(*pos);
+	}
+
+	cached = dns_cache_get(key, answer);
+	if (!cached) {
+		ast_debug(1, "Cached failure of DNS lookup for %s\n", dname);
+		return -1;
+	}
+
+	len = cached > 0 ? cached : dns_search(dname, class, type, answer, sizeof(answer), &negative);
+	if (len > 0) {
+		if ((res = dns_parse_answer(context, class, type, answer, len, &ttl, callback)) < 0) {
+			ast_log(LOG_WARNING, "DNS Parse error for %s\n", dname);
+			ret = -1;
+		} else if (res == 0) {
+			ast_debug(1, "No matches found in DNS for %s\n", dname);
+			ret = 0;
+		} else
+			ret = 1;
+
+		if (cached < 0 && ret >= 0) {
+			dns_cache_put(key, answer, len, ret ? ttl : MIN(ttl, DNS_CACHE_NEGATIVE_TTL));
+		}
+	} else if (negative) {
+		dns_cache_put(key, NULL, 0, DNS_CACHE_NEGATIVE_TTL);
+	}
+
 	return ret;
 }
 
+static void dns_cache_shutdown(void)
+{
+	ao2_cleanup(dns_cache);
+	dns_cache = NULL;
+}
+
+int ast_dns_cache_init(void)
+{
+	dns_cache = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0,
+		DNS_CACHE_BUCKETS, dns_cache_entry_hash_fn, NULL, dns_cache_entry_cmp_fn);
+	if (!dns_cache) {
+		return -1;
+	}
+
+	ast_register_cleanup(dns_cache_shutdown);
+
+	return 0;
+}
+
 struct ao2_container *ast_dns_get_nameservers(void)
 {
 #ifdef HAVE_RES_NINIT
@@ -65,11 +65,18 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/dsp.h"
 #include "asterisk/ulaw.h"
 #include "asterisk/alaw.h"
+#include "asterisk/g711.h"
 #include "asterisk/utils.h"
 #include "asterisk/options.h"
 #include "asterisk/config.h"
 #include "asterisk/test.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__ >= 5)
+/* AVX2 is built with a function target attribute and only used when the CPU has it. */
+#define GOERTZEL_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
 /*! Number of goertzels for progress detect */
 enum gsamp_size {
 	GSAMP_SIZE_NA = 183,			/*!< North America - 350, 440, 480, 620, 950, 1400, 1800 Hz */
@@ -353,6 +360,124 @@ static inline void goertzel_sample(goertzel_state_t *s, short sample)
 	}
 }
 
+/*! \brief Most goertzels fed together by goertzel_bank_samples() */
+#define GOERTZEL_BANK_SIZE 8
+
+/*!
+ * \brief Feed a block of samples to a bank of goertzels.
+ *
+ * \details
+ * The states are loaded into arrays and every goertzel is stepped for a
+ * sample before moving on to the next, without branching on the rescaling,
+ * so the compiler can evaluate them side by side. The results are the same
+ * as calling goertzel_sample() for each goertzel and sample.
+ */
+static void goertzel_bank_samples_scalar(goertzel_state_t *const *bank, int n, const int16_t *amp, int samples)
+{
+	int v2[GOERTZEL_BANK_SIZE];
+	int v3[GOERTZEL_BANK_SIZE];
+	int chunky[GOERTZEL_BANK_SIZE];
+	int fac[GOERTZEL_BANK_SIZE];
+	int i;
+	int j;
+
+	for (i = 0; i < n; i++) {
+		v2[i] = bank[i]->v2;
+		v3[i] = bank[i]->v3;
+		chunky[i] = bank[i]->chunky;
+		fac[i] = bank[i]->fac;
+	}
+
+	for (j = 0; j < samples; j++) {
+		short samp = amp[j];
+
+		for (i = 0; i < n; i++) {
+			int v1 = v2[i];
+			int big;
+
+			v2[i] = v3[i];
+			v3[i] = ((fac[i] * v2[i]) >> 15) - v1 + (samp >> chunky[i]);
+			big = abs(v3[i]) > (1 << 15);
+			chunky[i] += big;
+			v3[i] >>= big;
+			v2[i] >>= big;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		bank[i]->v2 = v2[i];
+		bank[i]->v3 = v3[i];
+		bank[i]->chunky = chunky[i];
+	}
+}
+
+#ifdef GOERTZEL_HAVE_AVX2
+static int goertzel_avx2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/*!
+ * \brief Feed a block of samples to a bank of goertzels, one per AVX2 lane.
+ *
+ * \note Unused lanes run with a coefficient of 0 and are never stored.
+ */
+__attribute__((target("avx2")))
+static void goertzel_bank_samples_avx2(goertzel_state_t *const *bank, int n, const int16_t *amp, int samples)
+{
+	int v2_lanes[GOERTZEL_BANK_SIZE] = { 0, };
+	int v3_lanes[GOERTZEL_BANK_SIZE] = { 0, };
+	int chunky_lanes[GOERTZEL_BANK_SIZE] = { 0, };
+	int fac_lanes[GOERTZEL_BANK_SIZE] = { 0, };
+	__m256i v2;
+	__m256i v3;
+	__m256i chunky;
+	__m256i fac;
+	const __m256i limit = _mm256_set1_epi32(1 << 15);
+	int i;
+	int j;
+
+	for (i = 0; i < n; i++) {
+		v2_lanes[i] = bank[i]->v2;
+		v3_lanes[i] = bank[i]->v3;
+		chunky_lanes[i] = bank[i]->chunky;
+		fac_lanes[i] = bank[i]->fac;
+	}
+	v2 = _mm256_loadu_si256((const __m256i *) v2_lanes);
+	v3 = _mm256_loadu_si256((const __m256i *) v3_lanes);
+	chunky = _mm256_loadu_si256((const __m256i *) chunky_lanes);
+	fac = _mm256_loadu_si256((const __m256i *) fac_lanes);
+
+	for (j = 0; j < samples; j++) {
+		__m256i samp = _mm256_set1_epi32(amp[j]);
+		__m256i v1 = v2;
+		__m256i big;
+
+		v2 = v3;
+		v3 = _mm256_srai_epi32(_mm256_mullo_epi32(fac, v2), 15);
+		v3 = _mm256_add_epi32(_mm256_sub_epi32(v3, v1), _mm256_srav_epi32(samp, chunky));
+		/* 1 in each lane that has grown too large, else 0 */
+		big = _mm256_srli_epi32(_mm256_cmpgt_epi32(_mm256_abs_epi32(v3), limit), 31);
+		chunky = _mm256_add_epi32(chunky, big);
+		v3 = _mm256_srav_epi32(v3, big);
+		v2 = _mm256_srav_epi32(v2, big);
+	}
+
+	_mm256_storeu_si256((__m256i *) v2_lanes, v2);
+	_mm256_storeu_si256((__m256i *) v3_lanes, v3);
+	_mm256_storeu_si256((__m256i *) chunky_lanes, chunky);
+	for (i = 0; i < n; i++) {
+		bank[i]->v2 = v2_lanes[i];
+		bank[i]->v3 = v3_lanes[i];
+		bank[i]->chunky = chunky_lanes[i];
+	}
+}
+#endif
+
+/*! \brief Goertzel bank implementation in use, chosen for the CPU by ast_dsp_init() */
+static void (*goertzel_bank_samples)(goertzel_state_t *const *bank, int n, const int16_t *amp, int samples) = goertzel_bank_samples_scalar;
+
 static inline float goertzel_result(goertzel_state_t *s)
 {
 	goertzel_result_t r;
@@ -676,6 +801,10 @@ static int dtmf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp
 {
 	float row_energy[4];
 	float col_energy[4];
+	goertzel_state_t *const bank[] = {
+		&s->td.dtmf.row_out[0], &s->td.dtmf.row_out[1], &s->td.dtmf.row_out[2], &s->td.dtmf.row_out[3],
+		&s->td.dtmf.col_out[0], &s->td.dtmf.col_out[1], &s->td.dtmf.col_out[2], &s->td.dtmf.col_out[3],
+	};
 	int i;
 	int j;
 	int sample;
@@ -699,22 +828,11 @@ static int dtmf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp
 		} else {
 			limit = samples;
 		}
-		/* The following unrolled loop takes only 35% (rough estimate) of the
-		   time of a rolled loop on the machine on which it was developed */
 		for (j = sample; j < limit; j++) {
 			samp = amp[j];
 			s->td.dtmf.energy += (int32_t) samp * (int32_t) samp;
-			/* With GCC 2.95, the following unrolled code seems to take about 35%
-			   (rough estimate) as long as a neat little 0-3 loop */
-			goertzel_sample(s->td.dtmf.row_out, samp);
-			goertzel_sample(s->td.dtmf.col_out, samp);
-			goertzel_sample(s->td.dtmf.row_out + 1, samp);
-			goertzel_sample(s->td.dtmf.col_out + 1, samp);
-			goertzel_sample(s->td.dtmf.row_out + 2, samp);
-			goertzel_sample(s->td.dtmf.col_out + 2, samp);
-			goertzel_sample(s->td.dtmf.row_out + 3, samp);
-			goertzel_sample(s->td.dtmf.col_out + 3, samp);
 		}
+		goertzel_bank_samples(bank, ARRAY_LEN(bank), amp + sample, limit - sample);
 		s->td.dtmf.current_sample += (limit - sample);
 		if (s->td.dtmf.current_sample < DTMF_GSIZE) {
 			continue;
@@ -883,12 +1001,14 @@ static int mf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp[]
 		int samples, int squelch, int relax)
 {
 	float energy[6];
+	goertzel_state_t *const bank[] = {
+		&s->td.mf.tone_out[0], &s->td.mf.tone_out[1], &s->td.mf.tone_out[2],
+		&s->td.mf.tone_out[3], &s->td.mf.tone_out[4], &s->td.mf.tone_out[5],
+	};
 	int best;
 	int second_best;
 	int i;
-	int j;
 	int sample;
-	short samp;
 	int hit;
 	int limit;
 	fragment_t mute = {0, 0};
@@ -907,19 +1027,7 @@ static int mf_detect(struct ast_dsp *dsp, digit_detect_state_t *s, int16_t amp[]
 		} else {
 			limit = samples;
 		}
-		/* The following unrolled loop takes only 35% (rough estimate) of the
-		   time of a rolled loop on the machine on which it was developed */
-		for (j = sample; j < limit; j++) {
-			/* With GCC 2.95, the following unrolled code seems to take about 35%
-			   (rough estimate) as long as a neat little 0-3 loop */
-			samp = amp[j];
-			goertzel_sample(s->td.mf.tone_out, samp);
-			goertzel_sample(s->td.mf.tone_out + 1, samp);
-			goertzel_sample(s->td.mf.tone_out + 2, samp);
-			goertzel_sample(s->td.mf.tone_out + 3, samp);
-			goertzel_sample(s->td.mf.tone_out + 4, samp);
-			goertzel_sample(s->td.mf.tone_out + 5, samp);
-		}
+		goertzel_bank_samples(bank, ARRAY_LEN(bank), amp + sample, limit - sample);
 		s->td.mf.current_sample += (limit - sample);
 		if (s->td.mf.current_sample < MF_GSIZE) {
 			continue;
@@ -1208,20 +1316,23 @@ int ast_dsp_call_progress(struct ast_dsp *dsp, struct ast_frame *inf)
 	return __ast_dsp_call_progress(dsp, inf->data.ptr, inf->datalen / 2);
 }
 
-static int __ast_dsp_silence_noise(struct ast_dsp *dsp, short *s, int len, int *totalsilence, int *totalnoise, int *frames_energy)
+/*! \brief Average absolute sample value of a block of audio */
+static int dsp_energy(short *s, int len)
 {
-	int accum;
+	int accum = 0;
 	int x;
-	int res = 0;
 
-	if (!len) {
-		return 0;
-	}
-	accum = 0;
 	for (x = 0; x < len; x++) {
 		accum += abs(s[x]);
 	}
-	accum /= len;
+	return accum / len;
+}
+
+/*! \brief Update the silence and noise state given the energy of a block of audio */
+static int dsp_silence_noise_update(struct ast_dsp *dsp, int accum, int len, int *totalsilence, int *totalnoise, int *frames_energy)
+{
+	int res = 0;
+
 	if (accum < dsp->threshold) {
 		/* Silent */
 		dsp->totalsilence += len / (dsp->sample_rate / 1000);
@@ -1274,6 +1385,14 @@ static int __ast_dsp_silence_noise(struct ast_dsp *dsp, short *s, int len, int *
 	return res;
 }
 
+static int __ast_dsp_silence_noise(struct ast_dsp *dsp, short *s, int len, int *totalsilence, int *totalnoise, int *frames_energy)
+{
+	if (!len) {
+		return 0;
+	}
+	return dsp_silence_noise_update(dsp, dsp_energy(s, len), len, totalsilence, totalnoise, frames_energy);
+}
+
 int ast_dsp_busydetect(struct ast_dsp *dsp)
 {
 	int res = 0, x;
@@ -1416,6 +1535,7 @@ static int ast_dsp_silence_noise_with_energy(struct ast_dsp *dsp, struct ast_fra
 	short *s;
 	int len;
 	int x;
+	int accum;
 	unsigned char *odata;
 
 	if (!f) {
@@ -1428,31 +1548,43 @@ static int ast_dsp_silence_noise_with_energy(struct ast_dsp *dsp, struct ast_fra
 	}
 
 	if (ast_format_cache_is_slinear(f->subclass.format)) {
-		s = f->data.ptr;
 		len = f->datalen/2;
-	} else {
-		odata = f->data.ptr;
+	} else if (ast_format_cmp(f->subclass.format, ast_format_ulaw) == AST_FORMAT_CMP_EQUAL
+		|| ast_format_cmp(f->subclass.format, ast_format_alaw) == AST_FORMAT_CMP_EQUAL) {
 		len = f->datalen;
-		if (ast_format_cmp(f->subclass.format, ast_format_ulaw)) {
-			s = ast_alloca(len * 2);
-			for (x = 0; x < len; x++) {
-				s[x] = AST_MULAW(odata[x]);
-			}
-		} else if (ast_format_cmp(f->subclass.format, ast_format_alaw)) {
+	} else {
+		ast_log(LOG_WARNING, "Can only calculate silence on signed-linear, alaw or ulaw frames :(\n");
+		return 0;
+	}
+	if (!len) {
+		return 0;
+	}
+
+	/* Frames sharing a payload are measured once for every consumer */
+	if (ast_frame_get_energy(f, &accum)) {
+		if (ast_format_cache_is_slinear(f->subclass.format)) {
+			s = f->data.ptr;
+		} else {
+			odata = f->data.ptr;
 			s = ast_alloca(len * 2);
-			for (x = 0; x < len; x++) {
-				s[x] = AST_ALAW(odata[x]);
+			if (ast_format_cmp(f->subclass.format, ast_format_ulaw) == AST_FORMAT_CMP_EQUAL) {
+				for (x = 0; x < len; x++) {
+					s[x] = AST_MULAW(odata[x]);
+				}
+			} else {
+				for (x = 0; x < len; x++) {
+					s[x] = AST_ALAW(odata[x]);
+				}
 			}
-		} else {
-			ast_log(LOG_WARNING, "Can only calculate silence on signed-linear, alaw or ulaw frames :(\n");
-			return 0;
 		}
+		accum = dsp_energy(s, len);
+		ast_frame_set_energy(f, accum);
 	}
 
 	if (noise) {
-		return __ast_dsp_silence_noise(dsp, s, len, NULL, total, frames_energy);
+		return dsp_silence_noise_update(dsp, accum, len, NULL, total, frames_energy);
 	} else {
-		return __ast_dsp_silence_noise(dsp, s, len, total, NULL, frames_energy);
+		return dsp_silence_noise_update(dsp, accum, len, total, NULL, frames_energy);
 	}
 }
 
@@ -1489,6 +1621,10 @@ struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp,
 	if (af->frametype != AST_FRAME_VOICE) {
 		return af;
 	}
+	/* Muting and squelching below change the audio in place */
+	if (ast_frame_unshare(af)) {
+		return af;
+	}
 
 	odata = af->data.ptr;
 	len = af->datalen;
@@ -1498,14 +1634,10 @@ struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp,
 		len = af->datalen / 2;
 	} else if (ast_format_cmp(af->subclass.format, ast_format_ulaw) == AST_FORMAT_CMP_EQUAL) {
 		shortdata = ast_alloca(af->datalen * 2);
-		for (x = 0; x < len; x++) {
-			shortdata[x] = AST_MULAW(odata[x]);
-		}
+		ast_mulaw_buf(shortdata, odata, len);
 	} else if (ast_format_cmp(af->subclass.format, ast_format_alaw) == AST_FORMAT_CMP_EQUAL) {
 		shortdata = ast_alloca(af->datalen * 2);
-		for (x = 0; x < len; x++) {
-			shortdata[x] = AST_ALAW(odata[x]);
-		}
+		ast_alaw_buf(shortdata, odata, len);
 	} else {
 		/*Display warning only once. Otherwise you would get hundreds of warnings every second */
 		if (dsp->display_inband_dtmf_warning) {
@@ -1642,13 +1774,9 @@ done:
 	}
 
 	if (ast_format_cmp(af->subclass.format, ast_format_ulaw) == AST_FORMAT_CMP_EQUAL) {
-		for (x = 0; x < len; x++) {
-			odata[x] = AST_LIN2MU((unsigned short) shortdata[x]);
-		}
+		ast_lin2mu_buf(odata, shortdata, len);
 	} else if (ast_format_cmp(af->subclass.format, ast_format_alaw) == AST_FORMAT_CMP_EQUAL) {
-		for (x = 0; x < len; x++) {
-			odata[x] = AST_LIN2A((unsigned short) shortdata[x]);
-		}
+		ast_lin2a_buf(odata, shortdata, len);
 	}
 
 	if (outf) {
@@ -2345,6 +2473,18 @@ AST_TEST_DEFINE(test_dsp_fax_detect)
 #ifdef TEST_FRAMEWORK
 AST_TEST_DEFINE(test_dsp_dtmf_detect)
 {
+	static const struct {
+		const char *name;
+		int (*supported)(void);
+		void (*samples)(goertzel_state_t *const *bank, int n, const int16_t *amp, int samples);
+	} backends[] = {
+		{ "scalar", NULL, goertzel_bank_samples_scalar },
+#ifdef GOERTZEL_HAVE_AVX2
+		{ "avx2", goertzel_avx2_supported, goertzel_bank_samples_avx2 },
+#endif
+	};
+	void (*original)(goertzel_state_t *const *bank, int n, const int16_t *amp, int samples) = goertzel_bank_samples;
+	int backend;
 	int idx;
 	struct ast_dsp *dsp;
 	enum ast_test_result_state result;
@@ -2368,17 +2508,29 @@ AST_TEST_DEFINE(test_dsp_dtmf_detect)
 
 	result = AST_TEST_PASS;
 
-	for (idx = 0; dtmf_positions[idx]; ++idx) {
-		if (test_dtmf_amplitude_sweep(test, dsp, idx)) {
-			result = AST_TEST_FAIL;
+	/* Every goertzel bank implementation must detect exactly the same */
+	for (backend = 0; backend < ARRAY_LEN(backends); ++backend) {
+		if (backends[backend].supported && !backends[backend].supported()) {
+			ast_test_status_update(test, "Goertzel bank '%s' is not available\n",
+				backends[backend].name);
+			continue;
 		}
-	}
+		ast_test_status_update(test, "Testing goertzel bank '%s'\n", backends[backend].name);
+		goertzel_bank_samples = backends[backend].samples;
 
-	for (idx = 0; dtmf_positions[idx]; ++idx) {
-		if (test_dtmf_twist_sweep(test, dsp, idx)) {
-			result = AST_TEST_FAIL;
+		for (idx = 0; dtmf_positions[idx]; ++idx) {
+			if (test_dtmf_amplitude_sweep(test, dsp, idx)) {
+				result = AST_TEST_FAIL;
+			}
+		}
+
+		for (idx = 0; dtmf_positions[idx]; ++idx) {
+			if (test_dtmf_twist_sweep(test, dsp, idx)) {
+				result = AST_TEST_FAIL;
+			}
 		}
 	}
+	goertzel_bank_samples = original;
 
 	ast_dsp_free(dsp);
 	return result;
@@ -2397,6 +2549,12 @@ int ast_dsp_init(void)
 {
 	int res = _dsp_init(0);
 
+#ifdef GOERTZEL_HAVE_AVX2
+	if (goertzel_avx2_supported()) {
+		goertzel_bank_samples = goertzel_bank_samples_avx2;
+	}
+#endif
+
 #ifdef TEST_FRAMEWORK
 	if (!res) {
 		AST_TEST_REGISTER(test_dsp_fax_detect);
@@ -38,6 +38,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/stasis_endpoints.h"
 #include "asterisk/stasis_message_router.h"
 #include "asterisk/stringfields.h"
+#include "asterisk/sched.h"
 #include "asterisk/_private.h"
 
 /*! Buckets for endpoint->channel mappings. Keep it prime! */
@@ -49,8 +50,20 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 /*! Buckets for technology endpoints. */
 #define TECH_ENDPOINT_BUCKETS 11
 
+/*!
+ * \brief Least time between snapshots published for channels added or removed
+ *
+ * A channel added to or removed from an endpoint sooner than this after
+ * its last snapshot waits for a snapshot published once the time is up,
+ * so a busy endpoint publishes one snapshot for many channel changes.
+ */
+#define ENDPOINT_CHANNEL_PUBLISH_MS 100
+
 static struct ao2_container *endpoints;
 
+/*! Scheduler of the delayed endpoint snapshots */
+static struct ast_sched_context *endpoint_sched;
+
 static struct ao2_container *tech_endpoints;
 
 struct ast_endpoint {
@@ -76,6 +89,12 @@ struct ast_endpoint {
 	struct ao2_container *channel_ids;
 	/*! Forwarding subscription from an endpoint to its tech endpoint */
 	struct stasis_forward *tech_forward;
+	/*! When the latest snapshot of this endpoint was published */
+	struct timeval published;
+	/*! Set while a snapshot for channel changes is scheduled */
+	unsigned int publish_scheduled:1;
+	/*! Set once the endpoint is shut down, and no snapshot may follow */
+	unsigned int shut_down:1;
 };
 
 static int endpoint_hash(const void *obj, int flags)
@@ -186,9 +205,71 @@ static void endpoint_publish_snapshot(struct ast_endpoint *endpoint)
 	if (!message) {
 		return;
 	}
+
+	ao2_lock(endpoint);
+	endpoint->published = ast_tvnow();
+	ao2_unlock(endpoint);
+
 	stasis_publish(ast_endpoint_topic(endpoint), message);
 }
 
+/*! \brief Scheduler callback publishing the snapshot of channel changes */
+static int endpoint_publish_scheduled(const void *data)
+{
+	struct ast_endpoint *endpoint = (struct ast_endpoint *) data;
+	int publish;
+
+	ao2_lock(endpoint);
+	endpoint->publish_scheduled = 0;
+	publish = !endpoint->shut_down;
+	ao2_unlock(endpoint);
+
+	if (publish) {
+		endpoint_publish_snapshot(endpoint);
+	}
+	ao2_ref(endpoint, -1);
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Publish a snapshot for a channel added to or removed from an endpoint
+ *
+ * \note Published at once unless the endpoint published its latest snapshot
+ * less than ENDPOINT_CHANNEL_PUBLISH_MS ago.  Otherwise a snapshot is
+ * scheduled for then, if none is yet, and covers every change until it is
+ * published.
+ */
+static void endpoint_channels_changed(struct ast_endpoint *endpoint)
+{
+	int64_t elapsed;
+
+	ao2_lock(endpoint);
+	if (endpoint->publish_scheduled) {
+		ao2_unlock(endpoint);
+		return;
+	}
+
+	elapsed = ast_tvdiff_ms(ast_tvnow(), endpoint->published);
+	if (elapsed >= ENDPOINT_CHANNEL_PUBLISH_MS || elapsed < 0 || !endpoint_sched) {
+		ao2_unlock(endpoint);
+		endpoint_publish_snapshot(endpoint);
+		return;
+	}
+
+	ao2_ref(endpoint, +1);
+	if (ast_sched_add(endpoint_sched, ENDPOINT_CHANNEL_PUBLISH_MS - elapsed,
+		endpoint_publish_scheduled, endpoint) < 0) {
+		ao2_ref(endpoint, -1);
+		ao2_unlock(endpoint);
+		endpoint_publish_snapshot(endpoint);
+		return;
+	}
+	endpoint->publish_scheduled = 1;
+	ao2_unlock(endpoint);
+}
+
 static void endpoint_dtor(void *obj)
 {
 	struct ast_endpoint *endpoint = obj;
@@ -221,7 +302,7 @@ int ast_endpoint_add_channel(struct ast_endpoint *endpoint,
 	ast_str_container_add(endpoint->channel_ids, ast_channel_uniqueid(chan));
 	ao2_unlock(endpoint);
 
-	endpoint_publish_snapshot(endpoint);
+	endpoint_channels_changed(endpoint);
 
 	return 0;
 }
@@ -246,7 +327,7 @@ static void endpoint_cache_clear(void *data,
 	ao2_lock(endpoint);
 	ast_str_container_remove(endpoint->channel_ids, clear_snapshot->uniqueid);
 	ao2_unlock(endpoint);
-	endpoint_publish_snapshot(endpoint);
+	endpoint_channels_changed(endpoint);
 }
 
 static void endpoint_default(void *data,
@@ -385,6 +466,11 @@ void ast_endpoint_shutdown(struct ast_endpoint *endpoint)
 	ao2_unlink(endpoints, endpoint);
 	endpoint->tech_forward = stasis_forward_cancel(endpoint->tech_forward);
 
+	/* A scheduled snapshot must not put the endpoint back in the cache */
+	ao2_lock(endpoint);
+	endpoint->shut_down = 1;
+	ao2_unlock(endpoint);
+
 	clear_msg = create_endpoint_snapshot_message(endpoint);
 	if (clear_msg) {
 		RAII_VAR(struct stasis_message *, message, NULL, ao2_cleanup);
@@ -513,6 +599,11 @@ struct ast_endpoint_snapshot *ast_endpoint_snapshot_create(
 
 static void endpoint_cleanup(void)
 {
+	if (endpoint_sched) {
+		ast_sched_context_destroy(endpoint_sched);
+		endpoint_sched = NULL;
+	}
+
 	ao2_cleanup(endpoints);
 	endpoints = NULL;
 
@@ -536,5 +627,13 @@ int ast_endpoint_init(void)
 		return -1;
 	}
 
+	endpoint_sched = ast_sched_context_create();
+	if (!endpoint_sched) {
+		return -1;
+	}
+	if (ast_sched_start_thread(endpoint_sched)) {
+		return -1;
+	}
+
 	return 0;
 }
@@ -32,6 +32,7 @@
 ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #include <dirent.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <math.h>
@@ -46,6 +47,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/utils.h"
 #include "asterisk/lock.h"
 #include "asterisk/app.h"
+#include "asterisk/options.h"
 #include "asterisk/pbx.h"
 #include "asterisk/linkedlists.h"
 #include "asterisk/module.h"
@@ -54,6 +56,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/stasis.h"
 #include "asterisk/json.h"
 #include "asterisk/stasis_system.h"
+#include "asterisk/taskprocessor.h"
+#include "asterisk/threadpool.h"
+#include "asterisk/media_cache.h"
 
 /*! \brief
  * The following variable controls the layout of localized sound files.
@@ -489,6 +494,494 @@ static int open_wrapper(struct ast_filestream *s)
 	return fn_wrapper(s, NULL, WRAP_OPEN);
 }
 
+#if defined(HAVE_FOPENCOOKIE)
+/*! \brief Number of buckets of the sound file cache */
+#define SOUND_FILE_CACHE_BUCKETS 127
+
+/*! \brief Seconds a mapping may go unused before it is dropped from the cache */
+#define SOUND_FILE_CACHE_IDLE 300
+
+/*! \brief A sound file mapped into memory, shared by the streams playing it */
+struct sound_file_map {
+	/*! Start of the mapping */
+	void *addr;
+	/*! Size of the file when it was mapped */
+	off_t size;
+	/*! Identity of the file when it was mapped, to notice it being replaced */
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	/*! When a stream last opened the file */
+	time_t last_used;
+	/*! Path of the file */
+	char path[0];
+};
+
+/*! \brief Position of a stream within a mapped sound file */
+struct sound_file_cookie {
+	struct sound_file_map *map;
+	off_t pos;
+};
+
+/*! \brief Mapped sound files, by path */
+static struct ao2_container *sound_file_cache;
+
+/*! \brief When the cache was last pruned of idle mappings */
+static time_t sound_file_cache_pruned;
+
+AO2_STRING_FIELD_HASH_FN(sound_file_map, path)
+AO2_STRING_FIELD_CMP_FN(sound_file_map, path)
+
+static void sound_file_map_destructor(void *obj)
+{
+	struct sound_file_map *map = obj;
+
+	if (map->addr) {
+		munmap(map->addr, map->size);
+	}
+}
+
+static struct sound_file_map *sound_file_map_create(const char *fn)
+{
+	struct sound_file_map *map;
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		ast_debug(1, "Unable to map sound file %s: %s\n", fn, strerror(errno));
+		return NULL;
+	}
+
+	map = ao2_alloc_options(sizeof(*map) + strlen(fn) + 1, sound_file_map_destructor,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!map) {
+		munmap(addr, st.st_size);
+		return NULL;
+	}
+	map->addr = addr;
+	map->size = st.st_size;
+	map->dev = st.st_dev;
+	map->ino = st.st_ino;
+	map->mtime = st.st_mtime;
+	strcpy(map->path, fn); /* Safe */
+
+	return map;
+}
+
+static int sound_file_map_idle_cb(void *obj, void *arg, int flags)
+{
+	struct sound_file_map *map = obj;
+	time_t *now = arg;
+
+	return *now - map->last_used > SOUND_FILE_CACHE_IDLE ? CMP_MATCH : 0;
+}
+
+/*!
+ * \internal
+ * \brief Get the mapping of a sound file, mapping it if it is not yet.
+ *
+ * \param fn Path of the file
+ * \param st What stat() returned for the file just now
+ *
+ * A mapping is replaced when the file no longer matches it. Streams that
+ * still play the old mapping keep it until they are closed.
+ *
+ * \return The mapping (must be ao2_ref()'d), NULL if the file cannot be mapped
+ */
+static struct sound_file_map *sound_file_map_get(const char *fn, const struct stat *st)
+{
+	struct sound_file_map *map;
+	time_t now = time(NULL);
+
+	ao2_lock(sound_file_cache);
+	if (now - sound_file_cache_pruned > SOUND_FILE_CACHE_IDLE) {
+		/* Streams still reading a dropped mapping hold their own reference */
+		ao2_callback(sound_file_cache, OBJ_NOLOCK | OBJ_MULTIPLE | OBJ_UNLINK | OBJ_NODATA,
+			sound_file_map_idle_cb, &now);
+		sound_file_cache_pruned = now;
+	}
+
+	map = ao2_find(sound_file_cache, fn, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (map && (map->size != st->st_size || map->mtime != st->st_mtime
+		|| map->ino != st->st_ino || map->dev != st->st_dev)) {
+		ao2_unlink_flags(sound_file_cache, map, OBJ_NOLOCK);
+		ao2_ref(map, -1);
+		map = NULL;
+	}
+	if (!map) {
+		map = sound_file_map_create(fn);
+		if (map) {
+			ao2_link_flags(sound_file_cache, map, OBJ_NOLOCK);
+		}
+	}
+	if (map) {
+		map->last_used = now;
+	}
+	ao2_unlock(sound_file_cache);
+
+	return map;
+}
+
+static ssize_t sound_file_read(void *cookie, char *buf, size_t size)
+{
+	struct sound_file_cookie *stream = cookie;
+	off_t left = stream->map->size - stream->pos;
+
+	if (left <= 0) {
+		return 0;
+	}
+	if (size > left) {
+		size = left;
+	}
+	memcpy(buf, (char *) stream->map->addr + stream->pos, size);
+	stream->pos += size;
+
+	return size;
+}
+
+static int sound_file_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct sound_file_cookie *stream = cookie;
+	off64_t pos;
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = *offset;
+		break;
+	case SEEK_CUR:
+		pos = stream->pos + *offset;
+		break;
+	case SEEK_END:
+		pos = stream->map->size + *offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if (pos < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	stream->pos = pos;
+	*offset = pos;
+	return 0;
+}
+
+static int sound_file_close(void *cookie)
+{
+	struct sound_file_cookie *stream = cookie;
+
+	ao2_ref(stream->map, -1);
+	ast_free(stream);
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Open a sound file for reading from its shared mapping.
+ *
+ * \return A stream reading the mapping, NULL if the file cannot be mapped
+ */
+static FILE *sound_file_fopen(const char *fn, const struct stat *st)
+{
+	static const cookie_io_functions_t cookie_funcs = {
+		sound_file_read,
+		NULL,
+		sound_file_seek,
+		sound_file_close
+	};
+	struct sound_file_cookie *stream;
+	FILE *bfile;
+
+	if (!sound_file_cache) {
+		return NULL;
+	}
+
+	stream = ast_calloc(1, sizeof(*stream));
+	if (!stream) {
+		return NULL;
+	}
+	stream->map = sound_file_map_get(fn, st);
+	if (!stream->map) {
+		ast_free(stream);
+		return NULL;
+	}
+
+	bfile = fopencookie(stream, "r", cookie_funcs);
+	if (!bfile) {
+		sound_file_close(stream);
+		return NULL;
+	}
+
+	/* Reads copy straight out of the mapping; a buffer would only add a copy */
+	setvbuf(bfile, NULL, _IONBF, 0);
+
+	return bfile;
+}
+
+/*! \brief Most bytes queued for one file before writing to it waits */
+#define FILE_WRITER_MAX_QUEUED (1024 * 1024)
+
+/*! \brief Most threads writing files at once */
+#define FILE_WRITER_MAX_THREADS 16
+
+/*! \brief Seconds a writer thread may be idle before it exits */
+#define FILE_WRITER_IDLE_TIMEOUT 60
+
+/*! \brief Threads writing the files opened with ast_writefile_async() */
+static struct ast_threadpool *file_writer_pool;
+
+/*! \brief A file written by the writer threads */
+struct file_writer {
+	/*! Signalled when queued data has been written */
+	ast_cond_t cond;
+	/*! Descriptor of the file */
+	int fd;
+	/*! Position of the stream, as seen by its user */
+	off_t pos;
+	/*! Size of the file once everything queued is written */
+	off_t size;
+	/*! Bytes queued and not yet written */
+	size_t queued;
+	/*! errno of the first failed write; later writes fail straight away */
+	int error;
+	/*! AST_WRITEFILE_* flags */
+	unsigned int flags;
+	/*! Serializer writing the data in the order it was queued */
+	struct ast_taskprocessor *serializer;
+};
+
+/*! \brief Data queued to be written to a file */
+struct file_writer_chunk {
+	struct file_writer *writer;
+	off_t offset;
+	size_t len;
+	char data[0];
+};
+
+static void file_writer_destructor(void *obj)
+{
+	struct file_writer *writer = obj;
+
+	ast_taskprocessor_unreference(writer->serializer);
+	ast_cond_destroy(&writer->cond);
+}
+
+static int file_writer_task(void *data)
+{
+	struct file_writer_chunk *chunk = data;
+	struct file_writer *writer = chunk->writer;
+	size_t done = 0;
+	int error = 0;
+
+	while (done < chunk->len) {
+		ssize_t res = pwrite(writer->fd, chunk->data + done, chunk->len - done, chunk->offset + done);
+
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error = errno;
+			break;
+		}
+		done += res;
+	}
+
+	ao2_lock(writer);
+	if (error && !writer->error) {
+		ast_log(LOG_WARNING, "Unable to write to file descriptor %d: %s\n", writer->fd, strerror(error));
+		writer->error = error;
+	}
+	writer->queued -= chunk->len;
+	ast_cond_broadcast(&writer->cond);
+	ao2_unlock(writer);
+
+	ao2_ref(writer, -1);
+	ast_free(chunk);
+	return 0;
+}
+
+static ssize_t file_writer_write(void *cookie, const char *buf, size_t size)
+{
+	struct file_writer *writer = cookie;
+	struct file_writer_chunk *chunk;
+
+	/* Only wait when the storage falls far behind */
+	ao2_lock(writer);
+	while (!writer->error && writer->queued && writer->queued + size > FILE_WRITER_MAX_QUEUED) {
+		ast_cond_wait(&writer->cond, ao2_object_get_lockaddr(writer));
+	}
+	if (writer->error) {
+		errno = writer->error;
+		ao2_unlock(writer);
+		return -1;
+	}
+	writer->queued += size;
+	ao2_unlock(writer);
+
+	chunk = ast_malloc(sizeof(*chunk) + size);
+	if (!chunk) {
+		ao2_lock(writer);
+		writer->queued -= size;
+		ao2_unlock(writer);
+		errno = ENOMEM;
+		return -1;
+	}
+	chunk->writer = ao2_bump(writer);
+	chunk->offset = writer->pos;
+	chunk->len = size;
+	memcpy(chunk->data, buf, size);
+
+	if (ast_taskprocessor_push(writer->serializer, file_writer_task, chunk)) {
+		/* Write it ourselves rather than lose it */
+		file_writer_task(chunk);
+	}
+
+	writer->pos += size;
+	writer->size = MAX(writer->size, writer->pos);
+	return size;
+}
+
+static int file_writer_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct file_writer *writer = cookie;
+	off64_t pos;
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = *offset;
+		break;
+	case SEEK_CUR:
+		pos = writer->pos + *offset;
+		break;
+	case SEEK_END:
+		pos = writer->size + *offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if (pos < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	writer->pos = pos;
+	*offset = pos;
+	return 0;
+}
+
+static int file_writer_close(void *cookie)
+{
+	struct file_writer *writer = cookie;
+	int res = 0;
+
+	/* The file is complete once closed, as with a synchronous stream */
+	ao2_lock(writer);
+	while (writer->queued) {
+		ast_cond_wait(&writer->cond, ao2_object_get_lockaddr(writer));
+	}
+	if (writer->error) {
+		errno = writer->error;
+		res = -1;
+	}
+	ao2_unlock(writer);
+
+	if ((writer->flags & AST_WRITEFILE_SYNC) && fsync(writer->fd) && !res) {
+		ast_log(LOG_WARNING, "Unable to sync file descriptor %d: %s\n", writer->fd, strerror(errno));
+		res = -1;
+	}
+	if (close(writer->fd) && !res) {
+		res = -1;
+	}
+
+	ao2_ref(writer, -1);
+	return res;
+}
+
+/*!
+ * \internal
+ * \brief Open a stream whose writes are made by the writer threads.
+ *
+ * \return The stream, NULL if writes cannot be made asynchronously
+ */
+static FILE *file_writer_fdopen(int fd, unsigned int flags)
+{
+	static const cookie_io_functions_t cookie_funcs = {
+		NULL,
+		file_writer_write,
+		file_writer_seek,
+		file_writer_close
+	};
+	char tps_name[AST_TASKPROCESSOR_MAX_NAME + 1];
+	struct file_writer *writer;
+	struct stat st;
+	FILE *bfile;
+
+	if (!file_writer_pool || fstat(fd, &st)) {
+		return NULL;
+	}
+
+	writer = ao2_alloc(sizeof(*writer), file_writer_destructor);
+	if (!writer) {
+		return NULL;
+	}
+	ast_cond_init(&writer->cond, NULL);
+	writer->fd = fd;
+	writer->flags = flags;
+	writer->size = st.st_size;
+
+	ast_taskprocessor_build_name(tps_name, sizeof(tps_name), "filewriter");
+	writer->serializer = ast_threadpool_serializer(tps_name, file_writer_pool);
+	if (!writer->serializer) {
+		ao2_ref(writer, -1);
+		return NULL;
+	}
+
+	bfile = fopencookie(writer, "w", cookie_funcs);
+	if (!bfile) {
+		ao2_ref(writer, -1);
+	}
+	return bfile;
+}
+#endif /* defined(HAVE_FOPENCOOKIE) */
+
+/*!
+ * \internal
+ * \brief Open a sound file for playback.
+ *
+ * \param fn Path of the file
+ * \param st What stat() returned for the file
+ * \param shared Non-zero if the file may be played from the sound file cache
+ */
+static FILE *sound_file_open(const char *fn, const struct stat *st, int shared)
+{
+#if defined(HAVE_FOPENCOOKIE)
+	if (shared && ast_option_sound_file_cache && st->st_size) {
+		FILE *bfile = sound_file_fopen(fn, st);
+
+		if (bfile) {
+			return bfile;
+		}
+	}
+#endif
+
+	return fopen(fn, "r");
+}
+
 enum file_action {
 	ACTION_EXISTS = 1, /* return matching format if file exists, 0 otherwise */
 	ACTION_DELETE,	/* delete file, return 0 on success, -1 on error */
@@ -551,7 +1044,8 @@ static int filehelper(const char *filename, const void *arg2, const char *fmt, c
 					ast_free(fn);
 					continue;	/* not a supported format */
 				}
-				if ( (bfile = fopen(fn, "r")) == NULL) {
+				/* Only files from the sounds directory are shared */
+				if ( (bfile = sound_file_open(fn, &st, filename[0] != '/')) == NULL) {
 					ast_free(fn);
 					continue;	/* cannot open file */
 				}
@@ -737,6 +1231,34 @@ static int fileexists_core(const char *filename, const char *fmt, const char *pr
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Get the local copy of media referenced by URI from the media cache
+ *
+ * \param filename File name, or URI such as http://example.com/prompt.wav
+ * \param buf Buffer of at least PATH_MAX for the path of the local copy
+ *
+ * \return The path of the local copy without extension, or filename if it is no URI
+ */
+static const char *media_cache_resolve(const char *filename, char *buf)
+{
+	char *ext;
+
+	if (!strstr(filename, "://")) {
+		return filename;
+	}
+
+	if (ast_media_cache_retrieve(filename, buf, PATH_MAX)) {
+		return filename;
+	}
+
+	if ((ext = strrchr(buf, '.')) && !strchr(ext, '/')) {
+		*ext = '\0';
+	}
+
+	return buf;
+}
+
 struct ast_filestream *ast_openstream(struct ast_channel *chan, const char *filename, const char *preflang)
 {
 	return ast_openstream_full(chan, filename, preflang, 0);
@@ -760,6 +1282,7 @@ struct ast_filestream *ast_openstream_full(struct ast_channel *chan, const char
 		if (ast_channel_generator(chan))
 			ast_deactivate_generator(chan);
 	}
+	filename = media_cache_resolve(filename, ast_alloca(PATH_MAX));
 	if (preflang == NULL)
 		preflang = "";
 	buflen = strlen(preflang) + strlen(filename) + 4;
@@ -1073,6 +1596,7 @@ int ast_fileexists(const char *filename, const char *fmt, const char *preflang)
 	char *buf;
 	int buflen;
 
+	filename = media_cache_resolve(filename, ast_alloca(PATH_MAX));
 	if (preflang == NULL)
 		preflang = "";
 	buflen = strlen(preflang) + strlen(filename) + 4;	/* room for everything */
@@ -1343,7 +1867,28 @@ struct ast_filestream *ast_readfile(const char *filename, const char *type, cons
 	return fs;
 }
 
-struct ast_filestream *ast_writefile(const char *filename, const char *type, const char *comment, int flags, int check, mode_t mode)
+/*!
+ * \internal
+ * \brief fdopen() a file to record to, with its writes made by the writer
+ * threads if asked to and possible.
+ */
+static FILE *writefile_fdopen(int fd, const char *mode, int async, unsigned int async_flags)
+{
+#if defined(HAVE_FOPENCOOKIE)
+	if (async && !strcmp(mode, "w")) {
+		FILE *bfile = file_writer_fdopen(fd, async_flags);
+
+		if (bfile) {
+			return bfile;
+		}
+	}
+#endif
+
+	return fdopen(fd, mode);
+}
+
+static struct ast_filestream *writefile(const char *filename, const char *type, const char *comment,
+	int flags, int check, mode_t mode, int async, unsigned int async_flags)
 {
 	int fd, myflags = 0;
 	/* compiler claims this variable can be used before initialization... */
@@ -1386,7 +1931,7 @@ struct ast_filestream *ast_writefile(const char *filename, const char *type, con
 		fd = open(fn, flags | myflags, mode);
 		if (fd > -1) {
 			/* fdopen() the resulting file stream */
-			bfile = fdopen(fd, ((flags | myflags) & O_RDWR) ? "w+" : "w");
+			bfile = writefile_fdopen(fd, ((flags | myflags) & O_RDWR) ? "w+" : "w", async, async_flags);
 			if (!bfile) {
 				ast_log(LOG_WARNING, "Whoa, fdopen failed: %s!\n", strerror(errno));
 				close(fd);
@@ -1417,7 +1962,7 @@ struct ast_filestream *ast_writefile(const char *filename, const char *type, con
 			fd = open(fn, flags | myflags, mode);
 			if (fd > -1) {
 				/* fdopen() the resulting file stream */
-				bfile = fdopen(fd, ((flags | myflags) & O_RDWR) ? "w+" : "w");
+				bfile = writefile_fdopen(fd, ((flags | myflags) & O_RDWR) ? "w+" : "w", async, async_flags);
 				if (!bfile) {
 					ast_log(LOG_WARNING, "Whoa, fdopen failed: %s!\n", strerror(errno));
 					close(fd);
@@ -1481,6 +2026,16 @@ struct ast_filestream *ast_writefile(const char *filename, const char *type, con
 	return fs;
 }
 
+struct ast_filestream *ast_writefile(const char *filename, const char *type, const char *comment, int flags, int check, mode_t mode)
+{
+	return writefile(filename, type, comment, flags, check, mode, 0, 0);
+}
+
+struct ast_filestream *ast_writefile_async(const char *filename, const char *type, const char *comment, int flags, mode_t mode, unsigned int async_flags)
+{
+	return writefile(filename, type, comment, flags, 0, mode, 1, async_flags);
+}
+
 static void waitstream_control(struct ast_channel *c,
 		enum ast_waitstream_fr_cb_values type,
 		ast_waitstream_fr_cb cb,
@@ -1931,12 +2486,34 @@ static void file_shutdown(void)
 	ast_cli_unregister_multiple(cli_file, ARRAY_LEN(cli_file));
 	STASIS_MESSAGE_TYPE_CLEANUP(ast_format_register_type);
 	STASIS_MESSAGE_TYPE_CLEANUP(ast_format_unregister_type);
+#if defined(HAVE_FOPENCOOKIE)
+	ao2_cleanup(sound_file_cache);
+	sound_file_cache = NULL;
+	ast_threadpool_shutdown(file_writer_pool);
+	file_writer_pool = NULL;
+#endif
 }
 
 int ast_file_init(void)
 {
+#if defined(HAVE_FOPENCOOKIE)
+	struct ast_threadpool_options options = {
+		.version = AST_THREADPOOL_OPTIONS_VERSION,
+		.idle_timeout = FILE_WRITER_IDLE_TIMEOUT,
+		.auto_increment = 1,
+		.initial_size = 0,
+		.max_size = FILE_WRITER_MAX_THREADS,
+	};
+#endif
+
 	STASIS_MESSAGE_TYPE_INIT(ast_format_register_type);
 	STASIS_MESSAGE_TYPE_INIT(ast_format_unregister_type);
+#if defined(HAVE_FOPENCOOKIE)
+	sound_file_cache = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0,
+		SOUND_FILE_CACHE_BUCKETS, sound_file_map_hash_fn, NULL, sound_file_map_cmp_fn);
+	/* Without it, files are written synchronously */
+	file_writer_pool = ast_threadpool_create("filewriter", NULL, &options);
+#endif
 	ast_cli_register_multiple(cli_file, ARRAY_LEN(cli_file));
 	ast_register_cleanup(file_shutdown);
 	return 0;
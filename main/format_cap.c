@@ -189,21 +189,29 @@ static inline int format_cap_framed_init(struct format_cap_framed *framed, struc
 	return 0;
 }
 
-/*! \internal \brief Determine if \c format is in \c cap */
-static int format_in_format_cap(struct ast_format_cap *cap, struct ast_format *format)
+/*!
+ * \internal
+ * \brief Find the entry of \c cap with the codec of \c format
+ *
+ * A capabilities structure holds at most one format per codec, so this is
+ * the head of the list for the codec.
+ */
+static struct format_cap_framed *format_cap_framed_by_codec(const struct ast_format_cap *cap,
+	const struct ast_format *format)
 {
-	struct format_cap_framed *framed;
-	int i;
+	unsigned int id = ast_format_get_codec_id(format);
 
-	for (i = 0; i < AST_VECTOR_SIZE(&cap->preference_order); i++) {
-		framed = AST_VECTOR_GET(&cap->preference_order, i);
-
-		if (ast_format_get_codec_id(format) == ast_format_get_codec_id(framed->format)) {
-			return 1;
-		}
+	if (id >= AST_VECTOR_SIZE(&cap->formats)) {
+		return NULL;
 	}
 
-	return 0;
+	return AST_LIST_FIRST(AST_VECTOR_GET_ADDR(&cap->formats, id));
+}
+
+/*! \internal \brief Determine if \c format is in \c cap */
+static int format_in_format_cap(struct ast_format_cap *cap, struct ast_format *format)
+{
+	return format_cap_framed_by_codec(cap, format) != NULL;
 }
 
 int __ast_format_cap_append(struct ast_format_cap *cap, struct ast_format *format, unsigned int framing)
@@ -318,21 +326,17 @@ int ast_format_cap_append_from_cap(struct ast_format_cap *dst, const struct ast_
 static int format_cap_replace(struct ast_format_cap *cap, struct ast_format *format, unsigned int framing)
 {
 	struct format_cap_framed *framed;
-	int i;
 
 	ast_assert(format != NULL);
 
-	for (i = 0; i < AST_VECTOR_SIZE(&cap->preference_order); i++) {
-		framed = AST_VECTOR_GET(&cap->preference_order, i);
-
-		if (ast_format_get_codec_id(format) == ast_format_get_codec_id(framed->format)) {
-			ao2_t_replace(framed->format, format, "replacing with new format");
-			framed->framing = framing;
-			return 0;
-		}
+	framed = format_cap_framed_by_codec(cap, format);
+	if (!framed) {
+		return -1;
 	}
 
-	return -1;
+	ao2_t_replace(framed->format, format, "replacing with new format");
+	framed->framing = framing;
+	return 0;
 }
 
 void ast_format_cap_replace_from_cap(struct ast_format_cap *dst, const struct ast_format_cap *src,
@@ -592,8 +596,16 @@ struct ast_format *ast_format_cap_get_compatible_format(const struct ast_format_
 	list = AST_VECTOR_GET_ADDR(&cap->formats, ast_format_get_codec_id(format));
 
 	AST_LIST_TRAVERSE(list, framed, entry) {
-		enum ast_format_cmp_res res = ast_format_cmp(format, framed->format);
+		enum ast_format_cmp_res res;
+
+		if (framed->format == format) {
+			/* The same format, so there are no attributes to join */
+			ao2_cleanup(result);
+			result = ao2_bump(framed->format);
+			break;
+		}
 
+		res = ast_format_cmp(format, framed->format);
 		if (res == AST_FORMAT_CMP_NOT_EQUAL) {
 			continue;
 		}
@@ -702,17 +714,13 @@ int ast_format_cap_iscompatible(const struct ast_format_cap *cap1, const struct
 static int internal_format_cap_identical(const struct ast_format_cap *cap1, const struct ast_format_cap *cap2)
 {
 	int idx;
-	struct ast_format *tmp;
 
 	for (idx = 0; idx < AST_VECTOR_SIZE(&cap1->preference_order); ++idx) {
-		tmp = ast_format_cap_get_format(cap1, idx);
+		struct format_cap_framed *framed = AST_VECTOR_GET(&cap1->preference_order, idx);
 
-		if (ast_format_cap_iscompatible_format(cap2, tmp) != AST_FORMAT_CMP_EQUAL) {
-			ao2_ref(tmp, -1);
+		if (ast_format_cap_iscompatible_format(cap2, framed->format) != AST_FORMAT_CMP_EQUAL) {
 			return 0;
 		}
-
-		ao2_ref(tmp, -1);
 	}
 
 	return 1;
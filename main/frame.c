@@ -44,6 +44,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/translate.h"
 #include "asterisk/dsp.h"
 #include "asterisk/file.h"
+#include "asterisk/slinmix.h"
 
 #if !defined(LOW_MEMORY)
 static void frame_cache_cleanup(void *data);
@@ -72,6 +73,257 @@ struct ast_frame_cache {
 };
 #endif
 
+#if !defined(LOW_MEMORY) && defined(HAVE_GCC_ATOMICS) && defined(__ATOMIC_SEQ_CST)
+/*! Frames duplicated by ast_frdup() come from per-thread frame pools */
+#define FRAME_POOL 1
+#endif
+
+#ifdef FRAME_POOL
+/*! \brief Number of frame pool size classes */
+#define FRAME_POOL_CLASSES 4
+
+/*!
+ * \brief Payload sizes of the frame pool size classes
+ *
+ * These cover 10 and 20ms of 8kHz, 16kHz and 48kHz signed linear audio.
+ */
+static const size_t frame_pool_payloads[FRAME_POOL_CLASSES] = { 160, 320, 640, 1920 };
+
+/*! \brief Space left in each pooled frame for a source string */
+#define FRAME_POOL_SRC_LEN 32
+
+/*! \brief Maximum number of free frames a pool keeps per size class */
+#define FRAME_POOL_MAX_FREE 64
+
+/*! \brief Number of bytes after the header of a frame in each size class */
+#define FRAME_POOL_LEN(class) \
+	(sizeof(struct ast_frame) + AST_FRIENDLY_OFFSET + frame_pool_payloads[class] + FRAME_POOL_SRC_LEN)
+
+struct frame_pool;
+
+/*! \brief A pooled frame, the header, offset, payload and source in one allocation */
+struct frame_pool_block {
+	/*! The pool of the thread that allocated the block */
+	struct frame_pool *owner;
+	/*! Next block on a free list */
+	struct frame_pool_block *next;
+	/*! Size class of the block */
+	unsigned int class;
+	/*! The frame, its offset, payload and source follow it */
+	struct ast_frame frame;
+};
+
+/*!
+ * \brief A per-thread pool of frames
+ *
+ * Only the owning thread touches the free lists.  Other threads hand
+ * blocks back by pushing them onto the remote list, which the owner
+ * takes over in one go when it runs out of free blocks.
+ */
+struct frame_pool {
+	/*! Free blocks of each size class */
+	struct frame_pool_block *free[FRAME_POOL_CLASSES];
+	unsigned int free_count[FRAME_POOL_CLASSES];
+	/*! Blocks freed by other threads, frame_pool_closed once the owner has exited */
+	struct frame_pool_block *remote;
+	/*! One reference for the owner thread and one for each block */
+	int refs;
+	/*! Allocations satisfied from the free lists */
+	unsigned long hits[FRAME_POOL_CLASSES];
+	/*! Allocations that had to go to the heap */
+	unsigned long misses[FRAME_POOL_CLASSES];
+	/*! Blocks returned by other threads */
+	unsigned long remote_frees;
+	AST_LIST_ENTRY(frame_pool) list;
+};
+
+/*! \brief Marks the remote list of a pool whose thread has exited */
+static struct frame_pool_block frame_pool_closed;
+
+/*! \brief All frame pools, and the counters of pools whose threads have exited */
+static AST_LIST_HEAD_STATIC(frame_pools, frame_pool);
+static struct frame_pool frame_pool_retired;
+
+static int frame_pool_init(void *data);
+static void frame_pool_cleanup(void *data);
+
+AST_THREADSTORAGE_CUSTOM(frame_pool_storage, frame_pool_init, frame_pool_cleanup);
+
+static int frame_pool_init(void *data)
+{
+	struct frame_pool *pool = data;
+
+	pool->refs = 1;
+	AST_LIST_LOCK(&frame_pools);
+	AST_LIST_INSERT_TAIL(&frame_pools, pool, list);
+	AST_LIST_UNLOCK(&frame_pools);
+	return 0;
+}
+
+static void frame_pool_unref(struct frame_pool *pool)
+{
+	if (ast_atomic_dec_and_test(&pool->refs)) {
+		ast_free(pool);
+	}
+}
+
+static void frame_pool_block_free(struct frame_pool_block *block)
+{
+	struct frame_pool *pool = block->owner;
+
+	ast_free(block);
+	frame_pool_unref(pool);
+}
+
+static void frame_pool_cleanup(void *data)
+{
+	struct frame_pool *pool = data;
+	struct frame_pool_block *block;
+	int class;
+
+	AST_LIST_LOCK(&frame_pools);
+	AST_LIST_REMOVE(&frame_pools, pool, list);
+	for (class = 0; class < FRAME_POOL_CLASSES; ++class) {
+		frame_pool_retired.hits[class] += pool->hits[class];
+		frame_pool_retired.misses[class] += pool->misses[class];
+	}
+	frame_pool_retired.remote_frees += pool->remote_frees;
+	AST_LIST_UNLOCK(&frame_pools);
+
+	for (class = 0; class < FRAME_POOL_CLASSES; ++class) {
+		while ((block = pool->free[class])) {
+			pool->free[class] = block->next;
+			frame_pool_block_free(block);
+		}
+	}
+
+	/* Any block freed from now on goes straight back to the heap. */
+	block = __atomic_exchange_n(&pool->remote, &frame_pool_closed, __ATOMIC_ACQ_REL);
+	while (block) {
+		struct frame_pool_block *next = block->next;
+
+		frame_pool_block_free(block);
+		block = next;
+	}
+
+	frame_pool_unref(pool);
+}
+
+/*! \brief Move the blocks other threads have freed onto the free lists */
+static void frame_pool_take_remote(struct frame_pool *pool)
+{
+	struct frame_pool_block *block;
+
+	block = __atomic_exchange_n(&pool->remote, NULL, __ATOMIC_ACQUIRE);
+	while (block) {
+		struct frame_pool_block *next = block->next;
+
+		++pool->remote_frees;
+		if (pool->free_count[block->class] < FRAME_POOL_MAX_FREE) {
+			block->next = pool->free[block->class];
+			pool->free[block->class] = block;
+			++pool->free_count[block->class];
+		} else {
+			frame_pool_block_free(block);
+		}
+		block = next;
+	}
+}
+
+/*!
+ * \brief Allocate a frame with room for len bytes from this thread's pool
+ *
+ * \return The zeroed frame header or NULL if len is too large for the pool
+ * or the allocation failed.
+ */
+static struct ast_frame *frame_pool_alloc(size_t len)
+{
+	struct frame_pool *pool;
+	struct frame_pool_block *block;
+	int class;
+
+	for (class = 0; class < FRAME_POOL_CLASSES; ++class) {
+		if (len <= FRAME_POOL_LEN(class)) {
+			break;
+		}
+	}
+	if (class == FRAME_POOL_CLASSES) {
+		return NULL;
+	}
+
+	if (!(pool = ast_threadstorage_get(&frame_pool_storage, sizeof(*pool)))) {
+		return NULL;
+	}
+
+	if (!pool->free[class] && __atomic_load_n(&pool->remote, __ATOMIC_RELAXED)) {
+		frame_pool_take_remote(pool);
+	}
+
+	if ((block = pool->free[class])) {
+		pool->free[class] = block->next;
+		--pool->free_count[class];
+		++pool->hits[class];
+	} else {
+		++pool->misses[class];
+		block = ast_malloc(offsetof(struct frame_pool_block, frame) + FRAME_POOL_LEN(class));
+		if (!block) {
+			return NULL;
+		}
+		block->owner = pool;
+		block->class = class;
+		ast_atomic_fetchadd_int(&pool->refs, +1);
+	}
+
+	memset(&block->frame, 0, sizeof(block->frame));
+	block->frame.mallocd_hdr_len = FRAME_POOL_LEN(class);
+	return &block->frame;
+}
+
+/*! \brief Return a pooled frame to the pool of the thread that allocated it */
+static void frame_pool_free(struct ast_frame *fr)
+{
+	struct frame_pool_block *block = (void *) ((char *) fr - offsetof(struct frame_pool_block, frame));
+	struct frame_pool *pool = block->owner;
+	struct frame_pool_block *head;
+
+	if (pool == ast_threadstorage_get_ptr(&frame_pool_storage)) {
+		if (pool->free_count[block->class] < FRAME_POOL_MAX_FREE) {
+			block->next = pool->free[block->class];
+			pool->free[block->class] = block;
+			++pool->free_count[block->class];
+		} else {
+			frame_pool_block_free(block);
+		}
+		return;
+	}
+
+	head = __atomic_load_n(&pool->remote, __ATOMIC_RELAXED);
+	do {
+		if (head == &frame_pool_closed) {
+			frame_pool_block_free(block);
+			return;
+		}
+		block->next = head;
+	} while (!__atomic_compare_exchange_n(&pool->remote, &head, block, 1,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+#endif
+
+/*! \brief A reference counted payload used by frames created with ast_frame_share() */
+struct frame_shared_payload {
+	/*! Private copy of the original frame, holding the data and src */
+	struct ast_frame *frame;
+	/*! Energy of the data plus one, 0 until it has been measured */
+	int energy;
+};
+
+/*! \brief Header of a frame created with ast_frame_share() */
+struct frame_shared {
+	struct ast_frame frame;
+	/*! The payload, only valid while AST_MALLOCD_SHARED is set */
+	struct frame_shared_payload *payload;
+};
+
 struct ast_frame ast_null_frame = { AST_FRAME_NULL, };
 
 static struct ast_frame *ast_frame_header_new(void)
@@ -154,6 +406,16 @@ static void __frame_free(struct ast_frame *fr, int cache)
 			ao2_cleanup(fr->subclass.format);
 		}
 
+		if (fr->mallocd & AST_MALLOCD_SHARED) {
+			ao2_ref(((struct frame_shared *) fr)->payload, -1);
+		}
+
+#ifdef FRAME_POOL
+		if (fr->mallocd & AST_MALLOCD_POOL) {
+			frame_pool_free(fr);
+			return;
+		}
+#endif
 		ast_free(fr);
 	} else {
 		fr->mallocd = 0;
@@ -196,6 +458,11 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr)
 		return ast_frdup(fr);
 	}
 
+	/* unsharing leaves everything malloc'd and keeps the header */
+	if (fr->mallocd & AST_MALLOCD_SHARED) {
+		return ast_frame_unshare(fr) ? NULL : fr;
+	}
+
 	/* if everything is already malloc'd, we are done */
 	if ((fr->mallocd & (AST_MALLOCD_HDR | AST_MALLOCD_SRC | AST_MALLOCD_DATA)) ==
 	    (AST_MALLOCD_HDR | AST_MALLOCD_SRC | AST_MALLOCD_DATA)) {
@@ -294,6 +561,7 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 	struct ast_frame *out = NULL;
 	int len, srclen = 0;
 	void *buf = NULL;
+	int pooled = 0;
 
 #if !defined(LOW_MEMORY)
 	struct ast_frame_cache *frames;
@@ -311,8 +579,15 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 	if (srclen > 0)
 		len += srclen + 1;
 
+#ifdef FRAME_POOL
+	if ((out = frame_pool_alloc(len))) {
+		buf = out;
+		pooled = 1;
+	}
+#endif
+
 #if !defined(LOW_MEMORY)
-	if ((frames = ast_threadstorage_get(&frame_cache, sizeof(*frames)))) {
+	if (!buf && (frames = ast_threadstorage_get(&frame_cache, sizeof(*frames)))) {
 		AST_LIST_TRAVERSE_SAFE_BEGIN(&frames->list, out, frame_list) {
 			if (out->mallocd_hdr_len >= len) {
 				size_t mallocd_len = out->mallocd_hdr_len;
@@ -352,7 +627,7 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 	 * was allocated in a single allocation, we'll only mark it as if the header
 	 * was heap-allocated; this will result in the entire frame being properly freed.
 	 */
-	out->mallocd = AST_MALLOCD_HDR;
+	out->mallocd = AST_MALLOCD_HDR | (pooled ? AST_MALLOCD_POOL : 0);
 	out->offset = AST_FRIENDLY_OFFSET;
 	if (out->datalen) {
 		out->data.ptr = buf + sizeof(*out) + AST_FRIENDLY_OFFSET;
@@ -375,6 +650,141 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 	return out;
 }
 
+static void frame_shared_payload_destroy(void *obj)
+{
+	struct frame_shared_payload *payload = obj;
+
+	ast_frfree(payload->frame);
+}
+
+struct ast_frame *ast_frame_share(const struct ast_frame *fr)
+{
+	struct frame_shared_payload *payload;
+	struct frame_shared *shared = NULL;
+	int pooled = 0;
+
+	if (fr->mallocd & AST_MALLOCD_SHARED) {
+		payload = ao2_bump(((struct frame_shared *) fr)->payload);
+	} else {
+		payload = ao2_alloc_options(sizeof(*payload), frame_shared_payload_destroy,
+			AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!payload) {
+			return NULL;
+		}
+		payload->frame = ast_frdup(fr);
+		if (!payload->frame) {
+			ao2_ref(payload, -1);
+			return NULL;
+		}
+	}
+
+#ifdef FRAME_POOL
+	if ((shared = (struct frame_shared *) frame_pool_alloc(sizeof(*shared)))) {
+		pooled = 1;
+	}
+#endif
+	if (!shared) {
+		shared = ast_calloc_cache(1, sizeof(*shared));
+		if (!shared) {
+			ao2_ref(payload, -1);
+			return NULL;
+		}
+		shared->frame.mallocd_hdr_len = sizeof(*shared);
+	}
+
+	shared->frame.frametype = fr->frametype;
+	shared->frame.subclass = fr->subclass;
+	if ((fr->frametype == AST_FRAME_VOICE) || (fr->frametype == AST_FRAME_VIDEO) ||
+		(fr->frametype == AST_FRAME_IMAGE)) {
+		ao2_bump(shared->frame.subclass.format);
+	}
+	shared->frame.datalen = fr->datalen;
+	shared->frame.samples = fr->samples;
+	shared->frame.delivery = fr->delivery;
+	shared->frame.mallocd = AST_MALLOCD_HDR | AST_MALLOCD_SHARED | (pooled ? AST_MALLOCD_POOL : 0);
+	shared->frame.offset = payload->frame->offset;
+	shared->frame.data = payload->frame->data;
+	shared->frame.src = payload->frame->src;
+	ast_copy_flags(&shared->frame, fr, AST_FLAGS_ALL);
+	shared->frame.ts = fr->ts;
+	shared->frame.len = fr->len;
+	shared->frame.seqno = fr->seqno;
+	shared->payload = payload;
+
+	return &shared->frame;
+}
+
+int ast_frame_unshare(struct ast_frame *fr)
+{
+	struct frame_shared *shared = (struct frame_shared *) fr;
+	void *newdata = NULL;
+	char *newsrc = NULL;
+
+	if (!(fr->mallocd & AST_MALLOCD_SHARED)) {
+		return 0;
+	}
+
+	if (fr->datalen) {
+		newdata = ast_malloc(fr->datalen + AST_FRIENDLY_OFFSET);
+		if (!newdata) {
+			return -1;
+		}
+		newdata += AST_FRIENDLY_OFFSET;
+		memcpy(newdata, fr->data.ptr, fr->datalen);
+	}
+	if (fr->src) {
+		newsrc = ast_strdup(fr->src);
+		if (!newsrc) {
+			if (newdata) {
+				ast_free(newdata - AST_FRIENDLY_OFFSET);
+			}
+			return -1;
+		}
+	}
+
+	if (newdata) {
+		fr->data.ptr = newdata;
+		fr->offset = AST_FRIENDLY_OFFSET;
+		fr->mallocd |= AST_MALLOCD_DATA;
+	}
+	if (newsrc) {
+		fr->src = newsrc;
+		fr->mallocd |= AST_MALLOCD_SRC;
+	}
+	fr->mallocd &= ~AST_MALLOCD_SHARED;
+	ao2_ref(shared->payload, -1);
+	shared->payload = NULL;
+
+	return 0;
+}
+
+int ast_frame_get_energy(const struct ast_frame *fr, int *energy)
+{
+	const struct frame_shared *shared = (const struct frame_shared *) fr;
+	int value;
+
+	if (!(fr->mallocd & AST_MALLOCD_SHARED)) {
+		return -1;
+	}
+
+	/* A single int is read and written, so no lock is needed */
+	value = shared->payload->energy;
+	if (!value) {
+		return -1;
+	}
+	*energy = value - 1;
+	return 0;
+}
+
+void ast_frame_set_energy(struct ast_frame *fr, int energy)
+{
+	struct frame_shared *shared = (struct frame_shared *) fr;
+
+	if (fr->mallocd & AST_MALLOCD_SHARED) {
+		shared->payload->energy = energy + 1;
+	}
+}
+
 void ast_swapcopy_samples(void *dst, const void *src, int samples)
 {
 	int i;
@@ -665,10 +1075,6 @@ void ast_frame_dump(const char *name, struct ast_frame *f, char *prefix)
 
 int ast_frame_adjust_volume(struct ast_frame *f, int adjustment)
 {
-	int count;
-	short *fdata = f->data.ptr;
-	short adjust_value = abs(adjustment);
-
 	if ((f->frametype != AST_FRAME_VOICE) || !(ast_format_cache_is_slinear(f->subclass.format))) {
 		return -1;
 	}
@@ -677,22 +1083,17 @@ int ast_frame_adjust_volume(struct ast_frame *f, int adjustment)
 		return 0;
 	}
 
-	for (count = 0; count < f->samples; count++) {
-		if (adjustment > 0) {
-			ast_slinear_saturated_multiply(&fdata[count], &adjust_value);
-		} else if (adjustment < 0) {
-			ast_slinear_saturated_divide(&fdata[count], &adjust_value);
-		}
+	if (ast_frame_unshare(f)) {
+		return -1;
 	}
 
+	ast_slinear_adjust_volume_buf(f->data.ptr, adjustment, f->samples);
+
 	return 0;
 }
 
 int ast_frame_slinear_sum(struct ast_frame *f1, struct ast_frame *f2)
 {
-	int count;
-	short *data1, *data2;
-
 	if ((f1->frametype != AST_FRAME_VOICE) || (ast_format_cmp(f1->subclass.format, ast_format_slin) != AST_FORMAT_CMP_NOT_EQUAL))
 		return -1;
 
@@ -702,10 +1103,11 @@ int ast_frame_slinear_sum(struct ast_frame *f1, struct ast_frame *f2)
 	if (f1->samples != f2->samples)
 		return -1;
 
-	for (count = 0, data1 = f1->data.ptr, data2 = f2->data.ptr;
-	     count < f1->samples;
-	     count++, data1++, data2++)
-		ast_slinear_saturated_add(data1, data2);
+	if (ast_frame_unshare(f1)) {
+		return -1;
+	}
+
+	ast_slinear_saturated_add_buf(f1->data.ptr, f2->data.ptr, f1->samples);
 
 	return 0;
 }
@@ -717,7 +1119,83 @@ int ast_frame_clear(struct ast_frame *frame)
 	for (next = AST_LIST_NEXT(frame, frame_list);
 		 frame;
 		 frame = next, next = frame ? AST_LIST_NEXT(frame, frame_list) : NULL) {
+		if (ast_frame_unshare(frame)) {
+			return -1;
+		}
 		memset(frame->data.ptr, 0, frame->datalen);
 	}
 	return 0;
 }
+
+#ifdef FRAME_POOL
+static char *handle_memory_show_frame_pool(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct frame_pool *pool;
+	unsigned long hits[FRAME_POOL_CLASSES];
+	unsigned long misses[FRAME_POOL_CLASSES];
+	unsigned int free_count[FRAME_POOL_CLASSES] = { 0, };
+	unsigned long remote_frees;
+	int pools = 0;
+	int class;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "memory show frame pool";
+		e->usage =
+			"Usage: memory show frame pool\n"
+			"       Show how often duplicated frames were allocated from the\n"
+			"       per-thread frame pools rather than the heap.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4) {
+		return CLI_SHOWUSAGE;
+	}
+
+	AST_LIST_LOCK(&frame_pools);
+	memcpy(hits, frame_pool_retired.hits, sizeof(hits));
+	memcpy(misses, frame_pool_retired.misses, sizeof(misses));
+	remote_frees = frame_pool_retired.remote_frees;
+	AST_LIST_TRAVERSE(&frame_pools, pool, list) {
+		/* The counters belong to other threads so these are only a snapshot. */
+		for (class = 0; class < FRAME_POOL_CLASSES; ++class) {
+			hits[class] += pool->hits[class];
+			misses[class] += pool->misses[class];
+			free_count[class] += pool->free_count[class];
+		}
+		remote_frees += pool->remote_frees;
+		++pools;
+	}
+	AST_LIST_UNLOCK(&frame_pools);
+
+	ast_cli(a->fd, "%-10s %15s %15s %10s\n", "Payload", "Hits", "Misses", "Free");
+	for (class = 0; class < FRAME_POOL_CLASSES; ++class) {
+		ast_cli(a->fd, "%-10zu %15lu %15lu %10u\n", frame_pool_payloads[class],
+			hits[class], misses[class], free_count[class]);
+	}
+	ast_cli(a->fd, "%d thread pools, %lu frames returned from other threads\n",
+		pools, remote_frees);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry frame_cli[] = {
+	AST_CLI_DEFINE(handle_memory_show_frame_pool, "Display frame pool statistics"),
+};
+
+static void frame_shutdown(void)
+{
+	ast_cli_unregister_multiple(frame_cli, ARRAY_LEN(frame_cli));
+}
+#endif
+
+int ast_frame_init(void)
+{
+#ifdef FRAME_POOL
+	ast_cli_register_multiple(frame_cli, ARRAY_LEN(frame_cli));
+	ast_register_cleanup(frame_shutdown);
+#endif
+	return 0;
+}
@@ -0,0 +1,427 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief G.711 buffer conversion
+ *
+ * The scalar backend simply applies the per-sample table lookups.  The SIMD
+ * backends compute the same values arithmetically, which boils down to
+ * finding the segment (exponent) of a sample and the four bits below its
+ * leading one.  Converting the magnitude to a float does exactly that: the
+ * float exponent is the segment and the top four fraction bits are the
+ * quantized mantissa.  Decoding runs the same trick in reverse.
+ *
+ * The tables are built from AST_LIN2MU(x) == linear2ulaw(x | 3) and
+ * AST_LIN2A(x) == linear2alaw(x | 7), because the last sample of each
+ * table bucket is the one written to it, so the SIMD code applies the
+ * same rounding.  They are only used with the default G.711 algorithm,
+ * G711_NEW_ALGORITHM always uses the scalar code.
+ */
+
+/*** MODULEINFO
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/_private.h"
+#include "asterisk/utils.h"
+#include "asterisk/strings.h"
+#include "asterisk/ulaw.h"
+#include "asterisk/alaw.h"
+#include "asterisk/g711.h"
+
+#if !defined(G711_NEW_ALGORITHM) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define G711_HAVE_SSE2 1
+#include <emmintrin.h>
+#if (defined(__clang__) || __GNUC__ >= 5)
+/* AVX2 is built with a function target attribute and only used when the CPU has it. */
+#define G711_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+/*! \brief Float bits of 2^7 shifted down to the segment and mantissa bits, (127 + 7) << 4 */
+#define G711_FLOAT_BIAS 2144
+
+/*! \brief A set of G.711 conversion routines */
+struct g711_backend {
+	/*! Name of the backend */
+	const char *name;
+	/*! Returns non-zero if the running CPU can use this backend */
+	int (*supported)(void);
+	void (*lin2mu)(unsigned char *dst, const int16_t *src, size_t samples);
+	void (*mulaw)(int16_t *dst, const unsigned char *src, size_t samples);
+	void (*lin2a)(unsigned char *dst, const int16_t *src, size_t samples);
+	void (*alaw)(int16_t *dst, const unsigned char *src, size_t samples);
+};
+
+static int scalar_supported(void)
+{
+	return 1;
+}
+
+static void scalar_lin2mu(unsigned char *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; ++i) {
+		dst[i] = AST_LIN2MU(src[i]);
+	}
+}
+
+static void scalar_mulaw(int16_t *dst, const unsigned char *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; ++i) {
+		dst[i] = AST_MULAW(src[i]);
+	}
+}
+
+static void scalar_lin2a(unsigned char *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; ++i) {
+		dst[i] = AST_LIN2A(src[i]);
+	}
+}
+
+static void scalar_alaw(int16_t *dst, const unsigned char *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; ++i) {
+		dst[i] = AST_ALAW(src[i]);
+	}
+}
+
+static const struct g711_backend scalar_backend = {
+	.name = "scalar",
+	.supported = scalar_supported,
+	.lin2mu = scalar_lin2mu,
+	.mulaw = scalar_mulaw,
+	.lin2a = scalar_lin2a,
+	.alaw = scalar_alaw,
+};
+
+#ifdef G711_HAVE_SSE2
+static int sse2_supported(void)
+{
+	/* SSE2 was enabled at compile time so it is a baseline requirement. */
+	return 1;
+}
+
+/*! \brief Segment and mantissa of positive 16 bit magnitudes of at least 128 */
+static inline __m128i sse2_segment(__m128i mag)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i bias = _mm_set1_epi32(G711_FLOAT_BIAS);
+	__m128i lo = _mm_castps_si128(_mm_cvtepi32_ps(_mm_unpacklo_epi16(mag, zero)));
+	__m128i hi = _mm_castps_si128(_mm_cvtepi32_ps(_mm_unpackhi_epi16(mag, zero)));
+
+	return _mm_packs_epi32(_mm_sub_epi32(_mm_srli_epi32(lo, 19), bias),
+		_mm_sub_epi32(_mm_srli_epi32(hi, 19), bias));
+}
+
+/*! \brief Magnitudes of segments 1 to 7 from their 7 bit segment and mantissa */
+static inline __m128i sse2_expand(__m128i code)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i bias = _mm_set1_epi32(G711_FLOAT_BIAS);
+	__m128i half = _mm_set1_epi32(1 << 18);
+	__m128i lo = _mm_unpacklo_epi16(code, zero);
+	__m128i hi = _mm_unpackhi_epi16(code, zero);
+
+	lo = _mm_or_si128(_mm_slli_epi32(_mm_add_epi32(lo, bias), 19), half);
+	hi = _mm_or_si128(_mm_slli_epi32(_mm_add_epi32(hi, bias), 19), half);
+	return _mm_packs_epi32(_mm_cvttps_epi32(_mm_castsi128_ps(lo)),
+		_mm_cvttps_epi32(_mm_castsi128_ps(hi)));
+}
+
+static void sse2_lin2mu(unsigned char *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i s = _mm_or_si128(_mm_loadu_si128((const __m128i *) &src[i]), _mm_set1_epi16(3));
+		__m128i neg = _mm_srai_epi16(s, 15);
+		__m128i mag = _mm_sub_epi16(_mm_xor_si128(s, neg), neg);
+		__m128i code;
+
+		mag = _mm_add_epi16(_mm_min_epi16(mag, _mm_set1_epi16(32635)), _mm_set1_epi16(0x84));
+		code = _mm_or_si128(sse2_segment(mag), _mm_and_si128(neg, _mm_set1_epi16(0x80)));
+		code = _mm_xor_si128(code, _mm_set1_epi16(0xff));
+		_mm_storel_epi64((__m128i *) &dst[i], _mm_packus_epi16(code, code));
+	}
+	scalar_lin2mu(dst + i, src + i, samples - i);
+}
+
+static void sse2_mulaw(int16_t *dst, const unsigned char *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i mu = _mm_xor_si128(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) &src[i]),
+			_mm_setzero_si128()), _mm_set1_epi16(0xff));
+		__m128i neg = _mm_cmpgt_epi16(mu, _mm_set1_epi16(0x7f));
+		__m128i y = _mm_sub_epi16(sse2_expand(_mm_and_si128(mu, _mm_set1_epi16(0x7f))), _mm_set1_epi16(0x84));
+
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_sub_epi16(_mm_xor_si128(y, neg), neg));
+	}
+	scalar_mulaw(dst + i, src + i, samples - i);
+}
+
+static void sse2_lin2a(unsigned char *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i s = _mm_or_si128(_mm_loadu_si128((const __m128i *) &src[i]), _mm_set1_epi16(7));
+		__m128i neg = _mm_srai_epi16(s, 15);
+		__m128i mag = _mm_sub_epi16(_mm_xor_si128(s, neg), neg);
+		/* Segment 0 is linear and quantized by 16 instead of 8 */
+		__m128i linear = _mm_cmpgt_epi16(_mm_set1_epi16(0x100), mag);
+		__m128i code = _mm_or_si128(_mm_and_si128(linear, _mm_srli_epi16(mag, 4)),
+			_mm_andnot_si128(linear, sse2_segment(mag)));
+
+		code = _mm_xor_si128(code, _mm_xor_si128(_mm_set1_epi16(0xd5), _mm_and_si128(neg, _mm_set1_epi16(0x80))));
+		_mm_storel_epi64((__m128i *) &dst[i], _mm_packus_epi16(code, code));
+	}
+	scalar_lin2a(dst + i, src + i, samples - i);
+}
+
+static void sse2_alaw(int16_t *dst, const unsigned char *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i a = _mm_xor_si128(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) &src[i]),
+			_mm_setzero_si128()), _mm_set1_epi16(0x55));
+		__m128i code = _mm_and_si128(a, _mm_set1_epi16(0x7f));
+		__m128i linear = _mm_cmpgt_epi16(_mm_set1_epi16(0x10), code);
+		__m128i neg = _mm_cmpgt_epi16(_mm_set1_epi16(0x80), a);
+		__m128i y = _mm_or_si128(
+			_mm_and_si128(linear, _mm_add_epi16(_mm_slli_epi16(code, 4), _mm_set1_epi16(8))),
+			_mm_andnot_si128(linear, sse2_expand(code)));
+
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_sub_epi16(_mm_xor_si128(y, neg), neg));
+	}
+	scalar_alaw(dst + i, src + i, samples - i);
+}
+
+static const struct g711_backend sse2_backend = {
+	.name = "sse2",
+	.supported = sse2_supported,
+	.lin2mu = sse2_lin2mu,
+	.mulaw = sse2_mulaw,
+	.lin2a = sse2_lin2a,
+	.alaw = sse2_alaw,
+};
+#endif
+
+#ifdef G711_HAVE_AVX2
+static int avx2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/* The unpack and pack instructions all work within 128 bit lanes so
+ * the sample order is preserved by the helpers below. */
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_segment(__m256i mag)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i bias = _mm256_set1_epi32(G711_FLOAT_BIAS);
+	__m256i lo = _mm256_castps_si256(_mm256_cvtepi32_ps(_mm256_unpacklo_epi16(mag, zero)));
+	__m256i hi = _mm256_castps_si256(_mm256_cvtepi32_ps(_mm256_unpackhi_epi16(mag, zero)));
+
+	return _mm256_packs_epi32(_mm256_sub_epi32(_mm256_srli_epi32(lo, 19), bias),
+		_mm256_sub_epi32(_mm256_srli_epi32(hi, 19), bias));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_expand(__m256i code)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i bias = _mm256_set1_epi32(G711_FLOAT_BIAS);
+	__m256i half = _mm256_set1_epi32(1 << 18);
+	__m256i lo = _mm256_unpacklo_epi16(code, zero);
+	__m256i hi = _mm256_unpackhi_epi16(code, zero);
+
+	lo = _mm256_or_si256(_mm256_slli_epi32(_mm256_add_epi32(lo, bias), 19), half);
+	hi = _mm256_or_si256(_mm256_slli_epi32(_mm256_add_epi32(hi, bias), 19), half);
+	return _mm256_packs_epi32(_mm256_cvttps_epi32(_mm256_castsi256_ps(lo)),
+		_mm256_cvttps_epi32(_mm256_castsi256_ps(hi)));
+}
+
+/*! \brief Store the low bytes of 16 words */
+__attribute__((target("avx2")))
+static inline void avx2_store_bytes(unsigned char *dst, __m256i words)
+{
+	__m256i bytes = _mm256_packus_epi16(words, words);
+
+	_mm_storeu_si128((__m128i *) dst, _mm256_castsi256_si128(_mm256_permute4x64_epi64(bytes, 0x08)));
+}
+
+__attribute__((target("avx2")))
+static void avx2_lin2mu(unsigned char *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= samples; i += 16) {
+		__m256i s = _mm256_or_si256(_mm256_loadu_si256((const __m256i *) &src[i]), _mm256_set1_epi16(3));
+		__m256i neg = _mm256_srai_epi16(s, 15);
+		__m256i mag = _mm256_abs_epi16(s);
+		__m256i code;
+
+		mag = _mm256_add_epi16(_mm256_min_epi16(mag, _mm256_set1_epi16(32635)), _mm256_set1_epi16(0x84));
+		code = _mm256_or_si256(avx2_segment(mag), _mm256_and_si256(neg, _mm256_set1_epi16(0x80)));
+		avx2_store_bytes(&dst[i], _mm256_xor_si256(code, _mm256_set1_epi16(0xff)));
+	}
+	sse2_lin2mu(dst + i, src + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_mulaw(int16_t *dst, const unsigned char *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= samples; i += 16) {
+		__m256i mu = _mm256_xor_si256(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) &src[i])),
+			_mm256_set1_epi16(0xff));
+		__m256i neg = _mm256_cmpgt_epi16(mu, _mm256_set1_epi16(0x7f));
+		__m256i y = _mm256_sub_epi16(avx2_expand(_mm256_and_si256(mu, _mm256_set1_epi16(0x7f))),
+			_mm256_set1_epi16(0x84));
+
+		_mm256_storeu_si256((__m256i *) &dst[i], _mm256_sign_epi16(y, _mm256_or_si256(neg, _mm256_set1_epi16(1))));
+	}
+	sse2_mulaw(dst + i, src + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_lin2a(unsigned char *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= samples; i += 16) {
+		__m256i s = _mm256_or_si256(_mm256_loadu_si256((const __m256i *) &src[i]), _mm256_set1_epi16(7));
+		__m256i neg = _mm256_srai_epi16(s, 15);
+		__m256i mag = _mm256_abs_epi16(s);
+		__m256i linear = _mm256_cmpgt_epi16(_mm256_set1_epi16(0x100), mag);
+		__m256i code = _mm256_blendv_epi8(avx2_segment(mag), _mm256_srli_epi16(mag, 4), linear);
+
+		code = _mm256_xor_si256(code, _mm256_xor_si256(_mm256_set1_epi16(0xd5), _mm256_and_si256(neg, _mm256_set1_epi16(0x80))));
+		avx2_store_bytes(&dst[i], code);
+	}
+	sse2_lin2a(dst + i, src + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_alaw(int16_t *dst, const unsigned char *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= samples; i += 16) {
+		__m256i a = _mm256_xor_si256(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) &src[i])),
+			_mm256_set1_epi16(0x55));
+		__m256i code = _mm256_and_si256(a, _mm256_set1_epi16(0x7f));
+		__m256i linear = _mm256_cmpgt_epi16(_mm256_set1_epi16(0x10), code);
+		__m256i neg = _mm256_cmpgt_epi16(_mm256_set1_epi16(0x80), a);
+		__m256i y = _mm256_blendv_epi8(avx2_expand(code),
+			_mm256_add_epi16(_mm256_slli_epi16(code, 4), _mm256_set1_epi16(8)), linear);
+
+		_mm256_storeu_si256((__m256i *) &dst[i], _mm256_sign_epi16(y, _mm256_or_si256(neg, _mm256_set1_epi16(1))));
+	}
+	sse2_alaw(dst + i, src + i, samples - i);
+}
+
+static const struct g711_backend avx2_backend = {
+	.name = "avx2",
+	.supported = avx2_supported,
+	.lin2mu = avx2_lin2mu,
+	.mulaw = avx2_mulaw,
+	.lin2a = avx2_lin2a,
+	.alaw = avx2_alaw,
+};
+#endif
+
+/*! \brief All compiled in backends, best first */
+static const struct g711_backend *backends[] = {
+#ifdef G711_HAVE_AVX2
+	&avx2_backend,
+#endif
+#ifdef G711_HAVE_SSE2
+	&sse2_backend,
+#endif
+	&scalar_backend,
+};
+
+/*! \brief The backend in use, scalar until ast_g711_init() has run */
+static const struct g711_backend *current = &scalar_backend;
+
+void ast_lin2mu_buf(unsigned char *dst, const int16_t *src, size_t samples)
+{
+	current->lin2mu(dst, src, samples);
+}
+
+void ast_mulaw_buf(int16_t *dst, const unsigned char *src, size_t samples)
+{
+	current->mulaw(dst, src, samples);
+}
+
+void ast_lin2a_buf(unsigned char *dst, const int16_t *src, size_t samples)
+{
+	current->lin2a(dst, src, samples);
+}
+
+void ast_alaw_buf(int16_t *dst, const unsigned char *src, size_t samples)
+{
+	current->alaw(dst, src, samples);
+}
+
+const char *ast_g711_backend(void)
+{
+	return current->name;
+}
+
+int ast_g711_set_backend(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(backends); ++i) {
+		if ((ast_strlen_zero(name) || !strcasecmp(name, backends[i]->name))
+			&& backends[i]->supported()) {
+			current = backends[i];
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int ast_g711_init(void)
+{
+	ast_g711_set_backend(NULL);
+	ast_debug(1, "Using '%s' G.711 conversion backend\n", current->name);
+	return 0;
+}
@@ -44,19 +44,23 @@ struct ast_heap {
 	void **heap;
 };
 
-static inline int left_node(int i)
-{
-	return 2 * i;
-}
+/*!
+ * \brief Children of each node
+ *
+ * Four children per node make the heap half as deep as a binary one, and
+ * the children of a node are next to each other in memory, so sifting an
+ * element down touches fewer cache lines.
+ */
+#define HEAP_ARITY 4
 
-static inline int right_node(int i)
+static inline int first_child(int i)
 {
-	return 2 * i + 1;
+	return HEAP_ARITY * (i - 1) + 2;
 }
 
 static inline int parent_node(int i)
 {
-	return i / 2;
+	return (i - 2) / HEAP_ARITY + 1;
 }
 
 static inline void *heap_get(struct ast_heap *h, int i)
@@ -91,20 +95,9 @@ int ast_heap_verify(struct ast_heap *h)
 {
 	unsigned int i;
 
-	for (i = 1; i <= (h->cur_len / 2); i++) {
-		int l = left_node(i);
-		int r = right_node(i);
-
-		if (l <= h->cur_len) {
-			if (h->cmp_fn(heap_get(h, i), heap_get(h, l)) < 0) {
-				return -1;
-			}
-		}
-
-		if (r <= h->cur_len) {
-			if (h->cmp_fn(heap_get(h, i), heap_get(h, r)) < 0) {
-				return -1;
-			}
+	for (i = 2; i <= h->cur_len; i++) {
+		if (h->cmp_fn(heap_get(h, parent_node(i)), heap_get(h, i)) < 0) {
+			return -1;
 		}
 	}
 
@@ -198,49 +191,55 @@ static int grow_heap(struct ast_heap *h
 	return 0;
 }
 
-static inline void heap_swap(struct ast_heap *h, int i, int j)
-{
-	void *tmp;
-
-	tmp = heap_get(h, i);
-	heap_set(h, i, heap_get(h, j));
-	heap_set(h, j, tmp);
-}
-
+/*!
+ * \brief Move the element at i down until none of its children is greater
+ *
+ * Children are moved up into the hole left by the element rather than
+ * swapped with it, and the element is only stored once in its final place.
+ */
 static inline void max_heapify(struct ast_heap *h, int i)
 {
+	void *elm = heap_get(h, i);
+
 	for (;;) {
-		int l = left_node(i);
-		int r = right_node(i);
+		int child = first_child(i);
+		int last;
 		int max;
 
-		if (l <= h->cur_len && h->cmp_fn(heap_get(h, l), heap_get(h, i)) > 0) {
-			max = l;
-		} else {
-			max = i;
+		if (child > h->cur_len) {
+			break;
 		}
 
-		if (r <= h->cur_len && h->cmp_fn(heap_get(h, r), heap_get(h, max)) > 0) {
-			max = r;
+		last = MIN(child + HEAP_ARITY - 1, h->cur_len);
+		for (max = child++; child <= last; child++) {
+			if (h->cmp_fn(heap_get(h, child), heap_get(h, max)) > 0) {
+				max = child;
+			}
 		}
 
-		if (max == i) {
+		if (h->cmp_fn(heap_get(h, max), elm) <= 0) {
 			break;
 		}
 
-		heap_swap(h, i, max);
-
+		heap_set(h, i, heap_get(h, max));
 		i = max;
 	}
+
+	heap_set(h, i, elm);
 }
 
+/*! \brief Move the element at i up while its parent is less than it */
 static int bubble_up(struct ast_heap *h, int i)
 {
-	while (i > 1 && h->cmp_fn(heap_get(h, parent_node(i)), heap_get(h, i)) < 0) {
-		heap_swap(h, i, parent_node(i));
+	void *elm = heap_get(h, i);
+
+	while (i > 1 && h->cmp_fn(heap_get(h, parent_node(i)), elm) < 0) {
+		heap_set(h, i, heap_get(h, parent_node(i)));
 		i = parent_node(i);
 	}
 
+	heap_set(h, i, elm);
+
 	return i;
 }
 
@@ -275,8 +274,10 @@ static void *_ast_heap_remove(struct ast_heap *h, unsigned int index)
 
 	ret = heap_get(h, index);
 	heap_set(h, index, heap_get(h, (h->cur_len)--));
-	index = bubble_up(h, index);
-	max_heapify(h, index);
+	if (index <= h->cur_len) {
+		index = bubble_up(h, index);
+		max_heapify(h, index);
+	}
 
 	return ret;
 }
@@ -51,6 +51,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <sys/stat.h>
 #include <sys/signal.h>
 #include <fcntl.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
 #include "asterisk/paths.h"	/* use ast_config_AST_DATA_DIR */
 #include "asterisk/cli.h"
@@ -66,6 +69,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/astobj2.h"
 #include "asterisk/netsock2.h"
 #include "asterisk/json.h"
+#include "asterisk/threadpool.h"
 
 #define MAX_PREFIX 80
 #define DEFAULT_PORT 8088
@@ -77,6 +81,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #define MIN_INITIAL_REQUEST_TIMEOUT	10000
 /*! (ms) Idle time between HTTP requests */
 #define DEFAULT_SESSION_KEEP_ALIVE 15000
+/*! (s) Idle time before a connection handling thread exits */
+#define HTTP_WORKER_IDLE_TIMEOUT 60
 /*! Max size for the http server name */
 #define	MAX_SERVER_NAME_LENGTH 128
 /*! Max size for the http response header */
@@ -105,6 +111,9 @@ static int session_count = 0;
 
 static struct ast_tls_config http_tls_cfg;
 
+/*! Threads handling HTTP and HTTPS connections, reused between connections */
+static struct ast_threadpool *http_worker_pool;
+
 static void *httpd_helper_thread(void *arg);
 
 /*!
@@ -443,6 +452,71 @@ struct http_worker_private_data {
 	struct ast_flags flags;
 };
 
+/*!
+ * \internal
+ * \brief Send the contents of a file as the body of a response.
+ *
+ * On plain TCP connections the file is handed to the kernel with sendfile(),
+ * so it is not copied through Asterisk.
+ *
+ * \retval 0 on success.
+ * \retval -1 on error; the connection should be closed.
+ */
+static int http_send_file(struct ast_tcptls_session_instance *ser, int fd)
+{
+	char buf[4096];
+	int len;
+
+#if defined(__linux__)
+	if (!ser->ssl) {
+		off_t offset = 0;
+		ssize_t sent;
+
+		/* The headers must be on the wire first */
+		fflush(ser->f);
+		for (;;) {
+			sent = sendfile(ser->fd, fd, &offset, 65536);
+			if (sent > 0) {
+				continue;
+			}
+			if (!sent) {
+				return 0;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				/* The socket is non-blocking */
+				if (ast_wait_for_output(ser->fd, session_inactivity) > 0) {
+					continue;
+				}
+				ast_log(LOG_WARNING, "Timed out sending file to %s\n",
+					ast_sockaddr_stringify(&ser->remote_address));
+				return -1;
+			}
+			if (!offset && (errno == EINVAL || errno == ENOSYS)) {
+				/* Not supported for this file; copy it instead */
+				break;
+			}
+			ast_log(LOG_WARNING, "sendfile() failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+#endif
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		/*
+		 * NOTE: Because ser->f is a non-standard FILE *, fwrite() will probably not
+		 * behave exactly as documented.
+		 */
+		if (fwrite(buf, len, 1, ser->f) != 1) {
+			ast_log(LOG_WARNING, "fwrite() failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
 void ast_http_send(struct ast_tcptls_session_instance *ser,
 	enum ast_http_method method, int status_code, const char *status_title,
 	struct ast_str *http_header, struct ast_str *out, int fd,
@@ -536,21 +610,8 @@ void ast_http_send(struct ast_tcptls_session_instance *ser,
 			}
 		}
 
-		if (fd) {
-			char buf[256];
-			int len;
-
-			while ((len = read(fd, buf, sizeof(buf))) > 0) {
-				/*
-				 * NOTE: Because ser->f is a non-standard FILE *, fwrite() will probably not
-				 * behave exactly as documented.
-				 */
-				if (fwrite(buf, len, 1, ser->f) != 1) {
-					ast_log(LOG_WARNING, "fwrite() failed: %s\n", strerror(errno));
-					close_connection = 1;
-					break;
-				}
-			}
+		if (fd && http_send_file(ser, fd)) {
+			close_connection = 1;
 		}
 	}
 
@@ -2333,6 +2394,11 @@ static void http_shutdown(void)
 	if (http_tls_cfg.enabled) {
 		ast_tcptls_server_stop(&https_desc);
 	}
+	http_desc.worker_pool = NULL;
+	https_desc.worker_pool = NULL;
+	/* Connections still open keep their threads until they close */
+	ast_threadpool_shutdown(http_worker_pool);
+	http_worker_pool = NULL;
 	ast_free(http_tls_cfg.certfile);
 	ast_free(http_tls_cfg.capath);
 	ast_free(http_tls_cfg.pvtfile);
@@ -2350,6 +2416,22 @@ static void http_shutdown(void)
 
 int ast_http_init(void)
 {
+	struct ast_threadpool_options options = {
+		.version = AST_THREADPOOL_OPTIONS_VERSION,
+		.idle_timeout = HTTP_WORKER_IDLE_TIMEOUT,
+		.auto_increment = 1,
+		.initial_size = 0,
+		.max_size = 0,
+	};
+
+	/*
+	 * Connections are handed to idle threads of the pool rather than each
+	 * getting a new thread. If the pool cannot be created, they still do.
+	 */
+	http_worker_pool = ast_threadpool_create("httpd", NULL, &options);
+	http_desc.worker_pool = http_worker_pool;
+	https_desc.worker_pool = http_worker_pool;
+
 	ast_http_uri_link(&statusuri);
 	ast_http_uri_link(&staticuri);
 	ast_cli_register_multiple(cli_http, ARRAY_LEN(cli_http));
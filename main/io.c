@@ -46,6 +46,313 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #define DEBUG(a)
 #endif
 
+#if defined(__linux__)
+/*!
+ * \brief Use epoll to wait for I/O
+ *
+ * The set of descriptors is kept in the kernel, so waiting costs nothing
+ * per idle descriptor and only the descriptors with events are visited.
+ */
+#define IO_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef IO_USE_EPOLL
+
+/*! \brief
+ * Kept for each file descriptor
+ */
+struct io_rec {
+	ast_io_cb callback;		/*!< What is to be called */
+	void *data;			/*!< Data to be passed */
+	int *id;			/*!< ID number, NULL if the record is free */
+	int fd;				/*!< File descriptor */
+	short events;			/*!< Events waited for */
+	unsigned int generation;	/*!< Changed each time the record is reused */
+	int next_free;			/*!< Next free record, if this one is free */
+};
+
+/*! \brief Number of records added to the context at once */
+#define GROW_SHRINK_SIZE 512
+
+/*! \brief Most events dispatched by one ast_io_wait() */
+#define MAX_EVENTS 256
+
+/*! \brief Global IO variables are now in a struct in order to be
+   made threadsafe */
+struct io_context {
+	int epfd;                     /*!< epoll descriptor */
+	struct io_rec *ior;           /*!< I/O records, indexed by ID */
+	unsigned int fdcnt;           /*!< Number of records in use */
+	unsigned int maxfdcnt;        /*!< Number of records allocated */
+	int first_free;               /*!< First free record, or -1 */
+};
+
+/*!
+ * \brief epoll data of a record.
+ *
+ * The generation lets events for a record that was removed and reused
+ * while dispatching be recognised and dropped.
+ */
+static uint64_t io_rec_data(const struct io_context *ioc, int x)
+{
+	return ((uint64_t) ioc->ior[x].generation << 32) | (unsigned int) x;
+}
+
+/*!
+ * \brief Add records to the free list.
+ */
+static void io_add_free(struct io_context *ioc, unsigned int from, unsigned int to)
+{
+	while (to > from) {
+		--to;
+		ioc->ior[to].id = NULL;
+		ioc->ior[to].next_free = ioc->first_free;
+		ioc->first_free = to;
+	}
+}
+
+/*! \brief Create an I/O context */
+struct io_context *io_context_create(void)
+{
+	struct io_context *tmp;
+
+	if (!(tmp = ast_calloc(1, sizeof(*tmp)))) {
+		return NULL;
+	}
+
+	tmp->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (tmp->epfd < 0) {
+		ast_log(LOG_ERROR, "Unable to create epoll descriptor: %s\n", strerror(errno));
+		ast_free(tmp);
+		return NULL;
+	}
+
+	tmp->first_free = -1;
+	tmp->maxfdcnt = GROW_SHRINK_SIZE / 2;
+	if (!(tmp->ior = ast_calloc(tmp->maxfdcnt, sizeof(*tmp->ior)))) {
+		close(tmp->epfd);
+		ast_free(tmp);
+		return NULL;
+	}
+	io_add_free(tmp, 0, tmp->maxfdcnt);
+
+	return tmp;
+}
+
+void io_context_destroy(struct io_context *ioc)
+{
+	unsigned int x;
+
+	for (x = 0; x < ioc->maxfdcnt; x++) {
+		ast_free(ioc->ior[x].id);
+	}
+	close(ioc->epfd);
+	ast_free(ioc->ior);
+	ast_free(ioc);
+}
+
+/*! \brief
+ * Grow the size of our arrays.
+ * \return 0 on success or -1 on failure
+ */
+static int io_grow(struct io_context *ioc)
+{
+	struct io_rec *tmp;
+	unsigned int oldcnt = ioc->maxfdcnt;
+
+	DEBUG(ast_debug(1, "io_grow()\n"));
+
+	if (!(tmp = ast_realloc(ioc->ior, (oldcnt + GROW_SHRINK_SIZE) * sizeof(*ioc->ior)))) {
+		return -1;
+	}
+	memset(tmp + oldcnt, 0, GROW_SHRINK_SIZE * sizeof(*tmp));
+	ioc->ior = tmp;
+	ioc->maxfdcnt += GROW_SHRINK_SIZE;
+	io_add_free(ioc, oldcnt, ioc->maxfdcnt);
+
+	return 0;
+}
+
+/*! \brief
+ * Add a new I/O entry for this file descriptor
+ * with the given event mask, to call callback with
+ * data as an argument.
+ * \return Returns NULL on failure.
+ */
+int *ast_io_add(struct io_context *ioc, int fd, ast_io_cb callback, short events, void *data)
+{
+	struct epoll_event ev = { 0, };
+	int x;
+
+	DEBUG(ast_debug(1, "ast_io_add()\n"));
+
+	if (ioc->first_free < 0 && io_grow(ioc)) {
+		return NULL;
+	}
+	x = ioc->first_free;
+
+	if (!(ioc->ior[x].id = ast_malloc(sizeof(*ioc->ior[x].id)))) {
+		/* Bonk if we couldn't allocate an int */
+		return NULL;
+	}
+	*ioc->ior[x].id = x;
+	ioc->ior[x].callback = callback;
+	ioc->ior[x].data = data;
+	ioc->ior[x].fd = fd;
+	ioc->ior[x].events = events;
+	ioc->ior[x].generation++;
+
+	/* The poll and epoll event bits are the same on Linux */
+	ev.events = events;
+	ev.data.u64 = io_rec_data(ioc, x);
+	if (epoll_ctl(ioc->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		ast_log(LOG_WARNING, "Unable to add descriptor %d to I/O context: %s\n", fd, strerror(errno));
+		ast_free(ioc->ior[x].id);
+		ioc->ior[x].id = NULL;
+		return NULL;
+	}
+
+	ioc->first_free = ioc->ior[x].next_free;
+	ioc->fdcnt++;
+
+	return ioc->ior[x].id;
+}
+
+int *ast_io_change(struct io_context *ioc, int *id, int fd, ast_io_cb callback, short events, void *data)
+{
+	struct io_rec *rec;
+	struct epoll_event ev = { 0, };
+
+	/* If this id doesn't belong to us it doesn't exist here */
+	if (*id < 0 || *id >= ioc->maxfdcnt || ioc->ior[*id].id != id) {
+		return NULL;
+	}
+	rec = &ioc->ior[*id];
+
+	if (callback)
+		rec->callback = callback;
+	if (data)
+		rec->data = data;
+
+	if ((fd > -1 && fd != rec->fd) || (events && events != rec->events)) {
+		if (events)
+			rec->events = events;
+		ev.events = rec->events;
+		ev.data.u64 = io_rec_data(ioc, *id);
+		if (fd > -1 && fd != rec->fd) {
+			epoll_ctl(ioc->epfd, EPOLL_CTL_DEL, rec->fd, &ev);
+			rec->fd = fd;
+			if (epoll_ctl(ioc->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+				ast_log(LOG_WARNING, "Unable to add descriptor %d to I/O context: %s\n", fd, strerror(errno));
+			}
+		} else if (epoll_ctl(ioc->epfd, EPOLL_CTL_MOD, rec->fd, &ev)) {
+			ast_log(LOG_WARNING, "Unable to change descriptor %d in I/O context: %s\n", rec->fd, strerror(errno));
+		}
+	}
+
+	return id;
+}
+
+int ast_io_remove(struct io_context *ioc, int *_id)
+{
+	struct epoll_event ev = { 0, };
+	int x;
+
+	if (!_id) {
+		ast_log(LOG_WARNING, "Asked to remove NULL?\n");
+		return -1;
+	}
+
+	x = *_id;
+	if (x < 0 || x >= ioc->maxfdcnt || ioc->ior[x].id != _id) {
+		ast_log(LOG_NOTICE, "Unable to remove unknown id %p\n", _id);
+		return -1;
+	}
+
+	/* The descriptor may already have been closed, which removes it */
+	epoll_ctl(ioc->epfd, EPOLL_CTL_DEL, ioc->ior[x].fd, &ev);
+
+	/* Free the int immediately and set to NULL so we know it's unused now */
+	ast_free(ioc->ior[x].id);
+	ioc->ior[x].id = NULL;
+	ioc->ior[x].next_free = ioc->first_free;
+	ioc->first_free = x;
+	ioc->fdcnt--;
+
+	return 0;
+}
+
+/*! \brief
+ * Make the poll call, and call
+ * the callbacks for anything that needs
+ * to be handled
+ */
+int ast_io_wait(struct io_context *ioc, int howlong)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int res, i;
+
+	DEBUG(ast_debug(1, "ast_io_wait()\n"));
+
+	if ((res = epoll_wait(ioc->epfd, events, ARRAY_LEN(events), howlong)) <= 0) {
+		return res;
+	}
+
+	for (i = 0; i < res; i++) {
+		unsigned int x = (unsigned int) events[i].data.u64;
+		unsigned int generation = events[i].data.u64 >> 32;
+		struct io_rec *rec;
+
+		/* Yes, it is possible for an entry to be deleted and still have an
+		   event waiting if it occurs after the original calling id */
+		if (x >= ioc->maxfdcnt) {
+			continue;
+		}
+		rec = &ioc->ior[x];
+		if (!rec->id || rec->generation != generation) {
+			continue;
+		}
+
+		if (rec->callback) {
+			if (!rec->callback(rec->id, rec->fd, events[i].events, rec->data)) {
+				/* Time to delete them since they returned a 0 */
+				ast_io_remove(ioc, ioc->ior[x].id);
+			}
+		}
+	}
+
+	return res;
+}
+
+void ast_io_dump(struct io_context *ioc)
+{
+	/*
+	 * Print some debugging information via
+	 * the logger interface
+	 */
+	unsigned int x;
+
+	ast_debug(1, "Asterisk IO Dump: %u entries, %u max entries\n", ioc->fdcnt, ioc->maxfdcnt);
+	ast_debug(1, "================================================\n");
+	ast_debug(1, "| ID    FD     Callback    Data        Events  |\n");
+	ast_debug(1, "+------+------+-----------+-----------+--------+\n");
+	for (x = 0; x < ioc->maxfdcnt; x++) {
+		if (!ioc->ior[x].id) {
+			continue;
+		}
+		ast_debug(1, "| %.4d | %.4d | %p | %p | %.6x |\n",
+				*ioc->ior[x].id,
+				ioc->ior[x].fd,
+				ioc->ior[x].callback,
+				ioc->ior[x].data,
+				(unsigned)ioc->ior[x].events);
+	}
+	ast_debug(1, "================================================\n");
+}
+
+#else /* !IO_USE_EPOLL */
+
 /*! \brief
  * Kept for each file descriptor
  */
@@ -330,6 +637,8 @@ void ast_io_dump(struct io_context *ioc)
 	ast_debug(1, "================================================\n");
 }
 
+#endif /* IO_USE_EPOLL */
+
 /* Unrelated I/O functions */
 
 int ast_hide_password(int fd)
@@ -711,6 +711,315 @@ int ast_json_dump_str_format(struct ast_json *root, struct ast_str **dst, enum a
 	return json_dump_callback((json_t *)root, write_to_ast_str, dst, dump_flags(format));
 }
 
+#define JSON_WRITER_SPACES "                "
+
+/*! \brief Newline followed by enough indentation for AST_JSON_WRITER_MAX_DEPTH */
+static const char json_writer_indent[] = "\n"
+	JSON_WRITER_SPACES JSON_WRITER_SPACES JSON_WRITER_SPACES JSON_WRITER_SPACES
+	JSON_WRITER_SPACES JSON_WRITER_SPACES JSON_WRITER_SPACES JSON_WRITER_SPACES;
+
+static int json_writer_append(struct ast_json_writer *writer, const char *data, size_t len)
+{
+	if (writer->error || write_to_ast_str(data, len, writer->buf)) {
+		writer->error = 1;
+		return -1;
+	}
+	return 0;
+}
+
+/*! \brief Start a new line, indented for \a depth, if pretty printing */
+static int json_writer_newline(struct ast_json_writer *writer, unsigned int depth)
+{
+	if (writer->format != AST_JSON_PRETTY) {
+		return 0;
+	}
+	/* Same indentation as JSON_INDENT(2) */
+	return json_writer_append(writer, json_writer_indent, 1 + depth * 2);
+}
+
+static int json_writer_fail(struct ast_json_writer *writer)
+{
+	writer->error = 1;
+	return -1;
+}
+
+/*! \brief Separate a new member of the innermost object or array from the previous one */
+static int json_writer_member(struct ast_json_writer *writer)
+{
+	uint64_t bit = 1ULL << (writer->depth - 1);
+
+	if ((writer->has_members & bit) && json_writer_append(writer, ",", 1)) {
+		return -1;
+	}
+	writer->has_members |= bit;
+	return json_writer_newline(writer, writer->depth);
+}
+
+/*! \brief Prepare to write a value in the current position */
+static int json_writer_value_start(struct ast_json_writer *writer)
+{
+	if (writer->error) {
+		return -1;
+	}
+	if (writer->after_key) {
+		writer->after_key = 0;
+		return 0;
+	}
+	if (!writer->depth) {
+		return 0;
+	}
+	if (writer->in_object & (1ULL << (writer->depth - 1))) {
+		/* Object members need a key */
+		return json_writer_fail(writer);
+	}
+	return json_writer_member(writer);
+}
+
+/*! \brief Append a string with JSON escaping, as json_dumps() does */
+static int json_writer_escaped(struct ast_json_writer *writer, const char *value)
+{
+	const char *pos;
+	const char *run = value;
+
+	if (!ast_json_utf8_check(value)) {
+		return json_writer_fail(writer);
+	}
+
+	json_writer_append(writer, "\"", 1);
+	for (pos = value; *pos; ++pos) {
+		unsigned char c = *pos;
+		char escape[7];
+		const char *text;
+
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+
+		switch (c) {
+		case '"':
+			text = "\\\"";
+			break;
+		case '\\':
+			text = "\\\\";
+			break;
+		case '\b':
+			text = "\\b";
+			break;
+		case '\f':
+			text = "\\f";
+			break;
+		case '\n':
+			text = "\\n";
+			break;
+		case '\r':
+			text = "\\r";
+			break;
+		case '\t':
+			text = "\\t";
+			break;
+		default:
+			snprintf(escape, sizeof(escape), "\\u%04X", c);
+			text = escape;
+			break;
+		}
+		json_writer_append(writer, run, pos - run);
+		json_writer_append(writer, text, strlen(text));
+		run = pos + 1;
+	}
+	json_writer_append(writer, run, pos - run);
+	return json_writer_append(writer, "\"", 1);
+}
+
+static int json_writer_open(struct ast_json_writer *writer, const char *bracket, int object)
+{
+	uint64_t bit;
+
+	if (json_writer_value_start(writer)) {
+		return -1;
+	}
+	if (writer->depth == AST_JSON_WRITER_MAX_DEPTH) {
+		return json_writer_fail(writer);
+	}
+
+	bit = 1ULL << writer->depth++;
+	writer->has_members &= ~bit;
+	if (object) {
+		writer->in_object |= bit;
+	} else {
+		writer->in_object &= ~bit;
+	}
+	return json_writer_append(writer, bracket, 1);
+}
+
+static int json_writer_close(struct ast_json_writer *writer, const char *bracket, int object)
+{
+	uint64_t bit;
+
+	if (writer->error) {
+		return -1;
+	}
+	if (!writer->depth || writer->after_key) {
+		return json_writer_fail(writer);
+	}
+
+	bit = 1ULL << (writer->depth - 1);
+	if (!(writer->in_object & bit) != !object) {
+		return json_writer_fail(writer);
+	}
+
+	--writer->depth;
+	if ((writer->has_members & bit) && json_writer_newline(writer, writer->depth)) {
+		return -1;
+	}
+	return json_writer_append(writer, bracket, 1);
+}
+
+void ast_json_writer_init(struct ast_json_writer *writer, struct ast_str **buf,
+	enum ast_json_encoding_format format)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->buf = buf;
+	writer->format = format;
+}
+
+int ast_json_writer_finish(struct ast_json_writer *writer)
+{
+	return writer->error || writer->depth || writer->after_key ? -1 : 0;
+}
+
+int ast_json_writer_object_start(struct ast_json_writer *writer)
+{
+	return json_writer_open(writer, "{", 1);
+}
+
+int ast_json_writer_object_end(struct ast_json_writer *writer)
+{
+	return json_writer_close(writer, "}", 1);
+}
+
+int ast_json_writer_array_start(struct ast_json_writer *writer)
+{
+	return json_writer_open(writer, "[", 0);
+}
+
+int ast_json_writer_array_end(struct ast_json_writer *writer)
+{
+	return json_writer_close(writer, "]", 0);
+}
+
+int ast_json_writer_key(struct ast_json_writer *writer, const char *key)
+{
+	if (writer->error) {
+		return -1;
+	}
+	if (!writer->depth || writer->after_key
+		|| !(writer->in_object & (1ULL << (writer->depth - 1)))) {
+		return json_writer_fail(writer);
+	}
+
+	json_writer_member(writer);
+	json_writer_escaped(writer, key);
+	if (writer->format == AST_JSON_PRETTY) {
+		json_writer_append(writer, ": ", 2);
+	} else {
+		json_writer_append(writer, ":", 1);
+	}
+	writer->after_key = 1;
+	return writer->error ? -1 : 0;
+}
+
+int ast_json_writer_string(struct ast_json_writer *writer, const char *value)
+{
+	if (!value) {
+		return ast_json_writer_null(writer);
+	}
+	if (json_writer_value_start(writer)) {
+		return -1;
+	}
+	return json_writer_escaped(writer, value);
+}
+
+int ast_json_writer_integer(struct ast_json_writer *writer, intmax_t value)
+{
+	char buf[32];
+	int len;
+
+	if (json_writer_value_start(writer)) {
+		return -1;
+	}
+	len = snprintf(buf, sizeof(buf), "%jd", value);
+	return json_writer_append(writer, buf, len);
+}
+
+int ast_json_writer_null(struct ast_json_writer *writer)
+{
+	if (json_writer_value_start(writer)) {
+		return -1;
+	}
+	return json_writer_append(writer, "null", 4);
+}
+
+int ast_json_writer_value(struct ast_json_writer *writer, struct ast_json *value)
+{
+	if (!value) {
+		return ast_json_writer_null(writer);
+	}
+	if (json_writer_value_start(writer)) {
+		return -1;
+	}
+
+	{
+		SCOPED_JSON_LOCK(value);
+		/* Embedded values are always compact; they do not know their indentation */
+		if (json_dump_callback((json_t *)value, write_to_ast_str, writer->buf,
+			JSON_COMPACT | JSON_ENCODE_ANY)) {
+			return json_writer_fail(writer);
+		}
+	}
+	return 0;
+}
+
+int ast_json_writer_timeval(struct ast_json_writer *writer, const struct timeval tv,
+	const char *zone)
+{
+	char buf[AST_ISO8601_LEN];
+	struct ast_tm tm = {};
+
+	ast_localtime(&tv, &tm, zone);
+
+	ast_strftime(buf, sizeof(buf), AST_ISO8601_FORMAT, &tm);
+
+	return ast_json_writer_string(writer, buf);
+}
+
+int ast_json_writer_name_number(struct ast_json_writer *writer, const char *name,
+	const char *number)
+{
+	ast_json_writer_object_start(writer);
+	ast_json_writer_key(writer, "name");
+	ast_json_writer_string(writer, AST_JSON_UTF8_VALIDATE(name));
+	ast_json_writer_key(writer, "number");
+	ast_json_writer_string(writer, AST_JSON_UTF8_VALIDATE(number));
+	return ast_json_writer_object_end(writer);
+}
+
+int ast_json_writer_dialplan_cep(struct ast_json_writer *writer, const char *context,
+	const char *exten, int priority)
+{
+	ast_json_writer_object_start(writer);
+	ast_json_writer_key(writer, "context");
+	ast_json_writer_string(writer, context);
+	ast_json_writer_key(writer, "exten");
+	ast_json_writer_string(writer, exten);
+	ast_json_writer_key(writer, "priority");
+	if (priority != -1) {
+		ast_json_writer_integer(writer, priority);
+	} else {
+		ast_json_writer_null(writer);
+	}
+	return ast_json_writer_object_end(writer);
+}
+
 
 int ast_json_dump_file_format(struct ast_json *root, FILE *output, enum ast_json_encoding_format format)
 {
@@ -0,0 +1,434 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Hot path latency histograms
+ */
+
+/*** MODULEINFO
+	<support_level>core</support_level>
+ ***/
+
+/*** DOCUMENTATION
+	<manager name="CoreShowLatency" language="en_US">
+		<synopsis>
+			Show the latency recorded for each hot path stage.
+		</synopsis>
+		<syntax>
+			<xi:include xpointer="xpointer(/docs/manager[@name='Login']/syntax/parameter[@name='ActionID'])" />
+		</syntax>
+		<description>
+			<para>Lists the number of times each stage of frame and task handling
+			has run since startup or the last <literal>core reset latency</literal>,
+			with the mean, 50th, 99th and 99.9th percentile and maximum times in
+			microseconds.  Percentiles are the upper bound of the histogram bucket
+			they fall in, which is within 1/8th of the recorded time.</para>
+			<para>This action is only available when Asterisk is built with
+			LATENCY_STATS enabled in menuselect.</para>
+		</description>
+		<responses>
+			<list-elements>
+				<managerEvent name="CoreShowLatency" language="en_US">
+					<managerEventInstance class="EVENT_FLAG_SYSTEM">
+						<synopsis>Latency recorded for one stage.</synopsis>
+						<syntax>
+							<parameter name="Stage">
+								<para>The name of the stage.</para>
+							</parameter>
+							<parameter name="Count" />
+							<parameter name="MeanUsec" />
+							<parameter name="P50Usec" />
+							<parameter name="P99Usec" />
+							<parameter name="P999Usec" />
+							<parameter name="MaxUsec" />
+						</syntax>
+					</managerEventInstance>
+				</managerEvent>
+			</list-elements>
+			<managerEvent name="CoreShowLatencyComplete" language="en_US">
+				<managerEventInstance class="EVENT_FLAG_SYSTEM">
+					<synopsis>Raised at the end of the CoreShowLatency list.</synopsis>
+					<syntax>
+						<parameter name="EventList" />
+						<parameter name="ListItems" />
+					</syntax>
+				</managerEventInstance>
+			</managerEvent>
+		</responses>
+	</manager>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/_private.h"
+#include "asterisk/latency.h"
+
+#ifdef LATENCY_STATS
+
+#include "asterisk/cli.h"
+#include "asterisk/linkedlists.h"
+#include "asterisk/manager.h"
+#include "asterisk/threadstorage.h"
+
+/*! \brief Each power of two is split into 2^LATENCY_SUB_BITS buckets */
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+/*! \brief Enough buckets to hold any 32 bit number of microseconds */
+#define LATENCY_BUCKETS ((32 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+/*! \brief Latency histogram of one stage */
+struct latency_histogram {
+	/*! Total of the recorded times, in microseconds */
+	uint64_t total_us;
+	/*! Number of recorded times in each bucket */
+	unsigned int buckets[LATENCY_BUCKETS];
+};
+
+/*! \brief The histograms of one thread */
+struct latency_thread {
+	/*! Only written by the thread that owns them */
+	struct latency_histogram stages[AST_LATENCY_STAGE_MAX];
+	AST_LIST_ENTRY(latency_thread) list;
+};
+
+/*! \brief Every thread that has recorded latency */
+static AST_LIST_HEAD_STATIC(latency_threads, latency_thread);
+
+/*!
+ * \brief Histograms of threads that have exited
+ * \note Protected by the latency_threads lock
+ */
+static struct latency_histogram latency_retired[AST_LATENCY_STAGE_MAX];
+
+/*!
+ * \brief Totals when the histograms were last reset
+ * \note Protected by the latency_threads lock
+ */
+static struct latency_histogram latency_baseline[AST_LATENCY_STAGE_MAX];
+
+static const char *latency_stage_names[AST_LATENCY_STAGE_MAX] = {
+	[AST_LATENCY_CHANNEL_READ] = "channel_read",
+	[AST_LATENCY_CHANNEL_WRITE] = "channel_write",
+	[AST_LATENCY_TRANSLATE] = "translate",
+	[AST_LATENCY_BRIDGE_FRAME] = "bridge_frame",
+	[AST_LATENCY_SOFTMIX_MIX] = "softmix_mix",
+	[AST_LATENCY_TASKPROCESSOR_WAIT] = "taskprocessor_wait",
+};
+
+static int latency_thread_init(void *data)
+{
+	struct latency_thread *thread = data;
+
+	AST_LIST_LOCK(&latency_threads);
+	AST_LIST_INSERT_HEAD(&latency_threads, thread, list);
+	AST_LIST_UNLOCK(&latency_threads);
+
+	return 0;
+}
+
+/*! \brief Add the histograms of one set of stages to another */
+static void latency_add(struct latency_histogram *sum, const struct latency_histogram *stages)
+{
+	int stage;
+	int i;
+
+	for (stage = 0; stage < AST_LATENCY_STAGE_MAX; ++stage) {
+		sum[stage].total_us += stages[stage].total_us;
+		for (i = 0; i < LATENCY_BUCKETS; ++i) {
+			sum[stage].buckets[i] += stages[stage].buckets[i];
+		}
+	}
+}
+
+static void latency_thread_destroy(void *data)
+{
+	struct latency_thread *thread = data;
+
+	/* Keep what the thread recorded once it has gone */
+	AST_LIST_LOCK(&latency_threads);
+	AST_LIST_REMOVE(&latency_threads, thread, list);
+	latency_add(latency_retired, thread->stages);
+	AST_LIST_UNLOCK(&latency_threads);
+
+	ast_free(thread);
+}
+
+AST_THREADSTORAGE_CUSTOM(latency_thread_buf, latency_thread_init, latency_thread_destroy);
+
+/*! \brief Find the bucket a number of microseconds is counted in */
+static unsigned int latency_bucket(unsigned int us)
+{
+	unsigned int shift = 0;
+
+	if (us < LATENCY_SUB_BUCKETS) {
+		return us;
+	}
+	while ((us >> shift) >= 2 * LATENCY_SUB_BUCKETS) {
+		++shift;
+	}
+	return ((shift + 1) << LATENCY_SUB_BITS) + (us >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+/*! \brief Find the largest number of microseconds counted in a bucket */
+static unsigned int latency_bucket_max(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < LATENCY_SUB_BUCKETS) {
+		return bucket;
+	}
+	shift = (bucket >> LATENCY_SUB_BITS) - 1;
+	return ((LATENCY_SUB_BUCKETS + (bucket & (LATENCY_SUB_BUCKETS - 1))) << shift)
+		+ (1U << shift) - 1;
+}
+
+void ast_latency_record(enum ast_latency_stage stage, struct timeval start)
+{
+	struct latency_thread *thread;
+	struct latency_histogram *histogram;
+	int64_t us;
+
+	if (stage >= AST_LATENCY_STAGE_MAX
+		|| !(thread = ast_threadstorage_get(&latency_thread_buf, sizeof(*thread)))) {
+		return;
+	}
+
+	us = ast_tvdiff_us(ast_tvnow(), start);
+	if (us < 0) {
+		us = 0;
+	} else if (us > UINT_MAX) {
+		us = UINT_MAX;
+	}
+
+	histogram = &thread->stages[stage];
+	histogram->total_us += us;
+	++histogram->buckets[latency_bucket(us)];
+}
+
+/*!
+ * \brief Sum the histograms of every thread
+ *
+ * \note The counts of running threads are read while they may be written,
+ * so a time recorded at the same moment may be left out.
+ */
+static void latency_sum(struct latency_histogram *sum, int reset)
+{
+	struct latency_thread *thread;
+	int stage;
+	int i;
+
+	memset(sum, 0, sizeof(*sum) * AST_LATENCY_STAGE_MAX);
+
+	AST_LIST_LOCK(&latency_threads);
+	latency_add(sum, latency_retired);
+	AST_LIST_TRAVERSE(&latency_threads, thread, list) {
+		latency_add(sum, thread->stages);
+	}
+	if (reset) {
+		memcpy(latency_baseline, sum, sizeof(latency_baseline));
+	}
+	for (stage = 0; stage < AST_LATENCY_STAGE_MAX; ++stage) {
+		sum[stage].total_us -= latency_baseline[stage].total_us;
+		for (i = 0; i < LATENCY_BUCKETS; ++i) {
+			sum[stage].buckets[i] -= latency_baseline[stage].buckets[i];
+		}
+	}
+	AST_LIST_UNLOCK(&latency_threads);
+}
+
+/*! \brief Find the bucket holding the given per mille of the recorded times */
+static unsigned int latency_percentile(const struct latency_histogram *histogram,
+	uint64_t count, unsigned int per_mille)
+{
+	uint64_t wanted = (count * per_mille + 999) / 1000;
+	uint64_t seen = 0;
+	int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; ++i) {
+		seen += histogram->buckets[i];
+		if (seen && seen >= wanted) {
+			return latency_bucket_max(i);
+		}
+	}
+	return 0;
+}
+
+static void latency_summarize(const struct latency_histogram *histogram,
+	struct ast_latency_summary *summary)
+{
+	int i;
+
+	memset(summary, 0, sizeof(*summary));
+
+	for (i = 0; i < LATENCY_BUCKETS; ++i) {
+		if (histogram->buckets[i]) {
+			summary->count += histogram->buckets[i];
+			summary->max_us = latency_bucket_max(i);
+		}
+	}
+	if (!summary->count) {
+		return;
+	}
+	summary->total_us = histogram->total_us;
+	summary->mean_us = histogram->total_us / summary->count;
+	summary->p50_us = latency_percentile(histogram, summary->count, 500);
+	summary->p99_us = latency_percentile(histogram, summary->count, 990);
+	summary->p999_us = latency_percentile(histogram, summary->count, 999);
+}
+
+void ast_latency_get_summaries(struct ast_latency_summary summaries[AST_LATENCY_STAGE_MAX])
+{
+	struct latency_histogram sum[AST_LATENCY_STAGE_MAX];
+	int stage;
+
+	latency_sum(sum, 0);
+	for (stage = 0; stage < AST_LATENCY_STAGE_MAX; ++stage) {
+		latency_summarize(&sum[stage], &summaries[stage]);
+	}
+}
+
+const char *ast_latency_stage_name(enum ast_latency_stage stage)
+{
+	return stage < AST_LATENCY_STAGE_MAX ? latency_stage_names[stage] : "unknown";
+}
+
+static char *handle_show_latency(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct latency_histogram sum[AST_LATENCY_STAGE_MAX];
+	struct ast_latency_summary summary;
+	int stage;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show latency";
+		e->usage =
+			"Usage: core show latency\n"
+			"       Shows how many times each hot path stage has run since startup\n"
+			"       or the last 'core reset latency', and the mean, 50th, 99th and\n"
+			"       99.9th percentile and maximum times in microseconds.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args) {
+		return CLI_SHOWUSAGE;
+	}
+
+	latency_sum(sum, 0);
+
+	ast_cli(a->fd, "%-20s %12s %10s %10s %10s %10s %10s\n",
+		"Stage", "Count", "Mean", "P50", "P99", "P99.9", "Max");
+	for (stage = 0; stage < AST_LATENCY_STAGE_MAX; ++stage) {
+		latency_summarize(&sum[stage], &summary);
+		ast_cli(a->fd, "%-20s %12" PRIu64 " %10u %10u %10u %10u %10u\n",
+			latency_stage_names[stage], summary.count, summary.mean_us,
+			summary.p50_us, summary.p99_us, summary.p999_us, summary.max_us);
+	}
+
+	return CLI_SUCCESS;
+}
+
+static char *handle_reset_latency(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct latency_histogram sum[AST_LATENCY_STAGE_MAX];
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core reset latency";
+		e->usage =
+			"Usage: core reset latency\n"
+			"       Clears the latency shown by 'core show latency'.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args) {
+		return CLI_SHOWUSAGE;
+	}
+
+	latency_sum(sum, 1);
+	ast_cli(a->fd, "Latency statistics reset\n");
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_latency[] = {
+	AST_CLI_DEFINE(handle_show_latency, "Show hot path latency"),
+	AST_CLI_DEFINE(handle_reset_latency, "Reset hot path latency"),
+};
+
+static int action_coreshowlatency(struct mansession *s, const struct message *m)
+{
+	const char *actionid = astman_get_header(m, "ActionID");
+	struct latency_histogram sum[AST_LATENCY_STAGE_MAX];
+	struct ast_latency_summary summary;
+	char idText[256] = "";
+	int stage;
+
+	if (!ast_strlen_zero(actionid)) {
+		snprintf(idText, sizeof(idText), "ActionID: %s\r\n", actionid);
+	}
+
+	latency_sum(sum, 0);
+
+	astman_send_listack(s, m, "Latency will follow", "start");
+	for (stage = 0; stage < AST_LATENCY_STAGE_MAX; ++stage) {
+		latency_summarize(&sum[stage], &summary);
+		astman_append(s,
+			"Event: CoreShowLatency\r\n"
+			"%s"
+			"Stage: %s\r\n"
+			"Count: %" PRIu64 "\r\n"
+			"MeanUsec: %u\r\n"
+			"P50Usec: %u\r\n"
+			"P99Usec: %u\r\n"
+			"P999Usec: %u\r\n"
+			"MaxUsec: %u\r\n"
+			"\r\n",
+			idText, latency_stage_names[stage], summary.count, summary.mean_us,
+			summary.p50_us, summary.p99_us, summary.p999_us, summary.max_us);
+	}
+	astman_send_list_complete_start(s, m, "CoreShowLatencyComplete", AST_LATENCY_STAGE_MAX);
+	astman_send_list_complete_end(s);
+
+	return 0;
+}
+
+static void latency_shutdown(void)
+{
+	ast_cli_unregister_multiple(cli_latency, ARRAY_LEN(cli_latency));
+	ast_manager_unregister("CoreShowLatency");
+}
+
+int ast_latency_init(void)
+{
+	ast_register_cleanup(latency_shutdown);
+	ast_cli_register_multiple(cli_latency, ARRAY_LEN(cli_latency));
+	return ast_manager_register_xml_core("CoreShowLatency", EVENT_FLAG_SYSTEM | EVENT_FLAG_REPORTING,
+		action_coreshowlatency);
+}
+
+#else  /* !defined(LATENCY_STATS) */
+int ast_latency_init(void)
+{
+	return 0;
+}
+#endif /* defined(LATENCY_STATS) */
@@ -124,6 +124,7 @@ struct ast_module {
 #endif
 	void *lib;					/* the shared lib, or NULL if embedded */
 	int usecount;					/* the number of 'users' currently in this module */
+	int64_t load_usec;				/* how long the load function last took */
 	struct module_user_list users;			/* the list of users in the module */
 	struct {
 		unsigned int running:1;
@@ -979,6 +980,7 @@ static enum ast_module_load_result start_resource(struct ast_module *mod)
 {
 	char tmp[256];
 	enum ast_module_load_result res;
+	struct timeval start;
 
 	if (mod->flags.running) {
 		return AST_MODULE_LOAD_SUCCESS;
@@ -991,7 +993,9 @@ static enum ast_module_load_result start_resource(struct ast_module *mod)
 	if (!ast_fully_booted) {
 		ast_verb(1, "Loading %s.\n", mod->resource);
 	}
+	start = ast_tvnow();
 	res = mod->info->load();
+	mod->load_usec = ast_tvdiff_us(ast_tvnow(), start);
 
 	switch (res) {
 	case AST_MODULE_LOAD_SUCCESS:
@@ -1460,6 +1464,24 @@ int ast_update_module_list_data(int (*modentry)(const char *module, const char *
 	return total_mod_loaded;
 }
 
+int ast_module_list_load_times(int (*modentry)(const char *module, int64_t usec, void *data),
+                               void *data)
+{
+	struct ast_module *cur;
+	int count = 0;
+
+	AST_DLLIST_LOCK(&module_list);
+	AST_DLLIST_TRAVERSE(&module_list, cur, entry) {
+		if (cur->flags.running || cur->flags.declined) {
+			modentry(cur->resource, cur->load_usec, data);
+			++count;
+		}
+	}
+	AST_DLLIST_UNLOCK(&module_list);
+
+	return count;
+}
+
 int ast_update_module_list_condition(int (*modentry)(const char *module, const char *description,
                                                      int usecnt, const char *status,
                                                      const char *like,
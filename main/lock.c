@@ -31,6 +31,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #include "asterisk/utils.h"
 #include "asterisk/lock.h"
+#include "asterisk/linkedlists.h"
+#include "asterisk/time.h"
+#include "asterisk/cli.h"
+#include "asterisk/_private.h"
 
 /* Allow direct use of pthread_mutex_* / pthread_cond_* */
 #undef pthread_mutex_init
@@ -122,6 +126,268 @@ static inline void delete_reentrancy_cs(struct ast_lock_track **plt)
 
 #endif /* DEBUG_THREADS */
 
+/*!
+ * \brief Call sites a thread can record lock contention for
+ *
+ * A power of two, and enough for the locks one thread takes in practice.
+ */
+#define LOCK_CONTENTION_SITES 256
+
+/*! \brief Call sites the threads together can record, a power of two */
+#define LOCK_CONTENTION_ALL_SITES 1024
+
+/*! \brief Slots probed for the call site before a sample is dropped */
+#define LOCK_CONTENTION_PROBES 8
+
+/*! \brief Upper bounds of the wait time histogram buckets, in microseconds */
+static const unsigned int lock_contention_bounds[] = { 10, 100, 1000, 10000, 100000 };
+
+/*! \brief Lock contention sampled at one call site */
+struct lock_contention_site {
+	/*! Call site, file is NULL if the slot is free */
+	const char *file;
+	const char *func;
+	int line;
+	/*! Lock calls sampled */
+	unsigned int samples;
+	/*! Sampled lock calls that had to wait */
+	unsigned int waits;
+	/*! Longest wait, in microseconds */
+	unsigned int max_us;
+	/*! Total wait, in microseconds */
+	uint64_t wait_us;
+	/*! Waits in each bucket of lock_contention_bounds, with one for longer waits */
+	unsigned int buckets[ARRAY_LEN(lock_contention_bounds) + 1];
+};
+
+/*!
+ * \brief Lock contention sampled by one thread
+ *
+ * Only the thread writes to it.  'core show lock contention' reads it while
+ * the thread runs, so what it shows can be slightly off.
+ */
+struct lock_contention_thread {
+	/*! Profiling run the sites belong to */
+	unsigned int generation;
+	/*! Lock calls since the last one sampled */
+	unsigned int tick;
+	/*! Samples dropped because the table was full */
+	unsigned int dropped;
+	struct lock_contention_site sites[LOCK_CONTENTION_SITES];
+	AST_LIST_ENTRY(lock_contention_thread) entry;
+};
+
+/*! \brief Sample one lock call in this many, 0 if profiling is off */
+static volatile unsigned int lock_contention_rate;
+
+/*! \brief Bumped whenever profiling is turned on, to start over */
+static volatile unsigned int lock_contention_generation;
+
+/*!
+ * \brief Threads sampling lock contention, and what exited threads sampled
+ *
+ * Guarded by lock_contention_lock, which is always used with the underlying
+ * pthread calls since it is taken from within the Asterisk mutex code.
+ * Nothing else may be locked while holding it.
+ */
+static AST_LIST_HEAD_NOLOCK_STATIC(lock_contention_threads, lock_contention_thread);
+static struct lock_contention_site lock_contention_exited[LOCK_CONTENTION_ALL_SITES];
+static unsigned int lock_contention_exited_dropped;
+AST_MUTEX_DEFINE_STATIC(lock_contention_lock);
+
+static pthread_key_t lock_contention_key;
+static pthread_once_t lock_contention_once = AST_PTHREAD_ONCE_INIT;
+
+static unsigned int lock_contention_hash(const char *file, int line)
+{
+	return ((uintptr_t) file >> 3) ^ (line * 2654435761U);
+}
+
+/*!
+ * \internal
+ * \brief Find or claim the slot of a call site in a table
+ *
+ * \return NULL if the table is full around where the site belongs
+ */
+static struct lock_contention_site *lock_contention_site_get(struct lock_contention_site *sites,
+	unsigned int size, const char *file, int line, const char *func)
+{
+	unsigned int hash = lock_contention_hash(file, line);
+	int i;
+
+	for (i = 0; i < LOCK_CONTENTION_PROBES; i++) {
+		struct lock_contention_site *site = &sites[(hash + i) & (size - 1)];
+
+		if (!site->file) {
+			site->func = func;
+			site->line = line;
+			site->file = file;
+			return site;
+		}
+		if (site->file == file && site->line == line) {
+			return site;
+		}
+	}
+
+	return NULL;
+}
+
+static void lock_contention_site_merge(struct lock_contention_site *to, const struct lock_contention_site *from)
+{
+	int i;
+
+	to->samples += from->samples;
+	to->waits += from->waits;
+	to->wait_us += from->wait_us;
+	to->max_us = MAX(to->max_us, from->max_us);
+	for (i = 0; i < ARRAY_LEN(to->buckets); i++) {
+		to->buckets[i] += from->buckets[i];
+	}
+}
+
+/*!
+ * \internal
+ * \brief Add the sites of one table to another
+ *
+ * \return Samples that did not fit
+ */
+static unsigned int lock_contention_merge(struct lock_contention_site *to, unsigned int to_size,
+	const struct lock_contention_site *from, unsigned int from_size)
+{
+	unsigned int dropped = 0;
+	int i;
+
+	for (i = 0; i < from_size; i++) {
+		const struct lock_contention_site *site = &from[i];
+		struct lock_contention_site *merged;
+
+		if (!site->file) {
+			continue;
+		}
+		merged = lock_contention_site_get(to, to_size, site->file, site->line, site->func);
+		if (merged) {
+			lock_contention_site_merge(merged, site);
+		} else {
+			dropped += site->samples;
+		}
+	}
+
+	return dropped;
+}
+
+static void lock_contention_thread_exit(void *data)
+{
+	struct lock_contention_thread *thr = data;
+
+	pthread_mutex_lock(&lock_contention_lock.mutex);
+	AST_LIST_REMOVE(&lock_contention_threads, thr, entry);
+	if (thr->generation == lock_contention_generation) {
+		lock_contention_exited_dropped += thr->dropped + lock_contention_merge(lock_contention_exited,
+			LOCK_CONTENTION_ALL_SITES, thr->sites, LOCK_CONTENTION_SITES);
+	}
+	pthread_mutex_unlock(&lock_contention_lock.mutex);
+
+	ast_std_free(thr);
+}
+
+static void lock_contention_key_init(void)
+{
+	pthread_key_create(&lock_contention_key, lock_contention_thread_exit);
+}
+
+/*!
+ * \internal
+ * \brief Slow path of lock_contention_sample()
+ */
+static struct lock_contention_thread *lock_contention_sample_thread(unsigned int rate)
+{
+	struct lock_contention_thread *thr;
+
+	pthread_once(&lock_contention_once, lock_contention_key_init);
+	thr = pthread_getspecific(lock_contention_key);
+	if (!thr) {
+		/* Not ast_calloc(), which may take a lock itself */
+		thr = ast_std_calloc(1, sizeof(*thr));
+		if (!thr) {
+			return NULL;
+		}
+		thr->generation = lock_contention_generation;
+		pthread_setspecific(lock_contention_key, thr);
+		pthread_mutex_lock(&lock_contention_lock.mutex);
+		AST_LIST_INSERT_HEAD(&lock_contention_threads, thr, entry);
+		pthread_mutex_unlock(&lock_contention_lock.mutex);
+	}
+
+	if (++thr->tick < rate) {
+		return NULL;
+	}
+	thr->tick = 0;
+
+	if (thr->generation != lock_contention_generation) {
+		memset(thr->sites, 0, sizeof(thr->sites));
+		thr->dropped = 0;
+		thr->generation = lock_contention_generation;
+	}
+	return thr;
+}
+
+/*!
+ * \internal
+ * \brief Decide whether to sample a lock call
+ *
+ * \return The sampling thread if the call is to be sampled, else NULL
+ */
+static force_inline struct lock_contention_thread *lock_contention_sample(void)
+{
+	unsigned int rate = lock_contention_rate;
+
+	return rate ? lock_contention_sample_thread(rate) : NULL;
+}
+
+/*!
+ * \internal
+ * \brief Record a sampled lock call
+ *
+ * \param start When the call started waiting, or ast_tv(0, 0) if the lock was free
+ */
+static void lock_contention_record(struct lock_contention_thread *thr,
+	const char *file, int line, const char *func, struct timeval start)
+{
+	struct lock_contention_site *site;
+	int64_t wait_us;
+	int i;
+
+	site = lock_contention_site_get(thr->sites, LOCK_CONTENTION_SITES, file, line, func);
+	if (!site) {
+		++thr->dropped;
+		return;
+	}
+
+	++site->samples;
+	if (ast_tvzero(start)) {
+		return;
+	}
+
+	wait_us = ast_tvdiff_us(ast_tvnow(), start);
+	++site->waits;
+	site->wait_us += wait_us;
+	site->max_us = MAX(site->max_us, wait_us);
+	for (i = 0; i < ARRAY_LEN(lock_contention_bounds) && wait_us >= lock_contention_bounds[i]; i++) {
+	}
+	++site->buckets[i];
+}
+
+static int lock_contention_site_cmp(const void *left, const void *right)
+{
+	const struct lock_contention_site *a = left;
+	const struct lock_contention_site *b = right;
+
+	if (a->wait_us != b->wait_us) {
+		return a->wait_us < b->wait_us ? 1 : -1;
+	}
+	return a->waits < b->waits ? 1 : a->waits > b->waits ? -1 : 0;
+}
+
 int __ast_pthread_mutex_init(int tracking, const char *filename, int lineno, const char *func,
 						const char *mutex_name, ast_mutex_t *t)
 {
@@ -234,6 +500,9 @@ int __ast_pthread_mutex_lock(const char *filename, int lineno, const char *func,
 				const char* mutex_name, ast_mutex_t *t)
 {
 	int res;
+#if !defined(DETECT_DEADLOCKS) || !defined(DEBUG_THREADS)
+	struct lock_contention_thread *contention;
+#endif
 
 #ifdef DEBUG_THREADS
 	struct ast_lock_track *lt = NULL;
@@ -306,13 +575,25 @@ int __ast_pthread_mutex_lock(const char *filename, int lineno, const char *func,
 		} while (res == EBUSY);
 	}
 #else /* !DETECT_DEADLOCKS || !DEBUG_THREADS */
+	contention = lock_contention_sample();
+	if (contention) {
+		struct timeval start = { 0, };
+
+		res = pthread_mutex_trylock(&t->mutex);
+		if (res == EBUSY) {
+			start = ast_tvnow();
+			res = pthread_mutex_lock(&t->mutex);
+		}
+		lock_contention_record(contention, filename, lineno, func, start);
+	} else {
 #ifdef	HAVE_MTX_PROFILE
-	ast_mark(mtx_prof, 1);
-	res = pthread_mutex_trylock(&t->mutex);
-	ast_mark(mtx_prof, 0);
-	if (res)
+		ast_mark(mtx_prof, 1);
+		res = pthread_mutex_trylock(&t->mutex);
+		ast_mark(mtx_prof, 0);
+		if (res)
 #endif
-	res = pthread_mutex_lock(&t->mutex);
+		res = pthread_mutex_lock(&t->mutex);
+	}
 #endif /* !DETECT_DEADLOCKS || !DEBUG_THREADS */
 
 #ifdef DEBUG_THREADS
@@ -842,6 +1123,9 @@ int __ast_rwlock_unlock(const char *filename, int line, const char *func, ast_rw
 int __ast_rwlock_rdlock(const char *filename, int line, const char *func, ast_rwlock_t *t, const char *name)
 {
 	int res;
+#if !defined(DETECT_DEADLOCKS) || !defined(DEBUG_THREADS)
+	struct lock_contention_thread *contention;
+#endif
 
 #ifdef DEBUG_THREADS
 	struct ast_lock_track *lt = NULL;
@@ -908,7 +1192,19 @@ int __ast_rwlock_rdlock(const char *filename, int line, const char *func, ast_rw
 		} while (res == EBUSY);
 	}
 #else /* !DETECT_DEADLOCKS || !DEBUG_THREADS */
-	res = pthread_rwlock_rdlock(&t->lock);
+	contention = lock_contention_sample();
+	if (contention) {
+		struct timeval start = { 0, };
+
+		res = pthread_rwlock_tryrdlock(&t->lock);
+		if (res == EBUSY) {
+			start = ast_tvnow();
+			res = pthread_rwlock_rdlock(&t->lock);
+		}
+		lock_contention_record(contention, filename, line, func, start);
+	} else {
+		res = pthread_rwlock_rdlock(&t->lock);
+	}
 #endif /* !DETECT_DEADLOCKS || !DEBUG_THREADS */
 
 #ifdef DEBUG_THREADS
@@ -951,6 +1247,9 @@ int __ast_rwlock_rdlock(const char *filename, int line, const char *func, ast_rw
 int __ast_rwlock_wrlock(const char *filename, int line, const char *func, ast_rwlock_t *t, const char *name)
 {
 	int res;
+#if !defined(DETECT_DEADLOCKS) || !defined(DEBUG_THREADS)
+	struct lock_contention_thread *contention;
+#endif
 
 #ifdef DEBUG_THREADS
 	struct ast_lock_track *lt = NULL;
@@ -1017,7 +1316,19 @@ int __ast_rwlock_wrlock(const char *filename, int line, const char *func, ast_rw
 		} while (res == EBUSY);
 	}
 #else /* !DETECT_DEADLOCKS || !DEBUG_THREADS */
-	res = pthread_rwlock_wrlock(&t->lock);
+	contention = lock_contention_sample();
+	if (contention) {
+		struct timeval start = { 0, };
+
+		res = pthread_rwlock_trywrlock(&t->lock);
+		if (res == EBUSY) {
+			start = ast_tvnow();
+			res = pthread_rwlock_wrlock(&t->lock);
+		}
+		lock_contention_record(contention, filename, line, func, start);
+	} else {
+		res = pthread_rwlock_wrlock(&t->lock);
+	}
 #endif /* !DETECT_DEADLOCKS || !DEBUG_THREADS */
 
 #ifdef DEBUG_THREADS
@@ -1359,3 +1670,151 @@ int __ast_rwlock_trywrlock(const char *filename, int line, const char *func, ast
 
 	return res;
 }
+
+static char *handle_set_lock_contention(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	static const char * const choices[] = { "on", "off", NULL };
+	unsigned int rate = 10;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core set lock contention";
+		e->usage =
+			"Usage: core set lock contention {on [<rate>]|off}\n"
+			"       Turn sampling of lock contention on or off.  One lock call in\n"
+			"       <rate>, 10 by default, is sampled: it is timed if the lock was\n"
+			"       taken and the wait is recorded against its file and line.\n"
+			"       Turning it on discards what was sampled before.\n"
+			"       See 'core show lock contention'.\n";
+		return NULL;
+	case CLI_GENERATE:
+		if (a->pos == 4) {
+			return ast_cli_complete(a->word, choices, a->n);
+		}
+		return NULL;
+	}
+
+	if (a->argc < 5 || a->argc > 6) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (!strcasecmp(a->argv[4], "off") && a->argc == 5) {
+		lock_contention_rate = 0;
+		ast_cli(a->fd, "Lock contention sampling is off\n");
+		return CLI_SUCCESS;
+	}
+	if (strcasecmp(a->argv[4], "on")
+		|| (a->argc == 6 && (sscanf(a->argv[5], "%30u", &rate) != 1 || !rate))) {
+		return CLI_SHOWUSAGE;
+	}
+
+	pthread_mutex_lock(&lock_contention_lock.mutex);
+	memset(lock_contention_exited, 0, sizeof(lock_contention_exited));
+	lock_contention_exited_dropped = 0;
+	++lock_contention_generation;
+	pthread_mutex_unlock(&lock_contention_lock.mutex);
+	lock_contention_rate = rate;
+
+	ast_cli(a->fd, "Sampling one lock call in %u for contention\n", rate);
+	return CLI_SUCCESS;
+}
+
+static char *handle_show_lock_contention(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT_HEADER "%-40s %8s %7s %10s %8s %8s  %6s %6s %6s %6s %6s %6s\n"
+#define FORMAT_ROW "%-40.40s %8u %6.2f%% %10.3f %8" PRIu64 " %8u  %6u %6u %6u %6u %6u %6u\n"
+	struct lock_contention_site *sites;
+	struct lock_contention_thread *thr;
+	unsigned int count = 20;
+	unsigned int dropped;
+	unsigned int generation;
+	int threads = 0;
+	int i;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show lock contention";
+		e->usage =
+			"Usage: core show lock contention [<count>]\n"
+			"       Show the <count> call sites, 20 by default, that waited the\n"
+			"       longest for locks in the sampled lock calls, with how often\n"
+			"       they had to wait and how long the waits were.\n"
+			"       See 'core set lock contention'.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc > 5 || (a->argc == 5 && (sscanf(a->argv[4], "%30u", &count) != 1 || !count))) {
+		return CLI_SHOWUSAGE;
+	}
+
+	/* Allocated up front since nothing may be locked under lock_contention_lock */
+	sites = ast_calloc(LOCK_CONTENTION_ALL_SITES, sizeof(*sites));
+	if (!sites) {
+		return CLI_FAILURE;
+	}
+
+	pthread_mutex_lock(&lock_contention_lock.mutex);
+	generation = lock_contention_generation;
+	dropped = lock_contention_exited_dropped + lock_contention_merge(sites, LOCK_CONTENTION_ALL_SITES,
+		lock_contention_exited, LOCK_CONTENTION_ALL_SITES);
+	AST_LIST_TRAVERSE(&lock_contention_threads, thr, entry) {
+		if (thr->generation != generation) {
+			continue;
+		}
+		++threads;
+		dropped += thr->dropped + lock_contention_merge(sites, LOCK_CONTENTION_ALL_SITES,
+			thr->sites, LOCK_CONTENTION_SITES);
+	}
+	pthread_mutex_unlock(&lock_contention_lock.mutex);
+
+	qsort(sites, LOCK_CONTENTION_ALL_SITES, sizeof(*sites), lock_contention_site_cmp);
+
+	if (lock_contention_rate) {
+		ast_cli(a->fd, "Sampling one lock call in %u, %d threads sampled\n", lock_contention_rate, threads);
+	} else {
+		ast_cli(a->fd, "Lock contention sampling is off\n");
+	}
+	if (dropped) {
+		ast_cli(a->fd, "%u samples dropped for lack of room\n", dropped);
+	}
+	ast_cli(a->fd, "\n" FORMAT_HEADER, "Call site", "Samples", "Waited", "Total ms", "Avg us", "Max us",
+		"<10us", "<100us", "<1ms", "<10ms", "<100ms", "Longer");
+	for (i = 0; i < count && i < LOCK_CONTENTION_ALL_SITES && sites[i].waits; i++) {
+		struct lock_contention_site *site = &sites[i];
+		char where[80];
+
+		snprintf(where, sizeof(where), "%s:%d %s", site->file, site->line, S_OR(site->func, ""));
+		ast_cli(a->fd, FORMAT_ROW, where, site->samples, 100.0 * site->waits / site->samples,
+			site->wait_us / 1000.0, site->wait_us / site->waits, site->max_us,
+			site->buckets[0], site->buckets[1], site->buckets[2], site->buckets[3],
+			site->buckets[4], site->buckets[5]);
+	}
+	if (!i) {
+		ast_cli(a->fd, "No lock contention sampled\n");
+	}
+
+	ast_free(sites);
+	return CLI_SUCCESS;
+#undef FORMAT_HEADER
+#undef FORMAT_ROW
+}
+
+static struct ast_cli_entry lock_cli[] = {
+	AST_CLI_DEFINE(handle_set_lock_contention, "Turn lock contention sampling on or off"),
+	AST_CLI_DEFINE(handle_show_lock_contention, "Show the call sites waiting the longest for locks"),
+};
+
+static void lock_contention_shutdown(void)
+{
+	lock_contention_rate = 0;
+	ast_cli_unregister_multiple(lock_cli, ARRAY_LEN(lock_cli));
+}
+
+int ast_lock_contention_init(void)
+{
+	ast_cli_register_multiple(lock_cli, ARRAY_LEN(lock_cli));
+	ast_register_cleanup(lock_contention_shutdown);
+	return 0;
+}
@@ -69,6 +69,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/buildinfo.h"
 #include "asterisk/ast_version.h"
 #include "asterisk/backtrace.h"
+#include "asterisk/logger_binary.h"
+#include "asterisk/vector.h"
 
 /*** DOCUMENTATION
  ***/
@@ -79,6 +81,10 @@ static char queue_log_name[256] = QUEUELOG;
 static char exec_after_rotate[256] = "";
 
 static int filesize_reload_needed;
+/*! \brief Size in bytes at which binary log files are rotated, 0 to never rotate them */
+static off_t binary_maxsize;
+/*! \brief Set by the logger thread when a binary log file has grown past binary_maxsize */
+static int binary_rotate_needed;
 static unsigned int global_logmask = 0xFFFF;
 static int queuelog_init;
 static int logger_initialized;
@@ -86,6 +92,9 @@ static volatile int next_unique_callid; /* Used to assign unique call_ids to cal
 static int display_callids;
 static void unique_callid_cleanup(void *data);
 
+/*! \brief Default size, in megabytes, at which binary log files are rotated */
+#define DEFAULT_BINARY_MAXSIZE 64
+
 static int logger_queue_size;
 static int logger_queue_limit = 1000;
 static int logger_messages_discarded;
@@ -93,8 +102,13 @@ static unsigned int high_water_alert;
 
 struct ast_callid {
 	int call_identifier; /* Numerical value of the call displayed in the logs */
+	unsigned int debug_level; /* Debug level of the messages logged for the call */
 };
 
+/*! \brief Callids with a debug level set, not holding a reference */
+static AST_VECTOR(, struct ast_callid *) debug_callids;
+AST_MUTEX_DEFINE_STATIC(debug_callids_lock);
+
 AST_THREADSTORAGE_CUSTOM(unique_callid, NULL, unique_callid_cleanup);
 
 static enum rotatestrategy {
@@ -118,6 +132,7 @@ enum logtypes {
 	LOGTYPE_SYSLOG,
 	LOGTYPE_FILE,
 	LOGTYPE_CONSOLE,
+	LOGTYPE_BINARY,
 };
 
 struct logchannel {
@@ -158,6 +173,8 @@ struct logmsg {
 	int line;
 	int lwp;
 	struct ast_callid *callid;
+	/*! When the message was logged. The date is formatted from it by the logger thread */
+	struct timeval when;
 	AST_DECLARE_STRING_FIELDS(
 		AST_STRING_FIELD(date);
 		AST_STRING_FIELD(file);
@@ -177,11 +194,23 @@ static void logmsg_free(struct logmsg *msg)
 	ast_free(msg);
 }
 
-static AST_LIST_HEAD_STATIC(logmsgs, logmsg);
+/*!
+ * \brief Messages waiting for the logger thread, most recent first
+ *
+ * Messages are pushed with a compare and swap, so logging threads never wait
+ * on each other or on the logger thread. The logger thread takes the whole
+ * stack at once.
+ */
+static struct logmsg *logmsgs;
+/*! \brief Lock the logger thread holds while it waits for messages */
+AST_MUTEX_DEFINE_STATIC(logmsgs_lock);
 static pthread_t logthread = AST_PTHREADT_NULL;
 static ast_cond_t logcond;
 static int close_logger_thread = 0;
 
+/*! \brief The number of messages the logger thread handles between flushes of the log files */
+#define LOGGER_FLUSH_INTERVAL 64
+
 static FILE *qlog;
 
 /*! \brief Logging channels used in the Asterisk logging system
@@ -315,6 +344,11 @@ static void make_filename(const char *channel, char *filename, size_t size)
 		return;
 	}
 
+	/* Binary channels are files too, "binary:" just selects the format */
+	if (!strncasecmp(channel, "binary:", 7)) {
+		channel += 7;
+	}
+
 	/* It's a filename */
 
 	if (channel[0] != '/') {
@@ -331,6 +365,21 @@ static void make_filename(const char *channel, char *filename, size_t size)
 	}
 }
 
+static const char *logchannel_type_name(const struct logchannel *chan)
+{
+	switch (chan->type) {
+	case LOGTYPE_CONSOLE:
+		return "Console";
+	case LOGTYPE_SYSLOG:
+		return "Syslog";
+	case LOGTYPE_BINARY:
+		return "Binary";
+	case LOGTYPE_FILE:
+		break;
+	}
+	return "File";
+}
+
 /*!
  * \brief Find a particular logger channel by name
  *
@@ -356,6 +405,40 @@ static struct logchannel *find_logchannel(const char *channel)
 	return NULL;
 }
 
+/*!
+ * \internal
+ * \brief Open the file of a binary log channel, writing the file header if it is new
+ *
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+static int logger_open_binary(struct logchannel *chan)
+{
+	struct ast_logger_binary_header header = {
+		.magic = AST_LOGGER_BINARY_MAGIC,
+		.version = AST_LOGGER_BINARY_VERSION,
+		.record_size = sizeof(struct ast_logger_binary_record),
+	};
+	struct stat st;
+
+	if (!(chan->fileptr = fopen(chan->filename, "ab"))) {
+		return -1;
+	}
+
+	if (fstat(fileno(chan->fileptr), &st) || st.st_size > 0) {
+		/* Appending to an existing file, which already has its header */
+		return 0;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, chan->fileptr) != 1 || fflush(chan->fileptr)) {
+		fclose(chan->fileptr);
+		chan->fileptr = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
 static struct logchannel *make_logchannel(const char *channel, const char *components, int lineno, int dynamic)
 {
 	struct logchannel *chan;
@@ -395,6 +478,19 @@ static struct logchannel *make_logchannel(const char *channel, const char *compo
 
 		chan->type = LOGTYPE_SYSLOG;
 		openlog("asterisk", LOG_PID, chan->facility);
+	} else if (!strncasecmp(channel, "binary:", 7)) {
+		/*
+		 * syntax is:
+		 *  binary:filename => level,level,level
+		 */
+		if (ast_strlen_zero(channel + 7) || logger_open_binary(chan)) {
+			ast_console_puts_mutable("ERROR: Unable to open binary log file '", __LOG_ERROR);
+			ast_console_puts_mutable(chan->filename, __LOG_ERROR);
+			ast_console_puts_mutable("'\n", __LOG_ERROR);
+			ast_free(chan);
+			return NULL;
+		}
+		chan->type = LOGTYPE_BINARY;
 	} else {
 		if (!(chan->fileptr = fopen(chan->filename, "a"))) {
 			/* Can't do real logging here since we're called with a lock
@@ -455,6 +551,7 @@ static int init_logger_chain(int locked, const char *altconf)
 	ast_copy_string(queue_log_name, QUEUELOG, sizeof(queue_log_name));
 	exec_after_rotate[0] = '\0';
 	rotatestrategy = SEQUENTIAL;
+	binary_maxsize = (off_t) DEFAULT_BINARY_MAXSIZE * 1024 * 1024;
 
 	/* delete our list of log channels */
 	while ((chan = AST_RWLIST_REMOVE_HEAD(&logchannels, list))) {
@@ -537,6 +634,16 @@ static int init_logger_chain(int locked, const char *altconf)
 			fprintf(stderr, "rotatetimestamp option has been deprecated.  Please use rotatestrategy instead.\n");
 		}
 	}
+	if ((s = ast_variable_retrieve(cfg, "general", "binary_maxsize"))) {
+		unsigned int maxsize;
+
+		if (sscanf(s, "%30u", &maxsize) == 1) {
+			binary_maxsize = (off_t) maxsize * 1024 * 1024;
+		} else {
+			fprintf(stderr, "binary_maxsize has an invalid value.  Leaving at default of %d.\n",
+				DEFAULT_BINARY_MAXSIZE);
+		}
+	}
 	if ((s = ast_variable_retrieve(cfg, "general", "logger_queue_limit"))) {
 		if (sscanf(s, "%30d", &logger_queue_limit) != 1) {
 			fprintf(stderr, "logger_queue_limit has an invalid value.  Leaving at default of %d.\n",
@@ -917,6 +1024,9 @@ static int reload_logger(int rotate, const char *altconf)
 			if (rotatestrategy != NONE && ftello(f->fileptr) > 0x40000000) { /* Arbitrarily, 1 GB */
 				/* Be more proactive about rotating massive log files */
 				rotate_this = 1;
+			} else if (rotatestrategy != NONE && f->type == LOGTYPE_BINARY && binary_maxsize
+				&& ftello(f->fileptr) >= binary_maxsize) {
+				rotate_this = 1;
 			}
 			fclose(f->fileptr);	/* Close file */
 			f->fileptr = NULL;
@@ -927,6 +1037,7 @@ static int reload_logger(int rotate, const char *altconf)
 	}
 
 	filesize_reload_needed = 0;
+	binary_rotate_needed = 0;
 
 	init_logger_chain(1 /* locked */, altconf);
 
@@ -1098,8 +1209,7 @@ int ast_logger_get_channels(int (*logentry)(const char *channel, const char *typ
 			}
 		}
 
-		res = logentry(chan->filename, chan->type == LOGTYPE_CONSOLE ? "Console" :
-			(chan->type == LOGTYPE_SYSLOG ? "Syslog" : "File"), chan->disabled ?
+		res = logentry(chan->filename, logchannel_type_name(chan), chan->disabled ?
 			"Disabled" : "Enabled", ast_str_buffer(configs), data);
 
 		if (res) {
@@ -1141,7 +1251,7 @@ static char *handle_logger_show_channels(struct ast_cli_entry *e, int cmd, struc
 	AST_RWLIST_TRAVERSE(&logchannels, chan, list) {
 		unsigned int level;
 
-		ast_cli(a->fd, FORMATL, chan->filename, chan->type == LOGTYPE_CONSOLE ? "Console" : (chan->type == LOGTYPE_SYSLOG ? "Syslog" : "File"),
+		ast_cli(a->fd, FORMATL, chan->filename, logchannel_type_name(chan),
 			chan->disabled ? "Disabled" : "Enabled");
 		ast_cli(a->fd, " - ");
 		for (level = 0; level < ARRAY_LEN(levels); level++) {
@@ -1379,6 +1489,50 @@ static char *logger_strip_verbose_magic(const char *message, int level)
 }
 
 /*! \brief Print a normal log message to the channels */
+/*!
+ * \internal
+ * \brief Append a message to a binary log channel
+ *
+ * The message is stored as it was logged, without date formatting or
+ * stripping of terminal escapes, so utils/astlogdecode can render it later.
+ *
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+static int logger_write_binary(struct logchannel *chan, struct logmsg *logmsg)
+{
+	struct ast_logger_binary_record record = {
+		.magic = AST_LOGGER_BINARY_RECORD_MAGIC,
+		.tv_sec = logmsg->when.tv_sec,
+		.tv_usec = logmsg->when.tv_usec,
+		.level = logmsg->level,
+		.lwp = logmsg->lwp,
+		.callid = logmsg->callid ? logmsg->callid->call_identifier : 0,
+		.line = logmsg->line,
+		.message_len = strlen(logmsg->message),
+		.file_len = MIN(strlen(logmsg->file), UINT16_MAX),
+		.function_len = MIN(strlen(logmsg->function), UINT16_MAX),
+		.level_name_len = MIN(strlen(logmsg->level_name), UINT16_MAX),
+	};
+
+	record.len = sizeof(record) + record.file_len + record.function_len
+		+ record.level_name_len + record.message_len;
+
+	if (fwrite(&record, sizeof(record), 1, chan->fileptr) != 1
+		|| fwrite(logmsg->file, 1, record.file_len, chan->fileptr) != record.file_len
+		|| fwrite(logmsg->function, 1, record.function_len, chan->fileptr) != record.function_len
+		|| fwrite(logmsg->level_name, 1, record.level_name_len, chan->fileptr) != record.level_name_len
+		|| fwrite(logmsg->message, 1, record.message_len, chan->fileptr) != record.message_len) {
+		return -1;
+	}
+
+	if (rotatestrategy != NONE && binary_maxsize && ftello(chan->fileptr) >= binary_maxsize) {
+		binary_rotate_needed = 1;
+	}
+
+	return 0;
+}
+
 static void logger_print_normal(struct logmsg *logmsg)
 {
 	struct logchannel *chan = NULL;
@@ -1482,7 +1636,21 @@ static void logger_print_normal(struct logmsg *logmsg)
 					***/
 					manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
 					chan->disabled = 1;
-				} else if (res > 0) {
+				} else if (res > 0 && logthread == AST_PTHREADT_NULL) {
+					/* The logger thread flushes once per batch of messages */
+					fflush(chan->fileptr);
+				}
+			/* Binary channels */
+			} else if (chan->type == LOGTYPE_BINARY && (chan->logmask & (1 << logmsg->level))) {
+				if (!chan->fileptr) {
+					continue;
+				}
+
+				if (logger_write_binary(chan, logmsg)) {
+					fprintf(stderr, "Logger Warning: Unable to write to binary log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
+					manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
+					chan->disabled = 1;
+				} else if (logthread == AST_PTHREADT_NULL) {
 					fflush(chan->fileptr);
 				}
 			}
@@ -1497,6 +1665,10 @@ static void logger_print_normal(struct logmsg *logmsg)
 	if (filesize_reload_needed) {
 		reload_logger(-1, NULL);
 		ast_verb(1, "Rotated Logs Per SIGXFSZ (Exceeded file size limit)\n");
+	} else if (binary_rotate_needed) {
+		/* Only the binary files that are over their size get rotated */
+		reload_logger(0, NULL);
+		ast_verb(1, "Rotated binary logs (Exceeded binary_maxsize)\n");
 	}
 
 	return;
@@ -1508,10 +1680,7 @@ static struct logmsg * __attribute__((format(printf, 6, 0))) format_log_message_
 {
 	struct logmsg *logmsg = NULL;
 	struct ast_str *buf = NULL;
-	struct ast_tm tm;
-	struct timeval now = ast_tvnow();
 	int res = 0;
-	char datestring[256];
 
 	if (!(buf = ast_str_thread_get(&log_buf, LOG_BUF_INIT_SIZE))) {
 		return NULL;
@@ -1545,10 +1714,8 @@ static struct logmsg * __attribute__((format(printf, 6, 0))) format_log_message_
 		/* callid will be unreffed at logmsg destruction */
 	}
 
-	/* Create our date/time */
-	ast_localtime(&now, &tm, NULL);
-	ast_strftime(datestring, sizeof(datestring), dateformat, &tm);
-	ast_string_field_set(logmsg, date, datestring);
+	/* The date is formatted when the message is printed */
+	logmsg->when = ast_tvnow();
 
 	/* Copy over data */
 	logmsg->level = level;
@@ -1575,50 +1742,139 @@ static struct logmsg * __attribute__((format(printf, 6, 0))) format_log_message(
 	return logmsg;
 }
 
+/*!
+ * \brief Set the date of a message from when it was logged
+ *
+ * \param logmsg The message
+ * \param cache Non-zero if the date of the previous message may be reused. Only
+ *        the logger thread may use the cache.
+ */
+static void logmsg_set_date(struct logmsg *logmsg, int cache)
+{
+	static char cached_date[256];
+	static char cached_format[256];
+	static time_t cached_sec = -1;
+	struct ast_tm tm;
+	char datestring[256];
+
+	/* Messages logged in the same second get the same date, unless the format
+	 * has fractions of a second in it.
+	 */
+	if (cache && logmsg->when.tv_sec == cached_sec
+		&& !strcmp(cached_format, dateformat)) {
+		ast_string_field_set(logmsg, date, cached_date);
+		return;
+	}
+
+	ast_localtime(&logmsg->when, &tm, NULL);
+	ast_strftime(datestring, sizeof(datestring), dateformat, &tm);
+	ast_string_field_set(logmsg, date, datestring);
+
+	if (cache && !strchr(dateformat, 'q')) {
+		ast_copy_string(cached_date, datestring, sizeof(cached_date));
+		ast_copy_string(cached_format, dateformat, sizeof(cached_format));
+		cached_sec = logmsg->when.tv_sec;
+	}
+}
+
+/*! \brief Hand a message to the logger thread */
+static void logmsg_push(struct logmsg *logmsg)
+{
+	struct logmsg *head = __atomic_load_n(&logmsgs, __ATOMIC_RELAXED);
+
+	ast_atomic_fetchadd_int(&logger_queue_size, +1);
+	do {
+		AST_LIST_NEXT(logmsg, list) = head;
+	} while (!__atomic_compare_exchange_n(&logmsgs, &head, logmsg, 1,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* Only the first message after the logger thread emptied the stack needs
+	 * to wake it up.
+	 */
+	if (!head) {
+		ast_mutex_lock(&logmsgs_lock);
+		ast_cond_signal(&logcond);
+		ast_mutex_unlock(&logmsgs_lock);
+	}
+}
+
+/*! \brief Write out what has been buffered for the log files */
+static void logger_flush_files(void)
+{
+	struct logchannel *chan;
+
+	AST_RWLIST_RDLOCK(&logchannels);
+	AST_RWLIST_TRAVERSE(&logchannels, chan, list) {
+		if ((chan->type == LOGTYPE_FILE || chan->type == LOGTYPE_BINARY) && chan->fileptr) {
+			fflush(chan->fileptr);
+		}
+	}
+	AST_RWLIST_UNLOCK(&logchannels);
+}
+
 /*! \brief Actual logging thread */
 static void *logger_thread(void *data)
 {
 	struct logmsg *next = NULL, *msg = NULL;
+	struct logmsg *stack;
+	int discarded;
+	int count;
 
 	for (;;) {
-		/* We lock the message list, and see if any message exists... if not we wait on the condition to be signalled */
-		AST_LIST_LOCK(&logmsgs);
-		if (AST_LIST_EMPTY(&logmsgs)) {
-			if (close_logger_thread) {
-				AST_LIST_UNLOCK(&logmsgs);
-				break;
-			} else {
-				ast_cond_wait(&logcond, &logmsgs.lock);
-			}
+		/* See if any message exists... if not we wait on the condition to be signalled */
+		ast_mutex_lock(&logmsgs_lock);
+		while (!__atomic_load_n(&logmsgs, __ATOMIC_ACQUIRE) && !close_logger_thread) {
+			ast_cond_wait(&logcond, &logmsgs_lock);
 		}
+		ast_mutex_unlock(&logmsgs_lock);
 
-		if (high_water_alert) {
-			msg = format_log_message(__LOG_WARNING, "logger", 0, "***", NULL,
-				"Logging resumed.  %d message%s discarded.\n",
-				logger_messages_discarded, logger_messages_discarded == 1 ? "" : "s");
-			if (msg) {
-				AST_LIST_INSERT_TAIL(&logmsgs, msg, list);
-			}
-			high_water_alert = 0;
-			logger_messages_discarded = 0;
+		/* Take every waiting message, and put them back in the order they were logged */
+		stack = __atomic_exchange_n(&logmsgs, NULL, __ATOMIC_ACQUIRE);
+		if (!stack) {
+			break;
 		}
+		next = NULL;
+		count = 0;
+		while ((msg = stack)) {
+			stack = AST_LIST_NEXT(msg, list);
+			AST_LIST_NEXT(msg, list) = next;
+			next = msg;
+			count++;
+		}
+		ast_atomic_fetchadd_int(&logger_queue_size, -count);
 
-		next = AST_LIST_FIRST(&logmsgs);
-		AST_LIST_HEAD_INIT_NOLOCK(&logmsgs);
-		logger_queue_size = 0;
-		AST_LIST_UNLOCK(&logmsgs);
-
-		/* Otherwise go through and process each message in the order added */
+		/* Go through and process each message in the order added */
+		count = 0;
 		while ((msg = next)) {
 			/* Get the next entry now so that we can free our current structure later */
 			next = AST_LIST_NEXT(msg, list);
 
 			/* Depending on the type, send it to the proper function */
+			logmsg_set_date(msg, 1);
 			logger_print_normal(msg);
 
 			/* Free the data since we are done */
 			logmsg_free(msg);
+
+			if (++count % LOGGER_FLUSH_INTERVAL == 0) {
+				logger_flush_files();
+			}
 		}
+
+		if (__atomic_load_n(&high_water_alert, __ATOMIC_RELAXED)) {
+			discarded = __atomic_exchange_n(&logger_messages_discarded, 0, __ATOMIC_RELAXED);
+			msg = format_log_message(__LOG_WARNING, "logger", 0, "***", NULL,
+				"Logging resumed.  %d message%s discarded.\n",
+				discarded, discarded == 1 ? "" : "s");
+			if (msg) {
+				logmsg_set_date(msg, 1);
+				logger_print_normal(msg);
+				logmsg_free(msg);
+			}
+			__atomic_store_n(&high_water_alert, 0, __ATOMIC_RELAXED);
+		}
+
+		logger_flush_files();
 	}
 
 	return NULL;
@@ -1697,8 +1953,8 @@ int init_logger(void)
  	 * the thread that unlocks the mutex.  Since init_logger is called after the
  	 * fork, it is safe to initialize the mutex here for future accesses.
  	 */
-	ast_mutex_destroy(&logmsgs.lock);
-	ast_mutex_init(&logmsgs.lock);
+	ast_mutex_destroy(&logmsgs_lock);
+	ast_mutex_init(&logmsgs_lock);
 	ast_cond_init(&logcond, NULL);
 
 	/* start logger thread */
@@ -1727,20 +1983,28 @@ void close_logger(void)
 {
 	struct logchannel *f = NULL;
 	struct verb *cur = NULL;
+	struct logmsg *msg;
+	struct logmsg *next;
 
 	ast_cli_unregister_multiple(cli_logger, ARRAY_LEN(cli_logger));
 
 	logger_initialized = 0;
 
 	/* Stop logger thread */
-	AST_LIST_LOCK(&logmsgs);
+	ast_mutex_lock(&logmsgs_lock);
 	close_logger_thread = 1;
 	ast_cond_signal(&logcond);
-	AST_LIST_UNLOCK(&logmsgs);
+	ast_mutex_unlock(&logmsgs_lock);
 
 	if (logthread != AST_PTHREADT_NULL)
 		pthread_join(logthread, NULL);
 
+	/* Messages pushed while the thread was exiting are not logged */
+	for (msg = __atomic_exchange_n(&logmsgs, NULL, __ATOMIC_ACQUIRE); msg; msg = next) {
+		next = AST_LIST_NEXT(msg, list);
+		logmsg_free(msg);
+	}
+
 	AST_RWLIST_WRLOCK(&verbosers);
 	while ((cur = AST_LIST_REMOVE_HEAD(&verbosers, list))) {
 		ast_free(cur);
@@ -1772,11 +2036,72 @@ void ast_callid_strnprint(char *buffer, size_t buffer_size, struct ast_callid *c
 	snprintf(buffer, buffer_size, "[C-%08x]", (unsigned)callid->call_identifier);
 }
 
+static void callid_destructor(void *obj)
+{
+	struct ast_callid *callid = obj;
+
+	if (callid->debug_level) {
+		ast_callid_debug_set(callid, 0);
+	}
+}
+
+void ast_callid_debug_set(struct ast_callid *callid, unsigned int level)
+{
+	ast_mutex_lock(&debug_callids_lock);
+	if (level && !callid->debug_level) {
+		if (AST_VECTOR_APPEND(&debug_callids, callid)) {
+			ast_mutex_unlock(&debug_callids_lock);
+			return;
+		}
+	} else if (!level && callid->debug_level) {
+		AST_VECTOR_REMOVE_ELEM_UNORDERED(&debug_callids, callid, AST_VECTOR_ELEM_CLEANUP_NOOP);
+	}
+	callid->debug_level = level;
+
+	if (AST_VECTOR_SIZE(&debug_callids)) {
+		ast_set_flag(&ast_options, AST_OPT_FLAG_DEBUG_CALLID);
+	} else {
+		ast_clear_flag(&ast_options, AST_OPT_FLAG_DEBUG_CALLID);
+	}
+	ast_mutex_unlock(&debug_callids_lock);
+}
+
+unsigned int ast_callid_debug_get(struct ast_callid *callid)
+{
+	return callid->debug_level;
+}
+
+void ast_callid_debug_clear_all(void)
+{
+	int i;
+
+	ast_mutex_lock(&debug_callids_lock);
+	for (i = 0; i < AST_VECTOR_SIZE(&debug_callids); i++) {
+		AST_VECTOR_GET(&debug_callids, i)->debug_level = 0;
+	}
+	AST_VECTOR_RESET(&debug_callids, AST_VECTOR_ELEM_CLEANUP_NOOP);
+	ast_clear_flag(&ast_options, AST_OPT_FLAG_DEBUG_CALLID);
+	ast_mutex_unlock(&debug_callids_lock);
+}
+
+unsigned int ast_debug_get_by_callid(void)
+{
+	struct ast_callid **callid;
+
+	/* Only called while some call is debugged, so the cost stays off the hot path */
+	callid = ast_threadstorage_get(&unique_callid, sizeof(*callid));
+	if (callid && *callid) {
+		return (*callid)->debug_level;
+	}
+
+	return 0;
+}
+
 struct ast_callid *ast_create_callid(void)
 {
 	struct ast_callid *call;
 
-	call = ao2_alloc_options(sizeof(*call), NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	call = ao2_alloc_options(sizeof(*call), callid_destructor, AO2_ALLOC_OPT_LOCK_NOLOCK);
 	if (!call) {
 		ast_log(LOG_ERROR, "Could not allocate callid struct.\n");
 		return NULL;
@@ -1941,39 +2266,35 @@ static void __attribute__((format(printf, 6, 0))) ast_log_full(int level, const
 		return;
 	}
 
-	AST_LIST_LOCK(&logmsgs);
-	if (logger_queue_size >= logger_queue_limit && !close_logger_thread) {
-		logger_messages_discarded++;
-		if (!high_water_alert && !close_logger_thread) {
+	/* Count what we can't queue rather than waiting for the logger thread */
+	if (logthread != AST_PTHREADT_NULL && !close_logger_thread
+		&& __atomic_load_n(&logger_queue_size, __ATOMIC_RELAXED) >= logger_queue_limit) {
+		ast_atomic_fetchadd_int(&logger_messages_discarded, +1);
+		if (!__atomic_exchange_n(&high_water_alert, 1, __ATOMIC_RELAXED)) {
 			logmsg = format_log_message(__LOG_WARNING, "logger", 0, "***", NULL,
 				"Log queue threshold (%d) exceeded.  Discarding new messages.\n", logger_queue_limit);
-			AST_LIST_INSERT_TAIL(&logmsgs, logmsg, list);
-			high_water_alert = 1;
-			ast_cond_signal(&logcond);
+			if (logmsg) {
+				logmsg_push(logmsg);
+			}
 		}
-		AST_LIST_UNLOCK(&logmsgs);
 		return;
 	}
-	AST_LIST_UNLOCK(&logmsgs);
 
 	logmsg = format_log_message_ap(level, file, line, function, callid, fmt, ap);
 	if (!logmsg) {
 		return;
 	}
 
-	/* If the logger thread is active, append it to the tail end of the list - otherwise skip that step */
+	/* If the logger thread is active, hand it the message - otherwise skip that step */
 	if (logthread != AST_PTHREADT_NULL) {
-		AST_LIST_LOCK(&logmsgs);
 		if (close_logger_thread) {
 			/* Logger is either closing or closed.  We cannot log this message. */
 			logmsg_free(logmsg);
 		} else {
-			AST_LIST_INSERT_TAIL(&logmsgs, logmsg, list);
-			logger_queue_size++;
-			ast_cond_signal(&logcond);
+			logmsg_push(logmsg);
 		}
-		AST_LIST_UNLOCK(&logmsgs);
 	} else {
+		logmsg_set_date(logmsg, 0);
 		logger_print_normal(logmsg);
 		logmsg_free(logmsg);
 	}
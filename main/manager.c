@@ -101,6 +101,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/format_cache.h"
 #include "asterisk/translate.h"
 #include "asterisk/taskprocessor.h"
+#include "asterisk/threadpool.h"
 
 /*** DOCUMENTATION
 	<manager name="Ping" language="en_US">
@@ -1401,6 +1402,34 @@ enum add_filter_result {
 	FILTER_COMPILE_FAIL,
 };
 
+/*! \brief How an event filter is matched against the event text */
+enum event_filter_match {
+	/*! The filter is a regular expression */
+	FILTER_MATCH_REGEX,
+	/*! The filter is literal text that has to appear anywhere in the event */
+	FILTER_MATCH_CONTAINS,
+	/*! The filter is literal text the event has to start with */
+	FILTER_MATCH_PREFIX,
+};
+
+/*!
+ * \brief An event filter.
+ *
+ * Most filters are plain text such as "Event: Newstate" or
+ * "Channel: PJSIP/.*".  These are matched with a string search instead of
+ * running the regular expression engine for every event.
+ */
+struct event_filter {
+	/*! How the filter is matched */
+	enum event_filter_match match;
+	/*! The compiled filter, only for FILTER_MATCH_REGEX */
+	regex_t regex;
+	/*! Length of text */
+	size_t len;
+	/*! The literal text to match */
+	char text[0];
+};
+
 /*!
  * Linked list of events.
  * Global events are appended to the list by append_event().
@@ -1442,6 +1471,7 @@ static int webmanager_enabled = 0;
 static int manager_debug = 0;	/*!< enable some debugging code in the manager */
 static int authtimeout;
 static int authlimit;
+static int eventbatchinterval;
 static char *manager_channelvars;
 
 #define DEFAULT_REALM		"asterisk"
@@ -1564,6 +1594,8 @@ struct mansession_session {
 	struct ast_variable *chanvars;  /*!< Channel variables to set for originate */
 	int send_events;	/*!<  XXX what ? */
 	struct eventqent *last_ev;	/*!< last event processed. */
+	struct ast_str *eventbuf;	/*!< Events taken from the queue but not yet written */
+	struct timeval eventbuf_tv;	/*!< When the first event in eventbuf was queued */
 	int writetimeout;	/*!< Timeout for ast_carefulwrite() */
 	time_t authstart;
 	int pending_event;         /*!< Pending events indicator in case when waiting_thread is NULL */
@@ -1587,6 +1619,8 @@ enum mansession_message_parsing {
 struct mansession {
 	struct mansession_session *session;
 	struct ast_tcptls_session_instance *tcptls_session;
+	enum ast_transport transport;	/*!< Transport of a session without tcptls_session */
+	struct ast_sockaddr local_address;	/*!< Local address of a session without tcptls_session */
 	FILE *f;
 	int fd;
 	enum mansession_message_parsing parsing;
@@ -2144,8 +2178,11 @@ static struct mansession_session *unref_mansession(struct mansession_session *s)
 
 static void event_filter_destructor(void *obj)
 {
-	regex_t *regex_filter = obj;
-	regfree(regex_filter);
+	struct event_filter *filter = obj;
+
+	if (filter->match == FILTER_MATCH_REGEX) {
+		regfree(&filter->regex);
+	}
 }
 
 static void session_destructor(void *obj)
@@ -2167,6 +2204,7 @@ static void session_destructor(void *obj)
 	if (eqe) {
 		ast_atomic_fetchadd_int(&eqe->usecount, -1);
 	}
+	ast_free(session->eventbuf);
 	if (session->chanvars) {
 		ast_variables_destroy(session->chanvars);
 	}
@@ -2908,6 +2946,34 @@ int ast_hook_send_action(struct manager_custom_hook *hook, const char *msg)
 }
 
 
+/*!
+ * \internal
+ * \brief Write the events batched up for a session to its socket.
+ *
+ * \note The session must be locked.
+ *
+ * \retval 0 on success or if there was nothing to write
+ * \retval -1 on error
+ */
+static int flush_events(struct mansession *s)
+{
+	struct ast_str *buf = s->session->eventbuf;
+	int res;
+
+	if (!buf || !ast_str_strlen(buf)) {
+		return 0;
+	}
+
+	res = ast_careful_fwrite(s->session->f, s->session->fd, ast_str_buffer(buf),
+		ast_str_strlen(buf), s->session->writetimeout);
+	ast_str_reset(buf);
+	if (res) {
+		s->write_error = 1;
+	}
+
+	return res;
+}
+
 /*!
  * helper function to send a string to the socket.
  * Return -1 on error (e.g. buffer full).
@@ -2928,6 +2994,13 @@ static int send_string(struct mansession *s, char *string)
 		return 0;
 	}
 
+	/* Events that have already been taken off the queue go out first */
+	if (f == s->session->f) {
+		ao2_lock(s->session);
+		flush_events(s);
+		ao2_unlock(s->session);
+	}
+
 	if ((res = ast_careful_fwrite(f, fd, string, strlen(string), s->session->writetimeout))) {
 		s->write_error = 1;
 	}
@@ -3117,10 +3190,18 @@ static int set_eventmask(struct mansession *s, const char *eventmask)
 
 static enum ast_transport mansession_get_transport(const struct mansession *s)
 {
+	if (!s->tcptls_session) {
+		return s->transport;
+	}
 	return s->tcptls_session->parent->tls_cfg ? AST_TRANSPORT_TLS :
 			AST_TRANSPORT_TCP;
 }
 
+static const struct ast_sockaddr *mansession_get_local_address(const struct mansession *s)
+{
+	return s->tcptls_session ? &s->tcptls_session->parent->local_address : &s->local_address;
+}
+
 static void report_invalid_user(const struct mansession *s, const char *username)
 {
 	char session_id[32];
@@ -3131,7 +3212,7 @@ static void report_invalid_user(const struct mansession *s, const char *username
 		.common.account_id = username,
 		.common.session_tv = &s->session->sessionstart_tv,
 		.common.local_addr = {
-			.addr      = &s->tcptls_session->parent->local_address,
+			.addr      = mansession_get_local_address(s),
 			.transport = mansession_get_transport(s),
 		},
 		.common.remote_addr = {
@@ -3156,7 +3237,7 @@ static void report_failed_acl(const struct mansession *s, const char *username)
 		.common.account_id = username,
 		.common.session_tv = &s->session->sessionstart_tv,
 		.common.local_addr = {
-			.addr      = &s->tcptls_session->parent->local_address,
+			.addr      = mansession_get_local_address(s),
 			.transport = mansession_get_transport(s),
 		},
 		.common.remote_addr = {
@@ -3181,7 +3262,7 @@ static void report_inval_password(const struct mansession *s, const char *userna
 		.common.account_id = username,
 		.common.session_tv = &s->session->sessionstart_tv,
 		.common.local_addr = {
-			.addr      = &s->tcptls_session->parent->local_address,
+			.addr      = mansession_get_local_address(s),
 			.transport = mansession_get_transport(s),
 		},
 		.common.remote_addr = {
@@ -3206,7 +3287,7 @@ static void report_auth_success(const struct mansession *s)
 		.common.account_id = s->session->username,
 		.common.session_tv = &s->session->sessionstart_tv,
 		.common.local_addr = {
-			.addr      = &s->tcptls_session->parent->local_address,
+			.addr      = mansession_get_local_address(s),
 			.transport = mansession_get_transport(s),
 		},
 		.common.remote_addr = {
@@ -3232,7 +3313,7 @@ static void report_req_not_allowed(const struct mansession *s, const char *actio
 		.common.account_id = s->session->username,
 		.common.session_tv = &s->session->sessionstart_tv,
 		.common.local_addr = {
-			.addr      = &s->tcptls_session->parent->local_address,
+			.addr      = mansession_get_local_address(s),
 			.transport = mansession_get_transport(s),
 		},
 		.common.remote_addr = {
@@ -3261,7 +3342,7 @@ static void report_req_bad_format(const struct mansession *s, const char *action
 		.common.account_id = s->session->username,
 		.common.session_tv = &s->session->sessionstart_tv,
 		.common.local_addr = {
-			.addr      = &s->tcptls_session->parent->local_address,
+			.addr      = mansession_get_local_address(s),
 			.transport = mansession_get_transport(s),
 		},
 		.common.remote_addr = {
@@ -3290,7 +3371,7 @@ static void report_failed_challenge_response(const struct mansession *s,
 		.common.account_id = s->session->username,
 		.common.session_tv = &s->session->sessionstart_tv,
 		.common.local_addr = {
-			.addr      = &s->tcptls_session->parent->local_address,
+			.addr      = mansession_get_local_address(s),
 			.transport = mansession_get_transport(s),
 		},
 		.common.remote_addr = {
@@ -3319,7 +3400,7 @@ static void report_session_limit(const struct mansession *s)
 		.common.account_id = s->session->username,
 		.common.session_tv = &s->session->sessionstart_tv,
 		.common.local_addr = {
-			.addr      = &s->tcptls_session->parent->local_address,
+			.addr      = mansession_get_local_address(s),
 			.transport = mansession_get_transport(s),
 		},
 		.common.remote_addr = {
@@ -3347,7 +3428,7 @@ static int authenticate(struct mansession *s, const struct message *m)
 	const char *password = astman_get_header(m, "Secret");
 	int error = -1;
 	struct ast_manager_user *user = NULL;
-	regex_t *regex_filter;
+	struct event_filter *regex_filter;
 	struct ao2_iterator filter_iter;
 
 	if (ast_strlen_zero(username)) {	/* missing username */
@@ -5078,6 +5159,9 @@ static void destroy_fast_originate_helper(struct fast_originate_helper *doomed)
 	ast_free(doomed);
 }
 
+/*! \brief Threads waiting for the outcome of asynchronous originates */
+static struct ast_threadpool *originate_pool;
+
 static void *fast_originate(void *data)
 {
 	struct fast_originate_helper *in = data;
@@ -5158,6 +5242,27 @@ static void *fast_originate(void *data)
 	return NULL;
 }
 
+static int fast_originate_task(void *data)
+{
+	fast_originate(data);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Run fast_originate() on another thread, reusing the threads of earlier originates
+ */
+static int fast_originate_start(struct fast_originate_helper *fast)
+{
+	pthread_t th;
+
+	if (originate_pool && !ast_threadpool_push(originate_pool, fast_originate_task, fast)) {
+		return 0;
+	}
+
+	return ast_pthread_create_detached(&th, NULL, fast_originate, fast);
+}
+
 static int aocmessage_get_unit_entry(const struct message *m, struct ast_aoc_unit_entry *entry, unsigned int entry_num)
 {
 	const char *unitamount;
@@ -5417,7 +5522,6 @@ static int action_originate(struct mansession *s, const struct message *m)
 	char tmp[256];
 	char tmp2[256];
 	struct ast_format_cap *cap = ast_format_cap_alloc(AST_FORMAT_CAP_FLAG_DEFAULT);
-	pthread_t th;
 	int bridge_early = 0;
 
 	if (!cap) {
@@ -5563,7 +5667,7 @@ static int action_originate(struct mansession *s, const struct message *m)
 			fast->timeout = to;
 			fast->early_media = bridge_early;
 			fast->priority = pi;
-			if (ast_pthread_create_detached(&th, NULL, fast_originate, fast)) {
+			if (fast_originate_start(fast)) {
 				destroy_fast_originate_helper(fast);
 				res = -1;
 			} else {
@@ -5742,13 +5846,34 @@ static int action_timeout(struct mansession *s, const struct message *m)
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Determine whether an event filter matches an event.
+ *
+ * \retval 1 if the filter matches
+ * \retval 0 if it does not
+ */
+static int event_filter_matches(const struct event_filter *filter, const char *eventdata)
+{
+	switch (filter->match) {
+	case FILTER_MATCH_CONTAINS:
+		return strstr(eventdata, filter->text) != NULL;
+	case FILTER_MATCH_PREFIX:
+		return !strncmp(eventdata, filter->text, filter->len);
+	case FILTER_MATCH_REGEX:
+		break;
+	}
+
+	return !regexec(&filter->regex, eventdata, 0, NULL, 0);
+}
+
 static int whitefilter_cmp_fn(void *obj, void *arg, void *data, int flags)
 {
-	regex_t *regex_filter = obj;
+	struct event_filter *filter = obj;
 	const char *eventdata = arg;
 	int *result = data;
 
-	if (!regexec(regex_filter, eventdata, 0, NULL, 0)) {
+	if (event_filter_matches(filter, eventdata)) {
 		*result = 1;
 		return (CMP_MATCH | CMP_STOP);
 	}
@@ -5758,11 +5883,11 @@ static int whitefilter_cmp_fn(void *obj, void *arg, void *data, int flags)
 
 static int blackfilter_cmp_fn(void *obj, void *arg, void *data, int flags)
 {
-	regex_t *regex_filter = obj;
+	struct event_filter *filter = obj;
 	const char *eventdata = arg;
 	int *result = data;
 
-	if (!regexec(regex_filter, eventdata, 0, NULL, 0)) {
+	if (event_filter_matches(filter, eventdata)) {
 		*result = 0;
 		return (CMP_MATCH | CMP_STOP);
 	}
@@ -5826,14 +5951,60 @@ static int action_filter(struct mansession *s, const struct message *m)
  * \endcode
  *
  */
-static enum add_filter_result manager_add_filter(const char *filter_pattern, struct ao2_container *whitefilters, struct ao2_container *blackfilters) {
-	regex_t *new_filter = ao2_t_alloc(sizeof(*new_filter), event_filter_destructor, "event_filter allocation");
-	int is_blackfilter;
+/*!
+ * \internal
+ * \brief Determine whether a filter is literal text.
+ *
+ * A filter is literal if it contains no regular expression operators other
+ * than a leading '^' and a trailing ".*", which do not change what it
+ * matches when it is searched for as text.  Operators escaped with a
+ * backslash are taken literally.
+ *
+ * \param pattern The filter
+ * \param text Receives the literal text of the filter, must be at least as
+ * long as pattern
+ * \param match Receives how the text is to be matched
+ *
+ * \retval 1 if the filter is literal
+ * \retval 0 if it needs the regular expression engine
+ */
+static int event_filter_literal(const char *pattern, char *text, enum event_filter_match *match)
+{
+	size_t len = strlen(pattern);
 
-	if (!new_filter) {
-		return FILTER_ALLOC_FAILED;
+	*match = FILTER_MATCH_CONTAINS;
+	if (*pattern == '^') {
+		*match = FILTER_MATCH_PREFIX;
+		++pattern;
+		--len;
+	}
+	if (len >= 2 && !strcmp(pattern + len - 2, ".*")
+		&& (len == 2 || pattern[len - 3] != '\\')) {
+		len -= 2;
 	}
 
+	for (; len; ++pattern, --len) {
+		if (*pattern == '\\') {
+			/* Only escaped punctuation is known to be literal */
+			if (len < 2 || isalnum((unsigned char) pattern[1])) {
+				return 0;
+			}
+			++pattern;
+			--len;
+		} else if (strchr(".[]()*+?{}|^$", *pattern)) {
+			return 0;
+		}
+		*text++ = *pattern;
+	}
+	*text = '\0';
+
+	return 1;
+}
+
+static enum add_filter_result manager_add_filter(const char *filter_pattern, struct ao2_container *whitefilters, struct ao2_container *blackfilters) {
+	struct event_filter *new_filter;
+	int is_blackfilter;
+
 	if (filter_pattern[0] == '!') {
 		is_blackfilter = 1;
 		filter_pattern++;
@@ -5841,9 +6012,22 @@ static enum add_filter_result manager_add_filter(const char *filter_pattern, str
 		is_blackfilter = 0;
 	}
 
-	if (regcomp(new_filter, filter_pattern, REG_EXTENDED | REG_NOSUB)) {
-		ao2_t_ref(new_filter, -1, "failed to make regex");
-		return FILTER_COMPILE_FAIL;
+	new_filter = ao2_t_alloc(sizeof(*new_filter) + strlen(filter_pattern) + 1,
+		event_filter_destructor, "event_filter allocation");
+	if (!new_filter) {
+		return FILTER_ALLOC_FAILED;
+	}
+
+	if (event_filter_literal(filter_pattern, new_filter->text, &new_filter->match)) {
+		new_filter->len = strlen(new_filter->text);
+	} else {
+		new_filter->match = FILTER_MATCH_REGEX;
+		if (regcomp(&new_filter->regex, filter_pattern, REG_EXTENDED | REG_NOSUB)) {
+			/* Don't let the destructor free a regex that was never compiled */
+			new_filter->match = FILTER_MATCH_CONTAINS;
+			ao2_t_ref(new_filter, -1, "failed to make regex");
+			return FILTER_COMPILE_FAIL;
+		}
 	}
 
 	if (is_blackfilter) {
@@ -5886,36 +6070,120 @@ static int match_filter(struct mansession *s, char *eventdata)
 	return result;
 }
 
+/*! \brief Most events taken from the queue in one pass */
+#define EVENT_BATCH_MAX_EVENTS 64
+
+/*! \brief Batched events are written once there are at least this many bytes */
+#define EVENT_BATCH_MAX_SIZE 65536
+
+/*!
+ * \internal
+ * \brief How long a session may wait before its batched events are due.
+ *
+ * \note The session must be locked.
+ *
+ * \retval -1 if no events are batched
+ * \retval 0 if the batched events are due to be written
+ * \return the number of milliseconds until they are due otherwise
+ */
+static int event_batch_timeout(struct mansession_session *session)
+{
+	int remaining;
+
+	if (!session->eventbuf || !ast_str_strlen(session->eventbuf)) {
+		return -1;
+	}
+
+	remaining = eventbatchinterval - ast_tvdiff_ms(ast_tvnow(), session->eventbuf_tv);
+	return remaining > 0 ? remaining : 0;
+}
+
 /*!
  * Send any applicable events to the client listening on this socket.
  * Wait only for a finite time on each event, and drop all events whether
  * they are successfully sent or not.
+ *
+ * Events are taken from the queue up to EVENT_BATCH_MAX_EVENTS at a time
+ * with a single lock of the queue, and the ones the session wants are
+ * collected into the session's event buffer.  The buffer is written in a
+ * single write once it is full or the first event in it has waited
+ * eventbatchinterval milliseconds.
  */
 static int process_events(struct mansession *s)
 {
+	struct mansession_session *session = s->session;
+	struct eventqent *batch[EVENT_BATCH_MAX_EVENTS];
+	struct eventqent *eqe;
+	struct eventqent *next;
+	int examined;
+	int count;
+	int i;
+	int closing = 0;
 	int ret = 0;
 
-	ao2_lock(s->session);
-	if (s->session->f != NULL) {
-		struct eventqent *eqe = s->session->last_ev;
+	ao2_lock(session);
+	if (session->f == NULL) {
+		ao2_unlock(session);
+		return 0;
+	}
 
-		while ((eqe = advance_event(eqe))) {
+	if (!session->eventbuf) {
+		session->eventbuf = ast_str_create(1024);
+	}
+
+	do {
+		count = 0;
+		eqe = session->last_ev;
+
+		AST_RWLIST_RDLOCK(&all_events);
+		for (examined = 0; examined < ARRAY_LEN(batch) && (next = AST_RWLIST_NEXT(eqe, eq_next)); ++examined) {
+			eqe = next;
 			if (eqe->category == EVENT_FLAG_SHUTDOWN) {
 				ast_debug(3, "Received CloseSession event\n");
-				ret = -1;
+				closing = 1;
 			}
-			if (!ret && s->session->authenticated &&
-			    (s->session->readperm & eqe->category) == eqe->category &&
-			    (s->session->send_events & eqe->category) == eqe->category) {
-					if (match_filter(s, eqe->eventdata)) {
-						if (send_string(s, eqe->eventdata) < 0)
-							ret = -1;	/* don't send more */
-					}
+			if (!closing && session->authenticated &&
+			    (session->readperm & eqe->category) == eqe->category &&
+			    (session->send_events & eqe->category) == eqe->category) {
+				/* Hold the event until it has been filtered and copied */
+				ast_atomic_fetchadd_int(&eqe->usecount, 1);
+				batch[count++] = eqe;
 			}
-			s->session->last_ev = eqe;
 		}
+		if (eqe != session->last_ev) {
+			ast_atomic_fetchadd_int(&eqe->usecount, 1);
+			ast_atomic_fetchadd_int(&session->last_ev->usecount, -1);
+			session->last_ev = eqe;
+		}
+		AST_RWLIST_UNLOCK(&all_events);
+
+		for (i = 0; i < count; ++i) {
+			if (ret || !match_filter(s, batch[i]->eventdata)) {
+				/* Not wanted, or a write has already failed */
+			} else if (session->eventbuf) {
+				if (!ast_str_strlen(session->eventbuf)) {
+					session->eventbuf_tv = batch[i]->tv;
+				}
+				ast_str_append(&session->eventbuf, 0, "%s", batch[i]->eventdata);
+			} else if (send_string(s, batch[i]->eventdata) < 0) {
+				/* No buffer to batch into, so they are sent one at a time */
+				ret = -1;
+			}
+			ast_atomic_fetchadd_int(&batch[i]->usecount, -1);
+		}
+	} while (examined == ARRAY_LEN(batch) && !closing && !ret);
+
+	if (closing) {
+		ret = -1;
 	}
-	ao2_unlock(s->session);
+	if (ret || event_batch_timeout(session) == 0
+		|| (session->eventbuf && ast_str_strlen(session->eventbuf) >= EVENT_BATCH_MAX_SIZE)) {
+		if (flush_events(s)) {
+			ret = -1;
+		}
+	}
+	ao2_unlock(session);
+
 	return ret;
 }
 
@@ -6383,6 +6651,7 @@ static int get_input(struct mansession *s, char *output)
 	int maxlen = sizeof(s->session->inbuf) - 1;
 	char *src = s->session->inbuf;
 	int timeout = -1;
+	int batch_timeout;
 	time_t now;
 
 	/*
@@ -6433,10 +6702,17 @@ static int get_input(struct mansession *s, char *output)
 			ao2_unlock(s->session);
 			return 0;
 		}
+		/* Wake up in time to write any batched events */
+		batch_timeout = event_batch_timeout(s->session);
+		if (!batch_timeout) {
+			ao2_unlock(s->session);
+			return 0;
+		}
 		s->session->waiting_thread = pthread_self();
 		ao2_unlock(s->session);
 
-		res = ast_wait_for_input(s->session->fd, timeout);
+		res = ast_wait_for_input(s->session->fd,
+			batch_timeout > 0 && (timeout < 0 || batch_timeout < timeout) ? batch_timeout : timeout);
 
 		ao2_lock(s->session);
 		s->session->waiting_thread = AST_PTHREADT_NULL;
@@ -6586,55 +6862,63 @@ static int do_message(struct mansession *s)
  * (called from here if no line is available, or at the end of
  * process_message(). )
  */
-static void *session_do(void *data)
+/*!
+ * \internal
+ * \brief Run an AMI session until the client logs off or disconnects.
+ *
+ * \param s Session with tcptls_session, transport and local_address set
+ * \param f Stream to read actions from and write to
+ * \param fd Descriptor underlying \a f
+ * \param remote Address of the client
+ *
+ * \note \a f is closed when the session is over.
+ */
+static void session_run(struct mansession *s, FILE *f, int fd, const struct ast_sockaddr *remote)
 {
-	struct ast_tcptls_session_instance *ser = data;
+	struct ast_tcptls_session_instance *ser = s->tcptls_session;
 	struct mansession_session *session;
-	struct mansession s = {
-		.tcptls_session = data,
-	};
 	int flags = 1;
 	int res;
 	struct ast_sockaddr ser_remote_address_tmp;
 
 	if (ast_atomic_fetchadd_int(&unauth_sessions, +1) >= authlimit) {
-		fclose(ser->f);
+		fclose(f);
 		ast_atomic_fetchadd_int(&unauth_sessions, -1);
-		goto done;
+		return;
 	}
 
-	ast_sockaddr_copy(&ser_remote_address_tmp, &ser->remote_address);
+	ast_sockaddr_copy(&ser_remote_address_tmp, remote);
 	session = build_mansession(&ser_remote_address_tmp);
 
 	if (session == NULL) {
-		fclose(ser->f);
+		fclose(f);
 		ast_atomic_fetchadd_int(&unauth_sessions, -1);
-		goto done;
+		return;
 	}
 
 	/* here we set TCP_NODELAY on the socket to disable Nagle's algorithm.
 	 * This is necessary to prevent delays (caused by buffering) as we
 	 * write to the socket in bits and pieces. */
-	if (setsockopt(ser->fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flags, sizeof(flags)) < 0) {
+	if (ser && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flags, sizeof(flags)) < 0) {
 		ast_log(LOG_WARNING, "Failed to set TCP_NODELAY on manager connection: %s\n", strerror(errno));
 	}
 
 	/* make sure socket is non-blocking */
-	flags = fcntl(ser->fd, F_GETFL);
+	flags = fcntl(fd, F_GETFL);
 	flags |= O_NONBLOCK;
-	fcntl(ser->fd, F_SETFL, flags);
+	fcntl(fd, F_SETFL, flags);
 
 	ao2_lock(session);
 	/* Hook to the tail of the event queue */
 	session->last_ev = grab_last();
 
-	ast_mutex_init(&s.lock);
+	ast_mutex_init(&s->lock);
 
 	/* these fields duplicate those in the 'ser' structure */
-	session->fd = s.fd = ser->fd;
-	session->f = s.f = ser->f;
+	session->fd = s->fd = fd;
+	session->f = s->f = f;
 	ast_sockaddr_copy(&session->addr, &ser_remote_address_tmp);
-	s.session = session;
+	s->session = session;
 
 	AST_LIST_HEAD_INIT_NOLOCK(&session->datastores);
 
@@ -6643,25 +6927,28 @@ static void *session_do(void *data)
 		ast_atomic_fetchadd_int(&unauth_sessions, -1);
 		ao2_unlock(session);
 		session_destroy(session);
-		goto done;
+		ast_mutex_destroy(&s->lock);
+		return;
 	}
 	ao2_unlock(session);
 
-	/*
-	 * We cannot let the stream exclusively wait for data to arrive.
-	 * We have to wake up the task to send async events.
-	 */
-	ast_tcptls_stream_set_exclusive_input(ser->stream_cookie, 0);
+	if (ser) {
+		/*
+		 * We cannot let the stream exclusively wait for data to arrive.
+		 * We have to wake up the task to send async events.
+		 */
+		ast_tcptls_stream_set_exclusive_input(ser->stream_cookie, 0);
 
-	ast_tcptls_stream_set_timeout_sequence(ser->stream_cookie,
-		ast_tvnow(), authtimeout * 1000);
+		ast_tcptls_stream_set_timeout_sequence(ser->stream_cookie,
+			ast_tvnow(), authtimeout * 1000);
+	}
 
-	astman_append(&s, "Asterisk Call Manager/%s\r\n", AMI_VERSION);	/* welcome prompt */
+	astman_append(s, "Asterisk Call Manager/%s\r\n", AMI_VERSION);	/* welcome prompt */
 	for (;;) {
-		if ((res = do_message(&s)) < 0 || s.write_error) {
+		if ((res = do_message(s)) < 0 || s->write_error) {
 			break;
 		}
-		if (session->authenticated) {
+		if (ser && session->authenticated) {
 			ast_tcptls_stream_set_timeout_disable(ser->stream_cookie);
 		}
 	}
@@ -6679,13 +6966,94 @@ static void *session_do(void *data)
 
 	session_destroy(session);
 
-	ast_mutex_destroy(&s.lock);
-done:
+	ast_mutex_destroy(&s->lock);
+}
+
+/*
+ * The thread that processes a TCP or TLS AMI connection.
+ */
+static void *session_do(void *data)
+{
+	struct ast_tcptls_session_instance *ser = data;
+	struct mansession s = {
+		.tcptls_session = data,
+	};
+
+	session_run(&s, ser->f, ser->fd, &ser->remote_address);
+
 	ao2_ref(ser, -1);
 	ser = NULL;
 	return NULL;
 }
 
+/*! \brief An AMI session carried over a socket provided by another transport */
+struct external_session {
+	/*! The socket */
+	int fd;
+	/*! Transport reported in security events */
+	enum ast_transport transport;
+	/*! Local address of the connection */
+	struct ast_sockaddr local;
+	/*! Address of the client */
+	struct ast_sockaddr remote;
+};
+
+/*
+ * The thread that processes an AMI session started by ast_manager_session_start().
+ */
+static void *external_session_do(void *data)
+{
+	struct external_session *external = data;
+	struct mansession s = {
+		.transport = external->transport,
+	};
+	FILE *f;
+
+	ast_sockaddr_copy(&s.local_address, &external->local);
+
+	f = fdopen(external->fd, "r+");
+	if (!f) {
+		ast_log(LOG_WARNING, "Failed to open stream for manager session from %s: %s\n",
+			ast_sockaddr_stringify_addr(&external->remote), strerror(errno));
+		close(external->fd);
+		ast_free(external);
+		return NULL;
+	}
+	setvbuf(f, NULL, _IONBF, 0);
+
+	session_run(&s, f, external->fd, &external->remote);
+
+	ast_free(external);
+	return NULL;
+}
+
+int ast_manager_session_start(int fd, const struct ast_sockaddr *local,
+	const struct ast_sockaddr *remote, enum ast_transport transport)
+{
+	struct external_session *external;
+	pthread_t thread;
+
+	if (!manager_enabled || !(external = ast_calloc(1, sizeof(*external)))) {
+		close(fd);
+		return -1;
+	}
+
+	external->fd = fd;
+	external->transport = transport;
+	if (local) {
+		ast_sockaddr_copy(&external->local, local);
+	}
+	ast_sockaddr_copy(&external->remote, remote);
+
+	if (ast_pthread_create_detached_background(&thread, NULL, external_session_do, external)) {
+		close(fd);
+		ast_free(external);
+		return -1;
+	}
+
+	return 0;
+}
+
 /*! \brief remove at most n_max stale session from the list. */
 static void purge_sessions(int n_max)
 {
@@ -8384,6 +8752,7 @@ static char *handle_manager_show_settings(struct ast_cli_entry *e, int cmd, stru
 	ast_cli(a->fd, FORMAT, "Allow multiple login:", AST_CLI_YESNO(allowmultiplelogin));
 	ast_cli(a->fd, FORMAT, "Display connects:", AST_CLI_YESNO(displayconnects));
 	ast_cli(a->fd, FORMAT, "Timestamp events:", AST_CLI_YESNO(timestampevents));
+	ast_cli(a->fd, FORMAT2, "Event batch interval (ms):", eventbatchinterval);
 	ast_cli(a->fd, FORMAT, "Channel vars:", S_OR(manager_channelvars, ""));
 	ast_cli(a->fd, FORMAT, "Debug:", AST_CLI_YESNO(manager_debug));
 #undef FORMAT
@@ -8649,6 +9018,9 @@ static void manager_shutdown(void)
 	/* This event is not actually transmitted, but causes all TCP sessions to be closed */
 	manager_event(EVENT_FLAG_SHUTDOWN, "CloseSession", "CloseSession: true\r\n");
 
+	ast_threadpool_shutdown(originate_pool);
+	originate_pool = NULL;
+
 	ast_manager_unregister("Ping");
 	ast_manager_unregister("Events");
 	ast_manager_unregister("Logoff");
@@ -8808,6 +9180,7 @@ static void manager_set_defaults(void)
 	broken_events_action = 0;
 	authtimeout = 30;
 	authlimit = 50;
+	eventbatchinterval = 0;
 	manager_debug = 0;		/* Debug disabled by default */
 
 	/* default values */
@@ -8851,9 +9224,19 @@ static int __init_manager(int reload, int by_external_config)
 		struct ao2_container *temp_event_docs;
 #endif
 		int res;
+		struct ast_threadpool_options originate_options = {
+			.version = AST_THREADPOOL_OPTIONS_VERSION,
+			.auto_increment = 8,
+			.max_size = 0,
+			.idle_timeout = 60,
+			.initial_size = 0,
+		};
 
 		ast_register_cleanup(manager_shutdown);
 
+		/* Without the pool every asynchronous originate starts a thread */
+		originate_pool = ast_threadpool_create("manager-originate", NULL, &originate_options);
+
 		res = STASIS_MESSAGE_TYPE_INIT(ast_manager_get_generic_type);
 		if (res != 0) {
 			return -1;
@@ -9025,6 +9408,14 @@ static int __init_manager(int reload, int by_external_config)
 			} else {
 				authlimit = limit;
 			}
+		} else if (!strcasecmp(var->name, "eventbatchinterval")) {
+			int interval = atoi(var->value);
+
+			if (interval < 0) {
+				ast_log(LOG_WARNING, "Invalid eventbatchinterval value '%s', using default value\n", var->value);
+			} else {
+				eventbatchinterval = interval;
+			}
 		} else if (!strcasecmp(var->name, "channelvars")) {
 			load_channelvars(var);
 		} else {
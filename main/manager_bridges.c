@@ -487,7 +487,7 @@ static int manager_bridges_list(struct mansession *s, const struct message *m)
 {
 	const char *id = astman_get_header(m, "ActionID");
 	const char *type_filter = astman_get_header(m, "BridgeType");
-	RAII_VAR(struct ast_str *, id_text, ast_str_create(128), ast_free);
+	RAII_VAR(struct ast_str *, id_text, ast_str_scratch_get(128), ast_str_scratch_release);
 	RAII_VAR(struct ao2_container *, bridges, NULL, ao2_cleanup);
 	struct bridge_list_data list_data;
 
@@ -565,7 +565,7 @@ static int manager_bridge_info(struct mansession *s, const struct message *m)
 {
 	const char *id = astman_get_header(m, "ActionID");
 	const char *bridge_uniqueid = astman_get_header(m, "BridgeUniqueid");
-	RAII_VAR(struct ast_str *, id_text, ast_str_create(128), ast_free);
+	RAII_VAR(struct ast_str *, id_text, ast_str_scratch_get(128), ast_str_scratch_release);
 	RAII_VAR(struct stasis_message *, msg, NULL, ao2_cleanup);
 	RAII_VAR(struct ast_str *, bridge_info, NULL, ast_free);
 	struct ast_bridge_snapshot *snapshot;
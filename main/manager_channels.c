@@ -459,25 +459,52 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
  */
 static struct stasis_forward *topic_forwarder;
 
+/*!
+ * \internal
+ * \brief Escape a string into a scratch string
+ *
+ * \return The escaped string, NULL if s is NULL or on allocation failure
+ */
+static const char *escape_c_scratch(struct ast_str **buf, const char *s)
+{
+	size_t size;
+
+	if (!s || !*buf) {
+		return NULL;
+	}
+
+	/* Every character may need escaping */
+	size = strlen(s) * 2 + 1;
+	if (ast_str_make_space(buf, size)) {
+		return NULL;
+	}
+	return ast_escape_c(ast_str_buffer(*buf), s, size);
+}
+
 struct ast_str *ast_manager_build_channel_state_string_prefix(
 		const struct ast_channel_snapshot *snapshot,
 		const char *prefix)
 {
-	struct ast_str *out = ast_str_create(1024);
+	struct ast_str *out;
+	struct ast_str *caller_buf;
+	struct ast_str *connected_buf;
 	int res = 0;
-	char *caller_name, *connected_name;
+	const char *caller_name, *connected_name;
 
-	if (!out) {
+	if (snapshot->tech_properties & AST_CHAN_TP_INTERNAL) {
 		return NULL;
 	}
 
-	if (snapshot->tech_properties & AST_CHAN_TP_INTERNAL) {
-		ast_free(out);
+	out = ast_str_create(1024);
+	if (!out) {
 		return NULL;
 	}
 
-	caller_name = ast_escape_c_alloc(snapshot->caller_name);
-	connected_name = ast_escape_c_alloc(snapshot->connected_name);
+	/* These only live for this call, spare allocating them every event */
+	caller_buf = ast_str_scratch_get(64);
+	connected_buf = ast_str_scratch_get(64);
+	caller_name = escape_c_scratch(&caller_buf, snapshot->caller_name);
+	connected_name = escape_c_scratch(&connected_buf, snapshot->connected_name);
 
 	res = ast_str_set(&out, 0,
 		"%sChannel: %s\r\n"
@@ -511,25 +538,24 @@ struct ast_str *ast_manager_build_channel_state_string_prefix(
 
 	if (!res) {
 		ast_free(out);
-		ast_free(caller_name);
-		ast_free(connected_name);
+		ast_str_scratch_release(caller_buf);
+		ast_str_scratch_release(connected_buf);
 		return NULL;
 	}
 
 	if (snapshot->manager_vars) {
 		struct ast_var_t *var;
-		char *val;
+		const char *val;
 		AST_LIST_TRAVERSE(snapshot->manager_vars, var, entries) {
-			val = ast_escape_c_alloc(var->value);
+			val = escape_c_scratch(&caller_buf, var->value);
 			ast_str_append(&out, 0, "%sChanVariable: %s=%s\r\n",
 				       prefix,
 				       var->name, S_OR(val, ""));
-			ast_free(val);
 		}
 	}
 
-	ast_free(caller_name);
-	ast_free(connected_name);
+	ast_str_scratch_release(caller_buf);
+	ast_str_scratch_release(connected_buf);
 
 	return out;
 }
@@ -984,7 +1010,7 @@ static void channel_fax_cb(void *data, struct stasis_subscription *sub,
 		struct stasis_message *message)
 {
 	RAII_VAR(struct ast_str *, channel_event_string, NULL, ast_free);
-	RAII_VAR(struct ast_str *, event_buffer, ast_str_create(256), ast_free);
+	RAII_VAR(struct ast_str *, event_buffer, ast_str_scratch_get(256), ast_str_scratch_release);
 	struct ast_channel_blob *payload = stasis_message_data(message);
 	const char *type = ast_json_string_get(ast_json_object_get(payload->blob, "type"));
 	struct ast_json *operation = ast_json_object_get(payload->blob, "operation");
@@ -0,0 +1,571 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief An in-memory media cache
+ */
+
+/*** MODULEINFO
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/bucket.h"
+#include "asterisk/astobj2.h"
+#include "asterisk/cli.h"
+#include "asterisk/file.h"
+#include "asterisk/threadpool.h"
+#include "asterisk/media_cache.h"
+
+/*! Number of buckets in the container of cached items */
+#define MEDIA_CACHE_BUCKETS 61
+
+/*! Number of items kept before the least recently used ones are removed */
+#define MEDIA_CACHE_MAX_ITEMS 512
+
+/*! Seconds an item stays fresh when its bucket scheme provides no expiry */
+#define MEDIA_CACHE_DEFAULT_LIFETIME 300
+
+/*! Seconds before revalidating an item again when revalidating it failed */
+#define MEDIA_CACHE_RETRY_INTERVAL 30
+
+/*! Threads retrieving items in the background */
+#define MEDIA_CACHE_FETCH_THREADS 4
+
+/*! \brief An item in the media cache */
+struct media_cache_item {
+	/*! The local copy, with the extension added to its path */
+	struct ast_bucket_file *file;
+	/*! When the item was last retrieved from the cache */
+	struct timeval last_used;
+	/*! When the local copy has to be revalidated */
+	time_t expires;
+	/*! Seconds the local copy stays fresh after being revalidated */
+	unsigned int lifetime;
+	/*! Set while the item is being revalidated in the background */
+	unsigned int refreshing:1;
+	/*! URI of the media */
+	char uri[0];
+};
+
+/*! \brief Cached items, by URI.  The container lock also protects the items. */
+static struct ao2_container *media_cache;
+
+/*! \brief Threads retrieving and revalidating items */
+static struct ast_threadpool *media_cache_pool;
+
+static int media_cache_item_hash(const void *obj, const int flags)
+{
+	const struct media_cache_item *item;
+	const char *key;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_KEY:
+		key = obj;
+		break;
+	case OBJ_SEARCH_OBJECT:
+		item = obj;
+		key = item->uri;
+		break;
+	default:
+		ast_assert(0);
+		return 0;
+	}
+	return ast_str_hash(key);
+}
+
+static int media_cache_item_cmp(void *obj, void *arg, int flags)
+{
+	const struct media_cache_item *left = obj;
+	const struct media_cache_item *right = arg;
+	const char *right_key = arg;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+		right_key = right->uri;
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		if (strcmp(left->uri, right_key)) {
+			return 0;
+		}
+		break;
+	default:
+		ast_assert(0);
+		return 0;
+	}
+	return CMP_MATCH;
+}
+
+static void media_cache_item_destroy(void *obj)
+{
+	struct media_cache_item *item = obj;
+
+	/* Destroying the bucket file removes the local copy */
+	ao2_cleanup(item->file);
+}
+
+/*!
+ * \internal
+ * \brief Add the extension of the media to the path of a local copy
+ *
+ * The extension is taken from the 'ext' metadata set by the bucket scheme,
+ * or else from the URI, and is needed to find a format to play the copy with.
+ */
+static int media_cache_file_add_extension(struct ast_bucket_file *file, const char *uri)
+{
+	struct ast_bucket_metadata *metadata;
+	char path[PATH_MAX];
+	char *ext = NULL;
+	char *end;
+
+	metadata = ast_bucket_file_metadata_get(file, "ext");
+	if (metadata) {
+		ext = ast_strdupa(metadata->value);
+		ao2_ref(metadata, -1);
+	} else {
+		char *name = ast_strdupa(uri);
+
+		name[strcspn(name, "?#")] = '\0';
+		if ((end = strrchr(name, '/'))) {
+			name = end + 1;
+		}
+		if ((end = strrchr(name, '.'))) {
+			ext = end + 1;
+		}
+	}
+
+	if (ast_strlen_zero(ext) || !ast_get_format_for_file_ext(ext)) {
+		ast_log(LOG_WARNING, "No format to play '%s' with, extension '%s'\n",
+			uri, S_OR(ext, ""));
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s.%s", file->path, ext);
+	if (rename(file->path, path)) {
+		ast_log(LOG_WARNING, "Could not rename '%s' to '%s' for '%s': %s\n",
+			file->path, path, uri, strerror(errno));
+		return -1;
+	}
+	ast_copy_string(file->path, path, sizeof(file->path));
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Remove the least recently used item if the cache holds too many
+ *
+ * \note Called with the container locked
+ */
+static void media_cache_evict(void)
+{
+	struct ao2_iterator iter;
+	struct media_cache_item *item;
+	struct media_cache_item *oldest = NULL;
+
+	if (ao2_container_count(media_cache) <= MEDIA_CACHE_MAX_ITEMS) {
+		return;
+	}
+
+	iter = ao2_iterator_init(media_cache, AO2_ITERATOR_DONTLOCK);
+	for (; (item = ao2_iterator_next(&iter)); ao2_ref(item, -1)) {
+		if (!oldest || ast_tvcmp(item->last_used, oldest->last_used) < 0) {
+			ao2_cleanup(oldest);
+			oldest = ao2_bump(item);
+		}
+	}
+	ao2_iterator_destroy(&iter);
+
+	if (oldest) {
+		ast_debug(3, "Removing least recently used '%s' from the media cache\n", oldest->uri);
+		ao2_unlink_flags(media_cache, oldest, OBJ_NOLOCK);
+		ao2_ref(oldest, -1);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Retrieve media into the cache, replacing any previous copy
+ *
+ * \return The new item, with a reference for the caller
+ */
+static struct media_cache_item *media_cache_fetch(const char *uri)
+{
+	struct ast_bucket_file *file;
+	struct ast_bucket_metadata *metadata;
+	struct media_cache_item *item;
+	struct media_cache_item *old;
+	time_t now = time(NULL);
+	time_t expires = 0;
+
+	file = ast_bucket_file_retrieve(uri);
+	if (!file) {
+		ast_log(LOG_WARNING, "Could not retrieve '%s' into the media cache\n", uri);
+		return NULL;
+	}
+
+	if (media_cache_file_add_extension(file, uri)) {
+		ao2_ref(file, -1);
+		return NULL;
+	}
+
+	metadata = ast_bucket_file_metadata_get(file, "__actual_expires");
+	if (metadata) {
+		expires = strtol(metadata->value, NULL, 10);
+		ao2_ref(metadata, -1);
+	}
+	if (expires <= now) {
+		expires = now + MEDIA_CACHE_DEFAULT_LIFETIME;
+	}
+
+	item = ao2_alloc(sizeof(*item) + strlen(uri) + 1, media_cache_item_destroy);
+	if (!item) {
+		ao2_ref(file, -1);
+		return NULL;
+	}
+	strcpy(item->uri, uri); /* Safe */
+	item->file = file;
+	item->last_used = ast_tvnow();
+	item->expires = expires;
+	item->lifetime = expires - now;
+
+	ao2_lock(media_cache);
+	old = ao2_find(media_cache, uri, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NOLOCK);
+	ao2_link_flags(media_cache, item, OBJ_NOLOCK);
+	media_cache_evict();
+	ao2_unlock(media_cache);
+
+	/* An old copy being played back stays readable until it is closed */
+	ao2_cleanup(old);
+
+	ast_debug(3, "Retrieved '%s' into the media cache as '%s'\n", uri, item->file->path);
+
+	return item;
+}
+
+/*! \brief Background task revalidating an expired item */
+static int media_cache_refresh(void *data)
+{
+	struct media_cache_item *item = data;
+	struct media_cache_item *fresh = NULL;
+	int stale;
+
+	stale = ast_bucket_file_is_stale(item->file);
+	if (stale) {
+		fresh = media_cache_fetch(item->uri);
+	}
+
+	ao2_lock(media_cache);
+	if (!stale) {
+		item->expires = time(NULL) + item->lifetime;
+	} else if (!fresh) {
+		/* Keep playing the copy we have and try again later */
+		item->expires = time(NULL) + MEDIA_CACHE_RETRY_INTERVAL;
+	}
+	item->refreshing = 0;
+	ao2_unlock(media_cache);
+
+	ast_debug(3, "Revalidated '%s' in the media cache, %s\n", item->uri,
+		!stale ? "unchanged" : fresh ? "replaced" : "failed");
+
+	ao2_cleanup(fresh);
+	ao2_ref(item, -1);
+	return 0;
+}
+
+/*! \brief Background task retrieving an item not in the cache */
+static int media_cache_prefetch(void *data)
+{
+	char *uri = data;
+
+	if (!ast_media_cache_exists(uri)) {
+		ao2_cleanup(media_cache_fetch(uri));
+	}
+
+	ast_free(uri);
+	return 0;
+}
+
+int ast_media_cache_exists(const char *uri)
+{
+	struct media_cache_item *item;
+
+	if (ast_strlen_zero(uri)) {
+		return 0;
+	}
+
+	item = ao2_find(media_cache, uri, OBJ_SEARCH_KEY);
+	if (!item) {
+		return 0;
+	}
+
+	ao2_ref(item, -1);
+	return 1;
+}
+
+int ast_media_cache_retrieve(const char *uri, char *file_path, size_t len)
+{
+	struct media_cache_item *item;
+	int refresh = 0;
+
+	if (ast_strlen_zero(uri)) {
+		return -1;
+	}
+
+	ao2_lock(media_cache);
+	item = ao2_find(media_cache, uri, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (item) {
+		item->last_used = ast_tvnow();
+		if (!item->refreshing && item->expires <= time(NULL)) {
+			item->refreshing = 1;
+			refresh = 1;
+		}
+	}
+	ao2_unlock(media_cache);
+
+	if (!item) {
+		/* Nothing to play until the media has been retrieved */
+		item = media_cache_fetch(uri);
+		if (!item) {
+			return -1;
+		}
+	} else if (refresh) {
+		/* Play the copy we have without waiting for it to be revalidated */
+		if (ast_threadpool_push(media_cache_pool, media_cache_refresh, ao2_bump(item))) {
+			ao2_lock(media_cache);
+			item->refreshing = 0;
+			ao2_unlock(media_cache);
+			ao2_ref(item, -1);
+		}
+	}
+
+	ast_copy_string(file_path, item->file->path, len);
+	ao2_ref(item, -1);
+
+	return 0;
+}
+
+int ast_media_cache_prefetch(const char *uri)
+{
+	char *data;
+
+	if (ast_strlen_zero(uri)) {
+		return -1;
+	}
+
+	if (ast_media_cache_exists(uri)) {
+		return 0;
+	}
+
+	data = ast_strdup(uri);
+	if (!data) {
+		return -1;
+	}
+
+	if (ast_threadpool_push(media_cache_pool, media_cache_prefetch, data)) {
+		ast_free(data);
+		return -1;
+	}
+
+	return 0;
+}
+
+int ast_media_cache_delete(const char *uri)
+{
+	struct media_cache_item *item;
+
+	if (ast_strlen_zero(uri)) {
+		return -1;
+	}
+
+	item = ao2_find(media_cache, uri, OBJ_SEARCH_KEY | OBJ_UNLINK);
+	if (!item) {
+		return -1;
+	}
+
+	ao2_ref(item, -1);
+	return 0;
+}
+
+static char *media_cache_complete_uri(const char *word, int state)
+{
+	struct ao2_iterator iter;
+	struct media_cache_item *item;
+	char *res = NULL;
+	int wordlen = strlen(word);
+	int which = 0;
+
+	iter = ao2_iterator_init(media_cache, 0);
+	for (; (item = ao2_iterator_next(&iter)); ao2_ref(item, -1)) {
+		if (!strncasecmp(word, item->uri, wordlen) && ++which > state) {
+			res = ast_strdup(item->uri);
+			ao2_ref(item, -1);
+			break;
+		}
+	}
+	ao2_iterator_destroy(&iter);
+
+	return res;
+}
+
+static char *media_cache_handle_show_all(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT_HEADER "%-60.60s %-40.40s %s\n"
+#define FORMAT_ROW "%-60.60s %-40.40s %ld\n"
+	struct ao2_iterator iter;
+	struct media_cache_item *item;
+	time_t now = time(NULL);
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "media cache show all";
+		e->usage =
+			"Usage: media cache show all\n"
+			"       Show the items in the media cache, with the seconds\n"
+			"       left before they are revalidated.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, FORMAT_HEADER, "URI", "Local File", "Expires");
+
+	ao2_lock(media_cache);
+	iter = ao2_iterator_init(media_cache, AO2_ITERATOR_DONTLOCK);
+	for (; (item = ao2_iterator_next(&iter)); ao2_ref(item, -1)) {
+		ast_cli(a->fd, FORMAT_ROW, item->uri, item->file->path,
+			(long) (item->expires > now ? item->expires - now : 0));
+	}
+	ao2_iterator_destroy(&iter);
+	ao2_unlock(media_cache);
+
+	ast_cli(a->fd, "%d items, at most %d\n", ao2_container_count(media_cache), MEDIA_CACHE_MAX_ITEMS);
+
+	return CLI_SUCCESS;
+#undef FORMAT_HEADER
+#undef FORMAT_ROW
+}
+
+static char *media_cache_handle_delete_item(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "media cache delete";
+		e->usage =
+			"Usage: media cache delete <uri>\n"
+			"       Remove an item from the media cache.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return a->pos == 3 ? media_cache_complete_uri(a->word, a->n) : NULL;
+	}
+
+	if (a->argc != 4) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (ast_media_cache_delete(a->argv[3])) {
+		ast_cli(a->fd, "'%s' is not in the media cache\n", a->argv[3]);
+		return CLI_FAILURE;
+	}
+
+	ast_cli(a->fd, "Removed '%s' from the media cache\n", a->argv[3]);
+	return CLI_SUCCESS;
+}
+
+static char *media_cache_handle_refresh_item(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct media_cache_item *item;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "media cache refresh";
+		e->usage =
+			"Usage: media cache refresh <uri>\n"
+			"       Retrieve an item into the media cache again, replacing\n"
+			"       the copy held.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return a->pos == 3 ? media_cache_complete_uri(a->word, a->n) : NULL;
+	}
+
+	if (a->argc != 4) {
+		return CLI_SHOWUSAGE;
+	}
+
+	item = media_cache_fetch(a->argv[3]);
+	if (!item) {
+		ast_cli(a->fd, "Could not retrieve '%s'\n", a->argv[3]);
+		return CLI_FAILURE;
+	}
+
+	ast_cli(a->fd, "Retrieved '%s' as '%s'\n", a->argv[3], item->file->path);
+	ao2_ref(item, -1);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_media_cache[] = {
+	AST_CLI_DEFINE(media_cache_handle_show_all, "Show the items in the media cache"),
+	AST_CLI_DEFINE(media_cache_handle_delete_item, "Remove an item from the media cache"),
+	AST_CLI_DEFINE(media_cache_handle_refresh_item, "Retrieve an item into the media cache again"),
+};
+
+static void media_cache_shutdown(void)
+{
+	ast_cli_unregister_multiple(cli_media_cache, ARRAY_LEN(cli_media_cache));
+
+	ast_threadpool_shutdown(media_cache_pool);
+	media_cache_pool = NULL;
+
+	ao2_cleanup(media_cache);
+	media_cache = NULL;
+}
+
+int ast_media_cache_init(void)
+{
+	struct ast_threadpool_options options = {
+		.version = AST_THREADPOOL_OPTIONS_VERSION,
+		.auto_increment = 1,
+		.max_size = MEDIA_CACHE_FETCH_THREADS,
+		.idle_timeout = 60,
+		.initial_size = 0,
+	};
+
+	ast_register_cleanup(media_cache_shutdown);
+
+	media_cache = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, MEDIA_CACHE_BUCKETS,
+		media_cache_item_hash, NULL, media_cache_item_cmp);
+	if (!media_cache) {
+		return -1;
+	}
+
+	media_cache_pool = ast_threadpool_create("media_cache", NULL, &options);
+	if (!media_cache_pool) {
+		return -1;
+	}
+
+	ast_cli_register_multiple(cli_media_cache, ARRAY_LEN(cli_media_cache));
+
+	return 0;
+}
@@ -42,6 +42,9 @@
 /*! \brief The number of buckets to be used for storing media filename-keyed objects */
 #define INDEX_BUCKETS 157
 
+/*! \brief The number of buckets to be used for storing directory-keyed objects */
+#define DIRECTORY_BUCKETS 61
+
 /*! \brief Structure to hold a list of the format variations for a media file for a specific variant */
 struct media_variant {
 	AST_DECLARE_STRING_FIELDS(
@@ -140,12 +143,78 @@ static int media_info_cmp(void *obj, void *arg, int flags)
 	return strcasecmp(opt1->name, name) ? 0 : CMP_MATCH | CMP_STOP;
 }
 
+/*! \brief Structure to hold the names found in a directory when it was read */
+struct media_dir {
+	AST_VECTOR(, char *) files;	/*!< Names of the regular files in the directory */
+	AST_VECTOR(, char *) subdirs;	/*!< Names of the subdirectories of the directory */
+	time_t mtime;			/*!< When the directory was last modified, as of reading it */
+	time_t read_at;			/*!< When the directory was read */
+	char path[0];			/*!< Path of the directory relative to the base directory */
+};
+
+static void media_dir_destroy(void *obj)
+{
+	struct media_dir *dir = obj;
+
+	AST_VECTOR_RESET(&dir->files, ast_free);
+	AST_VECTOR_FREE(&dir->files);
+	AST_VECTOR_RESET(&dir->subdirs, ast_free);
+	AST_VECTOR_FREE(&dir->subdirs);
+}
+
+static struct media_dir *media_dir_alloc(const char *path, time_t mtime, time_t read_at)
+{
+	struct media_dir *dir = ao2_alloc(sizeof(*dir) + strlen(path) + 1, media_dir_destroy);
+
+	if (!dir) {
+		return NULL;
+	}
+
+	strcpy(dir->path, path); /* Safe */
+	dir->mtime = mtime;
+	dir->read_at = read_at;
+	if (AST_VECTOR_INIT(&dir->files, 32) || AST_VECTOR_INIT(&dir->subdirs, 4)) {
+		ao2_ref(dir, -1);
+		return NULL;
+	}
+
+	return dir;
+}
+
+/*! \brief Add a name to a vector of a directory listing */
+#define media_dir_add_name(vec, name) ({ \
+	char *__name = ast_strdup(name); \
+	int __res = -1; \
+	if (__name) { \
+		__res = AST_VECTOR_APPEND(vec, __name); \
+		if (__res) { \
+			ast_free(__name); \
+		} \
+	} \
+	__res; \
+})
+
+static int media_dir_hash(const void *obj, const int flags)
+{
+	const char *path = (flags & OBJ_KEY) ? obj : ((struct media_dir *) obj)->path;
+	return ast_str_hash(path);
+}
+
+static int media_dir_cmp(void *obj, void *arg, int flags)
+{
+	struct media_dir *opt1 = obj, *opt2 = arg;
+	const char *path = (flags & OBJ_KEY) ? arg : opt2->path;
+	return strcmp(opt1->path, path) ? 0 : CMP_MATCH | CMP_STOP;
+}
+
 struct ast_media_index {
 	AST_DECLARE_STRING_FIELDS(
 		AST_STRING_FIELD(base_dir); /*!< Base directory for indexing */
 	);
 	struct ao2_container *index;            /*!< The index of media that has requested */
 	struct ao2_container *media_list_cache; /*!< Cache of filenames to prevent them from being regenerated so often */
+	struct ao2_container *dirs;             /*!< Listings of the directories indexed */
+	struct ao2_container *previous_dirs;    /*!< Listings which may be reused instead of reading directories */
 };
 
 static void media_index_dtor(void *obj)
@@ -155,6 +224,10 @@ static void media_index_dtor(void *obj)
 	index->index = NULL;
 	ao2_cleanup(index->media_list_cache);
 	index->media_list_cache = NULL;
+	ao2_cleanup(index->dirs);
+	index->dirs = NULL;
+	ao2_cleanup(index->previous_dirs);
+	index->previous_dirs = NULL;
 	ast_string_field_free_memory(index);
 }
 
@@ -172,6 +245,11 @@ struct ast_media_index *ast_media_index_create(const char *base_dir)
 		return NULL;
 	}
 
+	index->dirs = ao2_container_alloc(DIRECTORY_BUCKETS, media_dir_hash, media_dir_cmp);
+	if (!index->dirs) {
+		return NULL;
+	}
+
 	ao2_ref(index, +1);
 	return index;
 }
@@ -516,82 +594,286 @@ static int process_file(struct ast_media_index *index, const char *variant_str,
 	return 0;
 }
 
+/*!
+ * \brief Get the names of the files and subdirectories of a directory
+ *
+ * The listing of a previous index is reused if the directory was not
+ * modified since it was read, which saves reading the directory and
+ * stat()ing its entries.  Directories modified in the second they were
+ * read are always read again, since further changes in that second would
+ * not change their modification time.
+ */
+static struct media_dir *media_dir_list(struct ast_media_index *index, const char *path, const char *dir_path)
+{
+	struct media_dir *dir;
+	struct dirent *dent;
+	DIR *srcdir;
+	struct stat st;
+	RAII_VAR(struct ast_str *, statfile, ast_str_create(64), ast_free);
+
+	if (!statfile) {
+		return NULL;
+	}
+
+	if (stat(dir_path, &st) < 0) {
+		ast_log(LOG_ERROR, "Failed to stat %s: %s\n", dir_path, strerror(errno));
+		return NULL;
+	}
+
+	if (index->previous_dirs) {
+		dir = ao2_find(index->previous_dirs, path, OBJ_KEY);
+		if (dir && dir->mtime == st.st_mtime && dir->read_at > st.st_mtime) {
+			return dir;
+		}
+		ao2_cleanup(dir);
+	}
+
+	srcdir = opendir(dir_path);
+	if (srcdir == NULL) {
+		ast_log(LOG_ERROR, "Failed to open %s: %s\n", dir_path, strerror(errno));
+		return NULL;
+	}
+
+	dir = media_dir_alloc(path, st.st_mtime, time(NULL));
+	if (!dir) {
+		closedir(srcdir);
+		return NULL;
+	}
+
+	while((dent = readdir(srcdir)) != NULL) {
+		int is_dir = 0;
+		int is_reg = 0;
+		int res = 0;
+
+		if(!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, "..")) {
+			continue;
+		}
+
+#ifdef _DIRENT_HAVE_D_TYPE
+		is_dir = dent->d_type == DT_DIR;
+		is_reg = dent->d_type == DT_REG;
+		if (dent->d_type == DT_UNKNOWN || dent->d_type == DT_LNK)
+#endif
+		{
+			ast_str_set(&statfile, 0, "%s/%s", dir_path, dent->d_name);
+
+			if (stat(ast_str_buffer(statfile), &st) < 0) {
+				ast_log(LOG_WARNING, "Failed to stat %s: %s\n", ast_str_buffer(statfile), strerror(errno));
+				continue;
+			}
+			is_dir = S_ISDIR(st.st_mode);
+			is_reg = S_ISREG(st.st_mode);
+		}
+
+		if (is_dir) {
+			res = media_dir_add_name(&dir->subdirs, dent->d_name);
+		} else if (is_reg) {
+			res = media_dir_add_name(&dir->files, dent->d_name);
+		}
+
+		if (res) {
+			ao2_ref(dir, -1);
+			dir = NULL;
+			break;
+		}
+	}
+
+	closedir(srcdir);
+	return dir;
+}
+
 /*! \brief internal function for updating the index, recursive */
 static int media_index_update(struct ast_media_index *index,
 	const char *variant,
 	const char *subdir)
 {
-	struct dirent* dent;
-	DIR* srcdir;
 	RAII_VAR(struct ast_str *, index_dir, ast_str_create(64), ast_free);
-	RAII_VAR(struct ast_str *, statfile, ast_str_create(64), ast_free);
+	RAII_VAR(struct ast_str *, path, ast_str_create(64), ast_free);
+	RAII_VAR(struct media_dir *, dir, NULL, ao2_cleanup);
 	int res = 0;
+	int i;
 
-	if (!index_dir) {
+	if (!index_dir || !path) {
 		return 0;
 	}
 
-	ast_str_set(&index_dir, 0, "%s", index->base_dir);
 	if (!ast_strlen_zero(variant)) {
-		ast_str_append(&index_dir, 0, "/%s", variant);
+		ast_str_set(&path, 0, "%s", variant);
 	}
 	if (!ast_strlen_zero(subdir)) {
-		ast_str_append(&index_dir, 0, "/%s", subdir);
+		ast_str_append(&path, 0, "%s%s", ast_str_strlen(path) ? "/" : "", subdir);
+	}
+	ast_str_set(&index_dir, 0, "%s", index->base_dir);
+	if (ast_str_strlen(path)) {
+		ast_str_append(&index_dir, 0, "/%s", ast_str_buffer(path));
 	}
 
-	srcdir = opendir(ast_str_buffer(index_dir));
-	if (srcdir == NULL) {
-		ast_log(LOG_ERROR, "Failed to open %s: %s\n", ast_str_buffer(index_dir), strerror(errno));
+	dir = media_dir_list(index, ast_str_buffer(path), ast_str_buffer(index_dir));
+	if (!dir) {
 		return -1;
 	}
+	ao2_link(index->dirs, dir);
 
-	while((dent = readdir(srcdir)) != NULL) {
-		struct stat st;
+	for (i = 0; i < AST_VECTOR_SIZE(&dir->subdirs); i++) {
+		const char *name = AST_VECTOR_GET(&dir->subdirs, i);
 
-		if(!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, "..")) {
-			continue;
+		if (ast_strlen_zero(subdir)) {
+			res = media_index_update(index, variant, name);
+		} else {
+			RAII_VAR(struct ast_str *, new_subdir, ast_str_create(64), ast_free);
+			ast_str_set(&new_subdir, 0, "%s/%s", subdir, name);
+			res = media_index_update(index, variant, ast_str_buffer(new_subdir));
 		}
 
-		ast_str_reset(statfile);
-		ast_str_set(&statfile, 0, "%s/%s", ast_str_buffer(index_dir), dent->d_name);
+		if (res) {
+			return res;
+		}
+	}
 
-		if (stat(ast_str_buffer(statfile), &st) < 0) {
-			ast_log(LOG_WARNING, "Failed to stat %s: %s\n", ast_str_buffer(statfile), strerror(errno));
-			continue;
+	for (i = 0; i < AST_VECTOR_SIZE(&dir->files); i++) {
+		if (process_file(index, variant, subdir, AST_VECTOR_GET(&dir->files, i))) {
+			return -1;
 		}
+	}
 
-		if (S_ISDIR(st.st_mode)) {
-			if (ast_strlen_zero(subdir)) {
-				res = media_index_update(index, variant, dent->d_name);
-			} else {
-				RAII_VAR(struct ast_str *, new_subdir, ast_str_create(64), ast_free);
-				ast_str_set(&new_subdir, 0, "%s/%s", subdir, dent->d_name);
-				res = media_index_update(index, variant, ast_str_buffer(new_subdir));
-			}
+	return 0;
+}
 
-			if (res) {
-				break;
-			}
+int ast_media_index_update(struct ast_media_index *index,
+	const char *variant)
+{
+	return media_index_update(index, variant, NULL);
+}
+
+void ast_media_index_reuse(struct ast_media_index *index, struct ast_media_index *previous)
+{
+	ao2_cleanup(index->previous_dirs);
+	index->previous_dirs = previous ? ao2_bump(previous->dirs) : NULL;
+}
+
+int ast_media_index_save(struct ast_media_index *index, const char *filename)
+{
+	struct ao2_iterator it_dirs;
+	struct media_dir *dir;
+	char tmp_filename[PATH_MAX];
+	FILE *f;
+	int res = 0;
+	int i;
+
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+	f = fopen(tmp_filename, "w");
+	if (!f) {
+		ast_log(LOG_WARNING, "Could not open '%s' to save the media index: %s\n", tmp_filename, strerror(errno));
+		return -1;
+	}
+
+	fprintf(f, "; Directory listings of %s, reused by the next index when unmodified\n", index->base_dir);
+
+	it_dirs = ao2_iterator_init(index->dirs, 0);
+	for (; (dir = ao2_iterator_next(&it_dirs)); ao2_ref(dir, -1)) {
+		/* Listings with names which cannot be saved are read again next time */
+		if (strchr(dir->path, '\n')
+			|| AST_VECTOR_GET_CMP(&dir->files, "\n", strstr)
+			|| AST_VECTOR_GET_CMP(&dir->subdirs, "\n", strstr)) {
 			continue;
 		}
 
-		if (!S_ISREG(st.st_mode)) {
+		fprintf(f, "D %ld %ld %s\n", (long) dir->mtime, (long) dir->read_at, dir->path);
+		for (i = 0; i < AST_VECTOR_SIZE(&dir->subdirs); i++) {
+			fprintf(f, "S %s\n", AST_VECTOR_GET(&dir->subdirs, i));
+		}
+		for (i = 0; i < AST_VECTOR_SIZE(&dir->files); i++) {
+			fprintf(f, "F %s\n", AST_VECTOR_GET(&dir->files, i));
+		}
+	}
+	ao2_iterator_destroy(&it_dirs);
+
+	if (ferror(f)) {
+		res = -1;
+	}
+	if (fclose(f) || res) {
+		ast_log(LOG_WARNING, "Could not write '%s' to save the media index\n", tmp_filename);
+		unlink(tmp_filename);
+		return -1;
+	}
+
+	if (rename(tmp_filename, filename)) {
+		ast_log(LOG_WARNING, "Could not rename '%s' to '%s': %s\n", tmp_filename, filename, strerror(errno));
+		unlink(tmp_filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+int ast_media_index_load(struct ast_media_index *index, const char *filename)
+{
+	RAII_VAR(struct ao2_container *, dirs, NULL, ao2_cleanup);
+	struct media_dir *dir = NULL;
+	char buf[PATH_MAX + 8];
+	int res = 0;
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		if (errno != ENOENT) {
+			ast_log(LOG_WARNING, "Could not open '%s' to load the media index: %s\n", filename, strerror(errno));
+		}
+		return -1;
+	}
+
+	dirs = ao2_container_alloc(DIRECTORY_BUCKETS, media_dir_hash, media_dir_cmp);
+	if (!dirs) {
+		fclose(f);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		char *line = buf;
+		char *type;
+		long mtime;
+		long read_at;
+		int pos = 0;
+
+		line[strcspn(line, "\n")] = '\0';
+		type = strsep(&line, " ");
+		if (!line) {
+			/* Comments and lines not understood */
 			continue;
 		}
 
-		if (process_file(index, variant, subdir, dent->d_name)) {
-			res = -1;
+		if (!strcmp(type, "D")) {
+			ao2_cleanup(dir);
+			dir = NULL;
+			if (sscanf(line, "%ld %ld %n", &mtime, &read_at, &pos) != 2 || !pos) {
+				continue;
+			}
+			dir = media_dir_alloc(line + pos, mtime, read_at);
+			if (!dir) {
+				res = -1;
+				break;
+			}
+			ao2_link(dirs, dir);
+		} else if (dir && !strcmp(type, "S")) {
+			res = media_dir_add_name(&dir->subdirs, line);
+		} else if (dir && !strcmp(type, "F")) {
+			res = media_dir_add_name(&dir->files, line);
+		}
+
+		if (res) {
 			break;
 		}
 	}
+	ao2_cleanup(dir);
+	fclose(f);
 
-	closedir(srcdir);
-	return res;
-}
+	if (res) {
+		/* A listing missing names must not be reused */
+		return -1;
+	}
 
-int ast_media_index_update(struct ast_media_index *index,
-	const char *variant)
-{
-	return media_index_update(index, variant, NULL);
-}
+	ao2_cleanup(index->previous_dirs);
+	index->previous_dirs = ao2_bump(dirs);
 
+	return 0;
+}
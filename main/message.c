@@ -42,6 +42,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/vector.h"
 #include "asterisk/app.h"
 #include "asterisk/taskprocessor.h"
+#include "asterisk/threadpool.h"
 #include "asterisk/message.h"
 
 /*** DOCUMENTATION
@@ -237,7 +238,18 @@ static ast_rwlock_t msg_handlers_lock;
 /*! \brief Vector of received message handlers */
 AST_VECTOR(, const struct ast_msg_handler *) msg_handlers;
 
-static struct ast_taskprocessor *msg_q_tp;
+/*!
+ * \brief Number of serializers received messages are routed on
+ *
+ * \note Messages between the same two parties are always routed by the
+ * same serializer, so they are handled in the order they were received.
+ */
+#define MSG_Q_SHARDS 8
+
+/*! \brief Threadpool the message serializers run on */
+static struct ast_threadpool *msg_q_pool;
+
+static struct ast_taskprocessor *msg_q_tps[MSG_Q_SHARDS];
 
 static const char app_msg_send[] = "MessageSend";
 
@@ -809,7 +821,13 @@ static void destroy_msg_q_chan(void *data)
 
 AST_THREADSTORAGE_CUSTOM(msg_q_chan, NULL, destroy_msg_q_chan);
 
-/*! \internal \brief Handle a message bound for the dialplan */
+/*!
+ * \internal \brief Handle a message bound for the dialplan
+ *
+ * \note Each thread of the message threadpool keeps a channel of its own
+ * to run the dialplan on, so messages routed on different threads do not
+ * wait for each other.
+ */
 static int dialplan_handle_msg_cb(struct ast_msg *msg)
 {
 	struct ast_channel **chan_p, *chan;
@@ -918,8 +936,12 @@ int ast_msg_has_destination(const struct ast_msg *msg)
 
 int ast_msg_queue(struct ast_msg *msg)
 {
+	struct ast_taskprocessor *tps;
 	int res;
-	res = ast_taskprocessor_push(msg_q_tp, msg_q_cb, msg);
+
+	tps = msg_q_tps[(unsigned int) (ast_str_hash(S_OR(msg->to, ""))
+		^ ast_str_hash(S_OR(msg->from, ""))) % MSG_Q_SHARDS];
+	res = ast_taskprocessor_push(tps, msg_q_cb, msg);
 	if (res == -1) {
 		ao2_ref(msg, -1);
 	}
@@ -1462,8 +1484,18 @@ int ast_msg_handler_unregister(const struct ast_msg_handler *handler)
 
 void ast_msg_shutdown(void)
 {
-	if (msg_q_tp) {
-		msg_q_tp = ast_taskprocessor_unreference(msg_q_tp);
+	int i;
+
+	for (i = 0; i < MSG_Q_SHARDS; i++) {
+		if (msg_q_tps[i]) {
+			msg_q_tps[i] = ast_taskprocessor_unreference(msg_q_tps[i]);
+		}
+	}
+
+	/* Joining the threads releases the channels they routed messages on */
+	if (msg_q_pool) {
+		ast_threadpool_shutdown(msg_q_pool);
+		msg_q_pool = NULL;
 	}
 }
 
@@ -1471,7 +1503,7 @@ void ast_msg_shutdown(void)
  * \internal
  * \brief Clean up other resources on Asterisk shutdown
  *
- * \note This does not include the msg_q_tp object, which must be disposed
+ * \note This does not include the msg_q_tps objects, which must be disposed
  * of prior to Asterisk checking for channel destruction in its shutdown
  * sequence.  The atexit handlers are executed after this occurs.
  */
@@ -1503,13 +1535,30 @@ static void message_shutdown(void)
  */
 int ast_msg_init(void)
 {
+	struct ast_threadpool_options options = {
+		.version = AST_THREADPOOL_OPTIONS_VERSION,
+		.auto_increment = 1,
+		.max_size = MSG_Q_SHARDS,
+		.idle_timeout = 60,
+		.initial_size = 0,
+	};
+	char name[AST_TASKPROCESSOR_MAX_NAME + 1];
 	int res;
+	int i;
 
-	msg_q_tp = ast_taskprocessor_get("ast_msg_queue", TPS_REF_DEFAULT);
-	if (!msg_q_tp) {
+	msg_q_pool = ast_threadpool_create("ast_msg_queue", NULL, &options);
+	if (!msg_q_pool) {
 		return -1;
 	}
 
+	for (i = 0; i < MSG_Q_SHARDS; i++) {
+		ast_taskprocessor_build_name(name, sizeof(name), "ast_msg_queue-%d", i);
+		msg_q_tps[i] = ast_threadpool_serializer(name, msg_q_pool);
+		if (!msg_q_tps[i]) {
+			return -1;
+		}
+	}
+
 	ast_rwlock_init(&msg_techs_lock);
 	if (AST_VECTOR_INIT(&msg_techs, 8)) {
 		return -1;
@@ -29,16 +29,66 @@ ASTERISK_REGISTER_FILE()
 
 #include "asterisk/_private.h"
 #include "asterisk/astobj2.h"
+#include "asterisk/cli.h"
 #include "asterisk/named_locks.h"
 #include "asterisk/utils.h"
 
-struct ao2_container *named_locks;
-#define NAMED_LOCKS_BUCKETS 101
+/*! \brief Number of tables the named locks are spread over, by hash of their key */
+#define NAMED_LOCKS_SHARDS 32
+
+/*! \brief Number of buckets of a table */
+#define NAMED_LOCKS_BUCKETS 31
+
+/*! \brief Longest key, with its keyspace, of a lock which may be recycled */
+#define NAMED_LOCK_RECYCLE_KEY_LEN 80
+
+/*! \brief Released locks kept for recycling, per table and lock type */
+#define NAMED_LOCK_RECYCLE_MAX 8
+
+/*! \brief Statistics of the locks of a keyspace */
+struct named_lock_keyspace {
+	/*! Handles gotten */
+	int gets;
+	/*! Handles gotten for a lock another handle was held for */
+	int shared;
+	/*! Locks allocated */
+	int allocated;
+	/*! Locks recycled from a released one */
+	int recycled;
+	/*! Handles currently held */
+	int held;
+	char name[0];
+};
+
+/*! \brief Keyspaces locks were gotten for, never removed */
+static struct ao2_container *named_lock_keyspaces;
 
 struct ast_named_lock {
+	/*! Keyspace the lock was gotten for */
+	struct named_lock_keyspace *keyspace;
+	/*! Next released lock of the same type in a recycle list */
+	struct ast_named_lock *next;
+	/*! Set if the key storage is NAMED_LOCK_RECYCLE_KEY_LEN long */
+	unsigned int recyclable:1;
 	char key[0];
 };
 
+/*! \brief A table of named locks */
+struct named_locks_shard {
+	/*! Locks a handle is held for */
+	struct ao2_container *locks;
+	/*! Released locks, by lock type, protected by the lock of the table */
+	struct ast_named_lock *recycled[2];
+	/*! Locks in the above lists */
+	int recycled_count[2];
+};
+
+static struct named_locks_shard named_locks[NAMED_LOCKS_SHARDS];
+
+static int recycle_index(enum ast_named_lock_type lock_type)
+{
+	return lock_type == AST_NAMED_LOCK_TYPE_MUTEX ? 0 : 1;
+}
 static int named_locks_hash(const void *obj, const int flags)
 {
 	const struct ast_named_lock *lock = obj;
@@ -80,47 +130,213 @@ static int named_locks_cmp(void *obj_left, void *obj_right, int flags)
 	return cmp ? 0 : CMP_MATCH;
 }
 
+AO2_STRING_FIELD_HASH_FN(named_lock_keyspace, name);
+AO2_STRING_FIELD_CMP_FN(named_lock_keyspace, name);
+
+static struct named_lock_keyspace *named_lock_keyspace_get(const char *keyspace)
+{
+	struct named_lock_keyspace *stats;
+
+	stats = ao2_find(named_lock_keyspaces, keyspace, OBJ_SEARCH_KEY);
+	if (stats) {
+		return stats;
+	}
+
+	ao2_wrlock(named_lock_keyspaces);
+	stats = ao2_find(named_lock_keyspaces, keyspace, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!stats) {
+		stats = ao2_alloc_options(sizeof(*stats) + strlen(keyspace) + 1, NULL,
+			AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (stats) {
+			strcpy(stats->name, keyspace); /* Safe */
+			ao2_link_flags(named_lock_keyspaces, stats, OBJ_NOLOCK);
+		}
+	}
+	ao2_unlock(named_lock_keyspaces);
+
+	return stats;
+}
+
+static void named_lock_destroy(void *obj)
+{
+	struct ast_named_lock *lock = obj;
+
+	ao2_cleanup(lock->keyspace);
+}
+
+static char *handle_show_named_locks(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-30.30s %12s %12s %12s %12s %8s\n"
+#define FORMAT2 "%-30.30s %12d %12d %12d %12d %8d\n"
+	struct ao2_iterator iter;
+	struct named_lock_keyspace *stats;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show named locks";
+		e->usage =
+			"Usage: core show named locks\n"
+			"       Show statistics of the named locks of each keyspace.  Shared\n"
+			"       counts handles gotten while another was held for the same\n"
+			"       key, which are the ones likely to have waited for the lock.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, FORMAT, "Keyspace", "Gets", "Shared", "Allocated", "Recycled", "Held");
+	iter = ao2_iterator_init(named_lock_keyspaces, 0);
+	for (; (stats = ao2_iterator_next(&iter)); ao2_ref(stats, -1)) {
+		ast_cli(a->fd, FORMAT2, stats->name, stats->gets, stats->shared,
+			stats->allocated, stats->recycled, stats->held);
+	}
+	ao2_iterator_destroy(&iter);
+
+	return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+static struct ast_cli_entry cli_named_locks[] = {
+	AST_CLI_DEFINE(handle_show_named_locks, "Show named lock statistics"),
+};
+
 static void named_locks_shutdown(void)
 {
-	ao2_cleanup(named_locks);
+	struct ast_named_lock *lock;
+	int i;
+	int type;
+
+	ast_cli_unregister_multiple(cli_named_locks, ARRAY_LEN(cli_named_locks));
+
+	for (i = 0; i < NAMED_LOCKS_SHARDS; i++) {
+		for (type = 0; type < ARRAY_LEN(named_locks[i].recycled); type++) {
+			while ((lock = named_locks[i].recycled[type])) {
+				named_locks[i].recycled[type] = lock->next;
+				ao2_ref(lock, -1);
+			}
+		}
+		ao2_cleanup(named_locks[i].locks);
+		named_locks[i].locks = NULL;
+	}
+
+	ao2_cleanup(named_lock_keyspaces);
+	named_lock_keyspaces = NULL;
 }
 
 int ast_named_locks_init(void)
 {
-	named_locks = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0,
-		NAMED_LOCKS_BUCKETS, named_locks_hash, NULL, named_locks_cmp);
-	if (!named_locks) {
+	int i;
+
+	ast_register_cleanup(named_locks_shutdown);
+
+	for (i = 0; i < NAMED_LOCKS_SHARDS; i++) {
+		named_locks[i].locks = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0,
+			NAMED_LOCKS_BUCKETS, named_locks_hash, NULL, named_locks_cmp);
+		if (!named_locks[i].locks) {
+			return -1;
+		}
+	}
+
+	named_lock_keyspaces = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0,
+		NAMED_LOCKS_BUCKETS, named_lock_keyspace_hash_fn, NULL, named_lock_keyspace_cmp_fn);
+	if (!named_lock_keyspaces) {
 		return -1;
 	}
 
-	ast_register_cleanup(named_locks_shutdown);
+	ast_cli_register_multiple(cli_named_locks, ARRAY_LEN(cli_named_locks));
 
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Get a lock for a key not in a table
+ *
+ * A released lock of the type is recycled if the key fits in it.
+ *
+ * \note Called with the table locked
+ */
+static struct ast_named_lock *named_lock_alloc(struct named_locks_shard *shard,
+	enum ast_named_lock_type lock_type, struct named_lock_keyspace *stats, const char *key)
+{
+	int type = recycle_index(lock_type);
+	size_t key_len = strlen(key) + 1;
+	struct ast_named_lock *lock = NULL;
+
+	if (key_len <= NAMED_LOCK_RECYCLE_KEY_LEN) {
+		lock = shard->recycled[type];
+		if (lock) {
+			shard->recycled[type] = lock->next;
+			shard->recycled_count[type]--;
+			lock->next = NULL;
+			ast_atomic_fetchadd_int(&stats->recycled, +1);
+		} else {
+			lock = ao2_alloc_options(sizeof(*lock) + NAMED_LOCK_RECYCLE_KEY_LEN,
+				named_lock_destroy, lock_type);
+			if (lock) {
+				lock->recyclable = 1;
+				ast_atomic_fetchadd_int(&stats->allocated, +1);
+			}
+		}
+	} else {
+		lock = ao2_alloc_options(sizeof(*lock) + key_len, named_lock_destroy, lock_type);
+		if (lock) {
+			ast_atomic_fetchadd_int(&stats->allocated, +1);
+		}
+	}
+
+	if (!lock) {
+		return NULL;
+	}
+
+	strcpy(lock->key, key); /* Safe */
+	ao2_replace(lock->keyspace, stats);
+
+	return lock;
+}
+
 struct ast_named_lock *__ast_named_lock_get(const char *filename, int lineno, const char *func,
 	enum ast_named_lock_type lock_type, const char *keyspace, const char *key)
 {
 	struct ast_named_lock *lock = NULL;
+	struct named_lock_keyspace *stats;
+	struct named_locks_shard *shard;
 	int concat_key_buff_len = strlen(keyspace) + strlen(key) + 2;
 	char *concat_key = ast_alloca(concat_key_buff_len);
 
 	sprintf(concat_key, "%s-%s", keyspace, key); /* Safe */
 
-	ao2_lock(named_locks);
-	lock = ao2_find(named_locks, concat_key, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	stats = named_lock_keyspace_get(keyspace);
+	if (!stats) {
+		return NULL;
+	}
+
+	shard = &named_locks[ast_str_hash(concat_key) % NAMED_LOCKS_SHARDS];
+
+	ao2_lock(shard->locks);
+	lock = ao2_find(shard->locks, concat_key, OBJ_SEARCH_KEY | OBJ_NOLOCK);
 	if (lock) {
-		ao2_unlock(named_locks);
+		ao2_unlock(shard->locks);
 		ast_assert((ao2_options_get(lock) & AO2_ALLOC_OPT_LOCK_MASK) == lock_type);
-		return lock;
+		ast_atomic_fetchadd_int(&stats->shared, +1);
+	} else {
+		lock = named_lock_alloc(shard, lock_type, stats, concat_key);
+		if (lock) {
+			ao2_link_flags(shard->locks, lock, OBJ_NOLOCK);
+		}
+		ao2_unlock(shard->locks);
 	}
 
-	lock = ao2_alloc_options(sizeof(*lock) + concat_key_buff_len, NULL, lock_type);
 	if (lock) {
-		strcpy(lock->key, concat_key); /* Safe */
-		ao2_link_flags(named_locks, lock, OBJ_NOLOCK);
+		ast_atomic_fetchadd_int(&stats->gets, +1);
+		ast_atomic_fetchadd_int(&stats->held, +1);
 	}
-	ao2_unlock(named_locks);
+	ao2_ref(stats, -1);
 
 	return lock;
 }
@@ -128,15 +344,30 @@ struct ast_named_lock *__ast_named_lock_get(const char *filename, int lineno, co
 int __ast_named_lock_put(const char *filename, int lineno, const char *func,
 	struct ast_named_lock *lock)
 {
+	struct named_locks_shard *shard;
+	int type;
+
 	if (!lock) {
 		return -1;
 	}
 
-	ao2_lock(named_locks);
+	ast_atomic_fetchadd_int(&lock->keyspace->held, -1);
+
+	shard = &named_locks[ast_str_hash(lock->key) % NAMED_LOCKS_SHARDS];
+	type = recycle_index(ao2_options_get(lock) & AO2_ALLOC_OPT_LOCK_MASK);
+
+	ao2_lock(shard->locks);
 	if (ao2_ref(lock, -1) == 2) {
-		ao2_unlink_flags(named_locks, lock, OBJ_NOLOCK);
+		/* No handle is held anymore, so nobody else can have the lock */
+		if (lock->recyclable && shard->recycled_count[type] < NAMED_LOCK_RECYCLE_MAX) {
+			ao2_ref(lock, +1);
+			lock->next = shard->recycled[type];
+			shard->recycled[type] = lock;
+			shard->recycled_count[type]++;
+		}
+		ao2_unlink_flags(shard->locks, lock, OBJ_NOLOCK);
 	}
-	ao2_unlock(named_locks);
+	ao2_unlock(shard->locks);
 
 	return 0;
 }
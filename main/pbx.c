@@ -68,11 +68,13 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/module.h"
 #include "asterisk/indications.h"
 #include "asterisk/taskprocessor.h"
+#include "asterisk/threadpool.h"
 #include "asterisk/xmldoc.h"
 #include "asterisk/astobj2.h"
 #include "asterisk/stasis_channels.h"
 #include "asterisk/dial.h"
 #include "asterisk/vector.h"
+#include "asterisk/affinity.h"
 #include "pbx_private.h"
 
 /*!
@@ -249,6 +251,7 @@ struct ast_exten {
 	struct ast_app *cached_app;     /*!< Cached location of application */
 	void *data;			/*!< Data to use (arguments) */
 	void (*datad)(void *);		/*!< Data destructor */
+	struct pbx_template *data_template;	/*!< Data parsed for variable substitution */
 	struct ast_exten *peer;		/*!< Next higher priority with our extension */
 	struct ast_hashtab *peer_table;    /*!< Priorities list in hashtab form -- only on the head of the peer list */
 	struct ast_hashtab *peer_label_table; /*!< labeled priorities in the peers -- only on the head of the peer list */
@@ -321,6 +324,9 @@ struct ast_context {
 	int refcount;                   /*!< each module that would have created this context should inc/dec this as appropriate */
 	AST_LIST_HEAD_NOLOCK(, ast_sw) alts;	/*!< Alternative switches */
 	ast_mutex_t macrolock;			/*!< A lock to implement "exclusive" macros - held whilst a call is executing in the macro */
+	int has_cidmatch;			/*!< Set once an extension matching on caller id is added, never cleared */
+	int version;				/*!< Bumped each time the context may have been changed */
+	int merged_version;			/*!< Version the last dialplan merge copied the context at */
 	char name[0];				/*!< Name of the context */
 };
 
@@ -360,6 +366,7 @@ struct ast_hint {
 
 	/*! Dev state variables */
 	int laststate;			/*!< Last known device state */
+	int update_pending;		/*!< Queued to have its device state worked out again */
 
 	/*! Presence state variables */
 	int last_presence_state;     /*!< Last known presence state */
@@ -733,6 +740,8 @@ static int totalcalls;
 
 static struct ast_context *contexts;
 static struct ast_hashtab *contexts_table = NULL;
+/*! \brief Bumped, with conlock held, each time a context is linked into or unlinked from contexts */
+static int contexts_version;
 
 /*!
  * \brief Lock for the ast_context list
@@ -2386,6 +2395,9 @@ struct fake_context /* this struct is purely for matching in the hashtab */
 	int refcount;
 	AST_LIST_HEAD_NOLOCK(, ast_sw) alts;
 	ast_mutex_t macrolock;
+	int has_cidmatch;
+	int version;
+	int merged_version;
 	char name[256];
 };
 
@@ -2431,6 +2443,32 @@ static int matchcid(const char *cidpattern, const char *callerid)
 	return ast_extension_match(cidpattern, callerid);
 }
 
+/*!
+ * \internal
+ * \brief Find the extension a literal extension name exactly matches
+ *
+ * Every extension is in the context's root_table, so an exact match on
+ * one that is not a pattern can be looked up rather than searched for.
+ * Nothing is a better match than that, unless the context has extensions
+ * that match on caller id.
+ *
+ * \retval NULL if there is no such extension or it has to be searched for
+ */
+static struct ast_exten *find_exact_extension(struct ast_context *con, const char *exten, enum ext_match_t action)
+{
+	struct ast_exten ex = {
+		.exten = (char *) exten,
+		.matchcid = AST_EXT_MATCHCID_OFF,
+	};
+
+	if ((action & E_MATCH_MASK) != E_MATCH || con->has_cidmatch || !con->root_table
+		|| ast_strlen_zero(exten) || exten[0] == '_' || strpbrk(exten, " -")) {
+		return NULL;
+	}
+
+	return ast_hashtab_lookup(con->root_table, &ex);
+}
+
 struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 	struct ast_context *bypass, struct pbx_find_info *q,
 	const char *context, const char *exten, int priority,
@@ -2486,17 +2524,6 @@ struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 	score.total_specificity = 0;
 	score.exten = 0;
 	score.total_length = 0;
-	if (!tmp->pattern_tree && tmp->root_table) {
-		create_match_char_tree(tmp);
-#ifdef NEED_DEBUG
-		ast_debug(1, "Tree Created in context %s:\n", context);
-		log_match_char_tree(tmp->pattern_tree," ");
-#endif
-	}
-#ifdef NEED_DEBUG
-	ast_log(LOG_NOTICE, "The Trie we are searching in:\n");
-	log_match_char_tree(tmp->pattern_tree, "::  ");
-#endif
 
 	do {
 		if (!ast_strlen_zero(overrideswitch)) {
@@ -2557,7 +2584,33 @@ struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 		}
 	} while (0);
 
+	if ((eroot = find_exact_extension(tmp, exten, action))) {
+		if (action == E_FINDLABEL && label) {
+			e = ast_hashtab_lookup(eroot->peer_label_table, &pattern);
+		} else {
+			e = ast_hashtab_lookup(eroot->peer_table, &pattern);
+		}
+		if (e) {
+			q->status = STATUS_SUCCESS;
+			q->foundcontext = context;
+			return e;
+		}
+		/* Another extension may have the priority, search for it */
+	}
+
 	if (extenpatternmatchnew) {
+		/* Only built once something that is not an exact match is looked for */
+		if (!tmp->pattern_tree && tmp->root_table) {
+			create_match_char_tree(tmp);
+#ifdef NEED_DEBUG
+			ast_debug(1, "Tree Created in context %s:\n", context);
+			log_match_char_tree(tmp->pattern_tree," ");
+#endif
+		}
+#ifdef NEED_DEBUG
+		ast_log(LOG_NOTICE, "The Trie we are searching in:\n");
+		log_match_char_tree(tmp->pattern_tree, "::  ");
+#endif
 		new_find_extension(exten, &score, tmp->pattern_tree, 0, 0, callerid, label, action);
 		eroot = score.exten;
 
@@ -2798,6 +2851,14 @@ static struct ast_custom_function exception_function = {
 	.read = acf_exception_read,
 };
 
+/*! \brief Check if application data has variables or expressions to substitute */
+static int needs_substitution(const char *data)
+{
+	const char *tmp;
+
+	return data && (tmp = strchr(data, '$')) && (strstr(tmp, "${") || strstr(tmp, "$["));
+}
+
 /*!
  * \brief The return value depends on the action:
  *
@@ -2823,6 +2884,7 @@ static int pbx_extension_helper(struct ast_channel *c, struct ast_context *con,
 	struct ast_exten *e;
 	struct ast_app *app;
 	char *substitute = NULL;
+	struct pbx_template *data_template = NULL;
 	int res;
 	struct pbx_find_info q = { .stacklen = 0 }; /* the rest is reset in pbx_find_extension */
 	char passdata[EXT_DATA_SIZE];
@@ -2849,9 +2911,11 @@ static int pbx_extension_helper(struct ast_channel *c, struct ast_context *con,
 			app = e->cached_app;
 			if (ast_strlen_zero(e->data)) {
 				*passdata = '\0';
+			} else if (e->data_template) {
+				/* keep the parsed data for after the lock is released */
+				data_template = ao2_bump(e->data_template);
 			} else {
-				const char *tmp;
-				if ((!(tmp = strchr(e->data, '$'))) || (!strstr(tmp, "${") && !strstr(tmp, "$["))) {
+				if (!needs_substitution(e->data)) {
 					/* no variables to substitute, copy on through */
 					ast_copy_string(passdata, e->data, sizeof(passdata));
 				} else {
@@ -2862,6 +2926,7 @@ static int pbx_extension_helper(struct ast_channel *c, struct ast_context *con,
 			ast_unlock_contexts();
 			if (!app) {
 				ast_log(LOG_WARNING, "No application '%s' for extension (%s, %s, %d)\n", e->app, context, exten, priority);
+				ao2_cleanup(data_template);
 				return -1;
 			}
 			if (ast_channel_context(c) != context)
@@ -2869,7 +2934,10 @@ static int pbx_extension_helper(struct ast_channel *c, struct ast_context *con,
 			if (ast_channel_exten(c) != exten)
 				ast_channel_exten_set(c, exten);
 			ast_channel_priority_set(c, priority);
-			if (substitute) {
+			if (data_template) {
+				pbx_template_substitute(c, data_template, passdata, sizeof(passdata)-1);
+				ao2_ref(data_template, -1);
+			} else if (substitute) {
 				pbx_substitute_variables_helper(c, substitute, passdata, sizeof(passdata)-1);
 			}
 			ast_debug(1, "Launching '%s'\n", app_name(app));
@@ -3499,6 +3567,109 @@ static void presence_state_notify_callbacks(
 	ao2_iterator_destroy(&cb_iter);
 }
 
+/*!
+ * \brief Number of serializers hint device state updates are spread over
+ *
+ * \note Each hint is always updated by the same serializer, so the
+ * watchers of a hint see its changes in order.
+ */
+#define HINT_UPDATE_SHARDS 8
+
+AST_VECTOR(hint_update_vector, struct ast_hint *);
+
+/*! \brief Hints waiting for their device state to be worked out again */
+struct hint_update_shard {
+	ast_mutex_t lock;
+	struct ast_taskprocessor *serializer;
+	/*! The hints to update, each holding a reference */
+	struct hint_update_vector pending;
+	/*! Set while a task to update the pending hints is queued */
+	int scheduled;
+};
+
+static struct hint_update_shard hint_update_shards[HINT_UPDATE_SHARDS];
+
+/*! \brief Threadpool the hint update serializers run on */
+static struct ast_threadpool *hint_update_pool;
+
+static int hint_update_task(void *data)
+{
+	struct hint_update_shard *shard = data;
+	struct hint_update_vector pending;
+	struct ast_str *hint_app;
+	int i;
+
+	/* Take all the hints queued so far; any queued from now on get another task */
+	ast_mutex_lock(&shard->lock);
+	pending = shard->pending;
+	AST_VECTOR_INIT(&shard->pending, 8);
+	shard->scheduled = 0;
+	ast_mutex_unlock(&shard->lock);
+
+	hint_app = ast_str_create(1024);
+
+	for (i = 0; i < AST_VECTOR_SIZE(&pending); i++) {
+		struct ast_hint *hint = AST_VECTOR_GET(&pending, i);
+
+		ao2_lock(hint);
+		hint->update_pending = 0;
+		ao2_unlock(hint);
+
+		/* However many of its devices changed, the hint is worked out once */
+		if (hint_app) {
+			device_state_notify_callbacks(hint, &hint_app);
+		}
+		ao2_ref(hint, -1);
+	}
+
+	ast_free(hint_app);
+	AST_VECTOR_FREE(&pending);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Queue a hint to have its device state worked out again
+ *
+ * \retval 0 if queued, or already waiting to be updated.
+ * \retval -1 if the hint could not be queued and must be updated by the caller.
+ *
+ * \note The serializers only exist once load_pbx() has run.
+ */
+static int queue_hint_update(struct ast_hint *hint)
+{
+	struct hint_update_shard *shard;
+	int res = 0;
+
+	shard = &hint_update_shards[((uintptr_t) hint / sizeof(void *)) % HINT_UPDATE_SHARDS];
+
+	ao2_lock(hint);
+	if (hint->update_pending) {
+		ao2_unlock(hint);
+		return 0;
+	}
+
+	ast_mutex_lock(&shard->lock);
+	if (!shard->serializer || AST_VECTOR_APPEND(&shard->pending, hint)) {
+		res = -1;
+	} else {
+		ao2_ref(hint, +1);
+		hint->update_pending = 1;
+		if (!shard->scheduled) {
+			if (ast_taskprocessor_push(shard->serializer, hint_update_task, shard)) {
+				/* Retried by the next hint queued on this shard */
+				ast_log(LOG_WARNING, "Unable to queue hint device state updates\n");
+			} else {
+				shard->scheduled = 1;
+			}
+		}
+	}
+	ast_mutex_unlock(&shard->lock);
+	ao2_unlock(hint);
+
+	return res;
+}
+
 static int handle_hint_change_message_type(struct stasis_message *msg, enum ast_state_cb_update_reason reason)
 {
 	struct ast_hint *hint;
@@ -3516,7 +3687,9 @@ static int handle_hint_change_message_type(struct stasis_message *msg, enum ast_
 
 	switch (reason) {
 	case AST_HINT_UPDATE_DEVICE:
-		device_state_notify_callbacks(hint, &hint_app);
+		if (queue_hint_update(hint)) {
+			device_state_notify_callbacks(hint, &hint_app);
+		}
 		break;
 	case AST_HINT_UPDATE_PRESENCE:
 		{
@@ -3594,7 +3767,8 @@ static void device_state_cb(void *unused, struct stasis_subscription *sub, struc
 	}
 
 	for (; (device = ao2_iterator_next(dev_iter)); ao2_t_ref(device, -1, "Next device")) {
-		if (device->hint) {
+		/* Hints are worked out on the update serializers, once per batch of changes */
+		if (device->hint && queue_hint_update(device->hint)) {
 			device_state_notify_callbacks(device->hint, &hint_app);
 		}
 	}
@@ -4590,6 +4764,7 @@ static void destroy_exten(struct ast_exten *e)
 		ast_hashtab_destroy(e->peer_label_table, 0);
 	if (e->datad)
 		e->datad(e->data);
+	ao2_cleanup(e->data_template);
 	ast_free(e);
 }
 
@@ -4605,6 +4780,7 @@ static void *pbx_thread(void *data)
 	 */
 	struct ast_channel *c = data;
 
+	ast_thread_class_set(AST_THREAD_CLASS_CHANNEL);
 	__ast_pbx_run(c, NULL);
 	decrease_call_count();
 
@@ -6105,6 +6281,7 @@ struct ast_context *ast_context_find_or_create(struct ast_context **extcontexts,
 		tmp = ast_hashtab_lookup(contexts_table, &search);
 		if (tmp) {
 			tmp->refcount++;
+			ast_atomic_fetchadd_int(&tmp->version, 1);
 			ast_unlock_contexts();
 			return tmp;
 		}
@@ -6139,6 +6316,7 @@ struct ast_context *ast_context_find_or_create(struct ast_context **extcontexts,
 		tmp->next = *local_contexts;
 		*local_contexts = tmp;
 		ast_hashtab_insert_safe(contexts_table, tmp); /*put this context into the tree */
+		++contexts_version;
 		ast_unlock_contexts();
 		ast_verb(3, "Registered extension context '%s'; registrar: %s\n", tmp->name, registrar);
 	} else {
@@ -6292,6 +6470,133 @@ static void context_merge(struct ast_context **extcontexts, struct ast_hashtab *
 }
 
 
+/*!
+ * \internal
+ * \brief Remove what was merged into a context of the new dialplan
+ *
+ * Anything in the new dialplan that is not the registrar's was merged in
+ * from the old one.  A context that is left empty of its own is destroyed,
+ * as it was only created to hold what was merged.
+ */
+static void context_merge_strip(struct ast_context **extcontexts, struct ast_hashtab *exttable,
+	struct ast_context *new, const char *registrar)
+{
+	struct ast_ignorepat *ip, **ipp;
+	struct ast_include *i, **ip_inc;
+	struct ast_sw *sw;
+	struct ast_exten *exten_item, *prio_item;
+	struct ast_hashtab_iter *exten_iter;
+	struct ast_hashtab_iter *prio_iter;
+	struct ast_context **pos;
+	AST_VECTOR(, struct ast_exten *) merged;
+	int idx;
+
+	for (ipp = &new->ignorepats; (ip = *ipp); ) {
+		if (strcmp(ip->registrar, registrar)) {
+			*ipp = ip->next;
+			ast_free(ip);
+		} else {
+			ipp = &ip->next;
+		}
+	}
+	for (ip_inc = &new->includes; (i = *ip_inc); ) {
+		if (strcmp(i->registrar, registrar)) {
+			*ip_inc = i->next;
+			include_free(i);
+		} else {
+			ip_inc = &i->next;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&new->alts, sw, list) {
+		if (strcmp(sw->registrar, registrar)) {
+			AST_LIST_REMOVE_CURRENT(list);
+			ast_free(sw);
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+
+	/* Removing priorities changes the tables, so find them all first */
+	if (new->root_table && !AST_VECTOR_INIT(&merged, 0)) {
+		exten_iter = ast_hashtab_start_traversal(new->root_table);
+		while ((exten_item = ast_hashtab_next(exten_iter))) {
+			prio_iter = ast_hashtab_start_traversal(exten_item->peer_table);
+			while ((prio_item = ast_hashtab_next(prio_iter))) {
+				if (strcmp(prio_item->registrar, registrar)) {
+					AST_VECTOR_APPEND(&merged, prio_item);
+				}
+			}
+			ast_hashtab_end_traversal(prio_iter);
+		}
+		ast_hashtab_end_traversal(exten_iter);
+
+		for (idx = 0; idx < AST_VECTOR_SIZE(&merged); ++idx) {
+			char extension[AST_MAX_EXTENSION];
+			char cidmatch[AST_MAX_EXTENSION];
+
+			/* Each priority is freed as it is removed, so copy what identifies it */
+			prio_item = AST_VECTOR_GET(&merged, idx);
+			ast_copy_string(extension, prio_item->exten, sizeof(extension));
+			ast_copy_string(cidmatch, prio_item->cidmatch, sizeof(cidmatch));
+			ast_context_remove_extension_callerid2(new, extension, prio_item->priority,
+				cidmatch, prio_item->matchcid, NULL, 0);
+		}
+		AST_VECTOR_FREE(&merged);
+	}
+
+	if (strcmp(new->registrar, registrar) && !new->root && !new->includes
+		&& !new->ignorepats && AST_LIST_EMPTY(&new->alts)) {
+		ast_hashtab_remove_this_object(exttable, new);
+		for (pos = extcontexts; *pos; pos = &(*pos)->next) {
+			if (*pos == new) {
+				*pos = new->next;
+				break;
+			}
+		}
+		__ast_internal_context_destroy(new);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Merge the current dialplan into the new one without holding up lookups
+ *
+ * Each context is merged with only its own lock held, so the contexts lock
+ * is only taken to move on to the next one.  The version each context was
+ * merged at is recorded, so that ones changed since can be merged again.
+ *
+ * \param version Set to the contexts_version the merge was done at
+ *
+ * \retval 0 on success
+ * \retval -1 if contexts were added or removed meanwhile, and everything
+ * has to be merged again
+ */
+static int context_merge_unlocked(struct ast_context **extcontexts, struct ast_hashtab *exttable,
+	const char *registrar, int *version)
+{
+	struct ast_context *tmp;
+
+	ast_rdlock_contexts();
+	*version = contexts_version;
+	for (tmp = contexts; tmp; tmp = tmp->next) {
+		ast_rdlock_context(tmp);
+		ast_unlock_contexts();
+
+		tmp->merged_version = tmp->version;
+		context_merge(extcontexts, exttable, tmp, registrar);
+		ast_unlock_context(tmp);
+
+		/* Nothing can be unlinked, so tmp is still there, unless the version changed */
+		ast_rdlock_contexts();
+		if (contexts_version != *version) {
+			ast_unlock_contexts();
+			return -1;
+		}
+	}
+	ast_unlock_contexts();
+
+	return 0;
+}
+
 /* XXX this does not check that multiple contexts are merged */
 void ast_merge_contexts_and_delete(struct ast_context **extcontexts, struct ast_hashtab *exttable, const char *registrar)
 {
@@ -6312,6 +6617,10 @@ void ast_merge_contexts_and_delete(struct ast_context **extcontexts, struct ast_
 	struct timeval writelocktime;
 	struct timeval endlocktime;
 	struct timeval enddeltime;
+	struct ast_context *next;
+	struct ast_context *new;
+	int merged;
+	int version;
 
 	/*
 	 * It is very important that this function hold the hints
@@ -6327,6 +6636,13 @@ void ast_merge_contexts_and_delete(struct ast_context **extcontexts, struct ast_
 
 	begintime = ast_tvnow();
 	ast_mutex_lock(&context_merge_lock);/* Serialize ast_merge_contexts_and_delete */
+
+	/*
+	 * Merge most of the current dialplan before taking the contexts
+	 * lock, as every extension lookup needs that lock.
+	 */
+	merged = !context_merge_unlocked(extcontexts, exttable, registrar, &version);
+
 	ast_wrlock_contexts();
 
 	if (!contexts_table) {
@@ -6338,11 +6654,28 @@ void ast_merge_contexts_and_delete(struct ast_context **extcontexts, struct ast_
 		return;
 	}
 
-	iter = ast_hashtab_start_traversal(contexts_table);
-	while ((tmp = ast_hashtab_next(iter))) {
-		context_merge(extcontexts, exttable, tmp, registrar);
+	if (!merged || contexts_version != version) {
+		/* Contexts came or went meanwhile, start over with everything locked */
+		for (tmp = *extcontexts; tmp; tmp = next) {
+			next = tmp->next;
+			context_merge_strip(extcontexts, exttable, tmp, registrar);
+		}
+		iter = ast_hashtab_start_traversal(contexts_table);
+		while ((tmp = ast_hashtab_next(iter))) {
+			context_merge(extcontexts, exttable, tmp, registrar);
+		}
+		ast_hashtab_end_traversal(iter);
+	} else {
+		/* Only contexts that changed after being merged need merging again */
+		for (tmp = contexts; tmp; tmp = tmp->next) {
+			if (tmp->version != tmp->merged_version) {
+				if ((new = ast_hashtab_lookup(exttable, tmp))) {
+					context_merge_strip(extcontexts, exttable, new, registrar);
+				}
+				context_merge(extcontexts, exttable, tmp, registrar);
+			}
+		}
 	}
-	ast_hashtab_end_traversal(iter);
 
 	ao2_lock(hints);
 	writelocktime = ast_tvnow();
@@ -6443,6 +6776,11 @@ void ast_merge_contexts_and_delete(struct ast_context **extcontexts, struct ast_
 			hint->last_presence_subtype = saved_hint->last_presence_subtype;
 			hint->last_presence_message = saved_hint->last_presence_message;
 			ao2_unlock(hint);
+			/*
+			 * Device changes may have been worked out against the old hint
+			 * while the watchers were being moved, so check the state again.
+			 */
+			queue_hint_update(hint);
 			ao2_ref(hint, -1);
 			/*
 			 * The free of saved_hint->last_presence_subtype and
@@ -6489,8 +6827,6 @@ void ast_merge_contexts_and_delete(struct ast_context **extcontexts, struct ast_
 	ast_hashtab_destroy(oldtable, NULL);
 
 	for (tmp = oldcontextslist; tmp; ) {
-		struct ast_context *next;	/* next starting point */
-
 		next = tmp->next;
 		__ast_internal_context_destroy(tmp);
 		tmp = next;
@@ -7093,6 +7429,7 @@ static int add_priority(struct ast_context *con, struct ast_exten *tmp,
 		/* Destroy the old one */
 		if (e->datad)
 			e->datad(e->data);
+		ao2_cleanup(e->data_template);
 		ast_free(e);
 	} else {	/* Slip ourselves in just before e */
 		tmp->peer = e;
@@ -7298,11 +7635,19 @@ static int ast_add_extension2_lockopt(struct ast_context *con,
 	tmp->data = data;
 	tmp->datad = datad;
 	tmp->registrar = registrar;
+	if (priority != PRIORITY_HINT && needs_substitution(data)) {
+		/* Parse it now rather than every time the priority is executed */
+		tmp->data_template = pbx_template_compile(data);
+	}
 
 	if (lock_context) {
 		ast_wrlock_context(con);
 	}
 
+	if (tmp->matchcid == AST_EXT_MATCHCID_ON) {
+		con->has_cidmatch = 1;
+	}
+
 	if (con->pattern_tree) { /* usually, on initial load, the pattern_tree isn't formed until the first find_exten; so if we are adding
 								an extension, and the trie exists, then we need to incrementally add this pattern to it. */
 		ext_strncpy(dummy_name, tmp->exten, sizeof(dummy_name), 1);
@@ -7351,6 +7696,7 @@ static int ast_add_extension2_lockopt(struct ast_context *con,
 				/* if you free this, null it out */
 				tmp->data = NULL;
 			}
+			ao2_cleanup(tmp->data_template);
 
 			ast_free(tmp);
 		}
@@ -7540,6 +7886,33 @@ static void *pbx_outgoing_exec(void *data)
 	return NULL;
 }
 
+/*! \brief Threads dialing outgoing legs for callers not waiting for the call to complete */
+static struct ast_threadpool *outgoing_pool;
+
+static int pbx_outgoing_task(void *data)
+{
+	pbx_outgoing_exec(data);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Run pbx_outgoing_exec() on another thread
+ *
+ * Threads of the pool are reused by later originates instead of each
+ * originate starting a thread of its own.
+ */
+static int pbx_outgoing_start(struct pbx_outgoing *outgoing)
+{
+	pthread_t thread;
+
+	if (outgoing_pool && !ast_threadpool_push(outgoing_pool, pbx_outgoing_task, outgoing)) {
+		return 0;
+	}
+
+	return ast_pthread_create_detached(&thread, NULL, pbx_outgoing_exec, outgoing);
+}
+
 /*! \brief Internal dialing state callback which causes early media to trigger an answer */
 static void pbx_outgoing_state_callback(struct ast_dial *dial)
 {
@@ -7615,7 +7988,6 @@ static int pbx_outgoing_attempt(const char *type, struct ast_format_cap *cap,
 {
 	RAII_VAR(struct pbx_outgoing *, outgoing, NULL, ao2_cleanup);
 	struct ast_channel *dialed;
-	pthread_t thread;
 
 	outgoing = ao2_alloc(sizeof(*outgoing), pbx_outgoing_destroy);
 	if (!outgoing) {
@@ -7729,7 +8101,7 @@ static int pbx_outgoing_attempt(const char *type, struct ast_format_cap *cap,
 	} else {
 		outgoing->in_separate_thread = 1;
 
-		if (ast_pthread_create_detached(&thread, NULL, pbx_outgoing_exec, outgoing)) {
+		if (pbx_outgoing_start(outgoing)) {
 			ast_log(LOG_WARNING, "Unable to spawn dialing thread for '%s/%s'\n", type, addr);
 			ao2_ref(outgoing, -1);
 			if (locked_channel) {
@@ -8038,6 +8410,7 @@ void __ast_context_destroy(struct ast_context *list, struct ast_hashtab *context
 					tmpl->next = next;
 				else
 					contexts = next;
+				++contexts_version;
 				/* Okay, now we're safe to let it go -- in a sense, we were
 				   ready to let it go as soon as we locked it. */
 				ast_unlock_context(tmp);
@@ -8059,6 +8432,7 @@ void __ast_context_destroy(struct ast_context *list, struct ast_hashtab *context
 				tmpl->next = next;
 			else
 				contexts = next;
+			++contexts_version;
 			/* Okay, now we're safe to let it go -- in a sense, we were
 			   ready to let it go as soon as we locked it. */
 			ast_unlock_context(tmp);
@@ -8298,6 +8672,62 @@ static int action_extensionstatelist(struct mansession *s, const struct message
 }
 
 
+/*!
+ * \internal
+ * \brief Start the threadpool and serializers hint device state updates run on.
+ */
+static int outgoing_init(void)
+{
+	struct ast_threadpool_options options = {
+		.version = AST_THREADPOOL_OPTIONS_VERSION,
+		.auto_increment = 8,
+		/* Every originate needs its thread for as long as it rings */
+		.max_size = 0,
+		.idle_timeout = 60,
+		.initial_size = 0,
+	};
+
+	outgoing_pool = ast_threadpool_create("pbx-outgoing", NULL, &options);
+	return outgoing_pool ? 0 : -1;
+}
+
+static int hint_update_init(void)
+{
+	struct ast_threadpool_options options = {
+		.version = AST_THREADPOOL_OPTIONS_VERSION,
+		.auto_increment = 1,
+		.max_size = HINT_UPDATE_SHARDS,
+		.idle_timeout = 60,
+		.initial_size = 0,
+	};
+	char name[AST_TASKPROCESSOR_MAX_NAME + 1];
+	int i;
+
+	for (i = 0; i < HINT_UPDATE_SHARDS; i++) {
+		struct hint_update_shard *shard = &hint_update_shards[i];
+
+		ast_mutex_init(&shard->lock);
+		if (AST_VECTOR_INIT(&shard->pending, 8)) {
+			return -1;
+		}
+	}
+
+	hint_update_pool = ast_threadpool_create("pbx-hints", NULL, &options);
+	if (!hint_update_pool) {
+		return -1;
+	}
+
+	for (i = 0; i < HINT_UPDATE_SHARDS; i++) {
+		ast_taskprocessor_build_name(name, sizeof(name), "pbx-hint-%d", i);
+		hint_update_shards[i].serializer = ast_threadpool_serializer(name, hint_update_pool);
+		if (!hint_update_shards[i].serializer) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 /*!
  * \internal
  * \brief Clean up resources on Asterisk shutdown.
@@ -8306,9 +8736,37 @@ static int action_extensionstatelist(struct mansession *s, const struct message
  */
 static void unload_pbx(void)
 {
+	int i;
+
 	presence_state_sub = stasis_unsubscribe_and_join(presence_state_sub);
 	device_state_sub = stasis_unsubscribe_and_join(device_state_sub);
 
+	ast_threadpool_shutdown(outgoing_pool);
+	outgoing_pool = NULL;
+
+	if (hint_update_pool) {
+		for (i = 0; i < HINT_UPDATE_SHARDS; i++) {
+			struct hint_update_shard *shard = &hint_update_shards[i];
+			struct ast_taskprocessor *serializer;
+
+			/* Hints queued from now on are updated by whoever queued them */
+			ast_mutex_lock(&shard->lock);
+			serializer = shard->serializer;
+			shard->serializer = NULL;
+			ast_mutex_unlock(&shard->lock);
+			ast_taskprocessor_unreference(serializer);
+		}
+		ast_threadpool_shutdown(hint_update_pool);
+		hint_update_pool = NULL;
+		for (i = 0; i < HINT_UPDATE_SHARDS; i++) {
+			struct hint_update_shard *shard = &hint_update_shards[i];
+
+			AST_VECTOR_CALLBACK_VOID(&shard->pending, ao2_ref, -1);
+			AST_VECTOR_FREE(&shard->pending);
+			ast_mutex_destroy(&shard->lock);
+		}
+	}
+
 	ast_manager_unregister("ShowDialPlan");
 	ast_manager_unregister("ExtensionStateList");
 	ast_cli_unregister_multiple(pbx_cli, ARRAY_LEN(pbx_cli));
@@ -8340,6 +8798,14 @@ int load_pbx(void)
 		return -1;
 	}
 
+	if (hint_update_init()) {
+		return -1;
+	}
+
+	if (outgoing_init()) {
+		return -1;
+	}
+
 	if (!(device_state_sub = stasis_subscribe(ast_device_state_topic_all(), device_state_cb, NULL))) {
 		return -1;
 	}
@@ -8374,7 +8840,14 @@ int ast_unlock_contexts(void)
  */
 int ast_wrlock_context(struct ast_context *con)
 {
-	return ast_rwlock_wrlock(&con->lock);
+	int res = ast_rwlock_wrlock(&con->lock);
+
+	if (!res) {
+		/* Lets a dialplan merge tell that the context may have changed */
+		ast_atomic_fetchadd_int(&con->version, 1);
+	}
+
+	return res;
 }
 
 int ast_rdlock_context(struct ast_context *con)
@@ -8752,11 +9225,14 @@ static void print_statecbs_key(void *v_obj, void *where, ao2_prnt_fn *prnt)
 
 int ast_pbx_init(void)
 {
-	hints = ao2_container_alloc(HASH_EXTENHINT_SIZE, hint_hash, hint_cmp);
+	hints = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX,
+		AO2_CONTAINER_ALLOC_OPT_AUTO_RESIZE, HASH_EXTENHINT_SIZE, hint_hash, NULL, hint_cmp);
 	if (hints) {
 		ao2_container_register("hints", hints, print_hints_key);
 	}
-	hintdevices = ao2_container_alloc(HASH_EXTENHINT_SIZE, hintdevice_hash_cb, hintdevice_cmp_multiple);
+	hintdevices = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX,
+		AO2_CONTAINER_ALLOC_OPT_AUTO_RESIZE, HASH_EXTENHINT_SIZE,
+		hintdevice_hash_cb, NULL, hintdevice_cmp_multiple);
 	if (hintdevices) {
 		ao2_container_register("hintdevices", hintdevices, print_hintdevices_key);
 	}
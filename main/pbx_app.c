@@ -32,6 +32,7 @@
 ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #include "asterisk/_private.h"
+#include "asterisk/channel_cpu.h"
 #include "asterisk/cli.h"
 #include "asterisk/linkedlists.h"
 #include "asterisk/module.h"
@@ -475,6 +476,7 @@ int pbx_exec(struct ast_channel *c,	/*!< Channel */
 	struct ast_module_user *u = NULL;
 	const char *saved_c_appl;
 	const char *saved_c_data;
+	AST_CHANNEL_CPU_DECLARE(cpu);
 
 	/* save channel values */
 	saved_c_appl= ast_channel_appl(c);
@@ -488,7 +490,9 @@ int pbx_exec(struct ast_channel *c,	/*!< Channel */
 
 	if (app->module)
 		u = __ast_module_user_add(app->module, c);
+	AST_CHANNEL_CPU_START(cpu, c);
 	res = app->execute(c, S_OR(data, ""));
+	AST_CHANNEL_CPU_END(cpu);
 	if (app->module && u)
 		__ast_module_user_remove(app->module, u);
 	/* restore channel values */
@@ -41,6 +41,21 @@ struct ast_switch *pbx_findswitch(const char *sw);
 /*! pbx_app.c functions needed by pbx.c */
 const char *app_name(struct ast_app *app);
 
+/*! pbx_variables.c functions needed by pbx.c */
+struct pbx_template;
+
+/*!
+ * \brief Parse a string for variable substitution ahead of time
+ *
+ * \return ao2 object to pass to pbx_template_substitute(), or NULL on error
+ */
+struct pbx_template *pbx_template_compile(const char *templ);
+
+/*!
+ * \brief Substitute variables into a buffer, as pbx_substitute_variables_helper() would
+ */
+void pbx_template_substitute(struct ast_channel *c, struct pbx_template *templ, char *cp2, int count);
+
 #define VAR_BUF_SIZE 4096
 
 #endif /* _PBX_PRIVATE_H */
@@ -34,6 +34,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/_private.h"
 #include "asterisk/app.h"
 #include "asterisk/ast_expr.h"
+#include "asterisk/astobj2.h"
 #include "asterisk/chanvars.h"
 #include "asterisk/cli.h"
 #include "asterisk/linkedlists.h"
@@ -42,6 +43,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/paths.h"
 #include "asterisk/pbx.h"
 #include "asterisk/stasis_channels.h"
+#include "asterisk/vector.h"
 #include "pbx_private.h"
 
 /*** DOCUMENTATION
@@ -365,11 +367,8 @@ const char *ast_str_retrieve_variable(struct ast_str **str, ssize_t maxlen, stru
 			continue;
 		if (places[i] == &globals)
 			ast_rwlock_rdlock(&globalslock);
-		AST_LIST_TRAVERSE(places[i], variables, entries) {
-			if (!strcmp(ast_var_name(variables), var)) {
-				s = ast_var_value(variables);
-				break;
-			}
+		if ((variables = ast_var_list_find(places[i], var))) {
+			s = ast_var_value(variables);
 		}
 		if (places[i] == &globals)
 			ast_rwlock_unlock(&globalslock);
@@ -586,6 +585,51 @@ void ast_str_substitute_variables_varshead(struct ast_str **buf, ssize_t maxlen,
 	ast_str_substitute_variables_full(buf, maxlen, NULL, headp, templ, &used);
 }
 
+/*!
+ * \brief Look up the value of a variable or function being substituted
+ *
+ * \param vars Name of the variable, or function call, with any offset:length removed
+ * \param workspace Buffer of VAR_BUF_SIZE bytes to hold the value
+ *
+ * \return The value, cut down to offset:length, or NULL if there is none
+ */
+static char *substitute_variable(struct ast_channel *c, struct varshead *headp, const char *vars,
+	int offset, int offset2, int isfunction, char *workspace)
+{
+	char *cp4 = NULL;
+
+	workspace[0] = '\0';
+
+	if (isfunction) {
+		/* Evaluate function */
+		if (c || !headp)
+			cp4 = ast_func_read(c, vars, workspace, VAR_BUF_SIZE) ? NULL : workspace;
+		else {
+			struct varshead old;
+			struct ast_channel *c = ast_dummy_channel_alloc();
+			if (c) {
+				memcpy(&old, ast_channel_varshead(c), sizeof(old));
+				memcpy(ast_channel_varshead(c), headp, sizeof(*ast_channel_varshead(c)));
+				cp4 = ast_func_read(c, vars, workspace, VAR_BUF_SIZE) ? NULL : workspace;
+				/* Don't deallocate the varshead that was passed in */
+				memcpy(ast_channel_varshead(c), &old, sizeof(*ast_channel_varshead(c)));
+				c = ast_channel_unref(c);
+			} else {
+				ast_log(LOG_ERROR, "Unable to allocate bogus channel for variable substitution.  Function results may be blank.\n");
+			}
+		}
+		ast_debug(2, "Function %s result is '%s'\n", vars, cp4 ? cp4 : "(null)");
+	} else {
+		/* Retrieve variable value */
+		pbx_retrieve_variable(c, vars, &cp4, workspace, VAR_BUF_SIZE, headp);
+	}
+	if (cp4) {
+		cp4 = substring(cp4, offset, offset2, workspace, VAR_BUF_SIZE);
+	}
+
+	return cp4;
+}
+
 void pbx_substitute_variables_helper_full(struct ast_channel *c, struct varshead *headp, const char *cp1, char *cp2, int count, size_t *used)
 {
 	/* Substitutes variables into cp2, based on string cp1, cp2 NO LONGER NEEDS TO BE ZEROED OUT!!!!  */
@@ -684,35 +728,9 @@ void pbx_substitute_variables_helper_full(struct ast_channel *c, struct varshead
 			if (!workspace)
 				workspace = ast_alloca(VAR_BUF_SIZE);
 
-			workspace[0] = '\0';
-
 			parse_variable_name(vars, &offset, &offset2, &isfunction);
-			if (isfunction) {
-				/* Evaluate function */
-				if (c || !headp)
-					cp4 = ast_func_read(c, vars, workspace, VAR_BUF_SIZE) ? NULL : workspace;
-				else {
-					struct varshead old;
-					struct ast_channel *c = ast_dummy_channel_alloc();
-					if (c) {
-						memcpy(&old, ast_channel_varshead(c), sizeof(old));
-						memcpy(ast_channel_varshead(c), headp, sizeof(*ast_channel_varshead(c)));
-						cp4 = ast_func_read(c, vars, workspace, VAR_BUF_SIZE) ? NULL : workspace;
-						/* Don't deallocate the varshead that was passed in */
-						memcpy(ast_channel_varshead(c), &old, sizeof(*ast_channel_varshead(c)));
-						c = ast_channel_unref(c);
-					} else {
-						ast_log(LOG_ERROR, "Unable to allocate bogus channel for variable substitution.  Function results may be blank.\n");
-					}
-				}
-				ast_debug(2, "Function %s result is '%s'\n", vars, cp4 ? cp4 : "(null)");
-			} else {
-				/* Retrieve variable value */
-				pbx_retrieve_variable(c, vars, &cp4, workspace, VAR_BUF_SIZE, headp);
-			}
+			cp4 = substitute_variable(c, headp, vars, offset, offset2, isfunction, workspace);
 			if (cp4) {
-				cp4 = substring(cp4, offset, offset2, workspace, VAR_BUF_SIZE);
-
 				length = strlen(cp4);
 				if (length > count)
 					length = count;
@@ -784,6 +802,266 @@ void pbx_substitute_variables_helper_full(struct ast_channel *c, struct varshead
 	*used = cp2 - orig_cp2;
 }
 
+enum pbx_template_type {
+	/*! Text copied as is */
+	PBX_TEMPLATE_LITERAL,
+	/*! ${...} variable or function call */
+	PBX_TEMPLATE_VARIABLE,
+	/*! $[...] expression */
+	PBX_TEMPLATE_EXPRESSION,
+};
+
+struct pbx_template_node {
+	enum pbx_template_type type;
+	/*! Literal text, or the variable or expression if it has nothing to substitute */
+	char *text;
+	/*! Length of the literal text */
+	int len;
+	/*! Variable or expression that must be substituted itself before use */
+	struct pbx_template *sub;
+	/*! Substring of the variable value, when there is nothing to substitute in the name */
+	int offset;
+	int length;
+	int isfunction;
+};
+
+/*! \brief A string parsed once for variable substitution */
+struct pbx_template {
+	AST_VECTOR(, struct pbx_template_node) nodes;
+};
+
+static void template_destroy(void *obj)
+{
+	struct pbx_template *templ = obj;
+	int i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&templ->nodes); ++i) {
+		struct pbx_template_node *node = AST_VECTOR_GET_ADDR(&templ->nodes, i);
+
+		ast_free(node->text);
+		ao2_cleanup(node->sub);
+	}
+	AST_VECTOR_FREE(&templ->nodes);
+}
+
+static int template_add_node(struct pbx_template *templ, enum pbx_template_type type, const char *text, int len)
+{
+	struct pbx_template_node node = { .type = type, .len = len, };
+
+	if (!(node.text = ast_malloc(len + 1))) {
+		return -1;
+	}
+	memcpy(node.text, text, len);
+	node.text[len] = '\0';
+
+	if (AST_VECTOR_APPEND(&templ->nodes, node)) {
+		ast_free(node.text);
+		return -1;
+	}
+	return 0;
+}
+
+/*!
+ * \brief Parse a string the way pbx_substitute_variables_helper_full() does
+ *
+ * \note The string is split up exactly as it would be on every substitution,
+ * so that substituting the template gives the same result.
+ */
+struct pbx_template *pbx_template_compile(const char *cp1)
+{
+	struct pbx_template *templ;
+	struct pbx_template_node *node;
+	const char *whereweare, *literal;
+	const char *nextvar, *nextexp, *nextthing;
+	const char *vars, *vare;
+	int pos, brackets, needsub, len;
+
+	templ = ao2_alloc_options(sizeof(*templ), template_destroy, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!templ || AST_VECTOR_INIT(&templ->nodes, 4)) {
+		ao2_cleanup(templ);
+		return NULL;
+	}
+
+	literal = whereweare = cp1;
+	while (!ast_strlen_zero(whereweare)) {
+		/* Assume we're copying the whole remaining string */
+		pos = strlen(whereweare);
+		nextvar = NULL;
+		nextexp = NULL;
+		nextthing = strchr(whereweare, '$');
+		if (nextthing) {
+			switch (nextthing[1]) {
+			case '{':
+				nextvar = nextthing;
+				pos = nextvar - whereweare;
+				break;
+			case '[':
+				nextexp = nextthing;
+				pos = nextexp - whereweare;
+				break;
+			default:
+				pos = 1;
+			}
+		}
+		whereweare += pos;
+
+		if (!nextvar && !nextexp) {
+			/* More literal text, kept with any before it */
+			continue;
+		}
+
+		if (whereweare > literal
+			&& template_add_node(templ, PBX_TEMPLATE_LITERAL, literal, whereweare - literal)) {
+			goto error;
+		}
+
+		if (nextvar) {
+			vars = vare = nextvar + 2;
+			brackets = 1;
+			needsub = 0;
+
+			/* Find the end of it */
+			while (brackets && *vare) {
+				if ((vare[0] == '$') && (vare[1] == '{')) {
+					needsub++;
+				} else if (vare[0] == '{') {
+					brackets++;
+				} else if (vare[0] == '}') {
+					brackets--;
+				} else if ((vare[0] == '$') && (vare[1] == '['))
+					needsub++;
+				vare++;
+			}
+			if (brackets)
+				ast_log(LOG_WARNING, "Error in extension logic (missing '}')\n");
+		} else {
+			vars = vare = nextexp + 2;
+			brackets = 1;
+			needsub = 0;
+
+			/* Find the end of it */
+			while (brackets && *vare) {
+				if ((vare[0] == '$') && (vare[1] == '[')) {
+					needsub++;
+					brackets++;
+					vare++;
+				} else if (vare[0] == '[') {
+					brackets++;
+				} else if (vare[0] == ']') {
+					brackets--;
+				} else if ((vare[0] == '$') && (vare[1] == '{')) {
+					needsub++;
+					vare++;
+				}
+				vare++;
+			}
+			if (brackets)
+				ast_log(LOG_WARNING, "Error in extension logic (missing ']')\n");
+		}
+		len = vare - vars - 1;
+
+		/* Skip totally over variable string or expression */
+		whereweare += (len + 3);
+		literal = whereweare;
+
+		/* A '${' or '$[' at the very end has nothing in it */
+		if (template_add_node(templ, nextvar ? PBX_TEMPLATE_VARIABLE : PBX_TEMPLATE_EXPRESSION, vars, MAX(len, 0))) {
+			goto error;
+		}
+		node = AST_VECTOR_GET_ADDR(&templ->nodes, AST_VECTOR_SIZE(&templ->nodes) - 1);
+
+		if (needsub) {
+			if (!(node->sub = pbx_template_compile(node->text))) {
+				goto error;
+			}
+		} else if (nextvar) {
+			parse_variable_name(node->text, &node->offset, &node->length, &node->isfunction);
+		}
+	}
+
+	if (whereweare > literal
+		&& template_add_node(templ, PBX_TEMPLATE_LITERAL, literal, whereweare - literal)) {
+		goto error;
+	}
+
+	return templ;
+
+error:
+	ao2_ref(templ, -1);
+	return NULL;
+}
+
+static void template_substitute(struct ast_channel *c, struct varshead *headp,
+	struct pbx_template *templ, char *cp2, int count, size_t *used)
+{
+	const char *orig_cp2 = cp2;
+	char *workspace = NULL;
+	char *ltmp = NULL;
+	char *cp4, *vars;
+	int length, offset, offset2, isfunction;
+	int i;
+
+	*cp2 = 0; /* just in case nothing ends up there */
+	for (i = 0; i < AST_VECTOR_SIZE(&templ->nodes) && count; ++i) {
+		struct pbx_template_node *node = AST_VECTOR_GET_ADDR(&templ->nodes, i);
+
+		vars = node->text;
+		if (node->sub) {
+			size_t my_used;
+
+			if (!ltmp) {
+				ltmp = ast_alloca(VAR_BUF_SIZE);
+			}
+			template_substitute(c, headp, node->sub, ltmp, VAR_BUF_SIZE - 1, &my_used);
+			vars = ltmp;
+		}
+
+		switch (node->type) {
+		case PBX_TEMPLATE_LITERAL:
+			length = MIN(node->len, count);
+			memcpy(cp2, node->text, length);
+			break;
+		case PBX_TEMPLATE_VARIABLE:
+			if (!workspace) {
+				workspace = ast_alloca(VAR_BUF_SIZE);
+			}
+			if (node->sub) {
+				parse_variable_name(vars, &offset, &offset2, &isfunction);
+			} else {
+				offset = node->offset;
+				offset2 = node->length;
+				isfunction = node->isfunction;
+			}
+			length = 0;
+			if ((cp4 = substitute_variable(c, headp, vars, offset, offset2, isfunction, workspace))) {
+				length = MIN(strlen(cp4), count);
+				memcpy(cp2, cp4, length);
+			}
+			break;
+		case PBX_TEMPLATE_EXPRESSION:
+			length = ast_expr(vars, cp2, count, c);
+			if (length) {
+				ast_debug(1, "Expression result is '%s'\n", cp2);
+			}
+			break;
+		default:
+			length = 0;
+		}
+
+		count -= length;
+		cp2 += length;
+		*cp2 = 0;
+	}
+	*used = cp2 - orig_cp2;
+}
+
+void pbx_template_substitute(struct ast_channel *c, struct pbx_template *templ, char *cp2, int count)
+{
+	size_t used;
+
+	template_substitute(c, (c) ? ast_channel_varshead(c) : NULL, templ, cp2, count, &used);
+}
+
 void pbx_substitute_variables_helper(struct ast_channel *c, const char *cp1, char *cp2, int count)
 {
 	size_t used;
@@ -971,11 +1249,8 @@ const char *pbx_builtin_getvar_helper(struct ast_channel *chan, const char *name
 			continue;
 		if (places[i] == &globals)
 			ast_rwlock_rdlock(&globalslock);
-		AST_LIST_TRAVERSE(places[i], variables, entries) {
-			if (!strcmp(name, ast_var_name(variables))) {
-				ret = ast_var_value(variables);
-				break;
-			}
+		if ((variables = ast_var_list_find(places[i], name))) {
+			ret = ast_var_value(variables);
 		}
 		if (places[i] == &globals)
 			ast_rwlock_unlock(&globalslock);
@@ -1027,6 +1302,7 @@ int pbx_builtin_setvar_helper(struct ast_channel *chan, const char *name, const
 	struct ast_var_t *newvariable;
 	struct varshead *headp;
 	const char *nametail = name;
+	unsigned int hash;
 	/*! True if the old value was not an empty string. */
 	int old_value_existed = 0;
 
@@ -1051,8 +1327,9 @@ int pbx_builtin_setvar_helper(struct ast_channel *chan, const char *name, const
 			nametail++;
 	}
 
+	hash = ast_str_hash(nametail);
 	AST_LIST_TRAVERSE_SAFE_BEGIN(headp, newvariable, entries) {
-		if (strcmp(ast_var_name(newvariable), nametail) == 0) {
+		if (newvariable->hash == hash && strcmp(ast_var_name(newvariable), nametail) == 0) {
 			/* there is already such a variable, delete it */
 			AST_LIST_REMOVE_CURRENT(entries);
 			old_value_existed = !ast_strlen_zero(ast_var_value(newvariable));
@@ -66,6 +66,13 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/presencestate.h"
 #include "asterisk/pbx.h"
 #include "asterisk/app.h"
+#include "asterisk/astobj2.h"
+
+#ifdef LOW_MEMORY
+#define PRESENCE_STATE_BUCKETS 17
+#else
+#define PRESENCE_STATE_BUCKETS 563
+#endif
 
 /*! \brief Device state strings for printing */
 static const struct {
@@ -91,6 +98,36 @@ struct stasis_topic *presence_state_topic_all;
 struct stasis_cache *presence_state_cache;
 struct stasis_caching_topic *presence_state_topic_cached;
 
+/*!
+ * \brief Current presence state of each presentity, by provider
+ *
+ * Holds the ast_presence_state_message of the latest change of each
+ * presentity, and the answers providers gave for presentities that have
+ * not changed yet.  Unlike the stasis cache it is updated before the
+ * change is published, so it can tell whether a change is one at all.
+ *
+ * \note Providers must report a change of state with
+ * ast_presence_state_changed(), as the answer kept here is given until then.
+ */
+static struct ao2_container *presence_states;
+
+/*! \note Presentities are matched without regard to case, as hints do */
+static int presence_states_hash_fn(const void *obj, const int flags)
+{
+	const struct ast_presence_state_message *presence_state = obj;
+
+	return ast_str_case_hash((flags & OBJ_SEARCH_MASK) == OBJ_SEARCH_KEY ? obj : presence_state->provider);
+}
+
+static int presence_states_cmp_fn(void *obj, void *arg, int flags)
+{
+	const struct ast_presence_state_message *left = obj;
+	const struct ast_presence_state_message *right = arg;
+
+	return strcasecmp(left->provider, (flags & OBJ_SEARCH_MASK) == OBJ_SEARCH_KEY ? arg : right->provider)
+		? 0 : CMP_MATCH;
+}
+
 /*! \brief  A presence state provider */
 struct presence_state_provider {
 	char label[40];
@@ -126,24 +163,63 @@ enum ast_presence_state ast_presence_state_val(const char *val)
 static enum ast_presence_state presence_state_cached(const char *presence_provider, char **subtype, char **message)
 {
 	enum ast_presence_state res = AST_PRESENCE_INVALID;
-	RAII_VAR(struct stasis_message *, msg, NULL, ao2_cleanup);
 	struct ast_presence_state_message *presence_state;
 
-	msg = stasis_cache_get(ast_presence_state_cache(), ast_presence_state_message_type(), presence_provider);
+	if (!presence_states) {
+		return res;
+	}
 
-	if (!msg) {
+	presence_state = ao2_find(presence_states, presence_provider, OBJ_SEARCH_KEY);
+	if (!presence_state) {
 		return res;
 	}
 
-	presence_state = stasis_message_data(msg);
 	res = presence_state->state;
 
 	*subtype = !ast_strlen_zero(presence_state->subtype) ? ast_strdup(presence_state->subtype) : NULL;
 	*message = !ast_strlen_zero(presence_state->message) ? ast_strdup(presence_state->message) : NULL;
+	ao2_ref(presence_state, -1);
 
 	return res;
 }
 
+static struct ast_presence_state_message *presence_state_alloc(const char *provider,
+		enum ast_presence_state state,
+		const char *subtype,
+		const char *message);
+
+/*!
+ * \internal
+ * \brief Keep the answer a provider gave for a presentity
+ *
+ * \note Only kept if the presentity has no state yet, since a change
+ * reported while the provider was being asked is newer than the answer.
+ */
+static void presence_state_keep(const char *presence_provider, enum ast_presence_state state,
+	const char *subtype, const char *message)
+{
+	struct ast_presence_state_message *presence_state;
+	struct ast_presence_state_message *current;
+
+	if (!presence_states || state == AST_PRESENCE_INVALID) {
+		return;
+	}
+
+	presence_state = presence_state_alloc(presence_provider, state, subtype, message);
+	if (!presence_state) {
+		return;
+	}
+
+	ao2_lock(presence_states);
+	current = ao2_find(presence_states, presence_provider, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!current) {
+		ao2_link_flags(presence_states, presence_state, OBJ_NOLOCK);
+	}
+	ao2_unlock(presence_states);
+	ao2_cleanup(current);
+	ao2_ref(presence_state, -1);
+}
+
 static enum ast_presence_state ast_presence_state_helper(const char *presence_provider, char **subtype, char **message, int check_cache)
 {
 	struct presence_state_provider *provider;
@@ -182,6 +258,9 @@ static enum ast_presence_state ast_presence_state_helper(const char *presence_pr
 
 	if (!provider) {
 		ast_log(LOG_WARNING, "No provider found for label %s\n", label);
+	} else if (check_cache) {
+		/* Later queries are answered without asking the provider again */
+		presence_state_keep(presence_provider, res, *subtype, *message);
 	}
 
 	return res;
@@ -214,6 +293,17 @@ int ast_presence_state_prov_add(const char *label, ast_presence_state_prov_cb_ty
 
 	return 0;
 }
+/*! \brief Match the presentities of the provider label given as arg */
+static int presence_state_provider_match(void *obj, void *arg, int flags)
+{
+	struct ast_presence_state_message *presence_state = obj;
+	const char *label = arg;
+	size_t len = strlen(label);
+
+	return !strncasecmp(presence_state->provider, label, len)
+		&& presence_state->provider[len] == ':' ? CMP_MATCH : 0;
+}
+
 int ast_presence_state_prov_del(const char *label)
 {
 	struct presence_state_provider *provider;
@@ -231,6 +321,12 @@ int ast_presence_state_prov_del(const char *label)
 	AST_RWLIST_TRAVERSE_SAFE_END;
 	AST_RWLIST_UNLOCK(&presence_state_providers);
 
+	/* A provider registered with the label later may answer differently */
+	if (!res && presence_states) {
+		ao2_callback(presence_states, OBJ_MULTIPLE | OBJ_NODATA | OBJ_UNLINK,
+			presence_state_provider_match, (char *) label);
+	}
+
 	return res;
 }
 
@@ -260,6 +356,15 @@ static struct ast_presence_state_message *presence_state_alloc(const char *provi
 	return presence_state;
 }
 
+/*! \brief Whether two states of a presentity are the same */
+static int presence_state_same(const struct ast_presence_state_message *left,
+	const struct ast_presence_state_message *right)
+{
+	return left->state == right->state
+		&& !strcmp(left->subtype, right->subtype)
+		&& !strcmp(left->message, right->message);
+}
+
 static void presence_state_event(const char *provider,
 		enum ast_presence_state state,
 		const char *subtype,
@@ -267,6 +372,7 @@ static void presence_state_event(const char *provider,
 {
 	RAII_VAR(struct stasis_message *, msg, NULL, ao2_cleanup);
 	RAII_VAR(struct ast_presence_state_message *, presence_state, NULL, ao2_cleanup);
+	struct ast_presence_state_message *current;
 
 	if (!ast_presence_state_message_type()) {
 		return;
@@ -282,7 +388,27 @@ static void presence_state_event(const char *provider,
 		return;
 	}
 
-	stasis_publish(ast_presence_state_topic_all(), msg);
+	if (!presence_states) {
+		stasis_publish(ast_presence_state_topic_all(), msg);
+		return;
+	}
+
+	/*
+	 * The store is updated and the change published under its lock, so
+	 * changes of a presentity reported at the same time are published in
+	 * the order the store saw them.
+	 */
+	ao2_lock(presence_states);
+	current = ao2_find(presence_states, provider, OBJ_SEARCH_KEY | OBJ_NOLOCK | OBJ_UNLINK);
+	ao2_link_flags(presence_states, presence_state, OBJ_NOLOCK);
+	if (!current || !presence_state_same(current, presence_state)) {
+		stasis_publish(ast_presence_state_topic_all(), msg);
+	} else {
+		/* Nothing watching the presentity needs to hear about it again */
+		ast_debug(3, "Presence state of %s did not change, not published\n", provider);
+	}
+	ao2_unlock(presence_states);
+	ao2_cleanup(current);
 }
 
 static void do_presence_state_change(const char *provider)
@@ -363,6 +489,8 @@ static void presence_state_engine_cleanup(void)
 	presence_state_topic_all = NULL;
 	ao2_cleanup(presence_state_cache);
 	presence_state_cache = NULL;
+	ao2_cleanup(presence_states);
+	presence_states = NULL;
 	presence_state_topic_cached = stasis_caching_unsubscribe_and_join(presence_state_topic_cached);
 	STASIS_MESSAGE_TYPE_CLEANUP(ast_presence_state_message_type);
 }
@@ -390,6 +518,12 @@ int ast_presence_state_engine_init(void)
 		return -1;
 	}
 
+	presence_states = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0,
+		PRESENCE_STATE_BUCKETS, presence_states_hash_fn, NULL, presence_states_cmp_fn);
+	if (!presence_states) {
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -223,6 +223,21 @@ static AST_RWLIST_HEAD_STATIC(engines, ast_rtp_engine);
 /*! List of RTP glues */
 static AST_RWLIST_HEAD_STATIC(glues, ast_rtp_glue);
 
+/*! List of relay engines */
+static AST_RWLIST_HEAD_STATIC(relay_engines, ast_rtp_relay_engine);
+
+/*! \brief A relay that has been handed to a relay engine */
+struct ast_rtp_relay_offload {
+	/*! The relay engine relaying the packets, NULL once stopped */
+	struct ast_rtp_relay_engine *engine;
+	/*! Private data of the relay engine */
+	void *pvt;
+	/*! Packets relayed, known once stopped */
+	unsigned int packets;
+	/*! Payload octets relayed, known once stopped */
+	unsigned int octets;
+};
+
 #define MAX_RTP_MIME_TYPES 128
 
 /*! The following array defines the MIME Media type (and subtype) for each
@@ -371,6 +386,107 @@ int ast_rtp_glue_unregister(struct ast_rtp_glue *glue)
 	return current_glue ? 0 : -1;
 }
 
+int ast_rtp_relay_engine_register2(struct ast_rtp_relay_engine *engine, struct ast_module *module)
+{
+	struct ast_rtp_relay_engine *current_engine;
+
+	if (ast_strlen_zero(engine->name) || !engine->start || !engine->stop) {
+		ast_log(LOG_WARNING, "Relay engine '%s' failed sanity check so it was not registered.\n",
+			S_OR(engine->name, "Unknown"));
+		return -1;
+	}
+
+	engine->mod = module;
+
+	AST_RWLIST_WRLOCK(&relay_engines);
+	AST_RWLIST_TRAVERSE(&relay_engines, current_engine, entry) {
+		if (!strcmp(current_engine->name, engine->name)) {
+			ast_log(LOG_WARNING, "A relay engine with the name '%s' has already been registered.\n", engine->name);
+			AST_RWLIST_UNLOCK(&relay_engines);
+			return -1;
+		}
+	}
+	AST_RWLIST_INSERT_TAIL(&relay_engines, engine, entry);
+	AST_RWLIST_UNLOCK(&relay_engines);
+
+	ast_verb(2, "Registered relay engine '%s'\n", engine->name);
+
+	return 0;
+}
+
+int ast_rtp_relay_engine_unregister(struct ast_rtp_relay_engine *engine)
+{
+	struct ast_rtp_relay_engine *current_engine;
+
+	AST_RWLIST_WRLOCK(&relay_engines);
+	if ((current_engine = AST_RWLIST_REMOVE(&relay_engines, engine, entry))) {
+		ast_verb(2, "Unregistered relay engine '%s'\n", engine->name);
+	}
+	AST_RWLIST_UNLOCK(&relay_engines);
+
+	return current_engine ? 0 : -1;
+}
+
+static void relay_offload_destructor(void *obj)
+{
+	ast_rtp_relay_offload_stop(obj, NULL, NULL);
+}
+
+struct ast_rtp_relay_offload *ast_rtp_relay_offload_start(const struct ast_rtp_relay *relay)
+{
+	struct ast_rtp_relay_offload *offload;
+	struct ast_rtp_relay_engine *engine;
+
+	/* Most of the time there is nothing to offer the relay to */
+	if (!AST_RWLIST_FIRST(&relay_engines)) {
+		return NULL;
+	}
+
+	offload = ao2_alloc(sizeof(*offload), relay_offload_destructor);
+	if (!offload) {
+		return NULL;
+	}
+
+	AST_RWLIST_RDLOCK(&relay_engines);
+	AST_RWLIST_TRAVERSE(&relay_engines, engine, entry) {
+		if ((offload->pvt = engine->start(relay))) {
+			offload->engine = engine;
+			ast_module_ref(engine->mod);
+			break;
+		}
+	}
+	AST_RWLIST_UNLOCK(&relay_engines);
+
+	if (!offload->engine) {
+		ao2_ref(offload, -1);
+		return NULL;
+	}
+
+	ast_debug(1, "Relay engine '%s' is relaying RTP from %s\n",
+		offload->engine->name, ast_sockaddr_stringify(&relay->source));
+
+	return offload;
+}
+
+void ast_rtp_relay_offload_stop(struct ast_rtp_relay_offload *offload,
+	unsigned int *packets, unsigned int *octets)
+{
+	ao2_lock(offload);
+	if (offload->engine) {
+		offload->engine->stop(offload->pvt, &offload->packets, &offload->octets);
+		ast_module_unref(offload->engine->mod);
+		offload->engine = NULL;
+		offload->pvt = NULL;
+	}
+	if (packets) {
+		*packets = offload->packets;
+	}
+	if (octets) {
+		*octets = offload->octets;
+	}
+	ao2_unlock(offload);
+}
+
 static void instance_destructor(void *obj)
 {
 	struct ast_rtp_instance *instance = obj;
@@ -442,8 +558,13 @@ struct ast_rtp_instance *ast_rtp_instance_new(const char *engine_name,
 
 	AST_RWLIST_UNLOCK(&engines);
 
-	/* Allocate a new RTP instance */
-	if (!(instance = ao2_alloc(sizeof(*instance), instance_destructor))) {
+	/*
+	 * Allocate a new RTP instance.  Tearing down the engine's sockets,
+	 * ICE and DTLS is heavy so keep it off the media threads.
+	 */
+	instance = ao2_alloc_options(sizeof(*instance), instance_destructor,
+		AO2_ALLOC_OPT_LOCK_MUTEX | AO2_ALLOC_OPT_DEFER_DESTROY);
+	if (!instance) {
 		ast_module_unref(engine->mod);
 		return NULL;
 	}
@@ -518,6 +639,19 @@ struct ast_frame *ast_rtp_instance_read(struct ast_rtp_instance *instance, int r
 	return frame;
 }
 
+int ast_rtp_instance_local_bridge_reads(struct ast_rtp_instance *instance)
+{
+	int res = 0;
+
+	ao2_lock(instance);
+	if (instance->engine->local_bridge_reads) {
+		res = instance->engine->local_bridge_reads(instance);
+	}
+	ao2_unlock(instance);
+
+	return res;
+}
+
 int ast_rtp_instance_set_local_address(struct ast_rtp_instance *instance,
 		const struct ast_sockaddr *address)
 {
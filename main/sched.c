@@ -48,6 +48,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/lock.h"
 #include "asterisk/utils.h"
 #include "asterisk/heap.h"
+#include "asterisk/dlinkedlists.h"
 #include "asterisk/threadstorage.h"
 
 /*!
@@ -60,8 +61,20 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
  */
 #define SCHED_MAX_CACHE 128
 
+/*! \brief Number of bits of the expiration tick used to index each wheel level */
+#define SCHED_WHEEL_BITS 8
+#define SCHED_WHEEL_SLOTS (1 << SCHED_WHEEL_BITS)
+#define SCHED_WHEEL_MASK (SCHED_WHEEL_SLOTS - 1)
+/*! \brief Four levels of one millisecond ticks cover a little over 49 days */
+#define SCHED_WHEEL_LEVELS 4
+
+/*! \brief Mask of the tick bits below a wheel level */
+#define SCHED_WHEEL_LEVEL_MASK(level) ((UINT64_C(1) << (SCHED_WHEEL_BITS * (level))) - 1)
+
 AST_THREADSTORAGE(last_del_id);
 
+AST_DLLIST_HEAD_NOLOCK(sched_wheel_slot, sched);
+
 /*!
  * \brief Scheduler ID holder
  *
@@ -96,6 +109,11 @@ struct sched {
 	const void *data;             /*!< Data */
 	ast_sched_cb callback;        /*!< Callback */
 	ssize_t __heap_index;
+	/*! Timing wheel slot the entry is queued in, NULL if not queued on a wheel */
+	struct sched_wheel_slot *wheel_slot;
+	AST_DLLIST_ENTRY(sched) wheel_list;
+	/*! Timing wheel level of wheel_slot */
+	unsigned int wheel_level;
 	/*!
 	 * Used to synchronize between thread running a task and thread
 	 * attempting to delete a task
@@ -111,13 +129,40 @@ struct sched_thread {
 	unsigned int stop:1;
 };
 
+/*!
+ * \brief Hierarchical timing wheel
+ *
+ * Entries expiring within SCHED_WHEEL_SLOTS ticks of the current tick are
+ * kept on level 0, one slot per tick, in execution order.  Entries further
+ * out are kept unordered on the higher levels, each slot covering
+ * SCHED_WHEEL_SLOTS times the ticks of a slot on the level below.  When the
+ * current tick crosses into a higher level slot's range that slot is
+ * cascaded, its entries being placed again relative to the new tick.
+ */
+struct sched_wheel {
+	/*! The time of tick 0, ticks are one millisecond */
+	struct timeval epoch;
+	/*! The current tick.  Entries expiring before it are treated as expiring on it. */
+	uint64_t now;
+	/*! Number of entries on each level */
+	unsigned int count[SCHED_WHEEL_LEVELS];
+	/*! The entry that will be executed next, if first_valid is set */
+	struct sched *first;
+	/*! Set if first is known to be accurate */
+	unsigned int first_valid:1;
+	struct sched_wheel_slot slots[SCHED_WHEEL_LEVELS][SCHED_WHEEL_SLOTS];
+};
+
 struct ast_sched_context {
 	ast_mutex_t lock;
+	/*! How the scheduled entries are queued */
+	enum ast_sched_type type;
 	unsigned int eventcnt;                  /*!< Number of events processed */
 	unsigned int highwater;					/*!< highest count so far */
 	/*! Next tie breaker in case events expire at the same time. */
 	unsigned int tie_breaker;
 	struct ast_heap *sched_heap;
+	struct sched_wheel *sched_wheel;
 	struct sched_thread *sched_thread;
 	/*! The scheduled task that is currently executing */
 	struct sched *currently_executing;
@@ -130,6 +175,8 @@ struct ast_sched_context {
 	AST_LIST_HEAD_NOLOCK(, sched_id) id_queue;
 	/*! The number of IDs in the id_queue */
 	int id_queue_size;
+	/*! Queued entries indexed by scheduler ID, sized for id_queue_size IDs */
+	struct sched **id_map;
 };
 
 static void *sched_run(void *data)
@@ -236,7 +283,7 @@ static int sched_time_cmp(void *va, void *vb)
 	return cmp;
 }
 
-struct ast_sched_context *ast_sched_context_create(void)
+struct ast_sched_context *ast_sched_context_create_type(enum ast_sched_type type)
 {
 	struct ast_sched_context *tmp;
 
@@ -246,18 +293,276 @@ struct ast_sched_context *ast_sched_context_create(void)
 
 	ast_mutex_init(&tmp->lock);
 	tmp->eventcnt = 1;
+	tmp->type = type;
 
 	AST_LIST_HEAD_INIT_NOLOCK(&tmp->id_queue);
 
-	if (!(tmp->sched_heap = ast_heap_create(8, sched_time_cmp,
-			offsetof(struct sched, __heap_index)))) {
-		ast_sched_context_destroy(tmp);
-		return NULL;
+	switch (type) {
+	case AST_SCHED_TYPE_WHEEL:
+		if (!(tmp->sched_wheel = ast_calloc(1, sizeof(*tmp->sched_wheel)))) {
+			ast_sched_context_destroy(tmp);
+			return NULL;
+		}
+		tmp->sched_wheel->epoch = ast_tvnow();
+		break;
+	case AST_SCHED_TYPE_HEAP:
+	default:
+		tmp->type = AST_SCHED_TYPE_HEAP;
+		if (!(tmp->sched_heap = ast_heap_create(8, sched_time_cmp,
+				offsetof(struct sched, __heap_index)))) {
+			ast_sched_context_destroy(tmp);
+			return NULL;
+		}
+		break;
 	}
 
 	return tmp;
 }
 
+struct ast_sched_context *ast_sched_context_create(void)
+{
+	return ast_sched_context_create_type(AST_SCHED_TYPE_HEAP);
+}
+
+/*! \brief Convert an absolute time to a timing wheel tick */
+static uint64_t wheel_tick(const struct sched_wheel *wheel, struct timeval when)
+{
+	int64_t ms = ast_tvdiff_ms(when, wheel->epoch);
+
+	return ms > 0 ? ms : 0;
+}
+
+static void wheel_insert(struct sched_wheel *wheel, struct sched *s)
+{
+	struct sched_wheel_slot *slot;
+	uint64_t tick = wheel_tick(wheel, s->when);
+	uint64_t delta;
+	unsigned int level;
+
+	if (tick < wheel->now) {
+		tick = wheel->now;
+	}
+	delta = tick - wheel->now;
+	if (delta > SCHED_WHEEL_LEVEL_MASK(SCHED_WHEEL_LEVELS)) {
+		/* Too far out for the wheel, park it in the furthest slot until it cascades. */
+		delta = SCHED_WHEEL_LEVEL_MASK(SCHED_WHEEL_LEVELS);
+		tick = wheel->now + delta;
+	}
+
+	for (level = 0; level < SCHED_WHEEL_LEVELS - 1; ++level) {
+		if (delta <= SCHED_WHEEL_LEVEL_MASK(level + 1)) {
+			break;
+		}
+	}
+	slot = &wheel->slots[level][(tick >> (SCHED_WHEEL_BITS * level)) & SCHED_WHEEL_MASK];
+
+	if (level == 0) {
+		struct sched *prev = slot->last;
+
+		/* Level 0 slots are kept in execution order, normally this appends. */
+		while (prev && sched_time_cmp(s, prev) > 0) {
+			prev = AST_DLLIST_PREV(prev, wheel_list);
+		}
+		if (prev) {
+			AST_DLLIST_INSERT_AFTER(slot, prev, s, wheel_list);
+		} else {
+			AST_DLLIST_INSERT_HEAD(slot, s, wheel_list);
+		}
+	} else {
+		AST_DLLIST_INSERT_TAIL(slot, s, wheel_list);
+	}
+	s->wheel_slot = slot;
+	s->wheel_level = level;
+	++wheel->count[level];
+
+	if (wheel->first_valid && (!wheel->first || sched_time_cmp(s, wheel->first) > 0)) {
+		wheel->first = s;
+	}
+}
+
+static void wheel_remove(struct sched_wheel *wheel, struct sched *s)
+{
+	AST_DLLIST_REMOVE(s->wheel_slot, s, wheel_list);
+	--wheel->count[s->wheel_level];
+	s->wheel_slot = NULL;
+
+	if (s == wheel->first) {
+		wheel->first_valid = 0;
+	}
+}
+
+/*!
+ * \brief Advance the current tick of a timing wheel towards a target tick
+ *
+ * Ticks that cannot have anything on them are skipped and any higher level
+ * slots whose range is entered are cascaded down.
+ */
+static void wheel_advance(struct sched_wheel *wheel, uint64_t target)
+{
+	uint64_t next = target;
+	unsigned int level;
+
+	if (wheel->count[0]) {
+		next = wheel->now + 1;
+	} else {
+		for (level = 1; level < SCHED_WHEEL_LEVELS; ++level) {
+			if (wheel->count[level]) {
+				next = (wheel->now | SCHED_WHEEL_LEVEL_MASK(level)) + 1;
+				break;
+			}
+		}
+	}
+	if (next > target) {
+		next = target;
+	}
+	wheel->now = next;
+
+	for (level = 1; level < SCHED_WHEEL_LEVELS; ++level) {
+		struct sched_wheel_slot *slot;
+		struct sched *s;
+
+		if (wheel->now & SCHED_WHEEL_LEVEL_MASK(level)) {
+			break;
+		}
+		slot = &wheel->slots[level][(wheel->now >> (SCHED_WHEEL_BITS * level)) & SCHED_WHEEL_MASK];
+		while ((s = AST_DLLIST_REMOVE_HEAD(slot, wheel_list))) {
+			--wheel->count[level];
+			wheel_insert(wheel, s);
+		}
+	}
+}
+
+/*! \brief Find the entry on a timing wheel that will be executed next */
+static struct sched *wheel_first(struct sched_wheel *wheel)
+{
+	struct sched *first = NULL;
+	unsigned int level;
+
+	if (wheel->first_valid) {
+		return wheel->first;
+	}
+
+	for (level = 0; level < SCHED_WHEEL_LEVELS; ++level) {
+		unsigned int pos;
+		unsigned int i;
+
+		if (!wheel->count[level]) {
+			continue;
+		}
+
+		/*
+		 * The current slot of a higher level has already been cascaded so
+		 * anything in it is a full rotation away.
+		 */
+		pos = (wheel->now >> (SCHED_WHEEL_BITS * level)) + (level ? 1 : 0);
+		for (i = 0; i < SCHED_WHEEL_SLOTS; ++i) {
+			struct sched_wheel_slot *slot = &wheel->slots[level][(pos + i) & SCHED_WHEEL_MASK];
+			struct sched *candidate;
+			struct sched *cur;
+
+			if (!(candidate = slot->first)) {
+				continue;
+			}
+			if (level) {
+				AST_DLLIST_TRAVERSE(slot, cur, wheel_list) {
+					if (sched_time_cmp(cur, candidate) > 0) {
+						candidate = cur;
+					}
+				}
+			}
+			if (!first || sched_time_cmp(candidate, first) > 0) {
+				first = candidate;
+			}
+			break;
+		}
+	}
+
+	wheel->first = first;
+	wheel->first_valid = 1;
+	return first;
+}
+
+static size_t sched_count(struct ast_sched_context *con)
+{
+	size_t count = 0;
+	unsigned int level;
+
+	if (con->sched_heap) {
+		return ast_heap_size(con->sched_heap);
+	}
+	if (con->sched_wheel) {
+		for (level = 0; level < SCHED_WHEEL_LEVELS; ++level) {
+			count += con->sched_wheel->count[level];
+		}
+	}
+	return count;
+}
+
+static void sched_enqueue(struct ast_sched_context *con, struct sched *s)
+{
+	if (con->sched_wheel) {
+		wheel_insert(con->sched_wheel, s);
+	} else {
+		ast_heap_push(con->sched_heap, s);
+	}
+	con->id_map[s->sched_id->id] = s;
+}
+
+/*!
+ * \brief Remove an entry from the context's queue
+ *
+ * \retval 0 on success
+ * \retval -1 if the entry was not queued
+ */
+static int sched_dequeue(struct ast_sched_context *con, struct sched *s)
+{
+	con->id_map[s->sched_id->id] = NULL;
+	if (con->sched_wheel) {
+		if (!s->wheel_slot) {
+			return -1;
+		}
+		wheel_remove(con->sched_wheel, s);
+		return 0;
+	}
+	return ast_heap_remove(con->sched_heap, s) ? 0 : -1;
+}
+
+/*!
+ * \brief Call a function for every queued entry
+ *
+ * \note The callback may dequeue the entry it is given, and must return
+ * non-zero if it did, but no others.
+ */
+static void sched_traverse(struct ast_sched_context *con,
+	int (*cb)(struct ast_sched_context *con, struct sched *s, void *arg), void *arg)
+{
+	if (con->sched_wheel) {
+		unsigned int level;
+		unsigned int i;
+
+		for (level = 0; level < SCHED_WHEEL_LEVELS; ++level) {
+			for (i = 0; i < SCHED_WHEEL_SLOTS; ++i) {
+				struct sched *cur;
+				struct sched *next;
+
+				for (cur = con->sched_wheel->slots[level][i].first; cur; cur = next) {
+					next = AST_DLLIST_NEXT(cur, wheel_list);
+					cb(con, cur, arg);
+				}
+			}
+		}
+	} else if (con->sched_heap) {
+		struct sched *cur;
+		int x = 1;
+
+		while ((cur = ast_heap_peek(con->sched_heap, x))) {
+			if (!cb(con, cur, arg)) {
+				++x;
+			}
+		}
+	}
+}
+
 static void sched_free(struct sched *task)
 {
 	/* task->sched_id will be NULL most of the time, but when the
@@ -293,9 +598,25 @@ void ast_sched_context_destroy(struct ast_sched_context *con)
 		con->sched_heap = NULL;
 	}
 
+	if (con->sched_wheel) {
+		unsigned int level;
+		unsigned int i;
+
+		for (level = 0; level < SCHED_WHEEL_LEVELS; ++level) {
+			for (i = 0; i < SCHED_WHEEL_SLOTS; ++i) {
+				while ((s = AST_DLLIST_REMOVE_HEAD(&con->sched_wheel->slots[level][i], wheel_list))) {
+					sched_free(s);
+				}
+			}
+		}
+		ast_free(con->sched_wheel);
+		con->sched_wheel = NULL;
+	}
+
 	while ((sid = AST_LIST_REMOVE_HEAD(&con->id_queue, list))) {
 		ast_free(sid);
 	}
+	ast_free(con->id_map);
 
 	ast_mutex_unlock(&con->lock);
 	ast_mutex_destroy(&con->lock);
@@ -326,6 +647,19 @@ static int add_ids(struct ast_sched_context *con)
 		/* Overflow. Cap it at INT_MAX. */
 		new_size = INT_MAX;
 	}
+
+	/* Make room to look up every ID, including the new ones. */
+	{
+		struct sched **id_map;
+
+		id_map = ast_realloc(con->id_map, (new_size + 1) * sizeof(*id_map));
+		if (!id_map) {
+			return 0;
+		}
+		memset(id_map + original_size + 1, 0, (new_size - original_size) * sizeof(*id_map));
+		con->id_map = id_map;
+	}
+
 	for (i = original_size; i < new_size; ++i) {
 		struct sched_id *new_id;
 
@@ -407,23 +741,35 @@ static struct sched *sched_alloc(struct ast_sched_context *con)
 	return tmp;
 }
 
-void ast_sched_clean_by_callback(struct ast_sched_context *con, ast_sched_cb match, ast_sched_cb cleanup_cb)
+struct sched_clean_args {
+	ast_sched_cb match;
+	ast_sched_cb cleanup_cb;
+};
+
+static int sched_clean_cb(struct ast_sched_context *con, struct sched *current, void *arg)
 {
-	int i = 1;
-	struct sched *current;
+	struct sched_clean_args *args = arg;
 
-	ast_mutex_lock(&con->lock);
-	while ((current = ast_heap_peek(con->sched_heap, i))) {
-		if (current->callback != match) {
-			i++;
-			continue;
-		}
+	if (current->callback != args->match) {
+		return 0;
+	}
 
-		ast_heap_remove(con->sched_heap, current);
+	sched_dequeue(con, current);
 
-		cleanup_cb(current->data);
-		sched_release(con, current);
-	}
+	args->cleanup_cb(current->data);
+	sched_release(con, current);
+	return 1;
+}
+
+void ast_sched_clean_by_callback(struct ast_sched_context *con, ast_sched_cb match, ast_sched_cb cleanup_cb)
+{
+	struct sched_clean_args args = {
+		.match = match,
+		.cleanup_cb = cleanup_cb,
+	};
+
+	ast_mutex_lock(&con->lock);
+	sched_traverse(con, sched_clean_cb, &args);
 	ast_mutex_unlock(&con->lock);
 }
 
@@ -439,7 +785,12 @@ int ast_sched_wait(struct ast_sched_context *con)
 	DEBUG(ast_debug(1, "ast_sched_wait()\n"));
 
 	ast_mutex_lock(&con->lock);
-	if ((s = ast_heap_peek(con->sched_heap, 1))) {
+	if (con->sched_wheel) {
+		s = wheel_first(con->sched_wheel);
+	} else {
+		s = ast_heap_peek(con->sched_heap, 1);
+	}
+	if (s) {
 		ms = ast_tvdiff_ms(s->when, ast_tvnow());
 		if (ms < 0) {
 			ms = 0;
@@ -462,9 +813,9 @@ static void schedule(struct ast_sched_context *con, struct sched *s)
 {
 	size_t size;
 
-	size = ast_heap_size(con->sched_heap);
+	size = sched_count(con);
 
-	/* Record the largest the scheduler heap became for reporting purposes. */
+	/* Record the largest the scheduler queue became for reporting purposes. */
 	if (con->highwater <= size) {
 		con->highwater = size + 1;
 	}
@@ -481,7 +832,7 @@ static void schedule(struct ast_sched_context *con, struct sched *s)
 	}
 	s->tie_breaker = con->tie_breaker;
 
-	ast_heap_push(con->sched_heap, s);
+	sched_enqueue(con, s);
 }
 
 /*! \brief
@@ -576,19 +927,11 @@ int ast_sched_add(struct ast_sched_context *con, int when, ast_sched_cb callback
 
 static struct sched *sched_find(struct ast_sched_context *con, int id)
 {
-	int x;
-	size_t heap_size;
-
-	heap_size = ast_heap_size(con->sched_heap);
-	for (x = 1; x <= heap_size; x++) {
-		struct sched *cur = ast_heap_peek(con->sched_heap, x);
-
-		if (cur->sched_id->id == id) {
-			return cur;
-		}
+	if (id <= 0 || id > con->id_queue_size) {
+		return NULL;
 	}
 
-	return NULL;
+	return con->id_map[id];
 }
 
 const void *ast_sched_find_data(struct ast_sched_context *con, int id)
@@ -633,8 +976,8 @@ int _ast_sched_del(struct ast_sched_context *con, int id, const char *file, int
 
 	s = sched_find(con, id);
 	if (s) {
-		if (!ast_heap_remove(con->sched_heap, s)) {
-			ast_log(LOG_WARNING,"sched entry %d not in the sched heap?\n", s->sched_id->id);
+		if (sched_dequeue(con, s)) {
+			ast_log(LOG_WARNING,"sched entry %d not in the sched queue?\n", s->sched_id->id);
 		}
 		sched_release(con, s);
 	} else if (con->currently_executing && (id == con->currently_executing->sched_id->id)) {
@@ -672,34 +1015,40 @@ int _ast_sched_del(struct ast_sched_context *con, int id, const char *file, int
 	return 0;
 }
 
+struct sched_report_args {
+	struct ast_cb_names *cbnames;
+	int *countlist;
+};
+
+static int sched_report_cb(struct ast_sched_context *con, struct sched *cur, void *arg)
+{
+	struct sched_report_args *args = arg;
+	int i;
+
+	/* match the callback to the cblist */
+	for (i = 0; i < args->cbnames->numassocs; i++) {
+		if (cur->callback == args->cbnames->cblist[i]) {
+			break;
+		}
+	}
+	args->countlist[i]++;
+	return 0;
+}
+
 void ast_sched_report(struct ast_sched_context *con, struct ast_str **buf, struct ast_cb_names *cbnames)
 {
-	int i, x;
-	struct sched *cur;
+	int i;
 	int countlist[cbnames->numassocs + 1];
-	size_t heap_size;
+	struct sched_report_args args = {
+		.cbnames = cbnames,
+		.countlist = countlist,
+	};
 
 	memset(countlist, 0, sizeof(countlist));
-	ast_str_set(buf, 0, " Highwater = %u\n schedcnt = %zu\n", con->highwater, ast_heap_size(con->sched_heap));
 
 	ast_mutex_lock(&con->lock);
-
-	heap_size = ast_heap_size(con->sched_heap);
-	for (x = 1; x <= heap_size; x++) {
-		cur = ast_heap_peek(con->sched_heap, x);
-		/* match the callback to the cblist */
-		for (i = 0; i < cbnames->numassocs; i++) {
-			if (cur->callback == cbnames->cblist[i]) {
-				break;
-			}
-		}
-		if (i < cbnames->numassocs) {
-			countlist[i]++;
-		} else {
-			countlist[cbnames->numassocs]++;
-		}
-	}
-
+	ast_str_set(buf, 0, " Highwater = %u\n schedcnt = %zu\n", con->highwater, sched_count(con));
+	sched_traverse(con, sched_report_cb, &args);
 	ast_mutex_unlock(&con->lock);
 
 	for (i = 0; i < cbnames->numassocs; i++) {
@@ -709,35 +1058,36 @@ void ast_sched_report(struct ast_sched_context *con, struct ast_str **buf, struc
 	ast_str_append(buf, 0, "   <unknown> : %d\n", countlist[cbnames->numassocs]);
 }
 
+static int sched_dump_cb(struct ast_sched_context *con, struct sched *q, void *arg)
+{
+	struct timeval *when = arg;
+	struct timeval delta;
+
+	delta = ast_tvsub(q->when, *when);
+	ast_debug(1, "|%.4d | %-15p | %-15p | %.6ld : %.6ld |\n",
+		q->sched_id->id,
+		q->callback,
+		q->data,
+		(long)delta.tv_sec,
+		(long int)delta.tv_usec);
+	return 0;
+}
+
 /*! \brief Dump the contents of the scheduler to LOG_DEBUG */
 void ast_sched_dump(struct ast_sched_context *con)
 {
-	struct sched *q;
 	struct timeval when = ast_tvnow();
-	int x;
-	size_t heap_size;
 #ifdef SCHED_MAX_CACHE
-	ast_debug(1, "Asterisk Schedule Dump (%zu in Q, %u Total, %u Cache, %u high-water)\n", ast_heap_size(con->sched_heap), con->eventcnt - 1, con->schedccnt, con->highwater);
+	ast_debug(1, "Asterisk Schedule Dump (%zu in Q, %u Total, %u Cache, %u high-water)\n", sched_count(con), con->eventcnt - 1, con->schedccnt, con->highwater);
 #else
-	ast_debug(1, "Asterisk Schedule Dump (%zu in Q, %u Total, %u high-water)\n", ast_heap_size(con->sched_heap), con->eventcnt - 1, con->highwater);
+	ast_debug(1, "Asterisk Schedule Dump (%zu in Q, %u Total, %u high-water)\n", sched_count(con), con->eventcnt - 1, con->highwater);
 #endif
 
 	ast_debug(1, "=============================================================\n");
 	ast_debug(1, "|ID    Callback          Data              Time  (sec:ms)   |\n");
 	ast_debug(1, "+-----+-----------------+-----------------+-----------------+\n");
 	ast_mutex_lock(&con->lock);
-	heap_size = ast_heap_size(con->sched_heap);
-	for (x = 1; x <= heap_size; x++) {
-		struct timeval delta;
-		q = ast_heap_peek(con->sched_heap, x);
-		delta = ast_tvsub(q->when, when);
-		ast_debug(1, "|%.4d | %-15p | %-15p | %.6ld : %.6ld |\n",
-			q->sched_id->id,
-			q->callback,
-			q->data,
-			(long)delta.tv_sec,
-			(long int)delta.tv_usec);
-	}
+	sched_traverse(con, sched_dump_cb, &when);
 	ast_mutex_unlock(&con->lock);
 	ast_debug(1, "=============================================================\n");
 }
@@ -745,59 +1095,91 @@ void ast_sched_dump(struct ast_sched_context *con)
 /*! \brief
  * Launch all events which need to be run at this time.
  */
-int ast_sched_runq(struct ast_sched_context *con)
+/*!
+ * \brief Execute an entry that has been removed from the queue
+ *
+ * \note Must be called with the context locked.
+ */
+static void sched_execute(struct ast_sched_context *con, struct sched *current)
 {
-	struct sched *current;
-	struct timeval when;
-	int numevents;
 	int res;
 
-	DEBUG(ast_debug(1, "ast_sched_runq()\n"));
+	/*
+	 * At this point, the schedule queue is still intact.  We
+	 * have removed the first event and the rest is still there,
+	 * so it's permissible for the callback to add new events, but
+	 * trying to delete itself won't work because it isn't in
+	 * the schedule queue.  If that's what it wants to do, it
+	 * should return 0.
+	 */
 
+	con->currently_executing = current;
+	ast_mutex_unlock(&con->lock);
+	res = current->callback(current->data);
 	ast_mutex_lock(&con->lock);
+	con->currently_executing = NULL;
+	ast_cond_signal(&current->cond);
 
-	when = ast_tvadd(ast_tvnow(), ast_tv(0, 1000));
-	for (numevents = 0; (current = ast_heap_peek(con->sched_heap, 1)); numevents++) {
-		/* schedule all events which are going to expire within 1ms.
-		 * We only care about millisecond accuracy anyway, so this will
-		 * help us get more than one event at one time if they are very
-		 * close together.
+	if (res && !current->deleted) {
+		/*
+		 * If they return non-zero, we should schedule them to be
+		 * run again.
 		 */
-		if (ast_tvcmp(current->when, when) != -1) {
-			break;
+		if (sched_settime(&current->when, current->variable? res : current->resched)) {
+			sched_release(con, current);
+		} else {
+			schedule(con, current);
 		}
+	} else {
+		/* No longer needed, so release it */
+		sched_release(con, current);
+	}
+}
 
-		current = ast_heap_pop(con->sched_heap);
+int ast_sched_runq(struct ast_sched_context *con)
+{
+	struct sched *current;
+	struct timeval when;
+	int numevents = 0;
 
-		/*
-		 * At this point, the schedule queue is still intact.  We
-		 * have removed the first event and the rest is still there,
-		 * so it's permissible for the callback to add new events, but
-		 * trying to delete itself won't work because it isn't in
-		 * the schedule queue.  If that's what it wants to do, it
-		 * should return 0.
-		 */
+	DEBUG(ast_debug(1, "ast_sched_runq()\n"));
 
-		con->currently_executing = current;
-		ast_mutex_unlock(&con->lock);
-		res = current->callback(current->data);
-		ast_mutex_lock(&con->lock);
-		con->currently_executing = NULL;
-		ast_cond_signal(&current->cond);
-
-		if (res && !current->deleted) {
-			/*
-			 * If they return non-zero, we should schedule them to be
-			 * run again.
-			 */
-			if (sched_settime(&current->when, current->variable? res : current->resched)) {
-				sched_release(con, current);
-			} else {
-				schedule(con, current);
+	ast_mutex_lock(&con->lock);
+
+	/* schedule all events which are going to expire within 1ms.
+	 * We only care about millisecond accuracy anyway, so this will
+	 * help us get more than one event at one time if they are very
+	 * close together.
+	 */
+	when = ast_tvadd(ast_tvnow(), ast_tv(0, 1000));
+
+	if (con->sched_wheel) {
+		struct sched_wheel *wheel = con->sched_wheel;
+		uint64_t target = wheel_tick(wheel, when);
+
+		for (;;) {
+			/* The current slot is in execution order and may be added to as we go. */
+			current = wheel->slots[0][wheel->now & SCHED_WHEEL_MASK].first;
+			if (current && ast_tvcmp(current->when, when) == -1) {
+				sched_dequeue(con, current);
+				sched_execute(con, current);
+				++numevents;
+				continue;
 			}
-		} else {
-			/* No longer needed, so release it */
-			sched_release(con, current);
+			if (current || wheel->now >= target) {
+				break;
+			}
+			wheel_advance(wheel, target);
+		}
+	} else {
+		while ((current = ast_heap_peek(con->sched_heap, 1))) {
+			if (ast_tvcmp(current->when, when) != -1) {
+				break;
+			}
+
+			sched_dequeue(con, current);
+			sched_execute(con, current);
+			++numevents;
 		}
 	}
 
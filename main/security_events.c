@@ -379,6 +379,37 @@ static const size_t SECURITY_EVENT_BUF_INIT_LEN = 256;
 /*! \brief Security Topic */
 static struct stasis_topic *security_topic;
 
+/*! Buckets for the security event sources. Keep it prime! */
+#define SECURITY_EVENT_SOURCE_BUCKETS 257
+
+/*! \brief Events of a type a remote address may raise in an interval before they are suppressed */
+#define SECURITY_EVENT_SOURCE_LIMIT 20
+
+/*! \brief Interval, in milliseconds, SECURITY_EVENT_SOURCE_LIMIT applies to */
+#define SECURITY_EVENT_SOURCE_INTERVAL 1000
+
+/*! \brief Security events of a type raised for a remote address in the current interval */
+struct security_event_source {
+	enum ast_security_event_type event_type;
+	/*! Events reported */
+	unsigned int reported;
+	/*! Events suppressed after the limit was reached */
+	unsigned int suppressed;
+	/*! Remote address, within key */
+	const char *addr;
+	/*! Event type and remote address */
+	char key[0];
+};
+
+/*! \brief Security event sources of the current interval, see struct security_event_source */
+static struct ao2_container *security_event_sources;
+
+/*! \brief When the current interval started */
+static struct timeval security_event_sources_since;
+
+AO2_STRING_FIELD_HASH_FN(security_event_source, key)
+AO2_STRING_FIELD_CMP_FN(security_event_source, key)
+
 struct stasis_topic *ast_security_topic(void)
 {
 	return security_topic;
@@ -479,6 +510,9 @@ static void security_stasis_cleanup(void)
 	ao2_cleanup(security_topic);
 	security_topic = NULL;
 
+	ao2_cleanup(security_event_sources);
+	security_event_sources = NULL;
+
 	STASIS_MESSAGE_TYPE_CLEANUP(ast_security_event_type);
 }
 
@@ -495,6 +529,13 @@ int ast_security_stasis_init(void)
 		return -1;
 	}
 
+	security_event_sources = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0,
+		SECURITY_EVENT_SOURCE_BUCKETS, security_event_source_hash_fn, NULL,
+		security_event_source_cmp_fn);
+	if (!security_event_sources) {
+		return -1;
+	}
+	security_event_sources_since = ast_tvnow();
 
 	return 0;
 }
@@ -1170,6 +1211,89 @@ return_error:
 	return -1;
 }
 
+/*! \brief Log how many events of a source were suppressed in the interval that ended */
+static int security_event_source_flush(void *obj, void *arg, int flags)
+{
+	struct security_event_source *source = obj;
+
+	if (source->suppressed) {
+		ast_log(LOG_NOTICE, "Suppressed %u %s security events from %s after the first %u in %d ms\n",
+			source->suppressed, ast_security_event_get_name(source->event_type),
+			source->addr, source->reported, SECURITY_EVENT_SOURCE_INTERVAL);
+	}
+
+	return CMP_MATCH;
+}
+
+/*!
+ * \internal
+ * \brief Whether a security event should be raised or suppressed
+ *
+ * Only the first SECURITY_EVENT_SOURCE_LIMIT events of each type from a
+ * remote address in an interval are raised, so a flood of requests does
+ * not also flood the subscribers of the security topic.  The rest are
+ * counted, and logged once the interval is over.
+ *
+ * \note Intervals are ended by the first event raised after them.
+ *
+ * \retval 1 if the event should be raised.
+ * \retval 0 if it is suppressed.
+ */
+static int security_event_sample(const struct ast_security_event_common *sec)
+{
+	struct security_event_source *source;
+	struct timeval now;
+	char *key;
+	int res;
+
+	if (!security_event_sources || !sec->remote_addr.addr) {
+		return 1;
+	}
+
+	if (ast_asprintf(&key, "%u/%s", sec->event_type,
+		ast_sockaddr_stringify_addr(sec->remote_addr.addr)) < 0) {
+		return 1;
+	}
+
+	ao2_lock(security_event_sources);
+
+	now = ast_tvnow();
+	if (ast_tvdiff_ms(now, security_event_sources_since) >= SECURITY_EVENT_SOURCE_INTERVAL) {
+		ao2_callback(security_event_sources, OBJ_NOLOCK | OBJ_UNLINK | OBJ_MULTIPLE | OBJ_NODATA,
+			security_event_source_flush, NULL);
+		security_event_sources_since = now;
+	}
+
+	source = ao2_find(security_event_sources, key, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!source) {
+		source = ao2_alloc_options(sizeof(*source) + strlen(key) + 1, NULL,
+			AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!source) {
+			ao2_unlock(security_event_sources);
+			ast_free(key);
+			return 1;
+		}
+		strcpy(source->key, key);
+		source->addr = strchr(source->key, '/') + 1;
+		source->event_type = sec->event_type;
+		ao2_link_flags(security_event_sources, source, OBJ_NOLOCK);
+	}
+
+	if (source->reported < SECURITY_EVENT_SOURCE_LIMIT) {
+		++source->reported;
+		res = 1;
+	} else {
+		++source->suppressed;
+		res = 0;
+	}
+
+	ao2_unlock(security_event_sources);
+	ao2_ref(source, -1);
+	ast_free(key);
+
+	return res;
+}
+
 int ast_security_event_report(const struct ast_security_event_common *sec)
 {
 	if ((unsigned int)sec->event_type >= AST_SECURITY_EVENT_NUM_TYPES) {
@@ -1189,6 +1313,10 @@ int ast_security_event_report(const struct ast_security_event_common *sec)
 		return -1;
 	}
 
+	if (!security_event_sample(sec)) {
+		return 0;
+	}
+
 	if (handle_security_event(sec)) {
 		ast_log(LOG_ERROR, "Failed to issue security event of type %s.\n",
 				ast_security_event_get_name(sec->event_type));
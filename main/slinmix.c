@@ -0,0 +1,370 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Signed linear buffer mixing primitives
+ *
+ * Each backend implements the same four operations.  The scalar backend
+ * is always available and simply applies the per-sample helpers from
+ * utils.h.  The SIMD backends process as many whole vectors as they can
+ * and hand the remaining tail to the scalar code, which keeps the results
+ * identical regardless of buffer length or alignment.
+ */
+
+/*** MODULEINFO
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/_private.h"
+#include "asterisk/utils.h"
+#include "asterisk/strings.h"
+#include "asterisk/slinmix.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define SLINMIX_HAVE_SSE2 1
+#include <emmintrin.h>
+#if (defined(__clang__) || __GNUC__ >= 5)
+/* AVX2 is built with a function target attribute and only used when the CPU has it. */
+#define SLINMIX_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SLINMIX_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*! \brief A set of mixing primitives */
+struct slinmix_backend {
+	/*! Name of the backend */
+	const char *name;
+	/*! Returns non-zero if the running CPU can use this backend */
+	int (*supported)(void);
+	void (*add)(int16_t *dst, const int16_t *src, size_t samples);
+	void (*subtract)(int16_t *dst, const int16_t *src, size_t samples);
+	void (*multiply)(int16_t *buf, int16_t value, size_t samples);
+	void (*divide)(int16_t *buf, int16_t value, size_t samples);
+};
+
+static int scalar_supported(void)
+{
+	return 1;
+}
+
+static void scalar_add(int16_t *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; ++i) {
+		ast_slinear_saturated_add(&dst[i], (short *) &src[i]);
+	}
+}
+
+static void scalar_subtract(int16_t *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; ++i) {
+		ast_slinear_saturated_subtract(&dst[i], (short *) &src[i]);
+	}
+}
+
+static void scalar_multiply(int16_t *buf, int16_t value, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; ++i) {
+		ast_slinear_saturated_multiply(&buf[i], &value);
+	}
+}
+
+static void scalar_divide(int16_t *buf, int16_t value, size_t samples)
+{
+	size_t i;
+
+	/* Integer division does not vectorize well on any of the supported
+	 * instruction sets so every backend shares this implementation. */
+	for (i = 0; i < samples; ++i) {
+		ast_slinear_saturated_divide(&buf[i], &value);
+	}
+}
+
+static const struct slinmix_backend scalar_backend = {
+	.name = "scalar",
+	.supported = scalar_supported,
+	.add = scalar_add,
+	.subtract = scalar_subtract,
+	.multiply = scalar_multiply,
+	.divide = scalar_divide,
+};
+
+#ifdef SLINMIX_HAVE_SSE2
+static int sse2_supported(void)
+{
+	/* SSE2 was enabled at compile time so it is a baseline requirement. */
+	return 1;
+}
+
+static void sse2_add(int16_t *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *) &dst[i]);
+		__m128i b = _mm_loadu_si128((const __m128i *) &src[i]);
+
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_adds_epi16(a, b));
+	}
+	scalar_add(dst + i, src + i, samples - i);
+}
+
+static void sse2_subtract(int16_t *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *) &dst[i]);
+		__m128i b = _mm_loadu_si128((const __m128i *) &src[i]);
+
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_subs_epi16(a, b));
+	}
+	scalar_subtract(dst + i, src + i, samples - i);
+}
+
+static void sse2_multiply(int16_t *buf, int16_t value, size_t samples)
+{
+	__m128i v = _mm_set1_epi16(value);
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *) &buf[i]);
+		__m128i lo = _mm_mullo_epi16(a, v);
+		__m128i hi = _mm_mulhi_epi16(a, v);
+
+		/* Rebuild the full 32 bit products and pack them back down with
+		 * signed saturation, exactly like the scalar clamp does. */
+		_mm_storeu_si128((__m128i *) &buf[i],
+			_mm_packs_epi32(_mm_unpacklo_epi16(lo, hi), _mm_unpackhi_epi16(lo, hi)));
+	}
+	scalar_multiply(buf + i, value, samples - i);
+}
+
+static const struct slinmix_backend sse2_backend = {
+	.name = "sse2",
+	.supported = sse2_supported,
+	.add = sse2_add,
+	.subtract = sse2_subtract,
+	.multiply = sse2_multiply,
+	.divide = scalar_divide,
+};
+#endif
+
+#ifdef SLINMIX_HAVE_AVX2
+static int avx2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void avx2_add(int16_t *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= samples; i += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) &dst[i]);
+		__m256i b = _mm256_loadu_si256((const __m256i *) &src[i]);
+
+		_mm256_storeu_si256((__m256i *) &dst[i], _mm256_adds_epi16(a, b));
+	}
+	sse2_add(dst + i, src + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_subtract(int16_t *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= samples; i += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) &dst[i]);
+		__m256i b = _mm256_loadu_si256((const __m256i *) &src[i]);
+
+		_mm256_storeu_si256((__m256i *) &dst[i], _mm256_subs_epi16(a, b));
+	}
+	sse2_subtract(dst + i, src + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_multiply(int16_t *buf, int16_t value, size_t samples)
+{
+	__m256i v = _mm256_set1_epi16(value);
+	size_t i;
+
+	for (i = 0; i + 16 <= samples; i += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) &buf[i]);
+		__m256i lo = _mm256_mullo_epi16(a, v);
+		__m256i hi = _mm256_mulhi_epi16(a, v);
+
+		/* The unpack and pack instructions both work within 128 bit lanes
+		 * so the sample order is preserved. */
+		_mm256_storeu_si256((__m256i *) &buf[i],
+			_mm256_packs_epi32(_mm256_unpacklo_epi16(lo, hi), _mm256_unpackhi_epi16(lo, hi)));
+	}
+	sse2_multiply(buf + i, value, samples - i);
+}
+
+static const struct slinmix_backend avx2_backend = {
+	.name = "avx2",
+	.supported = avx2_supported,
+	.add = avx2_add,
+	.subtract = avx2_subtract,
+	.multiply = avx2_multiply,
+	.divide = scalar_divide,
+};
+#endif
+
+#ifdef SLINMIX_HAVE_NEON
+static int neon_supported(void)
+{
+	/* NEON was enabled at compile time so it is a baseline requirement. */
+	return 1;
+}
+
+static void neon_add(int16_t *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		vst1q_s16(&dst[i], vqaddq_s16(vld1q_s16(&dst[i]), vld1q_s16(&src[i])));
+	}
+	scalar_add(dst + i, src + i, samples - i);
+}
+
+static void neon_subtract(int16_t *dst, const int16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		vst1q_s16(&dst[i], vqsubq_s16(vld1q_s16(&dst[i]), vld1q_s16(&src[i])));
+	}
+	scalar_subtract(dst + i, src + i, samples - i);
+}
+
+static void neon_multiply(int16_t *buf, int16_t value, size_t samples)
+{
+	int16x4_t v = vdup_n_s16(value);
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		int16x8_t a = vld1q_s16(&buf[i]);
+		int32x4_t lo = vmull_s16(vget_low_s16(a), v);
+		int32x4_t hi = vmull_s16(vget_high_s16(a), v);
+
+		vst1q_s16(&buf[i], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+	scalar_multiply(buf + i, value, samples - i);
+}
+
+static const struct slinmix_backend neon_backend = {
+	.name = "neon",
+	.supported = neon_supported,
+	.add = neon_add,
+	.subtract = neon_subtract,
+	.multiply = neon_multiply,
+	.divide = scalar_divide,
+};
+#endif
+
+/*! \brief All compiled in backends, best first */
+static const struct slinmix_backend *backends[] = {
+#ifdef SLINMIX_HAVE_AVX2
+	&avx2_backend,
+#endif
+#ifdef SLINMIX_HAVE_SSE2
+	&sse2_backend,
+#endif
+#ifdef SLINMIX_HAVE_NEON
+	&neon_backend,
+#endif
+	&scalar_backend,
+};
+
+/*! \brief The backend in use, scalar until ast_slinmix_init() has run */
+static const struct slinmix_backend *current = &scalar_backend;
+
+void ast_slinear_saturated_add_buf(int16_t *dst, const int16_t *src, size_t samples)
+{
+	current->add(dst, src, samples);
+}
+
+void ast_slinear_saturated_subtract_buf(int16_t *dst, const int16_t *src, size_t samples)
+{
+	current->subtract(dst, src, samples);
+}
+
+void ast_slinear_saturated_multiply_buf(int16_t *buf, int16_t value, size_t samples)
+{
+	current->multiply(buf, value, samples);
+}
+
+void ast_slinear_saturated_divide_buf(int16_t *buf, int16_t value, size_t samples)
+{
+	current->divide(buf, value, samples);
+}
+
+void ast_slinear_adjust_volume_buf(int16_t *buf, int adjustment, size_t samples)
+{
+	int16_t adjust_value = abs(adjustment);
+
+	if (adjustment > 0) {
+		current->multiply(buf, adjust_value, samples);
+	} else if (adjustment < 0) {
+		current->divide(buf, adjust_value, samples);
+	}
+}
+
+const char *ast_slinmix_backend(void)
+{
+	return current->name;
+}
+
+int ast_slinmix_set_backend(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(backends); ++i) {
+		if ((ast_strlen_zero(name) || !strcasecmp(name, backends[i]->name))
+			&& backends[i]->supported()) {
+			current = backends[i];
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int ast_slinmix_init(void)
+{
+	ast_slinmix_set_backend(NULL);
+	ast_debug(1, "Using '%s' signed linear mixing backend\n", current->name);
+	return 0;
+}
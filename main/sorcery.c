@@ -202,6 +202,9 @@ struct ast_sorcery_object_field {
 	/*! \brief Callback function for translation of multiple values */
 	sorcery_fields_handler multiple_handler;
 
+	/*! \brief Whether wizards keep an index of objects by this field */
+	unsigned int indexed;
+
 	/*! \brief Position of the field */
 	intptr_t args[];
 };
@@ -1308,6 +1311,270 @@ int __ast_sorcery_object_field_register(struct ast_sorcery *sorcery, const char
 	return 0;
 }
 
+int ast_sorcery_object_field_index(struct ast_sorcery *sorcery, const char *type, const char *name)
+{
+	struct ast_sorcery_object_type *object_type;
+	struct ast_sorcery_object_field *object_field;
+
+	object_type = ao2_find(sorcery->types, type, OBJ_SEARCH_KEY);
+	if (!object_type) {
+		return -1;
+	}
+
+	object_field = ao2_find(object_type->fields, name, OBJ_SEARCH_KEY);
+	ao2_ref(object_type, -1);
+	if (!object_field) {
+		return -1;
+	}
+
+	object_field->indexed = 1;
+	ao2_ref(object_field, -1);
+
+	return 0;
+}
+
+/*! \brief An object in an index, under the value of one of its fields */
+struct sorcery_index_entry {
+	/*! \brief The indexed object */
+	void *obj;
+	/*! \brief The value of the field */
+	char value[0];
+};
+
+/*! \brief The objects in an index by the value of one field */
+struct sorcery_index_field {
+	/*! \brief Index entries, hashed by value */
+	struct ao2_container *entries;
+	/*! \brief Name of the field */
+	char name[0];
+};
+
+/*! \brief Index of objects by the fields of their type that are indexed */
+struct ast_sorcery_index {
+	AST_VECTOR(, struct sorcery_index_field *) fields;
+};
+
+/*! \brief Number of buckets an index field starts with */
+#define INDEX_ENTRY_BUCKETS 53
+
+static void sorcery_index_entry_destructor(void *obj)
+{
+	struct sorcery_index_entry *entry = obj;
+
+	ao2_cleanup(entry->obj);
+}
+
+static int sorcery_index_entry_hash(const void *obj, int flags)
+{
+	const struct sorcery_index_entry *entry = obj;
+	const char *key = obj;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+		key = entry->value;
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		break;
+	default:
+		ast_assert(0);
+		return 0;
+	}
+	return ast_str_hash(key);
+}
+
+static int sorcery_index_entry_cmp(void *obj, void *arg, int flags)
+{
+	const struct sorcery_index_entry *left = obj;
+	const struct sorcery_index_entry *right = arg;
+	const char *right_key = arg;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_OBJECT:
+		right_key = right->value;
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		break;
+	default:
+		return 0;
+	}
+	return strcmp(left->value, right_key) ? 0 : CMP_MATCH;
+}
+
+static void sorcery_index_field_destroy(struct sorcery_index_field *field)
+{
+	ao2_cleanup(field->entries);
+	ast_free(field);
+}
+
+static void sorcery_index_destructor(void *obj)
+{
+	struct ast_sorcery_index *index = obj;
+
+	AST_VECTOR_CALLBACK_VOID(&index->fields, sorcery_index_field_destroy);
+	AST_VECTOR_FREE(&index->fields);
+}
+
+struct ast_sorcery_index *ast_sorcery_index_alloc(const struct ast_sorcery *sorcery, const char *type)
+{
+	struct ast_sorcery_object_type *object_type;
+	struct ast_sorcery_object_field *object_field;
+	struct ast_sorcery_index *index;
+	struct ao2_iterator i;
+
+	object_type = ao2_find(sorcery->types, type, OBJ_SEARCH_KEY);
+	if (!object_type) {
+		return NULL;
+	}
+
+	index = ao2_alloc_options(sizeof(*index), sorcery_index_destructor, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!index || AST_VECTOR_INIT(&index->fields, 0)) {
+		ao2_cleanup(index);
+		ao2_ref(object_type, -1);
+		return NULL;
+	}
+
+	i = ao2_iterator_init(object_type->fields, 0);
+	for (; (object_field = ao2_iterator_next(&i)); ao2_ref(object_field, -1)) {
+		struct sorcery_index_field *field;
+
+		if (!object_field->indexed) {
+			continue;
+		}
+
+		field = ast_calloc(1, sizeof(*field) + strlen(object_field->name) + 1);
+		if (!field) {
+			continue;
+		}
+		strcpy(field->name, object_field->name); /* Safe */
+
+		field->entries = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK,
+			AO2_CONTAINER_ALLOC_OPT_AUTO_RESIZE, INDEX_ENTRY_BUCKETS,
+			sorcery_index_entry_hash, NULL, sorcery_index_entry_cmp);
+		if (!field->entries || AST_VECTOR_APPEND(&index->fields, field)) {
+			sorcery_index_field_destroy(field);
+		}
+	}
+	ao2_iterator_destroy(&i);
+	ao2_ref(object_type, -1);
+
+	if (!AST_VECTOR_SIZE(&index->fields)) {
+		/* Nothing of this type is indexed, or the index could not be built */
+		ao2_ref(index, -1);
+		return NULL;
+	}
+
+	return index;
+}
+
+int ast_sorcery_index_link(struct ast_sorcery_index *index, void *obj, const struct ast_variable *objectset)
+{
+	int res = 0;
+	int idx;
+
+	for (idx = 0; idx < AST_VECTOR_SIZE(&index->fields); ++idx) {
+		struct sorcery_index_field *field = AST_VECTOR_GET(&index->fields, idx);
+		struct sorcery_index_entry *entry;
+		const char *value;
+
+		/* Only the first value of a field is compared when retrieving by fields */
+		value = ast_variable_find_in_list(objectset, field->name);
+		if (!value) {
+			continue;
+		}
+
+		entry = ao2_alloc_options(sizeof(*entry) + strlen(value) + 1,
+			sorcery_index_entry_destructor, AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!entry) {
+			res = -1;
+			continue;
+		}
+		strcpy(entry->value, value); /* Safe */
+		entry->obj = ao2_bump(obj);
+
+		if (!ao2_link(field->entries, entry)) {
+			res = -1;
+		}
+		ao2_ref(entry, -1);
+	}
+
+	return res;
+}
+
+static int sorcery_index_entry_obj_match(void *obj, void *arg, void *data, int flags)
+{
+	const struct sorcery_index_entry *entry = obj;
+
+	return entry->obj == data && !strcmp(entry->value, arg) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+void ast_sorcery_index_unlink(struct ast_sorcery_index *index, void *obj, const struct ast_variable *objectset)
+{
+	int idx;
+
+	for (idx = 0; idx < AST_VECTOR_SIZE(&index->fields); ++idx) {
+		struct sorcery_index_field *field = AST_VECTOR_GET(&index->fields, idx);
+		const char *value;
+
+		value = ast_variable_find_in_list(objectset, field->name);
+		if (!value) {
+			continue;
+		}
+
+		ao2_callback_data(field->entries, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA,
+			sorcery_index_entry_obj_match, (char *) value, obj);
+	}
+}
+
+static int sorcery_index_entry_collect(void *obj, void *arg, void *data, int flags)
+{
+	struct sorcery_index_entry *entry = obj;
+
+	if (!strcmp(entry->value, arg)) {
+		ao2_link(data, entry->obj);
+	}
+
+	return 0;
+}
+
+struct ao2_container *ast_sorcery_index_find(struct ast_sorcery_index *index, const struct ast_variable *fields)
+{
+	const struct ast_variable *var;
+	struct ao2_container *candidates;
+	int idx;
+
+	for (var = fields; var; var = var->next) {
+		double number;
+
+		/*
+		 * Only a plain value is compared as a string, operators, regular
+		 * expressions and numbers have to be checked against every object.
+		 */
+		if (strchr(var->name, ' ') || !var->value
+			|| (var->value[0] == '/' && strlen(var->value) >= 2
+				&& var->value[strlen(var->value) - 1] == '/')
+			|| sscanf(var->value, "%lf", &number) == 1) {
+			continue;
+		}
+
+		for (idx = 0; idx < AST_VECTOR_SIZE(&index->fields); ++idx) {
+			struct sorcery_index_field *field = AST_VECTOR_GET(&index->fields, idx);
+
+			if (strcmp(field->name, var->name)) {
+				continue;
+			}
+
+			candidates = ao2_container_alloc_list(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, NULL, NULL);
+			if (candidates) {
+				ao2_callback_data(field->entries, OBJ_SEARCH_KEY | OBJ_MULTIPLE | OBJ_NODATA,
+					sorcery_index_entry_collect, (char *) var->value, candidates);
+			}
+			return candidates;
+		}
+	}
+
+	return NULL;
+}
+
 /*! \brief Retrieves whether or not the type is reloadable */
 static int sorcery_reloadable(const struct ast_sorcery *sorcery, const char *type)
 {
@@ -1862,6 +2129,7 @@ void *ast_sorcery_retrieve_by_id(const struct ast_sorcery *sorcery, const char *
 	void *object = NULL;
 	int i;
 	unsigned int cached = 0;
+	unsigned int missing = 0;
 
 	if (ast_strlen_zero(id)) {
 		return NULL;
@@ -1877,6 +2145,12 @@ void *ast_sorcery_retrieve_by_id(const struct ast_sorcery *sorcery, const char *
 		struct ast_sorcery_object_wizard *wizard =
 			AST_VECTOR_GET(&object_type->wizards, i);
 
+		if (wizard->caching && wizard->wizard->callbacks.is_missing_id &&
+			wizard->wizard->callbacks.is_missing_id(sorcery, wizard->data, object_type->name, id)) {
+			missing = 1;
+			break;
+		}
+
 		if (wizard->wizard->callbacks.retrieve_id &&
 			!(object = wizard->wizard->callbacks.retrieve_id(sorcery, wizard->data, object_type->name, id))) {
 			continue;
@@ -1893,6 +2167,16 @@ void *ast_sorcery_retrieve_by_id(const struct ast_sorcery *sorcery, const char *
 		};
 
 		AST_VECTOR_CALLBACK(&object_type->wizards, sorcery_cache_create, NULL, &sdetails, 0);
+	} else if (!object && !missing) {
+		/* Every wizard was asked, let the caches remember that the object does not exist */
+		for (i = 0; i < AST_VECTOR_SIZE(&object_type->wizards); i++) {
+			struct ast_sorcery_object_wizard *wizard =
+				AST_VECTOR_GET(&object_type->wizards, i);
+
+			if (wizard->caching && wizard->wizard->callbacks.missing_id) {
+				wizard->wizard->callbacks.missing_id(sorcery, wizard->data, object_type->name, id);
+			}
+		}
 	}
 	AST_VECTOR_RW_UNLOCK(&object_type->wizards);
 
@@ -1944,7 +2228,12 @@ void *ast_sorcery_retrieve_by_fields(const struct ast_sorcery *sorcery, const ch
 
 	/* If we are returning a single object and it came from a non-cache source create it in any caches */
 	if (!(flags & AST_RETRIEVE_FLAG_MULTIPLE) && !cached && object) {
-		AST_VECTOR_CALLBACK(&object_type->wizards, sorcery_cache_create, NULL, object, 0);
+		struct sorcery_details sdetails = {
+			.sorcery = sorcery,
+			.obj = object,
+		};
+
+		AST_VECTOR_CALLBACK(&object_type->wizards, sorcery_cache_create, NULL, &sdetails, 0);
 	}
 	AST_VECTOR_RW_UNLOCK(&object_type->wizards);
 
@@ -1981,6 +2270,79 @@ struct ao2_container *ast_sorcery_retrieve_by_regex(const struct ast_sorcery *so
 	return objects;
 }
 
+int ast_sorcery_prefetch(const struct ast_sorcery *sorcery, const char *type, const struct ast_variable *fields)
+{
+	struct ast_sorcery_object_type *object_type;
+	struct ao2_container *objects;
+	int i;
+	unsigned int caches = 0;
+	unsigned int cached = 0;
+	int res;
+
+	object_type = ao2_find(sorcery->types, type, OBJ_SEARCH_KEY);
+	if (!object_type) {
+		return -1;
+	}
+
+	objects = ao2_container_alloc_options(AO2_ALLOC_OPT_LOCK_NOLOCK, 1, NULL, NULL);
+	if (!objects) {
+		ao2_ref(object_type, -1);
+		return -1;
+	}
+
+	AST_VECTOR_RW_RDLOCK(&object_type->wizards);
+	for (i = 0; i < AST_VECTOR_SIZE(&object_type->wizards); i++) {
+		struct ast_sorcery_object_wizard *wizard =
+			AST_VECTOR_GET(&object_type->wizards, i);
+
+		if (wizard->caching && wizard->wizard->callbacks.create) {
+			caches++;
+		}
+	}
+
+	/* Without a cache there is nowhere to keep the objects, so do not bother the backend */
+	for (i = 0; caches && i < AST_VECTOR_SIZE(&object_type->wizards); i++) {
+		struct ast_sorcery_object_wizard *wizard =
+			AST_VECTOR_GET(&object_type->wizards, i);
+
+		if (!wizard->wizard->callbacks.retrieve_multiple) {
+			continue;
+		}
+
+		/* A cache of the full backend populates itself when it is asked for objects */
+		wizard->wizard->callbacks.retrieve_multiple(sorcery, wizard->data, object_type->name, objects, fields);
+		if (ao2_container_count(objects)) {
+			cached = wizard->caching;
+			break;
+		}
+	}
+
+	if (!cached && ao2_container_count(objects)) {
+		struct ao2_iterator it;
+		void *object;
+
+		it = ao2_iterator_init(objects, 0);
+		for (; (object = ao2_iterator_next(&it)); ao2_ref(object, -1)) {
+			struct sorcery_details sdetails = {
+				.sorcery = sorcery,
+				.obj = object,
+			};
+
+			AST_VECTOR_CALLBACK(&object_type->wizards, sorcery_cache_create, NULL, &sdetails, 0);
+		}
+		ao2_iterator_destroy(&it);
+	}
+	AST_VECTOR_RW_UNLOCK(&object_type->wizards);
+
+	res = caches ? ao2_container_count(objects) : -1;
+	ast_debug(3, "Prefetched %d objects of type '%s'\n", res, object_type->name);
+
+	ao2_ref(objects, -1);
+	ao2_ref(object_type, -1);
+
+	return res;
+}
+
 /*! \brief Internal function which returns if the wizard has created the object */
 static int sorcery_wizard_create(const struct ast_sorcery_object_wizard *object_wizard, const struct sorcery_details *details)
 {
@@ -2245,6 +2607,35 @@ int ast_sorcery_delete(const struct ast_sorcery *sorcery, void *object)
 	return object_wizard ? 0 : -1;
 }
 
+int ast_sorcery_is_stale(const struct ast_sorcery *sorcery, void *object)
+{
+	const struct ast_sorcery_object_details *details = object;
+	RAII_VAR(struct ast_sorcery_object_type *, object_type, ao2_find(sorcery->types, details->object->type, OBJ_KEY), ao2_cleanup);
+	struct ast_sorcery_object_wizard *found_wizard;
+	int res = 0;
+	int i;
+
+	if (!object_type) {
+		return -1;
+	}
+
+	AST_VECTOR_RW_RDLOCK(&object_type->wizards);
+	for (i = 0; i < AST_VECTOR_SIZE(&object_type->wizards); i++) {
+		found_wizard = AST_VECTOR_GET(&object_type->wizards, i);
+
+		if (found_wizard->wizard->callbacks.is_stale) {
+			res |= found_wizard->wizard->callbacks.is_stale(sorcery, found_wizard->data, object);
+			ast_debug(5, "After calling wizard '%s', object '%s' is %s\n",
+				found_wizard->wizard->callbacks.name,
+				ast_sorcery_object_get_id(object),
+				res ? "stale" : "not stale");
+		}
+	}
+	AST_VECTOR_RW_UNLOCK(&object_type->wizards);
+
+	return res;
+}
+
 void ast_sorcery_unref(struct ast_sorcery *sorcery)
 {
 	if (sorcery) {
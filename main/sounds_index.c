@@ -37,6 +37,7 @@
 #include "asterisk/_private.h"
 #include "asterisk/stasis_message_router.h"
 #include "asterisk/stasis_system.h"
+#include "asterisk/sched.h"
 
 /*** MODULEINFO
 	<support_level>core</support_level>
@@ -45,10 +46,27 @@
 /*! \brief The number of buckets to be used for storing language-keyed objects */
 #define LANGUAGE_BUCKETS 7
 
-static struct ast_media_index *sounds_index;
+/*! \brief Milliseconds without format changes before the index is updated for them */
+#define REINDEX_DELAY 1000
+
+static AO2_GLOBAL_OBJ_STATIC(sounds_index);
 
 static struct stasis_message_router *sounds_system_router;
 
+/*! \brief Scheduler of index updates following format changes */
+static struct ast_sched_context *sounds_sched;
+
+/*! \brief Scheduled index update, protected by reindex_lock */
+static int reindex_sched_id = -1;
+
+AST_MUTEX_DEFINE_STATIC(reindex_lock);
+
+/*! \brief Get the file the directory listings of the index are saved to */
+static void get_listing_file(char *buf, size_t len)
+{
+	snprintf(buf, len, "%s/sounds_index.listing", ast_config_AST_VAR_DIR);
+}
+
 /*! \brief Get the languages in which sound files are available */
 static struct ao2_container *get_languages(void)
 {
@@ -117,11 +135,14 @@ int ast_sounds_reindex(void)
 	RAII_VAR(struct ao2_container *, languages, NULL, ao2_cleanup);
 	RAII_VAR(char *, failed_index, NULL, ao2_cleanup);
 	RAII_VAR(struct ast_media_index *, new_index, NULL, ao2_cleanup);
-	struct ast_media_index *old_index;
+	RAII_VAR(struct ast_media_index *, old_index, NULL, ao2_cleanup);
+	char listing_file[PATH_MAX];
+	struct timeval start;
 
 	SCOPED_MUTEX(lock, &reload_lock);
 
-	old_index = sounds_index;
+	start = ast_tvnow();
+	old_index = ao2_global_obj_ref(sounds_index);
 	languages = get_languages();
 	sounds_dir = ast_str_create(64);
 
@@ -135,17 +156,53 @@ int ast_sounds_reindex(void)
 		return -1;
 	}
 
+	/* Only directories modified since the last index, even that of a previous run, are read */
+	get_listing_file(listing_file, sizeof(listing_file));
+	if (old_index) {
+		ast_media_index_reuse(new_index, old_index);
+	} else {
+		ast_media_index_load(new_index, listing_file);
+	}
+
 	failed_index = ao2_callback(languages, 0, update_index_cb, new_index);
 	if (failed_index) {
 		return -1;
 	}
 
-	ao2_ref(new_index, +1);
-	sounds_index = new_index;
-	ao2_cleanup(old_index);
+	/* The previous listings are not needed anymore */
+	ast_media_index_reuse(new_index, NULL);
+	ast_media_index_save(new_index, listing_file);
+
+	ao2_global_obj_replace_unref(sounds_index, new_index);
+	ast_debug(1, "Indexed sounds in %" PRIi64 " ms\n", ast_tvdiff_ms(ast_tvnow(), start));
+	return 0;
+}
+
+static int reindex_sched_cb(const void *data)
+{
+	ast_mutex_lock(&reindex_lock);
+	reindex_sched_id = -1;
+	ast_mutex_unlock(&reindex_lock);
+
+	ast_sounds_reindex();
 	return 0;
 }
 
+/*!
+ * \brief Update the index once no format has been registered or unregistered for a while
+ *
+ * Every format module loaded at startup registers formats, so this makes them
+ * share a single update.
+ */
+static void schedule_reindex(void)
+{
+	ast_mutex_lock(&reindex_lock);
+	if (reindex_sched_id < 0 || !ast_sched_del(sounds_sched, reindex_sched_id)) {
+		reindex_sched_id = ast_sched_add(sounds_sched, REINDEX_DELAY, reindex_sched_cb, NULL);
+	}
+	ast_mutex_unlock(&reindex_lock);
+}
+
 static int show_sounds_cb(void *obj, void *arg, int flags)
 {
 	char *name = obj;
@@ -203,7 +260,10 @@ static char *handle_cli_sounds_show(struct ast_cli_entry *e, int cmd, struct ast
 	}
 
 	if (a->argc == 3) {
-		RAII_VAR(struct ao2_container *, sound_files, ast_media_get_media(sounds_index), ao2_cleanup);
+		RAII_VAR(struct ast_media_index *, local_index, ast_sounds_get_index(), ao2_cleanup);
+		RAII_VAR(struct ao2_container *, sound_files, NULL, ao2_cleanup);
+
+		sound_files = local_index ? ast_media_get_media(local_index) : NULL;
 		if (!sound_files) {
 			return CLI_FAILURE;
 		}
@@ -233,7 +293,10 @@ static char *handle_cli_sound_show(struct ast_cli_entry *e, int cmd, struct ast_
 		struct ao2_iterator it_sounds;
 		char *match = NULL;
 		char *filename;
-		RAII_VAR(struct ao2_container *, sound_files, ast_media_get_media(sounds_index), ao2_cleanup);
+		RAII_VAR(struct ast_media_index *, local_index, ast_sounds_get_index(), ao2_cleanup);
+		RAII_VAR(struct ao2_container *, sound_files, NULL, ao2_cleanup);
+
+		sound_files = local_index ? ast_media_get_media(local_index) : NULL;
 		if (!sound_files) {
 			return NULL;
 		}
@@ -253,7 +316,10 @@ static char *handle_cli_sound_show(struct ast_cli_entry *e, int cmd, struct ast_
 	}
 
 	if (a->argc == 4) {
-		RAII_VAR(struct ao2_container *, variants, ast_media_get_variants(sounds_index, a->argv[3]), ao2_cleanup);
+		RAII_VAR(struct ast_media_index *, local_index, ast_sounds_get_index(), ao2_cleanup);
+		RAII_VAR(struct ao2_container *, variants, NULL, ao2_cleanup);
+
+		variants = local_index ? ast_media_get_variants(local_index, a->argv[3]) : NULL;
 		if (!variants || !ao2_container_count(variants)) {
 			ast_cli(a->fd, "ERROR: File %s not found in index\n", a->argv[3]);
 			return CLI_FAILURE;
@@ -278,23 +344,29 @@ static void sounds_cleanup(void)
 	stasis_message_router_unsubscribe_and_join(sounds_system_router);
 	sounds_system_router = NULL;
 	ast_cli_unregister_multiple(cli_sounds, ARRAY_LEN(cli_sounds));
-	ao2_cleanup(sounds_index);
-	sounds_index = NULL;
+	ast_sched_context_destroy(sounds_sched);
+	sounds_sched = NULL;
+	ao2_global_obj_release(sounds_index);
 }
 
 static void format_update_cb(void *data, struct stasis_subscription *sub,
 	struct stasis_message *message)
 {
-	ast_sounds_reindex();
+	schedule_reindex();
 }
 
 int ast_sounds_index_init(void)
 {
 	int res = 0;
-	sounds_index = NULL;
-	if (ast_sounds_reindex()) {
+
+	sounds_sched = ast_sched_context_create();
+	if (!sounds_sched || ast_sched_start_thread(sounds_sched)) {
 		return -1;
 	}
+
+	/* The index is built once the format modules are loaded, or when first needed */
+	schedule_reindex();
+
 	res |= ast_cli_register_multiple(cli_sounds, ARRAY_LEN(cli_sounds));
 
 	sounds_system_router = stasis_message_router_create(ast_system_topic());
@@ -328,6 +400,12 @@ int ast_sounds_index_init(void)
 
 struct ast_media_index *ast_sounds_get_index(void)
 {
-	ao2_ref(sounds_index, +1);
-	return sounds_index;
+	struct ast_media_index *index = ao2_global_obj_ref(sounds_index);
+
+	if (!index) {
+		ast_sounds_reindex();
+		index = ao2_global_obj_ref(sounds_index);
+	}
+
+	return index;
 }
@@ -32,6 +32,7 @@
 ASTERISK_FILE_VERSION(__FILE__, "$Revision$");
 
 #include "asterisk/astobj2.h"
+#include "asterisk/cli.h"
 #include "asterisk/stasis_internal.h"
 #include "asterisk/stasis.h"
 #include "asterisk/taskprocessor.h"
@@ -43,6 +44,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$");
 #include "asterisk/stasis_bridges.h"
 #include "asterisk/stasis_endpoints.h"
 #include "asterisk/config_options.h"
+#include "asterisk/affinity.h"
 
 /*** DOCUMENTATION
 	<managerEvent language="en_US" name="UserEvent">
@@ -304,6 +306,18 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$");
 /*! Thread pool for topics that don't want a dedicated taskprocessor */
 static struct ast_threadpool *pool;
 
+/*! The number of buckets to use for the subscriptions container */
+#define SUBSCRIPTION_BUCKETS 127
+
+/*! All subscriptions, for the CLI */
+static struct ao2_container *subscriptions;
+
+/*! Message types with an identifier below this can be filtered out */
+#define FILTER_MESSAGE_TYPES 1024
+
+/*! Bits in each word of a subscription's accepted message types */
+#define FILTER_WORD_BITS (sizeof(unsigned long) * 8)
+
 STASIS_MESSAGE_TYPE_DEFN(stasis_subscription_change_type);
 
 /*! \internal */
@@ -393,6 +407,15 @@ struct stasis_subscription {
 	/*! Flag set when final message for sub has been processed.
 	 *  Be sure join_lock is held before reading/setting. */
 	int final_message_processed;
+
+	/*! The message filter currently in use */
+	enum stasis_subscription_message_filter filter;
+	/*! Bitmap of the accepted message types, indexed by type identifier */
+	unsigned long accepted_message_types[FILTER_MESSAGE_TYPES / FILTER_WORD_BITS];
+	/*! Number of messages queued to the subscription */
+	int messages_delivered;
+	/*! Number of messages dropped by the filter */
+	int messages_filtered;
 };
 
 static void subscription_dtor(void *obj)
@@ -504,6 +527,9 @@ struct stasis_subscription *internal_stasis_subscribe(
 	if (topic_add_subscription(topic, sub) != 0) {
 		return NULL;
 	}
+	if (subscriptions) {
+		ao2_link(subscriptions, sub);
+	}
 	send_subscription_subscribe(topic, sub);
 
 	ao2_ref(sub, +1);
@@ -551,6 +577,9 @@ struct stasis_subscription *stasis_unsubscribe(struct stasis_subscription *sub)
 			"Internal error: subscription has invalid topic\n");
 		return NULL;
 	}
+	if (subscriptions) {
+		ao2_unlink(subscriptions, sub);
+	}
 
 	/* Now let everyone know about the unsubscribe */
 	send_subscription_unsubscribe(topic, sub);
@@ -577,6 +606,104 @@ int stasis_subscription_set_congestion_limits(struct stasis_subscription *subscr
 	return res;
 }
 
+int stasis_subscription_accept_message_type(struct stasis_subscription *subscription,
+	const struct stasis_message_type *type)
+{
+	int id;
+
+	if (!subscription) {
+		return -1;
+	}
+
+	if (!type) {
+		/* Declined message types are never published */
+		return 0;
+	}
+
+	id = stasis_message_type_id(type);
+	if (id < FILTER_MESSAGE_TYPES) {
+		SCOPED_AO2LOCK(lock, subscription);
+
+		subscription->accepted_message_types[id / FILTER_WORD_BITS] |= 1UL << (id % FILTER_WORD_BITS);
+	}
+	/* Message types beyond the bitmap are always accepted */
+
+	return 0;
+}
+
+int stasis_subscription_decline_message_type(struct stasis_subscription *subscription,
+	const struct stasis_message_type *type)
+{
+	int id;
+
+	if (!subscription) {
+		return -1;
+	}
+
+	if (!type) {
+		return 0;
+	}
+
+	id = stasis_message_type_id(type);
+	if (id < FILTER_MESSAGE_TYPES) {
+		SCOPED_AO2LOCK(lock, subscription);
+
+		subscription->accepted_message_types[id / FILTER_WORD_BITS] &= ~(1UL << (id % FILTER_WORD_BITS));
+	}
+
+	return 0;
+}
+
+int stasis_subscription_set_filter(struct stasis_subscription *subscription,
+	enum stasis_subscription_message_filter filter)
+{
+	if (!subscription) {
+		return -1;
+	}
+
+	ao2_lock(subscription);
+	if (subscription->filter != STASIS_SUBSCRIPTION_FILTER_FORCED_NONE) {
+		subscription->filter = filter;
+	}
+	ao2_unlock(subscription);
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Check whether a subscription's filter lets a message through.
+ *
+ * \param sub Subscription to check.
+ * \param message Message being published.
+ *
+ * \retval 1 deliver the message.
+ * \retval 0 the subscription does not want the message.
+ */
+static int subscription_accepts(const struct stasis_subscription *sub,
+	struct stasis_message *message)
+{
+	struct stasis_message_type *type;
+	int id;
+
+	if (sub->filter != STASIS_SUBSCRIPTION_FILTER_SELECTIVE) {
+		return 1;
+	}
+
+	type = stasis_message_type(message);
+	if (type == stasis_subscription_change_type()) {
+		/* Subscribes and unsubscribes are needed to track the subscription */
+		return 1;
+	}
+
+	id = stasis_message_type_id(type);
+	if (id >= FILTER_MESSAGE_TYPES) {
+		return 1;
+	}
+
+	return (sub->accepted_message_types[id / FILTER_WORD_BITS] >> (id % FILTER_WORD_BITS)) & 1;
+}
+
 void stasis_subscription_join(struct stasis_subscription *subscription)
 {
 	if (subscription) {
@@ -832,6 +959,12 @@ static void publish_msg(struct stasis_topic *topic,
 
 		ast_assert(sub != NULL);
 
+		if (sub != sync_sub && !subscription_accepts(sub, message)) {
+			ast_atomic_fetchadd_int(&sub->messages_filtered, +1);
+			continue;
+		}
+		ast_atomic_fetchadd_int(&sub->messages_delivered, +1);
+
 		dispatch_message(sub, message, (sub == sync_sub));
 	}
 	ao2_unlock(topic);
@@ -1271,7 +1404,7 @@ void ast_multi_object_blob_single_channel_publish(struct ast_channel *chan,
 	message = stasis_message_create(type, multi);
 	if (message) {
 		/* app_userevent still publishes to channel */
-		stasis_publish(ast_channel_topic(chan), message);
+		stasis_publish(ast_channel_topic_for_publish(chan), message);
 	}
 }
 
@@ -1557,9 +1690,77 @@ STASIS_MESSAGE_TYPE_DEFN(ast_multi_user_event_type,
 
 /*! @} */
 
+static int subscription_hash(const void *obj, int flags)
+{
+	const struct stasis_subscription *sub = obj;
+
+	return ast_str_hash(sub->uniqueid);
+}
+
+static const char *filter_name(enum stasis_subscription_message_filter filter)
+{
+	switch (filter) {
+	case STASIS_SUBSCRIPTION_FILTER_NONE:
+		return "None";
+	case STASIS_SUBSCRIPTION_FILTER_FORCED_NONE:
+		return "Forced";
+	case STASIS_SUBSCRIPTION_FILTER_SELECTIVE:
+		return "Selective";
+	}
+	return "Unknown";
+}
+
+static char *handle_cli_stasis_show_subscriptions(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-50.50s %-9s %12s %12s\n"
+#define FORMAT2 "%-50.50s %-9s %12d %12d\n"
+	struct ao2_iterator iter;
+	struct stasis_subscription *sub;
+	int count = 0;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "stasis show subscriptions";
+		e->usage =
+			"Usage: stasis show subscriptions\n"
+			"       Shows the message filter of every stasis subscription along\n"
+			"       with how many messages were delivered to it and how many\n"
+			"       were dropped by its filter.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, FORMAT, "Topic", "Filter", "Delivered", "Filtered");
+	iter = ao2_iterator_init(subscriptions, 0);
+	for (; (sub = ao2_iterator_next(&iter)); ao2_ref(sub, -1)) {
+		ast_cli(a->fd, FORMAT2, stasis_topic_name(sub->topic), filter_name(sub->filter),
+			ast_atomic_fetchadd_int(&sub->messages_delivered, 0),
+			ast_atomic_fetchadd_int(&sub->messages_filtered, 0));
+		++count;
+	}
+	ao2_iterator_destroy(&iter);
+	ast_cli(a->fd, "%d subscription%s\n", count, ESS(count));
+
+	return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+static struct ast_cli_entry cli_stasis[] = {
+	AST_CLI_DEFINE(handle_cli_stasis_show_subscriptions, "Show stasis subscription filters and counters"),
+};
+
 /*! \brief Cleanup function for graceful shutdowns */
 static void stasis_cleanup(void)
 {
+	ast_cli_unregister_multiple(cli_stasis, ARRAY_LEN(cli_stasis));
+	ao2_cleanup(subscriptions);
+	subscriptions = NULL;
 	ast_threadpool_shutdown(pool);
 	pool = NULL;
 	STASIS_MESSAGE_TYPE_CLEANUP(stasis_subscription_change_type);
@@ -1568,6 +1769,12 @@ static void stasis_cleanup(void)
 	ao2_global_obj_release(globals);
 }
 
+/*! \brief Place the threads delivering stasis messages */
+static void stasis_thread_start(void)
+{
+	ast_thread_class_set(AST_THREAD_CLASS_STASIS);
+}
+
 int stasis_init(void)
 {
 	RAII_VAR(struct stasis_config *, cfg, NULL, ao2_cleanup);
@@ -1630,6 +1837,7 @@ int stasis_init(void)
 	threadpool_opts.auto_increment = 1;
 	threadpool_opts.max_size = cfg->threadpool_options->max_size;
 	threadpool_opts.idle_timeout = cfg->threadpool_options->idle_timeout_sec;
+	threadpool_opts.thread_start = stasis_thread_start;
 	pool = ast_threadpool_create("stasis-core", NULL, &threadpool_opts);
 	if (!pool) {
 		ast_log(LOG_ERROR, "Failed to create 'stasis-core' threadpool\n");
@@ -1641,6 +1849,13 @@ int stasis_init(void)
 		return -1;
 	}
 
+	subscriptions = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0,
+		SUBSCRIPTION_BUCKETS, subscription_hash, NULL, NULL);
+	if (!subscriptions) {
+		return -1;
+	}
+	ast_cli_register_multiple(cli_stasis, ARRAY_LEN(cli_stasis));
+
 	if (STASIS_MESSAGE_TYPE_INIT(stasis_subscription_change_type) != 0) {
 		return -1;
 	}
@@ -45,6 +45,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
    consistency in the ordering of channels in a bridge will break. */
 #define SNAPSHOT_CHANNELS_BUCKETS 1
 
+/* Bridges with fewer channels build the container of channels of their
+   snapshot rather than look for the one of their latest snapshot. */
+#define SNAPSHOT_CHANNELS_REUSE_MIN 16
+
 /*** DOCUMENTATION
 	<managerEvent language="en_US" name="BlindTransfer">
 		<managerEventInstance class="EVENT_FLAG_CALL">
@@ -233,10 +237,117 @@ static void bridge_snapshot_dtor(void *obj)
 	snapshot->channels = NULL;
 }
 
+/*! \brief qsort comparator sorting channel uniqueids in descending order */
+static int uniqueid_cmp_descending(const void *left, const void *right)
+{
+	return strcmp(*(const char * const *) right, *(const char * const *) left);
+}
+
+/*!
+ * \internal
+ * \brief Get the channels of the latest snapshot of a bridge if they did not change.
+ *
+ * \param bridge The bridge.
+ * \param uniqueids Uniqueids of the channels in the bridge, in descending order.
+ * \param count Number of uniqueids.
+ *
+ * \details
+ * Snapshots are published again for changes other than channels joining or
+ * leaving, such as the video source of a conference following its talker.
+ * The container of channels of the latest snapshot is shared with the new
+ * one then, as snapshots are immutable.
+ *
+ * \retval container Reffed, when the channels did not change.
+ * \retval NULL otherwise.
+ */
+static struct ao2_container *snapshot_channels_latest(struct ast_bridge *bridge,
+	const char **uniqueids, unsigned int count)
+{
+	struct ast_bridge_snapshot *latest;
+	struct ao2_container *channels = NULL;
+	struct ao2_iterator iter;
+	char *uniqueid;
+	unsigned int idx = count;
+
+	latest = ast_bridge_snapshot_get_latest(bridge->uniqueid);
+	if (!latest) {
+		return NULL;
+	}
+
+	if (ao2_container_count(latest->channels) == count) {
+		/* The single bucket keeps the uniqueids in ascending order. */
+		iter = ao2_iterator_init(latest->channels, 0);
+		for (; (uniqueid = ao2_iterator_next(&iter)); ao2_ref(uniqueid, -1)) {
+			if (!idx || strcmp(uniqueid, uniqueids[--idx])) {
+				ao2_ref(uniqueid, -1);
+				break;
+			}
+		}
+		ao2_iterator_destroy(&iter);
+		if (!uniqueid) {
+			channels = ao2_bump(latest->channels);
+		}
+	}
+	ao2_ref(latest, -1);
+
+	return channels;
+}
+
+/*!
+ * \internal
+ * \brief Create the container of channels of a bridge snapshot.
+ *
+ * \param bridge The bridge, locked.
+ *
+ * \retval container on success.
+ * \retval NULL on error.
+ */
+static struct ao2_container *snapshot_channels_create(struct ast_bridge *bridge)
+{
+	struct ast_bridge_channel *bridge_channel;
+	struct ao2_container *channels = NULL;
+	const char **uniqueids;
+	unsigned int count = 0;
+	unsigned int idx;
+
+	uniqueids = ast_malloc(sizeof(*uniqueids) * (bridge->num_channels + 1));
+	if (!uniqueids) {
+		return NULL;
+	}
+	AST_LIST_TRAVERSE(&bridge->channels, bridge_channel, entry) {
+		if (count == bridge->num_channels) {
+			break;
+		}
+		uniqueids[count++] = ast_channel_uniqueid(bridge_channel->chan);
+	}
+
+	/*
+	 * The single sorted bucket is searched from its head for the place of
+	 * each uniqueid, so linking them in descending order puts each at the
+	 * head instead of walking the whole bucket.
+	 */
+	qsort(uniqueids, count, sizeof(*uniqueids), uniqueid_cmp_descending);
+
+	if (SNAPSHOT_CHANNELS_REUSE_MIN <= count) {
+		channels = snapshot_channels_latest(bridge, uniqueids, count);
+	}
+	if (!channels) {
+		channels = ast_str_container_alloc(SNAPSHOT_CHANNELS_BUCKETS);
+		for (idx = 0; channels && idx < count; ++idx) {
+			if (ast_str_container_add(channels, uniqueids[idx])) {
+				ao2_ref(channels, -1);
+				channels = NULL;
+			}
+		}
+	}
+	ast_free(uniqueids);
+
+	return channels;
+}
+
 struct ast_bridge_snapshot *ast_bridge_snapshot_create(struct ast_bridge *bridge)
 {
 	RAII_VAR(struct ast_bridge_snapshot *, snapshot, NULL, ao2_cleanup);
-	struct ast_bridge_channel *bridge_channel;
 
 	snapshot = ao2_alloc_options(sizeof(*snapshot), bridge_snapshot_dtor,
 		AO2_ALLOC_OPT_LOCK_NOLOCK);
@@ -250,18 +361,11 @@ struct ast_bridge_snapshot *ast_bridge_snapshot_create(struct ast_bridge *bridge
 		return NULL;
 	}
 
-	snapshot->channels = ast_str_container_alloc(SNAPSHOT_CHANNELS_BUCKETS);
+	snapshot->channels = snapshot_channels_create(bridge);
 	if (!snapshot->channels) {
 		return NULL;
 	}
 
-	AST_LIST_TRAVERSE(&bridge->channels, bridge_channel, entry) {
-		if (ast_str_container_add(snapshot->channels,
-				ast_channel_uniqueid(bridge_channel->chan))) {
-			return NULL;
-		}
-	}
-
 	ast_string_field_set(snapshot, uniqueid, bridge->uniqueid);
 	ast_string_field_set(snapshot, technology, bridge->technology->name);
 	ast_string_field_set(snapshot, subclass, bridge->v_table->name);
@@ -617,6 +721,53 @@ struct ast_json *ast_bridge_snapshot_to_json(
 	return ast_json_ref(json_bridge);
 }
 
+int ast_bridge_snapshot_write_json(const struct ast_bridge_snapshot *snapshot,
+	const struct stasis_message_sanitizer *sanitize, struct ast_json_writer *writer)
+{
+	struct ao2_iterator it;
+	char *item;
+
+	if (snapshot == NULL) {
+		return ast_json_writer_null(writer);
+	}
+
+	/* Keep in sync with ast_bridge_snapshot_to_json() */
+	ast_json_writer_object_start(writer);
+	ast_json_writer_key(writer, "id");
+	ast_json_writer_string(writer, snapshot->uniqueid);
+	ast_json_writer_key(writer, "technology");
+	ast_json_writer_string(writer, snapshot->technology);
+	ast_json_writer_key(writer, "bridge_type");
+	ast_json_writer_string(writer, capability2str(snapshot->capabilities));
+	ast_json_writer_key(writer, "bridge_class");
+	ast_json_writer_string(writer, snapshot->subclass);
+	ast_json_writer_key(writer, "creator");
+	ast_json_writer_string(writer, snapshot->creator);
+	ast_json_writer_key(writer, "name");
+	ast_json_writer_string(writer, snapshot->name);
+
+	ast_json_writer_key(writer, "channels");
+	ast_json_writer_array_start(writer);
+	for (it = ao2_iterator_init(snapshot->channels, 0);
+		(item = ao2_iterator_next(&it)); ao2_cleanup(item)) {
+		if (sanitize && sanitize->channel_id && sanitize->channel_id(item)) {
+			continue;
+		}
+		ast_json_writer_string(writer, item);
+	}
+	ao2_iterator_destroy(&it);
+	ast_json_writer_array_end(writer);
+
+	ast_json_writer_key(writer, "video_mode");
+	ast_json_writer_string(writer, ast_bridge_video_mode_to_string(snapshot->video_mode));
+	if (snapshot->video_mode != AST_BRIDGE_VIDEO_MODE_NONE
+		&& !ast_strlen_zero(snapshot->video_source_id)) {
+		ast_json_writer_key(writer, "video_source_id");
+		ast_json_writer_string(writer, snapshot->video_source_id);
+	}
+	return ast_json_writer_object_end(writer);
+}
+
 /*!
  * \internal
  * \brief Allocate the fields of an \ref ast_bridge_channel_snapshot_pair.
@@ -44,9 +44,33 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #define NUM_CACHE_BUCKETS 563
 #endif
 
-/*! \internal */
+#if defined(HAVE_GCC_ATOMICS) && defined(__ATOMIC_SEQ_CST)
+/*! Cache lookups take no lock, see cache_read_begin() */
+#define CACHE_LOCKLESS_READ 1
+#endif
+
+/*!
+ * \internal
+ *
+ * Published cache entries are never modified.  A writer replaces an
+ * entry by linking a changed copy in its place, so a reader always sees
+ * either the old or the new entry in full.
+ */
 struct stasis_cache {
-	struct ao2_container *entries;
+	/*! Hash chains of the cache entries */
+	struct stasis_cache_entry *buckets[NUM_CACHE_BUCKETS];
+	/*! Serializes writers.  Readers only take it without CACHE_LOCKLESS_READ. */
+	ast_rwlock_t lock;
+#ifdef CACHE_LOCKLESS_READ
+	/*! Current read epoch */
+	unsigned int epoch;
+	/*! Number of readers that entered during even and odd epochs */
+	int readers[2];
+	/*! Entries unlinked before the last epoch change */
+	struct stasis_cache_entry *retired_old;
+	/*! Entries unlinked during the current epoch */
+	struct stasis_cache_entry *retired_new;
+#endif
 	snapshot_get_id id_fn;
 	cache_aggregate_calc_fn aggregate_calc_fn;
 	cache_aggregate_publish_fn aggregate_publish_fn;
@@ -148,6 +172,10 @@ struct stasis_cache_entry {
 	struct stasis_message *local;
 	/*! Remote entity snapshots of the stasis event. */
 	AST_VECTOR(, struct stasis_message *) remote;
+	/*! Next entry in the hash chain. */
+	struct stasis_cache_entry *next;
+	/*! Next unlinked entry waiting to be released. */
+	struct stasis_cache_entry *retired;
 };
 
 static void cache_entry_dtor(void *obj)
@@ -225,72 +253,197 @@ static struct stasis_cache_entry *cache_entry_create(struct stasis_message_type
 	return entry;
 }
 
-static int cache_entry_hash(const void *obj, int flags)
-{
-	const struct stasis_cache_entry *object;
-	const struct cache_entry_key *key;
-
-	switch (flags & OBJ_SEARCH_MASK) {
-	case OBJ_SEARCH_KEY:
-		key = obj;
-		break;
-	case OBJ_SEARCH_OBJECT:
-		object = obj;
-		key = &object->key;
-		break;
-	default:
-		/* Hash can only work on something with a full key. */
-		ast_assert(0);
-		return 0;
-	}
-
-	return (int)key->hash;
-}
-
-static int cache_entry_cmp(void *obj, void *arg, int flags)
-{
-	const struct stasis_cache_entry *object_left = obj;
-	const struct stasis_cache_entry *object_right = arg;
-	const struct cache_entry_key *right_key = arg;
-	int cmp;
-
-	switch (flags & OBJ_SEARCH_MASK) {
-	case OBJ_SEARCH_OBJECT:
-		right_key = &object_right->key;
-		/* Fall through */
-	case OBJ_SEARCH_KEY:
-		cmp = object_left->key.type != right_key->type
-			|| strcmp(object_left->key.id, right_key->id);
-		break;
-	case OBJ_SEARCH_PARTIAL_KEY:
-		/* Not supported by container */
-		ast_assert(0);
-		cmp = -1;
-		break;
-	default:
-		/*
-		 * What arg points to is specific to this traversal callback
-		 * and has no special meaning to astobj2.
-		 */
-		cmp = 0;
-		break;
+/*!
+ * \internal
+ * \brief Copy a cache entry so that the copy can be changed before it is published.
+ *
+ * \param orig Entry to copy.
+ *
+ * \retval Copy of the entry on success.
+ * \retval NULL on error.
+ */
+static struct stasis_cache_entry *cache_entry_dup(const struct stasis_cache_entry *orig)
+{
+	struct stasis_cache_entry *entry;
+	size_t idx;
+
+	entry = ao2_alloc_options(sizeof(*entry), cache_entry_dtor,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!entry) {
+		return NULL;
 	}
-	if (cmp) {
-		return 0;
+
+	entry->key.id = ast_strdup(orig->key.id);
+	if (!entry->key.id) {
+		ao2_cleanup(entry);
+		return NULL;
 	}
-	/*
-	 * At this point the traversal callback is identical to a sorted
-	 * container.
-	 */
-	return CMP_MATCH;
+	entry->key.type = ao2_bump(orig->key.type);
+	entry->key.hash = orig->key.hash;
+
+	if (AST_VECTOR_INIT(&entry->remote, AST_VECTOR_SIZE(&orig->remote))) {
+		ao2_cleanup(entry);
+		return NULL;
+	}
+	for (idx = 0; idx < AST_VECTOR_SIZE(&orig->remote); ++idx) {
+		struct stasis_message *remote;
+
+		remote = AST_VECTOR_GET(&orig->remote, idx);
+		if (AST_VECTOR_APPEND(&entry->remote, remote)) {
+			ao2_cleanup(entry);
+			return NULL;
+		}
+		ao2_bump(remote);
+	}
+
+	entry->aggregate = ao2_bump(orig->aggregate);
+	entry->local = ao2_bump(orig->local);
+
+	return entry;
+}
+
+#ifdef CACHE_LOCKLESS_READ
+#define cache_load(link) __atomic_load_n(&(link), __ATOMIC_ACQUIRE)
+#define cache_store(link, entry) __atomic_store_n(&(link), (entry), __ATOMIC_RELEASE)
+#else
+#define cache_load(link) (link)
+#define cache_store(link, entry) ((link) = (entry))
+#endif
+
+/*!
+ * \internal
+ * \brief Enter a cache read section.
+ *
+ * \param cache The cache.
+ *
+ * Entries found in the cache remain valid until cache_read_end() even if
+ * a writer replaces or removes them in the meantime.  Readers just
+ * announce themselves in a counter for the current epoch, and a writer
+ * only releases the entries it unlinked once the epoch has moved on and
+ * no reader is left in the previous one.
+ *
+ * \return Token to pass to cache_read_end().
+ */
+static int cache_read_begin(struct stasis_cache *cache)
+{
+#ifdef CACHE_LOCKLESS_READ
+	unsigned int epoch;
+
+	for (;;) {
+		epoch = __atomic_load_n(&cache->epoch, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&cache->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&cache->epoch, __ATOMIC_SEQ_CST) == epoch) {
+			return epoch & 1;
+		}
+		/* A writer moved to the next epoch before we were counted. */
+		__atomic_sub_fetch(&cache->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+	}
+#else
+	ast_rwlock_rdlock(&cache->lock);
+	return 0;
+#endif
+}
+
+/*!
+ * \internal
+ * \brief Leave a cache read section.
+ *
+ * \param cache The cache.
+ * \param token What cache_read_begin() returned.
+ */
+static void cache_read_end(struct stasis_cache *cache, int token)
+{
+#ifdef CACHE_LOCKLESS_READ
+	__atomic_sub_fetch(&cache->readers[token], 1, __ATOMIC_SEQ_CST);
+#else
+	ast_rwlock_unlock(&cache->lock);
+#endif
+}
+
+#ifdef CACHE_LOCKLESS_READ
+static void cache_retired_release(struct stasis_cache_entry *entry)
+{
+	struct stasis_cache_entry *next;
+
+	while (entry) {
+		next = entry->retired;
+		ao2_ref(entry, -1);
+		entry = next;
+	}
+}
+#endif
+
+/*!
+ * \internal
+ * \brief Release the reference of the cache to an entry unlinked from it.
+ *
+ * \param cache The cache.
+ * \param entry The unlinked entry.
+ *
+ * \note The cache write lock is held.
+ */
+static void cache_retire(struct stasis_cache *cache, struct stasis_cache_entry *entry)
+{
+#ifdef CACHE_LOCKLESS_READ
+	/* Readers may still be looking at it. */
+	entry->retired = cache->retired_new;
+	cache->retired_new = entry;
+#else
+	ao2_ref(entry, -1);
+#endif
+}
+
+/*!
+ * \internal
+ * \brief Release retired entries no reader can still be looking at.
+ *
+ * \param cache The cache.
+ *
+ * This never waits for readers.  If readers from the previous epoch are
+ * still around the retired entries are simply kept until a later write.
+ *
+ * \note The cache write lock is held.
+ */
+static void cache_reclaim(struct stasis_cache *cache)
+{
+#ifdef CACHE_LOCKLESS_READ
+	unsigned int epoch = cache->epoch;
+
+	if (__atomic_load_n(&cache->readers[(epoch + 1) & 1], __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	/* Everyone who could have seen these has left. */
+	cache_retired_release(cache->retired_old);
+	cache->retired_old = NULL;
+
+	if (cache->retired_new) {
+		cache->retired_old = cache->retired_new;
+		cache->retired_new = NULL;
+		__atomic_store_n(&cache->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+	}
+#endif
 }
 
 static void cache_dtor(void *obj)
 {
 	struct stasis_cache *cache = obj;
+	struct stasis_cache_entry *entry;
+	int idx;
 
-	ao2_cleanup(cache->entries);
-	cache->entries = NULL;
+	for (idx = 0; idx < NUM_CACHE_BUCKETS; ++idx) {
+		while ((entry = cache->buckets[idx])) {
+			cache->buckets[idx] = entry->next;
+			ao2_ref(entry, -1);
+		}
+	}
+#ifdef CACHE_LOCKLESS_READ
+	cache_retired_release(cache->retired_old);
+	cache->retired_old = NULL;
+	cache_retired_release(cache->retired_new);
+	cache->retired_new = NULL;
+#endif
+	ast_rwlock_destroy(&cache->lock);
 }
 
 struct stasis_cache *stasis_cache_create_full(snapshot_get_id id_fn,
@@ -305,13 +458,7 @@ struct stasis_cache *stasis_cache_create_full(snapshot_get_id id_fn,
 		return NULL;
 	}
 
-	cache->entries = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0,
-		NUM_CACHE_BUCKETS, cache_entry_hash, NULL, cache_entry_cmp);
-	if (!cache->entries) {
-		ao2_cleanup(cache);
-		return NULL;
-	}
-
+	ast_rwlock_init(&cache->lock);
 	cache->id_fn = id_fn;
 	cache->aggregate_calc_fn = aggregate_calc_fn;
 	cache->aggregate_publish_fn = aggregate_publish_fn;
@@ -344,18 +491,48 @@ struct stasis_message *stasis_cache_entry_get_remote(struct stasis_cache_entry *
 
 /*!
  * \internal
- * \brief Find the cache entry in the cache entries container.
+ * \brief Find the link to a cache entry.
+ *
+ * \param cache The cache.
+ * \param key Key of the cache entry.
  *
- * \param entries Container of cached entries.
+ * \note Must be in a cache read section or hold the cache write lock.
+ *
+ * \return Link to the cache entry, or the empty link at the end of its
+ * hash chain if it is not in the cache.
+ */
+static struct stasis_cache_entry **cache_find_link(struct stasis_cache *cache,
+	const struct cache_entry_key *key)
+{
+	struct stasis_cache_entry **link = &cache->buckets[key->hash % NUM_CACHE_BUCKETS];
+	struct stasis_cache_entry *entry;
+
+	while ((entry = cache_load(*link))) {
+		if (entry->key.hash == key->hash && entry->key.type == key->type
+			&& !strcmp(entry->key.id, key->id)) {
+			break;
+		}
+		link = &entry->next;
+	}
+
+	return link;
+}
+
+/*!
+ * \internal
+ * \brief Find the cache entry in the cache.
+ *
+ * \param cache The cache.
  * \param type Type of message to retrieve the cache entry.
  * \param id Identity of the snapshot to retrieve the cache entry.
  *
- * \note The entries container is already locked.
+ * \note Must be in a cache read section or hold the cache write lock.
+ * \note The returned entry has not had its reference bumped.
  *
  * \retval Cache-entry on success.
  * \retval NULL Not in cache.
  */
-static struct stasis_cache_entry *cache_find(struct ao2_container *entries, struct stasis_message_type *type, const char *id)
+static struct stasis_cache_entry *cache_find(struct stasis_cache *cache, struct stasis_message_type *type, const char *id)
 {
 	struct cache_entry_key search_key;
 	struct stasis_cache_entry *entry;
@@ -363,7 +540,7 @@ static struct stasis_cache_entry *cache_find(struct ao2_container *entries, stru
 	search_key.type = type;
 	search_key.id = id;
 	cache_entry_compute_hash(&search_key);
-	entry = ao2_find(entries, &search_key, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	entry = cache_load(*cache_find_link(cache, &search_key));
 
 	/* Ensure that what we looked for is what we found. */
 	ast_assert(!entry
@@ -376,15 +553,12 @@ static struct stasis_cache_entry *cache_find(struct ao2_container *entries, stru
  * \internal
  * \brief Remove the stasis snapshot in the cache entry determined by eid.
  *
- * \param entries Container of cached entries.
  * \param cached_entry The entry to remove the snapshot from.
  * \param eid Which snapshot in the cached entry.
  *
- * \note The entries container is already locked.
- *
  * \return Previous stasis entry snapshot.
  */
-static struct stasis_message *cache_remove(struct ao2_container *entries, struct stasis_cache_entry *cached_entry, const struct ast_eid *eid)
+static struct stasis_message *cache_remove(struct stasis_cache_entry *cached_entry, const struct ast_eid *eid)
 {
 	struct stasis_message *old_snapshot;
 	int is_remote;
@@ -408,10 +582,6 @@ static struct stasis_message *cache_remove(struct ao2_container *entries, struct
 		}
 	}
 
-	if (!cached_entry->local && !AST_VECTOR_SIZE(&cached_entry->remote)) {
-		ao2_unlink_flags(entries, cached_entry, OBJ_NOLOCK);
-	}
-
 	return old_snapshot;
 }
 
@@ -468,35 +638,41 @@ static struct cache_put_snapshots cache_put(struct stasis_cache *cache,
 	struct stasis_message_type *type, const char *id, const struct ast_eid *eid,
 	struct stasis_message *new_snapshot)
 {
-	struct stasis_cache_entry *cached_entry;
+	struct cache_entry_key search_key;
+	struct stasis_cache_entry **link;
+	struct stasis_cache_entry *old_entry;
+	struct stasis_cache_entry *cached_entry = NULL;
 	struct cache_put_snapshots snapshots;
 
-	ast_assert(cache->entries != NULL);
 	ast_assert(eid != NULL);/* Aggregate snapshots not allowed to be put directly. */
 	ast_assert(new_snapshot == NULL ||
 		type == stasis_message_type(new_snapshot));
 
 	memset(&snapshots, 0, sizeof(snapshots));
 
-	ao2_wrlock(cache->entries);
+	ast_rwlock_wrlock(&cache->lock);
 
-	cached_entry = cache_find(cache->entries, type, id);
-
-	/* Update the eid snapshot. */
-	if (!new_snapshot) {
-		/* Remove snapshot from cache */
-		if (cached_entry) {
-			snapshots.old = cache_remove(cache->entries, cached_entry, eid);
+	search_key.type = type;
+	search_key.id = id;
+	cache_entry_compute_hash(&search_key);
+	link = cache_find_link(cache, &search_key);
+	old_entry = *link;
+
+	/* Update the eid snapshot in a copy, as readers may be using the entry. */
+	if (old_entry) {
+		cached_entry = cache_entry_dup(old_entry);
+		if (!cached_entry) {
+			/* Leave the cache alone */
+		} else if (!new_snapshot) {
+			/* Remove snapshot from cache */
+			snapshots.old = cache_remove(cached_entry, eid);
+		} else {
+			/* Update snapshot in cache */
+			snapshots.old = cache_udpate(cached_entry, eid, new_snapshot);
 		}
-	} else if (cached_entry) {
-		/* Update snapshot in cache */
-		snapshots.old = cache_udpate(cached_entry, eid, new_snapshot);
-	} else {
+	} else if (new_snapshot) {
 		/* Insert into the cache */
 		cached_entry = cache_entry_create(type, id, new_snapshot);
-		if (cached_entry) {
-			ao2_link_flags(cache->entries, cached_entry, OBJ_NOLOCK);
-		}
 	}
 
 	/* Update the aggregate snapshot. */
@@ -506,7 +682,25 @@ static struct cache_put_snapshots cache_put(struct stasis_cache *cache,
 		cached_entry->aggregate = ao2_bump(snapshots.aggregate_new);
 	}
 
-	ao2_unlock(cache->entries);
+	/* Publish the changed entry in place of the old one. */
+	if (!cached_entry) {
+		/* Nothing changed */
+	} else if (!cached_entry->local && !AST_VECTOR_SIZE(&cached_entry->remote)) {
+		if (old_entry) {
+			cache_store(*link, old_entry->next);
+			cache_retire(cache, old_entry);
+		}
+	} else {
+		cached_entry->next = old_entry ? old_entry->next : NULL;
+		cache_store(*link, ao2_bump(cached_entry));
+		if (old_entry) {
+			cache_retire(cache, old_entry);
+		}
+	}
+
+	cache_reclaim(cache);
+
+	ast_rwlock_unlock(&cache->lock);
 
 	ao2_cleanup(cached_entry);
 	return snapshots;
@@ -550,9 +744,9 @@ struct ao2_container *stasis_cache_get_all(struct stasis_cache *cache, struct st
 {
 	struct stasis_cache_entry *cached_entry;
 	struct ao2_container *found;
+	int token;
 
 	ast_assert(cache != NULL);
-	ast_assert(cache->entries != NULL);
 	ast_assert(id != NULL);
 
 	if (!type) {
@@ -564,17 +758,16 @@ struct ao2_container *stasis_cache_get_all(struct stasis_cache *cache, struct st
 		return NULL;
 	}
 
-	ao2_rdlock(cache->entries);
+	token = cache_read_begin(cache);
 
-	cached_entry = cache_find(cache->entries, type, id);
+	cached_entry = cache_find(cache, type, id);
 	if (cached_entry && cache_entry_dump(found, cached_entry)) {
 		ao2_cleanup(found);
 		found = NULL;
 	}
 
-	ao2_unlock(cache->entries);
+	cache_read_end(cache, token);
 
-	ao2_cleanup(cached_entry);
 	return found;
 }
 
@@ -622,26 +815,25 @@ struct stasis_message *stasis_cache_get_by_eid(struct stasis_cache *cache, struc
 {
 	struct stasis_cache_entry *cached_entry;
 	struct stasis_message *snapshot = NULL;
+	int token;
 
 	ast_assert(cache != NULL);
-	ast_assert(cache->entries != NULL);
 	ast_assert(id != NULL);
 
 	if (!type) {
 		return NULL;
 	}
 
-	ao2_rdlock(cache->entries);
+	token = cache_read_begin(cache);
 
-	cached_entry = cache_find(cache->entries, type, id);
+	cached_entry = cache_find(cache, type, id);
 	if (cached_entry) {
 		snapshot = cache_entry_by_eid(cached_entry, eid);
 		ao2_bump(snapshot);
 	}
 
-	ao2_unlock(cache->entries);
+	cache_read_end(cache, token);
 
-	ao2_cleanup(cached_entry);
 	return snapshot;
 }
 
@@ -656,6 +848,36 @@ struct cache_dump_data {
 	const struct ast_eid *eid;
 };
 
+/*!
+ * \internal
+ * \brief Call a callback for every entry in the cache.
+ *
+ * \param cache The cache.
+ * \param cb_fn Callback, stops the walk by returning CMP_STOP.
+ * \param cache_dump Passed to the callback.
+ *
+ * The cache is walked without locking out writers.  Every entry seen is
+ * complete, but entries changed during the walk may be seen either
+ * before or after the change.
+ */
+static void cache_dump_walk(struct stasis_cache *cache, ao2_callback_fn *cb_fn,
+	struct cache_dump_data *cache_dump)
+{
+	struct stasis_cache_entry *entry;
+	int token;
+	int idx;
+	int stop = 0;
+
+	token = cache_read_begin(cache);
+	for (idx = 0; !stop && idx < NUM_CACHE_BUCKETS; ++idx) {
+		for (entry = cache_load(cache->buckets[idx]); !stop && entry;
+			entry = cache_load(entry->next)) {
+			stop = cb_fn(entry, cache_dump, 0) & CMP_STOP;
+		}
+	}
+	cache_read_end(cache, token);
+}
+
 static int cache_dump_by_eid_cb(void *obj, void *arg, int flags)
 {
 	struct cache_dump_data *cache_dump = arg;
@@ -682,7 +904,6 @@ struct ao2_container *stasis_cache_dump_by_eid(struct stasis_cache *cache, struc
 	struct cache_dump_data cache_dump;
 
 	ast_assert(cache != NULL);
-	ast_assert(cache->entries != NULL);
 
 	cache_dump.eid = eid;
 	cache_dump.type = type;
@@ -691,7 +912,7 @@ struct ao2_container *stasis_cache_dump_by_eid(struct stasis_cache *cache, struc
 		return NULL;
 	}
 
-	ao2_callback(cache->entries, OBJ_MULTIPLE | OBJ_NODATA, cache_dump_by_eid_cb, &cache_dump);
+	cache_dump_walk(cache, cache_dump_by_eid_cb, &cache_dump);
 	return cache_dump.container;
 }
 
@@ -721,7 +942,6 @@ struct ao2_container *stasis_cache_dump_all(struct stasis_cache *cache, struct s
 	struct cache_dump_data cache_dump;
 
 	ast_assert(cache != NULL);
-	ast_assert(cache->entries != NULL);
 
 	cache_dump.eid = NULL;
 	cache_dump.type = type;
@@ -730,7 +950,7 @@ struct ao2_container *stasis_cache_dump_all(struct stasis_cache *cache, struct s
 		return NULL;
 	}
 
-	ao2_callback(cache->entries, OBJ_MULTIPLE | OBJ_NODATA, cache_dump_all_cb, &cache_dump);
+	cache_dump_walk(cache, cache_dump_all_cb, &cache_dump);
 	return cache_dump.container;
 }
 
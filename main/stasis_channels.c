@@ -122,12 +122,19 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 static struct stasis_cp_all *channel_cache_all;
 static struct stasis_cache *channel_cache_by_name;
 static struct stasis_caching_topic *channel_by_name_topic;
+/*! Topics shared by the channels that have none of their own */
+static struct stasis_cp_single *channel_topics_shared;
 
 struct stasis_cp_all *ast_channel_cache_all(void)
 {
 	return channel_cache_all;
 }
 
+struct stasis_cp_single *ast_channel_topics_shared(void)
+{
+	return channel_topics_shared;
+}
+
 struct stasis_cache *ast_channel_cache(void)
 {
 	return stasis_cp_all_cache(channel_cache_all);
@@ -191,74 +198,217 @@ static int channel_snapshot_cmp_cb(void *obj, void *arg, int flags)
 	return strcasecmp(left->name, match) ? 0 : (CMP_MATCH | CMP_STOP);
 }
 
+/*! \brief The groups of strings in a snapshot that are copied together */
+enum snapshot_segment_type {
+	SNAPSHOT_SEGMENT_BASE,
+	SNAPSHOT_SEGMENT_DIALPLAN,
+	SNAPSHOT_SEGMENT_CALLER,
+	SNAPSHOT_SEGMENT_CONNECTED,
+	SNAPSHOT_SEGMENT_BRIDGE,
+	SNAPSHOT_SEGMENT_HANGUP,
+	SNAPSHOT_SEGMENT_MAX,
+};
+
+/*! \brief Most strings held by a single segment */
+#define SNAPSHOT_SEGMENT_MAX_FIELDS 8
+
+#define SNAPSHOT_FIELD(field) offsetof(struct ast_channel_snapshot, field)
+
+/*! \brief Access the string at \a offset of a snapshot */
+#define SNAPSHOT_STRING(snapshot, offset) \
+	(*(const char **) ((char *) (snapshot) + (offset)))
+
+/*! \brief The snapshot strings held by each segment */
+static const struct {
+	size_t count;
+	size_t offsets[SNAPSHOT_SEGMENT_MAX_FIELDS];
+} snapshot_segments[SNAPSHOT_SEGMENT_MAX] = {
+	[SNAPSHOT_SEGMENT_BASE] = { 8, {
+		SNAPSHOT_FIELD(name), SNAPSHOT_FIELD(uniqueid), SNAPSHOT_FIELD(linkedid),
+		SNAPSHOT_FIELD(type), SNAPSHOT_FIELD(accountcode), SNAPSHOT_FIELD(peeraccount),
+		SNAPSHOT_FIELD(userfield), SNAPSHOT_FIELD(language), } },
+	[SNAPSHOT_SEGMENT_DIALPLAN] = { 4, {
+		SNAPSHOT_FIELD(appl), SNAPSHOT_FIELD(data), SNAPSHOT_FIELD(context),
+		SNAPSHOT_FIELD(exten), } },
+	[SNAPSHOT_SEGMENT_CALLER] = { 7, {
+		SNAPSHOT_FIELD(caller_name), SNAPSHOT_FIELD(caller_number),
+		SNAPSHOT_FIELD(caller_dnid), SNAPSHOT_FIELD(caller_ani),
+		SNAPSHOT_FIELD(caller_rdnis), SNAPSHOT_FIELD(caller_subaddr),
+		SNAPSHOT_FIELD(dialed_subaddr), } },
+	[SNAPSHOT_SEGMENT_CONNECTED] = { 2, {
+		SNAPSHOT_FIELD(connected_name), SNAPSHOT_FIELD(connected_number), } },
+	[SNAPSHOT_SEGMENT_BRIDGE] = { 1, {
+		SNAPSHOT_FIELD(bridgeid), } },
+	[SNAPSHOT_SEGMENT_HANGUP] = { 1, {
+		SNAPSHOT_FIELD(hangupsource), } },
+};
+
+/*!
+ * \internal
+ * \brief A channel snapshot along with the segments holding its strings
+ *
+ * Segments are immutable ao2 objects containing nothing but the strings,
+ * so they can be shared between any number of snapshots.
+ */
+struct channel_snapshot_private {
+	/*! The public snapshot.  This must be first. */
+	struct ast_channel_snapshot snapshot;
+	/*! The segments the snapshot's strings point into */
+	char *segments[SNAPSHOT_SEGMENT_MAX];
+};
+
 static void channel_snapshot_dtor(void *obj)
 {
-	struct ast_channel_snapshot *snapshot = obj;
+	struct channel_snapshot_private *priv = obj;
+	int i;
 
-	ast_string_field_free_memory(snapshot);
-	ao2_cleanup(snapshot->manager_vars);
+	for (i = 0; i < SNAPSHOT_SEGMENT_MAX; ++i) {
+		ao2_cleanup(priv->segments[i]);
+	}
+	ao2_cleanup(priv->snapshot.manager_vars);
+}
+
+/*!
+ * \internal
+ * \brief Determine whether a segment of \a last holds the values in \a current
+ */
+static int snapshot_segment_matches(enum snapshot_segment_type type,
+	const struct ast_channel_snapshot *last, const struct ast_channel_snapshot *current)
+{
+	size_t i;
+
+	for (i = 0; i < snapshot_segments[type].count; ++i) {
+		size_t offset = snapshot_segments[type].offsets[i];
+
+		if (strcmp(SNAPSHOT_STRING(last, offset), SNAPSHOT_STRING(current, offset))) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*!
+ * \internal
+ * \brief Fill in a segment of a snapshot
+ *
+ * If the last snapshot of the channel has the same values in this segment
+ * it is shared, otherwise the values from \a current are copied into a new
+ * segment.
+ *
+ * \retval 0 on success
+ * \retval -1 on allocation failure
+ */
+static int snapshot_segment_set(struct channel_snapshot_private *priv,
+	enum snapshot_segment_type type, const struct channel_snapshot_private *last,
+	const struct ast_channel_snapshot *current)
+{
+	const struct ast_channel_snapshot *source;
+	size_t len = 0;
+	size_t offset;
+	size_t i;
+	char *buf;
+
+	if (last && snapshot_segment_matches(type, &last->snapshot, current)) {
+		priv->segments[type] = ao2_bump(last->segments[type]);
+		source = &last->snapshot;
+		for (i = 0; i < snapshot_segments[type].count; ++i) {
+			offset = snapshot_segments[type].offsets[i];
+			SNAPSHOT_STRING(&priv->snapshot, offset) = SNAPSHOT_STRING(source, offset);
+		}
+		return 0;
+	}
+
+	for (i = 0; i < snapshot_segments[type].count; ++i) {
+		len += strlen(SNAPSHOT_STRING(current, snapshot_segments[type].offsets[i])) + 1;
+	}
+
+	buf = ao2_alloc_options(len, NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!buf) {
+		return -1;
+	}
+	priv->segments[type] = buf;
+
+	for (i = 0; i < snapshot_segments[type].count; ++i) {
+		offset = snapshot_segments[type].offsets[i];
+		len = strlen(SNAPSHOT_STRING(current, offset)) + 1;
+		memcpy(buf, SNAPSHOT_STRING(current, offset), len);
+		SNAPSHOT_STRING(&priv->snapshot, offset) = buf;
+		buf += len;
+	}
+
+	return 0;
 }
 
 struct ast_channel_snapshot *ast_channel_snapshot_create(struct ast_channel *chan)
 {
+	struct channel_snapshot_private *priv;
+	struct channel_snapshot_private *last;
 	struct ast_channel_snapshot *snapshot;
+	struct ast_channel_snapshot current;
 	struct ast_bridge *bridge;
+	int i;
 
 	/* no snapshots for dummy channels */
 	if (!ast_channel_tech(chan)) {
 		return NULL;
 	}
 
-	snapshot = ao2_alloc_options(sizeof(*snapshot), channel_snapshot_dtor,
+	priv = ao2_alloc_options(sizeof(*priv), channel_snapshot_dtor,
 		AO2_ALLOC_OPT_LOCK_NOLOCK);
-	if (!snapshot || ast_string_field_init(snapshot, 1024)) {
-		ao2_cleanup(snapshot);
+	if (!priv) {
 		return NULL;
 	}
-
-	ast_string_field_set(snapshot, name, ast_channel_name(chan));
-	ast_string_field_set(snapshot, type, ast_channel_tech(chan)->type);
-	ast_string_field_set(snapshot, accountcode, ast_channel_accountcode(chan));
-	ast_string_field_set(snapshot, peeraccount, ast_channel_peeraccount(chan));
-	ast_string_field_set(snapshot, userfield, ast_channel_userfield(chan));
-	ast_string_field_set(snapshot, uniqueid, ast_channel_uniqueid(chan));
-	ast_string_field_set(snapshot, linkedid, ast_channel_linkedid(chan));
-	ast_string_field_set(snapshot, hangupsource, ast_channel_hangupsource(chan));
-	if (ast_channel_appl(chan)) {
-		ast_string_field_set(snapshot, appl, ast_channel_appl(chan));
-	}
-	if (ast_channel_data(chan)) {
-		ast_string_field_set(snapshot, data, ast_channel_data(chan));
-	}
-	ast_string_field_set(snapshot, context, ast_channel_context(chan));
-	ast_string_field_set(snapshot, exten, ast_channel_exten(chan));
-
-	ast_string_field_set(snapshot, caller_name,
-		S_COR(ast_channel_caller(chan)->id.name.valid, ast_channel_caller(chan)->id.name.str, ""));
-	ast_string_field_set(snapshot, caller_number,
-		S_COR(ast_channel_caller(chan)->id.number.valid, ast_channel_caller(chan)->id.number.str, ""));
-	ast_string_field_set(snapshot, caller_dnid, S_OR(ast_channel_dialed(chan)->number.str, ""));
-	ast_string_field_set(snapshot, caller_subaddr,
-		S_COR(ast_channel_caller(chan)->id.subaddress.valid, ast_channel_caller(chan)->id.subaddress.str, ""));
-	ast_string_field_set(snapshot, dialed_subaddr,
-		S_COR(ast_channel_dialed(chan)->subaddress.valid, ast_channel_dialed(chan)->subaddress.str, ""));
-	ast_string_field_set(snapshot, caller_ani,
-		S_COR(ast_channel_caller(chan)->ani.number.valid, ast_channel_caller(chan)->ani.number.str, ""));
-	ast_string_field_set(snapshot, caller_rdnis,
-		S_COR(ast_channel_redirecting(chan)->from.number.valid, ast_channel_redirecting(chan)->from.number.str, ""));
-	ast_string_field_set(snapshot, caller_dnid,
-		S_OR(ast_channel_dialed(chan)->number.str, ""));
-
-	ast_string_field_set(snapshot, connected_name,
-		S_COR(ast_channel_connected(chan)->id.name.valid, ast_channel_connected(chan)->id.name.str, ""));
-	ast_string_field_set(snapshot, connected_number,
-		S_COR(ast_channel_connected(chan)->id.number.valid, ast_channel_connected(chan)->id.number.str, ""));
-	ast_string_field_set(snapshot, language, ast_channel_language(chan));
-
-	if ((bridge = ast_channel_get_bridge(chan))) {
-		ast_string_field_set(snapshot, bridgeid, bridge->uniqueid);
-		ao2_cleanup(bridge);
+	snapshot = &priv->snapshot;
+
+	/* Gather the current values without copying them, so that only the
+	 * segments that have changed since the last snapshot need copying. */
+	current.name = S_OR(ast_channel_name(chan), "");
+	current.type = S_OR(ast_channel_tech(chan)->type, "");
+	current.accountcode = S_OR(ast_channel_accountcode(chan), "");
+	current.peeraccount = S_OR(ast_channel_peeraccount(chan), "");
+	current.userfield = S_OR(ast_channel_userfield(chan), "");
+	current.uniqueid = S_OR(ast_channel_uniqueid(chan), "");
+	current.linkedid = S_OR(ast_channel_linkedid(chan), "");
+	current.language = S_OR(ast_channel_language(chan), "");
+	current.hangupsource = S_OR(ast_channel_hangupsource(chan), "");
+	current.appl = S_OR(ast_channel_appl(chan), "");
+	current.data = S_OR(ast_channel_data(chan), "");
+	current.context = S_OR(ast_channel_context(chan), "");
+	current.exten = S_OR(ast_channel_exten(chan), "");
+
+	current.caller_name =
+		S_COR(ast_channel_caller(chan)->id.name.valid, ast_channel_caller(chan)->id.name.str, "");
+	current.caller_number =
+		S_COR(ast_channel_caller(chan)->id.number.valid, ast_channel_caller(chan)->id.number.str, "");
+	current.caller_subaddr =
+		S_COR(ast_channel_caller(chan)->id.subaddress.valid, ast_channel_caller(chan)->id.subaddress.str, "");
+	current.dialed_subaddr =
+		S_COR(ast_channel_dialed(chan)->subaddress.valid, ast_channel_dialed(chan)->subaddress.str, "");
+	current.caller_ani =
+		S_COR(ast_channel_caller(chan)->ani.number.valid, ast_channel_caller(chan)->ani.number.str, "");
+	current.caller_rdnis =
+		S_COR(ast_channel_redirecting(chan)->from.number.valid, ast_channel_redirecting(chan)->from.number.str, "");
+	current.caller_dnid = S_OR(ast_channel_dialed(chan)->number.str, "");
+
+	current.connected_name =
+		S_COR(ast_channel_connected(chan)->id.name.valid, ast_channel_connected(chan)->id.name.str, "");
+	current.connected_number =
+		S_COR(ast_channel_connected(chan)->id.number.valid, ast_channel_connected(chan)->id.number.str, "");
+
+	/* The bridge is held until its uniqueid has been copied */
+	bridge = ast_channel_get_bridge(chan);
+	current.bridgeid = bridge ? bridge->uniqueid : "";
+
+	last = (struct channel_snapshot_private *) ast_channel_internal_snapshot(chan);
+	for (i = 0; i < SNAPSHOT_SEGMENT_MAX; ++i) {
+		if (snapshot_segment_set(priv, i, last, &current)) {
+			ao2_cleanup(bridge);
+			ao2_ref(priv, -1);
+			return NULL;
+		}
 	}
+	ao2_cleanup(bridge);
 
 	snapshot->creationtime = ast_channel_creationtime(chan);
 	snapshot->state = ast_channel_state(chan);
@@ -272,13 +422,15 @@ struct ast_channel_snapshot *ast_channel_snapshot_create(struct ast_channel *cha
 	snapshot->manager_vars = ast_channel_get_manager_vars(chan);
 	snapshot->tech_properties = ast_channel_tech(chan)->properties;
 
+	ast_channel_internal_snapshot_set(chan, snapshot);
+
 	return snapshot;
 }
 
 static void publish_message_for_channel_topics(struct stasis_message *message, struct ast_channel *chan)
 {
 	if (chan) {
-		stasis_publish(ast_channel_topic(chan), message);
+		stasis_publish(ast_channel_topic_for_publish(chan), message);
 	} else {
 		stasis_publish(ast_channel_topic_all(), message);
 	}
@@ -723,8 +875,8 @@ void ast_channel_publish_snapshot(struct ast_channel *chan)
 		return;
 	}
 
-	ast_assert(ast_channel_topic(chan) != NULL);
-	stasis_publish(ast_channel_topic(chan), message);
+	ast_assert(ast_channel_topic_for_publish(chan) != NULL);
+	stasis_publish(ast_channel_topic_for_publish(chan), message);
 }
 
 void ast_channel_publish_cached_blob(struct ast_channel *chan, struct stasis_message_type *type, struct ast_json *blob)
@@ -737,7 +889,7 @@ void ast_channel_publish_cached_blob(struct ast_channel *chan, struct stasis_mes
 
 	message = ast_channel_blob_create_from_cache(ast_channel_uniqueid(chan), type, blob);
 	if (message) {
-		stasis_publish(ast_channel_topic(chan), message);
+		stasis_publish(ast_channel_topic_for_publish(chan), message);
 	}
 	ao2_cleanup(message);
 }
@@ -752,7 +904,7 @@ void ast_channel_publish_blob(struct ast_channel *chan, struct stasis_message_ty
 
 	message = ast_channel_blob_create(chan, type, blob);
 	if (message) {
-		stasis_publish(ast_channel_topic(chan), message);
+		stasis_publish(ast_channel_topic_for_publish(chan), message);
 	}
 	ao2_cleanup(message);
 }
@@ -881,8 +1033,8 @@ void ast_publish_channel_state(struct ast_channel *chan)
 		return;
 	}
 
-	ast_assert(ast_channel_topic(chan) != NULL);
-	stasis_publish(ast_channel_topic(chan), message);
+	ast_assert(ast_channel_topic_for_publish(chan) != NULL);
+	stasis_publish(ast_channel_topic_for_publish(chan), message);
 }
 
 struct ast_json *ast_channel_snapshot_to_json(
@@ -921,6 +1073,41 @@ struct ast_json *ast_channel_snapshot_to_json(
 	return ast_json_ref(json_chan);
 }
 
+int ast_channel_snapshot_write_json(const struct ast_channel_snapshot *snapshot,
+	const struct stasis_message_sanitizer *sanitize, struct ast_json_writer *writer)
+{
+	if (snapshot == NULL
+		|| (sanitize && sanitize->channel_snapshot
+		&& sanitize->channel_snapshot(snapshot))) {
+		return ast_json_writer_null(writer);
+	}
+
+	/* Keep in sync with ast_channel_snapshot_to_json() */
+	ast_json_writer_object_start(writer);
+	ast_json_writer_key(writer, "id");
+	ast_json_writer_string(writer, snapshot->uniqueid);
+	ast_json_writer_key(writer, "name");
+	ast_json_writer_string(writer, snapshot->name);
+	ast_json_writer_key(writer, "state");
+	ast_json_writer_string(writer, ast_state2str(snapshot->state));
+	ast_json_writer_key(writer, "caller");
+	ast_json_writer_name_number(writer,
+		snapshot->caller_name, snapshot->caller_number);
+	ast_json_writer_key(writer, "connected");
+	ast_json_writer_name_number(writer,
+		snapshot->connected_name, snapshot->connected_number);
+	ast_json_writer_key(writer, "accountcode");
+	ast_json_writer_string(writer, snapshot->accountcode);
+	ast_json_writer_key(writer, "dialplan");
+	ast_json_writer_dialplan_cep(writer,
+		snapshot->context, snapshot->exten, snapshot->priority);
+	ast_json_writer_key(writer, "creationtime");
+	ast_json_writer_timeval(writer, snapshot->creationtime, NULL);
+	ast_json_writer_key(writer, "language");
+	ast_json_writer_string(writer, snapshot->language);
+	return ast_json_writer_object_end(writer);
+}
+
 int ast_channel_snapshot_cep_equal(
 	const struct ast_channel_snapshot *old_snapshot,
 	const struct ast_channel_snapshot *new_snapshot)
@@ -1249,6 +1436,8 @@ STASIS_MESSAGE_TYPE_DEFN(ast_channel_talking_stop,
 
 static void stasis_channels_cleanup(void)
 {
+	stasis_cp_single_unsubscribe(channel_topics_shared);
+	channel_topics_shared = NULL;
 	stasis_caching_unsubscribe_and_join(channel_by_name_topic);
 	channel_by_name_topic = NULL;
 	ao2_cleanup(channel_cache_by_name);
@@ -1307,6 +1496,12 @@ int ast_stasis_channels_init(void)
 		return -1;
 	}
 
+	channel_topics_shared = stasis_cp_single_create(channel_cache_all,
+		"ast_channel_topic_shared");
+	if (!channel_topics_shared) {
+		return -1;
+	}
+
 	res |= STASIS_MESSAGE_TYPE_INIT(ast_channel_dial_type);
 	res |= STASIS_MESSAGE_TYPE_INIT(ast_channel_varset_type);
 	res |= STASIS_MESSAGE_TYPE_INIT(ast_channel_hangup_request_type);
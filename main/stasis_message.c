@@ -39,8 +39,12 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 struct stasis_message_type {
 	struct stasis_message_vtable *vtable;
 	char *name;
+	int id;
 };
 
+/*! The identifier given to the next message type created */
+static int message_type_id;
+
 static struct stasis_message_vtable null_vtable = {};
 
 static void message_type_dtor(void *obj)
@@ -76,6 +80,7 @@ int stasis_message_type_create(const char *name,
 		return STASIS_MESSAGE_TYPE_ERROR;
 	}
 	type->vtable = vtable;
+	type->id = ast_atomic_fetchadd_int(&message_type_id, +1);
 	*result = type;
 
 	return STASIS_MESSAGE_TYPE_SUCCESS;
@@ -86,6 +91,11 @@ const char *stasis_message_type_name(const struct stasis_message_type *type)
 	return type->name;
 }
 
+int stasis_message_type_id(const struct stasis_message_type *type)
+{
+	return type->id;
+}
+
 /*! \internal */
 struct stasis_message {
 	/*! Time the message was created */
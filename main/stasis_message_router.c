@@ -45,40 +45,33 @@ struct stasis_message_route {
 	void *data;
 };
 
+/*!
+ * \brief Routes indexed by the id of their message type
+ *
+ * Message type ids are small and handed out in order, so looking up the
+ * route of a message is a bounds check and an array access.  Slots without
+ * a route have a NULL message_type.
+ */
 AST_VECTOR(route_table, struct stasis_message_route);
 
 static struct stasis_message_route *route_table_find(struct route_table *table,
 	struct stasis_message_type *message_type)
 {
-	size_t idx;
 	struct stasis_message_route *route;
+	int id;
 
-	/* While a linear search for routes may seem very inefficient, most
-	 * route tables have six routes or less. For such small data, it's
-	 * hard to beat a linear search. If we start having larger route
-	 * tables, then we can look into containers with more efficient
-	 * lookups.
-	 */
-	for (idx = 0; idx < AST_VECTOR_SIZE(table); ++idx) {
-		route = AST_VECTOR_GET_ADDR(table, idx);
-		if (route->message_type == message_type) {
-			return route;
-		}
+	if (!message_type) {
+		return NULL;
 	}
 
-	return NULL;
-}
+	id = stasis_message_type_id(message_type);
+	if (id < 0 || id >= AST_VECTOR_SIZE(table)) {
+		return NULL;
+	}
 
-/*!
- * \brief route_table comparator for AST_VECTOR_REMOVE_CMP_UNORDERED()
- *
- * \param elem Element to compare against
- * \param value Value to compare with the vector element.
- *
- * \return 0 if element does not match.
- * \return Non-zero if element matches.
- */
-#define ROUTE_TABLE_ELEM_CMP(elem, value) ((elem).message_type == (value))
+	route = AST_VECTOR_GET_ADDR(table, id);
+	return route->message_type == message_type ? route : NULL;
+}
 
 /*!
  * \brief route_table vector element cleanup.
@@ -92,8 +85,15 @@ static struct stasis_message_route *route_table_find(struct route_table *table,
 static int route_table_remove(struct route_table *table,
 	struct stasis_message_type *message_type)
 {
-	return AST_VECTOR_REMOVE_CMP_UNORDERED(table, message_type, ROUTE_TABLE_ELEM_CMP,
-		ROUTE_TABLE_ELEM_CLEANUP);
+	struct stasis_message_route *route = route_table_find(table, message_type);
+
+	if (!route) {
+		return -1;
+	}
+
+	ROUTE_TABLE_ELEM_CLEANUP(*route);
+	memset(route, 0, sizeof(*route));
+	return 0;
 }
 
 static int route_table_add(struct route_table *table,
@@ -101,16 +101,21 @@ static int route_table_add(struct route_table *table,
 	stasis_subscription_cb callback, void *data)
 {
 	struct stasis_message_route route;
+	int id = stasis_message_type_id(message_type);
 	int res;
 
 	ast_assert(callback != NULL);
 	ast_assert(route_table_find(table, message_type) == NULL);
 
+	if (id < 0) {
+		return -1;
+	}
+
 	route.message_type = ao2_bump(message_type);
 	route.callback = callback;
 	route.data = data;
 
-	res = AST_VECTOR_APPEND(table, route);
+	res = AST_VECTOR_REPLACE(table, id, route);
 	if (res) {
 		ROUTE_TABLE_ELEM_CLEANUP(route);
 	}
@@ -315,6 +320,11 @@ int stasis_message_router_add(struct stasis_message_router *router,
 	}
 	ao2_lock(router);
 	res = route_table_add(&router->routes, message_type, callback, data);
+	if (!res) {
+		/* Let the topic drop messages nothing is routed for */
+		stasis_subscription_accept_message_type(router->subscription, message_type);
+		stasis_subscription_set_filter(router->subscription, STASIS_SUBSCRIPTION_FILTER_SELECTIVE);
+	}
 	ao2_unlock(router);
 	return res;
 }
@@ -333,6 +343,10 @@ int stasis_message_router_add_cache_update(struct stasis_message_router *router,
 	}
 	ao2_lock(router);
 	res = route_table_add(&router->cache_routes, message_type, callback, data);
+	if (!res) {
+		stasis_subscription_accept_message_type(router->subscription, stasis_cache_update_type());
+		stasis_subscription_set_filter(router->subscription, STASIS_SUBSCRIPTION_FILTER_SELECTIVE);
+	}
 	ao2_unlock(router);
 	return res;
 }
@@ -377,6 +391,10 @@ int stasis_message_router_set_default(struct stasis_message_router *router,
 	router->default_route.callback = callback;
 	router->default_route.data = data;
 	ao2_unlock(router);
+
+	/* Every message may be routed now, so filtering is out */
+	stasis_subscription_set_filter(router->subscription, STASIS_SUBSCRIPTION_FILTER_FORCED_NONE);
+
 	/* While this implementation can never fail, it used to be able to */
 	return 0;
 }
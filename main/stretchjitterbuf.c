@@ -0,0 +1,822 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Time-stretching jitterbuffer.
+ *
+ * The playout delay follows the jitter seen on the incoming frames.  For
+ * signed linear and G.711 audio the delay is changed by time-stretching:
+ * a pitch period is removed from, or repeated in, the decoded audio
+ * (WSOLA), using the lag at which the waveform best matches itself.
+ * Other formats fall back to dropping frames to catch up and to
+ * interpolation when frames are missing.
+ */
+
+/*** MODULEINFO
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/utils.h"
+#include "asterisk/frame.h"
+#include "asterisk/format_cache.h"
+#include "asterisk/g711.h"
+#include "asterisk/abstract_jb.h"
+#include "stretchjitterbuf.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define STRETCH_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+/*! Number of frames the jitter is measured over */
+#define STRETCH_JB_HISTORY 64
+/*! Correlation window, in ms */
+#define STRETCH_WINDOW_MS 5
+/*! Shortest pitch period searched for, in tenths of a ms */
+#define STRETCH_MIN_LAG_TMS 25
+/*! Longest pitch period searched for, in ms */
+#define STRETCH_MAX_LAG_MS 12
+/*! Longest correlation window, at 48kHz */
+#define STRETCH_MAX_WINDOW (48 * STRETCH_WINDOW_MS)
+/*!
+ * Samples are scaled down by this many bits before being correlated so
+ * that the 32 bit sums of the SIMD version can not overflow.
+ */
+#define STRETCH_CORR_SHIFT 4
+/*! Scaled energy per sample below which audio is treated as silence */
+#define STRETCH_QUIET_ENERGY 64
+
+struct stretch_jb_frame
+{
+	struct ast_frame *frame;
+	long ts;
+	long ms;
+	struct stretch_jb_frame *next;
+};
+
+/*! \brief private stretch_jb structure */
+struct stretch_jb
+{
+	struct stretch_jb_conf conf;
+	/*! Queued frames, ordered by timestamp */
+	struct stretch_jb_frame *frames;
+
+	/*! Format of the audio played out */
+	struct ast_format *format;
+	/*! Sample rate of the audio played out */
+	unsigned int rate;
+	/*! Correlation window and pitch period search range, in samples */
+	int window;
+	int min_lag;
+	int max_lag;
+
+	/*! Decoded audio that has been taken from the queue but not played out */
+	int16_t *pcm;
+	size_t pcm_len;
+	size_t pcm_size;
+	/*! Buffer the audio played out is encoded into */
+	unsigned char *out;
+	size_t out_size;
+
+	/*! Media time, in samples, of the end of the audio taken from the queue */
+	long media_end;
+	/*! Time the next frame should be played out */
+	long next_delivery;
+	/*! Sequence number of the last frame taken from the queue */
+	int seqno;
+
+	/*! Recent transit times (arrival minus timestamp), in ms */
+	long transit[STRETCH_JB_HISTORY];
+	unsigned int transit_count;
+	unsigned int transit_pos;
+	long min_transit;
+
+	struct ast_jb_stats stats;
+	int started;
+	int force_resynch;
+};
+
+static long stretch_ms_to_samples(const struct stretch_jb *jb, long ms)
+{
+	return ms * (long) jb->rate / 1000;
+}
+
+static long stretch_samples_to_ms(const struct stretch_jb *jb, long samples)
+{
+	return samples * 1000 / (long) jb->rate;
+}
+
+/*! \brief Media time, in ms, of the audio to be played out next */
+static long stretch_play_ms(const struct stretch_jb *jb)
+{
+	return stretch_samples_to_ms(jb, jb->media_end - (long) jb->pcm_len);
+}
+
+/*! \brief How long audio with the given timestamp has been waiting beyond the quickest transit */
+static long stretch_delay(const struct stretch_jb *jb, long ts, long now)
+{
+	return now - ts - jb->min_transit;
+}
+
+static int stretch_format_supported(struct ast_format *format)
+{
+	return ast_format_cmp(format, ast_format_ulaw) == AST_FORMAT_CMP_EQUAL
+		|| ast_format_cmp(format, ast_format_alaw) == AST_FORMAT_CMP_EQUAL
+		|| ast_format_cache_is_slinear(format);
+}
+
+/*! \brief Switch to the format of a frame, keeping the media time */
+static void stretch_set_format(struct stretch_jb *jb, struct ast_format *format)
+{
+	unsigned int rate;
+
+	if (jb->format && ast_format_cmp(jb->format, format) == AST_FORMAT_CMP_EQUAL) {
+		return;
+	}
+
+	rate = ast_format_get_sample_rate(format);
+	if (!rate) {
+		rate = 8000;
+	}
+	if (jb->rate) {
+		jb->media_end = jb->media_end / (long) jb->rate * rate
+			+ jb->media_end % (long) jb->rate * rate / jb->rate;
+	}
+
+	ao2_replace(jb->format, format);
+	jb->rate = rate;
+	jb->window = rate * STRETCH_WINDOW_MS / 1000;
+	jb->min_lag = rate * STRETCH_MIN_LAG_TMS / 10000;
+	jb->max_lag = rate * STRETCH_MAX_LAG_MS / 1000;
+	if (jb->window > STRETCH_MAX_WINDOW) {
+		jb->window = STRETCH_MAX_WINDOW;
+	}
+}
+
+/*! \brief Check if a frame can be time-stretched along with the audio already decoded */
+static int stretch_frame_compatible(struct stretch_jb *jb, struct ast_frame *frame)
+{
+	if (!frame->datalen || !stretch_format_supported(frame->subclass.format)) {
+		return 0;
+	}
+
+	return !jb->pcm_len || ast_format_cmp(jb->format, frame->subclass.format) == AST_FORMAT_CMP_EQUAL;
+}
+
+static void stretch_record_transit(struct stretch_jb *jb, long transit)
+{
+	unsigned int i;
+
+	jb->transit[jb->transit_pos] = transit;
+	jb->transit_pos = (jb->transit_pos + 1) % STRETCH_JB_HISTORY;
+	if (jb->transit_count < STRETCH_JB_HISTORY) {
+		++jb->transit_count;
+	}
+
+	jb->min_transit = jb->stats.jitter = transit;
+	for (i = 0; i < jb->transit_count; ++i) {
+		if (jb->transit[i] < jb->min_transit) {
+			jb->min_transit = jb->transit[i];
+		}
+		if (jb->transit[i] > jb->stats.jitter) {
+			jb->stats.jitter = jb->transit[i];
+		}
+	}
+	/* stats.jitter held the highest transit */
+	jb->stats.jitter -= jb->min_transit;
+}
+
+/*! \brief The delay aimed for, in ms */
+static long stretch_target(struct stretch_jb *jb, long interpl, int stretching)
+{
+	long target = jb->stats.jitter + MAX(jb->conf.target_extra, 0);
+	long lookahead;
+
+	/* Stretching needs enough audio decoded to search for a pitch period */
+	if (stretching) {
+		lookahead = interpl + stretch_samples_to_ms(jb, jb->max_lag + jb->window);
+		target = MAX(target, lookahead);
+	}
+	if (jb->conf.max_size > 0) {
+		target = MIN(target, jb->conf.max_size);
+	}
+
+	return target;
+}
+
+static void stretch_count_lost(struct stretch_jb *jb, int seqno)
+{
+	unsigned short missing = seqno - jb->seqno - 1;
+
+	/* A big jump means the sender does not number its frames */
+	if (missing && missing < 100) {
+		jb->stats.frames_lost += missing;
+	}
+}
+
+static struct stretch_jb_frame *stretch_pop(struct stretch_jb *jb)
+{
+	struct stretch_jb_frame *head = jb->frames;
+
+	if (head) {
+		jb->frames = head->next;
+	}
+	return head;
+}
+
+static void stretch_flush(struct stretch_jb *jb)
+{
+	struct stretch_jb_frame *head;
+
+	while ((head = stretch_pop(jb))) {
+		ast_frfree(head->frame);
+		ast_free(head);
+	}
+	jb->pcm_len = 0;
+}
+
+/*! \brief Dispose of queued frames that have already been played out */
+static void stretch_drop_stale(struct stretch_jb *jb)
+{
+	struct stretch_jb_frame *head;
+	long play_ms = stretch_play_ms(jb);
+
+	while (jb->frames && jb->frames->ts + jb->frames->ms <= play_ms) {
+		head = stretch_pop(jb);
+		++jb->stats.frames_late;
+		ast_frfree(head->frame);
+		ast_free(head);
+	}
+}
+
+#ifdef STRETCH_HAVE_SSE2
+static int64_t stretch_dot(const int16_t *a, const int16_t *b, int samples)
+{
+	int64_t sum = 0;
+	int32_t lanes[4];
+	__m128i acc = _mm_setzero_si128();
+	int blocks = 0;
+	int i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i va = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) (a + i)), STRETCH_CORR_SHIFT);
+		__m128i vb = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) (b + i)), STRETCH_CORR_SHIFT);
+
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+		if (++blocks == 128) {
+			_mm_storeu_si128((__m128i *) lanes, acc);
+			sum += (int64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+			acc = _mm_setzero_si128();
+			blocks = 0;
+		}
+	}
+	_mm_storeu_si128((__m128i *) lanes, acc);
+	sum += (int64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+	for (; i < samples; ++i) {
+		sum += (a[i] >> STRETCH_CORR_SHIFT) * (b[i] >> STRETCH_CORR_SHIFT);
+	}
+
+	return sum;
+}
+#else
+static int64_t stretch_dot(const int16_t *a, const int16_t *b, int samples)
+{
+	int64_t sum = 0;
+	int i;
+
+	for (i = 0; i < samples; ++i) {
+		sum += (a[i] >> STRETCH_CORR_SHIFT) * (b[i] >> STRETCH_CORR_SHIFT);
+	}
+
+	return sum;
+}
+#endif
+
+/*!
+ * \brief Find the pitch period at the start of the decoded audio
+ *
+ * \return The lag, in samples, at which the audio best matches its start,
+ * or 0 if it does not match well enough to be stretched inaudibly.
+ *
+ * \pre At least max_lag + window samples are decoded
+ */
+static int stretch_find_lag(struct stretch_jb *jb)
+{
+	const int16_t *x = jb->pcm;
+	int window = jb->window;
+	/* Only periods the audio held covers can be searched */
+	int max_lag = MIN(jb->max_lag, (long) jb->pcm_len - window);
+	int64_t energy0;
+	int64_t energy;
+	int64_t corr;
+	int64_t best_corr = 0;
+	int64_t best_energy = 1;
+	double score;
+	double best_score = 0;
+	int best_lag = 0;
+	int lag;
+
+	if (max_lag < jb->min_lag) {
+		return 0;
+	}
+	energy0 = stretch_dot(x, x, window);
+	energy = stretch_dot(x + jb->min_lag, x + jb->min_lag, window);
+
+	for (lag = jb->min_lag; lag <= max_lag; ++lag) {
+		corr = stretch_dot(x, x + lag, window);
+		if (corr > 0) {
+			score = (double) corr * corr / (energy ? energy : 1);
+			if (score > best_score) {
+				best_score = score;
+				best_corr = corr;
+				best_energy = energy ? energy : 1;
+				best_lag = lag;
+			}
+		}
+		if (lag == max_lag) {
+			break;
+		}
+		/* Slide the energy of the window being compared along by one sample */
+		energy += (x[lag + window] >> STRETCH_CORR_SHIFT) * (x[lag + window] >> STRETCH_CORR_SHIFT)
+			- (x[lag] >> STRETCH_CORR_SHIFT) * (x[lag] >> STRETCH_CORR_SHIFT);
+	}
+
+	/* Silence can be stretched anywhere */
+	if (energy0 < (int64_t) window * STRETCH_QUIET_ENERGY) {
+		return best_lag ? best_lag : max_lag;
+	}
+
+	/* Otherwise the normalized correlation must be at least 0.5 */
+	if (best_lag && (double) best_corr * best_corr >= 0.25 * (double) energy0 * best_energy) {
+		return best_lag;
+	}
+
+	return 0;
+}
+
+/*! \brief Make room for decoded audio, and for a pitch period to be repeated */
+static int stretch_reserve(struct stretch_jb *jb, size_t samples)
+{
+	size_t size = jb->pcm_len + samples + jb->max_lag;
+	int16_t *pcm;
+
+	if (size <= jb->pcm_size) {
+		return 0;
+	}
+
+	pcm = ast_realloc(jb->pcm, size * sizeof(*pcm));
+	if (!pcm) {
+		return -1;
+	}
+	jb->pcm = pcm;
+	jb->pcm_size = size;
+
+	return 0;
+}
+
+/*! \brief Remove a pitch period from the decoded audio */
+static int stretch_accelerate(struct stretch_jb *jb)
+{
+	int16_t *x = jb->pcm;
+	int window = jb->window;
+	int lag = stretch_find_lag(jb);
+	int i;
+
+	if (!lag) {
+		return 0;
+	}
+
+	/* Fade from the start into the audio one period later */
+	for (i = 0; i < window; ++i) {
+		x[i] = (x[i] * (window - i) + x[i + lag] * i) / window;
+	}
+	memmove(x + window, x + window + lag, (jb->pcm_len - window - lag) * sizeof(*x));
+	jb->pcm_len -= lag;
+	jb->stats.accelerated += stretch_samples_to_ms(jb, lag);
+
+	return lag;
+}
+
+/*! \brief Repeat a pitch period of the decoded audio */
+static int stretch_expand(struct stretch_jb *jb)
+{
+	int16_t fade[STRETCH_MAX_WINDOW];
+	int16_t *x = jb->pcm;
+	int window = jb->window;
+	int lag;
+	int i;
+
+	if (stretch_reserve(jb, 0)) {
+		return 0;
+	}
+	x = jb->pcm;
+
+	lag = stretch_find_lag(jb);
+	if (!lag) {
+		return 0;
+	}
+
+	/* After one period fade from the audio back into its start */
+	for (i = 0; i < window; ++i) {
+		fade[i] = (x[lag + i] * (window - i) + x[i] * i) / window;
+	}
+	memmove(x + lag + window, x + window, (jb->pcm_len - window) * sizeof(*x));
+	memcpy(x + lag, fade, window * sizeof(*x));
+	jb->pcm_len += lag;
+	jb->stats.expanded += stretch_samples_to_ms(jb, lag);
+
+	return lag;
+}
+
+/*! \brief Decode a frame onto the end of the decoded audio */
+static void stretch_decode(struct stretch_jb *jb, struct stretch_jb_frame *head)
+{
+	struct ast_frame *frame = head->frame;
+	long start = stretch_ms_to_samples(jb, head->ts);
+	size_t samples;
+	size_t skip = 0;
+	int slin = ast_format_cache_is_slinear(frame->subclass.format);
+
+	samples = slin ? frame->datalen / sizeof(int16_t) : frame->datalen;
+
+	/* Part of the frame may overlap audio that was already decoded */
+	if (start < jb->media_end) {
+		skip = jb->media_end - start;
+	}
+	if (skip >= samples) {
+		++jb->stats.frames_late;
+		return;
+	}
+	if (stretch_reserve(jb, samples)) {
+		return;
+	}
+
+	if (slin) {
+		memcpy(jb->pcm + jb->pcm_len, (int16_t *) frame->data.ptr + skip,
+			(samples - skip) * sizeof(int16_t));
+	} else if (ast_format_cmp(frame->subclass.format, ast_format_ulaw) == AST_FORMAT_CMP_EQUAL) {
+		ast_mulaw_buf(jb->pcm + jb->pcm_len, (unsigned char *) frame->data.ptr + skip, samples - skip);
+	} else {
+		ast_alaw_buf(jb->pcm + jb->pcm_len, (unsigned char *) frame->data.ptr + skip, samples - skip);
+	}
+	jb->pcm_len += samples - skip;
+	jb->media_end = start + samples;
+}
+
+/*!
+ * \brief Decode queued frames that follow on from the decoded audio
+ *
+ * \retval 0 if the audio wanted was decoded
+ * \retval -1 if the queue ran out or has a gap first
+ */
+static int stretch_fill(struct stretch_jb *jb, size_t wanted)
+{
+	struct stretch_jb_frame *head;
+	/* Allow for timestamps being rounded to the ms */
+	long tolerance = stretch_ms_to_samples(jb, 1);
+
+	while (jb->pcm_len < wanted) {
+		head = jb->frames;
+		if (!head || !stretch_frame_compatible(jb, head->frame)) {
+			return -1;
+		}
+		if (!jb->pcm_len) {
+			stretch_set_format(jb, head->frame->subclass.format);
+		}
+		if (stretch_ms_to_samples(jb, head->ts) > jb->media_end + tolerance) {
+			return -1;
+		}
+		stretch_pop(jb);
+		jb->seqno = head->frame->seqno;
+		stretch_decode(jb, head);
+		ast_frfree(head->frame);
+		ast_free(head);
+	}
+
+	return 0;
+}
+
+/*! \brief Play out queued frames as they are */
+static int stretch_get_frame(struct stretch_jb *jb, struct ast_frame **frame, long now, long interpl)
+{
+	struct stretch_jb_frame *head = jb->frames;
+	long target = stretch_target(jb, interpl, 0);
+	long play_ms = stretch_play_ms(jb);
+
+	jb->stats.current = stretch_delay(jb, play_ms, now);
+	jb->stats.target = target;
+
+	if (!head) {
+		jb->stats.interpolated += interpl;
+		return STRETCH_JB_INTERP;
+	}
+
+	/* Something is missing, wait for it until the next frame is due */
+	if (head->ts > play_ms && stretch_delay(jb, head->ts, now) < target - interpl / 2) {
+		jb->stats.interpolated += interpl;
+		return STRETCH_JB_INTERP;
+	}
+
+	/* Catch up by skipping frames if the next one is due already */
+	while (head->next && stretch_delay(jb, head->next->ts, now) >= target) {
+		stretch_pop(jb);
+		++jb->stats.frames_dropped;
+		jb->stats.accelerated += head->ms;
+		ast_frfree(head->frame);
+		ast_free(head);
+		head = jb->frames;
+	}
+
+	stretch_pop(jb);
+	stretch_count_lost(jb, head->frame->seqno);
+	jb->seqno = head->frame->seqno;
+	stretch_set_format(jb, head->frame->subclass.format);
+	jb->pcm_len = 0;
+	jb->media_end = stretch_ms_to_samples(jb, head->ts + head->ms);
+
+	*frame = head->frame;
+	ast_free(head);
+
+	return STRETCH_JB_OK;
+}
+
+/*! \brief Play out decoded audio, time-stretching it towards the target delay */
+/*! \brief Skip over missing audio to the next frame, if it can be stretched */
+static int stretch_skip(struct stretch_jb *jb, size_t wanted)
+{
+	struct stretch_jb_frame *head = jb->frames;
+
+	if (!head || !stretch_frame_compatible(jb, head->frame)) {
+		return -1;
+	}
+	stretch_count_lost(jb, head->frame->seqno);
+	jb->media_end = stretch_ms_to_samples(jb, head->ts);
+
+	return stretch_fill(jb, wanted);
+}
+
+static int stretch_get_stretched(struct stretch_jb *jb, struct ast_frame **frame, long now, long interpl)
+{
+	struct stretch_jb_frame *head;
+	struct ast_frame out = { .frametype = AST_FRAME_VOICE, };
+	long target = stretch_target(jb, interpl, 1);
+	long hysteresis = interpl / 2;
+	size_t samples = stretch_ms_to_samples(jb, interpl);
+	size_t lookahead = samples + jb->max_lag + jb->window;
+	int starving;
+	long delay;
+
+	starving = stretch_fill(jb, lookahead);
+
+	/* Something is missing, skip it once the audio after it is due */
+	head = jb->frames;
+	if (jb->pcm_len < samples && head && stretch_delay(jb, head->ts, now) >= target - hysteresis) {
+		starving = stretch_skip(jb, lookahead);
+	}
+
+	delay = stretch_delay(jb, stretch_play_ms(jb), now);
+	jb->stats.current = delay;
+	jb->stats.target = target;
+
+	if (!starving && delay > target + hysteresis) {
+		stretch_accelerate(jb);
+	} else if (jb->pcm_len < samples) {
+		/* Conceal audio that is late by repeating periods of what is here */
+		while (jb->pcm_len < samples && stretch_expand(jb)) {
+		}
+		/* Rather than go quiet play on with what comes after it */
+		if (jb->pcm_len < samples) {
+			stretch_skip(jb, lookahead);
+		}
+	} else if (delay < target - hysteresis || (starving && delay < target)) {
+		/* Stretch early, while there is audio enough to, in case the next frame is late */
+		stretch_expand(jb);
+	}
+
+	if (jb->pcm_len < samples) {
+		/* Frames that can not be stretched are played out as they are */
+		if (jb->frames && !stretch_frame_compatible(jb, jb->frames->frame)) {
+			jb->pcm_len = 0;
+			return stretch_get_frame(jb, frame, now, interpl);
+		}
+		jb->stats.interpolated += interpl;
+		return STRETCH_JB_INTERP;
+	}
+
+	if (ast_format_cache_is_slinear(jb->format)) {
+		out.data.ptr = jb->pcm;
+		out.datalen = samples * sizeof(int16_t);
+	} else {
+		if (jb->out_size < samples) {
+			unsigned char *buf = ast_realloc(jb->out, samples);
+
+			if (!buf) {
+				return STRETCH_JB_NOFRAME;
+			}
+			jb->out = buf;
+			jb->out_size = samples;
+		}
+		if (ast_format_cmp(jb->format, ast_format_ulaw) == AST_FORMAT_CMP_EQUAL) {
+			ast_lin2mu_buf(jb->out, jb->pcm, samples);
+		} else {
+			ast_lin2a_buf(jb->out, jb->pcm, samples);
+		}
+		out.data.ptr = jb->out;
+		out.datalen = samples;
+	}
+	out.subclass.format = jb->format;
+	out.samples = samples;
+	out.ts = stretch_play_ms(jb);
+	out.len = interpl;
+	out.seqno = jb->seqno;
+	out.src = "stretch jitterbuffer";
+	ast_set_flag(&out, AST_FRFLAG_HAS_TIMING_INFO);
+
+	*frame = ast_frdup(&out);
+	if (!*frame) {
+		return STRETCH_JB_NOFRAME;
+	}
+
+	jb->pcm_len -= samples;
+	memmove(jb->pcm, jb->pcm + samples, jb->pcm_len * sizeof(*jb->pcm));
+
+	return STRETCH_JB_OK;
+}
+
+struct stretch_jb *stretch_jb_new(const struct stretch_jb_conf *conf)
+{
+	struct stretch_jb *jb;
+
+	if (!(jb = ast_calloc(1, sizeof(*jb)))) {
+		return NULL;
+	}
+
+	jb->conf = *conf;
+
+	return jb;
+}
+
+void stretch_jb_destroy(struct stretch_jb *jb)
+{
+	stretch_flush(jb);
+	ao2_cleanup(jb->format);
+	ast_free(jb->pcm);
+	ast_free(jb->out);
+	ast_free(jb);
+}
+
+/*! \brief Media time, in ms, of the oldest audio held once a frame has been put in */
+static long stretch_first_ms(struct stretch_jb *jb, struct ast_frame *frame)
+{
+	if (jb->pcm_len) {
+		return stretch_play_ms(jb);
+	}
+	/* Audio after a silence the sender did not send anything for always fits */
+	return jb->frames ? MIN(jb->frames->ts, frame->ts) : frame->ts;
+}
+
+/*! \brief Start over with the given frame */
+static void stretch_resynch(struct stretch_jb *jb, struct ast_frame *frame, long now)
+{
+	stretch_flush(jb);
+	stretch_set_format(jb, frame->subclass.format);
+	jb->media_end = stretch_ms_to_samples(jb, frame->ts);
+	jb->seqno = frame->seqno - 1;
+	jb->transit_count = 0;
+	jb->transit_pos = 0;
+	stretch_record_transit(jb, now - frame->ts);
+	jb->next_delivery = now + stretch_target(jb, frame->len, 0);
+	jb->started = 1;
+	jb->force_resynch = 0;
+}
+
+int stretch_jb_put(struct stretch_jb *jb, struct ast_frame *frame, long now)
+{
+	struct stretch_jb_frame *entry;
+	struct stretch_jb_frame **pos;
+	long play_ms;
+
+	if (!jb->started || jb->force_resynch) {
+		stretch_resynch(jb, frame, now);
+	} else if (jb->conf.resync_threshold > 0
+		&& labs(frame->ts - stretch_play_ms(jb)) > jb->conf.resync_threshold + jb->conf.max_size) {
+		stretch_resynch(jb, frame, now);
+	} else {
+		stretch_record_transit(jb, now - frame->ts);
+	}
+	++jb->stats.frames_in;
+
+	play_ms = stretch_play_ms(jb);
+	if (frame->ts + frame->len <= play_ms) {
+		++jb->stats.frames_late;
+		return STRETCH_JB_DROP;
+	}
+	/* When full make room by dropping the oldest audio rather than the newest */
+	while (jb->conf.max_size > 0 && frame->ts + frame->len - stretch_first_ms(jb, frame) > jb->conf.max_size) {
+		if (jb->pcm_len) {
+			jb->stats.accelerated += stretch_samples_to_ms(jb, jb->pcm_len);
+			jb->pcm_len = 0;
+		} else if ((entry = stretch_pop(jb))) {
+			++jb->stats.frames_dropped;
+			jb->stats.accelerated += entry->ms;
+			jb->seqno = entry->frame->seqno;
+			stretch_set_format(jb, entry->frame->subclass.format);
+			jb->media_end = stretch_ms_to_samples(jb, entry->ts + entry->ms);
+			ast_frfree(entry->frame);
+			ast_free(entry);
+		} else {
+			break;
+		}
+	}
+
+	for (pos = &jb->frames; *pos && (*pos)->ts < frame->ts; pos = &(*pos)->next) {
+	}
+	if (*pos && (*pos)->ts == frame->ts) {
+		++jb->stats.frames_dropped;
+		return STRETCH_JB_DROP;
+	}
+
+	if (!(entry = ast_calloc(1, sizeof(*entry)))) {
+		return STRETCH_JB_DROP;
+	}
+	entry->frame = frame;
+	entry->ts = frame->ts;
+	entry->ms = frame->len;
+	entry->next = *pos;
+	*pos = entry;
+
+	return STRETCH_JB_OK;
+}
+
+int stretch_jb_get(struct stretch_jb *jb, struct ast_frame **frame, long now, long interpl)
+{
+	struct stretch_jb_frame *head;
+
+	if (!jb->started || interpl <= 0) {
+		return STRETCH_JB_NOFRAME;
+	}
+
+	jb->next_delivery += interpl;
+
+	stretch_drop_stale(jb);
+	head = jb->frames;
+	if (jb->pcm_len || (head && stretch_frame_compatible(jb, head->frame))) {
+		return stretch_get_stretched(jb, frame, now, interpl);
+	}
+
+	return stretch_get_frame(jb, frame, now, interpl);
+}
+
+long stretch_jb_next(struct stretch_jb *jb)
+{
+	return jb->next_delivery;
+}
+
+int stretch_jb_remove(struct stretch_jb *jb, struct ast_frame **frame)
+{
+	struct stretch_jb_frame *head = stretch_pop(jb);
+
+	jb->pcm_len = 0;
+	if (!head) {
+		return STRETCH_JB_NOFRAME;
+	}
+
+	*frame = head->frame;
+	ast_free(head);
+
+	return STRETCH_JB_OK;
+}
+
+void stretch_jb_set_force_resynch(struct stretch_jb *jb)
+{
+	jb->force_resynch = 1;
+}
+
+int stretch_jb_is_late(struct stretch_jb *jb, long ts)
+{
+	return jb->started && ts < stretch_play_ms(jb);
+}
+
+void stretch_jb_get_stats(struct stretch_jb *jb, struct ast_jb_stats *stats)
+{
+	*stats = jb->stats;
+}
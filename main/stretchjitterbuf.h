@@ -0,0 +1,92 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Time-stretching jitterbuffer.
+ *
+ */
+
+#ifndef _STRETCHJITTERBUF_H_
+#define _STRETCHJITTERBUF_H_
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+struct ast_frame;
+struct ast_jb_stats;
+
+/* return codes */
+enum {
+	STRETCH_JB_OK,
+	STRETCH_JB_DROP,
+	STRETCH_JB_INTERP,
+	STRETCH_JB_NOFRAME
+};
+
+/* jb configuration properties */
+struct stretch_jb_conf
+{
+	/*! Maximum amount of audio buffered, in ms */
+	long max_size;
+	/*! Timestamp jump, in ms, that resets the jb */
+	long resync_threshold;
+	/*! Delay, in ms, kept on top of the observed jitter */
+	long target_extra;
+};
+
+struct stretch_jb;
+
+/* jb interface */
+
+struct stretch_jb *stretch_jb_new(const struct stretch_jb_conf *conf);
+
+void stretch_jb_destroy(struct stretch_jb *jb);
+
+/*!
+ * \brief Put a frame into the jb
+ *
+ * \note On STRETCH_JB_OK the jb owns the frame.
+ */
+int stretch_jb_put(struct stretch_jb *jb, struct ast_frame *frame, long now);
+
+/*!
+ * \brief Get the frame to play out now
+ *
+ * \param interpl Length of the frame to play out, in ms
+ *
+ * \note Audio in signed linear and G.711 is time-stretched to follow the
+ * target delay, so the frame returned may not be one that was put in.
+ */
+int stretch_jb_get(struct stretch_jb *jb, struct ast_frame **frame, long now, long interpl);
+
+long stretch_jb_next(struct stretch_jb *jb);
+
+int stretch_jb_remove(struct stretch_jb *jb, struct ast_frame **frame);
+
+void stretch_jb_set_force_resynch(struct stretch_jb *jb);
+
+/*! \brief Checks if the given time stamp is late */
+int stretch_jb_is_late(struct stretch_jb *jb, long ts);
+
+void stretch_jb_get_stats(struct stretch_jb *jb, struct ast_jb_stats *stats);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _STRETCHJITTERBUF_H_ */
@@ -46,6 +46,9 @@ ast_string_field __ast_string_field_empty = __ast_string_field_empty_buffer.stri
 
 #define ALLOCATOR_OVERHEAD 48
 
+/*! Space taken by the header before the first pool in the same allocation */
+#define HEADER_SIZE ast_align_for(sizeof(struct ast_string_field_header), struct ast_string_field_pool)
+
 static size_t optimal_alloc_size(size_t size)
 {
 	unsigned int count;
@@ -115,40 +118,27 @@ int __ast_string_field_free_memory(struct ast_string_field_mgr *mgr,
 	struct ast_string_field_pool **pool_head, enum ast_stringfield_cleanup_type cleanup_type,
 	const char *file, int lineno, const char *func)
 {
+	struct ast_string_field_header *header = mgr->header;
 	struct ast_string_field_pool *cur = NULL;
-	struct ast_string_field_pool *preserve = NULL;
+	struct ast_string_field_pool *preserve;
 
-	if (!mgr->header) {
+	if (!header) {
 		return -1;
 	}
 
 	/* reset all the fields regardless of cleanup type */
-	AST_VECTOR_CALLBACK_VOID(&mgr->header->string_fields, reset_field);
+	AST_VECTOR_CALLBACK_VOID(&header->string_fields, reset_field);
+
+	/* ALWAYS preserve the embedded pool, it is part of the header's allocation */
+	preserve = header->embedded_pool;
+	preserve->used = preserve->active = 0;
 
 	switch (cleanup_type) {
 	case AST_STRINGFIELD_DESTROY:
-		AST_VECTOR_FREE(&mgr->header->string_fields);
-
-		if (mgr->header->embedded_pool) { /* ALWAYS preserve the embedded pool if there is one */
-			preserve = mgr->header->embedded_pool;
-			preserve->used = preserve->active = 0;
-		}
-
-		ast_free(mgr->header);
+		AST_VECTOR_FREE(&header->string_fields);
 		mgr->header = NULL;
 		break;
 	case AST_STRINGFIELD_RESET:
-		/* Preserve the embedded pool if there is one, otherwise the last pool */
-		if (mgr->header->embedded_pool) {
-			preserve = mgr->header->embedded_pool;
-		} else {
-			if (*pool_head == NULL) {
-				ast_log(LOG_WARNING, "trying to reset empty pool\n");
-				return -1;
-			}
-			preserve = *pool_head;
-		}
-		preserve->used = preserve->active = 0;
 		break;
 	default:
 		return -1;
@@ -165,8 +155,12 @@ int __ast_string_field_free_memory(struct ast_string_field_mgr *mgr,
 	}
 
 	*pool_head = preserve;
-	if (preserve) {
-		preserve->prev = NULL;
+	preserve->prev = NULL;
+
+	if (!mgr->header && !header->in_structure) {
+		/* The embedded pool goes with the header */
+		*pool_head = NULL;
+		ast_free(header);
 	}
 
 	return 0;
@@ -190,6 +184,8 @@ int __ast_string_field_init(struct ast_string_field_mgr *mgr, struct ast_string_
 {
 	const char **p = (const char **) pool_head + 1;
 	size_t initial_vector_size = ((size_t) (((char *)mgr) - ((char *)p))) / sizeof(*p);
+	struct ast_string_field_pool *pool;
+	size_t alloc_size;
 
 	if (needed <= 0) {
 		return __ast_string_field_free_memory(mgr, pool_head, needed, file, lineno, func);
@@ -202,7 +198,9 @@ int __ast_string_field_init(struct ast_string_field_mgr *mgr, struct ast_string_
 	mgr->owner_line = lineno;
 #endif
 
-	if (!(mgr->header = calloc_wrapper(1, sizeof(*mgr->header), file, lineno, func))) {
+	/* The first pool is allocated along with the header, saving a malloc per structure */
+	alloc_size = HEADER_SIZE + optimal_alloc_size(sizeof(*pool) + needed);
+	if (!(mgr->header = calloc_wrapper(1, alloc_size, file, lineno, func))) {
 		return -1;
 	}
 
@@ -217,14 +215,10 @@ int __ast_string_field_init(struct ast_string_field_mgr *mgr, struct ast_string_
 		*p++ = __ast_string_field_empty;
 	}
 
-	*pool_head = NULL;
-	mgr->header->embedded_pool = NULL;
-	if (add_string_pool(mgr, pool_head, needed, file, lineno, func)) {
-		AST_VECTOR_FREE(&mgr->header->string_fields);
-		ast_free(mgr->header);
-		mgr->header = NULL;
-		return -1;
-	}
+	pool = (void *) mgr->header + HEADER_SIZE;
+	pool->size = alloc_size - HEADER_SIZE - sizeof(*pool);
+	mgr->header->embedded_pool = pool;
+	*pool_head = pool;
 
 	return 0;
 }
@@ -304,11 +298,12 @@ void __ast_string_field_release_active(struct ast_string_field_pool *pool_head,
 		if ((ptr >= pool->base) && (ptr <= (pool->base + pool->size))) {
 			pool->active -= AST_STRING_FIELD_ALLOCATION(ptr);
 			if (pool->active == 0) {
-				if (prev) {
+				if (!prev) {
+					pool->used = 0;
+				} else if (pool->prev) {
+					/* The first pool is only freed along with the header it is embedded in */
 					prev->prev = pool->prev;
 					ast_free(pool);
-				} else {
-					pool->used = 0;
 				}
 			}
 			break;
@@ -414,8 +409,10 @@ void *__ast_calloc_with_stringfields(unsigned int num_structs, size_t struct_siz
 	struct ast_string_field_mgr *mgr;
 	struct ast_string_field_pool *pool;
 	struct ast_string_field_pool **pool_head;
+	size_t header_offset = ast_align_for(struct_size, struct ast_string_field_header);
 	size_t pool_size_needed = sizeof(*pool) + pool_size;
-	size_t size_to_alloc = optimal_alloc_size(struct_size + pool_size_needed);
+	size_t size_to_alloc = optimal_alloc_size(struct_size + pool_size_needed)
+		+ header_offset - struct_size + HEADER_SIZE;
 	void *allocation;
 	const char **p;
 	size_t initial_vector_size;
@@ -428,23 +425,16 @@ void *__ast_calloc_with_stringfields(unsigned int num_structs, size_t struct_siz
 
 	mgr = allocation + field_mgr_offset;
 
-	/*
-	 * The header is calloced in __ast_string_field_init so it also gets calloced here
-	 * so __ast_string_fields_free_memory can always just free mgr->header.
-	 */
-	mgr->header = calloc_wrapper(1, sizeof(*mgr->header), file, lineno, func);
-	if (!mgr->header) {
-		ast_free(allocation);
-		return NULL;
-	}
+	/* The header and first pool follow the structure in the same allocation */
+	mgr->header = allocation + header_offset;
+	mgr->header->in_structure = 1;
 
-	pool = allocation + struct_size;
+	pool = (void *) mgr->header + HEADER_SIZE;
 	pool_head = allocation + field_mgr_pool_offset;
 	p = (const char **) pool_head + 1;
 	initial_vector_size = ((size_t) (((char *)mgr) - ((char *)p))) / sizeof(*p);
 
 	if (AST_VECTOR_INIT(&mgr->header->string_fields, initial_vector_size)) {
-		ast_free(mgr->header);
 		ast_free(allocation);
 		return NULL;
 	}
@@ -456,7 +446,7 @@ void *__ast_calloc_with_stringfields(unsigned int num_structs, size_t struct_siz
 
 	mgr->header->embedded_pool = pool;
 	*pool_head = pool;
-	pool->size = size_to_alloc - struct_size - sizeof(*pool);
+	pool->size = size_to_alloc - header_offset - HEADER_SIZE - sizeof(*pool);
 #if defined(__AST_DEBUG_MALLOC)
 		mgr->owner_file = file;
 		mgr->owner_func = func;
@@ -181,6 +181,117 @@ char *__ast_str_helper2(struct ast_str **buf, ssize_t maxlen, const char *src, s
 	return (*buf)->__AST_STR_STR;
 }
 
+/*!
+ * Scratch strings of a thread.
+ *
+ * Each slot is a thread local dynamic string of its own, so growing one
+ * keeps it attached to its slot, and the slot of a string is found from its
+ * __AST_STR_TS.
+ */
+AST_THREADSTORAGE(str_scratch_0);
+AST_THREADSTORAGE(str_scratch_1);
+AST_THREADSTORAGE(str_scratch_2);
+AST_THREADSTORAGE(str_scratch_3);
+AST_THREADSTORAGE(str_scratch_4);
+AST_THREADSTORAGE(str_scratch_5);
+AST_THREADSTORAGE(str_scratch_6);
+AST_THREADSTORAGE(str_scratch_7);
+
+static struct ast_threadstorage *const str_scratch_slots[] = {
+	&str_scratch_0, &str_scratch_1, &str_scratch_2, &str_scratch_3,
+	&str_scratch_4, &str_scratch_5, &str_scratch_6, &str_scratch_7,
+};
+
+/*! Which scratch strings of a thread are handed out, and their sizes */
+struct str_scratch_state {
+	unsigned int in_use;
+	size_t len[ARRAY_LEN(str_scratch_slots)];
+};
+
+AST_THREADSTORAGE(str_scratch_state);
+
+struct ast_str *ast_str_scratch_get(size_t init_len)
+{
+	struct str_scratch_state *state = ast_threadstorage_get(&str_scratch_state, sizeof(*state));
+	struct ast_str *buf;
+	int best = -1;
+	int i;
+
+	if (!state) {
+		return NULL;
+	}
+
+	/* The smallest free string that fits, else the largest free one */
+	for (i = 0; i < ARRAY_LEN(str_scratch_slots); i++) {
+		if (state->in_use & (1U << i)) {
+			continue;
+		}
+		if (best < 0
+			|| (state->len[best] < init_len && state->len[i] > state->len[best])
+			|| (state->len[i] >= init_len && state->len[i] < state->len[best])) {
+			best = i;
+		}
+	}
+
+	if (best < 0) {
+		/* All are in use, fall back to an ordinary string */
+		return ast_str_create(init_len);
+	}
+
+	buf = ast_str_thread_get(str_scratch_slots[best], init_len);
+	if (!buf || ast_str_make_space(&buf, init_len)) {
+		return NULL;
+	}
+	ast_str_reset(buf);
+
+	state->in_use |= 1U << best;
+	state->len[best] = ast_str_size(buf);
+	return buf;
+}
+
+void ast_str_scratch_release(struct ast_str *buf)
+{
+	struct str_scratch_state *state;
+	int i;
+
+	if (!buf) {
+		return;
+	}
+
+	for (i = 0; i < ARRAY_LEN(str_scratch_slots); i++) {
+		if (buf->__AST_STR_TS == str_scratch_slots[i]) {
+			break;
+		}
+	}
+	if (i == ARRAY_LEN(str_scratch_slots)) {
+		ast_free(buf);
+		return;
+	}
+
+	state = ast_threadstorage_get(&str_scratch_state, sizeof(*state));
+	if (state) {
+		state->in_use &= ~(1U << i);
+		state->len[i] = ast_str_size(buf);
+	}
+}
+
+unsigned int ast_str_scratch_mark(void)
+{
+	struct str_scratch_state *state = ast_threadstorage_get(&str_scratch_state, sizeof(*state));
+
+	return state ? state->in_use : 0;
+}
+
+void ast_str_scratch_reclaim(unsigned int mark)
+{
+	struct str_scratch_state *state = ast_threadstorage_get(&str_scratch_state, sizeof(*state));
+
+	if (state) {
+		/* Sizes are not known here, they are refreshed when next handed out */
+		state->in_use &= mark;
+	}
+}
+
 static int str_hash(const void *obj, const int flags)
 {
 	return ast_str_hash(obj);
@@ -38,6 +38,15 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/cli.h"
 #include "asterisk/taskprocessor.h"
 #include "asterisk/sem.h"
+#include "asterisk/options.h"
+#include "asterisk/latency.h"
+
+#include <sched.h>
+
+#if defined(HAVE_GCC_ATOMICS) && defined(__ATOMIC_SEQ_CST)
+/*! The lock-free taskprocessor queue needs the C11 style atomic builtins */
+#define TPS_HAVE_MPSC_QUEUE 1
+#endif
 
 /*!
  * \brief tps_task structure is queued to a taskprocessor
@@ -57,6 +66,30 @@ struct tps_task {
 	/*! \brief AST_LIST_ENTRY overhead */
 	AST_LIST_ENTRY(tps_task) list;
 	unsigned int wants_local:1;
+	/*! \brief Name the task's statistics are kept under */
+	const char *callsite;
+	/*! \brief When the task was queued */
+	struct timeval queued;
+};
+
+/*!
+ * \brief Intrusive lock-free multi-producer single-consumer task queue
+ *
+ * Producers atomically swap themselves in as the newest task and then link
+ * the previous newest task to themselves.  The single consumer walks the
+ * links from the oldest task.  Between the swap and the link the queue
+ * appears to end early, so a consumer that knows a task has been counted
+ * but cannot see it yet simply waits for the link.
+ */
+struct tps_mpsc_queue {
+	/*! \brief Most recently pushed task, swapped by producers */
+	struct tps_task *head;
+	/*! \brief Oldest task, only accessed by the consumer */
+	struct tps_task *tail;
+	/*! \brief Number of queued tasks plus the one currently executing */
+	int pending;
+	/*! \brief Placeholder task so the queue never becomes truly empty */
+	struct tps_task stub;
 };
 
 /*! \brief tps_taskprocessor_stats maintain statistics for a taskprocessor. */
@@ -65,8 +98,31 @@ struct tps_taskprocessor_stats {
 	unsigned long max_qsize;
 	/*! \brief This is the current number of tasks processed */
 	unsigned long _tasks_processed_count;
+	/*! \brief How long the tasks processed waited and executed for */
+	struct ast_taskprocessor_times times;
 };
 
+/*! \brief Time a task spent waiting in the queue and executing, in microseconds */
+struct tps_task_times {
+	uint64_t wait_us;
+	uint64_t exec_us;
+};
+
+/*! \brief Size of the table of callsite statistics, a power of two */
+#define TPS_CALLSITES 512
+/*! \brief Slots looked at for a callsite before giving up on it */
+#define TPS_CALLSITE_PROBES 16
+
+/*!
+ * \brief Statistics of the tasks pushed from each callsite
+ *
+ * Callsites claim a slot of the table by their name's address the first time
+ * one of their tasks executes and are never removed, so the executing thread
+ * records a task without locking.  The same name may be claimed more than once
+ * when it is pushed from different modules; reading merges them.
+ */
+static struct ast_taskprocessor_callsite_times tps_callsites[TPS_CALLSITES];
+
 /*! \brief A ast_taskprocessor structure is a singleton by name */
 struct ast_taskprocessor {
 	/*! \brief Friendly name of the taskprocessor */
@@ -82,6 +138,8 @@ struct ast_taskprocessor {
 	long tps_queue_high;
 	/*! \brief Taskprocessor queue */
 	AST_LIST_HEAD_NOLOCK(tps_queue, tps_task) tps_queue;
+	/*! \brief Lock-free queue used instead of tps_queue for serialized listeners */
+	struct tps_mpsc_queue *mpsc;
 	struct ast_taskprocessor_listener *listener;
 	/*! Current thread executing the tasks */
 	pthread_t thread;
@@ -112,6 +170,8 @@ struct ast_taskprocessor_listener {
 	struct ast_taskprocessor *tps;
 	/*! Data private to the listener */
 	void *user_data;
+	/*! TRUE if only one thread at a time executes the taskprocessor's tasks */
+	unsigned int serialized:1;
 };
 
 #define TPS_MAX_BUCKETS 7
@@ -134,12 +194,19 @@ static int tps_ping_handler(void *datap);
 
 static char *cli_tps_ping(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a);
 static char *cli_tps_report(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a);
+static char *cli_tps_slowest(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a);
+static char *cli_tps_callsites(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a);
 
 static struct ast_cli_entry taskprocessor_clis[] = {
 	AST_CLI_DEFINE(cli_tps_ping, "Ping a named task processor"),
 	AST_CLI_DEFINE(cli_tps_report, "List instantiated task processors and statistics"),
+	AST_CLI_DEFINE(cli_tps_slowest, "List the task processors with the slowest tasks"),
+	AST_CLI_DEFINE(cli_tps_callsites, "List the task callsites taking the most time"),
 };
 
+/*! Maximum number of tasks the default listener executes per queue lock */
+#define DEFAULT_LISTENER_BATCH_TASKS 32
+
 struct default_taskprocessor_listener_pvt {
 	pthread_t poll_thread;
 	int dead;
@@ -182,7 +249,10 @@ static void *default_tps_processing_function(void *data)
 			/* Just give up */
 			break;
 		}
-		ast_taskprocessor_execute(tps);
+		/* We are only signaled when the queue goes from empty to non-empty. */
+		while (!pvt->dead && ast_taskprocessor_execute_batch(tps, DEFAULT_LISTENER_BATCH_TASKS, 0)) {
+			/* No-op */
+		}
 	}
 
 	/* No posting to a dead taskprocessor! */
@@ -210,6 +280,11 @@ static void default_task_pushed(struct ast_taskprocessor_listener *listener, int
 {
 	struct default_taskprocessor_listener_pvt *pvt = listener->user_data;
 
+	if (!was_empty) {
+		/* The processing thread is already going to execute this task. */
+		return;
+	}
+
 	if (ast_sem_post(&pvt->sem) != 0) {
 		ast_log(LOG_ERROR, "Failed to notify of enqueued task: %s\n",
 			strerror(errno));
@@ -285,7 +360,8 @@ int ast_tps_init(void)
 }
 
 /* allocate resources for the task */
-static struct tps_task *tps_task_alloc(int (*task_exe)(void *datap), void *datap)
+static struct tps_task *tps_task_alloc(int (*task_exe)(void *datap), void *datap,
+	const char *callsite)
 {
 	struct tps_task *t;
 	if (!task_exe) {
@@ -301,11 +377,13 @@ static struct tps_task *tps_task_alloc(int (*task_exe)(void *datap), void *datap
 
 	t->callback.execute = task_exe;
 	t->datap = datap;
+	t->callsite = callsite;
 
 	return t;
 }
 
-static struct tps_task *tps_task_alloc_local(int (*task_exe)(struct ast_taskprocessor_local *local), void *datap)
+static struct tps_task *tps_task_alloc_local(int (*task_exe)(struct ast_taskprocessor_local *local), void *datap,
+	const char *callsite)
 {
 	struct tps_task *t;
 	if (!task_exe) {
@@ -322,6 +400,7 @@ static struct tps_task *tps_task_alloc_local(int (*task_exe)(struct ast_taskproc
 	t->callback.execute_local = task_exe;
 	t->datap = datap;
 	t->wants_local = 1;
+	t->callsite = callsite;
 
 	return t;
 }
@@ -333,6 +412,120 @@ static void *tps_task_free(struct tps_task *task)
 	return NULL;
 }
 
+/*! \brief Find the time histogram bucket a number of microseconds is counted in */
+static unsigned int tps_time_bucket(uint64_t us)
+{
+	unsigned int bucket = 0;
+
+	while (us && bucket < AST_TASKPROCESSOR_TIME_BUCKETS - 1) {
+		us >>= 1;
+		++bucket;
+	}
+	return bucket;
+}
+
+/*! \brief Count the times of a task */
+static void tps_times_add(struct ast_taskprocessor_times *times, const struct tps_task_times *task)
+{
+	++times->count;
+	times->wait_us += task->wait_us;
+	times->exec_us += task->exec_us;
+	times->max_exec_us = MAX(times->max_exec_us, task->exec_us);
+	++times->wait_buckets[tps_time_bucket(task->wait_us)];
+	++times->exec_buckets[tps_time_bucket(task->exec_us)];
+}
+
+/*! \brief Add the times counted for some tasks to those of others */
+static void tps_times_merge(struct ast_taskprocessor_times *sum, const struct ast_taskprocessor_times *times)
+{
+	int i;
+
+	sum->count += times->count;
+	sum->wait_us += times->wait_us;
+	sum->exec_us += times->exec_us;
+	sum->max_exec_us = MAX(sum->max_exec_us, times->max_exec_us);
+	for (i = 0; i < AST_TASKPROCESSOR_TIME_BUCKETS; ++i) {
+		sum->wait_buckets[i] += times->wait_buckets[i];
+		sum->exec_buckets[i] += times->exec_buckets[i];
+	}
+}
+
+#ifdef TPS_HAVE_MPSC_QUEUE
+static struct tps_mpsc_queue *tps_mpsc_alloc(void)
+{
+	struct tps_mpsc_queue *queue;
+
+	queue = ast_calloc(1, sizeof(*queue));
+	if (!queue) {
+		return NULL;
+	}
+	queue->head = &queue->stub;
+	queue->tail = &queue->stub;
+	return queue;
+}
+
+/* link a task in as the newest one, may be called by any number of threads */
+static void tps_mpsc_push(struct tps_mpsc_queue *queue, struct tps_task *task)
+{
+	struct tps_task *prev;
+
+	__atomic_store_n(&task->list.next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&queue->head, task, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->list.next, task, __ATOMIC_RELEASE);
+}
+
+/*
+ * remove the oldest task, only one thread at a time may call this
+ *
+ * Returns NULL if the queue is empty or if a producer is between
+ * swapping in its task and linking it.
+ */
+static struct tps_task *tps_mpsc_pop(struct tps_mpsc_queue *queue)
+{
+	struct tps_task *tail = queue->tail;
+	struct tps_task *next = __atomic_load_n(&tail->list.next, __ATOMIC_ACQUIRE);
+
+	if (tail == &queue->stub) {
+		if (!next) {
+			return NULL;
+		}
+		queue->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->list.next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+
+	if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+		/* A producer has not finished linking its task yet. */
+		return NULL;
+	}
+
+	/* The tail is the only task, put the stub behind it so it can be removed. */
+	tps_mpsc_push(queue, &queue->stub);
+	next = __atomic_load_n(&tail->list.next, __ATOMIC_ACQUIRE);
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/* free any tasks left in the queue, no producers may be active */
+static void tps_mpsc_free(struct tps_mpsc_queue *queue)
+{
+	struct tps_task *task;
+
+	while ((task = tps_mpsc_pop(queue))) {
+		tps_task_free(task);
+	}
+	ast_free(queue);
+}
+#endif
+
 /* taskprocessor tab completion */
 static char *tps_taskprocessor_tab_complete(struct ast_cli_args *a)
 {
@@ -522,6 +715,174 @@ static char *cli_tps_report(struct ast_cli_entry *e, int cmd, struct ast_cli_arg
 	ast_cli(a->fd, "\n%d taskprocessors\n\n", tcount);
 	ao2_ref(sorted_tps, -1);
 	return CLI_SUCCESS;
+#undef FMT_HEADERS
+#undef FMT_FIELDS
+}
+
+/*! \brief Microseconds below which a fraction of the tasks counted in a histogram fall */
+static uint64_t tps_time_percentile(const uint64_t *buckets, uint64_t count, double fraction)
+{
+	uint64_t seen = 0;
+	int i;
+
+	for (i = 0; i < AST_TASKPROCESSOR_TIME_BUCKETS - 1; ++i) {
+		seen += buckets[i];
+		if (seen >= count * fraction) {
+			break;
+		}
+	}
+	return (uint64_t) 1 << i;
+}
+
+struct tps_slowest {
+	struct ast_taskprocessor *tps;
+	struct ast_taskprocessor_times times;
+};
+
+/*! \brief Sorts the slowest taskprocessors, by mean execution time, first */
+static int tps_slowest_cmp(const void *left, const void *right)
+{
+	const struct ast_taskprocessor_times *left_times = &((const struct tps_slowest *) left)->times;
+	const struct ast_taskprocessor_times *right_times = &((const struct tps_slowest *) right)->times;
+	uint64_t left_mean = left_times->count ? left_times->exec_us / left_times->count : 0;
+	uint64_t right_mean = right_times->count ? right_times->exec_us / right_times->count : 0;
+
+	if (left_mean != right_mean) {
+		return left_mean < right_mean ? 1 : -1;
+	}
+	return 0;
+}
+
+/*! \brief Parse the optional number of rows a CLI command shows */
+static int tps_cli_rows(struct ast_cli_args *a, struct ast_cli_entry *e, int *rows)
+{
+	*rows = 20;
+	if (a->argc == e->args + 1) {
+		if (sscanf(a->argv[e->args], "%30d", rows) != 1 || *rows <= 0) {
+			return -1;
+		}
+	} else if (a->argc != e->args) {
+		return -1;
+	}
+	return 0;
+}
+
+static char *cli_tps_slowest(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct tps_slowest *slowest;
+	struct ast_taskprocessor *tps;
+	struct ao2_iterator iter;
+	int count = 0;
+	int rows;
+	int i;
+#define FMT_HEADERS		"%-45s %10s %10s %10s %10s %10s %10s\n"
+#define FMT_FIELDS		"%-45s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n"
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show taskprocessors slowest";
+		e->usage =
+			"Usage: core show taskprocessors slowest [<count>]\n"
+			"	Shows the task processors whose tasks take longest to execute\n"
+			"	on average, 20 unless a count is given.  Times are in\n"
+			"	microseconds, percentiles are rounded up to a power of two.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (tps_cli_rows(a, e, &rows)) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ao2_lock(tps_singletons);
+	slowest = ast_calloc(ao2_container_count(tps_singletons) + 1, sizeof(*slowest));
+	if (!slowest) {
+		ao2_unlock(tps_singletons);
+		return CLI_FAILURE;
+	}
+	iter = ao2_iterator_init(tps_singletons, AO2_ITERATOR_DONTLOCK);
+	while ((tps = ao2_iterator_next(&iter))) {
+		slowest[count].tps = tps;
+		if (tps->stats) {
+			slowest[count].times = tps->stats->times;
+		}
+		++count;
+	}
+	ao2_iterator_destroy(&iter);
+	ao2_unlock(tps_singletons);
+
+	qsort(slowest, count, sizeof(*slowest), tps_slowest_cmp);
+
+	ast_cli(a->fd, "\n" FMT_HEADERS, "Processor", "Processed", "Wait avg", "Wait p99",
+		"Exec avg", "Exec p99", "Exec max");
+	for (i = 0; i < count; ++i) {
+		struct ast_taskprocessor_times *times = &slowest[i].times;
+
+		if (i < rows && times->count) {
+			ast_cli(a->fd, FMT_FIELDS, slowest[i].tps->name, times->count,
+				times->wait_us / times->count,
+				tps_time_percentile(times->wait_buckets, times->count, 0.99),
+				times->exec_us / times->count,
+				tps_time_percentile(times->exec_buckets, times->count, 0.99),
+				times->max_exec_us);
+		}
+		ast_taskprocessor_unreference(slowest[i].tps);
+	}
+	ast_cli(a->fd, "\n");
+	ast_free(slowest);
+
+	return CLI_SUCCESS;
+#undef FMT_HEADERS
+#undef FMT_FIELDS
+}
+
+static char *cli_tps_callsites(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct ast_taskprocessor_callsite_times *callsites;
+	int count;
+	int rows;
+	int i;
+#define FMT_HEADERS		"%-45s %10s %12s %10s %10s %10s\n"
+#define FMT_FIELDS		"%-45s %10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n"
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show taskprocessors callsites";
+		e->usage =
+			"Usage: core show taskprocessors callsites [<count>]\n"
+			"	Shows the places tasks are pushed from whose tasks took the\n"
+			"	most time to execute in total, 20 unless a count is given.\n"
+			"	Tasks are named after the function that executes them.\n"
+			"	Times are in microseconds.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (tps_cli_rows(a, e, &rows)) {
+		return CLI_SHOWUSAGE;
+	}
+
+	callsites = ast_calloc(rows, sizeof(*callsites));
+	if (!callsites) {
+		return CLI_FAILURE;
+	}
+	count = ast_taskprocessor_callsite_times_get(callsites, rows);
+
+	ast_cli(a->fd, "\n" FMT_HEADERS, "Callsite", "Executed", "Exec total", "Exec avg",
+		"Exec max", "Wait avg");
+	for (i = 0; i < count; ++i) {
+		ast_cli(a->fd, FMT_FIELDS, callsites[i].callsite, callsites[i].count,
+			callsites[i].exec_us, callsites[i].exec_us / callsites[i].count,
+			callsites[i].max_exec_us, callsites[i].wait_us / callsites[i].count);
+	}
+	ast_cli(a->fd, "\n");
+	ast_free(callsites);
+
+	return CLI_SUCCESS;
+#undef FMT_HEADERS
+#undef FMT_FIELDS
 }
 
 /* hash callback for astobj2 */
@@ -574,6 +935,107 @@ static void tps_alert_add(struct ast_taskprocessor *tps, int delta)
 	ast_rwlock_unlock(&tps_alert_lock);
 }
 
+struct tps_totals {
+	unsigned long count;
+	unsigned long queued;
+	long max_queued;
+};
+
+static int tps_totals_cb(void *obj, void *arg, int flags)
+{
+	struct ast_taskprocessor *tps = obj;
+	struct tps_totals *totals = arg;
+	long size = ast_taskprocessor_size(tps);
+
+	++totals->count;
+	totals->queued += size;
+	totals->max_queued = MAX(totals->max_queued, size);
+
+	return 0;
+}
+
+void ast_taskprocessor_totals(unsigned long *count, unsigned long *queued, long *max_queued)
+{
+	struct tps_totals totals = { 0, };
+
+	ao2_callback(tps_singletons, OBJ_NODATA | OBJ_MULTIPLE, tps_totals_cb, &totals);
+
+	*count = totals.count;
+	*queued = totals.queued;
+	*max_queued = totals.max_queued;
+}
+
+static int tps_times_totals_cb(void *obj, void *arg, int flags)
+{
+	struct ast_taskprocessor *tps = obj;
+
+	if (tps->stats) {
+		tps_times_merge(arg, &tps->stats->times);
+	}
+	return 0;
+}
+
+void ast_taskprocessor_times_totals(struct ast_taskprocessor_times *times)
+{
+	memset(times, 0, sizeof(*times));
+	ao2_callback(tps_singletons, OBJ_NODATA | OBJ_MULTIPLE, tps_times_totals_cb, times);
+}
+
+/*! \brief Sorts the callsites with the most execution time first */
+static int tps_callsite_cmp(const void *left, const void *right)
+{
+	uint64_t left_us = ((const struct ast_taskprocessor_callsite_times *) left)->exec_us;
+	uint64_t right_us = ((const struct ast_taskprocessor_callsite_times *) right)->exec_us;
+
+	if (left_us != right_us) {
+		return left_us < right_us ? 1 : -1;
+	}
+	return 0;
+}
+
+int ast_taskprocessor_callsite_times_get(struct ast_taskprocessor_callsite_times *times, int max)
+{
+	struct ast_taskprocessor_callsite_times *merged;
+	int count = 0;
+	int i;
+	int j;
+
+	merged = ast_malloc(sizeof(tps_callsites));
+	if (!merged) {
+		return 0;
+	}
+
+	/* Tasks of the same name but pushed from different modules are shown together */
+	for (i = 0; i < TPS_CALLSITES; ++i) {
+		struct ast_taskprocessor_callsite_times slot = tps_callsites[i];
+
+		if (!slot.callsite || !slot.count) {
+			continue;
+		}
+		for (j = 0; j < count; ++j) {
+			if (!strcmp(merged[j].callsite, slot.callsite)) {
+				break;
+			}
+		}
+		if (j == count) {
+			merged[count++] = slot;
+			continue;
+		}
+		merged[j].count += slot.count;
+		merged[j].wait_us += slot.wait_us;
+		merged[j].exec_us += slot.exec_us;
+		merged[j].max_exec_us = MAX(merged[j].max_exec_us, slot.max_exec_us);
+	}
+
+	qsort(merged, count, sizeof(*merged), tps_callsite_cmp);
+
+	count = MIN(count, max);
+	memcpy(times, merged, count * sizeof(*times));
+	ast_free(merged);
+
+	return count;
+}
+
 unsigned int ast_taskprocessor_alert_get(void)
 {
 	unsigned int count;
@@ -629,6 +1091,12 @@ static void tps_taskprocessor_dtor(void *tps)
 	while ((task = AST_LIST_REMOVE_HEAD(&t->tps_queue, list))) {
 		tps_task_free(task);
 	}
+#ifdef TPS_HAVE_MPSC_QUEUE
+	if (t->mpsc) {
+		tps_mpsc_free(t->mpsc);
+		t->mpsc = NULL;
+	}
+#endif
 	t->tps_queue_size = 0;
 
 	if (t->high_water_alert) {
@@ -661,6 +1129,11 @@ static struct tps_task *tps_taskprocessor_pop(struct ast_taskprocessor *tps)
 
 long ast_taskprocessor_size(struct ast_taskprocessor *tps)
 {
+#ifdef TPS_HAVE_MPSC_QUEUE
+	if (tps && tps->mpsc) {
+		return __atomic_load_n(&tps->tps_queue_size, __ATOMIC_RELAXED);
+	}
+#endif
 	return (tps) ? tps->tps_queue_size : -1;
 }
 
@@ -714,6 +1187,11 @@ void *ast_taskprocessor_listener_get_user_data(const struct ast_taskprocessor_li
 	return listener->user_data;
 }
 
+void ast_taskprocessor_listener_set_serialized(struct ast_taskprocessor_listener *listener)
+{
+	listener->serialized = 1;
+}
+
 static void *default_listener_pvt_alloc(void)
 {
 	struct default_taskprocessor_listener_pvt *pvt;
@@ -752,6 +1230,16 @@ static struct ast_taskprocessor *__allocate_taskprocessor(const char *name, stru
 		return NULL;
 	}
 
+#ifdef TPS_HAVE_MPSC_QUEUE
+	if (listener->serialized && ast_option_lockfree_taskprocessors) {
+		p->mpsc = tps_mpsc_alloc();
+		if (!p->mpsc) {
+			ao2_ref(p, -1);
+			return NULL;
+		}
+	}
+#endif
+
 	ao2_ref(listener, +1);
 	p->listener = listener;
 
@@ -808,6 +1296,8 @@ struct ast_taskprocessor *ast_taskprocessor_get(const char *name, enum ast_tps_o
 		default_listener_pvt_destroy(pvt);
 		return NULL;
 	}
+	/* The default listener has a single thread executing tasks. */
+	ast_taskprocessor_listener_set_serialized(listener);
 
 	p = __allocate_taskprocessor(name, listener);
 
@@ -879,6 +1369,32 @@ static int taskprocessor_push(struct ast_taskprocessor *tps, struct tps_task *t)
 		return -1;
 	}
 
+	t->queued = ast_tvnow();
+
+#ifdef TPS_HAVE_MPSC_QUEUE
+	if (tps->mpsc) {
+		long size;
+
+		/* The currently executing task counts as still in queue */
+		was_empty = __atomic_fetch_add(&tps->mpsc->pending, 1, __ATOMIC_ACQ_REL) == 0;
+		size = __atomic_add_fetch(&tps->tps_queue_size, 1, __ATOMIC_RELAXED);
+		if (tps->tps_queue_high <= size && !tps->high_water_alert) {
+			ao2_lock(tps);
+			if (!tps->high_water_alert) {
+				ast_log(LOG_WARNING, "The '%s' task processor queue reached %ld scheduled tasks%s.\n",
+					tps->name, size, tps->high_water_warned ? " again" : "");
+				tps->high_water_warned = 1;
+				tps->high_water_alert = 1;
+				tps_alert_add(tps, +1);
+			}
+			ao2_unlock(tps);
+		}
+		tps_mpsc_push(tps->mpsc, t);
+		tps->listener->callbacks->task_pushed(tps->listener, was_empty);
+		return 0;
+	}
+#endif
+
 	ao2_lock(tps);
 	AST_LIST_INSERT_TAIL(&tps->tps_queue, t, list);
 	previous_size = tps->tps_queue_size++;
@@ -900,14 +1416,16 @@ static int taskprocessor_push(struct ast_taskprocessor *tps, struct tps_task *t)
 	return 0;
 }
 
-int ast_taskprocessor_push(struct ast_taskprocessor *tps, int (*task_exe)(void *datap), void *datap)
+int __ast_taskprocessor_push(struct ast_taskprocessor *tps, int (*task_exe)(void *datap), void *datap,
+	const char *callsite)
 {
-	return taskprocessor_push(tps, tps_task_alloc(task_exe, datap));
+	return taskprocessor_push(tps, tps_task_alloc(task_exe, datap, callsite));
 }
 
-int ast_taskprocessor_push_local(struct ast_taskprocessor *tps, int (*task_exe)(struct ast_taskprocessor_local *datap), void *datap)
+int __ast_taskprocessor_push_local(struct ast_taskprocessor *tps, int (*task_exe)(struct ast_taskprocessor_local *datap), void *datap,
+	const char *callsite)
 {
-	return taskprocessor_push(tps, tps_task_alloc_local(task_exe, datap));
+	return taskprocessor_push(tps, tps_task_alloc_local(task_exe, datap, callsite));
 }
 
 int ast_taskprocessor_suspend(struct ast_taskprocessor *tps)
@@ -937,12 +1455,144 @@ int ast_taskprocessor_is_suspended(struct ast_taskprocessor *tps)
 	return tps ? tps->suspended : -1;
 }
 
-int ast_taskprocessor_execute(struct ast_taskprocessor *tps)
+/*! \brief Count the times of a task under the callsite it was pushed from */
+static void tps_callsite_add(const char *callsite, const struct tps_task_times *task)
+{
+#ifdef HAVE_GCC_ATOMICS
+	struct ast_taskprocessor_callsite_times *slot;
+	uint64_t max;
+	unsigned int hash;
+	int i;
+
+	if (!callsite) {
+		return;
+	}
+
+	hash = ((uintptr_t) callsite >> 3) ^ ((uintptr_t) callsite >> 12);
+	for (i = 0; i < TPS_CALLSITE_PROBES; ++i) {
+		slot = &tps_callsites[(hash + i) & (TPS_CALLSITES - 1)];
+		if (slot->callsite != callsite
+			&& (slot->callsite || !__sync_bool_compare_and_swap(&slot->callsite, NULL, callsite))
+			&& slot->callsite != callsite) {
+			continue;
+		}
+
+		__sync_fetch_and_add(&slot->count, 1);
+		__sync_fetch_and_add(&slot->wait_us, task->wait_us);
+		__sync_fetch_and_add(&slot->exec_us, task->exec_us);
+		max = slot->max_exec_us;
+		while (task->exec_us > max
+			&& !__sync_bool_compare_and_swap(&slot->max_exec_us, max, task->exec_us)) {
+			max = slot->max_exec_us;
+		}
+		return;
+	}
+	/* The neighbourhood of the callsite is full, its tasks go uncounted. */
+#endif
+}
+
+/*!
+ * \brief Execute a task and free it
+ *
+ * \param t The task
+ * \param local_data The taskprocessor's local data, for tasks that want it
+ * \param[out] times How long the task waited and executed
+ */
+static void tps_task_execute(struct tps_task *t, void *local_data, struct tps_task_times *times)
 {
 	struct ast_taskprocessor_local local;
+	struct timeval start;
+	unsigned int scratch;
+	int64_t us;
+
+	AST_LATENCY_END(AST_LATENCY_TASKPROCESSOR_WAIT, t->queued);
+	scratch = ast_str_scratch_mark();
+	start = ast_tvnow();
+	us = ast_tvdiff_us(start, t->queued);
+	times->wait_us = MAX(us, 0);
+
+	if (t->wants_local) {
+		local.local_data = local_data;
+		local.data = t->datap;
+		t->callback.execute_local(&local);
+	} else {
+		t->callback.execute(t->datap);
+	}
+	ast_str_scratch_reclaim(scratch);
+
+	us = ast_tvdiff_us(ast_tvnow(), start);
+	times->exec_us = MAX(us, 0);
+	tps_callsite_add(t->callsite, times);
+
+	tps_task_free(t);
+}
+
+#ifdef TPS_HAVE_MPSC_QUEUE
+/*! \brief ast_taskprocessor_execute() for a taskprocessor using the lock-free queue */
+static int taskprocessor_execute_mpsc(struct ast_taskprocessor *tps)
+{
+	struct tps_task_times times;
+	struct tps_task *t;
+	long size;
+	int remaining;
+
+	/* Nothing can be executing here so pending only counts queued tasks. */
+	if (!__atomic_load_n(&tps->mpsc->pending, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	/* The task has been counted, wait for its producer to finish linking it. */
+	while (!(t = tps_mpsc_pop(tps->mpsc))) {
+		sched_yield();
+	}
+
+	size = __atomic_sub_fetch(&tps->tps_queue_size, 1, __ATOMIC_RELAXED);
+	if (tps->high_water_alert && size <= tps->tps_queue_low) {
+		ao2_lock(tps);
+		if (tps->high_water_alert && ast_taskprocessor_size(tps) <= tps->tps_queue_low) {
+			tps->high_water_alert = 0;
+			tps_alert_add(tps, -1);
+		}
+		ao2_unlock(tps);
+	}
+
+	__atomic_store_n(&tps->thread, pthread_self(), __ATOMIC_RELEASE);
+
+	/* local_data is only changed before the taskprocessor is started */
+	tps_task_execute(t, tps->local_data, &times);
+
+	__atomic_store_n(&tps->thread, AST_PTHREADT_NULL, __ATOMIC_RELEASE);
+	remaining = __atomic_sub_fetch(&tps->mpsc->pending, 1, __ATOMIC_ACQ_REL);
+
+	/* Only this thread updates the stats, the CLI tolerates a stale read. */
+	if (tps->stats) {
+		++tps->stats->_tasks_processed_count;
+		tps_times_add(&tps->stats->times, &times);
+		if (remaining >= tps->stats->max_qsize) {
+			tps->stats->max_qsize = remaining + 1;
+		}
+	}
+
+	if (!remaining && tps->listener->callbacks->emptied) {
+		tps->listener->callbacks->emptied(tps->listener);
+	}
+	return remaining > 0;
+}
+#endif
+
+int ast_taskprocessor_execute(struct ast_taskprocessor *tps)
+{
+	struct tps_task_times times;
 	struct tps_task *t;
+	void *local_data;
 	long size;
 
+#ifdef TPS_HAVE_MPSC_QUEUE
+	if (tps->mpsc) {
+		return taskprocessor_execute_mpsc(tps);
+	}
+#endif
+
 	ao2_lock(tps);
 	t = tps_taskprocessor_pop(tps);
 	if (!t) {
@@ -952,19 +1602,10 @@ int ast_taskprocessor_execute(struct ast_taskprocessor *tps)
 
 	tps->thread = pthread_self();
 	tps->executing = 1;
-
-	if (t->wants_local) {
-		local.local_data = tps->local_data;
-		local.data = t->datap;
-	}
+	local_data = tps->local_data;
 	ao2_unlock(tps);
 
-	if (t->wants_local) {
-		t->callback.execute_local(&local);
-	} else {
-		t->callback.execute(t->datap);
-	}
-	tps_task_free(t);
+	tps_task_execute(t, local_data, &times);
 
 	ao2_lock(tps);
 	tps->thread = AST_PTHREADT_NULL;
@@ -978,6 +1619,7 @@ int ast_taskprocessor_execute(struct ast_taskprocessor *tps)
 	/* Update the stats */
 	if (tps->stats) {
 		++tps->stats->_tasks_processed_count;
+		tps_times_add(&tps->stats->times, &times);
 
 		/* Include the task we just executed as part of the queue size. */
 		if (size >= tps->stats->max_qsize) {
@@ -993,10 +1635,107 @@ int ast_taskprocessor_execute(struct ast_taskprocessor *tps)
 	return size > 0;
 }
 
+int ast_taskprocessor_execute_batch(struct ast_taskprocessor *tps, unsigned int max_tasks, unsigned int max_usec)
+{
+	AST_LIST_HEAD_NOLOCK(, tps_task) batch = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
+	struct ast_taskprocessor_times batch_times = { 0, };
+	struct tps_task_times times;
+	struct tps_task *t;
+	struct timeval start = { 0, };
+	void *local_data;
+	unsigned int popped = 0;
+	unsigned int executed = 0;
+	long peak;
+	long size;
+
+#ifdef TPS_HAVE_MPSC_QUEUE
+	if (tps->mpsc) {
+		int more;
+
+		/* The lock-free queue never takes the lock so there is nothing to batch. */
+		if (max_usec) {
+			start = ast_tvnow();
+		}
+		do {
+			more = taskprocessor_execute_mpsc(tps);
+		} while (more && (!max_tasks || ++executed < max_tasks)
+			&& (!max_usec || ast_tvdiff_us(ast_tvnow(), start) < max_usec));
+		return more;
+	}
+#endif
+
+	ao2_lock(tps);
+	peak = tps->tps_queue_size;
+	while ((!max_tasks || popped < max_tasks) && (t = tps_taskprocessor_pop(tps))) {
+		AST_LIST_INSERT_TAIL(&batch, t, list);
+		++popped;
+	}
+	if (!popped) {
+		ao2_unlock(tps);
+		return 0;
+	}
+
+	tps->thread = pthread_self();
+	tps->executing = 1;
+	local_data = tps->local_data;
+	ao2_unlock(tps);
+
+	if (max_usec) {
+		start = ast_tvnow();
+	}
+	while ((t = AST_LIST_REMOVE_HEAD(&batch, list))) {
+		tps_task_execute(t, local_data, &times);
+		tps_times_add(&batch_times, &times);
+		++executed;
+
+		if (max_usec && !AST_LIST_EMPTY(&batch)
+			&& ast_tvdiff_us(ast_tvnow(), start) >= max_usec) {
+			break;
+		}
+	}
+
+	ao2_lock(tps);
+	if (executed < popped) {
+		/* Put the tasks we ran out of time for back in front of any new ones. */
+		AST_LIST_APPEND_LIST(&batch, &tps->tps_queue, list);
+		AST_LIST_APPEND_LIST(&tps->tps_queue, &batch, list);
+		tps->tps_queue_size += popped - executed;
+	}
+	tps->thread = AST_PTHREADT_NULL;
+	/* See ast_taskprocessor_execute() for why this is checked while locked. */
+	tps->executing = 0;
+	size = ast_taskprocessor_size(tps);
+
+	if (tps->stats) {
+		tps->stats->_tasks_processed_count += executed;
+		tps_times_merge(&tps->stats->times, &batch_times);
+
+		/* Include the tasks we just executed as part of the queue size. */
+		if (size + 1 > peak) {
+			peak = size + 1;
+		}
+		if (peak > tps->stats->max_qsize) {
+			tps->stats->max_qsize = peak;
+		}
+	}
+	ao2_unlock(tps);
+
+	if (size == 0 && tps->listener->callbacks->emptied) {
+		tps->listener->callbacks->emptied(tps->listener);
+	}
+	return size > 0;
+}
+
 int ast_taskprocessor_is_task(struct ast_taskprocessor *tps)
 {
 	int is_task;
 
+#ifdef TPS_HAVE_MPSC_QUEUE
+	if (tps->mpsc) {
+		return pthread_equal(__atomic_load_n(&tps->thread, __ATOMIC_ACQUIRE), pthread_self());
+	}
+#endif
+
 	ao2_lock(tps);
 	is_task = pthread_equal(tps->thread, pthread_self());
 	ao2_unlock(tps);
@@ -51,6 +51,34 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/astobj2.h"
 #include "asterisk/pbx.h"
 #include "asterisk/app.h"
+#include "asterisk/threadpool.h"
+
+#ifdef DO_SSL
+#include <openssl/rand.h>
+#endif
+
+/*! \brief Seconds a client can resume a TLS session for */
+#define TLS_SESSION_TIMEOUT 3600
+
+AST_MUTEX_DEFINE_STATIC(handshake_stats_lock);
+static struct ast_tcptls_handshake_stats handshake_stats;
+
+#ifdef DO_SSL
+/*!
+ * \brief Keys of the session tickets issued by every server
+ *
+ * Generated once, so a ticket can be used on any listener and after
+ * a reload has replaced the SSL_CTX that issued it.
+ */
+static unsigned char ticket_keys[48];
+static int ticket_keys_ok;
+static pthread_once_t ticket_keys_once = PTHREAD_ONCE_INIT;
+
+static void ticket_keys_init(void)
+{
+	ticket_keys_ok = RAND_bytes(ticket_keys, sizeof(ticket_keys)) == 1;
+}
+#endif
 
 /*! ao2 object used for the FILE stream fopencookie()/funopen() cookie. */
 struct ast_tcptls_stream {
@@ -637,8 +665,32 @@ static int check_tcptls_cert_name(ASN1_STRING *cert_str, const char *hostname, c
 	return ret;
 }
 
+/*! \brief Count a handshake that started at start */
+static void handshake_stats_update(SSL *ssl, int completed, struct timeval start)
+{
+	int64_t elapsed = ast_tvdiff_us(ast_tvnow(), start);
+
+	ast_mutex_lock(&handshake_stats_lock);
+	if (completed) {
+		++handshake_stats.completed;
+		if (SSL_session_reused(ssl)) {
+			++handshake_stats.resumed;
+		}
+		handshake_stats.total_us += MAX(elapsed, 0);
+	} else {
+		++handshake_stats.failed;
+	}
+	ast_mutex_unlock(&handshake_stats_lock);
+}
 #endif
 
+void ast_tcptls_handshake_stats_get(struct ast_tcptls_handshake_stats *stats)
+{
+	ast_mutex_lock(&handshake_stats_lock);
+	*stats = handshake_stats;
+	ast_mutex_unlock(&handshake_stats_lock);
+}
+
 /*! \brief
 * creates a FILE * from the fd passed by the accept thread.
 * This operation is potentially expensive (certificate verification),
@@ -687,8 +739,12 @@ static void *handle_tcptls_connection(void *data)
 	}
 #ifdef DO_SSL
 	else if ( (tcptls_session->ssl = SSL_new(tcptls_session->parent->tls_cfg->ssl_ctx)) ) {
+		struct timeval start = ast_tvnow();
+
 		SSL_set_fd(tcptls_session->ssl, tcptls_session->fd);
-		if ((ret = ssl_setup(tcptls_session->ssl)) <= 0) {
+		ret = ssl_setup(tcptls_session->ssl);
+		handshake_stats_update(tcptls_session->ssl, ret > 0, start);
+		if (ret <= 0) {
 			char err[256];
 			int sslerr = SSL_get_error(tcptls_session->ssl, ret);
 
@@ -796,6 +852,13 @@ static void *handle_tcptls_connection(void *data)
 	}
 }
 
+/*! \brief Threadpool task handling an accepted connection */
+static int handle_tcptls_connection_task(void *data)
+{
+	handle_tcptls_connection(data);
+	return 0;
+}
+
 void *ast_tcptls_server_root(void *data)
 {
 	struct ast_tcptls_session_args *desc = data;
@@ -852,7 +915,13 @@ void *ast_tcptls_server_root(void *data)
 		tcptls_session->client = 0;
 
 		/* This thread is now the only place that controls the single ref to tcptls_session */
-		if (ast_pthread_create_detached_background(&launched, NULL, handle_tcptls_connection, tcptls_session)) {
+		if (desc->worker_pool) {
+			if (ast_threadpool_push(desc->worker_pool, handle_tcptls_connection_task, tcptls_session)) {
+				ast_log(LOG_ERROR, "TCP/TLS unable to queue connection to %s\n", desc->name);
+				ast_tcptls_close_session_file(tcptls_session);
+				ao2_ref(tcptls_session, -1);
+			}
+		} else if (ast_pthread_create_detached_background(&launched, NULL, handle_tcptls_connection, tcptls_session)) {
 			ast_log(LOG_ERROR, "TCP/TLS unable to launch helper thread: %s\n",
 				strerror(errno));
 			ast_tcptls_close_session_file(tcptls_session);
@@ -871,6 +940,35 @@ void *ast_tcptls_server_root(void *data)
 	return NULL;
 }
 
+#ifdef DO_SSL
+/*!
+ * \brief Let clients of a server resume their TLS sessions
+ *
+ * A session is only resumed on servers with the same certificates and
+ * verification of clients, which the session id context is a hash of.
+ */
+static void ssl_session_cache_setup(struct ast_tls_config *cfg)
+{
+	struct ast_str *id = ast_str_alloca(1024);
+	char hash[41];
+
+	ast_str_set(&id, 0, "%s:%s:%s:%s:%s:%d", S_OR(cfg->certfile, ""),
+		S_OR(cfg->pvtfile, ""), S_OR(cfg->cafile, ""), S_OR(cfg->capath, ""),
+		S_OR(cfg->cipher, ""), ast_test_flag(&cfg->flags, AST_SSL_VERIFY_CLIENT) ? 1 : 0);
+	ast_sha1_hash(hash, ast_str_buffer(id));
+	SSL_CTX_set_session_id_context(cfg->ssl_ctx, (unsigned char *) hash, SSL_MAX_SID_CTX_LENGTH);
+	SSL_CTX_set_session_cache_mode(cfg->ssl_ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_timeout(cfg->ssl_ctx, TLS_SESSION_TIMEOUT);
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEYS
+	pthread_once(&ticket_keys_once, ticket_keys_init);
+	if (ticket_keys_ok) {
+		SSL_CTX_set_tlsext_ticket_keys(cfg->ssl_ctx, ticket_keys, sizeof(ticket_keys));
+	}
+#endif
+}
+#endif
+
 static int __ssl_setup(struct ast_tls_config *cfg, int client)
 {
 #ifndef DO_SSL
@@ -1035,6 +1133,10 @@ static int __ssl_setup(struct ast_tls_config *cfg, int client)
 
 #endif /* #ifdef HAVE_OPENSSL_EC */
 
+	if (!client) {
+		ssl_session_cache_setup(cfg);
+	}
+
 	ast_verb(2, "TLS/SSL certificate ok\n");	/* We should log which one that is ok. This message doesn't really make sense in production use */
 	return 1;
 #endif
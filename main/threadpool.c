@@ -23,10 +23,38 @@
 #include "asterisk/taskprocessor.h"
 #include "asterisk/astobj2.h"
 #include "asterisk/utils.h"
+#include "asterisk/dlinkedlists.h"
 
 /* Needs to stay prime if increased */
 #define THREAD_BUCKETS 89
 
+/*! Maximum number of run queues in a work stealing threadpool */
+#define WS_MAX_LANES 64
+
+/*! Milliseconds a work stealing worker waits for a serializer before going idle */
+#define WS_LINGER_MS 20
+
+struct serializer;
+
+/*!
+ * \brief A run queue of a work stealing threadpool
+ *
+ * Serializers with tasks queue themselves on their home lane.  Workers
+ * of the lane take serializers from its head, other workers that have
+ * run out of work steal them from its tail.
+ */
+struct ws_lane {
+	ast_mutex_t lock;
+	/*! Signalled when a serializer is queued or the pool shuts down */
+	ast_cond_t cond;
+	/*! Serializers waiting for a worker */
+	AST_DLLIST_HEAD_NOLOCK(, serializer) queue;
+	/*! Number of serializers queued.  Read without the lock to look for work. */
+	int queued;
+	/*! Number of workers waiting on cond */
+	int waiting;
+};
+
 /*!
  * \brief An opaque threadpool structure
  *
@@ -98,6 +126,12 @@ struct ast_threadpool {
 	int shutting_down;
 	/*! Threadpool-specific options */
 	struct ast_threadpool_options options;
+	/*! Run queues of serializers, if the pool is work stealing */
+	struct ws_lane *lanes;
+	/*! Number of lanes */
+	unsigned int num_lanes;
+	/*! Home lane of the next serializer created */
+	int next_lane;
 };
 
 /*!
@@ -157,6 +191,8 @@ struct worker_thread {
 	int wake_up;
 	/*! Options for this threadpool */
 	struct ast_threadpool_options options;
+	/*! The lane this worker takes serializers from first, if the pool is work stealing */
+	unsigned int lane;
 };
 
 /* Worker thread forward declarations. See definitions for documentation */
@@ -171,6 +207,13 @@ static int worker_idle(struct worker_thread *worker);
 static int worker_set_state(struct worker_thread *worker, enum worker_state state);
 static void worker_shutdown(struct worker_thread *worker);
 
+/* Work stealing forward declarations. See definitions for documentation */
+static int ws_wake_any(struct ast_threadpool *pool, unsigned int start);
+static void ws_wake_all(struct ast_threadpool *pool);
+static void ws_lanes_drain(struct ast_threadpool *pool);
+static int ws_execute(struct worker_thread *worker);
+static int ws_linger(struct worker_thread *worker);
+
 /*!
  * \brief Notify the threadpool listener that the state has changed.
  *
@@ -370,7 +413,42 @@ static int threadpool_execute(struct ast_threadpool *pool)
 static void threadpool_destructor(void *obj)
 {
 	struct ast_threadpool *pool = obj;
+	unsigned int i;
+
 	ao2_cleanup(pool->listener);
+
+	for (i = 0; i < pool->num_lanes; ++i) {
+		ast_mutex_destroy(&pool->lanes[i].lock);
+		ast_cond_destroy(&pool->lanes[i].cond);
+	}
+	ast_free(pool->lanes);
+}
+
+/*!
+ * \brief Allocate the lanes of a work stealing threadpool
+ *
+ * There is a lane for each thread the pool may have, up to WS_MAX_LANES.
+ *
+ * \param pool The threadpool
+ * \retval 0 success
+ * \retval -1 failure
+ */
+static int threadpool_lanes_alloc(struct ast_threadpool *pool)
+{
+	unsigned int num_lanes = pool->options.max_size ?: pool->options.initial_size;
+	unsigned int i;
+
+	num_lanes = MAX(1, MIN(num_lanes, WS_MAX_LANES));
+	pool->lanes = ast_calloc(num_lanes, sizeof(*pool->lanes));
+	if (!pool->lanes) {
+		return -1;
+	}
+	for (i = 0; i < num_lanes; ++i) {
+		ast_mutex_init(&pool->lanes[i].lock);
+		ast_cond_init(&pool->lanes[i].cond, NULL);
+	}
+	pool->num_lanes = num_lanes;
+	return 0;
 }
 
 /*
@@ -417,6 +495,9 @@ static struct ast_threadpool *threadpool_alloc(const char *name, const struct as
 		return NULL;
 	}
 	pool->options = *options;
+	if (options->work_stealing && threadpool_lanes_alloc(pool)) {
+		return NULL;
+	}
 
 	ao2_ref(pool, +1);
 	return pool;
@@ -662,6 +743,8 @@ static void threadpool_tps_shutdown(struct ast_taskprocessor_listener *listener)
 	ao2_cleanup(pool->active_threads);
 	ao2_cleanup(pool->idle_threads);
 	ao2_cleanup(pool->zombie_threads);
+	/* Queued serializers hold references that lead back to the pool */
+	ws_lanes_drain(pool);
 	ao2_cleanup(pool);
 }
 
@@ -891,6 +974,11 @@ struct ast_threadpool *ast_threadpool_create(const char *name,
 	RAII_VAR(struct ast_taskprocessor_listener *, tps_listener, NULL, ao2_cleanup);
 	RAII_VAR(struct ast_threadpool *, pool, NULL, ao2_cleanup);
 
+	if (options->version != AST_THREADPOOL_OPTIONS_VERSION) {
+		ast_log(LOG_WARNING, "Incompatible version of threadpool options in use.\n");
+		return NULL;
+	}
+
 	pool = threadpool_alloc(name, options);
 	if (!pool) {
 		return NULL;
@@ -901,11 +989,6 @@ struct ast_threadpool *ast_threadpool_create(const char *name,
 		return NULL;
 	}
 
-	if (options->version != AST_THREADPOOL_OPTIONS_VERSION) {
-		ast_log(LOG_WARNING, "Incompatible version of threadpool options in use.\n");
-		return NULL;
-	}
-
 	tps = ast_taskprocessor_create_with_listener(name, tps_listener);
 	if (!tps) {
 		return NULL;
@@ -921,13 +1004,22 @@ struct ast_threadpool *ast_threadpool_create(const char *name,
 	return pool;
 }
 
-int ast_threadpool_push(struct ast_threadpool *pool, int (*task)(void *data), void *data)
+int __ast_threadpool_push(struct ast_threadpool *pool, int (*task)(void *data), void *data,
+	const char *callsite)
 {
-	SCOPED_AO2LOCK(lock, pool);
+	int res = -1;
+
+	ao2_lock(pool);
 	if (!pool->shutting_down) {
-		return ast_taskprocessor_push(pool->tps, task, data);
+		res = __ast_taskprocessor_push(pool->tps, task, data, callsite);
+	}
+	ao2_unlock(pool);
+
+	if (!res && pool->lanes) {
+		/* A worker waiting for serializers can take the task sooner than an idle one */
+		ws_wake_any(pool, 0);
 	}
-	return -1;
+	return res;
 }
 
 void ast_threadpool_shutdown(struct ast_threadpool *pool)
@@ -941,6 +1033,7 @@ void ast_threadpool_shutdown(struct ast_threadpool *pool)
 	ao2_lock(pool);
 	pool->shutting_down = 1;
 	ao2_unlock(pool);
+	ws_wake_all(pool);
 	ast_taskprocessor_unreference(pool->control_tps);
 	ast_taskprocessor_unreference(pool->tps);
 }
@@ -1071,6 +1164,9 @@ static struct worker_thread *worker_thread_alloc(struct ast_threadpool *pool)
 	worker->thread = AST_PTHREADT_NULL;
 	worker->state = ALIVE;
 	worker->options = pool->options;
+	if (pool->num_lanes) {
+		worker->lane = worker->id % pool->num_lanes;
+	}
 	return worker;
 }
 
@@ -1093,6 +1189,16 @@ static void worker_active(struct worker_thread *worker)
 {
 	int alive;
 
+	if (worker->pool->lanes) {
+		int ran;
+
+		do {
+			ran = ws_execute(worker);
+			alive = threadpool_execute(worker->pool);
+		} while (ran || alive || ws_linger(worker));
+		return;
+	}
+
 	/* The following is equivalent to 
 	 *
 	 * while (threadpool_execute(worker->pool));
@@ -1285,6 +1391,11 @@ struct serializer {
 	struct ast_threadpool *pool;
 	/*! Which group will wait for this serializer to shutdown. */
 	struct ast_serializer_shutdown_group *shutdown_group;
+	/*! Lane the serializer is queued on, if the pool is work stealing */
+	unsigned int home_lane;
+	/*! Reference to the serializer's taskprocessor while it is queued on a lane */
+	struct ast_taskprocessor *queued_tps;
+	AST_DLLIST_ENTRY(serializer) lane_entry;
 };
 
 static void serializer_dtor(void *obj)
@@ -1309,17 +1420,23 @@ static struct serializer *serializer_create(struct ast_threadpool *pool,
 	ao2_ref(pool, +1);
 	ser->pool = pool;
 	ser->shutdown_group = ao2_bump(shutdown_group);
+	if (pool->num_lanes) {
+		ser->home_lane = (unsigned int) ast_atomic_fetchadd_int(&pool->next_lane, 1) % pool->num_lanes;
+	}
 	return ser;
 }
 
 AST_THREADSTORAGE_RAW(current_serializer);
 
+/*! Maximum number of serializer tasks executed per queue lock */
+#define SERIALIZER_BATCH_TASKS 32
+
 static int execute_tasks(void *data)
 {
 	struct ast_taskprocessor *tps = data;
 
 	ast_threadstorage_set_ptr(&current_serializer, tps);
-	while (ast_taskprocessor_execute(tps)) {
+	while (ast_taskprocessor_execute_batch(tps, SERIALIZER_BATCH_TASKS, 0)) {
 		/* No-op */
 	}
 	ast_threadstorage_set_ptr(&current_serializer, NULL);
@@ -1328,13 +1445,231 @@ static int execute_tasks(void *data)
 	return 0;
 }
 
+/*!
+ * \brief Task pushed to have the pool activate or add a worker for a queued serializer
+ */
+static int ws_kick(void *data)
+{
+	return 0;
+}
+
+/*!
+ * \brief Wake a worker waiting for serializers
+ *
+ * \param pool The work stealing threadpool
+ * \param start The lane to look on first
+ * \retval 1 A worker was woken
+ * \retval 0 No worker is waiting
+ */
+static int ws_wake_any(struct ast_threadpool *pool, unsigned int start)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->num_lanes; ++i) {
+		struct ws_lane *lane = &pool->lanes[(start + i) % pool->num_lanes];
+		int woke = 0;
+
+		if (!lane->waiting) {
+			continue;
+		}
+		ast_mutex_lock(&lane->lock);
+		if (lane->waiting) {
+			ast_cond_signal(&lane->cond);
+			woke = 1;
+		}
+		ast_mutex_unlock(&lane->lock);
+		if (woke) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * \brief Wake every worker waiting for serializers so they notice shutdown
+ */
+static void ws_wake_all(struct ast_threadpool *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->num_lanes; ++i) {
+		ast_mutex_lock(&pool->lanes[i].lock);
+		ast_cond_broadcast(&pool->lanes[i].cond);
+		ast_mutex_unlock(&pool->lanes[i].lock);
+	}
+}
+
+/*!
+ * \brief Queue a serializer with tasks on its home lane
+ *
+ * \param pool The work stealing threadpool
+ * \param ser The serializer
+ * \param tps The serializer's taskprocessor.  The reference is
+ * released once the serializer has been run.
+ *
+ * \retval 0 success
+ * \retval -1 the pool is shutting down
+ */
+static int ws_push(struct ast_threadpool *pool, struct serializer *ser, struct ast_taskprocessor *tps)
+{
+	struct ws_lane *lane = &pool->lanes[ser->home_lane];
+	int waiting;
+
+	ast_mutex_lock(&lane->lock);
+	if (pool->shutting_down) {
+		ast_mutex_unlock(&lane->lock);
+		return -1;
+	}
+	ser->queued_tps = tps;
+	AST_DLLIST_INSERT_TAIL(&lane->queue, ser, lane_entry);
+	++lane->queued;
+	waiting = lane->waiting;
+	if (waiting) {
+		ast_cond_signal(&lane->cond);
+	}
+	ast_mutex_unlock(&lane->lock);
+
+	if (!waiting && !ws_wake_any(pool, ser->home_lane + 1)) {
+		/*
+		 * Every worker is busy or idle.  Busy ones look at the lanes
+		 * when they finish, but only the pool can wake idle ones.
+		 */
+		ast_threadpool_push(pool, ws_kick, NULL);
+	}
+	return 0;
+}
+
+/*!
+ * \brief Take a serializer from the head of a lane
+ *
+ * \param lane The lane
+ * \param steal Take it from the tail instead
+ */
+static struct serializer *ws_take(struct ws_lane *lane, int steal)
+{
+	struct serializer *ser;
+
+	if (!lane->queued) {
+		return NULL;
+	}
+	ast_mutex_lock(&lane->lock);
+	if (steal) {
+		ser = AST_DLLIST_REMOVE_TAIL(&lane->queue, lane_entry);
+	} else {
+		ser = AST_DLLIST_REMOVE_HEAD(&lane->queue, lane_entry);
+	}
+	if (ser) {
+		--lane->queued;
+	}
+	ast_mutex_unlock(&lane->lock);
+	return ser;
+}
+
+/*!
+ * \brief Run a serializer from the worker's lane, or one stolen from another lane
+ *
+ * \param worker The worker thread
+ * \retval 1 A serializer was run
+ * \retval 0 No lane has a serializer queued
+ */
+static int ws_execute(struct worker_thread *worker)
+{
+	struct ast_threadpool *pool = worker->pool;
+	struct serializer *ser = ws_take(&pool->lanes[worker->lane], 0);
+	struct ast_taskprocessor *tps;
+	unsigned int i;
+
+	for (i = 1; !ser && i < pool->num_lanes; ++i) {
+		ser = ws_take(&pool->lanes[(worker->lane + i) % pool->num_lanes], 1);
+	}
+	if (!ser) {
+		return 0;
+	}
+
+	/* The serializer may be queued again once its tasks are run */
+	tps = ser->queued_tps;
+	ser->queued_tps = NULL;
+	execute_tasks(tps);
+	return 1;
+}
+
+/*!
+ * \brief Check if a worker of a work stealing pool has anything to do
+ */
+static int ws_has_work(struct ast_threadpool *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->num_lanes; ++i) {
+		if (pool->lanes[i].queued) {
+			return 1;
+		}
+	}
+	return ast_taskprocessor_size(pool->tps) > 0;
+}
+
+/*!
+ * \brief Wait briefly on the worker's lane before going idle
+ *
+ * Serializers often get more tasks shortly after running out of them.
+ * Waiting for them here is much cheaper than going idle and having the
+ * pool activate the worker again.
+ *
+ * \param worker The worker thread
+ * \retval 1 There is work to do
+ * \retval 0 The worker should go idle
+ */
+static int ws_linger(struct worker_thread *worker)
+{
+	struct ast_threadpool *pool = worker->pool;
+	struct ws_lane *lane = &pool->lanes[worker->lane];
+	struct timeval wait = ast_tvadd(ast_tvnow(), ast_samp2tv(WS_LINGER_MS, 1000));
+	struct timespec end = {
+		.tv_sec = wait.tv_sec,
+		.tv_nsec = wait.tv_usec * 1000,
+	};
+
+	ast_mutex_lock(&lane->lock);
+	if (!pool->shutting_down && !ws_has_work(pool)) {
+		++lane->waiting;
+		ast_cond_timedwait(&lane->cond, &lane->lock, &end);
+		--lane->waiting;
+	}
+	ast_mutex_unlock(&lane->lock);
+
+	return !pool->shutting_down && ws_has_work(pool);
+}
+
+/*!
+ * \brief Release the serializers still queued on the lanes of a pool being destroyed
+ */
+static void ws_lanes_drain(struct ast_threadpool *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->num_lanes; ++i) {
+		struct serializer *ser;
+
+		while ((ser = ws_take(&pool->lanes[i], 0))) {
+			struct ast_taskprocessor *tps = ser->queued_tps;
+
+			ser->queued_tps = NULL;
+			ast_taskprocessor_unreference(tps);
+		}
+	}
+}
+
 static void serializer_task_pushed(struct ast_taskprocessor_listener *listener, int was_empty)
 {
 	if (was_empty) {
 		struct serializer *ser = ast_taskprocessor_listener_get_user_data(listener);
 		struct ast_taskprocessor *tps = ast_taskprocessor_listener_get_tps(listener);
 
-		if (ast_threadpool_push(ser->pool, execute_tasks, tps)) {
+		if (ser->pool->lanes) {
+			if (ws_push(ser->pool, ser, tps)) {
+				ast_taskprocessor_unreference(tps);
+			}
+		} else if (ast_threadpool_push(ser->pool, execute_tasks, tps)) {
 			ast_taskprocessor_unreference(tps);
 		}
 	}
@@ -1384,6 +1719,8 @@ struct ast_taskprocessor *ast_threadpool_serializer_group(const char *name,
 		ao2_ref(ser, -1);
 		return NULL;
 	}
+	/* Serializer tasks are executed one at a time by the pool */
+	ast_taskprocessor_listener_set_serialized(listener);
 
 	tps = ast_taskprocessor_create_with_listener(name, listener);
 	if (!tps) {
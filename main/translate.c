@@ -45,6 +45,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/term.h"
 #include "asterisk/format.h"
 #include "asterisk/linkedlists.h"
+#include "asterisk/latency.h"
 
 /*! \todo
  * TODO: sample frames for each supported input format.
@@ -99,6 +100,37 @@ static int index_size;
 
 static void matrix_rebuild(int samples);
 
+/*! Number of buckets in the idle translation path cache */
+#define PATH_CACHE_BUCKETS 64
+/*! Maximum number of idle translation paths kept in each bucket */
+#define PATH_CACHE_MAX_IDLE 16
+
+/*! \brief An idle translation path waiting to be reused */
+struct path_cache_entry {
+	int src_index;
+	int dst_index;
+	struct ast_trans_pvt *path;
+};
+
+/*!
+ * \brief A bucket of idle translation paths
+ *
+ * Paths given to ast_translator_free_path() are reset and kept here so
+ * that building the same path again does not need to allocate anything.
+ * Every path in the cache matches the current translation matrix, the
+ * cache is emptied whenever the matrix is rebuilt.
+ *
+ * \note Adding and removing paths is done with the translators list read
+ * locked, emptying the cache with it write locked.
+ */
+struct path_cache_bucket {
+	ast_mutex_t lock;
+	unsigned int count;
+	struct path_cache_entry entries[PATH_CACHE_MAX_IDLE];
+};
+
+static struct path_cache_bucket path_cache[PATH_CACHE_BUCKETS];
+
 /*!
  * \internal
  * \brief converts codec id to index value.
@@ -290,7 +322,27 @@ static struct translator_path *matrix_get(unsigned int x, unsigned int y)
  * wrappers around the translator routines.
  */
 
-static void destroy(struct ast_trans_pvt *pvt)
+/*!
+ * \brief compute the required size of a descriptor adding private
+ * descriptor, buffer, AST_FRIENDLY_OFFSET.
+ */
+static size_t pvt_size(struct ast_translator *t)
+{
+	size_t len = sizeof(struct ast_trans_pvt) + t->desc_size;
+
+	if (t->buf_size) {
+		len += AST_FRIENDLY_OFFSET + t->buf_size;
+	}
+	return len;
+}
+
+/*!
+ * \brief Release everything a descriptor holds except its memory
+ *
+ * Afterwards the descriptor can either be freed or started again with
+ * pvt_start().
+ */
+static void pvt_stop(struct ast_trans_pvt *pvt)
 {
 	struct ast_translator *t = pvt->t;
 
@@ -298,36 +350,31 @@ static void destroy(struct ast_trans_pvt *pvt)
 		t->destroy(pvt);
 	}
 	ao2_cleanup(pvt->f.subclass.format);
+	pvt->f.subclass.format = NULL;
 	if (pvt->explicit_dst) {
 		ao2_ref(pvt->explicit_dst, -1);
 		pvt->explicit_dst = NULL;
 	}
-	ast_free(pvt);
 	ast_module_unref(t->module);
 }
 
+static void destroy(struct ast_trans_pvt *pvt)
+{
+	pvt_stop(pvt);
+	ast_free(pvt);
+}
+
 /*!
- * \brief Allocate the descriptor, required outbuf space,
- * and possibly desc.
+ * \brief Initialize a zeroed descriptor of pvt->t
+ *
+ * \retval 0 on success
+ * \retval -1 on failure, the descriptor only needs to be freed
  */
-static struct ast_trans_pvt *newpvt(struct ast_translator *t, struct ast_format *explicit_dst)
+static int pvt_start(struct ast_trans_pvt *pvt, struct ast_format *explicit_dst)
 {
-	struct ast_trans_pvt *pvt;
-	int len;
+	struct ast_translator *t = pvt->t;
 	char *ofs;
 
-	/*
-	 * compute the required size adding private descriptor,
-	 * buffer, AST_FRIENDLY_OFFSET.
-	 */
-	len = sizeof(*pvt) + t->desc_size;
-	if (t->buf_size)
-		len += AST_FRIENDLY_OFFSET + t->buf_size;
-	pvt = ast_calloc(1, len);
-	if (!pvt) {
-		return NULL;
-	}
-	pvt->t = t;
 	ofs = (char *)(pvt + 1);	/* pointer to data space */
 	if (t->desc_size) {		/* first comes the descriptor */
 		pvt->pvt = ofs;
@@ -347,9 +394,10 @@ static struct ast_trans_pvt *newpvt(struct ast_translator *t, struct ast_format
 
 	/* call local init routine, if present */
 	if (t->newpvt && t->newpvt(pvt)) {
-		ast_free(pvt);
+		ao2_cleanup(pvt->explicit_dst);
+		pvt->explicit_dst = NULL;
 		ast_module_unref(t->module);
-		return NULL;
+		return -1;
 	}
 
 	/* Setup normal static translation frame. */
@@ -377,8 +425,8 @@ static struct ast_trans_pvt *newpvt(struct ast_translator *t, struct ast_format
 				t->dst_codec.type, t->dst_codec.sample_rate);
 			if (!codec) {
 				ast_log(LOG_ERROR, "Unable to get destination codec\n");
-				destroy(pvt);
-				return NULL;
+				pvt_stop(pvt);
+				return -1;
 			}
 			pvt->f.subclass.format = ast_format_create(codec);
 			ao2_ref(codec, -1);
@@ -386,11 +434,32 @@ static struct ast_trans_pvt *newpvt(struct ast_translator *t, struct ast_format
 
 		if (!pvt->f.subclass.format) {
 			ast_log(LOG_ERROR, "Unable to create format\n");
-			destroy(pvt);
-			return NULL;
+			pvt_stop(pvt);
+			return -1;
 		}
 	}
 
+	return 0;
+}
+
+/*!
+ * \brief Allocate the descriptor, required outbuf space,
+ * and possibly desc.
+ */
+static struct ast_trans_pvt *newpvt(struct ast_translator *t, struct ast_format *explicit_dst)
+{
+	struct ast_trans_pvt *pvt;
+
+	pvt = ast_calloc(1, pvt_size(t));
+	if (!pvt) {
+		return NULL;
+	}
+	pvt->t = t;
+	if (pvt_start(pvt, explicit_dst)) {
+		ast_free(pvt);
+		return NULL;
+	}
+
 	return pvt;
 }
 
@@ -399,6 +468,12 @@ static int framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 {
 	/* Copy the last in jb timing info to the pvt */
 	ast_copy_flags(&pvt->f, f, AST_FRFLAG_HAS_TIMING_INFO);
+	/* Output is silence only if all of the input buffered for it was */
+	if (!pvt->samples) {
+		ast_copy_flags(&pvt->f, f, AST_FRFLAG_SILENCE);
+	} else if (!ast_test_flag(f, AST_FRFLAG_SILENCE)) {
+		ast_clear_flag(&pvt->f, AST_FRFLAG_SILENCE);
+	}
 	pvt->f.ts = f->ts;
 	pvt->f.len = f->len;
 	pvt->f.seqno = f->seqno;
@@ -465,9 +540,156 @@ static struct ast_frame *default_frameout(struct ast_trans_pvt *pvt)
 
 /* end of callback wrappers and helpers */
 
+/*! \brief The format, if any, a translation step must produce when building a path to dst */
+static struct ast_format *step_explicit_dst(struct ast_translator *t, struct ast_format *dst)
+{
+	if ((t->dst_codec.sample_rate == ast_format_get_sample_rate(dst)) && (t->dst_codec.type == ast_format_get_type(dst))) {
+		return dst;
+	}
+	return NULL;
+}
+
+static struct path_cache_bucket *path_cache_bucket_get(int src_index, int dst_index)
+{
+	return &path_cache[(src_index * 31 + dst_index) % PATH_CACHE_BUCKETS];
+}
+
+/*! \brief Free the memory of an idle path, its descriptors have already been stopped */
+static void path_cache_free(struct ast_trans_pvt *p)
+{
+	struct ast_trans_pvt *pn;
+
+	for (; p; p = pn) {
+		pn = p->next;
+		ast_free(p);
+	}
+}
+
+/*!
+ * \brief Empty the idle translation path cache
+ *
+ * \note Must be called with the translators list write locked.
+ */
+static void path_cache_flush(void)
+{
+	int x;
+
+	for (x = 0; x < PATH_CACHE_BUCKETS; ++x) {
+		struct path_cache_bucket *bucket = &path_cache[x];
+
+		ast_mutex_lock(&bucket->lock);
+		while (bucket->count) {
+			path_cache_free(bucket->entries[--bucket->count].path);
+		}
+		ast_mutex_unlock(&bucket->lock);
+	}
+}
+
+/*!
+ * \brief Reset a translation path and keep it for reuse
+ *
+ * \retval 0 if the path was consumed
+ * \retval -1 if the path does not match the translation matrix any more
+ */
+static int path_cache_put(struct ast_trans_pvt *path)
+{
+	struct path_cache_bucket *bucket;
+	struct ast_trans_pvt *p;
+	int src_index = path->t->src_fmt_index;
+	int dst_index;
+	int cur_index = src_index;
+
+	for (p = path; p->next; p = p->next) {
+	}
+	dst_index = p->t->dst_fmt_index;
+
+	AST_RWLIST_RDLOCK(&translators);
+
+	/* Only paths that ast_translator_build_path() would still build are kept */
+	for (p = path; p; p = p->next) {
+		if (matrix_get(cur_index, dst_index)->step != p->t) {
+			AST_RWLIST_UNLOCK(&translators);
+			return -1;
+		}
+		cur_index = p->t->dst_fmt_index;
+	}
+
+	for (p = path; p; p = p->next) {
+		struct ast_translator *t = p->t;
+		struct ast_trans_pvt *next = p->next;
+
+		pvt_stop(p);
+		memset(p, 0, pvt_size(t));
+		p->t = t;
+		p->next = next;
+	}
+
+	bucket = path_cache_bucket_get(src_index, dst_index);
+	ast_mutex_lock(&bucket->lock);
+	if (bucket->count < PATH_CACHE_MAX_IDLE) {
+		bucket->entries[bucket->count].src_index = src_index;
+		bucket->entries[bucket->count].dst_index = dst_index;
+		bucket->entries[bucket->count].path = path;
+		++bucket->count;
+		path = NULL;
+	}
+	ast_mutex_unlock(&bucket->lock);
+
+	AST_RWLIST_UNLOCK(&translators);
+
+	path_cache_free(path);
+	return 0;
+}
+
+/*!
+ * \brief Reuse an idle translation path
+ *
+ * \note Must be called with the translators list read locked.
+ *
+ * \return The started path or NULL if none was available
+ */
+static struct ast_trans_pvt *path_cache_get(int src_index, int dst_index, struct ast_format *dst)
+{
+	struct path_cache_bucket *bucket = path_cache_bucket_get(src_index, dst_index);
+	struct ast_trans_pvt *path = NULL;
+	struct ast_trans_pvt *p;
+	unsigned int x;
+
+	ast_mutex_lock(&bucket->lock);
+	for (x = bucket->count; x--;) {
+		if (bucket->entries[x].src_index == src_index && bucket->entries[x].dst_index == dst_index) {
+			path = bucket->entries[x].path;
+			bucket->entries[x] = bucket->entries[--bucket->count];
+			break;
+		}
+	}
+	ast_mutex_unlock(&bucket->lock);
+
+	for (p = path; p; p = p->next) {
+		if (pvt_start(p, step_explicit_dst(p->t, dst))) {
+			struct ast_trans_pvt *started;
+
+			ast_log(LOG_WARNING, "Failed to restart translator step from %s to %s\n",
+				p->t->src_codec.name, p->t->dst_codec.name);
+			for (started = path; started != p; started = started->next) {
+				pvt_stop(started);
+			}
+			path_cache_free(path);
+			return NULL;
+		}
+	}
+
+	return path;
+}
+
 void ast_translator_free_path(struct ast_trans_pvt *p)
 {
 	struct ast_trans_pvt *pn = p;
+
+	if (p && !path_cache_put(p)) {
+		return;
+	}
+
 	while ( (p = pn) ) {
 		pn = p->next;
 		destroy(p);
@@ -490,9 +712,14 @@ struct ast_trans_pvt *ast_translator_build_path(struct ast_format *dst, struct a
 
 	AST_RWLIST_RDLOCK(&translators);
 
+	if (src_index != dst_index && (head = path_cache_get(src_index, dst_index, dst))) {
+		AST_RWLIST_UNLOCK(&translators);
+		return head;
+	}
+
 	while (src_index != dst_index) {
 		struct ast_trans_pvt *cur;
-		struct ast_format *explicit_dst = NULL;
+		struct ast_format *explicit_dst;
 		struct ast_translator *t = matrix_get(src_index, dst_index)->step;
 		if (!t) {
 			ast_log(LOG_WARNING, "No translator path from %s to %s\n",
@@ -500,9 +727,7 @@ struct ast_trans_pvt *ast_translator_build_path(struct ast_format *dst, struct a
 			AST_RWLIST_UNLOCK(&translators);
 			return NULL;
 		}
-		if ((t->dst_codec.sample_rate == ast_format_get_sample_rate(dst)) && (t->dst_codec.type == ast_format_get_type(dst))) {
-			explicit_dst = dst;
-		}
+		explicit_dst = step_explicit_dst(t, dst);
 		if (!(cur = newpvt(t, explicit_dst))) {
 			ast_log(LOG_WARNING, "Failed to build translator step from %s to %s\n",
 				ast_format_get_name(src), ast_format_get_name(dst));
@@ -537,7 +762,9 @@ struct ast_frame *ast_translate(struct ast_trans_pvt *path, struct ast_frame *f,
 	long ts;
 	long len;
 	int seqno;
+	AST_LATENCY_DECLARE(start);
 
+	AST_LATENCY_START(start);
 	has_timing_info = ast_test_flag(f, AST_FRFLAG_HAS_TIMING_INFO);
 	ts = f->ts;
 	len = f->len;
@@ -625,6 +852,7 @@ struct ast_frame *ast_translate(struct ast_trans_pvt *path, struct ast_frame *f,
 	if (consume) {
 		ast_frfree(f);
 	}
+	AST_LATENCY_END(AST_LATENCY_TRANSLATE, start);
 	return out;
 }
 
@@ -650,6 +878,12 @@ static void generate_computational_cost(struct ast_translator *t, int seconds)
 		seconds = 1;
 	}
 
+	/* Offload translators know their cost better than the CPU time tells */
+	if (t->fixed_comp_cost) {
+		t->comp_cost = t->fixed_comp_cost;
+		return;
+	}
+
 	/* If they don't make samples, give them a terrible score */
 	if (!t->sample) {
 		ast_debug(3, "Translator '%s' does not produce sample frames.\n", t->name);
@@ -781,6 +1015,8 @@ static void matrix_rebuild(int samples)
 
 	ast_debug(1, "Resetting translation matrix\n");
 
+	/* Idle paths may no longer be the best ones or use translators that are going away */
+	path_cache_flush();
 	matrix_clear();
 
 	/* first, compute all direct costs */
@@ -1509,6 +1745,13 @@ static void translate_shutdown(void)
 	int x;
 	ast_cli_unregister_multiple(cli_translate, ARRAY_LEN(cli_translate));
 
+	AST_RWLIST_WRLOCK(&translators);
+	path_cache_flush();
+	AST_RWLIST_UNLOCK(&translators);
+	for (x = 0; x < PATH_CACHE_BUCKETS; ++x) {
+		ast_mutex_destroy(&path_cache[x].lock);
+	}
+
 	ast_rwlock_wrlock(&tablelock);
 	for (x = 0; x < index_size; x++) {
 		ast_free(__matrix[x]);
@@ -1524,6 +1767,11 @@ static void translate_shutdown(void)
 int ast_translate_init(void)
 {
 	int res = 0;
+	int x;
+
+	for (x = 0; x < PATH_CACHE_BUCKETS; ++x) {
+		ast_mutex_init(&path_cache[x].lock);
+	}
 	ast_rwlock_init(&tablelock);
 	res = matrix_resize(1);
 	res |= ast_cli_register_multiple(cli_translate, ARRAY_LEN(cli_translate));
@@ -468,7 +468,11 @@ static int udptl_rx_packet(struct ast_udptl *s, uint8_t *buf, unsigned int len)
 		/* Our buffers cannot tolerate overlength IFP packets in FEC mode */
 		if (ifp_len > LOCAL_FAX_MAX_DATAGRAM)
 			return -1;
-		/* Update any missed slots in the buffer */
+		/* Update any missed slots in the buffer.  After a long gap every slot
+		   is missed, so there is no need to visit each of them more than once. */
+		if (seq_no > s->rx_seq_no + UDPTL_BUF_MASK) {
+			s->rx_seq_no = seq_no - (UDPTL_BUF_MASK + 1);
+		}
 		for ( ; seq_no > s->rx_seq_no; s->rx_seq_no++) {
 			x = s->rx_seq_no & UDPTL_BUF_MASK;
 			s->rx[x].buf_len = -1;
@@ -544,11 +548,14 @@ static int udptl_rx_packet(struct ast_udptl *s, uint8_t *buf, unsigned int len)
 						which = (which == -1) ? k : -2;
 				}
 				if (which >= 0) {
-					/* Repairable */
-					for (j = 0; j < s->rx[l].fec_len[m]; j++) {
-						s->rx[which].buf[j] = s->rx[l].fec[m][j];
-						for (k = (limit - s->rx[l].fec_span * s->rx[l].fec_entries) & UDPTL_BUF_MASK; k != limit; k = (k + s->rx[l].fec_entries) & UDPTL_BUF_MASK)
-							s->rx[which].buf[j] ^= (s->rx[k].buf_len > j) ? s->rx[k].buf[j] : 0;
+					/* Repairable, XOR each received packet of the set into the FEC
+					   entry in turn.  The missing one has no length so adds nothing. */
+					memcpy(s->rx[which].buf, s->rx[l].fec[m], s->rx[l].fec_len[m]);
+					for (k = (limit - s->rx[l].fec_span * s->rx[l].fec_entries) & UDPTL_BUF_MASK; k != limit; k = (k + s->rx[l].fec_entries) & UDPTL_BUF_MASK) {
+						int common = MIN(s->rx[k].buf_len, (int) s->rx[l].fec_len[m]);
+
+						for (j = 0; j < common; j++)
+							s->rx[which].buf[j] ^= s->rx[k].buf[j];
 					}
 					s->rx[which].buf_len = s->rx[l].fec_len[m];
 					repaired[which] = TRUE;
@@ -603,7 +610,8 @@ static int udptl_rx_packet(struct ast_udptl *s, uint8_t *buf, unsigned int len)
 
 static int udptl_build_packet(struct ast_udptl *s, uint8_t *buf, unsigned int buflen, uint8_t *ifp, unsigned int ifp_len)
 {
-	uint8_t fec[LOCAL_FAX_MAX_DATAGRAM * 2] = { 0, };
+	/* Every byte of an entry is written before it is XOR'ed, see high_tide */
+	uint8_t fec[LOCAL_FAX_MAX_DATAGRAM * 2];
 	int i;
 	int j;
 	int seq;
@@ -1817,6 +1817,45 @@ int ast_regex_string_to_regex_pattern(const char *regex_string, struct ast_str *
 	return ret;
 }
 
+int ast_regex_literal_prefix(const char *regex, char *prefix)
+{
+	const char *src;
+	char *dst = prefix;
+
+	*prefix = '\0';
+
+	/* Any branch of an alternation can match, whatever the first one starts with */
+	if (regex[0] != '^' || strchr(regex, '|')) {
+		return 0;
+	}
+
+	for (src = regex + 1; *src; ++src) {
+		if (*src == '\\') {
+			++src;
+			if (!*src) {
+				*prefix = '\0';
+				return -1;
+			}
+			if (isalnum((unsigned char) *src)) {
+				/* Back references and classes such as \w are not literals */
+				break;
+			}
+		} else if (strchr("?*{", *src)) {
+			/* The last literal may not be there at all */
+			if (dst != prefix) {
+				--dst;
+			}
+			break;
+		} else if (strchr(".+[()^$", *src)) {
+			break;
+		}
+		*dst++ = *src;
+	}
+	*dst = '\0';
+
+	return 0;
+}
+
 int ast_true(const char *s)
 {
 	if (ast_strlen_zero(s))
@@ -39,6 +39,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/astobj2.h"
 #include "asterisk/xmldoc.h"
 #include "asterisk/cli.h"
+#include "asterisk/vector.h"
 
 #ifdef AST_XML_DOCS
 
@@ -76,6 +77,96 @@ static int xmldoc_parse_specialtags(struct ast_xml_node *fixnode, const char *ta
  */
 static AST_RWLIST_HEAD_STATIC(xmldoc_tree, documentation_tree);
 
+/*! \brief Number of buckets of the documentation index */
+#define XMLDOC_INDEX_BUCKETS 1021
+
+/*! \brief A documented item of a documentation tree */
+struct xmldoc_index_node {
+	struct documentation_tree *doctree;	/*!< Tree the node is in. */
+	struct ast_xml_node *node;		/*!< Node of the item. */
+};
+
+/*! \brief The documented items of a type and name */
+struct xmldoc_index_entry {
+	/*! Non-empty nodes of the items, in the order of the documentation trees */
+	AST_VECTOR(, struct xmldoc_index_node) nodes;
+	/*! 'type:name' of the items */
+	char key[0];
+};
+
+/*!
+ * \brief Index of the documentation trees by type and name
+ *
+ * Built once the documentation is loaded, so looking up an item does not
+ * search every top level node of every tree.  Protected by the xmldoc_tree
+ * lock, like the trees it points into.
+ */
+static struct ao2_container *xmldoc_index;
+
+AO2_STRING_FIELD_HASH_FN(xmldoc_index_entry, key);
+AO2_STRING_FIELD_CMP_FN(xmldoc_index_entry, key);
+
+static void xmldoc_index_entry_destructor(void *obj)
+{
+	struct xmldoc_index_entry *entry = obj;
+
+	AST_VECTOR_FREE(&entry->nodes);
+}
+
+/*!
+ * \internal
+ * \brief Add the documented items of a tree to the index.
+ *
+ * \param doctree The tree, added after every tree already indexed.
+ *
+ * \note Must be called with the xmldoc_tree write lock held.
+ */
+static void xmldoc_index_add(struct documentation_tree *doctree)
+{
+	struct ast_xml_node *node;
+	struct xmldoc_index_entry *entry;
+	struct xmldoc_index_node item = { .doctree = doctree, };
+	const char *type;
+	const char *name;
+	char *key;
+
+	node = ast_xml_get_root(doctree->doc);
+	if (!node) {
+		return;
+	}
+
+	for (node = ast_xml_node_get_children(node); node; node = ast_xml_node_get_next(node)) {
+		if (!ast_xml_node_get_children(node)) {
+			/* ignore empty nodes */
+			continue;
+		}
+		name = ast_xml_get_attribute(node, "name");
+		if (!name) {
+			continue;
+		}
+		type = ast_xml_node_get_name(node);
+		key = ast_alloca(strlen(type) + strlen(name) + 2);
+		sprintf(key, "%s:%s", type, name); /* Safe */
+		ast_xml_free_attr(name);
+
+		entry = ao2_find(xmldoc_index, key, OBJ_SEARCH_KEY);
+		if (!entry) {
+			entry = ao2_alloc_options(sizeof(*entry) + strlen(key) + 1,
+				xmldoc_index_entry_destructor, AO2_ALLOC_OPT_LOCK_NOLOCK);
+			if (!entry || AST_VECTOR_INIT(&entry->nodes, 1)) {
+				ao2_cleanup(entry);
+				continue;
+			}
+			strcpy(entry->key, key); /* Safe */
+			ao2_link(xmldoc_index, entry);
+		}
+
+		item.node = node;
+		AST_VECTOR_APPEND(&entry->nodes, item);
+		ao2_ref(entry, -1);
+	}
+}
+
 static const struct strcolorized_tags {
 	const char *init;      /*!< Replace initial tag with this string. */
 	const char *end;       /*!< Replace end tag with this string. */
@@ -438,68 +529,64 @@ static struct ast_xml_node *xmldoc_get_node(const char *type, const char *name,
 	struct ast_xml_node *node = NULL;
 	struct ast_xml_node *first_match = NULL;
 	struct ast_xml_node *lang_match = NULL;
-	struct documentation_tree *doctree;
+	struct documentation_tree *doctree = NULL;
+	struct xmldoc_index_entry *entry;
+	struct xmldoc_index_node *item;
+	char *key;
+	int i;
+
+	key = ast_alloca(strlen(type) + strlen(name) + 2);
+	sprintf(key, "%s:%s", type, name); /* Safe */
 
 	AST_RWLIST_RDLOCK(&xmldoc_tree);
-	AST_LIST_TRAVERSE(&xmldoc_tree, doctree, entry) {
-		/* the core xml documents have priority over thirdparty document. */
-		node = ast_xml_get_root(doctree->doc);
-		if (!node) {
+	entry = xmldoc_index ? ao2_find(xmldoc_index, key, OBJ_SEARCH_KEY) : NULL;
+	if (!entry) {
+		AST_RWLIST_UNLOCK(&xmldoc_tree);
+		return NULL;
+	}
+
+	/* the core xml documents have priority over thirdparty document. */
+	for (i = 0; i < AST_VECTOR_SIZE(&entry->nodes); i++) {
+		item = AST_VECTOR_GET_ADDR(&entry->nodes, i);
+
+		if (doctree && item->doctree != doctree) {
+			/* Matches of a later tree only count if this one had none. */
 			break;
 		}
+		doctree = item->doctree;
 
-		node = ast_xml_node_get_children(node);
-		while ((node = ast_xml_find_element(node, type, "name", name))) {
-			if (!ast_xml_node_get_children(node)) {
-				/* ignore empty nodes */
-				node = ast_xml_node_get_next(node);
-				continue;
-			}
+		if (!first_match) {
+			first_match = item->node;
+		}
 
-			if (!first_match) {
-				first_match = node;
+		/* Check language */
+		if (xmldoc_attribute_match(item->node, "language", language)) {
+			if (!lang_match) {
+				lang_match = item->node;
 			}
 
-			/* Check language */
-			if (xmldoc_attribute_match(node, "language", language)) {
-				if (!lang_match) {
-					lang_match = node;
-				}
-
-				/* if module is empty we have a match */
-				if (ast_strlen_zero(module)) {
-					break;
-				}
-
-				/* Check module */
-				if (xmldoc_attribute_match(node, "module", module)) {
-					break;
-				}
+			/* if module is empty we have a match */
+			if (ast_strlen_zero(module)) {
+				node = item->node;
+				break;
 			}
 
-			node = ast_xml_node_get_next(node);
-		}
-
-		/* if we matched lang and module return this match */
-		if (node) {
-			break;
-		}
-
-		/* we didn't match lang and module, just return the first
-		 * result with a matching language if we have one */
-		if (lang_match) {
-			node = lang_match;
-			break;
+			/* Check module */
+			if (xmldoc_attribute_match(item->node, "module", module)) {
+				node = item->node;
+				break;
+			}
 		}
+	}
 
-		/* we didn't match with only the language, just return the
-		 * first match */
-		if (first_match) {
-			node = first_match;
-			break;
-		}
+	/* if we matched lang and module return this match, else just return
+	 * the first result with a matching language if we have one, else the
+	 * first match */
+	if (!node) {
+		node = lang_match ? lang_match : first_match;
 	}
 	AST_RWLIST_UNLOCK(&xmldoc_tree);
+	ao2_ref(entry, -1);
 
 	return node;
 }
@@ -2824,6 +2911,8 @@ static void xmldoc_unload_documentation(void)
 	ast_cli_unregister(&cli_dump_xmldocs);
 
 	AST_RWLIST_WRLOCK(&xmldoc_tree);
+	ao2_cleanup(xmldoc_index);
+	xmldoc_index = NULL;
 	while ((doctree = AST_RWLIST_REMOVE_HEAD(&xmldoc_tree, entry))) {
 		ast_free(doctree->filename);
 		ast_xml_close(doctree->doc);
@@ -2898,6 +2987,13 @@ int ast_xmldoc_load_documentation(void)
 	ast_free(xmlpattern);
 
 	AST_RWLIST_WRLOCK(&xmldoc_tree);
+	xmldoc_index = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0,
+		XMLDOC_INDEX_BUCKETS, xmldoc_index_entry_hash_fn, NULL, xmldoc_index_entry_cmp_fn);
+	if (!xmldoc_index) {
+		AST_RWLIST_UNLOCK(&xmldoc_tree);
+		globfree(&globbuf);
+		return 1;
+	}
 	/* loop over expanded files */
 	for (i = 0; i < globbuf.gl_pathc; i++) {
 		/* check for duplicates (if we already [try to] open the same file. */
@@ -2941,6 +3037,7 @@ int ast_xmldoc_load_documentation(void)
 		doc_tree->doc = tmpdoc;
 		doc_tree->filename = ast_strdup(globbuf.gl_pathv[i]);
 		AST_RWLIST_INSERT_TAIL(&xmldoc_tree, doc_tree, entry);
+		xmldoc_index_add(doc_tree);
 	}
 	AST_RWLIST_UNLOCK(&xmldoc_tree);
 
@@ -99,6 +99,10 @@ static void lua_concat_args(lua_State *L, int start, int nargs);
 static void lua_state_destroy(void *data);
 static void lua_datastore_fixup(void *data, struct ast_channel *old_chan, struct ast_channel *new_chan);
 static lua_State *lua_get_state(struct ast_channel *chan);
+static lua_State *lua_state_pool_get(void);
+static void lua_state_pool_put(lua_State *L);
+static void lua_state_pool_flush(void);
+static int lua_dump_extensions(lua_State *L, char **data, long *size);
 
 static int exists(struct ast_channel *chan, const char *context, const char *exten, int priority, const char *callerid, const char *data);
 static int canmatch(struct ast_channel *chan, const char *context, const char *exten, int priority, const char *callerid, const char *data);
@@ -106,8 +110,22 @@ static int matchmore(struct ast_channel *chan, const char *context, const char *
 static int exec(struct ast_channel *chan, const char *context, const char *exten, int priority, const char *callerid, const char *data);
 
 AST_MUTEX_DEFINE_STATIC(config_file_lock);
+/*! extensions.lua compiled to bytecode, or its source if it could not be dumped */
 static char *config_file_data = NULL;
 static long config_file_size = 0;
+/*! Bumped each time extensions.lua is reloaded */
+static unsigned int config_file_generation = 0;
+
+/*! Most lua_States kept ready to be used, see lua_state_pool_get() */
+#define LUA_STATE_POOL_MAX 16
+
+AST_MUTEX_DEFINE_STATIC(lua_state_pool_lock);
+/*!
+ * lua_States with extensions.lua loaded that were only used to match
+ * extensions, so they are as good as freshly loaded ones
+ */
+static lua_State *lua_state_pool[LUA_STATE_POOL_MAX];
+static int lua_state_pool_count = 0;
 
 static struct ast_context *local_contexts = NULL;
 static struct ast_hashtab *local_table = NULL;
@@ -1129,6 +1147,7 @@ static char *lua_read_extensions_file(lua_State *L, long *size)
 	error_func = lua_gettop(L);
 
 	if (luaL_loadbuffer(L, data, *size, "extensions.lua")
+			|| lua_dump_extensions(L, &data, size)
 			|| lua_pcall(L, 0, LUA_MULTRET, error_func)
 			|| lua_sort_extensions(L)
 			|| lua_register_switches(L)
@@ -1142,6 +1161,73 @@ static char *lua_read_extensions_file(lua_State *L, long *size)
 	return data;
 }
 
+/*! \brief Buffer extensions.lua is compiled to by lua_dump_extensions() */
+struct lua_bytecode {
+	char *data;
+	size_t size;
+	size_t len;
+};
+
+/*!
+ * \brief [lua_Writer] Append a piece of compiled extensions.lua to a buffer
+ */
+static int lua_bytecode_writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	struct lua_bytecode *bytecode = ud;
+
+	if (bytecode->len + sz > bytecode->size) {
+		size_t size = MAX(bytecode->size * 2, bytecode->len + sz);
+		char *data = ast_realloc(bytecode->data, size);
+
+		if (!data) {
+			return 1;
+		}
+		bytecode->data = data;
+		bytecode->size = size;
+	}
+
+	memcpy(bytecode->data + bytecode->len, p, sz);
+	bytecode->len += sz;
+
+	return 0;
+}
+
+/*!
+ * \brief Replace the source of extensions.lua by its bytecode
+ *
+ * \param L the lua_State with the compiled extensions.lua on top of its stack
+ * \param data the source, replaced by the bytecode
+ * \param size the size of the source, replaced by the size of the bytecode
+ *
+ * Every channel loads extensions.lua into a lua_State of its own, and
+ * loading the bytecode skips parsing the source each time.  If the
+ * bytecode cannot be had, the source is kept.
+ *
+ * \retval 0 always, to be chained with the other loading steps
+ */
+static int lua_dump_extensions(lua_State *L, char **data, long *size)
+{
+	struct lua_bytecode bytecode = { NULL, 0, 0 };
+	int res;
+
+#if LUA_VERSION_NUM < 503
+	res = lua_dump(L, lua_bytecode_writer, &bytecode);
+#else
+	res = lua_dump(L, lua_bytecode_writer, &bytecode, 0);
+#endif
+	if (res || !bytecode.len) {
+		ast_log(LOG_WARNING, "Unable to compile extensions.lua to bytecode, it will be parsed for each channel\n");
+		ast_free(bytecode.data);
+		return 0;
+	}
+
+	ast_free(*data);
+	*data = bytecode.data;
+	*size = bytecode.len;
+
+	return 0;
+}
+
 /*!
  * \brief Load the extensions.lua file from the internal buffer
  *
@@ -1171,6 +1257,9 @@ static int lua_load_extensions(lua_State *L, struct ast_channel *chan)
 		ast_mutex_unlock(&config_file_lock);
 		return 1;
 	}
+	/* remember which extensions.lua this is, see lua_state_pool_put() */
+	lua_pushinteger(L, config_file_generation);
+	lua_setfield(L, LUA_REGISTRYINDEX, "generation");
 	ast_mutex_unlock(&config_file_lock);
 
 	/* now we setup special tables and functions */
@@ -1215,6 +1304,7 @@ static int lua_reload_extensions(lua_State *L)
 
 	config_file_data = data;
 	config_file_size = size;
+	config_file_generation++;
 	
 	/* merge our new contexts */
 	ast_merge_contexts_and_delete(&local_contexts, local_table, registrar);
@@ -1226,6 +1316,9 @@ static int lua_reload_extensions(lua_State *L)
 	local_contexts = NULL;
 
 	ast_mutex_unlock(&config_file_lock);
+
+	/* the pooled states have the old extensions.lua loaded */
+	lua_state_pool_flush();
 	return 0;
 }
 
@@ -1238,6 +1331,70 @@ static void lua_free_extensions()
 	config_file_size = 0;
 	ast_free(config_file_data);
 	ast_mutex_unlock(&config_file_lock);
+
+	lua_state_pool_flush();
+}
+
+/*!
+ * \brief Take a lua_State with extensions.lua loaded from the pool
+ *
+ * \return a lua_State not associated with any channel, or NULL if the pool
+ * is empty
+ */
+static lua_State *lua_state_pool_get(void)
+{
+	lua_State *L = NULL;
+
+	ast_mutex_lock(&lua_state_pool_lock);
+	if (lua_state_pool_count) {
+		L = lua_state_pool[--lua_state_pool_count];
+	}
+	ast_mutex_unlock(&lua_state_pool_lock);
+
+	return L;
+}
+
+/*!
+ * \brief Give back a lua_State that was only used to match extensions
+ *
+ * The state is closed instead if the pool is full, or if extensions.lua
+ * was reloaded since it was loaded into it.
+ *
+ * \note States that ran any extension must be closed with lua_close(),
+ * since they may have been changed by it.
+ */
+static void lua_state_pool_put(lua_State *L)
+{
+	unsigned int generation;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, "generation");
+	generation = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+
+	ast_mutex_lock(&config_file_lock);
+	ast_mutex_lock(&lua_state_pool_lock);
+	if (generation == config_file_generation && lua_state_pool_count < LUA_STATE_POOL_MAX) {
+		lua_state_pool[lua_state_pool_count++] = L;
+		L = NULL;
+	}
+	ast_mutex_unlock(&lua_state_pool_lock);
+	ast_mutex_unlock(&config_file_lock);
+
+	if (L) {
+		lua_close(L);
+	}
+}
+
+/*!
+ * \brief Close every lua_State in the pool
+ */
+static void lua_state_pool_flush(void)
+{
+	ast_mutex_lock(&lua_state_pool_lock);
+	while (lua_state_pool_count) {
+		lua_close(lua_state_pool[--lua_state_pool_count]);
+	}
+	ast_mutex_unlock(&lua_state_pool_lock);
 }
 
 /*!
@@ -1259,6 +1416,10 @@ static lua_State *lua_get_state(struct ast_channel *chan)
 	lua_State *L;
 
 	if (!chan) {
+		if ((L = lua_state_pool_get())) {
+			return L;
+		}
+
 		L = luaL_newstate();
 		if (!L) {
 			ast_log(LOG_ERROR, "Error allocating lua_State, no memory\n");
@@ -1285,6 +1446,19 @@ static lua_State *lua_get_state(struct ast_channel *chan)
 				return NULL;
 			}
 
+			if ((L = lua_state_pool_get())) {
+				/* already loaded, it only needs to know its channel */
+				datastore->data = L;
+				lua_pushlightuserdata(L, chan);
+				lua_setfield(L, LUA_REGISTRYINDEX, "channel");
+
+				ast_channel_lock(chan);
+				ast_channel_datastore_add(chan, datastore);
+				ast_channel_unlock(chan);
+
+				return L;
+			}
+
 			datastore->data = luaL_newstate();
 			if (!datastore->data) {
 				ast_datastore_free(datastore);
@@ -1333,7 +1507,7 @@ static int exists(struct ast_channel *chan, const char *context, const char *ext
 
 	res = lua_find_extension(L, context, exten, priority, &exists, 0);
 
-	if (!chan) lua_close(L);
+	if (!chan) lua_state_pool_put(L);
 	ast_module_user_remove(u);
 	return res;
 }
@@ -1356,7 +1530,7 @@ static int canmatch(struct ast_channel *chan, const char *context, const char *e
 
 	res = lua_find_extension(L, context, exten, priority, &canmatch, 0);
 
-	if (!chan) lua_close(L);
+	if (!chan) lua_state_pool_put(L);
 	ast_module_user_remove(u);
 	return res;
 }
@@ -1379,7 +1553,7 @@ static int matchmore(struct ast_channel *chan, const char *context, const char *
 	
 	res = lua_find_extension(L, context, exten, priority, &matchmore, 0);
 
-	if (!chan) lua_close(L);
+	if (!chan) lua_state_pool_put(L);
 	ast_module_user_remove(u);
 	return res;
 }
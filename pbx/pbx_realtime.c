@@ -345,19 +345,26 @@ static int realtime_exec(struct ast_channel *chan, const char *context, const ch
 						 term_color(tmp2, ast_channel_name(chan), COLOR_BRMAGENTA, 0, sizeof(tmp2)),
 						 term_color(tmp3, S_OR(appdata, ""), COLOR_BRMAGENTA, 0, sizeof(tmp3)));
 				if (ast_channel_snapshot_type()) {
+					const char *saved_appl;
+					const char *saved_data;
+
+					/* pbx_exec sets application name and data, but we don't want to log
+					 * every exec. Just put them in the snapshot here instead.
+					 */
 					ast_channel_lock(chan);
+					saved_appl = ast_channel_appl(chan);
+					saved_data = ast_channel_data(chan);
+					ast_channel_appl_set(chan, app);
+					ast_channel_data_set(chan, !ast_strlen_zero(appdata) ? appdata : "(NULL)");
 					snapshot = ast_channel_snapshot_create(chan);
+					ast_channel_appl_set(chan, saved_appl);
+					ast_channel_data_set(chan, saved_data);
 					ast_channel_unlock(chan);
 				}
 				if (snapshot) {
-					/* pbx_exec sets application name and data, but we don't want to log
-					 * every exec. Just update the snapshot here instead.
-					 */
-					ast_string_field_set(snapshot, appl, app);
-					ast_string_field_set(snapshot, data, !ast_strlen_zero(appdata) ? appdata : "(NULL)");
 					msg = stasis_message_create(ast_channel_snapshot_type(), snapshot);
 					if (msg) {
-						stasis_publish(ast_channel_topic(chan), msg);
+						stasis_publish(ast_channel_topic_for_publish(chan), msg);
 					}
 				}
 				res = pbx_exec(chan, a, appdata);
@@ -55,6 +55,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/options.h"
 #include "asterisk/format.h"
 #include "asterisk/format_cache.h"
+#include "asterisk/config.h"
+#include "asterisk/cli.h"
+#include "asterisk/threadpool.h"
 
 /*
  * pbx_spool is similar in spirit to qcall, but with substantially enhanced functionality...
@@ -76,6 +79,23 @@ enum {
 static char qdir[255];
 static char qdonedir[255];
 
+/*! Most call files being dialed at once, 0 for no limit */
+static unsigned int spool_maxcalls;
+/*! Most call files to start dialing each second, 0 for no limit */
+static unsigned int spool_maxcps;
+
+/*! Dialers of the call files */
+static struct ast_threadpool *spool_pool;
+
+/*! Call files waiting for a dialer or for their turn under maxcps */
+static int spool_backlog;
+/*! Call files being dialed */
+static int spool_active;
+
+/*! When the next call file may start dialing under maxcps */
+static struct timeval spool_next_start;
+AST_MUTEX_DEFINE_STATIC(spool_rate_lock);
+
 struct outgoing {
 	int retries;                              /*!< Current number of retries */
 	int maxretries;                           /*!< Maximum number of retries permitted */
@@ -464,11 +484,53 @@ static void *attempt_thread(void *data)
 	return NULL;
 }
 
+/*!
+ * \internal
+ * \brief Wait for the turn of a call file to start dialing under maxcps
+ */
+static void spool_rate_wait(void)
+{
+	struct timeval now;
+	struct timeval start;
+	int64_t delay;
+
+	if (!spool_maxcps) {
+		return;
+	}
+
+	ast_mutex_lock(&spool_rate_lock);
+	now = ast_tvnow();
+	start = ast_tvcmp(spool_next_start, now) > 0 ? spool_next_start : now;
+	spool_next_start = ast_tvadd(start, ast_tv(0, 1000000 / spool_maxcps));
+	ast_mutex_unlock(&spool_rate_lock);
+
+	delay = ast_tvdiff_ms(start, now);
+	if (delay > 0) {
+		usleep(delay * 1000);
+	}
+}
+
+static int attempt_task(void *data)
+{
+	spool_rate_wait();
+	ast_atomic_fetchadd_int(&spool_backlog, -1);
+	ast_atomic_fetchadd_int(&spool_active, +1);
+	attempt_thread(data);
+	ast_atomic_fetchadd_int(&spool_active, -1);
+	return 0;
+}
+
 static void launch_service(struct outgoing *o)
 {
 	pthread_t t;
 	int ret;
 
+	ast_atomic_fetchadd_int(&spool_backlog, +1);
+	if (spool_pool && !ast_threadpool_push(spool_pool, attempt_task, o)) {
+		return;
+	}
+	ast_atomic_fetchadd_int(&spool_backlog, -1);
+
 	if ((ret = ast_pthread_create_detached(&t, NULL, attempt_thread, o))) {
 		ast_log(LOG_WARNING, "Unable to create thread :( (returned error: %d)\n", ret);
 		free_outgoing(o);
@@ -935,6 +997,74 @@ static void *scan_thread(void *unused)
 }
 #endif
 
+static char *handle_cli_spool_show_status(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "spool show status";
+		e->usage =
+			"Usage: spool show status\n"
+			"       Shows how many call files are being dialed and how many\n"
+			"       are waiting to be.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, "Call files being dialed: %d\n", spool_active);
+	ast_cli(a->fd, "Call files waiting:      %d\n", spool_backlog);
+	if (spool_maxcalls) {
+		ast_cli(a->fd, "Max calls:               %u\n", spool_maxcalls);
+	} else {
+		ast_cli(a->fd, "Max calls:               Unlimited\n");
+	}
+	if (spool_maxcps) {
+		ast_cli(a->fd, "Max calls per second:    %u\n", spool_maxcps);
+	} else {
+		ast_cli(a->fd, "Max calls per second:    Unlimited\n");
+	}
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_spool[] = {
+	AST_CLI_DEFINE(handle_cli_spool_show_status, "Show status of the call file dialers"),
+};
+
+static void load_config(void)
+{
+	struct ast_flags config_flags = { 0 };
+	struct ast_config *cfg;
+	struct ast_variable *v;
+
+	cfg = ast_config_load("pbx_spool.conf", config_flags);
+	if (!cfg || cfg == CONFIG_STATUS_FILEINVALID) {
+		return;
+	}
+
+	for (v = ast_variable_browse(cfg, "general"); v; v = v->next) {
+		if (!strcasecmp(v->name, "maxcalls")) {
+			if (sscanf(v->value, "%30u", &spool_maxcalls) != 1) {
+				ast_log(LOG_WARNING, "Invalid maxcalls '%s' at line %d of pbx_spool.conf\n",
+					v->value, v->lineno);
+				spool_maxcalls = 0;
+			}
+		} else if (!strcasecmp(v->name, "maxcps")) {
+			if (sscanf(v->value, "%30u", &spool_maxcps) != 1 || spool_maxcps > 1000000) {
+				ast_log(LOG_WARNING, "Invalid maxcps '%s' at line %d of pbx_spool.conf\n",
+					v->value, v->lineno);
+				spool_maxcps = 0;
+			}
+		}
+	}
+
+	ast_config_destroy(cfg);
+}
+
 static int unload_module(void)
 {
 	return -1;
@@ -944,6 +1074,12 @@ static int load_module(void)
 {
 	pthread_t thread;
 	int ret;
+	struct ast_threadpool_options options = {
+		.version = AST_THREADPOOL_OPTIONS_VERSION,
+		.idle_timeout = 60,
+		.auto_increment = 1,
+		.initial_size = 0,
+	};
 	snprintf(qdir, sizeof(qdir), "%s/%s", ast_config_AST_SPOOL_DIR, "outgoing");
 	if (ast_mkdir(qdir, 0777)) {
 		ast_log(LOG_WARNING, "Unable to create queue directory %s -- outgoing spool disabled\n", qdir);
@@ -951,6 +1087,14 @@ static int load_module(void)
 	}
 	snprintf(qdonedir, sizeof(qdir), "%s/%s", ast_config_AST_SPOOL_DIR, "outgoing_done");
 
+	load_config();
+
+	/* Call files are dialed on threads of their own if there is no pool */
+	options.max_size = spool_maxcalls;
+	spool_pool = ast_threadpool_create("pbx_spool", NULL, &options);
+
+	ast_cli_register_multiple(cli_spool, ARRAY_LEN(cli_spool));
+
 	if ((ret = ast_pthread_create_detached_background(&thread, NULL, scan_thread, NULL))) {
 		ast_log(LOG_WARNING, "Unable to create thread :( (returned error: %d)\n", ret);
 		return AST_MODULE_LOAD_FAILURE;
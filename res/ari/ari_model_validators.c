@@ -6451,3 +6451,66 @@ ari_validator ast_ari_validate_application_fn(void)
 {
 	return ast_ari_validate_application;
 }
+
+int ast_ari_validate_bulk_result(struct ast_json *json)
+{
+	int res = 1;
+	struct ast_json_iter *iter;
+	int has_reason = 0;
+	int has_status_code = 0;
+
+	for (iter = ast_json_object_iter(json); iter; iter = ast_json_object_iter_next(json, iter)) {
+		if (strcmp("message", ast_json_object_iter_key(iter)) == 0) {
+			int prop_is_valid;
+			prop_is_valid = ast_ari_validate_object(
+				ast_json_object_iter_value(iter));
+			if (!prop_is_valid) {
+				ast_log(LOG_ERROR, "ARI BulkResult field message failed validation\n");
+				res = 0;
+			}
+		} else
+		if (strcmp("reason", ast_json_object_iter_key(iter)) == 0) {
+			int prop_is_valid;
+			has_reason = 1;
+			prop_is_valid = ast_ari_validate_string(
+				ast_json_object_iter_value(iter));
+			if (!prop_is_valid) {
+				ast_log(LOG_ERROR, "ARI BulkResult field reason failed validation\n");
+				res = 0;
+			}
+		} else
+		if (strcmp("status_code", ast_json_object_iter_key(iter)) == 0) {
+			int prop_is_valid;
+			has_status_code = 1;
+			prop_is_valid = ast_ari_validate_int(
+				ast_json_object_iter_value(iter));
+			if (!prop_is_valid) {
+				ast_log(LOG_ERROR, "ARI BulkResult field status_code failed validation\n");
+				res = 0;
+			}
+		} else
+		{
+			ast_log(LOG_ERROR,
+				"ARI BulkResult has undocumented field %s\n",
+				ast_json_object_iter_key(iter));
+			res = 0;
+		}
+	}
+
+	if (!has_reason) {
+		ast_log(LOG_ERROR, "ARI BulkResult missing required field reason\n");
+		res = 0;
+	}
+
+	if (!has_status_code) {
+		ast_log(LOG_ERROR, "ARI BulkResult missing required field status_code\n");
+		res = 0;
+	}
+
+	return res;
+}
+
+ari_validator ast_ari_validate_bulk_result_fn(void)
+{
+	return ast_ari_validate_bulk_result;
+}
@@ -1366,6 +1366,24 @@ int ast_ari_validate_application(struct ast_json *json);
  */
 ari_validator ast_ari_validate_application_fn(void);
 
+/*!
+ * \brief Validator for BulkResult.
+ *
+ * Result of an operation of a bulk request.
+ *
+ * \param json JSON object to validate.
+ * \returns True (non-zero) if valid.
+ * \returns False (zero) if invalid.
+ */
+int ast_ari_validate_bulk_result(struct ast_json *json);
+
+/*!
+ * \brief Function pointer to ast_ari_validate_bulk_result().
+ *
+ * See \ref ast_ari_model_validators.h for more details.
+ */
+ari_validator ast_ari_validate_bulk_result_fn(void);
+
 /*
  * JSON models
  *
@@ -1784,6 +1802,10 @@ ari_validator ast_ari_validate_application_fn(void);
  * - device_names: List[string] (required)
  * - endpoint_ids: List[string] (required)
  * - name: string (required)
+ * BulkResult
+ * - message: object
+ * - reason: string (required)
+ * - status_code: int (required)
  */
 
 #endif /* _ASTERISK_ARI_MODEL_H */
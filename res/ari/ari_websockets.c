@@ -24,6 +24,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/astobj2.h"
 #include "asterisk/http_websocket.h"
 #include "asterisk/stasis_app.h"
+#include "asterisk/taskprocessor.h"
 #include "internal.h"
 
 /*! \file
@@ -32,15 +33,111 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
  * \author David M. Lee, II <dlee@digium.com>
  */
 
+/*! \brief Most messages written to a websocket at once */
+#define SESSION_WRITE_BATCH 64
+
+/*! \brief A message serialized for a session, waiting to be written */
+struct ari_websocket_message {
+	AST_LIST_ENTRY(ari_websocket_message) list;
+	/*! The serialized message */
+	char *str;
+	uint64_t len;
+	/*! What the message is the state of, for coalescing. NULL if it cannot be coalesced */
+	char *subject;
+};
+
 struct ast_ari_websocket_session {
 	struct ast_websocket *ws_session;
 	int (*validator)(struct ast_json *);
+	/*! Serializer that writes queued messages to the websocket */
+	struct ast_taskprocessor *serializer;
+	/*! Messages waiting to be written, protected by the session lock */
+	AST_LIST_HEAD_NOLOCK(, ari_websocket_message) queue;
+	/*! Number of messages in queue */
+	unsigned int queued;
+	/*! Most messages queue may hold, from websocket_queue_limit */
+	unsigned int queue_limit;
+	/*! What to do with messages once queue_limit is reached */
+	enum ast_ari_websocket_overflow overflow;
+	/*! Messages dropped or coalesced since the queue last drained */
+	unsigned int overflowed;
+	/*! Set when the queue passes half its limit, cleared when it drains */
+	unsigned int backlogged:1;
+};
+
+static void ari_websocket_message_free(struct ari_websocket_message *message)
+{
+	ast_json_free(message->str);
+	ast_free(message->subject);
+	ast_free(message);
+}
+
+/*!
+ * \internal
+ * \brief Events that carry the whole state of their subject, so only the newest matters
+ */
+static const struct {
+	const char *type;
+	const char *object;
+	const char *field;
+} coalescable_events[] = {
+	{ "ChannelStateChange", "channel", "id" },
+	{ "ChannelDialplan", "channel", "id" },
+	{ "ChannelCallerId", "channel", "id" },
+	{ "ChannelConnectedLine", "channel", "id" },
+	{ "DeviceStateChanged", "device_state", "name" },
 };
 
+/*!
+ * \internal
+ * \brief Get what a message is the state of, if a newer message about it replaces it
+ *
+ * \return "<type>/<application>/<id>", to be freed by the caller, or NULL
+ */
+static char *ari_websocket_message_subject(struct ast_json *message)
+{
+	const char *type = ast_json_string_get(ast_json_object_get(message, "type"));
+	const char *application = ast_json_string_get(ast_json_object_get(message, "application"));
+	const char *id;
+	char *subject;
+	int i;
+
+	if (!type) {
+		return NULL;
+	}
+
+	for (i = 0; i < ARRAY_LEN(coalescable_events); i++) {
+		if (!strcmp(type, coalescable_events[i].type)) {
+			break;
+		}
+	}
+	if (i == ARRAY_LEN(coalescable_events)) {
+		return NULL;
+	}
+
+	id = ast_json_string_get(ast_json_object_get(
+		ast_json_object_get(message, coalescable_events[i].object),
+		coalescable_events[i].field));
+	if (!id) {
+		return NULL;
+	}
+
+	if (ast_asprintf(&subject, "%s/%s/%s", type, S_OR(application, ""), id) < 0) {
+		return NULL;
+	}
+
+	return subject;
+}
+
 static void websocket_session_dtor(void *obj)
 {
 	struct ast_ari_websocket_session *session = obj;
+	struct ari_websocket_message *message;
 
+	while ((message = AST_LIST_REMOVE_HEAD(&session->queue, list))) {
+		ari_websocket_message_free(message);
+	}
+	ast_taskprocessor_unreference(session->serializer);
 	ast_websocket_unref(session->ws_session);
 	session->ws_session = NULL;
 }
@@ -58,6 +155,7 @@ struct ast_ari_websocket_session *ast_ari_websocket_session_create(
 {
 	RAII_VAR(struct ast_ari_websocket_session *, session, NULL, ao2_cleanup);
 	RAII_VAR(struct ast_ari_conf *, config, ast_ari_config_get(), ao2_cleanup);
+	char tps_name[AST_TASKPROCESSOR_MAX_NAME + 1];
 
 	if (ws_session == NULL) {
 		return NULL;
@@ -91,6 +189,14 @@ struct ast_ari_websocket_session *ast_ari_websocket_session_create(
 	ao2_ref(ws_session, +1);
 	session->ws_session = ws_session;
 	session->validator = validator;
+	session->queue_limit = config->general->websocket_queue_limit;
+	session->overflow = config->general->websocket_overflow;
+
+	ast_taskprocessor_build_name(tps_name, sizeof(tps_name), "ari/websocket");
+	session->serializer = ast_taskprocessor_get(tps_name, TPS_REF_DEFAULT);
+	if (!session->serializer) {
+		return NULL;
+	}
 
 	ao2_ref(session, +1);
 	return session;
@@ -184,6 +290,174 @@ int ast_ari_websocket_session_write(struct ast_ari_websocket_session *session,
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Write the messages queued for a session
+ *
+ * Runs on the session's serializer. Everything queued when it runs is
+ * written, in batches of frames that are flushed to the websocket together.
+ */
+static int websocket_session_flush(void *data)
+{
+	struct ast_ari_websocket_session *session = data;
+	AST_LIST_HEAD_NOLOCK(, ari_websocket_message) messages;
+	struct ari_websocket_message *message;
+	char *payloads[SESSION_WRITE_BATCH];
+	uint64_t payload_sizes[SESSION_WRITE_BATCH];
+	int failed = 0;
+
+	ao2_lock(session);
+	AST_LIST_HEAD_INIT_NOLOCK(&messages);
+	AST_LIST_APPEND_LIST(&messages, &session->queue, list);
+	session->queued = 0;
+	if (session->backlogged) {
+		ast_log(LOG_NOTICE, "Websocket to %s caught up, %u events were dropped or coalesced\n",
+			ast_sockaddr_stringify(ast_ari_websocket_session_get_remote_addr(session)),
+			session->overflowed);
+		session->backlogged = 0;
+		session->overflowed = 0;
+	}
+	ao2_unlock(session);
+
+	while (!AST_LIST_EMPTY(&messages)) {
+		struct ari_websocket_message *batch[SESSION_WRITE_BATCH];
+		size_t count = 0;
+		size_t i;
+
+		while (count < SESSION_WRITE_BATCH
+			&& (message = AST_LIST_REMOVE_HEAD(&messages, list))) {
+			batch[count] = message;
+			payloads[count] = message->str;
+			payload_sizes[count] = message->len;
+			++count;
+		}
+
+		if (!failed && ast_websocket_write_batch(session->ws_session,
+			AST_WEBSOCKET_OPCODE_TEXT, payloads, payload_sizes, count)) {
+			ast_log(LOG_NOTICE, "Problem occurred during websocket write to %s, websocket closed\n",
+				ast_sockaddr_stringify(ast_ari_websocket_session_get_remote_addr(session)));
+			/* Whatever is left can no longer be delivered */
+			failed = 1;
+		}
+
+		for (i = 0; i < count; i++) {
+			ari_websocket_message_free(batch[i]);
+		}
+	}
+
+	ao2_ref(session, -1);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Handle a message for a session whose queue is full
+ *
+ * \note The session must be locked. The message is consumed.
+ *
+ * \retval 0 if the message was dropped or coalesced
+ * \retval -1 if the websocket should be closed
+ */
+static int websocket_session_overflow(struct ast_ari_websocket_session *session,
+	struct ari_websocket_message *message)
+{
+	struct ari_websocket_message *waiting;
+
+	switch (session->overflow) {
+	case ARI_WEBSOCKET_OVERFLOW_CLOSE:
+		ari_websocket_message_free(message);
+		return -1;
+	case ARI_WEBSOCKET_OVERFLOW_COALESCE:
+		if (!message->subject) {
+			break;
+		}
+		AST_LIST_TRAVERSE(&session->queue, waiting, list) {
+			if (waiting->subject && !strcmp(waiting->subject, message->subject)) {
+				/* Keep the place of the waiting message, with the newer state */
+				SWAP(waiting->str, message->str);
+				SWAP(waiting->len, message->len);
+				break;
+			}
+		}
+		break;
+	case ARI_WEBSOCKET_OVERFLOW_DROP:
+		break;
+	}
+
+	session->backlogged = 1;
+	++session->overflowed;
+	ari_websocket_message_free(message);
+	return 0;
+}
+
+int ast_ari_websocket_session_queue(struct ast_ari_websocket_session *session,
+	struct ast_json *message)
+{
+	struct ari_websocket_message *queued;
+	int was_empty;
+
+#ifdef AST_DEVMODE
+	if (!session->validator(message)) {
+		ast_log(LOG_ERROR, "Outgoing message failed validation\n");
+		return ast_websocket_write_string(session->ws_session, VALIDATION_FAILED);
+	}
+#endif
+
+	queued = ast_calloc(1, sizeof(*queued));
+	if (!queued) {
+		return -1;
+	}
+
+	queued->str = ast_json_dump_string_format(message, ast_ari_json_format());
+	if (!queued->str) {
+		ast_log(LOG_ERROR, "Failed to encode JSON object\n");
+		ast_free(queued);
+		return -1;
+	}
+	queued->len = strlen(queued->str);
+	if (session->overflow == ARI_WEBSOCKET_OVERFLOW_COALESCE) {
+		queued->subject = ari_websocket_message_subject(message);
+	}
+
+	ao2_lock(session);
+	if (session->queued >= session->queue_limit) {
+		int res = websocket_session_overflow(session, queued);
+
+		ao2_unlock(session);
+		if (res) {
+			ast_log(LOG_WARNING, "Websocket to %s has %u events waiting to be written, closing it\n",
+				ast_sockaddr_stringify(ast_ari_websocket_session_get_remote_addr(session)),
+				session->queued);
+			/* 1011 - server terminating connection due to not being able to fulfill the request */
+			ast_websocket_close(session->ws_session, 1011);
+			return -1;
+		}
+		return 0;
+	}
+	if (!session->backlogged && session->queued >= session->queue_limit / 2) {
+		/* Let the operator know before events have to be given up */
+		ast_log(LOG_WARNING, "Websocket to %s is not keeping up, %u events are waiting to be written\n",
+			ast_sockaddr_stringify(ast_ari_websocket_session_get_remote_addr(session)),
+			session->queued);
+		session->backlogged = 1;
+	}
+	was_empty = AST_LIST_EMPTY(&session->queue);
+	AST_LIST_INSERT_TAIL(&session->queue, queued, list);
+	++session->queued;
+	ao2_unlock(session);
+
+	/* A flush is already pending if the queue was not empty */
+	if (was_empty) {
+		ao2_ref(session, +1);
+		if (ast_taskprocessor_push(session->serializer, websocket_session_flush, session)) {
+			ao2_ref(session, -1);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 struct ast_sockaddr *ast_ari_websocket_session_get_remote_addr(
 	struct ast_ari_websocket_session *session)
 {
@@ -61,6 +61,25 @@ static int encoding_format_handler(const struct aco_option *opt,
 	return 0;
 }
 
+/*! \brief Parses the ast_ari_websocket_overflow enum from a config file */
+static int websocket_overflow_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	struct ast_ari_conf_general *general = obj;
+
+	if (!strcasecmp(var->value, "close")) {
+		general->websocket_overflow = ARI_WEBSOCKET_OVERFLOW_CLOSE;
+	} else if (!strcasecmp(var->value, "drop")) {
+		general->websocket_overflow = ARI_WEBSOCKET_OVERFLOW_DROP;
+	} else if (!strcasecmp(var->value, "coalesce")) {
+		general->websocket_overflow = ARI_WEBSOCKET_OVERFLOW_COALESCE;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
 /*! \brief Parses the ast_ari_password_format enum from a config file */
 static int password_format_handler(const struct aco_option *opt,
 	struct ast_variable *var, void *obj)
@@ -341,6 +360,11 @@ int ast_ari_config_init(void)
 	aco_option_register(&cfg_info, "websocket_write_timeout", ACO_EXACT, general_options,
 		AST_DEFAULT_WEBSOCKET_WRITE_TIMEOUT_STR, OPT_INT_T, PARSE_IN_RANGE,
 		FLDSET(struct ast_ari_conf_general, write_timeout), 1, INT_MAX);
+	aco_option_register(&cfg_info, "websocket_queue_limit", ACO_EXACT, general_options,
+		"10000", OPT_INT_T, PARSE_IN_RANGE,
+		FLDSET(struct ast_ari_conf_general, websocket_queue_limit), 10, INT_MAX);
+	aco_option_register_custom(&cfg_info, "websocket_overflow", ACO_EXACT,
+		general_options, "close", websocket_overflow_handler, 0);
 
 	/* ARI type=user category options */
 	aco_option_register(&cfg_info, "type", ACO_EXACT, user, NULL,
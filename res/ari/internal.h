@@ -61,12 +61,26 @@ struct ast_ari_conf {
 /*! Max length for auth_realm field */
 #define ARI_AUTH_REALM_LEN 80
 
+/*! \brief What to do with events for a WebSocket that has too many waiting */
+enum ast_ari_websocket_overflow {
+	/*! Close the WebSocket */
+	ARI_WEBSOCKET_OVERFLOW_CLOSE,
+	/*! Drop the event */
+	ARI_WEBSOCKET_OVERFLOW_DROP,
+	/*! Replace a waiting event with the same subject, or drop the event */
+	ARI_WEBSOCKET_OVERFLOW_COALESCE,
+};
+
 /*! \brief Global configuration options for ARI. */
 struct ast_ari_conf_general {
 	/*! Enabled by default, disabled if false. */
 	int enabled;
 	/*! Write timeout for websocket connections */
 	int write_timeout;
+	/*! Most events a websocket connection may have waiting to be written */
+	int websocket_queue_limit;
+	/*! What to do with events once websocket_queue_limit is reached */
+	enum ast_ari_websocket_overflow websocket_overflow;
 	/*! Encoding format used during output (default compact). */
 	enum ast_json_encoding_format format;
 	/*! Authentication realm */
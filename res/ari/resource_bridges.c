@@ -878,7 +878,8 @@ void ast_ari_bridges_list(struct ast_variable *headers,
 {
 	RAII_VAR(struct stasis_cache *, cache, NULL, ao2_cleanup);
 	RAII_VAR(struct ao2_container *, snapshots, NULL, ao2_cleanup);
-	RAII_VAR(struct ast_json *, json, NULL, ast_json_unref);
+	struct ast_str *body;
+	struct ast_json_writer writer;
 	struct ao2_iterator i;
 	void *obj;
 
@@ -897,27 +898,34 @@ void ast_ari_bridges_list(struct ast_variable *headers,
 		return;
 	}
 
-	json = ast_json_array_create();
-	if (!json) {
+	/* Encode the snapshots directly; this list can be large */
+	body = ast_str_create(256 * (ao2_container_count(snapshots) + 1));
+	if (!body) {
 		ast_ari_response_alloc_failed(response);
 		return;
 	}
+	ast_json_writer_init(&writer, &body, ast_ari_json_format());
 
+	ast_json_writer_array_start(&writer);
 	i = ao2_iterator_init(snapshots, 0);
 	while ((obj = ao2_iterator_next(&i))) {
 		RAII_VAR(struct stasis_message *, msg, obj, ao2_cleanup);
 		struct ast_bridge_snapshot *snapshot = stasis_message_data(msg);
-		struct ast_json *json_bridge = ast_bridge_snapshot_to_json(snapshot, stasis_app_get_sanitizer());
 
-		if (!json_bridge || ast_json_array_append(json, json_bridge)) {
-			ao2_iterator_destroy(&i);
-			ast_ari_response_alloc_failed(response);
-			return;
+		if (ast_bridge_snapshot_write_json(snapshot, stasis_app_get_sanitizer(), &writer)) {
+			break;
 		}
 	}
 	ao2_iterator_destroy(&i);
+	ast_json_writer_array_end(&writer);
+
+	if (ast_json_writer_finish(&writer)) {
+		ast_free(body);
+		ast_ari_response_alloc_failed(response);
+		return;
+	}
 
-	ast_ari_response_ok(response, ast_json_ref(json));
+	ast_ari_response_ok_encoded(response, body);
 }
 
 void ast_ari_bridges_create(struct ast_variable *headers,
@@ -0,0 +1,381 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief /api-docs/bulk.{format} implementation - Bulk operation resources
+ *
+ * Each operation of a bulk request is routed through ast_ari_invoke(), just
+ * as if it had been a request of its own. Operations are grouped by the
+ * resource they act on; the groups are run concurrently by a few threads,
+ * and the operations of a group one after the other.
+ */
+
+/*** MODULEINFO
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/http.h"
+#include "asterisk/lock.h"
+#include "asterisk/utils.h"
+#include "asterisk/vector.h"
+#include "resource_bulk.h"
+
+/*! \brief Most operations one bulk request may hold */
+#define BULK_MAX_OPERATIONS 1000
+
+/*! \brief Most threads running the operations of one bulk request */
+#define BULK_MAX_THREADS 16
+
+/*! \brief An operation of a bulk request */
+struct bulk_operation {
+	/*! HTTP method of the operation */
+	enum ast_http_method method;
+	/*! URI of the operation, relative to the API path */
+	char *uri;
+	/*! Query parameters of the operation */
+	struct ast_variable *get_params;
+	/*! Body of the operation */
+	struct ast_json *body;
+	/*! Next operation on the same resource */
+	struct bulk_operation *next;
+	/*! BulkResult of the operation, once it has run */
+	struct ast_json *result;
+};
+
+/*! \brief State shared by the threads running a bulk request */
+struct bulk_run {
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	/*! HTTP headers of the bulk request, passed to each operation */
+	struct ast_variable *headers;
+	/*! First operation on each resource */
+	AST_VECTOR(, struct bulk_operation *) chains;
+	/*! Index of the next chain to run */
+	size_t next_chain;
+	/*! Number of helper threads still running */
+	int threads;
+};
+
+static void bulk_operation_cleanup(struct bulk_operation *op)
+{
+	ast_free(op->uri);
+	ast_variables_destroy(op->get_params);
+	ast_json_unref(op->body);
+	ast_json_unref(op->result);
+}
+
+/*!
+ * \internal
+ * \brief Length of the part of a URI naming the resource it acts on.
+ *
+ * That is the first two path segments, such as channels/{channelId}.
+ */
+static size_t bulk_resource_len(const char *uri)
+{
+	const char *end = strchr(uri, '/');
+
+	if (end) {
+		end = strchr(end + 1, '/');
+	}
+	return end ? end - uri : strlen(uri);
+}
+
+/*!
+ * \internal
+ * \brief Fill in an operation from its JSON description.
+ *
+ * \return NULL on success, else the reason the operation is invalid.
+ */
+static const char *bulk_operation_parse(struct ast_json *json, struct bulk_operation *op)
+{
+	const char *method = ast_json_string_get(ast_json_object_get(json, "method"));
+	const char *uri = ast_json_string_get(ast_json_object_get(json, "uri"));
+	struct ast_json *query = ast_json_object_get(json, "query");
+	struct ast_json *body = ast_json_object_get(json, "body");
+	struct ast_json_iter *iter;
+
+	if (ast_strlen_zero(method)) {
+		return "Operation has no method";
+	}
+	if (!strcasecmp(method, "POST")) {
+		op->method = AST_HTTP_POST;
+	} else if (!strcasecmp(method, "PUT")) {
+		op->method = AST_HTTP_PUT;
+	} else if (!strcasecmp(method, "DELETE")) {
+		op->method = AST_HTTP_DELETE;
+	} else {
+		return "Operation method must be POST, PUT or DELETE";
+	}
+
+	if (uri && *uri == '/') {
+		++uri;
+	}
+	if (ast_strlen_zero(uri)) {
+		return "Operation has no uri";
+	}
+	if (strcspn(uri, "/") == 4 && !strncmp(uri, "bulk", 4)) {
+		return "Bulk requests cannot be nested";
+	}
+	if (!(op->uri = ast_strdup(uri))) {
+		return "Allocation failed";
+	}
+
+	if (query && ast_json_typeof(query) != AST_JSON_OBJECT) {
+		return "Operation query must be an object";
+	}
+	for (iter = ast_json_object_iter(query); iter;
+		iter = ast_json_object_iter_next(query, iter)) {
+		struct ast_json *value = ast_json_object_iter_value(iter);
+		struct ast_variable *var;
+		char buf[32];
+		const char *str;
+
+		switch (ast_json_typeof(value)) {
+		case AST_JSON_STRING:
+			str = ast_json_string_get(value);
+			break;
+		case AST_JSON_INTEGER:
+			snprintf(buf, sizeof(buf), "%jd", (intmax_t)ast_json_integer_get(value));
+			str = buf;
+			break;
+		case AST_JSON_TRUE:
+			str = "true";
+			break;
+		case AST_JSON_FALSE:
+			str = "false";
+			break;
+		default:
+			return "Operation query values must be strings, integers or booleans";
+		}
+
+		if (!(var = ast_variable_new(ast_json_object_iter_key(iter), str, ""))) {
+			return "Allocation failed";
+		}
+		var->next = op->get_params;
+		op->get_params = var;
+	}
+
+	op->body = body ? ast_json_ref(body) : ast_json_null();
+	return NULL;
+}
+
+/*! \brief Build a BulkResult */
+static struct ast_json *bulk_result(int status_code, const char *reason,
+	struct ast_json *message)
+{
+	struct ast_json *result;
+
+	result = ast_json_pack("{s: i, s: s}",
+		"status_code", status_code,
+		"reason", S_OR(reason, ""));
+	if (result && message && ast_json_typeof(message) == AST_JSON_OBJECT
+		&& ast_json_object_set(result, "message", ast_json_ref(message))) {
+		ast_json_unref(result);
+		return NULL;
+	}
+	return result;
+}
+
+static void bulk_operation_run(struct bulk_operation *op, struct ast_variable *headers)
+{
+	struct ast_ari_response response = {};
+	struct ast_json *message;
+
+	response.headers = ast_str_create(40);
+	if (!response.headers) {
+		op->result = bulk_result(500, "Internal Server Error", NULL);
+		return;
+	}
+
+	/* No connection; the response is collected instead of sent */
+	ast_ari_invoke(NULL, op->uri, op->method, op->get_params, headers,
+		op->body, &response);
+
+	message = response.message;
+	if (response.body) {
+		ast_json_unref(message);
+		message = ast_json_load_str(response.body, NULL);
+		ast_free(response.body);
+	}
+
+	op->result = bulk_result(response.response_code, response.response_text,
+		message);
+	ast_json_unref(message);
+	ast_free(response.headers);
+}
+
+/*!
+ * \internal
+ * \brief Run chains of operations until none are left.
+ */
+static void bulk_run_chains(struct bulk_run *run)
+{
+	for (;;) {
+		struct bulk_operation *op;
+
+		ast_mutex_lock(&run->lock);
+		if (run->next_chain == AST_VECTOR_SIZE(&run->chains)) {
+			ast_mutex_unlock(&run->lock);
+			return;
+		}
+		op = AST_VECTOR_GET(&run->chains, run->next_chain++);
+		ast_mutex_unlock(&run->lock);
+
+		for (; op; op = op->next) {
+			bulk_operation_run(op, run->headers);
+		}
+	}
+}
+
+static void *bulk_thread(void *data)
+{
+	struct bulk_run *run = data;
+
+	bulk_run_chains(run);
+
+	ast_mutex_lock(&run->lock);
+	if (!--run->threads) {
+		ast_cond_signal(&run->cond);
+	}
+	ast_mutex_unlock(&run->lock);
+	return NULL;
+}
+
+void ast_ari_bulk_run(struct ast_variable *headers,
+	struct ast_ari_bulk_run_args *args,
+	struct ast_ari_response *response)
+{
+	struct ast_json *operations = ast_json_object_get(args->operations, "operations");
+	struct bulk_operation *ops;
+	struct bulk_run run = {
+		.headers = headers,
+	};
+	/* Last operation of each chain, to append to */
+	AST_VECTOR(, struct bulk_operation *) tails;
+	struct ast_json *json = NULL;
+	const char *error = NULL;
+	size_t count;
+	size_t i;
+	int threads;
+
+	if (!operations || ast_json_typeof(operations) != AST_JSON_ARRAY) {
+		ast_ari_response_error(response, 400, "Bad Request",
+			"Body must hold a list of operations");
+		return;
+	}
+	count = ast_json_array_size(operations);
+	if (count > BULK_MAX_OPERATIONS) {
+		ast_ari_response_error(response, 400, "Bad Request",
+			"At most %d operations are allowed", BULK_MAX_OPERATIONS);
+		return;
+	}
+
+	ops = ast_calloc(count ? count : 1, sizeof(*ops));
+	if (!ops || AST_VECTOR_INIT(&run.chains, 8) || AST_VECTOR_INIT(&tails, 8)) {
+		ast_free(ops);
+		AST_VECTOR_FREE(&run.chains);
+		ast_ari_response_alloc_failed(response);
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		size_t len;
+		size_t chain;
+
+		error = bulk_operation_parse(ast_json_array_get(operations, i), &ops[i]);
+		if (error) {
+			break;
+		}
+
+		/* Queue it behind the earlier operations on the same resource */
+		len = bulk_resource_len(ops[i].uri);
+		for (chain = 0; chain < AST_VECTOR_SIZE(&tails); ++chain) {
+			struct bulk_operation *tail = AST_VECTOR_GET(&tails, chain);
+
+			if (bulk_resource_len(tail->uri) == len && !strncmp(tail->uri, ops[i].uri, len)) {
+				break;
+			}
+		}
+		if (chain < AST_VECTOR_SIZE(&tails)) {
+			AST_VECTOR_GET(&tails, chain)->next = &ops[i];
+			AST_VECTOR_REPLACE(&tails, chain, &ops[i]);
+		} else if (AST_VECTOR_APPEND(&run.chains, &ops[i])
+			|| AST_VECTOR_APPEND(&tails, &ops[i])) {
+			error = "Allocation failed";
+			break;
+		}
+	}
+	AST_VECTOR_FREE(&tails);
+
+	if (error) {
+		ast_ari_response_error(response, 400, "Bad Request",
+			"Operation %zu: %s", i, error);
+		goto cleanup;
+	}
+
+	/* The requesting thread runs chains too */
+	ast_mutex_init(&run.lock);
+	ast_cond_init(&run.cond, NULL);
+	threads = MIN(AST_VECTOR_SIZE(&run.chains), BULK_MAX_THREADS) - 1;
+	for (; threads > 0; --threads) {
+		pthread_t thread;
+
+		ast_mutex_lock(&run.lock);
+		++run.threads;
+		ast_mutex_unlock(&run.lock);
+		if (ast_pthread_create_detached(&thread, NULL, bulk_thread, &run)) {
+			ast_mutex_lock(&run.lock);
+			--run.threads;
+			ast_mutex_unlock(&run.lock);
+			break;
+		}
+	}
+
+	bulk_run_chains(&run);
+
+	ast_mutex_lock(&run.lock);
+	while (run.threads) {
+		ast_cond_wait(&run.cond, &run.lock);
+	}
+	ast_mutex_unlock(&run.lock);
+	ast_mutex_destroy(&run.lock);
+	ast_cond_destroy(&run.cond);
+
+	json = ast_json_array_create();
+	for (i = 0; json && i < count; ++i) {
+		if (!ops[i].result || ast_json_array_append(json, ast_json_ref(ops[i].result))) {
+			ast_json_unref(json);
+			json = NULL;
+		}
+	}
+	if (json) {
+		ast_ari_response_ok(response, json);
+	} else {
+		ast_ari_response_alloc_failed(response);
+	}
+
+cleanup:
+	for (i = 0; i < count; ++i) {
+		bulk_operation_cleanup(&ops[i]);
+	}
+	ast_free(ops);
+	AST_VECTOR_FREE(&run.chains);
+}
@@ -0,0 +1,65 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Generated file - declares stubs to be implemented in
+ * res/ari/resource_bulk.c
+ *
+ * Bulk operation resources
+ */
+
+/*
+ * !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+ * !!!!!                               DO NOT EDIT                        !!!!!
+ * !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+ * This file is generated by a mustache template. Please see the original
+ * template in rest-api-templates/ari_resource.h.mustache
+ */
+
+#ifndef _ASTERISK_RESOURCE_BULK_H
+#define _ASTERISK_RESOURCE_BULK_H
+
+#include "asterisk/ari.h"
+
+/*! Argument struct for ast_ari_bulk_run() */
+struct ast_ari_bulk_run_args {
+	/*! The "operations" key in the body object holds the list of operations to run. Each has a "method" (POST, PUT or DELETE), a "uri" relative to /ari, and optionally "query", an object of query parameters, and "body", the JSON body of the operation. Ex. { "operations": [ { "method": "POST", "uri": "channels/1234/mute", "query": { "direction": "in" } } ] } */
+	struct ast_json *operations;
+};
+/*!
+ * \brief Body parsing function for /bulk.
+ * \param body The JSON body from which to parse parameters.
+ * \param[out] args The args structure to parse into.
+ * \retval zero on success
+ * \retval non-zero on failure
+ */
+int ast_ari_bulk_run_parse_body(
+	struct ast_json *body,
+	struct ast_ari_bulk_run_args *args);
+
+/*!
+ * \brief Run several operations in one request.
+ *
+ * Operations on different resources run concurrently. Operations on the same resource, identified by the first two segments of their uri (such as channels/{channelId}), run one after the other in the order given. The results are returned in the order of the operations, whether or not they succeeded.
+ *
+ * \param headers HTTP headers
+ * \param args Swagger parameters
+ * \param[out] response HTTP response
+ */
+void ast_ari_bulk_run(struct ast_variable *headers, struct ast_ari_bulk_run_args *args, struct ast_ari_response *response);
+
+#endif /* _ASTERISK_RESOURCE_BULK_H */
@@ -148,7 +148,7 @@ static void app_handler(void *data, const char *app_name,
 			ast_json_free(str);
 		}
 
-		ast_ari_websocket_session_write(session->ws_session, message);
+		ast_ari_websocket_session_queue(session->ws_session, message);
 	}
 	ao2_unlock(session);
 }
@@ -86,6 +86,7 @@ int unpark_parked_user(struct parked_user *pu)
 {
 	if (pu->lot) {
 		ao2_unlink(pu->lot->parked_users, pu);
+		parking_lot_space_set(pu->lot, pu->parking_space, 0);
 		parking_lot_remove_if_unused(pu->lot);
 		return 0;
 	}
@@ -93,63 +94,140 @@ int unpark_parked_user(struct parked_user *pu)
 	return -1;
 }
 
-int parking_lot_get_space(struct parking_lot *lot, int target_override)
+/*! \brief Number of parking spaces in a word of the spaces_used bitmap */
+#define SPACES_PER_WORD (sizeof(unsigned long) * 8)
+
+/*!
+ * \internal
+ * \brief Make the spaces_used bitmap of a lot cover the spaces of its configuration.
+ *
+ * \param lot The parking lot, locked.
+ *
+ * \details
+ * The bitmap is built again from the parked users when the lot is first
+ * used or its range of spaces was changed by a reload.  Users parked out
+ * of the new range are not in it.
+ *
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+static int parking_lot_spaces_sync(struct parking_lot *lot)
 {
-	int original_target;
-	int current_target;
-	struct ao2_iterator i;
+	int start = lot->cfg->parking_start;
+	int count = lot->cfg->parking_stop - start + 1;
+	unsigned long *spaces_used;
+	struct ao2_iterator iter;
 	struct parked_user *user;
-	int wrap;
 
-	if (lot->cfg->parkfindnext) {
-		/* Use next_space if the lot already has next_space set; otherwise use lot start. */
-		original_target = lot->next_space ? lot->next_space : lot->cfg->parking_start;
-	} else {
-		original_target = lot->cfg->parking_start;
+	if (lot->spaces_used && lot->spaces_start == start && lot->spaces_count == count) {
+		return 0;
 	}
-
-	if (target_override >= lot->cfg->parking_start && target_override <= lot->cfg->parking_stop) {
-		original_target = target_override;
+	if (count <= 0) {
+		return -1;
 	}
 
-	current_target = original_target;
+	spaces_used = ast_calloc((count + SPACES_PER_WORD - 1) / SPACES_PER_WORD, sizeof(*spaces_used));
+	if (!spaces_used) {
+		return -1;
+	}
+	ast_free(lot->spaces_used);
+	lot->spaces_used = spaces_used;
+	lot->spaces_start = start;
+	lot->spaces_count = count;
+
+	iter = ao2_iterator_init(lot->parked_users, 0);
+	for (; (user = ao2_iterator_next(&iter)); ao2_ref(user, -1)) {
+		parking_lot_space_set(lot, user->parking_space, 1);
+	}
+	ao2_iterator_destroy(&iter);
 
-	wrap = lot->cfg->parking_start;
+	return 0;
+}
 
-	i = ao2_iterator_init(lot->parked_users, 0);
-	while ((user = ao2_iterator_next(&i))) {
-		/* Increment the wrap on each pass until we find an empty space */
-		if (wrap == user->parking_space) {
-			wrap += 1;
+void parking_lot_space_set(struct parking_lot *lot, int space, int used)
+{
+	unsigned int idx;
+
+	ao2_lock(lot);
+	if (lot->spaces_used && lot->spaces_start <= space
+		&& space < lot->spaces_start + lot->spaces_count) {
+		idx = space - lot->spaces_start;
+		if (used) {
+			lot->spaces_used[idx / SPACES_PER_WORD] |= 1UL << (idx % SPACES_PER_WORD);
+		} else {
+			lot->spaces_used[idx / SPACES_PER_WORD] &= ~(1UL << (idx % SPACES_PER_WORD));
 		}
+	}
+	ao2_unlock(lot);
+}
 
-		if (user->parking_space < current_target) {
-			/* It's lower than the anticipated target, so we haven't reached the target yet. */
-			ao2_ref(user, -1);
-			continue;
-		}
+/*!
+ * \internal
+ * \brief Find the first free parking space of a lot at or after an index of its bitmap.
+ *
+ * \param lot The parking lot, locked, with an up to date bitmap.
+ * \param from Index in the bitmap to start from.
+ *
+ * \return index of the free space, -1 if none.
+ */
+static int parking_lot_spaces_find_free(struct parking_lot *lot, unsigned int from)
+{
+	unsigned int words = (lot->spaces_count + SPACES_PER_WORD - 1) / SPACES_PER_WORD;
+	unsigned int word = from / SPACES_PER_WORD;
+	unsigned long free_spaces;
+	unsigned int idx;
 
-		if (user->parking_space > current_target) {
-			/* The current target is usable because all items below have been read and the next target is higher than the one we want. */
-			ao2_ref(user, -1);
-			break;
+	if (lot->spaces_count <= from) {
+		return -1;
+	}
+
+	/* Spaces before from count as used in its word */
+	free_spaces = ~lot->spaces_used[word] & (~0UL << (from % SPACES_PER_WORD));
+	while (!free_spaces) {
+		if (++word == words) {
+			return -1;
 		}
+		free_spaces = ~lot->spaces_used[word];
+	}
+
+	for (idx = 0; !(free_spaces & (1UL << idx)); ++idx) {
+	}
+	idx += word * SPACES_PER_WORD;
+
+	/* The bits past the last space of the last word are never set */
+	return idx < lot->spaces_count ? idx : -1;
+}
+
+int parking_lot_get_space(struct parking_lot *lot, int target_override)
+{
+	int original_target;
+	int idx;
+
+	if (parking_lot_spaces_sync(lot)) {
+		return -1;
+	}
 
-		/* We found one already parked here. */
-		current_target += 1;
-		ao2_ref(user, -1);
+	if (lot->cfg->parkfindnext) {
+		/* Use next_space if the lot already has next_space set; otherwise use lot start. */
+		original_target = lot->next_space ? lot->next_space : lot->cfg->parking_start;
+	} else {
+		original_target = lot->cfg->parking_start;
 	}
-	ao2_iterator_destroy(&i);
 
-	if (current_target <= lot->cfg->parking_stop) {
-		return current_target;
+	if (target_override >= lot->cfg->parking_start && target_override <= lot->cfg->parking_stop) {
+		original_target = target_override;
 	}
 
-	if (wrap <= lot->cfg->parking_stop) {
-		return wrap;
+	/* The first free space from the target, or else from the start of the lot */
+	idx = -1;
+	if (original_target >= lot->spaces_start) {
+		idx = parking_lot_spaces_find_free(lot, original_target - lot->spaces_start);
+	}
+	if (idx < 0) {
+		idx = parking_lot_spaces_find_free(lot, 0);
 	}
 
-	return -1;
+	return idx < 0 ? -1 : lot->spaces_start + idx;
 }
 
 static int retrieve_parked_user_targeted(void *obj, void *arg, int flags)
@@ -188,6 +266,8 @@ struct parked_user *parking_lot_retrieve_parked_user(struct parking_lot *lot, in
 	user->resolution = PARK_ANSWERED;
 	ao2_unlock(user);
 
+	parking_lot_space_set(lot, user->parking_space, 0);
+
 	parking_lot_remove_if_unused(user->lot);
 
 	/* Bump the ref count by 1 since the RAII_VAR will eat the reference otherwise */
@@ -93,6 +93,9 @@ struct parking_lot {
 	struct parking_lot_cfg *cfg;              /*!< Reference to configuration object for the parking lot */
 	enum parking_lot_modes mode;              /*!< Whether a parking lot is operational, being reconfigured, primed for deletion, or dynamically created. */
 	int disable_mark;                         /*!< On reload, disable this parking lot if it doesn't receive a new configuration. */
+	unsigned long *spaces_used;               /*!< Bitmap of the parking spaces with a parked user, lot locked to access */
+	int spaces_start;                         /*!< First parking space of spaces_used */
+	int spaces_count;                         /*!< Number of parking spaces in spaces_used */
 
 	AST_DECLARE_STRING_FIELDS(
 		AST_STRING_FIELD(name);               /*!< Name of the parking lot object */
@@ -195,6 +198,20 @@ struct ast_bridge *parking_lot_get_bridge(struct parking_lot *lot);
  */
 int parking_lot_get_space(struct parking_lot *lot, int target_override);
 
+/*!
+ * \since 13.18.0
+ * \brief Mark a parking space of a parking lot as used or free.
+ *
+ * \param lot Which parking lot the space is in
+ * \param space The parking space
+ * \param used Non-zero if a parked user was added to the lot with the space,
+ *        zero if it was removed
+ *
+ * \note Kept up to date for parking_lot_get_space to find free spaces
+ *       without walking the parked users.
+ */
+void parking_lot_space_set(struct parking_lot *lot, int space, int used);
+
 /*!
  * \since 12.0.0
  * \brief Determine if there is a parked user in a parking space and pull it from the parking lot if there is.
@@ -302,6 +302,24 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 			<ref type="application">AGI</ref>
 		</see-also>
 	</agi>
+	<agi name="fastagi release" language="en_US">
+		<synopsis>
+			Ends a FastAGI script and keeps its connection open.
+		</synopsis>
+		<syntax />
+		<description>
+			<para>Returns control to the dialplan like closing the connection
+			would, but leaves the connection open.  Asterisk keeps it and
+			sends the environment of the next FastAGI request to the same
+			server over it instead of connecting again.  Commands sent before
+			this one without waiting for their responses are still run.</para>
+			<para>Returns <literal>0</literal>, or <literal>-1</literal> if not
+			run from FastAGI.</para>
+		</description>
+		<see-also>
+			<ref type="application">AGI</ref>
+		</see-also>
+	</agi>
 	<agi name="get data" language="en_US">
 		<synopsis>
 			Prompts for DTMF on a channel
@@ -1404,6 +1422,9 @@ static int agidebug = 0;
 /*! Special return code for "asyncagi break" command. */
 #define ASYNC_AGI_BREAK	3
 
+/*! Most FastAGI connections kept open for reuse */
+#define FASTAGI_POOL_MAX 64
+
 enum agi_result {
 	AGI_RESULT_FAILURE = -1,
 	AGI_RESULT_SUCCESS,
@@ -1993,6 +2014,154 @@ async_agi_abort:
 #undef AMI_BUF_SIZE
 }
 
+/*!
+ * \brief A connection to a FastAGI server
+ *
+ * Connections the server released with FASTAGI RELEASE are kept in
+ * fastagi_pool for the next request to the same server.
+ */
+struct fastagi_connection {
+	/*! Socket to the server */
+	int fd;
+	/*! Bytes received and not handled yet */
+	size_t len;
+	char buf[AGI_BUF_LEN];
+	/*! Server as given in the URL, "host[:port]" */
+	char server[0];
+};
+
+/*! \brief Released FastAGI connections by server */
+static struct ao2_container *fastagi_pool;
+
+AO2_STRING_FIELD_HASH_FN(fastagi_connection, server);
+AO2_STRING_FIELD_CMP_FN(fastagi_connection, server);
+
+static void fastagi_connection_destroy(void *obj)
+{
+	struct fastagi_connection *conn = obj;
+
+	if (conn->fd > -1) {
+		close(conn->fd);
+	}
+}
+
+static struct fastagi_connection *fastagi_connection_alloc(const char *server, int fd)
+{
+	struct fastagi_connection *conn;
+
+	conn = ao2_alloc_options(sizeof(*conn) + strlen(server) + 1, fastagi_connection_destroy,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!conn) {
+		return NULL;
+	}
+	conn->fd = fd;
+	strcpy(conn->server, server); /* Safe */
+
+	return conn;
+}
+
+/*!
+ * \internal
+ * \brief Take a released connection to a FastAGI server out of the pool
+ *
+ * Connections the server closed or wrote to since releasing them are
+ * dropped.
+ *
+ * \retval NULL if there is no usable connection to the server.
+ */
+static struct fastagi_connection *fastagi_pool_get(const char *server)
+{
+	struct fastagi_connection *conn;
+	struct pollfd pfd;
+
+	while ((conn = ao2_find(fastagi_pool, server, OBJ_SEARCH_KEY | OBJ_UNLINK))) {
+		pfd.fd = conn->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (!ast_poll(&pfd, 1, 0)) {
+			return conn;
+		}
+		ast_debug(4, "Dropping released FastAGI connection to '%s'\n", server);
+		ao2_ref(conn, -1);
+	}
+
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Done with a FastAGI connection, pooling it if the server released it
+ */
+static void fastagi_connection_done(struct fastagi_connection *conn, int released)
+{
+	if (released && !conn->len && ao2_container_count(fastagi_pool) < FASTAGI_POOL_MAX) {
+		ast_debug(4, "Keeping FastAGI connection to '%s'\n", conn->server);
+		ao2_link(fastagi_pool, conn);
+	}
+	ao2_ref(conn, -1);
+}
+
+/*!
+ * \internal
+ * \brief Check if a whole line from the FastAGI server is waiting to be handled
+ */
+static int fastagi_line_ready(struct fastagi_connection *conn)
+{
+	return conn->len == sizeof(conn->buf) || memchr(conn->buf, '\n', conn->len);
+}
+
+/*!
+ * \internal
+ * \brief Read a line from the FastAGI server
+ *
+ * Commands the server sent without waiting for the responses to the
+ * previous ones stay in the connection's buffer until they are handled.
+ *
+ * \param conn The connection, which is non-blocking
+ * \param buf Buffer receiving the line, newline included like fgets()
+ * \param size Size of buf
+ *
+ * \retval 1 a line was read
+ * \retval 0 no whole line was received yet
+ * \retval -1 the server closed the connection, or it failed
+ */
+static int fastagi_read_line(struct fastagi_connection *conn, char *buf, size_t size)
+{
+	char *eol;
+	size_t line_len;
+	ssize_t res;
+
+	if (!fastagi_line_ready(conn)) {
+		res = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+		if (res < 0 && (errno == EINTR || errno == EAGAIN)) {
+			return 0;
+		}
+		if (res <= 0) {
+			if (!conn->len) {
+				return -1;
+			}
+			/* What was left before the server closed is the last line. */
+		} else {
+			conn->len += res;
+			if (!fastagi_line_ready(conn)) {
+				return 0;
+			}
+		}
+	}
+
+	eol = memchr(conn->buf, '\n', conn->len);
+	line_len = eol ? eol - conn->buf + 1 : conn->len;
+	if (line_len > size - 1) {
+		line_len = size - 1;
+	}
+	memcpy(buf, conn->buf, line_len);
+	buf[line_len] = '\0';
+	conn->len -= line_len;
+	memmove(conn->buf, conn->buf + line_len, conn->len);
+
+	return 1;
+}
+
 /*!
  * \internal
  * \brief Handle the connection that was started by launch_netscript.
@@ -2043,28 +2212,21 @@ static int handle_connection(const char *agiurl, const struct ast_sockaddr addr,
 	return 0;
 }
 
-/* launch_netscript: The fastagi handler.
-	FastAGI defaults to port 4573 */
-static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds)
+/*!
+ * \internal
+ * \brief Connect to a FastAGI server
+ *
+ * \return the non-blocking socket, or -1 on failure.
+ */
+static int fastagi_connect(const char *agiurl, const char *host)
 {
 	int s = 0, flags;
-	char *host, *script;
 	int num_addrs = 0, i = 0;
 	struct ast_sockaddr *addrs;
 
-	/* agiurl is "agi://host.domain[:port][/script/name]" */
-	host = ast_strdupa(agiurl + 6);	/* Remove agi:// */
-
-	/* Strip off any script name */
-	if ((script = strchr(host, '/'))) {
-		*script++ = '\0';
-	} else {
-		script = "";
-	}
-
 	if (!(num_addrs = ast_sockaddr_resolve(&addrs, host, 0, AST_AF_UNSPEC))) {
 		ast_log(LOG_WARNING, "Unable to locate host '%s'\n", host);
-		return AGI_RESULT_FAILURE;
+		return -1;
 	}
 
 	for (i = 0; i < num_addrs; i++) {
@@ -2108,13 +2270,50 @@ static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds)
 
 	if (i == num_addrs) {
 		ast_log(LOG_WARNING, "Couldn't connect to any host.  FastAGI failed.\n");
-		return AGI_RESULT_FAILURE;
+		return -1;
 	}
 
+	return s;
+}
+
+/* launch_netscript: The fastagi handler.
+	FastAGI defaults to port 4573 */
+static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds, struct fastagi_connection **conn)
+{
+	int s;
+	char *host, *script;
+
+	/* agiurl is "agi://host.domain[:port][/script/name]" */
+	host = ast_strdupa(agiurl + 6);	/* Remove agi:// */
+
+	/* Strip off any script name */
+	if ((script = strchr(host, '/'))) {
+		*script++ = '\0';
+	} else {
+		script = "";
+	}
+
+	*conn = fastagi_pool_get(host);
+	if (*conn) {
+		ast_debug(4, "Reusing FastAGI connection to '%s'\n", host);
+	} else {
+		s = fastagi_connect(agiurl, host);
+		if (s < 0) {
+			return AGI_RESULT_FAILURE;
+		}
+		*conn = fastagi_connection_alloc(host, s);
+		if (!*conn) {
+			close(s);
+			return AGI_RESULT_FAILURE;
+		}
+	}
+	s = (*conn)->fd;
+
 	if (ast_agi_send(s, NULL, "agi_network: yes\n") < 0) {
 		if (errno != EINTR) {
 			ast_log(LOG_WARNING, "Connect to '%s' failed: %s\n", agiurl, strerror(errno));
-			close(s);
+			ao2_ref(*conn, -1);
+			*conn = NULL;
 			return AGI_RESULT_FAILURE;
 		}
 	}
@@ -2150,7 +2349,7 @@ static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds)
  *
  * \return the result of the AGI operation.
  */
-static enum agi_result launch_ha_netscript(char *agiurl, char *argv[], int *fds)
+static enum agi_result launch_ha_netscript(char *agiurl, char *argv[], int *fds, struct fastagi_connection **conn)
 {
 	char *host, *script;
 	enum agi_result result;
@@ -2177,14 +2376,14 @@ static enum agi_result launch_ha_netscript(char *agiurl, char *argv[], int *fds)
 
 	if (strchr(host, ':')) {
 		ast_log(LOG_WARNING, "Specifying a port number disables SRV lookups: %s\n", agiurl);
-		return launch_netscript(agiurl + 1, argv, fds); /* +1 to strip off leading h from hagi:// */
+		return launch_netscript(agiurl + 1, argv, fds, conn); /* +1 to strip off leading h from hagi:// */
 	}
 
 	snprintf(service, sizeof(service), "%s%s", SRV_PREFIX, host);
 
 	while (!(srv_ret = ast_srv_lookup(&context, service, &srvhost, &srvport))) {
 		snprintf(resolved_uri, sizeof(resolved_uri), "agi://%s:%d/%s", srvhost, srvport, script);
-		result = launch_netscript(resolved_uri, argv, fds);
+		result = launch_netscript(resolved_uri, argv, fds, conn);
 		if (result == AGI_RESULT_FAILURE || result == AGI_RESULT_NOTFOUND) {
 			ast_log(LOG_WARNING, "AGI request failed for host '%s' (%s:%d)\n", host, srvhost, srvport);
 		} else {
@@ -2204,17 +2403,18 @@ static enum agi_result launch_ha_netscript(char *agiurl, char *argv[], int *fds)
 	return AGI_RESULT_FAILURE;
 }
 
-static enum agi_result launch_script(struct ast_channel *chan, char *script, int argc, char *argv[], int *fds, int *efd, int *opid)
+static enum agi_result launch_script(struct ast_channel *chan, char *script, int argc, char *argv[], int *fds, int *efd, int *opid,
+	struct fastagi_connection **conn)
 {
 	char tmp[256];
 	int pid, toast[2], fromast[2], audio[2], res;
 	struct stat st;
 
 	if (!strncasecmp(script, "agi://", 6)) {
-		return (efd == NULL) ? launch_netscript(script, argv, fds) : AGI_RESULT_FAILURE;
+		return (efd == NULL) ? launch_netscript(script, argv, fds, conn) : AGI_RESULT_FAILURE;
 	}
 	if (!strncasecmp(script, "hagi://", 7)) {
-		return (efd == NULL) ? launch_ha_netscript(script, argv, fds) : AGI_RESULT_FAILURE;
+		return (efd == NULL) ? launch_ha_netscript(script, argv, fds, conn) : AGI_RESULT_FAILURE;
 	}
 	if (!strncasecmp(script, "agi:async", sizeof("agi:async") - 1)) {
 		return launch_asyncagi(chan, argc, argv, efd);
@@ -2387,6 +2587,17 @@ static int handle_asyncagi_break(struct ast_channel *chan, AGI *agi, int argc, c
 	return ASYNC_AGI_BREAK;
 }
 
+static int handle_fastagi_release(struct ast_channel *chan, AGI *agi, int argc, const char * const argv[])
+{
+	if (!agi->fast) {
+		ast_agi_send(agi->fd, chan, "200 result=-1\n");
+		return RESULT_SUCCESS;
+	}
+	agi->released = 1;
+	ast_agi_send(agi->fd, chan, "200 result=0\n");
+	return RESULT_SUCCESS;
+}
+
 static int handle_waitfordigit(struct ast_channel *chan, AGI *agi, int argc, const char * const argv[])
 {
 	int res, to;
@@ -3720,6 +3931,7 @@ static struct agi_command commands[] = {
 	{ { "database", "get", NULL }, handle_dbget, NULL, NULL, 1 },
 	{ { "database", "put", NULL }, handle_dbput, NULL, NULL, 1 },
 	{ { "exec", NULL }, handle_exec, NULL, NULL, 1 },
+	{ { "fastagi", "release", NULL }, handle_fastagi_release, NULL, NULL, 1 },
 	{ { "get", "data", NULL }, handle_getdata, NULL, NULL, 0 },
 	{ { "get", "full", "variable", NULL }, handle_getvariablefull, NULL, NULL, 1 },
 	{ { "get", "option", NULL }, handle_getoption, NULL, NULL, 0 },
@@ -4122,7 +4334,8 @@ static enum agi_result agi_handle_command(struct ast_channel *chan, AGI *agi, ch
 	return AGI_RESULT_SUCCESS;
 }
 
-static enum agi_result run_agi(struct ast_channel *chan, char *request, AGI *agi, int pid, int *status, int dead, int argc, char *argv[])
+static enum agi_result run_agi(struct ast_channel *chan, char *request, AGI *agi, int pid, int *status, int dead, int argc, char *argv[],
+	struct fastagi_connection *conn)
 {
 	struct ast_channel *c;
 	int outfd;
@@ -4132,7 +4345,7 @@ static enum agi_result run_agi(struct ast_channel *chan, char *request, AGI *agi
 	struct ast_frame *f;
 	char buf[AGI_BUF_LEN];
 	char *res = NULL;
-	FILE *readf;
+	FILE *readf = NULL;
 	/* how many times we'll retry if ast_waitfor_nandfs will return without either
 	  channel or file descriptor in case select is interrupted by a system call (EINTR) */
 	int retry = AGI_NANDFS_RETRY;
@@ -4150,15 +4363,18 @@ static enum agi_result run_agi(struct ast_channel *chan, char *request, AGI *agi
 	exit_on_hangup = ast_true(exit_on_hangup_str);
 	ast_channel_unlock(chan);
 
-	if (!(readf = fdopen(agi->ctrl, "r"))) {
-		ast_log(LOG_WARNING, "Unable to fdopen file descriptor\n");
-		if (send_sighup && pid > -1)
-			kill(pid, SIGHUP);
-		close(agi->ctrl);
-		return AGI_RESULT_FAILURE;
-	}
+	/* FastAGI reads from the connection, which outlives the script if released */
+	if (!agi->fast) {
+		if (!(readf = fdopen(agi->ctrl, "r"))) {
+			ast_log(LOG_WARNING, "Unable to fdopen file descriptor\n");
+			if (send_sighup && pid > -1)
+				kill(pid, SIGHUP);
+			close(agi->ctrl);
+			return AGI_RESULT_FAILURE;
+		}
 
-	setlinebuf(readf);
+		setlinebuf(readf);
+	}
 	setup_env(chan, request, agi->fd, (agi->audio > -1), argc, argv);
 	for (;;) {
 		if (needhup) {
@@ -4176,7 +4392,11 @@ static enum agi_result run_agi(struct ast_channel *chan, char *request, AGI *agi
 			}
 		}
 		ms = -1;
-		if (dead || in_intercept) {
+		if (agi->fast && fastagi_line_ready(conn)) {
+			/* Commands the server sent together are run without waiting */
+			c = NULL;
+			outfd = agi->ctrl;
+		} else if (dead || in_intercept) {
 			c = ast_waitfor_nandfds(&chan, 0, &agi->ctrl, 1, NULL, &outfd, &ms);
 		} else if (!ast_check_hangup(chan)) {
 			c = ast_waitfor_nandfds(&chan, 1, &agi->ctrl, 1, NULL, &outfd, &ms);
@@ -4214,7 +4434,18 @@ static enum agi_result run_agi(struct ast_channel *chan, char *request, AGI *agi
 			retry = AGI_NANDFS_RETRY;
 			buf[0] = '\0';
 
-			while (len > 1) {
+			if (agi->fast) {
+				switch (fastagi_read_line(conn, buf, sizeof(buf))) {
+				case 0:
+					/* Wait for the rest of the line */
+					continue;
+				case -1:
+					buf[0] = '\0';
+					break;
+				}
+			}
+
+			while (!agi->fast && len > 1) {
 				res = fgets(buf + buflen, len, readf);
 				if (feof(readf))
 					break;
@@ -4265,6 +4496,10 @@ static enum agi_result run_agi(struct ast_channel *chan, char *request, AGI *agi
 			default:
 				break;
 			}
+			if (agi->released) {
+				ast_verb(3, "<%s>AGI Script %s released its connection, returning %d\n", ast_channel_name(chan), request, returnstatus);
+				break;
+			}
 		} else {
 			if (--retry <= 0) {
 				ast_log(LOG_WARNING, "No channel, no fd?\n");
@@ -4286,11 +4521,13 @@ static enum agi_result run_agi(struct ast_channel *chan, char *request, AGI *agi
 				usleep(1);
 			}
 			waitpid(pid, status, WNOHANG);
-		} else if (agi->fast) {
+		} else if (agi->fast && !agi->released) {
 			ast_agi_send(agi->fd, chan, "HANGUP\n");
 		}
 	}
-	fclose(readf);
+	if (readf) {
+		fclose(readf);
+	}
 	return returnstatus;
 }
 
@@ -4509,6 +4746,7 @@ static int agi_exec_full(struct ast_channel *chan, const char *data, int enhance
 	enum agi_result res;
 	char *buf;
 	int fds[2], efd = -1, pid = -1;
+	struct fastagi_connection *conn = NULL;
 	AST_DECLARE_APP_ARGS(args,
 		AST_APP_ARG(arg)[MAX_ARGS];
 	);
@@ -4531,7 +4769,7 @@ static int agi_exec_full(struct ast_channel *chan, const char *data, int enhance
 			return -1;
 	}
 #endif
-	res = launch_script(chan, args.argv[0], args.argc, args.argv, fds, enhanced ? &efd : NULL, &pid);
+	res = launch_script(chan, args.argv[0], args.argc, args.argv, fds, enhanced ? &efd : NULL, &pid, &conn);
 	/* Async AGI do not require run_agi(), so just proceed if normal AGI
 	   or Fast AGI are setup with success. */
 	if (res == AGI_RESULT_SUCCESS || res == AGI_RESULT_SUCCESS_FAST) {
@@ -4540,11 +4778,14 @@ static int agi_exec_full(struct ast_channel *chan, const char *data, int enhance
 		agi.ctrl = fds[0];
 		agi.audio = efd;
 		agi.fast = (res == AGI_RESULT_SUCCESS_FAST) ? 1 : 0;
-		res = run_agi(chan, args.argv[0], &agi, pid, &status, dead, args.argc, args.argv);
+		res = run_agi(chan, args.argv[0], &agi, pid, &status, dead, args.argc, args.argv, conn);
 		/* If the fork'd process returns non-zero, set AGISTATUS to FAILURE */
 		if ((res == AGI_RESULT_SUCCESS || res == AGI_RESULT_SUCCESS_FAST) && status)
 			res = AGI_RESULT_FAILURE;
-		if (fds[1] != fds[0])
+		if (conn) {
+			/* The connection closes its socket unless pooled */
+			fastagi_connection_done(conn, agi.released);
+		} else if (fds[1] != fds[0])
 			close(fds[1]);
 		if (efd > -1)
 			close(efd);
@@ -4689,6 +4930,8 @@ static int unload_module(void)
 	ast_manager_unregister("AGI");
 	ast_unregister_application(app);
 	AST_TEST_UNREGISTER(test_agi_null_docs);
+	ao2_cleanup(fastagi_pool);
+	fastagi_pool = NULL;
 	return 0;
 }
 
@@ -4696,6 +4939,11 @@ static int load_module(void)
 {
 	int err = 0;
 
+	fastagi_pool = ao2_container_alloc(37, fastagi_connection_hash_fn, fastagi_connection_cmp_fn);
+	if (!fastagi_pool) {
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
 	err |= STASIS_MESSAGE_TYPE_INIT(agi_exec_start_type);
 	err |= STASIS_MESSAGE_TYPE_INIT(agi_exec_end_type);
 	err |= STASIS_MESSAGE_TYPE_INIT(agi_async_start_type);
@@ -103,6 +103,31 @@
 						Value is in milliseconds; default is 100 ms.</para>
 					</description>
 				</configOption>
+				<configOption name="websocket_queue_limit" default="10000">
+					<synopsis>The most events a WebSocket connection may have waiting to be written.</synopsis>
+					<description>
+						<para>Events are queued for each WebSocket connection and written
+						to it by a thread of the connection, so a client that reads slowly
+						does not hold up call control. A warning is logged when a
+						connection has half this many events waiting. What happens to
+						further events once the limit is reached is set by
+						<literal>websocket_overflow</literal>.</para>
+					</description>
+				</configOption>
+				<configOption name="websocket_overflow" default="close">
+					<synopsis>What to do with events for a WebSocket connection that has reached websocket_queue_limit.</synopsis>
+					<description>
+						<enumlist>
+							<enum name="close"><para>Close the connection.</para></enum>
+							<enum name="drop"><para>Drop the event.</para></enum>
+							<enum name="coalesce"><para>If the event replaces the state
+							of a channel or device in an event that is still waiting, such as
+							<literal>ChannelStateChange</literal> or
+							<literal>DeviceStateChanged</literal>, the waiting event is replaced
+							with it. Other events are dropped.</para></enum>
+						</enumlist>
+					</description>
+				</configOption>
 				<configOption name="pretty">
 					<synopsis>Responses from ARI are formatted to be human readable</synopsis>
 				</configOption>
@@ -281,6 +306,25 @@ void ast_ari_response_ok(struct ast_ari_response *response,
 	response->response_text = "OK";
 }
 
+void ast_ari_response_ok_encoded(struct ast_ari_response *response,
+	struct ast_str *body)
+{
+#if defined(AST_DEVMODE)
+	/* The response validators only understand JSON trees */
+	response->message = ast_json_load_str(body, NULL);
+	ast_free(body);
+	if (!response->message) {
+		ast_ari_response_alloc_failed(response);
+		return;
+	}
+#else
+	response->message = ast_json_null();
+	response->body = body;
+#endif
+	response->response_code = 200;
+	response->response_text = "OK";
+}
+
 void ast_ari_response_no_content(struct ast_ari_response *response)
 {
 	response->message = ast_json_null();
@@ -553,6 +597,13 @@ void ast_ari_invoke(struct ast_tcptls_session_instance *ser,
 	}
 
 	if (handler->ws_server && method == AST_HTTP_GET) {
+		if (!ser) {
+			/* Invoked without a connection, as by a bulk request */
+			ast_ari_response_error(
+				response, 400, "Bad Request",
+				"WebSocket upgrade requires a connection");
+			return;
+		}
 		/* WebSocket! */
 		ari_handle_websocket(handler->ws_server, ser, uri, method,
 			get_params, headers);
@@ -1048,6 +1099,7 @@ static int ast_ari_callback(struct ast_tcptls_session_instance *ser,
 		/* The handler indicates no further response is necessary.
 		 * Probably because it already handled it */
 		ast_free(response.headers);
+		ast_free(response.body);
 		return 0;
 	}
 
@@ -1062,7 +1114,14 @@ request_failed:
 	/* response.message could be NULL, in which case the empty response_body
 	 * is correct
 	 */
-	if (response.message && !ast_json_is_null(response.message)) {
+	if (response.body) {
+		/* Already encoded by the handler */
+		ast_str_append(&response.headers, 0,
+			       "Content-type: application/json\r\n");
+		ast_free(response_body);
+		response_body = response.body;
+		response.body = NULL;
+	} else if (response.message && !ast_json_is_null(response.message)) {
 		ast_str_append(&response.headers, 0,
 			       "Content-type: application/json\r\n");
 		if (ast_json_dump_str_format(response.message, &response_body,
@@ -88,6 +88,43 @@ struct corosync_node {
 		(AST_BACKGROUND_STACKSIZE + (3 * COROSYNC_IPC_BUFFER_SIZE)),	\
 		__FILE__, __FUNCTION__, __LINE__, #c)
 
+/*! \brief Most bytes of events sent to the cluster in one CPG message */
+#define COROSYNC_BATCH_SIZE				(64 * 1024)
+
+/*! \brief Number of buckets of the containers of coalesced events */
+#define COALESCED_EVENT_BUCKETS				257
+
+/*!
+ * \brief Milliseconds device state and MWI events are held to be sent in one
+ * message, 0 to send every event at once
+ */
+static unsigned int coalesce_interval;
+
+/*! \brief A device state or MWI event, keyed by the device or mailbox it is about */
+struct coalesced_event {
+	/*! The event */
+	struct ast_event *event;
+	/*! 'd:device@' or 'm:mailbox@context' */
+	char key[0];
+};
+
+/*! \brief Latest event of each device or mailbox, waiting for the next batch */
+static struct ao2_container *pending_events;
+
+/*! \brief Last event sent of each device or mailbox, so unchanged ones are not sent again */
+static struct ao2_container *sent_events;
+
+AO2_STRING_FIELD_HASH_FN(coalesced_event, key);
+AO2_STRING_FIELD_CMP_FN(coalesced_event, key);
+
+/*! \brief Events sent to the cluster in one CPG message */
+struct event_batch {
+	/*! Bytes of buf used */
+	size_t len;
+	/*! The events, one after the other */
+	unsigned char buf[COROSYNC_BATCH_SIZE];
+};
+
 static struct corosync_node *corosync_node_alloc(struct ast_event *event)
 {
 	struct corosync_node *node;
@@ -471,20 +508,12 @@ static void cfg_shutdown_cb(corosync_cfg_handle_t cfg_handle,
 {
 }
 
-static void cpg_deliver_cb(cpg_handle_t handle, const struct cpg_name *group_name,
-		uint32_t nodeid, uint32_t pid, void *msg, size_t msg_len)
+static void deliver_event(void *msg, size_t msg_len)
 {
 	struct ast_event *event;
 	void (*publish_handler)(struct ast_event *) = NULL;
 	enum ast_event_type event_type;
 
-	if (msg_len < ast_event_minimum_length()) {
-		ast_debug(1, "Ignoring event that's too small. %u < %u\n",
-			(unsigned int) msg_len,
-			(unsigned int) ast_event_minimum_length());
-		return;
-	}
-
 	if (!ast_eid_cmp(&ast_eid_default, ast_event_get_ie_raw(msg, AST_EVENT_IE_EID))) {
 		/* Don't feed events back in that originated locally. */
 		return;
@@ -525,6 +554,33 @@ static void cpg_deliver_cb(cpg_handle_t handle, const struct cpg_name *group_nam
 	publish_handler(event);
 }
 
+static void cpg_deliver_cb(cpg_handle_t handle, const struct cpg_name *group_name,
+		uint32_t nodeid, uint32_t pid, void *msg, size_t msg_len)
+{
+	size_t event_len;
+
+	if (msg_len < ast_event_minimum_length()) {
+		ast_debug(1, "Ignoring event that's too small. %u < %u\n",
+			(unsigned int) msg_len,
+			(unsigned int) ast_event_minimum_length());
+		return;
+	}
+
+	/* A message is either one event or a batch of them, one after the other. */
+	do {
+		event_len = ast_event_get_size(msg);
+		if (event_len < ast_event_minimum_length() || event_len > msg_len) {
+			/* A message with a single event may carry trailing bytes. */
+			event_len = msg_len;
+		}
+
+		deliver_event(msg, event_len);
+
+		msg = (unsigned char *) msg + event_len;
+		msg_len -= event_len;
+	} while (msg_len >= ast_event_minimum_length());
+}
+
 static void publish_event_to_corosync(struct ast_event *event)
 {
 	cs_error_t cs_err;
@@ -544,19 +600,190 @@ static void publish_event_to_corosync(struct ast_event *event)
 	}
 }
 
-static void publish_to_corosync(struct stasis_message *message)
+static void event_batch_send(struct event_batch *batch)
+{
+	cs_error_t cs_err;
+	struct iovec iov;
+
+	if (!batch->len) {
+		return;
+	}
+
+	iov.iov_base = batch->buf;
+	iov.iov_len = batch->len;
+
+	ast_debug(5, "Publishing batch of %zu bytes of events to corosync\n", batch->len);
+
+	if ((cs_err = cpg_mcast_joined(cpg_handle, CPG_TYPE_FIFO, &iov, 1)) != CS_OK) {
+		ast_log(LOG_WARNING, "CPG mcast failed (%u) for batch of %zu bytes of events\n",
+			cs_err, batch->len);
+	}
+	batch->len = 0;
+}
+
+/*!
+ * \brief Add an event to a batch, sending the batch first if it does not fit
+ *
+ * \param batch The batch, NULL to send the event by itself
+ * \param event The event, copied into the batch
+ */
+static void event_batch_add(struct event_batch *batch, struct ast_event *event)
+{
+	size_t len = ast_event_get_size(event);
+
+	if (!batch || len > sizeof(batch->buf)) {
+		publish_event_to_corosync(event);
+		return;
+	}
+
+	if (batch->len + len > sizeof(batch->buf)) {
+		event_batch_send(batch);
+	}
+	memcpy(batch->buf + batch->len, event, len);
+	batch->len += len;
+}
+
+static void coalesced_event_dtor(void *obj)
+{
+	struct coalesced_event *coalesced = obj;
+
+	ast_event_destroy(coalesced->event);
+}
+
+/*!
+ * \brief Key an event by the device or mailbox it is about
+ *
+ * \param event The event, owned by the coalesced event on success
+ *
+ * \retval NULL if the event is not a device state or MWI event
+ */
+static struct coalesced_event *coalesced_event_alloc(struct ast_event *event)
+{
+	struct coalesced_event *coalesced;
+	const char *id;
+	const char *context = "";
+	char kind;
+
+	switch (ast_event_get_type(event)) {
+	case AST_EVENT_DEVICE_STATE_CHANGE:
+		kind = 'd';
+		id = ast_event_get_ie_str(event, AST_EVENT_IE_DEVICE);
+		break;
+	case AST_EVENT_MWI:
+		kind = 'm';
+		id = ast_event_get_ie_str(event, AST_EVENT_IE_MAILBOX);
+		context = S_OR(ast_event_get_ie_str(event, AST_EVENT_IE_CONTEXT), "");
+		break;
+	default:
+		return NULL;
+	}
+
+	if (!id) {
+		return NULL;
+	}
+
+	coalesced = ao2_alloc_options(sizeof(*coalesced) + strlen(id) + strlen(context) + 4,
+		coalesced_event_dtor, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!coalesced) {
+		return NULL;
+	}
+
+	sprintf(coalesced->key, "%c:%s@%s", kind, id, context); /* Safe */
+	coalesced->event = event;
+
+	return coalesced;
+}
+
+/*!
+ * \brief Hold an event for the next batch, replacing the one held for its device or mailbox
+ *
+ * \retval 0 the event is held
+ * \retval -1 the event is not coalesced and must be sent now
+ */
+static int coalesce_event(struct ast_event *event)
+{
+	struct coalesced_event *coalesced;
+
+	coalesced = coalesced_event_alloc(event);
+	if (!coalesced) {
+		return -1;
+	}
+
+	ao2_lock(pending_events);
+	ao2_find(pending_events, coalesced->key, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA | OBJ_NOLOCK);
+	ao2_link_flags(pending_events, coalesced, OBJ_NOLOCK);
+	ao2_unlock(pending_events);
+	ao2_ref(coalesced, -1);
+
+	return 0;
+}
+
+/*! \brief Send the events held since the last batch that differ from the last ones sent */
+static void send_pending_events(void)
+{
+	struct ao2_iterator *iter;
+	struct coalesced_event *coalesced;
+	struct coalesced_event *sent;
+	struct event_batch *batch;
+	size_t len;
+
+	if (!ao2_container_count(pending_events)) {
+		return;
+	}
+
+	iter = ao2_callback(pending_events, OBJ_MULTIPLE | OBJ_UNLINK, NULL, NULL);
+	if (!iter) {
+		return;
+	}
+
+	/* Without a batch, every changed event is sent by itself. */
+	batch = ast_malloc(sizeof(*batch));
+	if (batch) {
+		batch->len = 0;
+	}
+
+	for (; (coalesced = ao2_iterator_next(iter)); ao2_ref(coalesced, -1)) {
+		len = ast_event_get_size(coalesced->event);
+
+		sent = ao2_find(sent_events, coalesced->key, OBJ_SEARCH_KEY | OBJ_UNLINK);
+		if (sent && ast_event_get_size(sent->event) == len
+			&& !memcmp(sent->event, coalesced->event, len)) {
+			/* The cluster already has this state. */
+			ao2_link(sent_events, sent);
+			ao2_ref(sent, -1);
+			continue;
+		}
+		ao2_cleanup(sent);
+
+		ao2_link(sent_events, coalesced);
+		event_batch_add(batch, coalesced->event);
+	}
+	ao2_iterator_destroy(iter);
+
+	if (batch) {
+		event_batch_send(batch);
+		ast_free(batch);
+	}
+}
+
+/*!
+ * \brief Convert a message to the event to send to the cluster
+ *
+ * \retval NULL if it is not an event or did not originate from this server
+ */
+static struct ast_event *message_to_local_event(struct stasis_message *message)
 {
 	struct ast_event *event;
 
 	event = stasis_message_to_event(message);
 	if (!event) {
-		return;
+		return NULL;
 	}
 
 	if (ast_eid_cmp(&ast_eid_default, ast_event_get_ie_raw(event, AST_EVENT_IE_EID))) {
 		/* If the event didn't originate from this server, don't send it back out. */
 		ast_event_destroy(event);
-		return;
+		return NULL;
 	}
 
 	if (ast_event_get_type(event) == AST_EVENT_PING) {
@@ -568,7 +795,25 @@ static void publish_to_corosync(struct stasis_message *message)
 		ast_log(LOG_NOTICE, "Sending event PING from this server with EID: '%s'\n", buf);
 	}
 
+	return event;
+}
+
+static void publish_to_corosync(struct stasis_message *message)
+{
+	struct ast_event *event;
+
+	event = message_to_local_event(message);
+	if (!event) {
+		return;
+	}
+
+	if (coalesce_interval && !coalesce_event(event)) {
+		/* Sent with the next batch */
+		return;
+	}
+
 	publish_event_to_corosync(event);
+	ast_event_destroy(event);
 }
 
 static void stasis_message_cb(void *data, struct stasis_subscription *sub, struct stasis_message *message)
@@ -583,12 +828,20 @@ static void stasis_message_cb(void *data, struct stasis_subscription *sub, struc
 static int dump_cache_cb(void *obj, void *arg, int flags)
 {
 	struct stasis_message *message = obj;
+	struct event_batch *batch = arg;
+	struct ast_event *event;
 
 	if (!message) {
 		return 0;
 	}
 
-	publish_to_corosync(message);
+	event = message_to_local_event(message);
+	if (!event) {
+		return 0;
+	}
+
+	event_batch_add(batch, event);
+	ast_event_destroy(event);
 
 	return 0;
 }
@@ -598,6 +851,7 @@ static void cpg_confchg_cb(cpg_handle_t handle, const struct cpg_name *group_nam
 		const struct cpg_address *left_list, size_t left_list_entries,
 		const struct cpg_address *joined_list, size_t joined_list_entries)
 {
+	struct event_batch *batch = NULL;
 	unsigned int i;
 
 
@@ -620,6 +874,14 @@ static void cpg_confchg_cb(cpg_handle_t handle, const struct cpg_name *group_nam
 		return;
 	}
 
+	/* Nodes sending batches take them, so the cache is sent in as few messages as it fits. */
+	if (coalesce_interval) {
+		batch = ast_malloc(sizeof(*batch));
+		if (batch) {
+			batch->len = 0;
+		}
+	}
+
 	for (i = 0; i < ARRAY_LEN(event_types); i++) {
 		struct ao2_container *messages;
 
@@ -639,10 +901,15 @@ static void cpg_confchg_cb(cpg_handle_t handle, const struct cpg_name *group_nam
 			&ast_eid_default);
 		ast_rwlock_unlock(&event_types_lock);
 
-		ao2_callback(messages, OBJ_NODATA, dump_cache_cb, NULL);
+		ao2_callback(messages, OBJ_NODATA, dump_cache_cb, batch);
 
 		ao2_t_ref(messages, -1, "Dispose of dumped cache");
 	}
+
+	if (batch) {
+		event_batch_send(batch);
+		ast_free(batch);
+	}
 }
 
 /*! \brief Informs the cluster of our EID and our IP addresses */
@@ -687,6 +954,8 @@ static void send_cluster_notify(void)
 static void *dispatch_thread_handler(void *data)
 {
 	cs_error_t cs_err;
+	struct timeval next_batch = ast_tvnow();
+	int timeout = -1;
 	struct pollfd pfd[3] = {
 		{ .events = POLLIN, },
 		{ .events = POLLIN, },
@@ -715,7 +984,11 @@ static void *dispatch_thread_handler(void *data)
 		pfd[1].revents = 0;
 		pfd[2].revents = 0;
 
-		res = ast_poll(pfd, ARRAY_LEN(pfd), -1);
+		if (coalesce_interval) {
+			timeout = MAX(ast_tvdiff_ms(next_batch, ast_tvnow()), 0);
+		}
+
+		res = ast_poll(pfd, ARRAY_LEN(pfd), timeout);
 		if (res == -1 && errno != EINTR && errno != EAGAIN) {
 			ast_log(LOG_ERROR, "poll() error: %s (%d)\n", strerror(errno), errno);
 			continue;
@@ -733,6 +1006,11 @@ static void *dispatch_thread_handler(void *data)
 			}
 		}
 
+		if (coalesce_interval && ast_tvdiff_ms(next_batch, ast_tvnow()) <= 0) {
+			send_pending_events();
+			next_batch = ast_tvadd(ast_tvnow(), ast_samp2tv(coalesce_interval, 1000));
+		}
+
 		if (cs_err == CS_ERR_LIBRARY || cs_err == CS_ERR_BAD_HANDLE) {
 			struct cpg_name name;
 
@@ -939,6 +1217,10 @@ static char *corosync_show_config(struct ast_cli_entry *e, int cmd, struct ast_c
 	}
 	ast_rwlock_unlock(&event_types_lock);
 
+	if (coalesce_interval) {
+		ast_cli(a->fd, "=== ==> Coalescing Interval: %u ms\n", coalesce_interval);
+	}
+
 	ast_cli(a->fd, "===\n"
 	               "=============================================================\n"
 	               "\n");
@@ -993,12 +1275,18 @@ static int load_general_config(struct ast_config *cfg)
 		event_types[i].publish = event_types[i].publish_default;
 		event_types[i].subscribe = event_types[i].subscribe_default;
 	}
+	coalesce_interval = 0;
 
 	for (v = ast_variable_browse(cfg, "general"); v && !res; v = v->next) {
 		if (!strcasecmp(v->name, "publish_event")) {
 			res = set_event(v->value, PUBLISH);
 		} else if (!strcasecmp(v->name, "subscribe_event")) {
 			res = set_event(v->value, SUBSCRIBE);
+		} else if (!strcasecmp(v->name, "coalesce_interval")) {
+			if (sscanf(v->value, "%30u", &coalesce_interval) != 1) {
+				ast_log(LOG_WARNING, "Invalid coalesce_interval '%s'\n", v->value);
+				coalesce_interval = 0;
+			}
 		} else {
 			ast_log(LOG_WARNING, "Unknown option '%s'\n", v->name);
 		}
@@ -1115,6 +1403,11 @@ static void cleanup_module(void)
 
 	ao2_cleanup(nodes);
 	nodes = NULL;
+
+	ao2_cleanup(pending_events);
+	pending_events = NULL;
+	ao2_cleanup(sent_events);
+	sent_events = NULL;
 }
 
 static int load_module(void)
@@ -1132,6 +1425,14 @@ static int load_module(void)
 		goto failed;
 	}
 
+	pending_events = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0,
+		COALESCED_EVENT_BUCKETS, coalesced_event_hash_fn, NULL, coalesced_event_cmp_fn);
+	sent_events = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0,
+		COALESCED_EVENT_BUCKETS, coalesced_event_hash_fn, NULL, coalesced_event_cmp_fn);
+	if (!pending_events || !sent_events) {
+		goto failed;
+	}
+
 	corosync_aggregate_topic = stasis_topic_create("corosync_aggregate_topic");
 	if (!corosync_aggregate_topic) {
 		ast_log(AST_LOG_ERROR, "Failed to create stasis topic for corosync\n");
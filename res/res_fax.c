@@ -1433,7 +1433,7 @@ static int report_fax_status(struct ast_channel *chan, struct ast_fax_session_de
 		if (!message) {
 			return -1;
 		}
-		stasis_publish(ast_channel_topic(chan), message);
+		stasis_publish(ast_channel_topic_for_publish(chan), message);
 	}
 	return 0;
 }
@@ -2068,7 +2068,7 @@ static int report_receive_fax_status(struct ast_channel *chan, const char *filen
 		if (!message) {
 			return -1;
 		}
-		stasis_publish(ast_channel_topic(chan), message);
+		stasis_publish(ast_channel_topic_for_publish(chan), message);
 	}
 	return 0;
 }
@@ -2574,7 +2574,7 @@ static int report_send_fax_status(struct ast_channel *chan, struct ast_fax_sessi
 		if (!message) {
 			return -1;
 		}
-		stasis_publish(ast_channel_topic(chan), message);
+		stasis_publish(ast_channel_topic_for_publish(chan), message);
 	}
 	return 0;
 }
@@ -78,6 +78,13 @@
 				<configOption name="capture_id" default="0">
 					<synopsis>The ID for this capture agent.</synopsis>
 				</configOption>
+				<configOption name="sample_percent" default="100">
+					<synopsis>The percentage of calls to capture.</synopsis>
+					<description><para>Calls are picked by their UUID, so either
+					every packet of a call is sent or none is. Use with
+					<literal>uuid_type = call-id</literal> so that the SIP and RTCP
+					packets of a call share the same UUID.</para></description>
+				</configOption>
 			</configObject>
 		</configFile>
 	</configInfo>
@@ -97,6 +104,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
 #include <netinet/ip6.h>
+#include <sys/uio.h>
 
 /*! Generic vendor ID. Used for HEPv3 standard packets */
 #define GENERIC_VENDOR_ID 0x0000
@@ -238,6 +246,7 @@ struct hep_generic {
 struct hepv3_global_config {
 	unsigned int enabled;                    /*!< Whether or not sending is enabled */
 	unsigned int capture_id;                 /*!< Capture ID for this agent */
+	unsigned int sample_percent;             /*!< Percentage of calls to capture */
 	enum hep_uuid_type uuid_type;            /*!< The preferred type of the UUID */
 	AST_DECLARE_STRING_FIELDS(
 		AST_STRING_FIELD(capture_address);   /*!< Address to send to */
@@ -279,6 +288,41 @@ static AO2_GLOBAL_OBJ_STATIC(global_data);
 
 static struct ast_taskprocessor *hep_queue_tp;
 
+/*! \brief Most captures waiting to be sent before new ones are dropped */
+#define HEP_QUEUE_SIZE 4096
+
+/*! \brief Most packets sent with one system call */
+#define HEP_SEND_BATCH 32
+
+AST_MUTEX_DEFINE_STATIC(hep_queue_lock);
+
+/*! \brief Captures waiting to be sent by \ref hep_queue_tp */
+static struct {
+	/*! Ring of captures, oldest at head */
+	struct hepv3_capture_info *ring[HEP_QUEUE_SIZE];
+	unsigned int head;
+	unsigned int count;
+	/*! Set while a task sending the queue is pushed to \ref hep_queue_tp */
+	unsigned int sending:1;
+	/*! Set once captures are dropped, until the queue empties */
+	unsigned int overflow:1;
+} hep_queue;
+
+/*! \brief The chunks of one HEPv3 packet, sent without being copied together */
+struct hep_packet {
+	struct hep_generic hg_pkt;
+	struct hep_chunk_ip4 ipv4_src, ipv4_dst;
+	struct hep_chunk_ip6 ipv6_src, ipv6_dst;
+	struct hep_chunk auth_key, payload, uuid;
+	struct iovec iov[9];
+	int iovcnt;
+};
+
+#ifdef HAVE_SENDMMSG
+/*! \brief Set if the kernel does not implement sendmmsg */
+static int hep_sendmmsg_unsupported;
+#endif
+
 static void *module_config_alloc(void);
 static int hepv3_config_pre_apply(void);
 static void hepv3_config_post_apply(void);
@@ -449,152 +493,281 @@ struct hepv3_capture_info *hepv3_create_capture_info(const void *payload, size_t
 	return info;
 }
 
-/*! \brief Callback function for the \ref hep_queue_tp taskprocessor */
-static int hep_queue_cb(void *data)
+static void hep_packet_add(struct hep_packet *pkt, const void *data, size_t len)
 {
-	RAII_VAR(struct module_config *, config, ao2_global_obj_ref(global_config), ao2_cleanup);
-	RAII_VAR(struct hepv3_runtime_data *, hepv3_data, ao2_global_obj_ref(global_data), ao2_cleanup);
-	RAII_VAR(struct hepv3_capture_info *, capture_info, data, ao2_cleanup);
-	struct hep_generic hg_pkt;
-	unsigned int packet_len = 0, sock_buffer_len;
-	struct hep_chunk_ip4 ipv4_src, ipv4_dst;
-	struct hep_chunk_ip6 ipv6_src, ipv6_dst;
-	struct hep_chunk auth_key, payload, uuid;
-	void *sock_buffer;
-	int res;
+	pkt->iov[pkt->iovcnt].iov_base = (void *) data;
+	pkt->iov[pkt->iovcnt].iov_len = len;
+	pkt->iovcnt++;
+}
 
-	if (!capture_info || !config || !hepv3_data) {
-		return 0;
-	}
+/*!
+ * \internal
+ * \brief Fill in the chunks of the HEPv3 packet of a capture
+ *
+ * \note The packet points to the payload and UUID of the capture and to the
+ * password of the config, which must outlive it.
+ *
+ * \retval 0 success
+ * \retval -1 the capture cannot be sent
+ */
+static int hep_packet_build(struct hep_packet *pkt, struct hepv3_capture_info *capture_info,
+	struct hepv3_global_config *config)
+{
+	struct hep_generic *hg_pkt = &pkt->hg_pkt;
+	size_t password_len = strlen(config->capture_password);
+	size_t uuid_len = strlen(capture_info->uuid);
+	unsigned int packet_len;
+	int i;
 
 	if (ast_sockaddr_is_ipv4(&capture_info->src_addr) != ast_sockaddr_is_ipv4(&capture_info->dst_addr)) {
 		ast_log(AST_LOG_NOTICE, "Unable to send packet: Address Family mismatch between source/destination\n");
 		return -1;
 	}
 
-	packet_len = sizeof(hg_pkt);
+	pkt->iovcnt = 0;
+	hep_packet_add(pkt, hg_pkt, sizeof(*hg_pkt));
 
 	/* Build HEPv3 header, capture info, and calculate the total packet size */
-	memcpy(hg_pkt.header.id, "\x48\x45\x50\x33", 4);
+	memcpy(hg_pkt->header.id, "\x48\x45\x50\x33", 4);
 
-	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt.ip_proto, CHUNK_TYPE_IP_PROTOCOL_ID, capture_info->protocol_id);
-	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt.src_port, CHUNK_TYPE_SRC_PORT, htons(ast_sockaddr_port(&capture_info->src_addr)));
-	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt.dst_port, CHUNK_TYPE_DST_PORT, htons(ast_sockaddr_port(&capture_info->dst_addr)));
-	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt.time_sec, CHUNK_TYPE_TIMESTAMP_SEC, htonl(capture_info->capture_time.tv_sec));
-	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt.time_usec, CHUNK_TYPE_TIMESTAMP_USEC, htonl(capture_info->capture_time.tv_usec));
-	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt.proto_t, CHUNK_TYPE_PROTOCOL_TYPE, capture_info->capture_type);
-	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt.capt_id, CHUNK_TYPE_CAPTURE_AGENT_ID, htonl(config->general->capture_id));
+	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt->ip_proto, CHUNK_TYPE_IP_PROTOCOL_ID, capture_info->protocol_id);
+	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt->src_port, CHUNK_TYPE_SRC_PORT, htons(ast_sockaddr_port(&capture_info->src_addr)));
+	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt->dst_port, CHUNK_TYPE_DST_PORT, htons(ast_sockaddr_port(&capture_info->dst_addr)));
+	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt->time_sec, CHUNK_TYPE_TIMESTAMP_SEC, htonl(capture_info->capture_time.tv_sec));
+	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt->time_usec, CHUNK_TYPE_TIMESTAMP_USEC, htonl(capture_info->capture_time.tv_usec));
+	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt->proto_t, CHUNK_TYPE_PROTOCOL_TYPE, capture_info->capture_type);
+	INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt->capt_id, CHUNK_TYPE_CAPTURE_AGENT_ID, htonl(config->capture_id));
 
+	/* The addresses are copied out of the sockaddrs rather than printed and parsed back */
 	if (ast_sockaddr_is_ipv4(&capture_info->src_addr)) {
-		INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt.ip_family,
+		INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt->ip_family,
 			CHUNK_TYPE_IP_PROTOCOL_FAMILY, AF_INET);
 
-		INITIALIZE_GENERIC_HEP_CHUNK(&ipv4_src, CHUNK_TYPE_IPV4_SRC_ADDR);
-		inet_pton(AF_INET, ast_sockaddr_stringify_addr(&capture_info->src_addr), &ipv4_src.data);
+		INITIALIZE_GENERIC_HEP_CHUNK(&pkt->ipv4_src, CHUNK_TYPE_IPV4_SRC_ADDR);
+		pkt->ipv4_src.data = ((struct sockaddr_in *) &capture_info->src_addr.ss)->sin_addr;
 
-		INITIALIZE_GENERIC_HEP_CHUNK(&ipv4_dst, CHUNK_TYPE_IPV4_DST_ADDR);
-		inet_pton(AF_INET, ast_sockaddr_stringify_addr(&capture_info->dst_addr), &ipv4_dst.data);
+		INITIALIZE_GENERIC_HEP_CHUNK(&pkt->ipv4_dst, CHUNK_TYPE_IPV4_DST_ADDR);
+		pkt->ipv4_dst.data = ((struct sockaddr_in *) &capture_info->dst_addr.ss)->sin_addr;
 
-		packet_len += (sizeof(ipv4_src) + sizeof(ipv4_dst));
+		hep_packet_add(pkt, &pkt->ipv4_src, sizeof(pkt->ipv4_src));
+		hep_packet_add(pkt, &pkt->ipv4_dst, sizeof(pkt->ipv4_dst));
 	} else {
-		INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt.ip_family,
+		INITIALIZE_GENERIC_HEP_CHUNK_DATA(&hg_pkt->ip_family,
 			CHUNK_TYPE_IP_PROTOCOL_FAMILY, AF_INET6);
 
-		INITIALIZE_GENERIC_HEP_CHUNK(&ipv6_src, CHUNK_TYPE_IPV6_SRC_ADDR);
-		inet_pton(AF_INET6, ast_sockaddr_stringify_addr(&capture_info->src_addr), &ipv6_src.data);
+		INITIALIZE_GENERIC_HEP_CHUNK(&pkt->ipv6_src, CHUNK_TYPE_IPV6_SRC_ADDR);
+		pkt->ipv6_src.data = ((struct sockaddr_in6 *) &capture_info->src_addr.ss)->sin6_addr;
 
-		INITIALIZE_GENERIC_HEP_CHUNK(&ipv6_dst, CHUNK_TYPE_IPV6_DST_ADDR);
-		inet_pton(AF_INET6, ast_sockaddr_stringify_addr(&capture_info->dst_addr), &ipv6_dst.data);
+		INITIALIZE_GENERIC_HEP_CHUNK(&pkt->ipv6_dst, CHUNK_TYPE_IPV6_DST_ADDR);
+		pkt->ipv6_dst.data = ((struct sockaddr_in6 *) &capture_info->dst_addr.ss)->sin6_addr;
 
-		packet_len += (sizeof(ipv6_src) + sizeof(ipv6_dst));
+		hep_packet_add(pkt, &pkt->ipv6_src, sizeof(pkt->ipv6_src));
+		hep_packet_add(pkt, &pkt->ipv6_dst, sizeof(pkt->ipv6_dst));
 	}
 
-	if (!ast_strlen_zero(config->general->capture_password))  {
-		INITIALIZE_GENERIC_HEP_IDS_VAR(&auth_key, CHUNK_TYPE_AUTH_KEY, strlen(config->general->capture_password));
-		packet_len += (sizeof(auth_key) + strlen(config->general->capture_password));
+	/* Auth Key */
+	if (password_len) {
+		INITIALIZE_GENERIC_HEP_IDS_VAR(&pkt->auth_key, CHUNK_TYPE_AUTH_KEY, password_len);
+		hep_packet_add(pkt, &pkt->auth_key, sizeof(pkt->auth_key));
+		hep_packet_add(pkt, config->capture_password, password_len);
 	}
-	INITIALIZE_GENERIC_HEP_IDS_VAR(&uuid, CHUNK_TYPE_UUID, strlen(capture_info->uuid));
-	packet_len += (sizeof(uuid) + strlen(capture_info->uuid));
-	INITIALIZE_GENERIC_HEP_IDS_VAR(&payload,
+
+	/* UUID */
+	INITIALIZE_GENERIC_HEP_IDS_VAR(&pkt->uuid, CHUNK_TYPE_UUID, uuid_len);
+	hep_packet_add(pkt, &pkt->uuid, sizeof(pkt->uuid));
+	hep_packet_add(pkt, capture_info->uuid, uuid_len);
+
+	/* Packet! */
+	INITIALIZE_GENERIC_HEP_IDS_VAR(&pkt->payload,
 		capture_info->zipped ? CHUNK_TYPE_PAYLOAD_ZIP : CHUNK_TYPE_PAYLOAD, capture_info->len);
-	packet_len += (sizeof(payload) + capture_info->len);
-	hg_pkt.header.length = htons(packet_len);
+	hep_packet_add(pkt, &pkt->payload, sizeof(pkt->payload));
+	hep_packet_add(pkt, capture_info->payload, capture_info->len);
 
-	/* Build the buffer to send */
-	sock_buffer = ast_malloc(packet_len);
-	if (!sock_buffer) {
-		return -1;
+	ast_assert(pkt->iovcnt <= ARRAY_LEN(pkt->iov));
+
+	packet_len = 0;
+	for (i = 0; i < pkt->iovcnt; i++) {
+		packet_len += pkt->iov[i].iov_len;
 	}
+	hg_pkt->header.length = htons(packet_len);
 
-	/* Copy in the header */
-	memcpy(sock_buffer, &hg_pkt, sizeof(hg_pkt));
-	sock_buffer_len = sizeof(hg_pkt);
+	return 0;
+}
 
-	/* Addresses */
-	if (ast_sockaddr_is_ipv4(&capture_info->src_addr)) {
-		memcpy(sock_buffer + sock_buffer_len, &ipv4_src, sizeof(ipv4_src));
-		sock_buffer_len += sizeof(ipv4_src);
-		memcpy(sock_buffer + sock_buffer_len, &ipv4_dst, sizeof(ipv4_dst));
-		sock_buffer_len += sizeof(ipv4_dst);
-	} else {
-		memcpy(sock_buffer + sock_buffer_len, &ipv6_src, sizeof(ipv6_src));
-		sock_buffer_len += sizeof(ipv6_src);
-		memcpy(sock_buffer + sock_buffer_len, &ipv6_dst, sizeof(ipv6_dst));
-		sock_buffer_len += sizeof(ipv6_dst);
+static void hep_packet_send_error(void)
+{
+	ast_log(AST_LOG_ERROR, "Error [%d] while sending packet to HEPv3 server: %s\n",
+		errno, strerror(errno));
+}
+
+/*!
+ * \internal
+ * \brief Send packets to the HEPv3 server, with as few system calls as possible
+ */
+static void hep_packets_send(struct hepv3_runtime_data *hepv3_data, struct hep_packet *pkts, int count)
+{
+	struct msghdr msg = {
+		.msg_name = &hepv3_data->remote_addr.ss,
+		.msg_namelen = hepv3_data->remote_addr.len,
+	};
+	int sent = 0;
+
+#ifdef HAVE_SENDMMSG
+	if (!hep_sendmmsg_unsupported) {
+		struct mmsghdr msgs[HEP_SEND_BATCH];
+		int res;
+		int i;
+
+		for (i = 0; i < count; i++) {
+			msgs[i].msg_hdr = msg;
+			msgs[i].msg_hdr.msg_iov = pkts[i].iov;
+			msgs[i].msg_hdr.msg_iovlen = pkts[i].iovcnt;
+			msgs[i].msg_len = 0;
+		}
+
+		while (sent < count) {
+			res = sendmmsg(hepv3_data->sockfd, msgs + sent, count - sent, 0);
+			if (res < 0) {
+				if (errno == ENOSYS) {
+					ast_log(LOG_NOTICE, "sendmmsg is not supported, sending HEPv3 packets one at a time\n");
+					hep_sendmmsg_unsupported = 1;
+					break;
+				}
+				/* The failure is for the first packet, the rest may still go */
+				hep_packet_send_error();
+				res = 1;
+			}
+			sent += res;
+		}
 	}
+#endif
+
+	for (; sent < count; sent++) {
+		msg.msg_iov = pkts[sent].iov;
+		msg.msg_iovlen = pkts[sent].iovcnt;
+		if (sendmsg(hepv3_data->sockfd, &msg, 0) < 0) {
+			hep_packet_send_error();
+		}
+	}
+}
 
-	/* Auth Key */
-	if (!ast_strlen_zero(config->general->capture_password)) {
-		memcpy(sock_buffer + sock_buffer_len, &auth_key, sizeof(auth_key));
-		sock_buffer_len += sizeof(auth_key);
-		memcpy(sock_buffer + sock_buffer_len, config->general->capture_password, strlen(config->general->capture_password));
-		sock_buffer_len += strlen(config->general->capture_password);
+/*!
+ * \internal
+ * \brief Take the oldest captures off the queue
+ *
+ * \return The number of captures taken, 0 once the queue is empty, in which
+ * case the sending task is done.
+ */
+static int hep_queue_take(struct hepv3_capture_info **batch)
+{
+	int count = 0;
+
+	ast_mutex_lock(&hep_queue_lock);
+	while (count < HEP_SEND_BATCH && hep_queue.count) {
+		batch[count++] = hep_queue.ring[hep_queue.head];
+		hep_queue.ring[hep_queue.head] = NULL;
+		hep_queue.head = (hep_queue.head + 1) % HEP_QUEUE_SIZE;
+		hep_queue.count--;
 	}
+	if (!count) {
+		hep_queue.sending = 0;
+		hep_queue.overflow = 0;
+	}
+	ast_mutex_unlock(&hep_queue_lock);
 
-	/* UUID */
-	memcpy(sock_buffer + sock_buffer_len, &uuid, sizeof(uuid));
-	sock_buffer_len += sizeof(uuid);
-	memcpy(sock_buffer + sock_buffer_len, capture_info->uuid, strlen(capture_info->uuid));
-	sock_buffer_len += strlen(capture_info->uuid);
+	return count;
+}
 
-	/* Packet! */
-	memcpy(sock_buffer + sock_buffer_len, &payload, sizeof(payload));
-	sock_buffer_len += sizeof(payload);
-	memcpy(sock_buffer + sock_buffer_len, capture_info->payload, capture_info->len);
-	sock_buffer_len += capture_info->len;
+/*!
+ * \brief Callback function for the \ref hep_queue_tp taskprocessor
+ *
+ * Sends the queued captures in batches until the queue is empty.
+ */
+static int hep_queue_cb(void *data)
+{
+	struct hepv3_capture_info *batch[HEP_SEND_BATCH];
+	struct hep_packet pkts[HEP_SEND_BATCH];
+	int count;
+	int built;
+	int i;
+
+	while ((count = hep_queue_take(batch))) {
+		struct module_config *config = ao2_global_obj_ref(global_config);
+		struct hepv3_runtime_data *hepv3_data = ao2_global_obj_ref(global_data);
+
+		built = 0;
+		if (config && hepv3_data) {
+			for (i = 0; i < count; i++) {
+				if (!hep_packet_build(&pkts[built], batch[i], config->general)) {
+					built++;
+				}
+			}
+		}
+		if (built) {
+			hep_packets_send(hepv3_data, pkts, built);
+		}
+
+		for (i = 0; i < count; i++) {
+			ao2_ref(batch[i], -1);
+		}
+		ao2_cleanup(hepv3_data);
+		ao2_cleanup(config);
+	}
 
-	ast_assert(sock_buffer_len == packet_len);
+	return 0;
+}
 
-	res = ast_sendto(hepv3_data->sockfd, sock_buffer, sock_buffer_len, 0, &hepv3_data->remote_addr);
-	if (res < 0) {
-		ast_log(AST_LOG_ERROR, "Error [%d] while sending packet to HEPv3 server: %s\n",
-			errno, strerror(errno));
-	} else if (res != sock_buffer_len) {
-		ast_log(AST_LOG_WARNING, "Failed to send complete packet to HEPv3 server: %d of %u sent\n",
-			res, sock_buffer_len);
-		res = -1;
+/*!
+ * \internal
+ * \brief Whether a capture belongs to one of the sampled calls
+ */
+static int hep_capture_sampled(struct hepv3_global_config *config, struct hepv3_capture_info *capture_info)
+{
+	if (config->sample_percent >= 100) {
+		return 1;
 	}
 
-	ast_free(sock_buffer);
-	return res;
+	return capture_info->uuid
+		&& ast_str_hash(capture_info->uuid) % 100 < config->sample_percent;
 }
 
 int hepv3_send_packet(struct hepv3_capture_info *capture_info)
 {
 	RAII_VAR(struct module_config *, config, ao2_global_obj_ref(global_config), ao2_cleanup);
-	int res;
+	int push;
 
-	if (!config || !config->general->enabled) {
+	if (!config || !config->general->enabled
+		|| !hep_capture_sampled(config->general, capture_info)) {
 		ao2_ref(capture_info, -1);
 		return 0;
 	}
 
-	res = ast_taskprocessor_push(hep_queue_tp, hep_queue_cb, capture_info);
-	if (res == -1) {
+	ast_mutex_lock(&hep_queue_lock);
+	if (hep_queue.count == HEP_QUEUE_SIZE) {
+		if (!hep_queue.overflow) {
+			hep_queue.overflow = 1;
+			ast_log(AST_LOG_WARNING, "HEPv3 send queue is full, dropping captures\n");
+		}
+		ast_mutex_unlock(&hep_queue_lock);
 		ao2_ref(capture_info, -1);
+		return -1;
+	}
+	hep_queue.ring[(hep_queue.head + hep_queue.count) % HEP_QUEUE_SIZE] = capture_info;
+	hep_queue.count++;
+	push = !hep_queue.sending;
+	hep_queue.sending = 1;
+	ast_mutex_unlock(&hep_queue_lock);
+
+	/* One task sends everything queued until it is done */
+	if (push && ast_taskprocessor_push(hep_queue_tp, hep_queue_cb, NULL)) {
+		/* The capture stays queued for the next push */
+		ast_mutex_lock(&hep_queue_lock);
+		hep_queue.sending = 0;
+		ast_mutex_unlock(&hep_queue_lock);
+		return -1;
 	}
 
-	return res;
+	return 0;
 }
 
 /*!
@@ -657,6 +830,16 @@ static int unload_module(void)
 {
 	hep_queue_tp = ast_taskprocessor_unreference(hep_queue_tp);
 
+	ast_mutex_lock(&hep_queue_lock);
+	while (hep_queue.count) {
+		ao2_ref(hep_queue.ring[hep_queue.head], -1);
+		hep_queue.ring[hep_queue.head] = NULL;
+		hep_queue.head = (hep_queue.head + 1) % HEP_QUEUE_SIZE;
+		hep_queue.count--;
+	}
+	hep_queue.sending = 0;
+	ast_mutex_unlock(&hep_queue_lock);
+
 	ao2_global_obj_release(global_config);
 	ao2_global_obj_release(global_data);
 	aco_info_destroy(&cfg_info);
@@ -682,6 +865,7 @@ static int load_module(void)
 	aco_option_register(&cfg_info, "capture_address", ACO_EXACT, global_options, "", OPT_STRINGFIELD_T, 1, STRFLDSET(struct hepv3_global_config, capture_address));
 	aco_option_register(&cfg_info, "capture_password", ACO_EXACT, global_options, "", OPT_STRINGFIELD_T, 0, STRFLDSET(struct hepv3_global_config, capture_password));
 	aco_option_register(&cfg_info, "capture_id", ACO_EXACT, global_options, "0", OPT_UINT_T, 0, STRFLDSET(struct hepv3_global_config, capture_id));
+	aco_option_register(&cfg_info, "sample_percent", ACO_EXACT, global_options, "100", OPT_UINT_T, PARSE_IN_RANGE, FLDSET(struct hepv3_global_config, sample_percent), 0, 100);
 	aco_option_register_custom(&cfg_info, "uuid_type", ACO_EXACT, global_options, "call-id", uuid_type_handler, 0);
 
 	if (aco_process_config(&cfg_info, 0) == ACO_PROCESS_ERROR) {
@@ -0,0 +1,376 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief HTTP backend for the core media cache
+ *
+ * Registers the http and https bucket schemes, which download media to
+ * temporary files for the media cache.  The ETag and Last-Modified headers
+ * of a response are kept to revalidate the download with a conditional
+ * request once it expires, as given by the Cache-Control or Expires headers.
+ */
+
+/*** MODULEINFO
+	<depend>curl</depend>
+	<depend>res_curl</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <curl/curl.h>
+
+#include "asterisk/module.h"
+#include "asterisk/bucket.h"
+#include "asterisk/sorcery.h"
+
+#define GLOBAL_USERAGENT "asterisk-libcurl-agent/1.0"
+
+/*! Seconds a download or revalidation may take */
+#define HTTP_MEDIA_CACHE_TIMEOUT 180
+
+/*! \brief File extensions of the content types media is commonly served as */
+static const struct {
+	const char *content_type;
+	const char *ext;
+} content_type_exts[] = {
+	{ "audio/wav", "wav" },
+	{ "audio/wave", "wav" },
+	{ "audio/x-wav", "wav" },
+	{ "audio/basic", "au" },
+	{ "audio/gsm", "gsm" },
+	{ "audio/x-gsm", "gsm" },
+	{ "audio/g722", "g722" },
+	{ "audio/ogg", "ogg" },
+	{ "audio/mpeg", "mp3" },
+};
+
+/*! \brief Header callback keeping the headers of a response as metadata of the bucket file */
+static size_t curl_header_callback(char *buffer, size_t size, size_t nitems, void *data)
+{
+	struct ast_bucket_file *file = data;
+	size_t realsize = size * nitems;
+	char *header;
+	char *value;
+
+	header = ast_alloca(realsize + 1);
+	memcpy(header, buffer, realsize);
+	header[realsize] = '\0';
+
+	value = strchr(header, ':');
+	if (!value) {
+		return realsize;
+	}
+	*value++ = '\0';
+
+	value = ast_strip(value);
+	header = ast_strip(header);
+	if (ast_strlen_zero(header) || ast_strlen_zero(value)) {
+		return realsize;
+	}
+
+	ast_bucket_file_metadata_set(file, ast_str_to_lower(header), value);
+
+	return realsize;
+}
+
+/*!
+ * \internal
+ * \brief Set when the download expires from the Cache-Control or Expires headers
+ */
+static void bucket_file_set_expiration(struct ast_bucket_file *file)
+{
+	struct ast_bucket_metadata *metadata;
+	char time_buf[32];
+	time_t expires = 0;
+
+	metadata = ast_bucket_file_metadata_get(file, "cache-control");
+	if (metadata) {
+		const char *max_age = strstr(metadata->value, "max-age=");
+
+		if (strstr(metadata->value, "no-cache") || strstr(metadata->value, "no-store")) {
+			expires = time(NULL);
+		} else if (max_age) {
+			expires = time(NULL) + strtol(max_age + strlen("max-age="), NULL, 10);
+		}
+		ao2_ref(metadata, -1);
+	}
+
+	if (!expires) {
+		metadata = ast_bucket_file_metadata_get(file, "expires");
+		if (metadata) {
+			expires = curl_getdate(metadata->value, NULL);
+			ao2_ref(metadata, -1);
+		}
+	}
+
+	if (expires > 0) {
+		snprintf(time_buf, sizeof(time_buf), "%ld", (long) expires);
+		ast_bucket_file_metadata_set(file, "__actual_expires", time_buf);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Set the file extension of the download from its Content-Type header
+ */
+static void bucket_file_set_extension(struct ast_bucket_file *file)
+{
+	struct ast_bucket_metadata *metadata;
+	char *content_type;
+	int i;
+
+	metadata = ast_bucket_file_metadata_get(file, "content-type");
+	if (!metadata) {
+		return;
+	}
+
+	content_type = ast_strdupa(metadata->value);
+	ao2_ref(metadata, -1);
+	content_type[strcspn(content_type, "; ")] = '\0';
+
+	for (i = 0; i < ARRAY_LEN(content_type_exts); i++) {
+		if (!strcasecmp(content_type, content_type_exts[i].content_type)) {
+			ast_bucket_file_metadata_set(file, "ext", content_type_exts[i].ext);
+			return;
+		}
+	}
+}
+
+/*! \brief Create a curl handle with the options common to all requests */
+static CURL *get_curl_instance(const char *uri)
+{
+	CURL *curl;
+
+	curl = curl_easy_init();
+	if (!curl) {
+		return NULL;
+	}
+
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, HTTP_MEDIA_CACHE_TIMEOUT);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, GLOBAL_USERAGENT);
+	curl_easy_setopt(curl, CURLOPT_URL, uri);
+
+	return curl;
+}
+
+/*!
+ * \internal
+ * \brief Download the contents at the URI of a bucket file to its temporary file
+ */
+static long bucket_file_download(struct ast_bucket_file *file)
+{
+	const char *uri = ast_sorcery_object_get_id(file);
+	CURL *curl;
+	FILE *fp;
+	long http_code = 0;
+
+	fp = fopen(file->path, "wb");
+	if (!fp) {
+		ast_log(LOG_WARNING, "Could not open '%s' to download '%s' to: %s\n",
+			file->path, uri, strerror(errno));
+		return -1;
+	}
+
+	curl = get_curl_instance(uri);
+	if (!curl) {
+		fclose(fp);
+		return -1;
+	}
+
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) fp);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_header_callback);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *) file);
+
+	if (curl_easy_perform(curl)) {
+		ast_log(LOG_WARNING, "Failed to download '%s'\n", uri);
+	} else {
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+	}
+
+	curl_easy_cleanup(curl);
+	fclose(fp);
+
+	return http_code;
+}
+
+static void *bucket_http_wizard_retrieve_id(const struct ast_sorcery *sorcery,
+	void *data, const char *type, const char *id)
+{
+	struct ast_bucket_file *file;
+	long http_code;
+
+	if (strcmp(type, "file")) {
+		ast_log(LOG_WARNING, "Failed to create storage: invalid bucket type '%s'\n", type);
+		return NULL;
+	}
+
+	if (ast_strlen_zero(id)) {
+		ast_log(LOG_WARNING, "Failed to create storage: no URI\n");
+		return NULL;
+	}
+
+	file = ast_bucket_file_alloc(id);
+	if (!file) {
+		ast_log(LOG_WARNING, "Failed to create storage for '%s'\n", id);
+		return NULL;
+	}
+
+	http_code = bucket_file_download(file);
+	if (http_code / 100 != 2) {
+		if (http_code > 0) {
+			ast_log(LOG_WARNING, "Failed to download '%s': HTTP status %ld\n", id, http_code);
+		}
+		ao2_ref(file, -1);
+		return NULL;
+	}
+
+	bucket_file_set_expiration(file);
+	bucket_file_set_extension(file);
+
+	return file;
+}
+
+static int bucket_http_wizard_is_stale(const struct ast_sorcery *sorcery, void *data, void *object)
+{
+	struct ast_bucket_file *file = object;
+	struct ast_bucket_metadata *etag;
+	struct ast_bucket_metadata *last_modified;
+	struct curl_slist *headers = NULL;
+	char header[512];
+	CURL *curl;
+	long http_code = 0;
+
+	etag = ast_bucket_file_metadata_get(file, "etag");
+	last_modified = ast_bucket_file_metadata_get(file, "last-modified");
+	if (!etag && !last_modified) {
+		/* Nothing to revalidate against, so download it again */
+		return 1;
+	}
+
+	if (etag) {
+		snprintf(header, sizeof(header), "If-None-Match: %s", etag->value);
+		headers = curl_slist_append(headers, header);
+		ao2_ref(etag, -1);
+	}
+	if (last_modified) {
+		snprintf(header, sizeof(header), "If-Modified-Since: %s", last_modified->value);
+		headers = curl_slist_append(headers, header);
+		ao2_ref(last_modified, -1);
+	}
+
+	curl = get_curl_instance(ast_sorcery_object_get_id(file));
+	if (!curl) {
+		curl_slist_free_all(headers);
+		return 1;
+	}
+
+	curl_easy_setopt(curl, CURLOPT_NOBODY, 1);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+	if (!curl_easy_perform(curl)) {
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+	}
+
+	curl_easy_cleanup(curl);
+	curl_slist_free_all(headers);
+
+	return http_code == 304 ? 0 : 1;
+}
+
+static int bucket_http_wizard_create(const struct ast_sorcery *sorcery, void *data,
+	void *object)
+{
+	/* Media is only ever read from web servers */
+	return -1;
+}
+
+static int bucket_http_wizard_delete(const struct ast_sorcery *sorcery, void *data,
+	void *object)
+{
+	return -1;
+}
+
+static void *bucket_http_wizard_bucket_retrieve_id(const struct ast_sorcery *sorcery,
+	void *data, const char *type, const char *id)
+{
+	return NULL;
+}
+
+static struct ast_sorcery_wizard http_bucket_wizard = {
+	.name = "http",
+	.create = bucket_http_wizard_create,
+	.retrieve_id = bucket_http_wizard_bucket_retrieve_id,
+	.delete = bucket_http_wizard_delete,
+};
+
+static struct ast_sorcery_wizard http_bucket_file_wizard = {
+	.name = "http",
+	.create = bucket_http_wizard_create,
+	.retrieve_id = bucket_http_wizard_retrieve_id,
+	.delete = bucket_http_wizard_delete,
+	.is_stale = bucket_http_wizard_is_stale,
+};
+
+static struct ast_sorcery_wizard https_bucket_wizard = {
+	.name = "https",
+	.create = bucket_http_wizard_create,
+	.retrieve_id = bucket_http_wizard_bucket_retrieve_id,
+	.delete = bucket_http_wizard_delete,
+};
+
+static struct ast_sorcery_wizard https_bucket_file_wizard = {
+	.name = "https",
+	.create = bucket_http_wizard_create,
+	.retrieve_id = bucket_http_wizard_retrieve_id,
+	.delete = bucket_http_wizard_delete,
+	.is_stale = bucket_http_wizard_is_stale,
+};
+
+static int unload_module(void)
+{
+	/* Bucket schemes cannot be unregistered, which keeps this module loaded until shutdown */
+	return 0;
+}
+
+static int load_module(void)
+{
+	if (ast_bucket_scheme_register("http", &http_bucket_wizard, &http_bucket_file_wizard,
+		ast_bucket_file_temporary_create, ast_bucket_file_temporary_destroy)) {
+		ast_log(LOG_ERROR, "Failed to register Bucket HTTP wizard scheme implementation\n");
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	if (ast_bucket_scheme_register("https", &https_bucket_wizard, &https_bucket_file_wizard,
+		ast_bucket_file_temporary_create, ast_bucket_file_temporary_destroy)) {
+		ast_log(LOG_ERROR, "Failed to register Bucket HTTPS wizard scheme implementation\n");
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO(ASTERISK_GPL_KEY, AST_MODFLAG_DEFAULT, "HTTP Media Cache Backend",
+	.support_level = AST_MODULE_SUPPORT_CORE,
+	.load = load_module,
+	.unload = unload_module,
+	.nonoptreq = "res_curl",
+);
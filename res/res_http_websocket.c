@@ -345,61 +345,77 @@ static const char *websocket_opcode2str(enum ast_websocket_opcode opcode)
 /*! \brief Write function for websocket traffic */
 int AST_OPTIONAL_API_NAME(ast_websocket_write)(struct ast_websocket *session, enum ast_websocket_opcode opcode, char *payload, uint64_t payload_size)
 {
-	size_t header_size = 2; /* The minimum size of a websocket frame is 2 bytes */
-	char *frame;
-	uint64_t length;
-	uint64_t frame_size;
-
-	ast_debug(3, "Writing websocket %s frame, length %" PRIu64 "\n",
-			websocket_opcode2str(opcode), payload_size);
-
-	if (payload_size < 126) {
-		length = payload_size;
-	} else if (payload_size < (1 << 16)) {
-		length = 126;
-		/* We need an additional 2 bytes to store the extended length */
-		header_size += 2;
-	} else {
-		length = 127;
-		/* We need an additional 8 bytes to store the really really extended length */
-		header_size += 8;
-	}
+	/* A batch of one frame, which is built on the heap rather than the stack */
+	return ast_websocket_write_batch(session, opcode, &payload, &payload_size, 1);
+}
 
-	frame_size = header_size + payload_size;
+int AST_OPTIONAL_API_NAME(ast_websocket_write_batch)(struct ast_websocket *session, enum ast_websocket_opcode opcode, char * const *payloads, const uint64_t *payload_sizes, size_t count)
+{
+	/* The largest frame header is 2 bytes plus an 8 byte extended length */
+	const size_t max_header_size = 10;
+	uint64_t batch_size = 0;
+	char *batch;
+	char *pos;
+	size_t i;
+	int res = 0;
+
+	if (!count) {
+		return 0;
+	}
 
-	frame = ast_alloca(frame_size + 1);
-	memset(frame, 0, frame_size + 1);
+	for (i = 0; i < count; i++) {
+		batch_size += max_header_size + payload_sizes[i];
+	}
 
-	frame[0] = opcode | 0x80;
-	frame[1] = length;
+	ast_debug(3, "Writing %zu websocket %s frames, length %" PRIu64 "\n",
+			count, websocket_opcode2str(opcode), batch_size);
 
-	/* Use the additional available bytes to store the length */
-	if (length == 126) {
-		put_unaligned_uint16(&frame[2], htons(payload_size));
-	} else if (length == 127) {
-		put_unaligned_uint64(&frame[2], htonll(payload_size));
+	if (!(batch = ast_malloc(batch_size))) {
+		return -1;
 	}
 
-	memcpy(&frame[header_size], payload, payload_size);
+	/* Build every frame in one buffer, so the batch is written with one flush */
+	pos = batch;
+	for (i = 0; i < count; i++) {
+		uint64_t payload_size = payload_sizes[i];
+
+		pos[0] = opcode | 0x80;
+		if (payload_size < 126) {
+			pos[1] = payload_size;
+			pos += 2;
+		} else if (payload_size < (1 << 16)) {
+			pos[1] = 126;
+			put_unaligned_uint16(&pos[2], htons(payload_size));
+			pos += 4;
+		} else {
+			pos[1] = 127;
+			put_unaligned_uint64(&pos[2], htonll(payload_size));
+			pos += 10;
+		}
+		memcpy(pos, payloads[i], payload_size);
+		pos += payload_size;
+	}
 
 	ao2_lock(session);
 	if (session->closing) {
 		ao2_unlock(session);
+		ast_free(batch);
 		return -1;
 	}
 
-	if (ast_careful_fwrite(session->f, session->fd, frame, frame_size, session->timeout)) {
+	if (ast_careful_fwrite(session->f, session->fd, batch, pos - batch, session->timeout)) {
 		ao2_unlock(session);
 		/* 1011 - server terminating connection due to not being able to fulfill the request */
 		ast_debug(1, "Closing WS with 1011 because we can't fulfill a write request\n");
 		ast_websocket_close(session, 1011);
-		return -1;
+		res = -1;
+	} else {
+		ao2_unlock(session);
 	}
 
-	fflush(session->f);
-	ao2_unlock(session);
+	ast_free(batch);
 
-	return 0;
+	return res;
 }
 
 void AST_OPTIONAL_API_NAME(ast_websocket_reconstruct_enable)(struct ast_websocket *session, size_t bytes)
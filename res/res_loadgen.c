@@ -0,0 +1,958 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Synthetic media load generator
+ *
+ * Starts legs at a given rate, each streaming audio from memory for a given
+ * time, and reports every second how many are up, how many frames came back,
+ * how late they were and how much CPU Asterisk used.
+ *
+ * A leg is either a pair of RTP instances sending to each other over the
+ * loopback interface, which exercises the RTP engine alone, or a Local
+ * channel dialed into the dialplan, which exercises whatever the dialplan
+ * does with it.  Frames are expected back on the Local channel, so the
+ * extension should echo them: Echo() directly, or a bridge with something
+ * echoing on the other side, such as ConfBridge() for softmix or Dial() of
+ * another Local channel running Echo() for simple and native bridging.
+ *
+ * Each frame carries a sequence number in its first four bytes, so only
+ * codecs whose payload passes untouched are supported.
+ */
+
+/*** MODULEINFO
+	<defaultenabled>no</defaultenabled>
+	<support_level>extended</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <sys/resource.h>
+
+#include "asterisk/module.h"
+#include "asterisk/cli.h"
+#include "asterisk/channel.h"
+#include "asterisk/rtp_engine.h"
+#include "asterisk/format_cache.h"
+#include "asterisk/format_cap.h"
+#include "asterisk/sched.h"
+#include "asterisk/netsock2.h"
+#include "asterisk/poll-compat.h"
+#include "asterisk/vector.h"
+#include "asterisk/prometheus.h"
+#include "asterisk/bench.h"
+
+/*! \brief Number of frames a leg remembers sending, to tell how late they come back */
+#define LEG_WINDOW 64
+
+/*! \brief Most codecs in a codec mix */
+#define MAX_CODECS 4
+
+/*! \brief Longest packetization time, in milliseconds */
+#define MAX_PTIME 100
+
+/*! \brief Largest payload, 8 kHz signed linear at MAX_PTIME */
+#define MAX_PAYLOAD (8 * MAX_PTIME * 2)
+
+enum loadgen_mode {
+	/*! Pairs of RTP instances */
+	LOADGEN_RTP,
+	/*! Local channels into the dialplan */
+	LOADGEN_LOCAL,
+};
+
+struct loadgen_leg {
+	/*! Sending side of an RTP leg */
+	struct ast_rtp_instance *tx;
+	/*! Receiving side of an RTP leg */
+	struct ast_rtp_instance *rx;
+	/*! Local channel of a Local leg */
+	struct ast_channel *chan;
+	struct ast_format *format;
+	/*! When the leg is hung up */
+	struct timeval ends;
+	/*! When the next frame is sent */
+	struct timeval next_send;
+	/*! Sequence number of the next frame */
+	uint32_t seq;
+	/*! Frames that came back */
+	uint32_t received;
+	/*! The other side hung up */
+	unsigned int hungup:1;
+	/*! When the frames still in the window were sent */
+	struct timeval sent[LEG_WINDOW];
+};
+
+/*! \brief What a second of a run looked like */
+struct loadgen_report {
+	/*! Seconds since the run started */
+	unsigned int second;
+	/*! Legs up */
+	unsigned int active;
+	/*! Legs started during the second */
+	unsigned int started;
+	/*! Legs that failed to start or were hung up early, in all */
+	unsigned int failed;
+	/*! Frames sent and received during the second */
+	uint64_t sent;
+	uint64_t received;
+	/*! Frames that did not come back on the legs ended so far, percent */
+	double loss;
+	/*! How late frames came back during the second, microseconds */
+	int64_t latency_avg;
+	int64_t latency_max;
+	/*! CPU used by Asterisk during the second, percent of one core */
+	double cpu;
+};
+
+struct loadgen_run {
+	enum loadgen_mode mode;
+	/*! exten@context dialed for Local legs */
+	char *dest;
+	/*! Legs to start in all */
+	unsigned int legs;
+	/*! Legs started per second */
+	unsigned int cps;
+	/*! How long each leg lasts, in seconds */
+	unsigned int hold;
+	/*! Packetization time, in milliseconds */
+	unsigned int ptime;
+	/*! Codec mix, used in turn by the legs */
+	struct ast_format *formats[MAX_CODECS];
+	unsigned int num_formats;
+	struct ast_sched_context *sched;
+	pthread_t thread;
+	/*! Set to stop the run */
+	int stop;
+	/*! The run is over */
+	int finished;
+	struct timeval started;
+	AST_VECTOR(, struct loadgen_leg *) active;
+	unsigned int legs_started;
+	unsigned int legs_failed;
+	unsigned int legs_done;
+	uint64_t frames_sent;
+	uint64_t frames_received;
+	/*! Frames sent and received on the legs ended so far */
+	uint64_t ended_sent;
+	uint64_t ended_received;
+	/*! Latency of the frames received during the current second */
+	int64_t latency_sum;
+	int64_t latency_max;
+	uint64_t latency_count;
+	/*! The last second, guarded by run_lock */
+	struct loadgen_report report;
+	/*! Payload, with room for headers in front */
+	unsigned char buf[AST_FRIENDLY_OFFSET + MAX_PAYLOAD];
+};
+
+/*! \brief The current or last run, guarded by run_lock */
+static struct loadgen_run *current_run;
+AST_MUTEX_DEFINE_STATIC(run_lock);
+
+static const int64_t latency_bounds[] = { 1000, 5000, 20000, 50000, 100000, 500000 };
+static int64_t latency_buckets[ARRAY_LEN(latency_bounds) + 1];
+
+static struct ast_prometheus_metric metric_legs =
+	AST_PROMETHEUS_METRIC_INIT(AST_PROMETHEUS_GAUGE, "asterisk_loadgen_legs",
+		"Load generator legs up", NULL);
+static struct ast_prometheus_metric metric_sent =
+	AST_PROMETHEUS_METRIC_INIT(AST_PROMETHEUS_COUNTER, "asterisk_loadgen_frames_sent_total",
+		"Frames sent by the load generator", NULL);
+static struct ast_prometheus_metric metric_received =
+	AST_PROMETHEUS_METRIC_INIT(AST_PROMETHEUS_COUNTER, "asterisk_loadgen_frames_received_total",
+		"Frames that came back to the load generator", NULL);
+static struct ast_prometheus_metric metric_latency =
+	AST_PROMETHEUS_HISTOGRAM_INIT("asterisk_loadgen_latency_microseconds",
+		"How late frames came back to the load generator", NULL,
+		latency_bounds, latency_buckets);
+
+static struct ast_prometheus_metric *metrics[] = {
+	&metric_legs,
+	&metric_sent,
+	&metric_received,
+	&metric_latency,
+};
+
+/*! \brief Static RTP payload type of a format, -1 if it has none */
+static int loadgen_rtp_payload(struct ast_format *format)
+{
+	if (ast_format_cmp(format, ast_format_ulaw) == AST_FORMAT_CMP_EQUAL) {
+		return 0;
+	}
+	if (ast_format_cmp(format, ast_format_alaw) == AST_FORMAT_CMP_EQUAL) {
+		return 8;
+	}
+	return -1;
+}
+
+/*! \brief Bytes of payload in a frame of the format */
+static size_t loadgen_payload_len(struct ast_format *format, unsigned int ptime)
+{
+	size_t len = 8 * ptime;
+
+	return ast_format_cmp(format, ast_format_slin) == AST_FORMAT_CMP_EQUAL ? len * 2 : len;
+}
+
+static void loadgen_leg_free(struct loadgen_leg *leg)
+{
+	if (leg->tx) {
+		ast_rtp_instance_destroy(leg->tx);
+	}
+	if (leg->rx) {
+		ast_rtp_instance_destroy(leg->rx);
+	}
+	if (leg->chan) {
+		ast_hangup(leg->chan);
+	}
+	ao2_cleanup(leg->format);
+	ast_free(leg);
+}
+
+/*!
+ * \internal
+ * \brief Create a pair of RTP instances sending to each other over loopback
+ */
+static int loadgen_leg_rtp(struct loadgen_leg *leg, struct ast_sched_context *sched)
+{
+	struct ast_sockaddr addr;
+	struct ast_sockaddr tx_addr;
+	struct ast_sockaddr rx_addr;
+	int payload = loadgen_rtp_payload(leg->format);
+
+	ast_sockaddr_parse(&addr, "127.0.0.1", 0);
+	leg->tx = ast_rtp_instance_new("asterisk", sched, &addr, NULL);
+	leg->rx = ast_rtp_instance_new("asterisk", sched, &addr, NULL);
+	if (!leg->tx || !leg->rx || payload < 0) {
+		return -1;
+	}
+
+	ast_rtp_codecs_payloads_set_m_type(ast_rtp_instance_get_codecs(leg->tx), leg->tx, payload);
+	ast_rtp_codecs_payloads_set_m_type(ast_rtp_instance_get_codecs(leg->rx), leg->rx, payload);
+
+	ast_rtp_instance_get_local_address(leg->tx, &tx_addr);
+	ast_rtp_instance_get_local_address(leg->rx, &rx_addr);
+	ast_rtp_instance_set_remote_address(leg->tx, &rx_addr);
+	ast_rtp_instance_set_remote_address(leg->rx, &tx_addr);
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Dial a Local channel into the dialplan
+ */
+static int loadgen_leg_local(struct loadgen_leg *leg, const char *dest)
+{
+	struct ast_format_cap *cap;
+	int cause;
+
+	cap = ast_format_cap_alloc(AST_FORMAT_CAP_FLAG_DEFAULT);
+	if (!cap) {
+		return -1;
+	}
+	ast_format_cap_append(cap, leg->format, 0);
+	leg->chan = ast_request("Local", cap, NULL, NULL, dest, &cause);
+	ao2_ref(cap, -1);
+	if (!leg->chan) {
+		return -1;
+	}
+
+	if (ast_set_write_format(leg->chan, leg->format)
+		|| ast_set_read_format(leg->chan, leg->format)
+		|| ast_call(leg->chan, dest, 0)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static void loadgen_leg_start(struct loadgen_run *run, struct timeval now)
+{
+	struct loadgen_leg *leg;
+	int res = -1;
+
+	leg = ast_calloc(1, sizeof(*leg));
+	if (leg) {
+		leg->format = ao2_bump(run->formats[run->legs_started % run->num_formats]);
+		leg->ends = ast_tvadd(now, ast_tv(run->hold, 0));
+		leg->next_send = now;
+
+		if (run->mode == LOADGEN_RTP) {
+			res = loadgen_leg_rtp(leg, run->sched);
+		} else {
+			res = loadgen_leg_local(leg, run->dest);
+		}
+		if (!res) {
+			res = AST_VECTOR_APPEND(&run->active, leg);
+		}
+	}
+
+	++run->legs_started;
+	if (res) {
+		++run->legs_failed;
+		++run->legs_done;
+		if (leg) {
+			loadgen_leg_free(leg);
+		}
+	}
+}
+
+static void loadgen_leg_end(struct loadgen_run *run, struct loadgen_leg *leg)
+{
+	if (leg->hungup) {
+		++run->legs_failed;
+	}
+	run->ended_sent += leg->seq;
+	run->ended_received += MIN(leg->received, leg->seq);
+	++run->legs_done;
+	loadgen_leg_free(leg);
+}
+
+static void loadgen_leg_send(struct loadgen_run *run, struct loadgen_leg *leg, struct timeval now)
+{
+	uint32_t seq = htonl(leg->seq);
+	struct ast_frame f = {
+		.frametype = AST_FRAME_VOICE,
+		.subclass.format = leg->format,
+		.datalen = loadgen_payload_len(leg->format, run->ptime),
+		.samples = 8 * run->ptime,
+		.offset = AST_FRIENDLY_OFFSET,
+		.data.ptr = run->buf + AST_FRIENDLY_OFFSET,
+		.src = "loadgen",
+	};
+
+	memcpy(f.data.ptr, &seq, sizeof(seq));
+	if (leg->tx) {
+		ast_rtp_instance_write(leg->tx, &f);
+	} else {
+		ast_write(leg->chan, &f);
+	}
+
+	leg->sent[leg->seq % LEG_WINDOW] = now;
+	++leg->seq;
+	++run->frames_sent;
+	ast_prometheus_metric_add(&metric_sent, 1);
+}
+
+static void loadgen_leg_received(struct loadgen_run *run, struct loadgen_leg *leg, struct ast_frame *f)
+{
+	uint32_t seq;
+	int64_t latency;
+
+	if (f->frametype != AST_FRAME_VOICE || f->datalen < sizeof(seq)) {
+		return;
+	}
+
+	memcpy(&seq, f->data.ptr, sizeof(seq));
+	seq = ntohl(seq);
+	++leg->received;
+	++run->frames_received;
+	ast_prometheus_metric_add(&metric_received, 1);
+
+	if (seq >= leg->seq || leg->seq - seq > LEG_WINDOW) {
+		return;
+	}
+	latency = ast_tvdiff_us(ast_tvnow(), leg->sent[seq % LEG_WINDOW]);
+	run->latency_sum += latency;
+	run->latency_max = MAX(run->latency_max, latency);
+	++run->latency_count;
+	ast_prometheus_histogram_observe(&metric_latency, latency);
+}
+
+/*!
+ * \internal
+ * \brief Wait up to ms for frames on RTP legs and handle them
+ */
+static void loadgen_receive_rtp(struct loadgen_run *run, int ms)
+{
+	struct pollfd *fds;
+	size_t count = AST_VECTOR_SIZE(&run->active);
+	size_t i;
+
+	if (!count) {
+		usleep(ms * 1000);
+		return;
+	}
+
+	fds = ast_calloc(count, sizeof(*fds));
+	if (!fds) {
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		fds[i].fd = ast_rtp_instance_fd(AST_VECTOR_GET(&run->active, i)->rx, 0);
+		fds[i].events = POLLIN;
+	}
+
+	if (ast_poll(fds, count, ms) > 0) {
+		for (i = 0; i < count; i++) {
+			struct loadgen_leg *leg = AST_VECTOR_GET(&run->active, i);
+			struct ast_frame *f;
+
+			if (!(fds[i].revents & POLLIN)) {
+				continue;
+			}
+			f = ast_rtp_instance_read(leg->rx, 0);
+			if (f) {
+				loadgen_leg_received(run, leg, f);
+				ast_frfree(f);
+			}
+		}
+	}
+
+	ast_free(fds);
+}
+
+struct loadgen_chan_leg {
+	struct ast_channel *chan;
+	struct loadgen_leg *leg;
+};
+
+static int loadgen_chan_leg_cmp(const void *left, const void *right)
+{
+	const struct loadgen_chan_leg *a = left;
+	const struct loadgen_chan_leg *b = right;
+
+	return a->chan < b->chan ? -1 : a->chan > b->chan;
+}
+
+/*!
+ * \internal
+ * \brief Wait up to ms for frames on Local legs and handle them
+ */
+static void loadgen_receive_local(struct loadgen_run *run, int ms)
+{
+	struct loadgen_chan_leg *legs;
+	struct ast_channel **chans;
+	size_t count = AST_VECTOR_SIZE(&run->active);
+	size_t i;
+
+	if (!count) {
+		usleep(ms * 1000);
+		return;
+	}
+
+	legs = ast_calloc(count, sizeof(*legs));
+	chans = ast_calloc(count, sizeof(*chans));
+	if (!legs || !chans) {
+		ast_free(legs);
+		ast_free(chans);
+		return;
+	}
+
+	/* Sorted by channel to find the leg of a channel with frames */
+	for (i = 0; i < count; i++) {
+		legs[i].leg = AST_VECTOR_GET(&run->active, i);
+		legs[i].chan = legs[i].leg->chan;
+	}
+	qsort(legs, count, sizeof(*legs), loadgen_chan_leg_cmp);
+	for (i = 0; i < count; i++) {
+		chans[i] = legs[i].chan;
+	}
+
+	for (;;) {
+		struct loadgen_chan_leg key;
+		struct loadgen_chan_leg *found;
+		struct ast_frame *f;
+
+		key.chan = ast_waitfor_n(chans, count, &ms);
+		if (!key.chan) {
+			break;
+		}
+		found = bsearch(&key, legs, count, sizeof(*legs), loadgen_chan_leg_cmp);
+		if (!found || found->leg->hungup) {
+			continue;
+		}
+
+		f = ast_read(key.chan);
+		if (!f || (f->frametype == AST_FRAME_CONTROL && f->subclass.integer == AST_CONTROL_HANGUP)) {
+			found->leg->hungup = 1;
+		} else {
+			loadgen_leg_received(run, found->leg, f);
+		}
+		if (f) {
+			ast_frfree(f);
+		}
+		if (found->leg->hungup) {
+			/* Its channel would be ready forever */
+			break;
+		}
+	}
+
+	ast_free(legs);
+	ast_free(chans);
+}
+
+static int64_t loadgen_cpu_usec(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return (int64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+		+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/*!
+ * \internal
+ * \brief Sum up the second that just ended
+ */
+static void loadgen_report(struct loadgen_run *run, unsigned int second,
+	unsigned int started, uint64_t sent, uint64_t received, int64_t cpu_usec, int64_t wall_usec)
+{
+	struct loadgen_report report = {
+		.second = second,
+		.active = AST_VECTOR_SIZE(&run->active),
+		.started = started,
+		.failed = run->legs_failed,
+		.sent = sent,
+		.received = received,
+		.loss = run->ended_sent
+			? 100.0 * (run->ended_sent - run->ended_received) / run->ended_sent : 0.0,
+		.latency_avg = run->latency_count ? run->latency_sum / (int64_t) run->latency_count : 0,
+		.latency_max = run->latency_max,
+		.cpu = wall_usec > 0 ? 100.0 * cpu_usec / wall_usec : 0.0,
+	};
+
+	run->latency_sum = 0;
+	run->latency_max = 0;
+	run->latency_count = 0;
+	ast_prometheus_metric_set(&metric_legs, report.active);
+
+	ast_mutex_lock(&run_lock);
+	run->report = report;
+	ast_mutex_unlock(&run_lock);
+
+	ast_verb(4, "Load generator second %u: %u legs up, %u started, %u failed, %" PRIu64
+		" frames sent, %" PRIu64 " received, %.2f%% lost, latency avg %" PRId64
+		"us max %" PRId64 "us, CPU %.1f%%\n",
+		report.second, report.active, report.started, report.failed, report.sent,
+		report.received, report.loss, report.latency_avg, report.latency_max, report.cpu);
+}
+
+static void *loadgen_thread(void *data)
+{
+	struct loadgen_run *run = data;
+	struct timeval last_report = run->started;
+	unsigned int second = 0;
+	unsigned int started = 0;
+	uint64_t sent = 0;
+	uint64_t received = 0;
+	int64_t cpu = loadgen_cpu_usec();
+
+	while (!run->stop && run->legs_done < run->legs) {
+		struct timeval now = ast_tvnow();
+		struct timeval wake = ast_tvadd(last_report, ast_tv(1, 0));
+		unsigned int due;
+		int ms;
+		int i;
+
+		/* Start the legs due by now */
+		due = MIN(run->legs, ast_tvdiff_ms(now, run->started) * run->cps / 1000 + 1);
+		while (run->legs_started < due) {
+			loadgen_leg_start(run, now);
+		}
+		if (run->legs_started < run->legs) {
+			wake = ast_tvadd(run->started, ast_tv(0, (int64_t) run->legs_started * 1000000 / run->cps));
+		}
+
+		/* Send the frames due and end the legs that are over */
+		for (i = AST_VECTOR_SIZE(&run->active) - 1; i >= 0; i--) {
+			struct loadgen_leg *leg = AST_VECTOR_GET(&run->active, i);
+
+			if (leg->hungup || ast_tvcmp(now, leg->ends) >= 0) {
+				AST_VECTOR_REMOVE_UNORDERED(&run->active, i);
+				loadgen_leg_end(run, leg);
+				continue;
+			}
+			while (ast_tvcmp(leg->next_send, now) <= 0) {
+				loadgen_leg_send(run, leg, now);
+				leg->next_send = ast_tvadd(leg->next_send, ast_tv(0, run->ptime * 1000));
+			}
+			if (ast_tvcmp(leg->next_send, wake) < 0) {
+				wake = leg->next_send;
+			}
+		}
+
+		ms = MAX(ast_tvdiff_ms(wake, ast_tvnow()), 0);
+		if (run->mode == LOADGEN_RTP) {
+			loadgen_receive_rtp(run, ms);
+		} else {
+			loadgen_receive_local(run, ms);
+		}
+
+		now = ast_tvnow();
+		if (ast_tvdiff_ms(now, last_report) >= 1000) {
+			int64_t cpu_now = loadgen_cpu_usec();
+
+			loadgen_report(run, ++second, run->legs_started - started,
+				run->frames_sent - sent, run->frames_received - received,
+				cpu_now - cpu, ast_tvdiff_us(now, last_report));
+			last_report = now;
+			started = run->legs_started;
+			sent = run->frames_sent;
+			received = run->frames_received;
+			cpu = cpu_now;
+		}
+	}
+
+	while (AST_VECTOR_SIZE(&run->active)) {
+		loadgen_leg_end(run, AST_VECTOR_REMOVE_UNORDERED(&run->active, 0));
+	}
+	loadgen_report(run, second + 1, run->legs_started - started,
+		run->frames_sent - sent, run->frames_received - received,
+		loadgen_cpu_usec() - cpu, ast_tvdiff_us(ast_tvnow(), last_report));
+
+	ast_mutex_lock(&run_lock);
+	run->finished = 1;
+	ast_mutex_unlock(&run_lock);
+	ast_verb(2, "Load generator finished: %u legs, %u failed\n", run->legs_started, run->legs_failed);
+
+	return NULL;
+}
+
+static void loadgen_run_free(struct loadgen_run *run)
+{
+	int i;
+
+	if (!run) {
+		return;
+	}
+	if (run->thread != AST_PTHREADT_NULL) {
+		run->stop = 1;
+		pthread_join(run->thread, NULL);
+	}
+	ast_sched_context_destroy(run->sched);
+	AST_VECTOR_FREE(&run->active);
+	for (i = 0; i < run->num_formats; i++) {
+		ao2_cleanup(run->formats[i]);
+	}
+	ast_free(run->dest);
+	ast_free(run);
+}
+
+/*!
+ * \internal
+ * \brief Parse a comma separated codec mix into a run
+ */
+static int loadgen_parse_codecs(struct loadgen_run *run, const char *codecs, int fd)
+{
+	char *names = ast_strdupa(codecs);
+	char *name;
+
+	while ((name = ast_strip(strsep(&names, ",")))) {
+		struct ast_format *format;
+
+		if (run->num_formats == MAX_CODECS) {
+			ast_cli(fd, "At most %d codecs can be mixed\n", MAX_CODECS);
+			return -1;
+		}
+		format = ast_format_cache_get(name);
+		if (!format || loadgen_payload_len(format, 1) > 16
+			|| (loadgen_rtp_payload(format) < 0
+				&& (run->mode == LOADGEN_RTP
+					|| ast_format_cmp(format, ast_format_slin) != AST_FORMAT_CMP_EQUAL))) {
+			ast_cli(fd, "Codec '%s' is not supported, use ulaw or alaw%s\n", name,
+				run->mode == LOADGEN_LOCAL ? " or slin" : "");
+			ao2_cleanup(format);
+			return -1;
+		}
+		run->formats[run->num_formats++] = format;
+	}
+
+	return run->num_formats ? 0 : -1;
+}
+
+static char *handle_loadgen_start(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	static const char * const modes[] = { "rtp", "local", NULL };
+	struct loadgen_run *run;
+	int arg = 3;
+	int res;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "loadgen start";
+		e->usage =
+			"Usage: loadgen start rtp <legs> <cps> <hold> [<ptime> [<codecs>]]\n"
+			"       loadgen start local <exten>@<context> <legs> <cps> <hold> [<ptime> [<codecs>]]\n"
+			"       Start <legs> legs, <cps> a second, each streaming audio for <hold>\n"
+			"       seconds in frames of <ptime> milliseconds (20 by default) of the\n"
+			"       comma separated <codecs> in turn (ulaw by default).\n"
+			"       rtp legs are pairs of RTP instances sending to each other over\n"
+			"       loopback.  local legs are Local channels dialed into the dialplan,\n"
+			"       which must send the audio back, for instance with Echo().\n";
+		return NULL;
+	case CLI_GENERATE:
+		if (a->pos == 2) {
+			return ast_cli_complete(a->word, modes, a->n);
+		}
+		return NULL;
+	}
+
+	if (a->argc < 6) {
+		return CLI_SHOWUSAGE;
+	}
+
+	run = ast_calloc(1, sizeof(*run));
+	if (!run) {
+		return CLI_FAILURE;
+	}
+	run->thread = AST_PTHREADT_NULL;
+	run->ptime = 20;
+
+	if (!strcasecmp(a->argv[2], "rtp")) {
+		run->mode = LOADGEN_RTP;
+	} else if (!strcasecmp(a->argv[2], "local") && a->argc >= 7 && strchr(a->argv[3], '@')) {
+		run->mode = LOADGEN_LOCAL;
+		run->dest = ast_strdup(a->argv[arg++]);
+	} else {
+		loadgen_run_free(run);
+		return CLI_SHOWUSAGE;
+	}
+
+	if (a->argc > arg + 5
+		|| sscanf(a->argv[arg], "%30u", &run->legs) != 1 || !run->legs
+		|| sscanf(a->argv[arg + 1], "%30u", &run->cps) != 1 || !run->cps
+		|| sscanf(a->argv[arg + 2], "%30u", &run->hold) != 1 || !run->hold
+		|| (a->argc > arg + 3 && (sscanf(a->argv[arg + 3], "%30u", &run->ptime) != 1
+			|| run->ptime < 10 || run->ptime > MAX_PTIME || run->ptime % 10))) {
+		ast_cli(a->fd, "Legs, cps and hold must be positive, ptime a multiple of 10 up to %d\n", MAX_PTIME);
+		loadgen_run_free(run);
+		return CLI_SHOWUSAGE;
+	}
+	if (loadgen_parse_codecs(run, a->argc > arg + 4 ? a->argv[arg + 4] : "ulaw", a->fd)) {
+		loadgen_run_free(run);
+		return CLI_FAILURE;
+	}
+	memset(run->buf, 0x55, sizeof(run->buf));
+
+	if (AST_VECTOR_INIT(&run->active, MIN(run->legs, 1024))
+		|| (run->mode == LOADGEN_RTP
+			&& (!(run->sched = ast_sched_context_create()) || ast_sched_start_thread(run->sched)))) {
+		loadgen_run_free(run);
+		return CLI_FAILURE;
+	}
+
+	ast_mutex_lock(&run_lock);
+	if (current_run && !current_run->finished) {
+		ast_mutex_unlock(&run_lock);
+		ast_cli(a->fd, "The load generator is already running\n");
+		loadgen_run_free(run);
+		return CLI_SUCCESS;
+	}
+	loadgen_run_free(current_run);
+	current_run = run;
+	run->started = ast_tvnow();
+	res = ast_pthread_create(&run->thread, NULL, loadgen_thread, run);
+	if (res) {
+		run->thread = AST_PTHREADT_NULL;
+		run->finished = 1;
+	}
+	ast_mutex_unlock(&run_lock);
+
+	ast_cli(a->fd, res ? "Could not start the load generator\n"
+		: "Load generator started, see 'loadgen show status'\n");
+	return CLI_SUCCESS;
+}
+
+static char *handle_loadgen_stop(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "loadgen stop";
+		e->usage =
+			"Usage: loadgen stop\n"
+			"       Hang up every leg of the load generator and stop it.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 2) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_mutex_lock(&run_lock);
+	if (current_run && !current_run->finished) {
+		current_run->stop = 1;
+		ast_cli(a->fd, "Stopping the load generator\n");
+	} else {
+		ast_cli(a->fd, "The load generator is not running\n");
+	}
+	ast_mutex_unlock(&run_lock);
+
+	return CLI_SUCCESS;
+}
+
+static char *handle_loadgen_show_status(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct loadgen_report report;
+	unsigned int legs;
+	int finished;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "loadgen show status";
+		e->usage =
+			"Usage: loadgen show status\n"
+			"       Show the last second of the current or last load generator run.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_mutex_lock(&run_lock);
+	if (!current_run) {
+		ast_mutex_unlock(&run_lock);
+		ast_cli(a->fd, "The load generator has not been run\n");
+		return CLI_SUCCESS;
+	}
+	report = current_run->report;
+	legs = current_run->legs;
+	finished = current_run->finished;
+	ast_mutex_unlock(&run_lock);
+
+	ast_cli(a->fd, "State:          %s\n", finished ? "Finished" : "Running");
+	ast_cli(a->fd, "Second:         %u\n", report.second);
+	ast_cli(a->fd, "Legs up:        %u of %u\n", report.active, legs);
+	ast_cli(a->fd, "Legs started:   %u in the last second\n", report.started);
+	ast_cli(a->fd, "Legs failed:    %u\n", report.failed);
+	ast_cli(a->fd, "Frames:         %" PRIu64 " sent, %" PRIu64 " received in the last second\n",
+		report.sent, report.received);
+	ast_cli(a->fd, "Loss:           %.2f%%\n", report.loss);
+	ast_cli(a->fd, "Latency:        %" PRId64 "us average, %" PRId64 "us max\n",
+		report.latency_avg, report.latency_max);
+	ast_cli(a->fd, "CPU:            %.1f%%\n", report.cpu);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_loadgen[] = {
+	AST_CLI_DEFINE(handle_loadgen_start, "Start the load generator"),
+	AST_CLI_DEFINE(handle_loadgen_stop, "Stop the load generator"),
+	AST_CLI_DEFINE(handle_loadgen_show_status, "Show the state of the load generator"),
+};
+
+static struct ast_sched_context *bench_sched;
+static struct loadgen_leg *bench_leg;
+
+AST_BENCH_DEFINE(loadgen_rtp_roundtrip)
+{
+	static unsigned char buf[AST_FRIENDLY_OFFSET + 160];
+	uint32_t seq;
+	struct ast_frame f = {
+		.frametype = AST_FRAME_VOICE,
+		.datalen = 160,
+		.samples = 160,
+		.offset = AST_FRIENDLY_OFFSET,
+		.data.ptr = buf + AST_FRIENDLY_OFFSET,
+		.src = "loadgen",
+	};
+	struct pollfd pfd = { .events = POLLIN, };
+	struct timeval sent;
+
+	switch (cmd) {
+	case BENCH_INIT:
+		info->name = "rtp_roundtrip";
+		info->category = "/res/loadgen/";
+		info->summary = "Time for an RTP frame to cross loopback";
+		info->description = "Writes a 20 ms ulaw frame to an RTP instance and measures how long it takes to be read from the instance it is sent to.";
+		info->iterations = 1000;
+		return 0;
+	case BENCH_SETUP:
+		bench_sched = ast_sched_context_create();
+		bench_leg = ast_calloc(1, sizeof(*bench_leg));
+		if (!bench_sched || ast_sched_start_thread(bench_sched) || !bench_leg) {
+			return -1;
+		}
+		bench_leg->format = ao2_bump(ast_format_ulaw);
+		return loadgen_leg_rtp(bench_leg, bench_sched);
+	case BENCH_RUN:
+		f.subclass.format = bench_leg->format;
+		seq = htonl(bench_leg->seq++);
+		memcpy(f.data.ptr, &seq, sizeof(seq));
+		sent = ast_tvnow();
+		ast_rtp_instance_write(bench_leg->tx, &f);
+
+		pfd.fd = ast_rtp_instance_fd(bench_leg->rx, 0);
+		while (ast_poll(&pfd, 1, 1000) > 0) {
+			struct ast_frame *read = ast_rtp_instance_read(bench_leg->rx, 0);
+			int done = read && read->frametype == AST_FRAME_VOICE;
+
+			if (read) {
+				ast_frfree(read);
+			}
+			if (done) {
+				ast_bench_set_time(bench, ast_tvdiff_us(ast_tvnow(), sent));
+				return 0;
+			}
+		}
+		/* Strict RTP drops the first packets from a new source */
+		ast_bench_set_time(bench, 0);
+		return bench_leg->seq < 10 ? 0 : -1;
+	case BENCH_CLEANUP:
+		if (bench_leg) {
+			loadgen_leg_free(bench_leg);
+			bench_leg = NULL;
+		}
+		ast_sched_context_destroy(bench_sched);
+		bench_sched = NULL;
+		return 0;
+	}
+
+	return -1;
+}
+
+static int unload_module(void)
+{
+	int i;
+
+	AST_BENCH_UNREGISTER(loadgen_rtp_roundtrip);
+	ast_cli_unregister_multiple(cli_loadgen, ARRAY_LEN(cli_loadgen));
+	for (i = 0; i < ARRAY_LEN(metrics); i++) {
+		ast_prometheus_metric_unregister(metrics[i]);
+	}
+
+	ast_mutex_lock(&run_lock);
+	loadgen_run_free(current_run);
+	current_run = NULL;
+	ast_mutex_unlock(&run_lock);
+
+	return 0;
+}
+
+static int load_module(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(metrics); i++) {
+		/* Only served if res_prometheus is loaded */
+		ast_prometheus_metric_register(metrics[i]);
+	}
+	ast_cli_register_multiple(cli_loadgen, ARRAY_LEN(cli_loadgen));
+	AST_BENCH_REGISTER(loadgen_rtp_roundtrip);
+
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD_EXTENDED(ASTERISK_GPL_KEY, "Synthetic media load generator");
@@ -0,0 +1,501 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief AMI over WebSocket using JSON
+ *
+ * Clients connect to the HTTP server's WebSocket URI using the "ami"
+ * protocol.  Each text frame sent by the client holds an action as a JSON
+ * object, or an array of them, whose members are the action's headers.
+ * Each text frame sent to the client is a JSON array of the responses and
+ * events that were ready to be sent at the same time.
+ *
+ * The session itself is an ordinary AMI session started with
+ * ast_manager_session_start(), so authentication, permissions, event
+ * filters and event batching all behave exactly as they do over TCP.
+ */
+
+/*** MODULEINFO
+	<depend>res_http_websocket</depend>
+	<support_level>extended</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <sys/socket.h>
+
+#include "asterisk/module.h"
+#include "asterisk/manager.h"
+#include "asterisk/http_websocket.h"
+#include "asterisk/json.h"
+#include "asterisk/strings.h"
+#include "asterisk/utils.h"
+#include "asterisk/poll-compat.h"
+
+/*! \brief The WebSocket protocol name clients ask for */
+#define AMI_WS_PROTOCOL "ami"
+
+/*! \brief Largest fragmented message the client may send */
+#define AMI_WS_MAX_MESSAGE (64 * 1024)
+
+/*! \brief The banner AMI sends first, which has no blank line after it */
+#define AMI_BANNER_PREFIX "Asterisk Call Manager/"
+
+/*!
+ * \internal
+ * \brief Send an error for a client message that could not be made into an action.
+ */
+static int send_error(struct ast_websocket *ws, struct ast_json *action, const char *message)
+{
+	RAII_VAR(struct ast_json *, error, NULL, ast_json_unref);
+	const char *action_id = NULL;
+	char *str;
+	int res;
+
+	if (action && ast_json_typeof(action) == AST_JSON_OBJECT) {
+		action_id = ast_json_string_get(ast_json_object_get(action, "ActionID"));
+	}
+
+	if (action_id) {
+		error = ast_json_pack("[{s: s, s: s, s: s}]", "Response", "Error",
+			"ActionID", action_id, "Message", message);
+	} else {
+		error = ast_json_pack("[{s: s, s: s}]", "Response", "Error", "Message", message);
+	}
+	if (!error || !(str = ast_json_dump_string(error))) {
+		return -1;
+	}
+
+	res = ast_websocket_write_string(ws, str);
+	ast_json_free(str);
+
+	return res;
+}
+
+/*!
+ * \internal
+ * \brief Check that text can be placed in an AMI header without starting a new one.
+ */
+static int header_text_valid(const char *text)
+{
+	return !strpbrk(text, "\r\n");
+}
+
+/*!
+ * \internal
+ * \brief Append one header value to an action.
+ *
+ * Strings, numbers and booleans are placed in the header as is.  An array
+ * repeats the header for each element and an object repeats it as
+ * "name=value" for each member, which is how actions such as Originate
+ * take channel variables.
+ *
+ * \retval 0 on success
+ * \retval -1 if the value cannot be expressed as a header
+ */
+static int append_header(struct ast_str **text, const char *key, struct ast_json *value, int nested)
+{
+	struct ast_json_iter *iter;
+	size_t i;
+
+	switch (ast_json_typeof(value)) {
+	case AST_JSON_STRING:
+		if (!header_text_valid(ast_json_string_get(value))) {
+			return -1;
+		}
+		ast_str_append(text, 0, "%s: %s\r\n", key, ast_json_string_get(value));
+		return 0;
+	case AST_JSON_INTEGER:
+		ast_str_append(text, 0, "%s: %jd\r\n", key, ast_json_integer_get(value));
+		return 0;
+	case AST_JSON_REAL:
+		ast_str_append(text, 0, "%s: %f\r\n", key, ast_json_real_get(value));
+		return 0;
+	case AST_JSON_TRUE:
+		ast_str_append(text, 0, "%s: true\r\n", key);
+		return 0;
+	case AST_JSON_FALSE:
+		ast_str_append(text, 0, "%s: false\r\n", key);
+		return 0;
+	case AST_JSON_NULL:
+		ast_str_append(text, 0, "%s: \r\n", key);
+		return 0;
+	case AST_JSON_ARRAY:
+		if (nested) {
+			return -1;
+		}
+		for (i = 0; i < ast_json_array_size(value); ++i) {
+			if (append_header(text, key, ast_json_array_get(value, i), 1)) {
+				return -1;
+			}
+		}
+		return 0;
+	case AST_JSON_OBJECT:
+		if (nested) {
+			return -1;
+		}
+		for (iter = ast_json_object_iter(value); iter; iter = ast_json_object_iter_next(value, iter)) {
+			struct ast_json *member = ast_json_object_iter_value(iter);
+			const char *name = ast_json_object_iter_key(iter);
+
+			if (ast_json_typeof(member) != AST_JSON_STRING
+				|| !header_text_valid(name) || !header_text_valid(ast_json_string_get(member))) {
+				return -1;
+			}
+			ast_str_append(text, 0, "%s: %s=%s\r\n", key, name, ast_json_string_get(member));
+		}
+		return 0;
+	}
+
+	return -1;
+}
+
+/*!
+ * \internal
+ * \brief Convert a JSON action to AMI protocol text.
+ *
+ * \retval 0 on success
+ * \retval -1 if the action is not valid
+ */
+static int action_to_text(struct ast_json *action, struct ast_str **text)
+{
+	struct ast_json_iter *iter;
+
+	if (ast_json_typeof(action) != AST_JSON_OBJECT) {
+		return -1;
+	}
+
+	for (iter = ast_json_object_iter(action); iter; iter = ast_json_object_iter_next(action, iter)) {
+		const char *key = ast_json_object_iter_key(iter);
+
+		if (ast_strlen_zero(key) || strpbrk(key, ":\r\n")
+			|| append_header(text, key, ast_json_object_iter_value(iter), 0)) {
+			return -1;
+		}
+	}
+	ast_str_append(text, 0, "\r\n");
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Write all of a buffer to the manager session's socket.
+ */
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t res;
+
+	while (len) {
+		res = write(fd, buf, len);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += res;
+		len -= res;
+	}
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Pass a message from the client to the manager session.
+ *
+ * \retval 0 to keep going
+ * \retval -1 when the connection is over
+ */
+static int websocket_to_manager(struct ast_websocket *ws, int fd)
+{
+	RAII_VAR(struct ast_json *, json, NULL, ast_json_unref);
+	RAII_VAR(struct ast_str *, text, NULL, ast_free);
+	char *payload;
+	uint64_t payload_len;
+	enum ast_websocket_opcode opcode;
+	int fragmented;
+	size_t i;
+
+	if (ast_websocket_read(ws, &payload, &payload_len, &opcode, &fragmented)) {
+		return -1;
+	}
+
+	if (opcode == AST_WEBSOCKET_OPCODE_CLOSE) {
+		return -1;
+	}
+	if ((opcode != AST_WEBSOCKET_OPCODE_TEXT && opcode != AST_WEBSOCKET_OPCODE_BINARY)
+		|| fragmented) {
+		/* Control frames are handled by the WebSocket code, and fragments
+		 * are reconstructed until the message is complete. */
+		return 0;
+	}
+
+	json = ast_json_load_buf(payload, payload_len, NULL);
+	if (!json) {
+		return send_error(ws, NULL, "Invalid JSON");
+	}
+
+	text = ast_str_create(256);
+	if (!text) {
+		return -1;
+	}
+
+	if (ast_json_typeof(json) == AST_JSON_ARRAY) {
+		for (i = 0; i < ast_json_array_size(json); ++i) {
+			struct ast_json *action = ast_json_array_get(json, i);
+
+			if (action_to_text(action, &text)) {
+				return send_error(ws, action, "Invalid action");
+			}
+		}
+	} else if (action_to_text(json, &text)) {
+		return send_error(ws, json, "Invalid action");
+	}
+
+	return write_all(fd, ast_str_buffer(text), ast_str_strlen(text));
+}
+
+/*!
+ * \internal
+ * \brief Add a header of an AMI message to its JSON object.
+ *
+ * A header that appears more than once becomes an array of its values.
+ */
+static int message_add_header(struct ast_json *message, const char *key, const char *value)
+{
+	struct ast_json *existing = ast_json_object_get(message, key);
+	struct ast_json *array;
+
+	if (!existing) {
+		return ast_json_object_set(message, key, ast_json_string_create(value));
+	}
+
+	if (ast_json_typeof(existing) != AST_JSON_ARRAY) {
+		array = ast_json_array_create();
+		if (!array || ast_json_array_append(array, ast_json_ref(existing))
+			|| ast_json_object_set(message, key, array)) {
+			return -1;
+		}
+		existing = array;
+	}
+
+	return ast_json_array_append(existing, ast_json_string_create(value));
+}
+
+/*!
+ * \internal
+ * \brief Convert one AMI message to a JSON object.
+ *
+ * \param text The message's headers, modified in place
+ */
+static struct ast_json *message_to_json(char *text)
+{
+	struct ast_json *message = ast_json_object_create();
+	char *line;
+
+	if (!message) {
+		return NULL;
+	}
+
+	while ((line = strsep(&text, "\n"))) {
+		char *value;
+
+		line = ast_strip(line);
+		if (ast_strlen_zero(line)) {
+			continue;
+		}
+
+		value = strchr(line, ':');
+		if (value) {
+			*value++ = '\0';
+			value = ast_skip_blanks(value);
+		} else {
+			/* Lines that aren't headers are output from a command */
+			value = line;
+			line = "Output";
+		}
+
+		if (message_add_header(message, line, value)) {
+			ast_json_unref(message);
+			return NULL;
+		}
+	}
+
+	return message;
+}
+
+/*!
+ * \internal
+ * \brief Pass what the manager session has written on to the client.
+ *
+ * Every complete message that has been written is sent to the client in
+ * a single frame, so events the manager session batched together stay
+ * together.
+ *
+ * \retval 0 to keep going
+ * \retval -1 when the connection is over
+ */
+static int manager_to_websocket(struct ast_websocket *ws, int fd, struct ast_str **buf, int *banner)
+{
+	RAII_VAR(struct ast_json *, messages, NULL, ast_json_unref);
+	char data[4096];
+	ssize_t len;
+	char *start;
+	char *end;
+	char *str;
+	int res;
+
+	len = read(fd, data, sizeof(data) - 1);
+	if (len <= 0) {
+		return len < 0 && (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+	}
+	data[len] = '\0';
+	ast_str_append(buf, 0, "%s", data);
+
+	messages = ast_json_array_create();
+	if (!messages) {
+		return -1;
+	}
+
+	start = ast_str_buffer(*buf);
+	if (!*banner && (end = strstr(start, "\r\n"))) {
+		*end = '\0';
+		if (!strncmp(start, AMI_BANNER_PREFIX, strlen(AMI_BANNER_PREFIX))) {
+			ast_json_array_append(messages, ast_json_pack("{s: s}", "Banner", start));
+		}
+		start = end + 2;
+		*banner = 1;
+	}
+
+	while ((end = strstr(start, "\r\n\r\n"))) {
+		*end = '\0';
+		if (ast_json_array_append(messages, message_to_json(start))) {
+			return -1;
+		}
+		start = end + 4;
+	}
+
+	/* Keep the start of a message that hasn't been completely written yet */
+	len = strlen(start);
+	memmove(ast_str_buffer(*buf), start, len + 1);
+	ast_str_truncate(*buf, len);
+
+	if (!ast_json_array_size(messages)) {
+		return 0;
+	}
+
+	str = ast_json_dump_string(messages);
+	if (!str) {
+		return -1;
+	}
+	res = ast_websocket_write_string(ws, str);
+	ast_json_free(str);
+
+	return res;
+}
+
+static void manager_websocket_callback(struct ast_websocket *ws, struct ast_variable *parameters, struct ast_variable *headers)
+{
+	struct pollfd fds[2];
+	struct ast_str *buf = NULL;
+	int banner = 0;
+	int pair[2];
+
+	if (!check_manager_enabled() || !check_webmanager_enabled()) {
+		ast_debug(1, "AMI over WebSocket requested, but the web manager is not enabled\n");
+		goto end;
+	}
+
+	if (ast_websocket_set_nonblock(ws)) {
+		goto end;
+	}
+	ast_websocket_reconstruct_enable(ws, AMI_WS_MAX_MESSAGE);
+
+	if (socketpair(AF_LOCAL, SOCK_STREAM, 0, pair)) {
+		ast_log(LOG_WARNING, "Failed to create socket pair for AMI over WebSocket: %s\n",
+			strerror(errno));
+		goto end;
+	}
+
+	if (ast_manager_session_start(pair[1], NULL, ast_websocket_remote_address(ws),
+		ast_websocket_is_secure(ws) ? AST_TRANSPORT_WSS : AST_TRANSPORT_WS)) {
+		close(pair[0]);
+		goto end;
+	}
+
+	buf = ast_str_create(4096);
+	if (!buf) {
+		close(pair[0]);
+		goto end;
+	}
+
+	for (;;) {
+		fds[0].fd = ast_websocket_fd(ws);
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd = pair[0];
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+
+		if (ast_poll(fds, ARRAY_LEN(fds), -1) < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			break;
+		}
+
+		if (fds[0].revents && websocket_to_manager(ws, pair[0])) {
+			break;
+		}
+		if (fds[1].revents && manager_to_websocket(ws, pair[0], &buf, &banner)) {
+			break;
+		}
+	}
+
+	/* The manager session ends when it sees its socket close */
+	close(pair[0]);
+
+end:
+	ast_free(buf);
+	ast_websocket_unref(ws);
+}
+
+static int unload_module(void)
+{
+	ast_websocket_remove_protocol(AMI_WS_PROTOCOL, manager_websocket_callback);
+	return 0;
+}
+
+static int load_module(void)
+{
+	if (ast_websocket_add_protocol(AMI_WS_PROTOCOL, manager_websocket_callback)) {
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO(ASTERISK_GPL_KEY, AST_MODFLAG_LOAD_ORDER, "AMI over WebSocket",
+	.support_level = AST_MODULE_SUPPORT_EXTENDED,
+	.load = load_module,
+	.unload = unload_module,
+	.nonoptreq = "res_http_websocket",
+);
@@ -414,7 +414,7 @@ int AST_OPTIONAL_API_NAME(ast_monitor_start)(struct ast_channel *chan, const cha
 				ast_channel_monitor_start_type(),
 				NULL);
 		if (message) {
-			stasis_publish(ast_channel_topic(chan), message);
+			stasis_publish(ast_channel_topic_for_publish(chan), message);
 		}
 	} else {
 		ast_debug(1,"Cannot start monitoring %s, already monitored\n", ast_channel_name(chan));
@@ -538,7 +538,7 @@ int AST_OPTIONAL_API_NAME(ast_monitor_stop)(struct ast_channel *chan, int need_l
 				ast_channel_monitor_stop_type(),
 				NULL);
 		if (message) {
-			stasis_publish(ast_channel_topic(chan), message);
+			stasis_publish(ast_channel_topic_for_publish(chan), message);
 		}
 		pbx_builtin_setvar_helper(chan, "MONITORED", NULL);
 	}
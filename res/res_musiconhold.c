@@ -76,6 +76,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/poll-compat.h"
 
 #define INITIAL_NUM_FILES   8
+/*! Frames of a "broadcast" class kept for listeners that fall behind */
+#define MOH_RING_SIZE	16
+/*! Milliseconds between frames of a "broadcast" class being read */
+#define MOH_BROADCAST_TICK	20
 #define HANDLE_REF	1
 #define DONT_UNREF	0
 
@@ -151,6 +155,7 @@ struct moh_files_state {
 
 #define MOH_CACHERTCLASSES      (1 << 5)        /*!< Should we use a separate instance of MOH for each user or not */
 #define MOH_ANNOUNCEMENT	(1 << 6)			/*!< Do we play announcement files between songs on this channel? */
+#define MOH_BROADCAST		(1 << 7)	/*!< Play the files once for every channel listening to the class */
 
 /* Custom astobj2 flag */
 #define MOH_NOTDELETED          (1 << 30)       /*!< Find only records that aren't deleted? */
@@ -185,6 +190,12 @@ struct mohclass {
 	/*! Created on the fly, from RT engine */
 	unsigned int realtime:1;
 	unsigned int delete:1;
+	/*! Set to stop the thread of a "broadcast" class */
+	unsigned int stop:1;
+	/*! Latest frames of a "broadcast" class, in the class format */
+	struct ast_frame *ring[MOH_RING_SIZE];
+	/*! Number of frames placed in the ring so far */
+	unsigned int ring_head;
 	AST_LIST_HEAD_NOLOCK(, mohdata) members;
 	AST_LIST_ENTRY(mohclass) list;
 };
@@ -194,6 +205,8 @@ struct mohdata {
 	struct ast_format *origwfmt;
 	struct mohclass *parent;
 	struct ast_frame f;
+	/*! Number of the next frame of a "broadcast" class to play */
+	unsigned int ring_pos;
 	AST_LIST_ENTRY(mohdata) list;
 };
 
@@ -248,7 +261,7 @@ static void moh_post_start(struct ast_channel *chan, const char *moh_class_name)
 		/* A channel snapshot must have been in the cache. */
 		ast_assert(((struct ast_channel_blob *) stasis_message_data(message))->snapshot != NULL);
 
-		stasis_publish(ast_channel_topic(chan), message);
+		stasis_publish(ast_channel_topic_for_publish(chan), message);
 	}
 	ao2_cleanup(message);
 	ast_json_unref(json_object);
@@ -266,7 +279,7 @@ static void moh_post_stop(struct ast_channel *chan)
 		/* A channel snapshot must have been in the cache. */
 		ast_assert(((struct ast_channel_blob *) stasis_message_data(message))->snapshot != NULL);
 
-		stasis_publish(ast_channel_topic(chan), message);
+		stasis_publish(ast_channel_topic_for_publish(chan), message);
 	}
 	ao2_cleanup(message);
 }
@@ -797,6 +810,192 @@ static void *monmp3thread(void *data)
 	return NULL;
 }
 
+/*!
+ * \internal
+ * \brief Open the next file of a "broadcast" class.
+ *
+ * \param class The class
+ * \param pos Position of the file playing, updated to the file opened
+ *
+ * \return The stream of the file, NULL if none of the files could be opened
+ */
+static struct ast_filestream *moh_broadcast_open_next(struct mohclass *class, int *pos)
+{
+	int tries;
+
+	for (tries = 0; ; ++tries) {
+		char filename[PATH_MAX];
+		struct ast_filestream *stream;
+		char *ext;
+
+		/* The files may be rescanned while we play */
+		ao2_lock(class);
+		if (tries >= class->total_files) {
+			ao2_unlock(class);
+			return NULL;
+		}
+		if (ast_test_flag(class, MOH_RANDOMIZE)) {
+			*pos = ast_random() % class->total_files;
+		} else {
+			*pos = (*pos + 1) % class->total_files;
+		}
+		ast_copy_string(filename, class->filearray[*pos], sizeof(filename));
+		ao2_unlock(class);
+
+		ext = strrchr(filename, '.');
+		if (!ext) {
+			continue;
+		}
+		*ext++ = '\0';
+
+		stream = ast_readfile(filename, ext, NULL, O_RDONLY, 0, 0);
+		if (stream) {
+			ast_debug(1, "MOH class '%s' broadcasting file '%s.%s'\n", class->name, filename, ext);
+			return stream;
+		}
+	}
+}
+
+/*!
+ * \internal
+ * \brief Place a frame in the ring of a "broadcast" class.
+ *
+ * \return Number of samples placed
+ */
+static int moh_broadcast_push(struct mohclass *class, struct ast_frame *f)
+{
+	struct ast_frame *dup;
+	struct ast_frame **slot;
+
+	if (!(dup = ast_frdup(f))) {
+		return 0;
+	}
+
+	ao2_lock(class);
+	slot = &class->ring[class->ring_head % MOH_RING_SIZE];
+	if (*slot) {
+		ast_frfree(*slot);
+	}
+	*slot = dup;
+	++class->ring_head;
+	ao2_unlock(class);
+
+	return dup->samples;
+}
+
+/*!
+ * \brief Read the files of a "broadcast" class into its ring of frames.
+ *
+ * Files are read at the rate they play, and only while a channel is
+ * listening. Frames not in the class format are translated here, once for
+ * every listener.
+ */
+static void *moh_broadcast_thread(void *data)
+{
+	struct mohclass *class = data;
+	struct ast_filestream *stream = NULL;
+	struct ast_trans_pvt *trans = NULL;
+	struct ast_format *trans_src = NULL;
+	struct timeval start = { 0, };
+	int rate = ast_format_get_sample_rate(class->format);
+	long long samples = 0;
+	int pos = -1;
+	/* Whether failing to play has been logged, so it is not logged every tick */
+	int warned = 0;
+
+	while (!class->stop) {
+		long long due;
+		int frames;
+		int listening;
+
+		if (class->timer) {
+			struct pollfd pfd = { .fd = ast_timer_fd(class->timer), .events = POLLIN | POLLPRI, };
+
+			if (ast_poll(&pfd, 1, MOH_BROADCAST_TICK * 5) > 0) {
+				ast_timer_ack(class->timer, 1);
+			}
+		} else {
+			usleep(MOH_BROADCAST_TICK * 1000);
+		}
+
+		ao2_lock(class);
+		listening = !AST_LIST_EMPTY(&class->members);
+		ao2_unlock(class);
+		if (!listening) {
+			/* Pick up from here when someone listens again */
+			start = ast_tv(0, 0);
+			continue;
+		}
+		if (ast_tvzero(start)) {
+			start = ast_tvnow();
+			samples = 0;
+		}
+
+		/* Stay a tick ahead so listeners do not run dry between reads */
+		due = (ast_tvdiff_ms(ast_tvnow(), start) + MOH_BROADCAST_TICK) * rate / 1000;
+		for (frames = 0; samples < due && frames < MOH_RING_SIZE && !class->stop; ++frames) {
+			struct ast_frame *f = stream ? ast_readframe(stream) : NULL;
+			struct ast_frame *cur;
+
+			if (!f) {
+				if (stream) {
+					ast_closestream(stream);
+				}
+				if (!(stream = moh_broadcast_open_next(class, &pos))) {
+					if (!warned) {
+						ast_log(LOG_WARNING, "No files could be opened for MOH class '%s'\n", class->name);
+						warned = 1;
+					}
+					break;
+				}
+				continue;
+			}
+
+			if (ast_format_cmp(f->subclass.format, class->format) == AST_FORMAT_CMP_NOT_EQUAL) {
+				if (!trans || ast_format_cmp(f->subclass.format, trans_src) == AST_FORMAT_CMP_NOT_EQUAL) {
+					if (trans) {
+						ast_translator_free_path(trans);
+					}
+					ao2_replace(trans_src, f->subclass.format);
+					if (!(trans = ast_translator_build_path(class->format, f->subclass.format)) && !warned) {
+						ast_log(LOG_WARNING, "Cannot translate MOH class '%s' from %s to %s\n", class->name,
+							ast_format_get_name(f->subclass.format), ast_format_get_name(class->format));
+						warned = 1;
+					}
+					if (!trans) {
+						ast_closestream(stream);
+						stream = NULL;
+						break;
+					}
+				}
+				f = ast_translate(trans, f, 0);
+				for (cur = f; cur; cur = AST_LIST_NEXT(cur, frame_list)) {
+					samples += moh_broadcast_push(class, cur);
+				}
+				ast_frfree(f);
+			} else {
+				samples += moh_broadcast_push(class, f);
+			}
+			warned = 0;
+		}
+		if (samples < due) {
+			/* Could not keep up; do not try to make up for it later */
+			start = ast_tvnow();
+			samples = 0;
+		}
+	}
+
+	if (stream) {
+		ast_closestream(stream);
+	}
+	if (trans) {
+		ast_translator_free_path(trans);
+	}
+	ao2_cleanup(trans_src);
+
+	return NULL;
+}
+
 static int play_moh_exec(struct ast_channel *chan, const char *data)
 {
 	char *parse;
@@ -896,18 +1095,21 @@ static struct mohdata *mohalloc(struct mohclass *cl)
 	if (!(moh = ast_calloc(1, sizeof(*moh))))
 		return NULL;
 
-	if (pipe(moh->pipe)) {
+	if (ast_test_flag(cl, MOH_BROADCAST)) {
+		/* Frames are taken from the class ring instead */
+		moh->pipe[0] = moh->pipe[1] = -1;
+	} else if (pipe(moh->pipe)) {
 		ast_log(LOG_WARNING, "Failed to create pipe: %s\n", strerror(errno));
 		ast_free(moh);
 		return NULL;
+	} else {
+		/* Make entirely non-blocking */
+		flags = fcntl(moh->pipe[0], F_GETFL);
+		fcntl(moh->pipe[0], F_SETFL, flags | O_NONBLOCK);
+		flags = fcntl(moh->pipe[1], F_GETFL);
+		fcntl(moh->pipe[1], F_SETFL, flags | O_NONBLOCK);
 	}
 
-	/* Make entirely non-blocking */
-	flags = fcntl(moh->pipe[0], F_GETFL);
-	fcntl(moh->pipe[0], F_SETFL, flags | O_NONBLOCK);
-	flags = fcntl(moh->pipe[1], F_GETFL);
-	fcntl(moh->pipe[1], F_SETFL, flags | O_NONBLOCK);
-
 	moh->f.frametype = AST_FRAME_VOICE;
 	moh->f.subclass.format = cl->format;
 	moh->f.offset = AST_FRIENDLY_OFFSET;
@@ -916,6 +1118,7 @@ static struct mohdata *mohalloc(struct mohclass *cl)
 
 	ao2_lock(cl);
 	AST_LIST_INSERT_HEAD(&cl->members, moh, list);
+	moh->ring_pos = cl->ring_head;
 	ao2_unlock(cl);
 	
 	return moh;
@@ -931,8 +1134,10 @@ static void moh_release(struct ast_channel *chan, void *data)
 	AST_LIST_REMOVE(&moh->parent->members, moh, list);	
 	ao2_unlock(class);
 	
-	close(moh->pipe[0]);
-	close(moh->pipe[1]);
+	if (moh->pipe[0] > -1) {
+		close(moh->pipe[0]);
+		close(moh->pipe[1]);
+	}
 
 	oldwfmt = moh->origwfmt;
 
@@ -1032,6 +1237,50 @@ static struct ast_generator mohgen = {
 	.digit    = moh_handle_digit,
 };
 
+static int moh_broadcast_generate(struct ast_channel *chan, void *data, int len, int samples)
+{
+	struct mohdata *moh = data;
+	struct mohclass *class = moh->parent;
+	short buf[1280 + AST_FRIENDLY_OFFSET / 2];
+
+	for (;;) {
+		struct ast_frame *f;
+
+		/* Copy the frame out, since writing it may change it */
+		ao2_lock(class);
+		if (moh->ring_pos == class->ring_head) {
+			ao2_unlock(class);
+			return 0;
+		}
+		if (class->ring_head - moh->ring_pos > MOH_RING_SIZE) {
+			/* Fell behind; skip the frames no longer held */
+			moh->ring_pos = class->ring_head - MOH_RING_SIZE;
+		}
+		f = class->ring[moh->ring_pos++ % MOH_RING_SIZE];
+		if (f->datalen > sizeof(buf) - AST_FRIENDLY_OFFSET) {
+			ao2_unlock(class);
+			continue;
+		}
+		memcpy(buf + AST_FRIENDLY_OFFSET / 2, f->data.ptr, f->datalen);
+		moh->f.datalen = f->datalen;
+		moh->f.samples = f->samples;
+		ao2_unlock(class);
+
+		moh->f.data.ptr = buf + AST_FRIENDLY_OFFSET / 2;
+		if (ast_write(chan, &moh->f) < 0) {
+			ast_log(LOG_WARNING, "Failed to write frame to '%s': %s\n", ast_channel_name(chan), strerror(errno));
+			return -1;
+		}
+	}
+}
+
+static struct ast_generator moh_broadcast_stream = {
+	.alloc    = moh_alloc,
+	.release  = moh_release,
+	.generate = moh_broadcast_generate,
+	.digit    = moh_handle_digit,
+};
+
 static int moh_add_file(struct mohclass *class, const char *filepath)
 {
 	if (!class->allowed_files) {
@@ -1061,6 +1310,48 @@ static int moh_add_file(struct mohclass *class, const char *filepath)
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Add a file to a "broadcast" class.
+ *
+ * Files of a "broadcast" class are kept with their extension since they
+ * are read in a single format. When a file is present in several formats,
+ * the one in the class format is preferred.
+ */
+static int moh_add_broadcast_file(struct mohclass *class, const char *filepath)
+{
+	const char *ext = strrchr(filepath, '.');
+	struct ast_format *format = ast_get_format_for_file_ext(ext + 1);
+	int i;
+
+	if (!format) {
+		/* Not a format we can read */
+		return 0;
+	}
+
+	for (i = 0; i < class->total_files; i++) {
+		if (strrchr(class->filearray[i], '.') == class->filearray[i] + (ext - filepath)
+			&& !strncmp(class->filearray[i], filepath, ext - filepath)) {
+			break;
+		}
+	}
+	if (i == class->total_files) {
+		return moh_add_file(class, filepath);
+	}
+
+	if (ast_format_cmp(format, class->format) == AST_FORMAT_CMP_EQUAL) {
+		char *dup = ast_strdup(filepath);
+
+		if (!dup) {
+			return -1;
+		}
+		ast_free(class->filearray[i]);
+		class->filearray[i] = dup;
+	}
+
+	return 0;
+}
+
 static int moh_sort_compare(const void *i1, const void *i2)
 {
 	char *s1, *s2;
@@ -1119,6 +1410,12 @@ static int moh_scan_files(struct mohclass *class) {
 		if (!S_ISREG(statbuf.st_mode))
 			continue;
 
+		if (ast_test_flag(class, MOH_BROADCAST)) {
+			if (moh_add_broadcast_file(class, filepath))
+				break;
+			continue;
+		}
+
 		if ((ext = strrchr(filepath, '.')))
 			*ext = '\0';
 
@@ -1167,6 +1464,11 @@ static void moh_rescan_files(void) {
 	while ((c = ao2_iterator_next(&i))) {
 		if (!strcasecmp(c->mode, "files")) {
 			moh_scan_files(c);
+		} else if (!strcasecmp(c->mode, "broadcast")) {
+			/* The broadcast thread reads the files too */
+			ao2_lock(c);
+			moh_scan_files(c);
+			ao2_unlock(c);
 		}
 		ao2_ref(c, -1);
 	}
@@ -1229,6 +1531,35 @@ static int init_app_class(struct mohclass *class)
 	return 0;
 }
 
+static int init_broadcast_class(struct mohclass *class)
+{
+	ast_set_flag(class, MOH_BROADCAST);
+
+	if (init_files_class(class)) {
+		return -1;
+	}
+
+	if (!(class->timer = ast_timer_open())) {
+		ast_log(LOG_WARNING, "Unable to create timer: %s\n", strerror(errno));
+	}
+	if (class->timer && ast_timer_set_rate(class->timer, 1000 / MOH_BROADCAST_TICK)) {
+		ast_log(LOG_WARNING, "Unable to set %dms frame rate: %s\n", MOH_BROADCAST_TICK, strerror(errno));
+		ast_timer_close(class->timer);
+		class->timer = NULL;
+	}
+
+	if (ast_pthread_create_background(&class->thread, NULL, moh_broadcast_thread, class)) {
+		ast_log(LOG_WARNING, "Unable to create moh thread...\n");
+		if (class->timer) {
+			ast_timer_close(class->timer);
+			class->timer = NULL;
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
 /*!
  * \note This function owns the reference it gets to moh if unref is true
  */
@@ -1261,6 +1592,13 @@ static int _moh_register(struct mohclass *moh, int reload, int unref, const char
 			}
 			return -1;
 		}
+	} else if (!strcasecmp(moh->mode, "broadcast")) {
+		if (init_broadcast_class(moh)) {
+			if (unref) {
+				moh = mohclass_unref(moh, "unreffing potential new moh class (init_broadcast_class failed)");
+			}
+			return -1;
+		}
 	} else if (!strcasecmp(moh->mode, "mp3") || !strcasecmp(moh->mode, "mp3nb") || 
 			!strcasecmp(moh->mode, "quietmp3") || !strcasecmp(moh->mode, "quietmp3nb") || 
 			!strcasecmp(moh->mode, "httpmp3") || !strcasecmp(moh->mode, "custom")) {
@@ -1541,7 +1879,9 @@ static int local_ast_moh_start(struct ast_channel *chan, const char *mclass, con
 	}
 
 	if (!state || !state->class || strcmp(mohclass->name, state->class->name)) {
-		if (mohclass->total_files) {
+		if (ast_test_flag(mohclass, MOH_BROADCAST)) {
+			res = ast_activate_generator(chan, &moh_broadcast_stream, mohclass);
+		} else if (mohclass->total_files) {
 			res = ast_activate_generator(chan, &moh_file_stream, mohclass);
 		} else {
 			res = ast_activate_generator(chan, &mohgen, mohclass);
@@ -1579,6 +1919,7 @@ static void moh_class_destructor(void *obj)
 	struct mohclass *class = obj;
 	struct mohdata *member;
 	pthread_t tid = 0;
+	int x;
 
 	ast_debug(1, "Destroying MOH class '%s'\n", class->name);
 
@@ -1593,7 +1934,14 @@ static void moh_class_destructor(void *obj)
 	if (class->thread != AST_PTHREADT_NULL && class->thread != 0) {
 		tid = class->thread;
 		class->thread = AST_PTHREADT_NULL;
-		pthread_cancel(tid);
+		if (ast_test_flag(class, MOH_BROADCAST)) {
+			/* It uses the timer and format; let it finish before they go */
+			class->stop = 1;
+			pthread_join(tid, NULL);
+			tid = 0;
+		} else {
+			pthread_cancel(tid);
+		}
 		/* We'll collect the exit status later, after we ensure all the readers
 		 * are dead. */
 	}
@@ -1656,6 +2004,12 @@ static void moh_class_destructor(void *obj)
 		class->timer = NULL;
 	}
 
+	for (x = 0; x < MOH_RING_SIZE; x++) {
+		if (class->ring[x]) {
+			ast_frfree(class->ring[x]);
+		}
+	}
+
 	ao2_cleanup(class->format);
 
 	/* Finally, collect the exit status of the monitor thread */
@@ -1663,6 +2017,7 @@ static void moh_class_destructor(void *obj)
 		pthread_join(tid, NULL);
 	}
 
+
 }
 
 static int moh_class_mark(void *obj, void *arg, int flags)
@@ -64,6 +64,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/strings.h"
 #include "asterisk/threadstorage.h"
 #include "asterisk/data.h"
+#include "asterisk/threadpool.h"
+
+struct odbc_async_job;
 
 struct odbc_class
 {
@@ -92,10 +95,36 @@ struct odbc_class
 	ast_cond_t cond;
 	/*! The total number of current connections */
 	size_t connection_cnt;
+	/*! Maximum number of statements prepared on each connection */
+	unsigned int stmt_cache_size;
+	/*! Maximum number of connections running asynchronous statements */
+	unsigned int async_workers;
+	/*! Number of tasks currently running asynchronous statements */
+	unsigned int async_active;
+	/*! Asynchronous statements waiting for a worker */
+	AST_LIST_HEAD_NOLOCK(, odbc_async_job) async_queue;
+};
+
+/*! \brief A statement prepared on a connection */
+struct odbc_cached_stmt {
+	AST_LIST_ENTRY(odbc_cached_stmt) list;
+	SQLHSTMT stmt;
+	char sql[0];
+};
+
+/*! \brief A statement queued by ast_odbc_async_execute() */
+struct odbc_async_job {
+	AST_LIST_ENTRY(odbc_async_job) list;
+	SQLHSTMT (*prepare_cb)(struct odbc_obj *obj, void *data);
+	ast_odbc_async_cb result_cb;
+	void *data;
 };
 
 static struct ao2_container *class_container;
 
+/*! \brief Threads shared by the asynchronous workers of all classes */
+static struct ast_threadpool *async_pool;
+
 static AST_RWLIST_HEAD_STATIC(odbc_tables, odbc_cache_tables);
 
 static odbc_status odbc_obj_connect(struct odbc_obj *obj);
@@ -168,6 +197,7 @@ static void odbc_class_destructor(void *data)
 {
 	struct odbc_class *class = data;
 	struct odbc_obj *obj;
+	struct odbc_async_job *job;
 
 	/* Due to refcounts, we can safely assume that any objects with a reference
 	 * to us will prevent our destruction, so we don't need to worry about them.
@@ -186,6 +216,14 @@ static void odbc_class_destructor(void *data)
 		ao2_ref(obj, -1);
 	}
 
+	/* A queued statement keeps a worker, and so the class, alive, but be safe */
+	while ((job = AST_LIST_REMOVE_HEAD(&class->async_queue, list))) {
+		if (job->result_cb) {
+			job->result_cb(NULL, NULL, job->data);
+		}
+		ast_free(job);
+	}
+
 	SQLFreeHandle(SQL_HANDLE_ENV, class->env);
 	ast_mutex_destroy(&class->lock);
 	ast_cond_destroy(&class->cond);
@@ -371,6 +409,110 @@ int ast_odbc_clear_cache(const char *database, const char *tablename)
 	return tableptr ? 0 : -1;
 }
 
+/*!
+ * \internal
+ * \brief Free a statement handle, forgetting it if it is in the statement cache
+ */
+static void odbc_stmt_free(struct odbc_obj *obj, SQLHSTMT stmt)
+{
+	struct odbc_cached_stmt *cached;
+
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&obj->stmts, cached, list) {
+		if (cached->stmt == stmt) {
+			AST_LIST_REMOVE_CURRENT(list);
+			obj->stmt_count--;
+			ast_free(cached);
+			break;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+
+	SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+}
+
+/*!
+ * \internal
+ * \brief Free all of the statements prepared on a connection
+ */
+static void odbc_stmt_cache_flush(struct odbc_obj *obj)
+{
+	struct odbc_cached_stmt *cached;
+
+	while ((cached = AST_LIST_REMOVE_HEAD(&obj->stmts, list))) {
+		SQLFreeHandle(SQL_HANDLE_STMT, cached->stmt);
+		ast_free(cached);
+	}
+	obj->stmt_count = 0;
+}
+
+SQLHSTMT ast_odbc_prepare_cached(struct odbc_obj *obj, const char *sql)
+{
+	struct odbc_cached_stmt *cached;
+	SQLHSTMT stmt;
+	SQLRETURN res;
+
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&obj->stmts, cached, list) {
+		if (!strcmp(cached->sql, sql)) {
+			/* Keep the most recently used statements at the head */
+			AST_LIST_REMOVE_CURRENT(list);
+			AST_LIST_INSERT_HEAD(&obj->stmts, cached, list);
+			return cached->stmt;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+
+	res = SQLAllocHandle(SQL_HANDLE_STMT, obj->con, &stmt);
+	if (!SQL_SUCCEEDED(res)) {
+		ast_log(LOG_WARNING, "SQL Alloc Handle failed!\n");
+		return NULL;
+	}
+
+	res = SQLPrepare(stmt, (unsigned char *) sql, SQL_NTS);
+	if (!SQL_SUCCEEDED(res)) {
+		ast_odbc_print_errors(SQL_HANDLE_STMT, stmt, "SQL Prepare");
+		SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+		return NULL;
+	}
+
+	if (!obj->parent->stmt_cache_size
+		|| !(cached = ast_malloc(sizeof(*cached) + strlen(sql) + 1))) {
+		/* Not cached, ast_odbc_release_stmt() will free it */
+		return stmt;
+	}
+
+	if (obj->stmt_count >= obj->parent->stmt_cache_size) {
+		struct odbc_cached_stmt *oldest = AST_LIST_LAST(&obj->stmts);
+
+		odbc_stmt_free(obj, oldest->stmt);
+	}
+
+	cached->stmt = stmt;
+	strcpy(cached->sql, sql); /* SAFE */
+	AST_LIST_INSERT_HEAD(&obj->stmts, cached, list);
+	obj->stmt_count++;
+
+	return stmt;
+}
+
+void ast_odbc_release_stmt(struct odbc_obj *obj, SQLHSTMT stmt)
+{
+	struct odbc_cached_stmt *cached;
+
+	if (!stmt) {
+		return;
+	}
+
+	AST_LIST_TRAVERSE(&obj->stmts, cached, list) {
+		if (cached->stmt == stmt) {
+			SQLFreeStmt(stmt, SQL_CLOSE);
+			SQLFreeStmt(stmt, SQL_RESET_PARAMS);
+			return;
+		}
+	}
+
+	SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+}
+
 SQLHSTMT ast_odbc_direct_execute(struct odbc_obj *obj, SQLHSTMT (*exec_cb)(struct odbc_obj *obj, void *data), void *data)
 {
 	SQLHSTMT stmt;
@@ -402,7 +544,7 @@ SQLHSTMT ast_odbc_prepare_and_execute(struct odbc_obj *obj, SQLHSTMT (*prepare_c
 		}
 
 		ast_log(LOG_WARNING, "SQL Execute error %d!\n", res);
-		SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+		odbc_stmt_free(obj, stmt);
 		stmt = NULL;
 	}
 
@@ -491,6 +633,7 @@ static int load_odbc_config(void)
 	char *cat;
 	const char *dsn, *username, *password, *sanitysql;
 	int enabled, bse, conntimeout, forcecommit, isolation, maxconnections;
+	int stmtcache, asyncworkers;
 	struct timeval ncache = { 0, 0 };
 	int preconnect = 0, res = 0;
 	struct ast_flags config_flags = { 0 };
@@ -518,6 +661,8 @@ static int load_odbc_config(void)
 			forcecommit = 0;
 			isolation = SQL_TXN_READ_COMMITTED;
 			maxconnections = 1;
+			stmtcache = 16;
+			asyncworkers = 0;
 			for (v = ast_variable_browse(config, cat); v; v = v->next) {
 				if (!strcasecmp(v->name, "pooling") ||
 						!strncasecmp(v->name, "share", 5) ||
@@ -566,9 +711,24 @@ static int load_odbc_config(void)
 						ast_log(LOG_WARNING, "max_connections must be a positive integer\n");
 						maxconnections = 1;
                                         }
+				} else if (!strcasecmp(v->name, "statement_cache")) {
+					if (sscanf(v->value, "%30d", &stmtcache) != 1 || stmtcache < 0) {
+						ast_log(LOG_WARNING, "statement_cache must be a non-negative integer\n");
+						stmtcache = 16;
+					}
+				} else if (!strcasecmp(v->name, "async_workers")) {
+					if (sscanf(v->value, "%30d", &asyncworkers) != 1 || asyncworkers < 1) {
+						ast_log(LOG_WARNING, "async_workers must be a positive integer\n");
+						asyncworkers = 0;
+					}
 				}
 			}
 
+			/* Each asynchronous worker holds a connection while it runs */
+			if (!asyncworkers || asyncworkers > maxconnections) {
+				asyncworkers = maxconnections;
+			}
+
 			if (enabled && !ast_strlen_zero(dsn)) {
 				new = ao2_alloc(sizeof(*new), odbc_class_destructor);
 
@@ -592,6 +752,8 @@ static int load_odbc_config(void)
 				new->conntimeout = conntimeout;
 				new->negative_connection_cache = ncache;
 				new->maxconnections = maxconnections;
+				new->stmt_cache_size = stmtcache;
+				new->async_workers = asyncworkers;
 
 				if (cat)
 					ast_copy_string(new->name, cat, sizeof(new->name));
@@ -674,6 +836,7 @@ static char *handle_cli_odbc_show(struct ast_cli_entry *e, int cmd, struct ast_c
 			ast_cli(a->fd, "  Name:   %s\n  DSN:    %s\n", class->name, class->dsn);
 			ast_cli(a->fd, "    Last connection attempt: %s\n", timestr);
 			ast_cli(a->fd, "    Number of active connections: %zd (out of %d)\n", class->connection_cnt, class->maxconnections);
+			ast_cli(a->fd, "    Asynchronous workers: %u (out of %u)\n", class->async_active, class->async_workers);
 			ast_cli(a->fd, "\n");
 		}
 		ao2_ref(class, -1);
@@ -805,15 +968,17 @@ static int connection_dead(struct odbc_obj *connection, struct odbc_class *class
 	return SQL_SUCCEEDED(res) ? 0 : 1;
 }
 
-struct odbc_obj *_ast_odbc_request_obj2(const char *name, struct ast_flags flags, const char *file, const char *function, int lineno)
+/*!
+ * \internal
+ * \brief Take a connection from a class's pool, waiting for one if needed
+ *
+ * \param class The ODBC class
+ * \return A connection holding a reference to the class, or NULL on failure
+ */
+static struct odbc_obj *odbc_class_get_obj(struct odbc_class *class)
 {
 	struct odbc_obj *obj = NULL;
-	struct odbc_class *class;
-
-	if (!(class = ao2_callback(class_container, 0, aoro2_class_cb, (char *) name))) {
-		ast_debug(1, "Class '%s' not found!\n", name);
-		return NULL;
-	}
+	const char *name = class->name;
 
 	ast_mutex_lock(&class->lock);
 
@@ -867,11 +1032,129 @@ struct odbc_obj *_ast_odbc_request_obj2(const char *name, struct ast_flags flags
 	}
 
 	ast_mutex_unlock(&class->lock);
+
+	return obj;
+}
+
+struct odbc_obj *_ast_odbc_request_obj2(const char *name, struct ast_flags flags, const char *file, const char *function, int lineno)
+{
+	struct odbc_obj *obj;
+	struct odbc_class *class;
+
+	if (!(class = ao2_callback(class_container, 0, aoro2_class_cb, (char *) name))) {
+		ast_debug(1, "Class '%s' not found!\n", name);
+		return NULL;
+	}
+
+	obj = odbc_class_get_obj(class);
 	ao2_ref(class, -1);
 
 	return obj;
 }
 
+/*!
+ * \internal
+ * \brief Run the asynchronous statements queued on a class
+ *
+ * A single connection is used for as long as statements keep being queued,
+ * so they run back to back without going through the pool in between.
+ *
+ * \param data The ODBC class, whose reference is given to this task
+ */
+static int odbc_async_worker(void *data)
+{
+	struct odbc_class *class = data;
+	struct odbc_async_job *job;
+	struct odbc_obj *obj;
+	SQLHSTMT stmt;
+
+	obj = odbc_class_get_obj(class);
+	if (!obj) {
+		ast_log(LOG_WARNING, "Unable to retrieve database handle for '%s'.  Queued statements failed.\n",
+			class->name);
+	}
+
+	for (;;) {
+		ast_mutex_lock(&class->lock);
+		job = AST_LIST_REMOVE_HEAD(&class->async_queue, list);
+		if (!job) {
+			class->async_active--;
+		}
+		ast_mutex_unlock(&class->lock);
+
+		if (!job) {
+			break;
+		}
+
+		stmt = obj ? ast_odbc_prepare_and_execute(obj, job->prepare_cb, job->data) : NULL;
+		if (job->result_cb) {
+			job->result_cb(obj, stmt, job->data);
+		}
+		if (stmt) {
+			ast_odbc_release_stmt(obj, stmt);
+		}
+		ast_free(job);
+	}
+
+	if (obj) {
+		ast_odbc_release_obj(obj);
+	}
+	ao2_ref(class, -1);
+
+	return 0;
+}
+
+int ast_odbc_async_execute(const char *name, SQLHSTMT (*prepare_cb)(struct odbc_obj *obj, void *data),
+	ast_odbc_async_cb result_cb, void *data)
+{
+	struct odbc_class *class;
+	struct odbc_async_job *job;
+	int start_worker = 0;
+	int res = 0;
+
+	if (!(class = ao2_callback(class_container, 0, aoro2_class_cb, (char *) name))) {
+		ast_debug(1, "Class '%s' not found!\n", name);
+		return -1;
+	}
+
+	job = ast_calloc(1, sizeof(*job));
+	if (!job) {
+		ao2_ref(class, -1);
+		return -1;
+	}
+	job->prepare_cb = prepare_cb;
+	job->result_cb = result_cb;
+	job->data = data;
+
+	ast_mutex_lock(&class->lock);
+	AST_LIST_INSERT_TAIL(&class->async_queue, job, list);
+	if (class->async_active < class->async_workers) {
+		class->async_active++;
+		start_worker = 1;
+	}
+	ast_mutex_unlock(&class->lock);
+
+	/* The worker is given our class reference */
+	if (start_worker && ast_threadpool_push(async_pool, odbc_async_worker, class)) {
+		ast_mutex_lock(&class->lock);
+		class->async_active--;
+		if (!class->async_active) {
+			/* Nothing else will run it, so take our statement back */
+			AST_LIST_REMOVE(&class->async_queue, job, list);
+			ast_free(job);
+			res = -1;
+		}
+		ast_mutex_unlock(&class->lock);
+		start_worker = 0;
+	}
+
+	if (!start_worker) {
+		ao2_ref(class, -1);
+	}
+
+	return res;
+}
+
 struct odbc_obj *_ast_odbc_request_obj(const char *name, int check, const char *file, const char *function, int lineno)
 {
 	struct ast_flags flags = { check ? RES_ODBC_SANITY_CHECK : 0 };
@@ -896,6 +1179,9 @@ static odbc_status odbc_obj_disconnect(struct odbc_obj *obj)
 		return ODBC_SUCCESS;
 	}
 
+	/* Statement handles do not outlive their connection */
+	odbc_stmt_cache_flush(obj);
+
 	con = obj->con;
 	obj->con = NULL;
 	res = SQLDisconnect(con);
@@ -1080,6 +1366,17 @@ static int unload_module(void)
  */
 static int load_module(void)
 {
+	struct ast_threadpool_options options = {
+		.version = AST_THREADPOOL_OPTIONS_VERSION,
+		.idle_timeout = 60,
+		.auto_increment = 1,
+		.initial_size = 0,
+		.max_size = 0,
+	};
+
+	if (!(async_pool = ast_threadpool_create("odbc", NULL, &options))) {
+		return AST_MODULE_LOAD_DECLINE;
+	}
 	if (!(class_container = ao2_container_alloc(1, null_hash_fn, ao2_match_by_addr)))
 		return AST_MODULE_LOAD_DECLINE;
 	if (load_odbc_config() == -1)
@@ -634,6 +634,7 @@ static void parking_lot_destructor(void *obj)
 	}
 	ao2_cleanup(lot->parked_users);
 	ao2_cleanup(lot->cfg);
+	ast_free(lot->spaces_used);
 	ast_string_field_free_memory(lot);
 }
 
@@ -18,6 +18,10 @@
 
 #include "asterisk.h"
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 #include <pjsip.h>
 /* Needed for SUBSCRIBE, NOTIFY, and PUBLISH method definitions */
 #include <pjsip_simple.h>
@@ -44,6 +48,7 @@
 #include "asterisk/test.h"
 #include "asterisk/res_pjsip_presence_xml.h"
 #include "asterisk/res_pjproject.h"
+#include "asterisk/affinity.h"
 
 /*** MODULEINFO
 	<depend>pjproject</depend>
@@ -51,6 +56,7 @@
 	<depend>res_sorcery_config</depend>
 	<depend>res_sorcery_memory</depend>
 	<depend>res_sorcery_astdb</depend>
+	<use type="module">res_prometheus</use>
 	<support_level>core</support_level>
  ***/
 
@@ -1231,6 +1237,18 @@
 						</para>
 					</description>
 				</configOption>
+				<configOption name="udp_sockets" default="1">
+					<synopsis>Number of sockets to receive on (UDP ONLY)</synopsis>
+					<description><para>
+						When set higher than 1, that many sockets are bound to the
+						transport's address with SO_REUSEPORT and the kernel spreads
+						the messages from different sources between them.  Messages
+						from one source keep arriving on the same socket, and the
+						messages of a dialog are still handled by the same
+						serializer.  Use along with the system
+						<literal>monitor_threads</literal> option.  The maximum is 64.
+					</para></description>
+				</configOption>
 			</configObject>
 			<configObject name="contact">
 				<synopsis>A way of creating an aliased name to a SIP URI</synopsis>
@@ -1497,6 +1515,33 @@
 					<synopsis>Maximum number of threads in the res_pjsip threadpool.
 					A value of 0 indicates no maximum.</synopsis>
 				</configOption>
+				<configOption name="threadpool_work_stealing" default="no">
+					<synopsis>Run serializers on per thread queues of the res_pjsip threadpool.</synopsis>
+					<description><para>
+						Each serializer, such as the one of a dialog, is given a home
+						thread queue and is run by the threads of that queue.  Threads
+						with nothing to do take serializers from other queues.  This
+						reduces contention on the threadpool lock for busy systems.
+						Changes take effect when res_pjsip is next loaded.
+					</para></description>
+				</configOption>
+				<configOption name="monitor_threads" default="1">
+					<synopsis>Number of threads receiving SIP messages.</synopsis>
+					<description><para>
+						Each thread waits for and reads messages on all transports and
+						hands them to the res_pjsip threadpool.  More than one thread is
+						useful along with the transport <literal>udp_sockets</literal>
+						option so several messages can be received and parsed at once.
+						Changes take effect when res_pjsip is next loaded.
+					</para></description>
+				</configOption>
+				<configOption name="monitor_thread_affinity" default="no">
+					<synopsis>Pin each thread receiving SIP messages to its own CPU.</synopsis>
+					<description><para>
+						The threads are given CPUs in turn.  This is only supported
+						on Linux.  Changes take effect when res_pjsip is next loaded.
+					</para></description>
+				</configOption>
 				<configOption name="disable_tcp_switch" default="yes">
 					<synopsis>Disable automatic switching from UDP to TCP transports.</synopsis>
 					<description><para>
@@ -1551,6 +1596,24 @@
 					<synopsis>The interval at which unidentified requests are older than
 					twice the unidentified_request_period are pruned.</synopsis>
 				</configOption>
+				<configOption name="request_rate_limit" default="0">
+					<synopsis>The number of out-of-dialog requests per second to accept from a single IP.</synopsis>
+					<description><para>
+					Out-of-dialog requests received from an IP address faster than this rate are
+					dropped as soon as they are received, before the endpoint sending them is
+					identified or they are authenticated. The peer is left to retransmit them.
+					Short bursts of up to one second's worth of requests are allowed.
+					</para>
+					<para>
+					While enabled, requests from an IP address that has sent
+					<literal>unidentified_request_count</literal> unidentified requests within
+					<literal>unidentified_request_period</literal> are also dropped that way, until
+					its unidentified requests are pruned.
+					</para>
+					<para>
+					A value of 0 disables the limit.
+					</para></description>
+				</configOption>
 				<configOption name="type">
 					<synopsis>Must be of type 'global'.</synopsis>
 				</configOption>
@@ -4085,7 +4148,8 @@ static int serializer_pool_setup(void)
 	return 0;
 }
 
-int ast_sip_push_task(struct ast_taskprocessor *serializer, int (*sip_task)(void *), void *task_data)
+int __ast_sip_push_task(struct ast_taskprocessor *serializer, int (*sip_task)(void *), void *task_data,
+	const char *callsite)
 {
 	if (!serializer) {
 		unsigned int pos;
@@ -4102,7 +4166,7 @@ int ast_sip_push_task(struct ast_taskprocessor *serializer, int (*sip_task)(void
 		serializer = serializer_pool[pos];
 	}
 
-	return ast_taskprocessor_push(serializer, sip_task, task_data);
+	return __ast_taskprocessor_push(serializer, sip_task, task_data, callsite);
 }
 
 struct sync_task_data {
@@ -4135,7 +4199,8 @@ static int sync_task(void *data)
 	return ret;
 }
 
-int ast_sip_push_task_synchronous(struct ast_taskprocessor *serializer, int (*sip_task)(void *), void *task_data)
+int __ast_sip_push_task_synchronous(struct ast_taskprocessor *serializer, int (*sip_task)(void *), void *task_data,
+	const char *callsite)
 {
 	/* This method is an onion */
 	struct sync_task_data std;
@@ -4150,7 +4215,7 @@ int ast_sip_push_task_synchronous(struct ast_taskprocessor *serializer, int (*si
 	std.task = sip_task;
 	std.task_data = task_data;
 
-	if (ast_sip_push_task(serializer, sync_task, &std)) {
+	if (__ast_sip_push_task(serializer, sync_task, &std, callsite)) {
 		ast_mutex_destroy(&std.lock);
 		ast_cond_destroy(&std.cond);
 		return -1;
@@ -4189,11 +4254,48 @@ int ast_sip_is_content_type(pjsip_media_type *content_type, char *type, char *su
 
 pj_caching_pool caching_pool;
 pj_pool_t *memory_pool;
-pj_thread_t *monitor_thread;
+/*! Maximum number of threads receiving SIP messages */
+#define MAX_MONITOR_THREADS 64
+
+static pj_thread_t *monitor_threads[MAX_MONITOR_THREADS];
+static unsigned int monitor_thread_count;
 static int monitor_continue;
 
-static void *monitor_thread_exec(void *endpt)
+/*! \brief Pin the calling monitor thread to a CPU chosen by its index */
+static void monitor_thread_set_affinity(unsigned int index)
+{
+#ifdef __linux__
+	cpu_set_t cpus;
+	long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpu_count < 1) {
+		return;
+	}
+
+	CPU_ZERO(&cpus);
+	CPU_SET(index % cpu_count, &cpus);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+		ast_log(LOG_WARNING, "Could not pin SIP monitor thread %u to CPU %ld\n",
+			index, index % cpu_count);
+	}
+#else
+	if (!index) {
+		ast_log(LOG_WARNING, "SIP monitor thread affinity is not supported on this platform\n");
+	}
+#endif
+}
+
+static void *monitor_thread_exec(void *data)
 {
+	unsigned int index = (uintptr_t) data;
+	unsigned int count;
+	int affinity;
+
+	sip_get_monitor_thread_options(&count, &affinity);
+	if (affinity) {
+		monitor_thread_set_affinity(index);
+	}
+
 	while (monitor_continue) {
 		const pj_time_val delay = {0, 10};
 		pjsip_endpt_handle_events(ast_pjsip_endpoint, &delay);
@@ -4203,8 +4305,13 @@ static void *monitor_thread_exec(void *endpt)
 
 static void stop_monitor_thread(void)
 {
+	unsigned int i;
+
 	monitor_continue = 0;
-	pj_thread_join(monitor_thread);
+	for (i = 0; i < monitor_thread_count; ++i) {
+		pj_thread_join(monitor_threads[i]);
+	}
+	monitor_thread_count = 0;
 }
 
 AST_THREADSTORAGE(pj_thread_storage);
@@ -4217,6 +4324,8 @@ static void sip_thread_start(void)
 	pj_thread_t *thread;
 	uint32_t *servant_id;
 
+	ast_thread_class_set(AST_THREAD_CLASS_SIP);
+
 	servant_id = ast_threadstorage_get(&servant_id_storage, sizeof(*servant_id));
 	if (!servant_id) {
 		ast_log(LOG_ERROR, "Could not set SIP servant ID in thread-local storage.\n");
@@ -4240,9 +4349,12 @@ int ast_sip_thread_is_servant(void)
 {
 	uint32_t *servant_id;
 
-	if (monitor_thread &&
-			pthread_self() == *(pthread_t *)pj_thread_get_os_handle(monitor_thread)) {
-		return 1;
+	unsigned int i;
+
+	for (i = 0; i < monitor_thread_count; ++i) {
+		if (pthread_self() == *(pthread_t *)pj_thread_get_os_handle(monitor_threads[i])) {
+			return 1;
+		}
 	}
 
 	servant_id = ast_threadstorage_get(&servant_id_storage, sizeof(*servant_id));
@@ -4518,12 +4630,12 @@ static int unload_pjsip(void *data)
 		ast_res_pjsip_destroy_configuration();
 		ast_sip_destroy_system();
 		ast_sip_destroy_global_headers();
+		ast_sip_destroy_metrics();
 		internal_sip_unregister_service(&supplement_module);
 	}
 
-	if (monitor_thread) {
+	if (monitor_thread_count) {
 		stop_monitor_thread();
-		monitor_thread = NULL;
 	}
 
 	if (memory_pool) {
@@ -4551,6 +4663,8 @@ static int load_pjsip(void)
 {
 	const unsigned int flags = 0; /* no port, no brackets */
 	pj_status_t status;
+	unsigned int threads;
+	int affinity;
 
 	/* The third parameter is just copied from
 	 * example code from PJLIB. This can be adjusted
@@ -4586,12 +4700,17 @@ static int load_pjsip(void)
 	pjsip_tsx_layer_init_module(ast_pjsip_endpoint);
 	pjsip_ua_init_module(ast_pjsip_endpoint, NULL);
 
+	sip_get_monitor_thread_options(&threads, &affinity);
 	monitor_continue = 1;
-	status = pj_thread_create(memory_pool, "SIP", (pj_thread_proc *) &monitor_thread_exec,
-			NULL, PJ_THREAD_DEFAULT_STACK_SIZE * 2, 0, &monitor_thread);
-	if (status != PJ_SUCCESS) {
-		ast_log(LOG_ERROR, "Failed to start SIP monitor thread. Aborting load\n");
-		goto error;
+	while (monitor_thread_count < MIN(threads, MAX_MONITOR_THREADS)) {
+		status = pj_thread_create(memory_pool, "SIP", (pj_thread_proc *) &monitor_thread_exec,
+				(void *) (uintptr_t) monitor_thread_count, PJ_THREAD_DEFAULT_STACK_SIZE * 2, 0,
+				&monitor_threads[monitor_thread_count]);
+		if (status != PJ_SUCCESS) {
+			ast_log(LOG_ERROR, "Failed to start SIP monitor thread. Aborting load\n");
+			goto error;
+		}
+		++monitor_thread_count;
 	}
 
 	return AST_MODULE_LOAD_SUCCESS;
@@ -4667,6 +4786,8 @@ static int load_module(void)
 
 	ast_sip_initialize_global_headers();
 
+	ast_sip_initialize_metrics();
+
 	if (ast_res_pjsip_initialize_configuration(ast_module_info)) {
 		ast_log(LOG_ERROR, "Failed to initialize SIP configuration. Aborting load\n");
 		goto error;
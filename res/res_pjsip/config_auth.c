@@ -24,6 +24,7 @@
 #include "asterisk/logger.h"
 #include "asterisk/sorcery.h"
 #include "asterisk/cli.h"
+#include "asterisk/utils.h"
 #include "include/res_pjsip_private.h"
 #include "asterisk/res_pjsip_cli.h"
 
@@ -107,6 +108,21 @@ static int auth_apply(const struct ast_sorcery *sorcery, void *obj)
 		}
 		break;
 	case AST_SIP_AUTH_TYPE_USER_PASS:
+		/*
+		 * Hash the credentials once instead of on every request.  Without
+		 * a realm the default realm applies, which may change at runtime.
+		 */
+		auth->ha1[0] = '\0';
+		if (!ast_strlen_zero(auth->realm)) {
+			struct ast_str *creds = ast_str_alloca(256);
+
+			ast_str_set(&creds, 0, "%s:%s:%s", auth->auth_user, auth->realm,
+				auth->auth_pass);
+			if (ast_str_strlen(creds) < ast_str_size(creds) - 1) {
+				ast_md5_hash(auth->ha1, ast_str_buffer(creds));
+			}
+		}
+		break;
 	case AST_SIP_AUTH_TYPE_ARTIFICIAL:
 		break;
 	}
@@ -44,6 +44,7 @@
 #define DEFAULT_UNIDENTIFIED_REQUEST_COUNT 5
 #define DEFAULT_UNIDENTIFIED_REQUEST_PERIOD 5
 #define DEFAULT_UNIDENTIFIED_REQUEST_PRUNE_INTERVAL 30
+#define DEFAULT_REQUEST_RATE_LIMIT 0
 #define DEFAULT_MWI_TPS_QUEUE_HIGH AST_TASKPROCESSOR_HIGH_WATER_LEVEL
 #define DEFAULT_MWI_TPS_QUEUE_LOW -1
 #define DEFAULT_MWI_DISABLE_INITIAL_UNSOLICITED 0
@@ -93,6 +94,8 @@ struct global_config {
 	unsigned int unidentified_request_period;
 	/*! Interval at which expired unidentifed requests will be pruned */
 	unsigned int unidentified_request_prune_interval;
+	/*! The number of out-of-dialog requests per second accepted from a source IP address */
+	unsigned int request_rate_limit;
 	struct {
 		/*! Taskprocessor high water alert trigger level */
 		unsigned int tps_queue_high;
@@ -315,6 +318,21 @@ void ast_sip_get_unidentified_request_thresholds(unsigned int *count, unsigned i
 	return;
 }
 
+unsigned int ast_sip_get_request_rate_limit(void)
+{
+	unsigned int limit;
+	struct global_config *cfg;
+
+	cfg = get_global_cfg();
+	if (!cfg) {
+		return DEFAULT_REQUEST_RATE_LIMIT;
+	}
+
+	limit = cfg->request_rate_limit;
+	ao2_ref(cfg, -1);
+	return limit;
+}
+
 void ast_sip_get_default_realm(char *realm, size_t size)
 {
 	struct global_config *cfg;
@@ -539,6 +557,9 @@ int ast_sip_initialize_sorcery_global(void)
 	ast_sorcery_object_field_register(sorcery, "global", "unidentified_request_prune_interval",
 		__stringify(DEFAULT_UNIDENTIFIED_REQUEST_PRUNE_INTERVAL),
 		OPT_UINT_T, 0, FLDSET(struct global_config, unidentified_request_prune_interval));
+	ast_sorcery_object_field_register(sorcery, "global", "request_rate_limit",
+		__stringify(DEFAULT_REQUEST_RATE_LIMIT),
+		OPT_UINT_T, 0, FLDSET(struct global_config, request_rate_limit));
 	ast_sorcery_object_field_register(sorcery, "global", "default_realm", DEFAULT_REALM,
 		OPT_STRINGFIELD_T, 0, STRFLDSET(struct global_config, default_realm));
 	ast_sorcery_object_field_register(sorcery, "global", "mwi_tps_queue_high",
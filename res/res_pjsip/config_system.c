@@ -49,20 +49,35 @@ struct system_config {
 		int idle_timeout;
 		/*! Maxumum number of threads in the threadpool */
 		int max_size;
+		/*! Nonzero to schedule serializers on per thread run queues */
+		unsigned int work_stealing;
 	} threadpool;
 	/*! Nonzero to disable switching from UDP to TCP transport */
 	unsigned int disable_tcp_switch;
+	/*! Number of threads receiving SIP messages */
+	unsigned int monitor_threads;
+	/*! Nonzero to pin each monitor thread to a CPU */
+	unsigned int monitor_thread_affinity;
 };
 
 static struct ast_threadpool_options sip_threadpool_options = {
 	.version = AST_THREADPOOL_OPTIONS_VERSION,
 };
 
+static unsigned int sip_monitor_threads = 1;
+static int sip_monitor_thread_affinity;
+
 void sip_get_threadpool_options(struct ast_threadpool_options *threadpool_options)
 {
 	*threadpool_options = sip_threadpool_options;
 }
 
+void sip_get_monitor_thread_options(unsigned int *count, int *affinity)
+{
+	*count = sip_monitor_threads;
+	*affinity = sip_monitor_thread_affinity;
+}
+
 static struct ast_sorcery *system_sorcery;
 
 static void *system_alloc(const char *name)
@@ -106,10 +121,14 @@ static int system_apply(const struct ast_sorcery *system_sorcery, void *obj)
 	sip_threadpool_options.auto_increment = system->threadpool.auto_increment;
 	sip_threadpool_options.idle_timeout = system->threadpool.idle_timeout;
 	sip_threadpool_options.max_size = system->threadpool.max_size;
+	sip_threadpool_options.work_stealing = system->threadpool.work_stealing;
 
 	pjsip_cfg()->endpt.disable_tcp_switch =
 		system->disable_tcp_switch ? PJ_TRUE : PJ_FALSE;
 
+	sip_monitor_threads = system->monitor_threads;
+	sip_monitor_thread_affinity = system->monitor_thread_affinity;
+
 	return 0;
 }
 
@@ -182,8 +201,14 @@ int ast_sip_initialize_system(void)
 			OPT_UINT_T, 0, FLDSET(struct system_config, threadpool.idle_timeout));
 	ast_sorcery_object_field_register(system_sorcery, "system", "threadpool_max_size", "50",
 			OPT_UINT_T, 0, FLDSET(struct system_config, threadpool.max_size));
+	ast_sorcery_object_field_register(system_sorcery, "system", "threadpool_work_stealing", "no",
+			OPT_BOOL_T, 1, FLDSET(struct system_config, threadpool.work_stealing));
 	ast_sorcery_object_field_register(system_sorcery, "system", "disable_tcp_switch", "yes",
 			OPT_BOOL_T, 1, FLDSET(struct system_config, disable_tcp_switch));
+	ast_sorcery_object_field_register(system_sorcery, "system", "monitor_threads", "1",
+			OPT_UINT_T, PARSE_IN_RANGE, FLDSET(struct system_config, monitor_threads), 1, 64);
+	ast_sorcery_object_field_register(system_sorcery, "system", "monitor_thread_affinity", "no",
+			OPT_BOOL_T, 1, FLDSET(struct system_config, monitor_thread_affinity));
 
 	ast_sorcery_load(system_sorcery);
 
@@ -254,6 +254,14 @@ static int destroy_sip_transport_state(void *data)
 	if (transport_state->transport) {
 		pjsip_transport_shutdown(transport_state->transport);
 	}
+	if (transport_state->udp_transports) {
+		unsigned int i;
+
+		for (i = 0; i < transport_state->udp_transport_count; ++i) {
+			pjsip_transport_shutdown(transport_state->udp_transports[i]);
+		}
+		ast_free(transport_state->udp_transports);
+	}
 
 	return 0;
 }
@@ -450,6 +458,141 @@ static void states_cleanup(void *states)
 	}
 }
 
+/*!
+ * \internal
+ * \brief Start a UDP transport on a socket that can share its bind address
+ *
+ * The socket is bound with SO_REUSEPORT so several of them, each with its
+ * own transport, can be bound to the transport's address.  The kernel then
+ * spreads the packets from different sources between them while packets
+ * from one source keep arriving on the same socket.
+ *
+ * \param state The transport state holding the bind address
+ * \param async_operations Number of simultaneous asynchronous operations
+ * \param[out] tp The started transport
+ *
+ * \retval PJ_SUCCESS on success
+ */
+static pj_status_t udp_transport_start_shared(const struct ast_sip_transport_state *state,
+	unsigned int async_operations, pjsip_transport **tp)
+{
+	pjsip_transport_type_e type;
+	pj_sock_t sock;
+	pj_sockaddr bound;
+	int bound_len = sizeof(bound);
+	pjsip_host_port a_name;
+	char host[PJ_INET6_ADDRSTRLEN];
+	pj_uint16_t port;
+	pj_status_t res;
+
+	type = state->host.addr.sa_family == pj_AF_INET6() ? PJSIP_TRANSPORT_UDP6 : PJSIP_TRANSPORT_UDP;
+
+	res = pj_sock_socket(state->host.addr.sa_family, pj_SOCK_DGRAM(), 0, &sock);
+	if (res != PJ_SUCCESS) {
+		return res;
+	}
+
+#ifdef SO_REUSEPORT
+	{
+		int one = 1;
+
+		res = pj_sock_setsockopt(sock, pj_SOL_SOCKET(), SO_REUSEPORT, &one, sizeof(one));
+	}
+#else
+	res = PJ_ENOTSUP;
+#endif
+	if (res == PJ_SUCCESS) {
+		res = pj_sock_bind(sock, &state->host, pj_sockaddr_get_len(&state->host));
+	}
+	if (res == PJ_SUCCESS) {
+		res = pj_sock_getsockname(sock, &bound, &bound_len);
+	}
+	if (res == PJ_SUCCESS && !pj_sockaddr_has_addr(&bound)) {
+		/* Advertise the same address pjsip_udp_transport_start() would */
+		port = pj_sockaddr_get_port(&bound);
+		res = pj_gethostip(state->host.addr.sa_family, &bound);
+		pj_sockaddr_set_port(&bound, port);
+	}
+	if (res != PJ_SUCCESS) {
+		pj_sock_close(sock);
+		return res;
+	}
+
+	pj_sockaddr_print(&bound, host, sizeof(host), 0);
+	a_name.host = pj_str(host);
+	a_name.port = pj_sockaddr_get_port(&bound);
+
+	/* The transport owns the socket from here on, even on failure */
+	return pjsip_udp_transport_attach2(ast_sip_get_pjsip_endpoint(), type, sock, &a_name,
+		async_operations, tp);
+}
+
+/*!
+ * \internal
+ * \brief Start the UDP sockets after the first for a transport
+ *
+ * \retval PJ_SUCCESS on success
+ */
+static pj_status_t udp_transports_start_shared(const struct ast_sip_transport *transport,
+	struct ast_sip_transport_state *state)
+{
+	pj_status_t res = PJ_SUCCESS;
+
+	state->udp_transports = ast_calloc(transport->udp_sockets - 1, sizeof(*state->udp_transports));
+	if (!state->udp_transports) {
+		return PJ_ENOMEM;
+	}
+
+	while (state->udp_transport_count < transport->udp_sockets - 1) {
+		res = udp_transport_start_shared(state, transport->async_operations,
+			&state->udp_transports[state->udp_transport_count]);
+		if (res != PJ_SUCCESS) {
+			break;
+		}
+		++state->udp_transport_count;
+	}
+
+	return res;
+}
+
+/*!
+ * \internal
+ * \brief Stop the sockets of a UDP transport so its address can be bound again
+ */
+static void udp_transports_pause(struct ast_sip_transport_state *state)
+{
+	unsigned int i;
+
+	if (state->transport) {
+		pjsip_udp_transport_pause(state->transport, PJSIP_UDP_TRANSPORT_DESTROY_SOCKET);
+	}
+	for (i = 0; i < state->udp_transport_count; ++i) {
+		pjsip_udp_transport_pause(state->udp_transports[i], PJSIP_UDP_TRANSPORT_DESTROY_SOCKET);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Set the name and QoS of a started UDP transport
+ */
+static void udp_transport_setup(const struct ast_sip_transport *transport, pjsip_transport *tp)
+{
+	const char *transport_id = ast_sorcery_object_get_id(transport);
+
+	tp->info = pj_pool_alloc(tp->pool, (AST_SIP_X_AST_TXP_LEN + strlen(transport_id) + 2));
+
+	sprintf(tp->info, "%s:%s", AST_SIP_X_AST_TXP, transport_id);
+
+	if (transport->tos || transport->cos) {
+		pj_sock_t sock;
+		pj_qos_params qos_params;
+		sock = pjsip_udp_transport_get_socket(tp);
+		pj_sock_get_qos_params(sock, &qos_params);
+		set_qos(transport, &qos_params);
+		pj_sock_set_qos_params(sock, &qos_params);
+	}
+}
+
 /*! \brief Apply handler for transports */
 static int transport_apply(const struct ast_sorcery *sorcery, void *obj)
 {
@@ -533,16 +676,23 @@ static int transport_apply(const struct ast_sorcery *sorcery, void *obj)
 		}
 	}
 
+	if (transport->type != AST_TRANSPORT_UDP && transport->udp_sockets > 1) {
+		ast_log(LOG_WARNING, "Transport '%s': udp_sockets ignored for a transport that is not UDP\n",
+			transport_id);
+	}
+
 	if (transport->type == AST_TRANSPORT_UDP) {
 
 		for (i = 0; i < BIND_TRIES && res != PJ_SUCCESS; i++) {
-			if (perm_state && perm_state->state && perm_state->state->transport) {
-				pjsip_udp_transport_pause(perm_state->state->transport,
-					PJSIP_UDP_TRANSPORT_DESTROY_SOCKET);
+			if (perm_state && perm_state->state) {
+				udp_transports_pause(perm_state->state);
 				usleep(BIND_DELAY_US);
 			}
 
-			if (temp_state->state->host.addr.sa_family == pj_AF_INET()) {
+			if (transport->udp_sockets > 1) {
+				res = udp_transport_start_shared(temp_state->state, transport->async_operations,
+					&temp_state->state->transport);
+			} else if (temp_state->state->host.addr.sa_family == pj_AF_INET()) {
 				res = pjsip_udp_transport_start(ast_sip_get_pjsip_endpoint(),
 					&temp_state->state->host.ipv4, NULL, transport->async_operations,
 					&temp_state->state->transport);
@@ -553,19 +703,14 @@ static int transport_apply(const struct ast_sorcery *sorcery, void *obj)
 			}
 		}
 
+		if (res == PJ_SUCCESS && transport->udp_sockets > 1) {
+			res = udp_transports_start_shared(transport, temp_state->state);
+		}
+
 		if (res == PJ_SUCCESS) {
-			temp_state->state->transport->info = pj_pool_alloc(temp_state->state->transport->pool,
-				(AST_SIP_X_AST_TXP_LEN + strlen(transport_id) + 2));
-
-			sprintf(temp_state->state->transport->info, "%s:%s", AST_SIP_X_AST_TXP, transport_id);
-
-			if (transport->tos || transport->cos) {
-				pj_sock_t sock;
-				pj_qos_params qos_params;
-				sock = pjsip_udp_transport_get_socket(temp_state->state->transport);
-				pj_sock_get_qos_params(sock, &qos_params);
-				set_qos(transport, &qos_params);
-				pj_sock_set_qos_params(sock, &qos_params);
+			udp_transport_setup(transport, temp_state->state->transport);
+			for (i = 0; i < temp_state->state->udp_transport_count; i++) {
+				udp_transport_setup(transport, temp_state->state->udp_transports[i]);
 			}
 		}
 	} else if (transport->type == AST_TRANSPORT_TCP) {
@@ -1384,6 +1529,7 @@ int ast_sip_initialize_sorcery_transport(void)
 	ast_sorcery_object_field_register(sorcery, "transport", "websocket_write_timeout", AST_DEFAULT_WEBSOCKET_WRITE_TIMEOUT_STR, OPT_INT_T, PARSE_IN_RANGE, FLDSET(struct ast_sip_transport, write_timeout), 1, INT_MAX);
 	ast_sorcery_object_field_register(sorcery, "transport", "allow_reload", "no", OPT_BOOL_T, 1, FLDSET(struct ast_sip_transport, allow_reload));
 	ast_sorcery_object_field_register(sorcery, "transport", "symmetric_transport", "no", OPT_BOOL_T, 1, FLDSET(struct ast_sip_transport, symmetric_transport));
+	ast_sorcery_object_field_register(sorcery, "transport", "udp_sockets", "1", OPT_UINT_T, PARSE_IN_RANGE, FLDSET(struct ast_sip_transport, udp_sockets), 1, 64);
 
 	internal_sip_register_endpoint_formatter(&endpoint_transport_formatter);
 
@@ -168,6 +168,22 @@ void ast_sip_initialize_global_headers(void);
  */
 void ast_sip_destroy_global_headers(void);
 
+/*!
+ * \internal
+ * \brief Initialize counting SIP messages for res_prometheus
+ *
+ * \return Nothing
+ */
+void ast_sip_initialize_metrics(void);
+
+/*!
+ * \internal
+ * \brief Destroy counting SIP messages for res_prometheus
+ *
+ * \return Nothing
+ */
+void ast_sip_destroy_metrics(void);
+
 /*!
  * \internal
  * \brief Initialize OPTIONS request handling.
@@ -266,6 +282,15 @@ void ast_res_pjsip_cleanup_message_ip_updater(void);
  */
 void sip_get_threadpool_options(struct ast_threadpool_options *threadpool_options);
 
+/*!
+ * \internal
+ * \brief Retrieve the options for the threads receiving SIP messages
+ *
+ * \param[out] count Number of threads to start
+ * \param[out] affinity Nonzero if each thread should be pinned to a CPU
+ */
+void sip_get_monitor_thread_options(unsigned int *count, int *affinity);
+
 /*!
  * \internal
  * \brief Retrieve the name of the default outbound endpoint.
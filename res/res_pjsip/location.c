@@ -1201,10 +1201,11 @@ int ast_sip_initialize_sorcery_location(void)
 	/* As of pjproject 2.4.5, PJSIP_MAX_URL_SIZE isn't exposed yet but we try anyway. */
 	ast_pjproject_get_buildopt("PJSIP_MAX_URL_SIZE", "%d", &pjsip_max_url_size);
 
-	ast_sorcery_apply_default(sorcery, "contact", "astdb", "registrar");
+	/* Contacts are written to astdb behind the registrations, rather than while they are handled */
+	ast_sorcery_apply_default(sorcery, "contact", "astdb", "registrar,write_behind=1000");
 	ast_sorcery_object_set_congestion_levels(sorcery, "contact", -1,
 		3 * AST_TASKPROCESSOR_HIGH_WATER_LEVEL);
-	ast_sorcery_apply_default(sorcery, "aor", "config", "pjsip.conf,criteria=type=aor");
+	ast_sorcery_apply_default(sorcery, "aor", "config", "pjsip.conf,criteria=type=aor,reload=changed");
 
 	if (ast_sorcery_object_register(sorcery, "contact", contact_alloc, NULL, contact_apply_handler) ||
 		ast_sorcery_object_register(sorcery, "aor", aor_alloc, NULL, NULL)) {
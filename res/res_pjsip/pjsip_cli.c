@@ -111,7 +111,7 @@ static char *complete_show_sorcery_object(struct ao2_container *container,
 
 static void dump_str_and_free(int fd, struct ast_str *buf)
 {
-	ast_cli(fd, "%s", ast_str_buffer(buf));
+	ast_cli_flush(fd, &buf);
 	ast_free(buf);
 }
 
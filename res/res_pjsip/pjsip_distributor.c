@@ -57,6 +57,25 @@ struct unidentified_request{
 	char src_name[];
 };
 
+#define DEFAULT_SOURCES_BUCKETS 257
+
+/*! Out-of-dialog requests accepted per second from a source, 0 if unlimited */
+static unsigned int request_rate_limit;
+
+/*! Token buckets of the sources of out-of-dialog requests */
+static struct ao2_container *request_sources;
+
+struct request_source {
+	/*! When tokens were last added to the bucket */
+	struct timeval refilled;
+	/*! Requests that may still be accepted, in thousandths of a request */
+	unsigned int tokens;
+	char src_name[];
+};
+
+AO2_STRING_FIELD_HASH_FN(request_source, src_name);
+AO2_STRING_FIELD_CMP_FN(request_source, src_name);
+
 /*! Number of serializers in pool if one not otherwise known.  (Best if prime number) */
 #define DISTRIBUTOR_POOL_SIZE		31
 
@@ -471,6 +490,75 @@ static pjsip_module endpoint_mod = {
 	.on_rx_request = endpoint_lookup,
 };
 
+/*!
+ * \internal
+ * \brief Determine if the source of an out-of-dialog request is over its limit
+ *
+ * This runs on the transport thread for every out-of-dialog request, so
+ * requests from a flooding source are dropped before any parsing beyond
+ * what pjsip already did, identification or authentication.
+ *
+ * \retval 0 if the request may be processed
+ * \retval 1 if the request should be dropped
+ */
+static int request_over_limit(pjsip_rx_data *rdata)
+{
+	struct unidentified_request *unid;
+	struct request_source *source;
+	unsigned int capacity = request_rate_limit * 1000;
+	struct timeval now;
+	int64_t tokens;
+	int over;
+
+	if (rdata->msg_info.msg->line.req.method.id == PJSIP_ACK_METHOD) {
+		return 0;
+	}
+
+	/* Sources already reported for unidentified requests get no further */
+	unid = ao2_find(unidentified_requests, rdata->pkt_info.src_name, OBJ_SEARCH_KEY);
+	if (unid) {
+		ao2_rdlock(unid);
+		over = unidentified_count && unid->count >= unidentified_count;
+		ao2_unlock(unid);
+		ao2_ref(unid, -1);
+		if (over) {
+			return 1;
+		}
+	}
+
+	source = ao2_find(request_sources, rdata->pkt_info.src_name, OBJ_SEARCH_KEY);
+	if (!source) {
+		ao2_wrlock(request_sources);
+		source = ao2_find(request_sources, rdata->pkt_info.src_name, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+		if (!source) {
+			source = ao2_alloc(sizeof(*source) + strlen(rdata->pkt_info.src_name) + 1, NULL);
+			if (!source) {
+				ao2_unlock(request_sources);
+				return 0;
+			}
+			strcpy(source->src_name, rdata->pkt_info.src_name); /* Safe */
+			source->refilled = ast_tvnow();
+			source->tokens = capacity;
+			ao2_link_flags(request_sources, source, OBJ_NOLOCK);
+		}
+		ao2_unlock(request_sources);
+	}
+
+	now = ast_tvnow();
+	ao2_lock(source);
+	tokens = source->tokens + ast_tvdiff_ms(now, source->refilled) * request_rate_limit;
+	source->tokens = MIN(tokens, capacity);
+	source->refilled = now;
+	over = source->tokens < 1000;
+	if (!over) {
+		source->tokens -= 1000;
+	}
+	ao2_unlock(source);
+	ao2_ref(source, -1);
+
+	return over;
+}
+
 static pj_bool_t distributor(pjsip_rx_data *rdata)
 {
 	pjsip_dialog *dlg;
@@ -540,6 +628,13 @@ static pj_bool_t distributor(pjsip_rx_data *rdata)
 			return PJ_TRUE;
 		}
 
+		if (request_rate_limit && request_over_limit(rdata)) {
+			ast_debug(3, "Request rate limit exceeded: Ignoring '%s' from %s.\n",
+				pjsip_rx_data_get_info(rdata), rdata->pkt_info.src_name);
+			ao2_cleanup(dist);
+			return PJ_TRUE;
+		}
+
 		/* Pick a serializer for the out-of-dialog request. */
 		serializer = ast_sip_get_distributor_serializer(rdata);
 	}
@@ -1084,6 +1179,19 @@ static int expire_requests(void *object, void *arg, int flags)
 	return 0;
 }
 
+static int expire_sources(void *object, void *arg, int flags)
+{
+	struct request_source *source = object;
+	int64_t ms;
+
+	ao2_lock(source);
+	ms = ast_tvdiff_ms(ast_tvnow(), source->refilled);
+	ao2_unlock(source);
+
+	/* After a second of silence the bucket is full, as a new one would be */
+	return ms > 1000 ? CMP_MATCH : 0;
+}
+
 static int prune_task(const void *data)
 {
 	unsigned int maxage;
@@ -1091,6 +1199,7 @@ static int prune_task(const void *data)
 	ast_sip_get_unidentified_request_thresholds(&unidentified_count, &unidentified_period, &unidentified_prune_interval);
 	maxage = unidentified_period * 2;
 	ao2_callback(unidentified_requests, OBJ_MULTIPLE | OBJ_NODATA | OBJ_UNLINK, expire_requests, &maxage);
+	ao2_callback(request_sources, OBJ_MULTIPLE | OBJ_NODATA | OBJ_UNLINK, expire_sources, NULL);
 
 	return unidentified_prune_interval * 1000;
 }
@@ -1138,6 +1247,11 @@ static void global_loaded(const char *object_type)
 
 	ast_sip_get_unidentified_request_thresholds(&unidentified_count, &unidentified_period, &unidentified_prune_interval);
 
+	request_rate_limit = ast_sip_get_request_rate_limit();
+	if (!request_rate_limit) {
+		ao2_callback(request_sources, OBJ_MULTIPLE | OBJ_NODATA | OBJ_UNLINK, NULL, NULL);
+	}
+
 	/* Clean out the old task, if any */
 	ast_sched_clean_by_callback(prune_context, prune_task, clean_task);
 	/* Have to do something with the return value to shut up the stupid compiler. */
@@ -1201,6 +1315,13 @@ int ast_sip_initialize_distributor(void)
 		return -1;
 	}
 
+	request_sources = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0,
+		DEFAULT_SOURCES_BUCKETS, request_source_hash_fn, NULL, request_source_cmp_fn);
+	if (!request_sources) {
+		ast_sip_destroy_distributor();
+		return -1;
+	}
+
 	dialog_associations = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, 0,
 		DIALOG_ASSOCIATIONS_BUCKETS, dialog_associations_hash, NULL,
 		dialog_associations_cmp);
@@ -1288,5 +1409,6 @@ void ast_sip_destroy_distributor(void)
 	distributor_pool_shutdown();
 
 	ao2_cleanup(dialog_associations);
+	ao2_cleanup(request_sources);
 	ao2_cleanup(unidentified_requests);
 }
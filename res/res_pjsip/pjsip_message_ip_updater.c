@@ -198,8 +198,12 @@ static pj_status_t multihomed_on_tx_message(pjsip_tx_data *tdata)
 	pjsip_cseq_hdr *cseq;
 	pjsip_via_hdr *via;
 	pjsip_fromto_hdr *from;
+	/* A message still printed from an earlier send, such as a retransmission */
+	int printed = pjsip_tx_data_is_valid(tdata);
 
-	sanitize_tdata(tdata);
+	if (!printed) {
+		sanitize_tdata(tdata);
+	}
 
 	/* Use the destination information to determine what local interface this message will go out on */
 	pjsip_tpmgr_fla2_param_default(&prm);
@@ -242,6 +246,14 @@ static pj_status_t multihomed_on_tx_message(pjsip_tx_data *tdata)
 		pj_strassign(&prm.ret_addr, &tdata->tp_info.transport->local_name.host);
 	}
 
+	/*
+	 * The transport has to be chosen for every send, but a printed message
+	 * was already rewritten for it and is sent as is.
+	 */
+	if (printed) {
+		return PJ_SUCCESS;
+	}
+
 	/* If the message needs to be updated with new address do so */
 	if (tdata->msg->type == PJSIP_REQUEST_MSG || !(cseq = pjsip_msg_find_hdr(tdata->msg, PJSIP_H_CSEQ, NULL)) ||
 		pj_strcmp2(&cseq->method.name, "REGISTER")) {
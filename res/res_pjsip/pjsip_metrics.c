@@ -0,0 +1,176 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#include "asterisk.h"
+
+#include <pjsip.h>
+#include <pjlib.h>
+
+#include "asterisk/res_pjsip.h"
+#include "asterisk/prometheus.h"
+#include "include/res_pjsip_private.h"
+
+/*!
+ * \brief Methods counted on their own, the last counts every other method
+ *
+ * \note The order matches the metrics in request_metrics() below.
+ */
+static const char *metric_methods[] = {
+	"INVITE", "ACK", "BYE", "CANCEL", "OPTIONS", "REGISTER", "SUBSCRIBE", "NOTIFY", NULL,
+};
+
+#define METHOD_METRICS ARRAY_LEN(metric_methods)
+
+/*! \brief Responses are counted by class, 1xx through 6xx */
+#define RESPONSE_METRICS 6
+
+#define REQUEST_METRIC(name, help, method) \
+	AST_PROMETHEUS_METRIC_INIT(AST_PROMETHEUS_COUNTER, name, help, "method=\"" method "\"")
+
+#define request_metrics(name, help) { \
+	REQUEST_METRIC(name, help, "INVITE"), \
+	REQUEST_METRIC(name, help, "ACK"), \
+	REQUEST_METRIC(name, help, "BYE"), \
+	REQUEST_METRIC(name, help, "CANCEL"), \
+	REQUEST_METRIC(name, help, "OPTIONS"), \
+	REQUEST_METRIC(name, help, "REGISTER"), \
+	REQUEST_METRIC(name, help, "SUBSCRIBE"), \
+	REQUEST_METRIC(name, help, "NOTIFY"), \
+	REQUEST_METRIC(name, help, "other"), \
+}
+
+#define RESPONSE_METRIC(name, help, class) \
+	AST_PROMETHEUS_METRIC_INIT(AST_PROMETHEUS_COUNTER, name, help, "class=\"" class "\"")
+
+#define response_metrics(name, help) { \
+	RESPONSE_METRIC(name, help, "1xx"), \
+	RESPONSE_METRIC(name, help, "2xx"), \
+	RESPONSE_METRIC(name, help, "3xx"), \
+	RESPONSE_METRIC(name, help, "4xx"), \
+	RESPONSE_METRIC(name, help, "5xx"), \
+	RESPONSE_METRIC(name, help, "6xx"), \
+}
+
+static struct ast_prometheus_metric requests_received[METHOD_METRICS] =
+	request_metrics("asterisk_pjsip_requests_received_total", "SIP requests received");
+static struct ast_prometheus_metric requests_sent[METHOD_METRICS] =
+	request_metrics("asterisk_pjsip_requests_sent_total", "SIP requests sent");
+static struct ast_prometheus_metric responses_received[RESPONSE_METRICS] =
+	response_metrics("asterisk_pjsip_responses_received_total", "SIP responses received");
+static struct ast_prometheus_metric responses_sent[RESPONSE_METRICS] =
+	response_metrics("asterisk_pjsip_responses_sent_total", "SIP responses sent");
+
+static void count_request(struct ast_prometheus_metric *metrics, const pjsip_method *method)
+{
+	int i;
+
+	for (i = 0; metric_methods[i]; ++i) {
+		if (!pj_stricmp2(&method->name, metric_methods[i])) {
+			break;
+		}
+	}
+	ast_prometheus_metric_add(&metrics[i], 1);
+}
+
+static void count_response(struct ast_prometheus_metric *metrics, int code)
+{
+	int class = code / 100;
+
+	if (class >= 1 && class <= RESPONSE_METRICS) {
+		ast_prometheus_metric_add(&metrics[class - 1], 1);
+	}
+}
+
+static pj_bool_t metrics_on_rx_request(pjsip_rx_data *rdata)
+{
+	count_request(requests_received, &rdata->msg_info.msg->line.req.method);
+
+	return PJ_FALSE;
+}
+
+static pj_bool_t metrics_on_rx_response(pjsip_rx_data *rdata)
+{
+	count_response(responses_received, rdata->msg_info.msg->line.status.code);
+
+	return PJ_FALSE;
+}
+
+static pj_status_t metrics_on_tx_request(pjsip_tx_data *tdata)
+{
+	count_request(requests_sent, &tdata->msg->line.req.method);
+
+	return PJ_SUCCESS;
+}
+
+static pj_status_t metrics_on_tx_response(pjsip_tx_data *tdata)
+{
+	count_response(responses_sent, tdata->msg->line.status.code);
+
+	return PJ_SUCCESS;
+}
+
+/*!
+ * \brief Module counting the messages going through the transport layer
+ *
+ * It sits just before the transaction layer so it sees every message,
+ * including retransmissions, whether or not a transaction takes it.
+ */
+static pjsip_module metrics_module = {
+	.name = {"Metrics", 7},
+	.priority = PJSIP_MOD_PRIORITY_TSX_LAYER - 1,
+	.on_rx_request = metrics_on_rx_request,
+	.on_rx_response = metrics_on_rx_response,
+	.on_tx_request = metrics_on_tx_request,
+	.on_tx_response = metrics_on_tx_response,
+};
+
+static void register_metrics(struct ast_prometheus_metric *metrics, int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		ast_prometheus_metric_register(&metrics[i]);
+	}
+}
+
+static void unregister_metrics(struct ast_prometheus_metric *metrics, int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		ast_prometheus_metric_unregister(&metrics[i]);
+	}
+}
+
+void ast_sip_initialize_metrics(void)
+{
+	internal_sip_register_service(&metrics_module);
+
+	register_metrics(requests_received, METHOD_METRICS);
+	register_metrics(requests_sent, METHOD_METRICS);
+	register_metrics(responses_received, RESPONSE_METRICS);
+	register_metrics(responses_sent, RESPONSE_METRICS);
+}
+
+void ast_sip_destroy_metrics(void)
+{
+	unregister_metrics(requests_received, METHOD_METRICS);
+	unregister_metrics(requests_sent, METHOD_METRICS);
+	unregister_metrics(responses_received, RESPONSE_METRICS);
+	unregister_metrics(responses_sent, RESPONSE_METRICS);
+
+	internal_sip_unregister_service(&metrics_module);
+}
@@ -32,11 +32,24 @@
 #include "asterisk/statsd.h"
 #include "include/res_pjsip_private.h"
 #include "asterisk/taskprocessor.h"
+#include "asterisk/dlinkedlists.h"
+#include "asterisk/vector.h"
 
 #define DEFAULT_LANGUAGE "en"
 #define DEFAULT_ENCODING "text/plain"
 #define QUALIFIED_BUCKETS 211
 
+/*! \brief Resolution of the qualify wheel, in milliseconds */
+#define QUALIFY_TICK 250
+/*! \brief Number of slots in the qualify wheel */
+#define QUALIFY_SLOTS 1024
+/*! \brief Most contacts qualified by one task */
+#define QUALIFY_BATCH 32
+/*! \brief Number of serializers qualify requests are sent from */
+#define QUALIFY_SERIALIZERS 8
+/*! \brief Number of round trip time histogram buckets, each twice as wide as the last */
+#define RTT_BUCKETS 14
+
 static const char *status_map [] = {
 	[UNAVAILABLE] = "Unreachable",
 	[AVAILABLE] = "Reachable",
@@ -55,6 +68,7 @@ static const char *short_status_map [] = {
 
 static void contact_deleted(const void *obj);
 static void qualify_and_schedule(struct ast_sip_contact *contact);
+static int unschedule_all_cb(void *obj, void *arg, int flags);
 
 const char *ast_sip_get_contact_status_label(const enum ast_sip_contact_status_type status)
 {
@@ -196,7 +210,7 @@ struct ast_sip_contact_status *ast_res_pjsip_find_or_create_contact_status(const
  * \brief Update an ast_sip_contact_status's elements.
  */
 static void update_contact_status(const struct ast_sip_contact *contact,
-	enum ast_sip_contact_status_type value, int is_contact_refresh)
+	enum ast_sip_contact_status_type value, int is_contact_refresh, int64_t rtt)
 {
 	RAII_VAR(struct ast_sip_contact_status *, status, NULL, ao2_cleanup);
 	RAII_VAR(struct ast_sip_contact_status *, update, NULL, ao2_cleanup);
@@ -252,13 +266,8 @@ static void update_contact_status(const struct ast_sip_contact *contact,
 		update->last_status = status->status;
 		update->status = value;
 
-		/*
-		 * if the contact is available calculate the rtt as
-		 * the diff between the last start time and "now"
-		 */
-		update->rtt = update->status == AVAILABLE && status->rtt_start.tv_sec > 0
-			? ast_tvdiff_us(ast_tvnow(), status->rtt_start)
-			: 0;
+		/* The rtt is only meaningful if the contact answered */
+		update->rtt = update->status == AVAILABLE ? rtt : 0;
 		update->rtt_start = ast_tv(0, 0);
 
 		ast_test_suite_event_notify("AOR_CONTACT_QUALIFY_RESULT",
@@ -276,47 +285,6 @@ static void update_contact_status(const struct ast_sip_contact *contact,
 	}
 }
 
-/*!
- * \internal
- * \brief Initialize the start time on a contact status so the round
- *        trip time can be calculated upon a valid response.
- */
-static void init_start_time(const struct ast_sip_contact *contact)
-{
-	RAII_VAR(struct ast_sip_contact_status *, status, NULL, ao2_cleanup);
-	RAII_VAR(struct ast_sip_contact_status *, update, NULL, ao2_cleanup);
-
-	status = ast_res_pjsip_find_or_create_contact_status(contact);
-	if (!status) {
-		ast_log(LOG_ERROR, "Unable to find ast_sip_contact_status for contact %s\n",
-			contact->uri);
-		return;
-	}
-
-	update = ast_sorcery_alloc(ast_sip_get_sorcery(), CONTACT_STATUS,
-		ast_sorcery_object_get_id(status));
-	if (!update) {
-		ast_log(LOG_ERROR, "Unable to copy ast_sip_contact_status for contact %s\n",
-			contact->uri);
-		return;
-	}
-
-	update->uri = ast_strdup(contact->uri);
-	if (!update->uri) {
-		return;
-	}
-
-	update->status = status->status;
-	update->last_status = status->last_status;
-	update->rtt = status->rtt;
-	update->rtt_start = ast_tvnow();
-
-	if (ast_sorcery_update(ast_sip_get_sorcery(), update)) {
-		ast_log(LOG_ERROR, "Unable to update ast_sip_contact_status for contact %s\n",
-			contact->uri);
-	}
-}
-
 /*!
  * \internal
  * \brief For an endpoint try to match the given contact->aor.
@@ -371,13 +339,94 @@ static struct ast_sip_endpoint *find_an_endpoint(struct ast_sip_contact *contact
 	return endpoint;
 }
 
+/*!
+ * \internal
+ * \brief Round trip times of the qualify requests sent to the contacts of an AOR
+ */
+struct aor_rtt_stats {
+	/*! Number of requests that were answered */
+	unsigned int answered;
+	/*! Number of requests that were not answered */
+	unsigned int unanswered;
+	/*! Answers by round trip time, the first bucket is under 1ms */
+	unsigned int buckets[RTT_BUCKETS];
+	/*! Name of the AOR */
+	char aor[0];
+};
+
+/*!
+ * \internal
+ * \brief Round trip time statistics, by AOR name
+ */
+static struct ao2_container *rtt_stats;
+
+AO2_STRING_FIELD_HASH_FN(aor_rtt_stats, aor)
+AO2_STRING_FIELD_CMP_FN(aor_rtt_stats, aor)
+AO2_STRING_FIELD_SORT_FN(aor_rtt_stats, aor)
+
+/*!
+ * \internal
+ * \brief Count the answer, or lack of one, to a qualify request in the statistics of its AOR
+ */
+static void rtt_stats_record(const char *aor, int answered, int64_t rtt)
+{
+	struct aor_rtt_stats *stats;
+	int64_t ms;
+	int bucket;
+
+	if (!rtt_stats || ast_strlen_zero(aor)) {
+		return;
+	}
+
+	ao2_lock(rtt_stats);
+	stats = ao2_find(rtt_stats, aor, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!stats) {
+		stats = ao2_alloc_options(sizeof(*stats) + strlen(aor) + 1, NULL,
+			AO2_ALLOC_OPT_LOCK_MUTEX);
+		if (!stats) {
+			ao2_unlock(rtt_stats);
+			return;
+		}
+		strcpy(stats->aor, aor); /* Safe */
+		ao2_link_flags(rtt_stats, stats, OBJ_NOLOCK);
+	}
+	ao2_unlock(rtt_stats);
+
+	ao2_lock(stats);
+	if (answered) {
+		++stats->answered;
+		for (bucket = 0, ms = rtt / 1000; ms && bucket < RTT_BUCKETS - 1; ++bucket) {
+			ms >>= 1;
+		}
+		++stats->buckets[bucket];
+	} else {
+		++stats->unanswered;
+	}
+	ao2_unlock(stats);
+
+	ao2_ref(stats, -1);
+}
+
+/*!
+ * \internal
+ * \brief A qualify request that has been sent
+ */
+struct qualify_request {
+	/*! The contact being qualified */
+	struct ast_sip_contact *contact;
+	/*! When the request was sent */
+	struct timeval start;
+};
+
 /*!
  * \internal
  * \brief Receive a response to the qualify contact request.
  */
 static void qualify_contact_cb(void *token, pjsip_event *e)
 {
-	struct ast_sip_contact *contact = token;
+	struct qualify_request *request = token;
+	struct ast_sip_contact *contact = request->contact;
+	int64_t rtt = ast_tvdiff_us(ast_tvnow(), request->start);
 
 	switch(e->body.tsx_state.type) {
 	default:
@@ -385,13 +434,16 @@ static void qualify_contact_cb(void *token, pjsip_event *e)
 		/* Fall through */
 	case PJSIP_EVENT_TRANSPORT_ERROR:
 	case PJSIP_EVENT_TIMER:
-		update_contact_status(contact, UNAVAILABLE, 0);
+		rtt_stats_record(contact->aor, 0, 0);
+		update_contact_status(contact, UNAVAILABLE, 0, 0);
 		break;
 	case PJSIP_EVENT_RX_MSG:
-		update_contact_status(contact, AVAILABLE, 0);
+		rtt_stats_record(contact->aor, 1, rtt);
+		update_contact_status(contact, AVAILABLE, 0, rtt);
 		break;
 	}
 	ao2_cleanup(contact);
+	ast_free(request);
 }
 
 /*!
@@ -404,6 +456,7 @@ static void qualify_contact_cb(void *token, pjsip_event *e)
 static int qualify_contact(struct ast_sip_endpoint *endpoint, struct ast_sip_contact *contact)
 {
 	pjsip_tx_data *tdata;
+	struct qualify_request *request;
 	RAII_VAR(struct ast_sip_endpoint *, endpoint_local, NULL, ao2_cleanup);
 
 	if (endpoint) {
@@ -438,15 +491,25 @@ static int qualify_contact(struct ast_sip_endpoint *endpoint, struct ast_sip_con
 		return -1;
 	}
 
-	init_start_time(contact);
+	request = ast_malloc(sizeof(*request));
+	if (!request) {
+		pjsip_tx_data_dec_ref(tdata);
+		return -1;
+	}
+	request->contact = ao2_bump(contact);
+	/*
+	 * The start time is kept with the request rather than in the contact
+	 * status, so sending the request does not need a status update.
+	 */
+	request->start = ast_tvnow();
 
-	ao2_ref(contact, +1);
-	if (ast_sip_send_out_of_dialog_request(tdata, endpoint_local, (int)(contact->qualify_timeout * 1000), contact, qualify_contact_cb)
+	if (ast_sip_send_out_of_dialog_request(tdata, endpoint_local, (int)(contact->qualify_timeout * 1000), request, qualify_contact_cb)
 		!= PJ_SUCCESS) {
 		ast_log(LOG_ERROR, "Unable to send request to qualify contact %s\n",
 			contact->uri);
-		update_contact_status(contact, UNAVAILABLE, 0);
+		update_contact_status(contact, UNAVAILABLE, 0, 0);
 		ao2_ref(contact, -1);
+		ast_free(request);
 		return -1;
 	}
 
@@ -455,13 +518,15 @@ static int qualify_contact(struct ast_sip_endpoint *endpoint, struct ast_sip_con
 
 /*!
  * \internal
- * \brief Scheduling context for sending QUALIFY request at specified intervals.
+ * \brief Scheduling context for the qualify wheel.
  */
 static struct ast_sched_context *sched;
 
 /*!
  * \internal
  * \brief Container to hold all actively scheduled qualifies.
+ *
+ * The container lock also protects the qualify wheel.
  */
 static struct ao2_container *sched_qualifies;
 
@@ -470,16 +535,89 @@ static struct ao2_container *sched_qualifies;
  * \brief Structure to hold qualify contact scheduling information.
  */
 struct sched_data {
-	/*! The scheduling id */
-	int id;
+	/*! Entry in the wheel slot */
+	AST_DLLIST_ENTRY(sched_data) list;
+	/*! The tick the contact is next qualified at */
+	int64_t due;
+	/*! The wheel slot the contact is in */
+	unsigned int slot;
 	/*! The the contact being checked */
 	struct ast_sip_contact *contact;
 };
 
 /*!
  * \internal
- * \brief Destroy the scheduled data and remove from scheduler.
+ * \brief Scheduled qualifies by the tick, modulo the wheel size, they are due at.
+ *
+ * Qualifies due more than one turn of the wheel away stay in their slot
+ * when it is checked.
+ */
+static AST_DLLIST_HEAD_NOLOCK(, sched_data) qualify_wheel[QUALIFY_SLOTS];
+
+/*! \internal \brief The last tick the wheel was checked up to */
+static int64_t qualify_checked;
+
+/*! \internal \brief Serializers the qualify requests are sent from */
+static struct ast_taskprocessor *qualify_serializers[QUALIFY_SERIALIZERS];
+
+/*! \internal \brief The serializer the next batch of qualify requests goes to */
+static unsigned int qualify_serializer_next;
+
+/*!
+ * \internal
+ * \brief Contacts whose qualify requests are sent by one task.
+ */
+struct qualify_batch {
+	/*! Number of contacts in the batch */
+	unsigned int count;
+	/*! The contacts */
+	struct ast_sip_contact *contacts[QUALIFY_BATCH];
+};
+
+AST_VECTOR(qualify_batches, struct qualify_batch *);
+
+/*!
+ * \internal
+ * \brief The current qualify wheel tick.
  */
+static int64_t qualify_now(void)
+{
+	struct timeval now = ast_tvnow();
+
+	return ((int64_t) now.tv_sec * 1000 + now.tv_usec / 1000) / QUALIFY_TICK;
+}
+
+/*!
+ * \internal
+ * \brief Put a scheduled qualify in the wheel slot of its due tick.
+ *
+ * \note sched_qualifies must be locked.
+ */
+static void qualify_wheel_insert(struct sched_data *data)
+{
+	data->slot = MAX(data->due, qualify_checked + 1) % QUALIFY_SLOTS;
+	AST_DLLIST_INSERT_TAIL(&qualify_wheel[data->slot], data, list);
+}
+
+/*!
+ * \internal
+ * \brief Spread the qualifies of contacts over a period.
+ *
+ * \details The offset depends only on the contact, so restarting
+ * Asterisk spreads the contacts the same way rather than sending to
+ * them all at once.
+ *
+ * \return Offset into the period, in milliseconds.
+ */
+static int qualify_jitter(const struct ast_sip_contact *contact, int period)
+{
+	if (period <= 0) {
+		return 0;
+	}
+
+	return (unsigned int) ast_str_hash(ast_sorcery_object_get_id(contact)) % period;
+}
+
 static void sched_data_destructor(void *obj)
 {
 	struct sched_data *data = obj;
@@ -494,7 +632,8 @@ static struct sched_data *sched_data_create(struct ast_sip_contact *contact)
 {
 	struct sched_data *data;
 
-	data = ao2_t_alloc(sizeof(*data), sched_data_destructor, contact->uri);
+	data = ao2_t_alloc_options(sizeof(*data), sched_data_destructor, AO2_ALLOC_OPT_LOCK_NOLOCK,
+		contact->uri);
 	if (!data) {
 		ast_log(LOG_ERROR, "Unable to create schedule qualify data for contact %s\n",
 			contact->uri);
@@ -523,23 +662,107 @@ static int qualify_contact_task(void *obj)
 
 /*!
  * \internal
- * \brief Send a scheduled qualify contact request.
+ * \brief Send the qualify requests of a batch of contacts.
  */
-static int qualify_contact_sched(const void *obj)
+static int qualify_batch_task(void *obj)
 {
-	struct sched_data *data = (struct sched_data *) obj;
+	struct qualify_batch *batch = obj;
+	unsigned int i;
 
-	ao2_ref(data->contact, +1);
-	if (ast_sip_push_task(NULL, qualify_contact_task, data->contact)) {
-		ao2_ref(data->contact, -1);
+	for (i = 0; i < batch->count; ++i) {
+		qualify_contact(NULL, batch->contacts[i]);
+		ao2_ref(batch->contacts[i], -1);
 	}
+	ast_free(batch);
 
-	/*
-	 * Always reschedule rather than have a potential race cleaning
-	 * up the data object ref between self deletion and an external
-	 * deletion.
-	 */
-	return data->contact->qualify_frequency * 1000;
+	return 0;
+}
+
+static void qualify_batch_push(struct qualify_batch *batch)
+{
+	unsigned int i;
+
+	i = ast_atomic_fetchadd_int((int *) &qualify_serializer_next, 1) % QUALIFY_SERIALIZERS;
+	if (ast_sip_push_task(qualify_serializers[i], qualify_batch_task, batch)) {
+		for (i = 0; i < batch->count; ++i) {
+			ao2_ref(batch->contacts[i], -1);
+		}
+		ast_free(batch);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Send the qualifies that are due, in batches.
+ *
+ * \details Runs every tick.  Only the wheel slots of the ticks since the
+ * last run are looked at, and each qualify done is put back in the wheel
+ * one qualify_frequency later.
+ */
+static int qualify_wheel_tick(const void *obj)
+{
+	struct qualify_batches batches;
+	struct qualify_batch *batch = NULL;
+	int64_t now = qualify_now();
+	int64_t tick;
+	int64_t last = now;
+	int i;
+
+	if (AST_VECTOR_INIT(&batches, 8)) {
+		return QUALIFY_TICK;
+	}
+
+	ao2_lock(sched_qualifies);
+	if (now - qualify_checked > QUALIFY_SLOTS) {
+		/* Every slot needs looking at once */
+		last = qualify_checked + QUALIFY_SLOTS;
+	}
+	for (tick = qualify_checked + 1; tick <= last; ++tick) {
+		struct sched_data *data;
+
+		AST_DLLIST_TRAVERSE_SAFE_BEGIN(&qualify_wheel[tick % QUALIFY_SLOTS], data, list) {
+			if (data->due > now) {
+				continue;
+			}
+
+			if (!batch) {
+				batch = ast_malloc(sizeof(*batch));
+				if (!batch) {
+					continue;
+				}
+				batch->count = 0;
+			}
+			batch->contacts[batch->count++] = ao2_bump(data->contact);
+			if (batch->count == QUALIFY_BATCH) {
+				if (AST_VECTOR_APPEND(&batches, batch)) {
+					qualify_batch_push(batch);
+				}
+				batch = NULL;
+			}
+
+			AST_DLLIST_REMOVE_CURRENT(list);
+			data->due += MAX(data->contact->qualify_frequency * 1000 / QUALIFY_TICK, 1);
+			if (data->due <= now) {
+				/* Fell behind, so carry on from now */
+				data->due = now + qualify_jitter(data->contact,
+					data->contact->qualify_frequency * 1000) / QUALIFY_TICK + 1;
+			}
+			qualify_wheel_insert(data);
+		}
+		AST_DLLIST_TRAVERSE_SAFE_END;
+	}
+	qualify_checked = now;
+	ao2_unlock(sched_qualifies);
+
+	if (batch) {
+		qualify_batch_push(batch);
+	}
+	for (i = 0; i < AST_VECTOR_SIZE(&batches); ++i) {
+		qualify_batch_push(AST_VECTOR_GET(&batches, i));
+	}
+	AST_VECTOR_FREE(&batches);
+
+	return QUALIFY_TICK;
 }
 
 /*!
@@ -557,17 +780,13 @@ static void schedule_qualify(struct ast_sip_contact *contact, int initial_interv
 
 	ast_assert(contact->qualify_frequency != 0);
 
-	ao2_t_ref(data, +1, "Ref for qualify_contact_sched() scheduler entry");
-	data->id = ast_sched_add_variable(sched, initial_interval,
-		qualify_contact_sched, data, 1);
-	if (data->id < 0) {
-		ao2_t_ref(data, -1, "Cleanup failed scheduler add");
-		ast_log(LOG_ERROR, "Unable to schedule qualify for contact %s\n",
-			contact->uri);
-	} else if (!ao2_link(sched_qualifies, data)) {
-		AST_SCHED_DEL_UNREF(sched, data->id,
-			ao2_t_ref(data, -1, "Cleanup scheduler for failed ao2_link"));
+	ao2_lock(sched_qualifies);
+	data->due = qualify_now() + initial_interval / QUALIFY_TICK + 1;
+	if (ao2_link_flags(sched_qualifies, data, OBJ_NOLOCK)) {
+		qualify_wheel_insert(data);
 	}
+	ao2_unlock(sched_qualifies);
+
 	ao2_t_ref(data, -1, "Done setting up scheduler entry");
 }
 
@@ -579,14 +798,14 @@ static void unschedule_qualify(struct ast_sip_contact *contact)
 {
 	struct sched_data *data;
 
-	data = ao2_find(sched_qualifies, contact, OBJ_UNLINK | OBJ_SEARCH_KEY);
-	if (!data) {
-		return;
+	ao2_lock(sched_qualifies);
+	data = ao2_find(sched_qualifies, contact, OBJ_UNLINK | OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (data) {
+		AST_DLLIST_REMOVE(&qualify_wheel[data->slot], data, list);
 	}
+	ao2_unlock(sched_qualifies);
 
-	AST_SCHED_DEL_UNREF(sched, data->id,
-		ao2_t_ref(data, -1, "Delete scheduler entry ref"));
-	ao2_t_ref(data, -1, "Done with ao2_find ref");
+	ao2_cleanup(data);
 }
 
 /*!
@@ -605,7 +824,7 @@ static void qualify_and_schedule(struct ast_sip_contact *contact)
 
 		schedule_qualify(contact, contact->qualify_frequency * 1000);
 	} else {
-		update_contact_status(contact, UNKNOWN, 0);
+		update_contact_status(contact, UNKNOWN, 0, 0);
 	}
 }
 
@@ -624,7 +843,7 @@ static void contact_created(const void *obj)
  */
 static void contact_updated(const void *obj)
 {
-	update_contact_status(obj, AVAILABLE, 1);
+	update_contact_status(obj, AVAILABLE, 1, 0);
 }
 
 /*!
@@ -657,15 +876,50 @@ static const struct ast_sorcery_observer contact_observer = {
 	.deleted = contact_deleted,
 };
 
+static void qualify_serializers_destroy(void)
+{
+	int i;
+
+	for (i = 0; i < QUALIFY_SERIALIZERS; ++i) {
+		ast_taskprocessor_unreference(qualify_serializers[i]);
+		qualify_serializers[i] = NULL;
+	}
+}
+
 static pj_bool_t options_start(void)
 {
+	char tps_name[AST_TASKPROCESSOR_MAX_NAME + 1];
+	int i;
+
+	for (i = 0; i < QUALIFY_SERIALIZERS; ++i) {
+		/* Create name with seq number appended. */
+		ast_taskprocessor_build_name(tps_name, sizeof(tps_name), "pjsip/qualify");
+
+		qualify_serializers[i] = ast_sip_create_serializer_named(tps_name);
+		if (!qualify_serializers[i]) {
+			qualify_serializers_destroy();
+			return -1;
+		}
+	}
+
 	sched = ast_sched_context_create();
 	if (!sched) {
+		qualify_serializers_destroy();
 		return -1;
 	}
 	if (ast_sched_start_thread(sched)) {
 		ast_sched_context_destroy(sched);
 		sched = NULL;
+		qualify_serializers_destroy();
+		return -1;
+	}
+
+	qualify_checked = qualify_now();
+	if (ast_sched_add_variable(sched, QUALIFY_TICK, qualify_wheel_tick, NULL, 1) < 0) {
+		ast_log(LOG_WARNING, "Unable to schedule qualifies\n");
+		ast_sched_context_destroy(sched);
+		sched = NULL;
+		qualify_serializers_destroy();
 		return -1;
 	}
 
@@ -673,18 +927,13 @@ static pj_bool_t options_start(void)
 		ast_log(LOG_WARNING, "Unable to add contact observer\n");
 		ast_sched_context_destroy(sched);
 		sched = NULL;
+		qualify_serializers_destroy();
 		return -1;
 	}
 
 	return PJ_SUCCESS;
 }
 
-static int sched_qualifies_empty(void *obj, void *arg, int flags)
-{
-	ao2_t_ref(obj, -1, "Release ref held by destroyed scheduler context.");
-	return CMP_MATCH;
-}
-
 static pj_bool_t options_stop(void)
 {
 	ast_sorcery_observer_remove(ast_sip_get_sorcery(), "contact", &contact_observer);
@@ -694,9 +943,11 @@ static pj_bool_t options_stop(void)
 		sched = NULL;
 	}
 
-	/* Empty the container of scheduling data refs. */
+	/* Empty the container and the wheel of scheduling data. */
 	ao2_callback(sched_qualifies, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE,
-		sched_qualifies_empty, NULL);
+		unschedule_all_cb, NULL);
+
+	qualify_serializers_destroy();
 
 	return PJ_SUCCESS;
 }
@@ -999,8 +1250,99 @@ static int ami_sip_qualify(struct mansession *s, const struct message *m)
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief The round trip time, in milliseconds, that a percentage of the answers were quicker than.
+ *
+ * \retval -1 if they were not quicker than the last bucket
+ */
+static long rtt_stats_percentile(const struct aor_rtt_stats *stats, unsigned int percent)
+{
+	unsigned long long wanted = ((unsigned long long) stats->answered * percent + 99) / 100;
+	unsigned long long seen = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < RTT_BUCKETS - 1; ++bucket) {
+		seen += stats->buckets[bucket];
+		if (seen >= wanted) {
+			return 1L << bucket;
+		}
+	}
+
+	return -1;
+}
+
+static const char *rtt_stats_percentile_str(const struct aor_rtt_stats *stats, unsigned int percent,
+	char *buf, size_t size)
+{
+	long ms = rtt_stats_percentile(stats, percent);
+
+	if (!stats->answered) {
+		snprintf(buf, size, "-");
+	} else if (ms < 0) {
+		snprintf(buf, size, ">=%ldms", 1L << (RTT_BUCKETS - 2));
+	} else {
+		snprintf(buf, size, "<%ldms", ms);
+	}
+
+	return buf;
+}
+
+static char *cli_show_qualify_stats(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-32.32s %9s %11s %9s %9s %9s\n"
+	struct ao2_iterator iter;
+	struct aor_rtt_stats *stats;
+	char answered[16];
+	char unanswered[16];
+	char p50[16];
+	char p90[16];
+	char p99[16];
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "pjsip show qualify statistics";
+		e->usage =
+			"Usage: pjsip show qualify statistics [<aor>]\n"
+			"       Show how many qualify requests to the contacts of each AOR were\n"
+			"       answered, and how quickly.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4 && a->argc != 5) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_cli(a->fd, FORMAT, "AOR", "Answered", "Unanswered", "RTT 50%", "RTT 90%", "RTT 99%");
+
+	iter = ao2_iterator_init(rtt_stats, 0);
+	while ((stats = ao2_iterator_next(&iter))) {
+		if (a->argc == 5 && strcmp(stats->aor, a->argv[4])) {
+			ao2_ref(stats, -1);
+			continue;
+		}
+
+		ao2_lock(stats);
+		snprintf(answered, sizeof(answered), "%u", stats->answered);
+		snprintf(unanswered, sizeof(unanswered), "%u", stats->unanswered);
+		ast_cli(a->fd, FORMAT, stats->aor, answered, unanswered,
+			rtt_stats_percentile_str(stats, 50, p50, sizeof(p50)),
+			rtt_stats_percentile_str(stats, 90, p90, sizeof(p90)),
+			rtt_stats_percentile_str(stats, 99, p99, sizeof(p99)));
+		ao2_unlock(stats);
+		ao2_ref(stats, -1);
+	}
+	ao2_iterator_destroy(&iter);
+
+	return CLI_SUCCESS;
+#undef FORMAT
+}
+
 static struct ast_cli_entry cli_options[] = {
-	AST_CLI_DEFINE(cli_qualify, "Send an OPTIONS request to a PJSIP endpoint")
+	AST_CLI_DEFINE(cli_qualify, "Send an OPTIONS request to a PJSIP endpoint"),
+	AST_CLI_DEFINE(cli_show_qualify_stats, "Show round trip times of qualify requests by AOR"),
 };
 
 static int sched_qualifies_hash_fn(const void *obj, int flags)
@@ -1124,20 +1466,20 @@ static void qualify_and_schedule_contact(struct ast_sip_contact *contact)
 	int initial_interval;
 	int max_time = ast_sip_get_max_initial_qualify_time();
 
-	/* Delay initial qualification by a random fraction of the specified interval */
+	/* Delay initial qualification by a fraction of the specified interval that depends on the contact */
 	if (max_time && max_time < contact->qualify_frequency) {
 		initial_interval = max_time;
 	} else {
 		initial_interval = contact->qualify_frequency;
 	}
 
-	initial_interval = (int)((initial_interval * 1000) * ast_random_double());
+	initial_interval = qualify_jitter(contact, initial_interval * 1000);
 
 	unschedule_qualify(contact);
 	if (contact->qualify_frequency) {
 		schedule_qualify(contact, initial_interval);
 	} else {
-		update_contact_status(contact, UNKNOWN, 0);
+		update_contact_status(contact, UNKNOWN, 0, 0);
 	}
 }
 
@@ -1193,7 +1535,7 @@ static int unschedule_all_cb(void *obj, void *arg, int flags)
 {
 	struct sched_data *data = obj;
 
-	AST_SCHED_DEL_UNREF(sched, data->id, ao2_ref(data, -1));
+	AST_DLLIST_REMOVE(&qualify_wheel[data->slot], data, list);
 
 	return CMP_MATCH;
 }
@@ -1331,6 +1673,8 @@ static void aor_observer_deleted(const void *obj)
 		ao2_callback(contacts, OBJ_NODATA | OBJ_MULTIPLE, unschedule_contact_cb, NULL);
 		ao2_ref(contacts, -1);
 	}
+
+	ao2_find(rtt_stats, ast_sorcery_object_get_id(aor), OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA);
 }
 
 static const struct ast_sorcery_observer observer_callbacks_options = {
@@ -1468,16 +1812,27 @@ int ast_res_pjsip_init_options_handling(int reload)
 		return 0;
 	}
 
-	sched_qualifies = ao2_t_container_alloc(QUALIFIED_BUCKETS,
-		sched_qualifies_hash_fn, sched_qualifies_cmp_fn,
+	sched_qualifies = ao2_t_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX,
+		AO2_CONTAINER_ALLOC_OPT_AUTO_RESIZE, QUALIFIED_BUCKETS,
+		sched_qualifies_hash_fn, NULL, sched_qualifies_cmp_fn,
 		"Create container for scheduled qualifies");
 	if (!sched_qualifies) {
 		return -1;
 	}
 
+	rtt_stats = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, QUALIFIED_BUCKETS,
+		aor_rtt_stats_hash_fn, aor_rtt_stats_sort_fn, aor_rtt_stats_cmp_fn);
+	if (!rtt_stats) {
+		ao2_cleanup(sched_qualifies);
+		sched_qualifies = NULL;
+		return -1;
+	}
+
 	if (pjsip_endpt_register_module(ast_sip_get_pjsip_endpoint(), &options_module) != PJ_SUCCESS) {
 		ao2_cleanup(sched_qualifies);
 		sched_qualifies = NULL;
+		ao2_cleanup(rtt_stats);
+		rtt_stats = NULL;
 		return -1;
 	}
 
@@ -1486,6 +1841,8 @@ int ast_res_pjsip_init_options_handling(int reload)
 		pjsip_endpt_unregister_module(ast_sip_get_pjsip_endpoint(), &options_module);
 		ao2_cleanup(sched_qualifies);
 		sched_qualifies = NULL;
+		ao2_cleanup(rtt_stats);
+		rtt_stats = NULL;
 		return -1;
 	}
 
@@ -1493,6 +1850,8 @@ int ast_res_pjsip_init_options_handling(int reload)
 		pjsip_endpt_unregister_module(ast_sip_get_pjsip_endpoint(), &options_module);
 		ao2_cleanup(sched_qualifies);
 		sched_qualifies = NULL;
+		ao2_cleanup(rtt_stats);
+		rtt_stats = NULL;
 		return -1;
 	}
 
@@ -1516,4 +1875,6 @@ void ast_res_pjsip_cleanup_options_handling(void)
 	pjsip_endpt_unregister_module(ast_sip_get_pjsip_endpoint(), &options_module);
 	ao2_cleanup(sched_qualifies);
 	sched_qualifies = NULL;
+	ao2_cleanup(rtt_stats);
+	rtt_stats = NULL;
 }
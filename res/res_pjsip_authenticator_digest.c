@@ -173,8 +173,13 @@ static pj_status_t digest_lookup(pj_pool_t *pool, const pj_str_t *realm,
 
 	switch (auth->type) {
 	case AST_SIP_AUTH_TYPE_USER_PASS:
-		pj_strdup2(pool, &info->data, auth->auth_pass);
-		info->data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+		if (!ast_strlen_zero(auth->ha1)) {
+			pj_strdup2(pool, &info->data, auth->ha1);
+			info->data_type = PJSIP_CRED_DATA_DIGEST;
+		} else {
+			pj_strdup2(pool, &info->data, auth->auth_pass);
+			info->data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+		}
 		break;
 	case AST_SIP_AUTH_TYPE_MD5:
 		pj_strdup2(pool, &info->data, auth->md5_creds);
@@ -270,8 +275,12 @@ static int find_challenge(const pjsip_rx_data *rdata, const struct ast_sip_auth
 	char nonce[64];
 
 	while ((auth_hdr = (pjsip_authorization_hdr *) pjsip_msg_find_hdr(rdata->msg_info.msg, PJSIP_H_AUTHORIZATION, auth_hdr->next))) {
+		/* Only rebuild the nonce for credentials of this realm */
+		if (pj_strcmp2(&auth_hdr->credential.digest.realm, auth->realm)) {
+			continue;
+		}
 		ast_copy_pj_str(nonce, &auth_hdr->credential.digest.nonce, sizeof(nonce));
-		if (check_nonce(nonce, rdata, auth) && !pj_strcmp2(&auth_hdr->credential.digest.realm, auth->realm)) {
+		if (check_nonce(nonce, rdata, auth)) {
 			challenge_found = 1;
 			break;
 		}
@@ -82,12 +82,13 @@ static struct ast_datastore *dialog_info_xml_state_find_or_create(struct ast_sip
 	return datastore;
 }
 
-static unsigned int dialog_info_xml_get_version(struct ast_sip_subscription *sub, unsigned int *version)
+static int dialog_info_xml_get_version(struct ast_sip_subscription *sub, unsigned int *version)
 {
 	struct ast_datastore *datastore = dialog_info_xml_state_find_or_create(sub);
 	struct dialog_info_xml_state *state;
 
 	if (!datastore) {
+		ast_log(LOG_WARNING, "dialog-info+xml version could not be retrieved from datastore\n");
 		return -1;
 	}
 
@@ -105,8 +106,7 @@ static int dialog_info_generate_body_content(void *body, void *data)
 	char *local = ast_strdupa(state_data->local), *stripped, *statestring = NULL;
 	char *pidfstate = NULL, *pidfnote = NULL;
 	enum ast_sip_pidf_state local_state;
-	unsigned int version;
-	char version_str[32], sanitized[PJSIP_MAX_URL_SIZE];
+	char sanitized[PJSIP_MAX_URL_SIZE];
 	struct ast_sip_endpoint *endpoint = NULL;
 	unsigned int notify_early_inuse_ringing = 0;
 
@@ -114,11 +114,6 @@ static int dialog_info_generate_body_content(void *body, void *data)
 		return -1;
 	}
 
-	if (dialog_info_xml_get_version(state_data->sub, &version)) {
-		ast_log(LOG_WARNING, "dialog-info+xml version could not be retrieved from datastore\n");
-		return -1;
-	}
-
 	stripped = ast_strip_quoted(local, "<", ">");
 	ast_sip_sanitize_xml(stripped, sanitized, sizeof(sanitized));
 
@@ -131,8 +126,9 @@ static int dialog_info_generate_body_content(void *body, void *data)
 
 	ast_sip_presence_xml_create_attr(state_data->pool, dialog_info, "xmlns", "urn:ietf:params:xml:ns:dialog-info");
 
-	snprintf(version_str, sizeof(version_str), "%u", version);
-	ast_sip_presence_xml_create_attr(state_data->pool, dialog_info, "version", version_str);
+	/* The version is filled in for each subscription the body is sent to */
+	ast_sip_presence_xml_create_attr(state_data->pool, dialog_info, "version",
+		AST_SIP_BODY_VERSION_PLACEHOLDER);
 
 	ast_sip_presence_xml_create_attr(state_data->pool, dialog_info, "state", "full");
 	ast_sip_presence_xml_create_attr(state_data->pool, dialog_info, "entity", sanitized);
@@ -195,6 +191,7 @@ static struct ast_sip_pubsub_body_generator dialog_info_body_generator = {
 	.generate_body_content = dialog_info_generate_body_content,
 	.to_string = dialog_info_to_string,
 	/* No need for a destroy_body callback since we use a pool */
+	.body_version = dialog_info_xml_get_version,
 };
 
 static int load_module(void)
@@ -31,6 +31,7 @@
 #include "asterisk/module.h"
 #include "asterisk/acl.h"
 #include "asterisk/manager.h"
+#include "asterisk/vector.h"
 #include "res_pjsip/include/res_pjsip_private.h"
 
 /*** DOCUMENTATION
@@ -199,31 +200,421 @@ static int ip_identify_match_check(void *obj, void *arg, int flags)
 	}
 }
 
+/*! \brief A node of an address prefix tree */
+struct ip_identify_node {
+	/*! \brief The nodes for the next bit being 0 and 1 */
+	struct ip_identify_node *child[2];
+	/*! \brief The identify matching this prefix, if any */
+	struct ip_identify_match *identify;
+};
+
+/*!
+ * \brief An index of the configured identify sections
+ *
+ * Addresses are looked up by walking a prefix tree per address family so
+ * the cost does not depend on how many identify sections or addresses are
+ * configured.  The index is thrown away whenever identify sections change
+ * and rebuilt on the next request.
+ */
+struct ip_identify_index {
+	/*! \brief Prefix tree of IPv4 networks */
+	struct ip_identify_node *ipv4;
+	/*! \brief Prefix tree of IPv6 networks */
+	struct ip_identify_node *ipv6;
+	/*! \brief Identify sections with a netmask that is not a prefix */
+	AST_VECTOR(, struct ip_identify_match *) others;
+	/*! \brief Identify sections matching by header */
+	AST_VECTOR(, struct ip_identify_match *) headers;
+	/*! \brief Number of identify sections */
+	size_t count;
+};
+
+/*! \brief The current index, NULL if it needs to be built */
+static struct ip_identify_index *identify_index;
+/*! \brief Bumped every time the index is thrown away */
+static unsigned int identify_index_generation;
+AST_RWLOCK_DEFINE_STATIC(identify_index_lock);
+
+static void ip_identify_node_free(struct ip_identify_node *node)
+{
+	if (!node) {
+		return;
+	}
+	ip_identify_node_free(node->child[0]);
+	ip_identify_node_free(node->child[1]);
+	ao2_cleanup(node->identify);
+	ast_free(node);
+}
+
+static void ip_identify_index_destroy(void *obj)
+{
+	struct ip_identify_index *index = obj;
+
+	ip_identify_node_free(index->ipv4);
+	ip_identify_node_free(index->ipv6);
+	AST_VECTOR_CALLBACK_VOID(&index->others, ao2_ref, -1);
+	AST_VECTOR_FREE(&index->others);
+	AST_VECTOR_CALLBACK_VOID(&index->headers, ao2_ref, -1);
+	AST_VECTOR_FREE(&index->headers);
+}
+
+/*!
+ * \brief Get the raw bytes of an IPv4 or IPv6 address
+ *
+ * \return The number of bytes, 4 or 16
+ * \retval 0 if the address is neither
+ */
+static size_t ip_identify_addr_bytes(const struct ast_sockaddr *addr, unsigned char *bytes)
+{
+	if (ast_sockaddr_is_ipv4(addr)) {
+		uint32_t ipv4 = htonl(ast_sockaddr_ipv4(addr));
+
+		memcpy(bytes, &ipv4, sizeof(ipv4));
+		return sizeof(ipv4);
+	}
+	if (ast_sockaddr_is_ipv6(addr)) {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) &addr->ss;
+
+		memcpy(bytes, sin6->sin6_addr.s6_addr, sizeof(sin6->sin6_addr.s6_addr));
+		return sizeof(sin6->sin6_addr.s6_addr);
+	}
+	return 0;
+}
+
+/*!
+ * \brief Get the prefix length of a netmask
+ *
+ * \retval -1 if the netmask is not a prefix
+ */
+static int ip_identify_prefix_len(const unsigned char *mask, size_t len)
+{
+	int bits = 0;
+	size_t i;
+	int bit;
+
+	for (i = 0; i < len; ++i) {
+		for (bit = 7; bit >= 0; --bit) {
+			if (!(mask[i] & (1 << bit))) {
+				goto done;
+			}
+			++bits;
+		}
+	}
+	return bits;
+
+done:
+	/* Every bit after the first zero must be zero as well */
+	for (; i < len; ++i, bit = 7) {
+		for (; bit >= 0; --bit) {
+			if (mask[i] & (1 << bit)) {
+				return -1;
+			}
+		}
+	}
+	return bits;
+}
+
+static int ip_identify_bit(const unsigned char *bytes, int bit)
+{
+	return (bytes[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+/*!
+ * \brief Add a network of an identify section to a prefix tree
+ *
+ * \note If two identify sections have the same network the first one added
+ * keeps it.
+ */
+static int ip_identify_node_add(struct ip_identify_node **root, const unsigned char *bytes,
+	int prefix_len, struct ip_identify_match *identify)
+{
+	struct ip_identify_node **node = root;
+	int bit;
+
+	for (bit = 0; ; ++bit) {
+		if (!*node) {
+			*node = ast_calloc(1, sizeof(**node));
+			if (!*node) {
+				return -1;
+			}
+		}
+		if (bit == prefix_len) {
+			break;
+		}
+		node = &(*node)->child[ip_identify_bit(bytes, bit)];
+	}
+
+	if (!(*node)->identify) {
+		(*node)->identify = ao2_bump(identify);
+	}
+	return 0;
+}
+
+/*! \brief Add every network of an identify section to the index */
+static int ip_identify_index_add(struct ip_identify_index *index, struct ip_identify_match *identify)
+{
+	const struct ast_ha *ha;
+	int others = 0;
+
+	for (ha = identify->matches; ha; ha = ha->next) {
+		unsigned char addr[16];
+		unsigned char mask[16];
+		size_t len = ip_identify_addr_bytes(&ha->addr, addr);
+		int prefix_len;
+
+		if (!len || ip_identify_addr_bytes(&ha->netmask, mask) != len
+			|| (prefix_len = ip_identify_prefix_len(mask, len)) < 0) {
+			others = 1;
+			continue;
+		}
+
+		if (ip_identify_node_add(len == 4 ? &index->ipv4 : &index->ipv6, addr, prefix_len, identify)) {
+			return -1;
+		}
+	}
+
+	if (others) {
+		if (AST_VECTOR_APPEND(&index->others, identify)) {
+			return -1;
+		}
+		ao2_ref(identify, +1);
+	}
+	if (!ast_strlen_zero(identify->match_header)) {
+		if (AST_VECTOR_APPEND(&index->headers, identify)) {
+			return -1;
+		}
+		ao2_ref(identify, +1);
+	}
+	return 0;
+}
+
+/*!
+ * \brief Check if the identify sections only come from configuration
+ *
+ * Sections kept elsewhere, such as realtime, can change without sorcery
+ * observers knowing, so they are never indexed.
+ */
+static int ip_identify_indexable(void)
+{
+	struct ast_sorcery_wizard *wizard;
+	int count = ast_sorcery_get_wizard_mapping_count(ast_sip_get_sorcery(), "identify");
+	int i;
+
+	if (count <= 0) {
+		return 0;
+	}
+	for (i = 0; i < count; ++i) {
+		if (ast_sorcery_get_wizard_mapping(ast_sip_get_sorcery(), "identify", i, &wizard, NULL)
+			|| strcmp(wizard->name, "config")) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static struct ip_identify_index *ip_identify_index_build(struct ao2_container *identifies)
+{
+	struct ip_identify_index *index;
+	struct ip_identify_match *identify;
+	struct ao2_iterator it;
+
+	index = ao2_alloc_options(sizeof(*index), ip_identify_index_destroy, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!index) {
+		return NULL;
+	}
+	if (AST_VECTOR_INIT(&index->others, 0) || AST_VECTOR_INIT(&index->headers, 0)) {
+		ao2_ref(index, -1);
+		return NULL;
+	}
+
+	it = ao2_iterator_init(identifies, 0);
+	while ((identify = ao2_iterator_next(&it))) {
+		if (ip_identify_index_add(index, identify)) {
+			ao2_ref(identify, -1);
+			ao2_iterator_destroy(&it);
+			ao2_ref(index, -1);
+			return NULL;
+		}
+		ao2_ref(identify, -1);
+	}
+	ao2_iterator_destroy(&it);
+	index->count = ao2_container_count(identifies);
+
+	return index;
+}
+
+/*!
+ * \brief Get the index of identify sections, building it if needed
+ *
+ * \retval NULL if the sections cannot be indexed
+ */
+static struct ip_identify_index *ip_identify_index_get(void)
+{
+	struct ip_identify_index *index;
+	struct ao2_container *identifies;
+	unsigned int generation;
+
+	ast_rwlock_rdlock(&identify_index_lock);
+	index = ao2_bump(identify_index);
+	generation = identify_index_generation;
+	ast_rwlock_unlock(&identify_index_lock);
+
+	if (index || !ip_identify_indexable()) {
+		return index;
+	}
+
+	identifies = ast_sorcery_retrieve_by_fields(ast_sip_get_sorcery(), "identify",
+		AST_RETRIEVE_FLAG_MULTIPLE | AST_RETRIEVE_FLAG_ALL, NULL);
+	if (!identifies) {
+		return NULL;
+	}
+	index = ip_identify_index_build(identifies);
+	ao2_ref(identifies, -1);
+	if (!index) {
+		return NULL;
+	}
+
+	/* Only keep the index if nothing changed while it was built */
+	ast_rwlock_wrlock(&identify_index_lock);
+	if (!identify_index && generation == identify_index_generation) {
+		identify_index = ao2_bump(index);
+	}
+	ast_rwlock_unlock(&identify_index_lock);
+
+	return index;
+}
+
+static void ip_identify_index_invalidate(void)
+{
+	struct ip_identify_index *index;
+
+	ast_rwlock_wrlock(&identify_index_lock);
+	index = identify_index;
+	identify_index = NULL;
+	++identify_index_generation;
+	ast_rwlock_unlock(&identify_index_lock);
+
+	ao2_cleanup(index);
+}
+
+static void identify_changed(const void *object)
+{
+	ip_identify_index_invalidate();
+}
+
+static void identify_loaded(const char *object_type)
+{
+	ip_identify_index_invalidate();
+}
+
+static struct ast_sorcery_observer identify_observer = {
+	.created = identify_changed,
+	.updated = identify_changed,
+	.deleted = identify_changed,
+	.loaded = identify_loaded,
+};
+
+/*! \brief Find the most specific identify section whose networks include an address */
+static struct ip_identify_match *ip_identify_index_find(struct ip_identify_index *index,
+	const struct ast_sockaddr *addr)
+{
+	struct ast_sockaddr mapped;
+	const struct ip_identify_node *node;
+	struct ip_identify_match *found = NULL;
+	unsigned char bytes[16];
+	size_t len;
+	int bit;
+	size_t i;
+
+	/* IPv4 networks apply to IPv4-mapped addresses as well */
+	if (ast_sockaddr_is_ipv4_mapped(addr) && ast_sockaddr_ipv4_mapped(addr, &mapped)) {
+		addr = &mapped;
+	}
+
+	len = ip_identify_addr_bytes(addr, bytes);
+	node = len == 4 ? index->ipv4 : len == 16 ? index->ipv6 : NULL;
+	for (bit = 0; node; ++bit) {
+		if (node->identify) {
+			found = node->identify;
+		}
+		if (bit == len * 8) {
+			break;
+		}
+		node = node->child[ip_identify_bit(bytes, bit)];
+	}
+	if (found) {
+		return ao2_bump(found);
+	}
+
+	for (i = 0; i < AST_VECTOR_SIZE(&index->others); ++i) {
+		found = AST_VECTOR_GET(&index->others, i);
+		if (ip_identify_match_check(found, (void *) addr, 0)) {
+			return ao2_bump(found);
+		}
+	}
+
+	return NULL;
+}
+
+static struct ip_identify_match *ip_identify_index_find_header(struct ip_identify_index *index,
+	pjsip_rx_data *rdata)
+{
+	struct ip_identify_match *identify;
+	size_t i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&index->headers); ++i) {
+		identify = AST_VECTOR_GET(&index->headers, i);
+		if (header_identify_match_check(identify, rdata, 0)) {
+			return ao2_bump(identify);
+		}
+	}
+
+	return NULL;
+}
+
 static struct ast_sip_endpoint *ip_identify(pjsip_rx_data *rdata)
 {
 	struct ast_sockaddr addr = { { 0, } };
+	RAII_VAR(struct ip_identify_index *, index, NULL, ao2_cleanup);
 	RAII_VAR(struct ao2_container *, candidates, NULL, ao2_cleanup);
 	RAII_VAR(struct ip_identify_match *, match, NULL, ao2_cleanup);
 	struct ast_sip_endpoint *endpoint;
 
-	/* If no possibilities exist return early to save some time */
-	if (!(candidates = ast_sorcery_retrieve_by_fields(ast_sip_get_sorcery(), "identify", AST_RETRIEVE_FLAG_MULTIPLE | AST_RETRIEVE_FLAG_ALL, NULL)) ||
-		!ao2_container_count(candidates)) {
-		ast_debug(3, "No identify sections to match against\n");
-		return NULL;
-	}
-
 	ast_sockaddr_parse(&addr, rdata->pkt_info.src_name, PARSE_PORT_FORBID);
 	ast_sockaddr_set_port(&addr, rdata->pkt_info.src_port);
 
-	match = ao2_callback(candidates, 0, ip_identify_match_check, &addr);
-	if (!match) {
-		ast_debug(3, "Identify checks by IP address failed to find match: '%s' did not match any identify section rules\n",
-				ast_sockaddr_stringify(&addr));
-		match = ao2_callback(candidates, 0, header_identify_match_check, rdata);
+	index = ip_identify_index_get();
+	if (index) {
+		if (!index->count) {
+			ast_debug(3, "No identify sections to match against\n");
+			return NULL;
+		}
+		match = ip_identify_index_find(index, &addr);
 		if (!match) {
+			ast_debug(3, "Identify checks by IP address failed to find match: '%s' did not match any identify section rules\n",
+					ast_sockaddr_stringify(&addr));
+			match = ip_identify_index_find_header(index, rdata);
+			if (!match) {
+				return NULL;
+			}
+		}
+	} else {
+		/* If no possibilities exist return early to save some time */
+		if (!(candidates = ast_sorcery_retrieve_by_fields(ast_sip_get_sorcery(), "identify", AST_RETRIEVE_FLAG_MULTIPLE | AST_RETRIEVE_FLAG_ALL, NULL)) ||
+			!ao2_container_count(candidates)) {
+			ast_debug(3, "No identify sections to match against\n");
 			return NULL;
 		}
+
+		match = ao2_callback(candidates, 0, ip_identify_match_check, &addr);
+		if (!match) {
+			ast_debug(3, "Identify checks by IP address failed to find match: '%s' did not match any identify section rules\n",
+					ast_sockaddr_stringify(&addr));
+			match = ao2_callback(candidates, 0, header_identify_match_check, rdata);
+			if (!match) {
+				return NULL;
+			}
+		}
 	}
 
 	endpoint = ast_sorcery_retrieve_by_id(ast_sip_get_sorcery(), "endpoint", match->endpoint_name);
@@ -674,6 +1065,9 @@ static int load_module(void)
 	ast_sorcery_object_field_register_custom(ast_sip_get_sorcery(), "identify", "match", "", ip_identify_match_handler, match_to_str, match_to_var_list, 0, 0);
 	ast_sorcery_object_field_register(ast_sip_get_sorcery(), "identify", "match_header", "", OPT_STRINGFIELD_T, 0, STRFLDSET(struct ip_identify_match, match_header));
 	ast_sorcery_object_field_register(ast_sip_get_sorcery(), "identify", "srv_lookups", "yes", OPT_BOOL_T, 1, FLDSET(struct ip_identify_match, srv_lookups));
+	/* Identifies are looked up by endpoint when showing endpoints */
+	ast_sorcery_object_field_index(ast_sip_get_sorcery(), "identify", "endpoint");
+	ast_sorcery_observer_add(ast_sip_get_sorcery(), "identify", &identify_observer);
 	ast_sorcery_load_object(ast_sip_get_sorcery(), "identify");
 
 	ast_sip_register_endpoint_identifier_with_name(&ip_identifier, "ip");
@@ -711,6 +1105,8 @@ static int unload_module(void)
 	ast_sip_unregister_cli_formatter(cli_formatter);
 	ast_sip_unregister_endpoint_formatter(&endpoint_identify_formatter);
 	ast_sip_unregister_endpoint_identifier(&ip_identifier);
+	ast_sorcery_observer_remove(ast_sip_get_sorcery(), "identify", &identify_observer);
+	ip_identify_index_invalidate();
 
 	return 0;
 }
@@ -47,6 +47,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #define HISTORY_INITIAL_SIZE 256
 
+/*! \brief Number of packets kept, the oldest being replaced once reached */
+#define HISTORY_MAX_ENTRIES 10000
+
 /*! \brief Pool factory used by pjlib to allocate memory. */
 static pj_caching_pool cachingpool;
 
@@ -70,8 +73,12 @@ struct pjsip_history_entry {
 	pj_sockaddr_in dst;
 	/*! \brief Memory pool used to allocate \c msg */
 	pj_pool_t *pool;
-	/*! \brief The actual SIP message */
+	/*! \brief The SIP message, parsed from \c packet when first needed */
 	pjsip_msg *msg;
+	/*! \brief Length of \c packet */
+	int len;
+	/*! \brief The packet as it was sent or received, NULL terminated */
+	char packet[0];
 };
 
 /*! \brief Mutex that protects \ref vector_history */
@@ -80,6 +87,9 @@ AST_MUTEX_DEFINE_STATIC(history_lock);
 /*! \brief The one and only history that we've captured */
 static AST_VECTOR(vector_history_t, struct pjsip_history_entry *) vector_history;
 
+/*! \brief Position of the oldest entry in \ref vector_history once it is full */
+static int history_oldest;
+
 struct expression_token;
 
 /*! \brief An operator that we understand in an expression */
@@ -493,7 +503,7 @@ static void *entry_get_addr(struct pjsip_history_entry *entry)
 /*! \brief Callback to retrieve the entry's SIP request method type */
 static void *entry_get_sip_msg_request_method(struct pjsip_history_entry *entry)
 {
-	if (entry->msg->type != PJSIP_REQUEST_MSG) {
+	if (!entry->msg || entry->msg->type != PJSIP_REQUEST_MSG) {
 		return NULL;
 	}
 
@@ -505,9 +515,13 @@ static void *entry_get_sip_msg_call_id(struct pjsip_history_entry *entry)
 {
 	pjsip_cid_hdr *cid_hdr;
 
+	if (!entry->msg) {
+		return NULL;
+	}
+
 	cid_hdr = PJSIP_MSG_CID_HDR(entry->msg);
 
-	return &cid_hdr->id;
+	return cid_hdr ? &cid_hdr->id : NULL;
 }
 
 /*! \brief The fields we allow */
@@ -621,41 +635,70 @@ static void pjsip_history_entry_dtor(void *obj)
 /*!
  * \brief Create a \c pjsip_history_entry AO2 object
  *
- * \param msg The PJSIP message that this history entry wraps
+ * Only the raw packet is copied. The SIP message is parsed from it by
+ * \ref parse_history_entries when the history is displayed or filtered.
+ *
+ * \param packet The packet that this history entry wraps
+ * \param len Length of \c packet
  *
  * \retval An AO2 \c pjsip_history_entry object on success
  * \retval NULL on failure
  */
-static struct pjsip_history_entry *pjsip_history_entry_alloc(pjsip_msg *msg)
+static struct pjsip_history_entry *pjsip_history_entry_alloc(const char *packet, int len)
 {
 	struct pjsip_history_entry *entry;
 
-	entry = ao2_alloc_options(sizeof(*entry), pjsip_history_entry_dtor, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	entry = ao2_alloc(sizeof(*entry) + len + 1, pjsip_history_entry_dtor);
 	if (!entry) {
 		return NULL;
 	}
-	entry->number = ast_atomic_fetchadd_int(&packet_number, 1);
 	entry->timestamp = ast_tvnow();
 	entry->timestamp.tv_usec = 0;
 
-	entry->pool = pj_pool_create(&cachingpool.factory, NULL, PJSIP_POOL_RDATA_LEN,
-	                             PJSIP_POOL_RDATA_INC, NULL);
-	if (!entry->pool) {
-		ao2_ref(entry, -1);
-		return NULL;
-	}
+	memcpy(entry->packet, packet, len);
+	entry->packet[len] = '\0';
+	entry->len = len;
 
-	entry->msg = pjsip_msg_clone(entry->pool, msg);
-	if (!entry->msg) {
-		ao2_ref(entry, -1);
-		return NULL;
+	return entry;
+}
+
+/*!
+ * \brief Add an entry to the history, replacing the oldest one once it is full
+ *
+ * The history gets its own reference to \c entry.
+ */
+static void history_append(struct pjsip_history_entry *entry)
+{
+	struct pjsip_history_entry *replaced = NULL;
+
+	ast_mutex_lock(&history_lock);
+	entry->number = packet_number++;
+	if (AST_VECTOR_SIZE(&vector_history) < HISTORY_MAX_ENTRIES) {
+		if (!AST_VECTOR_APPEND(&vector_history, entry)) {
+			ao2_ref(entry, +1);
+		}
+	} else {
+		replaced = AST_VECTOR_GET(&vector_history, history_oldest);
+		*AST_VECTOR_GET_ADDR(&vector_history, history_oldest) = ao2_bump(entry);
+		history_oldest = (history_oldest + 1) % HISTORY_MAX_ENTRIES;
 	}
+	ast_mutex_unlock(&history_lock);
 
-	return entry;
+	ao2_cleanup(replaced);
+}
+
+/*!
+ * \brief Get an entry of the history, 0 being the oldest one
+ *
+ * \note \ref history_lock must be held
+ */
+static struct pjsip_history_entry *history_get(int i)
+{
+	return AST_VECTOR_GET(&vector_history, (history_oldest + i) % AST_VECTOR_SIZE(&vector_history));
 }
 
 /*! \brief Format single line history entry */
-static void sprint_list_entry(struct pjsip_history_entry *entry, char *line, int len)
+static void sprint_list_entry(struct pjsip_history_entry *entry, pjsip_msg *msg, char *line, int len)
 {
 	char addr[64];
 
@@ -665,17 +708,24 @@ static void sprint_list_entry(struct pjsip_history_entry *entry, char *line, int
 		pj_sockaddr_print(&entry->src, addr, sizeof(addr), 3);
 	}
 
-	if (entry->msg->type == PJSIP_REQUEST_MSG) {
+	if (!msg) {
+		snprintf(line, len, "%-5.5d %-10.10ld %-5.5s %-24.24s (unable to parse %d bytes)",
+			entry->number,
+			entry->timestamp.tv_sec,
+			entry->transmitted ? "* ==>" : "* <==",
+			addr,
+			entry->len);
+	} else if (msg->type == PJSIP_REQUEST_MSG) {
 		char uri[128];
 
-		pjsip_uri_print(PJSIP_URI_IN_REQ_URI, entry->msg->line.req.uri, uri, sizeof(uri));
+		pjsip_uri_print(PJSIP_URI_IN_REQ_URI, msg->line.req.uri, uri, sizeof(uri));
 		snprintf(line, len, "%-5.5d %-10.10ld %-5.5s %-24.24s %.*s %s SIP/2.0",
 			entry->number,
 			entry->timestamp.tv_sec,
 			entry->transmitted ? "* ==>" : "* <==",
 			addr,
-			(int)pj_strlen(&entry->msg->line.req.method.name),
-			pj_strbuf(&entry->msg->line.req.method.name),
+			(int)pj_strlen(&msg->line.req.method.name),
+			pj_strbuf(&msg->line.req.method.name),
 			uri);
 	} else {
 		snprintf(line, len, "%-5.5d %-10.10ld %-5.5s %-24.24s SIP/2.0 %u %.*s",
@@ -683,9 +733,9 @@ static void sprint_list_entry(struct pjsip_history_entry *entry, char *line, int
 			entry->timestamp.tv_sec,
 			entry->transmitted ? "* ==>" : "* <==",
 			addr,
-			entry->msg->line.status.code,
-			(int)pj_strlen(&entry->msg->line.status.reason),
-			pj_strbuf(&entry->msg->line.status.reason));
+			msg->line.status.code,
+			(int)pj_strlen(&msg->line.status.reason),
+			pj_strbuf(&msg->line.status.reason));
 	}
 }
 
@@ -698,7 +748,7 @@ static pj_status_t history_on_tx_msg(pjsip_tx_data *tdata)
 		return PJ_SUCCESS;
 	}
 
-	entry = pjsip_history_entry_alloc(tdata->msg);
+	entry = pjsip_history_entry_alloc(tdata->buf.start, tdata->buf.cur - tdata->buf.start);
 	if (!entry) {
 		return PJ_SUCCESS;
 	}
@@ -706,16 +756,15 @@ static pj_status_t history_on_tx_msg(pjsip_tx_data *tdata)
 	pj_sockaddr_cp(&entry->src, &tdata->tp_info.transport->local_addr);
 	pj_sockaddr_cp(&entry->dst, &tdata->tp_info.dst_addr);
 
-	ast_mutex_lock(&history_lock);
-	AST_VECTOR_APPEND(&vector_history, entry);
-	ast_mutex_unlock(&history_lock);
+	history_append(entry);
 
 	if (log_level != -1) {
 		char line[256];
 
-		sprint_list_entry(entry, line, sizeof(line));
+		sprint_list_entry(entry, tdata->msg, line, sizeof(line));
 		ast_log_dynamic_level(log_level, "%s\n", line);
 	}
+	ao2_ref(entry, -1);
 
 	return PJ_SUCCESS;
 }
@@ -733,7 +782,7 @@ static pj_bool_t history_on_rx_msg(pjsip_rx_data *rdata)
 		return PJ_FALSE;
 	}
 
-	entry = pjsip_history_entry_alloc(rdata->msg_info.msg);
+	entry = pjsip_history_entry_alloc(rdata->msg_info.msg_buf, rdata->msg_info.len);
 	if (!entry) {
 		return PJ_FALSE;
 	}
@@ -746,16 +795,15 @@ static pj_bool_t history_on_rx_msg(pjsip_rx_data *rdata)
 		pj_sockaddr_cp(&entry->src, &rdata->pkt_info.src_addr);
 	}
 
-	ast_mutex_lock(&history_lock);
-	AST_VECTOR_APPEND(&vector_history, entry);
-	ast_mutex_unlock(&history_lock);
+	history_append(entry);
 
 	if (log_level != -1) {
 		char line[256];
 
-		sprint_list_entry(entry, line, sizeof(line));
+		sprint_list_entry(entry, rdata->msg_info.msg, line, sizeof(line));
 		ast_log_dynamic_level(log_level, "%s\n", line);
 	}
+	ao2_ref(entry, -1);
 
 	return PJ_FALSE;
 }
@@ -775,12 +823,86 @@ static int clear_history_entries(void *obj)
 {
 	ast_mutex_lock(&history_lock);
 	AST_VECTOR_RESET(&vector_history, clear_history_entry_cb);
+	history_oldest = 0;
 	packet_number = 0;
 	ast_mutex_unlock(&history_lock);
 
 	return 0;
 }
 
+/*!
+ * \brief Copy the references of the history, oldest entry first
+ *
+ * \retval NULL on error
+ * \retval A vector that must be cleaned up by \ref safe_vector_cleanup
+ */
+static struct vector_history_t *history_snapshot(void)
+{
+	struct vector_history_t *output;
+	int i;
+
+	output = ast_malloc(sizeof(*output));
+	if (!output) {
+		return NULL;
+	}
+
+	ast_mutex_lock(&history_lock);
+	if (AST_VECTOR_INIT(output, AST_VECTOR_SIZE(&vector_history))) {
+		ast_mutex_unlock(&history_lock);
+		ast_free(output);
+		return NULL;
+	}
+	for (i = 0; i < AST_VECTOR_SIZE(&vector_history); i++) {
+		AST_VECTOR_APPEND(output, ao2_bump(history_get(i)));
+	}
+	ast_mutex_unlock(&history_lock);
+
+	return output;
+}
+
+/*!
+ * \brief Parse the packet of an entry, if not done yet
+ *
+ * This must be called from a registered PJSIP thread
+ */
+static void parse_history_entry(struct pjsip_history_entry *entry)
+{
+	ao2_lock(entry);
+	if (!entry->pool) {
+		entry->pool = pj_pool_create(&cachingpool.factory, NULL, PJSIP_POOL_RDATA_LEN,
+		                             PJSIP_POOL_RDATA_INC, NULL);
+		if (entry->pool) {
+			entry->msg = pjsip_parse_msg(entry->pool, entry->packet, entry->len, NULL);
+		}
+	}
+	ao2_unlock(entry);
+}
+
+/*! \brief Parse the packets of a history vector, serviced on a registered PJSIP thread */
+static int parse_history_entries(void *obj)
+{
+	struct vector_history_t *vec = obj;
+	int i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(vec); i++) {
+		parse_history_entry(AST_VECTOR_GET(vec, i));
+	}
+
+	return 0;
+}
+
+/*! \brief Cleanup routine for a history vector, serviced on a registered PJSIP thread */
+static int safe_vector_cleanup(void *obj)
+{
+	struct vector_history_t *vec = obj;
+
+	AST_VECTOR_RESET(vec, clear_history_entry_cb);
+	AST_VECTOR_FREE(vec);
+	ast_free(vec);
+
+	return 0;
+}
+
 /*!
  * \brief Build a reverse polish notation expression queue
  *
@@ -1084,47 +1206,52 @@ error:
  */
 static struct vector_history_t *filter_history(struct ast_cli_args *a)
 {
+	struct vector_history_t *history;
 	struct vector_history_t *output;
 	struct expression_token *queue;
 	int i;
 
-	output = ast_malloc(sizeof(*output));
-	if (!output) {
+	queue = build_expression_queue(a);
+	if (!queue) {
 		return NULL;
 	}
 
-	if (AST_VECTOR_INIT(output, HISTORY_INITIAL_SIZE / 2)) {
-		ast_free(output);
+	history = history_snapshot();
+	if (!history) {
+		expression_token_free(queue);
 		return NULL;
 	}
+	ast_sip_push_task_synchronous(NULL, parse_history_entries, history);
 
-	queue = build_expression_queue(a);
-	if (!queue) {
+	output = ast_malloc(sizeof(*output));
+	if (!output || AST_VECTOR_INIT(output, HISTORY_INITIAL_SIZE / 2)) {
+		ast_free(output);
+		ast_sip_push_task(NULL, safe_vector_cleanup, history);
+		expression_token_free(queue);
 		return NULL;
 	}
 
-	ast_mutex_lock(&history_lock);
-	for (i = 0; i < AST_VECTOR_SIZE(&vector_history); i++) {
-		struct pjsip_history_entry *entry = AST_VECTOR_GET(&vector_history, i);
+	for (i = 0; i < AST_VECTOR_SIZE(history); i++) {
+		struct pjsip_history_entry *entry = AST_VECTOR_GET(history, i);
 		int res;
 
 		res = evaluate_history_entry(entry, queue);
 		if (res == -1) {
 			/* Error in expression evaluation; bail */
-			ast_mutex_unlock(&history_lock);
-			AST_VECTOR_RESET(output, clear_history_entry_cb);
-			AST_VECTOR_FREE(output);
-			ast_free(output);
-			expression_token_free(queue);
-			return NULL;
+			ast_sip_push_task(NULL, safe_vector_cleanup, output);
+			output = NULL;
+			break;
 		} else if (!res) {
 			continue;
 		} else {
-			AST_VECTOR_APPEND(output, ao2_bump(entry));
+			if (AST_VECTOR_APPEND(output, entry)) {
+				continue;
+			}
+			ao2_ref(entry, +1);
 		}
 	}
-	ast_mutex_unlock(&history_lock);
 
+	ast_sip_push_task(NULL, safe_vector_cleanup, history);
 	expression_token_free(queue);
 
 	return output;
@@ -1134,18 +1261,6 @@ static struct vector_history_t *filter_history(struct ast_cli_args *a)
 static void display_single_entry(struct ast_cli_args *a, struct pjsip_history_entry *entry)
 {
 	char addr[64];
-	char *buf;
-
-	buf = ast_calloc(1, PJSIP_MAX_PKT_LEN * sizeof(char));
-	if (!buf) {
-		return;
-	}
-
-	if (pjsip_msg_print(entry->msg, buf, PJSIP_MAX_PKT_LEN) == -1) {
-		ast_log(LOG_WARNING, "Unable to print SIP message %d: packet too large!\n", entry->number);
-		ast_free(buf);
-		return;
-	}
 
 	if (entry->transmitted) {
 		pj_sockaddr_print(&entry->dst, addr, sizeof(addr), 3);
@@ -1158,9 +1273,7 @@ static void display_single_entry(struct ast_cli_args *a, struct pjsip_history_en
 		entry->transmitted ? "Sent to" : "Received from",
 		addr,
 		entry->timestamp.tv_sec);
-	ast_cli(a->fd, "%s\n", buf);
-
-	ast_free(buf);
+	ast_cli(a->fd, "%s\n", entry->packet);
 }
 
 /*! \brief Print a list of the entries to the CLI */
@@ -1180,27 +1293,15 @@ static void display_entry_list(struct ast_cli_args *a, struct vector_history_t *
 		char line[256];
 
 		entry = AST_VECTOR_GET(vec, i);
-		sprint_list_entry(entry, line, sizeof(line));
+		sprint_list_entry(entry, entry->msg, line, sizeof(line));
 
 		ast_cli(a->fd, "%s\n", line);
 	}
 }
 
-/*! \brief Cleanup routine for a history vector, serviced on a registered PJSIP thread */
-static int safe_vector_cleanup(void *obj)
-{
-	struct vector_history_t *vec = obj;
-
-	AST_VECTOR_RESET(vec, clear_history_entry_cb);
-	AST_VECTOR_FREE(vec);
-	ast_free(vec);
-
-	return 0;
-}
-
 static char *pjsip_show_history(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
-	struct vector_history_t *vec = &vector_history;
+	struct vector_history_t *vec = NULL;
 	struct pjsip_history_entry *entry = NULL;
 
 	if (cmd == CLI_INIT) {
@@ -1241,15 +1342,20 @@ static char *pjsip_show_history(struct ast_cli_entry *e, int cmd, struct ast_cli
 				return CLI_FAILURE;
 			}
 
-			/* Get the entry at the provided position */
+			/* Get the entry with the provided number */
 			ast_mutex_lock(&history_lock);
-			if (num >= AST_VECTOR_SIZE(&vector_history) || num < 0) {
+			if (AST_VECTOR_SIZE(&vector_history)) {
+				int i = num - history_get(0)->number;
+
+				if (i >= 0 && i < AST_VECTOR_SIZE(&vector_history)) {
+					entry = ao2_bump(history_get(i));
+				}
+			}
+			ast_mutex_unlock(&history_lock);
+			if (!entry) {
 				ast_cli(a->fd, "Entry '%d' does not exist\n", num);
-				ast_mutex_unlock(&history_lock);
 				return CLI_FAILURE;
 			}
-			entry = ao2_bump(AST_VECTOR_GET(&vector_history, num));
-			ast_mutex_unlock(&history_lock);
 		} else if (!strcasecmp(a->argv[3], "where")) {
 			vec = filter_history(a);
 			if (!vec) {
@@ -1258,33 +1364,25 @@ static char *pjsip_show_history(struct ast_cli_entry *e, int cmd, struct ast_cli
 		} else {
 			return CLI_SHOWUSAGE;
 		}
+	} else {
+		vec = history_snapshot();
+		if (!vec) {
+			return CLI_FAILURE;
+		}
+		ast_sip_push_task_synchronous(NULL, parse_history_entries, vec);
 	}
 
-	if (AST_VECTOR_SIZE(vec) == 1) {
-		if (vec == &vector_history) {
-			ast_mutex_lock(&history_lock);
-		}
+	if (vec && AST_VECTOR_SIZE(vec) == 1) {
 		entry = ao2_bump(AST_VECTOR_GET(vec, 0));
-		if (vec == &vector_history) {
-			ast_mutex_lock(&history_lock);
-		}
 	}
 
 	if (entry) {
 		display_single_entry(a, entry);
 	} else {
-		if (vec == &vector_history) {
-			ast_mutex_lock(&history_lock);
-		}
-
 		display_entry_list(a, vec);
-
-		if (vec == &vector_history) {
-			ast_mutex_unlock(&history_lock);
-		}
 	}
 
-	if (vec != &vector_history) {
+	if (vec) {
 		ast_sip_push_task(NULL, safe_vector_cleanup, vec);
 	}
 	ao2_cleanup(entry);
@@ -1305,9 +1403,9 @@ static char *pjsip_set_history(struct ast_cli_entry *e, int cmd, struct ast_cli_
 			"       packets. Disabling the history will stop recording, but keep\n"
 			"       the already received packets. Clearing the history will wipe\n"
 			"       the received packets from memory.\n\n"
-			"       As the PJSIP history is maintained in memory, and includes\n"
-			"       all received/transmitted requests and responses, it should\n"
-			"       only be enabled for debugging purposes, and cleared when done.\n";
+			"       The PJSIP history is maintained in memory and keeps the\n"
+			"       last 10000 received/transmitted requests and responses, as\n"
+			"       they were on the wire. They are only parsed when shown.\n";
 		return NULL;
 	} else if (cmd == CLI_GENERATE) {
 		return NULL;
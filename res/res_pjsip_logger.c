@@ -68,10 +68,16 @@ static int ast_sockaddr_resolve_first_af(struct ast_sockaddr *addr,
 	return 0;
 }
 
-/*! \brief See if we pass debug IP filter */
-static inline int pjsip_log_test_addr(const char *address, int port)
+/*!
+ * \brief See if we pass debug IP filter
+ *
+ * The address is compared as the transport gave it, before anything about
+ * the message is formatted.
+ */
+static inline int pjsip_log_test_addr(const pj_sockaddr *address, int address_len)
 {
 	struct ast_sockaddr test_addr;
+
 	if (logging_mode == LOGGING_MODE_DISABLED) {
 		return 0;
 	}
@@ -82,12 +88,12 @@ static inline int pjsip_log_test_addr(const char *address, int port)
 	}
 
 	/* A null address was passed in. Just reject it. */
-	if (ast_strlen_zero(address)) {
+	if (address_len <= 0 || address_len > sizeof(test_addr.ss)) {
 		return 0;
 	}
 
-	ast_sockaddr_parse(&test_addr, address, PARSE_PORT_IGNORE);
-	ast_sockaddr_set_port(&test_addr, port);
+	memcpy(&test_addr.ss, address, address_len);
+	test_addr.len = address_len;
 
 	/* If no port was specified for a debug address, just compare the
 	 * addresses, otherwise compare the address and port
@@ -101,7 +107,7 @@ static inline int pjsip_log_test_addr(const char *address, int port)
 
 static pj_status_t logging_on_tx_msg(pjsip_tx_data *tdata)
 {
-	if (!pjsip_log_test_addr(tdata->tp_info.dst_name, tdata->tp_info.dst_port)) {
+	if (!pjsip_log_test_addr(&tdata->tp_info.dst_addr, tdata->tp_info.dst_addr_len)) {
 		return PJ_SUCCESS;
 	}
 
@@ -117,7 +123,7 @@ static pj_status_t logging_on_tx_msg(pjsip_tx_data *tdata)
 
 static pj_bool_t logging_on_rx_msg(pjsip_rx_data *rdata)
 {
-	if (!pjsip_log_test_addr(rdata->pkt_info.src_name, rdata->pkt_info.src_port)) {
+	if (!pjsip_log_test_addr(&rdata->pkt_info.src_addr, rdata->pkt_info.src_addr_len)) {
 		return PJ_FALSE;
 	}
 
@@ -43,6 +43,9 @@
 struct mwi_subscription;
 static struct ao2_container *unsolicited_mwi;
 
+/*! Container of \ref mwi_mailbox structures, by mailbox */
+static struct ao2_container *mwi_mailboxes;
+
 static char *default_voicemail_extension;
 
 #define STASIS_BUCKETS 13
@@ -82,15 +85,30 @@ static struct ast_sip_subscription_handler mwi_handler = {
 	.notifier = &mwi_notifier,
 };
 
+/*!
+ * \brief The one stasis subscription to the MWI state of a mailbox
+ *
+ * It is shared by every MWI subscription for the mailbox, so a mailbox
+ * that many endpoints watch is still subscribed to once.
+ */
+struct mwi_mailbox {
+	/*! The MWI stasis subscription, which holds a reference to this */
+	struct stasis_subscription *stasis_sub;
+	/*! The \ref mwi_subscription structures for the mailbox */
+	struct ao2_container *subscribers;
+	/*! The mailbox. Used as a hash key */
+	char mailbox[1];
+};
+
 /*!
  * \brief Wrapper for stasis subscription
  *
  * An MWI subscription has a container of these. This
- * represents a stasis subscription for MWI state.
+ * represents the subscription to the MWI state of one mailbox.
  */
 struct mwi_stasis_subscription {
-	/*! The MWI stasis subscription */
-	struct stasis_subscription *stasis_sub;
+	/*! The shared subscription to the mailbox, NULL once unsubscribed */
+	struct mwi_mailbox *mailbox_sub;
 	/*! The mailbox corresponding with the MWI subscription. Used as a hash key */
 	char mailbox[1];
 };
@@ -103,8 +121,8 @@ struct mwi_stasis_subscription {
  *
  * This structure acts as the owner for the underlying SIP subscription.
  * When the mwi_subscription is destroyed, the SIP subscription dies, too.
- * The mwi_subscription's lifetime is governed by its underlying stasis
- * subscriptions. When all stasis subscriptions are destroyed, the
+ * The mwi_subscription's lifetime is governed by the mailboxes it is for.
+ * When it has been removed from the subscribers of all of them, the
  * mwi_subscription is destroyed as well.
  */
 struct mwi_subscription {
@@ -119,6 +137,8 @@ struct mwi_subscription {
 	char *aors;
 	/*! Is the MWI solicited (i.e. Initiated with an external SUBSCRIBE) ? */
 	unsigned int is_solicited;
+	/*! A NOTIFY is queued and not sent yet, guarded by the object lock */
+	unsigned int notify_pending;
 	/*! Identifier for the subscription.
 	 * The identifier is the same as the corresponding endpoint's stasis ID.
 	 * Used as a hash key
@@ -240,10 +260,104 @@ static int mwi_serializer_set_alert_levels(void)
 static void mwi_stasis_cb(void *userdata, struct stasis_subscription *sub,
 		struct stasis_message *msg);
 
+static void mwi_mailbox_destructor(void *obj)
+{
+	struct mwi_mailbox *mailbox_sub = obj;
+
+	ao2_cleanup(mailbox_sub->subscribers);
+}
+
+AO2_STRING_FIELD_HASH_FN(mwi_mailbox, mailbox);
+AO2_STRING_FIELD_CMP_FN(mwi_mailbox, mailbox);
+
+/*!
+ * \internal
+ * \brief Add an MWI subscription to the subscribers of a mailbox
+ *
+ * The stasis subscription to the mailbox is created for its first
+ * subscriber.
+ *
+ * \retval The mailbox, with a reference for the caller
+ * \retval NULL on error
+ */
+static struct mwi_mailbox *mwi_mailbox_subscribe(const char *mailbox, struct mwi_subscription *mwi_sub)
+{
+	struct mwi_mailbox *mailbox_sub;
+
+	ao2_lock(mwi_mailboxes);
+	mailbox_sub = ao2_find(mwi_mailboxes, mailbox, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!mailbox_sub) {
+		mailbox_sub = ao2_alloc(sizeof(*mailbox_sub) + strlen(mailbox), mwi_mailbox_destructor);
+		if (!mailbox_sub) {
+			ao2_unlock(mwi_mailboxes);
+			return NULL;
+		}
+
+		/* Safe strcpy */
+		strcpy(mailbox_sub->mailbox, mailbox);
+
+		mailbox_sub->subscribers = ao2_container_alloc_list(AO2_ALLOC_OPT_LOCK_MUTEX, 0, NULL, NULL);
+		if (!mailbox_sub->subscribers) {
+			ao2_unlock(mwi_mailboxes);
+			ao2_ref(mailbox_sub, -1);
+			return NULL;
+		}
+
+		ast_debug(3, "Creating stasis MWI subscription to mailbox %s\n", mailbox);
+		ao2_ref(mailbox_sub, +1);
+		mailbox_sub->stasis_sub = stasis_subscribe_pool(ast_mwi_topic(mailbox), mwi_stasis_cb, mailbox_sub);
+		if (!mailbox_sub->stasis_sub) {
+			/* Failed to subscribe. */
+			ao2_unlock(mwi_mailboxes);
+			ao2_ref(mailbox_sub, -2);
+			return NULL;
+		}
+		ao2_link_flags(mwi_mailboxes, mailbox_sub, OBJ_NOLOCK);
+	}
+
+	ast_debug(3, "Adding endpoint %s to the subscribers of mailbox %s\n", mwi_sub->id, mailbox);
+	ao2_link(mailbox_sub->subscribers, mwi_sub);
+	ao2_unlock(mwi_mailboxes);
+
+	return mailbox_sub;
+}
+
+static int mwi_subscriber_match(void *obj, void *arg, int flags)
+{
+	return obj == arg ? CMP_MATCH | CMP_STOP : 0;
+}
+
+static int serialized_cleanup(void *userdata);
+
+/*!
+ * \internal
+ * \brief Remove an MWI subscription from the subscribers of a mailbox
+ *
+ * The stasis subscription to the mailbox goes with its last subscriber.
+ */
+static void mwi_mailbox_unsubscribe(struct mwi_mailbox *mailbox_sub, struct mwi_subscription *mwi_sub)
+{
+	struct mwi_subscription *removed;
+
+	ao2_lock(mwi_mailboxes);
+	removed = ao2_callback(mailbox_sub->subscribers, OBJ_UNLINK, mwi_subscriber_match, mwi_sub);
+	if (!ao2_container_count(mailbox_sub->subscribers) && mailbox_sub->stasis_sub) {
+		ast_debug(3, "Removing stasis subscription to mailbox %s\n", mailbox_sub->mailbox);
+		ao2_unlink_flags(mwi_mailboxes, mailbox_sub, OBJ_NOLOCK);
+		/* The final message releases the reference held by the subscription */
+		mailbox_sub->stasis_sub = stasis_unsubscribe(mailbox_sub->stasis_sub);
+	}
+	ao2_unlock(mwi_mailboxes);
+
+	/* The last reference to an MWI subscription must go on a SIP thread */
+	if (removed && ast_sip_push_task(NULL, serialized_cleanup, removed)) {
+		ao2_ref(removed, -1);
+	}
+}
+
 static struct mwi_stasis_subscription *mwi_stasis_subscription_alloc(const char *mailbox, struct mwi_subscription *mwi_sub)
 {
 	struct mwi_stasis_subscription *mwi_stasis_sub;
-	struct stasis_topic *topic;
 
 	if (!mwi_sub) {
 		return NULL;
@@ -254,19 +368,13 @@ static struct mwi_stasis_subscription *mwi_stasis_subscription_alloc(const char
 		return NULL;
 	}
 
-	topic = ast_mwi_topic(mailbox);
-
 	/* Safe strcpy */
 	strcpy(mwi_stasis_sub->mailbox, mailbox);
 
-	ast_debug(3, "Creating stasis MWI subscription to mailbox %s for endpoint %s\n",
-		mailbox, mwi_sub->id);
-	ao2_ref(mwi_sub, +1);
-	mwi_stasis_sub->stasis_sub = stasis_subscribe_pool(topic, mwi_stasis_cb, mwi_sub);
-	if (!mwi_stasis_sub->stasis_sub) {
+	mwi_stasis_sub->mailbox_sub = mwi_mailbox_subscribe(mailbox, mwi_sub);
+	if (!mwi_stasis_sub->mailbox_sub) {
 		/* Failed to subscribe. */
 		ao2_ref(mwi_stasis_sub, -1);
-		ao2_ref(mwi_sub, -1);
 		mwi_stasis_sub = NULL;
 	}
 	return mwi_stasis_sub;
@@ -674,12 +782,21 @@ static void send_mwi_notify(struct mwi_subscription *sub)
 	send_unsolicited_mwi_notify(sub, &counter);
 }
 
+/*!
+ * \brief Unsubscribe an MWI subscription from one of its mailboxes
+ *
+ * \param obj The \ref mwi_stasis_subscription
+ * \param arg The \ref mwi_subscription it belongs to
+ */
 static int unsubscribe_stasis(void *obj, void *arg, int flags)
 {
 	struct mwi_stasis_subscription *mwi_stasis = obj;
-	if (mwi_stasis->stasis_sub) {
-		ast_debug(3, "Removing stasis subscription to mailbox %s\n", mwi_stasis->mailbox);
-		mwi_stasis->stasis_sub = stasis_unsubscribe_and_join(mwi_stasis->stasis_sub);
+	struct mwi_subscription *mwi_sub = arg;
+
+	if (mwi_stasis->mailbox_sub) {
+		mwi_mailbox_unsubscribe(mwi_stasis->mailbox_sub, mwi_sub);
+		ao2_ref(mwi_stasis->mailbox_sub, -1);
+		mwi_stasis->mailbox_sub = NULL;
 	}
 	return CMP_MATCH;
 }
@@ -695,7 +812,7 @@ static void mwi_subscription_shutdown(struct ast_sip_subscription *sub)
 	}
 
 	mwi_sub = mwi_datastore->data;
-	ao2_callback(mwi_sub->stasis_subs, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, unsubscribe_stasis, NULL);
+	ao2_callback(mwi_sub->stasis_subs, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, unsubscribe_stasis, mwi_sub);
 	ast_sip_subscription_remove_datastore(sub, MWI_DATASTORE);
 
 	ao2_ref(mwi_datastore, -1);
@@ -760,7 +877,7 @@ static int endpoint_receives_unsolicited_mwi_for_mailbox(struct ast_sip_endpoint
 		mwi_stasis = ao2_find(mwi_sub->stasis_subs, mailbox, OBJ_SEARCH_KEY);
 		if (mwi_stasis) {
 			if (endpoint->subscription.mwi.subscribe_replaces_unsolicited) {
-				unsubscribe_stasis(mwi_stasis, NULL, 0);
+				unsubscribe_stasis(mwi_stasis, mwi_sub, 0);
 				ao2_unlink(mwi_sub->stasis_subs, mwi_stasis);
 			} else {
 				ret = 1;
@@ -1039,21 +1156,49 @@ static int serialized_notify(void *userdata)
 {
 	struct mwi_subscription *mwi_sub = userdata;
 
+	/* Changes from now on need another NOTIFY */
+	ao2_lock(mwi_sub);
+	mwi_sub->notify_pending = 0;
+	ao2_unlock(mwi_sub);
+
 	send_mwi_notify(mwi_sub);
 	ao2_ref(mwi_sub, -1);
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Queue a NOTIFY for an MWI subscription unless one is already queued
+ *
+ * The NOTIFY reports the message counts as they are when it is sent, so a
+ * queued one covers every change made before it runs.  A burst of updates,
+ * such as the mailboxes of a subscription changing together or all of them
+ * at startup, is sent as one NOTIFY per subscription.
+ */
+static void queue_notify(struct mwi_subscription *mwi_sub, struct ast_taskprocessor *serializer)
+{
+	ao2_lock(mwi_sub);
+	if (mwi_sub->notify_pending) {
+		ao2_unlock(mwi_sub);
+		return;
+	}
+	mwi_sub->notify_pending = 1;
+	ao2_unlock(mwi_sub);
+
+	if (ast_sip_push_task(serializer, serialized_notify, ao2_bump(mwi_sub))) {
+		ao2_lock(mwi_sub);
+		mwi_sub->notify_pending = 0;
+		ao2_unlock(mwi_sub);
+		ao2_ref(mwi_sub, -1);
+	}
+}
+
 static int serialized_cleanup(void *userdata)
 {
 	struct mwi_subscription *mwi_sub = userdata;
 
-	/* This is getting rid of the reference that was added
-	 * just before this serialized task was pushed.
-	 */
-	ao2_cleanup(mwi_sub);
 	/* This is getting rid of the reference held by the
-	 * stasis subscription
+	 * subscribers of a mailbox
 	 */
 	ao2_cleanup(mwi_sub);
 	return 0;
@@ -1066,9 +1211,7 @@ static int send_notify(void *obj, void *arg, int flags)
 		? ast_sip_subscription_get_serializer(mwi_sub->sip_sub)
 		: get_mwi_serializer();
 
-	if (ast_sip_push_task(serializer, serialized_notify, ao2_bump(mwi_sub))) {
-		ao2_ref(mwi_sub, -1);
-	}
+	queue_notify(mwi_sub, serializer);
 
 	return 0;
 }
@@ -1076,17 +1219,15 @@ static int send_notify(void *obj, void *arg, int flags)
 static void mwi_stasis_cb(void *userdata, struct stasis_subscription *sub,
 		struct stasis_message *msg)
 {
-	struct mwi_subscription *mwi_sub = userdata;
+	struct mwi_mailbox *mailbox_sub = userdata;
 
 	if (stasis_subscription_final_message(sub, msg)) {
-		if (ast_sip_push_task(NULL, serialized_cleanup, ao2_bump(mwi_sub))) {
-			ao2_ref(mwi_sub, -1);
-		}
+		ao2_ref(mailbox_sub, -1);
 		return;
 	}
 
 	if (ast_mwi_state_type() == stasis_message_type(msg)) {
-		send_notify(mwi_sub, NULL, 0);
+		ao2_callback(mailbox_sub->subscribers, OBJ_NODATA | OBJ_MULTIPLE, send_notify, NULL);
 	}
 }
 
@@ -1147,7 +1288,7 @@ static int unsubscribe(void *obj, void *arg, int flags)
 {
 	struct mwi_subscription *mwi_sub = obj;
 
-	ao2_callback(mwi_sub->stasis_subs, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, unsubscribe_stasis, NULL);
+	ao2_callback(mwi_sub->stasis_subs, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, unsubscribe_stasis, mwi_sub);
 
 	return CMP_MATCH;
 }
@@ -1191,9 +1332,7 @@ static int send_contact_notify(void *obj, void *arg, int flags)
 		return 0;
 	}
 
-	if (ast_sip_push_task(get_mwi_serializer(), serialized_notify, ao2_bump(mwi_sub))) {
-		ao2_ref(mwi_sub, -1);
-	}
+	queue_notify(mwi_sub, get_mwi_serializer());
 
 	return 0;
 }
@@ -1349,9 +1488,19 @@ static int load_module(void)
 		ast_log(AST_LOG_WARNING, "Failed to create MWI serializer pool. The default SIP pool will be used for MWI\n");
 	}
 
+	mwi_mailboxes = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, MWI_BUCKETS,
+		mwi_mailbox_hash_fn, NULL, mwi_mailbox_cmp_fn);
+	if (!mwi_mailboxes) {
+		mwi_serializer_pool_shutdown();
+		ast_sip_unregister_subscription_handler(&mwi_handler);
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
 	unsolicited_mwi = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, MWI_BUCKETS,
 		mwi_sub_hash, NULL, mwi_sub_cmp);
 	if (!unsolicited_mwi) {
+		ao2_ref(mwi_mailboxes, -1);
+		mwi_mailboxes = NULL;
 		mwi_serializer_pool_shutdown();
 		ast_sip_unregister_subscription_handler(&mwi_handler);
 		return AST_MODULE_LOAD_DECLINE;
@@ -1381,6 +1530,8 @@ static int unload_module(void)
 	ao2_callback(unsolicited_mwi, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, unsubscribe, NULL);
 	ao2_ref(unsolicited_mwi, -1);
 	unsolicited_mwi = NULL;
+	ao2_ref(mwi_mailboxes, -1);
+	mwi_mailboxes = NULL;
 
 	mwi_serializer_pool_shutdown();
 
@@ -32,6 +32,9 @@
 #include "asterisk/module.h"
 #include "asterisk/acl.h"
 
+/*! \brief The registered NAT hooks, refreshed as hooks are created and deleted */
+static AO2_GLOBAL_OBJ_STATIC(nat_hooks);
+
 static void rewrite_uri(pjsip_rx_data *rdata, pjsip_sip_uri *uri)
 {
 	pj_cstr(&uri->host, rdata->pkt_info.src_name);
@@ -215,6 +218,14 @@ static pj_status_t nat_on_tx_message(pjsip_tx_data *tdata)
 	pjsip_sip_uri *uri = NULL;
 	RAII_VAR(struct ao2_container *, hooks, NULL, ao2_cleanup);
 
+	/*
+	 * A message still printed from an earlier send, such as a
+	 * retransmission, was already rewritten and is sent as is.
+	 */
+	if (pjsip_tx_data_is_valid(tdata)) {
+		return PJ_SUCCESS;
+	}
+
 	/* If a transport selector is in use we know the transport or factory, so explicitly find it */
 	if (tdata->tp_sel.type == PJSIP_TPSELECTOR_TRANSPORT) {
 		details.transport = tdata->tp_sel.u.transport;
@@ -293,7 +304,7 @@ static pj_status_t nat_on_tx_message(pjsip_tx_data *tdata)
 	}
 
 	/* Invoke any additional hooks that may be registered */
-	if ((hooks = ast_sorcery_retrieve_by_fields(ast_sip_get_sorcery(), "nat_hook", AST_RETRIEVE_FLAG_MULTIPLE | AST_RETRIEVE_FLAG_ALL, NULL))) {
+	if ((hooks = ao2_global_obj_ref(nat_hooks))) {
 		struct nat_hook_details hook_details = {
 			.tdata = tdata,
 			.transport = transport,
@@ -301,6 +312,9 @@ static pj_status_t nat_on_tx_message(pjsip_tx_data *tdata)
 		ao2_callback(hooks, 0, nat_invoke_hook, &hook_details);
 	}
 
+	/* The message is printed once, after every module has rewritten it */
+	pjsip_tx_data_invalidate_msg(tdata);
+
 	return PJ_SUCCESS;
 }
 
@@ -348,10 +362,33 @@ static struct ast_sip_session_supplement nat_supplement = {
 };
 
 
+/*! \brief Retrieve the registered NAT hooks again */
+static void nat_hooks_refresh(void)
+{
+	struct ao2_container *hooks;
+
+	hooks = ast_sorcery_retrieve_by_fields(ast_sip_get_sorcery(), "nat_hook",
+		AST_RETRIEVE_FLAG_MULTIPLE | AST_RETRIEVE_FLAG_ALL, NULL);
+	ao2_global_obj_replace_unref(nat_hooks, hooks);
+	ao2_cleanup(hooks);
+}
+
+static void nat_hook_changed(const void *object)
+{
+	nat_hooks_refresh();
+}
+
+static const struct ast_sorcery_observer nat_hook_observer = {
+	.created = nat_hook_changed,
+	.deleted = nat_hook_changed,
+};
+
 static int unload_module(void)
 {
 	ast_sip_session_unregister_supplement(&nat_supplement);
 	ast_sip_unregister_service(&nat_module);
+	ast_sorcery_observer_remove(ast_sip_get_sorcery(), "nat_hook", &nat_hook_observer);
+	ao2_global_obj_release(nat_hooks);
 	return 0;
 }
 
@@ -359,8 +396,17 @@ static int load_module(void)
 {
 	CHECK_PJSIP_SESSION_MODULE_LOADED();
 
+	/* Observe first so a hook created meanwhile is not missed */
+	if (ast_sorcery_observer_add(ast_sip_get_sorcery(), "nat_hook", &nat_hook_observer)) {
+		ast_log(LOG_ERROR, "Could not observe NAT hooks\n");
+		return AST_MODULE_LOAD_DECLINE;
+	}
+	nat_hooks_refresh();
+
 	if (ast_sip_register_service(&nat_module)) {
 		ast_log(LOG_ERROR, "Could not register NAT module for incoming and outgoing requests\n");
+		ast_sorcery_observer_remove(ast_sip_get_sorcery(), "nat_hook", &nat_hook_observer);
+		ao2_global_obj_release(nat_hooks);
 		return AST_MODULE_LOAD_DECLINE;
 	}
 
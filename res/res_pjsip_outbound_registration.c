@@ -374,6 +374,21 @@ struct sip_outbound_registration_state {
 /*! Shutdown group to monitor sip_outbound_registration_client_state serializers. */
 static struct ast_serializer_shutdown_group *shutdown_group;
 
+/*! Number of serializers shared by the registrations */
+#define REGISTRATION_SERIALIZER_POOL_SIZE 16
+
+/*! Serializers shared by the registrations, each one on the same for its lifetime */
+static struct ast_taskprocessor *registration_serializer_pool[REGISTRATION_SERIALIZER_POOL_SIZE];
+
+/*! Registrations started per second when many of them start together */
+#define REGISTRATION_START_RATE 100
+
+/*! Mutex that protects \ref registration_next_start */
+AST_MUTEX_DEFINE_STATIC(registration_start_lock);
+
+/*! Earliest time the next registration may start at */
+static struct timeval registration_next_start;
+
 /*! \brief Default number of state container buckets */
 #define DEFAULT_STATE_BUCKETS 53
 static AO2_GLOBAL_OBJ_STATIC(current_states);
@@ -616,19 +631,19 @@ static void sip_outbound_registration_timer_cb(pj_timer_heap_t *timer_heap, stru
 	}
 }
 
-/*! \brief Helper function which sets up the timer to re-register in a specific amount of time */
-static void schedule_registration(struct sip_outbound_registration_client_state *client_state, unsigned int seconds)
+/*! \brief Helper function which sets up the timer to re-register after a delay in milliseconds */
+static void schedule_registration_ms(struct sip_outbound_registration_client_state *client_state, unsigned int ms)
 {
-	pj_time_val delay = { .sec = seconds, };
+	pj_time_val delay = { .sec = ms / 1000, .msec = ms % 1000, };
 	pjsip_regc_info info;
 
 	cancel_registration(client_state);
 
 	pjsip_regc_get_info(client_state->client, &info);
-	ast_debug(1, "Scheduling outbound registration to server '%.*s' from client '%.*s' in %d seconds\n",
+	ast_debug(1, "Scheduling outbound registration to server '%.*s' from client '%.*s' in %u ms\n",
 			(int) info.server_uri.slen, info.server_uri.ptr,
 			(int) info.client_uri.slen, info.client_uri.ptr,
-			seconds);
+			ms);
 
 	ao2_ref(client_state, +1);
 	if (pjsip_endpt_schedule_timer(ast_sip_get_pjsip_endpoint(), &client_state->timer, &delay) != PJ_SUCCESS) {
@@ -639,6 +654,37 @@ static void schedule_registration(struct sip_outbound_registration_client_state
 	}
 }
 
+/*! \brief Helper function which sets up the timer to re-register in a specific amount of time */
+static void schedule_registration(struct sip_outbound_registration_client_state *client_state, unsigned int seconds)
+{
+	schedule_registration_ms(client_state, seconds * 1000);
+}
+
+/*!
+ * \brief Pick how many milliseconds to wait before starting a registration
+ *
+ * Each registration starts 1 to 10 seconds after its turn, and turns are
+ * given out at most \ref REGISTRATION_START_RATE per second, so that
+ * loading thousands of registrations does not send all of their
+ * REGISTERs at once.
+ */
+static unsigned int registration_start_delay(void)
+{
+	struct timeval now = ast_tvnow();
+	unsigned int turn;
+
+	ast_mutex_lock(&registration_start_lock);
+	if (ast_tvcmp(registration_next_start, now) < 0) {
+		registration_next_start = now;
+	}
+	turn = ast_tvdiff_ms(registration_next_start, now);
+	registration_next_start = ast_tvadd(registration_next_start,
+		ast_samp2tv(1, REGISTRATION_START_RATE));
+	ast_mutex_unlock(&registration_start_lock);
+
+	return turn + 1000 + ast_random() % 9000;
+}
+
 static void update_client_state_status(struct sip_outbound_registration_client_state *client_state, enum sip_outbound_registration_status status)
 {
 	const char *status_old;
@@ -1019,7 +1065,7 @@ static void sip_outbound_registration_client_state_destroy(void *obj)
 static struct sip_outbound_registration_state *sip_outbound_registration_state_alloc(struct sip_outbound_registration *registration)
 {
 	struct sip_outbound_registration_state *state;
-	char tps_name[AST_TASKPROCESSOR_MAX_NAME + 1];
+	const char *id = ast_sorcery_object_get_id(registration);
 
 	state = ao2_alloc(sizeof(*state), sip_outbound_registration_state_destroy);
 	if (!state) {
@@ -1032,12 +1078,8 @@ static struct sip_outbound_registration_state *sip_outbound_registration_state_a
 		return NULL;
 	}
 
-	/* Create name with seq number appended. */
-	ast_taskprocessor_build_name(tps_name, sizeof(tps_name), "pjsip/outreg/%s",
-		ast_sorcery_object_get_id(registration));
-
-	state->client_state->serializer = ast_sip_create_serializer_group_named(tps_name,
-		shutdown_group);
+	state->client_state->serializer = ao2_bump(registration_serializer_pool[
+		ast_str_hash(id) % REGISTRATION_SERIALIZER_POOL_SIZE]);
 	if (!state->client_state->serializer) {
 		ao2_cleanup(state);
 		return NULL;
@@ -1305,7 +1347,7 @@ static int sip_outbound_registration_perform(void *data)
 
 	pjsip_regc_update_expires(state->client_state->client, registration->expiration);
 
-	schedule_registration(state->client_state, (ast_random() % 10) + 1);
+	schedule_registration_ms(state->client_state, registration_start_delay());
 
 	ao2_ref(registration, -1);
 	ao2_ref(state, -1);
@@ -2030,6 +2072,42 @@ static void network_change_stasis_cb(void *data, struct stasis_subscription *sub
 	reregister_all();
 }
 
+/*! \brief Release the module's references to the registration serializers */
+static void registration_serializer_pool_shutdown(void)
+{
+	int idx;
+
+	for (idx = 0; idx < REGISTRATION_SERIALIZER_POOL_SIZE; ++idx) {
+		ast_taskprocessor_unreference(registration_serializer_pool[idx]);
+		registration_serializer_pool[idx] = NULL;
+	}
+}
+
+/*!
+ * \brief Create the registration serializers
+ *
+ * \retval 0 on success.
+ * \retval -1 on error.
+ */
+static int registration_serializer_pool_setup(void)
+{
+	char tps_name[AST_TASKPROCESSOR_MAX_NAME + 1];
+	int idx;
+
+	for (idx = 0; idx < REGISTRATION_SERIALIZER_POOL_SIZE; ++idx) {
+		/* Create name with seq number appended. */
+		ast_taskprocessor_build_name(tps_name, sizeof(tps_name), "pjsip/outreg");
+
+		registration_serializer_pool[idx] = ast_sip_create_serializer_group_named(tps_name,
+			shutdown_group);
+		if (!registration_serializer_pool[idx]) {
+			registration_serializer_pool_shutdown();
+			return -1;
+		}
+	}
+	return 0;
+}
+
 static int unload_module(void)
 {
 	int remaining;
@@ -2053,6 +2131,9 @@ static int unload_module(void)
 
 	ao2_global_obj_release(current_states);
 
+	/* The serializers go once the last registration using them is destroyed */
+	registration_serializer_pool_shutdown();
+
 	/* Wait for registration serializers to get destroyed. */
 	ast_debug(2, "Waiting for registration transactions to complete for unload.\n");
 	remaining = ast_serializer_shutdown_group_join(shutdown_group, MAX_UNLOAD_TIMEOUT_TIME);
@@ -2086,6 +2167,12 @@ static int load_module(void)
 		return AST_MODULE_LOAD_DECLINE;
 	}
 
+	if (registration_serializer_pool_setup()) {
+		ast_log(LOG_ERROR, "Unable to create outbound registration serializers\n");
+		unload_module();
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
 	/* Create outbound registration states container. */
 	new_states = ao2_container_alloc(DEFAULT_STATE_BUCKETS,
 		registration_state_hash, registration_state_cmp);
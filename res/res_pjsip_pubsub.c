@@ -44,8 +44,10 @@
 #include "asterisk/manager.h"
 #include "asterisk/cli.h"
 #include "asterisk/test.h"
+#include "asterisk/threadstorage.h"
 #include "res_pjsip/include/res_pjsip_private.h"
 #include "asterisk/res_pjsip_presence_xml.h"
+#include "asterisk/res_pjsip_body_generator_types.h"
 
 /*** DOCUMENTATION
 	<manager name="PJSIPShowSubscriptionsInbound" language="en_US">
@@ -238,6 +240,33 @@ static struct ast_sched_context *sched;
 /*! \brief Number of buckets for subscription datastore */
 #define DATASTORE_BUCKETS 53
 
+/*! \brief Number of buckets for shared bodies */
+#define SHARED_BODY_BUCKETS 257
+
+/*! \brief Number of shared bodies kept before the cache is emptied */
+#define SHARED_BODY_MAX 4096
+
+/*! \brief Placeholders generated in place of the per-dialog parts of a shared body */
+#define SHARED_BODY_LOCAL "\x1elocal\x1e"
+#define SHARED_BODY_REMOTE "\x1eremote\x1e"
+
+/*!
+ * \brief Body text shared between subscriptions
+ *
+ * Extension state bodies are generated once for each resource, state and
+ * content type, with placeholders in place of the per-dialog parts. They are
+ * keyed on everything else that goes into them.
+ */
+struct shared_body {
+	/*! Body text, with placeholders */
+	char *text;
+	/*! Key the body is shared under */
+	char key[0];
+};
+
+/*! \brief Bodies shared between subscriptions */
+static struct ao2_container *shared_bodies;
+
 /*! \brief Default expiration for subscriptions */
 #define DEFAULT_EXPIRES 3600
 
@@ -1818,6 +1847,12 @@ struct ast_taskprocessor *ast_sip_subscription_get_serializer(struct ast_sip_sub
 	return sub->tree->serializer;
 }
 
+/*! \brief Largest buffer allocated for an outgoing subscription request */
+#define TDATA_MAX_BUF_LEN 64000
+
+/*! \brief Scratch buffer outgoing subscription requests are measured in */
+AST_THREADSTORAGE(tdata_print_buf);
+
 /*!
  * \brief Pre-allocate a buffer for the transmission
  *
@@ -1831,6 +1866,10 @@ struct ast_taskprocessor *ast_sip_subscription_get_serializer(struct ast_sip_sub
  * we instead take the strategy of pre-allocating the buffer, testing for ourselves
  * if the message will fit, and resizing the buffer as required.
  *
+ * The message is measured by printing it to a per-thread scratch buffer, so the
+ * pool of the tdata only grows once, by the size the message needs, rather than
+ * by every size tried.
+ *
  * RFC 3261 says that a SIP UDP request can be up to 65535 bytes long. We're capping
  * it at 64000 for a couple of reasons:
  * 1) Allocating more than 64K at a time is hard to justify
@@ -1848,18 +1887,33 @@ struct ast_taskprocessor *ast_sip_subscription_get_serializer(struct ast_sip_sub
 static int allocate_tdata_buffer(pjsip_tx_data *tdata)
 {
 	int buf_size;
-	int size = -1;
+	int size;
 	char *buf;
 
-	for (buf_size = PJSIP_MAX_PKT_LEN; size == -1 && buf_size < 64000; buf_size *= 2) {
-		buf = pj_pool_alloc(tdata->pool, buf_size);
-		size = pjsip_msg_print(tdata->msg, buf, buf_size);
+	buf = ast_threadstorage_get(&tdata_print_buf, TDATA_MAX_BUF_LEN);
+	if (!buf) {
+		return -1;
 	}
 
+	size = pjsip_msg_print(tdata->msg, buf, TDATA_MAX_BUF_LEN);
 	if (size == -1) {
 		return -1;
 	}
 
+	/* Leave the same room the message would have had if grown step by step */
+	buf_size = PJSIP_MAX_PKT_LEN;
+	while (buf_size <= size) {
+		buf_size *= 2;
+	}
+	if (buf_size >= TDATA_MAX_BUF_LEN) {
+		return -1;
+	}
+
+	buf = pj_pool_alloc(tdata->pool, buf_size);
+	if (!buf) {
+		return -1;
+	}
+
 	tdata->buf.start = buf;
 	tdata->buf.cur = tdata->buf.start;
 	tdata->buf.end = tdata->buf.start + buf_size;
@@ -2407,6 +2461,8 @@ static int schedule_notification(struct sip_subscription_tree *sub_tree)
 	return 0;
 }
 
+static int generate_subscription_body(struct ast_sip_subscription *sub, struct ast_sip_body_data *data);
+
 int ast_sip_subscription_notify(struct ast_sip_subscription *sub, struct ast_sip_body_data *notify_data,
 		int terminate)
 {
@@ -2420,8 +2476,7 @@ int ast_sip_subscription_notify(struct ast_sip_subscription *sub, struct ast_sip
 		return 0;
 	}
 
-	if (ast_sip_pubsub_generate_body_content(ast_sip_subscription_get_body_type(sub),
-				ast_sip_subscription_get_body_subtype(sub), notify_data, &sub->body_text)) {
+	if (generate_subscription_body(sub, notify_data)) {
 		pjsip_dlg_dec_lock(dlg);
 		return -1;
 	}
@@ -2817,8 +2872,7 @@ static int generate_initial_notify(struct ast_sip_subscription *sub)
 
 	data.body_data = notify_data;
 
-	res = ast_sip_pubsub_generate_body_content(ast_sip_subscription_get_body_type(sub),
-			ast_sip_subscription_get_body_subtype(sub), &data, &sub->body_text);
+	res = generate_subscription_body(sub, &data);
 
 	ao2_cleanup(notify_data);
 
@@ -3326,6 +3380,24 @@ const char *ast_sip_publication_get_event_configuration(const struct ast_sip_pub
 	return pub->event_configuration_name;
 }
 
+AO2_STRING_FIELD_HASH_FN(shared_body, key);
+AO2_STRING_FIELD_CMP_FN(shared_body, key);
+
+static void shared_body_destroy(void *obj)
+{
+	struct shared_body *shared = obj;
+
+	ast_free(shared->text);
+}
+
+/*! \brief Forget all shared bodies, so they are generated again when next needed */
+static void shared_bodies_flush(void)
+{
+	if (shared_bodies) {
+		ao2_callback(shared_bodies, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, NULL, NULL);
+	}
+}
+
 int ast_sip_pubsub_register_body_generator(struct ast_sip_pubsub_body_generator *generator)
 {
 	struct ast_sip_pubsub_body_generator *existing;
@@ -3342,6 +3414,7 @@ int ast_sip_pubsub_register_body_generator(struct ast_sip_pubsub_body_generator
 	}
 	AST_LIST_INSERT_HEAD(&body_generators, generator, list);
 	AST_RWLIST_UNLOCK(&body_generators);
+	shared_bodies_flush();
 
 	/* Lengths of type and subtype plus a slash. */
 	accept_len = strlen(generator->type) + strlen(generator->subtype) + 1;
@@ -3369,6 +3442,7 @@ void ast_sip_pubsub_unregister_body_generator(struct ast_sip_pubsub_body_generat
 	}
 	AST_RWLIST_TRAVERSE_SAFE_END;
 	AST_RWLIST_UNLOCK(&body_generators);
+	shared_bodies_flush();
 }
 
 int ast_sip_pubsub_register_body_supplement(struct ast_sip_pubsub_body_supplement *supplement)
@@ -3376,6 +3450,7 @@ int ast_sip_pubsub_register_body_supplement(struct ast_sip_pubsub_body_supplemen
 	AST_RWLIST_WRLOCK(&body_supplements);
 	AST_RWLIST_INSERT_TAIL(&body_supplements, supplement, list);
 	AST_RWLIST_UNLOCK(&body_supplements);
+	shared_bodies_flush();
 
 	return 0;
 }
@@ -3393,6 +3468,7 @@ void ast_sip_pubsub_unregister_body_supplement(struct ast_sip_pubsub_body_supple
 	}
 	AST_RWLIST_TRAVERSE_SAFE_END;
 	AST_RWLIST_UNLOCK(&body_supplements);
+	shared_bodies_flush();
 }
 
 const char *ast_sip_subscription_get_body_type(struct ast_sip_subscription *sub)
@@ -3405,31 +3481,32 @@ const char *ast_sip_subscription_get_body_subtype(struct ast_sip_subscription *s
 	return sub->body_generator->subtype;
 }
 
-int ast_sip_pubsub_generate_body_content(const char *type, const char *subtype,
+/*!
+ * \brief Run a body generator and the supplements for its content type
+ *
+ * \param generator The body generator
+ * \param data The data to generate the body from
+ * \param[out] str The generated body text
+ * \retval 0 Success
+ * \retval non-zero Failure
+ */
+static int render_body(struct ast_sip_pubsub_body_generator *generator,
 		struct ast_sip_body_data *data, struct ast_str **str)
 {
 	struct ast_sip_pubsub_body_supplement *supplement;
-	struct ast_sip_pubsub_body_generator *generator;
 	int res = 0;
 	void *body;
 
-	generator = find_body_generator_type_subtype(type, subtype);
-	if (!generator) {
-		ast_log(LOG_WARNING, "Unable to find a body generator for %s/%s\n",
-				type, subtype);
-		return -1;
-	}
-
 	if (strcmp(data->body_type, generator->body_type)) {
 		ast_log(LOG_WARNING, "%s/%s body generator does not accept the type of data provided\n",
-			type, subtype);
+			generator->type, generator->subtype);
 		return -1;
 	}
 
 	body = generator->allocate_body(data->body_data);
 	if (!body) {
 		ast_log(LOG_WARNING, "%s/%s body generator could not to allocate a body\n",
-			type, subtype);
+			generator->type, generator->subtype);
 		return -1;
 	}
 
@@ -3462,6 +3539,221 @@ end:
 	return res;
 }
 
+/*!
+ * \brief Copy body text, filling in its placeholders
+ *
+ * \param generator The body generator that produced the text
+ * \param sub The subscription the body is for
+ * \param text The body text with placeholders
+ * \param local The local URI to fill in, or NULL to leave its placeholder
+ * \param remote The remote URI to fill in, or NULL to leave its placeholder
+ * \param[out] str The body text for the subscription
+ * \retval 0 Success
+ * \retval non-zero Failure
+ */
+static int fill_body_text(struct ast_sip_pubsub_body_generator *generator, struct ast_sip_subscription *sub,
+		const char *text, const char *local, const char *remote, struct ast_str **str)
+{
+	const char *placeholder;
+	unsigned int version;
+
+	ast_str_reset(*str);
+	while ((placeholder = strchr(text, '\x1e'))) {
+		ast_str_append_substr(str, 0, text, placeholder - text);
+		if (local && ast_begins_with(placeholder, SHARED_BODY_LOCAL)) {
+			ast_str_append(str, 0, "%s", local);
+			text = placeholder + strlen(SHARED_BODY_LOCAL);
+		} else if (remote && ast_begins_with(placeholder, SHARED_BODY_REMOTE)) {
+			ast_str_append(str, 0, "%s", remote);
+			text = placeholder + strlen(SHARED_BODY_REMOTE);
+		} else if (generator->body_version && sub
+			&& ast_begins_with(placeholder, AST_SIP_BODY_VERSION_PLACEHOLDER)) {
+			if (generator->body_version(sub, &version)) {
+				return -1;
+			}
+			ast_str_append(str, 0, "%u", version);
+			text = placeholder + strlen(AST_SIP_BODY_VERSION_PLACEHOLDER);
+		} else {
+			ast_str_append_substr(str, 0, placeholder, 1);
+			text = placeholder + 1;
+		}
+	}
+	ast_str_append(str, 0, "%s", text);
+
+	return 0;
+}
+
+/*!
+ * \brief Get the shared body text for a subscription's extension state
+ *
+ * \param sub The subscription the body is for
+ * \param data Extension state data for the subscription
+ * \return The shared body, with a reference, or NULL on failure
+ */
+static struct shared_body *shared_body_get(struct ast_sip_subscription *sub, struct ast_sip_body_data *data)
+{
+	struct ast_sip_exten_state_data *state_data = data->body_data;
+	struct ast_sip_exten_state_data template_data;
+	struct ast_sip_body_data template_body = {
+		.body_type = data->body_type,
+		.body_data = &template_data,
+	};
+	struct ast_sip_endpoint *endpoint;
+	struct ast_str *key;
+	struct ast_str *text;
+	struct shared_body *shared;
+
+	key = ast_str_create(256);
+	if (!key) {
+		return NULL;
+	}
+
+	/*
+	 * Everything the body is generated from, except the per-dialog parts. The
+	 * endpoint's notify_early_inuse_ringing setting is read by the dialog-info
+	 * generator through the subscription.
+	 */
+	endpoint = ast_sip_subscription_get_endpoint(sub);
+	ast_str_set(&key, 0, "%s/%s\x1f%s\x1f%s\x1f%d\x1f%d\x1f%s\x1f%s\x1f%s\x1f%u",
+		sub->body_generator->type, sub->body_generator->subtype, sub->resource,
+		S_OR(state_data->exten, ""), state_data->exten_state, state_data->presence_state,
+		S_OR(state_data->presence_subtype, ""), S_OR(state_data->presence_message, ""),
+		S_OR(state_data->user_agent, ""), endpoint ? endpoint->notify_early_inuse_ringing : 0);
+	ao2_cleanup(endpoint);
+
+	shared = ao2_find(shared_bodies, ast_str_buffer(key), OBJ_SEARCH_KEY);
+	if (shared) {
+		ast_free(key);
+		return shared;
+	}
+
+	text = ast_str_create(512);
+	if (!text) {
+		ast_free(key);
+		return NULL;
+	}
+
+	template_data = *state_data;
+	ast_copy_string(template_data.local, SHARED_BODY_LOCAL, sizeof(template_data.local));
+	ast_copy_string(template_data.remote, SHARED_BODY_REMOTE, sizeof(template_data.remote));
+	if (render_body(sub->body_generator, &template_body, &text)) {
+		ast_free(text);
+		ast_free(key);
+		return NULL;
+	}
+
+	shared = ao2_alloc_options(sizeof(*shared) + ast_str_strlen(key) + 1, shared_body_destroy,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (shared) {
+		strcpy(shared->key, ast_str_buffer(key)); /* Safe */
+		shared->text = ast_strdup(ast_str_buffer(text));
+		if (!shared->text) {
+			ao2_ref(shared, -1);
+			shared = NULL;
+		}
+	}
+	ast_free(text);
+	ast_free(key);
+	if (!shared) {
+		return NULL;
+	}
+
+	if (ao2_container_count(shared_bodies) >= SHARED_BODY_MAX) {
+		shared_bodies_flush();
+	}
+	ao2_link(shared_bodies, shared);
+
+	return shared;
+}
+
+/*!
+ * \brief Generate the body text for a subscription
+ *
+ * Extension state bodies are shared between all subscriptions to a resource
+ * in the same state, so that a state change seen by many subscribers only
+ * runs the body generator and supplements once. Only the per-dialog parts
+ * are filled in for each subscription.
+ *
+ * \param sub The subscription, whose body text is set
+ * \param data The data to generate the body from
+ * \retval 0 Success
+ * \retval non-zero Failure
+ */
+static int generate_subscription_body(struct ast_sip_subscription *sub, struct ast_sip_body_data *data)
+{
+	struct ast_sip_exten_state_data *state_data;
+	struct shared_body *shared;
+	char *local;
+	char sanitized_local[PJSIP_MAX_URL_SIZE];
+	char sanitized_remote[PJSIP_MAX_URL_SIZE];
+	int res;
+
+	if (strcmp(data->body_type, AST_SIP_EXTEN_STATE_DATA)) {
+		return ast_sip_pubsub_generate_body_content(ast_sip_subscription_get_body_type(sub),
+			ast_sip_subscription_get_body_subtype(sub), data, &sub->body_text);
+	}
+	state_data = data->body_data;
+
+	/*
+	 * The body generators disagree on whether the local URI is escaped, so
+	 * only share bodies when it does not need to be.
+	 */
+	local = ast_strdupa(state_data->local);
+	local = ast_strip_quoted(local, "<", ">");
+	ast_sip_sanitize_xml(local, sanitized_local, sizeof(sanitized_local));
+	if (strcmp(local, sanitized_local) || strchr(local, '\x1e')
+		|| strchr(state_data->remote, '\x1e')) {
+		return ast_sip_pubsub_generate_body_content(ast_sip_subscription_get_body_type(sub),
+			ast_sip_subscription_get_body_subtype(sub), data, &sub->body_text);
+	}
+	ast_sip_sanitize_xml(state_data->remote, sanitized_remote, sizeof(sanitized_remote));
+
+	shared = shared_body_get(sub, data);
+	if (!shared) {
+		return -1;
+	}
+
+	res = fill_body_text(sub->body_generator, sub, shared->text, local, sanitized_remote,
+		&sub->body_text);
+	ao2_ref(shared, -1);
+
+	return res;
+}
+
+int ast_sip_pubsub_generate_body_content(const char *type, const char *subtype,
+		struct ast_sip_body_data *data, struct ast_str **str)
+{
+	struct ast_sip_pubsub_body_generator *generator;
+	struct ast_sip_exten_state_data *state_data;
+	struct ast_str *text;
+	int res;
+
+	generator = find_body_generator_type_subtype(type, subtype);
+	if (!generator) {
+		ast_log(LOG_WARNING, "Unable to find a body generator for %s/%s\n",
+				type, subtype);
+		return -1;
+	}
+
+	if (!generator->body_version || strcmp(data->body_type, AST_SIP_EXTEN_STATE_DATA)) {
+		return render_body(generator, data, str);
+	}
+
+	/* Fill in the version the body generator left a placeholder for */
+	text = ast_str_create(512);
+	if (!text) {
+		return -1;
+	}
+	state_data = data->body_data;
+	res = render_body(generator, data, &text);
+	if (!res) {
+		res = fill_body_text(generator, state_data->sub, ast_str_buffer(text), NULL, NULL, str);
+	}
+	ast_free(text);
+
+	return res;
+}
+
 static pj_bool_t pubsub_on_rx_request(pjsip_rx_data *rdata)
 {
 	if (!pjsip_method_cmp(&rdata->msg_info.msg->line.req.method, pjsip_get_subscribe_method())) {
@@ -5296,21 +5588,32 @@ static int load_module(void)
 		return AST_MODULE_LOAD_DECLINE;
 	}
 
+	shared_bodies = ao2_container_alloc(SHARED_BODY_BUCKETS, shared_body_hash_fn, shared_body_cmp_fn);
+	if (!shared_bodies) {
+		ast_log(LOG_ERROR, "Could not create container for shared bodies\n");
+		ast_sched_context_destroy(sched);
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
 	pjsip_endpt_add_capability(ast_sip_get_pjsip_endpoint(), NULL, PJSIP_H_ALLOW, NULL, 1, &str_PUBLISH);
 
 	if (ast_sip_register_service(&pubsub_module)) {
 		ast_log(LOG_ERROR, "Could not register pubsub service\n");
 		ast_sched_context_destroy(sched);
+		ao2_ref(shared_bodies, -1);
 		return AST_MODULE_LOAD_DECLINE;
 	}
 
 	ast_sorcery_apply_config(sorcery, "res_pjsip_pubsub");
-	ast_sorcery_apply_default(sorcery, "subscription_persistence", "astdb", "subscription_persistence");
+	/* Refreshes update persistence on every SUBSCRIBE, so let astdb batch the writes */
+	ast_sorcery_apply_default(sorcery, "subscription_persistence", "astdb",
+		"subscription_persistence,write_behind=1000");
 	if (ast_sorcery_object_register(sorcery, "subscription_persistence", subscription_persistence_alloc,
 		NULL, NULL)) {
 		ast_log(LOG_ERROR, "Could not register subscription persistence object support\n");
 		ast_sip_unregister_service(&pubsub_module);
 		ast_sched_context_destroy(sched);
+		ao2_ref(shared_bodies, -1);
 		return AST_MODULE_LOAD_DECLINE;
 	}
 	ast_sorcery_object_field_register(sorcery, "subscription_persistence", "packet", "", OPT_CHAR_ARRAY_T, 0,
@@ -5339,6 +5642,7 @@ static int load_module(void)
 	if (apply_list_configuration(sorcery)) {
 		ast_sip_unregister_service(&pubsub_module);
 		ast_sched_context_destroy(sched);
+		ao2_ref(shared_bodies, -1);
 		return AST_MODULE_LOAD_DECLINE;
 	}
 
@@ -5348,6 +5652,7 @@ static int load_module(void)
 		ast_log(LOG_ERROR, "Could not register subscription persistence object support\n");
 		ast_sip_unregister_service(&pubsub_module);
 		ast_sched_context_destroy(sched);
+		ao2_ref(shared_bodies, -1);
 		return AST_MODULE_LOAD_DECLINE;
 	}
 	ast_sorcery_object_field_register(sorcery, "inbound-publication", "type", "", OPT_NOOP_T, 0, 0);
@@ -5402,6 +5707,8 @@ static int unload_module(void)
 	if (sched) {
 		ast_sched_context_destroy(sched);
 	}
+	ao2_cleanup(shared_bodies);
+	shared_bodies = NULL;
 
 	return 0;
 }
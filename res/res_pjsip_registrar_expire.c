@@ -31,6 +31,14 @@
 #include "asterisk/res_pjsip.h"
 #include "asterisk/module.h"
 #include "asterisk/named_locks.h"
+#include "asterisk/dlinkedlists.h"
+#include "asterisk/vector.h"
+
+/*! \brief Number of one second slots in the expiration wheel */
+#define WHEEL_SLOTS 4096
+
+/*! \brief Number of buckets for the expirations container */
+#define EXPIRATION_BUCKETS 2053
 
 /*! \brief Thread keeping things alive */
 static pthread_t check_thread = AST_PTHREADT_NULL;
@@ -38,6 +46,118 @@ static pthread_t check_thread = AST_PTHREADT_NULL;
 /*! \brief The global interval at which to check for contact expiration */
 static unsigned int check_interval;
 
+/*! \brief When a contact expires, kept in the expiration wheel */
+struct contact_expiration {
+	/*! \brief Entry in the wheel slot */
+	AST_DLLIST_ENTRY(contact_expiration) list;
+	/*! \brief Time the contact expires */
+	time_t expires;
+	/*! \brief Wheel slot the contact is in */
+	unsigned int slot;
+	/*! \brief Sorcery identifier of the contact */
+	char id[0];
+};
+
+/*!
+ * \brief Expirations of all contacts, by contact identifier
+ *
+ * The container lock also protects the wheel.
+ */
+static struct ao2_container *expirations;
+
+/*!
+ * \brief Contacts by the second, modulo the wheel size, they expire in
+ *
+ * Contacts that expire more than one turn of the wheel away stay in their
+ * slot when it is checked.
+ */
+static AST_DLLIST_HEAD_NOLOCK(, contact_expiration) wheel[WHEEL_SLOTS];
+
+/*! \brief The last second the wheel was checked up to */
+static time_t wheel_checked;
+
+AO2_STRING_FIELD_HASH_FN(contact_expiration, id)
+AO2_STRING_FIELD_CMP_FN(contact_expiration, id)
+
+/*!
+ * \internal
+ * \brief Put a contact in the wheel, or move it if it was there already
+ *
+ * \note Contacts that have already expired go in the next slot checked.
+ */
+static void contact_expiration_set(const char *id, time_t expires)
+{
+	struct contact_expiration *expiration;
+	time_t when;
+
+	ao2_lock(expirations);
+	expiration = ao2_find(expirations, id, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (expiration) {
+		AST_DLLIST_REMOVE(&wheel[expiration->slot], expiration, list);
+	} else {
+		expiration = ao2_alloc_options(sizeof(*expiration) + strlen(id) + 1, NULL,
+			AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!expiration) {
+			ao2_unlock(expirations);
+			return;
+		}
+		strcpy(expiration->id, id); /* Safe */
+		ao2_link_flags(expirations, expiration, OBJ_NOLOCK);
+	}
+
+	when = MAX(expires, wheel_checked + 1);
+	expiration->expires = expires;
+	expiration->slot = when % WHEEL_SLOTS;
+	AST_DLLIST_INSERT_TAIL(&wheel[expiration->slot], expiration, list);
+	ao2_unlock(expirations);
+
+	ao2_ref(expiration, -1);
+}
+
+/*! \brief Take a contact out of the wheel */
+static void contact_expiration_remove(const char *id)
+{
+	struct contact_expiration *expiration;
+
+	ao2_lock(expirations);
+	expiration = ao2_find(expirations, id, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NOLOCK);
+	if (expiration) {
+		AST_DLLIST_REMOVE(&wheel[expiration->slot], expiration, list);
+		ao2_ref(expiration, -1);
+	}
+	ao2_unlock(expirations);
+}
+
+static void contact_expiration_observe(const void *obj)
+{
+	const struct ast_sip_contact *contact = obj;
+
+	if (ast_tvzero(contact->expiration_time)) {
+		contact_expiration_remove(ast_sorcery_object_get_id(contact));
+	} else {
+		contact_expiration_set(ast_sorcery_object_get_id(contact), contact->expiration_time.tv_sec);
+	}
+}
+
+static void contact_expiration_deleted(const void *obj)
+{
+	contact_expiration_remove(ast_sorcery_object_get_id(obj));
+}
+
+/*! \brief Observer which keeps the wheel up to date as contacts are added, refreshed and removed */
+static const struct ast_sorcery_observer contact_expiration_observer = {
+	.created = contact_expiration_observe,
+	.updated = contact_expiration_observe,
+	.deleted = contact_expiration_deleted,
+};
+
+static int contact_expiration_add(void *obj, void *arg, int flags)
+{
+	contact_expiration_observe(obj);
+
+	return 0;
+}
+
 /*! \brief Callback function which deletes a contact */
 static int expire_contact(void *obj, void *arg, int flags)
 {
@@ -63,29 +183,77 @@ static int expire_contact(void *obj, void *arg, int flags)
 	return 0;
 }
 
+/*! \brief Take the contacts that have expired by now out of the wheel */
+static void take_expired(time_t now, struct ao2_container *expired)
+{
+	time_t second;
+	time_t last = now;
+
+	ao2_lock(expirations);
+	if (now - wheel_checked > WHEEL_SLOTS) {
+		/* Every slot needs looking at once */
+		last = wheel_checked + WHEEL_SLOTS;
+	}
+	for (second = wheel_checked + 1; second <= last; ++second) {
+		struct contact_expiration *expiration;
+
+		AST_DLLIST_TRAVERSE_SAFE_BEGIN(&wheel[second % WHEEL_SLOTS], expiration, list) {
+			if (expiration->expires > now) {
+				continue;
+			}
+			AST_DLLIST_REMOVE_CURRENT(list);
+			ao2_link_flags(expired, expiration, OBJ_NOLOCK);
+			ao2_unlink_flags(expirations, expiration, OBJ_NOLOCK);
+		}
+		AST_DLLIST_TRAVERSE_SAFE_END;
+	}
+	wheel_checked = now;
+	ao2_unlock(expirations);
+}
+
+/*! \brief Callback function which expires the contact of an expiration taken from the wheel */
+static int expire_expiration(void *obj, void *arg, int flags)
+{
+	struct contact_expiration *expiration = obj;
+	struct ast_sip_contact *contact;
+
+	contact = ast_sip_location_retrieve_contact(expiration->id);
+	if (!contact) {
+		/* Removed already */
+		return 0;
+	}
+
+	if (ast_tvdiff_ms(ast_tvnow(), contact->expiration_time) > 0) {
+		expire_contact(contact, NULL, 0);
+	} else {
+		/* Refreshed, or due later within this second, so it goes back in the wheel */
+		contact_expiration_set(expiration->id, contact->expiration_time.tv_sec);
+	}
+	ao2_ref(contact, -1);
+
+	return 0;
+}
+
 static void *check_expiration_thread(void *data)
 {
-	struct ao2_container *contacts;
-	struct ast_variable *var;
-	char *time = alloca(64);
+	struct ao2_container *expired;
 
 	while (check_interval) {
 		sleep(check_interval);
 
-		sprintf(time, "%ld", ast_tvnow().tv_sec);
-		var = ast_variable_new("expiration_time <=", time, "");
+		ast_debug(4, "Woke up at %ld  Interval: %d\n", (long) ast_tvnow().tv_sec, check_interval);
 
-		ast_debug(4, "Woke up at %s  Interval: %d\n", time, check_interval);
-
-		contacts = ast_sorcery_retrieve_by_fields(ast_sip_get_sorcery(), "contact",
-			AST_RETRIEVE_FLAG_MULTIPLE, var);
-
-		ast_variables_destroy(var);
-		if (contacts) {
-			ast_debug(3, "Expiring %d contacts\n", ao2_container_count(contacts));
-			ao2_callback(contacts, OBJ_NODATA, expire_contact, NULL);
-			ao2_ref(contacts, -1);
+		/* Only the contacts in the wheel slots that came due are looked at */
+		expired = ao2_container_alloc_list(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, NULL, NULL);
+		if (!expired) {
+			continue;
+		}
+		take_expired(ast_tvnow().tv_sec, expired);
+		if (ao2_container_count(expired)) {
+			ast_debug(3, "Expiring %d contacts\n", ao2_container_count(expired));
+			ao2_callback(expired, OBJ_NODATA, expire_expiration, NULL);
 		}
+		ao2_ref(expired, -1);
 	}
 
 	return NULL;
@@ -130,6 +298,17 @@ static int unload_module(void)
 	}
 
 	ast_sorcery_observer_remove(ast_sip_get_sorcery(), "global", &expiration_global_observer);
+	ast_sorcery_observer_remove(ast_sip_get_sorcery(), "contact", &contact_expiration_observer);
+
+	if (expirations) {
+		int i;
+
+		for (i = 0; i < WHEEL_SLOTS; ++i) {
+			AST_DLLIST_HEAD_INIT_NOLOCK(&wheel[i]);
+		}
+		ao2_ref(expirations, -1);
+		expirations = NULL;
+	}
 
 	return 0;
 }
@@ -137,8 +316,29 @@ static int unload_module(void)
 
 static int load_module(void)
 {
+	struct ao2_container *contacts;
+
 	CHECK_PJSIP_MODULE_LOADED();
 
+	expirations = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, EXPIRATION_BUCKETS,
+		contact_expiration_hash_fn, NULL, contact_expiration_cmp_fn);
+	if (!expirations) {
+		return AST_MODULE_LOAD_DECLINE;
+	}
+	wheel_checked = ast_tvnow().tv_sec;
+
+	/*
+	 * Contacts are put in the wheel as they change, whichever wizard they
+	 * are kept by, so the contacts that already exist only need finding once.
+	 */
+	ast_sorcery_observer_add(ast_sip_get_sorcery(), "contact", &contact_expiration_observer);
+	contacts = ast_sorcery_retrieve_by_fields(ast_sip_get_sorcery(), "contact",
+		AST_RETRIEVE_FLAG_MULTIPLE | AST_RETRIEVE_FLAG_ALL, NULL);
+	if (contacts) {
+		ao2_callback(contacts, OBJ_NODATA, contact_expiration_add, NULL);
+		ao2_ref(contacts, -1);
+	}
+
 	ast_sorcery_observer_add(ast_sip_get_sorcery(), "global", &expiration_global_observer);
 	ast_sorcery_reload_object(ast_sip_get_sorcery(), "global");
 
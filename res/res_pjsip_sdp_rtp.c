@@ -464,20 +464,18 @@ static int set_caps(struct ast_sip_session *session, struct ast_sip_session_medi
 	return 0;
 }
 
-static pjmedia_sdp_attr* generate_rtpmap_attr(struct ast_sip_session *session, pjmedia_sdp_media *media, pj_pool_t *pool,
-					      int rtp_code, int asterisk_format, struct ast_format *format, int code)
+static pjmedia_sdp_attr* build_rtpmap_attr(pjmedia_sdp_media *media, pj_pool_t *pool,
+	int rtp_code, unsigned int clock_rate, const char *mime_subtype)
 {
 	pjmedia_sdp_rtpmap rtpmap;
 	pjmedia_sdp_attr *attr = NULL;
 	char tmp[64];
-	enum ast_rtp_options options = session->endpoint->media.g726_non_standard ?
-		AST_RTP_OPT_G726_NONSTANDARD : 0;
 
 	snprintf(tmp, sizeof(tmp), "%d", rtp_code);
 	pj_strdup2(pool, &media->desc.fmt[media->desc.fmt_count++], tmp);
 	rtpmap.pt = media->desc.fmt[media->desc.fmt_count - 1];
-	rtpmap.clock_rate = ast_rtp_lookup_sample_rate2(asterisk_format, format, code);
-	pj_strdup2(pool, &rtpmap.enc_name, ast_rtp_lookup_mime_subtype2(asterisk_format, format, code, options));
+	rtpmap.clock_rate = clock_rate;
+	pj_strdup2(pool, &rtpmap.enc_name, mime_subtype);
 	if (!pj_stricmp2(&rtpmap.enc_name, "opus")) {
 		pj_cstr(&rtpmap.param, "2");
 	} else {
@@ -489,29 +487,162 @@ static pjmedia_sdp_attr* generate_rtpmap_attr(struct ast_sip_session *session, p
 	return attr;
 }
 
-static pjmedia_sdp_attr* generate_fmtp_attr(pj_pool_t *pool, struct ast_format *format, int rtp_code)
+static pjmedia_sdp_attr* generate_rtpmap_attr(struct ast_sip_session *session, pjmedia_sdp_media *media, pj_pool_t *pool,
+					      int rtp_code, int asterisk_format, struct ast_format *format, int code)
+{
+	enum ast_rtp_options options = session->endpoint->media.g726_non_standard ?
+		AST_RTP_OPT_G726_NONSTANDARD : 0;
+
+	return build_rtpmap_attr(media, pool, rtp_code,
+		ast_rtp_lookup_sample_rate2(asterisk_format, format, code),
+		ast_rtp_lookup_mime_subtype2(asterisk_format, format, code, options));
+}
+
+/*!
+ * \internal
+ * \brief Render the value of the fmtp attribute of a format
+ *
+ * \retval NULL if the format has no fmtp attribute
+ * \return the value, within \a fmtp
+ */
+static char *generate_fmtp_value(struct ast_format *format, int rtp_code, struct ast_str **fmtp)
 {
-	struct ast_str *fmtp0 = ast_str_alloca(256);
-	pj_str_t fmtp1;
-	pjmedia_sdp_attr *attr = NULL;
 	char *tmp;
 
-	ast_format_generate_sdp_fmtp(format, rtp_code, &fmtp0);
-	if (ast_str_strlen(fmtp0)) {
-		tmp = ast_str_buffer(fmtp0) + ast_str_strlen(fmtp0) - 1;
-		/* remove any carriage return line feeds */
-		while (*tmp == '\r' || *tmp == '\n') --tmp;
-		*++tmp = '\0';
-		/* ast...generate gives us everything, just need value */
-		tmp = strchr(ast_str_buffer(fmtp0), ':');
-		if (tmp && tmp[1] != '\0') {
-			fmtp1 = pj_str(tmp + 1);
-		} else {
-			fmtp1 = pj_str(ast_str_buffer(fmtp0));
+	ast_format_generate_sdp_fmtp(format, rtp_code, fmtp);
+	if (!ast_str_strlen(*fmtp)) {
+		return NULL;
+	}
+
+	tmp = ast_str_buffer(*fmtp) + ast_str_strlen(*fmtp) - 1;
+	/* remove any carriage return line feeds */
+	while (*tmp == '\r' || *tmp == '\n') --tmp;
+	*++tmp = '\0';
+	/* ast...generate gives us everything, just need value */
+	tmp = strchr(ast_str_buffer(*fmtp), ':');
+	if (tmp && tmp[1] != '\0') {
+		return tmp + 1;
+	}
+	return ast_str_buffer(*fmtp);
+}
+
+/*! \brief Number of buckets for the SDP fragment cache */
+#define SDP_FRAGMENT_BUCKETS 61
+
+/*! \brief Number of SDP fragments cached before the cache is emptied */
+#define SDP_FRAGMENT_MAX 256
+
+/*!
+ * \brief The rtpmap and fmtp details of a format offered with a payload type
+ *
+ * Formats are immutable, so what goes in the rtpmap and fmtp attributes of a
+ * format only depends on the payload type and options it is offered with.
+ * Offers to endpoints sharing a codec configuration keep producing the same
+ * details, which are cached here instead of being looked up and rendered for
+ * every stream of every offer.
+ */
+struct sdp_fragment {
+	/*! The format, referenced so its address is not reused while cached */
+	struct ast_format *format;
+	/*! Payload type the format is offered with */
+	int rtp_code;
+	/*! RTP options the MIME subtype was looked up with */
+	enum ast_rtp_options options;
+	/*! Clock rate of the rtpmap attribute */
+	unsigned int clock_rate;
+	/*! Encoding name of the rtpmap attribute */
+	char *mime_subtype;
+	/*! Value of the fmtp attribute, NULL if there is none */
+	char *fmtp;
+	char buf[0];
+};
+
+/*! \brief Cached SDP fragments */
+static struct ao2_container *sdp_fragments;
+
+static int sdp_fragment_hash(const void *obj, const int flags)
+{
+	const struct sdp_fragment *fragment = obj;
+
+	return (int) (((uintptr_t) fragment->format >> 4) ^ (fragment->rtp_code << 8) ^ fragment->options) & INT_MAX;
+}
+
+static int sdp_fragment_cmp(void *obj, void *arg, int flags)
+{
+	const struct sdp_fragment *left = obj;
+	const struct sdp_fragment *right = arg;
+
+	return left->format == right->format && left->rtp_code == right->rtp_code
+		&& left->options == right->options ? CMP_MATCH : 0;
+}
+
+static void sdp_fragment_destroy(void *obj)
+{
+	struct sdp_fragment *fragment = obj;
+
+	ao2_cleanup(fragment->format);
+}
+
+/*!
+ * \internal
+ * \brief Get the SDP fragment of a format offered with a payload type
+ *
+ * \retval NULL on allocation failure
+ * \return the fragment, which the caller must unreference
+ */
+static struct sdp_fragment *sdp_fragment_get(struct ast_sip_session *session,
+	struct ast_format *format, int rtp_code)
+{
+	struct sdp_fragment key = {
+		.format = format,
+		.rtp_code = rtp_code,
+		.options = session->endpoint->media.g726_non_standard ? AST_RTP_OPT_G726_NONSTANDARD : 0,
+	};
+	struct sdp_fragment *fragment;
+	struct ast_str *fmtp = ast_str_alloca(256);
+	const char *mime_subtype;
+	const char *value;
+	size_t mime_len;
+	size_t fmtp_len;
+
+	fragment = ao2_find(sdp_fragments, &key, OBJ_SEARCH_OBJECT);
+	if (fragment) {
+		return fragment;
+	}
+
+	mime_subtype = ast_rtp_lookup_mime_subtype2(1, format, 0, key.options);
+	mime_len = strlen(mime_subtype) + 1;
+	value = generate_fmtp_value(format, rtp_code, &fmtp);
+	fmtp_len = value ? strlen(value) + 1 : 0;
+
+	fragment = ao2_alloc_options(sizeof(*fragment) + mime_len + fmtp_len,
+		sdp_fragment_destroy, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!fragment) {
+		return NULL;
+	}
+	fragment->format = ao2_bump(format);
+	fragment->rtp_code = rtp_code;
+	fragment->options = key.options;
+	fragment->clock_rate = ast_rtp_lookup_sample_rate2(1, format, 0);
+	fragment->mime_subtype = fragment->buf;
+	memcpy(fragment->mime_subtype, mime_subtype, mime_len);
+	if (value) {
+		fragment->fmtp = fragment->buf + mime_len;
+		memcpy(fragment->fmtp, value, fmtp_len);
+	}
+
+	/*
+	 * A format the RTP engine does not know yet may become known when
+	 * its module loads, so only remember fragments with a MIME subtype.
+	 */
+	if (mime_len > 1) {
+		if (ao2_container_count(sdp_fragments) >= SDP_FRAGMENT_MAX) {
+			ao2_callback(sdp_fragments, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, NULL, NULL);
 		}
-		attr = pjmedia_sdp_attr_create(pool, "fmtp", &fmtp1);
+		ao2_link(sdp_fragments, fragment);
 	}
-	return attr;
+
+	return fragment;
 }
 
 /*! \brief Function which adds ICE attributes to a media stream */
@@ -1254,6 +1385,7 @@ static int create_outgoing_sdp_stream(struct ast_sip_session *session, struct as
 
 	for (index = 0; index < ast_format_cap_count(caps); ++index) {
 		struct ast_format *format = ast_format_cap_get_format(caps, index);
+		struct sdp_fragment *fragment;
 
 		if (ast_format_get_type(format) != media_type) {
 			ao2_ref(format, -1);
@@ -1266,15 +1398,23 @@ static int create_outgoing_sdp_stream(struct ast_sip_session *session, struct as
 			continue;
 		}
 
-		if (!(attr = generate_rtpmap_attr(session, media, pool, rtp_code, 1, format, 0))) {
+		if (!(fragment = sdp_fragment_get(session, format, rtp_code))) {
+			ao2_ref(format, -1);
+			continue;
+		}
+
+		if (!(attr = build_rtpmap_attr(media, pool, rtp_code, fragment->clock_rate, fragment->mime_subtype))) {
+			ao2_ref(fragment, -1);
 			ao2_ref(format, -1);
 			continue;
 		}
 		media->attr[media->attr_count++] = attr;
 
-		if ((attr = generate_fmtp_attr(pool, format, rtp_code))) {
+		if (fragment->fmtp) {
+			attr = pjmedia_sdp_attr_create(pool, "fmtp", pj_cstr(&stmp, fragment->fmtp));
 			media->attr[media->attr_count++] = attr;
 		}
+		ao2_ref(fragment, -1);
 
 		if (ast_format_get_maximum_ms(format) &&
 			((ast_format_get_maximum_ms(format) < max_packet_size) || !max_packet_size)) {
@@ -1607,6 +1747,9 @@ static int unload_module(void)
 		ast_sched_context_destroy(sched);
 	}
 
+	ao2_cleanup(sdp_fragments);
+	sdp_fragments = NULL;
+
 	return 0;
 }
 
@@ -1630,6 +1773,11 @@ static int load_module(void)
 		ast_sockaddr_parse(&address_rtp, "0.0.0.0", 0);
 	}
 
+	sdp_fragments = ao2_container_alloc(SDP_FRAGMENT_BUCKETS, sdp_fragment_hash, sdp_fragment_cmp);
+	if (!sdp_fragments) {
+		goto end;
+	}
+
 	if (!(sched = ast_sched_context_create())) {
 		ast_log(LOG_ERROR, "Unable to create scheduler context.\n");
 		goto end;
@@ -37,6 +37,9 @@
 #include "asterisk/res_pjsip.h"
 #include "asterisk/res_pjsip_session.h"
 #include "asterisk/taskprocessor.h"
+#include "asterisk/io.h"
+#include "asterisk/alertpipe.h"
+#include "asterisk/linkedlists.h"
 
 static int transport_type_wss;
 static int transport_type_wss_ipv6;
@@ -251,8 +254,8 @@ on_error:
 
 struct transport_read_data {
 	struct ws_transport *transport;
-	char *payload;
 	uint64_t payload_len;
+	char payload[0];
 };
 
 /*!
@@ -286,7 +289,10 @@ static int transport_read(void *data)
 
 	pj_pool_reset(rdata->tp_info.pool);
 
-	return (read_data->payload_len == recvd) ? 0 : -1;
+	recvd = (read_data->payload_len == recvd) ? 0 : -1;
+	ast_free(read_data);
+
+	return recvd;
 }
 
 static int get_write_timeout(void)
@@ -337,13 +343,216 @@ static struct ast_taskprocessor *create_websocket_serializer(void)
 	return ast_sip_create_serializer_named(tps_name);
 }
 
-/*! \brief WebSocket connection handler. */
+/*! \brief Threads reading the frames of the WebSocket connections */
+#define WS_READER_COUNT 4
+
+struct ws_reader;
+
+/*!
+ * \brief A WebSocket connection, waited on by a reader
+ */
+struct ws_connection {
+	struct ast_websocket *session;
+	/*! Serializer the frames of the connection are handled on */
+	struct ast_taskprocessor *serializer;
+	struct ws_transport *transport;
+	/*! The reader the connection was handed to */
+	struct ws_reader *reader;
+	/*! ID in the I/O context of the reader */
+	int *io_id;
+	AST_LIST_ENTRY(ws_connection) next;
+};
+
+/*!
+ * \brief A thread waiting for the frames of many connections at once
+ */
+struct ws_reader {
+	struct io_context *ioc;
+	/*! Written to when connections are handed to the reader or it must stop */
+	int alert_pipe[2];
+	pthread_t thread;
+	/*! Connections handed to the reader that it does not wait on yet */
+	AST_LIST_HEAD(, ws_connection) pending;
+	/*! Connections waited on, only used by the reader thread */
+	AST_LIST_HEAD_NOLOCK(, ws_connection) connections;
+	int stop;
+};
+
+static struct ws_reader readers[WS_READER_COUNT];
+
+/*! \brief Reader the next connection is handed to */
+static int next_reader;
+
+static void connection_destroy(struct ws_connection *conn)
+{
+	/* Queued behind the frames already read, which are handled first */
+	if (ast_sip_push_task(conn->serializer, transport_shutdown, conn->transport)) {
+		ast_log(LOG_ERROR, "Could not shut down WebSocket transport.\n");
+	}
+
+	ast_taskprocessor_unreference(conn->serializer);
+	ast_websocket_unref(conn->session);
+	ast_free(conn);
+}
+
+static void connection_close(struct ws_connection *conn)
+{
+	/*
+	 * Stop waiting on the descriptor before the transport shutdown can
+	 * close it, and the number be reused by another connection.
+	 */
+	ast_io_remove(conn->reader->ioc, conn->io_id);
+	AST_LIST_REMOVE(&conn->reader->connections, conn, next);
+	connection_destroy(conn);
+}
+
+/*!
+ * \brief Read a frame of a connection and queue it to its serializer
+ *
+ * \note Always returns 1 since closed connections are already removed.
+ */
+static int connection_read_cb(int *id, int fd, short events, void *cbdata)
+{
+	struct ws_connection *conn = cbdata;
+	struct transport_read_data *read_data;
+	enum ast_websocket_opcode opcode;
+	char *payload;
+	uint64_t payload_len;
+	int fragmented;
+
+	if (ast_websocket_read(conn->session, &payload, &payload_len, &opcode, &fragmented)
+		|| opcode == AST_WEBSOCKET_OPCODE_CLOSE) {
+		connection_close(conn);
+		return 1;
+	}
+
+	if (opcode != AST_WEBSOCKET_OPCODE_TEXT && opcode != AST_WEBSOCKET_OPCODE_BINARY) {
+		return 1;
+	}
+
+	read_data = ast_malloc(sizeof(*read_data) + payload_len);
+	if (!read_data) {
+		return 1;
+	}
+	read_data->transport = conn->transport;
+	read_data->payload_len = payload_len;
+	memcpy(read_data->payload, payload, payload_len);
+
+	if (ast_sip_push_task(conn->serializer, transport_read, read_data)) {
+		ast_free(read_data);
+	}
+
+	return 1;
+}
+
+/*! \brief Start waiting on the connections handed to a reader */
+static int reader_alert_cb(int *id, int fd, short events, void *cbdata)
+{
+	struct ws_reader *reader = cbdata;
+	struct ws_connection *conn;
+
+	ast_alertpipe_read(reader->alert_pipe);
+
+	AST_LIST_LOCK(&reader->pending);
+	while ((conn = AST_LIST_REMOVE_HEAD(&reader->pending, next))) {
+		conn->io_id = ast_io_add(reader->ioc, ast_websocket_fd(conn->session),
+			connection_read_cb, AST_IO_IN, conn);
+		if (!conn->io_id) {
+			ast_log(LOG_ERROR, "Could not wait on WebSocket connection.\n");
+			connection_destroy(conn);
+			continue;
+		}
+		AST_LIST_INSERT_TAIL(&reader->connections, conn, next);
+	}
+	AST_LIST_UNLOCK(&reader->pending);
+
+	return 1;
+}
+
+static void *reader_thread(void *data)
+{
+	struct ws_reader *reader = data;
+
+	while (!reader->stop) {
+		ast_io_wait(reader->ioc, -1);
+	}
+
+	return NULL;
+}
+
+static void readers_stop(void)
+{
+	struct ws_connection *conn;
+	int i;
+
+	for (i = 0; i < WS_READER_COUNT; ++i) {
+		struct ws_reader *reader = &readers[i];
+
+		if (reader->thread != AST_PTHREADT_NULL) {
+			reader->stop = 1;
+			ast_alertpipe_write(reader->alert_pipe);
+			pthread_join(reader->thread, NULL);
+			reader->thread = AST_PTHREADT_NULL;
+		}
+
+		while ((conn = AST_LIST_REMOVE_HEAD(&reader->connections, next))) {
+			ast_io_remove(reader->ioc, conn->io_id);
+			connection_destroy(conn);
+		}
+		while ((conn = AST_LIST_REMOVE_HEAD(&reader->pending, next))) {
+			connection_destroy(conn);
+		}
+		AST_LIST_HEAD_DESTROY(&reader->pending);
+
+		if (reader->ioc) {
+			io_context_destroy(reader->ioc);
+			reader->ioc = NULL;
+		}
+		ast_alertpipe_close(reader->alert_pipe);
+	}
+}
+
+static int readers_start(void)
+{
+	int i;
+
+	for (i = 0; i < WS_READER_COUNT; ++i) {
+		readers[i].thread = AST_PTHREADT_NULL;
+		ast_alertpipe_clear(readers[i].alert_pipe);
+		AST_LIST_HEAD_INIT(&readers[i].pending);
+	}
+
+	for (i = 0; i < WS_READER_COUNT; ++i) {
+		struct ws_reader *reader = &readers[i];
+
+		reader->stop = 0;
+		reader->ioc = io_context_create();
+		if (!reader->ioc
+			|| ast_alertpipe_init(reader->alert_pipe)
+			|| !ast_io_add(reader->ioc, ast_alertpipe_readfd(reader->alert_pipe),
+				reader_alert_cb, AST_IO_IN, reader)
+			|| ast_pthread_create_background(&reader->thread, NULL, reader_thread, reader)) {
+			reader->thread = AST_PTHREADT_NULL;
+			readers_stop();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief WebSocket connection handler.
+ *
+ * Creates the transport and hands the connection to a reader, which waits
+ * on it together with many others, so the HTTP session thread is done.
+ */
 static void websocket_cb(struct ast_websocket *session, struct ast_variable *parameters, struct ast_variable *headers)
 {
 	struct ast_taskprocessor *serializer;
 	struct transport_create_data create_data;
-	struct ws_transport *transport;
-	struct transport_read_data read_data;
+	struct ws_connection *conn;
+	struct ws_reader *reader;
 
 	if (ast_websocket_set_nonblock(session)) {
 		ast_websocket_unref(session);
@@ -365,32 +574,29 @@ static void websocket_cb(struct ast_websocket *session, struct ast_variable *par
 
 	if (ast_sip_push_task_synchronous(serializer, transport_create, &create_data)) {
 		ast_log(LOG_ERROR, "Could not create WebSocket transport.\n");
+		ast_taskprocessor_unreference(serializer);
 		ast_websocket_unref(session);
 		return;
 	}
 
-	transport = create_data.transport;
-	read_data.transport = transport;
-
-	while (ast_wait_for_input(ast_websocket_fd(session), -1) > 0) {
-		enum ast_websocket_opcode opcode;
-		int fragmented;
-
-		if (ast_websocket_read(session, &read_data.payload, &read_data.payload_len, &opcode, &fragmented)) {
-			break;
-		}
-
-		if (opcode == AST_WEBSOCKET_OPCODE_TEXT || opcode == AST_WEBSOCKET_OPCODE_BINARY) {
-			ast_sip_push_task_synchronous(serializer, transport_read, &read_data);
-		} else if (opcode == AST_WEBSOCKET_OPCODE_CLOSE) {
-			break;
-		}
+	conn = ast_calloc(1, sizeof(*conn));
+	if (!conn) {
+		ast_sip_push_task_synchronous(serializer, transport_shutdown, create_data.transport);
+		ast_taskprocessor_unreference(serializer);
+		ast_websocket_unref(session);
+		return;
 	}
+	conn->session = session;
+	conn->serializer = serializer;
+	conn->transport = create_data.transport;
 
-	ast_sip_push_task_synchronous(serializer, transport_shutdown, transport);
+	reader = &readers[(unsigned int) ast_atomic_fetchadd_int(&next_reader, 1) % WS_READER_COUNT];
+	conn->reader = reader;
 
-	ast_taskprocessor_unreference(serializer);
-	ast_websocket_unref(session);
+	AST_LIST_LOCK(&reader->pending);
+	AST_LIST_INSERT_TAIL(&reader->pending, conn, next);
+	AST_LIST_UNLOCK(&reader->pending);
+	ast_alertpipe_write(reader->alert_pipe);
 }
 
 /*!
@@ -480,7 +686,14 @@ static int load_module(void)
 		return AST_MODULE_LOAD_DECLINE;
 	}
 
+	if (readers_start()) {
+		ast_sip_session_unregister_supplement(&websocket_supplement);
+		ast_sip_unregister_service(&websocket_module);
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
 	if (ast_websocket_add_protocol("sip", websocket_cb)) {
+		readers_stop();
 		ast_sip_session_unregister_supplement(&websocket_supplement);
 		ast_sip_unregister_service(&websocket_module);
 		return AST_MODULE_LOAD_DECLINE;
@@ -494,6 +707,7 @@ static int unload_module(void)
 	ast_sip_unregister_service(&websocket_module);
 	ast_sip_session_unregister_supplement(&websocket_supplement);
 	ast_websocket_remove_protocol("sip", websocket_cb);
+	readers_stop();
 
 	return 0;
 }
@@ -0,0 +1,764 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Prometheus metrics served over the built-in HTTP server
+ */
+
+/*** MODULEINFO
+	<support_level>extended</support_level>
+ ***/
+
+/*** DOCUMENTATION
+	<configInfo name="res_prometheus" language="en_US">
+		<synopsis>Prometheus metrics.</synopsis>
+		<configFile name="prometheus.conf">
+			<configObject name="global">
+				<synopsis>Global configuration settings</synopsis>
+				<configOption name="enabled">
+					<synopsis>Enable/disable serving metrics</synopsis>
+				</configOption>
+				<configOption name="uri">
+					<synopsis>HTTP URI, below the HTTP server's prefix, that metrics are served on</synopsis>
+				</configOption>
+			</configObject>
+		</configFile>
+	</configInfo>
+***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/config_options.h"
+#include "asterisk/module.h"
+#include "asterisk/http.h"
+#include "asterisk/tcptls.h"
+#include "asterisk/channel.h"
+#include "asterisk/pbx.h"
+#include "asterisk/rtp_engine.h"
+#include "asterisk/stasis_bridges.h"
+#include "asterisk/taskprocessor.h"
+#include "asterisk/latency.h"
+#include "asterisk/channel_cpu.h"
+#include "asterisk/test.h"
+
+#define AST_API_MODULE
+#include "asterisk/prometheus.h"
+
+/*! \brief Content type of the Prometheus text exposition format */
+#define PROMETHEUS_CONTENT_TYPE "text/plain; version=0.0.4"
+
+/*! \brief Number of task callsites served, those taking the most time */
+#define MAX_CALLSITES 100
+
+/*! \brief Registered metrics, with metrics of the same name next to each other */
+static AST_RWLIST_HEAD_STATIC(metrics, ast_prometheus_metric);
+
+/*! \brief Global configuration options for prometheus. */
+struct conf_global_options {
+	AST_DECLARE_STRING_FIELDS(
+		/*! HTTP URI metrics are served on */
+		AST_STRING_FIELD(uri);
+	);
+	/*! Enabled by default, disabled if false. */
+	int enabled;
+};
+
+/*! \brief All configuration options for prometheus. */
+struct conf {
+	/*! The general section configuration options. */
+	struct conf_global_options *global;
+};
+
+/*! \brief Locking container for safe configuration access. */
+static AO2_GLOBAL_OBJ_STATIC(confs);
+
+int AST_OPTIONAL_API_NAME(ast_prometheus_metric_register)(struct ast_prometheus_metric *metric)
+{
+	struct ast_prometheus_metric *iter;
+	struct ast_prometheus_metric *last = NULL;
+
+	if (ast_strlen_zero(metric->name)
+		|| (metric->type == AST_PROMETHEUS_HISTOGRAM && !metric->buckets)) {
+		return -1;
+	}
+
+	AST_RWLIST_WRLOCK(&metrics);
+	AST_RWLIST_TRAVERSE(&metrics, iter, entry) {
+		if (iter == metric) {
+			AST_RWLIST_UNLOCK(&metrics);
+			return -1;
+		}
+		if (!strcmp(iter->name, metric->name)) {
+			last = iter;
+		}
+	}
+	if (last) {
+		AST_RWLIST_INSERT_AFTER(&metrics, last, metric, entry);
+	} else {
+		AST_RWLIST_INSERT_TAIL(&metrics, metric, entry);
+	}
+	AST_RWLIST_UNLOCK(&metrics);
+
+	return 0;
+}
+
+void AST_OPTIONAL_API_NAME(ast_prometheus_metric_unregister)(struct ast_prometheus_metric *metric)
+{
+	AST_RWLIST_WRLOCK(&metrics);
+	AST_RWLIST_REMOVE(&metrics, metric, entry);
+	AST_RWLIST_UNLOCK(&metrics);
+}
+
+static const char *metric_type_str(enum ast_prometheus_metric_type type)
+{
+	switch (type) {
+	case AST_PROMETHEUS_COUNTER:
+		return "counter";
+	case AST_PROMETHEUS_GAUGE:
+		return "gauge";
+	case AST_PROMETHEUS_HISTOGRAM:
+		return "histogram";
+	}
+	return "untyped";
+}
+
+static void print_header(struct ast_str **out, const char *name, const char *type, const char *help)
+{
+	ast_str_append(out, 0, "# HELP %s %s\n# TYPE %s %s\n", name, S_OR(help, name), name, type);
+}
+
+/*! \brief Print one metric in the text exposition format */
+static void print_metric(struct ast_str **out, struct ast_prometheus_metric *metric, int header)
+{
+	const char *labels = S_OR(metric->labels, "");
+	int64_t cumulative = 0;
+	unsigned int i;
+
+	if (header) {
+		print_header(out, metric->name, metric_type_str(metric->type), metric->help);
+	}
+
+	if (metric->type != AST_PROMETHEUS_HISTOGRAM) {
+		ast_str_append(out, 0, "%s%s%s%s %" PRId64 "\n", metric->name,
+			*labels ? "{" : "", labels, *labels ? "}" : "",
+			metric->get_value ? metric->get_value() : metric->value);
+		return;
+	}
+
+	for (i = 0; i <= metric->num_bounds; ++i) {
+		cumulative += metric->buckets[i];
+		if (i < metric->num_bounds) {
+			ast_str_append(out, 0, "%s_bucket{%s%sle=\"%" PRId64 "\"} %" PRId64 "\n",
+				metric->name, labels, *labels ? "," : "", metric->bounds[i], cumulative);
+		} else {
+			ast_str_append(out, 0, "%s_bucket{%s%sle=\"+Inf\"} %" PRId64 "\n",
+				metric->name, labels, *labels ? "," : "", cumulative);
+		}
+	}
+	ast_str_append(out, 0, "%s_sum%s%s%s %" PRId64 "\n", metric->name,
+		*labels ? "{" : "", labels, *labels ? "}" : "", metric->value);
+	ast_str_append(out, 0, "%s_count%s%s%s %" PRId64 "\n", metric->name,
+		*labels ? "{" : "", labels, *labels ? "}" : "", cumulative);
+}
+
+/*! \brief Print every registered metric */
+static void print_registered(struct ast_str **out)
+{
+	struct ast_prometheus_metric *metric;
+	const char *last = NULL;
+
+	AST_RWLIST_RDLOCK(&metrics);
+	AST_RWLIST_TRAVERSE(&metrics, metric, entry) {
+		print_metric(out, metric, !last || strcmp(last, metric->name));
+		last = metric->name;
+	}
+	AST_RWLIST_UNLOCK(&metrics);
+}
+
+static void print_gauge(struct ast_str **out, const char *name, const char *help, const char *value)
+{
+	print_header(out, name, "gauge", help);
+	ast_str_append(out, 0, "%s %s\n", name, value);
+}
+
+/*!
+ * \brief Print the RTP statistics of the channels that have RTP
+ *
+ * These are gathered from the channels when metrics are read, so they cover
+ * the calls that are up at the time.
+ */
+static void print_rtp(struct ast_str **out)
+{
+	struct ast_channel_iterator *iter;
+	struct ast_channel *chan;
+	unsigned int streams = 0;
+	uint64_t rx_packets = 0;
+	uint64_t tx_packets = 0;
+	uint64_t rx_lost = 0;
+	double total_jitter = 0.0;
+	double max_jitter = 0.0;
+	char value[32];
+
+	iter = ast_channel_iterator_all_new();
+	for (; iter && (chan = ast_channel_iterator_next(iter)); ast_channel_unref(chan)) {
+		struct ast_rtp_glue *glue;
+		struct ast_rtp_instance *instance = NULL;
+		struct ast_rtp_instance_stats stats;
+
+		ast_channel_lock(chan);
+		glue = ast_rtp_instance_get_glue(ast_channel_tech(chan)->type);
+		if (glue) {
+			glue->get_rtp_info(chan, &instance);
+		}
+		ast_channel_unlock(chan);
+		if (!instance) {
+			continue;
+		}
+
+		memset(&stats, 0, sizeof(stats));
+		if (!ast_rtp_instance_get_stats(instance, &stats, AST_RTP_INSTANCE_STAT_ALL)) {
+			++streams;
+			rx_packets += stats.rxcount;
+			tx_packets += stats.txcount;
+			rx_lost += stats.rxploss;
+			/* txjitter is the jitter measured on the packets we received, in seconds */
+			total_jitter += stats.txjitter;
+			max_jitter = MAX(max_jitter, stats.txjitter);
+		}
+		ao2_ref(instance, -1);
+	}
+	if (iter) {
+		ast_channel_iterator_destroy(iter);
+	}
+
+	snprintf(value, sizeof(value), "%u", streams);
+	print_gauge(out, "asterisk_rtp_streams", "Channels with an RTP stream", value);
+	snprintf(value, sizeof(value), "%" PRIu64, rx_packets);
+	print_gauge(out, "asterisk_rtp_rx_packets", "RTP packets received by the current streams", value);
+	snprintf(value, sizeof(value), "%" PRIu64, tx_packets);
+	print_gauge(out, "asterisk_rtp_tx_packets", "RTP packets sent by the current streams", value);
+	snprintf(value, sizeof(value), "%" PRIu64, rx_lost);
+	print_gauge(out, "asterisk_rtp_rx_packets_lost", "RTP packets lost by the current streams", value);
+	snprintf(value, sizeof(value), "%f", streams ? total_jitter / streams : 0.0);
+	print_gauge(out, "asterisk_rtp_rx_jitter_seconds_mean", "Mean jitter of the current streams", value);
+	snprintf(value, sizeof(value), "%f", max_jitter);
+	print_gauge(out, "asterisk_rtp_rx_jitter_seconds_max", "Largest jitter of the current streams", value);
+}
+
+/*! \brief Print a histogram of task times, counted in buckets of a power of two microseconds */
+static void print_task_histogram(struct ast_str **out, const char *name, const char *help,
+	const uint64_t *buckets, uint64_t total_us)
+{
+	uint64_t cumulative = 0;
+	int i;
+
+	print_header(out, name, "histogram", help);
+	for (i = 0; i < AST_TASKPROCESSOR_TIME_BUCKETS - 1; ++i) {
+		cumulative += buckets[i];
+		ast_str_append(out, 0, "%s_bucket{le=\"%f\"} %" PRIu64 "\n",
+			name, (double) ((uint64_t) 1 << i) / 1000000.0, cumulative);
+	}
+	cumulative += buckets[i];
+	ast_str_append(out, 0, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, cumulative);
+	ast_str_append(out, 0, "%s_sum %f\n", name, total_us / 1000000.0);
+	ast_str_append(out, 0, "%s_count %" PRIu64 "\n", name, cumulative);
+}
+
+/*!
+ * \brief Print how long taskprocessor tasks took, in total and for the callsites
+ * taking the most time
+ */
+static void print_taskprocessor_times(struct ast_str **out)
+{
+	struct ast_taskprocessor_times times;
+	struct ast_taskprocessor_callsite_times callsites[MAX_CALLSITES];
+	int count;
+	int i;
+
+	ast_taskprocessor_times_totals(&times);
+	print_task_histogram(out, "asterisk_taskprocessor_task_wait_seconds",
+		"Time tasks waited in taskprocessor queues", times.wait_buckets, times.wait_us);
+	print_task_histogram(out, "asterisk_taskprocessor_task_exec_seconds",
+		"Time taskprocessor tasks took to execute", times.exec_buckets, times.exec_us);
+
+	count = ast_taskprocessor_callsite_times_get(callsites, ARRAY_LEN(callsites));
+	print_header(out, "asterisk_taskprocessor_callsite_tasks_total", "counter",
+		"Tasks executed, by the function they were pushed with");
+	for (i = 0; i < count; ++i) {
+		ast_str_append(out, 0, "asterisk_taskprocessor_callsite_tasks_total{callsite=\"%s\"} %" PRIu64 "\n",
+			callsites[i].callsite, callsites[i].count);
+	}
+	print_header(out, "asterisk_taskprocessor_callsite_exec_seconds_total", "counter",
+		"Time tasks took to execute, by the function they were pushed with");
+	for (i = 0; i < count; ++i) {
+		ast_str_append(out, 0, "asterisk_taskprocessor_callsite_exec_seconds_total{callsite=\"%s\"} %f\n",
+			callsites[i].callsite, callsites[i].exec_us / 1000000.0);
+	}
+	print_header(out, "asterisk_taskprocessor_callsite_wait_seconds_total", "counter",
+		"Time tasks waited to execute, by the function they were pushed with");
+	for (i = 0; i < count; ++i) {
+		ast_str_append(out, 0, "asterisk_taskprocessor_callsite_wait_seconds_total{callsite=\"%s\"} %f\n",
+			callsites[i].callsite, callsites[i].wait_us / 1000000.0);
+	}
+}
+
+/*! \brief Print the TLS handshakes of the TCP/TLS servers and clients */
+static void print_tls_handshakes(struct ast_str **out)
+{
+	struct ast_tcptls_handshake_stats stats;
+
+	ast_tcptls_handshake_stats_get(&stats);
+
+	print_header(out, "asterisk_tls_handshakes_total", "counter", "TLS handshakes completed");
+	ast_str_append(out, 0, "asterisk_tls_handshakes_total %" PRIu64 "\n", stats.completed);
+	print_header(out, "asterisk_tls_handshakes_resumed_total", "counter",
+		"TLS handshakes completed by resuming a session");
+	ast_str_append(out, 0, "asterisk_tls_handshakes_resumed_total %" PRIu64 "\n", stats.resumed);
+	print_header(out, "asterisk_tls_handshakes_failed_total", "counter", "TLS handshakes that failed");
+	ast_str_append(out, 0, "asterisk_tls_handshakes_failed_total %" PRIu64 "\n", stats.failed);
+	print_header(out, "asterisk_tls_handshake_seconds_total", "counter",
+		"Time the completed TLS handshakes took");
+	ast_str_append(out, 0, "asterisk_tls_handshake_seconds_total %f\n", stats.total_us / 1000000.0);
+}
+
+#ifdef LATENCY_STATS
+/*! \brief Print the hot path latency as a summary with a quantile for each percentile */
+static void print_latency(struct ast_str **out)
+{
+	static const char name[] = "asterisk_latency_seconds";
+	struct ast_latency_summary summaries[AST_LATENCY_STAGE_MAX];
+	int stage;
+
+	ast_latency_get_summaries(summaries);
+
+	print_header(out, name, "summary", "Time spent in each hot path stage");
+	for (stage = 0; stage < AST_LATENCY_STAGE_MAX; ++stage) {
+		const char *stage_name = ast_latency_stage_name(stage);
+		struct ast_latency_summary *summary = &summaries[stage];
+
+		ast_str_append(out, 0, "%s{stage=\"%s\",quantile=\"0.5\"} %f\n",
+			name, stage_name, summary->p50_us / 1000000.0);
+		ast_str_append(out, 0, "%s{stage=\"%s\",quantile=\"0.99\"} %f\n",
+			name, stage_name, summary->p99_us / 1000000.0);
+		ast_str_append(out, 0, "%s{stage=\"%s\",quantile=\"0.999\"} %f\n",
+			name, stage_name, summary->p999_us / 1000000.0);
+		ast_str_append(out, 0, "%s_sum{stage=\"%s\"} %f\n",
+			name, stage_name, summary->total_us / 1000000.0);
+		ast_str_append(out, 0, "%s_count{stage=\"%s\"} %" PRIu64 "\n",
+			name, stage_name, summary->count);
+	}
+}
+#endif
+
+static int64_t channels_get(void)
+{
+	return ast_active_channels();
+}
+
+static int64_t channels_cpu_get(void)
+{
+	return ast_channel_cpu_usec_total();
+}
+
+static int64_t calls_get(void)
+{
+	return ast_active_calls();
+}
+
+static int64_t calls_processed_get(void)
+{
+	return ast_processed_calls();
+}
+
+static int64_t bridges_get(void)
+{
+	struct ao2_container *bridges;
+	int64_t count;
+
+	if (!ast_bridge_cache()) {
+		return 0;
+	}
+	bridges = stasis_cache_dump(ast_bridge_cache(), ast_bridge_snapshot_type());
+	if (!bridges) {
+		return 0;
+	}
+	count = ao2_container_count(bridges);
+	ao2_ref(bridges, -1);
+
+	return count;
+}
+
+static int64_t taskprocessors_get(void)
+{
+	unsigned long count;
+	unsigned long queued;
+	long max_queued;
+
+	ast_taskprocessor_totals(&count, &queued, &max_queued);
+	return count;
+}
+
+static int64_t taskprocessor_queued_get(void)
+{
+	unsigned long count;
+	unsigned long queued;
+	long max_queued;
+
+	ast_taskprocessor_totals(&count, &queued, &max_queued);
+	return queued;
+}
+
+static int64_t taskprocessor_max_queued_get(void)
+{
+	unsigned long count;
+	unsigned long queued;
+	long max_queued;
+
+	ast_taskprocessor_totals(&count, &queued, &max_queued);
+	return max_queued;
+}
+
+static int64_t taskprocessor_alerts_get(void)
+{
+	return ast_taskprocessor_alert_get();
+}
+
+/*! \brief Metrics of the core, read when metrics are served */
+static struct ast_prometheus_metric core_metrics[] = {
+	{ .type = AST_PROMETHEUS_GAUGE, .name = "asterisk_channels",
+	  .help = "Active channels", .get_value = channels_get, },
+	{ .type = AST_PROMETHEUS_COUNTER, .name = "asterisk_channels_cpu_microseconds_total",
+	  .help = "CPU time counted for channels, when built with CHANNEL_CPU_STATS", .get_value = channels_cpu_get, },
+	{ .type = AST_PROMETHEUS_GAUGE, .name = "asterisk_calls",
+	  .help = "Active calls", .get_value = calls_get, },
+	{ .type = AST_PROMETHEUS_COUNTER, .name = "asterisk_calls_processed_total",
+	  .help = "Calls processed since startup", .get_value = calls_processed_get, },
+	{ .type = AST_PROMETHEUS_GAUGE, .name = "asterisk_bridges",
+	  .help = "Active bridges", .get_value = bridges_get, },
+	{ .type = AST_PROMETHEUS_GAUGE, .name = "asterisk_taskprocessors",
+	  .help = "Taskprocessors", .get_value = taskprocessors_get, },
+	{ .type = AST_PROMETHEUS_GAUGE, .name = "asterisk_taskprocessor_queued_tasks",
+	  .help = "Tasks queued on all taskprocessors", .get_value = taskprocessor_queued_get, },
+	{ .type = AST_PROMETHEUS_GAUGE, .name = "asterisk_taskprocessor_max_queued_tasks",
+	  .help = "Tasks queued on the taskprocessor with the most", .get_value = taskprocessor_max_queued_get, },
+	{ .type = AST_PROMETHEUS_GAUGE, .name = "asterisk_taskprocessor_alerts",
+	  .help = "Taskprocessors over their high water mark", .get_value = taskprocessor_alerts_get, },
+};
+
+static int metrics_callback(struct ast_tcptls_session_instance *ser,
+	const struct ast_http_uri *urih, const char *uri,
+	enum ast_http_method method, struct ast_variable *get_vars,
+	struct ast_variable *headers)
+{
+	struct ast_str *http_header;
+	struct ast_str *out;
+
+	if (method != AST_HTTP_GET && method != AST_HTTP_HEAD) {
+		ast_http_error(ser, 501, "Not Implemented", "Attempt to use unimplemented / unsupported method");
+		return 0;
+	}
+
+	http_header = ast_str_create(64);
+	out = ast_str_create(4096);
+	if (!http_header || !out) {
+		ast_free(http_header);
+		ast_free(out);
+		ast_http_request_close_on_completion(ser);
+		ast_http_error(ser, 500, "Server Error", "Out of memory");
+		return 0;
+	}
+
+	print_registered(&out);
+	print_rtp(&out);
+	print_taskprocessor_times(&out);
+	print_tls_handshakes(&out);
+#ifdef LATENCY_STATS
+	print_latency(&out);
+#endif
+
+	ast_str_set(&http_header, 0, "Content-Type: " PROMETHEUS_CONTENT_TYPE "\r\n");
+	ast_http_send(ser, method, 200, NULL, http_header, out, 0, 0);
+
+	return 0;
+}
+
+/*! \brief The URI metrics are currently served on */
+static char metrics_uri_path[AST_MAX_EXTENSION];
+
+static struct ast_http_uri metrics_uri = {
+	.callback = metrics_callback,
+	.description = "Prometheus metrics",
+	.uri = metrics_uri_path,
+	.has_subtree = 0,
+	.data = NULL,
+	.key = __FILE__,
+};
+
+static int metrics_uri_linked;
+
+/*! \brief Mapping of the prometheus conf struct's globals to the
+ *         general context in the config file. */
+static struct aco_type global_option = {
+	.type = ACO_GLOBAL,
+	.name = "global",
+	.item_offset = offsetof(struct conf, global),
+	.category = "^general$",
+	.category_match = ACO_WHITELIST
+};
+
+static struct aco_type *global_options[] = ACO_TYPES(&global_option);
+
+/*! \brief Disposes of the prometheus conf object */
+static void conf_destructor(void *obj)
+{
+	struct conf *cfg = obj;
+
+	ao2_cleanup(cfg->global);
+}
+
+static void conf_global_destructor(void *obj)
+{
+	struct conf_global_options *global = obj;
+
+	ast_string_field_free_memory(global);
+}
+
+/*! \brief Creates the prometheus conf object. */
+static void *conf_alloc(void)
+{
+	struct conf *cfg;
+
+	if (!(cfg = ao2_alloc(sizeof(*cfg), conf_destructor))) {
+		return NULL;
+	}
+
+	if (!(cfg->global = ao2_alloc(sizeof(*cfg->global), conf_global_destructor))
+		|| ast_string_field_init(cfg->global, 32)) {
+		ao2_ref(cfg, -1);
+		return NULL;
+	}
+	return cfg;
+}
+
+/*! \brief The conf file that's processed for the module. */
+static struct aco_file conf_file = {
+	/*! The config file name. */
+	.filename = "prometheus.conf",
+	/*! The mapping object types to be processed. */
+	.types = ACO_TYPES(&global_option),
+};
+
+CONFIG_INFO_STANDARD(cfg_info, confs, conf_alloc,
+		     .files = ACO_FILES(&conf_file));
+
+/*! \brief Serve metrics on the configured URI, if enabled */
+static void metrics_uri_update(void)
+{
+	RAII_VAR(struct conf *, cfg, ao2_global_obj_ref(confs), ao2_cleanup);
+
+	if (metrics_uri_linked) {
+		ast_http_uri_unlink(&metrics_uri);
+		metrics_uri_linked = 0;
+	}
+
+	if (!cfg || !cfg->global->enabled) {
+		return;
+	}
+
+	ast_copy_string(metrics_uri_path, cfg->global->uri, sizeof(metrics_uri_path));
+	if (!ast_http_uri_link(&metrics_uri)) {
+		metrics_uri_linked = 1;
+	}
+}
+
+#ifdef TEST_FRAMEWORK
+AST_TEST_DEFINE(metric_format)
+{
+	static const int64_t bounds[] = { 10, 100 };
+	int64_t buckets[ARRAY_LEN(bounds) + 1] = { 0, };
+	struct ast_prometheus_metric invite =
+		AST_PROMETHEUS_METRIC_INIT(AST_PROMETHEUS_COUNTER, "test_requests_total",
+			"Requests", "method=\"INVITE\"");
+	struct ast_prometheus_metric gauge =
+		AST_PROMETHEUS_METRIC_INIT(AST_PROMETHEUS_GAUGE, "test_level", "Level", NULL);
+	struct ast_prometheus_metric bye =
+		AST_PROMETHEUS_METRIC_INIT(AST_PROMETHEUS_COUNTER, "test_requests_total",
+			"Requests", "method=\"BYE\"");
+	struct ast_prometheus_metric histogram =
+		AST_PROMETHEUS_HISTOGRAM_INIT("test_size", "Size", NULL, bounds, buckets);
+	struct ast_prometheus_metric *registered[] = { &invite, &gauge, &bye, &histogram };
+	static const char expected[] =
+		"# HELP test_requests_total Requests\n"
+		"# TYPE test_requests_total counter\n"
+		"test_requests_total{method=\"INVITE\"} 2\n"
+		"test_requests_total{method=\"BYE\"} 1\n"
+		"# HELP test_level Level\n"
+		"# TYPE test_level gauge\n"
+		"test_level -5\n"
+		"# HELP test_size Size\n"
+		"# TYPE test_size histogram\n"
+		"test_size_bucket{le=\"10\"} 1\n"
+		"test_size_bucket{le=\"100\"} 2\n"
+		"test_size_bucket{le=\"+Inf\"} 3\n"
+		"test_size_sum 1065\n"
+		"test_size_count 3\n";
+	struct ast_prometheus_metric *metric;
+	struct ast_str *out = NULL;
+	const char *last = NULL;
+	int i;
+	enum ast_test_result_state res = AST_TEST_FAIL;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "metric_format";
+		info->category = "/res/res_prometheus/";
+		info->summary = "Prometheus metric formatting";
+		info->description =
+			"Checks that metrics with the same name are grouped under\n"
+			"one header and that histograms count their buckets cumulatively.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	ast_prometheus_metric_add(&invite, 2);
+	ast_prometheus_metric_add(&bye, 1);
+	ast_prometheus_metric_set(&gauge, -5);
+	ast_prometheus_histogram_observe(&histogram, 5);
+	ast_prometheus_histogram_observe(&histogram, 60);
+	ast_prometheus_histogram_observe(&histogram, 1000);
+
+	/* Only the metrics named test_ are printed below, so other modules' metrics are left out */
+	for (i = 0; i < ARRAY_LEN(registered); ++i) {
+		if (ast_prometheus_metric_register(registered[i])) {
+			ast_test_status_update(test, "Failed to register metric %d\n", i);
+			goto cleanup;
+		}
+	}
+	if (!ast_prometheus_metric_register(&gauge)) {
+		ast_test_status_update(test, "Registered the same metric twice\n");
+		goto cleanup;
+	}
+
+	out = ast_str_create(512);
+	if (!out) {
+		goto cleanup;
+	}
+
+	AST_RWLIST_RDLOCK(&metrics);
+	AST_RWLIST_TRAVERSE(&metrics, metric, entry) {
+		if (strncmp(metric->name, "test_", 5)) {
+			continue;
+		}
+		print_metric(&out, metric, !last || strcmp(last, metric->name));
+		last = metric->name;
+	}
+	AST_RWLIST_UNLOCK(&metrics);
+
+	if (strcmp(ast_str_buffer(out), expected)) {
+		ast_test_status_update(test, "Expected:\n%s\nGot:\n%s\n", expected, ast_str_buffer(out));
+		goto cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+cleanup:
+	for (i = 0; i < ARRAY_LEN(registered); ++i) {
+		ast_prometheus_metric_unregister(registered[i]);
+	}
+	ast_free(out);
+
+	return res;
+}
+#endif
+
+static int load_module(void)
+{
+	int i;
+
+	if (aco_info_init(&cfg_info)) {
+		aco_info_destroy(&cfg_info);
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	aco_option_register(&cfg_info, "enabled", ACO_EXACT, global_options,
+		"no", OPT_BOOL_T, 1,
+		FLDSET(struct conf_global_options, enabled));
+
+	aco_option_register(&cfg_info, "uri", ACO_EXACT, global_options,
+		"metrics", OPT_STRINGFIELD_T, 0,
+		STRFLDSET(struct conf_global_options, uri));
+
+	if (aco_process_config(&cfg_info, 0) == ACO_PROCESS_ERROR) {
+		aco_info_destroy(&cfg_info);
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	for (i = 0; i < ARRAY_LEN(core_metrics); ++i) {
+		ast_prometheus_metric_register(&core_metrics[i]);
+	}
+
+	metrics_uri_update();
+
+	AST_TEST_REGISTER(metric_format);
+
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+static int unload_module(void)
+{
+	AST_TEST_UNREGISTER(metric_format);
+
+	if (metrics_uri_linked) {
+		ast_http_uri_unlink(&metrics_uri);
+		metrics_uri_linked = 0;
+	}
+
+	/* The metrics of other modules belong to them, so they are only forgotten */
+	AST_RWLIST_WRLOCK(&metrics);
+	while (AST_RWLIST_REMOVE_HEAD(&metrics, entry)) {
+	}
+	AST_RWLIST_UNLOCK(&metrics);
+
+	aco_info_destroy(&cfg_info);
+	ao2_global_obj_release(confs);
+	return 0;
+}
+
+static int reload_module(void)
+{
+	if (aco_process_config(&cfg_info, 1) == ACO_PROCESS_ERROR) {
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	metrics_uri_update();
+
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+/* The priority of this module is set to be as low as possible, since it could
+ * be used by any other sort of module.
+ */
+AST_MODULE_INFO(ASTERISK_GPL_KEY, AST_MODFLAG_GLOBAL_SYMBOLS | AST_MODFLAG_LOAD_ORDER, "Prometheus metrics",
+	.support_level = AST_MODULE_SUPPORT_EXTENDED,
+	.load = load_module,
+	.unload = unload_module,
+	.reload = reload_module,
+	.load_pri = 0,
+	);
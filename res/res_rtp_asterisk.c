@@ -71,6 +71,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/rtp_engine.h"
 #include "asterisk/smoother.h"
 #include "asterisk/test.h"
+#include "asterisk/alertpipe.h"
 
 #define MAX_TIMESTAMP_SKEW	640
 
@@ -127,10 +128,30 @@ static int dtmftimeout = DEFAULT_DTMF_TIMEOUT;
 
 static int rtpstart = DEFAULT_RTP_START;			/*!< First port for RTP sessions (set in rtp.conf) */
 static int rtpend = DEFAULT_RTP_END;			/*!< Last port for RTP sessions (set in rtp.conf) */
+
+/*! \brief Number of instances bound to each even port, indexed by port / 2 */
+static unsigned short rtp_ports_used[MAXIMUM_RTP_PORT / 2 + 1];
+
+/*! \brief Port allocation statistics, shown by "rtp show ports" */
+static struct {
+	/*! Ports allocated */
+	unsigned long allocations;
+	/*! Instances that found no free port */
+	unsigned long failures;
+	/*! bind() calls made allocating */
+	unsigned long binds;
+	/*! Time spent allocating, in microseconds */
+	uint64_t usec;
+} rtp_port_stats;
+
+/*! \brief Protects rtp_ports_used and rtp_port_stats */
+AST_MUTEX_DEFINE_STATIC(rtp_ports_lock);
 static int rtpdebug;			/*!< Are we debugging? */
 static int rtcpdebug;			/*!< Are we debugging RTCP? */
 static int rtcpstats;			/*!< Are we debugging RTCP? */
 static int rtcpinterval = RTCP_DEFAULT_INTERVALMS; /*!< Time between rtcp reports in millisecs */
+static int rtcp_publish_interval;	/*!< Least time between RTCP stasis messages of an instance in millisecs, 0 for every report */
+static unsigned int localbridge_threads;	/*!< Threads reading the RTP of locally bridged sessions, 0 to leave it to the channel threads */
 static struct ast_sockaddr rtpdebugaddr;	/*!< Debug packets to/from this host */
 static struct ast_sockaddr rtcpdebugaddr;	/*!< Debug RTCP packets to/from this host */
 static int rtpdebugport;		/*!< Debug only RTP packets from IP or IP+Port if port is > 0 */
@@ -143,6 +164,7 @@ static int learning_min_sequential = DEFAULT_LEARNING_MIN_SEQUENTIAL; /*!< Numbe
 #ifdef HAVE_PJPROJECT
 static int icesupport = DEFAULT_ICESUPPORT;
 static struct sockaddr_in stunaddr;
+static int stun_mapped_lifetime;	/*!< Seconds a mapped address learned over STUN is shared by new instances, 0 to not share */
 static pj_str_t turnaddr;
 static int turnport = DEFAULT_TURN_PORT;
 static pj_str_t turnusername;
@@ -155,6 +177,12 @@ static ast_rwlock_t ice_blacklist_lock = AST_RWLOCK_INIT_VALUE;
 static struct ast_ha *stun_blacklist = NULL;
 static ast_rwlock_t stun_blacklist_lock = AST_RWLOCK_INIT_VALUE;
 
+/*! External address last learned over STUN, shared with stun_mapped_lifetime */
+static struct in_addr stun_mapped_addr;
+/*! When stun_mapped_addr was learned, zero if it is not known */
+static struct timeval stun_mapped_time;
+AST_MUTEX_DEFINE_STATIC(stun_mapped_lock);
+
 
 /*! \brief Pool factory used by pjlib to allocate memory. */
 static pj_caching_pool cachingpool;
@@ -210,6 +238,8 @@ static AST_RWLIST_HEAD_STATIC(host_candidates, ast_ice_host_candidate);
 #define FLAG_NAT_INACTIVE_NOWARN        (1 << 1)
 #define FLAG_NEED_MARKER_BIT            (1 << 3)
 #define FLAG_DTMF_COMPENSATE            (1 << 4)
+#define FLAG_RELAY_SYNCED               (1 << 5)
+#define FLAG_SILENCE_SENT               (1 << 6)
 
 #define TRANSPORT_SOCKET_RTP 0
 #define TRANSPORT_SOCKET_RTCP 1
@@ -243,6 +273,7 @@ struct ice_wrap {
 /*! \brief RTP session description */
 struct ast_rtp {
 	int s;
+	int port;			/*!< Port allocated to s, 0 if none */
 	/*! \note The f.subclass.format holds a ref. */
 	struct ast_frame f;
 	unsigned char rawdata[8192 + AST_FRIENDLY_OFFSET];
@@ -303,6 +334,16 @@ struct ast_rtp {
 	struct ast_rtcp *rtcp;
 	struct ast_rtp *bridged;        /*!< Who we are Packet bridged to */
 
+	/* Packet bridging (relay) variables */
+	unsigned int relay_ssrc;             /*!< SSRC of the packets being relayed to bridged */
+	unsigned short relay_seqno_offset;   /*!< Added to the sequence number of relayed packets */
+	unsigned int relay_ts_offset;        /*!< Added to the timestamp of relayed packets */
+	unsigned short relay_next_seqno;     /*!< Sequence number of bridged after the last relayed packet */
+	unsigned int relay_offload_tried:1;  /*!< Bit to indicate that a relay engine has been tried for this bridge */
+	struct ast_rtp_relay_offload *relay_offload;     /*!< Relay engine relaying packets received by us */
+	struct ast_rtp_relay_offload *relay_offload_out; /*!< Relay engine relaying packets sent by us */
+	struct rtp_bridge_thread *bridge_thread;         /*!< Thread reading our packets while locally bridged, NULL if the channel's */
+
 	enum strict_rtp_state strict_rtp_state; /*!< Current state that strict RTP protection is in */
 	struct ast_sockaddr strict_rtp_address;  /*!< Remote address information for strict RTP purposes */
 
@@ -422,6 +463,10 @@ struct ast_rtcp {
 	/* VP8: sequence number for the RTCP FIR FCI */
 	int firseq;
 
+	/*! When a sent and a received report were last published */
+	struct timeval sent_published;
+	struct timeval received_published;
+
 #ifdef HAVE_OPENSSL_SRTP
 	struct dtls_details dtls; /*!< DTLS state information */
 #endif
@@ -475,6 +520,7 @@ static void ast_rtp_stun_request(struct ast_rtp_instance *instance, struct ast_s
 static void ast_rtp_stop(struct ast_rtp_instance *instance);
 static int ast_rtp_qos_set(struct ast_rtp_instance *instance, int tos, int cos, const char* desc);
 static int ast_rtp_sendcng(struct ast_rtp_instance *instance, int level);
+static int rtp_send_cn(struct ast_rtp_instance *instance, int level);
 
 #ifdef HAVE_OPENSSL_SRTP
 static int ast_rtp_activate(struct ast_rtp_instance *instance);
@@ -484,6 +530,10 @@ static void dtls_srtp_stop_timeout_timer(struct ast_rtp_instance *instance, stru
 #endif
 
 static int __rtp_sendto(struct ast_rtp_instance *instance, void *buf, size_t size, int flags, struct ast_sockaddr *sa, int rtcp, int *via_ice, int use_srtp);
+static void relay_offload_stop_in(struct ast_rtp *rtp);
+static void relay_offload_stop_out(struct ast_rtp *rtp);
+static void rtp_bridge_thread_remove(struct ast_rtp_instance *instance);
+static int ast_rtp_local_bridge_reads(struct ast_rtp_instance *instance);
 
 #ifdef HAVE_PJPROJECT
 /*! \brief Helper function which clears the ICE host candidate mapping */
@@ -1890,6 +1940,7 @@ static struct ast_rtp_engine asterisk_rtp_engine = {
 	.red_init = rtp_red_init,
 	.red_buffer = rtp_red_buffer,
 	.local_bridge = ast_rtp_local_bridge,
+	.local_bridge_reads = ast_rtp_local_bridge_reads,
 	.get_stat = ast_rtp_get_stat,
 	.dtmf_compatible = ast_rtp_dtmf_compatible,
 	.stun_request = ast_rtp_stun_request,
@@ -2406,10 +2457,23 @@ static int rtcp_mux(struct ast_rtp *rtp, const unsigned char *packet)
 	return 0;
 }
 
-/*! \pre instance is locked */
-static int __rtp_recvfrom(struct ast_rtp_instance *instance, void *buf, size_t size, int flags, struct ast_sockaddr *sa, int rtcp)
+/*!
+ * \internal
+ * \brief Handle DTLS, ICE and SRTP for a packet that has been received
+ *
+ * \param instance RTP instance the packet was received on
+ * \param buf The packet
+ * \param len Length of the packet
+ * \param sa Source of the packet
+ * \param rtcp Non-zero if the packet was received on the RTCP socket
+ *
+ * \return Length of the packet to interpret, 0 if it has been handled, or -1
+ * on failure
+ *
+ * \pre instance is locked
+ */
+static int rtp_recv_process(struct ast_rtp_instance *instance, void *buf, int len, struct ast_sockaddr *sa, int rtcp)
 {
-	int len;
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
 	struct ast_srtp *srtp = ast_rtp_instance_get_srtp(instance, rtcp);
 	char *in = buf;
@@ -2417,10 +2481,6 @@ static int __rtp_recvfrom(struct ast_rtp_instance *instance, void *buf, size_t s
 	struct ast_sockaddr *loop = rtcp ? &rtp->rtcp_loop : &rtp->rtp_loop;
 #endif
 
-	if ((len = ast_recvfrom(rtcp ? rtp->rtcp->s : rtp->s, buf, size, flags, sa)) < 0) {
-	   return len;
-	}
-
 #ifdef HAVE_OPENSSL_SRTP
 	/* If this is an SSL packet pass it to OpenSSL for processing. RFC section for first byte value:
 	 * https://tools.ietf.org/html/rfc5764#section-5.1.2 */
@@ -2547,6 +2607,19 @@ static int __rtp_recvfrom(struct ast_rtp_instance *instance, void *buf, size_t s
 	return len;
 }
 
+/*! \pre instance is locked */
+static int __rtp_recvfrom(struct ast_rtp_instance *instance, void *buf, size_t size, int flags, struct ast_sockaddr *sa, int rtcp)
+{
+	int len;
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+
+	if ((len = ast_recvfrom(rtcp ? rtp->rtcp->s : rtp->s, buf, size, flags, sa)) < 0) {
+	   return len;
+	}
+
+	return rtp_recv_process(instance, buf, len, sa, rtcp);
+}
+
 /*! \pre instance is locked */
 static int rtcp_recvfrom(struct ast_rtp_instance *instance, void *buf, size_t size, int flags, struct ast_sockaddr *sa)
 {
@@ -2785,6 +2858,56 @@ static int stun_address_is_blacklisted(const struct ast_sockaddr *addr)
 	return result;
 }
 
+/*!
+ * \internal
+ * \brief Get the external address shared by instances, if there is one
+ *
+ * \retval 0 if addr was set
+ * \retval -1 if a STUN request must be made
+ */
+static int stun_mapped_get(struct in_addr *addr)
+{
+	int res = -1;
+
+	if (!stun_mapped_lifetime) {
+		return -1;
+	}
+
+	ast_mutex_lock(&stun_mapped_lock);
+	if (!ast_tvzero(stun_mapped_time)
+		&& ast_tvdiff_ms(ast_tvnow(), stun_mapped_time) < stun_mapped_lifetime * 1000LL) {
+		*addr = stun_mapped_addr;
+		res = 0;
+	}
+	ast_mutex_unlock(&stun_mapped_lock);
+
+	return res;
+}
+
+/*!
+ * \internal
+ * \brief Share the external address learned by a STUN request
+ *
+ * The address is only shared if the NAT kept the local port, since other
+ * instances advertise it with their own port.
+ */
+static void stun_mapped_set(const struct sockaddr_in *answer, int port)
+{
+	if (!stun_mapped_lifetime) {
+		return;
+	}
+	if (ntohs(answer->sin_port) != port) {
+		ast_debug(3, "STUN mapped port %d differs from local port %d, not sharing the address\n",
+			ntohs(answer->sin_port), port);
+		return;
+	}
+
+	ast_mutex_lock(&stun_mapped_lock);
+	stun_mapped_addr = answer->sin_addr;
+	stun_mapped_time = ast_tvnow();
+	ast_mutex_unlock(&stun_mapped_lock);
+}
+
 /*! \pre instance is locked */
 static void rtp_add_candidates_to_ice(struct ast_rtp_instance *instance, struct ast_rtp *rtp, struct ast_sockaddr *addr, int port, int component,
 				      int transport)
@@ -2824,16 +2947,25 @@ static void rtp_add_candidates_to_ice(struct ast_rtp_instance *instance, struct
 	if (stunaddr.sin_addr.s_addr && count && ast_sockaddr_is_ipv4(addr)
 		&& !stun_address_is_blacklisted(addr)) {
 		struct sockaddr_in answer;
-		int rsp;
+		int rsp = -1;
 
-		/*
-		 * The instance should not be locked because we can block
-		 * waiting for a STUN respone.
-		 */
-		ao2_unlock(instance);
-		rsp = ast_stun_request(component == AST_RTP_ICE_COMPONENT_RTCP
-			? rtp->rtcp->s : rtp->s, &stunaddr, NULL, &answer);
-		ao2_lock(instance);
+		if (!stun_mapped_get(&answer.sin_addr)) {
+			answer.sin_port = htons(port);
+			rsp = 0;
+		}
+		if (rsp) {
+			/*
+			 * The instance should not be locked because we can block
+			 * waiting for a STUN respone.
+			 */
+			ao2_unlock(instance);
+			rsp = ast_stun_request(component == AST_RTP_ICE_COMPONENT_RTCP
+				? rtp->rtcp->s : rtp->s, &stunaddr, NULL, &answer);
+			ao2_lock(instance);
+			if (!rsp) {
+				stun_mapped_set(&answer, port);
+			}
+		}
 		if (!rsp) {
 			pj_sockaddr base;
 			pj_sockaddr ext;
@@ -2986,6 +3118,51 @@ static int ice_create(struct ast_rtp_instance *instance, struct ast_sockaddr *ad
 }
 #endif
 
+/*! \brief Whether an instance is bound to an even port */
+static int rtp_port_is_used(int port)
+{
+	int used;
+
+	ast_mutex_lock(&rtp_ports_lock);
+	used = rtp_ports_used[port / 2] != 0;
+	ast_mutex_unlock(&rtp_ports_lock);
+
+	return used;
+}
+
+/*! \brief Record that an instance has bound to an even port */
+static void rtp_port_acquire(int port, struct timeval start, int binds)
+{
+	ast_mutex_lock(&rtp_ports_lock);
+	if (rtp_ports_used[port / 2] < USHRT_MAX) {
+		rtp_ports_used[port / 2]++;
+	}
+	rtp_port_stats.allocations++;
+	rtp_port_stats.binds += binds;
+	rtp_port_stats.usec += MAX(ast_tvdiff_us(ast_tvnow(), start), 0);
+	ast_mutex_unlock(&rtp_ports_lock);
+}
+
+/*! \brief Record that an instance found no port to bind to */
+static void rtp_port_failed(struct timeval start, int binds)
+{
+	ast_mutex_lock(&rtp_ports_lock);
+	rtp_port_stats.failures++;
+	rtp_port_stats.binds += binds;
+	rtp_port_stats.usec += MAX(ast_tvdiff_us(ast_tvnow(), start), 0);
+	ast_mutex_unlock(&rtp_ports_lock);
+}
+
+/*! \brief Record that an instance has closed its socket on an even port */
+static void rtp_port_release(int port)
+{
+	ast_mutex_lock(&rtp_ports_lock);
+	if (rtp_ports_used[port / 2]) {
+		rtp_ports_used[port / 2]--;
+	}
+	ast_mutex_unlock(&rtp_ports_lock);
+}
+
 /*! \pre instance is locked */
 static int ast_rtp_new(struct ast_rtp_instance *instance,
 		       struct ast_sched_context *sched, struct ast_sockaddr *addr,
@@ -2993,6 +3170,9 @@ static int ast_rtp_new(struct ast_rtp_instance *instance,
 {
 	struct ast_rtp *rtp = NULL;
 	int x, startplace;
+	int pass = 0;
+	int binds = 0;
+	struct timeval start;
 
 	/* Create a new RTP structure to hold all of our data */
 	if (!(rtp = ast_calloc(1, sizeof(*rtp)))) {
@@ -3022,14 +3202,29 @@ static int ast_rtp_new(struct ast_rtp_instance *instance,
 	x = (rtpend == rtpstart) ? rtpstart : (ast_random() % (rtpend - rtpstart)) + rtpstart;
 	x = x & ~1;
 	startplace = x;
+	start = ast_tvnow();
 
+	/*
+	 * The first pass skips the ports other instances are bound to.  Those
+	 * may only be free on another address, so the second pass tries them.
+	 */
 	for (;;) {
-		ast_sockaddr_set_port(addr, x);
-		/* Try to bind, this will tell us whether the port is available or not */
-		if (!ast_bind(rtp->s, addr)) {
-			ast_debug(1, "Allocated port %d for RTP instance '%p'\n", x, instance);
-			ast_rtp_instance_set_local_address(instance, addr);
-			break;
+		if (pass || !rtp_port_is_used(x)) {
+			ast_sockaddr_set_port(addr, x);
+			binds++;
+			/* Try to bind, this will tell us whether the port is available or not */
+			if (!ast_bind(rtp->s, addr)) {
+				ast_debug(1, "Allocated port %d for RTP instance '%p'\n", x, instance);
+				ast_rtp_instance_set_local_address(instance, addr);
+				rtp_port_acquire(x, start, binds);
+				rtp->port = x;
+				break;
+			}
+
+			/* See if the bind failed because of something other than the address being in use */
+			if (errno != EADDRINUSE && errno != EACCES) {
+				break;
+			}
 		}
 
 		x += 2;
@@ -3037,15 +3232,20 @@ static int ast_rtp_new(struct ast_rtp_instance *instance,
 			x = (rtpstart + 1) & ~1;
 		}
 
-		/* See if we ran out of ports or if the bind actually failed because of something other than the address being in use */
-		if (x == startplace || (errno != EADDRINUSE && errno != EACCES)) {
-			ast_log(LOG_ERROR, "Oh dear... we couldn't allocate a port for RTP instance '%p'\n", instance);
-			close(rtp->s);
-			ast_free(rtp);
-			return -1;
+		if (x == startplace && pass++) {
+			/* We ran out of ports */
+			break;
 		}
 	}
 
+	if (!rtp->port) {
+		ast_log(LOG_ERROR, "Oh dear... we couldn't allocate a port for RTP instance '%p'\n", instance);
+		rtp_port_failed(start, binds);
+		close(rtp->s);
+		ast_free(rtp);
+		return -1;
+	}
+
 #ifdef HAVE_PJPROJECT
 	/* Initialize synchronization aspects */
 	ast_cond_init(&rtp->cond, NULL);
@@ -3095,6 +3295,9 @@ static int ast_rtp_destroy(struct ast_rtp_instance *instance)
 	ast_rtp_dtls_stop(instance);
 #endif
 
+	relay_offload_stop_in(rtp);
+	relay_offload_stop_out(rtp);
+
 	/* Destroy the smoother that was smoothing out audio if present */
 	if (rtp->smoother) {
 		ast_smoother_free(rtp->smoother);
@@ -3104,6 +3307,9 @@ static int ast_rtp_destroy(struct ast_rtp_instance *instance)
 	if (rtp->s > -1) {
 		close(rtp->s);
 	}
+	if (rtp->port) {
+		rtp_port_release(rtp->port);
+	}
 
 	/* Destroy RTCP if it was being used */
 	if (rtp->rtcp) {
@@ -3222,6 +3428,8 @@ static int ast_rtp_dtmf_begin(struct ast_rtp_instance *instance, char digit)
 	char data[256];
 	unsigned int *rtpheader = (unsigned int*)data;
 
+	relay_offload_stop_out(rtp);
+
 	ast_rtp_instance_get_remote_address(instance, &remote_address);
 
 	/* If we have no remote address information bail out now */
@@ -3555,6 +3763,35 @@ static void calculate_lost_packet_statistics(struct ast_rtp *rtp,
 	rtp->rtcp->rxlost_count++;
 }
 
+/*!
+ * \internal
+ * \brief Decide whether an RTCP report is to be published to stasis
+ *
+ * With rtcp_publish_interval set, an instance publishes at most one sent and
+ * one received report per interval.  The counters in a report are running
+ * totals, so the reports that are skipped are summed up by the next one.
+ *
+ * \param last When a report of the same kind was last published, updated
+ * if this one is to be
+ *
+ * \retval non-zero if the report is to be published
+ */
+static int rtcp_publish_due(struct timeval *last)
+{
+	struct timeval now;
+
+	if (!rtcp_publish_interval) {
+		return 1;
+	}
+
+	now = ast_tvnow();
+	if (!ast_tvzero(*last) && ast_tvdiff_ms(now, *last) < rtcp_publish_interval) {
+		return 0;
+	}
+	*last = now;
+	return 1;
+}
+
 /*!
  * \brief Send RTCP SR or RR report
  *
@@ -3704,12 +3941,14 @@ static int ast_rtcp_write_report(struct ast_rtp_instance *instance, int sr)
 		}
 	}
 
-	message_blob = ast_json_pack("{s: s, s: s}",
-			"to", ast_sockaddr_stringify(&remote_address),
-			"from", rtp->rtcp->local_addr_str);
-	ast_rtp_publish_rtcp_message(instance, ast_rtp_rtcp_sent_type(),
-			rtcp_report,
-			message_blob);
+	if (rtcp_publish_due(&rtp->rtcp->sent_published)) {
+		message_blob = ast_json_pack("{s: s, s: s}",
+				"to", ast_sockaddr_stringify(&remote_address),
+				"from", rtp->rtcp->local_addr_str);
+		ast_rtp_publish_rtcp_message(instance, ast_rtp_rtcp_sent_type(),
+				rtcp_report,
+				message_blob);
+	}
 	return res;
 }
 
@@ -3921,6 +4160,15 @@ static struct ast_frame *red_t140_to_red(struct rtp_red *red)
 }
 
 /*! \pre instance is locked */
+/*! \brief Whether the remote side takes comfort noise, not just the static payload type */
+static int rtp_cn_negotiated(struct ast_rtp_instance *instance)
+{
+	struct ast_rtp_codecs *codecs = ast_rtp_instance_get_codecs(instance);
+	int payload = ast_rtp_codecs_payload_code(codecs, 0, NULL, AST_RTP_CN);
+
+	return payload >= 0 && ast_rtp_codecs_find_payload_code(codecs, payload) >= 0;
+}
+
 static int ast_rtp_write(struct ast_rtp_instance *instance, struct ast_frame *frame)
 {
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
@@ -3928,6 +4176,9 @@ static int ast_rtp_write(struct ast_rtp_instance *instance, struct ast_frame *fr
 	struct ast_format *format;
 	int codec;
 
+	/* Anything we send ourselves must follow on from what a relay engine sent */
+	relay_offload_stop_out(rtp);
+
 	ast_rtp_instance_get_remote_address(instance, &remote_address);
 
 	/* If we don't actually know the remote address don't even bother doing anything */
@@ -4023,6 +4274,18 @@ static int ast_rtp_write(struct ast_rtp_instance *instance, struct ast_frame *fr
 		}
 	}
 
+	/* Silence is sent as a single comfort noise packet if the remote side
+	 * negotiated comfort noise, and the next audio starts a talkspurt. */
+	if (frame->frametype == AST_FRAME_VOICE && ast_test_flag(frame, AST_FRFLAG_SILENCE)
+		&& rtp_cn_negotiated(instance)) {
+		if (!ast_test_flag(rtp, FLAG_SILENCE_SENT)) {
+			rtp_send_cn(instance, 0);
+			ast_set_flag(rtp, FLAG_SILENCE_SENT | FLAG_NEED_MARKER_BIT);
+		}
+		return 0;
+	}
+	ast_clear_flag(rtp, FLAG_SILENCE_SENT);
+
 	/* If no smoother is present see if we have to set one up */
 	if (!rtp->smoother && ast_format_can_be_smoothed(format)) {
 		unsigned int smoother_flags = ast_format_get_smoother_flags(format);
@@ -4060,7 +4323,9 @@ static int ast_rtp_write(struct ast_rtp_instance *instance, struct ast_frame *fr
 		int hdrlen = 12;
 		struct ast_frame *f = NULL;
 
-		if (frame->offset < hdrlen) {
+		/* The RTP header is written in front of the data, which must not
+		 * happen to a payload shared with other frames. */
+		if (frame->offset < hdrlen || (frame->mallocd & AST_MALLOCD_SHARED)) {
 			f = ast_frdup(frame);
 		} else {
 			f = frame;
@@ -4675,6 +4940,9 @@ static struct ast_frame *ast_rtcp_interpret(struct ast_rtp_instance *instance, c
 			 * this loop.
 			 */
 
+			if (!rtcp_publish_due(&rtp->rtcp->received_published)) {
+				break;
+			}
 			message_blob = ast_json_pack("{s: s, s: s, s: f}",
 					"from", ast_sockaddr_stringify(&rtp->rtcp->them),
 					"to", rtp->rtcp->local_addr_str,
@@ -4775,6 +5043,126 @@ static struct ast_frame *ast_rtcp_read(struct ast_rtp_instance *instance)
 	return ast_rtcp_interpret(instance, read_area, res, &addr);
 }
 
+/*!
+ * \internal
+ * \brief Stop a relay engine relaying the packets received by an RTP session
+ *
+ * \pre The instance of rtp is locked
+ */
+static void relay_offload_stop_in(struct ast_rtp *rtp)
+{
+	unsigned int packets;
+	unsigned int octets;
+
+	if (!rtp->relay_offload) {
+		return;
+	}
+
+	ast_rtp_relay_offload_stop(rtp->relay_offload, &packets, &octets);
+	ao2_ref(rtp->relay_offload, -1);
+	rtp->relay_offload = NULL;
+
+	rtp->rxcount += packets;
+	rtp->rxoctetcount += octets;
+	ast_clear_flag(rtp, FLAG_RELAY_SYNCED);
+}
+
+/*!
+ * \internal
+ * \brief Stop a relay engine relaying packets sent by an RTP session
+ *
+ * \pre The instance of rtp is locked
+ */
+static void relay_offload_stop_out(struct ast_rtp *rtp)
+{
+	unsigned int packets;
+	unsigned int octets;
+
+	if (!rtp->relay_offload_out) {
+		return;
+	}
+
+	ast_rtp_relay_offload_stop(rtp->relay_offload_out, &packets, &octets);
+	ao2_ref(rtp->relay_offload_out, -1);
+	rtp->relay_offload_out = NULL;
+
+	rtp->txcount += packets;
+	rtp->txoctetcount += octets;
+	/* Carry on from where the relay engine left the sequence numbers */
+	rtp->seqno += packets;
+}
+
+/*!
+ * \internal
+ * \brief Determine if the packets received by an RTP session could be relayed by a relay engine
+ *
+ * Relay engines only rewrite headers so the packets must be plain RTP
+ * from a single known source.
+ *
+ * \pre instance is locked
+ */
+static int relay_offload_possible(struct ast_rtp_instance *instance)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+
+	if (ast_rtp_instance_get_srtp(instance, 0)) {
+		return 0;
+	}
+#ifdef HAVE_PJPROJECT
+	if (rtp->ice) {
+		return 0;
+	}
+#endif
+#ifdef HAVE_OPENSSL_SRTP
+	if (rtp->dtls.ssl) {
+		return 0;
+	}
+#endif
+	if (rtp->rtcp && rtp->rtcp->type == AST_RTP_INSTANCE_RTCP_MUX) {
+		return 0;
+	}
+
+	return rtp->strict_rtp_state != STRICT_RTP_LEARN;
+}
+
+/*!
+ * \internal
+ * \brief Try to hand the packets relayed from instance to instance1 to a relay engine
+ *
+ * \param relay The relay with the source, SSRC and payload map already filled in
+ *
+ * \return The started relay, which the caller must store in the session of instance
+ *
+ * \pre instance1 is locked
+ */
+static struct ast_rtp_relay_offload *relay_offload_start(struct ast_rtp_instance *instance, struct ast_rtp_instance *instance1,
+	struct ast_rtp_relay *relay, struct ast_sockaddr *remote_address)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+	struct ast_rtp *bridged = ast_rtp_instance_get_data(instance1);
+	struct ast_rtp_relay_offload *offload;
+
+	if (!relay_offload_possible(instance1)) {
+		return NULL;
+	}
+
+	relay->in_fd = rtp->s;
+	relay->out_fd = bridged->s;
+	ast_sockaddr_copy(&relay->destination, remote_address);
+	relay->out_ssrc = bridged->ssrc;
+	relay->seqno_offset = rtp->relay_seqno_offset;
+	relay->timestamp_offset = rtp->relay_ts_offset;
+
+	relay_offload_stop_out(bridged);
+	offload = ast_rtp_relay_offload_start(relay);
+	if (offload) {
+		ao2_ref(offload, +1);
+		bridged->relay_offload_out = offload;
+	}
+
+	return offload;
+}
+
 /*! \pre instance is locked */
 static int bridge_p2p_rtp_write(struct ast_rtp_instance *instance,
 	struct ast_rtp_instance *instance1, unsigned int *rtpheader, int len, int hdrlen)
@@ -4787,6 +5175,14 @@ static int bridge_p2p_rtp_write(struct ast_rtp_instance *instance,
 	struct ast_sockaddr remote_address = { {0,} };
 	int ice;
 	unsigned int timestamp = ntohl(rtpheader[1]);
+	unsigned int ssrc = ntohl(rtpheader[2]);
+	unsigned short seqno = reconstruct & 0xffff;
+	unsigned short seqno_out;
+	unsigned int timestamp_out;
+	int rate;
+	struct ast_rtp_relay *relay = NULL;
+	struct ast_rtp_relay_offload *offload = NULL;
+	int i;
 
 	/* Get fields from packet */
 	payload = (reconstruct & 0x7f0000) >> 16;
@@ -4815,6 +5211,16 @@ static int bridge_p2p_rtp_write(struct ast_rtp_instance *instance,
 		return -1;
 	}
 
+	/*
+	 * Bridge features listening for DTMF need the digits to come through
+	 * the core, which writes them to the bridged peer if they are not a
+	 * feature.  Only the audio is relayed then.
+	 */
+	if (!payload_type->asterisk_format && payload_type->rtp_code == AST_RTP_DTMF
+		&& ast_rtp_instance_get_prop(instance, AST_RTP_PROPERTY_LOCAL_BRIDGE_DTMF)) {
+		return -1;
+	}
+
 	/* If bridged peer is in dtmf, feed all packets to core until it finishes to avoid infinite dtmf */
 	if (bridged->sending_digit) {
 		ast_debug(1, "Feeding packets to core until DTMF finishes\n");
@@ -4837,11 +5243,38 @@ static int bridge_p2p_rtp_write(struct ast_rtp_instance *instance,
 		ast_clear_flag(rtp, FLAG_NEED_MARKER_BIT);
 	}
 
-	/* Reconstruct part of the packet */
-	reconstruct &= 0xFF80FFFF;
-	reconstruct |= (bridged_payload << 16);
-	reconstruct |= (mark << 23);
-	rtpheader[0] = htonl(reconstruct);
+	/* Packets arriving here mean the relay engine is no longer relaying them */
+	relay_offload_stop_in(rtp);
+
+	/* Describe the relay while we still know what instance negotiated */
+	if (!rtp->relay_offload_tried && relay_offload_possible(instance)) {
+		relay = ast_calloc(1, sizeof(*relay));
+	}
+	if (relay) {
+		struct ast_rtp_payload_type *type;
+
+		ast_rtp_instance_get_remote_address(instance, &relay->source);
+		relay->in_ssrc = ssrc;
+		for (i = 0; i < AST_RTP_MAX_PT; ++i) {
+			relay->payload_map[i] = -1;
+			type = ast_rtp_codecs_get_payload(ast_rtp_instance_get_codecs(instance), i);
+			if (!type) {
+				continue;
+			}
+			/* DTMF and comfort noise are left for us to handle */
+			if (type->asterisk_format) {
+				relay->payload_map[i] = ast_rtp_codecs_payload_code(ast_rtp_instance_get_codecs(instance1),
+					1, type->format, 0);
+				if (relay->payload_map[i] > -1
+					&& ast_rtp_codecs_find_payload_code(ast_rtp_instance_get_codecs(instance1), relay->payload_map[i]) == -1) {
+					relay->payload_map[i] = -1;
+				}
+			}
+			ao2_ref(type, -1);
+		}
+	}
+
+	rate = payload_type->asterisk_format ? rtp_get_rate(payload_type->format) : 8000;
 
 	/*
 	 * We have now determined that we need to send the RTP packet
@@ -4864,12 +5297,48 @@ static int bridge_p2p_rtp_write(struct ast_rtp_instance *instance,
 		ast_debug(5, "Remote address is null, most likely RTP has been stopped\n");
 		ao2_unlock(instance1);
 		ao2_lock(instance);
+		ast_free(relay);
 		return 0;
 	}
 
+	/*
+	 * The far end sees a single stream from bridged so the packets are
+	 * sent with its SSRC, and with sequence numbers and timestamps that
+	 * carry on from whatever it sent last.  Whenever the source changes or
+	 * bridged has sent something else the offsets are worked out again.
+	 */
+	if (!ast_test_flag(rtp, FLAG_RELAY_SYNCED) || ssrc != rtp->relay_ssrc
+		|| bridged->seqno != rtp->relay_next_seqno) {
+		rtp->relay_ssrc = ssrc;
+		rtp->relay_seqno_offset = bridged->seqno - seqno;
+		rtp->relay_ts_offset = bridged->lastts + calc_txstamp(bridged, NULL) * (rate / 1000) - timestamp;
+		ast_set_flag(rtp, FLAG_RELAY_SYNCED);
+		mark = 1;
+	}
+	seqno_out = seqno + rtp->relay_seqno_offset;
+	timestamp_out = timestamp + rtp->relay_ts_offset;
+
+	/* Reconstruct part of the packet */
+	reconstruct &= 0xFF800000;
+	reconstruct |= (bridged_payload << 16);
+	reconstruct |= (mark << 23);
+	reconstruct |= seqno_out;
+	rtpheader[0] = htonl(reconstruct);
+	rtpheader[1] = htonl(timestamp_out);
+	rtpheader[2] = htonl(bridged->ssrc);
+
+	/* Late and duplicate packets must not take bridged backwards */
+	if ((short) (seqno_out - bridged->seqno) >= 0) {
+		bridged->seqno = seqno_out + 1;
+		bridged->lastts = timestamp_out;
+		bridged->txcore = ast_tvnow();
+	}
+	rtp->relay_next_seqno = bridged->seqno;
+
 	/* Send the packet back out */
 	res = rtp_sendto(instance1, (void *)rtpheader, len, 0, &remote_address, &ice);
 	if (res < 0) {
+		ast_free(relay);
 		if (!ast_rtp_instance_get_prop(instance1, AST_RTP_PROPERTY_NAT) || (ast_rtp_instance_get_prop(instance1, AST_RTP_PROPERTY_NAT) && (ast_test_flag(bridged, FLAG_NAT_ACTIVE) == FLAG_NAT_ACTIVE))) {
 			ast_log(LOG_WARNING,
 				"RTP Transmission error of packet to %s: %s\n",
@@ -4897,58 +5366,51 @@ static int bridge_p2p_rtp_write(struct ast_rtp_instance *instance,
 			    bridged_payload, len - hdrlen);
 	}
 
+	/* Only a plain UDP path can be handed to a relay engine */
+	if (relay && !ice) {
+		rtp->relay_offload_tried = 1;
+		offload = relay_offload_start(instance, instance1, relay, &remote_address);
+	}
+	ast_free(relay);
+
 	ao2_unlock(instance1);
 	ao2_lock(instance);
+	rtp->relay_offload = offload;
 	return 0;
 }
 
-/*! \pre instance is locked */
-static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtcp)
+/*!
+ * \internal
+ * \brief Interpret an RTP packet that has been read into the instance's buffer
+ *
+ * \param instance RTP instance the packet was received on
+ * \param src Source of the packet
+ * \param res Length of the packet, 0 if it has already been handled
+ *
+ * \pre instance is locked
+ */
+static struct ast_frame *ast_rtp_interpret(struct ast_rtp_instance *instance, const struct ast_sockaddr *src, int res)
 {
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
 	struct ast_rtp_instance *instance1;
 	struct ast_sockaddr addr;
-	int res, hdrlen = 12, version, payloadtype, padding, mark, ext, cc, prev_seqno;
+	int hdrlen = 12, version, payloadtype, padding, mark, ext, cc, prev_seqno;
 	unsigned char *read_area = rtp->rawdata + AST_FRIENDLY_OFFSET;
-	size_t read_area_size = sizeof(rtp->rawdata) - AST_FRIENDLY_OFFSET;
 	unsigned int *rtpheader = (unsigned int*)(read_area), seqno, ssrc, timestamp;
 	RAII_VAR(struct ast_rtp_payload_type *, payload, NULL, ao2_cleanup);
 	struct ast_sockaddr remote_address = { {0,} };
 	struct frame_list frames;
 
-	/* If this is actually RTCP let's hop on over and handle it */
-	if (rtcp) {
-		if (rtp->rtcp && rtp->rtcp->type == AST_RTP_INSTANCE_RTCP_STANDARD) {
-			return ast_rtcp_read(instance);
-		}
+	ast_sockaddr_copy(&addr, src);
+
+	/* If this was handled by the ICE session don't do anything */
+	if (!res) {
 		return &ast_null_frame;
 	}
 
-	/* If we are currently sending DTMF to the remote party send a continuation packet */
-	if (rtp->sending_digit) {
-		ast_rtp_dtmf_continuation(instance);
-	}
-
-	/* Actually read in the data from the socket */
-	if ((res = rtp_recvfrom(instance, read_area, read_area_size, 0,
-				&addr)) < 0) {
-		ast_assert(errno != EBADF);
-		if (errno != EAGAIN) {
-			ast_log(LOG_WARNING, "RTP Read error: %s.  Hanging up.\n",
-				(errno) ? strerror(errno) : "Unspecified");
-			return NULL;
-		}
-		return &ast_null_frame;
-	}
-
-	/* If this was handled by the ICE session don't do anything */
-	if (!res) {
-		return &ast_null_frame;
-	}
-
-	/* This could be a multiplexed RTCP packet. If so, be sure to interpret it correctly */
-	if (rtcp_mux(rtp, read_area)) {
-		return ast_rtcp_interpret(instance, read_area, res, &addr);
+	/* This could be a multiplexed RTCP packet. If so, be sure to interpret it correctly */
+	if (rtcp_mux(rtp, read_area)) {
+		return ast_rtcp_interpret(instance, read_area, res, &addr);
 	}
 
 	/* Make sure the data that was read in is actually enough to make up an RTP packet */
@@ -5338,6 +5800,189 @@ static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtc
 	return AST_LIST_FIRST(&frames);
 }
 
+#ifdef HAVE_RECVMMSG
+/*! \brief Most RTP packets taken off a socket by one read */
+#define RTP_READ_BATCH 4
+
+/*! \brief Buffers for the packets of a batch after the first */
+struct rtp_read_batch {
+	/*! Each the size of the read area of struct ast_rtp rawdata */
+	unsigned char data[RTP_READ_BATCH - 1][8192];
+};
+
+AST_THREADSTORAGE(rtp_read_batch_buf);
+
+/*! \brief Set if the kernel does not implement recvmmsg */
+static int rtp_read_batch_unsupported;
+
+/*!
+ * \internal
+ * \brief Add the frames of one packet of a batch to the frames to return
+ *
+ * \param frames Frames read so far
+ * \param f Frames interpreted from the packet
+ * \param copy Non-zero if the instance's buffer and frame are about to be
+ * reused for the next packet, so the frames must be copied
+ */
+static void rtp_read_batch_append(struct frame_list *frames, struct ast_frame *f, int copy)
+{
+	struct ast_frame *next;
+
+	if (f == &ast_null_frame) {
+		return;
+	}
+
+	for (; f; f = next) {
+		next = AST_LIST_NEXT(f, frame_list);
+		AST_LIST_NEXT(f, frame_list) = NULL;
+		if (copy) {
+			struct ast_frame *dup = ast_frdup(f);
+
+			ast_frfree(f);
+			if (!dup) {
+				continue;
+			}
+			f = dup;
+		}
+		AST_LIST_INSERT_TAIL(frames, f, frame_list);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Read every RTP packet waiting on the socket, up to RTP_READ_BATCH
+ *
+ * The first packet is received straight into the instance's buffer and the
+ * others into thread storage, then each is interpreted in turn.  The frames
+ * of all of them are returned as one list, which the channel core queues.
+ *
+ * \pre instance is locked
+ */
+static struct ast_frame *ast_rtp_read_batch(struct ast_rtp_instance *instance)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+	unsigned char *read_area = rtp->rawdata + AST_FRIENDLY_OFFSET;
+	struct rtp_read_batch *batch;
+	struct mmsghdr msgs[RTP_READ_BATCH];
+	struct iovec iovs[RTP_READ_BATCH];
+	struct ast_sockaddr addrs[RTP_READ_BATCH];
+	struct frame_list frames = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
+	struct ast_frame *f;
+	int count;
+	int res;
+	int i;
+
+	batch = ast_threadstorage_get(&rtp_read_batch_buf, sizeof(*batch));
+	count = batch ? RTP_READ_BATCH : 1;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < count; i++) {
+		if (i) {
+			iovs[i].iov_base = batch->data[i - 1];
+			iovs[i].iov_len = sizeof(batch->data[i - 1]);
+		} else {
+			iovs[i].iov_base = read_area;
+			iovs[i].iov_len = sizeof(rtp->rawdata) - AST_FRIENDLY_OFFSET;
+		}
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &addrs[i].ss;
+		msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i].ss);
+	}
+
+	if ((count = recvmmsg(rtp->s, msgs, count, 0, NULL)) < 0) {
+		ast_assert(errno != EBADF);
+		if (errno == ENOSYS) {
+			/* The packets are still waiting and will be read one at a time */
+			ast_log(LOG_NOTICE, "recvmmsg is not supported, reading RTP packets one at a time\n");
+			rtp_read_batch_unsupported = 1;
+			return &ast_null_frame;
+		}
+		if (errno != EAGAIN) {
+			ast_log(LOG_WARNING, "RTP Read error: %s.  Hanging up.\n",
+				(errno) ? strerror(errno) : "Unspecified");
+			return NULL;
+		}
+		return &ast_null_frame;
+	}
+
+	for (i = 0; i < count; i++) {
+		addrs[i].len = msgs[i].msg_hdr.msg_namelen;
+		if (i) {
+			memcpy(read_area, batch->data[i - 1], msgs[i].msg_len);
+		}
+
+		if ((res = rtp_recv_process(instance, read_area, msgs[i].msg_len, &addrs[i], 0)) < 0) {
+			if (errno != EAGAIN) {
+				ast_log(LOG_WARNING, "RTP Read error: %s.  Hanging up.\n",
+					(errno) ? strerror(errno) : "Unspecified");
+				f = NULL;
+				break;
+			}
+			continue;
+		}
+
+		if (!(f = ast_rtp_interpret(instance, &addrs[i], res))) {
+			break;
+		}
+		rtp_read_batch_append(&frames, f, i < count - 1);
+	}
+
+	if (i < count) {
+		/* Reading failed, so the channel is going to be hung up */
+		if (AST_LIST_FIRST(&frames)) {
+			ast_frfree(AST_LIST_FIRST(&frames));
+		}
+		return NULL;
+	}
+
+	return AST_LIST_FIRST(&frames) ? AST_LIST_FIRST(&frames) : &ast_null_frame;
+}
+#endif
+
+/*! \pre instance is locked */
+static struct ast_frame *ast_rtp_read(struct ast_rtp_instance *instance, int rtcp)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+	struct ast_sockaddr addr;
+	int res;
+	unsigned char *read_area = rtp->rawdata + AST_FRIENDLY_OFFSET;
+	size_t read_area_size = sizeof(rtp->rawdata) - AST_FRIENDLY_OFFSET;
+
+	/* If this is actually RTCP let's hop on over and handle it */
+	if (rtcp) {
+		if (rtp->rtcp && rtp->rtcp->type == AST_RTP_INSTANCE_RTCP_STANDARD) {
+			return ast_rtcp_read(instance);
+		}
+		return &ast_null_frame;
+	}
+
+	/* If we are currently sending DTMF to the remote party send a continuation packet */
+	if (rtp->sending_digit) {
+		ast_rtp_dtmf_continuation(instance);
+	}
+
+#ifdef HAVE_RECVMMSG
+	if (!rtp_read_batch_unsupported) {
+		return ast_rtp_read_batch(instance);
+	}
+#endif
+
+	/* Actually read in the data from the socket */
+	if ((res = rtp_recvfrom(instance, read_area, read_area_size, 0,
+				&addr)) < 0) {
+		ast_assert(errno != EBADF);
+		if (errno != EAGAIN) {
+			ast_log(LOG_WARNING, "RTP Read error: %s.  Hanging up.\n",
+				(errno) ? strerror(errno) : "Unspecified");
+			return NULL;
+		}
+		return &ast_null_frame;
+	}
+
+	return ast_rtp_interpret(instance, &addr, res);
+}
+
 /*! \pre instance is locked */
 static void ast_rtp_prop_set(struct ast_rtp_instance *instance, enum ast_rtp_property property, int value)
 {
@@ -5500,6 +6145,10 @@ static void ast_rtp_remote_address_set(struct ast_rtp_instance *instance, struct
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
 	struct ast_sockaddr local;
 
+	/* Relay engines only know the old address */
+	relay_offload_stop_in(rtp);
+	relay_offload_stop_out(rtp);
+
 	ast_rtp_instance_get_local_address(instance, &local);
 	if (!ast_sockaddr_isnull(addr)) {
 		/* Update the local RTP address with what is being used */
@@ -5603,17 +6252,311 @@ static int rtp_red_buffer(struct ast_rtp_instance *instance, struct ast_frame *f
 }
 
 /*! \pre Neither instance0 nor instance1 are locked */
+/*!
+ * \brief A thread reading the RTP of locally bridged sessions
+ *
+ * Packets relayed to the bridged session are then sent from this thread
+ * without waking the channel thread.  Only the frames that the core has to
+ * handle, such as DTMF, are queued on the channel.
+ */
+struct rtp_bridge_thread {
+	/*! The thread */
+	pthread_t id;
+	/*! Protects instances, stop and changed */
+	ast_mutex_t lock;
+	/*! Alerted when instances changed or the thread should stop */
+	int alert_pipe[2];
+	/*! Set to stop the thread */
+	unsigned int stop:1;
+	/*! Set when instances changed since the thread last polled */
+	unsigned int changed:1;
+	/*! Instances read by the thread, each holding a reference */
+	AST_VECTOR(, struct ast_rtp_instance *) instances;
+};
+
+/*! \brief Threads reading the RTP of locally bridged sessions */
+static struct rtp_bridge_thread *bridge_threads;
+
+/*! \brief Number of bridge_threads */
+static unsigned int bridge_thread_count;
+
+/*! \brief Used to spread sessions across bridge_threads */
+static int bridge_thread_next;
+
+/*!
+ * \internal
+ * \brief Read the packets waiting on a session for a bridge thread
+ *
+ * \note Called without the instance locked.
+ */
+static void rtp_bridge_thread_read(struct rtp_bridge_thread *thread, struct ast_rtp_instance *instance)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+	struct frame_list frames = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
+	struct ast_frame *f;
+	struct ast_frame *cur;
+	struct ast_frame *dup;
+	struct ast_channel *chan;
+	const char *channel_id;
+	int hangup = 0;
+
+	ao2_lock(instance);
+	if (rtp->bridge_thread != thread) {
+		/* The bridge stopped since the thread last polled */
+		ao2_unlock(instance);
+		return;
+	}
+
+	f = ast_rtp_read(instance, 0);
+	if (!f) {
+		/* The channel would have hung up on this error, so have it do so. */
+		hangup = 1;
+		rtp_bridge_thread_remove(instance);
+	} else if (f != &ast_null_frame) {
+		/* The frames are only valid until the next read of the session. */
+		for (cur = f; cur; cur = AST_LIST_NEXT(cur, frame_list)) {
+			if ((dup = ast_frdup(cur))) {
+				AST_LIST_INSERT_TAIL(&frames, dup, frame_list);
+			}
+		}
+		ast_frfree(f);
+	}
+	channel_id = ast_strdupa(ast_rtp_instance_get_channel_id(instance));
+	ao2_unlock(instance);
+
+	if (!hangup && !AST_LIST_FIRST(&frames)) {
+		/* Everything was relayed */
+		return;
+	}
+
+	chan = ast_strlen_zero(channel_id) ? NULL : ast_channel_get_by_name(channel_id);
+	if (chan) {
+		if (hangup) {
+			ast_queue_hangup(chan);
+		} else {
+			ast_queue_frame(chan, AST_LIST_FIRST(&frames));
+		}
+		ast_channel_unref(chan);
+	}
+
+	if (AST_LIST_FIRST(&frames)) {
+		ast_frfree(AST_LIST_FIRST(&frames));
+	}
+}
+
+static void *rtp_bridge_thread_run(void *data)
+{
+	struct rtp_bridge_thread *thread = data;
+	AST_VECTOR(, struct ast_rtp_instance *) instances;
+	struct ast_rtp_instance *instance;
+	struct pollfd *pfds = NULL;
+	struct pollfd *new_pfds;
+	size_t count;
+	size_t i;
+
+	AST_VECTOR_INIT(&instances, 0);
+
+	for (;;) {
+		ast_mutex_lock(&thread->lock);
+		if (thread->stop) {
+			ast_mutex_unlock(&thread->lock);
+			break;
+		}
+		if (thread->changed || !pfds) {
+			count = AST_VECTOR_SIZE(&thread->instances);
+			new_pfds = ast_calloc(count + 1, sizeof(*new_pfds));
+			if (new_pfds) {
+				ast_free(pfds);
+				pfds = new_pfds;
+				pfds[0].fd = thread->alert_pipe[0];
+				pfds[0].events = POLLIN;
+
+				/* Poll a copy so the bridges do not wait on the thread. */
+				AST_VECTOR_RESET(&instances, ao2_cleanup);
+				for (i = 0; i < count; ++i) {
+					instance = AST_VECTOR_GET(&thread->instances, i);
+					if (AST_VECTOR_APPEND(&instances, instance)) {
+						break;
+					}
+					ao2_ref(instance, +1);
+					pfds[AST_VECTOR_SIZE(&instances)].fd =
+						((struct ast_rtp *) ast_rtp_instance_get_data(instance))->s;
+					pfds[AST_VECTOR_SIZE(&instances)].events = POLLIN;
+				}
+				thread->changed = 0;
+			}
+		}
+		ast_mutex_unlock(&thread->lock);
+
+		if (!pfds) {
+			usleep(100000);
+			continue;
+		}
+
+		if (ast_poll(pfds, AST_VECTOR_SIZE(&instances) + 1, -1) <= 0) {
+			continue;
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			ast_alertpipe_read(thread->alert_pipe);
+		}
+
+		for (i = 0; i < AST_VECTOR_SIZE(&instances); ++i) {
+			if (pfds[i + 1].revents & (POLLIN | POLLERR)) {
+				rtp_bridge_thread_read(thread, AST_VECTOR_GET(&instances, i));
+			}
+		}
+	}
+
+	AST_VECTOR_RESET(&instances, ao2_cleanup);
+	AST_VECTOR_FREE(&instances);
+	ast_free(pfds);
+
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Have a bridge thread read the packets of a session
+ *
+ * \pre instance is locked
+ */
+static void rtp_bridge_thread_add(struct ast_rtp_instance *instance)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+	struct rtp_bridge_thread *thread;
+	int res;
+
+	if (rtp->bridge_thread || !bridge_thread_count) {
+		return;
+	}
+
+	thread = &bridge_threads[(unsigned int) ast_atomic_fetchadd_int(&bridge_thread_next, +1) % bridge_thread_count];
+
+	ast_mutex_lock(&thread->lock);
+	res = AST_VECTOR_APPEND(&thread->instances, instance);
+	if (!res) {
+		ao2_ref(instance, +1);
+		thread->changed = 1;
+	}
+	ast_mutex_unlock(&thread->lock);
+
+	if (!res) {
+		rtp->bridge_thread = thread;
+		ast_alertpipe_write(thread->alert_pipe);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Leave reading the packets of a session to the channel again
+ *
+ * \pre instance is locked
+ */
+static void rtp_bridge_thread_remove(struct ast_rtp_instance *instance)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+	struct rtp_bridge_thread *thread = rtp->bridge_thread;
+
+	if (!thread) {
+		return;
+	}
+	rtp->bridge_thread = NULL;
+
+	ast_mutex_lock(&thread->lock);
+	/* The caller holds a reference, so this is never the last one. */
+	AST_VECTOR_REMOVE_CMP_UNORDERED(&thread->instances, instance, AST_VECTOR_ELEM_DEFAULT_CMP, ao2_cleanup);
+	thread->changed = 1;
+	ast_mutex_unlock(&thread->lock);
+
+	ast_alertpipe_write(thread->alert_pipe);
+}
+
+static void rtp_bridge_threads_stop(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < bridge_thread_count; ++i) {
+		struct rtp_bridge_thread *thread = &bridge_threads[i];
+
+		if (thread->id != AST_PTHREADT_NULL) {
+			ast_mutex_lock(&thread->lock);
+			thread->stop = 1;
+			ast_mutex_unlock(&thread->lock);
+			ast_alertpipe_write(thread->alert_pipe);
+			pthread_join(thread->id, NULL);
+		}
+		AST_VECTOR_RESET(&thread->instances, ao2_cleanup);
+		AST_VECTOR_FREE(&thread->instances);
+		ast_alertpipe_close(thread->alert_pipe);
+		ast_mutex_destroy(&thread->lock);
+	}
+
+	ast_free(bridge_threads);
+	bridge_threads = NULL;
+	bridge_thread_count = 0;
+}
+
+static int rtp_bridge_threads_start(unsigned int count)
+{
+	unsigned int i;
+
+	if (!count) {
+		return 0;
+	}
+
+	bridge_threads = ast_calloc(count, sizeof(*bridge_threads));
+	if (!bridge_threads) {
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		struct rtp_bridge_thread *thread = &bridge_threads[i];
+
+		thread->id = AST_PTHREADT_NULL;
+		ast_alertpipe_clear(thread->alert_pipe);
+		ast_mutex_init(&thread->lock);
+		AST_VECTOR_INIT(&thread->instances, 0);
+		/* Counted first so a failure cleans up what was set up. */
+		bridge_thread_count = i + 1;
+		if (ast_alertpipe_init(thread->alert_pipe)
+			|| ast_pthread_create_background(&thread->id, NULL, rtp_bridge_thread_run, thread)) {
+			thread->id = AST_PTHREADT_NULL;
+			rtp_bridge_threads_stop();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 static int ast_rtp_local_bridge(struct ast_rtp_instance *instance0, struct ast_rtp_instance *instance1)
 {
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance0);
 
 	ao2_lock(instance0);
 	ast_set_flag(rtp, FLAG_NEED_MARKER_BIT);
+	ast_clear_flag(rtp, FLAG_RELAY_SYNCED);
+	relay_offload_stop_in(rtp);
+	rtp->relay_offload_tried = 0;
+	if (instance1) {
+		rtp_bridge_thread_add(instance0);
+	} else {
+		rtp_bridge_thread_remove(instance0);
+	}
 	ao2_unlock(instance0);
 
 	return 0;
 }
 
+/*! \pre instance is locked */
+static int ast_rtp_local_bridge_reads(struct ast_rtp_instance *instance)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+
+	return rtp->bridge_thread ? 1 : 0;
+}
+
 /*! \pre instance is locked */
 static int ast_rtp_get_stat(struct ast_rtp_instance *instance, struct ast_rtp_instance_stats *stats, enum ast_rtp_instance_stat stat)
 {
@@ -5704,6 +6647,8 @@ static void ast_rtp_stop(struct ast_rtp_instance *instance)
 	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
 	struct ast_sockaddr addr = { {0,} };
 
+	rtp_bridge_thread_remove(instance);
+
 #ifdef HAVE_OPENSSL_SRTP
 	ao2_unlock(instance);
 	AST_SCHED_DEL_UNREF(rtp->sched, rtp->rekeyid, ao2_ref(instance, -1));
@@ -5747,11 +6692,11 @@ static int ast_rtp_qos_set(struct ast_rtp_instance *instance, int tos, int cos,
 }
 
 /*!
- * \brief generate comfort noice (CNG)
+ * \brief Send a comfort noise (CN) packet
  *
  * \pre instance is locked
  */
-static int ast_rtp_sendcng(struct ast_rtp_instance *instance, int level)
+static int rtp_send_cn(struct ast_rtp_instance *instance, int level)
 {
 	unsigned int *rtpheader;
 	int hdrlen = 12;
@@ -5771,8 +6716,6 @@ static int ast_rtp_sendcng(struct ast_rtp_instance *instance, int level)
 
 	level = 127 - (level & 0x7f);
 
-	rtp->dtmfmute = ast_tvadd(ast_tvnow(), ast_tv(0, 500000));
-
 	/* Get a pointer to the header */
 	rtpheader = (unsigned int *)data;
 	rtpheader[0] = htonl((2 << 30) | (payload << 16) | (rtp->seqno));
@@ -5799,6 +6742,20 @@ static int ast_rtp_sendcng(struct ast_rtp_instance *instance, int level)
 	return res;
 }
 
+/*!
+ * \brief generate comfort noice (CNG)
+ *
+ * \pre instance is locked
+ */
+static int ast_rtp_sendcng(struct ast_rtp_instance *instance, int level)
+{
+	struct ast_rtp *rtp = ast_rtp_instance_get_data(instance);
+
+	rtp->dtmfmute = ast_tvadd(ast_tvnow(), ast_tv(0, 500000));
+
+	return rtp_send_cn(instance, level);
+}
+
 #ifdef HAVE_OPENSSL_SRTP
 static void dtls_perform_setup(struct dtls_details *dtls)
 {
@@ -5943,6 +6900,55 @@ static char *handle_cli_rtcp_set_debug(struct ast_cli_entry *e, int cmd, struct
 	return CLI_SHOWUSAGE;   /* default, failure */
 }
 
+static char *handle_cli_rtp_show_ports(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	unsigned long allocations;
+	unsigned long failures;
+	unsigned long binds;
+	uint64_t usec;
+	int used = 0;
+	int port;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rtp show ports";
+		e->usage =
+			"Usage: rtp show ports\n"
+			"       Show how many RTP ports are in use and how long\n"
+			"       allocating them has taken.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_mutex_lock(&rtp_ports_lock);
+	for (port = rtpstart & ~1; port <= rtpend; port += 2) {
+		if (rtp_ports_used[port / 2]) {
+			used++;
+		}
+	}
+	allocations = rtp_port_stats.allocations;
+	failures = rtp_port_stats.failures;
+	binds = rtp_port_stats.binds;
+	usec = rtp_port_stats.usec;
+	ast_mutex_unlock(&rtp_ports_lock);
+
+	ast_cli(a->fd, "Port range:          %d - %d\n", rtpstart, rtpend);
+	ast_cli(a->fd, "Ports in use:        %d of %d\n", used, (rtpend - (rtpstart & ~1)) / 2 + 1);
+	ast_cli(a->fd, "Allocations:         %lu\n", allocations);
+	ast_cli(a->fd, "Failed allocations:  %lu\n", failures);
+	ast_cli(a->fd, "Binds per attempt:   %.2f\n",
+		allocations + failures ? (double) binds / (allocations + failures) : 0.0);
+	ast_cli(a->fd, "Time per attempt:    %.1f us\n",
+		allocations + failures ? (double) usec / (allocations + failures) : 0.0);
+
+	return CLI_SUCCESS;
+}
+
 static char *handle_cli_rtcp_set_stats(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	switch (cmd) {
@@ -5974,6 +6980,7 @@ static struct ast_cli_entry cli_rtp[] = {
 	AST_CLI_DEFINE(handle_cli_rtp_set_debug,  "Enable/Disable RTP debugging"),
 	AST_CLI_DEFINE(handle_cli_rtcp_set_debug, "Enable/Disable RTCP debugging"),
 	AST_CLI_DEFINE(handle_cli_rtcp_set_stats, "Enable/Disable RTCP stats"),
+	AST_CLI_DEFINE(handle_cli_rtp_show_ports, "Show RTP port allocation"),
 };
 
 #ifdef HAVE_PJPROJECT
@@ -6057,6 +7064,7 @@ static int rtp_reload(int reload)
 	dtmftimeout = DEFAULT_DTMF_TIMEOUT;
 	strictrtp = DEFAULT_STRICT_RTP;
 	learning_min_sequential = DEFAULT_LEARNING_MIN_SEQUENTIAL;
+	rtcp_publish_interval = 0;
 
 	/** This resource is not "reloaded" so much as unloaded and loaded again.
 	 * In the case of the TURN related variables, the memory referenced by a
@@ -6070,6 +7078,10 @@ static int rtp_reload(int reload)
 	icesupport = DEFAULT_ICESUPPORT;
 	turnport = DEFAULT_TURN_PORT;
 	memset(&stunaddr, 0, sizeof(stunaddr));
+	stun_mapped_lifetime = 0;
+	ast_mutex_lock(&stun_mapped_lock);
+	stun_mapped_time = ast_tv(0, 0);
+	ast_mutex_unlock(&stun_mapped_lock);
 	turnaddr = pj_str(NULL);
 	turnusername = pj_str(NULL);
 	turnpassword = pj_str(NULL);
@@ -6101,6 +7113,18 @@ static int rtp_reload(int reload)
 		if (rtcpinterval > RTCP_MAX_INTERVALMS)
 			rtcpinterval = RTCP_MAX_INTERVALMS;
 	}
+	if ((s = ast_variable_retrieve(cfg, "general", "rtcp_publish_interval"))) {
+		if (sscanf(s, "%30d", &rtcp_publish_interval) != 1 || rtcp_publish_interval < 0) {
+			ast_log(LOG_WARNING, "Invalid rtcp_publish_interval '%s', publishing every RTCP report\n", s);
+			rtcp_publish_interval = 0;
+		}
+	}
+	if (!reload && (s = ast_variable_retrieve(cfg, "general", "localbridge_threads"))) {
+		if (sscanf(s, "%30u", &localbridge_threads) != 1) {
+			ast_log(LOG_WARNING, "Invalid localbridge_threads '%s', leaving reading to the channels\n", s);
+			localbridge_threads = 0;
+		}
+	}
 	if ((s = ast_variable_retrieve(cfg, "general", "rtpchecksums"))) {
 #ifdef SO_NO_CHECK
 		nochecksums = ast_false(s) ? 1 : 0;
@@ -6136,6 +7160,12 @@ static int rtp_reload(int reload)
 			ast_log(LOG_WARNING, "Invalid STUN server address: %s\n", s);
 		}
 	}
+	if ((s = ast_variable_retrieve(cfg, "general", "stun_mapped_lifetime"))) {
+		if (sscanf(s, "%30d", &stun_mapped_lifetime) != 1 || stun_mapped_lifetime < 0) {
+			ast_log(LOG_WARNING, "Invalid stun_mapped_lifetime '%s', not sharing STUN addresses\n", s);
+			stun_mapped_lifetime = 0;
+		}
+	}
 	if ((s = ast_variable_retrieve(cfg, "general", "turnaddr"))) {
 		struct sockaddr_in addr;
 		addr.sin_port = htons(DEFAULT_TURN_PORT);
@@ -6285,6 +7315,11 @@ static int load_module(void)
 
 	rtp_reload(0);
 
+	if (rtp_bridge_threads_start(localbridge_threads)) {
+		ast_log(LOG_WARNING, "Could not start %u threads for locally bridged RTP, leaving reading to the channels\n",
+			localbridge_threads);
+	}
+
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
@@ -6292,6 +7327,7 @@ static int unload_module(void)
 {
 	ast_rtp_engine_unregister(&asterisk_rtp_engine);
 	ast_cli_unregister_multiple(cli_rtp, ARRAY_LEN(cli_rtp));
+	rtp_bridge_threads_stop();
 
 #ifdef HAVE_PJPROJECT
 	host_candidate_overrides_clear();
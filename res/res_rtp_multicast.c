@@ -518,8 +518,9 @@ static int multicast_rtp_write(struct ast_rtp_instance *instance, struct ast_fra
 	} else {
 		int hdrlen = 12;
 
-		/* If we do not have space to construct an RTP header duplicate the frame so we get some */
-		if (frame->offset < hdrlen) {
+		/* If we do not have space to construct an RTP header, or the space
+		 * belongs to a shared payload, duplicate the frame so we get some */
+		if (frame->offset < hdrlen || (frame->mallocd & AST_MALLOCD_SHARED)) {
 			f = ast_frdup(frame);
 		} else {
 			f = frame;
@@ -38,6 +38,65 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/sorcery.h"
 #include "asterisk/astdb.h"
 #include "asterisk/json.h"
+#include "asterisk/astobj2.h"
+#include "asterisk/sched.h"
+
+/*! \brief Number of buckets for the stores container */
+#define STORES_BUCKETS 17
+
+/*! \brief Number of buckets for the pending writes of a store */
+#define PENDING_BUCKETS 257
+
+/*! \brief Configuration of an astdb wizard mapping */
+struct sorcery_astdb {
+	/*! \brief How long, in milliseconds, writes are held before going to astdb */
+	unsigned int write_behind;
+	/*! \brief Prefix of the astdb families */
+	char prefix[0];
+};
+
+/*!
+ * \brief Objects of an astdb family kept in memory
+ *
+ * When a mapping holds writes back, the objects of the family are loaded
+ * once and reads are answered from here.  Changes are made here and queued
+ * in the pending container, replacing any change already queued for the
+ * same object, until the scheduler writes them all to astdb together.
+ */
+struct sorcery_astdb_store {
+	/*! \brief The objects, sorted by identifier */
+	struct ao2_container *entries;
+	/*! \brief Changes not yet written to astdb */
+	struct ao2_container *pending;
+	/*! \brief Serializes writing the pending changes */
+	ast_mutex_t flush_lock;
+	/*! \brief Scheduler id of the pending write, protected by the store lock */
+	int flush_id;
+	/*! \brief How long, in milliseconds, writes are held */
+	unsigned int write_behind;
+	/*! \brief The astdb family */
+	char family[0];
+};
+
+/*! \brief An object in a store, or a pending change to one */
+struct sorcery_astdb_entry {
+	/*! \brief JSON objectset of the object, NULL if it was deleted */
+	char *value;
+	/*! \brief Identifier of the object */
+	char key[0];
+};
+
+/*! \brief Stores of the families that hold writes back */
+static struct ao2_container *stores;
+
+/*! \brief Scheduler used to write held changes */
+static struct ast_sched_context *sched;
+
+AO2_STRING_FIELD_HASH_FN(sorcery_astdb_store, family)
+AO2_STRING_FIELD_CMP_FN(sorcery_astdb_store, family)
+AO2_STRING_FIELD_HASH_FN(sorcery_astdb_entry, key)
+AO2_STRING_FIELD_CMP_FN(sorcery_astdb_entry, key)
+AO2_STRING_FIELD_SORT_FN(sorcery_astdb_entry, key)
 
 static void *sorcery_astdb_open(const char *data);
 static int sorcery_astdb_create(const struct ast_sorcery *sorcery, void *data, void *object);
@@ -63,22 +122,355 @@ static struct ast_sorcery_wizard astdb_object_wizard = {
 	.close = sorcery_astdb_close,
 };
 
-static int sorcery_astdb_create(const struct ast_sorcery *sorcery, void *data, void *object)
+static struct sorcery_astdb_entry *sorcery_astdb_entry_alloc(const char *key, const char *value)
+{
+	size_t key_len = strlen(key) + 1;
+	struct sorcery_astdb_entry *entry;
+
+	entry = ao2_alloc_options(sizeof(*entry) + key_len + (value ? strlen(value) + 1 : 0),
+		NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!entry) {
+		return NULL;
+	}
+
+	strcpy(entry->key, key); /* Safe */
+	if (value) {
+		entry->value = entry->key + key_len;
+		strcpy(entry->value, value); /* Safe */
+	}
+
+	return entry;
+}
+
+static void sorcery_astdb_store_destructor(void *obj)
+{
+	struct sorcery_astdb_store *store = obj;
+
+	ao2_cleanup(store->entries);
+	ao2_cleanup(store->pending);
+	ast_mutex_destroy(&store->flush_lock);
+}
+
+/*! \brief Write the pending changes of a store to astdb */
+static void sorcery_astdb_store_flush(struct sorcery_astdb_store *store)
+{
+	struct ao2_iterator *pending;
+	struct sorcery_astdb_entry *entry;
+
+	/* Only one flush at a time, so that later changes are written last */
+	ast_mutex_lock(&store->flush_lock);
+	pending = ao2_callback(store->pending, OBJ_MULTIPLE | OBJ_UNLINK, NULL, NULL);
+	if (pending) {
+		/*
+		 * astdb commits its changes at most once a second, so all of
+		 * these end up in the same transaction.
+		 */
+		while ((entry = ao2_iterator_next(pending))) {
+			if (entry->value) {
+				ast_db_put(store->family, entry->key, entry->value);
+			} else {
+				ast_db_del(store->family, entry->key);
+			}
+			ao2_ref(entry, -1);
+		}
+		ao2_iterator_destroy(pending);
+	}
+	ast_mutex_unlock(&store->flush_lock);
+}
+
+static int sorcery_astdb_store_flush_cb(const void *data)
+{
+	struct sorcery_astdb_store *store = (struct sorcery_astdb_store *) data;
+
+	ao2_lock(store);
+	store->flush_id = -1;
+	ao2_unlock(store);
+
+	sorcery_astdb_store_flush(store);
+	ao2_ref(store, -1);
+
+	return 0;
+}
+
+/*! \brief Queue a change to be written, replacing any change queued for the same object */
+static void sorcery_astdb_store_pend(struct sorcery_astdb_store *store, struct sorcery_astdb_entry *entry)
+{
+	ao2_link(store->pending, entry);
+
+	ao2_lock(store);
+	if (store->flush_id < 0) {
+		store->flush_id = ast_sched_add(sched, store->write_behind, sorcery_astdb_store_flush_cb,
+			ao2_bump(store));
+		if (store->flush_id < 0) {
+			/* The change is written with the next one, or when the module unloads */
+			ao2_ref(store, -1);
+		}
+	}
+	ao2_unlock(store);
+}
+
+static struct sorcery_astdb_store *sorcery_astdb_store_alloc(const char *family, unsigned int write_behind)
+{
+	struct sorcery_astdb_store *store;
+	struct ast_db_entry *entries;
+	struct ast_db_entry *db_entry;
+
+	store = ao2_alloc(sizeof(*store) + strlen(family) + 1, sorcery_astdb_store_destructor);
+	if (!store) {
+		return NULL;
+	}
+
+	ast_mutex_init(&store->flush_lock);
+	store->flush_id = -1;
+	store->write_behind = write_behind;
+	strcpy(store->family, family); /* Safe */
+
+	store->entries = ao2_container_alloc_rbtree(AO2_ALLOC_OPT_LOCK_MUTEX,
+		AO2_CONTAINER_ALLOC_OPT_DUPS_REPLACE, sorcery_astdb_entry_sort_fn, NULL);
+	store->pending = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX,
+		AO2_CONTAINER_ALLOC_OPT_DUPS_REPLACE, PENDING_BUCKETS, sorcery_astdb_entry_hash_fn,
+		NULL, sorcery_astdb_entry_cmp_fn);
+	if (!store->entries || !store->pending) {
+		ao2_ref(store, -1);
+		return NULL;
+	}
+
+	entries = ast_db_gettree(family, NULL);
+	for (db_entry = entries; db_entry; db_entry = db_entry->next) {
+		struct sorcery_astdb_entry *entry;
+
+		entry = sorcery_astdb_entry_alloc(db_entry->key + strlen(family) + 2, db_entry->data);
+		if (!entry) {
+			ast_db_freetree(entries);
+			ao2_ref(store, -1);
+			return NULL;
+		}
+		ao2_link_flags(store->entries, entry, OBJ_NOLOCK);
+		ao2_ref(entry, -1);
+	}
+	ast_db_freetree(entries);
+
+	ast_debug(1, "Loaded %d objects of astdb family '%s', writes are held for %u ms\n",
+		ao2_container_count(store->entries), family, write_behind);
+
+	return store;
+}
+
+/*!
+ * \internal
+ * \brief Get the in-memory store of a family
+ *
+ * \retval NULL if the mapping writes directly to astdb
+ */
+static struct sorcery_astdb_store *sorcery_astdb_store_get(const struct sorcery_astdb *astdb, const char *family)
+{
+	struct sorcery_astdb_store *store;
+
+	if (!astdb->write_behind) {
+		return NULL;
+	}
+
+	ao2_lock(stores);
+	store = ao2_find(stores, family, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!store) {
+		store = sorcery_astdb_store_alloc(family, astdb->write_behind);
+		if (store) {
+			ao2_link_flags(stores, store, OBJ_NOLOCK);
+		}
+	}
+	ao2_unlock(stores);
+
+	return store;
+}
+
+static int sorcery_astdb_store_put(struct sorcery_astdb_store *store, const char *key, const char *value,
+	int must_exist)
+{
+	struct sorcery_astdb_entry *entry;
+	struct sorcery_astdb_entry *existing;
+
+	entry = sorcery_astdb_entry_alloc(key, value);
+	if (!entry) {
+		return -1;
+	}
+
+	ao2_lock(store->entries);
+	if (must_exist) {
+		existing = ao2_find(store->entries, key, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+		if (!existing) {
+			ao2_unlock(store->entries);
+			ao2_ref(entry, -1);
+			return -1;
+		}
+		ao2_ref(existing, -1);
+	}
+	ao2_link_flags(store->entries, entry, OBJ_NOLOCK);
+	sorcery_astdb_store_pend(store, entry);
+	ao2_unlock(store->entries);
+
+	ao2_ref(entry, -1);
+
+	return 0;
+}
+
+static int sorcery_astdb_store_del(struct sorcery_astdb_store *store, const char *key)
+{
+	struct sorcery_astdb_entry *deleted;
+	struct sorcery_astdb_entry *existing;
+
+	deleted = sorcery_astdb_entry_alloc(key, NULL);
+	if (!deleted) {
+		return -1;
+	}
+
+	ao2_lock(store->entries);
+	existing = ao2_find(store->entries, key, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NOLOCK);
+	if (existing) {
+		sorcery_astdb_store_pend(store, deleted);
+		ao2_ref(existing, -1);
+	}
+	ao2_unlock(store->entries);
+
+	ao2_ref(deleted, -1);
+
+	return existing ? 0 : -1;
+}
+
+/*! \brief Internal helper function which gets the value of an object from the store or astdb */
+static int sorcery_astdb_get(const struct sorcery_astdb *astdb, const char *family, const char *key,
+	char **value)
+{
+	struct sorcery_astdb_store *store = sorcery_astdb_store_get(astdb, family);
+	struct sorcery_astdb_entry *entry;
+
+	if (!store) {
+		return ast_db_get_allocated(family, key, value);
+	}
+
+	entry = ao2_find(store->entries, key, OBJ_SEARCH_KEY);
+	ao2_ref(store, -1);
+	if (!entry) {
+		return -1;
+	}
+
+	*value = ast_strdup(entry->value);
+	ao2_ref(entry, -1);
+
+	return *value ? 0 : -1;
+}
+
+/*!
+ * \brief Internal helper function which gets objects, in the same form as ast_db_gettree(),
+ * from the store or astdb
+ *
+ * \param tree astDB prefix pattern, as made by make_astdb_prefix_pattern()
+ */
+static struct ast_db_entry *sorcery_astdb_gettree(const struct sorcery_astdb *astdb, const char *family,
+	const char *tree)
+{
+	struct sorcery_astdb_store *store = sorcery_astdb_store_get(astdb, family);
+	size_t prefix_len = tree ? strlen(tree) : 0;
+	char prefix[prefix_len + 1];
+	struct ao2_iterator *iter;
+	struct sorcery_astdb_entry *entry;
+	struct ast_db_entry *ret = NULL;
+	struct ast_db_entry **last = &ret;
+
+	if (!store) {
+		return ast_db_gettree(family, tree);
+	}
+
+	/* The store is searched with a plain prefix, the regex filters the rest */
+	if (prefix_len && tree[prefix_len - 1] == '%') {
+		--prefix_len;
+	}
+	memcpy(prefix, tree, prefix_len);
+	prefix[prefix_len] = '\0';
+
+	iter = ao2_callback(store->entries, OBJ_MULTIPLE | OBJ_SEARCH_PARTIAL_KEY, NULL, prefix);
+	ao2_ref(store, -1);
+	if (!iter) {
+		return NULL;
+	}
+
+	while ((entry = ao2_iterator_next(iter))) {
+		size_t value_len = strlen(entry->value) + 1;
+		struct ast_db_entry *cur;
+
+		cur = ast_malloc(sizeof(*cur) + value_len + strlen(family) + strlen(entry->key) + 3);
+		if (!cur) {
+			ao2_ref(entry, -1);
+			break;
+		}
+		cur->next = NULL;
+		strcpy(cur->data, entry->value); /* Safe */
+		cur->key = cur->data + value_len;
+		sprintf(cur->key, "/%s/%s", family, entry->key); /* Safe */
+		*last = cur;
+		last = &cur->next;
+		ao2_ref(entry, -1);
+	}
+	ao2_iterator_destroy(iter);
+
+	return ret;
+}
+
+static int sorcery_astdb_flush_all(void *obj, void *arg, int flags)
+{
+	struct sorcery_astdb_store *store = obj;
+
+	ao2_lock(store);
+	if (store->flush_id > -1 && !ast_sched_del(sched, store->flush_id)) {
+		store->flush_id = -1;
+		ao2_ref(store, -1);
+	}
+	ao2_unlock(store);
+
+	sorcery_astdb_store_flush(store);
+
+	return 0;
+}
+
+/*! \brief Internal helper function which writes an object, optionally only if it already exists */
+static int sorcery_astdb_put(const struct ast_sorcery *sorcery, void *data, void *object, int must_exist)
 {
 	RAII_VAR(struct ast_json *, objset, ast_sorcery_objectset_json_create(sorcery, object), ast_json_unref);
 	RAII_VAR(char *, value, NULL, ast_json_free);
-	const char *prefix = data;
-	char family[strlen(prefix) + strlen(ast_sorcery_object_get_type(object)) + 2];
+	const struct sorcery_astdb *astdb = data;
+	char family[strlen(astdb->prefix) + strlen(ast_sorcery_object_get_type(object)) + 2];
+	struct sorcery_astdb_store *store;
+	int res;
 
 	if (!objset || !(value = ast_json_dump_string(objset))) {
 		return -1;
 	}
 
-	snprintf(family, sizeof(family), "%s/%s", prefix, ast_sorcery_object_get_type(object));
+	snprintf(family, sizeof(family), "%s/%s", astdb->prefix, ast_sorcery_object_get_type(object));
+
+	store = sorcery_astdb_store_get(astdb, family);
+	if (store) {
+		res = sorcery_astdb_store_put(store, ast_sorcery_object_get_id(object), value, must_exist);
+		ao2_ref(store, -1);
+		return res;
+	}
+
+	if (must_exist) {
+		char existing[2];
+
+		/* It is okay for the value to be truncated, we are only checking that it exists */
+		if (ast_db_get(family, ast_sorcery_object_get_id(object), existing, sizeof(existing))) {
+			return -1;
+		}
+	}
 
 	return ast_db_put(family, ast_sorcery_object_get_id(object), value);
 }
 
+static int sorcery_astdb_create(const struct ast_sorcery *sorcery, void *data, void *object)
+{
+	return sorcery_astdb_put(sorcery, data, object, 0);
+}
+
 /*! \brief Internal helper function which returns a filtered objectset.
  *
  * The following are filtered out of the objectset:
@@ -134,14 +526,14 @@ static struct ast_variable *sorcery_astdb_filter_objectset(struct ast_variable *
 /*! \brief Internal helper function which retrieves an object, or multiple objects, using fields for criteria */
 static void *sorcery_astdb_retrieve_fields_common(const struct ast_sorcery *sorcery, void *data, const char *type, const struct ast_variable *fields, struct ao2_container *objects)
 {
-	const char *prefix = data;
-	char family[strlen(prefix) + strlen(type) + 2];
+	const struct sorcery_astdb *astdb = data;
+	char family[strlen(astdb->prefix) + strlen(type) + 2];
 	RAII_VAR(struct ast_db_entry *, entries, NULL, ast_db_freetree);
 	struct ast_db_entry *entry;
 
-	snprintf(family, sizeof(family), "%s/%s", prefix, type);
+	snprintf(family, sizeof(family), "%s/%s", astdb->prefix, type);
 
-	if (!(entries = ast_db_gettree(family, NULL))) {
+	if (!(entries = sorcery_astdb_gettree(astdb, family, NULL))) {
 		return NULL;
 	}
 
@@ -190,17 +582,17 @@ static void *sorcery_astdb_retrieve_fields(const struct ast_sorcery *sorcery, vo
 
 static void *sorcery_astdb_retrieve_id(const struct ast_sorcery *sorcery, void *data, const char *type, const char *id)
 {
-	const char *prefix = data;
-	char family[strlen(prefix) + strlen(type) + 2];
+	const struct sorcery_astdb *astdb = data;
+	char family[strlen(astdb->prefix) + strlen(type) + 2];
 	RAII_VAR(char *, value, NULL, ast_free_ptr);
 	RAII_VAR(struct ast_json *, json, NULL, ast_json_unref);
 	struct ast_json_error error;
 	RAII_VAR(struct ast_variable *, objset, NULL, ast_variables_destroy);
 	void *object = NULL;
 
-	snprintf(family, sizeof(family), "%s/%s", prefix, type);
+	snprintf(family, sizeof(family), "%s/%s", astdb->prefix, type);
 
-	if (ast_db_get_allocated(family, id, &value)
+	if (sorcery_astdb_get(astdb, family, id, &value)
 		|| !(json = ast_json_load_string(value, &error))
 		|| (ast_json_to_ast_variables(json, &objset) != AST_JSON_TO_AST_VARS_CODE_SUCCESS)
 		|| !(objset = sorcery_astdb_filter_objectset(objset, sorcery, type))
@@ -219,87 +611,30 @@ static void sorcery_astdb_retrieve_multiple(const struct ast_sorcery *sorcery, v
 	sorcery_astdb_retrieve_fields_common(sorcery, data, type, fields, objects);
 }
 
-/*!
- * \internal
- * \brief Convert regex prefix pattern to astDB prefix pattern if possible.
- *
- * \param tree astDB prefix pattern buffer to fill.
- * \param regex Extended regular expression with the start anchor character '^'.
- *
- * \note Since this is a helper function, the tree buffer is
- * assumed to always be large enough.
- *
- * \retval 0 on success.
- * \retval -1 on error.  regex is invalid.
- */
-static int make_astdb_prefix_pattern(char *tree, const char *regex)
-{
-	const char *src;
-	char *dst;
-
-	for (dst = tree, src = regex + 1; *src; ++src) {
-		if (*src == '\\') {
-			/* Escaped regex char. */
-			++src;
-			if (!*src) {
-				/* Invalid regex.  The caller escaped the string terminator. */
-				return -1;
-			}
-		} else if (*src == '$') {
-			if (!src[1]) {
-				/* Remove the tail anchor character. */
-				*dst = '\0';
-				return 0;
-			}
-		} else if (strchr(".?*+{[(|", *src)) {
-			/*
-			 * The regex is not a simple prefix pattern.
-			 *
-			 * XXX With more logic, it is possible to simply
-			 * use the current prefix pattern.  The last character
-			 * needs to be removed if possible when the current regex
-			 * token is "?*{".  Also the rest of the regex pattern
-			 * would need to be checked for subgroup/alternation.
-			 * Subgroup/alternation is too complex for a simple prefix
-			 * match.
-			 */
-			dst = tree;
-			break;
-		}
-		*dst++ = *src;
-	}
-	if (dst != tree) {
-		*dst++ = '%';
-	}
-	*dst = '\0';
-	return 0;
-}
-
 static void sorcery_astdb_retrieve_regex(const struct ast_sorcery *sorcery, void *data, const char *type, struct ao2_container *objects, const char *regex)
 {
-	const char *prefix = data;
-	char family[strlen(prefix) + strlen(type) + 2];
-	char tree[strlen(regex) + 1];
+	const struct sorcery_astdb *astdb = data;
+	char family[strlen(astdb->prefix) + strlen(type) + 2];
+	char tree[strlen(regex) + 2];
 	RAII_VAR(struct ast_db_entry *, entries, NULL, ast_db_freetree);
 	regex_t expression;
 	struct ast_db_entry *entry;
 
-	snprintf(family, sizeof(family), "%s/%s", prefix, type);
+	snprintf(family, sizeof(family), "%s/%s", astdb->prefix, type);
 
-	if (regex[0] == '^') {
-		/*
-		 * For performance reasons, try to create an astDB prefix
-		 * pattern from the regex to reduce the number of entries
-		 * retrieved from astDB for regex to then match.
-		 */
-		if (make_astdb_prefix_pattern(tree, regex)) {
-			return;
-		}
-	} else {
-		tree[0] = '\0';
+	/*
+	 * For performance reasons, create an astDB prefix pattern from
+	 * the regex to reduce the number of entries retrieved from astDB
+	 * for regex to then match.
+	 */
+	if (ast_regex_literal_prefix(regex, tree)) {
+		return;
+	}
+	if (tree[0]) {
+		strcat(tree, "%");
 	}
 
-	if (!(entries = ast_db_gettree(family, tree))
+	if (!(entries = sorcery_astdb_gettree(astdb, family, tree))
 		|| regcomp(&expression, regex, REG_EXTENDED | REG_NOSUB)) {
 		return;
 	}
@@ -331,27 +666,26 @@ static void sorcery_astdb_retrieve_regex(const struct ast_sorcery *sorcery, void
 
 static int sorcery_astdb_update(const struct ast_sorcery *sorcery, void *data, void *object)
 {
-	const char *prefix = data;
-	char family[strlen(prefix) + strlen(ast_sorcery_object_get_type(object)) + 2], value[2];
-
-	snprintf(family, sizeof(family), "%s/%s", prefix, ast_sorcery_object_get_type(object));
-
-	/* It is okay for the value to be truncated, we are only checking that it exists */
-	if (ast_db_get(family, ast_sorcery_object_get_id(object), value, sizeof(value))) {
-		return -1;
-	}
-
 	/* The only difference between update and create is that for update the object must already exist */
-	return sorcery_astdb_create(sorcery, data, object);
+	return sorcery_astdb_put(sorcery, data, object, 1);
 }
 
 static int sorcery_astdb_delete(const struct ast_sorcery *sorcery, void *data, void *object)
 {
-	const char *prefix = data;
-	char family[strlen(prefix) + strlen(ast_sorcery_object_get_type(object)) + 2];
+	const struct sorcery_astdb *astdb = data;
+	char family[strlen(astdb->prefix) + strlen(ast_sorcery_object_get_type(object)) + 2];
 	char value[2];
+	struct sorcery_astdb_store *store;
+	int res;
 
-	snprintf(family, sizeof(family), "%s/%s", prefix, ast_sorcery_object_get_type(object));
+	snprintf(family, sizeof(family), "%s/%s", astdb->prefix, ast_sorcery_object_get_type(object));
+
+	store = sorcery_astdb_store_get(astdb, family);
+	if (store) {
+		res = sorcery_astdb_store_del(store, ast_sorcery_object_get_id(object));
+		ao2_ref(store, -1);
+		return res;
+	}
 
 	if (ast_db_get(family, ast_sorcery_object_get_id(object), value, sizeof(value))) {
 		return -1;
@@ -362,12 +696,47 @@ static int sorcery_astdb_delete(const struct ast_sorcery *sorcery, void *data, v
 
 static void *sorcery_astdb_open(const char *data)
 {
+	struct sorcery_astdb *astdb;
+	char *options;
+	char *prefix;
+	char *option;
+
 	/* We require a prefix for family string generation, or else stuff could mix together */
 	if (ast_strlen_zero(data)) {
 		return NULL;
 	}
 
-	return ast_strdup(data);
+	options = ast_strdupa(data);
+	prefix = ast_strip(strsep(&options, ","));
+	if (ast_strlen_zero(prefix)) {
+		return NULL;
+	}
+
+	astdb = ast_calloc(1, sizeof(*astdb) + strlen(prefix) + 1);
+	if (!astdb) {
+		return NULL;
+	}
+	strcpy(astdb->prefix, prefix); /* Safe */
+
+	while ((option = strsep(&options, ","))) {
+		char *name = ast_strip(strsep(&option, "="));
+		char *value = ast_strip(option);
+
+		if (!strcasecmp(name, "write_behind")) {
+			if (ast_strlen_zero(value) || sscanf(value, "%30u", &astdb->write_behind) != 1) {
+				ast_log(LOG_ERROR, "Invalid write_behind '%s' for astdb prefix '%s'\n",
+					S_OR(value, ""), prefix);
+				ast_free(astdb);
+				return NULL;
+			}
+		} else {
+			ast_log(LOG_ERROR, "Unsupported option '%s' for astdb prefix '%s'\n", name, prefix);
+			ast_free(astdb);
+			return NULL;
+		}
+	}
+
+	return astdb;
 }
 
 static void sorcery_astdb_close(void *data)
@@ -375,21 +744,58 @@ static void sorcery_astdb_close(void *data)
 	ast_free(data);
 }
 
-static int load_module(void)
+/*! \brief Write all held changes before astdb is closed */
+static void sorcery_astdb_atexit(void)
 {
-	if (ast_sorcery_wizard_register(&astdb_object_wizard)) {
-		return AST_MODULE_LOAD_DECLINE;
+	if (stores) {
+		ao2_callback(stores, OBJ_NODATA | OBJ_MULTIPLE, sorcery_astdb_flush_all, NULL);
 	}
-
-	return AST_MODULE_LOAD_SUCCESS;
 }
 
 static int unload_module(void)
 {
 	ast_sorcery_wizard_unregister(&astdb_object_wizard);
+
+	ast_unregister_atexit(sorcery_astdb_atexit);
+	sorcery_astdb_atexit();
+
+	if (sched) {
+		ast_sched_context_destroy(sched);
+		sched = NULL;
+	}
+
+	ao2_cleanup(stores);
+	stores = NULL;
+
 	return 0;
 }
 
+static int load_module(void)
+{
+	stores = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, STORES_BUCKETS,
+		sorcery_astdb_store_hash_fn, NULL, sorcery_astdb_store_cmp_fn);
+	if (!stores) {
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	sched = ast_sched_context_create();
+	if (!sched || ast_sched_start_thread(sched)) {
+		ast_log(LOG_ERROR, "Failed to create scheduler for astdb write behind\n");
+		unload_module();
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	if (ast_sorcery_wizard_register(&astdb_object_wizard)) {
+		unload_module();
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	/* Held changes are written even on a fast shutdown, when modules are not unloaded */
+	ast_register_atexit(sorcery_astdb_atexit);
+
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
 AST_MODULE_INFO(ASTERISK_GPL_KEY, AST_MODFLAG_GLOBAL_SYMBOLS | AST_MODFLAG_LOAD_ORDER, "Sorcery Astdb Object Wizard",
 	.support_level = AST_MODULE_SUPPORT_CORE,
 	.load = load_module,
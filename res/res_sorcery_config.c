@@ -49,6 +49,9 @@ struct sorcery_config {
 	/*! \brief Objects retrieved from the configuration file */
 	struct ao2_global_obj objects;
 
+	/*! \brief Index of the objects by their indexed fields */
+	struct ao2_global_obj index;
+
 	/*! \brief Any specific variable criteria for considering a defined category for this object */
 	struct ast_variable *criteria;
 
@@ -58,10 +61,27 @@ struct sorcery_config {
 	/*! \brief Enable file level integrity instead of object level */
 	unsigned int file_integrity:1;
 
+	/*! \brief Only rebuild the objects whose configuration changed on reload */
+	unsigned int reload_changed:1;
+
+	/*! \brief Configuration the objects were last built from, only used by loads */
+	struct ao2_container *sources;
+
 	/*! \brief Filename of the configuration file */
 	char filename[];
 };
 
+/*! \brief Configuration an object was built from */
+struct sorcery_config_source {
+	/*! \brief Length of the text */
+	size_t len;
+	/*! \brief Object id, then the name and value of every variable, each terminated */
+	char text[0];
+};
+
+/*! \brief Number of buckets for the configuration of objects */
+#define SOURCE_BUCKETS 53
+
 /*! \brief Structure used for fields comparison */
 struct sorcery_config_fields_cmp_params {
 	/*! \brief Pointer to the sorcery structure */
@@ -73,6 +93,12 @@ struct sorcery_config_fields_cmp_params {
 	/*! \brief Regular expression for checking object id */
 	regex_t *regex;
 
+	/*! \brief Literal prefix of the ids the regular expression can match */
+	const char *prefix;
+
+	/*! \brief Length of the prefix */
+	size_t prefix_len;
+
 	/*! \brief Optional container to put object into */
 	struct ao2_container *container;
 };
@@ -106,17 +132,70 @@ static void sorcery_config_destructor(void *obj)
 
 	ao2_global_obj_release(config->objects);
 	ast_rwlock_destroy(&config->objects.lock);
+	ao2_global_obj_release(config->index);
+	ast_rwlock_destroy(&config->index.lock);
+	ao2_cleanup(config->sources);
 	ast_variables_destroy(config->criteria);
 }
 
+static int sorcery_config_source_hash(const void *obj, const int flags)
+{
+	const struct sorcery_config_source *source = obj;
+
+	/* The text starts with the object id */
+	return ast_str_hash((flags & OBJ_SEARCH_MASK) == OBJ_SEARCH_KEY ? obj : source->text);
+}
+
+static int sorcery_config_source_cmp(void *obj, void *arg, int flags)
+{
+	const struct sorcery_config_source *left = obj;
+	const struct sorcery_config_source *right = arg;
+
+	return !strcmp(left->text, (flags & OBJ_SEARCH_MASK) == OBJ_SEARCH_KEY ? arg : right->text) ? CMP_MATCH : 0;
+}
+
+/*!
+ * \internal
+ * \brief Record the configuration of an object, to tell if it changed later
+ */
+static struct sorcery_config_source *sorcery_config_source_alloc(const char *id, const struct ast_variable *fields)
+{
+	struct sorcery_config_source *source;
+	const struct ast_variable *field;
+	size_t len = strlen(id) + 1;
+	char *pos;
+
+	for (field = fields; field; field = field->next) {
+		len += strlen(field->name) + strlen(field->value) + 2;
+	}
+
+	source = ao2_alloc_options(sizeof(*source) + len, NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!source) {
+		return NULL;
+	}
+	source->len = len;
+
+	pos = source->text;
+	pos += strlen(strcpy(pos, id)) + 1; /* Safe */
+	for (field = fields; field; field = field->next) {
+		pos += strlen(strcpy(pos, field->name)) + 1; /* Safe */
+		pos += strlen(strcpy(pos, field->value)) + 1; /* Safe */
+	}
+
+	return source;
+}
+
 static int sorcery_config_fields_cmp(void *obj, void *arg, int flags)
 {
 	const struct sorcery_config_fields_cmp_params *params = arg;
 	RAII_VAR(struct ast_variable *, objset, NULL, ast_variables_destroy);
 
 	if (params->regex) {
+		const char *id = ast_sorcery_object_get_id(obj);
+
 		/* If a regular expression has been provided see if it matches, otherwise move on */
-		if (!regexec(params->regex, ast_sorcery_object_get_id(obj), 0, NULL, 0)) {
+		if ((!params->prefix_len || !strncmp(id, params->prefix, params->prefix_len))
+			&& !regexec(params->regex, id, 0, NULL, 0)) {
 			ao2_link(params->container, obj);
 		}
 		return 0;
@@ -142,10 +221,30 @@ static int sorcery_config_fields_cmp(void *obj, void *arg, int flags)
 	}
 }
 
+/*!
+ * \internal
+ * \brief Get the container of the objects that may match fields
+ *
+ * \return The objects found in the index, or all objects if the index can not narrow them
+ */
+static struct ao2_container *sorcery_config_candidates(struct sorcery_config *config, const struct ast_variable *fields)
+{
+	struct ast_sorcery_index *index;
+	struct ao2_container *candidates = NULL;
+
+	index = ao2_global_obj_ref(config->index);
+	if (index) {
+		candidates = ast_sorcery_index_find(index, fields);
+		ao2_ref(index, -1);
+	}
+
+	return candidates ? candidates : ao2_global_obj_ref(config->objects);
+}
+
 static void *sorcery_config_retrieve_fields(const struct ast_sorcery *sorcery, void *data, const char *type, const struct ast_variable *fields)
 {
 	struct sorcery_config *config = data;
-	RAII_VAR(struct ao2_container *, objects, ao2_global_obj_ref(config->objects), ao2_cleanup);
+	RAII_VAR(struct ao2_container *, objects, fields ? sorcery_config_candidates(config, fields) : NULL, ao2_cleanup);
 	struct sorcery_config_fields_cmp_params params = {
 		.sorcery = sorcery,
 		.fields = fields,
@@ -171,7 +270,8 @@ static void *sorcery_config_retrieve_id(const struct ast_sorcery *sorcery, void
 static void sorcery_config_retrieve_multiple(const struct ast_sorcery *sorcery, void *data, const char *type, struct ao2_container *objects, const struct ast_variable *fields)
 {
 	struct sorcery_config *config = data;
-	RAII_VAR(struct ao2_container *, config_objects, ao2_global_obj_ref(config->objects), ao2_cleanup);
+	RAII_VAR(struct ao2_container *, config_objects,
+		fields ? sorcery_config_candidates(config, fields) : ao2_global_obj_ref(config->objects), ao2_cleanup);
 	struct sorcery_config_fields_cmp_params params = {
 		.sorcery = sorcery,
 		.fields = fields,
@@ -195,11 +295,20 @@ static void sorcery_config_retrieve_regex(const struct ast_sorcery *sorcery, voi
 		.container = objects,
 		.regex = &expression,
 	};
+	char *prefix;
 
 	if (ast_strlen_zero(regex)) {
 		regex = ".";
 	}
 
+	/* Ids without the literal prefix of the regex are skipped without executing it */
+	prefix = ast_alloca(strlen(regex) + 1);
+	if (ast_regex_literal_prefix(regex, prefix)) {
+		return;
+	}
+	params.prefix = prefix;
+	params.prefix_len = strlen(prefix);
+
 	if (!config_objects || regcomp(&expression, regex, REG_EXTENDED | REG_NOSUB)) {
 		return;
 	}
@@ -223,8 +332,11 @@ static void sorcery_config_internal_load(void *data, const struct ast_sorcery *s
 	struct ast_config *cfg = ast_config_load2(config->filename, config->uuid, flags);
 	struct ast_category *category = NULL;
 	RAII_VAR(struct ao2_container *, objects, NULL, ao2_cleanup);
+	RAII_VAR(struct ast_sorcery_index *, index, NULL, ao2_cleanup);
+	RAII_VAR(struct ao2_container *, sources, NULL, ao2_cleanup);
 	const char *id = NULL;
 	unsigned int buckets = 0;
+	unsigned int unchanged = 0;
 
 	if (!cfg) {
 		ast_log(LOG_ERROR, "Unable to load config file '%s'\n", config->filename);
@@ -275,8 +387,16 @@ static void sorcery_config_internal_load(void *data, const struct ast_sorcery *s
 		return;
 	}
 
+	index = ast_sorcery_index_alloc(sorcery, type);
+
+	if (config->reload_changed) {
+		sources = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, SOURCE_BUCKETS,
+			sorcery_config_source_hash, NULL, sorcery_config_source_cmp);
+	}
+
 	while ((category = ast_category_browse_filtered(cfg, NULL, category, NULL))) {
 		RAII_VAR(void *, obj, NULL, ao2_cleanup);
+		RAII_VAR(struct sorcery_config_source *, source, NULL, ao2_cleanup);
 		id = ast_category_get_name(category);
 
 		/* If given criteria has not been met skip the category, it is not applicable */
@@ -295,7 +415,22 @@ static void sorcery_config_internal_load(void *data, const struct ast_sorcery *s
 			return;
 		}
 
-		if (!(obj = ast_sorcery_alloc(sorcery, type, id)) ||
+		/* An object whose configuration did not change is kept as it is instead of being built again */
+		if (sources && (source = sorcery_config_source_alloc(id, ast_category_first(category)))) {
+			struct sorcery_config_source *previous = NULL;
+
+			if (reload && config->sources) {
+				previous = ao2_find(config->sources, id, OBJ_SEARCH_KEY);
+			}
+			if (previous && previous->len == source->len && !memcmp(previous->text, source->text, source->len)) {
+				obj = sorcery_config_retrieve_id(sorcery, data, type, id);
+			}
+			ao2_cleanup(previous);
+		}
+
+		if (obj) {
+			++unchanged;
+		} else if (!(obj = ast_sorcery_alloc(sorcery, type, id)) ||
 		    ast_sorcery_objectset_apply(sorcery, obj, ast_category_first(category))) {
 
 			if (config->file_integrity) {
@@ -316,13 +451,41 @@ static void sorcery_config_internal_load(void *data, const struct ast_sorcery *s
 			}
 
 			ast_log(LOG_NOTICE, "Retaining existing configuration for object of type '%s' with id '%s'\n", type, id);
+
+			/* The configuration was not applied, so the next reload must try again */
+			ao2_replace(source, NULL);
 		}
 
 		ao2_link(objects, obj);
+		if (source) {
+			ao2_link(sources, source);
+		}
+
+		if (index) {
+			RAII_VAR(struct ast_variable *, objset, ast_sorcery_objectset_create(sorcery, obj), ast_variables_destroy);
+
+			if (!objset || ast_sorcery_index_link(index, obj, objset)) {
+				/* An incomplete index would hide objects, so look at every object instead */
+				ao2_ref(index, -1);
+				index = NULL;
+			}
+		}
 	}
 
+	/* Replace the index first so lookups by fields do not miss newly loaded objects */
+	if (index) {
+		ao2_global_obj_replace_unref(config->index, index);
+	} else {
+		ao2_global_obj_release(config->index);
+	}
 	ao2_global_obj_replace_unref(config->objects, objects);
 	ast_config_destroy(cfg);
+
+	if (sources) {
+		ast_debug(1, "Kept %u of %d objects of type '%s' from '%s' unchanged\n",
+			unchanged, ao2_container_count(objects), type, config->filename);
+		ao2_replace(config->sources, sources);
+	}
 }
 
 static void sorcery_config_load(void *data, const struct ast_sorcery *sorcery, const char *type)
@@ -356,6 +519,7 @@ static void *sorcery_config_open(const char *data)
 	ast_uuid_generate_str(config->uuid, sizeof(config->uuid));
 
 	ast_rwlock_init(&config->objects.lock);
+	ast_rwlock_init(&config->index.lock);
 	strcpy(config->filename, filename);
 
 	while ((option = strsep(&tmp, ","))) {
@@ -375,6 +539,15 @@ static void *sorcery_config_open(const char *data)
 				ast_log(LOG_ERROR, "Unsupported integrity value of '%s' used for configuration file '%s', defaulting to 'object'\n",
 					value, filename);
 			}
+		} else if (!strcasecmp(name, "reload")) {
+			if (!strcasecmp(value, "changed")) {
+				config->reload_changed = 1;
+			} else if (!strcasecmp(value, "all")) {
+				config->reload_changed = 0;
+			} else {
+				ast_log(LOG_ERROR, "Unsupported reload value of '%s' used for configuration file '%s', defaulting to 'all'\n",
+					value, filename);
+			}
 		} else if (!strcasecmp(name, "criteria")) {
 			char *field = strsep(&value, "=");
 			struct ast_variable *criteria = ast_variable_new(field, value, "");
@@ -65,6 +65,16 @@ static struct ast_sorcery_wizard memory_object_wizard = {
 	.close = sorcery_memory_close,
 };
 
+/*! \brief Structure for storing objects in memory */
+struct sorcery_memory {
+	/*! \brief The objects */
+	struct ao2_container *objects;
+	/*! \brief Index of the objects by their indexed fields, protected by the objects lock */
+	struct ast_sorcery_index *index;
+	/*! \brief Whether an index has been looked for */
+	unsigned int index_checked:1;
+};
+
 /*! \brief Structure used for fields comparison */
 struct sorcery_memory_fields_cmp_params {
 	/*! \brief Pointer to the sorcery structure */
@@ -76,6 +86,12 @@ struct sorcery_memory_fields_cmp_params {
 	/*! \brief Regular expression for checking object id */
 	regex_t *regex;
 
+	/*! \brief Literal prefix of the ids the regular expression can match */
+	const char *prefix;
+
+	/*! \brief Length of the prefix */
+	size_t prefix_len;
+
 	/*! \brief Optional container to put object into */
 	struct ao2_container *container;
 };
@@ -96,22 +112,99 @@ static int sorcery_memory_cmp(void *obj, void *arg, int flags)
 	return !strcmp(ast_sorcery_object_get_id(obj), flags & OBJ_KEY ? id : ast_sorcery_object_get_id(arg)) ? CMP_MATCH | CMP_STOP : 0;
 }
 
+/*!
+ * \internal
+ * \brief Add an object to the index, creating the index with the first object
+ *
+ * \pre memory->objects is locked
+ */
+static void sorcery_memory_index_link(const struct ast_sorcery *sorcery, struct sorcery_memory *memory, void *object)
+{
+	struct ast_variable *objectset;
+
+	if (!memory->index_checked) {
+		memory->index = ast_sorcery_index_alloc(sorcery, ast_sorcery_object_get_type(object));
+		memory->index_checked = 1;
+	}
+
+	if (!memory->index) {
+		return;
+	}
+
+	objectset = ast_sorcery_objectset_create(sorcery, object);
+	if (!objectset || ast_sorcery_index_link(memory->index, object, objectset)) {
+		/* An incomplete index would hide objects, so look at every object from now on */
+		ao2_ref(memory->index, -1);
+		memory->index = NULL;
+	}
+	ast_variables_destroy(objectset);
+}
+
+/*!
+ * \internal
+ * \brief Remove an object from the index
+ *
+ * \pre memory->objects is locked
+ */
+static void sorcery_memory_index_unlink(const struct ast_sorcery *sorcery, struct sorcery_memory *memory, void *object)
+{
+	struct ast_variable *objectset;
+
+	if (!memory->index) {
+		return;
+	}
+
+	objectset = ast_sorcery_objectset_create(sorcery, object);
+	if (!objectset) {
+		ao2_ref(memory->index, -1);
+		memory->index = NULL;
+		return;
+	}
+	ast_sorcery_index_unlink(memory->index, object, objectset);
+	ast_variables_destroy(objectset);
+}
+
+/*!
+ * \internal
+ * \brief Get the container of the objects that may match fields
+ *
+ * \return The objects found in the index, or all objects if the index can not narrow them
+ */
+static struct ao2_container *sorcery_memory_candidates(struct sorcery_memory *memory, const struct ast_variable *fields)
+{
+	struct ast_sorcery_index *index;
+	struct ao2_container *candidates = NULL;
+
+	ao2_lock(memory->objects);
+	index = ao2_bump(memory->index);
+	ao2_unlock(memory->objects);
+
+	if (index) {
+		candidates = ast_sorcery_index_find(index, fields);
+		ao2_ref(index, -1);
+	}
+
+	return candidates ? candidates : ao2_bump(memory->objects);
+}
+
 static int sorcery_memory_create(const struct ast_sorcery *sorcery, void *data, void *object)
 {
+	struct sorcery_memory *memory = data;
 	void *existing;
 
-	ao2_lock(data);
+	ao2_lock(memory->objects);
 
-	existing = ao2_find(data, ast_sorcery_object_get_id(object), OBJ_KEY | OBJ_NOLOCK);
+	existing = ao2_find(memory->objects, ast_sorcery_object_get_id(object), OBJ_KEY | OBJ_NOLOCK);
 	if (existing) {
 		ao2_ref(existing, -1);
-		ao2_unlock(data);
+		ao2_unlock(memory->objects);
 		return -1;
 	}
 
-	ao2_link_flags(data, object, OBJ_NOLOCK);
+	ao2_link_flags(memory->objects, object, OBJ_NOLOCK);
+	sorcery_memory_index_link(sorcery, memory, object);
 
-	ao2_unlock(data);
+	ao2_unlock(memory->objects);
 
 	return 0;
 }
@@ -122,8 +215,11 @@ static int sorcery_memory_fields_cmp(void *obj, void *arg, int flags)
 	RAII_VAR(struct ast_variable *, objset, NULL, ast_variables_destroy);
 
 	if (params->regex) {
+		const char *id = ast_sorcery_object_get_id(obj);
+
 		/* If a regular expression has been provided see if it matches, otherwise move on */
-		if (!regexec(params->regex, ast_sorcery_object_get_id(obj), 0, NULL, 0)) {
+		if ((!params->prefix_len || !strncmp(id, params->prefix, params->prefix_len))
+			&& !regexec(params->regex, id, 0, NULL, 0)) {
 			ao2_link(params->container, obj);
 		}
 		return 0;
@@ -149,85 +245,145 @@ static int sorcery_memory_fields_cmp(void *obj, void *arg, int flags)
 
 static void *sorcery_memory_retrieve_fields(const struct ast_sorcery *sorcery, void *data, const char *type, const struct ast_variable *fields)
 {
+	struct sorcery_memory *memory = data;
 	struct sorcery_memory_fields_cmp_params params = {
 		.sorcery = sorcery,
 		.fields = fields,
 		.container = NULL,
 	};
+	struct ao2_container *candidates;
+	void *object;
 
 	/* If no fields are present return nothing, we require *something* */
 	if (!fields) {
 		return NULL;
 	}
 
-	return ao2_callback(data, 0, sorcery_memory_fields_cmp, &params);
+	candidates = sorcery_memory_candidates(memory, fields);
+	object = ao2_callback(candidates, 0, sorcery_memory_fields_cmp, &params);
+	ao2_ref(candidates, -1);
+
+	return object;
 }
 
 static void *sorcery_memory_retrieve_id(const struct ast_sorcery *sorcery, void *data, const char *type, const char *id)
 {
-	return ao2_find(data, id, OBJ_KEY);
+	struct sorcery_memory *memory = data;
+
+	return ao2_find(memory->objects, id, OBJ_KEY);
 }
 
 static void sorcery_memory_retrieve_multiple(const struct ast_sorcery *sorcery, void *data, const char *type, struct ao2_container *objects, const struct ast_variable *fields)
 {
+	struct sorcery_memory *memory = data;
 	struct sorcery_memory_fields_cmp_params params = {
 		.sorcery = sorcery,
 		.fields = fields,
 		.container = objects,
 	};
+	struct ao2_container *candidates;
 
-	ao2_callback(data, 0, sorcery_memory_fields_cmp, &params);
+	candidates = fields ? sorcery_memory_candidates(memory, fields) : ao2_bump(memory->objects);
+	ao2_callback(candidates, 0, sorcery_memory_fields_cmp, &params);
+	ao2_ref(candidates, -1);
 }
 
 static void sorcery_memory_retrieve_regex(const struct ast_sorcery *sorcery, void *data, const char *type, struct ao2_container *objects, const char *regex)
 {
+	struct sorcery_memory *memory = data;
 	regex_t expression;
 	struct sorcery_memory_fields_cmp_params params = {
 		.sorcery = sorcery,
 		.container = objects,
 		.regex = &expression,
 	};
+	char *prefix;
 
 	if (ast_strlen_zero(regex)) {
 		regex = ".";
 	}
 
+	/* Ids without the literal prefix of the regex are skipped without executing it */
+	prefix = ast_alloca(strlen(regex) + 1);
+	if (ast_regex_literal_prefix(regex, prefix)) {
+		return;
+	}
+	params.prefix = prefix;
+	params.prefix_len = strlen(prefix);
+
 	if (regcomp(&expression, regex, REG_EXTENDED | REG_NOSUB)) {
 		return;
 	}
 
-	ao2_callback(data, 0, sorcery_memory_fields_cmp, &params);
+	ao2_callback(memory->objects, 0, sorcery_memory_fields_cmp, &params);
 	regfree(&expression);
 }
 
 static int sorcery_memory_update(const struct ast_sorcery *sorcery, void *data, void *object)
 {
+	struct sorcery_memory *memory = data;
 	RAII_VAR(void *, existing, NULL, ao2_cleanup);
 
-	ao2_lock(data);
+	ao2_lock(memory->objects);
 
-	if (!(existing = ao2_find(data, ast_sorcery_object_get_id(object), OBJ_KEY | OBJ_UNLINK))) {
-		ao2_unlock(data);
+	if (!(existing = ao2_find(memory->objects, ast_sorcery_object_get_id(object), OBJ_KEY | OBJ_UNLINK))) {
+		ao2_unlock(memory->objects);
 		return -1;
 	}
+	sorcery_memory_index_unlink(sorcery, memory, existing);
 
-	ao2_link(data, object);
+	ao2_link(memory->objects, object);
+	sorcery_memory_index_link(sorcery, memory, object);
 
-	ao2_unlock(data);
+	ao2_unlock(memory->objects);
 
 	return 0;
 }
 
 static int sorcery_memory_delete(const struct ast_sorcery *sorcery, void *data, void *object)
 {
-	RAII_VAR(void *, existing, ao2_find(data, ast_sorcery_object_get_id(object), OBJ_KEY | OBJ_UNLINK), ao2_cleanup);
+	struct sorcery_memory *memory = data;
+	void *existing;
+
+	ao2_lock(memory->objects);
+	existing = ao2_find(memory->objects, ast_sorcery_object_get_id(object), OBJ_KEY | OBJ_UNLINK);
+	if (existing) {
+		sorcery_memory_index_unlink(sorcery, memory, existing);
+	}
+	ao2_unlock(memory->objects);
+
+	if (!existing) {
+		return -1;
+	}
+	ao2_ref(existing, -1);
+
+	return 0;
+}
+
+static void sorcery_memory_destructor(void *obj)
+{
+	struct sorcery_memory *memory = obj;
 
-	return existing ? 0 : -1;
+	ao2_cleanup(memory->objects);
+	ao2_cleanup(memory->index);
 }
 
 static void *sorcery_memory_open(const char *data)
 {
-	return ao2_container_alloc(OBJECT_BUCKETS, sorcery_memory_hash, sorcery_memory_cmp);
+	struct sorcery_memory *memory;
+
+	memory = ao2_alloc_options(sizeof(*memory), sorcery_memory_destructor, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!memory) {
+		return NULL;
+	}
+
+	memory->objects = ao2_container_alloc(OBJECT_BUCKETS, sorcery_memory_hash, sorcery_memory_cmp);
+	if (!memory->objects) {
+		ao2_ref(memory, -1);
+		return NULL;
+	}
+
+	return memory;
 }
 
 static void sorcery_memory_close(void *data)
@@ -38,6 +38,7 @@
 #include "asterisk/heap.h"
 #include "asterisk/cli.h"
 #include "asterisk/manager.h"
+#include "asterisk/linkedlists.h"
 
 /*** DOCUMENTATION
 	<manager name="SorceryMemoryCacheExpireObject" language="en_US">
@@ -121,6 +122,16 @@
 	</manager>
  ***/
 
+/*! \brief Structure for remembering that the backend does not have an object */
+struct sorcery_memory_negative_object {
+	/*! \brief The time at which the backend did not have the object */
+	struct timeval created;
+	/*! \brief Linkage in the cache's oldest first list of negative entries */
+	AST_LIST_ENTRY(sorcery_memory_negative_object) list;
+	/*! \brief The identifier of the object */
+	char id[0];
+};
+
 /*! \brief Structure for storing a memory cache */
 struct sorcery_memory_cache {
 	/*! \brief The name of the memory cache */
@@ -137,6 +148,18 @@ struct sorcery_memory_cache {
 	unsigned int expire_on_reload;
 	/*! \brief Whether this is a cache of the entire backend, 0 if disabled */
 	unsigned int full_backend_cache;
+	/*! \brief Whether all objects are fetched from the backend when the cache is loaded, 0 if disabled */
+	unsigned int prefetch;
+	/*! \brief The amount of time (in seconds) the backend is remembered not to have an object, 0 if disabled */
+	unsigned int object_lifetime_negative;
+	/*! \brief The maximum number of objects the backend is remembered not to have, 0 if no limit */
+	unsigned int maximum_negative_objects;
+	/*! \brief Objects the backend does not have, NULL if negative caching is disabled */
+	struct ao2_container *negative;
+	/*! \brief Negative entries, oldest first, protected by the lock of the negative container */
+	AST_LIST_HEAD_NOLOCK(, sorcery_memory_negative_object) negative_order;
+	/*! \brief Index of the cached objects by their indexed fields, only for a full backend cache */
+	struct ast_sorcery_index *index;
 	/*! \brief Heap of cached objects. Oldest object is at the top. */
 	struct ast_heap *object_heap;
 	/*! \brief Scheduler item for expiring oldest object. */
@@ -203,6 +226,10 @@ static void sorcery_memory_cache_retrieve_regex(const struct ast_sorcery *sorcer
 	struct ao2_container *objects, const char *regex);
 static int sorcery_memory_cache_delete(const struct ast_sorcery *sorcery, void *data, void *object);
 static void sorcery_memory_cache_close(void *data);
+static int sorcery_memory_cache_is_missing_id(const struct ast_sorcery *sorcery, void *data,
+	const char *type, const char *id);
+static void sorcery_memory_cache_missing_id(const struct ast_sorcery *sorcery, void *data,
+	const char *type, const char *id);
 
 static struct ast_sorcery_wizard memory_cache_object_wizard = {
 	.name = "memory_cache",
@@ -217,6 +244,8 @@ static struct ast_sorcery_wizard memory_cache_object_wizard = {
 	.retrieve_multiple = sorcery_memory_cache_retrieve_multiple,
 	.retrieve_regex = sorcery_memory_cache_retrieve_regex,
 	.close = sorcery_memory_cache_close,
+	.is_missing_id = sorcery_memory_cache_is_missing_id,
+	.missing_id = sorcery_memory_cache_missing_id,
 };
 
 /*! \brief The bucket size for the container of caches */
@@ -225,6 +254,12 @@ static struct ast_sorcery_wizard memory_cache_object_wizard = {
 /*! \brief The default bucket size for the container of objects in the cache */
 #define CACHE_CONTAINER_BUCKET_SIZE 53
 
+/*! \brief The bucket size for the container of negative entries in the cache */
+#define CACHE_NEGATIVE_CONTAINER_BUCKET_SIZE 53
+
+/*! \brief The default maximum number of negative entries in the cache */
+#define CACHE_NEGATIVE_DEFAULT_MAXIMUM 1000
+
 /*! \brief Height of heap for cache object heap. Allows 31 initial objects */
 #define CACHE_HEAP_INIT_HEIGHT 5
 
@@ -404,6 +439,71 @@ static int sorcery_memory_cached_object_cmp(void *obj, void *arg, int flags)
 	return cmp ? 0 : CMP_MATCH;
 }
 
+/*!
+ * \internal
+ * \brief Hashing function for the container holding negative entries
+ *
+ * \param obj A negative entry or id of one
+ * \param flags Hashing flags
+ *
+ * \return The hash of the negative entry id
+ */
+static int sorcery_memory_negative_object_hash(const void *obj, int flags)
+{
+	const struct sorcery_memory_negative_object *negative = obj;
+	const char *name = obj;
+	int hash;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	default:
+	case OBJ_SEARCH_OBJECT:
+		name = negative->id;
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		hash = ast_str_hash(name);
+		break;
+	case OBJ_SEARCH_PARTIAL_KEY:
+		/* Should never happen in hash callback. */
+		ast_assert(0);
+		hash = 0;
+		break;
+	}
+	return hash;
+}
+
+/*!
+ * \internal
+ * \brief Comparison function for the container holding negative entries
+ *
+ * \param obj A negative entry
+ * \param arg A negative entry, or id of one
+ * \param flags Comparison flags
+ *
+ * \retval CMP_MATCH if the id is the same
+ * \retval 0 if the id does not match
+ */
+static int sorcery_memory_negative_object_cmp(void *obj, void *arg, int flags)
+{
+	struct sorcery_memory_negative_object *left = obj;
+	struct sorcery_memory_negative_object *right = arg;
+	const char *right_name = arg;
+	int cmp;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	default:
+	case OBJ_SEARCH_OBJECT:
+		right_name = right->id;
+		/* Fall through */
+	case OBJ_SEARCH_KEY:
+		cmp = strcmp(left->id, right_name);
+		break;
+	case OBJ_SEARCH_PARTIAL_KEY:
+		cmp = strncmp(left->id, right_name, strlen(right_name));
+		break;
+	}
+	return cmp ? 0 : CMP_MATCH;
+}
+
 /*!
  * \internal
  * \brief Destructor function for a sorcery memory cache
@@ -419,6 +519,8 @@ static void sorcery_memory_cache_destructor(void *obj)
 		ast_heap_destroy(cache->object_heap);
 	}
 	ao2_cleanup(cache->objects);
+	ao2_cleanup(cache->negative);
+	ao2_cleanup(cache->index);
 	ast_free(cache->object_type);
 }
 
@@ -466,6 +568,10 @@ static int remove_from_cache(struct sorcery_memory_cache *cache, const char *id,
 
 	ast_assert(!strcmp(ast_sorcery_object_get_id(hash_object->object), id));
 
+	if (cache->index) {
+		ast_sorcery_index_unlink(cache->index, hash_object, hash_object->objectset);
+	}
+
 	oldest_object = ast_heap_peek(cache->object_heap, 1);
 	heap_object = ast_heap_remove(cache->object_heap, hash_object);
 
@@ -532,6 +638,67 @@ static int expire_objects_from_cache(const void *data)
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Remove the oldest negative entry from the cache.
+ *
+ * \pre cache->negative is write-locked
+ *
+ * \param cache The cache from which to remove the oldest negative entry
+ */
+static void remove_oldest_negative_from_cache(struct sorcery_memory_cache *cache)
+{
+	struct sorcery_memory_negative_object *negative;
+
+	negative = AST_LIST_REMOVE_HEAD(&cache->negative_order, list);
+	if (negative) {
+		ao2_unlink_flags(cache->negative, negative, OBJ_NOLOCK);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Forget that the backend does not have an object.
+ *
+ * \param cache The cache to remove the negative entry from
+ * \param id The identifier of the object
+ */
+static void remove_negative_from_cache(struct sorcery_memory_cache *cache, const char *id)
+{
+	struct sorcery_memory_negative_object *negative;
+
+	if (!cache->negative) {
+		return;
+	}
+
+	ao2_wrlock(cache->negative);
+	negative = ao2_find(cache->negative, id, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NOLOCK);
+	if (negative) {
+		AST_LIST_REMOVE(&cache->negative_order, negative, list);
+		ao2_ref(negative, -1);
+	}
+	ao2_unlock(cache->negative);
+}
+
+/*!
+ * \internal
+ * \brief Forget every object the backend is known not to have.
+ *
+ * \param cache The cache to empty of negative entries
+ */
+static void remove_all_negative_from_cache(struct sorcery_memory_cache *cache)
+{
+	if (!cache->negative) {
+		return;
+	}
+
+	ao2_wrlock(cache->negative);
+	while (!AST_LIST_EMPTY(&cache->negative_order)) {
+		remove_oldest_negative_from_cache(cache);
+	}
+	ao2_unlock(cache->negative);
+}
+
 /*!
  * \internal
  * \brief Remove all objects from the cache.
@@ -544,11 +711,17 @@ static int expire_objects_from_cache(const void *data)
  */
 static void remove_all_from_cache(struct sorcery_memory_cache *cache)
 {
-	while (ast_heap_pop(cache->object_heap)) {
+	struct sorcery_memory_cached_object *cached;
+
+	while ((cached = ast_heap_pop(cache->object_heap))) {
+		if (cache->index) {
+			ast_sorcery_index_unlink(cache->index, cached, cached->objectset);
+		}
 	}
 
 	ao2_callback(cache->objects, OBJ_UNLINK | OBJ_NOLOCK | OBJ_NODATA | OBJ_MULTIPLE,
 		NULL, NULL);
+	remove_all_negative_from_cache(cache);
 
 	cache->del_expire = 1;
 	AST_SCHED_DEL_UNREF(sched, cache->expire_id, ao2_ref(cache, -1));
@@ -697,6 +870,10 @@ static int remove_oldest_from_cache(struct sorcery_memory_cache *cache)
 
 	ast_assert(heap_old_object == hash_old_object);
 
+	if (cache->index) {
+		ast_sorcery_index_unlink(cache->index, hash_old_object, hash_old_object->objectset);
+	}
+
 	ao2_ref(hash_old_object, -1);
 
 	schedule_cache_expiration(cache);
@@ -730,7 +907,16 @@ static int add_to_cache(struct sorcery_memory_cache *cache,
 		cached_object->created = front->created;
 	}
 
+	if (cache->index && ast_sorcery_index_link(cache->index, cached_object, cached_object->objectset)) {
+		ao2_find(cache->objects, cached_object,
+			OBJ_SEARCH_OBJECT | OBJ_UNLINK | OBJ_NODATA | OBJ_NOLOCK);
+		return -1;
+	}
+
 	if (ast_heap_push(cache->object_heap, cached_object)) {
+		if (cache->index) {
+			ast_sorcery_index_unlink(cache->index, cached_object, cached_object->objectset);
+		}
 		ao2_find(cache->objects, cached_object,
 			OBJ_SEARCH_OBJECT | OBJ_UNLINK | OBJ_NODATA | OBJ_NOLOCK);
 		return -1;
@@ -810,7 +996,16 @@ static int sorcery_memory_cache_create(const struct ast_sorcery *sorcery, void *
 	 */
 
 	ao2_wrlock(cache->objects);
+	if (cache->full_backend_cache && !ao2_container_count(cache->objects)) {
+		/* A single object would stop a full backend cache that has not been populated from
+		 * populating itself, leaving it with only this object, so it is left to populate.
+		 */
+		ao2_unlock(cache->objects);
+		ao2_ref(cached, -1);
+		return 0;
+	}
 	remove_from_cache(cache, ast_sorcery_object_get_id(object), 1);
+	remove_negative_from_cache(cache, ast_sorcery_object_get_id(object));
 	if (cache->maximum_objects && ao2_container_count(cache->objects) >= cache->maximum_objects) {
 		if (remove_oldest_from_cache(cache)) {
 			ast_log(LOG_ERROR, "Unable to make room in cache for sorcery object '%s'.\n",
@@ -944,6 +1139,52 @@ static int stale_cache_update(const void *data)
 	return 0;
 }
 
+/*!
+ * \internal
+ * \brief Scheduler callback which fetches every object into a cache
+ *
+ * \param data The stale cache update task data for the cache
+ */
+static int memory_cache_prefetch(const void *data)
+{
+	struct stale_cache_update_task_data *task_data = (struct stale_cache_update_task_data *) data;
+	int count;
+
+	count = ast_sorcery_prefetch(task_data->sorcery, task_data->type, NULL);
+	ast_debug(1, "Prefetched %d objects of type '%s' into sorcery memory cache '%s'\n",
+		count, task_data->type, task_data->cache->name);
+
+	ao2_ref(task_data, -1);
+
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Queue fetching every object into a cache
+ *
+ * Objects are fetched from the scheduler as the backend may not be loaded
+ * yet when the cache is.
+ *
+ * \param sorcery The sorcery instance
+ * \param cache The sorcery memory cache
+ * \param type The type of object
+ */
+static void memory_cache_prefetch_queue(const struct ast_sorcery *sorcery, struct sorcery_memory_cache *cache,
+	const char *type)
+{
+	struct stale_cache_update_task_data *task_data;
+
+	if (!cache->prefetch || cache->full_backend_cache) {
+		return;
+	}
+
+	task_data = stale_cache_update_task_data_alloc((struct ast_sorcery *) sorcery, cache, type);
+	if (task_data && ast_sched_add(sched, 1, memory_cache_prefetch, task_data) < 0) {
+		ao2_ref(task_data, -1);
+	}
+}
+
 struct stale_update_task_data {
 	struct ast_sorcery *sorcery;
 	struct sorcery_memory_cache *cache;
@@ -1233,6 +1474,94 @@ static void *sorcery_memory_cache_retrieve_id(const struct ast_sorcery *sorcery,
 	return object;
 }
 
+/*!
+ * \internal
+ * \brief Callback function to determine if the backend is known not to have an object
+ *
+ * \param sorcery The sorcery instance
+ * \param data The sorcery memory cache
+ * \param type The type of the object
+ * \param id The id of the object
+ *
+ * \retval non-zero the backend did not have the object within the negative lifetime
+ * \retval 0 the backend needs to be asked
+ */
+static int sorcery_memory_cache_is_missing_id(const struct ast_sorcery *sorcery, void *data,
+	const char *type, const char *id)
+{
+	struct sorcery_memory_cache *cache = data;
+	struct sorcery_memory_negative_object *negative;
+	int missing;
+
+	if (!cache->negative || is_passthru_update()) {
+		return 0;
+	}
+
+	negative = ao2_find(cache->negative, id, OBJ_SEARCH_KEY);
+	if (!negative) {
+		return 0;
+	}
+
+	/* Expired entries are left for the next miss to clean up */
+	missing = ast_tvsub(ast_tvnow(), negative->created).tv_sec < cache->object_lifetime_negative;
+	ao2_ref(negative, -1);
+
+	return missing;
+}
+
+/*!
+ * \internal
+ * \brief Callback function to remember that the backend does not have an object
+ *
+ * \param sorcery The sorcery instance
+ * \param data The sorcery memory cache
+ * \param type The type of the object
+ * \param id The id of the object
+ */
+static void sorcery_memory_cache_missing_id(const struct ast_sorcery *sorcery, void *data,
+	const char *type, const char *id)
+{
+	struct sorcery_memory_cache *cache = data;
+	struct sorcery_memory_negative_object *negative;
+	struct sorcery_memory_negative_object *existing;
+	struct sorcery_memory_negative_object *oldest;
+	size_t id_len;
+
+	if (!cache->negative || is_passthru_update()) {
+		return;
+	}
+
+	id_len = strlen(id) + 1;
+	negative = ao2_alloc_options(sizeof(*negative) + id_len, NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!negative) {
+		return;
+	}
+	ast_copy_string(negative->id, id, id_len);
+	negative->created = ast_tvnow();
+
+	ao2_wrlock(cache->negative);
+	existing = ao2_find(cache->negative, id, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NOLOCK);
+	if (existing) {
+		AST_LIST_REMOVE(&cache->negative_order, existing, list);
+		ao2_ref(existing, -1);
+	}
+
+	/* All entries share the same lifetime so the expired and oldest ones are at the front */
+	while ((oldest = AST_LIST_FIRST(&cache->negative_order))
+		&& ((cache->maximum_negative_objects
+				&& ao2_container_count(cache->negative) >= cache->maximum_negative_objects)
+			|| ast_tvsub(negative->created, oldest->created).tv_sec >= cache->object_lifetime_negative)) {
+		remove_oldest_negative_from_cache(cache);
+	}
+
+	if (ao2_link_flags(cache->negative, negative, OBJ_NOLOCK)) {
+		AST_LIST_INSERT_TAIL(&cache->negative_order, negative, list);
+	}
+	ao2_unlock(cache->negative);
+
+	ao2_ref(negative, -1);
+}
+
 /*!
  * \internal
  * \brief AO2 callback function for comparing a retrieval request and finding applicable objects
@@ -1272,6 +1601,26 @@ static int sorcery_memory_cache_fields_cmp(void *obj, void *arg, int flags)
 	}
 }
 
+/*!
+ * \internal
+ * \brief Get the container of the cached objects that may match fields
+ *
+ * \param cache The sorcery memory cache
+ * \param fields The fields being searched for
+ *
+ * \return The cached objects found in the index, or all cached objects if the index can not narrow them
+ */
+static struct ao2_container *memory_cache_candidates(struct sorcery_memory_cache *cache, const struct ast_variable *fields)
+{
+	struct ao2_container *candidates = NULL;
+
+	if (cache->index && fields) {
+		candidates = ast_sorcery_index_find(cache->index, fields);
+	}
+
+	return candidates ? candidates : ao2_bump(cache->objects);
+}
+
 /*!
  * \internal
  * \brief Callback function to retrieve a single object based on fields
@@ -1290,6 +1639,7 @@ static void *sorcery_memory_cache_retrieve_fields(const struct ast_sorcery *sorc
 		.cache = cache,
 		.fields = fields,
 	};
+	struct ao2_container *candidates;
 	struct sorcery_memory_cached_object *cached;
 	void *object = NULL;
 
@@ -1297,7 +1647,9 @@ static void *sorcery_memory_cache_retrieve_fields(const struct ast_sorcery *sorc
 		return NULL;
 	}
 
-	cached = ao2_callback(cache->objects, 0, sorcery_memory_cache_fields_cmp, &params);
+	candidates = memory_cache_candidates(cache, fields);
+	cached = ao2_callback(candidates, 0, sorcery_memory_cache_fields_cmp, &params);
+	ao2_ref(candidates, -1);
 
 	if (cached) {
 		memory_cache_stale_check_object(sorcery, cache, cached);
@@ -1328,13 +1680,16 @@ static void sorcery_memory_cache_retrieve_multiple(const struct ast_sorcery *sor
 		.fields = fields,
 		.container = objects,
 	};
+	struct ao2_container *candidates;
 
 	if (is_passthru_update() || !cache->full_backend_cache) {
 		return;
 	}
 
 	memory_cache_full_update(sorcery, type, cache);
-	ao2_callback(cache->objects, 0, sorcery_memory_cache_fields_cmp, &params);
+	candidates = memory_cache_candidates(cache, fields);
+	ao2_callback(candidates, 0, sorcery_memory_cache_fields_cmp, &params);
+	ao2_ref(candidates, -1);
 
 	if (ao2_container_count(objects)) {
 		memory_cache_stale_check(sorcery, cache);
@@ -1399,6 +1754,12 @@ static void sorcery_memory_cache_load(void *data, const struct ast_sorcery *sorc
 
 	cache->sorcery = sorcery;
 	cache->object_type = ast_strdup(type);
+
+	if (cache->full_backend_cache) {
+		cache->index = ast_sorcery_index_alloc(sorcery, type);
+	}
+
+	memory_cache_prefetch_queue(sorcery, cache, type);
 }
 
 /*!
@@ -1420,6 +1781,8 @@ static void sorcery_memory_cache_reload(void *data, const struct ast_sorcery *so
 	ao2_wrlock(cache->objects);
 	remove_all_from_cache(cache);
 	ao2_unlock(cache->objects);
+
+	memory_cache_prefetch_queue(sorcery, cache, type);
 }
 
 /*!
@@ -1468,6 +1831,7 @@ static void *sorcery_memory_cache_open(const char *data)
 
 	cache->expire_id = -1;
 	cache->stale_update_sched_id = -1;
+	cache->maximum_negative_objects = CACHE_NEGATIVE_DEFAULT_MAXIMUM;
 
 	/* If no configuration options have been provided this memory cache will operate in a default
 	 * configuration.
@@ -1500,24 +1864,49 @@ static void *sorcery_memory_cache_open(const char *data)
 					value);
 				return NULL;
 			}
+		} else if (!strcasecmp(name, "object_lifetime_negative")) {
+			if (configuration_parse_unsigned_integer(value, &cache->object_lifetime_negative) != 1) {
+				ast_log(LOG_ERROR, "Unsupported object negative lifetime value of '%s' used for memory cache\n",
+					value);
+				return NULL;
+			}
+		} else if (!strcasecmp(name, "maximum_negative_objects")) {
+			if (configuration_parse_unsigned_integer(value, &cache->maximum_negative_objects) != 1) {
+				ast_log(LOG_ERROR, "Unsupported maximum negative objects value of '%s' used for memory cache\n",
+					value);
+				return NULL;
+			}
 		} else if (!strcasecmp(name, "expire_on_reload")) {
 			cache->expire_on_reload = ast_true(value);
 		} else if (!strcasecmp(name, "full_backend_cache")) {
 			cache->full_backend_cache = ast_true(value);
+		} else if (!strcasecmp(name, "prefetch")) {
+			cache->prefetch = ast_true(value);
 		} else {
 			ast_log(LOG_ERROR, "Unsupported option '%s' used for memory cache\n", name);
 			return NULL;
 		}
 	}
 
-	cache->objects = ao2_container_alloc_options(AO2_ALLOC_OPT_LOCK_RWLOCK,
+	/* Retrievals by id do not lock the container so they never wait on an update */
+	cache->objects = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND,
 		cache->maximum_objects ? cache->maximum_objects : CACHE_CONTAINER_BUCKET_SIZE,
-		sorcery_memory_cached_object_hash, sorcery_memory_cached_object_cmp);
+		sorcery_memory_cached_object_hash, NULL, sorcery_memory_cached_object_cmp);
 	if (!cache->objects) {
 		ast_log(LOG_ERROR, "Could not create a container to hold cached objects for memory cache\n");
 		return NULL;
 	}
 
+	if (cache->object_lifetime_negative) {
+		cache->negative = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK,
+			AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND, CACHE_NEGATIVE_CONTAINER_BUCKET_SIZE,
+			sorcery_memory_negative_object_hash, NULL, sorcery_memory_negative_object_cmp);
+		if (!cache->negative) {
+			ast_log(LOG_ERROR, "Could not create a container to hold negative entries for memory cache\n");
+			return NULL;
+		}
+	}
+
 	cache->object_heap = ast_heap_create(CACHE_HEAP_INIT_HEIGHT, age_cmp,
 		offsetof(struct sorcery_memory_cached_object, __heap_index));
 	if (!cache->object_heap) {
@@ -1673,7 +2062,14 @@ static char *sorcery_memory_cache_show(struct ast_cli_entry *e, int cmd, struct
 	} else {
 		ast_cli(a->fd, "Object staleness is not enabled - cached objects will not go stale\n");
 	}
+	if (cache->negative) {
+		ast_cli(a->fd, "Number of seconds a missing object is remembered: %d\n", cache->object_lifetime_negative);
+		ast_cli(a->fd, "Number of missing objects remembered: %d\n", ao2_container_count(cache->negative));
+	} else {
+		ast_cli(a->fd, "Negative caching is not enabled - missing objects are always looked up\n");
+	}
 	ast_cli(a->fd, "Expire all objects on reload: %s\n", AST_CLI_ONOFF(cache->expire_on_reload));
+	ast_cli(a->fd, "Prefetch all objects on load: %s\n", AST_CLI_ONOFF(cache->prefetch));
 
 	ao2_ref(cache, -1);
 
@@ -2941,6 +3337,9 @@ static void *test_data_alloc(const char *id) {
 	return ast_sorcery_generic_alloc(sizeof(struct test_data), NULL);
 }
 
+/*! \brief Number of times the mock wizard was asked for an object by ID */
+static int mock_retrieve_id_count;
+
 /*!
  * \brief Callback for retrieving sorcery object by ID
  *
@@ -2962,6 +3361,7 @@ static void *mock_retrieve_id(const struct ast_sorcery *sorcery, void *data,
 {
 	struct test_data *b_data;
 
+	++mock_retrieve_id_count;
 	if (!real_backend_data->exists) {
 		return NULL;
 	}
@@ -3185,6 +3585,171 @@ cleanup:
 	return res;
 }
 
+/*!
+ * \brief Retrieve an object and check how many times the mock backend was asked
+ */
+static int check_negative_retrieve(struct ast_test *test, struct ast_sorcery *sorcery,
+	const char *id, int expected)
+{
+	struct test_data *object;
+
+	object = ast_sorcery_retrieve_by_id(sorcery, "test", id);
+	if (object) {
+		ast_test_status_update(test, "Retrieved object '%s' the backend does not have\n", id);
+		ao2_ref(object, -1);
+		return -1;
+	}
+
+	if (mock_retrieve_id_count != expected) {
+		ast_test_status_update(test, "Backend was asked for objects %d times when %d was expected\n",
+			mock_retrieve_id_count, expected);
+		return -1;
+	}
+
+	return 0;
+}
+
+AST_TEST_DEFINE(negative)
+{
+	int res = AST_TEST_FAIL;
+	struct ast_sorcery *sorcery = NULL;
+	struct backend_data missing = {
+		.salt = 0,
+		.pepper = 0,
+		.exists = 0,
+	};
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "negative";
+		info->category = "/res/res_sorcery_memory_cache/";
+		info->summary = "Ensure that missing objects are remembered";
+		info->description = "This test performs the following:\n"
+			"\t* Create a sorcery instance with two wizards"
+			"\t\t* The first is a memory cache that remembers 2 missing objects for 2 seconds\n"
+			"\t\t* The second is a mock of a back-end without any objects\n"
+			"\t* Retrieves a missing object twice and ensures the backend is only asked once\n"
+			"\t* Retrieves more missing objects and ensures the oldest is forgotten\n"
+			"\t* Waits for the missing objects to expire and ensures the backend is asked again";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	ast_sorcery_wizard_register(&mock_wizard);
+
+	sorcery = ast_sorcery_open();
+	if (!sorcery) {
+		ast_test_status_update(test, "Failed to create sorcery instance\n");
+		goto cleanup;
+	}
+
+	ast_sorcery_apply_wizard_mapping(sorcery, "test", "memory_cache",
+			"object_lifetime_negative=2,maximum_negative_objects=2", 1);
+	ast_sorcery_apply_wizard_mapping(sorcery, "test", "mock", NULL, 0);
+	ast_sorcery_internal_object_register(sorcery, "test", test_data_alloc, NULL, NULL);
+
+	real_backend_data = &missing;
+	mock_retrieve_id_count = 0;
+
+	if (check_negative_retrieve(test, sorcery, "alice", 1)
+		|| check_negative_retrieve(test, sorcery, "alice", 1)
+		|| check_negative_retrieve(test, sorcery, "bob", 2)
+		|| check_negative_retrieve(test, sorcery, "carol", 3)
+		|| check_negative_retrieve(test, sorcery, "carol", 3)
+		|| check_negative_retrieve(test, sorcery, "alice", 4)) {
+		goto cleanup;
+	}
+
+	sleep(3);
+
+	if (check_negative_retrieve(test, sorcery, "alice", 5)
+		|| check_negative_retrieve(test, sorcery, "alice", 5)) {
+		goto cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+cleanup:
+	if (sorcery) {
+		ast_sorcery_unref(sorcery);
+	}
+	ast_sorcery_wizard_unregister(&mock_wizard);
+	return res;
+}
+
+AST_TEST_DEFINE(prefetch)
+{
+	int res = AST_TEST_FAIL;
+	struct ast_sorcery *sorcery = NULL;
+	struct sorcery_memory_cache *cache = NULL;
+	struct backend_data initial = {
+		.salt = 0,
+		.pepper = 0,
+		.exists = 3,
+	};
+	int count;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "prefetch";
+		info->category = "/res/res_sorcery_memory_cache/";
+		info->summary = "Ensure that prefetched objects are cached";
+		info->description = "This test performs the following:\n"
+			"\t* Create a sorcery instance with two wizards"
+			"\t\t* The first is a memory cache\n"
+			"\t\t* The second is a mock of a back-end with 3 objects\n"
+			"\t* Prefetches the objects and ensures all of them are in the cache";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	ast_sorcery_wizard_register(&mock_wizard);
+
+	sorcery = ast_sorcery_open();
+	if (!sorcery) {
+		ast_test_status_update(test, "Failed to create sorcery instance\n");
+		goto cleanup;
+	}
+
+	ast_sorcery_apply_wizard_mapping(sorcery, "test", "memory_cache", "name=prefetch_test", 1);
+	ast_sorcery_apply_wizard_mapping(sorcery, "test", "mock", NULL, 0);
+	ast_sorcery_internal_object_register(sorcery, "test", test_data_alloc, NULL, NULL);
+	ast_sorcery_load_object(sorcery, "test");
+
+	real_backend_data = &initial;
+
+	count = ast_sorcery_prefetch(sorcery, "test", NULL);
+	if (count != initial.exists) {
+		ast_test_status_update(test, "Prefetched %d objects when %d were expected\n",
+			count, initial.exists);
+		goto cleanup;
+	}
+
+	cache = ao2_find(caches, "prefetch_test", OBJ_SEARCH_KEY);
+	if (!cache) {
+		ast_test_status_update(test, "Failed to find the memory cache\n");
+		goto cleanup;
+	}
+
+	if (ao2_container_count(cache->objects) != initial.exists) {
+		ast_test_status_update(test, "Cache holds %d objects when %d were prefetched\n",
+			ao2_container_count(cache->objects), initial.exists);
+		goto cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+cleanup:
+	ao2_cleanup(cache);
+	if (sorcery) {
+		ast_sorcery_unref(sorcery);
+	}
+	ast_sorcery_wizard_unregister(&mock_wizard);
+	return res;
+}
+
 AST_TEST_DEFINE(full_backend_cache_expiration)
 {
 	int res = AST_TEST_FAIL;
@@ -3452,6 +4017,8 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(stale);
 	AST_TEST_UNREGISTER(full_backend_cache_expiration);
 	AST_TEST_UNREGISTER(full_backend_cache_stale);
+	AST_TEST_UNREGISTER(negative);
+	AST_TEST_UNREGISTER(prefetch);
 
 	ast_manager_unregister("SorceryMemoryCacheExpireObject");
 	ast_manager_unregister("SorceryMemoryCacheExpire");
@@ -3533,6 +4100,8 @@ static int load_module(void)
 	AST_TEST_REGISTER(expiration);
 	AST_TEST_REGISTER(full_backend_cache_expiration);
 	AST_TEST_REGISTER(full_backend_cache_stale);
+	AST_TEST_REGISTER(negative);
+	AST_TEST_REGISTER(prefetch);
 
 	return AST_MODULE_LOAD_SUCCESS;
 }
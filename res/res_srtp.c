@@ -59,6 +59,18 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/options.h"
 #include "asterisk/rtp_engine.h"
 #include "asterisk/astobj2.h"
+#include "asterisk/cli.h"
+#include "asterisk/time.h"
+
+/*! \brief Packets one direction of a session has processed and the time it took */
+struct srtp_crypto_stats {
+	/*! Packets protected or unprotected */
+	unsigned long packets;
+	/*! Packets that failed */
+	unsigned long failures;
+	/*! Time spent in libsrtp, in microseconds */
+	uint64_t usec;
+};
 
 struct ast_srtp {
 	struct ast_rtp_instance *rtp;
@@ -67,6 +79,8 @@ struct ast_srtp {
 	const struct ast_srtp_cb *cb;
 	void *data;
 	int warned;
+	struct srtp_crypto_stats protect_stats;
+	struct srtp_crypto_stats unprotect_stats;
 	unsigned char buf[8192 + AST_FRIENDLY_OFFSET];
 	unsigned char rtcpbuf[8192 + AST_FRIENDLY_OFFSET];
 };
@@ -78,6 +92,20 @@ struct ast_srtp_policy {
 /*! Tracks whether or not we've initialized the libsrtp library */
 static int g_initialized = 0;
 
+/*! \brief Totals of the sessions destroyed since the module was loaded */
+static struct {
+	unsigned long sessions;
+	struct srtp_crypto_stats protect;
+	struct srtp_crypto_stats unprotect;
+} totals;
+AST_MUTEX_DEFINE_STATIC(totals_lock);
+
+/*! \brief Number of sessions in existence */
+static int active_sessions;
+
+/*! \brief Set if the CPU has the AES-NI and carry-less multiply instructions */
+static int cpu_has_aesni;
+
 /* SRTP functions */
 static int ast_srtp_create(struct ast_srtp **srtp, struct ast_rtp_instance *rtp, struct ast_srtp_policy *policy);
 static int ast_srtp_replace(struct ast_srtp **srtp, struct ast_rtp_instance *rtp, struct ast_srtp_policy *policy);
@@ -198,6 +226,7 @@ static struct ast_srtp *res_srtp_new(void)
 	}
 	
 	srtp->warned = 1;
+	ast_atomic_fetchadd_int(&active_sessions, +1);
 
 	return srtp;
 }
@@ -334,7 +363,7 @@ static void ast_srtp_set_cb(struct ast_srtp *srtp, const struct ast_srtp_cb *cb,
 }
 
 /* Vtable functions */
-static int ast_srtp_unprotect(struct ast_srtp *srtp, void *buf, int *len, int rtcp)
+static int srtp_unprotect_packet(struct ast_srtp *srtp, void *buf, int *len, int rtcp)
 {
 	int res = 0;
 	int i;
@@ -431,10 +460,32 @@ tryagain:
 	return *len;
 }
 
+/*! \brief Account for one packet in a session's crypto stats */
+static void srtp_crypto_stats_add(struct srtp_crypto_stats *stats, struct timeval start, int res)
+{
+	stats->packets++;
+	if (res < 0) {
+		stats->failures++;
+	}
+	/* The wall clock may have been stepped back meanwhile */
+	stats->usec += MAX(ast_tvdiff_us(ast_tvnow(), start), 0);
+}
+
+static int ast_srtp_unprotect(struct ast_srtp *srtp, void *buf, int *len, int rtcp)
+{
+	struct timeval start = ast_tvnow();
+	int res;
+
+	res = srtp_unprotect_packet(srtp, buf, len, rtcp);
+	srtp_crypto_stats_add(&srtp->unprotect_stats, start, res);
+	return res;
+}
+
 static int ast_srtp_protect(struct ast_srtp *srtp, void **buf, int *len, int rtcp)
 {
 	int res;
 	unsigned char *localbuf;
+	struct timeval start;
 
 	if ((*len + SRTP_MAX_TRAILER_LEN) > sizeof(srtp->buf)) {
 		return -1;
@@ -444,10 +495,14 @@ static int ast_srtp_protect(struct ast_srtp *srtp, void **buf, int *len, int rtc
 
 	memcpy(localbuf, *buf, *len);
 
-	if ((res = rtcp ? srtp_protect_rtcp(srtp->session, localbuf, len) : srtp_protect(srtp->session, localbuf, len)) != err_status_ok && res != err_status_replay_fail) {
+	start = ast_tvnow();
+	res = rtcp ? srtp_protect_rtcp(srtp->session, localbuf, len) : srtp_protect(srtp->session, localbuf, len);
+	if (res != err_status_ok && res != err_status_replay_fail) {
+		srtp_crypto_stats_add(&srtp->protect_stats, start, -1);
 		ast_log(LOG_WARNING, "SRTP protect: %s\n", srtp_errstr(res));
 		return -1;
 	}
+	srtp_crypto_stats_add(&srtp->protect_stats, start, 0);
 
 	*buf = localbuf;
 	return *len;
@@ -486,8 +541,28 @@ static int ast_srtp_replace(struct ast_srtp **srtp, struct ast_rtp_instance *rtp
 	return ast_srtp_create(srtp, rtp, policy);
 }
 
+/*! \brief Add the stats of one direction of a session to the totals */
+static void srtp_crypto_stats_merge(struct srtp_crypto_stats *total, const struct srtp_crypto_stats *stats)
+{
+	total->packets += stats->packets;
+	total->failures += stats->failures;
+	total->usec += stats->usec;
+}
+
 static void ast_srtp_destroy(struct ast_srtp *srtp)
 {
+	ast_debug(3, "SRTP session %p protected %lu packets in %" PRIu64 " us (%lu failed), "
+		"unprotected %lu packets in %" PRIu64 " us (%lu failed)\n", srtp,
+		srtp->protect_stats.packets, srtp->protect_stats.usec, srtp->protect_stats.failures,
+		srtp->unprotect_stats.packets, srtp->unprotect_stats.usec, srtp->unprotect_stats.failures);
+
+	ast_mutex_lock(&totals_lock);
+	totals.sessions++;
+	srtp_crypto_stats_merge(&totals.protect, &srtp->protect_stats);
+	srtp_crypto_stats_merge(&totals.unprotect, &srtp->unprotect_stats);
+	ast_mutex_unlock(&totals_lock);
+	ast_atomic_fetchadd_int(&active_sessions, -1);
+
 	if (srtp->session) {
 		srtp_dealloc(srtp->session);
 	}
@@ -558,8 +633,59 @@ static int ast_srtp_change_source(struct ast_srtp *srtp, unsigned int from_ssrc,
 	return 0;
 }
 
+/*! \brief Print the totals of one direction */
+static void srtp_crypto_stats_print(int fd, const char *name, const struct srtp_crypto_stats *stats)
+{
+	ast_cli(fd, "%-12s %12lu %12lu %14" PRIu64 " %10.2f\n", name,
+		stats->packets, stats->failures, stats->usec,
+		stats->packets ? (double) stats->usec / stats->packets : 0.0);
+}
+
+static char *handle_cli_srtp_show_stats(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct srtp_crypto_stats protect;
+	struct srtp_crypto_stats unprotect;
+	unsigned long sessions;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "srtp show stats";
+		e->usage =
+			"Usage: srtp show stats\n"
+			"       Show the packets protected and unprotected by the SRTP sessions\n"
+			"       that have ended, and the time libsrtp took on them.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3) {
+		return CLI_SHOWUSAGE;
+	}
+
+	ast_mutex_lock(&totals_lock);
+	sessions = totals.sessions;
+	protect = totals.protect;
+	unprotect = totals.unprotect;
+	ast_mutex_unlock(&totals_lock);
+
+	ast_cli(a->fd, "AES-NI: %s\n", cpu_has_aesni ? "Available" : "Not available");
+	ast_cli(a->fd, "Active sessions: %d\n", active_sessions);
+	ast_cli(a->fd, "Ended sessions: %lu\n\n", sessions);
+	ast_cli(a->fd, "%-12s %12s %12s %14s %10s\n", "Direction", "Packets", "Failures", "Time (us)", "us/packet");
+	srtp_crypto_stats_print(a->fd, "Protect", &protect);
+	srtp_crypto_stats_print(a->fd, "Unprotect", &unprotect);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_srtp[] = {
+	AST_CLI_DEFINE(handle_cli_srtp_show_stats, "Show SRTP crypto statistics"),
+};
+
 static void res_srtp_shutdown(void)
 {
+	ast_cli_unregister_multiple(cli_srtp, ARRAY_LEN(cli_srtp));
 	srtp_install_event_handler(NULL);
 	ast_rtp_engine_unregister_srtp();
 #ifdef HAVE_SRTP_SHUTDOWN
@@ -581,12 +707,20 @@ static int res_srtp_init(void)
 
 	srtp_install_event_handler(srtp_event_cb);
 
+#if defined(__x86_64__) || defined(__i386__)
+	/* libsrtp only uses these when it is built with OpenSSL crypto */
+	cpu_has_aesni = __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+#endif
+	ast_debug(1, "AES-NI is %savailable for SRTP\n", cpu_has_aesni ? "" : "not ");
+
 	if (ast_rtp_engine_register_srtp(&srtp_res, &policy_res)) {
 		ast_log(AST_LOG_WARNING, "Failed to register SRTP with rtp engine\n");
 		res_srtp_shutdown();
 		return -1;
 	}
 
+	ast_cli_register_multiple(cli_srtp, ARRAY_LEN(cli_srtp));
+
 	g_initialized = 1;
 	return 0;
 }
@@ -139,7 +139,7 @@ static void publish_chanspy_message(struct stasis_app_snoop *snoop, int start)
 		return;
 	}
 
-	stasis_publish(ast_channel_topic(snoop->chan), message);
+	stasis_publish(ast_channel_topic_for_publish(snoop->chan), message);
 }
 
 /*! \brief Callback function for writing to a Snoop whisper audiohook */
@@ -45,6 +45,14 @@
 				<configOption name="add_newline">
 					<synopsis>Append a newline to every event. This is useful if you want to fake out a server using netcat (nc -lu 8125)</synopsis>
 				</configOption>
+				<configOption name="flush_interval">
+					<synopsis>Milliseconds metrics are buffered for before they are sent</synopsis>
+					<description><para>When set, each thread sums the counters and gauges it
+					logs and packs them, with the other metrics it logs, into as few
+					datagrams as possible, which are sent every <replaceable>flush_interval</replaceable>
+					milliseconds.  When 0, the default, every metric is sent in its own
+					datagram as it is logged.</para></description>
+				</configOption>
 			</configObject>
 		</configFile>
 	</configInfo>
@@ -56,7 +64,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #include "asterisk/config_options.h"
 #include "asterisk/module.h"
+#include "asterisk/linkedlists.h"
 #include "asterisk/netsock2.h"
+#include "asterisk/sched.h"
+#include "asterisk/threadstorage.h"
 
 #define AST_API_MODULE
 #include "asterisk/statsd.h"
@@ -65,6 +76,12 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #define MAX_PREFIX 40
 
+/*! Largest datagram metrics are packed into, so it fits an Ethernet frame */
+#define MAX_PACKET_SIZE 1432
+
+/*! How often buffers are checked for metrics when flush_interval is 0 */
+#define IDLE_FLUSH_INTERVAL 1000
+
 /*! Socket for sending statd messages */
 static int socket_fd = -1;
 
@@ -78,6 +95,8 @@ struct conf_global_options {
 	struct ast_sockaddr statsd_server;
 	/*! Prefix to put on every stat. */
 	char prefix[MAX_PREFIX + 1];
+	/*! Milliseconds metrics are buffered for, or 0 to send them immediately. */
+	unsigned int flush_interval;
 };
 
 /*! \brief All configuration options for statsd client. */
@@ -97,13 +116,381 @@ static void conf_server(const struct conf *cfg, struct ast_sockaddr *addr)
 	}
 }
 
+/*! \brief Send a datagram of metrics to the statsd server, and empty it */
+static void statsd_send(const struct conf *cfg, struct ast_str **packet)
+{
+	struct ast_sockaddr statsd_server;
+
+	if (!ast_str_strlen(*packet)) {
+		return;
+	}
+
+	if (cfg->global->add_newline) {
+		ast_str_append(packet, 0, "\n");
+	}
+
+	conf_server(cfg, &statsd_server);
+	ast_debug(6, "Sending statistic %s to StatsD server\n", ast_str_buffer(*packet));
+	ast_sendto(socket_fd, ast_str_buffer(*packet), ast_str_strlen(*packet), 0, &statsd_server);
+
+	ast_str_reset(*packet);
+}
+
+/*!
+ * \brief Pack a metric into a datagram
+ *
+ * The datagram is sent first if the metric would make it too big.
+ */
+static void statsd_pack(const struct conf *cfg, struct ast_str **packet, const char *metric)
+{
+	if (ast_str_strlen(*packet)
+		&& ast_str_strlen(*packet) + strlen(metric) + 2 > MAX_PACKET_SIZE) {
+		statsd_send(cfg, packet);
+	}
+
+	ast_str_append(packet, 0, "%s%s", ast_str_strlen(*packet) ? "\n" : "", metric);
+}
+
+/*! \brief Format a metric as the statsd server expects it */
+static void statsd_format(struct ast_str **msg, const struct conf *cfg, const char *metric_name,
+	const char *metric_type, const char *value, double sample_rate)
+{
+	if (!ast_strlen_zero(cfg->global->prefix)) {
+		ast_str_append(msg, 0, "%s.", cfg->global->prefix);
+	}
+
+	ast_str_append(msg, 0, "%s:%s|%s", metric_name, value, metric_type);
+
+	if (sample_rate < 1.0) {
+		ast_str_append(msg, 0, "|@%.2f", sample_rate);
+	}
+}
+
+/*! \brief A counter or gauge summed over a flush interval */
+struct statsd_aggregate {
+	/*! The sum of a counter, or the value a gauge was set to */
+	intmax_t value;
+	/*! The change of a gauge since it was set */
+	intmax_t delta;
+	/*! Non-zero for a gauge */
+	unsigned int gauge:1;
+	/*! Non-zero if the gauge was set, rather than only changed */
+	unsigned int absolute:1;
+	/*! Non-zero if logged since the last flush */
+	unsigned int updated:1;
+	char name[0];
+};
+
+/*! \brief Key aggregates are found by */
+struct statsd_aggregate_key {
+	const char *name;
+	unsigned int gauge;
+};
+
+static int statsd_aggregate_hash(const void *obj, const int flags)
+{
+	const char *name;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_KEY:
+		name = ((const struct statsd_aggregate_key *) obj)->name;
+		break;
+	case OBJ_SEARCH_OBJECT:
+		name = ((const struct statsd_aggregate *) obj)->name;
+		break;
+	default:
+		ast_assert(0);
+		return 0;
+	}
+	return ast_str_hash(name);
+}
+
+static int statsd_aggregate_cmp(void *obj, void *arg, int flags)
+{
+	const struct statsd_aggregate *left = obj;
+	const char *name;
+	unsigned int gauge;
+
+	switch (flags & OBJ_SEARCH_MASK) {
+	case OBJ_SEARCH_KEY:
+		name = ((const struct statsd_aggregate_key *) arg)->name;
+		gauge = ((const struct statsd_aggregate_key *) arg)->gauge;
+		break;
+	case OBJ_SEARCH_OBJECT:
+		name = ((const struct statsd_aggregate *) arg)->name;
+		gauge = ((const struct statsd_aggregate *) arg)->gauge;
+		break;
+	default:
+		ast_assert(0);
+		return 0;
+	}
+	if (left->gauge != gauge || strcmp(left->name, name)) {
+		return 0;
+	}
+	return CMP_MATCH;
+}
+
+/*!
+ * \brief Metrics a thread has logged since they were last sent
+ *
+ * Only the thread itself and the flush adds to, and empties, the buffer, so
+ * its lock is hardly ever contended.
+ */
+struct statsd_thread_buf {
+	ast_mutex_t lock;
+	/*! Counters and gauges, summed */
+	struct ao2_container *aggregates;
+	/*! Datagram of the metrics that can't be summed */
+	struct ast_str *pending;
+	AST_LIST_ENTRY(statsd_thread_buf) list;
+};
+
+/*! \brief The buffers of all threads that have logged with flush_interval set */
+static AST_LIST_HEAD_STATIC(thread_bufs, statsd_thread_buf);
+
+/*! \brief Scheduler the buffers are flushed by */
+static struct ast_sched_context *sched;
+
+struct statsd_flush {
+	const struct conf *cfg;
+	/*! Datagram being packed */
+	struct ast_str **packet;
+	/*! Scratch space for formatting a metric */
+	struct ast_str **msg;
+};
+
+/*!
+ * \brief Pack a counter or gauge for sending and reset it
+ *
+ * Aggregates not logged during the interval are unlinked, so metrics whose
+ * names come and go, such as those named after a channel, are not kept.
+ */
+static int statsd_aggregate_flush(void *obj, void *arg, int flags)
+{
+	struct statsd_aggregate *aggregate = obj;
+	struct statsd_flush *flush = arg;
+	struct ast_str **msg = flush->msg;
+	char value[32];
+
+	if (!aggregate->updated) {
+		return CMP_MATCH;
+	}
+
+	ast_str_reset(*msg);
+	if (!aggregate->gauge) {
+		snprintf(value, sizeof(value), "%jd", aggregate->value);
+		statsd_format(msg, flush->cfg, aggregate->name, AST_STATSD_COUNTER, value, 1.0);
+		statsd_pack(flush->cfg, flush->packet, ast_str_buffer(*msg));
+	} else if (!aggregate->absolute) {
+		if (aggregate->delta) {
+			snprintf(value, sizeof(value), "%+jd", aggregate->delta);
+			statsd_format(msg, flush->cfg, aggregate->name, AST_STATSD_GAUGE, value, 1.0);
+			statsd_pack(flush->cfg, flush->packet, ast_str_buffer(*msg));
+		}
+	} else {
+		intmax_t gauge = aggregate->value + aggregate->delta;
+
+		/* A gauge can't be set to a negative value, only changed to one */
+		snprintf(value, sizeof(value), "%jd", MAX(gauge, 0));
+		statsd_format(msg, flush->cfg, aggregate->name, AST_STATSD_GAUGE, value, 1.0);
+		statsd_pack(flush->cfg, flush->packet, ast_str_buffer(*msg));
+		if (gauge < 0) {
+			ast_str_reset(*msg);
+			snprintf(value, sizeof(value), "%jd", gauge);
+			statsd_format(msg, flush->cfg, aggregate->name, AST_STATSD_GAUGE, value, 1.0);
+			statsd_pack(flush->cfg, flush->packet, ast_str_buffer(*msg));
+		}
+	}
+
+	aggregate->value = 0;
+	aggregate->delta = 0;
+	aggregate->absolute = 0;
+	aggregate->updated = 0;
+
+	return 0;
+}
+
+/*! \brief Pack the metrics of a thread's buffer for sending. Called with it locked. */
+static void statsd_thread_buf_flush(struct statsd_thread_buf *buf, const struct conf *cfg,
+	struct ast_str **packet, struct ast_str **msg)
+{
+	struct statsd_flush flush = { .cfg = cfg, .packet = packet, .msg = msg, };
+
+	ao2_callback(buf->aggregates, OBJ_NODATA | OBJ_MULTIPLE | OBJ_UNLINK,
+		statsd_aggregate_flush, &flush);
+
+	if (ast_str_strlen(buf->pending)) {
+		statsd_pack(cfg, packet, ast_str_buffer(buf->pending));
+		ast_str_reset(buf->pending);
+	}
+}
+
+/*! \brief Send the metrics of every thread's buffer */
+static void statsd_flush_all(void)
+{
+	struct conf *cfg;
+	struct statsd_thread_buf *buf;
+	struct ast_str *packet;
+	struct ast_str *msg;
+
+	cfg = ao2_global_obj_ref(confs);
+	if (!cfg || socket_fd == -1) {
+		ao2_cleanup(cfg);
+		return;
+	}
+
+	packet = ast_str_create(MAX_PACKET_SIZE);
+	msg = ast_str_create(128);
+	if (!packet || !msg) {
+		ast_free(packet);
+		ast_free(msg);
+		ao2_ref(cfg, -1);
+		return;
+	}
+
+	AST_LIST_LOCK(&thread_bufs);
+	AST_LIST_TRAVERSE(&thread_bufs, buf, list) {
+		ast_mutex_lock(&buf->lock);
+		statsd_thread_buf_flush(buf, cfg, &packet, &msg);
+		ast_mutex_unlock(&buf->lock);
+	}
+	AST_LIST_UNLOCK(&thread_bufs);
+
+	statsd_send(cfg, &packet);
+
+	ast_free(packet);
+	ast_free(msg);
+	ao2_ref(cfg, -1);
+}
+
+/*! \brief Scheduler callback, returning when to flush next */
+static int statsd_flush_cb(const void *data)
+{
+	RAII_VAR(struct conf *, cfg, ao2_global_obj_ref(confs), ao2_cleanup);
+
+	statsd_flush_all();
+
+	if (!cfg || !cfg->global->flush_interval) {
+		return IDLE_FLUSH_INTERVAL;
+	}
+	return cfg->global->flush_interval;
+}
+
+static int statsd_thread_buf_init(void *data)
+{
+	struct statsd_thread_buf *buf = data;
+
+	buf->aggregates = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, 61,
+		statsd_aggregate_hash, NULL, statsd_aggregate_cmp);
+	buf->pending = ast_str_create(MAX_PACKET_SIZE);
+	if (!buf->aggregates || !buf->pending) {
+		ao2_cleanup(buf->aggregates);
+		ast_free(buf->pending);
+		return -1;
+	}
+	ast_mutex_init(&buf->lock);
+
+	AST_LIST_LOCK(&thread_bufs);
+	AST_LIST_INSERT_HEAD(&thread_bufs, buf, list);
+	AST_LIST_UNLOCK(&thread_bufs);
+
+	return 0;
+}
+
+static void statsd_thread_buf_destroy(void *data)
+{
+	struct statsd_thread_buf *buf = data;
+	struct conf *cfg;
+	struct ast_str *packet;
+	struct ast_str *msg;
+
+	AST_LIST_LOCK(&thread_bufs);
+	AST_LIST_REMOVE(&thread_bufs, buf, list);
+	AST_LIST_UNLOCK(&thread_bufs);
+
+	/* Send what the thread logged since the last flush before it goes */
+	cfg = ao2_global_obj_ref(confs);
+	packet = ast_str_create(MAX_PACKET_SIZE);
+	msg = ast_str_create(128);
+	if (cfg && socket_fd != -1 && packet && msg) {
+		statsd_thread_buf_flush(buf, cfg, &packet, &msg);
+		statsd_send(cfg, &packet);
+	}
+	ast_free(packet);
+	ast_free(msg);
+	ao2_cleanup(cfg);
+
+	ao2_ref(buf->aggregates, -1);
+	ast_free(buf->pending);
+	ast_mutex_destroy(&buf->lock);
+	ast_free(buf);
+}
+
+AST_THREADSTORAGE_CUSTOM(statsd_thread_buf, statsd_thread_buf_init, statsd_thread_buf_destroy);
+
+/*! \brief Scratch space for formatting a metric that is buffered */
+AST_THREADSTORAGE(statsd_msg_buf);
+
+/*!
+ * \brief Sum a counter or gauge into a thread's buffer. Called with it locked.
+ *
+ * \retval 0 if the metric was summed
+ * \retval -1 if the metric is of a type or value that can't be summed
+ */
+static int statsd_aggregate_add(struct statsd_thread_buf *buf, const char *metric_name,
+	const char *metric_type, const char *value)
+{
+	struct statsd_aggregate_key key = { .name = metric_name, };
+	struct statsd_aggregate *aggregate;
+	intmax_t amount;
+	char *end;
+
+	if (!strcmp(metric_type, AST_STATSD_GAUGE)) {
+		key.gauge = 1;
+	} else if (strcmp(metric_type, AST_STATSD_COUNTER)) {
+		return -1;
+	}
+
+	errno = 0;
+	amount = strtoimax(value, &end, 10);
+	if (ast_strlen_zero(value) || *end || errno) {
+		return -1;
+	}
+
+	aggregate = ao2_find(buf->aggregates, &key, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!aggregate) {
+		aggregate = ao2_alloc_options(sizeof(*aggregate) + strlen(metric_name) + 1, NULL,
+			AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!aggregate) {
+			return -1;
+		}
+		strcpy(aggregate->name, metric_name); /* Safe */
+		aggregate->gauge = key.gauge;
+		ao2_link_flags(buf->aggregates, aggregate, OBJ_NOLOCK);
+	}
+
+	if (!aggregate->gauge) {
+		aggregate->value += amount;
+	} else if (*value == '+' || *value == '-') {
+		aggregate->delta += amount;
+	} else {
+		/* Setting a gauge replaces whatever it was changed by before */
+		aggregate->value = amount;
+		aggregate->delta = 0;
+		aggregate->absolute = 1;
+	}
+	aggregate->updated = 1;
+
+	ao2_ref(aggregate, -1);
+	return 0;
+}
+
 void AST_OPTIONAL_API_NAME(ast_statsd_log_string)(const char *metric_name,
 	const char *metric_type, const char *value, double sample_rate)
 {
 	struct conf *cfg;
 	struct ast_str *msg;
-	size_t len;
-	struct ast_sockaddr statsd_server;
+	struct statsd_thread_buf *buf;
 
 	if (socket_fd == -1) {
 		return;
@@ -119,7 +506,22 @@ void AST_OPTIONAL_API_NAME(ast_statsd_log_string)(const char *metric_name,
 	}
 
 	cfg = ao2_global_obj_ref(confs);
-	conf_server(cfg, &statsd_server);
+
+	if (cfg->global->flush_interval
+		&& (buf = ast_threadstorage_get(&statsd_thread_buf, sizeof(*buf)))
+		&& (msg = ast_str_thread_get(&statsd_msg_buf, 128))) {
+		ast_mutex_lock(&buf->lock);
+		/* Sampled metrics are sent as they are, so the server scales them */
+		if (sample_rate < 1.0
+			|| statsd_aggregate_add(buf, metric_name, metric_type, value)) {
+			ast_str_reset(msg);
+			statsd_format(&msg, cfg, metric_name, metric_type, value, sample_rate);
+			statsd_pack(cfg, &buf->pending, ast_str_buffer(msg));
+		}
+		ast_mutex_unlock(&buf->lock);
+		ao2_ref(cfg, -1);
+		return;
+	}
 
 	msg = ast_str_create(40);
 	if (!msg) {
@@ -127,24 +529,8 @@ void AST_OPTIONAL_API_NAME(ast_statsd_log_string)(const char *metric_name,
 		return;
 	}
 
-	if (!ast_strlen_zero(cfg->global->prefix)) {
-		ast_str_append(&msg, 0, "%s.", cfg->global->prefix);
-	}
-
-	ast_str_append(&msg, 0, "%s:%s|%s", metric_name, value, metric_type);
-
-	if (sample_rate < 1.0) {
-		ast_str_append(&msg, 0, "|@%.2f", sample_rate);
-	}
-
-	if (cfg->global->add_newline) {
-		ast_str_append(&msg, 0, "\n");
-	}
-
-	len = ast_str_strlen(msg);
-
-	ast_debug(6, "Sending statistic %s to StatsD server\n", ast_str_buffer(msg));
-	ast_sendto(socket_fd, ast_str_buffer(msg), len, 0, &statsd_server);
+	statsd_format(&msg, cfg, metric_name, metric_type, value, sample_rate);
+	statsd_send(cfg, &msg);
 
 	ao2_cleanup(cfg);
 	ast_free(msg);
@@ -305,6 +691,20 @@ static int statsd_init(void)
 	ast_debug(3, "  statsd server = %s.\n", server);
 	ast_debug(3, "  add newline = %s\n", AST_YESNO(cfg->global->add_newline));
 	ast_debug(3, "  prefix = %s\n", cfg->global->prefix);
+	ast_debug(3, "  flush interval = %u\n", cfg->global->flush_interval);
+
+	if (!sched) {
+		sched = ast_sched_context_create();
+		if (!sched || ast_sched_start_thread(sched)
+			|| ast_sched_add_variable(sched, IDLE_FLUSH_INTERVAL, statsd_flush_cb, NULL, 1) < 0) {
+			ast_log(LOG_ERROR, "Failed to start flushing statsd buffers\n");
+			if (sched) {
+				ast_sched_context_destroy(sched);
+				sched = NULL;
+			}
+			return -1;
+		}
+	}
 
 	return 0;
 }
@@ -312,6 +712,7 @@ static int statsd_init(void)
 static void statsd_shutdown(void)
 {
 	ast_debug(3, "Shutting down statsd client.\n");
+	statsd_flush_all();
 	if (socket_fd != -1) {
 		close(socket_fd);
 		socket_fd = -1;
@@ -341,6 +742,10 @@ static int load_module(void)
 		"", OPT_CHAR_ARRAY_T, 0,
 		CHARFLDSET(struct conf_global_options, prefix));
 
+	aco_option_register(&cfg_info, "flush_interval", ACO_EXACT, global_options,
+		"0", OPT_UINT_T, 0,
+		FLDSET(struct conf_global_options, flush_interval));
+
 	if (aco_process_config(&cfg_info, 0)) {
 		aco_info_destroy(&cfg_info);
 		return AST_MODULE_LOAD_DECLINE;
@@ -360,6 +765,10 @@ static int load_module(void)
 
 static int unload_module(void)
 {
+	if (sched) {
+		ast_sched_context_destroy(sched);
+		sched = NULL;
+	}
 	statsd_shutdown();
 	aco_info_destroy(&cfg_info);
 	ao2_global_obj_release(confs);
@@ -73,6 +73,34 @@ struct timerfd_timer {
 	unsigned int is_continuous:1;
 };
 
+/*!
+ * \internal
+ * \brief Arm a timer with the interval of its saved timer
+ *
+ * The first expiration is put on the next multiple of the interval on the
+ * monotonic clock, so timers of the same rate expire together and the kernel
+ * can wake their threads from a single timer interrupt.
+ */
+static int timerfd_timer_arm(struct timerfd_timer *timer)
+{
+	struct itimerspec aligned = timer->saved_timer;
+	struct timespec now;
+	uint64_t interval;
+	uint64_t next;
+
+	interval = (uint64_t) aligned.it_interval.tv_sec * 1000000000 + aligned.it_interval.tv_nsec;
+	if (!interval || clock_gettime(CLOCK_MONOTONIC, &now)) {
+		return timerfd_settime(timer->fd, 0, &timer->saved_timer, NULL);
+	}
+
+	next = ((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec) / interval + 1;
+	next *= interval;
+	aligned.it_value.tv_sec = next / 1000000000;
+	aligned.it_value.tv_nsec = next % 1000000000;
+
+	return timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, &aligned, NULL);
+}
+
 static void timer_destroy(void *obj)
 {
 	struct timerfd_timer *timer = obj;
@@ -116,7 +144,7 @@ static int timerfd_timer_set_rate(void *data, unsigned int rate)
 	timer->saved_timer.it_interval.tv_nsec = timer->saved_timer.it_value.tv_nsec;
 
 	if (!timer->is_continuous) {
-		res = timerfd_settime(timer->fd, 0, &timer->saved_timer, NULL);
+		res = timerfd_timer_arm(timer);
 	}
 
 	ao2_unlock(timer);
@@ -210,7 +238,7 @@ static int timerfd_timer_disable_continuous(void *data)
 		return 0;
 	}
 
-	res = timerfd_settime(timer->fd, 0, &timer->saved_timer, NULL);
+	res = timerfd_timer_arm(timer);
 	timer->is_continuous = 0;
 	memset(&timer->saved_timer, 0, sizeof(timer->saved_timer));
 	ao2_unlock(timer);
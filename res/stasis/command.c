@@ -95,6 +95,16 @@ int command_join(struct stasis_app_command *command)
 	return command->retval;
 }
 
+stasis_app_command_cb command_callback(struct stasis_app_command *command)
+{
+	return command->callback;
+}
+
+void *command_data(struct stasis_app_command *command)
+{
+	return command->data;
+}
+
 void command_invoke(struct stasis_app_command *command,
 	struct stasis_app_control *control, struct ast_channel *chan)
 {
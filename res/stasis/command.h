@@ -37,6 +37,16 @@ struct stasis_app_command *command_create(
 
 void command_complete(struct stasis_app_command *command, int retval);
 
+/*!
+ * \brief Get the callback a command will invoke
+ */
+stasis_app_command_cb command_callback(struct stasis_app_command *command);
+
+/*!
+ * \brief Get the data a command will pass to its callback
+ */
+void *command_data(struct stasis_app_command *command);
+
 void command_invoke(struct stasis_app_command *command,
 	struct stasis_app_control *control, struct ast_channel *chan);
 
@@ -1116,7 +1116,7 @@ void stasis_app_control_publish(
 	if (!control || !control->channel || !message) {
 		return;
 	}
-	stasis_publish(ast_channel_topic(control->channel), message);
+	stasis_publish(ast_channel_topic_for_publish(control->channel), message);
 }
 
 int stasis_app_control_queue_control(struct stasis_app_control *control,
@@ -1138,22 +1138,113 @@ void control_flush_queue(struct stasis_app_control *control)
 	ao2_iterator_destroy(&iter);
 }
 
+/*!
+ * \internal
+ * \brief Name of the variable a set variable command sets, for comparison.
+ *
+ * \return NULL if the command sets a dialplan function, which may have side
+ *         effects and so must not be coalesced or run with the channel locked.
+ */
+static const char *chanvar_command_name(struct stasis_app_command *command)
+{
+	struct chanvar *var = command_data(command);
+	const char *name = var->name;
+
+	if (ast_strlen_zero(name) || name[strlen(name) - 1] == ')') {
+		return NULL;
+	}
+
+	/* Inheritance prefixes do not make for a different variable */
+	if (*name == '_') {
+		++name;
+		if (*name == '_') {
+			++name;
+		}
+	}
+	return name;
+}
+
+AST_VECTOR(chanvar_commands, struct stasis_app_command *);
+
+/*!
+ * \internal
+ * \brief Run a run of consecutive set variable commands.
+ *
+ * The commands are run with the channel locked once for all of them, and
+ * a command is skipped when a later one of the run sets the same variable.
+ * Skipped commands complete successfully, just as if they had been
+ * overwritten right away.
+ */
+static void dispatch_chanvar_commands(struct stasis_app_control *control,
+	struct ast_channel *chan, struct chanvar_commands *commands)
+{
+	size_t i;
+	size_t j;
+
+	if (!AST_VECTOR_SIZE(commands)) {
+		return;
+	}
+
+	ast_channel_lock(chan);
+	for (i = 0; i < AST_VECTOR_SIZE(commands); ++i) {
+		struct stasis_app_command *command = AST_VECTOR_GET(commands, i);
+		const char *name = chanvar_command_name(command);
+
+		for (j = i + 1; j < AST_VECTOR_SIZE(commands); ++j) {
+			if (!strcmp(name, chanvar_command_name(AST_VECTOR_GET(commands, j)))) {
+				break;
+			}
+		}
+
+		if (j < AST_VECTOR_SIZE(commands)) {
+			command_complete(command, 0);
+		} else {
+			command_invoke(command, control, chan);
+		}
+		ao2_ref(command, -1);
+	}
+	ast_channel_unlock(chan);
+
+	AST_VECTOR_RESET(commands, AST_VECTOR_ELEM_CLEANUP_NOOP);
+}
+
 int control_dispatch_all(struct stasis_app_control *control,
 	struct ast_channel *chan)
 {
 	int count = 0;
-	struct ao2_iterator iter;
+	struct ao2_iterator *iter;
 	struct stasis_app_command *command;
+	struct chanvar_commands chanvars;
 
 	ast_assert(control->channel == chan);
 
-	iter = ao2_iterator_init(control->command_queue, AO2_ITERATOR_UNLINK);
-	while ((command = ao2_iterator_next(&iter))) {
+	/* Take every queued command at once, locking the queue a single time */
+	iter = ao2_callback(control->command_queue, OBJ_MULTIPLE | OBJ_UNLINK, NULL, NULL);
+	if (!iter) {
+		return 0;
+	}
+
+	/* Nothing is allocated until a set variable command is seen */
+	AST_VECTOR_INIT(&chanvars, 0);
+
+	while ((command = ao2_iterator_next(iter))) {
+		++count;
+
+		if (command_callback(command) == app_control_set_channel_var
+			&& chanvar_command_name(command)
+			&& !AST_VECTOR_APPEND(&chanvars, command)) {
+			continue;
+		}
+
+		/* Anything else may depend on the variables set before it */
+		dispatch_chanvar_commands(control, chan, &chanvars);
 		command_invoke(command, control, chan);
 		ao2_ref(command, -1);
-		++count;
 	}
-	ao2_iterator_destroy(&iter);
+	dispatch_chanvar_commands(control, chan, &chanvars);
+
+	ao2_iterator_destroy(iter);
+	AST_VECTOR_FREE(&chanvars);
 
 	return count;
 }
@@ -22,8 +22,8 @@
  *
  * \author \verbatim Matt Jordan <mjordan@digium.com> \endverbatim
  *
- * Tests the abstract jitter buffer API.  This tests both adaptive and fixed
- * jitter buffers.  Functions defined in abstract_jb that are not part of the
+ * Tests the abstract jitter buffer API.  This tests the adaptive, fixed and
+ * stretch jitter buffers.  Functions defined in abstract_jb that are not part of the
  * abstract jitter buffer API are not tested by this unit test.
  *
  * \ingroup tests
@@ -38,6 +38,8 @@
 
 ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
+#include <math.h>
+
 #include "asterisk/utils.h"
 #include "asterisk/module.h"
 #include "asterisk/test.h"
@@ -513,6 +515,120 @@ test_put_overflow(AST_JB_FIXED, "fixed", 12)
 
 test_put_out_of_order(AST_JB_FIXED, "fixed", DEFAULT_CONFIG_RESYNC_THRESHOLD)
 
+test_create_nominal(AST_JB_STRETCH, "stretch")
+
+test_put_first(AST_JB_STRETCH, "stretch")
+
+#define STRETCH_FRAME_MS 20
+#define STRETCH_FRAME_SAMPLES 160
+#define STRETCH_FRAMES 50
+#define STRETCH_LOST_FRAME 30
+
+/*!
+ * \internal
+ * \brief Create a test frame of a 150Hz tone in signed linear
+ */
+static struct ast_frame *create_tone_frame(long timestamp, int seqno)
+{
+	int16_t data[STRETCH_FRAME_SAMPLES];
+	struct ast_frame f = {0};
+	int i;
+
+	for (i = 0; i < STRETCH_FRAME_SAMPLES; ++i) {
+		data[i] = 8000 * sin(2 * M_PI * 150 * (timestamp * 8 + i) / 8000.0);
+	}
+
+	f.subclass.format = ast_format_slin;
+	f.frametype = AST_FRAME_VOICE;
+	f.src = "TEST";
+	f.ts = timestamp;
+	f.len = STRETCH_FRAME_MS;
+	f.seqno = seqno;
+	f.data.ptr = data;
+	f.datalen = sizeof(data);
+	f.samples = STRETCH_FRAME_SAMPLES;
+
+	return ast_frisolate(&f);
+}
+
+AST_TEST_DEFINE(TEST_NAME(AST_JB_STRETCH, conceal))
+{
+	RAII_VAR(struct ast_jb *, jb, &default_jb, dispose_jitterbuffer);
+	const struct ast_jb_impl *impl;
+	struct ast_jb_conf conf;
+	struct ast_jb_stats stats;
+	struct ast_frame *frame;
+	long now;
+	int i = 0;
+	int res;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = STRINGIFY_TESTNAME(TEST_NAME(AST_JB_STRETCH, conceal));
+		info->category = "/main/abstract_jb/";
+		info->summary = "Test a stretch jitterbuffer covering a lost frame";
+		info->description =
+			"This tests that a stretch jitterbuffer plays out audio without "
+			"gaps when a frame is lost, by stretching the audio around it, "
+			"and that it counts the frame as lost.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	OBTAIN_JITTERBUFFER_IMPL(impl, AST_JB_STRETCH, "stretch");
+	MAKE_DEFAULT_CONFIG(&conf, impl);
+	conf.max_size = 200;
+	conf.resync_threshold = 1000;
+	conf.target_extra = 0;
+	jb->jbobj = impl->create(&conf);
+	jb->impl = impl;
+	if (!jb->jbobj) {
+		ast_test_status_update(test, "Error: Failed to create stretch jitterbuffer\n");
+		return AST_TEST_FAIL;
+	}
+
+	/* Frames arrive every 20ms, one of them never does */
+	for (now = 1100; i < STRETCH_FRAMES; ++now) {
+		if (now == 1100 + i * STRETCH_FRAME_MS) {
+			if (i != STRETCH_LOST_FRAME) {
+				frame = create_tone_frame(1000 + i * STRETCH_FRAME_MS, i);
+				res = i ? impl->put(jb->jbobj, frame, now) : impl->put_first(jb->jbobj, frame, now);
+				if (res != AST_JB_IMPL_OK) {
+					ast_frfree(frame);
+					ast_test_status_update(test, "Error: On frame %d, got %d back from put (expected %d)\n",
+						i, res, AST_JB_IMPL_OK);
+					return AST_TEST_FAIL;
+				}
+			}
+			++i;
+		}
+
+		while (i < STRETCH_FRAMES && now >= impl->next(jb->jbobj)) {
+			res = impl->get(jb->jbobj, &frame, now, STRETCH_FRAME_MS);
+			if (res != AST_JB_IMPL_OK) {
+				ast_test_status_update(test, "Error: got %d back from get at time %ld (expected %d)\n",
+					res, now, AST_JB_IMPL_OK);
+				return AST_TEST_FAIL;
+			}
+			LONG_INT_TEST(frame->len, STRETCH_FRAME_MS);
+			INT_TEST(frame->samples, STRETCH_FRAME_SAMPLES);
+			ast_frfree(frame);
+		}
+	}
+
+	impl->stats(jb->jbobj, &stats);
+	UINT_TEST(stats.frames_in, STRETCH_FRAMES - 1U);
+	UINT_TEST(stats.frames_lost, 1U);
+	LONG_INT_TEST(stats.interpolated, 0);
+	if (!stats.expanded) {
+		ast_test_status_update(test, "Error: the lost frame was not covered by stretching\n");
+		return AST_TEST_FAIL;
+	}
+
+	return AST_TEST_PASS;
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(TEST_NAME(AST_JB_ADAPTIVE, create));
@@ -527,6 +643,10 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(TEST_NAME(AST_JB_FIXED, put_overflow));
 	AST_TEST_UNREGISTER(TEST_NAME(AST_JB_FIXED, put_out_of_order));
 
+	AST_TEST_UNREGISTER(TEST_NAME(AST_JB_STRETCH, create));
+	AST_TEST_UNREGISTER(TEST_NAME(AST_JB_STRETCH, put_first));
+	AST_TEST_UNREGISTER(TEST_NAME(AST_JB_STRETCH, conceal));
+
 	return 0;
 }
 
@@ -544,6 +664,10 @@ static int load_module(void)
 	AST_TEST_REGISTER(TEST_NAME(AST_JB_FIXED, put_overflow));
 	AST_TEST_REGISTER(TEST_NAME(AST_JB_FIXED, put_out_of_order));
 
+	AST_TEST_REGISTER(TEST_NAME(AST_JB_STRETCH, create));
+	AST_TEST_REGISTER(TEST_NAME(AST_JB_STRETCH, put_first));
+	AST_TEST_REGISTER(TEST_NAME(AST_JB_STRETCH, conceal));
+
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
@@ -435,10 +435,111 @@ acl_cleanup:
 	return res;
 }
 
+/*! \brief Make up a random rule for the acl_index test */
+static void random_rule(char *buf, size_t size)
+{
+	static const char *dotted_masks[] = { "255.0.255.0", "255.255.0.255", "0.255.0.0" };
+	const char *negate = ast_random() % 8 ? "" : "!";
+
+	switch (ast_random() % 6) {
+	case 0:
+		/* A netmask that is not a prefix */
+		snprintf(buf, size, "%s10.%d.%d.0/%s", negate, (int) (ast_random() % 4),
+			(int) (ast_random() % 4), dotted_masks[ast_random() % ARRAY_LEN(dotted_masks)]);
+		break;
+	case 1:
+		snprintf(buf, size, "%sfe80::%x:0/%d", negate, (unsigned int) (ast_random() % 4),
+			(int) (ast_random() % 129));
+		break;
+	default:
+		snprintf(buf, size, "%s10.%d.%d.%d/%d", negate, (int) (ast_random() % 4),
+			(int) (ast_random() % 4), (int) (ast_random() % 4), (int) (ast_random() % 33));
+		break;
+	}
+}
+
+AST_TEST_DEFINE(acl_index)
+{
+	struct ast_ha *ha = NULL;
+	struct ast_ha_index *index = NULL;
+	struct ast_sockaddr addr;
+	char rule[64];
+	char address[64];
+	int error = 0;
+	int round;
+	int i;
+	enum ast_test_result_state res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "acl_index";
+		info->category = "/main/acl/";
+		info->summary = "ACL index test";
+		info->description =
+			"Checks that host access rules compiled into an index\n"
+			"give the same result as applying the rule list.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	for (round = 0; round < 50 && res == AST_TEST_PASS; ++round) {
+		for (i = 0; i < 1 + round; ++i) {
+			random_rule(rule, sizeof(rule));
+			ha = ast_append_ha(ast_random() % 2 ? "permit" : "deny", rule, ha, &error);
+			if (error) {
+				ast_test_status_update(test, "Failed to add rule '%s'\n", rule);
+				res = AST_TEST_FAIL;
+				goto end;
+			}
+		}
+
+		index = ast_ha_index_build(ha);
+		if (!index) {
+			ast_test_status_update(test, "Failed to build index\n");
+			res = AST_TEST_FAIL;
+			goto end;
+		}
+
+		for (i = 0; i < 200; ++i) {
+			switch (ast_random() % 4) {
+			case 0:
+				snprintf(address, sizeof(address), "fe80::%x:%x", (unsigned int) (ast_random() % 4),
+					(unsigned int) (ast_random() % 4));
+				break;
+			case 1:
+				snprintf(address, sizeof(address), "::ffff:10.%d.%d.%d", (int) (ast_random() % 4),
+					(int) (ast_random() % 4), (int) (ast_random() % 4));
+				break;
+			default:
+				snprintf(address, sizeof(address), "10.%d.%d.%d", (int) (ast_random() % 4),
+					(int) (ast_random() % 4), (int) (ast_random() % 4));
+				break;
+			}
+			ast_sockaddr_parse(&addr, address, PARSE_PORT_FORBID);
+
+			if (ast_ha_index_apply(index, &addr) != ast_apply_ha(ha, &addr)) {
+				ast_test_status_update(test, "Index and rule list disagree about '%s'\n", address);
+				res = AST_TEST_FAIL;
+				break;
+			}
+		}
+
+		ast_ha_index_free(index);
+		index = NULL;
+	}
+
+end:
+	ast_ha_index_free(index);
+	ast_free_ha(ha);
+	return res;
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(invalid_acl);
 	AST_TEST_UNREGISTER(acl);
+	AST_TEST_UNREGISTER(acl_index);
 	return 0;
 }
 
@@ -446,6 +547,7 @@ static int load_module(void)
 {
 	AST_TEST_REGISTER(invalid_acl);
 	AST_TEST_REGISTER(acl);
+	AST_TEST_REGISTER(acl_index);
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
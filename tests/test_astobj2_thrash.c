@@ -245,7 +245,8 @@ static int compare_strings(void *lhs, void *rhs, int flags)
 	}
 }
 
-AST_TEST_DEFINE(hash_test)
+static enum ast_test_result_state hash_test_run(struct ast_test *test,
+	unsigned int container_options)
 {
 	enum ast_test_result_state res = AST_TEST_PASS;
 	struct hash_test data = {};
@@ -253,23 +254,12 @@ AST_TEST_DEFINE(hash_test)
 	void *thread_results;
 	int i;
 
-	switch (cmd) {
-	case TEST_INIT:
-		info->name = "thrash";
-		info->category = "/main/astobj2/";
-		info->summary = "Testing astobj2 container concurrency";
-		info->description = "Test astobj2 container concurrency correctness.";
-		return AST_TEST_NOT_RUN;
-	case TEST_EXECUTE:
-		break;
-	}
-
 	ast_test_status_update(test, "Executing hash concurrency test...\n");
 	data.preload = MAX_HASH_ENTRIES / 2;
 	data.max_grow = MAX_HASH_ENTRIES - data.preload;
 	data.deadline = ast_tvadd(ast_tvnow(), ast_tv(MAX_TEST_SECONDS, 0));
-	data.to_be_thrashed = ao2_container_alloc(HASH_BUCKETS, hash_string,
-		compare_strings);
+	data.to_be_thrashed = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX,
+		container_options, HASH_BUCKETS, hash_string, NULL, compare_strings);
 
 	if (data.to_be_thrashed == NULL) {
 		ast_test_status_update(test, "Allocation failed\n");
@@ -345,15 +335,72 @@ AST_TEST_DEFINE(hash_test)
 	return res;
 }
 
+AST_TEST_DEFINE(hash_test)
+{
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "thrash";
+		info->category = "/main/astobj2/";
+		info->summary = "Testing astobj2 container concurrency";
+		info->description = "Test astobj2 container concurrency correctness.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	return hash_test_run(test, 0);
+}
+
+AST_TEST_DEFINE(hash_test_lockfree)
+{
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "thrash_lockfree";
+		info->category = "/main/astobj2/";
+		info->summary = "Testing astobj2 lock free find concurrency";
+		info->description =
+			"Test astobj2 container concurrency correctness when\n"
+			"finds do not lock the container.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	return hash_test_run(test, AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND);
+}
+
+AST_TEST_DEFINE(hash_test_resize)
+{
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "thrash_resize";
+		info->category = "/main/astobj2/";
+		info->summary = "Testing astobj2 resizing hash container concurrency";
+		info->description =
+			"Test astobj2 container concurrency correctness when\n"
+			"the buckets grow while the container is in use.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	return hash_test_run(test, AO2_CONTAINER_ALLOC_OPT_AUTO_RESIZE
+		| AO2_CONTAINER_ALLOC_OPT_LOCKFREE_FIND);
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(hash_test);
+	AST_TEST_UNREGISTER(hash_test_lockfree);
+	AST_TEST_UNREGISTER(hash_test_resize);
 	return 0;
 }
 
 static int load_module(void)
 {
 	AST_TEST_REGISTER(hash_test);
+	AST_TEST_REGISTER(hash_test_lockfree);
+	AST_TEST_REGISTER(hash_test_resize);
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
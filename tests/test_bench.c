@@ -0,0 +1,375 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ * \brief Benchmarks of core subsystems
+ *
+ * Run with 'bench execute all'.  See \ref AstBenchAPI.
+ *
+ * \ingroup tests
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/bench.h"
+#include "asterisk/module.h"
+#include "asterisk/astobj2.h"
+#include "asterisk/taskprocessor.h"
+#include "asterisk/stasis.h"
+#include "asterisk/translate.h"
+#include "asterisk/format_cache.h"
+#include "asterisk/frame.h"
+#include "asterisk/lock.h"
+#include "asterisk/time.h"
+
+/*! \brief Objects in the container of the astobj2 benchmarks */
+#define AO2_OBJECTS 10000
+
+/*! \brief Lookups or tasks in an iteration */
+#define OPS_PER_ITERATION 1000
+
+/*! \brief Samples in the frames translated */
+#define FRAME_SAMPLES 160
+
+static struct ao2_container *bench_container;
+
+/*! \brief Completion of asynchronous work of an iteration */
+static struct {
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	/*! Tasks or messages not handled yet */
+	int pending;
+	/*! When the last message was delivered */
+	struct timeval delivered;
+} completion;
+
+static void completion_set(int pending)
+{
+	ast_mutex_lock(&completion.lock);
+	completion.pending = pending;
+	ast_mutex_unlock(&completion.lock);
+}
+
+static void completion_done(void)
+{
+	ast_mutex_lock(&completion.lock);
+	if (!--completion.pending) {
+		completion.delivered = ast_tvnow();
+		ast_cond_signal(&completion.cond);
+	}
+	ast_mutex_unlock(&completion.lock);
+}
+
+/*! \brief Wait for the work of an iteration to be done, at most 10 seconds */
+static int completion_wait(void)
+{
+	struct timeval deadline = ast_tvadd(ast_tvnow(), ast_tv(10, 0));
+	struct timespec end = {
+		.tv_sec = deadline.tv_sec,
+		.tv_nsec = deadline.tv_usec * 1000,
+	};
+	int res = 0;
+
+	ast_mutex_lock(&completion.lock);
+	while (completion.pending && !res) {
+		res = ast_cond_timedwait(&completion.cond, &completion.lock, &end);
+	}
+	res = completion.pending ? -1 : 0;
+	ast_mutex_unlock(&completion.lock);
+
+	return res;
+}
+
+static int bench_container_fill(void)
+{
+	char name[16];
+	int i;
+
+	bench_container = ast_str_container_alloc_options(AO2_ALLOC_OPT_LOCK_RWLOCK, 1021);
+	if (!bench_container) {
+		return -1;
+	}
+
+	for (i = 0; i < AO2_OBJECTS; i++) {
+		snprintf(name, sizeof(name), "object-%d", i);
+		if (ast_str_container_add(bench_container, name)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+AST_BENCH_DEFINE(ao2_hash_find)
+{
+	char name[16];
+	int i;
+
+	switch (cmd) {
+	case BENCH_INIT:
+		info->name = "hash_find";
+		info->category = "/main/astobj2/";
+		info->summary = "Find objects by key in a hash container";
+		info->description = "Looks up random keys of a 10000 object hash container of strings.";
+		info->ops = OPS_PER_ITERATION;
+		return 0;
+	case BENCH_SETUP:
+		return bench_container_fill();
+	case BENCH_RUN:
+		for (i = 0; i < OPS_PER_ITERATION; i++) {
+			snprintf(name, sizeof(name), "object-%ld", ast_random() % AO2_OBJECTS);
+			ao2_find(bench_container, name, OBJ_SEARCH_KEY | OBJ_NODATA);
+		}
+		return 0;
+	case BENCH_CLEANUP:
+		ao2_cleanup(bench_container);
+		bench_container = NULL;
+		return 0;
+	}
+
+	return -1;
+}
+
+AST_BENCH_DEFINE(ao2_hash_link_unlink)
+{
+	char *obj;
+	int i;
+
+	switch (cmd) {
+	case BENCH_INIT:
+		info->name = "hash_link_unlink";
+		info->category = "/main/astobj2/";
+		info->summary = "Link and unlink objects of a hash container";
+		info->description = "Unlinks and links back objects of a 10000 object hash container of strings.";
+		info->ops = OPS_PER_ITERATION;
+		return 0;
+	case BENCH_SETUP:
+		return bench_container_fill();
+	case BENCH_RUN:
+		for (i = 0; i < OPS_PER_ITERATION; i++) {
+			char name[16];
+
+			snprintf(name, sizeof(name), "object-%ld", ast_random() % AO2_OBJECTS);
+			obj = ao2_find(bench_container, name, OBJ_SEARCH_KEY | OBJ_UNLINK);
+			if (!obj) {
+				return -1;
+			}
+			ao2_link(bench_container, obj);
+			ao2_ref(obj, -1);
+		}
+		return 0;
+	case BENCH_CLEANUP:
+		ao2_cleanup(bench_container);
+		bench_container = NULL;
+		return 0;
+	}
+
+	return -1;
+}
+
+static struct ast_taskprocessor *bench_tps;
+
+static int bench_task(void *data)
+{
+	completion_done();
+	return 0;
+}
+
+AST_BENCH_DEFINE(taskprocessor_throughput)
+{
+	int i;
+
+	switch (cmd) {
+	case BENCH_INIT:
+		info->name = "throughput";
+		info->category = "/main/taskprocessor/";
+		info->summary = "Push tasks to a taskprocessor";
+		info->description = "Pushes 1000 empty tasks to a taskprocessor and waits for all of them to run.";
+		info->ops = OPS_PER_ITERATION;
+		return 0;
+	case BENCH_SETUP:
+		bench_tps = ast_taskprocessor_get("bench_throughput", TPS_REF_DEFAULT);
+		return bench_tps ? 0 : -1;
+	case BENCH_RUN:
+		completion_set(OPS_PER_ITERATION);
+		for (i = 0; i < OPS_PER_ITERATION; i++) {
+			if (ast_taskprocessor_push(bench_tps, bench_task, NULL)) {
+				return -1;
+			}
+		}
+		return completion_wait();
+	case BENCH_CLEANUP:
+		bench_tps = ast_taskprocessor_unreference(bench_tps);
+		return 0;
+	}
+
+	return -1;
+}
+
+static struct stasis_topic *bench_topic;
+static struct stasis_subscription *bench_sub;
+static struct stasis_message_type *bench_message_type;
+
+static void bench_message_cb(void *data, struct stasis_subscription *sub, struct stasis_message *message)
+{
+	if (stasis_message_type(message) == bench_message_type) {
+		completion_done();
+	}
+}
+
+AST_BENCH_DEFINE(stasis_latency)
+{
+	struct stasis_message *message;
+	struct timeval *sent;
+
+	switch (cmd) {
+	case BENCH_INIT:
+		info->name = "publish_latency";
+		info->category = "/stasis/";
+		info->summary = "Time from publishing a message to its delivery";
+		info->description = "Publishes a message to a topic with one subscriber and measures how long it takes to be delivered.";
+		info->iterations = 1000;
+		return 0;
+	case BENCH_SETUP:
+		if (stasis_message_type_create("BenchMessage", NULL, &bench_message_type) != STASIS_MESSAGE_TYPE_SUCCESS) {
+			return -1;
+		}
+		bench_topic = stasis_topic_create("bench_topic");
+		if (!bench_topic) {
+			return -1;
+		}
+		bench_sub = stasis_subscribe(bench_topic, bench_message_cb, NULL);
+		return bench_sub ? 0 : -1;
+	case BENCH_RUN:
+		sent = ao2_alloc_options(sizeof(*sent), NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!sent) {
+			return -1;
+		}
+		message = stasis_message_create(bench_message_type, sent);
+		if (!message) {
+			ao2_ref(sent, -1);
+			return -1;
+		}
+
+		completion_set(1);
+		*sent = ast_tvnow();
+		stasis_publish(bench_topic, message);
+		ao2_ref(message, -1);
+		if (completion_wait()) {
+			ao2_ref(sent, -1);
+			return -1;
+		}
+		ast_bench_set_time(bench, ast_tvdiff_us(completion.delivered, *sent));
+		ao2_ref(sent, -1);
+		return 0;
+	case BENCH_CLEANUP:
+		bench_sub = stasis_unsubscribe_and_join(bench_sub);
+		ao2_cleanup(bench_topic);
+		bench_topic = NULL;
+		ao2_cleanup(bench_message_type);
+		bench_message_type = NULL;
+		return 0;
+	}
+
+	return -1;
+}
+
+static struct ast_trans_pvt *bench_path;
+static struct ast_frame bench_frame;
+static int16_t bench_samples[FRAME_SAMPLES];
+
+AST_BENCH_DEFINE(translate_slin_ulaw)
+{
+	struct ast_frame *out;
+	int i;
+
+	switch (cmd) {
+	case BENCH_INIT:
+		info->name = "slin_to_ulaw";
+		info->category = "/main/translate/";
+		info->summary = "Translate frames from signed linear to ulaw";
+		info->description = "Translates 1000 frames of 20 ms from 8 kHz signed linear to ulaw. Needs codec_ulaw.";
+		info->ops = OPS_PER_ITERATION;
+		return 0;
+	case BENCH_SETUP:
+		bench_path = ast_translator_build_path(ast_format_ulaw, ast_format_slin);
+		if (!bench_path) {
+			ast_bench_status_update(bench, "No translation path from slin to ulaw\n");
+			return -1;
+		}
+		for (i = 0; i < FRAME_SAMPLES; i++) {
+			bench_samples[i] = (i % 40 - 20) * 800;
+		}
+		bench_frame.frametype = AST_FRAME_VOICE;
+		bench_frame.subclass.format = ast_format_slin;
+		bench_frame.data.ptr = bench_samples;
+		bench_frame.datalen = sizeof(bench_samples);
+		bench_frame.samples = FRAME_SAMPLES;
+		bench_frame.src = "bench";
+		return 0;
+	case BENCH_RUN:
+		for (i = 0; i < OPS_PER_ITERATION; i++) {
+			out = ast_translate(bench_path, &bench_frame, 0);
+			if (!out) {
+				return -1;
+			}
+			ast_frfree(out);
+		}
+		return 0;
+	case BENCH_CLEANUP:
+		if (bench_path) {
+			ast_translator_free_path(bench_path);
+			bench_path = NULL;
+		}
+		return 0;
+	}
+
+	return -1;
+}
+
+static int unload_module(void)
+{
+	AST_BENCH_UNREGISTER(ao2_hash_find);
+	AST_BENCH_UNREGISTER(ao2_hash_link_unlink);
+	AST_BENCH_UNREGISTER(taskprocessor_throughput);
+	AST_BENCH_UNREGISTER(stasis_latency);
+	AST_BENCH_UNREGISTER(translate_slin_ulaw);
+	ast_mutex_destroy(&completion.lock);
+	ast_cond_destroy(&completion.cond);
+	return 0;
+}
+
+static int load_module(void)
+{
+	ast_mutex_init(&completion.lock);
+	ast_cond_init(&completion.cond, NULL);
+	AST_BENCH_REGISTER(ao2_hash_find);
+	AST_BENCH_REGISTER(ao2_hash_link_unlink);
+	AST_BENCH_REGISTER(taskprocessor_throughput);
+	AST_BENCH_REGISTER(stasis_latency);
+	AST_BENCH_REGISTER(translate_slin_ulaw);
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "Core benchmarks");
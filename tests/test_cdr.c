@@ -54,6 +54,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #define MOCK_CDR_BACKEND "mock_cdr_backend"
 
+#define MOCK_CDR_BATCH_BACKEND "mock_cdr_batch_backend"
+
 #define CHANNEL_TECH_NAME "CDRTestChannel"
 
 /*! \brief A placeholder for Asterisk's 'real' CDR configuration */
@@ -74,6 +76,14 @@ static struct ast_cdr_config congestion_cdr_config = {
 	.settings.flags = CDR_ENABLED | CDR_UNANSWERED | CDR_DEBUG | CDR_CONGESTION,
 };
 
+/*! \brief A configuration that posts CDRs in batches of two */
+static struct ast_cdr_config batch_cdr_config = {
+	.settings.flags = CDR_ENABLED | CDR_UNANSWERED | CDR_DEBUG | CDR_BATCHMODE,
+	.batch_settings.size = 2,
+	.batch_settings.time = 5,
+	.batch_settings.settings.flags = BATCH_MODE_SCHEDULER_ONLY,
+};
+
 /*! \brief Macro to swap a configuration out from the CDR engine. This should be
  * used at the beginning of each test to set the needed configuration for that
  * test.
@@ -165,6 +175,36 @@ static int mock_cdr_backend_cb(struct ast_cdr *cdr)
 	return 0;
 }
 
+/*! \brief The largest batch of CDRs the mock batch backend has received */
+static size_t global_mock_cdr_batch_size;
+
+/*! \internal
+ * \brief Callback function for the mock CDR batch backend
+ *
+ * Each record of the batch is handled as the mock CDR backend does.
+ */
+static int mock_cdr_batch_backend_cb(struct ast_cdr **cdrs, size_t count)
+{
+	size_t i;
+
+	AST_LIST_LOCK(&actual_cdr_entries);
+	if (count > global_mock_cdr_batch_size) {
+		global_mock_cdr_batch_size = count;
+	}
+	AST_LIST_UNLOCK(&actual_cdr_entries);
+
+	for (i = 0; i < count; i++) {
+		struct ast_cdr *next = cdrs[i]->next;
+
+		/* Only the record itself was given to us */
+		cdrs[i]->next = NULL;
+		mock_cdr_backend_cb(cdrs[i]);
+		cdrs[i]->next = next;
+	}
+
+	return 0;
+}
+
 /*! \internal
  * \brief Remove all entries from \ref actual_cdr_entries
  */
@@ -178,6 +218,7 @@ static void clear_mock_cdr_backend(void)
 		ast_free(cdr_wrapper);
 	}
 	global_mock_cdr_count = 0;
+	global_mock_cdr_batch_size = 0;
 	AST_LIST_UNLOCK(&actual_cdr_entries);
 }
 
@@ -2517,6 +2558,83 @@ AST_TEST_DEFINE(test_cdr_fork_cdr)
 	return result;
 }
 
+AST_TEST_DEFINE(test_cdr_batch_backend)
+{
+	RAII_VAR(struct ast_channel *, chan_alice, NULL, safe_channel_release);
+	RAII_VAR(struct ast_channel *, chan_bob, NULL, safe_channel_release);
+	RAII_VAR(struct ast_cdr_config *, config, ao2_alloc(sizeof(*config), NULL),
+			ao2_cleanup);
+
+	struct ast_party_caller caller_alice = ALICE_CALLERID;
+	struct ast_party_caller caller_bob = BOB_CALLERID;
+	struct ast_cdr bob_expected = {
+		.clid = "\"Bob\" <200>",
+		.src = "200",
+		.dst = "200",
+		.dcontext = "default",
+		.channel = CHANNEL_TECH_NAME "/Bob",
+		.amaflags = AST_AMA_DOCUMENTATION,
+		.disposition = AST_CDR_NOANSWER,
+		.accountcode = "200",
+	};
+	struct ast_cdr alice_expected = {
+		.clid = "\"Alice\" <100>",
+		.src = "100",
+		.dst = "100",
+		.dcontext = "default",
+		.channel = CHANNEL_TECH_NAME "/Alice",
+		.amaflags = AST_AMA_DOCUMENTATION,
+		.disposition = AST_CDR_NOANSWER,
+		.accountcode = "100",
+		.next = &bob_expected,
+	};
+	enum ast_test_result_state result = AST_TEST_NOT_RUN;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = __func__;
+		info->category = TEST_CATEGORY;
+		info->summary = "Test that a batch backend is given a batch of CDRs at once";
+		info->description =
+			"Test that a CDR backend registered with a batch callback\n"
+			"is given all of the CDRs of a batch in one call";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	/* Only let the batch backend record anything */
+	ast_cdr_backend_suspend(MOCK_CDR_BACKEND);
+	if (ast_cdr_register_batch(MOCK_CDR_BATCH_BACKEND, "Mock CDR batch backend", NULL, mock_cdr_batch_backend_cb)) {
+		ast_cdr_backend_unsuspend(MOCK_CDR_BACKEND);
+		return AST_TEST_FAIL;
+	}
+
+	SWAP_CONFIG(config, batch_cdr_config);
+
+	CREATE_ALICE_CHANNEL(chan_alice, &caller_alice, &alice_expected);
+	HANGUP_CHANNEL(chan_alice, AST_CAUSE_NORMAL);
+
+	CREATE_BOB_CHANNEL(chan_bob, &caller_bob, &bob_expected);
+	HANGUP_CHANNEL(chan_bob, AST_CAUSE_NORMAL);
+
+	result = verify_mock_cdr_record(test, &alice_expected, 2);
+
+	AST_LIST_LOCK(&actual_cdr_entries);
+	if (result == AST_TEST_PASS && global_mock_cdr_batch_size != 2) {
+		ast_test_status_update(test, "Largest batch received was %zu CDRs, expected 2\n",
+			global_mock_cdr_batch_size);
+		result = AST_TEST_FAIL;
+	}
+	AST_LIST_UNLOCK(&actual_cdr_entries);
+
+	ast_cdr_backend_suspend(MOCK_CDR_BATCH_BACKEND);
+	ast_cdr_unregister(MOCK_CDR_BATCH_BACKEND);
+	ast_cdr_backend_unsuspend(MOCK_CDR_BACKEND);
+
+	return result;
+}
+
 /*!
  * \internal
  * \brief Callback function called before each test executes
@@ -2577,6 +2695,8 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(test_cdr_no_reset_cdr);
 	AST_TEST_UNREGISTER(test_cdr_fork_cdr);
 
+	AST_TEST_UNREGISTER(test_cdr_batch_backend);
+
 	ast_cdr_unregister(MOCK_CDR_BACKEND);
 	ast_channel_unregister(&test_cdr_chan_tech);
 	clear_mock_cdr_backend();
@@ -2618,6 +2738,8 @@ static int load_module(void)
 	AST_TEST_REGISTER(test_cdr_no_reset_cdr);
 	AST_TEST_REGISTER(test_cdr_fork_cdr);
 
+	AST_TEST_REGISTER(test_cdr_batch_backend);
+
 	ast_test_register_init(TEST_CATEGORY, test_cdr_init_cb);
 	ast_test_register_cleanup(TEST_CATEGORY, test_cdr_cleanup_cb);
 
@@ -0,0 +1,357 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Channel container and waitfor tests
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/test.h"
+#include "asterisk/module.h"
+#include "asterisk/channel.h"
+
+#define TEST_CHANNELS 40
+#define TEST_PREFIX "TestLookup/prefix-"
+
+/*! \brief Count the channels an iterator returns that start with TEST_PREFIX */
+static int count_matches(struct ast_channel_iterator *iter)
+{
+	struct ast_channel *chan;
+	int count = 0;
+
+	if (!iter) {
+		return -1;
+	}
+	while ((chan = ast_channel_iterator_next(iter))) {
+		if (!strncmp(ast_channel_name(chan), TEST_PREFIX, strlen(TEST_PREFIX))) {
+			++count;
+		}
+		ast_channel_unref(chan);
+	}
+	ast_channel_iterator_destroy(iter);
+
+	return count;
+}
+
+AST_TEST_DEFINE(channel_lookup)
+{
+	struct ast_channel *chans[TEST_CHANNELS] = { NULL, };
+	struct ast_channel *other = NULL;
+	struct ast_channel *found;
+	char name[64];
+	char uniqueid[AST_MAX_UNIQUEID];
+	int count;
+	int i;
+	enum ast_test_result_state res = AST_TEST_FAIL;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "lookup";
+		info->category = "/main/channel/";
+		info->summary = "Channel container lookup test";
+		info->description =
+			"Checks that channels can be found by name, name prefix, unique ID\n"
+			"and iteration, including after they have been renamed.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	for (i = 0; i < TEST_CHANNELS; ++i) {
+		chans[i] = ast_channel_alloc(0, AST_STATE_DOWN, NULL, NULL, NULL, NULL, NULL,
+			NULL, NULL, 0, TEST_PREFIX "%d", i);
+		if (!chans[i]) {
+			ast_test_status_update(test, "Failed to allocate channel %d\n", i);
+			goto cleanup;
+		}
+		ast_channel_unlock(chans[i]);
+	}
+	other = ast_channel_alloc(0, AST_STATE_DOWN, NULL, NULL, NULL, NULL, NULL,
+		NULL, NULL, 0, "TestLookup/other");
+	if (!other) {
+		ast_test_status_update(test, "Failed to allocate channel\n");
+		goto cleanup;
+	}
+	ast_channel_unlock(other);
+
+	for (i = 0; i < TEST_CHANNELS; ++i) {
+		/* Lookups ignore case */
+		snprintf(name, sizeof(name), "testlookup/PREFIX-%d", i);
+		found = ast_channel_get_by_name(name);
+		ast_channel_cleanup(found);
+		if (found != chans[i]) {
+			ast_test_status_update(test, "Failed to find channel '%s' by name\n", name);
+			goto cleanup;
+		}
+	}
+
+	found = ast_channel_get_by_name_prefix(TEST_PREFIX "1", strlen(TEST_PREFIX "1"));
+	ast_channel_cleanup(found);
+	if (!found || strncmp(ast_channel_name(found), TEST_PREFIX "1", strlen(TEST_PREFIX "1"))) {
+		ast_test_status_update(test, "Failed to find a channel by name prefix\n");
+		goto cleanup;
+	}
+
+	/* Names that match no channel fall back to unique IDs */
+	for (i = 0; i < TEST_CHANNELS; ++i) {
+		found = ast_channel_get_by_name(ast_channel_uniqueid(chans[i]));
+		ast_channel_cleanup(found);
+		if (found != chans[i]) {
+			ast_test_status_update(test, "Failed to find channel %d by unique ID\n", i);
+			goto cleanup;
+		}
+	}
+	ast_copy_string(uniqueid, ast_channel_uniqueid(chans[0]), sizeof(uniqueid));
+	found = ast_channel_get_by_name_prefix(uniqueid, strlen(uniqueid) - 1);
+	ast_channel_cleanup(found);
+	if (!found || strncmp(ast_channel_uniqueid(found), uniqueid, strlen(uniqueid) - 1)) {
+		ast_test_status_update(test, "Failed to find a channel by unique ID prefix\n");
+		goto cleanup;
+	}
+
+	count = count_matches(ast_channel_iterator_by_name_new(TEST_PREFIX, strlen(TEST_PREFIX)));
+	if (count != TEST_CHANNELS) {
+		ast_test_status_update(test, "Prefix iterator found %d channels, expected %d\n",
+			count, TEST_CHANNELS);
+		goto cleanup;
+	}
+
+	count = count_matches(ast_channel_iterator_all_new());
+	if (count != TEST_CHANNELS) {
+		ast_test_status_update(test, "All channels iterator found %d channels, expected %d\n",
+			count, TEST_CHANNELS);
+		goto cleanup;
+	}
+
+	/* Renaming moves the channel within the containers */
+	ast_change_name(other, TEST_PREFIX "renamed");
+	found = ast_channel_get_by_name("TestLookup/other");
+	if (found) {
+		ast_channel_unref(found);
+		ast_test_status_update(test, "Renamed channel found by its old name\n");
+		goto cleanup;
+	}
+	found = ast_channel_get_by_name(TEST_PREFIX "renamed");
+	ast_channel_cleanup(found);
+	if (found != other) {
+		ast_test_status_update(test, "Renamed channel not found by its new name\n");
+		goto cleanup;
+	}
+	count = count_matches(ast_channel_iterator_by_name_new(TEST_PREFIX, strlen(TEST_PREFIX)));
+	if (count != TEST_CHANNELS + 1) {
+		ast_test_status_update(test, "Prefix iterator found %d channels after rename, expected %d\n",
+			count, TEST_CHANNELS + 1);
+		goto cleanup;
+	}
+
+	/* Released channels can no longer be found */
+	ast_channel_release(chans[0]);
+	chans[0] = NULL;
+	found = ast_channel_get_by_name(TEST_PREFIX "0");
+	if (found) {
+		ast_channel_unref(found);
+		ast_test_status_update(test, "Released channel is still found by name\n");
+		goto cleanup;
+	}
+	found = ast_channel_get_by_name(uniqueid);
+	if (found) {
+		ast_channel_unref(found);
+		ast_test_status_update(test, "Released channel is still found by unique ID\n");
+		goto cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+cleanup:
+	for (i = 0; i < TEST_CHANNELS; ++i) {
+		if (chans[i]) {
+			ast_channel_release(chans[i]);
+		}
+	}
+	if (other) {
+		ast_channel_release(other);
+	}
+
+	return res;
+}
+
+/*! \brief Wait on the given channels and check which one, and which fd, is ready */
+static int check_waitfor(struct ast_test *test, struct ast_channel **chans, int n,
+	struct ast_channel *expected, int fdno)
+{
+	struct ast_channel *winner;
+	int ms = expected ? 1000 : 20;
+
+	winner = ast_waitfor_n(chans, n, &ms);
+	if (winner != expected) {
+		ast_test_status_update(test, "Expected %s to be ready, got %s\n",
+			expected ? ast_channel_name(expected) : "nothing",
+			winner ? ast_channel_name(winner) : "nothing");
+		return -1;
+	}
+	if (winner && ast_channel_fdno(winner) != fdno) {
+		ast_test_status_update(test, "Expected fd %d of %s to be ready, got %d\n",
+			fdno, ast_channel_name(winner), ast_channel_fdno(winner));
+		return -1;
+	}
+	return 0;
+}
+
+/*! \brief Read the byte written to a pipe so it is no longer readable */
+static void drain_pipe(int fd)
+{
+	char c;
+
+	if (read(fd, &c, 1) < 0) {
+		/* The next wait will fail the test */
+	}
+}
+
+AST_TEST_DEFINE(channel_waitfor)
+{
+	struct ast_channel *chans[2] = { NULL, };
+	int pipes[3][2] = { { -1, -1 }, { -1, -1 }, { -1, -1 } };
+	int outfd;
+	int ms;
+	int i;
+	enum ast_test_result_state res = AST_TEST_FAIL;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "waitfor";
+		info->category = "/main/channel/";
+		info->summary = "Channel waitfor test";
+		info->description =
+			"Checks that waiting on channels reports the ready channel and fd,\n"
+			"including after a channel's fd is replaced by another with the\n"
+			"same number.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	for (i = 0; i < ARRAY_LEN(chans); ++i) {
+		chans[i] = ast_channel_alloc(0, AST_STATE_DOWN, NULL, NULL, NULL, NULL, NULL,
+			NULL, NULL, 0, "TestWaitfor/%d", i);
+		if (!chans[i]) {
+			ast_test_status_update(test, "Failed to allocate channel %d\n", i);
+			goto cleanup;
+		}
+		ast_channel_unlock(chans[i]);
+	}
+	for (i = 0; i < ARRAY_LEN(pipes); ++i) {
+		if (pipe(pipes[i])) {
+			ast_test_status_update(test, "Failed to create pipe: %s\n", strerror(errno));
+			goto cleanup;
+		}
+	}
+
+	ast_channel_set_fd(chans[0], 0, pipes[0][0]);
+	ast_channel_set_fd(chans[1], 1, pipes[1][0]);
+
+	if (check_waitfor(test, chans, 1, NULL, 0)
+		|| check_waitfor(test, chans, 2, NULL, 0)) {
+		goto cleanup;
+	}
+
+	if (write(pipes[0][1], "x", 1) != 1
+		|| check_waitfor(test, chans, 1, chans[0], 0)) {
+		goto cleanup;
+	}
+	drain_pipe(pipes[0][0]);
+
+	if (write(pipes[1][1], "x", 1) != 1
+		|| check_waitfor(test, chans, 2, chans[1], 1)) {
+		goto cleanup;
+	}
+	drain_pipe(pipes[1][0]);
+
+	/* An fd of its own takes priority over the channels */
+	if (write(pipes[0][1], "x", 1) != 1 || write(pipes[2][1], "x", 1) != 1) {
+		goto cleanup;
+	}
+	ms = 1000;
+	if (ast_waitfor_nandfds(chans, 2, &pipes[2][0], 1, NULL, &outfd, &ms)
+		|| outfd != pipes[2][0]) {
+		ast_test_status_update(test, "Ready fd was not reported\n");
+		goto cleanup;
+	}
+	drain_pipe(pipes[0][0]);
+	drain_pipe(pipes[2][0]);
+
+	/* Replace the fd with a new one that gets the same number */
+	close(pipes[0][0]);
+	close(pipes[0][1]);
+	pipes[0][0] = pipes[0][1] = -1;
+	if (pipe(pipes[0])) {
+		goto cleanup;
+	}
+	ast_channel_set_fd(chans[0], 0, pipes[0][0]);
+	if (write(pipes[0][1], "x", 1) != 1
+		|| check_waitfor(test, chans, 1, chans[0], 0)) {
+		goto cleanup;
+	}
+	drain_pipe(pipes[0][0]);
+
+	/* A removed fd is no longer waited on */
+	ast_channel_set_fd(chans[1], 1, -1);
+	if (write(pipes[1][1], "x", 1) != 1
+		|| check_waitfor(test, chans, 2, NULL, 0)) {
+		goto cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+cleanup:
+	for (i = 0; i < ARRAY_LEN(chans); ++i) {
+		if (chans[i]) {
+			ast_channel_set_fd(chans[i], i, -1);
+			ast_channel_release(chans[i]);
+		}
+	}
+	for (i = 0; i < ARRAY_LEN(pipes); ++i) {
+		if (pipes[i][0] > -1) {
+			close(pipes[i][0]);
+			close(pipes[i][1]);
+		}
+	}
+
+	return res;
+}
+
+static int unload_module(void)
+{
+	AST_TEST_UNREGISTER(channel_lookup);
+	AST_TEST_UNREGISTER(channel_waitfor);
+	return 0;
+}
+
+static int load_module(void)
+{
+	AST_TEST_REGISTER(channel_lookup);
+	AST_TEST_REGISTER(channel_waitfor);
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "Channel container test module");
@@ -290,12 +290,63 @@ AST_TEST_DEFINE(put_get_long)
 	return res;
 }
 
+AST_TEST_DEFINE(gettree_prefix)
+{
+	int res = AST_TEST_PASS;
+	struct ast_db_entry *dbes, *cur;
+	int num_deleted;
+	size_t x;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "gettree_prefix";
+		info->category = "/main/astdb/";
+		info->summary = "ast_db_(gettree|deltree) prefix unit test";
+		info->description =
+			"Ensures that ast_db gettree and deltree only match whole key\n"
+			"components, and see changes that are not yet written to disk";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	ast_db_put("astdbtest", "one", "a");
+	ast_db_put("astdbtest", "one/two", "b");
+	ast_db_put("astdbtest", "onetwo", "c");
+
+	dbes = ast_db_gettree("astdbtest", "one");
+	for (cur = dbes, x = 0; cur; cur = cur->next, x++) {
+		if (strcmp(cur->key, "/astdbtest/one") && strcmp(cur->key, "/astdbtest/one/two")) {
+			ast_test_status_update(test, "ast_db_gettree returned unexpected key %s\n", cur->key);
+			res = AST_TEST_FAIL;
+		}
+	}
+	ast_db_freetree(dbes);
+	if (x != 2) {
+		ast_test_status_update(test, "ast_db_gettree returned %zu entries when we expected 2\n", x);
+		res = AST_TEST_FAIL;
+	}
+
+	if ((num_deleted = ast_db_deltree("astdbtest", "one")) != 2) {
+		ast_test_status_update(test, "Failed to deltree astdbtest/one, expected 2 deletions and got %d\n", num_deleted);
+		res = AST_TEST_FAIL;
+	}
+
+	if ((num_deleted = ast_db_deltree("astdbtest", NULL)) != 1) {
+		ast_test_status_update(test, "Failed to deltree astdbtest, expected 1 deletion and got %d\n", num_deleted);
+		res = AST_TEST_FAIL;
+	}
+
+	return res;
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(put_get_del);
 	AST_TEST_UNREGISTER(gettree_deltree);
 	AST_TEST_UNREGISTER(perftest);
 	AST_TEST_UNREGISTER(put_get_long);
+	AST_TEST_UNREGISTER(gettree_prefix);
 	return 0;
 }
 
@@ -305,6 +356,7 @@ static int load_module(void)
 	AST_TEST_REGISTER(gettree_deltree);
 	AST_TEST_REGISTER(perftest);
 	AST_TEST_REGISTER(put_get_long);
+	AST_TEST_REGISTER(gettree_prefix);
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
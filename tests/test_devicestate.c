@@ -286,8 +286,12 @@ static void device_state_cb(void *data, struct stasis_subscription *sub, struct
 	ast_mutex_unlock(&update_lock);
 }
 
+/*! \brief Number of times devstate_prov_cb() was asked for a state */
+static int devstate_prov_queries;
+
 static enum ast_device_state devstate_prov_cb(const char *data)
 {
+	ast_atomic_fetchadd_int(&devstate_prov_queries, +1);
 	return current_device_state;
 }
 
@@ -787,6 +791,53 @@ AST_TEST_DEFINE(devstate_changed)
 	return AST_TEST_PASS;
 }
 
+AST_TEST_DEFINE(devstate_queries)
+{
+	int queries;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = __func__;
+		info->category = "/main/devicestate/";
+		info->summary = "Test device states kept from a device state provider";
+		info->description =
+			"This unit test checks that the state a device state provider gives\n"
+			"for a device that is not cached is given again without asking the\n"
+			"provider, until the device changes or the provider goes away. A\n"
+			"device that reports states that must not be cached is always asked.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	current_device_state = AST_DEVICE_BUSY;
+	ast_test_validate(test, ast_devstate_prov_add(DEVSTATE_PROVIDER, devstate_prov_cb) == 0);
+
+	queries = devstate_prov_queries;
+	ast_test_validate(test, ast_device_state(DEVSTATE_PROVIDER ":kept") == AST_DEVICE_BUSY);
+	ast_test_validate(test, ast_device_state(DEVSTATE_PROVIDER ":kept") == AST_DEVICE_BUSY);
+	ast_test_validate(test, devstate_prov_queries == queries + 1);
+
+	/* The provider going away drops what it answered */
+	ast_test_validate(test, ast_devstate_prov_del(DEVSTATE_PROVIDER) == 0);
+	current_device_state = AST_DEVICE_INUSE;
+	ast_test_validate(test, ast_devstate_prov_add(DEVSTATE_PROVIDER, devstate_prov_cb) == 0);
+	ast_test_validate(test, ast_device_state(DEVSTATE_PROVIDER ":kept") == AST_DEVICE_INUSE);
+	ast_test_validate(test, devstate_prov_queries == queries + 2);
+
+	/* Devices that are not cachable are always asked */
+	ast_test_validate(test, ast_devstate_changed_literal(AST_DEVICE_RINGING, AST_DEVSTATE_NOT_CACHABLE, DEVSTATE_PROVIDER ":asked") == 0);
+	queries = devstate_prov_queries;
+	ast_test_validate(test, ast_device_state(DEVSTATE_PROVIDER ":asked") == AST_DEVICE_INUSE);
+	ast_test_validate(test, ast_device_state(DEVSTATE_PROVIDER ":asked") == AST_DEVICE_INUSE);
+	ast_test_validate(test, devstate_prov_queries == queries + 2);
+
+	current_device_state = AST_DEVICE_BUSY;
+	ast_test_validate(test, ast_devstate_prov_del(DEVSTATE_PROVIDER) == 0);
+
+	return AST_TEST_PASS;
+}
+
 AST_TEST_DEFINE(devstate_conversions)
 {
 	switch (cmd) {
@@ -936,6 +987,7 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(devstate_prov_del);
 
 	AST_TEST_UNREGISTER(devstate_changed);
+	AST_TEST_UNREGISTER(devstate_queries);
 	AST_TEST_UNREGISTER(devstate_conversions);
 
 	AST_TEST_UNREGISTER(devstate_channels);
@@ -961,6 +1013,7 @@ static int load_module(void)
 	AST_TEST_REGISTER(devstate_prov_del);
 
 	AST_TEST_REGISTER(devstate_changed);
+	AST_TEST_REGISTER(devstate_queries);
 	AST_TEST_REGISTER(devstate_conversions);
 
 	AST_TEST_REGISTER(devstate_channels);
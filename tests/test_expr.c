@@ -177,15 +177,81 @@ AST_TEST_DEFINE(expr_test)
 	return res;
 }
 
+AST_TEST_DEFINE(expr_cache_test)
+{
+	int res = AST_TEST_PASS, i, j, round, len;
+	struct {
+		char *input;
+		const char *output;
+	} tests[] = {
+		{ "2 + 2", "4" },
+		{ "4 + (2 * 8) ? 3 :: 6", "3" },
+		{ "\"011043567857575\" =~ \"011(..)\"", "04" },
+		{ "FLOOR(4 + 8 / 3)", "6" },
+		{ "-(3 - 5)", "2" },
+		{ "!4 | !0", "1" },
+		{ "", "" },
+		/* Runs deeper than the stack the interpreter normally uses */
+		{ "1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + (1 + 1)))))))))))))))))", "19" },
+		/* Syntax errors are not kept, but must still evaluate the same way */
+		{ "2 +", "0" },
+	};
+	char input[32];
+	char buf[32];
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "expr_cache_test";
+		info->category = "/main/ast_expr/";
+		info->summary = "unit test for reusing compiled expressions";
+		info->description =
+			"Verifies that expressions evaluated again, after they have been\n"
+			"compiled and after they have been replaced by others, give the\n"
+			"same results";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	for (round = 0; round < 3; round++) {
+		for (i = 0; i < ARRAY_LEN(tests); i++) {
+			for (j = 0; j < 2; j++) {
+				memset(buf, 0, sizeof(buf));
+				len = ast_expr(tests[i].input, buf, sizeof(buf), NULL);
+				buf[len] = '\0';
+				if (strcmp(buf, tests[i].output)) {
+					ast_test_status_update(test, "Round %d: expression '%s' evaluated as '%s', but should have evaluated as '%s'\n", round + 1, tests[i].input, buf, tests[i].output);
+					res = AST_TEST_FAIL;
+				}
+			}
+		}
+
+		/* Push the expressions above out of the compiled ones kept */
+		for (i = 0; i < 64; i++) {
+			snprintf(input, sizeof(input), "%d * %d", i, round);
+			len = ast_expr(input, buf, sizeof(buf), NULL);
+			buf[len] = '\0';
+			if (atoi(buf) != i * round) {
+				ast_test_status_update(test, "Expression '%s' evaluated as '%s', but should have evaluated as '%d'\n", input, buf, i * round);
+				res = AST_TEST_FAIL;
+			}
+		}
+	}
+
+	return res;
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(expr_test);
+	AST_TEST_UNREGISTER(expr_cache_test);
 	return 0;
 }
 
 static int load_module(void)
 {
 	AST_TEST_REGISTER(expr_test);
+	AST_TEST_REGISTER(expr_cache_test);
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
@@ -620,6 +620,66 @@ AST_TEST_DEFINE(format_cap_remove_single)
 	return AST_TEST_PASS;
 }
 
+AST_TEST_DEFINE(format_cap_remove_append)
+{
+	RAII_VAR(struct ast_format_cap *, caps, NULL, ao2_cleanup);
+	RAII_VAR(struct ast_codec *, codec, NULL, ao2_cleanup);
+	RAII_VAR(struct ast_format *, format, NULL, ao2_cleanup);
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "format_cap_remove_append";
+		info->category = "/main/format_cap/";
+		info->summary = "format capabilities removal and append unit test";
+		info->description =
+			"Test that a format removed from a format capabilities structure can be added again, once";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	caps = ast_format_cap_alloc(AST_FORMAT_CAP_FLAG_DEFAULT);
+	if (!caps) {
+		ast_test_status_update(test, "Could not allocate an empty format capabilities structure\n");
+		return AST_TEST_FAIL;
+	}
+
+	codec = ast_codec_get("ulaw", AST_MEDIA_TYPE_AUDIO, 8000);
+	if (!codec) {
+		ast_test_status_update(test, "Could not retrieve built-in ulaw codec\n");
+		return AST_TEST_FAIL;
+	}
+
+	format = ast_format_create(codec);
+	if (!format) {
+		ast_test_status_update(test, "Could not create format using built-in codec\n");
+		return AST_TEST_FAIL;
+	}
+
+	if (ast_format_cap_append(caps, format, 42)) {
+		ast_test_status_update(test, "Could not add newly created format to capabilities structure\n");
+		return AST_TEST_FAIL;
+	} else if (ast_format_cap_remove(caps, format)) {
+		ast_test_status_update(test, "Could not remove format that was just added to capabilities structure\n");
+		return AST_TEST_FAIL;
+	} else if (ast_format_cap_append(caps, format, 20)) {
+		ast_test_status_update(test, "Could not add removed format back to capabilities structure\n");
+		return AST_TEST_FAIL;
+	} else if (ast_format_cap_append(caps, format, 30)) {
+		ast_test_status_update(test, "Adding a format a second time failed\n");
+		return AST_TEST_FAIL;
+	} else if (ast_format_cap_count(caps) != 1) {
+		ast_test_status_update(test, "Capabilities structure should contain one format but instead it contains '%zu'\n",
+			ast_format_cap_count(caps));
+		return AST_TEST_FAIL;
+	} else if (ast_format_cap_get_format_framing(caps, format) != 20) {
+		ast_test_status_update(test, "Capabilities structure should have the framing of the first append after removal\n");
+		return AST_TEST_FAIL;
+	}
+
+	return AST_TEST_PASS;
+}
+
 AST_TEST_DEFINE(format_cap_remove_multiple)
 {
 	RAII_VAR(struct ast_format_cap *, caps, NULL, ao2_cleanup);
@@ -1436,6 +1496,7 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(format_cap_append_from_cap_duplicate);
 	AST_TEST_UNREGISTER(format_cap_set_framing);
 	AST_TEST_UNREGISTER(format_cap_remove_single);
+	AST_TEST_UNREGISTER(format_cap_remove_append);
 	AST_TEST_UNREGISTER(format_cap_remove_multiple);
 	AST_TEST_UNREGISTER(format_cap_remove_bytype);
 	AST_TEST_UNREGISTER(format_cap_remove_all);
@@ -1461,6 +1522,7 @@ static int load_module(void)
 	AST_TEST_REGISTER(format_cap_append_from_cap_duplicate);
 	AST_TEST_REGISTER(format_cap_set_framing);
 	AST_TEST_REGISTER(format_cap_remove_single);
+	AST_TEST_REGISTER(format_cap_remove_append);
 	AST_TEST_REGISTER(format_cap_remove_multiple);
 	AST_TEST_REGISTER(format_cap_remove_bytype);
 	AST_TEST_REGISTER(format_cap_remove_all);
@@ -0,0 +1,140 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Frame tests
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/test.h"
+#include "asterisk/module.h"
+#include "asterisk/frame.h"
+#include "asterisk/format_cache.h"
+
+#define TEST_SAMPLES 160
+
+AST_TEST_DEFINE(frame_share)
+{
+	int16_t buf[TEST_SAMPLES];
+	int16_t expected[TEST_SAMPLES];
+	struct ast_frame f = {
+		.frametype = AST_FRAME_VOICE,
+		.datalen = sizeof(buf),
+		.samples = TEST_SAMPLES,
+		.data.ptr = buf,
+		.src = "test_frame",
+	};
+	struct ast_frame *first = NULL;
+	struct ast_frame *second = NULL;
+	enum ast_test_result_state res = AST_TEST_FAIL;
+	int i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "share";
+		info->category = "/main/frame/";
+		info->summary = "Shared frame payload test";
+		info->description =
+			"Checks that frames created with ast_frame_share() reference a\n"
+			"single payload and that modifying one of them gives it a copy.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	for (i = 0; i < TEST_SAMPLES; ++i) {
+		buf[i] = i * 100;
+	}
+	memcpy(expected, buf, sizeof(buf));
+	f.subclass.format = ast_format_slin;
+
+	first = ast_frame_share(&f);
+	second = first ? ast_frame_share(first) : NULL;
+	if (!first || !second) {
+		ast_test_status_update(test, "Failed to share frame\n");
+		goto cleanup;
+	}
+
+	if (first->data.ptr == f.data.ptr || memcmp(first->data.ptr, buf, sizeof(buf))
+		|| strcmp(first->src, f.src)) {
+		ast_test_status_update(test, "First shared frame is not a copy of the original\n");
+		goto cleanup;
+	}
+	if (second == first || second->data.ptr != first->data.ptr || second->src != first->src) {
+		ast_test_status_update(test, "Second shared frame does not reference the same payload\n");
+		goto cleanup;
+	}
+
+	/* Modifying the second frame must not change the first */
+	if (ast_frame_adjust_volume(second, 2)) {
+		ast_test_status_update(test, "Failed to adjust volume of shared frame\n");
+		goto cleanup;
+	}
+	if (second->data.ptr == first->data.ptr || (second->mallocd & AST_MALLOCD_SHARED)) {
+		ast_test_status_update(test, "Modified frame still shares its payload\n");
+		goto cleanup;
+	}
+	if (memcmp(first->data.ptr, expected, sizeof(expected))) {
+		ast_test_status_update(test, "Modifying one shared frame changed another\n");
+		goto cleanup;
+	}
+	if (((int16_t *) second->data.ptr)[1] != expected[1] * 2) {
+		ast_test_status_update(test, "Modified frame has the wrong data\n");
+		goto cleanup;
+	}
+
+	/* Isolating a shared frame gives it its own copy of everything */
+	if (ast_frisolate(first) != first || (first->mallocd & AST_MALLOCD_SHARED)
+		|| !(first->mallocd & AST_MALLOCD_DATA) || !(first->mallocd & AST_MALLOCD_SRC)
+		|| memcmp(first->data.ptr, expected, sizeof(expected))) {
+		ast_test_status_update(test, "Isolating a shared frame failed\n");
+		goto cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+cleanup:
+	if (first) {
+		ast_frfree(first);
+	}
+	if (second) {
+		ast_frfree(second);
+	}
+
+	return res;
+}
+
+static int unload_module(void)
+{
+	AST_TEST_UNREGISTER(frame_share);
+	return 0;
+}
+
+static int load_module(void)
+{
+	AST_TEST_REGISTER(frame_share);
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "Frame test module");
@@ -0,0 +1,263 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief G.711 buffer conversion tests
+ *
+ * Every conversion backend the CPU supports is run against the per-sample
+ * macros for every possible input and the results must match exactly.
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/test.h"
+#include "asterisk/module.h"
+#include "asterisk/cli.h"
+#include "asterisk/utils.h"
+#include "asterisk/time.h"
+#include "asterisk/ulaw.h"
+#include "asterisk/alaw.h"
+#include "asterisk/g711.h"
+
+/*! Every signed linear value */
+#define LINEAR_SAMPLES 65536
+/*! Every G.711 value, plus an odd tail */
+#define LAW_SAMPLES (256 + 7)
+
+static const char *backend_names[] = { "scalar", "sse2", "avx2" };
+
+static int check_backend(struct ast_test *test, const char *backend)
+{
+	int16_t *linear;
+	int16_t decoded[LAW_SAMPLES];
+	unsigned char law[LAW_SAMPLES];
+	unsigned char *encoded;
+	size_t offset;
+	size_t samples;
+	size_t i;
+	int res = -1;
+
+	linear = ast_malloc(LINEAR_SAMPLES * sizeof(*linear));
+	encoded = ast_malloc(LINEAR_SAMPLES);
+	if (!linear || !encoded) {
+		goto cleanup;
+	}
+
+	for (i = 0; i < LINEAR_SAMPLES; ++i) {
+		linear[i] = (int16_t) (i - 32768);
+	}
+	for (i = 0; i < LAW_SAMPLES; ++i) {
+		law[i] = i;
+	}
+
+	/* Odd offsets make sure unaligned data and lengths that are not a
+	 * multiple of the vector width are handled. */
+	for (offset = 0; offset < 3; ++offset) {
+		samples = LINEAR_SAMPLES - offset;
+
+		ast_lin2mu_buf(encoded, linear + offset, samples);
+		for (i = 0; i < samples; ++i) {
+			if (encoded[i] != AST_LIN2MU(linear[offset + i])) {
+				ast_test_status_update(test, "%s mu-law encode of %d: expected %u got %u\n",
+					backend, linear[offset + i], AST_LIN2MU(linear[offset + i]), encoded[i]);
+				goto cleanup;
+			}
+		}
+
+		ast_lin2a_buf(encoded, linear + offset, samples);
+		for (i = 0; i < samples; ++i) {
+			if (encoded[i] != AST_LIN2A(linear[offset + i])) {
+				ast_test_status_update(test, "%s A-law encode of %d: expected %u got %u\n",
+					backend, linear[offset + i], AST_LIN2A(linear[offset + i]), encoded[i]);
+				goto cleanup;
+			}
+		}
+
+		samples = LAW_SAMPLES - offset;
+
+		ast_mulaw_buf(decoded, law + offset, samples);
+		for (i = 0; i < samples; ++i) {
+			if (decoded[i] != AST_MULAW(law[offset + i])) {
+				ast_test_status_update(test, "%s mu-law decode of %u: expected %d got %d\n",
+					backend, law[offset + i], AST_MULAW(law[offset + i]), decoded[i]);
+				goto cleanup;
+			}
+		}
+
+		ast_alaw_buf(decoded, law + offset, samples);
+		for (i = 0; i < samples; ++i) {
+			if (decoded[i] != AST_ALAW(law[offset + i])) {
+				ast_test_status_update(test, "%s A-law decode of %u: expected %d got %d\n",
+					backend, law[offset + i], AST_ALAW(law[offset + i]), decoded[i]);
+				goto cleanup;
+			}
+		}
+	}
+
+	res = 0;
+
+cleanup:
+	ast_free(linear);
+	ast_free(encoded);
+	return res;
+}
+
+AST_TEST_DEFINE(g711_backends)
+{
+	const char *original;
+	int tested = 0;
+	int i;
+	enum ast_test_result_state res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "backends";
+		info->category = "/main/g711/";
+		info->summary = "G.711 conversion backend test";
+		info->description =
+			"Checks that every G.711 conversion backend supported by this\n"
+			"CPU produces results identical to the per-sample macros.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	original = ast_g711_backend();
+
+	for (i = 0; i < ARRAY_LEN(backend_names); ++i) {
+		if (ast_g711_set_backend(backend_names[i])) {
+			ast_test_status_update(test, "Backend '%s' is not available\n", backend_names[i]);
+			continue;
+		}
+		++tested;
+		ast_test_status_update(test, "Testing backend '%s'\n", backend_names[i]);
+		if (check_backend(test, backend_names[i])) {
+			res = AST_TEST_FAIL;
+			break;
+		}
+	}
+
+	ast_g711_set_backend(original);
+
+	if (!tested) {
+		ast_test_status_update(test, "No conversion backends were available\n");
+		res = AST_TEST_FAIL;
+	}
+
+	return res;
+}
+
+static char *handle_cli_g711_bench(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	/* One second of 8kHz audio at a time */
+	int16_t linear[8000];
+	unsigned char law[8000];
+	const char *original;
+	unsigned int seconds;
+	unsigned int s;
+	struct timeval start;
+	int i;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "g711 benchmark";
+		e->usage = ""
+			"Usage: g711 benchmark <seconds>\n"
+			"       Time converting <seconds> of 8kHz audio to and from\n"
+			"       mu-law and A-law with each G.711 conversion backend.\n"
+			"";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args + 1) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (sscanf(a->argv[e->args], "%u", &seconds) != 1) {
+		return CLI_SHOWUSAGE;
+	}
+
+	for (i = 0; i < ARRAY_LEN(linear); ++i) {
+		linear[i] = (int16_t) ast_random();
+	}
+
+	original = ast_g711_backend();
+
+	for (i = 0; i < ARRAY_LEN(backend_names); ++i) {
+		if (ast_g711_set_backend(backend_names[i])) {
+			continue;
+		}
+
+		ast_cli(a->fd, "Backend '%s':\n", backend_names[i]);
+
+		start = ast_tvnow();
+		for (s = 0; s < seconds; ++s) {
+			ast_lin2mu_buf(law, linear, ARRAY_LEN(linear));
+		}
+		ast_cli(a->fd, "  mu-law encode: %" PRIi64 " us\n", ast_tvdiff_us(ast_tvnow(), start));
+
+		start = ast_tvnow();
+		for (s = 0; s < seconds; ++s) {
+			ast_mulaw_buf(linear, law, ARRAY_LEN(law));
+		}
+		ast_cli(a->fd, "  mu-law decode: %" PRIi64 " us\n", ast_tvdiff_us(ast_tvnow(), start));
+
+		start = ast_tvnow();
+		for (s = 0; s < seconds; ++s) {
+			ast_lin2a_buf(law, linear, ARRAY_LEN(linear));
+		}
+		ast_cli(a->fd, "  A-law encode:  %" PRIi64 " us\n", ast_tvdiff_us(ast_tvnow(), start));
+
+		start = ast_tvnow();
+		for (s = 0; s < seconds; ++s) {
+			ast_alaw_buf(linear, law, ARRAY_LEN(law));
+		}
+		ast_cli(a->fd, "  A-law decode:  %" PRIi64 " us\n", ast_tvdiff_us(ast_tvnow(), start));
+	}
+
+	ast_g711_set_backend(original);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_g711[] = {
+	AST_CLI_DEFINE(handle_cli_g711_bench, "Benchmark G.711 conversion backends"),
+};
+
+static int unload_module(void)
+{
+	AST_TEST_UNREGISTER(g711_backends);
+	ast_cli_unregister_multiple(cli_g711, ARRAY_LEN(cli_g711));
+	return 0;
+}
+
+static int load_module(void)
+{
+	AST_TEST_REGISTER(g711_backends);
+	ast_cli_register_multiple(cli_g711, ARRAY_LEN(cli_g711));
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "G.711 conversion test module");
@@ -1699,6 +1699,90 @@ AST_TEST_DEFINE(json_test_cep)
 	return AST_TEST_PASS;
 }
 
+AST_TEST_DEFINE(json_test_writer)
+{
+	RAII_VAR(struct ast_json *, uut, NULL, ast_json_unref);
+	RAII_VAR(struct ast_json *, expected, NULL, ast_json_unref);
+	RAII_VAR(struct ast_str *, buf, NULL, ast_free);
+	struct ast_json_writer writer;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "writer";
+		info->category = CATEGORY;
+		info->summary = "Streamed JSON decodes to the equivalent tree.";
+		info->description = "Test JSON abstraction library.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	expected = ast_json_pack("{s: s, s: i, s: o, s: [s, o], s: {}, s: o}",
+		"string", "quote\" backslash\\ newline\n tab\t \001",
+		"integer", -42,
+		"null", ast_json_null(),
+		"array", "one", ast_json_dialplan_cep("main", NULL, 7),
+		"empty", "caller", ast_json_name_number("Alice", NULL));
+	ast_test_validate(test, expected != NULL);
+
+	/* Twice, as the pretty format has its own separators */
+	buf = ast_str_create(16);
+	ast_test_validate(test, buf != NULL);
+	ast_json_writer_init(&writer, &buf, AST_JSON_COMPACT);
+	ast_json_writer_object_start(&writer);
+	ast_json_writer_key(&writer, "string");
+	ast_json_writer_string(&writer, "quote\" backslash\\ newline\n tab\t \001");
+	ast_json_writer_key(&writer, "integer");
+	ast_json_writer_integer(&writer, -42);
+	ast_json_writer_key(&writer, "null");
+	ast_json_writer_string(&writer, NULL);
+	ast_json_writer_key(&writer, "array");
+	ast_json_writer_array_start(&writer);
+	ast_json_writer_string(&writer, "one");
+	ast_json_writer_dialplan_cep(&writer, "main", NULL, 7);
+	ast_json_writer_array_end(&writer);
+	ast_json_writer_key(&writer, "empty");
+	ast_json_writer_object_start(&writer);
+	ast_json_writer_object_end(&writer);
+	ast_json_writer_key(&writer, "caller");
+	ast_json_writer_name_number(&writer, "Alice", NULL);
+	ast_json_writer_object_end(&writer);
+	ast_test_validate(test, 0 == ast_json_writer_finish(&writer));
+
+	uut = ast_json_load_str(buf, NULL);
+	ast_test_validate(test, ast_json_equal(expected, uut));
+
+	ast_json_unref(uut);
+	ast_str_reset(buf);
+	ast_json_writer_init(&writer, &buf, AST_JSON_PRETTY);
+	ast_json_writer_array_start(&writer);
+	ast_json_writer_value(&writer, expected);
+	ast_json_writer_array_start(&writer);
+	ast_json_writer_array_end(&writer);
+	ast_json_writer_array_end(&writer);
+	ast_test_validate(test, 0 == ast_json_writer_finish(&writer));
+
+	uut = ast_json_load_str(buf, NULL);
+	ast_test_validate(test, ast_json_array_size(uut) == 2);
+	ast_test_validate(test, ast_json_equal(expected, ast_json_array_get(uut, 0)));
+
+	/* Members of an object need keys */
+	ast_str_reset(buf);
+	ast_json_writer_init(&writer, &buf, AST_JSON_COMPACT);
+	ast_json_writer_object_start(&writer);
+	ast_test_validate(test, -1 == ast_json_writer_string(&writer, "keyless"));
+	ast_json_writer_object_end(&writer);
+	ast_test_validate(test, -1 == ast_json_writer_finish(&writer));
+
+	/* Unbalanced */
+	ast_str_reset(buf);
+	ast_json_writer_init(&writer, &buf, AST_JSON_COMPACT);
+	ast_json_writer_array_start(&writer);
+	ast_test_validate(test, -1 == ast_json_writer_finish(&writer));
+
+	return AST_TEST_PASS;
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(json_test_false);
@@ -1752,6 +1836,7 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(json_test_name_number);
 	AST_TEST_UNREGISTER(json_test_timeval);
 	AST_TEST_UNREGISTER(json_test_cep);
+	AST_TEST_UNREGISTER(json_test_writer);
 	return 0;
 }
 
@@ -1808,6 +1893,7 @@ static int load_module(void)
 	AST_TEST_REGISTER(json_test_name_number);
 	AST_TEST_REGISTER(json_test_timeval);
 	AST_TEST_REGISTER(json_test_cep);
+	AST_TEST_REGISTER(json_test_writer);
 
 	ast_test_register_init(CATEGORY, json_test_init);
 	ast_test_register_cleanup(CATEGORY, json_test_cleanup);
@@ -135,16 +135,80 @@ fail:
 	return res;
 }
 
+AST_TEST_DEFINE(named_lock_recycle_test)
+{
+	enum ast_test_result_state res = AST_TEST_FAIL;
+	struct ast_named_lock *lock1 = NULL;
+	struct ast_named_lock *lock2 = NULL;
+	struct ast_named_lock *lock3 = NULL;
+	struct ast_named_lock *lock4 = NULL;
+
+	switch(cmd) {
+	case TEST_INIT:
+		info->name = "named_lock_recycle_test";
+		info->category = "/main/lock/";
+		info->summary = "Named Lock recycling test";
+		info->description =
+			"Tests that handles of a key share a lock while held, and that\n"
+			"released locks are not shared by different keys";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	lock1 = ast_named_lock_get(AST_NAMED_LOCK_TYPE_MUTEX, "lock_test", "recycle_1");
+	ast_test_validate_cleanup(test, lock1 != NULL, res, fail);
+
+	lock2 = ast_named_lock_get(AST_NAMED_LOCK_TYPE_MUTEX, "lock_test", "recycle_1");
+	ast_test_validate_cleanup(test, lock2 == lock1, res, fail);
+
+	ast_named_lock_put(lock2);
+	lock2 = NULL;
+	ast_named_lock_put(lock1);
+	lock1 = NULL;
+
+	/* The released lock may now be recycled for any key */
+	lock3 = ast_named_lock_get(AST_NAMED_LOCK_TYPE_MUTEX, "lock_test", "recycle_2");
+	ast_test_validate_cleanup(test, lock3 != NULL, res, fail);
+
+	lock4 = ast_named_lock_get(AST_NAMED_LOCK_TYPE_MUTEX, "lock_test", "recycle_1");
+	ast_test_validate_cleanup(test, lock4 != NULL && lock4 != lock3, res, fail);
+
+	if (ao2_trylock(lock3)) {
+		ast_test_status_update(test, "ao2_trylock on a recycled lock failed\n");
+		goto fail;
+	}
+	if (ao2_trylock(lock4)) {
+		ast_test_status_update(test, "ao2_trylock on a lock of another key failed\n");
+		ao2_unlock(lock3);
+		goto fail;
+	}
+	ao2_unlock(lock4);
+	ao2_unlock(lock3);
+
+	res = AST_TEST_PASS;
+
+fail:
+
+	ast_named_lock_put(lock1);
+	ast_named_lock_put(lock2);
+	ast_named_lock_put(lock3);
+	ast_named_lock_put(lock4);
+
+	return res;
+}
 
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(named_lock_test);
+	AST_TEST_UNREGISTER(named_lock_recycle_test);
 	return 0;
 }
 
 static int load_module(void)
 {
 	AST_TEST_REGISTER(named_lock_test);
+	AST_TEST_REGISTER(named_lock_recycle_test);
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
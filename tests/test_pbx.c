@@ -35,6 +35,7 @@
 
 ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
+#include "asterisk/channel.h"
 #include "asterisk/module.h"
 #include "asterisk/pbx.h"
 #include "asterisk/test.h"
@@ -191,6 +192,7 @@ AST_TEST_DEFINE(pattern_match_test)
 	enum ast_test_result_state res = AST_TEST_PASS;
 	static const char TEST_PATTERN[] = "test_pattern";
 	static const char TEST_PATTERN_INCLUDE[] = "test_pattern_include";
+	static const char TEST_PATTERN_CID[] = "test_pattern_cid";
 	int i, j;
 
 	/* The array of contexts to register for our test.
@@ -201,6 +203,7 @@ AST_TEST_DEFINE(pattern_match_test)
 	} contexts[] = {
 		{ TEST_PATTERN, },
 		{ TEST_PATTERN_INCLUDE, },
+		{ TEST_PATTERN_CID, },
 	};
 
 	/*
@@ -229,6 +232,11 @@ AST_TEST_DEFINE(pattern_match_test)
 		[0] = { TEST_PATTERN, "_2.", NULL, 1, { 1 } },
 		[1] = { TEST_PATTERN, "2000", NULL, 1, { 1 } },
 		[2] = { TEST_PATTERN_INCLUDE, "2000", NULL, 1, { 2 } },
+		[3] = { TEST_PATTERN, "_3XX", NULL, 2, { 1, 2 } },
+		[4] = { TEST_PATTERN, "300", NULL, 1, { 1 } },
+		[5] = { TEST_PATTERN, "4-00", NULL, 1, { 1 } },
+		[6] = { TEST_PATTERN_CID, "500", NULL, 1, { 1 } },
+		[7] = { TEST_PATTERN_CID, "500", "123", 1, { 1 } },
 	};
 
 	/* This array contains our test material. See the doxygen
@@ -243,6 +251,12 @@ AST_TEST_DEFINE(pattern_match_test)
 		{ TEST_PATTERN, "2000", NULL, 1, &extens[1] },
 		{ TEST_PATTERN, "2000", NULL, 2, &extens[2] },
 		{ TEST_PATTERN_INCLUDE, "2000", NULL, 2, &extens[2] },
+		{ TEST_PATTERN, "300", NULL, 1, &extens[4] },
+		{ TEST_PATTERN, "300", NULL, 2, &extens[3] },
+		{ TEST_PATTERN, "301", NULL, 1, &extens[3] },
+		{ TEST_PATTERN, "400", NULL, 1, &extens[5] },
+		{ TEST_PATTERN, "4-00", NULL, 1, &extens[5] },
+		{ TEST_PATTERN_CID, "500", "123", 1, &extens[7] },
 	};
 
 	switch (cmd) {
@@ -323,6 +337,96 @@ cleanup:
 	return res;
 }
 
+AST_TEST_DEFINE(substitution_test)
+{
+	static const char registrar[] = "test_pbx";
+	static const char TEST_SUBSTITUTION[] = "test_substitution";
+	/* Set() data for each priority, with the variables to substitute */
+	static const char *data[] = {
+		"RESULT=plain",
+		"RESULT=${FOO}",
+		"RESULT=a${FOO}b$c${BAR}$",
+		"RESULT=${FOO:1:3}${FOO:-2}",
+		"RESULT=${${NAME}}${${NAME}:2}",
+		"RESULT=${LEN(${FOO})}",
+		"RESULT=$[1 + 2]$[${NUM} * $[${NUM} + 1]]",
+		"RESULT=${IF($[${NUM} > 2]?${FOO}:${BAR})}",
+		"RESULT=${UNSET}-${FOO",
+		"RESULT=$[${NUM} + 1",
+	};
+	struct ast_channel *chan;
+	char expected[256];
+	const char *result;
+	int found;
+	int i;
+	enum ast_test_result_state res = AST_TEST_FAIL;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "substitution_test";
+		info->category = "/main/pbx/";
+		info->summary = "Test variable substitution in application data";
+		info->description = "Execute priorities whose data has variables, functions and\n"
+			"expressions in it, and check that they are substituted the same way\n"
+			"pbx_substitute_variables_helper() substitutes them.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	chan = ast_channel_alloc(0, AST_STATE_DOWN, NULL, NULL, NULL, NULL, NULL,
+		NULL, NULL, 0, "TestSubstitution/1");
+	if (!chan) {
+		ast_test_status_update(test, "Failed to allocate channel\n");
+		return AST_TEST_FAIL;
+	}
+	ast_channel_unlock(chan);
+
+	pbx_builtin_setvar_helper(chan, "FOO", "foobar");
+	pbx_builtin_setvar_helper(chan, "BAR", "baz");
+	pbx_builtin_setvar_helper(chan, "NAME", "FOO");
+	pbx_builtin_setvar_helper(chan, "NUM", "3");
+
+	if (!ast_context_find_or_create(NULL, NULL, TEST_SUBSTITUTION, registrar)) {
+		ast_test_status_update(test, "Failed to create context %s\n", TEST_SUBSTITUTION);
+		goto cleanup;
+	}
+	for (i = 0; i < ARRAY_LEN(data); ++i) {
+		if (ast_add_extension(TEST_SUBSTITUTION, 0, "s", i + 1, NULL, NULL, "Set",
+				(void *) data[i], NULL, registrar)) {
+			ast_test_status_update(test, "Failed to add priority %d\n", i + 1);
+			goto cleanup;
+		}
+	}
+
+	for (i = 0; i < ARRAY_LEN(data); ++i) {
+		pbx_builtin_setvar_helper(chan, "RESULT", NULL);
+		if (ast_spawn_extension(chan, TEST_SUBSTITUTION, "s", i + 1, NULL, &found, 0) || !found) {
+			ast_test_status_update(test, "Failed to execute priority %d\n", i + 1);
+			goto cleanup;
+		}
+
+		pbx_substitute_variables_helper(chan, data[i], expected, sizeof(expected) - 1);
+		ast_channel_lock(chan);
+		result = pbx_builtin_getvar_helper(chan, "RESULT");
+		if (strcmp(S_OR(result, ""), expected + strlen("RESULT="))) {
+			ast_test_status_update(test, "'%s' substituted to '%s', expected '%s'\n",
+				data[i], S_OR(result, ""), expected + strlen("RESULT="));
+			ast_channel_unlock(chan);
+			goto cleanup;
+		}
+		ast_channel_unlock(chan);
+	}
+
+	res = AST_TEST_PASS;
+
+cleanup:
+	ast_context_destroy(NULL, registrar);
+	ast_channel_release(chan);
+
+	return res;
+}
+
 AST_TEST_DEFINE(segv)
 {
 	switch (cmd) {
@@ -347,12 +451,14 @@ static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(segv);
 	AST_TEST_UNREGISTER(pattern_match_test);
+	AST_TEST_UNREGISTER(substitution_test);
 	return 0;
 }
 
 static int load_module(void)
 {
 	AST_TEST_REGISTER(pattern_match_test);
+	AST_TEST_REGISTER(substitution_test);
 	AST_TEST_REGISTER(segv);
 	return AST_MODULE_LOAD_SUCCESS;
 }
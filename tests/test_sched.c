@@ -106,26 +106,20 @@ static int sched_order_8_cb(const void *data)
 	return 0;
 }
 
-AST_TEST_DEFINE(sched_test_order)
+static const char *sched_type_name(enum ast_sched_type type)
+{
+	return type == AST_SCHED_TYPE_WHEEL ? "wheel" : "heap";
+}
+
+static enum ast_test_result_state sched_test_order_type(struct ast_test *test, enum ast_sched_type type)
 {
 	struct ast_sched_context *con;
 	enum ast_test_result_state res = AST_TEST_FAIL;
 	int id1, id2, id3, wait;
 
-	switch (cmd) {
-	case TEST_INIT:
-		info->name = "sched_test_order";
-		info->category = "/main/sched/";
-		info->summary = "Test ordering of events in the scheduler API";
-		info->description =
-			"This test ensures that events are properly ordered by the "
-			"time they are scheduled to execute in the scheduler API.";
-		return AST_TEST_NOT_RUN;
-	case TEST_EXECUTE:
-		break;
-	}
+	ast_test_status_update(test, "Testing %s scheduler context\n", sched_type_name(type));
 
-	if (!(con = ast_sched_context_create())) {
+	if (!(con = ast_sched_context_create_type(type))) {
 		ast_test_status_update(test,
 				"Test failed - could not create scheduler context\n");
 		return AST_TEST_FAIL;
@@ -264,77 +258,128 @@ return_cleanup:
 	return res;
 }
 
-static char *handle_cli_sched_bench(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+AST_TEST_DEFINE(sched_test_order)
 {
-	struct ast_sched_context *con;
-	struct timeval start;
-	unsigned int num, i;
-	int *sched_ids = NULL;
-
 	switch (cmd) {
-	case CLI_INIT:
-		e->command = "sched benchmark";
-		e->usage = ""
-			"Usage: sched benchmark <num>\n"
-			"";
-		return NULL;
-	case CLI_GENERATE:
-		return NULL;
+	case TEST_INIT:
+		info->name = "sched_test_order";
+		info->category = "/main/sched/";
+		info->summary = "Test ordering of events in the scheduler API";
+		info->description =
+			"This test ensures that events are properly ordered by the "
+			"time they are scheduled to execute in the scheduler API, "
+			"for every type of scheduler context.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
 	}
 
-	if (a->argc != e->args + 1) {
-		return CLI_SHOWUSAGE;
+	if (sched_test_order_type(test, AST_SCHED_TYPE_HEAP) != AST_TEST_PASS
+		|| sched_test_order_type(test, AST_SCHED_TYPE_WHEEL) != AST_TEST_PASS) {
+		return AST_TEST_FAIL;
 	}
 
-	if (sscanf(a->argv[e->args], "%u", &num) != 1) {
-		return CLI_SHOWUSAGE;
-	}
+	return AST_TEST_PASS;
+}
 
-	if (!(con = ast_sched_context_create())) {
-		ast_cli(a->fd, "Test failed - could not create scheduler context\n");
-		return CLI_FAILURE;
-	}
+static void sched_bench_type(int fd, enum ast_sched_type type, unsigned int num, int *sched_ids)
+{
+	struct ast_sched_context *con;
+	struct timeval start;
+	unsigned int i;
 
-	if (!(sched_ids = ast_malloc(sizeof(*sched_ids) * num))) {
-		ast_cli(a->fd, "Test failed - memory allocation failure\n");
-		goto return_cleanup;
+	if (!(con = ast_sched_context_create_type(type))) {
+		ast_cli(fd, "Test failed - could not create %s scheduler context\n", sched_type_name(type));
+		return;
 	}
 
-	ast_cli(a->fd, "Testing ast_sched_add() performance - timing how long it takes "
-			"to add %u entries at random time intervals from 0 to 60 seconds\n", num);
+	ast_cli(fd, "Testing %s ast_sched_add() performance - timing how long it takes "
+			"to add %u entries at random time intervals from 0 to 60 seconds\n",
+			sched_type_name(type), num);
 
 	start = ast_tvnow();
 
 	for (i = 0; i < num; i++) {
 		long when = labs(ast_random()) % 60000;
 		if ((sched_ids[i] = ast_sched_add(con, when, sched_cb, NULL)) == -1) {
-			ast_cli(a->fd, "Test failed - sched_add returned -1\n");
+			ast_cli(fd, "Test failed - sched_add returned -1\n");
 			goto return_cleanup;
 		}
 	}
 
-	ast_cli(a->fd, "Test complete - %" PRIi64 " us\n", ast_tvdiff_us(ast_tvnow(), start));
+	ast_cli(fd, "Test complete - %" PRIi64 " us\n", ast_tvdiff_us(ast_tvnow(), start));
 
-	ast_cli(a->fd, "Testing ast_sched_del() performance - timing how long it takes "
-			"to delete %u entries with random time intervals from 0 to 60 seconds\n", num);
+	ast_cli(fd, "Testing %s ast_sched_replace() performance - timing how long it takes "
+			"to reschedule %u entries at random time intervals from 0 to 60 seconds\n",
+			sched_type_name(type), num);
+
+	start = ast_tvnow();
+
+	for (i = 0; i < num; i++) {
+		long when = labs(ast_random()) % 60000;
+		if ((sched_ids[i] = ast_sched_replace(sched_ids[i], con, when, sched_cb, NULL)) == -1) {
+			ast_cli(fd, "Test failed - sched_replace returned -1\n");
+			goto return_cleanup;
+		}
+	}
+
+	ast_cli(fd, "Test complete - %" PRIi64 " us\n", ast_tvdiff_us(ast_tvnow(), start));
+
+	ast_cli(fd, "Testing %s ast_sched_del() performance - timing how long it takes "
+			"to delete %u entries with random time intervals from 0 to 60 seconds\n",
+			sched_type_name(type), num);
 
 	start = ast_tvnow();
 
 	for (i = 0; i < num; i++) {
 		if (ast_sched_del(con, sched_ids[i]) == -1) {
-			ast_cli(a->fd, "Test failed - sched_del returned -1\n");
+			ast_cli(fd, "Test failed - sched_del returned -1\n");
 			goto return_cleanup;
 		}
 	}
 
-	ast_cli(a->fd, "Test complete - %" PRIi64 " us\n", ast_tvdiff_us(ast_tvnow(), start));
+	ast_cli(fd, "Test complete - %" PRIi64 " us\n", ast_tvdiff_us(ast_tvnow(), start));
 
 return_cleanup:
 	ast_sched_context_destroy(con);
-	if (sched_ids) {
-		ast_free(sched_ids);
+}
+
+static char *handle_cli_sched_bench(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	unsigned int num;
+	int *sched_ids = NULL;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "sched benchmark";
+		e->usage = ""
+			"Usage: sched benchmark <num>\n"
+			"       Time adding, rescheduling and deleting <num> entries\n"
+			"       on each type of scheduler context.\n"
+			"";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args + 1) {
+		return CLI_SHOWUSAGE;
 	}
 
+	if (sscanf(a->argv[e->args], "%u", &num) != 1) {
+		return CLI_SHOWUSAGE;
+	}
+
+	if (!(sched_ids = ast_malloc(sizeof(*sched_ids) * num))) {
+		ast_cli(a->fd, "Test failed - memory allocation failure\n");
+		return CLI_FAILURE;
+	}
+
+	sched_bench_type(a->fd, AST_SCHED_TYPE_HEAP, num, sched_ids);
+	sched_bench_type(a->fd, AST_SCHED_TYPE_WHEEL, num, sched_ids);
+
+	ast_free(sched_ids);
+
 	return CLI_SUCCESS;
 }
 
@@ -0,0 +1,197 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Signed linear mixing primitive tests
+ *
+ * Every mixing backend the CPU supports is run against the per-sample
+ * helpers from utils.h and the results must match bit for bit.
+ */
+
+/*** MODULEINFO
+	<depend>TEST_FRAMEWORK</depend>
+	<support_level>core</support_level>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/test.h"
+#include "asterisk/module.h"
+#include "asterisk/utils.h"
+#include "asterisk/slinmix.h"
+
+/*! Large enough for a 20ms 48kHz frame plus some odd tail samples */
+#define TEST_SAMPLES 967
+
+static const char *backend_names[] = { "scalar", "sse2", "avx2", "neon" };
+
+/*! \brief Fill a buffer with random audio, biased towards the clipping points */
+static void fill_random(int16_t *buf, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; ++i) {
+		switch (ast_random() % 8) {
+		case 0:
+			buf[i] = 32767;
+			break;
+		case 1:
+			buf[i] = -32768;
+			break;
+		default:
+			buf[i] = (int16_t) ast_random();
+			break;
+		}
+	}
+}
+
+static int compare(struct ast_test *test, const char *backend, const char *op,
+	size_t offset, const int16_t *expected, const int16_t *actual, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; ++i) {
+		if (expected[i] != actual[i]) {
+			ast_test_status_update(test, "%s %s at offset %zu differs at sample %zu: expected %d got %d\n",
+				backend, op, offset, i, expected[i], actual[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int check_backend(struct ast_test *test, const char *backend)
+{
+	int16_t a[TEST_SAMPLES + 1];
+	int16_t b[TEST_SAMPLES + 1];
+	int16_t expected[TEST_SAMPLES + 1];
+	int16_t actual[TEST_SAMPLES + 1];
+	static const int volumes[] = { 1, 2, 3, 4, 7, 16, -1, -2, -3, -4, -16, 0 };
+	size_t offset;
+	size_t samples;
+	size_t i;
+	int v;
+
+	/* Use an odd offset into the buffers to make sure unaligned data and
+	 * lengths that are not a multiple of the vector width are handled. */
+	for (offset = 0; offset < 2; ++offset) {
+		samples = TEST_SAMPLES - offset;
+
+		fill_random(a, ARRAY_LEN(a));
+		fill_random(b, ARRAY_LEN(b));
+
+		memcpy(expected, a, sizeof(a));
+		for (i = 0; i < samples; ++i) {
+			ast_slinear_saturated_add(&expected[offset + i], &b[offset + i]);
+		}
+		memcpy(actual, a, sizeof(a));
+		ast_slinear_saturated_add_buf(actual + offset, b + offset, samples);
+		if (compare(test, backend, "add", offset, expected, actual, ARRAY_LEN(a))) {
+			return -1;
+		}
+
+		memcpy(expected, a, sizeof(a));
+		for (i = 0; i < samples; ++i) {
+			ast_slinear_saturated_subtract(&expected[offset + i], &b[offset + i]);
+		}
+		memcpy(actual, a, sizeof(a));
+		ast_slinear_saturated_subtract_buf(actual + offset, b + offset, samples);
+		if (compare(test, backend, "subtract", offset, expected, actual, ARRAY_LEN(a))) {
+			return -1;
+		}
+
+		for (v = 0; v < ARRAY_LEN(volumes); ++v) {
+			short adjust_value = abs(volumes[v]);
+
+			memcpy(expected, a, sizeof(a));
+			for (i = 0; i < samples; ++i) {
+				if (volumes[v] > 0) {
+					ast_slinear_saturated_multiply(&expected[offset + i], &adjust_value);
+				} else if (volumes[v] < 0) {
+					ast_slinear_saturated_divide(&expected[offset + i], &adjust_value);
+				}
+			}
+			memcpy(actual, a, sizeof(a));
+			ast_slinear_adjust_volume_buf(actual + offset, volumes[v], samples);
+			if (compare(test, backend, "volume", offset, expected, actual, ARRAY_LEN(a))) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+AST_TEST_DEFINE(slinmix_backends)
+{
+	const char *original;
+	int tested = 0;
+	int i;
+	enum ast_test_result_state res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "backends";
+		info->category = "/main/slinmix/";
+		info->summary = "Signed linear mixing backend test";
+		info->description =
+			"Checks that every signed linear mixing backend supported by\n"
+			"this CPU produces results identical to the scalar helpers.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	original = ast_slinmix_backend();
+
+	for (i = 0; i < ARRAY_LEN(backend_names); ++i) {
+		if (ast_slinmix_set_backend(backend_names[i])) {
+			ast_test_status_update(test, "Backend '%s' is not available\n", backend_names[i]);
+			continue;
+		}
+		++tested;
+		ast_test_status_update(test, "Testing backend '%s'\n", backend_names[i]);
+		if (check_backend(test, backend_names[i])) {
+			res = AST_TEST_FAIL;
+			break;
+		}
+	}
+
+	ast_slinmix_set_backend(original);
+
+	if (!tested) {
+		ast_test_status_update(test, "No mixing backends were available\n");
+		res = AST_TEST_FAIL;
+	}
+
+	return res;
+}
+
+static int unload_module(void)
+{
+	AST_TEST_UNREGISTER(slinmix_backends);
+	return 0;
+}
+
+static int load_module(void)
+{
+	AST_TEST_REGISTER(slinmix_backends);
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "Signed linear mixing test module");
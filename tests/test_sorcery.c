@@ -1982,6 +1982,110 @@ AST_TEST_DEFINE(object_retrieve_multiple_field)
 	return AST_TEST_PASS;
 }
 
+AST_TEST_DEFINE(object_field_index)
+{
+	RAII_VAR(struct ast_sorcery *, sorcery, NULL, ast_sorcery_unref);
+	RAII_VAR(struct ast_sorcery_index *, index, NULL, ao2_cleanup);
+	RAII_VAR(struct test_sorcery_object *, obj1, NULL, ao2_cleanup);
+	RAII_VAR(struct test_sorcery_object *, obj2, NULL, ao2_cleanup);
+	RAII_VAR(struct ast_variable *, objset1, ast_variable_new("bob", "alpha", ""), ast_variables_destroy);
+	RAII_VAR(struct ast_variable *, objset2, ast_variable_new("bob", "beta", ""), ast_variables_destroy);
+	RAII_VAR(struct ast_variable *, fields, NULL, ast_variables_destroy);
+	RAII_VAR(struct ao2_container *, candidates, NULL, ao2_cleanup);
+	struct test_sorcery_object *found;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "object_field_index";
+		info->category = "/main/sorcery/";
+		info->summary = "sorcery object field index unit test";
+		info->description =
+			"Test finding objects by the value of an indexed field";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!objset1 || !objset2) {
+		ast_test_status_update(test, "Failed to create object sets\n");
+		return AST_TEST_FAIL;
+	}
+
+	if (!(sorcery = alloc_and_initialize_sorcery())) {
+		ast_test_status_update(test, "Failed to open sorcery structure\n");
+		return AST_TEST_FAIL;
+	}
+
+	if ((index = ast_sorcery_index_alloc(sorcery, "test"))) {
+		ast_test_status_update(test, "Allocated an index for a type without indexed fields\n");
+		return AST_TEST_FAIL;
+	}
+
+	if (ast_sorcery_object_field_index(sorcery, "test", "bob")) {
+		ast_test_status_update(test, "Failed to index a registered field\n");
+		return AST_TEST_FAIL;
+	} else if (!ast_sorcery_object_field_index(sorcery, "test", "nobody")) {
+		ast_test_status_update(test, "Indexed a field that was not registered\n");
+		return AST_TEST_FAIL;
+	}
+
+	if (!(index = ast_sorcery_index_alloc(sorcery, "test"))) {
+		ast_test_status_update(test, "Failed to allocate an index\n");
+		return AST_TEST_FAIL;
+	}
+
+	if (!(obj1 = ast_sorcery_alloc(sorcery, "test", "one")) ||
+		!(obj2 = ast_sorcery_alloc(sorcery, "test", "two"))) {
+		ast_test_status_update(test, "Failed to allocate objects\n");
+		return AST_TEST_FAIL;
+	}
+
+	if (ast_sorcery_index_link(index, obj1, objset1) || ast_sorcery_index_link(index, obj2, objset2)) {
+		ast_test_status_update(test, "Failed to add objects to the index\n");
+		return AST_TEST_FAIL;
+	}
+
+	if (!(fields = ast_variable_new("bob", "alpha", ""))) {
+		ast_test_status_update(test, "Failed to create fields\n");
+		return AST_TEST_FAIL;
+	} else if (!(candidates = ast_sorcery_index_find(index, fields))) {
+		ast_test_status_update(test, "Failed to find objects by an indexed field\n");
+		return AST_TEST_FAIL;
+	} else if (ao2_container_count(candidates) != 1) {
+		ast_test_status_update(test, "Found %d objects by an indexed field when there should be one\n",
+			ao2_container_count(candidates));
+		return AST_TEST_FAIL;
+	} else if (!(found = ao2_callback(candidates, 0, ao2_match_by_addr, obj1))) {
+		ast_test_status_update(test, "Found the wrong object by an indexed field\n");
+		return AST_TEST_FAIL;
+	}
+	ao2_ref(found, -1);
+	ao2_ref(candidates, -1);
+
+	ast_sorcery_index_unlink(index, obj1, objset1);
+	if (!(candidates = ast_sorcery_index_find(index, fields))) {
+		ast_test_status_update(test, "Failed to find objects by an indexed field\n");
+		return AST_TEST_FAIL;
+	} else if (ao2_container_count(candidates)) {
+		ast_test_status_update(test, "Found an object that was removed from the index\n");
+		return AST_TEST_FAIL;
+	}
+	ao2_ref(candidates, -1);
+	candidates = NULL;
+	ast_variables_destroy(fields);
+
+	/* Operators can not be answered by the index */
+	if (!(fields = ast_variable_new("bob LIKE", "%a%", ""))) {
+		ast_test_status_update(test, "Failed to create fields\n");
+		return AST_TEST_FAIL;
+	} else if ((candidates = ast_sorcery_index_find(index, fields))) {
+		ast_test_status_update(test, "Used the index for a field with an operator\n");
+		return AST_TEST_FAIL;
+	}
+
+	return AST_TEST_PASS;
+}
+
 AST_TEST_DEFINE(object_retrieve_regex)
 {
 	RAII_VAR(struct ast_sorcery *, sorcery, NULL, ast_sorcery_unref);
@@ -3500,6 +3604,7 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(object_retrieve_field);
 	AST_TEST_UNREGISTER(object_retrieve_multiple_all);
 	AST_TEST_UNREGISTER(object_retrieve_multiple_field);
+	AST_TEST_UNREGISTER(object_field_index);
 	AST_TEST_UNREGISTER(object_retrieve_regex);
 	AST_TEST_UNREGISTER(object_update);
 	AST_TEST_UNREGISTER(object_update_uncreated);
@@ -3556,6 +3661,7 @@ static int load_module(void)
 	AST_TEST_REGISTER(object_retrieve_field);
 	AST_TEST_REGISTER(object_retrieve_multiple_all);
 	AST_TEST_REGISTER(object_retrieve_multiple_field);
+	AST_TEST_REGISTER(object_field_index);
 	AST_TEST_REGISTER(object_retrieve_regex);
 	AST_TEST_REGISTER(object_update);
 	AST_TEST_REGISTER(object_update_uncreated);
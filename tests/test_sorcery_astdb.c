@@ -603,6 +603,130 @@ AST_TEST_DEFINE(object_delete_uncreated)
 	return AST_TEST_PASS;
 }
 
+/*! \brief Wait for astdb to have, or not have, a key written behind */
+static int wait_for_astdb(const char *family, const char *key, int exists)
+{
+	char value[2];
+	int i;
+
+	for (i = 0; i < 50; ++i) {
+		if ((ast_db_get(family, key, value, sizeof(value)) == 0) == exists) {
+			return 0;
+		}
+		usleep(100000);
+	}
+
+	return -1;
+}
+
+AST_TEST_DEFINE(object_write_behind)
+{
+	RAII_VAR(struct ast_sorcery *, sorcery, NULL, ast_sorcery_unref);
+	RAII_VAR(struct test_sorcery_object *, obj, NULL, ao2_cleanup);
+	RAII_VAR(struct test_sorcery_object *, obj2, NULL, ao2_cleanup);
+	RAII_VAR(struct ao2_container *, objects, NULL, ao2_cleanup);
+	enum ast_test_result_state res = AST_TEST_FAIL;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "object_write_behind";
+		info->category = "/res/sorcery_astdb/";
+		info->summary = "sorcery astdb write behind unit test";
+		info->description =
+			"Test that objects written behind by the astdb wizard can be\n"
+			"retrieved, updated and deleted at once and reach astdb later";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	ast_db_deltree("test_wb/test", NULL);
+
+	if (!(sorcery = ast_sorcery_open())) {
+		ast_test_status_update(test, "Failed to open sorcery structure\n");
+		return AST_TEST_FAIL;
+	}
+
+	if ((ast_sorcery_apply_default(sorcery, "test", "astdb", "test_wb,write_behind=100") != AST_SORCERY_APPLY_SUCCESS) ||
+		ast_sorcery_internal_object_register(sorcery, "test", test_sorcery_object_alloc, NULL, NULL)) {
+		ast_test_status_update(test, "Failed to register object type\n");
+		return AST_TEST_FAIL;
+	}
+
+	ast_sorcery_object_field_register_nodoc(sorcery, "test", "bob", "5", OPT_UINT_T, 0, FLDSET(struct test_sorcery_object, bob));
+	ast_sorcery_object_field_register_nodoc(sorcery, "test", "joe", "10", OPT_UINT_T, 0, FLDSET(struct test_sorcery_object, joe));
+
+	if (!(obj = ast_sorcery_alloc(sorcery, "test", "blah-1"))
+		|| !(obj2 = ast_sorcery_alloc(sorcery, "test", "neener-1"))) {
+		ast_test_status_update(test, "Failed to allocate a known object type\n");
+		return AST_TEST_FAIL;
+	}
+
+	if (ast_sorcery_create(sorcery, obj) || ast_sorcery_create(sorcery, obj2)) {
+		ast_test_status_update(test, "Failed to create objects using astdb wizard\n");
+		goto cleanup;
+	}
+
+	obj->bob = 1000;
+	if (ast_sorcery_update(sorcery, obj)) {
+		ast_test_status_update(test, "Failed to update object before it was written\n");
+		goto cleanup;
+	}
+
+	ao2_cleanup(obj);
+	if (!(obj = ast_sorcery_retrieve_by_id(sorcery, "test", "blah-1"))) {
+		ast_test_status_update(test, "Failed to retrieve object before it was written\n");
+		goto cleanup;
+	} else if (obj->bob != 1000) {
+		ast_test_status_update(test, "Object retrieved is not the updated object\n");
+		goto cleanup;
+	}
+
+	if (!(objects = ast_sorcery_retrieve_by_regex(sorcery, "test", "^blah-"))
+		|| ao2_container_count(objects) != 1) {
+		ast_test_status_update(test, "Failed to retrieve objects by regex before they were written\n");
+		goto cleanup;
+	}
+
+	if (wait_for_astdb("test_wb/test", "blah-1", 1)
+		|| wait_for_astdb("test_wb/test", "neener-1", 1)) {
+		ast_test_status_update(test, "Objects were never written to astdb\n");
+		goto cleanup;
+	}
+
+	if (ast_sorcery_delete(sorcery, obj2)) {
+		ast_test_status_update(test, "Failed to delete object using astdb wizard\n");
+		goto cleanup;
+	}
+	ao2_cleanup(obj2);
+	obj2 = NULL;
+
+	if ((obj2 = ast_sorcery_retrieve_by_id(sorcery, "test", "neener-1"))) {
+		ast_test_status_update(test, "Retrieved deleted object that should not be there\n");
+		goto cleanup;
+	}
+
+	if (wait_for_astdb("test_wb/test", "neener-1", 0)) {
+		ast_test_status_update(test, "Deleted object was never removed from astdb\n");
+		goto cleanup;
+	}
+
+	res = AST_TEST_PASS;
+
+cleanup:
+	/* The wizard keeps its copy of the objects, so they are removed through it */
+	if (obj) {
+		ast_sorcery_delete(sorcery, obj);
+	}
+	if (obj2) {
+		ast_sorcery_delete(sorcery, obj2);
+	}
+	wait_for_astdb("test_wb/test", "blah-1", 0);
+	wait_for_astdb("test_wb/test", "neener-1", 0);
+
+	return res;
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(object_create);
@@ -615,6 +739,7 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(object_update_uncreated);
 	AST_TEST_UNREGISTER(object_delete);
 	AST_TEST_UNREGISTER(object_delete_uncreated);
+	AST_TEST_UNREGISTER(object_write_behind);
 
 	return 0;
 }
@@ -631,6 +756,7 @@ static int load_module(void)
 	AST_TEST_REGISTER(object_update_uncreated);
 	AST_TEST_REGISTER(object_delete);
 	AST_TEST_REGISTER(object_delete_uncreated);
+	AST_TEST_REGISTER(object_write_behind);
 
 	return AST_MODULE_LOAD_SUCCESS;
 }
@@ -463,6 +463,70 @@ AST_TEST_DEFINE(publish)
 	return AST_TEST_PASS;
 }
 
+AST_TEST_DEFINE(publish_filter)
+{
+	RAII_VAR(struct stasis_topic *, topic, NULL, ao2_cleanup);
+	RAII_VAR(struct stasis_subscription *, uut, NULL, stasis_unsubscribe);
+	RAII_VAR(char *, test_data, NULL, ao2_cleanup);
+	RAII_VAR(struct stasis_message_type *, accepted_type, NULL, ao2_cleanup);
+	RAII_VAR(struct stasis_message_type *, filtered_type, NULL, ao2_cleanup);
+	RAII_VAR(struct stasis_message *, accepted_message, NULL, ao2_cleanup);
+	RAII_VAR(struct stasis_message *, filtered_message, NULL, ao2_cleanup);
+	RAII_VAR(struct consumer *, consumer, NULL, ao2_cleanup);
+	int actual_len;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = __func__;
+		info->category = test_category;
+		info->summary = "Test publishing with a message type filter";
+		info->description = "Test that a subscription only receives the\n"
+			"message types it accepted once its filter is selective.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	topic = stasis_topic_create("TestTopic");
+	ast_test_validate(test, NULL != topic);
+
+	consumer = consumer_create(1);
+	ast_test_validate(test, NULL != consumer);
+
+	uut = stasis_subscribe(topic, consumer_exec, consumer);
+	ast_test_validate(test, NULL != uut);
+	ao2_ref(consumer, +1);
+
+	test_data = ao2_alloc(1, NULL);
+	ast_test_validate(test, NULL != test_data);
+	ast_test_validate(test, stasis_message_type_create("TestAccepted", NULL, &accepted_type) == STASIS_MESSAGE_TYPE_SUCCESS);
+	ast_test_validate(test, stasis_message_type_create("TestFiltered", NULL, &filtered_type) == STASIS_MESSAGE_TYPE_SUCCESS);
+	accepted_message = stasis_message_create(accepted_type, test_data);
+	ast_test_validate(test, NULL != accepted_message);
+	filtered_message = stasis_message_create(filtered_type, test_data);
+	ast_test_validate(test, NULL != filtered_message);
+
+	ast_test_validate(test, 0 == stasis_subscription_accept_message_type(uut, accepted_type));
+	ast_test_validate(test, 0 == stasis_subscription_set_filter(uut, STASIS_SUBSCRIPTION_FILTER_SELECTIVE));
+
+	stasis_publish(topic, filtered_message);
+	stasis_publish(topic, accepted_message);
+
+	actual_len = consumer_should_stay(consumer, 1);
+	ast_test_validate(test, 1 == actual_len);
+	ast_test_validate(test, accepted_message == consumer->messages_rxed[0]);
+
+	/* Without the filter everything is delivered again */
+	ast_test_validate(test, 0 == stasis_subscription_set_filter(uut, STASIS_SUBSCRIPTION_FILTER_NONE));
+	stasis_publish(topic, filtered_message);
+
+	actual_len = consumer_wait_for(consumer, 2);
+	ast_test_validate(test, 2 == actual_len);
+	ast_test_validate(test, filtered_message == consumer->messages_rxed[1]);
+
+	return AST_TEST_PASS;
+}
+
 AST_TEST_DEFINE(publish_sync)
 {
 	RAII_VAR(struct stasis_topic *, topic, NULL, ao2_cleanup);
@@ -1237,6 +1301,155 @@ AST_TEST_DEFINE(cache_dump)
 	return AST_TEST_PASS;
 }
 
+#define CACHE_READERS 4
+#define CACHE_READERS_IDS 16
+#define CACHE_READERS_UPDATES 4000
+
+struct cache_reader_data {
+	struct stasis_cache *cache;
+	struct stasis_message_type *type;
+	int done;
+	int errors;
+};
+
+static void *cache_reader(void *obj)
+{
+	struct cache_reader_data *data = obj;
+	struct stasis_message *snapshot;
+	struct ao2_container *dump;
+	struct cache_test_data *test_data;
+	char id[16];
+	int idx = 0;
+
+	while (!ast_atomic_fetchadd_int(&data->done, 0)) {
+		snprintf(id, sizeof(id), "%d", idx % CACHE_READERS_IDS);
+		snapshot = stasis_cache_get(data->cache, data->type, id);
+		if (snapshot) {
+			test_data = stasis_message_data(snapshot);
+			if (strcmp(test_data->id, id)) {
+				ast_atomic_fetchadd_int(&data->errors, +1);
+			}
+			ao2_ref(snapshot, -1);
+		}
+
+		if (!(++idx % CACHE_READERS_IDS)) {
+			dump = stasis_cache_dump(data->cache, data->type);
+			if (!dump || ao2_container_count(dump) > CACHE_READERS_IDS) {
+				ast_atomic_fetchadd_int(&data->errors, +1);
+			}
+			ao2_cleanup(dump);
+		}
+	}
+
+	return NULL;
+}
+
+AST_TEST_DEFINE(cache_readers)
+{
+	RAII_VAR(struct stasis_message_type *, cache_type, NULL, ao2_cleanup);
+	RAII_VAR(struct stasis_topic *, topic, NULL, ao2_cleanup);
+	RAII_VAR(struct stasis_cache *, cache, NULL, ao2_cleanup);
+	RAII_VAR(struct stasis_caching_topic *, caching_topic, NULL, stasis_caching_unsubscribe_and_join);
+	RAII_VAR(struct ao2_container *, cache_dump, NULL, ao2_cleanup);
+	struct cache_reader_data data = { 0, };
+	pthread_t readers[CACHE_READERS];
+	struct stasis_message *message;
+	struct stasis_message *clear;
+	struct cache_test_data *test_data;
+	char id[16];
+	char value[16];
+	int started = 0;
+	int idx;
+	enum ast_test_result_state res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = __func__;
+		info->category = test_category;
+		info->summary = "Test cache lookups while the cache is updated.";
+		info->description = "Test that cache lookups and dumps always see complete\n"
+			"entries while the cache is being updated.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	ast_test_validate(test, stasis_message_type_create("Cacheable", NULL, &cache_type) == STASIS_MESSAGE_TYPE_SUCCESS);
+	ast_test_validate(test, NULL != cache_type);
+	topic = stasis_topic_create("SomeTopic");
+	ast_test_validate(test, NULL != topic);
+	cache = stasis_cache_create(cache_test_data_id);
+	ast_test_validate(test, NULL != cache);
+	caching_topic = stasis_caching_topic_create(topic, cache);
+	ast_test_validate(test, NULL != caching_topic);
+
+	data.cache = cache;
+	data.type = cache_type;
+	for (started = 0; started < CACHE_READERS; ++started) {
+		if (ast_pthread_create(&readers[started], NULL, cache_reader, &data)) {
+			ast_test_status_update(test, "Failed to start reader thread\n");
+			res = AST_TEST_FAIL;
+			break;
+		}
+	}
+
+	/* Update and clear entries, ending with a final value for each */
+	for (idx = 0; res == AST_TEST_PASS && idx < CACHE_READERS_UPDATES + CACHE_READERS_IDS; ++idx) {
+		snprintf(id, sizeof(id), "%d", idx % CACHE_READERS_IDS);
+		snprintf(value, sizeof(value), "%d", idx);
+		message = cache_test_message_create(cache_type, id, value);
+		if (!message) {
+			res = AST_TEST_FAIL;
+			break;
+		}
+		stasis_publish(topic, message);
+		if (idx < CACHE_READERS_UPDATES && !(idx % 3)) {
+			clear = stasis_cache_clear_create(message);
+			if (clear) {
+				stasis_publish(topic, clear);
+				ao2_ref(clear, -1);
+			}
+		}
+		ao2_ref(message, -1);
+	}
+
+	/* Wait for the last update to reach the cache */
+	snprintf(id, sizeof(id), "%d", (idx - 1) % CACHE_READERS_IDS);
+	snprintf(value, sizeof(value), "%d", idx - 1);
+	for (idx = 0; res == AST_TEST_PASS && idx < 1000; ++idx) {
+		message = stasis_cache_get(cache, cache_type, id);
+		test_data = message ? stasis_message_data(message) : NULL;
+		if (test_data && !strcmp(test_data->value, value)) {
+			ao2_ref(message, -1);
+			break;
+		}
+		ao2_cleanup(message);
+		usleep(10000);
+	}
+	if (idx == 1000) {
+		ast_test_status_update(test, "Timed out waiting for the cache\n");
+		res = AST_TEST_FAIL;
+	}
+
+	ast_atomic_fetchadd_int(&data.done, +1);
+	while (started--) {
+		pthread_join(readers[started], NULL);
+	}
+
+	if (data.errors) {
+		ast_test_status_update(test, "Readers saw %d inconsistent results\n", data.errors);
+		res = AST_TEST_FAIL;
+	}
+
+	cache_dump = stasis_cache_dump(cache, cache_type);
+	if (res == AST_TEST_PASS && (!cache_dump || ao2_container_count(cache_dump) != CACHE_READERS_IDS)) {
+		ast_test_status_update(test, "Cache does not hold every entry\n");
+		res = AST_TEST_FAIL;
+	}
+
+	return res;
+}
+
 AST_TEST_DEFINE(cache_eid_aggregate)
 {
 	RAII_VAR(struct stasis_message_type *, cache_type, NULL, ao2_cleanup);
@@ -2053,12 +2266,14 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(subscription_pool_messages);
 	AST_TEST_UNREGISTER(publish);
 	AST_TEST_UNREGISTER(publish_sync);
+	AST_TEST_UNREGISTER(publish_filter);
 	AST_TEST_UNREGISTER(publish_pool);
 	AST_TEST_UNREGISTER(unsubscribe_stops_messages);
 	AST_TEST_UNREGISTER(forward);
 	AST_TEST_UNREGISTER(cache_filter);
 	AST_TEST_UNREGISTER(cache);
 	AST_TEST_UNREGISTER(cache_dump);
+	AST_TEST_UNREGISTER(cache_readers);
 	AST_TEST_UNREGISTER(cache_eid_aggregate);
 	AST_TEST_UNREGISTER(router);
 	AST_TEST_UNREGISTER(router_pool);
@@ -2082,12 +2297,14 @@ static int load_module(void)
 	AST_TEST_REGISTER(subscription_pool_messages);
 	AST_TEST_REGISTER(publish);
 	AST_TEST_REGISTER(publish_sync);
+	AST_TEST_REGISTER(publish_filter);
 	AST_TEST_REGISTER(publish_pool);
 	AST_TEST_REGISTER(unsubscribe_stops_messages);
 	AST_TEST_REGISTER(forward);
 	AST_TEST_REGISTER(cache_filter);
 	AST_TEST_REGISTER(cache);
 	AST_TEST_REGISTER(cache_dump);
+	AST_TEST_REGISTER(cache_readers);
 	AST_TEST_REGISTER(cache_eid_aggregate);
 	AST_TEST_REGISTER(router);
 	AST_TEST_REGISTER(router_pool);
@@ -305,6 +305,47 @@ AST_TEST_DEFINE(channel_snapshot_json)
 	return AST_TEST_PASS;
 }
 
+AST_TEST_DEFINE(channel_snapshot_segments)
+{
+	RAII_VAR(struct ast_channel *, chan, NULL, safe_channel_release);
+	RAII_VAR(struct ast_channel_snapshot *, first, NULL, ao2_cleanup);
+	RAII_VAR(struct ast_channel_snapshot *, second, NULL, ao2_cleanup);
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = __func__;
+		info->category = test_category;
+		info->summary = "Test sharing of unchanged channel snapshot strings";
+		info->description = "Test that consecutive snapshots of a channel share the\n"
+			"strings that have not changed and copy the ones that have.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	chan = ast_channel_alloc(0, AST_STATE_DOWN, "cid_num", "cid_name", "acctcode", "exten", "context", NULL, NULL, 0, "TEST/name");
+	ast_test_validate(test, NULL != chan);
+	first = ast_channel_snapshot_create(chan);
+	ast_channel_context_set(chan, "other");
+	second = ast_channel_snapshot_create(chan);
+	ast_channel_unlock(chan);
+	ast_test_validate(test, NULL != first);
+	ast_test_validate(test, NULL != second);
+
+	/* The dialplan changed, nothing else did */
+	ast_test_validate(test, 0 == strcmp("context", first->context));
+	ast_test_validate(test, 0 == strcmp("other", second->context));
+	ast_test_validate(test, first->exten != second->exten);
+	ast_test_validate(test, 0 == strcmp(first->exten, second->exten));
+	ast_test_validate(test, first->name == second->name);
+	ast_test_validate(test, first->accountcode == second->accountcode);
+	ast_test_validate(test, first->caller_name == second->caller_name);
+	ast_test_validate(test, first->connected_name == second->connected_name);
+	ast_test_validate(test, first->hangupsource == second->hangupsource);
+
+	return AST_TEST_PASS;
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(channel_blob_create);
@@ -312,6 +353,7 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(multi_channel_blob_create);
 	AST_TEST_UNREGISTER(multi_channel_blob_snapshots);
 	AST_TEST_UNREGISTER(channel_snapshot_json);
+	AST_TEST_UNREGISTER(channel_snapshot_segments);
 
 	return 0;
 }
@@ -323,6 +365,7 @@ static int load_module(void)
 	AST_TEST_REGISTER(multi_channel_blob_create);
 	AST_TEST_REGISTER(multi_channel_blob_snapshots);
 	AST_TEST_REGISTER(channel_snapshot_json);
+	AST_TEST_REGISTER(channel_snapshot_segments);
 
 	return AST_MODULE_LOAD_SUCCESS;
 }
@@ -585,6 +585,107 @@ AST_TEST_DEFINE(strings_match)
 	return AST_TEST_PASS;
 }
 
+/*! \brief Whether the literal prefix of regex is expected */
+static int regex_prefix_is(const char *regex, const char *expected)
+{
+	char prefix[strlen(regex) + 1];
+
+	return !ast_regex_literal_prefix(regex, prefix) && !strcmp(prefix, expected);
+}
+
+AST_TEST_DEFINE(regex_literal_prefix_test)
+{
+	char prefix[4];
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "regex_literal_prefix";
+		info->category = "/main/strings/";
+		info->summary = "Test ast_regex_literal_prefix";
+		info->description = "Test the literal prefix found for extended regular expressions";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	ast_test_validate(test, regex_prefix_is("", ""));
+	ast_test_validate(test, regex_prefix_is("abc", ""));
+	ast_test_validate(test, regex_prefix_is("^", ""));
+	ast_test_validate(test, regex_prefix_is("^abc", "abc"));
+	ast_test_validate(test, regex_prefix_is("^abc$", "abc"));
+	ast_test_validate(test, regex_prefix_is("^abc.*", "abc"));
+	ast_test_validate(test, regex_prefix_is("^abc*", "ab"));
+	ast_test_validate(test, regex_prefix_is("^abc?d", "ab"));
+	ast_test_validate(test, regex_prefix_is("^abc{2}", "ab"));
+	ast_test_validate(test, regex_prefix_is("^abc+", "abc"));
+	ast_test_validate(test, regex_prefix_is("^ab[cd]", "ab"));
+	ast_test_validate(test, regex_prefix_is("^ab(cd)", "ab"));
+	ast_test_validate(test, regex_prefix_is("^a\\.b", "a.b"));
+	ast_test_validate(test, regex_prefix_is("^a\\.?b", "a"));
+	ast_test_validate(test, regex_prefix_is("^a\\wb", "a"));
+	ast_test_validate(test, regex_prefix_is("^abc|^def", ""));
+	ast_test_validate(test, ast_regex_literal_prefix("^ab\\", prefix) == -1);
+
+	return AST_TEST_PASS;
+}
+
+AST_TEST_DEFINE(scratch_test)
+{
+	struct ast_str *bufs[10] = { NULL, };
+	struct ast_str *buf;
+	unsigned int mark;
+	int i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "scratch";
+		info->category = "/main/strings/";
+		info->summary = "Test ast_str_scratch_get";
+		info->description = "Test that scratch strings are handed out empty, reused, and taken back";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	mark = ast_str_scratch_mark();
+
+	/* More than there are, the last ones being ordinary strings */
+	for (i = 0; i < ARRAY_LEN(bufs); i++) {
+		bufs[i] = ast_str_scratch_get(32);
+		ast_test_validate(test, bufs[i] != NULL);
+		ast_test_validate(test, ast_str_strlen(bufs[i]) == 0);
+		ast_test_validate(test, ast_str_size(bufs[i]) >= 32);
+		ast_test_validate(test, ast_str_set(&bufs[i], 0, "scratch %d", i) > 0);
+	}
+	for (i = 0; i < ARRAY_LEN(bufs); i++) {
+		ast_test_validate(test, !strncmp(ast_str_buffer(bufs[i]), "scratch ", 8));
+		ast_test_validate(test, atoi(ast_str_buffer(bufs[i]) + 8) == i);
+		ast_str_scratch_release(bufs[i]);
+	}
+	ast_test_validate(test, ast_str_scratch_mark() == mark);
+
+	/* A string grown while handed out is given back at its new size */
+	buf = ast_str_scratch_get(16);
+	ast_test_validate(test, buf != NULL);
+	for (i = 0; i < 100; i++) {
+		ast_str_append(&buf, 0, "%s", "0123456789");
+	}
+	ast_test_validate(test, ast_str_strlen(buf) == 1000);
+	ast_str_scratch_release(buf);
+
+	buf = ast_str_scratch_get(1000);
+	ast_test_validate(test, buf != NULL);
+	ast_test_validate(test, ast_str_strlen(buf) == 0);
+	ast_test_validate(test, ast_str_size(buf) >= 1000);
+
+	/* Reclaiming takes back what was not released */
+	ast_test_validate(test, ast_str_scratch_mark() != mark);
+	ast_str_scratch_reclaim(mark);
+	ast_test_validate(test, ast_str_scratch_mark() == mark);
+
+	return AST_TEST_PASS;
+}
+
 static int unload_module(void)
 {
 	AST_TEST_UNREGISTER(str_test);
@@ -594,6 +695,8 @@ static int unload_module(void)
 	AST_TEST_UNREGISTER(escape_semicolons_test);
 	AST_TEST_UNREGISTER(escape_test);
 	AST_TEST_UNREGISTER(strings_match);
+	AST_TEST_UNREGISTER(regex_literal_prefix_test);
+	AST_TEST_UNREGISTER(scratch_test);
 	return 0;
 }
 
@@ -606,6 +709,8 @@ static int load_module(void)
 	AST_TEST_REGISTER(escape_semicolons_test);
 	AST_TEST_REGISTER(escape_test);
 	AST_TEST_REGISTER(strings_match);
+	AST_TEST_REGISTER(regex_literal_prefix_test);
+	AST_TEST_REGISTER(scratch_test);
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
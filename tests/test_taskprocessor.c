@@ -35,6 +35,7 @@
 #include "asterisk/taskprocessor.h"
 #include "asterisk/module.h"
 #include "asterisk/astobj2.h"
+#include "asterisk/options.h"
 
 /*!
  * \brief userdata associated with baseline taskprocessor test
@@ -274,6 +275,150 @@ test_end:
 	return res;
 }
 
+#define LOCKFREE_PRODUCERS 4
+#define LOCKFREE_TASKS_PER_PRODUCER 5000
+
+/*!
+ * \brief Relevant data associated with the lock-free taskprocessor test
+ */
+static struct lockfree_task_data {
+	/*! Condition used to indicate all tasks have executed */
+	ast_cond_t cond;
+	/*! Lock used to protect the condition */
+	ast_mutex_t lock;
+	/*! Counter of the number of completed tasks */
+	int tasks_completed;
+	/*! Number of tasks that executed out of order */
+	int out_of_order;
+	/*! Next expected sequence number for each producer */
+	int next_seq[LOCKFREE_PRODUCERS];
+	/*! Storage for task-specific data, the producer and its sequence number */
+	int task_data[LOCKFREE_PRODUCERS][LOCKFREE_TASKS_PER_PRODUCER];
+	/*! Taskprocessor the producers push to */
+	struct ast_taskprocessor *tps;
+} lockfree_results;
+
+static int lockfree_task(void *data)
+{
+	int *seq = data;
+	int producer = (seq - &lockfree_results.task_data[0][0]) / LOCKFREE_TASKS_PER_PRODUCER;
+
+	/* Only the taskprocessor thread touches next_seq */
+	if (*seq != lockfree_results.next_seq[producer]++) {
+		++lockfree_results.out_of_order;
+	}
+
+	ast_mutex_lock(&lockfree_results.lock);
+	if (++lockfree_results.tasks_completed == LOCKFREE_PRODUCERS * LOCKFREE_TASKS_PER_PRODUCER) {
+		ast_cond_signal(&lockfree_results.cond);
+	}
+	ast_mutex_unlock(&lockfree_results.lock);
+	return 0;
+}
+
+static void *lockfree_producer(void *data)
+{
+	int *seqs = data;
+	int i;
+
+	for (i = 0; i < LOCKFREE_TASKS_PER_PRODUCER; ++i) {
+		seqs[i] = i;
+		ast_taskprocessor_push(lockfree_results.tps, lockfree_task, &seqs[i]);
+	}
+	return NULL;
+}
+
+/*!
+ * \brief Load test for a taskprocessor using the lock-free queue
+ *
+ * Several threads push tasks at the same time.  Every task must run and the
+ * tasks from each producer must run in the order that producer queued them.
+ */
+AST_TEST_DEFINE(lockfree_taskprocessor_load)
+{
+	pthread_t producers[LOCKFREE_PRODUCERS];
+	struct timeval start;
+	struct timespec ts;
+	enum ast_test_result_state res = AST_TEST_PASS;
+	int old_option;
+	int i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "lockfree_taskprocessor_load";
+		info->category = "/main/taskprocessor/";
+		info->summary = "Load test of lock-free taskprocessor queue";
+		info->description =
+			"Ensure that tasks pushed concurrently from several threads to a\n"
+			"taskprocessor using the lock-free queue are all executed in order.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	/* The queue type is chosen when the taskprocessor is created. */
+	old_option = ast_option_lockfree_taskprocessors;
+	ast_option_lockfree_taskprocessors = 1;
+	lockfree_results.tps = ast_taskprocessor_get("test_lockfree", TPS_REF_DEFAULT);
+	ast_option_lockfree_taskprocessors = old_option;
+
+	if (!lockfree_results.tps) {
+		ast_test_status_update(test, "Unable to create test taskprocessor\n");
+		return AST_TEST_FAIL;
+	}
+
+	ast_cond_init(&lockfree_results.cond, NULL);
+	ast_mutex_init(&lockfree_results.lock);
+	lockfree_results.tasks_completed = 0;
+	lockfree_results.out_of_order = 0;
+	memset(lockfree_results.next_seq, 0, sizeof(lockfree_results.next_seq));
+
+	for (i = 0; i < LOCKFREE_PRODUCERS; ++i) {
+		if (ast_pthread_create(&producers[i], NULL, lockfree_producer, lockfree_results.task_data[i])) {
+			producers[i] = AST_PTHREADT_NULL;
+			ast_test_status_update(test, "Unable to create producer thread\n");
+			res = AST_TEST_FAIL;
+		}
+	}
+	for (i = 0; i < LOCKFREE_PRODUCERS; ++i) {
+		if (producers[i] != AST_PTHREADT_NULL) {
+			pthread_join(producers[i], NULL);
+		}
+	}
+	if (res == AST_TEST_FAIL) {
+		goto test_end;
+	}
+
+	start = ast_tvnow();
+	ts.tv_sec = start.tv_sec + 60;
+	ts.tv_nsec = start.tv_usec * 1000;
+
+	ast_mutex_lock(&lockfree_results.lock);
+	while (lockfree_results.tasks_completed < LOCKFREE_PRODUCERS * LOCKFREE_TASKS_PER_PRODUCER) {
+		if (ast_cond_timedwait(&lockfree_results.cond, &lockfree_results.lock, &ts) == ETIMEDOUT) {
+			break;
+		}
+	}
+	ast_mutex_unlock(&lockfree_results.lock);
+
+	if (lockfree_results.tasks_completed != LOCKFREE_PRODUCERS * LOCKFREE_TASKS_PER_PRODUCER) {
+		ast_test_status_update(test, "Unexpected number of tasks executed. Expected %d but got %d\n",
+			LOCKFREE_PRODUCERS * LOCKFREE_TASKS_PER_PRODUCER, lockfree_results.tasks_completed);
+		res = AST_TEST_FAIL;
+	} else if (lockfree_results.out_of_order) {
+		ast_test_status_update(test, "%d queued tasks did not execute in order\n",
+			lockfree_results.out_of_order);
+		res = AST_TEST_FAIL;
+	}
+
+test_end:
+	/* Any tasks still queued are discarded, they only reference static data. */
+	lockfree_results.tps = ast_taskprocessor_unreference(lockfree_results.tps);
+	ast_mutex_destroy(&lockfree_results.lock);
+	ast_cond_destroy(&lockfree_results.cond);
+	return res;
+}
+
 /*!
  * \brief Private data for the test taskprocessor listener
  */
@@ -390,6 +535,107 @@ static int check_stats(struct ast_test *test, const struct test_listener_pvt *pv
 	return 0;
 }
 
+static int batch_test_task(void *data)
+{
+	int *executed = data;
+
+	++*executed;
+	return 0;
+}
+
+/*!
+ * \brief Test for executing batches of tasks from a taskprocessor.
+ *
+ * This test pushes tasks to a taskprocessor with a custom listener and executes them
+ * in batches, ensuring that the batch limit is honored and that the listener is told
+ * the queue emptied only once the last task has run.
+ */
+AST_TEST_DEFINE(taskprocessor_execute_batch)
+{
+	struct ast_taskprocessor *tps = NULL;
+	struct ast_taskprocessor_listener *listener = NULL;
+	struct test_listener_pvt *pvt = NULL;
+	enum ast_test_result_state res = AST_TEST_PASS;
+	int executed = 0;
+	int more;
+	int i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "taskprocessor_execute_batch";
+		info->category = "/main/taskprocessor/";
+		info->summary = "Test of executing taskprocessor tasks in batches";
+		info->description =
+			"Ensures that batches execute at most the requested number of tasks\n"
+			"and that listener callbacks are called when expected.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	pvt = test_listener_pvt_alloc();
+	if (!pvt) {
+		ast_test_status_update(test, "Unable to allocate test taskprocessor listener user data\n");
+		return AST_TEST_FAIL;
+	}
+
+	listener = ast_taskprocessor_listener_alloc(&test_callbacks, pvt);
+	if (!listener) {
+		ast_test_status_update(test, "Unable to allocate test taskprocessor listener\n");
+		res = AST_TEST_FAIL;
+		goto test_exit;
+	}
+
+	tps = ast_taskprocessor_create_with_listener("test_batch", listener);
+	if (!tps) {
+		ast_test_status_update(test, "Unable to allocate test taskprocessor\n");
+		res = AST_TEST_FAIL;
+		goto test_exit;
+	}
+
+	for (i = 0; i < 5; ++i) {
+		ast_taskprocessor_push(tps, batch_test_task, &executed);
+	}
+
+	more = ast_taskprocessor_execute_batch(tps, 3, 0);
+	if (!more || executed != 3 || ast_taskprocessor_size(tps) != 2) {
+		ast_test_status_update(test, "First batch executed %d tasks leaving %ld, expected 3 leaving 2\n",
+			executed, ast_taskprocessor_size(tps));
+		res = AST_TEST_FAIL;
+		goto test_exit;
+	}
+
+	if (check_stats(test, pvt, 5, 0, 1) < 0) {
+		res = AST_TEST_FAIL;
+		goto test_exit;
+	}
+
+	more = ast_taskprocessor_execute_batch(tps, 0, 0);
+	if (more || executed != 5) {
+		ast_test_status_update(test, "Second batch left tasks behind, %d of 5 executed\n", executed);
+		res = AST_TEST_FAIL;
+		goto test_exit;
+	}
+
+	if (check_stats(test, pvt, 5, 1, 1) < 0) {
+		res = AST_TEST_FAIL;
+		goto test_exit;
+	}
+
+	if (ast_taskprocessor_execute_batch(tps, 0, 0) || executed != 5) {
+		ast_test_status_update(test, "Batch on an empty taskprocessor did something\n");
+		res = AST_TEST_FAIL;
+		goto test_exit;
+	}
+
+test_exit:
+	ao2_cleanup(listener);
+	/* This is safe even if tps is NULL */
+	ast_taskprocessor_unreference(tps);
+	ast_free(pvt);
+	return res;
+}
+
 /*!
  * \brief Test for a taskprocessor with custom listener.
  *
@@ -727,13 +973,91 @@ AST_TEST_DEFINE(taskprocessor_push_local)
 	return AST_TEST_PASS;
 }
 
+/*! \brief Number of tasks executed for the test_times callsite */
+static uint64_t callsite_count(void)
+{
+	struct ast_taskprocessor_callsite_times times[512];
+	int count;
+	int i;
+
+	count = ast_taskprocessor_callsite_times_get(times, ARRAY_LEN(times));
+	for (i = 0; i < count; ++i) {
+		if (!strcmp(times[i].callsite, "test_times")) {
+			return times[i].count;
+		}
+	}
+	return 0;
+}
+
+AST_TEST_DEFINE(taskprocessor_times)
+{
+	RAII_VAR(struct ast_taskprocessor *, tps, NULL, ast_taskprocessor_unreference);
+	RAII_VAR(struct task_data *, task_data, NULL, ao2_cleanup);
+	struct ast_taskprocessor_times before;
+	struct ast_taskprocessor_times after;
+	uint64_t callsite_before;
+	int i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "taskprocessor_times";
+		info->category = "/main/taskprocessor/";
+		info->summary = "Test of task time statistics";
+		info->description =
+			"Ensures that executed tasks are counted in the time histograms\n"
+			"and under the callsite they were pushed with.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	tps = ast_taskprocessor_get("test_times", TPS_REF_DEFAULT);
+	task_data = task_data_create();
+	if (!tps || !task_data) {
+		ast_test_status_update(test, "Unable to create test taskprocessor\n");
+		return AST_TEST_FAIL;
+	}
+
+	ast_taskprocessor_times_totals(&before);
+	callsite_before = callsite_count();
+
+	if (__ast_taskprocessor_push(tps, task, task_data, "test_times")
+		|| task_wait(task_data)) {
+		ast_test_status_update(test, "Queued task did not execute!\n");
+		return AST_TEST_FAIL;
+	}
+
+	/* The times are counted just after the task returns */
+	for (i = 0; i < 100 && callsite_count() == callsite_before; ++i) {
+		usleep(10000);
+	}
+
+#ifdef HAVE_GCC_ATOMICS
+	if (callsite_count() != callsite_before + 1) {
+		ast_test_status_update(test, "Task was not counted under its callsite\n");
+		return AST_TEST_FAIL;
+	}
+#endif
+
+	ast_taskprocessor_times_totals(&after);
+	if (after.count <= before.count) {
+		ast_test_status_update(test, "Task was not counted in the totals\n");
+		return AST_TEST_FAIL;
+	}
+
+	return AST_TEST_PASS;
+}
+
 static int unload_module(void)
 {
 	ast_test_unregister(default_taskprocessor);
 	ast_test_unregister(default_taskprocessor_load);
+	ast_test_unregister(lockfree_taskprocessor_load);
 	ast_test_unregister(taskprocessor_listener);
+	ast_test_unregister(taskprocessor_execute_batch);
 	ast_test_unregister(taskprocessor_shutdown);
 	ast_test_unregister(taskprocessor_push_local);
+	ast_test_unregister(taskprocessor_times);
 	return 0;
 }
 
@@ -741,9 +1065,12 @@ static int load_module(void)
 {
 	ast_test_register(default_taskprocessor);
 	ast_test_register(default_taskprocessor_load);
+	ast_test_register(lockfree_taskprocessor_load);
 	ast_test_register(taskprocessor_listener);
+	ast_test_register(taskprocessor_execute_batch);
 	ast_test_register(taskprocessor_shutdown);
 	ast_test_register(taskprocessor_push_local);
+	ast_test_register(taskprocessor_times);
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
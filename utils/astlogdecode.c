@@ -0,0 +1,235 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2017, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Decode binary log files written by "binary:" logger channels
+ *
+ * Records are printed either in the format of a regular log file or as one
+ * JSON object per line.
+ */
+
+/*** MODULEINFO
+	<support_level>extended</support_level>
+ ***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asterisk/logger_binary.h"
+
+static int json_output;
+static const char *date_format = "%b %e %T";
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-j] [-d <dateformat>] <file> [<file> ...]\n"
+		"  -j  Print each record as a JSON object on its own line\n"
+		"  -d  strftime(3) format of the date of text output (default \"%%b %%e %%T\")\n",
+		name);
+}
+
+/*! \brief Print a string as a JSON string, escaping it as needed */
+static void print_json_string(const char *str, size_t len)
+{
+	size_t i;
+
+	putchar('"');
+	for (i = 0; i < len; i++) {
+		unsigned char c = str[i];
+
+		switch (c) {
+		case '"':
+			fputs("\\\"", stdout);
+			break;
+		case '\\':
+			fputs("\\\\", stdout);
+			break;
+		case '\n':
+			fputs("\\n", stdout);
+			break;
+		case '\r':
+			fputs("\\r", stdout);
+			break;
+		case '\t':
+			fputs("\\t", stdout);
+			break;
+		default:
+			if (c < 0x20) {
+				printf("\\u%04x", c);
+			} else {
+				putchar(c);
+			}
+		}
+	}
+	putchar('"');
+}
+
+static void print_record(const struct ast_logger_binary_record *record, const char *strings)
+{
+	const char *file = strings;
+	const char *function = file + record->file_len;
+	const char *level_name = function + record->function_len;
+	const char *message = level_name + record->level_name_len;
+	size_t message_len = record->message_len;
+
+	if (json_output) {
+		/* The trailing newline is part of the line, not of the message */
+		if (message_len && message[message_len - 1] == '\n') {
+			message_len--;
+		}
+		printf("{\"time\":%lld.%06u,\"level\":", (long long) record->tv_sec, record->tv_usec);
+		print_json_string(level_name, record->level_name_len);
+		printf(",\"lwp\":%d,", record->lwp);
+		if (record->callid) {
+			printf("\"callid\":\"C-%08x\",", record->callid);
+		}
+		fputs("\"file\":", stdout);
+		print_json_string(file, record->file_len);
+		printf(",\"line\":%d,\"function\":", record->line);
+		print_json_string(function, record->function_len);
+		fputs(",\"message\":", stdout);
+		print_json_string(message, message_len);
+		fputs("}\n", stdout);
+	} else {
+		char date[256];
+		char callid[16] = "";
+		time_t when = record->tv_sec;
+		struct tm tm;
+
+		localtime_r(&when, &tm);
+		strftime(date, sizeof(date), date_format, &tm);
+		if (record->callid) {
+			snprintf(callid, sizeof(callid), "[C-%08x]", record->callid);
+		}
+		printf("[%s] %.*s[%d]%s %.*s:%d %.*s: %.*s",
+			date, (int) record->level_name_len, level_name, record->lwp, callid,
+			(int) record->file_len, file, record->line,
+			(int) record->function_len, function, (int) message_len, message);
+		if (!message_len || message[message_len - 1] != '\n') {
+			putchar('\n');
+		}
+	}
+}
+
+static int decode_file(const char *filename)
+{
+	struct ast_logger_binary_header header;
+	struct ast_logger_binary_record record;
+	char *strings = NULL;
+	size_t strings_size = 0;
+	long offset;
+	int res = 0;
+	FILE *f;
+
+	if (!(f = fopen(filename, "rb"))) {
+		perror(filename);
+		return -1;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1
+		|| memcmp(header.magic, AST_LOGGER_BINARY_MAGIC, sizeof(header.magic))) {
+		fprintf(stderr, "%s: Not a binary log file\n", filename);
+		fclose(f);
+		return -1;
+	}
+	if (header.version != AST_LOGGER_BINARY_VERSION || header.record_size != sizeof(record)) {
+		fprintf(stderr, "%s: Unsupported binary log version %u\n", filename, header.version);
+		fclose(f);
+		return -1;
+	}
+
+	for (;;) {
+		size_t len;
+
+		offset = ftell(f);
+		if (fread(&record, sizeof(record), 1, f) != 1) {
+			if (!feof(f) || ftell(f) != offset) {
+				fprintf(stderr, "%s: Truncated record at offset %ld\n", filename, offset);
+				res = -1;
+			}
+			break;
+		}
+		if (record.magic != AST_LOGGER_BINARY_RECORD_MAGIC || record.len < sizeof(record)
+			|| record.len != sizeof(record) + record.file_len + record.function_len
+				+ record.level_name_len + record.message_len) {
+			fprintf(stderr, "%s: Corrupt record at offset %ld\n", filename, offset);
+			res = -1;
+			break;
+		}
+
+		len = record.len - sizeof(record);
+		if (len > strings_size) {
+			char *tmp = realloc(strings, len);
+
+			if (!tmp) {
+				fprintf(stderr, "%s: Out of memory\n", filename);
+				res = -1;
+				break;
+			}
+			strings = tmp;
+			strings_size = len;
+		}
+		if (fread(strings, 1, len, f) != len) {
+			fprintf(stderr, "%s: Truncated record at offset %ld\n", filename, offset);
+			res = -1;
+			break;
+		}
+
+		print_record(&record, strings);
+	}
+
+	free(strings);
+	fclose(f);
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	int res = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "jd:h")) != -1) {
+		switch (c) {
+		case 'j':
+			json_output = 1;
+			break;
+		case 'd':
+			date_format = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (; optind < argc; optind++) {
+		if (decode_file(argv[optind])) {
+			res = 1;
+		}
+	}
+
+	return res;
+}
@@ -23,6 +23,8 @@
 #include "asterisk.h"
 ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
+#include <sys/time.h>
+
 #include "asterisk/ast_expr.h"
 
 #define AST_API_MODULE 1
@@ -127,6 +129,7 @@ static int global_expr_max_size=0;
 static int global_expr_tot_size=0;
 static int global_warn_count=0;
 static int global_OK_count=0;
+static long global_eval_usecs=0;
 
 struct varz
 {
@@ -286,6 +289,7 @@ int check_eval(char *buffer, char *error_report)
 	char s[4096];
 	char evalbuf[80000];
 	int result;
+	struct timeval start, end;
 
 	error_report[0] = 0;
 	ep = evalbuf;
@@ -340,7 +344,10 @@ int check_eval(char *buffer, char *error_report)
 	*ep++ = 0;
 
 	/* now, run the test */
+	gettimeofday(&start, NULL);
 	result = ast_expr(evalbuf, s, sizeof(s),NULL);
+	gettimeofday(&end, NULL);
+	global_eval_usecs += (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
 	if (result) {
 		sprintf(error_report,"line %d, evaluation of $[ %s ] result: %s\n", global_lineno, evalbuf, s);
 		return 1;
@@ -432,12 +439,14 @@ void parse_file(const char *fname)
 		}
 		last_char = c1;
 	}
-	printf("Summary:\n  Expressions detected: %d\n  Expressions OK:  %d\n  Total # Warnings:   %d\n  Longest Expr:   %d chars\n  Ave expr len:  %d chars\n",
+	printf("Summary:\n  Expressions detected: %d\n  Expressions OK:  %d\n  Total # Warnings:   %d\n  Longest Expr:   %d chars\n  Ave expr len:  %d chars\n  Evaluation time:  %ld usec\n  Ave eval time:  %ld usec\n",
 		   global_expr_count,
 		   global_OK_count,
 		   global_warn_count,
 		   global_expr_max_size,
-		   (global_expr_count) ? global_expr_tot_size/global_expr_count : 0);
+		   (global_expr_count) ? global_expr_tot_size/global_expr_count : 0,
+		   global_eval_usecs,
+		   (global_expr_count) ? global_eval_usecs/global_expr_count : 0);
 	
 	fclose(f);
 	fclose(l);